@@ -0,0 +1,69 @@
+#pragma once
+// Heap allocations for the end-to-end benchmarks: every operator new of
+// the process, counted between startCountingAllocations() and
+// stopCountingAllocations(). It replaces the global
+// operator new and delete, so include it in one translation unit of a
+// benchmark, never in the library or the tests. Off, the cost is one
+// relaxed load per allocation.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace cw::bench {
+
+	struct AllocationCount
+	{
+		std::uint64_t calls = 0;
+		std::uint64_t bytes = 0;
+	};
+
+	namespace detail {
+		inline std::atomic<bool> countingAllocations = false;
+		inline std::atomic<std::uint64_t> allocationCalls = 0;
+		inline std::atomic<std::uint64_t> allocationBytes = 0;
+
+		inline void* allocate(std::size_t size, std::size_t alignment)
+		{
+			if (countingAllocations.load(std::memory_order_relaxed)) {
+				allocationCalls.fetch_add(1, std::memory_order_relaxed);
+				allocationBytes.fetch_add(size, std::memory_order_relaxed);
+			}
+			if (size == 0) size = 1;
+			void* p = alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__
+				? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+				: std::malloc(size);
+			if (!p) throw std::bad_alloc();
+			return p;
+		}
+	}
+
+	// Zeroes the counts and counts from here
+	inline void startCountingAllocations()
+	{
+		detail::allocationCalls = 0;
+		detail::allocationBytes = 0;
+		detail::countingAllocations = true;
+	}
+
+	inline AllocationCount stopCountingAllocations()
+	{
+		detail::countingAllocations = false;
+		return { detail::allocationCalls.load(), detail::allocationBytes.load() };
+	}
+}
+
+void* operator new(std::size_t size) { return cw::bench::detail::allocate(size, 0); }
+void* operator new[](std::size_t size) { return cw::bench::detail::allocate(size, 0); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return cw::bench::detail::allocate(size, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return cw::bench::detail::allocate(size, static_cast<std::size_t>(alignment)); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
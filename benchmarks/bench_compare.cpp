@@ -0,0 +1,152 @@
+// Compares two benchmark result files and flags regressions, so performance
+// work on Connection and Frame.h cannot silently make things slower.
+//
+//   bench_compare BASELINE.json CONTENDER.json [--threshold=PCT] [--filter=TEXT] [--all]
+//
+// Both files are Google Benchmark JSON: from ./benchmarks with
+// --benchmark_out=FILE --benchmark_out_format=json, or from transfer_bench
+// and scale_bench with --json=FILE. Benchmarks are matched by name and every
+// metric both sides have is compared: real_time, cpu_time and counters are
+// better lower, counters named *_per_second better higher. A metric that is
+// worse by more than --threshold percent (default 5) is a regression.
+// Only changes beyond the threshold are listed unless --all is given.
+//
+// Exit status: 0 no regression, 1 at least one regression, 2 bad usage or an
+// unreadable file. Run the micro benchmarks with --benchmark_repetitions=N
+// on both sides: repetitions are compared by their median, which is far
+// steadier than a single run.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bench_json.h"
+
+using cw::bench::BenchmarkFile;
+using cw::bench::BenchmarkResult;
+
+namespace {
+
+	struct Metric
+	{
+		std::string name;
+		double value;
+	};
+
+	std::vector<Metric> metrics(const BenchmarkResult& result)
+	{
+		std::vector<Metric> all{ { "real_time", result.realTime }, { "cpu_time", result.cpuTime } };
+		for (const auto& [name, value] : result.counters) all.push_back({ name, value });
+		return all;
+	}
+
+	std::optional<double> find(const std::vector<Metric>& all, const std::string& name)
+	{
+		for (const Metric& metric : all) {
+			if (metric.name == name) return metric.value;
+		}
+		return std::nullopt;
+	}
+
+	std::string format(double value)
+	{
+		char text[32];
+		std::snprintf(text, sizeof(text), "%.4g", value);
+		return text;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<std::string> files;
+	double threshold = 5.0;
+	std::string filter;
+	bool all = false;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.starts_with("--threshold=")) threshold = std::stod(arg.substr(12));
+		else if (arg.starts_with("--filter=")) filter = arg.substr(9);
+		else if (arg == "--all") all = true;
+		else if (arg.starts_with("--")) {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return 2;
+		}
+		else files.push_back(arg);
+	}
+	if (files.size() != 2) {
+		std::cerr << "Usage: bench_compare BASELINE.json CONTENDER.json [--threshold=PCT] [--filter=TEXT] [--all]" << std::endl;
+		return 2;
+	}
+
+	BenchmarkFile baseline, contender;
+	try {
+		baseline = cw::bench::readBenchmarkJson(files[0]);
+		contender = cw::bench::readBenchmarkJson(files[1]);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 2;
+	}
+
+	if (baseline.debugBuild || contender.debugBuild) {
+		std::cerr << "Warning: " << (baseline.debugBuild ? files[0] : files[1])
+			<< " comes from a debug build; its timings say little" << std::endl;
+	}
+
+	std::size_t compared = 0, regressions = 0, improvements = 0;
+	std::printf("%-56s %-20s %12s %12s %9s\n", "benchmark", "metric", "baseline", "contender", "change");
+
+	for (const BenchmarkResult& base : baseline.results) {
+		if (!filter.empty() && base.name.find(filter) == std::string::npos) continue;
+
+		auto other = std::find_if(contender.results.begin(), contender.results.end(),
+			[&](const BenchmarkResult& r) { return r.name == base.name; });
+		if (other == contender.results.end()) {
+			std::printf("%-56s missing from %s\n", base.name.c_str(), files[1].c_str());
+			continue;
+		}
+		++compared;
+
+		std::vector<Metric> contenderMetrics = metrics(*other);
+		for (const Metric& metric : metrics(base)) {
+			std::optional<double> value = find(contenderMetrics, metric.name);
+			if (!value || metric.value == 0 || !std::isfinite(metric.value) || !std::isfinite(*value)) continue;
+
+			// Positive 'worse' is a slowdown, whichever way the metric points
+			double change = (*value - metric.value) / std::fabs(metric.value) * 100.0;
+			double worse = cw::bench::higherIsBetter(metric.name) ? -change : change;
+
+			const char* verdict = "";
+			if (worse > threshold) {
+				verdict = "  REGRESSION";
+				++regressions;
+			}
+			else if (worse < -threshold) {
+				verdict = "  improved";
+				++improvements;
+			}
+			else if (!all) {
+				continue;
+			}
+
+			std::printf("%-56s %-20s %12s %12s %+8.1f%%%s\n", base.name.c_str(), metric.name.c_str(),
+				format(metric.value).c_str(), format(*value).c_str(), change, verdict);
+		}
+	}
+
+	for (const BenchmarkResult& result : contender.results) {
+		if (!filter.empty() && result.name.find(filter) == std::string::npos) continue;
+		bool known = std::any_of(baseline.results.begin(), baseline.results.end(),
+			[&](const BenchmarkResult& r) { return r.name == result.name; });
+		if (!known) std::printf("%-56s new in %s\n", result.name.c_str(), files[1].c_str());
+	}
+
+	std::printf("\n%zu benchmarks compared, %zu regressions and %zu improvements beyond %.1f%%\n",
+		compared, regressions, improvements, threshold);
+	return regressions ? 1 : 0;
+}
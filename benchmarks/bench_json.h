@@ -0,0 +1,370 @@
+#pragma once
+// Benchmark results in Google Benchmark's JSON format (what
+// --benchmark_out=FILE --benchmark_out_format=json writes), so the
+// end-to-end benchmarks and the micro benchmarks can be compared by the
+// same tool: bench_compare, or Google Benchmark's own tools/compare.py.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace cw::bench {
+
+	// One benchmark run. Times are in nanoseconds; counters are named the way
+	// Google Benchmark names them ("bytes_per_second", "items_per_second"):
+	// a counter whose name ends in "_per_second" is better higher, any other
+	// is better lower.
+	struct BenchmarkResult
+	{
+		std::string name;
+		std::uint64_t iterations = 1;
+		double realTime = 0;
+		double cpuTime = 0;
+		std::vector<std::pair<std::string, double>> counters;
+	};
+
+	inline bool higherIsBetter(const std::string& metric)
+	{
+		return metric.ends_with("_per_second");
+	}
+
+	namespace detail {
+
+		inline std::string quote(const std::string& text)
+		{
+			std::string out = "\"";
+			for (char c : text) {
+				if (c == '"' || c == '\\') {
+					out += '\\';
+					out += c;
+				}
+				else if (static_cast<unsigned char>(c) < 0x20) {
+					char escaped[8];
+					std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+					out += escaped;
+				}
+				else {
+					out += c;
+				}
+			}
+			return out + "\"";
+		}
+
+		inline std::string number(double value)
+		{
+			char text[32];
+			std::snprintf(text, sizeof(text), "%.17g", value);
+			return text;
+		}
+
+		// Just enough JSON to read back benchmark output
+		struct JsonValue
+		{
+			enum class Kind { Null, Boolean, Number, String, Array, Object };
+			Kind kind = Kind::Null;
+			bool boolean = false;
+			double number = 0;
+			std::string string;
+			std::vector<JsonValue> array;
+			std::vector<std::pair<std::string, JsonValue>> object;
+
+			const JsonValue* find(const std::string& key) const
+			{
+				for (const auto& [name, value] : object) {
+					if (name == key) return &value;
+				}
+				return nullptr;
+			}
+		};
+
+		class JsonParser
+		{
+		public:
+			explicit JsonParser(const std::string& text) : m_text(text) {}
+
+			JsonValue parseDocument()
+			{
+				JsonValue value = parseValue();
+				skipSpace();
+				if (m_pos != m_text.size()) fail("trailing characters");
+				return value;
+			}
+
+		private:
+			[[noreturn]] void fail(const char* what) const
+			{
+				throw std::runtime_error("Invalid JSON at offset " + std::to_string(m_pos) + ": " + what);
+			}
+
+			void skipSpace()
+			{
+				while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos]))) ++m_pos;
+			}
+
+			bool consume(char c)
+			{
+				skipSpace();
+				if (m_pos < m_text.size() && m_text[m_pos] == c) {
+					++m_pos;
+					return true;
+				}
+				return false;
+			}
+
+			void expect(char c)
+			{
+				if (!consume(c)) fail("unexpected character");
+			}
+
+			bool consumeWord(const char* word)
+			{
+				std::string_view w(word);
+				if (m_text.compare(m_pos, w.size(), w) != 0) return false;
+				m_pos += w.size();
+				return true;
+			}
+
+			JsonValue parseValue()
+			{
+				skipSpace();
+				if (m_pos >= m_text.size()) fail("unexpected end");
+
+				JsonValue value;
+				char c = m_text[m_pos];
+				if (c == '{') {
+					value.kind = JsonValue::Kind::Object;
+					++m_pos;
+					if (consume('}')) return value;
+					do {
+						skipSpace();
+						std::string key = parseString();
+						expect(':');
+						value.object.emplace_back(std::move(key), parseValue());
+					} while (consume(','));
+					expect('}');
+				}
+				else if (c == '[') {
+					value.kind = JsonValue::Kind::Array;
+					++m_pos;
+					if (consume(']')) return value;
+					do {
+						value.array.push_back(parseValue());
+					} while (consume(','));
+					expect(']');
+				}
+				else if (c == '"') {
+					value.kind = JsonValue::Kind::String;
+					value.string = parseString();
+				}
+				else if (consumeWord("true")) {
+					value.kind = JsonValue::Kind::Boolean;
+					value.boolean = true;
+				}
+				else if (consumeWord("false")) {
+					value.kind = JsonValue::Kind::Boolean;
+				}
+				else if (consumeWord("null")) {
+					value.kind = JsonValue::Kind::Null;
+				}
+				else {
+					// Google Benchmark writes inf and nan unquoted when a rate divides by zero
+					std::size_t end = m_pos;
+					while (end < m_text.size() && std::string_view("+-.0123456789eEinfatyINFATY").find(m_text[end]) != std::string_view::npos) ++end;
+					if (end == m_pos) fail("unexpected character");
+					value.kind = JsonValue::Kind::Number;
+					value.number = std::strtod(m_text.substr(m_pos, end - m_pos).c_str(), nullptr);
+					m_pos = end;
+				}
+				return value;
+			}
+
+			std::string parseString()
+			{
+				if (m_pos >= m_text.size() || m_text[m_pos] != '"') fail("expected a string");
+				++m_pos;
+				std::string out;
+				while (m_pos < m_text.size() && m_text[m_pos] != '"') {
+					char c = m_text[m_pos++];
+					if (c != '\\') {
+						out += c;
+						continue;
+					}
+					if (m_pos >= m_text.size()) break;
+					char escaped = m_text[m_pos++];
+					switch (escaped) {
+					case 'n': out += '\n'; break;
+					case 't': out += '\t'; break;
+					case 'r': out += '\r'; break;
+					case 'b': out += '\b'; break;
+					case 'f': out += '\f'; break;
+					case 'u':
+						// Names are ASCII; anything wider is kept as a placeholder
+						if (m_pos + 4 > m_text.size()) fail("truncated escape");
+						out += static_cast<char>(std::min(0x7Ful, std::strtoul(m_text.substr(m_pos, 4).c_str(), nullptr, 16)));
+						m_pos += 4;
+						break;
+					default: out += escaped; break;
+					}
+				}
+				if (m_pos >= m_text.size()) fail("unterminated string");
+				++m_pos;
+				return out;
+			}
+
+			const std::string& m_text;
+			std::size_t m_pos = 0;
+		};
+
+		inline double toNanoseconds(double value, const std::string& unit)
+		{
+			if (unit == "us") return value * 1e3;
+			if (unit == "ms") return value * 1e6;
+			if (unit == "s") return value * 1e9;
+			return value;
+		}
+
+		inline double median(std::vector<double> values)
+		{
+			std::sort(values.begin(), values.end());
+			std::size_t mid = values.size() / 2;
+			return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+		}
+	}
+
+	// Writes 'results' as a Google Benchmark JSON document
+	inline void writeBenchmarkJson(const std::filesystem::path& path, const std::string& executable,
+		const std::vector<BenchmarkResult>& results)
+	{
+		std::time_t now = std::time(nullptr);
+		char date[32] = "";
+		std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+
+		std::ostringstream out;
+		out << "{\n  \"context\": {\n"
+			<< "    \"date\": " << detail::quote(date) << ",\n"
+			<< "    \"executable\": " << detail::quote(executable) << ",\n"
+			<< "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#if defined(NDEBUG)
+			<< "    \"library_build_type\": \"release\"\n"
+#else
+			<< "    \"library_build_type\": \"debug\"\n"
+#endif
+			<< "  },\n  \"benchmarks\": [";
+		for (std::size_t i = 0; i < results.size(); ++i) {
+			const BenchmarkResult& result = results[i];
+			out << (i ? ",\n" : "\n") << "    {\n"
+				<< "      \"name\": " << detail::quote(result.name) << ",\n"
+				<< "      \"run_name\": " << detail::quote(result.name) << ",\n"
+				<< "      \"run_type\": \"iteration\",\n"
+				<< "      \"repetitions\": 1,\n"
+				<< "      \"repetition_index\": 0,\n"
+				<< "      \"threads\": 1,\n"
+				<< "      \"iterations\": " << result.iterations << ",\n"
+				<< "      \"real_time\": " << detail::number(result.realTime) << ",\n"
+				<< "      \"cpu_time\": " << detail::number(result.cpuTime) << ",\n"
+				<< "      \"time_unit\": \"ns\"";
+			for (const auto& [name, value] : result.counters) {
+				out << ",\n      " << detail::quote(name) << ": " << detail::number(value);
+			}
+			out << "\n    }";
+		}
+		out << "\n  ]\n}\n";
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file << out.str();
+		if (!file) throw std::runtime_error("Could not write " + path.string());
+	}
+
+	struct BenchmarkFile
+	{
+		bool debugBuild = false;
+		std::vector<BenchmarkResult> results; // In file order, one per benchmark
+	};
+
+	// Reads a Google Benchmark JSON document. Repetitions of a benchmark
+	// (--benchmark_repetitions) are folded into their median, metric by
+	// metric; the aggregate rows Google Benchmark adds are skipped. Errored
+	// runs are left out.
+	inline BenchmarkFile readBenchmarkJson(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file) throw std::runtime_error("Could not open " + path.string());
+		std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		detail::JsonValue document = detail::JsonParser(text).parseDocument();
+
+		BenchmarkFile parsed;
+		if (const detail::JsonValue* context = document.find("context")) {
+			if (const detail::JsonValue* type = context->find("library_build_type")) parsed.debugBuild = type->string == "debug";
+		}
+
+		const detail::JsonValue* benchmarks = document.find("benchmarks");
+		if (!benchmarks || benchmarks->kind != detail::JsonValue::Kind::Array) {
+			throw std::runtime_error(path.string() + " has no \"benchmarks\" array");
+		}
+
+		// Per benchmark, per metric: the value from each repetition
+		std::vector<std::string> order;
+		std::map<std::string, std::vector<std::pair<std::string, std::vector<double>>>> samples;
+		static const std::vector<std::string> fields = { "name", "run_name", "run_type", "aggregate_name", "aggregate_unit",
+			"family_index", "per_family_instance_index", "repetitions", "repetition_index", "threads", "iterations",
+			"time_unit", "error_occurred", "error_message", "label", "big_o", "rms" };
+
+		for (const detail::JsonValue& entry : benchmarks->array) {
+			const detail::JsonValue* runType = entry.find("run_type");
+			if (runType && runType->string == "aggregate") continue;
+			if (const detail::JsonValue* error = entry.find("error_occurred"); error && error->boolean) continue;
+
+			const detail::JsonValue* runName = entry.find("run_name");
+			if (!runName) runName = entry.find("name");
+			if (!runName) continue;
+
+			const detail::JsonValue* unit = entry.find("time_unit");
+			std::string timeUnit = unit ? unit->string : "ns";
+
+			auto [it, inserted] = samples.try_emplace(runName->string);
+			if (inserted) order.push_back(runName->string);
+			auto add = [&metrics = it->second](const std::string& metric, double value)
+				{
+					auto found = std::find_if(metrics.begin(), metrics.end(), [&](const auto& m) { return m.first == metric; });
+					if (found == metrics.end()) found = metrics.insert(metrics.end(), { metric, {} });
+					found->second.push_back(value);
+				};
+
+			for (const auto& [key, value] : entry.object) {
+				if (value.kind != detail::JsonValue::Kind::Number) continue;
+				if (std::find(fields.begin(), fields.end(), key) != fields.end()) continue;
+				bool isTime = key == "real_time" || key == "cpu_time";
+				add(key, isTime ? detail::toNanoseconds(value.number, timeUnit) : value.number);
+			}
+			if (const detail::JsonValue* iterations = entry.find("iterations")) add("iterations", iterations->number);
+		}
+
+		for (const std::string& name : order) {
+			BenchmarkResult result;
+			result.name = name;
+			for (const auto& [metric, values] : samples[name]) {
+				double value = detail::median(values);
+				if (metric == "iterations") result.iterations = static_cast<std::uint64_t>(value);
+				else if (metric == "real_time") result.realTime = value;
+				else if (metric == "cpu_time") result.cpuTime = value;
+				else result.counters.emplace_back(metric, value);
+			}
+			parsed.results.push_back(std::move(result));
+		}
+		return parsed;
+	}
+}
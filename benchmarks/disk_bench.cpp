@@ -0,0 +1,481 @@
+// Storage sink benchmark: the received-file sinks a Server can write
+// through, driven with the chunk patterns it sees, without the network.
+// Reports GB/s, files/s and the write latency (queued to landed on disk)
+// of every sink, pattern and durability mode on this machine's disk.
+//
+//   disk_bench [--sinks=LIST] [--patterns=LIST] [--durability=LIST] [--dir=PATH]
+//              [--size-mb=N] [--files=N] [--file-kb=N] [--chunk-kb=N] [--stripes=N]
+//              [--disk-threads=N] [--json=FILE]
+//
+// Sinks (all this build has by default):
+//   pool         WriteBehindFile: pwrite on the DiskWriter's threads
+//   direct       the same, unbuffered (O_DIRECT, FILE_FLAG_NO_BUFFERING)
+//   drop-behind  the same, written back and dropped from the page cache behind
+//   mapped       the same, copied into a shared mapping of the file (see
+//                DiskWriter::setMappedWrites); POSIX
+//   splice       chunks arrive in a pipe (see SplicePipe) and are spliced to
+//                the file, as under Connection::setSpliceReceive; Linux
+//   native       AsyncWriteFile: io_uring or IOCP; builds with ASIO_HAS_FILE
+//
+// Patterns (all by default):
+//   sequential  one --size-mb file, chunk after chunk
+//   striped     the same file in --stripes stripes written round-robin, the
+//               out-of-order offsets of a striped transfer
+//   small       --files files of --file-kb, one write each, many at a time
+//
+// Durability: none (the default), file, group; see cw::file::Durability.
+// Each run writes into a fresh directory under --dir (the temporary
+// directory by default), removed afterwards: point --dir at the disk to
+// measure.
+//
+// --json=FILE also writes every run in Google Benchmark's JSON format, as
+// "disk/<sink>/<pattern>/<durability>", for bench_compare.
+
+#include <asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "cw/buffer/buffer_pool.h"
+#include "cw/buffer/shared_buffer.h"
+#include "cw/file/disk_writer.h"
+#include "cw/file/incoming_file.h"
+#include "cw/metrics/metrics.h"
+#include "cw/log/logger.h"
+#include "bench_json.h"
+#include "resource_usage.h"
+
+namespace fs = std::filesystem;
+using cw::bench::resourceUsage;
+using cw::metrics::Clock;
+
+namespace {
+
+	// Bytes a file may have queued for the disk before its producer waits,
+	// as a connection pauses its reads (see WriteBehindFile::pendingBytes)
+	constexpr std::size_t WINDOW_CHUNKS = 16;
+	constexpr std::size_t SMALL_FILES_IN_FLIGHT = 64;
+	constexpr std::uint64_t FILES_PER_DIRECTORY = 1000;
+
+	enum class Sink { Pool, Direct, DropBehind, Mapped, Splice, Native };
+
+	struct SinkInfo
+	{
+		Sink sink;
+		std::string_view name;
+	};
+
+	constexpr SinkInfo SINKS[] = {
+		{ Sink::Pool, "pool" },
+		{ Sink::Direct, "direct" },
+		{ Sink::DropBehind, "drop-behind" },
+		{ Sink::Mapped, "mapped" },
+		{ Sink::Splice, "splice" },
+		{ Sink::Native, "native" },
+	};
+
+	bool sinkAvailable(Sink sink)
+	{
+#if !defined(__linux__)
+		if (sink == Sink::Splice) return false;
+#endif
+#if defined(_WIN32)
+		if (sink == Sink::Mapped) return false;
+#endif
+		if (sink == Sink::Native) return cw::file::hasNativeFileBackend();
+		return true;
+	}
+
+	struct Settings
+	{
+		std::vector<std::string> sinks;
+		std::vector<std::string> patterns{ "sequential", "striped", "small" };
+		std::vector<std::string> durability{ "none" };
+		fs::path dir = fs::temp_directory_path();
+		std::uint64_t sizeMb = 1024;
+		std::uint64_t files = 10000;
+		std::size_t fileKb = 16;
+		std::size_t chunkKb = 1024;
+		std::size_t stripes = 4;
+		std::size_t diskThreads = 2;
+		std::optional<fs::path> json;
+	};
+
+	std::vector<std::string> splitList(std::string_view list)
+	{
+		std::vector<std::string> items;
+		while (!list.empty()) {
+			std::size_t comma = list.find(',');
+			if (comma != 0) items.emplace_back(list.substr(0, comma));
+			if (comma == std::string_view::npos) break;
+			list.remove_prefix(comma + 1);
+		}
+		return items;
+	}
+
+	// Random bytes every chunk is cut from, aligned for the direct sink so
+	// it writes them without a bounce copy
+	class Block
+	{
+	public:
+		explicit Block(std::size_t size)
+			: m_buffer(std::make_shared<cw::buffer::PooledBuffer>(size, cw::file::DIRECT_IO_ALIGNMENT))
+		{
+			std::mt19937_64 rng(42);
+			for (auto& byte : m_buffer->span()) byte = static_cast<std::uint8_t>(rng());
+		}
+
+		cw::buffer::SharedBuffer slice(std::size_t length) const
+		{
+			return cw::buffer::SharedBuffer(m_buffer, std::span<const std::uint8_t>(m_buffer->data(), length));
+		}
+
+	private:
+		std::shared_ptr<cw::buffer::PooledBuffer> m_buffer;
+	};
+
+#if defined(__linux__)
+	// Feeds the splice sink: bytes go into one end of a socket pair and are
+	// spliced from the other into a pipe, as a receiving connection's are
+	class PipeFeeder
+	{
+	public:
+		PipeFeeder()
+		{
+			if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, m_fds) != 0) throw std::system_error(errno, std::system_category(), "socketpair");
+			for (int fd : m_fds) ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+		}
+
+		~PipeFeeder()
+		{
+			::close(m_fds[0]);
+			::close(m_fds[1]);
+		}
+
+		PipeFeeder(const PipeFeeder&) = delete;
+		PipeFeeder& operator=(const PipeFeeder&) = delete;
+
+		std::shared_ptr<cw::file::SplicePipe> fill(std::span<const std::uint8_t> data)
+		{
+			auto pipe = cw::file::SplicePipe::acquire();
+			if (!pipe) throw std::runtime_error("Cannot make a pipe");
+
+			std::size_t written = 0;
+			std::size_t moved = 0;
+			while (moved < data.size()) {
+				if (written < data.size()) {
+					ssize_t n = ::write(m_fds[0], data.data() + written, data.size() - written);
+					if (n > 0) written += static_cast<std::size_t>(n);
+					else if (errno != EAGAIN && errno != EINTR) throw std::system_error(errno, std::system_category(), "write");
+				}
+				std::size_t n = 0;
+				std::error_code ec = pipe->fill(m_fds[1], written - moved, n);
+				if (ec && ec != std::errc::resource_unavailable_try_again) throw std::system_error(ec, "splice");
+				moved += n;
+			}
+			return pipe;
+		}
+
+	private:
+		int m_fds[2] = { -1, -1 };
+	};
+#endif
+
+	// One run: a sink with its writer, and what it measured
+	class Run
+	{
+	public:
+		Run(Sink sink, cw::file::Durability durability, const Settings& settings, const Block& block, fs::path root)
+			: m_sink(sink), m_settings(settings), m_block(block), m_root(std::move(root)),
+			m_writer(std::make_shared<cw::file::DiskWriter>(settings.diskThreads))
+		{
+			m_writer->setDurability(durability);
+			if (sink == Sink::Direct) m_writer->setDirectIoMinSize(1);
+			if (sink == Sink::DropBehind) m_writer->setDropBehind(true);
+			if (sink == Sink::Mapped) m_writer->setMappedWrites(true);
+			m_writer->setBackend(sink == Sink::Native ? cw::file::FileBackend::Native : cw::file::FileBackend::ThreadPool);
+			fs::create_directories(m_root);
+		}
+
+		asio::awaitable<void> sequential(bool striped)
+		{
+			std::size_t chunk = chunkSize();
+			std::uint64_t size = m_settings.sizeMb * 1024 * 1024;
+			std::uint64_t chunks = (size + chunk - 1) / chunk;
+
+			// Chunk order: stripe after stripe, or one chunk of each in turn
+			std::vector<std::uint64_t> order;
+			order.reserve(chunks);
+			std::uint64_t stripes = striped ? std::max<std::uint64_t>(1, m_settings.stripes) : 1;
+			std::uint64_t perStripe = (chunks + stripes - 1) / stripes;
+			for (std::uint64_t i = 0; i < perStripe; ++i) {
+				for (std::uint64_t s = 0; s < stripes; ++s) {
+					if (std::uint64_t index = s * perStripe + i; index < chunks) order.push_back(index);
+				}
+			}
+
+			co_await writeFile(m_root / "huge.bin", size, order, chunk);
+		}
+
+		asio::awaitable<void> small()
+		{
+			std::uint64_t size = m_settings.fileKb * 1024;
+			auto executor = co_await asio::this_coro::executor;
+			std::uint64_t next = 0;
+			std::size_t running = 0;
+			asio::steady_timer done(executor, asio::steady_timer::time_point::max());
+
+			// SMALL_FILES_IN_FLIGHT writers, each taking the next file when its last is done
+			for (; running < std::min<std::uint64_t>(SMALL_FILES_IN_FLIGHT, m_settings.files); ++running) {
+				asio::co_spawn(executor, smallFiles(size, next, running, done), [](std::exception_ptr error) { if (error) std::rethrow_exception(error); });
+			}
+			if (running == 0) co_return;
+
+			std::error_code ignored;
+			co_await done.async_wait(asio::redirect_error(asio::use_awaitable, ignored));
+			if (m_error) throw std::system_error(m_error);
+		}
+
+		std::uint64_t bytes() const { return m_bytes; }
+		std::uint64_t files() const { return m_files; }
+		cw::metrics::LatencySnapshot latency() const { return m_latency->snapshot(); }
+
+	private:
+		asio::awaitable<void> smallFiles(std::uint64_t size, std::uint64_t& next, std::size_t& running, asio::steady_timer& done)
+		{
+			while (next < m_settings.files) {
+				co_await writeFile(smallFilePath(next++), size, std::vector<std::uint64_t>(1, 0), static_cast<std::size_t>(size));
+			}
+			if (--running == 0) done.cancel();
+		}
+
+		// Directories of at most FILES_PER_DIRECTORY files, as transfer_bench makes
+		fs::path smallFilePath(std::uint64_t index) const
+		{
+			return m_root / ("d" + std::to_string(index / FILES_PER_DIRECTORY)) / ("f" + std::to_string(index));
+		}
+
+		std::size_t chunkSize() const
+		{
+			std::size_t chunk = std::max<std::size_t>(1, m_settings.chunkKb) * 1024;
+#if defined(__linux__)
+			// A chunk is spliced through one pipe
+			if (m_sink == Sink::Splice) {
+				if (auto pipe = cw::file::SplicePipe::acquire()) chunk = std::min(chunk, pipe->capacity());
+			}
+#endif
+			return chunk;
+		}
+
+		// Waits for an IncomingFile callback
+		template<typename Start>
+		static asio::awaitable<std::error_code> wait(Start start)
+		{
+			auto token = asio::as_tuple(asio::use_awaitable);
+			auto [ec] = co_await asio::async_initiate<decltype(token), void(std::error_code)>([start](auto handler) mutable
+				{
+					auto shared = std::make_shared<decltype(handler)>(std::move(handler));
+					start([shared](std::error_code ec) { (*shared)(ec); });
+				}, token);
+			co_return ec;
+		}
+
+		asio::awaitable<void> writeFile(fs::path path, std::uint64_t size, std::vector<std::uint64_t> order, std::size_t chunk)
+		{
+			auto executor = co_await asio::this_coro::executor;
+			auto file = cw::file::makeIncomingFile(*m_writer, executor);
+			file->recordWriteLatency(m_latency);
+
+			std::error_code ec = co_await wait([&](auto done) { file->open(path, size, std::move(done)); });
+			for (std::uint64_t index : order) {
+				if (ec) break;
+				std::uint64_t offset = index * chunk;
+				std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(chunk, size - offset));
+				write(*file, offset, length);
+
+				if (file->pendingBytes() > WINDOW_CHUNKS * chunk) {
+					co_await wait([&](auto done) { file->whenDrained(WINDOW_CHUNKS * chunk / 2, [done]() { done({}); }); });
+				}
+			}
+			if (!ec) {
+				ec = co_await wait([&](auto done) { file->finish([done](std::error_code ec, std::uint64_t) { done(ec); }); });
+			}
+			if (ec) {
+				m_error = ec;
+				throw std::system_error(ec, path.string());
+			}
+
+			m_bytes += size;
+			++m_files;
+		}
+
+		void write(cw::file::IncomingFile& file, std::uint64_t offset, std::size_t length)
+		{
+#if defined(__linux__)
+			if (m_sink == Sink::Splice) {
+				auto pipe = m_feeder.fill(m_block.slice(length).span());
+				file.writeFromPipe(std::move(pipe), offset, length, Clock::now());
+				return;
+			}
+#endif
+			file.write(offset, m_block.slice(length), Clock::now());
+		}
+
+		Sink m_sink;
+		const Settings& m_settings;
+		const Block& m_block;
+		fs::path m_root;
+		std::shared_ptr<cw::file::DiskWriter> m_writer;
+		std::shared_ptr<cw::metrics::LatencyHistogram> m_latency = std::make_shared<cw::metrics::LatencyHistogram>();
+#if defined(__linux__)
+		PipeFeeder m_feeder;
+#endif
+		std::uint64_t m_bytes = 0;
+		std::uint64_t m_files = 0;
+		std::error_code m_error;
+	};
+
+	cw::bench::BenchmarkResult report(const std::string& name, const Run& run, Clock::duration elapsed, double cpuSeconds)
+	{
+		double seconds = std::chrono::duration<double>(elapsed).count();
+		double gigabytes = static_cast<double>(run.bytes()) / 1e9;
+		cw::metrics::LatencySnapshot latency = run.latency();
+		auto ms = [](std::uint64_t nanos) { return static_cast<double>(nanos) / 1e6; };
+
+		std::printf("%-36s %7.3f GB/s %9.0f files/s  write p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms\n", name.c_str(),
+			gigabytes / seconds, static_cast<double>(run.files()) / seconds,
+			ms(latency.quantile(0.5)), ms(latency.quantile(0.99)), ms(latency.quantile(0.999)));
+
+		cw::bench::BenchmarkResult result;
+		result.name = "disk/" + name;
+		result.realTime = seconds * 1e9;
+		result.cpuTime = cpuSeconds * 1e9;
+		result.counters = {
+			{ "bytes_per_second", static_cast<double>(run.bytes()) / seconds },
+			{ "items_per_second", static_cast<double>(run.files()) / seconds },
+			{ "cpu_seconds_per_gb", gigabytes > 0 ? cpuSeconds / gigabytes : 0.0 },
+			{ "write_p50_ns", static_cast<double>(latency.quantile(0.5)) },
+			{ "write_p99_ns", static_cast<double>(latency.quantile(0.99)) },
+			{ "write_p999_ns", static_cast<double>(latency.quantile(0.999)) },
+		};
+		return result;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Settings settings;
+	for (const auto& info : SINKS) {
+		if (sinkAvailable(info.sink)) settings.sinks.emplace_back(info.name);
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.starts_with("--sinks=")) settings.sinks = splitList(std::string_view(arg).substr(8));
+		else if (arg.starts_with("--patterns=")) settings.patterns = splitList(std::string_view(arg).substr(11));
+		else if (arg.starts_with("--durability=")) settings.durability = splitList(std::string_view(arg).substr(13));
+		else if (arg.starts_with("--dir=")) settings.dir = fs::absolute(arg.substr(6));
+		else if (arg.starts_with("--size-mb=")) settings.sizeMb = std::stoull(arg.substr(10));
+		else if (arg.starts_with("--files=")) settings.files = std::stoull(arg.substr(8));
+		else if (arg.starts_with("--file-kb=")) settings.fileKb = std::max<std::size_t>(1, std::stoul(arg.substr(10)));
+		else if (arg.starts_with("--chunk-kb=")) settings.chunkKb = std::max<std::size_t>(1, std::stoul(arg.substr(11)));
+		else if (arg.starts_with("--stripes=")) settings.stripes = std::max<std::size_t>(1, std::stoul(arg.substr(10)));
+		else if (arg.starts_with("--disk-threads=")) settings.diskThreads = std::max<std::size_t>(1, std::stoul(arg.substr(15)));
+		else if (arg.starts_with("--json=")) settings.json = fs::absolute(arg.substr(7));
+		else {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<Sink> sinks;
+	for (const auto& name : settings.sinks) {
+		auto info = std::find_if(std::begin(SINKS), std::end(SINKS), [&](const SinkInfo& s) { return s.name == name; });
+		if (info == std::end(SINKS) || !sinkAvailable(info->sink)) {
+			std::cerr << "Sink not available in this build: " << name << std::endl;
+			return 1;
+		}
+		sinks.push_back(info->sink);
+	}
+	for (const auto& pattern : settings.patterns) {
+		if (pattern != "sequential" && pattern != "striped" && pattern != "small") {
+			std::cerr << "Unknown pattern: " << pattern << std::endl;
+			return 1;
+		}
+	}
+	std::vector<cw::file::Durability> durabilities;
+	for (const auto& name : settings.durability) {
+		auto durability = cw::file::parseDurability(name);
+		if (!durability) {
+			std::cerr << "Unknown durability: " << name << std::endl;
+			return 1;
+		}
+		durabilities.push_back(*durability);
+	}
+
+	cw::log::Logger::instance().setLevel(cw::log::Level::Warn);
+
+	fs::path scratch = settings.dir / ("cw_disk_bench_" + std::to_string(Clock::now().time_since_epoch().count()));
+	Block block(std::max<std::size_t>(settings.chunkKb * 1024, settings.fileKb * 1024));
+	std::vector<cw::bench::BenchmarkResult> results;
+	int status = 0;
+
+	try {
+		std::size_t runs = 0;
+		for (Sink sink : sinks) {
+			for (const auto& pattern : settings.patterns) {
+				for (std::size_t d = 0; d < durabilities.size(); ++d) {
+					std::string name = std::string(std::find_if(std::begin(SINKS), std::end(SINKS),
+						[&](const SinkInfo& s) { return s.sink == sink; })->name) + "/" + pattern + "/" + settings.durability[d];
+
+					fs::path root = scratch / std::to_string(runs++);
+					std::optional<Run> run;
+					run.emplace(sink, durabilities[d], settings, block, root);
+
+					asio::io_context io;
+					std::exception_ptr failure;
+					double cpuBefore = resourceUsage().cpuSeconds;
+					auto started = Clock::now();
+					asio::co_spawn(io, pattern == "small" ? run->small() : run->sequential(pattern == "striped"),
+						[&](std::exception_ptr error) { failure = error; });
+					io.run();
+					auto elapsed = Clock::now() - started;
+					double cpu = resourceUsage().cpuSeconds - cpuBefore;
+					if (failure) std::rethrow_exception(failure);
+
+					results.push_back(report(name, *run, elapsed, cpu));
+					run.reset();
+
+					std::error_code ignored;
+					fs::remove_all(root, ignored);
+				}
+			}
+		}
+		if (settings.json) cw::bench::writeBenchmarkJson(*settings.json, "disk_bench", results);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		status = 1;
+	}
+
+	std::error_code ignored;
+	fs::remove_all(scratch, ignored);
+	return status;
+}
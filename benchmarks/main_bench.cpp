@@ -0,0 +1,543 @@
+#include <asio.hpp>
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../protocol/packet/packet.h"
+#include "../protocol/packet/packet_registry.h"
+#include "../Frame.h"
+#include "cw/endian.h"
+#include "cw/buffer/receive_buffer.h"
+#include "cw/buffer/zero_scan.h"
+#include "cw/network/submission_queue.h"
+
+using namespace cw::packet;
+
+// Encode/decode hot paths. Run a Release build; save runs with
+// --benchmark_out=run.json and diff two of them with Google Benchmark's
+// tools/compare.py.
+
+// ---------------------------------------------------------
+// SAMPLE PACKETS (typical sizes on the wire)
+// ---------------------------------------------------------
+namespace {
+
+	std::vector<uint8_t> bytes(std::size_t size)
+	{
+		std::vector<uint8_t> data(size);
+		for (std::size_t i = 0; i < size; ++i) data[i] = static_cast<uint8_t>(i * 131 + 7);
+		return data;
+	}
+
+	std::string fileName() { return "projects/connectwith/build/output/artifact-0042.bin"; }
+
+	template<typename P> P sample();
+
+	template<> Ack sample() { Ack p; p.streamId = 3; p.offset = 1 << 20; return p; }
+	template<> Error sample() { Error p; p.code = 2; p.message = "Cannot write stream 3: No space left on device"; return p; }
+	template<> FileChunk sample() { FileChunk p; p.streamId = 3; p.offset = 1 << 20; p.data = bytes(64 * 1024); p.crc = 0x1234u; return p; }
+	template<> FileDone sample() { FileDone p; p.streamId = 3; p.fileSize = 1 << 30; p.crc = 0x1234u; return p; }
+	template<> FileInfo sample() { FileInfo p; p.streamId = 3; p.fileSize = 1 << 30; p.fileName = fileName(); return p; }
+	template<> StripeInfo sample() { StripeInfo p; p.streamId = 3; p.transferId = 99; p.stripeCount = 4; p.fileSize = 1 << 30; p.fileName = fileName(); return p; }
+	template<> FileResume sample() { FileResume p; p.streamId = 3; p.fileSize = 1 << 30; p.fingerprint = 77; p.fileName = fileName(); return p; }
+	template<> DeltaInfo sample() { DeltaInfo p; p.streamId = 3; p.fileSize = 1 << 30; p.fileName = fileName(); return p; }
+	template<> BlockCopy sample() { BlockCopy p; p.streamId = 3; p.offset = 4096; p.sourceOffset = 8192; p.length = 1 << 20; return p; }
+	template<> DeltaDone sample() { DeltaDone p; p.streamId = 3; p.fileSize = 1 << 30; p.hash = 0xabcdef; return p; }
+	template<> Capabilities sample() { Capabilities p; p.codecs = 6; return p; }
+	template<> Retransmit sample() { Retransmit p; p.streamId = 3; p.offset = 1 << 20; p.length = 64 * 1024; return p; }
+	template<> SignatureRequest sample() { SignatureRequest p; p.requestId = 5; p.fileName = fileName(); return p; }
+
+	template<> FileBatch sample()
+	{
+		FileBatch p;
+		for (int i = 0; i < 32; ++i) p.files.push_back({ "src/module/file" + std::to_string(i) + ".cpp", bytes(2048) });
+		return p;
+	}
+
+	template<> Manifest sample()
+	{
+		Manifest p;
+		p.requestId = 5;
+		for (int i = 0; i < 256; ++i) p.entries.push_back({ "src/module/file" + std::to_string(i) + ".cpp", 4096u + i, 1'700'000'000'000'000'000 + i, 0 });
+		return p;
+	}
+
+	template<> ManifestDiff sample()
+	{
+		ManifestDiff p;
+		p.requestId = 5;
+		for (uint32_t i = 0; i < 256; i += 2) p.changed.push_back(i);
+		return p;
+	}
+
+	template<> Signatures sample()
+	{
+		Signatures p;
+		p.requestId = 5;
+		p.blockSize = 4096;
+		p.fileSize = 1024 * 4096;
+		for (uint32_t i = 0; i < 1024; ++i) p.blocks.push_back({ i * 2654435761u, i * 0x9E3779B97F4A7C15ull });
+		return p;
+	}
+
+	template<> CompressedChunk sample()
+	{
+		CompressedChunk p;
+		p.streamId = 3;
+		p.offset = 1 << 20;
+		p.codec = 1;
+		p.rawSize = 64 * 1024;
+		p.data = cw::buffer::SharedBuffer::fromVector(bytes(24 * 1024));
+		p.crc = 0x1234u;
+		return p;
+	}
+
+	template<> ChunkManifest sample()
+	{
+		ChunkManifest p;
+		p.streamId = 3;
+		p.fileName = fileName();
+		for (uint32_t i = 0; i < 512; ++i) {
+			ChunkRef chunk;
+			chunk.hash[0] = static_cast<uint8_t>(i);
+			chunk.hash[1] = static_cast<uint8_t>(i >> 8);
+			chunk.length = 64 * 1024;
+			p.chunks.push_back(chunk);
+			p.fileSize += chunk.length;
+		}
+		return p;
+	}
+
+	template<> ChunkRequest sample()
+	{
+		ChunkRequest p;
+		p.streamId = 3;
+		for (uint32_t i = 0; i < 512; i += 3) p.indices.push_back(i);
+		return p;
+	}
+
+	// Contiguous frame of 'packet' (header, fixed fields and any trailing payload)
+	template<typename P>
+	std::vector<uint8_t> contiguousFrame(const P& packet)
+	{
+		OutgoingFrame frame = buildOutgoingFrame(packet);
+		std::vector<uint8_t> out = frame.header;
+		out.insert(out.end(), frame.payload.data(), frame.payload.data() + frame.payload.size());
+		return out;
+	}
+}
+
+// ---------------------------------------------------------
+// 1. ENDIAN HELPERS
+// ---------------------------------------------------------
+template<typename T>
+static void BM_WriteBigEndian(benchmark::State& state)
+{
+	std::vector<uint8_t> buffer(sizeof(T) * 1024);
+	T value = static_cast<T>(0x0123456789abcdefull);
+	for (auto _ : state) {
+		uint8_t* out = buffer.data();
+		for (int i = 0; i < 1024; ++i, out += sizeof(T)) cw::binary::writeBigEndian(out, static_cast<T>(value + i));
+		benchmark::DoNotOptimize(buffer.data());
+		benchmark::ClobberMemory();
+	}
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(buffer.size()));
+}
+BENCHMARK_TEMPLATE(BM_WriteBigEndian, uint16_t);
+BENCHMARK_TEMPLATE(BM_WriteBigEndian, uint32_t);
+BENCHMARK_TEMPLATE(BM_WriteBigEndian, uint64_t);
+
+template<typename T>
+static void BM_ReadBigEndian(benchmark::State& state)
+{
+	std::vector<uint8_t> buffer = bytes(sizeof(T) * 1024);
+	for (auto _ : state) {
+		T sum = 0;
+		const uint8_t* in = buffer.data();
+		for (int i = 0; i < 1024; ++i, in += sizeof(T)) sum += cw::binary::readBigEndian<T>(in);
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(buffer.size()));
+}
+BENCHMARK_TEMPLATE(BM_ReadBigEndian, uint16_t);
+BENCHMARK_TEMPLATE(BM_ReadBigEndian, uint32_t);
+BENCHMARK_TEMPLATE(BM_ReadBigEndian, uint64_t);
+
+// Whole arrays at once (index lists, offset tables)
+template<typename T>
+static void BM_ReadBigEndianArray(benchmark::State& state)
+{
+	std::vector<uint8_t> buffer = bytes(sizeof(T) * 1024);
+	std::vector<T> values(1024);
+	for (auto _ : state) {
+		cw::binary::readBigEndianArray(buffer.data(), values.data(), values.size());
+		benchmark::DoNotOptimize(values.data());
+		benchmark::ClobberMemory();
+	}
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(buffer.size()));
+}
+BENCHMARK_TEMPLATE(BM_ReadBigEndianArray, uint16_t);
+BENCHMARK_TEMPLATE(BM_ReadBigEndianArray, uint32_t);
+BENCHMARK_TEMPLATE(BM_ReadBigEndianArray, uint64_t);
+
+// ---------------------------------------------------------
+// 2. FRAMING (buildFrame / parseFrame, by chunk size)
+// ---------------------------------------------------------
+static void BM_BuildFrame(benchmark::State& state)
+{
+	FileChunk chunk = sample<FileChunk>();
+	chunk.data = bytes(static_cast<std::size_t>(state.range(0)));
+	for (auto _ : state) {
+		auto frame = buildFrame(chunk);
+		benchmark::DoNotOptimize(frame.data());
+		cw::buffer::HeaderPool::release(std::move(frame));
+	}
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BuildFrame)->RangeMultiplier(8)->Range(64, 1 << 20);
+
+static void BM_BuildOutgoingFrame(benchmark::State& state)
+{
+	SharedFileChunk chunk;
+	chunk.streamId = 3;
+	chunk.offset = 0;
+	chunk.data = cw::buffer::SharedBuffer::fromVector(bytes(static_cast<std::size_t>(state.range(0))));
+	for (auto _ : state) {
+		auto frame = buildOutgoingFrame(chunk);
+		benchmark::DoNotOptimize(frame.header.data());
+		cw::buffer::HeaderPool::release(std::move(frame.header));
+	}
+	state.SetItemsProcessed(state.iterations()); // The payload is referenced, not copied
+}
+BENCHMARK(BM_BuildOutgoingFrame)->RangeMultiplier(8)->Range(64, 1 << 20);
+
+static void BM_ParseFrame(benchmark::State& state)
+{
+	FileChunk chunk = sample<FileChunk>();
+	chunk.data = bytes(static_cast<std::size_t>(state.range(0)));
+	auto frame = buildFrame(chunk);
+	for (auto _ : state) {
+		ParseResult result = tryParseFrame(frame.data(), frame.size());
+		benchmark::DoNotOptimize(result);
+	}
+}
+BENCHMARK(BM_ParseFrame)->Arg(64)->Arg(64 * 1024);
+
+// ---------------------------------------------------------
+// 3. PACKETS (serialize into a sized buffer, deserialize from a frame)
+// ---------------------------------------------------------
+template<typename P>
+static void BM_Serialize(benchmark::State& state)
+{
+	P packet = sample<P>();
+	std::vector<uint8_t> buffer(packet.payloadSize());
+	for (auto _ : state) {
+		cw::binary::ByteWriter out(buffer.data());
+		if constexpr (FrameBuildable<P>) packet.serialize(out);
+		else packet.serializeHeader(out); // Scatter/gather: the payload is referenced, not copied
+		benchmark::DoNotOptimize(buffer.data());
+		benchmark::ClobberMemory();
+	}
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(packet.payloadSize()));
+}
+
+// What the receive path builds from a P: the registry's choice, except that
+// FileBatch is received raw and then decoded as a view by its handler
+template<typename P> struct PacketReceivedAs : ReceivedAs<P> {};
+template<> struct PacketReceivedAs<FileBatch> { using type = FileBatchView; };
+
+template<typename P, typename Decoded = typename PacketReceivedAs<P>::type>
+static void BM_Deserialize(benchmark::State& state)
+{
+	auto frame = contiguousFrame(sample<P>());
+	ParsedFrame parsed = parseFrame(frame);
+	for (auto _ : state) {
+		Decoded packet = Decoded::deserialize(parsed.payload_view, parsed.size);
+		benchmark::DoNotOptimize(packet);
+	}
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(parsed.size));
+}
+
+#define CW_PACKET_BENCHMARKS(P)            \
+	BENCHMARK_TEMPLATE(BM_Serialize, P);   \
+	BENCHMARK_TEMPLATE(BM_Deserialize, P)
+
+CW_PACKET_BENCHMARKS(FileInfo);
+CW_PACKET_BENCHMARKS(FileChunk);
+CW_PACKET_BENCHMARKS(FileDone);
+CW_PACKET_BENCHMARKS(Error);
+CW_PACKET_BENCHMARKS(Ack);
+CW_PACKET_BENCHMARKS(StripeInfo);
+CW_PACKET_BENCHMARKS(FileBatch);
+CW_PACKET_BENCHMARKS(FileResume);
+CW_PACKET_BENCHMARKS(Manifest);
+CW_PACKET_BENCHMARKS(ManifestDiff);
+CW_PACKET_BENCHMARKS(SignatureRequest);
+CW_PACKET_BENCHMARKS(Signatures);
+CW_PACKET_BENCHMARKS(DeltaInfo);
+CW_PACKET_BENCHMARKS(BlockCopy);
+CW_PACKET_BENCHMARKS(DeltaDone);
+CW_PACKET_BENCHMARKS(Capabilities);
+CW_PACKET_BENCHMARKS(CompressedChunk);
+CW_PACKET_BENCHMARKS(Retransmit);
+CW_PACKET_BENCHMARKS(ChunkManifest);
+CW_PACKET_BENCHMARKS(ChunkRequest);
+
+// The owning decoders, where the receive path uses a view
+BENCHMARK_TEMPLATE(BM_Deserialize, FileChunk, FileChunk);
+BENCHMARK_TEMPLATE(BM_Deserialize, FileBatch, FileBatch);
+
+// ---------------------------------------------------------
+// 4. RECEIVE PATH (Connection::processBuffer's loop, by read boundaries)
+// ---------------------------------------------------------
+// The stream arrives in reads of the given sizes; after each read every
+// complete frame is parsed in place, dispatched through the packet
+// registry and consumed, exactly as processBuffer does (the socket and the
+// file writes are left out). How TCP cuts the stream is up to the network,
+// so the adversarial cuts are covered: 1-byte reads, reads ending inside
+// every header, many frames per read and frames far larger than a read.
+struct DecodeOnlyHandler
+{
+	std::size_t packets = 0;
+	template<typename P> void operator()(const P&) { ++packets; }
+};
+
+// Frames back to back, and where each one starts
+struct FrameStream
+{
+	std::vector<uint8_t> bytes;
+	std::vector<std::size_t> starts;
+
+	template<typename P>
+	void append(const P& packet)
+	{
+		std::vector<uint8_t> frame = contiguousFrame(packet);
+		starts.push_back(bytes.size());
+		bytes.insert(bytes.end(), frame.begin(), frame.end());
+	}
+};
+
+static FrameStream mixedStream()
+{
+	FrameStream stream;
+	stream.append(sample<FileInfo>());
+	FileChunk chunk = sample<FileChunk>();
+	for (int i = 0; i < 64; ++i) {
+		stream.append(chunk);
+		if (i % 8 == 7) stream.append(sample<Ack>());
+	}
+	stream.append(sample<FileDone>());
+	return stream;
+}
+
+// Payloads from this size up whose frame is incomplete take Connection's
+// two-phase read: gathered in a buffer of their own and parsed once, the
+// receive buffer never growing to hold them
+constexpr std::size_t PARSE_LARGE_FRAME = 256 * 1024; // Connection::LARGE_FRAME_SIZE
+
+// Feeds 'stream' to the parse loop in reads of 'reads[i]' bytes, cycling
+// through 'reads'
+template<typename Handler>
+static void feed(const std::vector<uint8_t>& stream, const std::vector<std::size_t>& reads, cw::buffer::ReceiveBuffer& buffer, Handler& handler)
+{
+	std::vector<uint8_t> large; // Body of the large frame being gathered
+	std::size_t largeHave = 0;
+	PacketType largeType{};
+
+	std::size_t next = 0;
+	for (std::size_t pos = 0; pos < stream.size();) {
+		std::size_t length = std::min(reads[next++ % reads.size()], stream.size() - pos);
+
+		if (!large.empty()) {
+			length = std::min(length, large.size() - largeHave);
+			std::memcpy(large.data() + largeHave, stream.data() + pos, length);
+			largeHave += length;
+			pos += length;
+			if (largeHave == large.size()) {
+				PacketList::dispatch(ParsedFrame{ large.data(), large.size(), largeType }, handler);
+				large.clear();
+			}
+			continue;
+		}
+
+		auto writable = buffer.prepare(length);
+		std::memcpy(writable.data(), stream.data() + pos, length);
+		buffer.commit(length);
+		pos += length;
+
+		while (!buffer.empty()) {
+			ParseResult result = tryParseFrame(buffer.data(), buffer.size());
+			if (result.status == ParseStatus::Complete) {
+				PacketList::dispatch(result.frame, handler);
+				buffer.consume(result.headerSize + result.frame.size);
+				continue;
+			}
+
+			ParseResult header = tryParseFrameHeader(buffer.data(), buffer.size());
+			if (header.status == ParseStatus::Complete && header.frame.size >= PARSE_LARGE_FRAME) {
+				largeType = header.frame.type;
+				largeHave = buffer.size() - header.headerSize;
+				large.resize(header.frame.size);
+				std::memcpy(large.data(), buffer.data() + header.headerSize, largeHave);
+				buffer.consume(buffer.size());
+			}
+			break;
+		}
+	}
+}
+
+static void runFeed(benchmark::State& state, const FrameStream& stream, const std::vector<std::size_t>& reads)
+{
+	cw::buffer::ReceiveBuffer buffer(2 * 64 * 1024);
+	DecodeOnlyHandler handler;
+
+	for (auto _ : state) feed(stream.bytes, reads, buffer, handler);
+
+	benchmark::DoNotOptimize(handler.packets);
+	// A frame lost at some cut would otherwise show up as a speedup
+	if (handler.packets != state.iterations() * stream.starts.size()) state.SkipWithError("Frames were lost or duplicated");
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(stream.bytes.size()));
+	state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(stream.starts.size()));
+}
+
+static void BM_ProcessBuffer(benchmark::State& state)
+{
+	runFeed(state, mixedStream(), { static_cast<std::size_t>(state.range(0)) });
+}
+// 1 byte (worst case), header-sized, odd, MTU-ish, and whole-socket-buffer reads
+BENCHMARK(BM_ProcessBuffer)->Arg(1)->Arg(10)->Arg(997)->Arg(1448)->Arg(16 * 1024)->Arg(256 * 1024);
+
+// Every read ends 'range(0)' bytes into the next frame's header, so every
+// frame is first parsed without its length
+static void BM_ProcessBufferHeaderSplits(benchmark::State& state)
+{
+	FrameStream stream = mixedStream();
+	std::size_t into = static_cast<std::size_t>(state.range(0));
+
+	std::vector<std::size_t> reads;
+	std::size_t from = 0;
+	for (std::size_t i = 1; i <= stream.starts.size(); ++i) {
+		std::size_t cut = i < stream.starts.size() ? stream.starts[i] + into : stream.bytes.size();
+		reads.push_back(cut - from);
+		from = cut;
+	}
+	runFeed(state, stream, reads);
+}
+BENCHMARK(BM_ProcessBufferHeaderSplits)->Arg(1)->Arg(3);
+
+// Thousands of tiny frames (acks) per read: the per-frame overhead alone
+static void BM_ProcessBufferCoalesced(benchmark::State& state)
+{
+	FrameStream stream;
+	Ack ack = sample<Ack>();
+	for (int i = 0; i < 16384; ++i) {
+		ack.offset = static_cast<uint64_t>(i) << 16;
+		stream.append(ack);
+	}
+	runFeed(state, stream, { static_cast<std::size_t>(state.range(0)) });
+}
+BENCHMARK(BM_ProcessBufferCoalesced)->Arg(1448)->Arg(64 * 1024)->Arg(256 * 1024);
+
+// Chunks of the largest size allowed, each spanning hundreds of reads
+static void BM_ProcessBufferGiantFrames(benchmark::State& state)
+{
+	FrameStream stream;
+	FileChunk chunk = sample<FileChunk>();
+	chunk.data = bytes(MAX_CHUNK_SIZE);
+	for (int i = 0; i < 4; ++i) {
+		chunk.offset = static_cast<uint64_t>(i) * MAX_CHUNK_SIZE;
+		stream.append(chunk);
+	}
+	runFeed(state, stream, { static_cast<std::size_t>(state.range(0)) });
+}
+BENCHMARK(BM_ProcessBufferGiantFrames)->Arg(1448)->Arg(64 * 1024)->Arg(1 << 20);
+
+// ---------------------------------------------------------
+// 5. ZERO CHUNKS (isAllZero over a whole chunk, the sender's worst case)
+// ---------------------------------------------------------
+static void BM_IsAllZero(benchmark::State& state)
+{
+	std::vector<uint8_t> zeros(static_cast<std::size_t>(state.range(0)), 0);
+	for (auto _ : state) {
+		bool result = cw::buffer::isAllZero(zeros);
+		benchmark::DoNotOptimize(result);
+	}
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_IsAllZero)->Arg(4 * 1024)->Arg(256 * 1024)->Arg(1 << 20);
+
+// ---------------------------------------------------------
+// 6. SEND HAND-OFF (producer threads to one consumer, per frame)
+// ---------------------------------------------------------
+namespace {
+	// What Connection::send hands over: a header and a reference
+	struct Submission
+	{
+		std::vector<uint8_t> header;
+		std::shared_ptr<int> owner;
+	};
+
+	std::shared_ptr<int> g_owner = std::make_shared<int>(0);
+}
+
+// The lock-free queue, drained by a consumer thread in batches
+static void BM_SubmissionQueuePush(benchmark::State& state)
+{
+	static cw::network::SubmissionQueue<Submission>* queue;
+	static std::atomic<bool> stop;
+	static std::thread consumer;
+	if (state.thread_index() == 0) {
+		queue = new cw::network::SubmissionQueue<Submission>();
+		stop = false;
+		consumer = std::thread([]()
+			{
+				while (!stop.load(std::memory_order_relaxed)) {
+					if (queue->drain([](Submission&&) {}, 4096) == 0) std::this_thread::yield();
+				}
+			});
+	}
+
+	std::vector<uint8_t> header(24, 1);
+	for (auto _ : state) queue->push({ header, g_owner });
+
+	if (state.thread_index() == 0) {
+		stop = true;
+		consumer.join();
+		delete queue;
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SubmissionQueuePush)->Threads(1)->Threads(4)->UseRealTime();
+
+// What it replaced: one asio::post per frame into the consumer's io_context
+static void BM_PostPerFrame(benchmark::State& state)
+{
+	static asio::io_context* io;
+	static std::thread consumer;
+	static std::optional<asio::executor_work_guard<asio::io_context::executor_type>> work;
+	if (state.thread_index() == 0) {
+		io = new asio::io_context(1);
+		work.emplace(io->get_executor());
+		consumer = std::thread([]() { io->run(); });
+	}
+
+	std::vector<uint8_t> header(24, 1);
+	for (auto _ : state) {
+		asio::post(*io, [submission = Submission{ header, g_owner }]() { benchmark::DoNotOptimize(submission.header.data()); });
+	}
+
+	if (state.thread_index() == 0) {
+		work.reset();
+		consumer.join();
+		delete io;
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PostPerFrame)->Threads(1)->Threads(4)->UseRealTime();
+
+BENCHMARK_MAIN();
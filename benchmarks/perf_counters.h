@@ -0,0 +1,133 @@
+#pragma once
+// Hardware and scheduler counters for the end-to-end benchmarks (Linux
+// perf_event_open): cycles, instructions and cache misses say where the
+// time per byte went when the GB/s alone do not.
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cw::bench {
+
+	struct PerfSample
+	{
+		std::optional<std::uint64_t> cycles;
+		std::optional<std::uint64_t> instructions;
+		std::optional<std::uint64_t> cacheMisses;
+		std::optional<std::uint64_t> contextSwitches;
+	};
+
+	// Counts this process: the calling thread and every thread started after
+	// the constructor, so construct it before the server's and the pools'.
+	// Events the kernel refuses (perf_event_paranoid, containers, VMs without
+	// a PMU) stay empty; elsewhere than Linux all do.
+	class PerfCounters
+	{
+	public:
+		PerfCounters()
+		{
+#if defined(__linux__)
+			m_fds[CYCLES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+			m_fds[INSTRUCTIONS] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+			m_fds[CACHE_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+			m_fds[CONTEXT_SWITCHES] = open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+#endif
+		}
+
+		~PerfCounters()
+		{
+#if defined(__linux__)
+			for (int fd : m_fds) {
+				if (fd >= 0) ::close(fd);
+			}
+#endif
+		}
+
+		PerfCounters(const PerfCounters&) = delete;
+		PerfCounters& operator=(const PerfCounters&) = delete;
+
+		bool available() const
+		{
+			for (int fd : m_fds) {
+				if (fd >= 0) return true;
+			}
+			return false;
+		}
+
+		// Zeroes the counts and starts counting, threads started since included
+		void start()
+		{
+#if defined(__linux__)
+			for (int fd : m_fds) {
+				if (fd < 0) continue;
+				::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+#endif
+		}
+
+		// Stops counting and reads the counts, scaled up where the PMU had
+		// more events than registers and time-shared them
+		PerfSample stop()
+		{
+			PerfSample sample;
+#if defined(__linux__)
+			for (int fd : m_fds) {
+				if (fd >= 0) ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			}
+			sample.cycles = read(m_fds[CYCLES]);
+			sample.instructions = read(m_fds[INSTRUCTIONS]);
+			sample.cacheMisses = read(m_fds[CACHE_MISSES]);
+			sample.contextSwitches = read(m_fds[CONTEXT_SWITCHES]);
+#endif
+			return sample;
+		}
+
+	private:
+		enum { CYCLES, INSTRUCTIONS, CACHE_MISSES, CONTEXT_SWITCHES, EVENTS };
+
+#if defined(__linux__)
+		static int open(std::uint32_t type, std::uint64_t config)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = type;
+			attr.config = config;
+			attr.disabled = 1;
+			attr.inherit = 1;        // Threads started from here on
+			attr.exclude_kernel = 0; // The socket and disk paths are most of a transfer
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			int fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+			if (fd < 0) {
+				// Unprivileged users may count their own user space only
+				attr.exclude_kernel = 1;
+				fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+			}
+			return fd;
+		}
+
+		static std::optional<std::uint64_t> read(int fd)
+		{
+			if (fd < 0) return std::nullopt;
+			std::uint64_t values[3] = {}; // Value, time enabled, time running
+			if (::read(fd, values, sizeof(values)) != static_cast<ssize_t>(sizeof(values))) return std::nullopt;
+			if (values[2] == 0) return values[1] == 0 ? std::optional<std::uint64_t>(0) : std::nullopt;
+			if (values[2] < values[1]) return static_cast<std::uint64_t>(static_cast<double>(values[0]) * values[1] / values[2]);
+			return values[0];
+		}
+#endif
+
+		std::array<int, EVENTS> m_fds{ -1, -1, -1, -1 };
+	};
+}
@@ -0,0 +1,67 @@
+#pragma once
+// Process CPU time and memory, for the end-to-end benchmarks
+
+#include <cstdint>
+#include <cstdio>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace cw::bench {
+
+	struct ResourceUsage
+	{
+		double cpuSeconds = 0;      // User + system, all threads
+		std::uint64_t peakRss = 0;  // Bytes
+	};
+
+	inline ResourceUsage resourceUsage()
+	{
+		ResourceUsage usage;
+#if defined(_WIN32)
+		FILETIME creation, exit, kernel, user;
+		if (::GetProcessTimes(::GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+			auto ticks = [](const FILETIME& t) { return (static_cast<std::uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime; };
+			usage.cpuSeconds = static_cast<double>(ticks(kernel) + ticks(user)) / 1e7;
+		}
+		PROCESS_MEMORY_COUNTERS counters{};
+		if (::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters))) {
+			usage.peakRss = counters.PeakWorkingSetSize;
+		}
+#else
+		rusage ru{};
+		::getrusage(RUSAGE_SELF, &ru);
+		usage.cpuSeconds = static_cast<double>(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)
+			+ static_cast<double>(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+#if defined(__APPLE__)
+		usage.peakRss = static_cast<std::uint64_t>(ru.ru_maxrss);         // Bytes
+#else
+		usage.peakRss = static_cast<std::uint64_t>(ru.ru_maxrss) * 1024;  // Kilobytes
+#endif
+#endif
+		return usage;
+	}
+
+	// Resident set size now, in bytes. Where there is no way to ask (macOS
+	// without task_info), the peak: it only grows while connections open.
+	inline std::uint64_t currentRss()
+	{
+#if defined(_WIN32)
+		PROCESS_MEMORY_COUNTERS counters{};
+		if (::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters))) return counters.WorkingSetSize;
+#elif defined(__linux__)
+		if (std::FILE* statm = std::fopen("/proc/self/statm", "r")) {
+			unsigned long long size = 0, resident = 0;
+			int fields = std::fscanf(statm, "%llu %llu", &size, &resident);
+			std::fclose(statm);
+			if (fields == 2) return resident * static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+		}
+#endif
+		return resourceUsage().peakRss;
+	}
+}
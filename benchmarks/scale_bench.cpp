@@ -0,0 +1,411 @@
+// Connection-scaling benchmark: thousands of client connections against one
+// Server, most of them idle, some trickling small files. Reports what each
+// connection costs in memory, how fast the server accepts them, frame round
+// trip latency under that load, and the CPU the idle and the active phase
+// take.
+//
+//   scale_bench [--connections=N] [--active=N] [--seconds=S] [--file-kb=N] [--interval-ms=N]
+//               [--connect-window=N] [--server-threads=N] [--client-threads=N]
+//               [--pending-accepts=N] [--host=IP] [--port=N] [--json=FILE]
+//               [socket options as for Server and Client: --nodelay --rcvbuf-kb=N ...]
+//
+// Phases:
+//   connect   --connections clients connect, at most --connect-window at a
+//             time (beyond the listen backlog SYNs are dropped and retried
+//             a second later, which would measure the retry timer)
+//   idle      two seconds with every connection open and nothing sent
+//   active    --active of them upload a --file-kb file, then time a Manifest
+//             round trip behind it, every --interval-ms, for --seconds
+//   sweep     one Manifest round trip on every idle connection at once
+//
+// In-process (the default) the server runs on its own io_context with
+// --server-threads threads, memory and CPU cover both ends, and the accept
+// rate is the server's: connections it has counted open. With --host the
+// server is remote and only the client end is measured. Every connection
+// costs a descriptor at each end; the soft descriptor limit is raised to the
+// hard one.
+//
+// --json=FILE also writes each phase in Google Benchmark's JSON format, as
+// "scale/connect", "scale/idle", "scale/active" and "scale/sweep", for
+// bench_compare.
+
+#include <asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "cw/network/Connection.h"
+#include "cw/network/Client.h"
+#include "cw/network/Server.h"
+#include "cw/network/socket_options.h"
+#include "cw/file/file.h"
+#include "cw/file/directory_upload.h"
+#include "cw/metrics/metrics.h"
+#include "cw/log/logger.h"
+#include "bench_json.h"
+#include "resource_usage.h"
+
+namespace fs = std::filesystem;
+using cw::bench::ResourceUsage;
+using cw::bench::resourceUsage;
+using cw::metrics::Clock;
+
+namespace {
+
+	constexpr auto IDLE_PHASE = std::chrono::seconds(2);
+	constexpr auto NO_PROGRESS_TIMEOUT = std::chrono::seconds(10); // A phase gives up after this long without progress
+
+	struct Settings
+	{
+		std::size_t connections = 10000;
+		std::size_t active = 100;
+		std::chrono::seconds seconds{ 10 };
+		std::size_t fileKb = 4;
+		std::chrono::milliseconds interval{ 100 };
+		std::size_t connectWindow = 512;
+		std::size_t serverThreads = 1;
+		std::size_t clientThreads = 1;
+		std::size_t pendingAccepts = 0; // 0 = the Server's default
+		std::optional<std::string> host;
+		uint16_t port = 18081;
+		std::optional<fs::path> json;
+		cw::network::SocketOptions socketOptions;
+	};
+
+	// Raises the soft descriptor limit to the hard one; returns the limit in effect
+	std::uint64_t raiseDescriptorLimit()
+	{
+#if defined(_WIN32)
+		return UINT64_MAX; // Sockets are not counted against a descriptor limit
+#else
+		rlimit limit{};
+		if (::getrlimit(RLIMIT_NOFILE, &limit) != 0) return 0;
+		if (limit.rlim_cur < limit.rlim_max) {
+			rlimit raised = limit;
+			raised.rlim_cur = limit.rlim_max;
+			if (::setrlimit(RLIMIT_NOFILE, &raised) == 0) limit = raised;
+		}
+		return limit.rlim_cur == RLIM_INFINITY ? UINT64_MAX : static_cast<std::uint64_t>(limit.rlim_cur);
+#endif
+	}
+
+	// Polls until 'done', or until 'progress' has not moved for NO_PROGRESS_TIMEOUT
+	asio::awaitable<bool> waitFor(std::function<bool()> done, std::function<std::uint64_t()> progress)
+	{
+		asio::steady_timer timer(co_await asio::this_coro::executor);
+		std::uint64_t last = progress();
+		auto lastMoved = Clock::now();
+		while (!done()) {
+			if (std::uint64_t now = progress(); now != last) {
+				last = now;
+				lastMoved = Clock::now();
+			}
+			else if (Clock::now() - lastMoved > NO_PROGRESS_TIMEOUT) {
+				co_return false;
+			}
+			timer.expires_after(std::chrono::milliseconds(5));
+			co_await timer.async_wait(asio::use_awaitable);
+		}
+		co_return true;
+	}
+
+	asio::awaitable<void> sleepFor(Clock::duration duration)
+	{
+		asio::steady_timer timer(co_await asio::this_coro::executor, duration);
+		co_await timer.async_wait(asio::use_awaitable);
+	}
+
+	// One active connection: a small file, then a Manifest round trip behind
+	// it (packets are handled in order, so its answer means the file has been
+	// dispatched), every 'interval' until 'until'
+	asio::awaitable<void> trickle(std::shared_ptr<cw::network::Connection> conn, fs::path file, std::string name,
+		cw::TransferOptions options, asio::any_io_executor fileExecutor, std::chrono::milliseconds interval,
+		Clock::time_point until, cw::metrics::LatencyHistogram& roundTrips, std::atomic<std::uint64_t>& files)
+	{
+		asio::steady_timer timer(co_await asio::this_coro::executor);
+		std::vector<std::shared_ptr<cw::network::Connection>> conns{ conn };
+		while (Clock::now() < until) {
+			auto sent = Clock::now();
+			co_await cw::asyncUploadFile(conns, conn, file, name, options, fileExecutor);
+			co_await conn->asyncRequestDiff(cw::packet::Manifest{}, asio::use_awaitable);
+			roundTrips.record(Clock::now() - sent);
+			files.fetch_add(1, std::memory_order_relaxed);
+
+			timer.expires_after(interval);
+			co_await timer.async_wait(asio::use_awaitable);
+		}
+	}
+
+	asio::awaitable<void> roundTrip(std::shared_ptr<cw::network::Connection> conn, cw::metrics::LatencyHistogram& roundTrips,
+		std::atomic<std::uint64_t>& done)
+	{
+		auto sent = Clock::now();
+		co_await conn->asyncRequestDiff(cw::packet::Manifest{}, asio::use_awaitable);
+		roundTrips.record(Clock::now() - sent);
+		done.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	std::string latencies(const cw::metrics::LatencySnapshot& snapshot)
+	{
+		char line[160];
+		auto ms = [](std::uint64_t nanos) { return static_cast<double>(nanos) / 1e6; };
+		std::snprintf(line, sizeof(line), "p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms (%llu samples)",
+			ms(snapshot.quantile(0.5)), ms(snapshot.quantile(0.99)), ms(snapshot.quantile(0.999)),
+			static_cast<unsigned long long>(snapshot.count));
+		return line;
+	}
+
+	double seconds(Clock::duration duration) { return std::chrono::duration<double>(duration).count(); }
+
+	cw::bench::BenchmarkResult phase(std::string name, Clock::duration elapsed, double cpuSeconds,
+		std::vector<std::pair<std::string, double>> counters)
+	{
+		cw::bench::BenchmarkResult result;
+		result.name = "scale/" + std::move(name);
+		result.realTime = seconds(elapsed) * 1e9;
+		result.cpuTime = cpuSeconds * 1e9;
+		result.counters = std::move(counters);
+		return result;
+	}
+
+	void addLatencies(std::vector<std::pair<std::string, double>>& counters, const std::string& prefix,
+		const cw::metrics::LatencySnapshot& snapshot)
+	{
+		counters.emplace_back(prefix + "_p50_ns", static_cast<double>(snapshot.quantile(0.5)));
+		counters.emplace_back(prefix + "_p99_ns", static_cast<double>(snapshot.quantile(0.99)));
+		counters.emplace_back(prefix + "_p999_ns", static_cast<double>(snapshot.quantile(0.999)));
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Settings settings;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (cw::network::parseSocketOption(arg, settings.socketOptions)) continue;
+		if (arg.starts_with("--connections=")) settings.connections = std::max<std::size_t>(1, std::stoul(arg.substr(14)));
+		else if (arg.starts_with("--active=")) settings.active = std::stoul(arg.substr(9));
+		else if (arg.starts_with("--seconds=")) settings.seconds = std::chrono::seconds(std::stoul(arg.substr(10)));
+		else if (arg.starts_with("--file-kb=")) settings.fileKb = std::stoul(arg.substr(10));
+		else if (arg.starts_with("--interval-ms=")) settings.interval = std::chrono::milliseconds(std::stoul(arg.substr(14)));
+		else if (arg.starts_with("--connect-window=")) settings.connectWindow = std::max<std::size_t>(1, std::stoul(arg.substr(17)));
+		else if (arg.starts_with("--server-threads=")) settings.serverThreads = std::max<std::size_t>(1, std::stoul(arg.substr(17)));
+		else if (arg.starts_with("--client-threads=")) settings.clientThreads = std::max<std::size_t>(1, std::stoul(arg.substr(17)));
+		else if (arg.starts_with("--pending-accepts=")) settings.pendingAccepts = std::stoul(arg.substr(18));
+		else if (arg.starts_with("--host=")) settings.host = arg.substr(7);
+		else if (arg.starts_with("--port=")) settings.port = static_cast<uint16_t>(std::stoul(arg.substr(7)));
+		else if (arg.starts_with("--json=")) settings.json = fs::absolute(arg.substr(7));
+		else {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return 1;
+		}
+	}
+	settings.active = std::min(settings.active, settings.connections);
+
+	// Per-connection info lines would be part of the measurement
+	cw::log::Logger::instance().setLevel(cw::log::Level::Warn);
+
+	std::uint64_t descriptors = raiseDescriptorLimit();
+	std::uint64_t needed = settings.connections * (settings.host ? 1 : 2) + 64;
+	if (descriptors < needed) {
+		std::cerr << "Descriptor limit " << descriptors << " is below the " << needed
+			<< " this run needs; raise it (ulimit -n) or connect fewer" << std::endl;
+		return 1;
+	}
+
+	fs::path scratch = fs::temp_directory_path() / ("cw_scale_bench_" + std::to_string(
+		std::chrono::steady_clock::now().time_since_epoch().count()));
+
+	int status = 0;
+	try {
+		fs::create_directories(scratch / "destination");
+		fs::path trickleFile = scratch / "trickle.bin";
+		{
+			std::ofstream out(trickleFile, std::ios::binary);
+			out << std::string(settings.fileKb * 1024, 'x');
+		}
+
+		// In-process server: writes relative to the working directory, like Server's main
+		auto registry = std::make_shared<cw::metrics::MetricsRegistry>();
+		std::optional<asio::io_context> serverIo;
+		std::optional<cw::network::Server> server;
+		std::vector<std::thread> serverThreadPool;
+		if (!settings.host) {
+			fs::current_path(scratch / "destination");
+
+			serverIo.emplace();
+			server.emplace(*serverIo, settings.port, std::make_shared<cw::file::DiskWriter>());
+			server->setMetrics(registry);
+			server->setSocketOptions(settings.socketOptions);
+			if (settings.pendingAccepts != 0) server->setPendingAccepts(settings.pendingAccepts);
+			for (std::size_t i = 0; i < settings.serverThreads; ++i) {
+				serverThreadPool.emplace_back([&serverIo]() { serverIo->run(); });
+			}
+		}
+
+		asio::io_context io;
+		auto work = asio::make_work_guard(io);
+		std::vector<std::thread> clientThreadPool;
+		for (std::size_t i = 1; i < settings.clientThreads; ++i) {
+			clientThreadPool.emplace_back([&io]() { io.run(); });
+		}
+		asio::thread_pool filePool(2);
+
+		std::vector<std::unique_ptr<cw::network::Client>> clients;
+		clients.reserve(settings.connections);
+		for (std::size_t i = 0; i < settings.connections; ++i) {
+			clients.push_back(std::make_unique<cw::network::Client>(io));
+			clients.back()->SetSocketOptions(settings.socketOptions);
+		}
+
+		// Connects are launched from the client threads: each completed one starts the next
+		std::atomic<std::size_t> nextClient = 0;
+		std::atomic<std::size_t> connected = 0;
+		std::function<void()> connectNext = [&]()
+			{
+				std::size_t index = nextClient.fetch_add(1);
+				if (index >= clients.size()) return;
+				clients[index]->Connect(settings.host.value_or("127.0.0.1"), settings.port, [&]()
+					{
+						connected.fetch_add(1);
+						connectNext();
+					});
+			};
+
+		auto openConnections = [&]() -> std::uint64_t
+			{
+				return settings.host ? connected.load() : registry->snapshot().connectionsOpen;
+			};
+
+		std::vector<cw::bench::BenchmarkResult> results;
+		asio::co_spawn(io, [&]() -> asio::awaitable<void>
+			{
+				std::uint64_t rssBefore = cw::bench::currentRss();
+				ResourceUsage connectBefore = resourceUsage();
+				auto started = Clock::now();
+				for (std::size_t i = 0; i < std::min(settings.connectWindow, clients.size()); ++i) connectNext();
+
+				bool all = co_await waitFor([&]() { return connected.load() == clients.size() && openConnections() >= clients.size(); },
+					[&]() { return connected.load() + openConnections(); });
+				auto connectTime = Clock::now() - started;
+				std::size_t open = std::min<std::size_t>(connected.load(), openConnections());
+
+				std::printf("connections  %zu of %zu open%s\n", open, clients.size(), all ? "" : " (gave up waiting for the rest)");
+				std::printf("accept rate  %.0f connections/s (%.3f s)\n", static_cast<double>(open) / seconds(connectTime), seconds(connectTime));
+				results.push_back(phase("connect", connectTime, resourceUsage().cpuSeconds - connectBefore.cpuSeconds,
+					{ { "items_per_second", static_cast<double>(open) / seconds(connectTime) } }));
+
+				// Buffers grow lazily: memory is measured again after the active phase
+				ResourceUsage idleBefore = resourceUsage();
+				co_await sleepFor(IDLE_PHASE);
+				ResourceUsage idleAfter = resourceUsage();
+				std::uint64_t rssConnected = cw::bench::currentRss();
+				double perConnection = open ? static_cast<double>(rssConnected - std::min(rssConnected, rssBefore)) / static_cast<double>(open) : 0.0;
+				const char* ends = settings.host ? "client end" : "client and server ends";
+				std::printf("memory       %.1f KiB per connection (%s), %.1f MiB in all\n",
+					perConnection / 1024.0, ends, static_cast<double>(rssConnected) / (1024.0 * 1024.0));
+				std::printf("idle cpu     %.3f cores\n", (idleAfter.cpuSeconds - idleBefore.cpuSeconds) / seconds(IDLE_PHASE));
+				results.push_back(phase("idle", IDLE_PHASE, idleAfter.cpuSeconds - idleBefore.cpuSeconds,
+					{ { "bytes_per_connection", perConnection }, { "rss", static_cast<double>(rssConnected) } }));
+
+				// Active phase: the first --active connections trickle files
+				std::vector<std::shared_ptr<cw::network::Connection>> conns;
+				for (auto& client : clients) conns.push_back(client->GetConnection());
+				std::size_t active = std::min(settings.active, open);
+
+				cw::metrics::LatencyHistogram activeRoundTrips;
+				std::atomic<std::uint64_t> files = 0;
+				std::atomic<std::size_t> trickling = active;
+				ResourceUsage activeBefore = resourceUsage();
+				auto activeStarted = Clock::now();
+				auto until = activeStarted + settings.seconds;
+				for (std::size_t i = 0; i < active; ++i) {
+					asio::co_spawn(io, trickle(conns[i], trickleFile, "t" + std::to_string(i) + ".bin", cw::TransferOptions{},
+						filePool.get_executor(), settings.interval, until, activeRoundTrips, files),
+						[&](std::exception_ptr error)
+						{
+							if (error) std::cerr << "An active connection failed" << std::endl;
+							trickling.fetch_sub(1);
+						});
+				}
+				co_await waitFor([&]() { return trickling.load() == 0; }, [&]() { return files.load(); });
+				auto activeTime = Clock::now() - activeStarted;
+				ResourceUsage activeAfter = resourceUsage();
+
+				std::printf("active       %zu connections, %llu files of %zu KiB (%.0f files/s)\n", active,
+					static_cast<unsigned long long>(files.load()), settings.fileKb, static_cast<double>(files.load()) / seconds(activeTime));
+				std::printf("active rtt   %s\n", latencies(activeRoundTrips.snapshot()).c_str());
+				std::vector<std::pair<std::string, double>> activeCounters{ { "items_per_second", static_cast<double>(files.load()) / seconds(activeTime) } };
+				addLatencies(activeCounters, "rtt", activeRoundTrips.snapshot());
+				if (!settings.host) {
+					cw::metrics::Snapshot snapshot = registry->snapshot();
+					std::printf("server send  %s\n", latencies(snapshot.sendLatency).c_str());
+					std::printf("server disk  %s\n", latencies(snapshot.diskLatency).c_str());
+				}
+				std::printf("active cpu   %.3f cores\n", (activeAfter.cpuSeconds - activeBefore.cpuSeconds) / seconds(activeTime));
+				results.push_back(phase("active", activeTime, activeAfter.cpuSeconds - activeBefore.cpuSeconds, std::move(activeCounters)));
+
+				// Sweep: every idle connection wakes at once
+				cw::metrics::LatencyHistogram sweepRoundTrips;
+				std::atomic<std::uint64_t> swept = 0;
+				std::size_t idle = open - active;
+				ResourceUsage sweepBefore = resourceUsage();
+				auto sweepStarted = Clock::now();
+				for (std::size_t i = active; i < open; ++i) {
+					asio::co_spawn(io, roundTrip(conns[i], sweepRoundTrips, swept), asio::detached);
+				}
+				co_await waitFor([&]() { return swept.load() == idle; }, [&]() { return swept.load(); });
+				auto sweepTime = Clock::now() - sweepStarted;
+				ResourceUsage sweepAfter = resourceUsage();
+				std::printf("sweep        %zu idle connections in %.3f s, rtt %s\n", idle, seconds(sweepTime),
+					latencies(sweepRoundTrips.snapshot()).c_str());
+				std::printf("peak rss     %.1f MiB\n", static_cast<double>(sweepAfter.peakRss) / (1024.0 * 1024.0));
+				std::vector<std::pair<std::string, double>> sweepCounters{ { "peak_rss", static_cast<double>(sweepAfter.peakRss) } };
+				addLatencies(sweepCounters, "rtt", sweepRoundTrips.snapshot());
+				results.push_back(phase("sweep", sweepTime, sweepAfter.cpuSeconds - sweepBefore.cpuSeconds, std::move(sweepCounters)));
+
+				if (open < clients.size()) status = 1;
+				io.stop();
+			}, [&](std::exception_ptr error)
+			{
+				if (error) {
+					try { std::rethrow_exception(error); }
+					catch (const std::exception& e) { std::cerr << "Benchmark failed: " << e.what() << std::endl; }
+					status = 1;
+				}
+				io.stop();
+			});
+
+		io.run();
+		for (auto& thread : clientThreadPool) thread.join();
+		if (serverIo) serverIo->stop();
+		for (auto& thread : serverThreadPool) thread.join();
+		filePool.join();
+		if (settings.json && !results.empty()) cw::bench::writeBenchmarkJson(*settings.json, "scale_bench", results);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		status = 1;
+	}
+
+	std::error_code ignored;
+	fs::current_path(fs::temp_directory_path(), ignored);
+	fs::remove_all(scratch, ignored);
+
+	return status;
+}
@@ -0,0 +1,391 @@
+// Tree scan benchmark: the upload's directory walk (DirectoryScanner and
+// the getdents64/statx lister under it) against the walk the client did
+// before it, over synthetic trees of each shape, with the dentry and inode
+// caches warm and cold. Reports entries/s and files/s of every walk.
+//
+//   scan_bench [--shapes=LIST] [--walks=LIST] [--caches=LIST] [--dir=PATH]
+//              [--files=N] [--large-files=N] [--depth=N] [--threads=N]
+//              [--keep] [--json=FILE]
+//
+// Shapes (all by default):
+//   wide   --files files in directories of 10,000, all under the root
+//   deep   --files files spread over a binary tree --depth levels deep
+//   large  --large-files (1M by default), about 100 to a directory, in
+//          directories of directories of the root
+//
+// Walks (all by default):
+//   iterator  recursive_directory_iterator, is_regular_file and file_size
+//             per entry: the loop src/client.cpp used to find what to send
+//   lister    detail::listDirectory directory by directory on one thread
+//   scanner   DirectoryScanner on a pool of --threads, as an upload runs it
+//
+// Caches: warm (after an untimed walk) and cold (after dropping the page,
+// dentry and inode caches). Dropping them takes root on Linux; elsewhere,
+// or without the right, cold runs are skipped with a note.
+//
+// Trees are made under --dir (the temporary directory by default) once per
+// shape, which for large takes a while, and removed afterwards unless
+// --keep: a kept tree is reused by the next run with the same settings.
+//
+// --json=FILE also writes every run in Google Benchmark's JSON format, as
+// "scan/<shape>/<walk>/<cache>", for bench_compare.
+
+#include <asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+#include "cw/file/directory_scanner.h"
+#include "cw/metrics/metrics.h"
+#include "cw/log/logger.h"
+#include "bench_json.h"
+#include "resource_usage.h"
+
+namespace fs = std::filesystem;
+using cw::bench::resourceUsage;
+using cw::metrics::Clock;
+
+namespace {
+
+	constexpr std::uint64_t WIDE_FILES_PER_DIRECTORY = 10000;
+	constexpr std::uint64_t LARGE_FILES_PER_DIRECTORY = 100;
+	constexpr std::uint64_t LARGE_FANOUT = 100;
+	// Files get 0 to FILE_SIZES - 1 bytes, so the walks' sizes can be checked
+	constexpr std::uint64_t FILE_SIZES = 16;
+
+	struct Settings
+	{
+		std::vector<std::string> shapes{ "wide", "deep", "large" };
+		std::vector<std::string> walks{ "iterator", "lister", "scanner" };
+		std::vector<std::string> caches{ "warm", "cold" };
+		fs::path dir = fs::temp_directory_path();
+		std::uint64_t files = 100000;
+		std::uint64_t largeFiles = 1000000;
+		std::size_t depth = 12;
+		std::size_t threads = 4;
+		bool keep = false;
+		std::optional<fs::path> json;
+	};
+
+	std::vector<std::string> splitList(std::string_view list)
+	{
+		std::vector<std::string> items;
+		while (!list.empty()) {
+			std::size_t comma = list.find(',');
+			if (comma != 0) items.emplace_back(list.substr(0, comma));
+			if (comma == std::string_view::npos) break;
+			list.remove_prefix(comma + 1);
+		}
+		return items;
+	}
+
+	// What a walk found: every walk of a tree must find the same
+	struct Tally
+	{
+		std::uint64_t files = 0;
+		std::uint64_t directories = 0;
+		std::uint64_t bytes = 0;
+
+		std::uint64_t entries() const { return files + directories; }
+		bool operator==(const Tally&) const = default;
+	};
+
+	// A synthetic tree: the directories of a shape, filled round-robin
+	class Tree
+	{
+	public:
+		Tree(std::string shape, const Settings& settings) : m_shape(std::move(shape))
+		{
+			std::string name = "cw_scan_bench_" + m_shape + "_" + std::to_string(fileCount(settings));
+			if (m_shape == "deep") name += "_" + std::to_string(settings.depth);
+			m_root = settings.dir / name;
+			std::vector<fs::path> directories = layout(settings);
+			m_expected.directories = directories.size() - 1; // Not the root
+
+			std::uint64_t files = fileCount(settings);
+			m_expected.files = files + 1; // And the marker of a complete tree
+			for (std::uint64_t i = 0; i < files; ++i) m_expected.bytes += i % FILE_SIZES;
+
+			// A tree kept by an earlier run is reused as it is
+			if (fs::exists(m_root / ".complete")) return;
+
+			std::error_code ignored;
+			fs::remove_all(m_root, ignored);
+			for (const auto& directory : directories) fs::create_directories(directory);
+
+			// Files of the non-root directories only, so that wide's root
+			// holds nothing but its directories
+			std::size_t first = directories.size() > 1 ? 1 : 0;
+			std::size_t slots = directories.size() - first;
+			char contents[FILE_SIZES] = {};
+			for (std::uint64_t i = 0; i < files; ++i) {
+				fs::path path = directories[first + i % slots] / ("f" + std::to_string(i));
+				std::FILE* file = std::fopen(path.string().c_str(), "wb");
+				if (!file) throw std::system_error(errno, std::generic_category(), path.string());
+				std::fwrite(contents, 1, i % FILE_SIZES, file);
+				std::fclose(file);
+			}
+			std::FILE* marker = std::fopen((m_root / ".complete").string().c_str(), "wb");
+			if (marker) std::fclose(marker);
+		}
+
+		const fs::path& root() const { return m_root; }
+		const std::string& shape() const { return m_shape; }
+		const Tally& expected() const { return m_expected; }
+
+		void remove()
+		{
+			std::error_code ignored;
+			fs::remove_all(m_root, ignored);
+		}
+
+	private:
+		std::uint64_t fileCount(const Settings& settings) const
+		{
+			return m_shape == "large" ? settings.largeFiles : settings.files;
+		}
+
+		// Every directory of the shape, parents first, the root first of all
+		std::vector<fs::path> layout(const Settings& settings)
+		{
+			std::vector<fs::path> directories{ m_root };
+			std::uint64_t files = fileCount(settings);
+			if (m_shape == "wide") {
+				std::uint64_t count = std::max<std::uint64_t>(1, (files + WIDE_FILES_PER_DIRECTORY - 1) / WIDE_FILES_PER_DIRECTORY);
+				for (std::uint64_t i = 0; i < count; ++i) directories.push_back(m_root / ("d" + std::to_string(i)));
+			}
+			else if (m_shape == "deep") {
+				// Level by level: directory i's children are 2i + 1 and 2i + 2
+				std::uint64_t count = (std::uint64_t(1) << std::max<std::size_t>(1, settings.depth)) - 1;
+				for (std::uint64_t i = 1; i < count; ++i) {
+					directories.push_back(directories[(i - 1) / 2] / (i % 2 ? "l" : "r"));
+				}
+			}
+			else {
+				std::uint64_t count = std::max<std::uint64_t>(1, (files + LARGE_FILES_PER_DIRECTORY - 1) / LARGE_FILES_PER_DIRECTORY);
+				std::uint64_t parents = (count + LARGE_FANOUT - 1) / LARGE_FANOUT;
+				for (std::uint64_t p = 0; p < parents; ++p) directories.push_back(m_root / ("p" + std::to_string(p)));
+				for (std::uint64_t i = 0; i < count; ++i) {
+					directories.push_back(directories[1 + i / LARGE_FANOUT] / ("d" + std::to_string(i % LARGE_FANOUT)));
+				}
+			}
+			return directories;
+		}
+
+		std::string m_shape;
+		fs::path m_root;
+		Tally m_expected;
+	};
+
+	// Empties the page, dentry and inode caches; false where that is not allowed
+	bool dropCaches()
+	{
+#if defined(__linux__)
+		::sync();
+		std::FILE* control = std::fopen("/proc/sys/vm/drop_caches", "w");
+		if (!control) return false;
+		bool dropped = std::fputs("3\n", control) >= 0;
+		return std::fclose(control) == 0 && dropped;
+#else
+		return false;
+#endif
+	}
+
+	// The client's walk before DirectoryScanner: a stat per entry behind
+	// is_regular_file, and another behind file_size
+	Tally iteratorWalk(const fs::path& root)
+	{
+		Tally tally;
+		for (const auto& entry : fs::recursive_directory_iterator(root)) {
+			if (entry.is_regular_file()) {
+				tally.files++;
+				tally.bytes += fs::file_size(entry.path());
+			}
+			else if (entry.is_directory()) {
+				tally.directories++;
+			}
+		}
+		return tally;
+	}
+
+	Tally listerWalk(const fs::path& root)
+	{
+		Tally tally;
+		std::vector<fs::path> pending{ fs::path() };
+		std::vector<cw::file::ScannedFile> files;
+		std::vector<fs::path> subdirectories;
+		while (!pending.empty()) {
+			fs::path relative = std::move(pending.back());
+			pending.pop_back();
+			files.clear();
+			subdirectories.clear();
+			if (auto ec = cw::file::detail::listDirectory(relative.empty() ? root : root / relative, relative, files, subdirectories)) {
+				throw std::system_error(ec, (root / relative).string());
+			}
+			for (const auto& file : files) tally.bytes += file.size;
+			tally.files += files.size();
+			tally.directories += subdirectories.size();
+			pending.insert(pending.end(), subdirectories.begin(), subdirectories.end());
+		}
+		return tally;
+	}
+
+	Tally scannerWalk(const fs::path& root, std::size_t threads)
+	{
+		Tally tally;
+		asio::io_context io;
+		auto work = asio::make_work_guard(io);
+		asio::thread_pool pool(threads);
+
+		// One sink call per directory: the walk is over when each reported has called
+		std::uint64_t owed = 1;
+		std::shared_ptr<cw::file::DirectoryScanner> scanner;
+		scanner = cw::file::DirectoryScanner::start(root, pool.get_executor(), io.get_executor(),
+			[&](std::vector<cw::file::ScannedFile> files, std::vector<fs::path> subdirectories)
+			{
+				for (const auto& file : files) tally.bytes += file.size;
+				tally.files += files.size();
+				tally.directories += subdirectories.size();
+				owed += subdirectories.size();
+				scanner->consumed(files.size());
+				if (--owed == 0) work.reset();
+			}, threads);
+		io.run();
+		pool.join();
+		return tally;
+	}
+
+	cw::bench::BenchmarkResult report(const std::string& name, const Tally& tally, Clock::duration elapsed, double cpuSeconds)
+	{
+		double seconds = std::chrono::duration<double>(elapsed).count();
+		std::printf("%-28s %12.0f entries/s %12.0f files/s  %8.3f s, %.3f s CPU\n", name.c_str(),
+			static_cast<double>(tally.entries()) / seconds, static_cast<double>(tally.files) / seconds, seconds, cpuSeconds);
+
+		cw::bench::BenchmarkResult result;
+		result.name = "scan/" + name;
+		result.realTime = seconds * 1e9;
+		result.cpuTime = cpuSeconds * 1e9;
+		result.counters = {
+			{ "items_per_second", static_cast<double>(tally.entries()) / seconds },
+			{ "files_per_second", static_cast<double>(tally.files) / seconds },
+			{ "cpu_seconds_per_million", tally.entries() > 0 ? cpuSeconds * 1e6 / static_cast<double>(tally.entries()) : 0.0 },
+		};
+		return result;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Settings settings;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.starts_with("--shapes=")) settings.shapes = splitList(std::string_view(arg).substr(9));
+		else if (arg.starts_with("--walks=")) settings.walks = splitList(std::string_view(arg).substr(8));
+		else if (arg.starts_with("--caches=")) settings.caches = splitList(std::string_view(arg).substr(9));
+		else if (arg.starts_with("--dir=")) settings.dir = fs::absolute(arg.substr(6));
+		else if (arg.starts_with("--files=")) settings.files = std::stoull(arg.substr(8));
+		else if (arg.starts_with("--large-files=")) settings.largeFiles = std::stoull(arg.substr(14));
+		else if (arg.starts_with("--depth=")) settings.depth = std::clamp<std::size_t>(std::stoul(arg.substr(8)), 1, 24);
+		else if (arg.starts_with("--threads=")) settings.threads = std::max<std::size_t>(1, std::stoul(arg.substr(10)));
+		else if (arg == "--keep") settings.keep = true;
+		else if (arg.starts_with("--json=")) settings.json = fs::absolute(arg.substr(7));
+		else {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	for (const auto& shape : settings.shapes) {
+		if (shape != "wide" && shape != "deep" && shape != "large") {
+			std::cerr << "Unknown shape: " << shape << std::endl;
+			return 1;
+		}
+	}
+	for (const auto& walk : settings.walks) {
+		if (walk != "iterator" && walk != "lister" && walk != "scanner") {
+			std::cerr << "Unknown walk: " << walk << std::endl;
+			return 1;
+		}
+	}
+	for (const auto& cache : settings.caches) {
+		if (cache != "warm" && cache != "cold") {
+			std::cerr << "Unknown cache: " << cache << std::endl;
+			return 1;
+		}
+	}
+
+	cw::log::Logger::instance().setLevel(cw::log::Level::Warn);
+
+	std::vector<cw::bench::BenchmarkResult> results;
+	std::optional<Tree> tree;
+	bool coldSkipped = false;
+	int status = 0;
+
+	try {
+		for (const auto& shape : settings.shapes) {
+			auto started = Clock::now();
+			tree.emplace(shape, settings);
+			std::printf("%s: %llu files, %llu directories (%.1f s to make)\n", shape.c_str(),
+				static_cast<unsigned long long>(tree->expected().files), static_cast<unsigned long long>(tree->expected().directories),
+				std::chrono::duration<double>(Clock::now() - started).count());
+
+			for (const auto& cache : settings.caches) {
+				for (const auto& walk : settings.walks) {
+					auto run = [&]()
+						{
+							if (walk == "iterator") return iteratorWalk(tree->root());
+							if (walk == "lister") return listerWalk(tree->root());
+							return scannerWalk(tree->root(), settings.threads);
+						};
+
+					if (cache == "cold") {
+						if (coldSkipped || !dropCaches()) {
+							coldSkipped = true;
+							continue;
+						}
+					}
+					else {
+						run();
+					}
+
+					double cpuBefore = resourceUsage().cpuSeconds;
+					auto walkStarted = Clock::now();
+					Tally tally = run();
+					auto elapsed = Clock::now() - walkStarted;
+					double cpu = resourceUsage().cpuSeconds - cpuBefore;
+
+					if (tally != tree->expected()) {
+						throw std::runtime_error(walk + " found " + std::to_string(tally.files) + " files and " +
+							std::to_string(tally.directories) + " directories in " + shape + ", not " +
+							std::to_string(tree->expected().files) + " and " + std::to_string(tree->expected().directories));
+					}
+					results.push_back(report(shape + "/" + walk + "/" + cache, tally, elapsed, cpu));
+				}
+			}
+
+			if (!settings.keep) tree->remove();
+			tree.reset();
+		}
+		if (coldSkipped) std::printf("Cold runs skipped: cannot drop the caches here (Linux, as root)\n");
+		if (settings.json) cw::bench::writeBenchmarkJson(*settings.json, "scan_bench", results);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		if (tree && !settings.keep) tree->remove();
+		status = 1;
+	}
+	return status;
+}
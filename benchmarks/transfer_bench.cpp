@@ -0,0 +1,455 @@
+// End-to-end transfer benchmark: a generated workload is uploaded over real
+// sockets, by default to a Server running in this process on loopback, and
+// the run is reported as GB/s, files/s, CPU seconds per GB and peak RSS.
+//
+//   transfer_bench [--workload=huge|tiny|mixed] [--size-mb=N] [--files=N] [--source=PATH]
+//                  [--host=IP] [--port=N] [--streams=N] [--workers=N] [--server-threads=N]
+//                  [--disk-threads=N] [--chunk-kb=N] [--mmap] [--sendfile] [--keep] [--json=FILE] [--counters]
+//                  [socket options as for Server and Client: --nodelay --rcvbuf-kb=N ...]
+//                  [--wan-rtt-ms=N] [--wan-jitter-ms=N] [--wan-mbit=N] [--wan-loss=PCT] [--wan-queue-kb=N]
+//
+// With --host the server is remote (start it there as usual) and the clock
+// stops once every connection has had a Manifest round trip after the last
+// file: the server has taken in all the data, but its last writes may still
+// be in flight. In-process, the clock stops when the server's own counters
+// show every file written, and CPU and RSS cover both ends.
+//
+// The --wan-* options put a WanEmulator between the clients and the server
+// (in-process or remote): the run sees that RTT, jitter, bottleneck rate
+// and loss instead of loopback's, without netem or root.
+//
+// --counters adds what the run cost per byte: cycles, instructions and
+// cache misses from the CPU's counters (Linux perf events; "unavailable"
+// where perf_event_paranoid or the VM forbids them), context switches, and
+// heap allocations per GB moved. Both ends are counted in-process.
+//
+// --json=FILE also writes the run in Google Benchmark's JSON format, as
+// "transfer/<workload>", for bench_compare.
+
+#include <asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cw/network/Connection.h"
+#include "cw/network/Client.h"
+#include "cw/network/Server.h"
+#include "cw/network/socket_options.h"
+#include "cw/network/wan_emulator.h"
+#include "cw/file/file.h"
+#include "cw/file/directory_upload.h"
+#include "cw/metrics/metrics.h"
+#include "cw/log/logger.h"
+#include "allocation_counter.h"
+#include "bench_json.h"
+#include "perf_counters.h"
+#include "resource_usage.h"
+
+namespace fs = std::filesystem;
+using cw::bench::ResourceUsage;
+using cw::bench::resourceUsage;
+using cw::bench::AllocationCount;
+using cw::bench::PerfSample;
+
+namespace {
+
+	struct Workload
+	{
+		std::uint64_t files = 0;
+		std::uint64_t bytes = 0;
+	};
+
+	// Random bytes: neither compressible nor deduplicable. Files are cut from
+	// this block at varying offsets rather than generated byte by byte.
+	class Filler
+	{
+	public:
+		static constexpr std::size_t BLOCK_SIZE = 4 * 1024 * 1024;
+
+		explicit Filler(std::mt19937_64& rng) : m_rng(rng), m_block(BLOCK_SIZE)
+		{
+			for (std::size_t i = 0; i + sizeof(std::uint64_t) <= m_block.size(); i += sizeof(std::uint64_t)) {
+				std::uint64_t value = m_rng();
+				std::memcpy(m_block.data() + i, &value, sizeof(value));
+			}
+		}
+
+		void writeFile(const fs::path& path, std::uint64_t size, Workload& workload)
+		{
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			if (!out) throw std::runtime_error("Cannot create " + path.string());
+
+			std::uint64_t left = size;
+			std::size_t offset = static_cast<std::size_t>(m_rng() % (BLOCK_SIZE / 2));
+			while (left > 0) {
+				std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(left, BLOCK_SIZE - offset));
+				out.write(reinterpret_cast<const char*>(m_block.data() + offset), static_cast<std::streamsize>(n));
+				left -= n;
+				offset = 0;
+			}
+			if (!out) throw std::runtime_error("Cannot write " + path.string());
+
+			++workload.files;
+			workload.bytes += size;
+		}
+
+	private:
+		std::mt19937_64& m_rng;
+		std::vector<char> m_block;
+	};
+
+	// Directories of at most this many files, like a real tree and unlike one
+	// directory with a million entries
+	constexpr std::uint64_t FILES_PER_DIRECTORY = 1000;
+
+	fs::path directoryFor(const fs::path& root, std::uint64_t index)
+	{
+		fs::path dir = root / ("d" + std::to_string(index / FILES_PER_DIRECTORY));
+		if (index % FILES_PER_DIRECTORY == 0) fs::create_directories(dir);
+		return dir;
+	}
+
+	Workload generate(const std::string& kind, const fs::path& root, std::uint64_t sizeMb, std::uint64_t files)
+	{
+		std::mt19937_64 rng(42);
+		Filler filler(rng);
+		Workload workload;
+		fs::create_directories(root);
+
+		if (kind == "huge") {
+			filler.writeFile(root / "huge.bin", sizeMb * 1024 * 1024, workload);
+		}
+		else if (kind == "tiny") {
+			// 64 B to 4 KiB: every one fits a FileBatch
+			for (std::uint64_t i = 0; i < files; ++i) {
+				filler.writeFile(directoryFor(root, i) / ("f" + std::to_string(i)), 64 + rng() % 4033, workload);
+			}
+		}
+		else if (kind == "mixed") {
+			// By count mostly small files, by bytes mostly large ones: 70% up to
+			// 16 KiB, 25% from 64 KiB to 1 MiB, 5% from 8 to 64 MiB
+			std::uint64_t target = sizeMb * 1024 * 1024;
+			for (std::uint64_t i = 0; workload.bytes < target; ++i) {
+				std::uint64_t roll = rng() % 100;
+				std::uint64_t size = roll < 70 ? 1 + rng() % (16 * 1024)
+					: roll < 95 ? 64 * 1024 + rng() % (960 * 1024)
+					: 8 * 1024 * 1024 + rng() % (56 * 1024 * 1024);
+				size = std::min(size, target - workload.bytes);
+				filler.writeFile(directoryFor(root, i) / ("f" + std::to_string(i)), size, workload);
+			}
+		}
+		else {
+			throw std::invalid_argument("Unknown workload: " + kind);
+		}
+
+		return workload;
+	}
+
+	Workload measure(const fs::path& root)
+	{
+		Workload workload;
+		if (fs::is_regular_file(root)) return { 1, fs::file_size(root) };
+
+		for (const auto& entry : fs::recursive_directory_iterator(root)) {
+			if (!entry.is_regular_file()) continue;
+			++workload.files;
+			workload.bytes += entry.file_size();
+		}
+		return workload;
+	}
+
+	asio::awaitable<void> upload(std::vector<std::shared_ptr<cw::network::Connection>> conns, fs::path source, cw::TransferOptions options,
+		cw::DirectoryUploadOptions uploadOptions, asio::any_io_executor fileExecutor)
+	{
+		if (fs::is_directory(source)) {
+			co_await cw::asyncUploadDirectory(conns, source, options, uploadOptions, fileExecutor);
+		}
+		else {
+			co_await cw::asyncUploadFile(conns, conns.front(), source, source.filename().string(), options, fileExecutor);
+		}
+
+		// Packets are handled in order, so an answered Manifest means the server
+		// has dispatched everything sent before it on that connection
+		for (auto& conn : conns) {
+			co_await conn->asyncRequestDiff(cw::packet::Manifest{}, asio::use_awaitable);
+		}
+	}
+
+	// In-process only: the received files are complete once the server has
+	// counted them, which happens after their last write.
+	asio::awaitable<void> waitForServer(std::shared_ptr<cw::metrics::MetricsRegistry> registry, Workload expected)
+	{
+		asio::steady_timer timer(co_await asio::this_coro::executor);
+		for (;;) {
+			cw::metrics::Snapshot snapshot = registry->snapshot();
+			if (snapshot.filesReceived >= expected.files && snapshot.fileBytes >= expected.bytes) co_return;
+
+			timer.expires_after(std::chrono::milliseconds(1));
+			co_await timer.async_wait(asio::use_awaitable);
+		}
+	}
+
+	// 'registry' is the in-process server's, null for a remote one
+	asio::awaitable<void> transfer(std::vector<std::shared_ptr<cw::network::Connection>> conns, fs::path source, cw::TransferOptions options,
+		cw::DirectoryUploadOptions uploadOptions, asio::any_io_executor fileExecutor,
+		std::shared_ptr<cw::metrics::MetricsRegistry> registry, Workload expected)
+	{
+		co_await upload(std::move(conns), std::move(source), options, uploadOptions, fileExecutor);
+		if (registry) co_await waitForServer(std::move(registry), expected);
+	}
+
+	// What --counters measured over the run
+	struct Counters
+	{
+		PerfSample perf;
+		AllocationCount allocations;
+	};
+
+	void reportCounters(const Counters& counters, const Workload& workload, cw::bench::BenchmarkResult& result)
+	{
+		double bytes = static_cast<double>(std::max<std::uint64_t>(workload.bytes, 1));
+		double gigabytes = bytes / 1e9;
+		const PerfSample& perf = counters.perf;
+
+		if (perf.cycles && perf.instructions) {
+			std::printf("cycles       %.2f per byte, %.2f instructions per byte (%.2f IPC)\n",
+				static_cast<double>(*perf.cycles) / bytes, static_cast<double>(*perf.instructions) / bytes,
+				*perf.cycles > 0 ? static_cast<double>(*perf.instructions) / static_cast<double>(*perf.cycles) : 0.0);
+			result.counters.emplace_back("cycles_per_byte", static_cast<double>(*perf.cycles) / bytes);
+			result.counters.emplace_back("instructions_per_byte", static_cast<double>(*perf.instructions) / bytes);
+		}
+		else {
+			std::printf("cycles       unavailable\n");
+		}
+		if (perf.cacheMisses) {
+			std::printf("cache misses %.0f per MB\n", static_cast<double>(*perf.cacheMisses) / (bytes / 1e6));
+			result.counters.emplace_back("cache_misses_per_mb", static_cast<double>(*perf.cacheMisses) / (bytes / 1e6));
+		}
+		if (perf.contextSwitches) {
+			std::printf("ctx switches %llu (%.0f per GB)\n", static_cast<unsigned long long>(*perf.contextSwitches),
+				static_cast<double>(*perf.contextSwitches) / gigabytes);
+			result.counters.emplace_back("context_switches_per_gb", static_cast<double>(*perf.contextSwitches) / gigabytes);
+		}
+
+		const AllocationCount& allocations = counters.allocations;
+		std::printf("allocations  %llu (%.0f per GB, %.1f MB per GB)\n", static_cast<unsigned long long>(allocations.calls),
+			static_cast<double>(allocations.calls) / gigabytes, static_cast<double>(allocations.bytes) / 1e6 / gigabytes);
+		result.counters.emplace_back("allocations_per_gb", static_cast<double>(allocations.calls) / gigabytes);
+		result.counters.emplace_back("allocated_bytes_per_gb", static_cast<double>(allocations.bytes) / gigabytes);
+	}
+
+	cw::bench::BenchmarkResult report(const std::string& name, const Workload& workload, std::chrono::steady_clock::duration elapsed,
+		const ResourceUsage& before, const ResourceUsage& after, const std::optional<Counters>& counters)
+	{
+		double seconds = std::chrono::duration<double>(elapsed).count();
+		double gigabytes = static_cast<double>(workload.bytes) / 1e9;
+		double cpu = after.cpuSeconds - before.cpuSeconds;
+
+		std::printf("workload     %s: %llu files, %.3f GB\n", name.c_str(),
+			static_cast<unsigned long long>(workload.files), gigabytes);
+		std::printf("elapsed      %.3f s\n", seconds);
+		std::printf("throughput   %.3f GB/s, %.0f files/s\n", gigabytes / seconds, static_cast<double>(workload.files) / seconds);
+		std::printf("cpu          %.3f s (%.3f s per GB, %.2f cores)\n", cpu, gigabytes > 0 ? cpu / gigabytes : 0.0, cpu / seconds);
+		std::printf("peak rss     %.1f MiB\n", static_cast<double>(after.peakRss) / (1024.0 * 1024.0));
+
+		cw::bench::BenchmarkResult result;
+		result.name = "transfer/" + name;
+		result.realTime = seconds * 1e9;
+		result.cpuTime = cpu * 1e9;
+		result.counters = {
+			{ "bytes_per_second", static_cast<double>(workload.bytes) / seconds },
+			{ "items_per_second", static_cast<double>(workload.files) / seconds },
+			{ "cpu_seconds_per_gb", gigabytes > 0 ? cpu / gigabytes : 0.0 },
+			{ "peak_rss", static_cast<double>(after.peakRss) },
+		};
+		if (counters) reportCounters(*counters, workload, result);
+		return result;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::string workloadKind = "huge";
+	std::uint64_t sizeMb = 1024;
+	std::uint64_t files = 100000;
+	std::optional<fs::path> source;
+	std::optional<std::string> host;
+	uint16_t port = 18080;
+	std::size_t streams = 1;
+	std::size_t serverThreads = 1;
+	std::size_t diskThreads = 2;
+	bool keep = false;
+	bool collectCounters = false;
+	std::optional<fs::path> json;
+	cw::TransferOptions options;
+	cw::DirectoryUploadOptions uploadOptions;
+	cw::network::SocketOptions socketOptions;
+	cw::network::WanProfile wan;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (cw::network::parseSocketOption(arg, socketOptions)) continue;
+		if (cw::network::parseWanOption(arg, wan)) continue;
+		if (arg.starts_with("--workload=")) workloadKind = arg.substr(11);
+		else if (arg.starts_with("--size-mb=")) sizeMb = std::stoull(arg.substr(10));
+		else if (arg.starts_with("--files=")) files = std::stoull(arg.substr(8));
+		else if (arg.starts_with("--source=")) source = fs::absolute(arg.substr(9));
+		else if (arg.starts_with("--host=")) host = arg.substr(7);
+		else if (arg.starts_with("--port=")) port = static_cast<uint16_t>(std::stoul(arg.substr(7)));
+		else if (arg.starts_with("--streams=")) streams = std::max<std::size_t>(1, std::stoul(arg.substr(10)));
+		else if (arg.starts_with("--workers=")) uploadOptions.workers = std::max<std::size_t>(1, std::stoul(arg.substr(10)));
+		else if (arg.starts_with("--server-threads=")) serverThreads = std::max<std::size_t>(1, std::stoul(arg.substr(17)));
+		else if (arg.starts_with("--disk-threads=")) diskThreads = std::max<std::size_t>(1, std::stoul(arg.substr(15)));
+		else if (arg.starts_with("--chunk-kb=")) options.chunkSize = std::stoul(arg.substr(11)) * 1024;
+		else if (arg == "--mmap") options.memoryMap = true;
+		else if (arg == "--sendfile") options.kernelCopy = true;
+		else if (arg == "--keep") keep = true;
+		else if (arg.starts_with("--json=")) json = fs::absolute(arg.substr(7));
+		else if (arg == "--counters") collectCounters = true;
+		else {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	// Per-file and per-batch info lines would be part of the measurement
+	cw::log::Logger::instance().setLevel(cw::log::Level::Warn);
+
+	fs::path scratch = fs::temp_directory_path() / ("cw_transfer_bench_" + std::to_string(
+		std::chrono::steady_clock::now().time_since_epoch().count()));
+
+	int status = 0;
+	try {
+		// Before any thread starts: the perf events follow only threads created after them
+		std::optional<cw::bench::PerfCounters> perf;
+		std::optional<Counters> counters;
+		if (collectCounters) perf.emplace();
+
+		Workload workload;
+		std::string name = workloadKind;
+		if (source) {
+			workload = measure(*source);
+			name = source->string();
+		}
+		else {
+			std::cout << "Generating " << workloadKind << " workload in " << scratch << "..." << std::endl;
+			source = scratch / "source";
+			workload = generate(workloadKind, *source, sizeMb, files);
+		}
+
+		// In-process server: writes relative to the working directory, like Server's main
+		auto registry = std::make_shared<cw::metrics::MetricsRegistry>();
+		std::optional<asio::io_context> serverIo;
+		std::optional<cw::network::Server> server;
+		std::vector<std::thread> serverThreadPool;
+		if (!host) {
+			fs::create_directories(scratch / "destination");
+			fs::current_path(scratch / "destination");
+
+			serverIo.emplace();
+			server.emplace(*serverIo, port, std::make_shared<cw::file::DiskWriter>(diskThreads));
+			server->setMetrics(registry);
+			server->setSocketOptions(socketOptions);
+			for (std::size_t i = 0; i < serverThreads; ++i) {
+				serverThreadPool.emplace_back([&serverIo]() { serverIo->run(); });
+			}
+		}
+
+		// The emulated path, on a thread of its own so its timers fire on time
+		std::optional<asio::io_context> wanIo;
+		std::optional<cw::network::WanEmulator> emulator;
+		std::thread wanThread;
+		std::string connectHost = host.value_or("127.0.0.1");
+		uint16_t connectPort = port;
+		if (wan.shapes()) {
+			wanIo.emplace();
+			emulator.emplace(*wanIo, asio::ip::tcp::endpoint(asio::ip::make_address(connectHost), port), wan);
+			connectHost = "127.0.0.1";
+			connectPort = emulator->port();
+			wanThread = std::thread([&wanIo]() { wanIo->run(); });
+			std::printf("wan          %.1f ms RTT, %.1f ms jitter, %.0f Mbit/s, %.2f%% loss\n",
+				static_cast<double>(wan.rtt.count()) / 1000, static_cast<double>(wan.jitter.count()) / 1000,
+				static_cast<double>(wan.bandwidthBitsPerSecond) / 1e6, wan.lossRate * 100);
+		}
+
+		asio::io_context io;
+		asio::thread_pool filePool(uploadOptions.workers);
+		std::vector<std::unique_ptr<cw::network::Client>> clients;
+		for (std::size_t i = 0; i < streams; ++i) {
+			clients.push_back(std::make_unique<cw::network::Client>(io));
+			clients.back()->SetTransferOptions(options);
+			clients.back()->SetSocketOptions(socketOptions);
+		}
+
+		std::optional<std::chrono::steady_clock::time_point> started;
+		std::optional<std::chrono::steady_clock::time_point> finished;
+		ResourceUsage before;
+		std::exception_ptr failure;
+
+		std::size_t connected = 0;
+		for (auto& client : clients) {
+			client->Connect(connectHost, connectPort, [&]() {
+				if (++connected < clients.size()) return;
+
+				std::vector<std::shared_ptr<cw::network::Connection>> conns;
+				for (auto& c : clients) conns.push_back(c->GetConnection());
+
+				before = resourceUsage();
+				if (perf) {
+					perf->start();
+					cw::bench::startCountingAllocations();
+				}
+				started = std::chrono::steady_clock::now();
+
+				asio::co_spawn(io, transfer(std::move(conns), *source, clients.front()->GetTransferOptions(), uploadOptions,
+					filePool.get_executor(), host ? nullptr : registry, workload), [&](std::exception_ptr error)
+					{
+						failure = error;
+						finished = std::chrono::steady_clock::now();
+						io.stop();
+					});
+				});
+		}
+
+		io.run();
+		ResourceUsage after = resourceUsage();
+		if (perf) counters = Counters{ perf->stop(), cw::bench::stopCountingAllocations() };
+
+		if (wanIo) wanIo->stop();
+		if (wanThread.joinable()) wanThread.join();
+		if (serverIo) serverIo->stop();
+		for (auto& thread : serverThreadPool) thread.join();
+		filePool.join();
+		if (failure) std::rethrow_exception(failure);
+
+		if (!started || !finished) {
+			std::cerr << "Could not connect to " << host.value_or("127.0.0.1") << ":" << port << std::endl;
+			status = 1;
+		}
+		else {
+			cw::bench::BenchmarkResult result = report(name, workload, *finished - *started, before, after, counters);
+			if (json) cw::bench::writeBenchmarkJson(*json, "transfer_bench", { result });
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		status = 1;
+	}
+
+	std::error_code ignored;
+	fs::current_path(fs::temp_directory_path(), ignored);
+	if (!keep) fs::remove_all(scratch, ignored);
+
+	return status;
+}
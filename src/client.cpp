@@ -1,94 +1,763 @@
 #include <asio.hpp>
+#include <chrono>
+#include <csignal>
 #include <iostream>
 #include <string>
-#include <thread>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <vector>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
 
 #include "cw/network/Connection.h"
 #include "cw/network/Client.h"
+#include "cw/network/socket_options.h"
+#include "cw/network/busy_poll.h"
+#include "cw/network/tls.h"
+#include "cw/network/udp_tunnel.h"
 #include "cw/protocol/packet/packet.h" 
 
 // Ensure this path matches where you saved the file header
 #include "cw/file/file.h" 
+#include "cw/file/auto_tuner.h"
+#include "cw/file/directory_upload.h"
+#include "cw/file/download.h"
+#include "cw/file/stream_upload.h"
+#include "cw/log/logger.h"
+#include "cw/metrics/progress.h"
+#include "cw/metrics/stage_profile.h"
+#include "cw/metrics/timeline.h"
 
 using namespace cw::network;
 namespace fs = std::filesystem;
 
+// Uploads a single file, or a whole tree with several files in flight at once.
+// With a 'tune_cache' (--auto-tune) it starts from the setting that did best
+// for 'destination' last time; a tree is tuned as it goes and the best
+// setting found is kept for next time.
+asio::awaitable<void> uploadPath(std::vector<std::shared_ptr<Connection>> conns, fs::path source_path, cw::TransferOptions options,
+	cw::DirectoryUploadOptions upload_options, asio::any_io_executor file_executor, std::optional<fs::path> tune_cache, std::string destination)
+{
+	// Handshake first: compression, server-side copy, compact headers and the
+	// server's chunk and window limits all come from its Capabilities
+	for (auto& conn : conns) co_await conn->asyncWaitCapabilities(asio::use_awaitable);
+
+	std::optional<cw::TuningCache> cache;
+	std::shared_ptr<cw::AutoTuner> tuner;
+	if (tune_cache) {
+		cache.emplace(*tune_cache);
+		auto start = cw::TuningSetting::of(options, conns.size());
+		if (auto known = cache->find(destination)) start = known->setting;
+		tuner = std::make_shared<cw::AutoTuner>(start, cw::AutoTuner::Limits::available(*conns.front(), conns.size()));
+		CW_LOG_INFO("[Tune] Starting with ", tuner->current().describe());
+	}
+
+	if (fs::is_directory(source_path)) {
+		std::shared_ptr<asio::steady_timer> probe;
+		if (tuner && options.progress) {
+			upload_options.tuner = tuner;
+			probe = std::make_shared<asio::steady_timer>(co_await asio::this_coro::executor);
+			asio::co_spawn(probe->get_executor(), cw::asyncTune(tuner, options.progress, probe), asio::detached);
+		}
+
+		co_await cw::asyncUploadDirectory(conns, source_path, options, upload_options, file_executor);
+
+		if (probe) {
+			probe->cancel();
+			if (tuner->bestRate() > 0) {
+				cache->store(destination, tuner->best(), tuner->bestRate());
+				if (auto ec = cache->save()) CW_LOG_WARN("[Tune] Could not save ", *tune_cache, ": ", ec.message());
+				else CW_LOG_INFO("[Tune] Kept ", tuner->best().describe(), " for ", destination);
+			}
+		}
+	}
+	else {
+		// A single file is sent with the tuner's starting point
+		if (tuner) {
+			auto setting = tuner->current();
+			options = setting.applied(options);
+			conns.resize(std::clamp<std::size_t>(setting.streams, 1, conns.size()));
+		}
+		// Single file case
+		if (options.progress) {
+			std::error_code ec;
+			options.progress->plan(1, fs::file_size(source_path, ec));
+			options.progress->planComplete();
+		}
+		CW_LOG_INFO("Sending: ", source_path);
+		// For a single file, the relative path is just the filename
+		co_await cw::asyncUploadFile(conns, conns.front(), source_path, source_path.filename().string(), options, file_executor);
+	}
+}
+
+// Downloads 'remote_path' from the server's --download-root into the
+// working directory, in slices over all the connections (--streams)
+asio::awaitable<void> downloadPath(std::vector<std::shared_ptr<Connection>> conns, std::string remote_path)
+{
+	co_await cw::asyncDownloadFileParallel(conns, remote_path);
+}
+
+// Completes once the server has acked every file of the upload (its writes
+// are done), with false if a connection is lost first (the latest of each,
+// with --reconnect). Woken by the last ack itself; the connections are looked
+// at every second meanwhile.
+asio::awaitable<bool> awaitAcked(std::shared_ptr<cw::metrics::TransferProgress> progress, std::vector<std::shared_ptr<Connection>> conns)
+{
+	auto timer = std::make_shared<asio::steady_timer>(co_await asio::this_coro::executor);
+	progress->onComplete([timer]() { asio::post(timer->get_executor(), [timer]() { timer->cancel(); }); });
+	for (;;) {
+		if (progress->complete()) co_return true;
+		for (auto& conn : conns) {
+			if (!conn->latest()->isOpen()) co_return false;
+		}
+		timer->expires_after(std::chrono::seconds(1));
+		std::error_code ec;
+		co_await timer->async_wait(asio::redirect_error(asio::use_awaitable, ec));
+	}
+}
+
+// Runs 'transfer' and, for an upload (one with 'progress'), waits for the
+// server's acks: true once everything is on the other side
+asio::awaitable<bool> completeTransfer(asio::awaitable<void> transfer, std::shared_ptr<cw::metrics::TransferProgress> progress,
+	std::vector<std::shared_ptr<Connection>> conns)
+{
+	co_await std::move(transfer);
+	if (!progress) co_return true;
+	bool acked = co_await awaitAcked(progress, std::move(conns));
+	if (!acked) {
+		CW_LOG_ERROR("[Client] Connection lost before the server acked every file");
+		co_return false;
+	}
+	CW_LOG_INFO("[Client] All ", progress->snapshot().filesAcked, " files acked");
+	co_return true;
+}
+
+// Ends the session: each connection is closed gracefully (see
+// Connection::asyncClose), so the server reads everything sent and its last
+// acks still arrive, or shut down after 'timeout' if the server does not
+// close its side
+asio::awaitable<void> closeAll(std::vector<std::shared_ptr<Connection>> conns, std::chrono::steady_clock::duration timeout)
+{
+	for (auto& conn : conns) conn = conn->latest();
+	asio::steady_timer timer(co_await asio::this_coro::executor, timeout);
+	timer.async_wait([conns](std::error_code ec)
+		{
+			if (ec) return;
+			for (auto& conn : conns) conn->shutdown();
+		});
+	for (auto& conn : conns) {
+		std::error_code ec;
+		co_await conn->asyncClose(asio::redirect_error(asio::use_awaitable, ec));
+	}
+	timer.cancel();
+}
+
+// Prints a progress line to stderr every 'interval' until the upload is
+// acked to its end. Reads the counters the upload updates; prints nothing
+// from the send or ack paths themselves.
+asio::awaitable<void> showProgress(std::shared_ptr<const cw::metrics::TransferProgress> progress, std::chrono::steady_clock::duration interval)
+{
+	cw::metrics::ProgressMeter meter(std::move(progress));
+	asio::steady_timer timer(co_await asio::this_coro::executor);
+	for (;;) {
+		timer.expires_after(interval);
+		co_await timer.async_wait(asio::use_awaitable);
+
+		cw::metrics::ProgressReport report = meter.sample();
+		std::cerr << "[Progress] " << cw::metrics::formatProgress(report) << std::endl;
+		if (report.totals.planComplete && report.totals.filesAcked >= report.totals.filesPlanned) co_return;
+	}
+}
+
+#if defined(__linux__)
+// Uploads 'source_path', then what changes under it, until interrupted or
+// a connection is lost
+asio::awaitable<void> watchPath(std::vector<std::shared_ptr<Connection>> conns, fs::path source_path, cw::TransferOptions options,
+	cw::DirectoryUploadOptions upload_options, asio::any_io_executor file_executor)
+{
+	for (auto& conn : conns) co_await conn->asyncWaitCapabilities(asio::use_awaitable);
+	co_await cw::asyncWatchDirectory(std::move(conns), std::move(source_path), std::move(options), std::move(upload_options), file_executor);
+}
+#endif
+
+#if defined(ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+// Uploads what arrives on stdin (tar output, a database dump) as 'name',
+// without knowing its size up front
+asio::awaitable<void> uploadStdin(std::shared_ptr<Connection> conn, std::string name, cw::TransferOptions options)
+{
+	asio::posix::stream_descriptor input(co_await asio::this_coro::executor, ::dup(STDIN_FILENO));
+	co_await cw::asyncSendStream(std::move(conn), input, std::move(name), std::move(options));
+}
+#endif
+
 int main(int argc, char* argv[])
 {
 	// 1. Argument Parsing
-	if (argc != 3) {
-		std::cerr << "Usage: " << argv[0] << " <path_to_send> <server_ip>" << std::endl;
+	if (argc < 3) {
+		std::cerr << "Usage: " << argv[0] << " <path_to_send> <server_host>[,<server_host>...] [--download | --stdin] [--chunk-kb=N] [--adaptive-chunks] [--read-ahead=CHUNKS] [--direct-io[=MIN_MB]] [--drop-behind] [--mmap] [--sendfile] [--resume] [--delta] [--dedup] [--tree-hash] [--chunk-key=FILE] [--no-attributes] [--inline-kb=N] [--busy-retries=N] [--compress=lz4|zstd|deflate] [--batch-dictionary[=FILE]] [--streams=N] [--bind=ADDR|IFACE ...] [--workers=N] [--work-threads=N] [--max-inflight-mb=N] [--sync] [--sync-hash] [--scan-index[=FILE]] [--archive] [--read-order=scan|inode|physical] [--watch[=DEBOUNCE_MS]] [--huge-pages-mb=N] [--nodelay] [--sndbuf-kb=N] [--rcvbuf-kb=N] [--notsent-lowat-kb=N] [--busy-poll-us=N] [--spin] [--congestion=NAME] [--zerocopy] [--rio] [--tls | --tls-ca=PEM [--tls-name=HOST] [--tls-cert=PEM --tls-key=PEM]] [--transport=tcp|udp] [--udp-port=N] [--fec=PCT] [--xdp=IFACE[:QUEUE] [--xdp-map=PATH]] [--local-socket=PATH] [--server-copy[=LOCAL_DIR:SERVER_DIR]] [--rate-limit-mbit=N] [--priority=urgent|normal|background] [--reconnect[=ATTEMPTS]] [--trace-out=FILE] [--cpu-profile] [--progress[=S]] [--auto-tune[=CACHE_FILE]]" << std::endl;
 		return 1;
 	}
 
 	std::string source_path_str = argv[1];
-	std::string server_ip = argv[2];
+	std::string server_host = argv[2]; // Name or IP literal, or a list of them
 	fs::path source_path(source_path_str);
 
-	if (!fs::exists(source_path)) {
+	// Several servers: a cluster, files sharded over them by consistent hash
+	// of their path, --streams connections to each
+	std::vector<std::string> server_hosts;
+	for (std::size_t start = 0; start <= server_host.size();) {
+		auto comma = std::min(server_host.find(',', start), server_host.size());
+		if (comma > start) server_hosts.push_back(server_host.substr(start, comma - start));
+		start = comma + 1;
+	}
+	if (server_hosts.empty()) {
+		std::cerr << "No server given" << std::endl;
+		return 1;
+	}
+	bool cluster = server_hosts.size() > 1;
+
+	cw::TransferOptions options;
+	cw::DirectoryUploadOptions upload_options;
+	cw::network::SocketOptions socket_options;
+	cw::network::TlsOptions tls_options;
+	std::size_t streams = 1;
+	std::vector<std::string> bind_sources; // Local address or interface per stream, round-robin
+	bool udp_transport = false;
+	uint16_t udp_port = 8080;
+	cw::network::UdpTunnelOptions udp_options;
+	std::string local_socket;
+	uint64_t rate_limit = 0; // Bytes/s over all streams, 0 = no cap
+	std::optional<cw::network::ReconnectOptions> reconnect; // Replace lost connections mid-transfer
+	bool download = false;   // Fetch <path_to_send> from the server instead
+	bool from_stdin = false; // Send stdin, stored as <path_to_send>
+	bool watch = false;      // Keep sending <path_to_send> as it changes, until interrupted
+	std::size_t huge_pages_mb = 0; // Buffer pool arena of huge pages, 0 = heap blocks
+	std::string trace_out;   // Chrome trace of the session, written once it ends
+	bool cpu_profile = false; // CPU time by stage, logged once the session ends
+	std::size_t progress_interval = 0; // Seconds between progress lines, 0 = none
+	std::optional<fs::path> tune_cache; // Tune streams, chunk size and compression, remembered here
+	std::optional<fs::path> scan_index; // Files as of the last completed sync; empty = the default for this tree and server
+	std::optional<fs::path> batch_dictionary; // zstd dictionary for batches of small files; empty = trained on the tree
+	std::optional<std::size_t> work_threads;  // Chunks compressed and files hashed side by side; one per core with --compress or --sync-hash
+	bool streams_given = false;
+	bool spin = false; // The network thread polls without sleeping
+	for (int i = 3; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (cw::network::parseSocketOption(arg, socket_options)) {
+			// TCP tuning (buffer sizes for long fat links, Nagle, congestion control)
+		}
+		else if (cw::network::parseTlsOption(arg, tls_options)) {
+			// Encrypted, offloaded to kTLS; --tls alone skips certificate checks
+		}
+		else if (arg == "--spin") {
+			// Interactive use: acks in microseconds, for a core busy polling (with SO_BUSY_POLL)
+			spin = true;
+		}
+		else if (arg.starts_with("--chunk-kb=")) {
+			options.chunkSize = std::stoul(arg.substr(11)) * 1024;
+		}
+		else if (arg == "--adaptive-chunks") {
+			options.adaptiveChunkSize = true;
+		}
+		else if (arg.starts_with("--read-ahead=")) {
+			options.readAheadChunks = std::stoul(arg.substr(13));
+		}
+		else if (arg == "--direct-io" || arg.starts_with("--direct-io=")) {
+			options.directIo = true;
+			if (arg.size() > 11) options.directIoMinSize = std::stoull(arg.substr(12)) * 1024 * 1024;
+		}
+		else if (arg == "--drop-behind") {
+			options.dropBehind = true;
+		}
+		else if (arg.starts_with("--trace-out=")) {
+			trace_out = arg.substr(12);
+		}
+		else if (arg == "--cpu-profile") {
+			cpu_profile = true;
+		}
+		else if (arg == "--mmap") {
+			options.memoryMap = true;
+		}
+		else if (arg == "--sendfile") {
+			options.kernelCopy = true;
+		}
+		else if (arg == "--resume") {
+			options.resume = true;
+		}
+		else if (arg.starts_with("--compress=")) {
+			auto codec = cw::compression::codecFromName(arg.substr(11));
+			if (!codec) {
+				std::cerr << "Unknown codec: " << arg.substr(11) << std::endl;
+				return 1;
+			}
+			if (*codec != cw::compression::Codec::None && !(cw::compression::supportedCodecs() & cw::compression::codecBit(*codec))) {
+				std::cerr << "This build has no " << arg.substr(11) << " support; sending raw" << std::endl;
+			}
+			options.compression = *codec;
+		}
+		else if (arg == "--batch-dictionary" || arg.starts_with("--batch-dictionary=")) {
+			// Batches of small files compressed with a zstd dictionary: from FILE (zstd --train), or trained on the tree
+			batch_dictionary = arg.size() > 18 ? fs::path(arg.substr(19)) : fs::path();
+		}
+		else if (arg == "--delta") {
+			// Changed files the server already has: send only what differs
+			options.delta = true;
+		}
+		else if (arg == "--dedup") {
+			// Send only the chunks the server has not already stored from any file
+			options.dedup = true;
+		}
+		else if (arg == "--tree-hash") {
+			// SHA-256 tree of each file's chunks, checked by a server run with --tree-hash
+			options.treeHash = true;
+		}
+		else if (arg.starts_with("--chunk-key=")) {
+			// Chunks sealed with a key shared with the server (64 hex digits in FILE), for transports without TLS
+			auto key = cw::integrity::readChunkKey(arg.substr(12));
+			if (!key) {
+				std::cerr << "Cannot read a chunk key (64 hex digits) from " << arg.substr(12) << std::endl;
+				return 1;
+			}
+			if (!cw::integrity::ChunkCipher::available()) {
+				std::cerr << "This build cannot seal chunks (no OpenSSL)" << std::endl;
+				return 1;
+			}
+			options.chunkKey = std::make_shared<const cw::integrity::ChunkKey>(*key);
+		}
+		else if (arg == "--no-attributes") {
+			// Received files get their arrival time and the server's default mode
+			options.attributes = false;
+		}
+		else if (arg.starts_with("--inline-kb=")) {
+			// Single files up to this size go whole in their header (0: always as chunks)
+			options.inlineMaxFileSize = std::stoul(arg.substr(12)) * 1024;
+		}
+		else if (arg.starts_with("--busy-retries=")) {
+			// Times a file the server refused as busy is sent again (0: the upload fails)
+			options.busyRetries = static_cast<unsigned>(std::stoul(arg.substr(15)));
+		}
+		else if (arg.starts_with("--workers=")) {
+			upload_options.workers = std::max<std::size_t>(1, std::stoul(arg.substr(10)));
+		}
+		else if (arg.starts_with("--work-threads=")) {
+			work_threads = std::stoul(arg.substr(15));
+		}
+		else if (arg.starts_with("--max-inflight-mb=")) {
+			upload_options.maxInFlightBytes = std::stoul(arg.substr(18)) * 1024 * 1024;
+		}
+		else if (arg == "--sync") {
+			// Upload only what the server lacks or holds a different version of
+			upload_options.sync = true;
+		}
+		else if (arg == "--sync-hash") {
+			upload_options.sync = true;
+			upload_options.syncHash = true;
+		}
+		else if (arg == "--scan-index" || arg.starts_with("--scan-index=")) {
+			// Sync from what the last completed sync recorded: unchanged files are not asked about or hashed
+			upload_options.sync = true;
+			scan_index = arg.size() > 12 ? fs::path(arg.substr(13)) : fs::path();
+		}
+		else if (arg.starts_with("--huge-pages-mb=")) {
+			huge_pages_mb = std::stoul(arg.substr(16));
+		}
+		else if (arg == "--archive") {
+			// Small files of a directory go as one packed stream per worker
+			upload_options.archive = true;
+		}
+		else if (arg.starts_with("--read-order=")) {
+			// Files of a directory read in disk order, for sources on spinning disks
+			std::string order = arg.substr(13);
+			if (order == "scan") upload_options.order = cw::file::ReadOrder::Scan;
+			else if (order == "inode") upload_options.order = cw::file::ReadOrder::Inode;
+			else if (order == "physical") upload_options.order = cw::file::ReadOrder::Physical;
+			else {
+				std::cerr << "Unknown read order: " << order << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--watch" || arg.starts_with("--watch=")) {
+			// Stay connected and send the files of the directory as they change
+			watch = true;
+			if (arg.size() > 7) upload_options.watchDebounce = std::chrono::milliseconds(std::stoul(arg.substr(8)));
+		}
+		else if (arg.starts_with("--streams=")) {
+			// Large files are striped over this many TCP connections
+			streams = std::max<std::size_t>(1, std::stoul(arg.substr(10)));
+			streams_given = true;
+		}
+		else if (arg.starts_with("--bind=")) {
+			// Multipath: streams leave from these addresses or interfaces in turn
+			bind_sources.push_back(arg.substr(7));
+		}
+		else if (arg.starts_with("--transport=")) {
+			// udp: reliable streams over UDP for lossy long-haul links (Server --udp-port)
+			std::string transport = arg.substr(12);
+			if (transport != "tcp" && transport != "udp") {
+				std::cerr << "Unknown transport: " << transport << std::endl;
+				return 1;
+			}
+			udp_transport = transport == "udp";
+		}
+		else if (arg.starts_with("--udp-port=")) {
+			udp_port = static_cast<uint16_t>(std::stoul(arg.substr(11)));
+		}
+		else if (arg.starts_with("--fec=")) {
+			// Over UDP, this many parity datagrams per hundred data ones: losses
+			// are rebuilt without waiting a round trip for the retransmit
+			udp_options.fecOverhead = std::stod(arg.substr(6)) / 100;
+		}
+		else if (arg.starts_with("--xdp=")) {
+			// Kernel bypass for the UDP datagrams (Linux AF_XDP), IFACE[:QUEUE]: dedicated links only
+			std::string xdp = arg.substr(6);
+			auto colon = xdp.find(':');
+			udp_options.xdpInterface = xdp.substr(0, colon);
+			if (colon != std::string::npos) udp_options.xdpQueue = static_cast<uint32_t>(std::stoul(xdp.substr(colon + 1)));
+		}
+		else if (arg.starts_with("--xdp-map=")) {
+			// The XSKMAP its XDP program redirects into, pinned on bpffs
+			udp_options.xdpMap = arg.substr(10);
+		}
+		else if (arg.starts_with("--priority=")) {
+			// Scheduling class of this upload on the connections it shares
+			std::string priority = arg.substr(11);
+			if (priority == "urgent") options.priority = cw::packet::Priority::Urgent;
+			else if (priority == "normal") options.priority = cw::packet::Priority::Normal;
+			else if (priority == "background") options.priority = cw::packet::Priority::Background;
+			else {
+				std::cerr << "Unknown priority: " << priority << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--reconnect" || arg.starts_with("--reconnect=")) {
+			// A reset connection (failover, NAT rebinding) is made again and each
+			// file goes on from what the server has on disk
+			reconnect.emplace();
+			if (arg.size() > 11) reconnect->attempts = static_cast<unsigned>(std::max(1ul, std::stoul(arg.substr(12))));
+		}
+		else if (arg == "--download") {
+			// <path_to_send> is a path under the server's --download-root, saved here
+			download = true;
+		}
+		else if (arg == "--stdin") {
+			// Stream stdin (a pipe: tar, a dump) without staging it; <path_to_send> names it
+			from_stdin = true;
+		}
+		else if (arg == "--progress" || arg.starts_with("--progress=")) {
+			// Bytes and files acked, rate and ETA on stderr, every S seconds (default 1)
+			progress_interval = arg.size() > 11 ? std::stoul(arg.substr(11)) : 1;
+		}
+		else if (arg == "--auto-tune" || arg.starts_with("--auto-tune=")) {
+			// Probe streams (up to --streams), chunk size and compression while
+			// uploading a tree, and remember what worked best for this server
+			tune_cache = arg.size() > 12 ? fs::path(arg.substr(12)) : cw::TuningCache::defaultPath();
+		}
+		else if (arg.starts_with("--rate-limit-mbit=")) {
+			// Share the link: all streams together send at most this many megabits per second
+			rate_limit = std::stoull(arg.substr(18)) * 1000 * 1000 / 8;
+		}
+		else if (arg.starts_with("--local-socket=")) {
+			// Server on this host (its --local-socket); with --sendfile files go as descriptors
+			local_socket = arg.substr(15);
+		}
+		else if (arg == "--server-copy" || arg.starts_with("--server-copy=")) {
+			// Server reads the same storage (its --server-copy-root): it copies, we send paths
+			options.serverCopy = true;
+			if (arg.size() > 14) {
+				std::string mapping = arg.substr(14);
+				auto colon = mapping.find(':');
+				if (colon == std::string::npos) {
+					std::cerr << "--server-copy= expects LOCAL_DIR:SERVER_DIR" << std::endl;
+					return 1;
+				}
+				options.serverCopyPathMap.emplace_back(fs::absolute(mapping.substr(0, colon)), mapping.substr(colon + 1));
+			}
+		}
+		else {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return 1;
+		}
+	}
+	if (spin && socket_options.busyPollMicros == 0) socket_options.busyPollMicros = cw::network::DEFAULT_BUSY_POLL_MICROS;
+
+	if (!download && !from_stdin && !fs::exists(source_path)) {
 		std::cerr << "Path does not exist: " << source_path << std::endl;
 		return 1;
 	}
+	if (watch && (download || from_stdin || !fs::is_directory(source_path))) {
+		std::cerr << "--watch takes a directory to upload" << std::endl;
+		return 1;
+	}
+#if !defined(__linux__)
+	if (watch) {
+		std::cerr << "--watch is only supported on Linux" << std::endl;
+		return 1;
+	}
+#endif
+
+	if (cluster && (udp_transport || !local_socket.empty() || tune_cache || scan_index)) {
+		std::cerr << "Several servers do not go with --transport=udp, --local-socket, --auto-tune or --scan-index" << std::endl;
+		return 1;
+	}
+
+#if !defined(CW_HAS_TLS)
+	if (tls_options.enabled) {
+		std::cerr << "This build has no TLS support (OpenSSL not found)" << std::endl;
+		return 1;
+	}
+#endif
 
 	try {
+		// Chunk buffers from one huge-page mapping: fewer TLB misses at high rates
+		if (huge_pages_mb > 0) {
+			auto backing = cw::buffer::BufferPool::instance().useHugePages(huge_pages_mb * 1024 * 1024);
+			CW_LOG_INFO("[Client] Buffer pool: ", huge_pages_mb, " MB of ", cw::buffer::HugePageArena::describe(backing));
+		}
+
 		asio::io_context io_context;
-		Client client(io_context);
+#if defined(CW_HAS_TLS)
+		std::shared_ptr<asio::ssl::context> tls_context;
+		if (tls_options.enabled) tls_context = cw::network::makeTlsContext(false, tls_options);
+#endif
 
-		// Connect to the provided IP on port 8080
-		// We capture &client to access the connection object, and source_path for the logic
-		client.Connect(server_ip, 8080, [&client, source_path]() {
+		// Disk reads of the upload workers run here, in parallel, off the network thread
+		asio::thread_pool file_pool(upload_options.workers);
 
-			std::cout << "[Client] Connected! Starting upload...\n";
+		// Each Client connects over loopback to the tunnel, which carries its
+		// stream to the server over UDP
+		std::shared_ptr<UdpTunnel> udp_tunnel;
+		std::string connect_host = server_host;
+		uint16_t connect_port = 8080;
+		if (udp_transport) {
+			// The server's tunnel listens on IPv4
+			asio::ip::udp::resolver resolver(io_context);
+			auto remote = *resolver.resolve(asio::ip::udp::v4(), server_host, std::to_string(udp_port)).begin();
+			udp_tunnel = UdpTunnel::dial(io_context, remote.endpoint(), 0, udp_options);
+			connect_host = "127.0.0.1";
+			connect_port = udp_tunnel->localPort();
+			CW_LOG_INFO("[Client] UDP transport to ", remote.endpoint());
+		}
 
-			auto conn = client.GetConnection();
+		// The tuner may use up to --streams connections, a few unless told
+		if (tune_cache && !streams_given) streams = 4;
+		// One stream per path at least, unless told otherwise
+		if (!streams_given) streams = std::max(streams, bind_sources.size());
+		if (udp_transport && !bind_sources.empty()) {
+			CW_LOG_WARN("[Client] --bind does not apply to the UDP transport");
+			bind_sources.clear();
+		}
 
-			if (conn) {
-				// DEADLOCK FIX: 
-				// We MUST run the file transfer in a background thread.
-				// If we ran it here directly, the 'sleep' inside sendFile would 
-				// block io_context, preventing the network from actually sending packets!
-				std::thread t([conn, source_path]() {
+		if (batch_dictionary && !(cw::compression::supportedCodecs() & cw::compression::codecBit(cw::compression::Codec::Zstd))) {
+			CW_LOG_WARN("[Client] This build has no zstd support; batches go without a dictionary");
+		}
+		else if (batch_dictionary && !batch_dictionary->empty()) {
+			std::ifstream in(*batch_dictionary, std::ios::binary);
+			std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			if (!in || bytes.empty() || bytes.size() > cw::packet::MAX_DICTIONARY_SIZE) {
+				std::cerr << "Cannot use " << *batch_dictionary << " as a dictionary" << std::endl;
+				return 1;
+			}
+			options.batchDictionary = std::make_shared<const cw::compression::Dictionary>(std::move(bytes), options.compressionLevel);
+		}
+		else if (batch_dictionary && fs::is_directory(source_path)) {
+			options.batchDictionary = cw::trainBatchDictionary(source_path, options.batchMaxFileSize, 2000, options.compressionLevel);
+			if (!options.batchDictionary) CW_LOG_WARN("[Client] Too few small files to train a dictionary on; batches go without one");
+		}
+
+		// One core compresses or hashes far slower than the link: spread the work over them all
+		bool cpu_bound = options.compression != cw::compression::Codec::None || upload_options.syncHash;
+		std::size_t pool_threads = work_threads.value_or(cpu_bound ? cw::WorkPool::defaultThreads() : 0);
+		if (pool_threads > 0) options.workPool = std::make_shared<cw::WorkPool>(pool_threads);
+
+		// Saved once the server has acked the whole upload, for the next sync
+		if (scan_index) {
+			if (scan_index->empty()) scan_index = cw::file::ScanIndex::defaultPath(source_path, server_host);
+			upload_options.scanIndex = std::make_shared<cw::file::ScanIndex>(*scan_index);
+			CW_LOG_INFO("[Client] Scan index ", *scan_index, ": ", upload_options.scanIndex->size(), " files");
+		}
+
+		// Counted by the upload as it goes, read by showProgress and the
+		// tuner; the session ends once every file it plans has been acked.
+		// A watch has no end to count towards.
+		if (!download && !watch) {
+			options.progress = std::make_shared<cw::metrics::TransferProgress>();
+			if (from_stdin) {
+				options.progress->plan(1, 0);
+				options.progress->planComplete();
+			}
+		}
+
+		// One Client per stream to each server; the upload starts once all of
+		// them are connected
+		auto rate_limiter = rate_limit ? std::make_shared<RateLimiter>(rate_limit) : nullptr;
+		// A busy server may point a file at a peer server with room; the
+		// connections to such peers come from this pool
+		if (!udp_transport && local_socket.empty()) {
+			cw::network::ClientPoolOptions redirect_options;
+			redirect_options.socketOptions = socket_options;
+			redirect_options.rateLimiter = rate_limiter;
+#if defined(CW_HAS_TLS)
+			redirect_options.tls = tls_context;
+#endif
+			options.redirectPool = cw::network::ClientPool::create(io_context, redirect_options);
+		}
+		std::vector<std::unique_ptr<Client>> clients;
+		for (std::size_t i = 0; i < streams * server_hosts.size(); ++i) {
+			clients.push_back(std::make_unique<Client>(io_context));
+			clients.back()->SetTransferOptions(options);
+			auto stream_options = socket_options;
+			if (!bind_sources.empty()) stream_options.bindTo = bind_sources[i % bind_sources.size()];
+			clients.back()->SetSocketOptions(stream_options);
+			clients.back()->SetRateLimiter(rate_limiter);
+			if (reconnect) clients.back()->SetReconnect(*reconnect);
+#if defined(CW_HAS_TLS)
+			if (tls_context) clients.back()->SetTls(tls_context, tls_options.serverName);
+#endif
+		}
+
+		// The session timeline, written once the transfer ends, before the
+		// connections are closed, and the CPU by stage, logged then
+		auto& timeline = cw::metrics::Timeline::instance();
+		if (!trace_out.empty()) {
+			timeline.start();
+			timeline.nameThisThread("network");
+		}
+		auto& stages = cw::metrics::StageProfile::instance();
+		if (cpu_profile) stages.start();
+		auto write_trace = [&timeline, &trace_out, &stages]()
+			{
+				if (stages.enabled()) {
+					stages.stop();
+					CW_LOG_INFO("[Client] ", stages.breakdown().format());
+				}
+				if (trace_out.empty() || !timeline.enabled()) return;
+				timeline.stop();
+				if (timeline.writeJson(trace_out)) CW_LOG_INFO("[Client] Trace of ", timeline.eventCount(), " events written to ", trace_out);
+				else CW_LOG_ERROR("[Client] Could not write the trace to ", trace_out);
+			};
+
+		// Once the transfer is over: the exit code, the trace, a graceful close
+		// of every connection, and nothing left to run (the process exits)
+		int exit_code = 1;
+		auto finish_session = [&io_context, &write_trace, &exit_code](std::vector<std::shared_ptr<Connection>> conns, std::exception_ptr error, bool done)
+			{
+				if (error) {
 					try {
-						if (fs::is_directory(source_path)) {
-							// Recursively find every file to send
-							for (const auto& entry : fs::recursive_directory_iterator(source_path)) {
-								if (entry.is_regular_file()) {
-									std::cout << "Sending: " << entry.path().string() << std::endl;
-
-									// Calculate the relative path to send to the server
-									// This allows the server to recreate the directory structure
-									// e.g. if source is "data" and file is "data/imgs/1.png", relative is "imgs/1.png"
-									std::string relative_path = fs::relative(entry.path(), source_path).string();
-
-									// Pass both the absolute path (for reading) and relative path (for saving on server)
-									cw::sendFile(conn, entry.path().string(), relative_path);
-								}
-							}
-						}
-						else {
-							// Single file case
-							std::cout << "Sending: " << source_path.string() << std::endl;
-							// For a single file, the relative path is just the filename
-							cw::sendFile(conn, source_path.string(), source_path.filename().string());
-						}
+						std::rethrow_exception(error);
 					}
 					catch (const std::exception& e) {
-						std::cerr << "File system error inside thread: " << e.what() << "\n";
+						CW_LOG_ERROR("Transfer failed: ", e.what());
 					}
-					});
+				}
+				exit_code = !error && done ? 0 : 1;
+				write_trace();
+				asio::co_spawn(io_context, closeAll(std::move(conns), std::chrono::seconds(30)), [&io_context](std::exception_ptr) { io_context.stop(); });
+			};
 
-				// Detach allows the thread to run independently while io_context handles the network
-				t.detach();
-			}
+		// SIGINT/SIGTERM: stop where we are; --resume picks the files up from there next time
+		asio::signal_set signals(io_context, SIGINT, SIGTERM);
+		signals.async_wait([&io_context, &clients, &write_trace, &exit_code](std::error_code ec, int)
+			{
+				if (ec) return;
+				CW_LOG_INFO("[Client] Interrupted, closing the connections");
+				exit_code = 1;
+				write_trace();
+				for (auto& client : clients) {
+					if (auto conn = client->GetConnection()) conn->shutdown();
+				}
+				io_context.stop();
 			});
 
-		// The Engine: Pumps data sent by the thread
-		io_context.run();
+		std::size_t connected = 0;
+		auto on_connected = [&clients, &connected, &io_context, &file_pool, &finish_session, upload_options, source_path, source_path_str, download, from_stdin, watch,
+			progress = options.progress, progress_interval, tune_cache, destination = server_host, server_hosts, streams]() mutable {
+
+			if (++connected < clients.size()) return;
+			if (progress && progress_interval != 0) asio::co_spawn(io_context, showProgress(progress, std::chrono::seconds(progress_interval)), asio::detached);
+
+			std::vector<std::shared_ptr<Connection>> conns;
+			for (auto& c : clients) conns.push_back(c->GetConnection());
+
+			// A cluster: each server's streams are the next 'streams' clients.
+			// A download or stdin upload goes whole to the server its name
+			// belongs to.
+			if (server_hosts.size() > 1) {
+				auto route = std::make_shared<cw::ClusterRoute>(cw::ClusterRoute{ cw::network::HashRing(server_hosts), {} });
+				for (std::size_t i = 0; i < server_hosts.size(); ++i) {
+					route->servers.emplace_back(conns.begin() + i * streams, conns.begin() + (i + 1) * streams);
+				}
+				upload_options.cluster = route;
+				CW_LOG_INFO("[Client] Sharding over ", server_hosts.size(), " servers, ", streams, " streams each");
+				if (download || from_stdin) conns = route->connectionsFor(source_path_str);
+			}
+
+			auto on_done = [&finish_session, conns, index = upload_options.scanIndex](std::exception_ptr error, bool done)
+				{
+					if (index && !error && done) {
+						if (auto ec = index->save()) CW_LOG_WARN("[Client] Could not save the scan index ", index->path(), ": ", ec.message());
+					}
+					finish_session(conns, error, done);
+				};
+			if (download) {
+				asio::co_spawn(io_context, completeTransfer(downloadPath(conns, source_path_str), nullptr, conns), on_done);
+				return;
+			}
+#if defined(ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+			if (from_stdin) {
+				asio::co_spawn(io_context, completeTransfer(uploadStdin(conns.front(), source_path_str, clients.front()->GetTransferOptions()), progress, conns), on_done);
+				return;
+			}
+#endif
+#if defined(__linux__)
+			if (watch) {
+				CW_LOG_INFO("[Client] Connected! Uploading, then watching for changes...");
+				asio::co_spawn(io_context, completeTransfer(watchPath(conns, source_path, clients.front()->GetTransferOptions(), upload_options, file_pool.get_executor()),
+					nullptr, conns), on_done);
+				return;
+			}
+#endif
+
+			CW_LOG_INFO("[Client] Connected! Starting upload...");
+
+			// The upload is a coroutine on the same io_context as the sockets:
+			// backpressure is awaited, so no background thread is required.
+			asio::co_spawn(io_context, completeTransfer(uploadPath(conns, source_path, clients.front()->GetTransferOptions(), upload_options, file_pool.get_executor(),
+				tune_cache, destination), progress, conns), on_done);
+		};
+
+		// A connection that cannot be made ends the session (the others are let go)
+		auto on_connect_failed = [&io_context, &clients, &exit_code](std::error_code)
+			{
+				exit_code = 1;
+				for (auto& client : clients) {
+					if (auto conn = client->GetConnection()) conn->shutdown();
+				}
+				io_context.stop();
+			};
+
+		for (std::size_t i = 0; i < clients.size(); ++i) {
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+			if (!local_socket.empty()) {
+				clients[i]->ConnectLocal(local_socket, on_connected, on_connect_failed);
+				continue;
+			}
+#endif
+			// Connect to the provided host (each its share of a cluster) on port 8080
+			clients[i]->Connect(cluster ? server_hosts[i / streams] : connect_host, connect_port, on_connected, on_connect_failed);
+		}
+
+		// The Engine: Pumps the network and the upload coroutine, until the session is closed
+		cw::network::runEventLoop(io_context, spin);
+		write_trace();
+		return exit_code;
 	}
 	catch (std::exception& e) {
 		std::cerr << "Exception: " << e.what() << "\n";
 	}
 
-	return 0;
+	return 1;
 }
\ No newline at end of file
@@ -1,86 +1,427 @@
 #pragma once
+#include <cassert>
+#include <chrono>
 #include <vector>
 #include <cstdint>
 #include <concepts>
+#include <memory>
 #include <stdexcept>
+#include <type_traits>
 
 // Ensure this matches your file name (e.g. src/cw/endian.h)
 #include "endian.h" 
 #include "protocol/packet/packet_type.h"
+#include "protocol/packet/wire_layout.h"
+#include "cw/buffer/shared_buffer.h"
+#include "cw/buffer/buffer_pool.h"
+#include "cw/file/file_handle.h"
 
 namespace cw {
 	namespace packet {
 
 		// View to parsed frame buffer.
-		// Optimized Order: Pointer (8) -> Size (8) -> Type (2) -> Padding (6)
+		// Optimized Order: Pointer (8) -> Size (8) -> Type (2) -> Order (1) -> Padding (5)
 		struct ParsedFrame
 		{
 			const uint8_t* payload_view; // Reverted to payload_view as requested
 			std::size_t size;
 			PacketType type;
+			WireOrder order = WireOrder::BigEndian; // Of the payload's fixed fields (a native frame's chunk header)
 		};
 
+		// A packet writes itself (payloadSize and serialize by hand) or has
+		// them generated from a fixed WireLayout (FixedLayoutPacket).
 		template<typename T>
 		concept FrameBuildable =
-			requires(const T pkt, std::vector<uint8_t>&out) {
+			requires(const T pkt, cw::binary::ByteWriter& out) {
 				{ T::type } -> std::convertible_to<cw::packet::PacketType>;
 				{ pkt.payloadSize() } -> std::same_as<std::size_t>;
 				{ pkt.serialize(out) } -> std::same_as<void>;
 		};
 
-		template<FrameBuildable P>
-		std::vector<uint8_t> buildFrame(const P& packet) {
+		// Packets whose whole payload is their Layout: the frame has a size
+		// known at compile time (fixedFrameSize)
+		template<typename T>
+		concept FixedFrameBuildable = FrameBuildable<T> &&
+			requires { { T::Layout::SIZE } -> std::convertible_to<std::size_t>; } &&
+			std::derived_from<T, FixedLayoutPacket<T>>;
+
+		// Header: [Length: 8 bytes] + [Type: 2 bytes]
+		constexpr std::size_t FRAME_HEADER_SIZE = sizeof(uint64_t) + sizeof(uint16_t);
+
+		// Compact header: [Version: 1 byte = 2] + [Type: 1 byte] + [Length: varint,
+		// 7 bits per byte, low bits first]. A classic header always starts with
+		// a zero byte (lengths are far below 2^56), so the first byte tells the
+		// formats apart frame by frame and both can share a stream. Sent only
+		// to peers announcing CAP_COMPACT_FRAMES; an Ack's header shrinks from
+		// 10 bytes to 3.
+		constexpr uint8_t COMPACT_FRAME_VERSION = 2;
+		constexpr std::size_t MAX_COMPACT_HEADER_SIZE = 2 + 4; // 4 varint bytes cover MAX_FRAME_PAYLOAD_SIZE
+
+		// Native frame: a compact header with version byte 3, on a FileChunk
+		// whose chunk header is little-endian (ChunkHeader::Packed) rather
+		// than big-endian, so that between two little-endian hosts it is
+		// written and read with one copy and no byteswaps. Sent only to
+		// peers announcing CAP_NATIVE_FRAMES, by a little-endian host.
+		constexpr uint8_t NATIVE_FRAME_VERSION = 3;
+
+		enum class FrameFormat : uint8_t
+		{
+			Classic,
+			Compact,
+			Native
+		};
+
+		// Types above 255 have no compact form and keep the classic header;
+		// only FileChunk has a native form, the others are compact
+		constexpr FrameFormat effectiveFormat(FrameFormat format, PacketType type) noexcept
+		{
+			if (static_cast<uint16_t>(type) > 0xFF) return FrameFormat::Classic;
+			if (format == FrameFormat::Native && type != PacketType::FileChunk) return FrameFormat::Compact;
+			return format;
+		}
+
+		constexpr WireOrder wireOrder(FrameFormat format, PacketType type) noexcept
+		{
+			return effectiveFormat(format, type) == FrameFormat::Native ? WireOrder::LittleEndian : WireOrder::BigEndian;
+		}
+
+		// serializeHeader/serialize, passing the frame's byte order to packets that have one
+		template<typename P>
+		void writeFixedFields(const P& packet, cw::binary::ByteWriter& writer, FrameFormat format)
+		{
+			if constexpr (requires { packet.serializeHeader(writer, WireOrder{}); }) packet.serializeHeader(writer, wireOrder(format, P::type));
+			else packet.serializeHeader(writer);
+		}
+
+		template<typename P>
+		void writePayload(const P& packet, cw::binary::ByteWriter& writer, FrameFormat format)
+		{
+			if constexpr (requires { packet.serialize(writer, WireOrder{}); }) packet.serialize(writer, wireOrder(format, P::type));
+			else packet.serialize(writer);
+		}
+
+		constexpr std::size_t frameHeaderSize(std::size_t payloadSz, PacketType type, FrameFormat format) noexcept
+		{
+			if (effectiveFormat(format, type) == FrameFormat::Classic) return FRAME_HEADER_SIZE;
+
+			std::size_t varintBytes = 1;
+			for (uint64_t rest = payloadSz >> 7; rest != 0; rest >>= 7) ++varintBytes;
+			return 2 + varintBytes;
+		}
+
+		template<FixedFrameBuildable P>
+		constexpr std::size_t fixedFrameSize(FrameFormat format = FrameFormat::Classic) noexcept
+		{
+			return frameHeaderSize(P::Layout::SIZE, P::type, format) + P::Layout::SIZE;
+		}
+
+		inline void writeFrameHeaderFields(cw::binary::ByteWriter& writer, std::size_t payloadSz, PacketType type, FrameFormat format) noexcept
+		{
+			if (effectiveFormat(format, type) == FrameFormat::Classic) {
+				// Note: We write LENGTH (8 bytes) then TYPE (2 bytes)
+				writer.write<uint64_t>(static_cast<uint64_t>(payloadSz));
+				writer.write<uint16_t>(static_cast<uint16_t>(type));
+				return;
+			}
+
+			writer.write<uint8_t>(effectiveFormat(format, type) == FrameFormat::Native ? NATIVE_FRAME_VERSION : COMPACT_FRAME_VERSION);
+			writer.write<uint8_t>(static_cast<uint8_t>(type));
+			uint64_t rest = payloadSz;
+			while (rest >= 0x80) {
+				writer.write<uint8_t>(static_cast<uint8_t>(rest | 0x80));
+				rest >>= 7;
+			}
+			writer.write<uint8_t>(static_cast<uint8_t>(rest));
+		}
+
+		// Serializes 'packet' as a frame into 'result', sized here from payloadSize()
+		template<FrameBuildable P, typename Bytes>
+		void writeFrame(const P& packet, FrameFormat format, Bytes& result) {
 
 			std::size_t payloadSz = packet.payloadSize();
 
-			// Header: [Type: 2 bytes] + [Length: 8 bytes]
-			constexpr std::size_t HEADER_SIZE = sizeof(uint16_t) + sizeof(uint64_t);
-			std::size_t totalSize = HEADER_SIZE + payloadSz;
+			std::size_t totalSize = frameHeaderSize(payloadSz, P::type, format) + payloadSz;
 
-			std::vector<uint8_t> result;
-			result.reserve(totalSize);
+			// Sized once from payloadSize(): every field is then a plain store
+			result.resize(totalSize);
+			cw::binary::ByteWriter writer(result.data());
 
-			// Note: We write LENGTH (8 bytes) then TYPE (2 bytes)
-			// Use 'template' keyword for MSVC compatibility
-			cw::binary::template writeBigEndian<uint64_t>(result, static_cast<uint64_t>(payloadSz));
-			cw::binary::template writeBigEndian<uint16_t>(result, static_cast<uint16_t>(P::type));
+			writeFrameHeaderFields(writer, payloadSz, P::type, format);
 
-			packet.serialize(result);
+			writePayload(packet, writer, format);
+			assert(writer.position() == result.data() + result.size() && "payloadSize() disagrees with serialize()");
+		}
 
+		template<FrameBuildable P>
+		std::vector<uint8_t> buildFrame(const P& packet, FrameFormat format = FrameFormat::Classic) {
+			std::vector<uint8_t> result = cw::buffer::HeaderPool::acquire(frameHeaderSize(packet.payloadSize(), P::type, format) + packet.payloadSize());
+			writeFrame(packet, format, result);
 			return result;
 		}
 
-		inline ParsedFrame parseFrame(const std::vector<uint8_t>& buffer) {
+		// The frame in memory from 'allocator' (e.g. a std::pmr arena) instead
+		// of the header pool
+		template<FrameBuildable P, typename Allocator>
+			requires std::same_as<typename Allocator::value_type, uint8_t>
+		std::vector<uint8_t, Allocator> buildFrame(const P& packet, const Allocator& allocator, FrameFormat format = FrameFormat::Classic) {
+			std::vector<uint8_t, Allocator> result(allocator);
+			writeFrame(packet, format, result);
+			return result;
+		}
+
+		// Scheduling class of an outgoing frame (see Connection::send). Classes
+		// share the socket by weight, so an urgent file overtakes the chunks
+		// of a background upload queued ahead of it without starving them.
+		enum class Priority : std::uint8_t { Urgent, Normal, Background };
+		constexpr std::size_t PRIORITY_CLASSES = 3;
+
+		// Scatter/gather frame: a small inline header plus an optional ref-counted
+		// payload segment. Written with one gathered async_write, so bulk payloads
+		// go from their original buffer to the socket without being copied.
+		struct OutgoingFrame
+		{
+			std::vector<uint8_t> header;        // Frame header + packet fixed fields (or the whole frame)
+			cw::buffer::SharedBuffer payload;   // Optional trailing bytes, sent as-is
+			cw::file::FileSegment file;         // Optional trailing file range, copied by the kernel
+			std::shared_ptr<const cw::file::FileHandle> descriptor; // Optional file passed with the header (SCM_RIGHTS)
+			std::chrono::steady_clock::time_point enqueuedAt; // Set by Connection::send, for the send latency
+			Priority priority = Priority::Normal;             // Set by Connection::send
+			bool keepalive = false;                           // Ping/Pong: not traffic to the idle timeout
+			std::uint32_t streamId = 0;                       // A file's data frame: dropped if its stream fails
+
+			std::size_t size() const { return header.size() + payload.size() + file.length; }
+		};
+
+		// Packets whose trailing bytes can be referenced instead of serialized.
+		// serializeHeader writes everything except payloadSegment().
+		template<typename T>
+		concept SegmentedFrameBuildable =
+			requires(const T pkt, cw::binary::ByteWriter& out) {
+				{ T::type } -> std::convertible_to<cw::packet::PacketType>;
+				{ pkt.payloadSize() } -> std::same_as<std::size_t>;
+				{ pkt.serializeHeader(out) } -> std::same_as<void>;
+				{ pkt.payloadSegment() } -> std::convertible_to<cw::buffer::SharedBuffer>;
+		};
+
+		// Frame header plus the packet's fixed fields ('headerPayloadSz' bytes of the
+		// payload), written in one pass into a buffer sized up front.
+		template<typename P>
+		std::vector<uint8_t> writeFrameHeader(const P& packet, std::size_t payloadSz, std::size_t headerPayloadSz, FrameFormat format) {
 
-			constexpr size_t HEADER_SIZE = sizeof(uint16_t) + sizeof(uint64_t);
+			std::size_t headerSz = frameHeaderSize(payloadSz, P::type, format) + headerPayloadSz;
+			std::vector<uint8_t> header = cw::buffer::HeaderPool::acquire(headerSz);
+			header.resize(headerSz);
+			cw::binary::ByteWriter writer(header.data());
+
+			writeFrameHeaderFields(writer, payloadSz, P::type, format);
+
+			writeFixedFields(packet, writer, format);
+			assert(writer.position() == header.data() + header.size() && "payloadSize() disagrees with serializeHeader()");
+
+			return header;
+		}
 
-			if (buffer.size() < HEADER_SIZE) {
-				throw std::runtime_error("Incomplete Frame Header");
+		template<SegmentedFrameBuildable P>
+		OutgoingFrame buildOutgoingFrame(const P& packet, FrameFormat format = FrameFormat::Classic) {
+
+			std::size_t payloadSz = packet.payloadSize();
+			cw::buffer::SharedBuffer segment = packet.payloadSegment();
+
+			OutgoingFrame frame;
+			frame.header = writeFrameHeader<P>(packet, payloadSz, payloadSz - segment.size(), format);
+			frame.payload = std::move(segment);
+
+			return frame;
+		}
+
+		// Packets that own their trailing bytes and give them up when sent as an
+		// rvalue: buildOutgoingFrame(std::move(chunk)) keeps the buffer as the
+		// payload segment, so a caller that already owns it pays no copy.
+		template<typename T>
+		concept OwnedSegmentFrameBuildable = !std::is_reference_v<T> && !SegmentedFrameBuildable<T> &&
+			requires(T pkt, cw::binary::ByteWriter& out) {
+				{ T::type } -> std::convertible_to<cw::packet::PacketType>;
+				{ pkt.payloadSize() } -> std::same_as<std::size_t>;
+				{ pkt.serializeHeader(out) } -> std::same_as<void>;
+				{ pkt.payloadSegmentSize() } -> std::same_as<std::size_t>;
+				{ pkt.takePayloadSegment() } -> std::convertible_to<cw::buffer::SharedBuffer>;
+		};
+
+		template<OwnedSegmentFrameBuildable P>
+		OutgoingFrame buildOutgoingFrame(P&& packet, FrameFormat format = FrameFormat::Classic) {
+
+			std::size_t payloadSz = packet.payloadSize();
+
+			// The header describes the bytes before they are taken
+			OutgoingFrame frame;
+			frame.header = writeFrameHeader<P>(packet, payloadSz, payloadSz - packet.payloadSegmentSize(), format);
+			frame.payload = packet.takePayloadSegment();
+
+			return frame;
+		}
+
+		// Packets whose trailing bytes are a file range sent with sendfile/TransmitFile.
+		template<typename T>
+		concept FileSegmentFrameBuildable =
+			requires(const T pkt, cw::binary::ByteWriter& out) {
+				{ T::type } -> std::convertible_to<cw::packet::PacketType>;
+				{ pkt.payloadSize() } -> std::same_as<std::size_t>;
+				{ pkt.serializeHeader(out) } -> std::same_as<void>;
+				{ pkt.fileSegment() } -> std::convertible_to<cw::file::FileSegment>;
+		};
+
+		template<FileSegmentFrameBuildable P>
+		OutgoingFrame buildOutgoingFrame(const P& packet, FrameFormat format = FrameFormat::Classic) {
+
+			std::size_t payloadSz = packet.payloadSize();
+
+			OutgoingFrame frame;
+			frame.file = packet.fileSegment();
+			frame.header = writeFrameHeader<P>(packet, payloadSz, payloadSz - frame.file.length, format);
+
+			return frame;
+		}
+
+		// Packets that carry an open file to the peer over a local socket
+		template<typename T>
+		concept DescriptorFrameBuildable = FrameBuildable<T> &&
+			requires(const T pkt) {
+				{ pkt.descriptor() } -> std::convertible_to<std::shared_ptr<const cw::file::FileHandle>>;
+		};
+
+		template<DescriptorFrameBuildable P>
+		OutgoingFrame buildOutgoingFrame(const P& packet, FrameFormat format = FrameFormat::Classic) {
+			OutgoingFrame frame;
+			frame.header = buildFrame(packet, format);
+			frame.descriptor = packet.descriptor();
+			return frame;
+		}
+
+		template<FrameBuildable P>
+			requires (!SegmentedFrameBuildable<P> && !FileSegmentFrameBuildable<P> && !DescriptorFrameBuildable<P>)
+		OutgoingFrame buildOutgoingFrame(const P& packet, FrameFormat format = FrameFormat::Classic) {
+			OutgoingFrame frame;
+			frame.header = buildFrame(packet, format);
+			return frame;
+		}
+
+		// Upper bound for a declared payload length. The largest packet is a
+		// FileChunk (MAX_CHUNK_SIZE + its own 21-byte header), so anything above
+		// this is garbage or hostile and the stream cannot be resynchronised.
+		constexpr std::size_t MAX_FRAME_PAYLOAD_SIZE = 16 * 1024 * 1024;
+
+		enum class ParseStatus : uint8_t
+		{
+			NeedMoreData,  // Normal TCP fragmentation: wait for the next read
+			Complete,      // 'frame' is valid
+			ProtocolError  // Stream is corrupt: drop the connection
+		};
+
+		struct ParseResult
+		{
+			ParseStatus status;
+			ParsedFrame frame;
+			std::size_t headerSize = 0; // Frame bytes before the payload: consume headerSize + frame.size
+		};
+
+		// Header of the frame at 'data', either format, with frame.payload_view
+		// left unset. NeedMoreData until the whole header is there.
+		inline ParseResult tryParseFrameHeader(const uint8_t* data, std::size_t size) noexcept {
+
+			ParseResult result{ ParseStatus::NeedMoreData, {} };
+			if (size == 0) return result;
+
+			uint64_t payloadLen = 0;
+			uint16_t typeVal = 0;
+
+			if (data[0] == COMPACT_FRAME_VERSION || data[0] == NATIVE_FRAME_VERSION) {
+				if (size < 3) return result;
+				typeVal = data[1];
+
+				// Only a FileChunk is sent native
+				if (data[0] == NATIVE_FRAME_VERSION) {
+					if (typeVal != static_cast<uint16_t>(PacketType::FileChunk)) {
+						result.status = ParseStatus::ProtocolError;
+						return result;
+					}
+					result.frame.order = WireOrder::LittleEndian;
+				}
+
+				std::size_t cursor = 2;
+				for (unsigned shift = 0;; shift += 7) {
+					if (cursor == MAX_COMPACT_HEADER_SIZE) {
+						result.status = ParseStatus::ProtocolError;
+						return result;
+					}
+					if (cursor == size) return result;
+
+					uint8_t byte = data[cursor++];
+					payloadLen |= static_cast<uint64_t>(byte & 0x7F) << shift;
+					if ((byte & 0x80) == 0) break;
+				}
+				result.headerSize = cursor;
+			}
+			else if (data[0] == 0) {
+				if (size < FRAME_HEADER_SIZE) return result;
+
+				// Read Length (8 bytes), then Type (2 bytes)
+				payloadLen = cw::binary::template readBigEndian<uint64_t>(data);
+				typeVal = cw::binary::template readBigEndian<uint16_t>(data + sizeof(uint64_t));
+				result.headerSize = FRAME_HEADER_SIZE;
+			}
+			else {
+				// No known format (or a length over 2^56)
+				result.status = ParseStatus::ProtocolError;
+				return result;
 			}
 
-			const uint8_t* ptr = buffer.data();
+			if (payloadLen > MAX_FRAME_PAYLOAD_SIZE) {
+				result.status = ParseStatus::ProtocolError;
+				return result;
+			}
+
+			result.status = ParseStatus::Complete;
+			result.frame.size = static_cast<size_t>(payloadLen);
+			result.frame.type = static_cast<PacketType>(typeVal);
+			return result;
+		}
 
-			// Read Length (8 bytes)
-			uint64_t payloadLen = cw::binary::template readBigEndian<uint64_t>(ptr);
-			ptr += sizeof(uint64_t); // Advance pointer
+		// Non-throwing parser used on the receive path.
+		// The partial-frame case costs two comparisons and no exception.
+		inline ParseResult tryParseFrame(const uint8_t* data, std::size_t size) noexcept {
+
+			ParseResult result = tryParseFrameHeader(data, size);
+			if (result.status != ParseStatus::Complete) return result;
 
 			// Bounds Check (Safe Subtraction)
-			if (buffer.size() - HEADER_SIZE < payloadLen)
-			{
-				throw std::runtime_error("Incomplete Frame Body");
+			if (size - result.headerSize < result.frame.size) {
+				result.status = ParseStatus::NeedMoreData;
+				return result;
 			}
 
-			// Read Type (2 bytes)
-			// Added 'template' keyword here too
-			uint16_t typeVal = cw::binary::template readBigEndian<uint16_t>(ptr);
-			ptr += sizeof(uint16_t);
+			result.frame.payload_view = data + result.headerSize;
+			return result;
+		}
 
-			ParsedFrame result;
-			result.payload_view = ptr;      // Using payload_view as requested
-			result.size = static_cast<size_t>(payloadLen);
-			result.type = static_cast<PacketType>(typeVal);
+		// Throwing wrapper, kept for callers that treat a short buffer as an error.
+		inline ParsedFrame parseFrame(const uint8_t* data, std::size_t size) {
 
-			return result;
+			ParseResult result = tryParseFrame(data, size);
+
+			switch (result.status)
+			{
+			case ParseStatus::Complete:
+				return result.frame;
+			case ParseStatus::ProtocolError:
+				throw std::runtime_error("Frame length exceeds protocol limit");
+			default:
+				throw std::runtime_error(tryParseFrameHeader(data, size).status != ParseStatus::Complete ? "Incomplete Frame Header" : "Incomplete Frame Body");
+			}
+		}
+
+		inline ParsedFrame parseFrame(const std::vector<uint8_t>& buffer) {
+			return parseFrame(buffer.data(), buffer.size());
 		}
 	}
 }
\ No newline at end of file
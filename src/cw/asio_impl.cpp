@@ -0,0 +1,11 @@
+// asio's non-template code, compiled once into the cw library instead of in
+// every translation unit that includes <asio.hpp>: targets build and link
+// faster and carry one copy of asio's statics. Only with
+// ASIO_SEPARATE_COMPILATION (CW_ASIO_SEPARATE_COMPILATION, the default);
+// otherwise asio stays header-only and this file is empty.
+#if defined(ASIO_SEPARATE_COMPILATION)
+#include <asio/impl/src.hpp>
+#if defined(CW_HAS_TLS)
+#include <asio/ssl/impl/src.hpp>
+#endif
+#endif
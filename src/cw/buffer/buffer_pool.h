@@ -0,0 +1,462 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <vector>
+
+#include "cw/buffer/huge_page_arena.h"
+#include "cw/buffer/shared_buffer.h"
+
+namespace cw::buffer {
+
+	// Size-classed free lists for chunk payloads and frame headers, so a
+	// steady-state transfer reuses the same few blocks instead of hitting the
+	// heap for every chunk.
+	// Each thread keeps a small cache per class; blocks freed on another thread
+	// than the one that took them (read on the file pool, released when the
+	// socket write completes on the io thread) flow back through a shared depot
+	// in batches, so the mutex is taken once per batch rather than per chunk.
+	// On NUMA machines each node has its own depot (see setThreadNode), so a
+	// block freed by the threads of one node is only reused by them.
+	// Blocks come from the heap, or from a HugePageArena once useHugePages()
+	// was called, and from the heap again once the arena is used up.
+	class BufferPool
+	{
+	public:
+		// Classes are powers of two from 1 KiB to 16 MiB, each with room for an
+		// allocator header (a shared_ptr control block) on top.
+		static constexpr std::size_t MIN_CLASS_SIZE = 1024;
+		static constexpr std::size_t CLASS_COUNT = 15;
+		static constexpr std::size_t HEADER_SLACK = 64;
+
+		static constexpr std::size_t THREAD_CACHE_BYTES = 8 * 1024 * 1024;  // Per thread and class
+		static constexpr std::size_t DEPOT_BYTES = 64 * 1024 * 1024;        // Per class and node
+		static constexpr std::size_t MAX_NODES = 8;                          // Higher nodes share depots
+
+		struct Stats
+		{
+			std::uint64_t heapAllocations = 0; // Blocks that had to come from the heap
+			std::uint64_t reused = 0;          // Blocks served from a cache or the depot
+		};
+
+		static BufferPool& instance()
+		{
+			static BufferPool pool;
+			return pool;
+		}
+
+		// Requests above the largest class go straight to the heap.
+		void* allocate(std::size_t size)
+		{
+			std::size_t index = classFor(size);
+			if (index == CLASS_COUNT) {
+				m_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+				return ::operator new(size);
+			}
+
+			if (cacheGone() || poolGone()) {
+				m_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+				return ::operator new(capacityOf(index));
+			}
+
+			auto& local = localCache();
+			auto& cache = local.lists[index];
+			if (cache.empty()) refill(local.node, index, cache);
+
+			if (!cache.empty()) {
+				void* block = cache.back();
+				cache.pop_back();
+				m_reused.fetch_add(1, std::memory_order_relaxed);
+				return block;
+			}
+
+			if (auto* arena = currentArena().load(std::memory_order_acquire)) {
+				if (void* block = arena->take(capacityOf(index))) return block;
+			}
+			m_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+			return ::operator new(capacityOf(index));
+		}
+
+		void deallocate(void* block, std::size_t size) noexcept
+		{
+			std::size_t index = classFor(size);
+			if (index == CLASS_COUNT) {
+				::operator delete(block);
+				return;
+			}
+
+			// Freed at exit after this thread's cache or the pool itself went
+			// (a static that held pooled objects, a thread still running):
+			// back to the heap, which every block came from
+			if (cacheGone() || poolGone()) {
+				release(block);
+				return;
+			}
+
+			auto& local = localCache();
+			auto& cache = local.lists[index];
+			if (cache.capacity() == 0) cache.reserve(cacheLimit(index)); // Never grown again
+			if (cache.size() >= cacheLimit(index)) spill(local.node, index, cache);
+			cache.push_back(block);
+		}
+
+		// Stocks the calling thread's node depot with up to 'count' blocks for
+		// requests of 'size' (within the depot's limit), taken from the heap
+		// now rather than by the first transfers, or by a later peak of them
+		void prefill(std::size_t size, std::size_t count)
+		{
+			std::size_t index = classFor(size);
+			if (index == CLASS_COUNT || cacheGone() || poolGone()) return;
+
+			std::size_t node = localCache().node;
+			std::lock_guard lock(m_depots[node].mutex);
+			auto& depot = m_depots[node].lists[index];
+			depot.reserve(depotLimit(index)); // Spills never grow it after this
+			while (count-- > 0 && depot.size() < depotLimit(index)) {
+				void* block = nullptr;
+				if (auto* arena = currentArena().load(std::memory_order_acquire)) block = arena->take(capacityOf(index));
+				if (!block) {
+					m_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+					block = ::operator new(capacityOf(index));
+				}
+				depot.push_back(block);
+			}
+		}
+
+		Stats stats() const
+		{
+			return { m_heapAllocations.load(std::memory_order_relaxed), m_reused.load(std::memory_order_relaxed) };
+		}
+
+		static constexpr std::size_t capacityOf(std::size_t index) { return (MIN_CLASS_SIZE << index) + HEADER_SLACK; }
+
+		// Backs blocks taken from now on with an arena of 'bytes' of huge
+		// pages (see HugePageArena), for pooled payloads the CPU copies,
+		// checksums and compresses at memory speed. Call once at startup,
+		// before the transfers; later calls keep the first arena. The arena
+		// is never unmapped: blocks of it may be dropped by any thread until
+		// the process exits. Throws std::runtime_error if nothing can be mapped.
+		HugePageArena::Backing useHugePages(std::size_t bytes)
+		{
+			std::lock_guard lock(m_arenaMutex);
+			if (auto* arena = currentArena().load(std::memory_order_acquire)) return arena->backing();
+			auto* arena = new HugePageArena(bytes);
+			currentArena().store(arena, std::memory_order_release);
+			return arena->backing();
+		}
+
+		// The arena set up by useHugePages, or nullptr
+		const HugePageArena* hugePages() const { return currentArena().load(std::memory_order_acquire); }
+
+		// The NUMA node the calling thread runs on (it was pinned there): its
+		// cache trades blocks with that node's depot. Threads default to node 0.
+		static void setThreadNode(int node)
+		{
+			if (cacheGone()) return;
+			localCache().node = static_cast<std::size_t>(node < 0 ? 0 : node) % MAX_NODES;
+		}
+
+	private:
+		BufferPool() = default;
+
+		~BufferPool()
+		{
+			for (auto& depot : m_depots) {
+				std::lock_guard lock(depot.mutex);
+				poolGone().store(true, std::memory_order_release);
+				for (auto& list : depot.lists) {
+					for (void* block : list) release(block);
+					list.clear();
+				}
+			}
+		}
+
+		static constexpr std::size_t classFor(std::size_t size)
+		{
+			std::size_t index = 0;
+			while (index < CLASS_COUNT && capacityOf(index) < size) ++index;
+			return index;
+		}
+
+		static constexpr std::size_t cacheLimit(std::size_t index) { return std::max<std::size_t>(2, THREAD_CACHE_BYTES / capacityOf(index)); }
+		static constexpr std::size_t depotLimit(std::size_t index) { return std::max<std::size_t>(4, DEPOT_BYTES / capacityOf(index)); }
+
+		struct ThreadCache
+		{
+			std::array<std::vector<void*>, CLASS_COUNT> lists;
+			std::size_t node = 0;
+
+			~ThreadCache()
+			{
+				cacheGone() = true;
+
+				// Statics outlive the main thread's thread_locals, so the depot
+				// is usually still there; not for a thread that ends after exit()
+				// began. Whatever it cannot take goes back to the heap.
+				if (poolGone().load(std::memory_order_acquire)) {
+					for (auto& list : lists) {
+						for (void* block : list) release(block);
+					}
+					return;
+				}
+				auto& pool = BufferPool::instance();
+				for (std::size_t index = 0; index < CLASS_COUNT; ++index) pool.spill(node, index, lists[index], true);
+			}
+		};
+
+		static ThreadCache& localCache()
+		{
+			thread_local ThreadCache cache;
+			return cache;
+		}
+
+		// Set once this thread's cache is destroyed; trivially destructible,
+		// so still readable by the destructors that run after it
+		static bool& cacheGone()
+		{
+			thread_local bool gone = false;
+			return gone;
+		}
+
+		// Set by ~BufferPool; constant-initialized and trivially destructible,
+		// so it outlives the pool
+		static std::atomic<bool>& poolGone()
+		{
+			static constinit std::atomic<bool> gone = false;
+			return gone;
+		}
+
+		// Takes half a cache's worth of blocks from the node's depot
+		void refill(std::size_t node, std::size_t index, std::vector<void*>& cache)
+		{
+			std::lock_guard lock(m_depots[node].mutex);
+			if (poolGone().load(std::memory_order_relaxed)) return;
+			auto& depot = m_depots[node].lists[index];
+			std::size_t take = std::min(depot.size(), std::max<std::size_t>(1, cacheLimit(index) / 2));
+			if (take > 0 && cache.capacity() == 0) cache.reserve(cacheLimit(index));
+			cache.insert(cache.end(), depot.end() - static_cast<std::ptrdiff_t>(take), depot.end());
+			depot.resize(depot.size() - take);
+		}
+
+		// Moves half the cache (all of it when 'everything') to the node's depot
+		void spill(std::size_t node, std::size_t index, std::vector<void*>& cache, bool everything = false)
+		{
+			std::size_t give = everything ? cache.size() : cache.size() / 2 + 1;
+			give = std::min(give, cache.size());
+
+			std::lock_guard lock(m_depots[node].mutex);
+			bool gone = poolGone().load(std::memory_order_relaxed);
+			auto& depot = m_depots[node].lists[index];
+			for (std::size_t i = 0; i < give; ++i) {
+				void* block = cache.back();
+				cache.pop_back();
+				// Arena blocks stay pooled: the arena bounds them, and they cannot be freed
+				if (!gone && (depot.size() < depotLimit(index) || ownedByArena(block))) depot.push_back(block);
+				else release(block);
+			}
+		}
+
+		// Set by useHugePages and leaked on purpose: constant-initialized, so
+		// blocks dropped after the pool went can still be recognized
+		static std::atomic<HugePageArena*>& currentArena()
+		{
+			static constinit std::atomic<HugePageArena*> current = nullptr;
+			return current;
+		}
+
+		static bool ownedByArena(const void* block)
+		{
+			auto* arena = currentArena().load(std::memory_order_acquire);
+			return arena && arena->owns(block);
+		}
+
+		// Back to the heap, unless the block is part of the arena (which outlives the pool)
+		static void release(void* block)
+		{
+			if (!ownedByArena(block)) ::operator delete(block);
+		}
+
+		struct Depot
+		{
+			std::mutex mutex;
+			std::array<std::vector<void*>, CLASS_COUNT> lists;
+		};
+
+	private:
+		std::array<Depot, MAX_NODES> m_depots;
+
+		std::mutex m_arenaMutex;
+
+		std::atomic<std::uint64_t> m_heapAllocations = 0;
+		std::atomic<std::uint64_t> m_reused = 0;
+	};
+
+	// Standard allocator over BufferPool. Used for pooled vectors and, through
+	// allocate_shared, for payloads and their control block in one block.
+	template<typename T>
+	struct PoolAllocator
+	{
+		using value_type = T;
+
+		PoolAllocator() = default;
+		template<typename U>
+		PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+		T* allocate(std::size_t n) { return static_cast<T*>(BufferPool::instance().allocate(n * sizeof(T))); }
+		void deallocate(T* p, std::size_t n) noexcept { BufferPool::instance().deallocate(p, n * sizeof(T)); }
+
+		template<typename U>
+		bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+	};
+
+	// Writable pooled bytes. Filled in place (a file read, a received chunk),
+	// then frozen into a SharedBuffer; the block returns to the pool when the
+	// last SharedBuffer copy is dropped, e.g. when the socket write completes.
+	class PooledBuffer
+	{
+	public:
+		PooledBuffer() = default;
+
+		// Contents are uninitialized
+		explicit PooledBuffer(std::size_t size)
+			: m_bytes(std::allocate_shared_for_overwrite<std::uint8_t[]>(PoolAllocator<std::uint8_t>{}, size)),
+			m_size(size)
+		{
+		}
+
+		// data() at a multiple of 'alignment' (a power of two), for unbuffered
+		// I/O (see cw::file::DIRECT_IO_ALIGNMENT). The block carries up to
+		// alignment - 1 bytes of slack, so it may come from the next size class.
+		PooledBuffer(std::size_t size, std::size_t alignment)
+			: m_bytes(std::allocate_shared_for_overwrite<std::uint8_t[]>(PoolAllocator<std::uint8_t>{}, size + alignment - 1)),
+			m_size(size)
+		{
+			auto address = reinterpret_cast<std::uintptr_t>(m_bytes.get());
+			m_offset = static_cast<std::size_t>((alignment - address % alignment) % alignment);
+		}
+
+		std::uint8_t* data() { return m_bytes.get() + m_offset; }
+		std::size_t size() const { return m_size; }
+		std::span<std::uint8_t> span() { return { data(), m_size }; }
+
+		// A short read: keeps the first 'size' bytes
+		void shrink(std::size_t size) { m_size = std::min(size, m_size); }
+
+		SharedBuffer share() &&
+		{
+			std::span<const std::uint8_t> view(data(), m_size);
+			m_size = 0;
+			return SharedBuffer(std::move(m_bytes), view);
+		}
+
+	private:
+		std::shared_ptr<std::uint8_t[]> m_bytes;
+		std::size_t m_offset = 0; // Of data() in m_bytes
+		std::size_t m_size = 0;
+	};
+
+	// Pooled copy of bytes that do not outlive their buffer (the receive buffer).
+	inline SharedBuffer pooledCopy(std::span<const std::uint8_t> bytes)
+	{
+		PooledBuffer buffer(bytes.size());
+		std::copy(bytes.begin(), bytes.end(), buffer.data());
+		return std::move(buffer).share();
+	}
+
+	// Recycled frame header vectors. Headers are a few dozen bytes, but one is
+	// built per frame; reusing the vectors (with their capacity) keeps that off
+	// the heap too. Taken where frames are built, returned once written; both
+	// happen on the io thread for the coroutine uploads, so a per-thread cache
+	// is enough (headers built elsewhere just fall back to the heap).
+	class HeaderPool
+	{
+	public:
+		static constexpr std::size_t MAX_RETAINED_CAPACITY = 4096; // Larger (whole-frame) vectors are freed
+		static constexpr std::size_t THREAD_CACHE_SIZE = 256;
+
+		static std::vector<std::uint8_t> acquire(std::size_t capacity)
+		{
+			auto& cache = localCache();
+			std::vector<std::uint8_t> header;
+			if (!cache.empty() && capacity <= MAX_RETAINED_CAPACITY) {
+				header = std::move(cache.back());
+				cache.pop_back();
+			}
+			header.reserve(capacity);
+			return header;
+		}
+
+		static void release(std::vector<std::uint8_t>&& header)
+		{
+			if (header.capacity() == 0 || header.capacity() > MAX_RETAINED_CAPACITY) return;
+
+			auto& cache = localCache();
+			if (cache.size() >= THREAD_CACHE_SIZE) return;
+			header.clear();
+			cache.push_back(std::move(header));
+		}
+
+	private:
+		static std::vector<std::vector<std::uint8_t>>& localCache()
+		{
+			thread_local std::vector<std::vector<std::uint8_t>> cache;
+			return cache;
+		}
+	};
+
+	// Recycled lists of buffers: the pieces of a gathered write
+	// (Connection::queueChunkWrite). A list is taken on the io thread and
+	// given back on a disk thread once written, so the lists are shared
+	// rather than cached per thread, one uncontended lock each way.
+	class BufferListPool
+	{
+	public:
+		static constexpr std::size_t MAX_RETAINED = 1024;
+
+		static std::vector<SharedBuffer> acquire(std::size_t capacity)
+		{
+			std::vector<SharedBuffer> list;
+			{
+				auto& pool = shared();
+				std::lock_guard lock(pool.mutex);
+				if (!pool.lists.empty()) {
+					list = std::move(pool.lists.back());
+					pool.lists.pop_back();
+				}
+			}
+			list.reserve(capacity);
+			return list;
+		}
+
+		static void release(std::vector<SharedBuffer>&& list)
+		{
+			if (list.capacity() == 0) return;
+			list.clear();
+
+			auto& pool = shared();
+			std::lock_guard lock(pool.mutex);
+			if (pool.lists.size() < MAX_RETAINED) pool.lists.push_back(std::move(list));
+		}
+
+	private:
+		struct Lists
+		{
+			std::mutex mutex;
+			std::vector<std::vector<SharedBuffer>> lists;
+		};
+
+		// Leaked on purpose: disk threads may give lists back during exit
+		static Lists& shared()
+		{
+			static Lists* pool = new Lists;
+			return *pool;
+		}
+	};
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace cw::buffer {
+
+	// One contiguous mapping backed by 2 MB pages, carved into BufferPool
+	// blocks: a chunk copied, checksummed and compressed at memory speed then
+	// costs a TLB entry per 2 MB instead of per 4 KB. Explicit huge pages
+	// (MAP_HUGETLB on Linux, reserved by the administrator in
+	// /proc/sys/vm/nr_hugepages; MEM_LARGE_PAGES on Windows, which needs the
+	// "Lock pages in memory" privilege) are tried first, then transparent huge
+	// pages (madvise(MADV_HUGEPAGE)), then ordinary pages. The whole arena is
+	// a single region(), so it can be registered once with a kernel interface
+	// that takes fixed buffers (io_uring_register_buffers, RIORegisterBuffer).
+	// Blocks are handed out by a lock-free bump pointer and never given back:
+	// they cycle through the pool's caches instead. The mapping lives until
+	// the arena is destroyed.
+	class HugePageArena
+	{
+	public:
+		static constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+		static constexpr std::size_t BLOCK_ALIGNMENT = 64;
+
+		enum class Backing { HugePages, TransparentHugePages, RegularPages };
+
+		static const char* describe(Backing backing)
+		{
+			switch (backing) {
+			case Backing::HugePages: return "huge pages";
+			case Backing::TransparentHugePages: return "transparent huge pages";
+			default: return "regular pages";
+			}
+		}
+
+		// Maps 'bytes', rounded up to whole huge pages. Throws std::runtime_error
+		// if not even ordinary pages can be mapped.
+		explicit HugePageArena(std::size_t bytes)
+		{
+			m_size = (std::max<std::size_t>(bytes, 1) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+			map();
+		}
+
+		~HugePageArena() { unmap(); }
+
+		HugePageArena(const HugePageArena&) = delete;
+		HugePageArena& operator=(const HugePageArena&) = delete;
+
+		// 'size' bytes of the arena, or nullptr once it is used up. Thread-safe.
+		void* take(std::size_t size)
+		{
+			size = (size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+			std::size_t offset = m_used.fetch_add(size, std::memory_order_relaxed);
+			if (offset > m_size || size > m_size - offset) {
+				m_used.fetch_sub(size, std::memory_order_relaxed);
+				return nullptr;
+			}
+			return m_base + offset;
+		}
+
+		bool owns(const void* block) const
+		{
+			auto* byte = static_cast<const std::uint8_t*>(block);
+			return byte >= m_base && byte < m_base + m_size;
+		}
+
+		Backing backing() const { return m_backing; }
+		std::size_t size() const { return m_size; }
+		std::size_t used() const { return std::min(m_used.load(std::memory_order_relaxed), m_size); }
+
+		std::span<std::uint8_t> region() const { return { m_base, m_size }; }
+
+	private:
+		void map()
+		{
+#if defined(_WIN32)
+			if (SIZE_T large = GetLargePageMinimum(); large != 0 && m_size % large == 0) {
+				m_base = static_cast<std::uint8_t*>(VirtualAlloc(nullptr, m_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+				if (m_base) {
+					m_backing = Backing::HugePages;
+					return;
+				}
+			}
+			m_base = static_cast<std::uint8_t*>(VirtualAlloc(nullptr, m_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+			if (!m_base) throw std::runtime_error("HugePageArena: VirtualAlloc failed");
+			m_backing = Backing::RegularPages;
+#else
+#if defined(MAP_HUGETLB)
+			int hugeFlags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#if defined(MAP_HUGE_SHIFT)
+			hugeFlags |= 21 << MAP_HUGE_SHIFT; // log2(2 MB)
+#endif
+			void* huge = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, hugeFlags, -1, 0);
+			if (huge != MAP_FAILED) {
+				m_base = static_cast<std::uint8_t*>(huge);
+				m_mapped = m_size;
+				m_backing = Backing::HugePages;
+				return;
+			}
+#endif
+			// Ordinary pages, aligned to a huge page so the kernel can back them with ones
+			m_mapped = m_size + HUGE_PAGE_SIZE;
+			void* plain = mmap(nullptr, m_mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (plain == MAP_FAILED) throw std::runtime_error("HugePageArena: mmap failed");
+			m_mapping = static_cast<std::uint8_t*>(plain);
+			auto address = reinterpret_cast<std::uintptr_t>(plain);
+			m_base = m_mapping + ((HUGE_PAGE_SIZE - address % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE);
+			m_backing = Backing::RegularPages;
+#if defined(MADV_HUGEPAGE)
+			if (madvise(m_base, m_size, MADV_HUGEPAGE) == 0) m_backing = Backing::TransparentHugePages;
+#endif
+#endif
+		}
+
+		void unmap()
+		{
+#if defined(_WIN32)
+			if (m_base) VirtualFree(m_base, 0, MEM_RELEASE);
+#else
+			if (m_base) munmap(m_mapping ? m_mapping : m_base, m_mapped);
+#endif
+		}
+
+		std::uint8_t* m_base = nullptr;
+		std::size_t m_size = 0;
+		std::atomic<std::size_t> m_used = 0;
+		Backing m_backing = Backing::RegularPages;
+#if !defined(_WIN32)
+		std::uint8_t* m_mapping = nullptr; // Start of the mapping, when m_base was aligned within it
+		std::size_t m_mapped = 0;
+#endif
+	};
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace cw::buffer {
+
+	// What a connection holds memory for
+	enum class MemoryUse
+	{
+		SendQueue,     // Frames queued, not yet written to the socket
+		ReceiveBuffer, // The receive buffer and a large frame being read
+		WriteBehind,   // Chunks received, not yet on disk
+		Count
+	};
+
+	// Bytes held across every connection charged to it, by use, and the cap
+	// on their total (0: none). Connections charge it through a MemoryAccount
+	// and hold back, as their backpressure allows, while it is exceeded.
+	// Any thread; counters are relaxed atomics.
+	class MemoryBudget
+	{
+	public:
+		explicit MemoryBudget(std::size_t limit = 0) : m_limit(limit) {}
+
+		// The one every connection charges unless given another
+		static std::shared_ptr<MemoryBudget> defaultInstance()
+		{
+			static auto instance = std::make_shared<MemoryBudget>();
+			return instance;
+		}
+
+		void setLimit(std::size_t bytes) { m_limit.store(bytes, std::memory_order_relaxed); }
+		std::size_t limit() const { return m_limit.load(std::memory_order_relaxed); }
+
+		std::size_t used(MemoryUse use) const { return m_used[index(use)].load(std::memory_order_relaxed); }
+
+		std::size_t used() const
+		{
+			std::size_t total = 0;
+			for (const auto& used : m_used) total += used.load(std::memory_order_relaxed);
+			return total;
+		}
+
+		bool exceeded() const
+		{
+			std::size_t cap = limit();
+			return cap != 0 && used() > cap;
+		}
+
+		void add(MemoryUse use, std::size_t bytes) { m_used[index(use)].fetch_add(bytes, std::memory_order_relaxed); }
+		void remove(MemoryUse use, std::size_t bytes) { m_used[index(use)].fetch_sub(bytes, std::memory_order_relaxed); }
+
+	private:
+		static std::size_t index(MemoryUse use) { return static_cast<std::size_t>(use); }
+
+		std::atomic<std::size_t> m_limit;
+		std::array<std::atomic<std::size_t>, static_cast<std::size_t>(MemoryUse::Count)> m_used{};
+	};
+
+	// One connection's share of a MemoryBudget, with a quota of its own (0:
+	// none). Everything still charged is given back when it is destroyed, so
+	// a connection that fails mid-transfer leaves the budget as it found it.
+	class MemoryAccount
+	{
+	public:
+		explicit MemoryAccount(std::shared_ptr<MemoryBudget> budget = MemoryBudget::defaultInstance(), std::size_t quota = 0)
+			: m_budget(std::move(budget)), m_quota(quota)
+		{
+		}
+
+		~MemoryAccount()
+		{
+			for (std::size_t i = 0; i < m_used.size(); ++i) {
+				m_budget->remove(static_cast<MemoryUse>(i), m_used[i].load(std::memory_order_relaxed));
+			}
+		}
+
+		MemoryAccount(const MemoryAccount&) = delete;
+		MemoryAccount& operator=(const MemoryAccount&) = delete;
+
+		const MemoryBudget& budget() const { return *m_budget; }
+
+		void setQuota(std::size_t bytes) { m_quota.store(bytes, std::memory_order_relaxed); }
+		std::size_t quota() const { return m_quota.load(std::memory_order_relaxed); }
+
+		void add(MemoryUse use, std::size_t bytes)
+		{
+			m_used[index(use)].fetch_add(bytes, std::memory_order_relaxed);
+			m_budget->add(use, bytes);
+		}
+
+		void remove(MemoryUse use, std::size_t bytes)
+		{
+			m_used[index(use)].fetch_sub(bytes, std::memory_order_relaxed);
+			m_budget->remove(use, bytes);
+		}
+
+		// For memory sampled rather than counted as it moves (a buffer's capacity).
+		// One writer per use.
+		void set(MemoryUse use, std::size_t bytes)
+		{
+			std::size_t before = m_used[index(use)].exchange(bytes, std::memory_order_relaxed);
+			if (bytes > before) m_budget->add(use, bytes - before);
+			else if (before > bytes) m_budget->remove(use, before - bytes);
+		}
+
+		std::size_t used(MemoryUse use) const { return m_used[index(use)].load(std::memory_order_relaxed); }
+
+		std::size_t used() const
+		{
+			std::size_t total = 0;
+			for (const auto& used : m_used) total += used.load(std::memory_order_relaxed);
+			return total;
+		}
+
+		bool overQuota() const
+		{
+			std::size_t cap = quota();
+			return cap != 0 && used() > cap;
+		}
+
+		// Over its own quota or the budget over its limit: time to hold back
+		bool constrained() const { return overQuota() || m_budget->exceeded(); }
+
+	private:
+		static std::size_t index(MemoryUse use) { return static_cast<std::size_t>(use); }
+
+		std::shared_ptr<MemoryBudget> m_budget;
+		std::atomic<std::size_t> m_quota;
+		std::array<std::atomic<std::size_t>, static_cast<std::size_t>(MemoryUse::Count)> m_used{};
+	};
+}
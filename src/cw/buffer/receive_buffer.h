@@ -0,0 +1,158 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <span>
+
+#include "cw/buffer/buffer_pool.h"
+
+namespace cw::buffer {
+
+	// Linear receive buffer with read/write cursors.
+	// Frames are parsed in place from data()/size() and released with consume().
+	// A capacity of 0 allocates nothing until the first append/prepare.
+	// Unread bytes are only shifted to the front when the tail runs out of room,
+	// so consuming a frame is O(1) instead of a memmove of the whole backlog.
+	// The storage is pooled: a buffer released while its link is quiet and
+	// taken again when bytes arrive costs no heap allocation either time.
+	class ReceiveBuffer
+	{
+	public:
+		explicit ReceiveBuffer(std::size_t initialCapacity = 8192)
+		{
+			m_storage.resize(initialCapacity);
+		}
+
+		const uint8_t* data() const { return m_storage.data() + m_readPos; }
+		std::size_t size() const { return m_writePos - m_readPos; }
+		bool empty() const { return m_readPos == m_writePos; }
+		std::size_t capacity() const { return m_storage.size(); }
+
+		void append(const uint8_t* src, std::size_t length)
+		{
+			ensureWritable(length);
+			std::memcpy(m_storage.data() + m_writePos, src, length);
+			m_writePos += length;
+		}
+
+		// Prepare/commit: hand the free tail straight to the socket read.
+		// The returned span covers at least minWritable bytes and stays valid until
+		// the next call to prepare/append/commit.
+		std::span<uint8_t> prepare(std::size_t minWritable)
+		{
+			ensureWritable(minWritable);
+			return { m_storage.data() + m_writePos, m_storage.size() - m_writePos };
+		}
+
+		void commit(std::size_t length)
+		{
+			m_writePos += std::min(length, m_storage.size() - m_writePos);
+		}
+
+		void consume(std::size_t length)
+		{
+			m_readPos += std::min(length, size());
+
+			// Fully drained: rewind for free, no bytes to move.
+			if (m_readPos == m_writePos) {
+				m_readPos = 0;
+				m_writePos = 0;
+			}
+		}
+
+		void clear()
+		{
+			m_readPos = 0;
+			m_writePos = 0;
+		}
+
+		// Gives memory back once a burst is over. Only while empty, so no
+		// bytes move; a no-op if the buffer is already this small.
+		void shrink(std::size_t targetCapacity)
+		{
+			if (!empty() || m_storage.size() <= targetCapacity) return;
+			Storage(targetCapacity).swap(m_storage);
+			clear();
+		}
+
+		// Frees the storage of an empty buffer (an idle connection's); the
+		// next append/prepare allocates again
+		void release()
+		{
+			if (!empty()) return;
+			Storage().swap(m_storage);
+			clear();
+		}
+
+	private:
+		void ensureWritable(std::size_t length)
+		{
+			if (m_storage.size() - m_writePos >= length) return;
+
+			// Compact: move the unread tail to the front (only happens on wrap).
+			std::size_t pending = size();
+			if (m_readPos > 0) {
+				std::memmove(m_storage.data(), m_storage.data() + m_readPos, pending);
+				m_readPos = 0;
+				m_writePos = pending;
+			}
+
+			// Grow if a single frame is larger than the whole buffer.
+			if (m_storage.size() - m_writePos < length) {
+				m_storage.resize(std::max(m_storage.size() * 2, pending + length));
+			}
+		}
+
+	private:
+		using Storage = std::vector<uint8_t, PoolAllocator<uint8_t>>;
+
+		Storage m_storage;
+		std::size_t m_readPos = 0;
+		std::size_t m_writePos = 0;
+	};
+
+	// How much to ask the socket for next. Doubles while reads fill all they
+	// are offered or more than it (a bulk stream), halves after two short reads in a row (a
+	// quiet one), and reaches for the rest of a partially received frame at
+	// once: a 1 MB chunk arriving over a fast link takes a few reads instead
+	// of one per initial read size.
+	class AdaptiveReadSize
+	{
+	public:
+		AdaptiveReadSize(std::size_t minimum, std::size_t initial, std::size_t maximum)
+			: m_minimum(minimum), m_maximum(maximum), m_size(std::clamp(initial, minimum, maximum))
+		{
+		}
+
+		std::size_t current() const { return m_size; }
+
+		// 'frameRemaining': bytes still missing from the frame at the read
+		// cursor, 0 when it is not yet known
+		std::size_t next(std::size_t frameRemaining) const
+		{
+			return std::max(m_size, std::min(frameRemaining, m_maximum));
+		}
+
+		void record(std::size_t offered, std::size_t filled)
+		{
+			// A read larger than the current size (one reaching for a frame)
+			// counts as bulk traffic too
+			if (filled >= offered || filled > m_size) {
+				m_size = std::min(m_size * 2, m_maximum);
+				m_shortReads = 0;
+			}
+			else if (filled < m_size / 2 && ++m_shortReads >= 2) {
+				m_size = std::max(m_size / 2, m_minimum);
+				m_shortReads = 0;
+			}
+		}
+
+	private:
+		std::size_t m_minimum;
+		std::size_t m_maximum;
+		std::size_t m_size;
+		unsigned m_shortReads = 0;
+	};
+}
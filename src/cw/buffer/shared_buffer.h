@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <span>
+#include <cstdint>
+
+namespace cw::buffer {
+
+	// Ref-counted, read-only byte range.
+	// 'owner' keeps whatever backs the bytes alive (a vector, a pool slot, a file
+	// mapping...) until the last copy is dropped, e.g. when a socket write completes.
+	class SharedBuffer
+	{
+	public:
+		SharedBuffer() = default;
+
+		SharedBuffer(std::shared_ptr<const void> owner, std::span<const uint8_t> bytes)
+			: m_owner(std::move(owner)), m_bytes(bytes)
+		{
+		}
+
+		// Takes ownership of an existing vector without copying its contents.
+		static SharedBuffer fromVector(std::vector<uint8_t>&& bytes) { return fromAllocatedVector(std::move(bytes)); }
+
+		// The same for a vector with its own allocator. One from a memory
+		// resource must not outlive the resource.
+		template<typename Allocator>
+		static SharedBuffer fromAllocatedVector(std::vector<uint8_t, Allocator>&& bytes)
+		{
+			auto owner = std::make_shared<const std::vector<uint8_t, Allocator>>(std::move(bytes));
+			std::span<const uint8_t> view(owner->data(), owner->size());
+			return SharedBuffer(std::move(owner), view);
+		}
+
+		const uint8_t* data() const { return m_bytes.data(); }
+		std::size_t size() const { return m_bytes.size(); }
+		bool empty() const { return m_bytes.empty(); }
+		std::span<const uint8_t> span() const { return m_bytes; }
+
+		// Sub-range sharing the same owner.
+		SharedBuffer slice(std::size_t offset, std::size_t length) const
+		{
+			return SharedBuffer(m_owner, m_bytes.subspan(offset, length));
+		}
+
+	private:
+		std::shared_ptr<const void> m_owner;
+		std::span<const uint8_t> m_bytes;
+	};
+}
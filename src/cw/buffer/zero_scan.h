@@ -0,0 +1,89 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include "cw/endian.h" // SIMD headers and the run-time ISA checks
+
+namespace cw::buffer {
+
+	namespace detail {
+
+		// Bytes scanned before each early-out check: most chunks that are not
+		// zeros differ in their first block, and a zero chunk is read once
+		constexpr std::size_t ZERO_SCAN_STRIDE = 256;
+
+#if defined(CW_BYTESWAP_X86)
+		// Whole 256-byte strides only; returns how many bytes were found zero,
+		// stopping at the first stride that is not
+#if defined(__GNUC__) || defined(__clang__)
+		__attribute__((target("avx2")))
+#endif
+		inline std::size_t zeroPrefixAvx2(const std::uint8_t* data, std::size_t size) noexcept
+		{
+			std::size_t bytes = size & ~(ZERO_SCAN_STRIDE - 1);
+			for (std::size_t i = 0; i < bytes; i += ZERO_SCAN_STRIDE) {
+				__m256i folded = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+				for (std::size_t j = 32; j < ZERO_SCAN_STRIDE; j += 32) {
+					folded = _mm256_or_si256(folded, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + j)));
+				}
+				if (!_mm256_testz_si256(folded, folded)) return i;
+			}
+			return bytes;
+		}
+
+		// SSE2: part of x86-64 itself, no check needed
+		inline std::size_t zeroPrefixSse2(const std::uint8_t* data, std::size_t size) noexcept
+		{
+			std::size_t bytes = size & ~(ZERO_SCAN_STRIDE - 1);
+			const __m128i zero = _mm_setzero_si128();
+			for (std::size_t i = 0; i < bytes; i += ZERO_SCAN_STRIDE) {
+				__m128i folded = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+				for (std::size_t j = 16; j < ZERO_SCAN_STRIDE; j += 16) {
+					folded = _mm_or_si128(folded, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + j)));
+				}
+				if (_mm_movemask_epi8(_mm_cmpeq_epi8(folded, zero)) != 0xFFFF) return i;
+			}
+			return bytes;
+		}
+#elif defined(CW_BYTESWAP_NEON)
+		inline std::size_t zeroPrefixNeon(const std::uint8_t* data, std::size_t size) noexcept
+		{
+			std::size_t bytes = size & ~(ZERO_SCAN_STRIDE - 1);
+			for (std::size_t i = 0; i < bytes; i += ZERO_SCAN_STRIDE) {
+				uint8x16_t folded = vld1q_u8(data + i);
+				for (std::size_t j = 16; j < ZERO_SCAN_STRIDE; j += 16) folded = vorrq_u8(folded, vld1q_u8(data + i + j));
+				if (vmaxvq_u8(folded) != 0) return i;
+			}
+			return bytes;
+		}
+#endif
+	}
+
+	// True if every byte of 'data' is zero (an empty span is not). Looks at
+	// the first word before anything else, then ORs 256-byte strides with
+	// AVX2 (picked at run time), SSE2 or NEON, scalar for the tail and on
+	// other targets.
+	inline bool isAllZero(std::span<const std::uint8_t> data) noexcept
+	{
+		if (data.empty()) return false;
+
+		std::uint64_t word = 0;
+		std::memcpy(&word, data.data(), std::min(data.size(), sizeof(word)));
+		if (word != 0) return false;
+
+		std::size_t done = 0;
+#if defined(CW_BYTESWAP_X86)
+		done = cw::binary::detail::hasAvx2() ? detail::zeroPrefixAvx2(data.data(), data.size()) : detail::zeroPrefixSse2(data.data(), data.size());
+#elif defined(CW_BYTESWAP_NEON)
+		done = detail::zeroPrefixNeon(data.data(), data.size());
+#endif
+		if (done < (data.size() & ~(detail::ZERO_SCAN_STRIDE - 1))) return false;
+
+		std::uint8_t folded = 0;
+		for (std::size_t i = done; i < data.size(); ++i) folded |= data[i];
+		return folded == 0;
+	}
+}
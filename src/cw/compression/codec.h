@@ -0,0 +1,206 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#if defined(CW_HAS_LZ4)
+#include <lz4.h>
+#endif
+#if defined(CW_HAS_ZSTD)
+#include <zstd.h>
+#endif
+#if defined(CW_HAS_ISAL)
+#include <isa-l/igzip_lib.h>
+#endif
+
+namespace cw::compression {
+
+	// Chunk codecs. Which ones exist depends on the build (CW_HAS_LZ4 /
+	// CW_HAS_ZSTD / CW_HAS_ISAL); peers announce theirs in a Capabilities
+	// packet and a sender only uses a codec the receiver listed.
+	enum class Codec : std::uint8_t
+	{
+		None = 0,
+		Lz4 = 1,    // Fast, modest ratio: LAN links
+		Zstd = 2,   // Slower, better ratio: WAN links
+		Deflate = 3 // Raw DEFLATE by ISA-L's igzip: several GB/s a core on x86 with AVX2/AVX-512
+	};
+
+	constexpr std::uint32_t codecBit(Codec codec) { return std::uint32_t(1) << static_cast<std::uint8_t>(codec); }
+
+	// Codecs this build can compress and decompress
+	constexpr std::uint32_t supportedCodecs()
+	{
+		std::uint32_t codecs = 0;
+#if defined(CW_HAS_LZ4)
+		codecs |= codecBit(Codec::Lz4);
+#endif
+#if defined(CW_HAS_ZSTD)
+		codecs |= codecBit(Codec::Zstd);
+#endif
+#if defined(CW_HAS_ISAL)
+		codecs |= codecBit(Codec::Deflate);
+#endif
+		return codecs;
+	}
+
+	inline std::optional<Codec> codecFromName(std::string_view name)
+	{
+		if (name == "none") return Codec::None;
+		if (name == "lz4") return Codec::Lz4;
+		if (name == "zstd") return Codec::Zstd;
+		if (name == "deflate") return Codec::Deflate;
+		return std::nullopt;
+	}
+
+	inline std::string_view codecName(Codec codec)
+	{
+		switch (codec) {
+		case Codec::Lz4: return "lz4";
+		case Codec::Zstd: return "zstd";
+		case Codec::Deflate: return "deflate";
+		default: return "none";
+		}
+	}
+
+	// Cheap pre-check: Shannon entropy of a sample from the start of the chunk.
+	// Media, archives and encrypted data sit near 8 bits/byte and are sent raw
+	// without attempting compression.
+	inline bool looksCompressible(std::span<const std::uint8_t> data)
+	{
+		constexpr std::size_t SAMPLE_SIZE = 4096;
+		constexpr double MAX_ENTROPY_BITS = 7.5;
+
+		std::size_t sample = std::min(data.size(), SAMPLE_SIZE);
+		if (sample == 0) return false;
+
+		std::array<std::uint32_t, 256> counts{};
+		for (std::size_t i = 0; i < sample; ++i) ++counts[data[i]];
+
+		double entropy = 0.0;
+		for (std::uint32_t count : counts) {
+			if (count == 0) continue;
+			double p = static_cast<double>(count) / static_cast<double>(sample);
+			entropy -= p * std::log2(p);
+		}
+		return entropy < MAX_ENTROPY_BITS;
+	}
+
+	// Compressed copy of 'data', or nullopt if the codec is not built in or the
+	// result would not be at least 1/16 smaller (then the chunk goes raw).
+	inline std::optional<std::vector<std::uint8_t>> compress(Codec codec, std::span<const std::uint8_t> data, int level = 0)
+	{
+		std::vector<std::uint8_t> out;
+		std::size_t limit = data.size() - data.size() / 16;
+
+		switch (codec)
+		{
+#if defined(CW_HAS_LZ4)
+		case Codec::Lz4:
+		{
+			out.resize(static_cast<std::size_t>(LZ4_compressBound(static_cast<int>(data.size()))));
+			int size = LZ4_compress_default(reinterpret_cast<const char*>(data.data()), reinterpret_cast<char*>(out.data()),
+				static_cast<int>(data.size()), static_cast<int>(out.size()));
+			if (size <= 0) return std::nullopt;
+			out.resize(static_cast<std::size_t>(size));
+			break;
+		}
+#endif
+#if defined(CW_HAS_ZSTD)
+		case Codec::Zstd:
+		{
+			out.resize(ZSTD_compressBound(data.size()));
+			std::size_t size = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), level > 0 ? level : 3);
+			if (ZSTD_isError(size)) return std::nullopt;
+			out.resize(size);
+			break;
+		}
+#endif
+#if defined(CW_HAS_ISAL)
+		case Codec::Deflate:
+		{
+			// Levels 1 to 3 (1 unless given), each with a buffer of its own size, kept per thread
+			static constexpr std::array<std::uint32_t, 4> BUFFER_SIZES = { 0, ISAL_DEF_LVL1_DEFAULT, ISAL_DEF_LVL2_DEFAULT, ISAL_DEF_LVL3_DEFAULT };
+			int isalLevel = std::clamp(level > 0 ? level : 1, 1, 3);
+			thread_local std::vector<std::uint8_t> levelBuffer;
+			levelBuffer.resize(BUFFER_SIZES[isalLevel]);
+
+			out.resize(limit);
+			isal_zstream stream;
+			isal_deflate_stateless_init(&stream);
+			stream.next_in = const_cast<std::uint8_t*>(data.data());
+			stream.avail_in = static_cast<std::uint32_t>(data.size());
+			stream.next_out = out.data();
+			stream.avail_out = static_cast<std::uint32_t>(out.size());
+			stream.end_of_stream = 1;
+			stream.flush = NO_FLUSH;
+			stream.level = static_cast<std::uint32_t>(isalLevel);
+			stream.level_buf = levelBuffer.data();
+			stream.level_buf_size = static_cast<std::uint32_t>(levelBuffer.size());
+			// Does not fit in 'limit': not worth sending compressed
+			if (isal_deflate_stateless(&stream) != COMP_OK) return std::nullopt;
+			out.resize(stream.total_out);
+			break;
+		}
+#endif
+		default:
+			(void)level;
+			return std::nullopt;
+		}
+
+		if (out.size() >= limit) return std::nullopt;
+		return out;
+	}
+
+	// Decompresses into 'out', which must be exactly the original size.
+	inline std::error_code decompress(Codec codec, std::span<const std::uint8_t> data, std::span<std::uint8_t> out)
+	{
+		switch (codec)
+		{
+		case Codec::None:
+			if (data.size() != out.size()) return std::make_error_code(std::errc::illegal_byte_sequence);
+			std::copy(data.begin(), data.end(), out.begin());
+			return {};
+#if defined(CW_HAS_LZ4)
+		case Codec::Lz4:
+		{
+			int size = LZ4_decompress_safe(reinterpret_cast<const char*>(data.data()), reinterpret_cast<char*>(out.data()),
+				static_cast<int>(data.size()), static_cast<int>(out.size()));
+			if (size < 0 || static_cast<std::size_t>(size) != out.size()) return std::make_error_code(std::errc::illegal_byte_sequence);
+			return {};
+		}
+#endif
+#if defined(CW_HAS_ZSTD)
+		case Codec::Zstd:
+		{
+			std::size_t size = ZSTD_decompress(out.data(), out.size(), data.data(), data.size());
+			if (ZSTD_isError(size) || size != out.size()) return std::make_error_code(std::errc::illegal_byte_sequence);
+			return {};
+		}
+#endif
+#if defined(CW_HAS_ISAL)
+		case Codec::Deflate:
+		{
+			inflate_state state;
+			isal_inflate_init(&state);
+			state.next_in = const_cast<std::uint8_t*>(data.data());
+			state.avail_in = static_cast<std::uint32_t>(data.size());
+			state.next_out = out.data();
+			state.avail_out = static_cast<std::uint32_t>(out.size());
+			if (isal_inflate_stateless(&state) != ISAL_DECOMP_OK || state.total_out != out.size()) {
+				return std::make_error_code(std::errc::illegal_byte_sequence);
+			}
+			return {};
+		}
+#endif
+		default:
+			return std::make_error_code(std::errc::not_supported);
+		}
+	}
+}
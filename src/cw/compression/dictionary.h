@@ -0,0 +1,129 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#if defined(CW_HAS_ZSTD)
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+namespace cw::compression {
+
+	// A zstd dictionary for many small, similar inputs (config files, JSON,
+	// sources): what they have in common is learned once (train) and held by
+	// both ends, so each input compresses as if the others had come before
+	// it. Named by a hash of its bytes, so both ends agree on the id without
+	// asking. Without CW_HAS_ZSTD nothing is trained and compress and
+	// decompress always fail.
+	//
+	// Immutable once made: share it across threads.
+	class Dictionary
+	{
+	public:
+		static constexpr std::size_t DEFAULT_CAPACITY = 112 * 1024; // zstd's own default
+		static constexpr std::size_t MAX_SIZE = 1024 * 1024;
+
+		explicit Dictionary(std::vector<std::uint8_t> bytes, int level = 0) : m_bytes(std::move(bytes))
+		{
+			// FNV-1a, never 0 (no dictionary)
+			std::uint32_t hash = 2166136261u;
+			for (std::uint8_t byte : m_bytes) hash = (hash ^ byte) * 16777619u;
+			m_id = hash != 0 ? hash : 1;
+#if defined(CW_HAS_ZSTD)
+			m_compress.reset(ZSTD_createCDict(m_bytes.data(), m_bytes.size(), level > 0 ? level : 3));
+			m_decompress.reset(ZSTD_createDDict(m_bytes.data(), m_bytes.size()));
+#else
+			(void)level;
+#endif
+		}
+
+		// From the contents of 'samples' (a few hundred files of the kind it is
+		// for, at least), at most 'capacity' bytes. Null if zstd finds too
+		// little in them to learn from, or is not built in.
+		static std::shared_ptr<const Dictionary> train(const std::vector<std::vector<std::uint8_t>>& samples,
+			std::size_t capacity = DEFAULT_CAPACITY, int level = 0)
+		{
+#if defined(CW_HAS_ZSTD)
+			std::vector<std::uint8_t> joined;
+			std::vector<std::size_t> sizes;
+			for (const auto& sample : samples) {
+				if (sample.empty()) continue;
+				joined.insert(joined.end(), sample.begin(), sample.end());
+				sizes.push_back(sample.size());
+			}
+			if (sizes.empty()) return nullptr;
+
+			std::vector<std::uint8_t> bytes(std::min(capacity, MAX_SIZE));
+			std::size_t size = ZDICT_trainFromBuffer(bytes.data(), bytes.size(), joined.data(), sizes.data(), static_cast<unsigned>(sizes.size()));
+			if (ZDICT_isError(size)) return nullptr;
+			bytes.resize(size);
+			return std::make_shared<const Dictionary>(std::move(bytes), level);
+#else
+			(void)samples;
+			(void)capacity;
+			(void)level;
+			return nullptr;
+#endif
+		}
+
+		std::uint32_t id() const { return m_id; }
+		std::span<const std::uint8_t> bytes() const { return m_bytes; }
+
+		// As cw::compression::compress(Codec::Zstd, ...), with the dictionary
+		std::optional<std::vector<std::uint8_t>> compress(std::span<const std::uint8_t> data) const
+		{
+#if defined(CW_HAS_ZSTD)
+			if (!m_compress) return std::nullopt;
+			std::vector<std::uint8_t> out(ZSTD_compressBound(data.size()));
+			std::size_t size = ZSTD_compress_usingCDict(compressContext(), out.data(), out.size(), data.data(), data.size(), m_compress.get());
+			if (ZSTD_isError(size) || size >= data.size() - data.size() / 16) return std::nullopt;
+			out.resize(size);
+			return out;
+#else
+			(void)data;
+			return std::nullopt;
+#endif
+		}
+
+		// Into 'out', which must be exactly the original size
+		std::error_code decompress(std::span<const std::uint8_t> data, std::span<std::uint8_t> out) const
+		{
+#if defined(CW_HAS_ZSTD)
+			if (!m_decompress) return std::make_error_code(std::errc::not_supported);
+			std::size_t size = ZSTD_decompress_usingDDict(decompressContext(), out.data(), out.size(), data.data(), data.size(), m_decompress.get());
+			if (ZSTD_isError(size) || size != out.size()) return std::make_error_code(std::errc::illegal_byte_sequence);
+			return {};
+#else
+			(void)data;
+			(void)out;
+			return std::make_error_code(std::errc::not_supported);
+#endif
+		}
+
+	private:
+#if defined(CW_HAS_ZSTD)
+		// One context of each per thread, reused from call to call
+		static ZSTD_CCtx* compressContext()
+		{
+			thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+			return context.get();
+		}
+
+		static ZSTD_DCtx* decompressContext()
+		{
+			thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+			return context.get();
+		}
+
+		std::unique_ptr<ZSTD_CDict, decltype(&ZSTD_freeCDict)> m_compress{ nullptr, &ZSTD_freeCDict };
+		std::unique_ptr<ZSTD_DDict, decltype(&ZSTD_freeDDict)> m_decompress{ nullptr, &ZSTD_freeDDict };
+#endif
+		std::vector<std::uint8_t> m_bytes;
+		std::uint32_t m_id = 0;
+	};
+}
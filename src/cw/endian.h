@@ -1,11 +1,24 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <bit>
 #include <vector>
 #include <cstdint>
 #include <cstring>
 #include <type_traits>
 
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#define CW_BYTESWAP_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CW_BYTESWAP_NEON 1
+#endif
+
 namespace cw {
 
 	namespace binary {
@@ -59,6 +72,183 @@ namespace cw {
 
 
 
+		namespace detail {
+
+			// pshufb mask reversing every Width-byte lane of a 16-byte block
+			// (AVX2 shuffles each 128-bit half alike, so it is used twice)
+			template<std::size_t Width>
+			inline constexpr auto LANE_REVERSAL = []() {
+				std::array<uint8_t, 32> mask{};
+				for (std::size_t i = 0; i < mask.size(); ++i) {
+					std::size_t inBlock = i % 16;
+					mask[i] = static_cast<uint8_t>(inBlock / Width * Width + (Width - 1 - inBlock % Width));
+				}
+				return mask;
+			}();
+
+			template<std::size_t Width>
+			using Word = std::conditional_t<Width == 2, uint16_t, std::conditional_t<Width == 4, uint32_t, uint64_t>>;
+
+#if defined(CW_BYTESWAP_X86)
+			// Each ISA is checked once at run time, so the binary still runs on older CPUs
+			inline bool hasSsse3()
+			{
+#if defined(__SSSE3__)
+				return true;
+#elif defined(_MSC_VER)
+				static const bool supported = []() { int info[4]; __cpuid(info, 1); return (info[2] & (1 << 9)) != 0; }();
+				return supported;
+#else
+				static const bool supported = __builtin_cpu_supports("ssse3");
+				return supported;
+#endif
+			}
+
+			inline bool hasAvx2()
+			{
+#if defined(__AVX2__)
+				return true;
+#elif defined(_MSC_VER)
+				return false; // Needs the OS check too; builds with /arch:AVX2 take the branch above
+#else
+				static const bool supported = __builtin_cpu_supports("avx2");
+				return supported;
+#endif
+			}
+
+			// Whole 16/32-byte blocks only; returns how many values were swapped
+			template<std::size_t Width>
+#if defined(__GNUC__) || defined(__clang__)
+			__attribute__((target("ssse3")))
+#endif
+			inline std::size_t swapLanesSsse3(uint8_t* dest, const uint8_t* src, std::size_t count) noexcept
+			{
+				const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(LANE_REVERSAL<Width>.data()));
+				std::size_t bytes = count * Width & ~std::size_t(15);
+				for (std::size_t i = 0; i < bytes; i += 16) {
+					__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_shuffle_epi8(block, mask));
+				}
+				return bytes / Width;
+			}
+
+			template<std::size_t Width>
+#if defined(__GNUC__) || defined(__clang__)
+			__attribute__((target("avx2")))
+#endif
+			inline std::size_t swapLanesAvx2(uint8_t* dest, const uint8_t* src, std::size_t count) noexcept
+			{
+				const __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(LANE_REVERSAL<Width>.data()));
+				std::size_t bytes = count * Width & ~std::size_t(31);
+				for (std::size_t i = 0; i < bytes; i += 32) {
+					__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_shuffle_epi8(block, mask));
+				}
+				return bytes / Width;
+			}
+#elif defined(CW_BYTESWAP_NEON)
+			template<std::size_t Width>
+			inline std::size_t swapLanesNeon(uint8_t* dest, const uint8_t* src, std::size_t count) noexcept
+			{
+				std::size_t bytes = count * Width & ~std::size_t(15);
+				for (std::size_t i = 0; i < bytes; i += 16) {
+					uint8x16_t block = vld1q_u8(src + i);
+					if constexpr (Width == 2) block = vrev16q_u8(block);
+					else if constexpr (Width == 4) block = vrev32q_u8(block);
+					else block = vrev64q_u8(block);
+					vst1q_u8(dest + i, block);
+				}
+				return bytes / Width;
+			}
+#endif
+
+			// Reverses the bytes of 'count' Width-byte values; dest may equal src
+			template<std::size_t Width>
+			inline void swapLanes(uint8_t* dest, const uint8_t* src, std::size_t count) noexcept
+			{
+				std::size_t done = 0;
+#if defined(CW_BYTESWAP_X86)
+				if (hasAvx2()) done = swapLanesAvx2<Width>(dest, src, count);
+				else if (hasSsse3()) done = swapLanesSsse3<Width>(dest, src, count);
+#elif defined(CW_BYTESWAP_NEON)
+				done = swapLanesNeon<Width>(dest, src, count);
+#endif
+				for (std::size_t i = done; i < count; ++i) {
+					Word<Width> value;
+					std::memcpy(&value, src + i * Width, Width);
+					value = std::byteswap(value);
+					std::memcpy(dest + i * Width, &value, Width);
+				}
+			}
+		}
+
+		// Bulk forms for arrays of one integer type (index lists, offset
+		// tables): 'count' values to or from big-endian bytes with SIMD byte
+		// shuffles, 32 or 16 bytes per instruction (AVX2 or SSSE3, picked at
+		// run time, or NEON), scalar for the tail and on other targets.
+		template<Integer T>
+		void writeBigEndianArray(uint8_t* dest, const T* values, std::size_t count) noexcept
+		{
+			if (count == 0) return;
+			if constexpr (sizeof(T) == 1 || std::endian::native == std::endian::big)
+				std::memcpy(dest, values, count * sizeof(T));
+			else
+				detail::swapLanes<sizeof(T)>(dest, reinterpret_cast<const uint8_t*>(values), count);
+		}
+
+		template<Integer T>
+		void readBigEndianArray(const uint8_t* src, T* values, std::size_t count) noexcept
+		{
+			if (count == 0) return;
+			if constexpr (sizeof(T) == 1 || std::endian::native == std::endian::big)
+				std::memcpy(values, src, count * sizeof(T));
+			else
+				detail::swapLanes<sizeof(T)>(reinterpret_cast<uint8_t*>(values), src, count);
+		}
+
+		// Write cursor over a buffer already sized for everything written through
+		// it (a frame whose size came from payloadSize()): each field is a store
+		// and a pointer bump, with no bounds check or resize.
+		class ByteWriter
+		{
+		public:
+			explicit ByteWriter(uint8_t* dest) noexcept : m_cursor(dest) {}
+
+			template<Integer T>
+			void write(T value) noexcept
+			{
+				writeBigEndian(m_cursor, value);
+				m_cursor += sizeof(T);
+			}
+
+			template<Integer T>
+			void array(const T* values, std::size_t count) noexcept
+			{
+				writeBigEndianArray(m_cursor, values, count);
+				m_cursor += count * sizeof(T);
+			}
+
+			template<typename It>
+			void bytes(It first, It last) noexcept
+			{
+				m_cursor = std::copy(first, last, m_cursor);
+			}
+
+			// The next 'count' bytes, for a caller that fills them itself (a
+			// fixed WireLayout)
+			uint8_t* take(std::size_t count) noexcept
+			{
+				uint8_t* dest = m_cursor;
+				m_cursor += count;
+				return dest;
+			}
+
+			uint8_t* position() const noexcept { return m_cursor; }
+
+		private:
+			uint8_t* m_cursor;
+		};
+
 		template<Integer T>
 		constexpr T readBigEndian(const uint8_t* src) noexcept
 		{
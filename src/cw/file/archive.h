@@ -0,0 +1,189 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "cw/buffer/shared_buffer.h"
+#include "cw/buffer/buffer_pool.h"
+#include "cw/endian.h"
+#include "cw/file/disk_writer.h"
+#include "cw/file/safe_path.h"
+#include "cw/protocol/packet/packet.h"
+
+namespace cw::file {
+
+	// Archive streams (ArchiveInfo): a directory's small files packed back to
+	// back into one byte stream, so they cost neither a FileInfo/FileDone
+	// round of their own nor a frame boundary. Each member is a header
+	// [u32 nameLength][u64 size][name] followed by its 'size' bytes; a header
+	// of nameLength 0 ends the archive. Integers are big-endian.
+	constexpr std::size_t ARCHIVE_HEADER_SIZE = sizeof(std::uint32_t) + sizeof(std::uint64_t);
+	constexpr std::uint64_t MAX_ARCHIVE_MEMBER_SIZE = 16 * 1024 * 1024; // (DoS protection)
+
+	// The header of member 'name', or the end marker for an empty name
+	inline std::vector<std::uint8_t> archiveHeader(std::string_view name, std::uint64_t size)
+	{
+		if (name.size() > cw::packet::MAX_STRING_LENGTH) throw std::length_error("Archive: name too long");
+
+		std::vector<std::uint8_t> header;
+		header.reserve(ARCHIVE_HEADER_SIZE + name.size());
+		cw::binary::writeBigEndian(header, static_cast<std::uint32_t>(name.size()));
+		cw::binary::writeBigEndian(header, size);
+		header.insert(header.end(), name.begin(), name.end());
+		return header;
+	}
+
+	// Receiving side of an archive stream: takes the stream's chunks in any
+	// order (resent ones come late), parses them in stream order and hands
+	// out the members completed so far as SmallFiles, to be written in
+	// batches by writeSmallFiles. A member inside a single chunk is a slice
+	// of it, uncopied; one spanning chunks is assembled in a pooled buffer.
+	// Throws std::runtime_error on a malformed archive.
+	class ArchiveUnpacker
+	{
+	public:
+		// Bytes [offset, offset + data.size()) of the stream. False if the
+		// chunk at 'offset' was already had (a resend of a good one).
+		bool add(std::uint64_t offset, cw::buffer::SharedBuffer data)
+		{
+			if (offset < m_received || m_ahead.contains(offset)) return false;
+			if (offset > m_received) {
+				m_aheadBytes += data.size();
+				m_ahead.emplace(offset, std::move(data));
+				return true;
+			}
+
+			consume(std::move(data));
+			while (!m_ahead.empty() && m_ahead.begin()->first <= m_received) {
+				auto node = m_ahead.extract(m_ahead.begin());
+				m_aheadBytes -= node.mapped().size();
+
+				std::uint64_t skip = m_received - node.key();
+				if (skip < node.mapped().size()) {
+					consume(node.mapped().slice(static_cast<std::size_t>(skip), node.mapped().size() - static_cast<std::size_t>(skip)));
+				}
+			}
+			return true;
+		}
+
+		// Contiguous bytes parsed from the start of the stream
+		std::uint64_t received() const { return m_received; }
+
+		// The end marker was parsed
+		bool ended() const { return m_ended; }
+
+		// Held for parsing: chunks ahead of a gap and the member being assembled
+		std::size_t bufferedBytes() const { return m_aheadBytes + m_member.size(); }
+
+		// Completed members not yet taken
+		std::size_t readyCount() const { return m_ready.size(); }
+		std::uint64_t readyBytes() const { return m_readyBytes; }
+
+		std::vector<SmallFile> takeReady()
+		{
+			m_readyBytes = 0;
+			return std::exchange(m_ready, {});
+		}
+
+	private:
+		enum class State { Header, Name, Data };
+
+		void consume(cw::buffer::SharedBuffer data)
+		{
+			m_received += data.size();
+
+			std::size_t cursor = 0;
+			while (cursor < data.size()) {
+				if (m_ended) throw std::runtime_error("Archive: data after the end marker");
+
+				const std::uint8_t* bytes = data.data() + cursor;
+				std::size_t available = data.size() - cursor;
+
+				if (m_state == State::Header) {
+					std::size_t take = std::min(available, ARCHIVE_HEADER_SIZE - m_header.size());
+					m_header.insert(m_header.end(), bytes, bytes + take);
+					cursor += take;
+					if (m_header.size() == ARCHIVE_HEADER_SIZE) onHeader();
+				}
+				else if (m_state == State::Name) {
+					std::size_t take = std::min(available, m_nameLength - m_name.size());
+					m_name.append(reinterpret_cast<const char*>(bytes), take);
+					cursor += take;
+					if (m_name.size() == m_nameLength) startMember();
+				}
+				else {
+					std::size_t take = static_cast<std::size_t>(std::min<std::uint64_t>(available, m_remaining));
+
+					// Whole in this chunk: a view of it
+					if (m_member.size() == 0 && take == m_size) m_data = data.slice(cursor, take);
+					else {
+						if (m_member.size() == 0) m_member = cw::buffer::PooledBuffer(static_cast<std::size_t>(m_size));
+						std::copy(bytes, bytes + take, m_member.data() + (m_size - m_remaining));
+					}
+					cursor += take;
+					m_remaining -= take;
+					if (m_remaining == 0) finishMember();
+				}
+			}
+		}
+
+		void onHeader()
+		{
+			m_nameLength = cw::binary::readBigEndian<std::uint32_t>(m_header.data());
+			m_size = cw::binary::readBigEndian<std::uint64_t>(m_header.data() + sizeof(std::uint32_t));
+			m_header.clear();
+
+			if (m_nameLength == 0) {
+				if (m_size != 0) throw std::runtime_error("Archive: corrupted end marker");
+				m_ended = true;
+				return;
+			}
+			if (m_nameLength > cw::packet::MAX_STRING_LENGTH) throw std::runtime_error("Archive: name too long (DoS protection).");
+			if (m_size > MAX_ARCHIVE_MEMBER_SIZE) throw std::runtime_error("Archive: member too large (DoS protection).");
+			m_state = State::Name;
+		}
+
+		void startMember()
+		{
+			if (!isSafeRelativePath(m_name)) throw std::runtime_error("Archive: member name outside the destination");
+			m_state = State::Data;
+			m_remaining = m_size;
+			if (m_size == 0) finishMember();
+		}
+
+		void finishMember()
+		{
+			if (m_member.size() != 0) m_data = std::move(m_member).share();
+			m_member = {};
+
+			m_readyBytes += m_data.size();
+			m_ready.push_back({ std::filesystem::path(std::move(m_name)), std::move(m_data) });
+			m_name.clear();
+			m_data = {};
+			m_state = State::Header;
+		}
+
+		std::uint64_t m_received = 0;
+		std::map<std::uint64_t, cw::buffer::SharedBuffer> m_ahead; // Past a gap, by offset
+		std::size_t m_aheadBytes = 0;
+
+		State m_state = State::Header;
+		bool m_ended = false;
+		std::vector<std::uint8_t> m_header;
+		std::uint32_t m_nameLength = 0;
+		std::uint64_t m_size = 0;
+		std::string m_name;
+		std::uint64_t m_remaining = 0;
+		cw::buffer::PooledBuffer m_member;
+		cw::buffer::SharedBuffer m_data;
+
+		std::vector<SmallFile> m_ready;
+		std::uint64_t m_readyBytes = 0;
+	};
+}
@@ -0,0 +1,452 @@
+#pragma once
+#include <asio.hpp>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#include "cw/buffer/shared_buffer.h"
+#include "cw/buffer/buffer_pool.h"
+#include "cw/buffer/memory_budget.h"
+#include "cw/file/disk_writer.h"
+#include "cw/file/durability.h"
+#include "cw/file/file_handle.h"
+#include "cw/integrity/checksum.h"
+#include "cw/metrics/metrics.h"
+#include "cw/trace.h"
+
+namespace cw::file {
+
+#if defined(ASIO_HAS_FILE)
+
+	// Incoming file written through asio::random_access_file: io_uring on Linux
+	// (build with CW_USE_IO_URING), overlapped I/O on IOCP on Windows.
+	// Unlike WriteBehindFile no disk thread is involved: every chunk becomes an
+	// async_write_at submitted from the connection's executor, so many positional
+	// writes are in flight at once and the kernel batches them.
+	// Same interface as WriteBehindFile. open() must be called on 'executor'; the
+	// other calls may come from any thread and are dispatched onto it.
+	class AsyncWriteFile : public std::enable_shared_from_this<AsyncWriteFile>
+	{
+	public:
+		using Callback = std::function<void(std::error_code)>;
+		using FinishCallback = std::function<void(std::error_code, std::uint64_t bytesWritten)>;
+
+		// 'load': the writer's, which its queued writes count towards
+		static std::shared_ptr<AsyncWriteFile> create(asio::any_io_executor executor, std::shared_ptr<DirectoryCache> directories = nullptr,
+			Durability durability = Durability::None, std::shared_ptr<DiskLoad> load = nullptr)
+		{
+			return std::shared_ptr<AsyncWriteFile>(new AsyncWriteFile(std::move(executor), std::move(directories), durability, std::move(load)));
+		}
+
+		// An atomic file dropped before finish leaves nothing behind
+		~AsyncWriteFile()
+		{
+			if (m_finished || m_writePath.empty() || m_writePath == m_path) return;
+			std::error_code ignored;
+			m_file.close(ignored);
+			if (m_directories) m_directories->remove(m_writePath);
+			else std::filesystem::remove(m_writePath, ignored);
+		}
+
+		// Creates parent directories, opens and preallocates the file.
+		// Opening is a synchronous open(2)/fallocate(2) on the calling thread.
+		// 'atomic': write under receivingPathFor(path) until finish publishes it.
+		void open(std::filesystem::path path, std::uint64_t size, Callback onOpened, bool atomic = true)
+		{
+			std::error_code ec;
+			m_path = path;
+			m_writePath = atomic ? receivingPathFor(path) : path;
+			m_size = size;
+			if (m_directories) {
+				// openat relative to the cached parent; the ring takes the descriptor
+				try {
+					FileHandle handle = m_directories->openWrite(m_writePath);
+					m_file.assign(handle.native(), ec);
+					if (!ec) (void)handle.release();
+				}
+				catch (const std::system_error& e) {
+					ec = e.code();
+				}
+			}
+			else {
+				if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path(), ec);
+				if (!ec) {
+					m_file.open(m_writePath.string(),
+						asio::file_base::write_only | asio::file_base::create | asio::file_base::truncate, ec);
+				}
+			}
+			if (!ec) ec = preallocate(m_file.native_handle(), size);
+
+			if (!ec) ResumeJournal(path).remove();
+
+			if (ec) fail(ec);
+			CW_TRACE(file__open, m_path.c_str(), size, ec.value());
+			asio::post(m_executor, [onOpened = std::move(onOpened), ec]() { onOpened(ec); });
+		}
+
+		// No checkpoints are kept for this sink: every resumable open starts over at 0.
+		void openResumable(std::filesystem::path path, std::uint64_t size, std::uint64_t /*fingerprint*/,
+			std::uint64_t /*checkpointInterval*/, std::function<void(std::error_code, std::uint64_t)> onOpened)
+		{
+			open(std::move(path), size, [onOpened = std::move(onOpened)](std::error_code ec) { onOpened(ec, 0); });
+		}
+
+		// Called on the executor with the total bytes written after each write
+		// lands. Set before the first write.
+		void onProgress(std::function<void(std::uint64_t bytesWritten)> fn) { m_onProgress = std::move(fn); }
+
+		// Where writes given an arrival time record how long they took to land.
+		// Set before the first write.
+		void recordWriteLatency(std::shared_ptr<cw::metrics::LatencyHistogram> histogram) { m_writeLatency = std::move(histogram); }
+
+		// The connection whose memory the queued bytes count against (see
+		// cw::buffer::MemoryAccount). Set before the first write.
+		void chargeTo(std::shared_ptr<cw::buffer::MemoryAccount> account) { m_memory = std::move(account); }
+
+		// Submits a positional write. Never blocks. 'arrived': when the bytes came
+		// off the socket, for the write latency histogram.
+		void write(std::uint64_t offset, cw::buffer::SharedBuffer data, cw::metrics::Clock::time_point arrived = {})
+		{
+			std::size_t length = data.size();
+			addPending(length);
+
+			auto self = shared_from_this();
+			asio::dispatch(m_executor, [this, self, offset, data = std::move(data), length, arrived]() mutable
+				{
+					if (m_error || !m_file.is_open()) {
+						removePending(length);
+						checkDrained();
+						return;
+					}
+
+					++m_inFlight;
+					auto buffer = asio::buffer(data.data(), length);
+					asio::async_write_at(m_file, offset, buffer,
+						[this, self, data = std::move(data), length, arrived](std::error_code ec, std::size_t written)
+						{
+							if (ec) fail(ec);
+							else {
+								recordLatency(arrived);
+								m_bytesWritten += written;
+								if (m_onProgress) m_onProgress(m_bytesWritten);
+							}
+
+							removePending(length);
+							--m_inFlight;
+							checkDrained();
+							if (m_inFlight == 0 && m_onFinish) runFinish();
+						});
+				});
+		}
+
+		// Chunks that follow one another from 'offset', submitted as one
+		// gathered write (a single writev request to the ring)
+		void writeGathered(std::uint64_t offset, std::vector<cw::buffer::SharedBuffer> pieces, cw::metrics::Clock::time_point arrived = {})
+		{
+			std::size_t length = 0;
+			for (const auto& piece : pieces) length += piece.size();
+			addPending(length);
+
+			auto self = shared_from_this();
+			asio::dispatch(m_executor, [this, self, offset, pieces = std::move(pieces), length, arrived]() mutable
+				{
+					if (m_error || !m_file.is_open()) {
+						removePending(length);
+						checkDrained();
+						return;
+					}
+
+					// The buffer sequence lives as long as the operation
+					struct Gathered
+					{
+						std::vector<cw::buffer::SharedBuffer> pieces;
+						std::vector<asio::const_buffer> buffers;
+					};
+					auto gathered = std::make_shared<Gathered>();
+					gathered->pieces = std::move(pieces);
+					for (const auto& piece : gathered->pieces) gathered->buffers.push_back(asio::buffer(piece.data(), piece.size()));
+
+					++m_inFlight;
+					asio::async_write_at(m_file, offset, gathered->buffers,
+						[this, self, gathered, length, arrived](std::error_code ec, std::size_t written)
+						{
+							if (ec) fail(ec);
+							else {
+								recordLatency(arrived);
+								m_bytesWritten += written;
+								if (m_onProgress) m_onProgress(m_bytesWritten);
+							}
+
+							removePending(length);
+							--m_inFlight;
+							checkDrained();
+							if (m_inFlight == 0 && m_onFinish) runFinish();
+						});
+				});
+		}
+
+		// A compressed chunk. Decompressed (and checked against 'crc') synchronously
+		// on the calling thread (this sink has no worker threads), then submitted like any chunk.
+		void writeCompressed(std::uint64_t offset, cw::compression::Codec codec, std::uint32_t rawSize, cw::buffer::SharedBuffer data,
+			std::optional<std::uint32_t> crc = std::nullopt, cw::metrics::Clock::time_point arrived = {})
+		{
+			cw::buffer::PooledBuffer raw(rawSize);
+			std::error_code ec = cw::compression::decompress(codec, data.span(), raw.span());
+			if (!ec && crc && cw::integrity::crc32c(raw.span()) != *crc) ec = std::make_error_code(std::errc::illegal_byte_sequence);
+			if (ec) {
+				asio::dispatch(m_executor, [self = shared_from_this(), ec]() { self->fail(ec); });
+				return;
+			}
+			write(offset, std::move(raw).share(), arrived);
+		}
+
+		// A sealed chunk, opened (and decompressed) on the calling thread likewise
+		void writeSealed(std::uint64_t offset, std::shared_ptr<const cw::integrity::ChunkCipher> cipher, cw::compression::Codec codec,
+			std::uint32_t rawSize, cw::buffer::SharedBuffer data, cw::metrics::Clock::time_point arrived = {})
+		{
+			cw::buffer::PooledBuffer raw(rawSize);
+			if (std::error_code ec = openSealedChunk(*cipher, offset, codec, data.span(), raw.span())) {
+				asio::dispatch(m_executor, [self = shared_from_this(), ec]() { self->fail(ec); });
+				return;
+			}
+			write(offset, std::move(raw).share(), arrived);
+		}
+
+		// Delta block reference, or a file range passed by descriptor. The source
+		// is read synchronously on the calling thread, then written like a
+		// received chunk.
+		void copyFrom(std::shared_ptr<const FileHandle> source, std::uint64_t sourceOffset, std::uint64_t offset, std::uint64_t length,
+			cw::metrics::Clock::time_point arrived = {})
+		{
+			cw::buffer::PooledBuffer bytes(static_cast<std::size_t>(length));
+			std::error_code ec = source ? source->readAt(sourceOffset, bytes.span()) : std::make_error_code(std::errc::bad_file_descriptor);
+			if (ec) {
+				asio::dispatch(m_executor, [self = shared_from_this(), ec]() { self->fail(ec); });
+				return;
+			}
+			write(offset, std::move(bytes).share(), arrived);
+		}
+
+#if defined(__linux__)
+		// Bytes spliced into 'pipe': read out on the calling thread, then
+		// written like a received chunk
+		void writeFromPipe(std::shared_ptr<SplicePipe> pipe, std::uint64_t offset, std::size_t length,
+			cw::metrics::Clock::time_point arrived = {})
+		{
+			cw::buffer::PooledBuffer bytes(length);
+			if (std::error_code ec = pipe->readInto(bytes.span())) {
+				asio::dispatch(m_executor, [self = shared_from_this(), ec]() { self->fail(ec); });
+				return;
+			}
+			write(offset, std::move(bytes).share(), arrived);
+		}
+#endif
+
+		// 'length' bytes already written will be written again (a repair asked
+		// for by the tree hash): they count once, whichever write lands first
+		void unwrite(std::uint64_t length)
+		{
+			asio::dispatch(m_executor, [self = shared_from_this(), length]() { self->m_bytesWritten -= length; });
+		}
+
+		// A range of zeros (FileHole): punched synchronously on the
+		// executor (no write touches the range, so nothing has to land first)
+		// and counted as written.
+		void punchHole(std::uint64_t offset, std::uint64_t length)
+		{
+			auto self = shared_from_this();
+			asio::dispatch(m_executor, [this, self, offset, length]()
+				{
+					if (m_error || !m_file.is_open()) return;
+					if (std::error_code ec = cw::file::punchHole(m_file.native_handle(), offset, length)) {
+						fail(ec);
+						return;
+					}
+
+					m_bytesWritten += length;
+					if (m_onProgress) m_onProgress(m_bytesWritten);
+				});
+		}
+
+		// Server-side copy (FileCopy). Not done here: the kernel copies would
+		// block the calling thread, so 'onDone' gets 0 and the sender streams.
+		void cloneFrom(std::shared_ptr<const FileHandle>, std::uint64_t, std::function<void(std::uint64_t copied)> onDone)
+		{
+			asio::post(m_executor, [onDone = std::move(onDone)]() { onDone(0); });
+		}
+
+		// As WriteBehindFile::setSize
+		void setSize(std::uint64_t size)
+		{
+			asio::dispatch(m_executor, [self = shared_from_this(), size]() { self->m_size = size; });
+		}
+
+		// Runs after every submitted write has completed and closes the file.
+		// 'publish': as WriteBehindFile::finish.
+		// As WriteBehindFile::setAttributes
+		void setAttributes(FileAttributes attributes)
+		{
+			asio::dispatch(m_executor, [self = shared_from_this(), attributes]() { self->m_attributes = attributes; });
+		}
+
+		void finish(FinishCallback onDone, bool publish = true)
+		{
+			auto self = shared_from_this();
+			asio::dispatch(m_executor, [this, self, onDone = std::move(onDone), publish]() mutable
+				{
+					m_publish = publish;
+					m_onFinish = std::move(onDone);
+					if (m_inFlight == 0) asio::post(m_executor, [self]() { self->runFinish(); });
+				});
+		}
+
+		std::size_t pendingBytes() const { return m_pendingBytes; }
+
+		// No journal to save (see openResumable)
+		void checkpoint() {}
+
+		// Posts 'onDrained' to the executor once pendingBytes() <= threshold.
+		void whenDrained(std::size_t threshold, std::function<void()> onDrained)
+		{
+			auto self = shared_from_this();
+			asio::dispatch(m_executor, [this, self, threshold, onDrained = std::move(onDrained)]() mutable
+				{
+					m_drainWaiters.push_back({ threshold, std::move(onDrained) });
+					checkDrained();
+				});
+		}
+
+	private:
+		AsyncWriteFile(asio::any_io_executor executor, std::shared_ptr<DirectoryCache> directories, Durability durability,
+			std::shared_ptr<DiskLoad> load)
+			: m_executor(executor),
+			m_directories(std::move(directories)),
+			m_durability(durability),
+			m_load(std::move(load)),
+			m_file(executor)
+		{
+		}
+
+		void fail(std::error_code ec)
+		{
+			if (!m_error) m_error = ec;
+
+			// Cancels the remaining submissions; their handlers still run
+			std::error_code ignored;
+			m_file.close(ignored);
+		}
+
+		void recordLatency(cw::metrics::Clock::time_point arrived)
+		{
+			if (arrived == cw::metrics::Clock::time_point{}) return;
+			auto took = cw::metrics::Clock::now() - arrived;
+			if (m_writeLatency) m_writeLatency->record(took);
+			if (m_load) m_load->record(took);
+		}
+
+		void addPending(std::size_t bytes)
+		{
+			m_pendingBytes += bytes;
+			if (m_load) m_load->add(bytes);
+			if (m_memory) m_memory->add(cw::buffer::MemoryUse::WriteBehind, bytes);
+		}
+
+		void removePending(std::size_t bytes)
+		{
+			if (m_memory) m_memory->remove(cw::buffer::MemoryUse::WriteBehind, bytes);
+			if (m_load) m_load->remove(bytes);
+			m_pendingBytes -= bytes;
+		}
+
+		void checkDrained()
+		{
+			std::erase_if(m_drainWaiters, [this](DrainWaiter& waiter)
+				{
+					if (m_pendingBytes > waiter.threshold) return false;
+					asio::post(m_executor, std::move(waiter.fn));
+					return true;
+				});
+		}
+
+		void runFinish()
+		{
+			if (!m_onFinish) return;
+
+			m_finished = true;
+			bool atomic = m_writePath != m_path;
+			bool keep = !m_error && m_publish && m_bytesWritten == m_size && m_file.is_open();
+
+			// Best effort, before the sync (see WriteBehindFile::finish)
+			if (keep && m_attributes) applyAttributes(m_file.native_handle(), *m_attributes);
+
+			// No group commit here: both durable modes sync the file itself
+			if (keep && m_durability != Durability::None) {
+				cw::metrics::StageTimer stage(cw::metrics::Stage::Fsync);
+#if defined(_WIN32)
+				if (!::FlushFileBuffers(m_file.native_handle())) m_error = { static_cast<int>(::GetLastError()), std::system_category() };
+#else
+				if (::fdatasync(m_file.native_handle()) != 0) m_error = { errno, std::system_category() };
+#endif
+			}
+
+			std::error_code ignored;
+			m_file.close(ignored);
+
+			if (keep && !m_error && atomic) {
+				if (m_directories) m_error = m_directories->rename(m_writePath, m_path);
+				else std::filesystem::rename(m_writePath, m_path, m_error);
+			}
+			if (keep && !m_error && m_durability != Durability::None && m_directories) m_error = m_directories->syncDirectory(m_path.parent_path());
+			if (!keep && atomic) {
+				if (m_directories) m_directories->remove(m_writePath);
+				else std::filesystem::remove(m_writePath, ignored);
+			}
+
+			CW_TRACE(file__close, m_path.c_str(), m_bytesWritten, keep || m_error ? m_error.value() : static_cast<int>(std::errc::operation_canceled));
+			auto onDone = std::exchange(m_onFinish, nullptr);
+			onDone(m_error, m_bytesWritten);
+		}
+
+	private:
+		asio::any_io_executor m_executor;
+		std::shared_ptr<DirectoryCache> m_directories;
+		Durability m_durability;
+		std::shared_ptr<DiskLoad> m_load;
+		std::filesystem::path m_path;      // Final name
+		std::filesystem::path m_writePath; // Written under until published
+		std::uint64_t m_size = 0;
+		std::optional<FileAttributes> m_attributes; // See setAttributes
+		bool m_publish = true;
+		bool m_finished = false;
+		asio::random_access_file m_file;
+
+		struct DrainWaiter
+		{
+			std::size_t threshold;
+			std::function<void()> fn;
+		};
+
+		std::error_code m_error;
+		std::uint64_t m_bytesWritten = 0;
+		std::atomic<std::size_t> m_pendingBytes = 0;
+		std::shared_ptr<cw::buffer::MemoryAccount> m_memory;
+		std::size_t m_inFlight = 0;
+
+		FinishCallback m_onFinish;
+		std::function<void(std::uint64_t)> m_onProgress;
+		std::shared_ptr<cw::metrics::LatencyHistogram> m_writeLatency;
+		std::vector<DrainWaiter> m_drainWaiters;
+	};
+
+#endif
+}
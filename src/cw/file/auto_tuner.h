@@ -0,0 +1,352 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "cw/compression/codec.h"
+#include "cw/file/file.h"
+#include "cw/log/logger.h"
+#include "cw/metrics/progress.h"
+
+namespace cw {
+
+	// One point of the tuner's search: how many connections a file may use,
+	// its chunk size and its compression
+	struct TuningSetting
+	{
+		size_t streams = 1;
+		size_t chunkSize = DEFAULT_CHUNK_SIZE;
+		cw::compression::Codec compression = cw::compression::Codec::None;
+		int compressionLevel = 0;
+
+		bool operator==(const TuningSetting&) const = default;
+
+		// The setting 'options' already asks for
+		static TuningSetting of(const TransferOptions& options, size_t streams)
+		{
+			return { streams, options.chunkSize, options.compression, options.compressionLevel };
+		}
+
+		// 'options' with this setting's chunk size and compression (fixed: the
+		// tuner, not the ChunkSizer, moves the chunk size)
+		TransferOptions applied(TransferOptions options) const
+		{
+			options.chunkSize = chunkSize;
+			options.adaptiveChunkSize = false;
+			options.compression = compression;
+			options.compressionLevel = compressionLevel;
+			return options;
+		}
+
+		std::string describe() const
+		{
+			std::ostringstream out;
+			out << streams << " streams, " << chunkSize / 1024 << " KB chunks, " << cw::compression::codecName(compression);
+			if (compression != cw::compression::Codec::None && compressionLevel != 0) out << ":" << compressionLevel;
+			return out.str();
+		}
+	};
+
+	// Closed-loop tuning of an upload: each probe runs a setting for a
+	// while and reports the throughput it got (onSample); the tuner climbs
+	// one dimension at a time (streams, chunk size, compression), doubling
+	// or halving, or stepping to the next codec, while the rate improves by
+	// more than IMPROVEMENT, and settles once a round over every dimension
+	// finds nothing better. The first sample after a change is discarded:
+	// it still holds files started under the previous setting (the very
+	// first, the connections' slow start).
+	// Any thread; the upload reads current() as each file starts.
+	class AutoTuner
+	{
+	public:
+		static constexpr double IMPROVEMENT = 0.05;
+
+		struct Compression
+		{
+			cw::compression::Codec codec = cw::compression::Codec::None;
+			int level = 0;
+		};
+
+		struct Limits
+		{
+			size_t maxStreams = 1;
+			size_t minChunkSize = 64 * 1024;
+			size_t maxChunkSize = cw::packet::MAX_CHUNK_SIZE;
+			std::vector<Compression> compressions{ {} }; // Cheapest first
+			std::chrono::steady_clock::duration probe = std::chrono::seconds(2);
+
+			// What this build and 'conn''s peer have in common, over up to 'connections' streams
+			static Limits available(const cw::network::Connection& conn, size_t connections)
+			{
+				using cw::compression::Codec;
+				Limits limits;
+				limits.maxStreams = std::max<size_t>(1, connections);
+				if (std::uint32_t peerMax = conn.peerMaxChunkSize()) limits.maxChunkSize = std::min<size_t>(limits.maxChunkSize, peerMax);
+				std::uint32_t codecs = cw::compression::supportedCodecs();
+				if ((codecs & cw::compression::codecBit(Codec::Lz4)) && conn.peerAccepts(Codec::Lz4)) limits.compressions.push_back({ Codec::Lz4, 0 });
+				if ((codecs & cw::compression::codecBit(Codec::Deflate)) && conn.peerAccepts(Codec::Deflate)) limits.compressions.push_back({ Codec::Deflate, 1 });
+				if ((codecs & cw::compression::codecBit(Codec::Zstd)) && conn.peerAccepts(Codec::Zstd)) {
+					limits.compressions.push_back({ Codec::Zstd, 1 });
+					limits.compressions.push_back({ Codec::Zstd, 3 });
+					limits.compressions.push_back({ Codec::Zstd, 9 });
+				}
+				return limits;
+			}
+		};
+
+		AutoTuner(TuningSetting start, Limits limits) : m_limits(std::move(limits))
+		{
+			start.streams = std::clamp<size_t>(start.streams, 1, m_limits.maxStreams);
+			start.chunkSize = std::clamp(start.chunkSize, m_limits.minChunkSize, std::max(m_limits.minChunkSize, m_limits.maxChunkSize));
+			m_best = m_current = start;
+		}
+
+		const Limits& limits() const { return m_limits; }
+
+		TuningSetting current() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_current;
+		}
+
+		TuningSetting best() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_best;
+		}
+
+		double bestRate() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return std::max(0.0, m_bestRate);
+		}
+
+		bool converged() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_converged;
+		}
+
+		// The throughput (bytes/s) of the probe that just ended under
+		// current(). True if it moved on to another setting.
+		bool onSample(double bytesPerSecond)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_settling) {
+				m_settling = false;
+				return false;
+			}
+			if (m_converged) return false;
+
+			if (m_bestRate < 0) {
+				m_bestRate = bytesPerSecond;
+			}
+			else if (bytesPerSecond > m_bestRate * (1 + IMPROVEMENT)) {
+				// Better: keep going the same way
+				m_best = m_current;
+				m_bestRate = bytesPerSecond;
+				m_fruitless = 0;
+				m_moved = true;
+			}
+			else {
+				m_bestRate = std::max(m_bestRate, bytesPerSecond);
+				turn();
+			}
+			return propose();
+		}
+
+	private:
+		static constexpr int DIMENSIONS = 3;
+
+		// Tries the other direction (unless this one paid off), then the next dimension
+		void turn()
+		{
+			if (m_direction > 0 && !m_moved) {
+				m_direction = -1;
+				return;
+			}
+			m_direction = 1;
+			m_dimension = (m_dimension + 1) % DIMENSIONS;
+			m_moved = false;
+			++m_fruitless;
+		}
+
+		// Moves current() to the next neighbour of the best setting
+		bool propose()
+		{
+			TuningSetting previous = m_current;
+			for (;;) {
+				if (m_fruitless >= DIMENSIONS) {
+					m_converged = true;
+					m_current = m_best;
+					break;
+				}
+				if (auto next = step(m_best)) {
+					m_current = *next;
+					break;
+				}
+				turn();
+			}
+			m_settling = m_current != previous;
+			return m_settling;
+		}
+
+		// 'from' one step along the current dimension and direction, if that stays within the limits
+		std::optional<TuningSetting> step(TuningSetting from) const
+		{
+			switch (m_dimension) {
+			case 0: {
+				size_t streams = m_direction > 0 ? std::min(from.streams * 2, m_limits.maxStreams) : std::max<size_t>(1, from.streams / 2);
+				if (streams == from.streams) return std::nullopt;
+				from.streams = streams;
+				return from;
+			}
+			case 1: {
+				size_t chunk = m_direction > 0 ? std::min(from.chunkSize * 2, m_limits.maxChunkSize) : std::max(from.chunkSize / 2, m_limits.minChunkSize);
+				if (chunk == from.chunkSize) return std::nullopt;
+				from.chunkSize = chunk;
+				return from;
+			}
+			default: {
+				auto& all = m_limits.compressions;
+				auto here = std::find_if(all.begin(), all.end(), [&](const Compression& c) { return c.codec == from.compression && c.level == from.compressionLevel; });
+				std::ptrdiff_t index = here == all.end() ? 0 : here - all.begin();
+				std::ptrdiff_t next = index + m_direction;
+				if (next < 0 || next >= static_cast<std::ptrdiff_t>(all.size()) || (here == all.end() && m_direction < 0)) return std::nullopt;
+				from.compression = all[static_cast<size_t>(next)].codec;
+				from.compressionLevel = all[static_cast<size_t>(next)].level;
+				return from;
+			}
+			}
+		}
+
+		mutable std::mutex m_mutex;
+		Limits m_limits;
+		TuningSetting m_best;
+		TuningSetting m_current;
+		double m_bestRate = -1; // Not measured yet
+		int m_dimension = 0;
+		int m_direction = 1;
+		int m_fruitless = 0; // Dimensions in a row that found nothing better
+		bool m_moved = false; // This dimension found something better
+		bool m_settling = true; // The first probe only warms the connections up
+		bool m_converged = false;
+	};
+
+	// Drives 'tuner' from the acked rate of 'progress', read every probe
+	// interval, until 'timer' is cancelled (the upload is over) or it settles.
+	inline asio::awaitable<void> asyncTune(std::shared_ptr<AutoTuner> tuner, std::shared_ptr<const cw::metrics::TransferProgress> progress,
+		std::shared_ptr<asio::steady_timer> timer)
+	{
+		cw::metrics::ProgressSnapshot last = progress->snapshot();
+		for (;;) {
+			timer->expires_after(tuner->limits().probe);
+			std::error_code ec;
+			co_await timer->async_wait(asio::redirect_error(asio::use_awaitable, ec));
+			if (ec) co_return;
+
+			// The rate of this probe alone, not smoothed across settings
+			cw::metrics::ProgressSnapshot now = progress->snapshot();
+			double seconds = std::max(1e-9, std::chrono::duration<double>(now.elapsed - last.elapsed).count());
+			double rate = static_cast<double>(now.bytesAcked - last.bytesAcked) / seconds;
+			last = now;
+
+			if (tuner->onSample(rate)) {
+				CW_LOG_INFO("[Tune] ", rate / 1e6, " MB/s, trying ", tuner->current().describe());
+			}
+			else if (tuner->converged()) {
+				CW_LOG_INFO("[Tune] Settled on ", tuner->best().describe(), " (", tuner->bestRate() / 1e6, " MB/s)");
+				co_return;
+			}
+		}
+	}
+
+	// The best setting found for each destination (a server's name), kept
+	// between runs in a small text file, one destination per line:
+	//   destination streams chunkSize codec level bytesPerSecond
+	class TuningCache
+	{
+	public:
+		struct Entry
+		{
+			TuningSetting setting;
+			double bytesPerSecond = 0;
+		};
+
+		// $XDG_CACHE_HOME/connectwith/tuning (~/.cache on Unix, %LOCALAPPDATA% on Windows)
+		static fs::path defaultPath()
+		{
+			fs::path base;
+			if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache && *cache) base = cache;
+			else if (const char* local = std::getenv("LOCALAPPDATA"); local && *local) base = local;
+			else if (const char* home = std::getenv("HOME"); home && *home) base = fs::path(home) / ".cache";
+			else base = fs::temp_directory_path();
+			return base / "connectwith" / "tuning";
+		}
+
+		explicit TuningCache(fs::path path = defaultPath()) : m_path(std::move(path))
+		{
+			std::ifstream in(m_path);
+			std::string line;
+			while (std::getline(in, line)) {
+				std::istringstream fields(line);
+				std::string destination, codec;
+				Entry entry;
+				if (!(fields >> destination >> entry.setting.streams >> entry.setting.chunkSize >> codec >> entry.setting.compressionLevel >> entry.bytesPerSecond)) continue;
+				auto parsed = cw::compression::codecFromName(codec);
+				if (!parsed || entry.setting.streams == 0 || entry.setting.chunkSize == 0) continue;
+				entry.setting.compression = *parsed;
+				m_entries[destination] = entry;
+			}
+		}
+
+		std::optional<Entry> find(const std::string& destination) const
+		{
+			auto it = m_entries.find(destination);
+			if (it == m_entries.end()) return std::nullopt;
+			return it->second;
+		}
+
+		void store(const std::string& destination, const TuningSetting& setting, double bytesPerSecond)
+		{
+			m_entries[destination] = { setting, bytesPerSecond };
+		}
+
+		// Written to a temporary file and renamed over the old one
+		std::error_code save() const
+		{
+			std::error_code ec;
+			fs::create_directories(m_path.parent_path(), ec);
+			fs::path temporary = m_path;
+			temporary += ".tmp";
+			{
+				std::ofstream out(temporary, std::ios::trunc);
+				for (const auto& [destination, entry] : m_entries) {
+					const TuningSetting& s = entry.setting;
+					out << destination << ' ' << s.streams << ' ' << s.chunkSize << ' ' << cw::compression::codecName(s.compression) << ' '
+						<< s.compressionLevel << ' ' << static_cast<std::uint64_t>(entry.bytesPerSecond) << '\n';
+				}
+				if (!out.flush()) return std::make_error_code(std::errc::io_error);
+			}
+			fs::rename(temporary, m_path, ec);
+			return ec;
+		}
+
+	private:
+		fs::path m_path;
+		std::map<std::string, Entry> m_entries;
+	};
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
+#include "cw/buffer/shared_buffer.h"
+#include "cw/file/manifest.h"
+
+namespace cw::file {
+
+	// Which version of which file a cached chunk is of: a file rewritten or
+	// replaced since (new size, mtime or inode) misses rather than serving
+	// stale bytes
+	struct FileIdentity
+	{
+		std::uint64_t device = 0;
+		std::uint64_t inode = 0; // 0 where the platform has none
+		std::uint64_t size = 0;
+		std::int64_t modifiedNs = 0;
+		std::uint64_t pathHash = 0; // Tells files apart without an inode
+
+		friend bool operator==(const FileIdentity&, const FileIdentity&) = default;
+
+		static std::optional<FileIdentity> of(const std::filesystem::path& path)
+		{
+			FileIdentity id;
+#if !defined(_WIN32)
+			struct stat info;
+			if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) return std::nullopt;
+			id.device = static_cast<std::uint64_t>(info.st_dev);
+			id.inode = static_cast<std::uint64_t>(info.st_ino);
+			id.size = static_cast<std::uint64_t>(info.st_size);
+			id.modifiedNs = static_cast<std::int64_t>(info.st_mtim.tv_sec) * 1'000'000'000 + info.st_mtim.tv_nsec;
+#else
+			std::error_code ec;
+			id.size = std::filesystem::file_size(path, ec);
+			if (ec) return std::nullopt;
+			auto modified = std::filesystem::last_write_time(path, ec);
+			if (ec) return std::nullopt;
+			id.modifiedNs = cw::file::modifiedNs(modified);
+			std::string key = std::filesystem::absolute(path, ec).lexically_normal().generic_string();
+			Fnv1a hash;
+			hash.update(reinterpret_cast<const std::uint8_t*>(key.data()), key.size());
+			id.pathHash = hash.value();
+#endif
+			return id;
+		}
+	};
+
+	// Recently sent chunks in memory, for servers that send the same files
+	// over and over: many clients downloading one artifact, a relay passing
+	// a file to several next hops. A chunk is the buffer it was read into,
+	// shared with the frames that send it, so a hit costs neither a disk
+	// read nor a copy. Split into shards, each a least-recently-used list
+	// under its own lock with its share of the byte budget, so readers on
+	// many threads rarely wait on each other. Chunks are keyed by file
+	// version, offset and length: readers of the same file with the same
+	// chunk size share them. Thread-safe.
+	class ChunkCache
+	{
+	public:
+		static constexpr std::size_t DEFAULT_SHARDS = 16;
+
+		struct Key
+		{
+			FileIdentity file;
+			std::uint64_t offset = 0;
+			std::uint32_t length = 0;
+
+			friend bool operator==(const Key&, const Key&) = default;
+		};
+
+		struct Stats
+		{
+			std::uint64_t hits = 0;
+			std::uint64_t misses = 0;
+			std::uint64_t evictions = 0;
+			std::uint64_t bytes = 0;   // Held now
+			std::uint64_t entries = 0; // Held now
+		};
+
+		explicit ChunkCache(std::size_t capacityBytes, std::size_t shards = DEFAULT_SHARDS)
+			: m_shards(std::max<std::size_t>(1, shards))
+		{
+			for (auto& shard : m_shards) shard.capacity = capacityBytes / m_shards.size();
+		}
+
+		std::size_t capacity() const { return m_shards.front().capacity * m_shards.size(); }
+
+		// The chunk cached under 'key', now the most recently used of its shard
+		std::optional<cw::buffer::SharedBuffer> find(const Key& key)
+		{
+			Shard& shard = shardFor(key);
+			std::lock_guard lock(shard.mutex);
+			auto it = shard.index.find(key);
+			if (it == shard.index.end()) {
+				m_misses.fetch_add(1, std::memory_order_relaxed);
+				return std::nullopt;
+			}
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			m_hits.fetch_add(1, std::memory_order_relaxed);
+			return it->second->data;
+		}
+
+		// Keeps 'data' under 'key', evicting the least recently used chunks
+		// of its shard to make room. A chunk larger than a shard's share is
+		// not kept.
+		void insert(const Key& key, cw::buffer::SharedBuffer data)
+		{
+			Shard& shard = shardFor(key);
+			if (data.empty() || data.size() > shard.capacity) return;
+
+			std::lock_guard lock(shard.mutex);
+			if (auto it = shard.index.find(key); it != shard.index.end()) {
+				shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+				return;
+			}
+			while (shard.bytes + data.size() > shard.capacity && !shard.lru.empty()) {
+				auto& victim = shard.lru.back();
+				shard.bytes -= victim.data.size();
+				shard.index.erase(victim.key);
+				shard.lru.pop_back();
+				m_evictions.fetch_add(1, std::memory_order_relaxed);
+			}
+			shard.bytes += data.size();
+			shard.lru.push_front({ key, std::move(data) });
+			shard.index.emplace(key, shard.lru.begin());
+		}
+
+		Stats stats() const
+		{
+			Stats stats{ m_hits.load(std::memory_order_relaxed), m_misses.load(std::memory_order_relaxed), m_evictions.load(std::memory_order_relaxed) };
+			for (auto& shard : m_shards) {
+				std::lock_guard lock(shard.mutex);
+				stats.bytes += shard.bytes;
+				stats.entries += shard.index.size();
+			}
+			return stats;
+		}
+
+	private:
+		struct KeyHash
+		{
+			std::size_t operator()(const Key& key) const
+			{
+				Fnv1a hash;
+				hash.update(key.file.device);
+				hash.update(key.file.inode);
+				hash.update(key.file.size);
+				hash.update(static_cast<std::uint64_t>(key.file.modifiedNs));
+				hash.update(key.file.pathHash);
+				hash.update(key.offset);
+				hash.update(key.length);
+				return static_cast<std::size_t>(hash.value());
+			}
+		};
+
+		struct Entry
+		{
+			Key key;
+			cw::buffer::SharedBuffer data;
+		};
+
+		struct Shard
+		{
+			mutable std::mutex mutex;
+			std::list<Entry> lru; // Most recently used first
+			std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+			std::size_t bytes = 0;
+			std::size_t capacity = 0;
+		};
+
+		// High bits: the low ones pick the bucket within the shard
+		Shard& shardFor(const Key& key) { return m_shards[(KeyHash{}(key) >> 40) % m_shards.size()]; }
+
+		std::vector<Shard> m_shards;
+		std::atomic<std::uint64_t> m_hits = 0;
+		std::atomic<std::uint64_t> m_misses = 0;
+		std::atomic<std::uint64_t> m_evictions = 0;
+	};
+}
@@ -0,0 +1,274 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+
+#include "cw/buffer/shared_buffer.h"
+#include "cw/buffer/buffer_pool.h"
+#include "cw/file/chunk_cache.h"
+#include "cw/file/mapped_file.h"
+#include "cw/log/logger.h"
+#include "cw/file/file_handle.h"
+#include "cw/metrics/stage_profile.h"
+#include "cw/metrics/timeline.h"
+
+namespace cw::file {
+
+	enum class ReadMode
+	{
+		Stream,     // std::ifstream into a fresh buffer per chunk
+		MemoryMap,  // Views into a read-only mapping
+		KernelCopy, // No reads at all: file ranges for sendfile/TransmitFile
+		Direct      // Unbuffered reads (O_DIRECT) into aligned pool buffers
+	};
+
+	// Sequential chunk reader used by the upload paths.
+	// Backed either by a read-only mapping (chunks are views into the page cache),
+	// a raw handle (chunks are file ranges the kernel copies to the socket),
+	// an unbuffered handle (chunks are read past the page cache, so a file far
+	// larger than RAM sent once does not evict everything else cached),
+	// or by std::ifstream (chunks are read into a fresh buffer each).
+	class ChunkSource
+	{
+	public:
+		// MemoryMap, KernelCopy and Direct fall back to Stream if the file cannot
+		// be mapped/opened raw/opened unbuffered.
+		ChunkSource(const std::filesystem::path& path, ReadMode mode) : m_path(path)
+		{
+			try {
+				if (mode == ReadMode::MemoryMap) {
+					m_mapping = MappedFile::open(path);
+					return;
+				}
+				if (mode == ReadMode::KernelCopy) {
+					auto handle = std::make_shared<FileHandle>(FileHandle::openRead(path));
+					m_fileSize = handle->size();
+					m_handle = std::move(handle);
+					return;
+				}
+				if (mode == ReadMode::Direct) {
+					m_direct = FileHandle::openRead(path, true);
+					m_fileSize = m_direct.size();
+					return;
+				}
+			}
+			catch (const std::system_error& e) {
+				CW_LOG_WARN("[File] Fast read path unavailable, using stream reads: ", e.what());
+			}
+
+			m_stream.open(path, std::ios::binary);
+		}
+
+		// What was read and not yet dropped goes too
+		~ChunkSource()
+		{
+			if (m_dropBehind && m_offset > m_droppedTo) dropCache(m_droppedTo, m_offset - m_droppedTo);
+		}
+
+		// Keeps the next 'bytes' of the file being read into the page cache in
+		// the background while earlier chunks are on the wire, so disk latency
+		// overlaps network latency instead of adding to it (0 = off, the
+		// default). The window is topped up once half of it has been consumed.
+		// Direct reads bypass the page cache, so there it does nothing.
+		void setReadAhead(std::size_t bytes)
+		{
+			m_readAhead = m_direct.isOpen() ? 0 : bytes;
+			if (m_readAhead > 0 && !openAdviceHandle()) m_readAhead = 0;
+			m_prefetchedTo = m_offset;
+			readAhead();
+		}
+
+		// Drop-behind: the pages of what has been read are dropped from the
+		// page cache (see cw::file::dropCache) in DROP_BEHIND_STEP batches,
+		// a step behind the read position so chunks still on the wire (views,
+		// file ranges) are not read twice. Off by default; moot for Direct.
+		void setDropBehind(bool enabled)
+		{
+			m_dropBehind = enabled && !m_direct.isOpen() && openAdviceHandle();
+			m_droppedTo = m_offset;
+		}
+
+		// Chunks read into buffers (Stream and Direct) are looked up in and
+		// kept in 'cache' (see ChunkCache), keyed by the file as it is now.
+		// Views of a mapping and kernel ranges are not: those are the page
+		// cache already.
+		void setCache(std::shared_ptr<ChunkCache> cache)
+		{
+			if (m_mapping || m_handle || !cache) return;
+			auto identity = FileIdentity::of(m_path);
+			if (!identity) return;
+			m_cache = std::move(cache);
+			m_identity = *identity;
+		}
+
+		bool isMapped() const { return m_mapping != nullptr; }
+		bool isKernelCopy() const { return m_handle != nullptr; }
+		bool isDirect() const { return m_direct.isOpen(); }
+		bool isOpen() const { return m_mapping || m_handle || m_direct.isOpen() || m_stream.is_open(); }
+
+		// Continues reading at 'offset': a resumed upload (before the first
+		// chunk), or past a hole the upload skips.
+		void seek(std::uint64_t offset)
+		{
+			if (m_droppedTo >= m_offset || offset < m_droppedTo) m_droppedTo = offset; // Nothing read is pending
+			m_offset = offset;
+			if (m_stream.is_open()) m_stream.seekg(static_cast<std::streamoff>(offset));
+			m_prefetchedTo = offset;
+			readAhead();
+		}
+
+		// KernelCopy mode: next range of at most chunkSize bytes. Empty at EOF.
+		FileSegment nextSegment(std::size_t chunkSize)
+		{
+			FileSegment segment;
+			if (!m_handle || m_offset >= m_fileSize) return segment;
+
+			segment.file = m_handle;
+			segment.offset = m_offset;
+			segment.length = static_cast<std::size_t>(std::min<std::uint64_t>(chunkSize, m_fileSize - m_offset));
+
+			m_offset += segment.length;
+			readAhead();
+			dropBehind();
+			return segment;
+		}
+
+		// Next chunk of at most chunkSize bytes. Empty at EOF.
+		cw::buffer::SharedBuffer next(std::size_t chunkSize)
+		{
+			ChunkCache::Key key{ m_identity, m_offset, static_cast<std::uint32_t>(chunkSize) };
+			if (m_cache) {
+				if (auto cached = m_cache->find(key)) {
+					m_offset += cached->size();
+					if (m_stream.is_open()) m_stream.seekg(static_cast<std::streamoff>(m_offset));
+					return std::move(*cached);
+				}
+			}
+
+			cw::metrics::TimelineSpan span("read", "file", 0, m_offset);
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Read);
+			cw::buffer::SharedBuffer chunk = m_mapping
+				? m_mapping->slice(m_offset, chunkSize)
+				: m_direct.isOpen() ? readDirect(chunkSize) : readStream(chunkSize);
+			if (m_cache && !m_mapping) m_cache->insert(key, chunk);
+
+			span.setBytes(chunk.size());
+			m_offset += chunk.size();
+			readAhead();
+			dropBehind();
+			return chunk;
+		}
+
+		static constexpr std::uint64_t DROP_BEHIND_STEP = 8 * 1024 * 1024;
+
+	private:
+		// ifstream has no descriptor to advise: a second one, for advice only
+		bool openAdviceHandle()
+		{
+			if (m_mapping || m_handle || m_adviceHandle.isOpen()) return true;
+			try {
+				m_adviceHandle = FileHandle::openRead(m_path);
+				return true;
+			}
+			catch (const std::system_error&) {
+				return false;
+			}
+		}
+
+		void dropBehind()
+		{
+			if (!m_dropBehind || m_offset < m_droppedTo + 2 * DROP_BEHIND_STEP) return;
+
+			std::uint64_t to = m_offset - DROP_BEHIND_STEP;
+			dropCache(m_droppedTo, to - m_droppedTo);
+			m_droppedTo = to;
+		}
+
+		void dropCache(std::uint64_t offset, std::uint64_t length)
+		{
+			if (m_mapping) m_mapping->dropCache(offset, length);
+			else if (m_handle) m_handle->dropCache(offset, length);
+			else m_adviceHandle.dropCache(offset, length);
+		}
+
+		void readAhead()
+		{
+			if (m_readAhead == 0 || m_prefetchedTo >= m_offset + m_readAhead / 2) return;
+
+			std::uint64_t from = std::max(m_prefetchedTo, m_offset);
+			std::uint64_t to = m_offset + m_readAhead;
+			if (m_mapping) m_mapping->prefetch(from, to - from);
+			else if (m_handle) m_handle->prefetch(from, to - from);
+			else m_adviceHandle.prefetch(from, to - from);
+			m_prefetchedTo = to;
+		}
+
+		// Reads straight into the buffer that will become the frame's payload segment.
+		cw::buffer::SharedBuffer readStream(std::size_t chunkSize)
+		{
+			if (!m_stream) return {};
+
+			cw::buffer::PooledBuffer data(chunkSize);
+
+			m_stream.read(reinterpret_cast<char*>(data.data()), chunkSize);
+			size_t bytesRead = m_stream.gcount();
+
+			if (bytesRead == 0) return {};
+
+			if (bytesRead < chunkSize) {
+				data.shrink(bytesRead);
+			}
+
+			return std::move(data).share();
+		}
+
+		// Whole aligned blocks around [m_offset, m_offset + chunkSize) into an
+		// aligned buffer; the chunk is the slice of it past any unaligned head
+		// (a seek to an odd offset). The last block may run past the end of the
+		// file, which is a short read. A device that refuses the read anyway
+		// (a larger logical block size) sends the rest through the stream.
+		cw::buffer::SharedBuffer readDirect(std::size_t chunkSize)
+		{
+			if (m_offset >= m_fileSize) return {};
+
+			std::uint64_t start = m_offset / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+			auto head = static_cast<std::size_t>(m_offset - start);
+			auto length = static_cast<std::size_t>(std::min<std::uint64_t>(chunkSize, m_fileSize - m_offset));
+			std::size_t blocks = (head + length + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+
+			cw::buffer::PooledBuffer data(blocks, DIRECT_IO_ALIGNMENT);
+			std::size_t bytesRead = 0;
+			if (std::error_code ec = m_direct.readAt(start, data.span(), bytesRead)) {
+				CW_LOG_WARN("[File] Unbuffered read failed, using stream reads: ", ec.message());
+				m_direct.close();
+				m_stream.open(m_path, std::ios::binary);
+				m_stream.seekg(static_cast<std::streamoff>(m_offset));
+				return readStream(chunkSize);
+			}
+			if (bytesRead <= head) return {};
+
+			return std::move(data).share().slice(head, std::min(length, bytesRead - head));
+		}
+
+	private:
+		std::filesystem::path m_path;
+		std::shared_ptr<MappedFile> m_mapping;
+		std::shared_ptr<const FileHandle> m_handle;
+		FileHandle m_direct;
+		std::uint64_t m_fileSize = 0;
+		std::ifstream m_stream;
+		std::uint64_t m_offset = 0;
+
+		std::size_t m_readAhead = 0;
+		std::uint64_t m_prefetchedTo = 0; // Prefetch asked for up to here
+		FileHandle m_adviceHandle;
+
+		bool m_dropBehind = false;
+		std::uint64_t m_droppedTo = 0; // Read before here and dropped (or never read)
+
+		std::shared_ptr<ChunkCache> m_cache; // See setCache
+		FileIdentity m_identity;
+	};
+}
@@ -0,0 +1,169 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "cw/file/file_handle.h"
+#include "cw/integrity/sha256.h"
+#include "cw/log/logger.h"
+
+namespace cw::file {
+
+	// Whole-file dedup of a receiver's published files, for servers that are
+	// sent the same content over and over (build artifacts, shared libraries)
+	// by clients that do not dedup on the wire. Each file is hashed (SHA-256)
+	// once it is verified and published; the first file with some content
+	// becomes its object (<root>/ab/cdef..., as ChunkStore), and any later one
+	// is replaced by a link to that object, so N copies take the space of one
+	// and nothing more is written for them.
+	//
+	// Hardlink: the copies are one inode. Received files are always written
+	// under another name and renamed into place, so a later upload of the
+	// same name replaces its link and never writes through it; whatever edits
+	// a published file in place edits every copy, though. Reflink: each copy
+	// is its own file sharing extents with the object (FICLONE: btrfs, XFS),
+	// copy-on-write; where the filesystem cannot, files are kept as they are.
+	// Either way the root must be on the same filesystem as the files.
+	//
+	// Thread-safe; adopt() hashes the whole file, so run it on the disk pool.
+	class ContentStore
+	{
+	public:
+		enum class Link { Hardlink, Reflink };
+
+		enum class Adopted
+		{
+			Stored,  // First of its content: now the object
+			Linked,  // A copy: now a link to the object
+			Skipped, // Empty, changed while hashed, or not a regular file
+		};
+
+		explicit ContentStore(std::filesystem::path root, Link link = Link::Hardlink) :
+			m_root(std::move(root)), m_link(link), m_nextTemp(std::random_device{}())
+		{
+		}
+
+		const std::filesystem::path& root() const { return m_root; }
+		Link link() const { return m_link; }
+
+		std::filesystem::path pathFor(const cw::integrity::Sha256Digest& hash) const
+		{
+			std::string hex = cw::integrity::toHex(hash);
+			return m_root / hex.substr(0, 2) / hex.substr(2);
+		}
+
+		// Files replaced by links, and the bytes they no longer take
+		std::uint64_t linkedFiles() const { return m_linkedFiles.load(std::memory_order_relaxed); }
+		std::uint64_t savedBytes() const { return m_savedBytes.load(std::memory_order_relaxed); }
+
+		// Dedups a published file: stores it as the object of its content, or
+		// replaces it with a link to the object already stored. On error the
+		// file is left as it was.
+		Adopted adopt(const std::filesystem::path& path, std::error_code& ec)
+		{
+			ec.clear();
+			if (!std::filesystem::is_regular_file(path, ec) || ec) return Adopted::Skipped;
+			auto size = std::filesystem::file_size(path, ec);
+			auto modified = std::filesystem::last_write_time(path, ec);
+			if (ec || size == 0) return Adopted::Skipped;
+
+			cw::integrity::Sha256Digest hash;
+			if ((ec = hashFile(path, hash))) return Adopted::Skipped;
+
+			// Rewritten while it was hashed: the hash is not of what is there now
+			std::error_code stat;
+			if (std::filesystem::file_size(path, stat) != size || std::filesystem::last_write_time(path, stat) != modified || stat)
+				return Adopted::Skipped;
+
+			std::filesystem::path object = pathFor(hash);
+			std::error_code missing;
+			if (std::filesystem::file_size(object, missing) == size && !missing) {
+				if (std::filesystem::equivalent(object, path, missing)) return Adopted::Linked;
+				if ((ec = place(object, path))) return Adopted::Skipped;
+				m_linkedFiles.fetch_add(1, std::memory_order_relaxed);
+				m_savedBytes.fetch_add(size, std::memory_order_relaxed);
+				CW_LOG_INFO("[Store] ", path.generic_string(), " is a copy of ", cw::integrity::toHex(hash).substr(0, 12), ", linked (", size, " bytes)");
+				return Adopted::Linked;
+			}
+
+			std::filesystem::create_directories(object.parent_path(), ec);
+			if (ec || (ec = place(path, object))) return Adopted::Skipped;
+			return Adopted::Stored;
+		}
+
+		Adopted adopt(const std::filesystem::path& path)
+		{
+			std::error_code ec;
+			Adopted adopted = adopt(path, ec);
+			if (ec) CW_LOG_WARN("[Store] ", path.generic_string(), " kept as it is: ", ec.message());
+			return adopted;
+		}
+
+	private:
+		static constexpr std::size_t READ_SIZE = 1024 * 1024;
+
+		static std::error_code hashFile(const std::filesystem::path& path, cw::integrity::Sha256Digest& hash)
+		{
+			try {
+				FileHandle file = FileHandle::openRead(path);
+				std::vector<std::uint8_t> buffer(READ_SIZE);
+				cw::integrity::Sha256 sha;
+				std::uint64_t offset = 0;
+				while (true) {
+					std::size_t read = 0;
+					if (auto ec = file.readAt(offset, buffer, read)) return ec;
+					if (read == 0) break;
+					sha.update(std::span<const std::uint8_t>(buffer.data(), read));
+					offset += read;
+				}
+				hash = sha.digest();
+				return {};
+			}
+			catch (const std::system_error& e) {
+				return e.code();
+			}
+		}
+
+		// 'target' becomes a link to (or a reflinked copy of) 'source': made
+		// under a temporary name and renamed over it, so 'target' is never missing
+		std::error_code place(const std::filesystem::path& source, const std::filesystem::path& target)
+		{
+			std::filesystem::path temp = target;
+			temp += ".tmp" + std::to_string(m_nextTemp++);
+
+			std::error_code ec;
+			if (m_link == Link::Hardlink) std::filesystem::create_hard_link(source, temp, ec);
+			else ec = reflink(source, temp);
+
+			if (!ec) std::filesystem::rename(temp, target, ec);
+			if (ec) {
+				std::error_code ignored;
+				std::filesystem::remove(temp, ignored);
+			}
+			return ec;
+		}
+
+		static std::error_code reflink(const std::filesystem::path& source, const std::filesystem::path& target)
+		{
+			try {
+				FileHandle in = FileHandle::openRead(source);
+				FileHandle out = FileHandle::openWrite(target);
+				return out.cloneFrom(in);
+			}
+			catch (const std::system_error& e) {
+				return e.code();
+			}
+		}
+
+		std::filesystem::path m_root;
+		Link m_link;
+		std::atomic<std::uint64_t> m_nextTemp; // Random start: several processes may share a store
+		std::atomic<std::uint64_t> m_linkedFiles = 0;
+		std::atomic<std::uint64_t> m_savedBytes = 0;
+	};
+}
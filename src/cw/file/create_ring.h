@@ -0,0 +1,255 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define CW_HAS_CREATE_RING 1
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+// Macros of <linux/fs.h>, which it includes, that would shadow names of our own
+#undef BLOCK_SIZE
+#undef BLOCK_SIZE_BITS
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cw::file {
+
+#if defined(CW_HAS_CREATE_RING)
+	// An io_uring of a disk thread's own for batches of small files: each
+	// file is one linked chain (openat into a registered descriptor slot,
+	// write, close, renameat), and up to SLOTS chains go in one submission,
+	// so a batch of N files costs N/SLOTS system calls instead of four per
+	// file. Raw system calls against <linux/io_uring.h>, no liburing; needs
+	// Linux 5.15 (descriptors opened straight into slots), probed when the
+	// ring is set up. Not thread-safe: one per thread (forThisThread).
+	class CreateRing
+	{
+	public:
+		static constexpr unsigned OPS_PER_FILE = 4;
+		static constexpr unsigned ENTRIES = 256;
+		static constexpr unsigned SLOTS = ENTRIES / OPS_PER_FILE;
+		static constexpr std::size_t MAX_FILE_SIZE = 1u << 30; // One write each
+
+		// One file of a batch, written to 'receiving' then renamed to 'name',
+		// both in the directory 'directory' is a descriptor of
+		struct File
+		{
+			int directory;
+			const char* receiving;
+			const char* name;
+			std::span<const std::uint8_t> data;
+			int openFlags;
+		};
+
+		CreateRing(const CreateRing&) = delete;
+		CreateRing& operator=(const CreateRing&) = delete;
+
+		~CreateRing()
+		{
+			if (m_sqes) ::munmap(m_sqes, m_sqesSize);
+			if (m_cqRing && m_cqRing != m_sqRing) ::munmap(m_cqRing, m_cqRingSize);
+			if (m_sqRing) ::munmap(m_sqRing, m_sqRingSize);
+			if (m_fd >= 0) ::close(m_fd);
+		}
+
+		// The calling thread's ring, or null where the kernel cannot run the
+		// chains (too old, io_uring disabled); the caller writes file by file
+		static CreateRing* forThisThread()
+		{
+			thread_local std::unique_ptr<CreateRing> ring = open();
+			return ring.get();
+		}
+
+		// Writes 'files'; per file, 0 or the -errno of the first step that
+		// failed (the steps after it are cancelled: a file that failed is
+		// never renamed into place, its receiving name may be left)
+		std::vector<int> write(std::span<const File> files)
+		{
+			std::vector<int> results(files.size(), 0);
+			for (std::size_t first = 0; first < files.size(); first += SLOTS) {
+				std::size_t count = std::min<std::size_t>(SLOTS, files.size() - first);
+				for (std::size_t i = 0; i < count; ++i) queueChain(files[first + i], static_cast<unsigned>(i), first + i);
+				complete(static_cast<unsigned>(count * OPS_PER_FILE), results);
+			}
+			return results;
+		}
+
+	private:
+		CreateRing() = default;
+
+		static std::unique_ptr<CreateRing> open()
+		{
+			std::unique_ptr<CreateRing> ring(new CreateRing());
+			if (!ring->setUp() || !ring->probe()) return nullptr;
+			return ring;
+		}
+
+		bool setUp()
+		{
+			io_uring_params params{};
+			m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, ENTRIES, &params));
+			if (m_fd < 0) return false;
+
+			m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+			if (single) m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+			m_sqRing = map(m_sqRingSize, IORING_OFF_SQ_RING);
+			if (!m_sqRing) return false;
+			m_cqRing = single ? m_sqRing : map(m_cqRingSize, IORING_OFF_CQ_RING);
+			if (!m_cqRing) return false;
+			m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+			m_sqes = static_cast<io_uring_sqe*>(map(m_sqesSize, IORING_OFF_SQES));
+			if (!m_sqes) return false;
+
+			auto* sq = static_cast<std::uint8_t*>(m_sqRing);
+			auto* cq = static_cast<std::uint8_t*>(m_cqRing);
+			m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+			m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+			m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+			m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+			m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+			m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+			m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+			// Empty slots the chains open their files into
+			std::vector<int> slots(SLOTS, -1);
+			return ::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_FILES, slots.data(), SLOTS) == 0;
+		}
+
+		void* map(std::size_t size, off_t offset) const
+		{
+			void* mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+			return mapped == MAP_FAILED ? nullptr : mapped;
+		}
+
+		// Every opcode known, and opening into a slot accepted (5.15; before,
+		// the slot field is refused with EINVAL)
+		bool probe()
+		{
+			constexpr unsigned OPS = 256;
+			std::vector<std::uint8_t> buffer(sizeof(io_uring_probe) + OPS * sizeof(io_uring_probe_op), 0);
+			auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+			if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, OPS) != 0) return false;
+			for (unsigned op : { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_RENAMEAT }) {
+				if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+			}
+
+			io_uring_sqe* open = next(0);
+			open->opcode = IORING_OP_OPENAT;
+			open->fd = AT_FDCWD;
+			open->addr = reinterpret_cast<std::uint64_t>(".");
+			open->open_flags = O_RDONLY | O_DIRECTORY;
+			open->file_index = 1;
+			open->flags = IOSQE_IO_LINK;
+			io_uring_sqe* close = next(1);
+			close->opcode = IORING_OP_CLOSE;
+			close->file_index = 1;
+			std::vector<int> results(2, 0);
+			complete(2, results);
+			return results[0] == 0 && results[1] == 0;
+		}
+
+		// A zeroed entry at the tail, for the result of 'file'
+		io_uring_sqe* next(std::uint64_t file)
+		{
+			unsigned index = m_pendingTail++ & m_sqMask;
+			io_uring_sqe* sqe = &m_sqes[index];
+			std::memset(sqe, 0, sizeof(*sqe));
+			sqe->user_data = file;
+			m_sqArray[index] = index;
+			return sqe;
+		}
+
+		void queueChain(const File& file, unsigned slot, std::uint64_t index)
+		{
+			io_uring_sqe* open = next(index);
+			open->opcode = IORING_OP_OPENAT;
+			open->fd = file.directory;
+			open->addr = reinterpret_cast<std::uint64_t>(file.receiving);
+			open->len = 0644;
+			open->open_flags = static_cast<std::uint32_t>(file.openFlags & ~O_CLOEXEC); // Refused for a slot, which no exec inherits
+			open->file_index = slot + 1;
+			open->flags = IOSQE_IO_LINK;
+
+			// A short write fails the chain as an error does
+			io_uring_sqe* write = next(index);
+			write->opcode = IORING_OP_WRITE;
+			write->fd = static_cast<int>(slot);
+			write->addr = reinterpret_cast<std::uint64_t>(file.data.data());
+			write->len = static_cast<std::uint32_t>(file.data.size());
+			write->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+
+			io_uring_sqe* close = next(index);
+			close->opcode = IORING_OP_CLOSE;
+			close->file_index = slot + 1;
+			close->flags = IOSQE_IO_LINK;
+
+			io_uring_sqe* rename = next(index);
+			rename->opcode = IORING_OP_RENAMEAT;
+			rename->fd = file.directory;
+			rename->addr = reinterpret_cast<std::uint64_t>(file.receiving);
+			rename->len = static_cast<std::uint32_t>(file.directory);
+			rename->addr2 = reinterpret_cast<std::uint64_t>(file.name);
+		}
+
+		// Submits what was queued and waits for its 'count' completions;
+		// the first failure of each file's chain goes into 'results'
+		void complete(unsigned count, std::vector<int>& results)
+		{
+			std::atomic_ref<unsigned>(*m_sqTail).store(m_pendingTail, std::memory_order_release);
+			unsigned toSubmit = count;
+			unsigned reaped = 0;
+			while (reaped < count) {
+				long entered = ::syscall(__NR_io_uring_enter, m_fd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+				if (entered < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+					// The ring itself failed: everything not reaped is failed with it
+					int error = -errno;
+					for (auto& result : results) {
+						if (result == 0) result = error;
+					}
+					std::atomic_ref<unsigned>(*m_cqHead).store(std::atomic_ref<unsigned>(*m_cqTail).load(std::memory_order_acquire), std::memory_order_release);
+					return;
+				}
+				if (entered > 0) toSubmit -= std::min<unsigned>(toSubmit, static_cast<unsigned>(entered));
+
+				unsigned head = *m_cqHead;
+				unsigned tail = std::atomic_ref<unsigned>(*m_cqTail).load(std::memory_order_acquire);
+				for (; head != tail; ++head, ++reaped) {
+					const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+					int& result = results[cqe.user_data];
+					if (cqe.res < 0 && (result == 0 || result == -ECANCELED)) result = cqe.res;
+				}
+				std::atomic_ref<unsigned>(*m_cqHead).store(head, std::memory_order_release);
+			}
+		}
+
+		int m_fd = -1;
+		void* m_sqRing = nullptr;
+		void* m_cqRing = nullptr;
+		std::size_t m_sqRingSize = 0;
+		std::size_t m_cqRingSize = 0;
+		io_uring_sqe* m_sqes = nullptr;
+		std::size_t m_sqesSize = 0;
+
+		unsigned* m_sqTail = nullptr;
+		unsigned m_sqMask = 0;
+		unsigned* m_sqArray = nullptr;
+		unsigned m_pendingTail = 0; // Ours alone: no SQPOLL thread reads it
+		unsigned* m_cqHead = nullptr;
+		unsigned* m_cqTail = nullptr;
+		unsigned m_cqMask = 0;
+		io_uring_cqe* m_cqes = nullptr;
+	};
+#endif
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "cw/file/file_handle.h"
+#include "cw/integrity/sha256.h"
+#include "cw/protocol/packet/packet.h"
+
+namespace cw::file {
+
+	// FastCDC (Xia et al., 2016/2020) content-defined chunking: cut points depend
+	// only on the bytes near them, so an insertion moves the chunk boundaries
+	// around it and no others, and identical data yields identical chunks in
+	// any file. Gear hash with normalized chunking: a stricter mask before the
+	// average size and a looser one after it keep sizes close to the average.
+	class FastCdc
+	{
+	public:
+		static constexpr std::size_t MIN_SIZE = 16 * 1024;
+		static constexpr std::size_t AVG_SIZE = 64 * 1024;
+		static constexpr std::size_t MAX_SIZE = 256 * 1024;
+
+		// Length of the chunk starting at 'data' (at most 'size', which is taken
+		// as the rest of the file when below MAX_SIZE).
+		static std::size_t cut(const std::uint8_t* data, std::size_t size)
+		{
+			if (size <= MIN_SIZE) return size;
+			std::size_t end = std::min(size, MAX_SIZE);
+			std::size_t normal = std::min(end, AVG_SIZE);
+
+			const auto& gear = gearTable();
+			std::uint64_t fingerprint = 0;
+			std::size_t i = MIN_SIZE;
+			for (; i < normal; ++i) {
+				fingerprint = (fingerprint << 1) + gear[data[i]];
+				if ((fingerprint & MASK_SMALL) == 0) return i + 1;
+			}
+			for (; i < end; ++i) {
+				fingerprint = (fingerprint << 1) + gear[data[i]];
+				if ((fingerprint & MASK_LARGE) == 0) return i + 1;
+			}
+			return end;
+		}
+
+	private:
+		// High bits: they depend on the last 64 bytes, the low ones on far fewer.
+		// log2(AVG_SIZE) = 16, normalization level 2.
+		static constexpr std::uint64_t MASK_SMALL = ~std::uint64_t(0) << (64 - 18);
+		static constexpr std::uint64_t MASK_LARGE = ~std::uint64_t(0) << (64 - 14);
+
+		// Fixed pseudo-random table (splitmix64 of a constant seed). Every client
+		// must cut identically, so this can never change.
+		static const std::array<std::uint64_t, 256>& gearTable()
+		{
+			static const std::array<std::uint64_t, 256> table = []()
+				{
+					std::array<std::uint64_t, 256> gear{};
+					std::uint64_t state = 0x636f6e6e65637457ull;
+					for (auto& entry : gear) {
+						std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+						z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+						z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+						entry = z ^ (z >> 31);
+					}
+					return gear;
+				}();
+			return table;
+		}
+	};
+
+	// Content-defined chunks of a file with their SHA-256, in file order.
+	// Reads the file once; nullopt if it cannot be read.
+	inline std::optional<std::vector<cw::packet::ChunkRef>> chunkFile(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return std::nullopt;
+
+		std::vector<cw::packet::ChunkRef> chunks;
+		std::vector<std::uint8_t> buffer;
+		std::size_t start = 0;
+		bool eof = false;
+
+		while (true) {
+			// Keep at least one maximal chunk ahead of the cursor (unless at EOF)
+			if (!eof && buffer.size() - start < FastCdc::MAX_SIZE) {
+				buffer.erase(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(start));
+				start = 0;
+
+				std::size_t old = buffer.size();
+				buffer.resize(old + 4 * FastCdc::MAX_SIZE);
+				file.read(reinterpret_cast<char*>(buffer.data() + old), static_cast<std::streamsize>(buffer.size() - old));
+				buffer.resize(old + static_cast<std::size_t>(file.gcount()));
+				if (!file) eof = true;
+				if (file.bad()) return std::nullopt;
+			}
+
+			std::size_t available = buffer.size() - start;
+			if (available == 0) break;
+
+			std::size_t length = FastCdc::cut(buffer.data() + start, available);
+			cw::packet::ChunkRef chunk;
+			chunk.hash = cw::integrity::sha256(std::span<const std::uint8_t>(buffer.data() + start, length));
+			chunk.length = static_cast<std::uint32_t>(length);
+			chunks.push_back(chunk);
+
+			start += length;
+		}
+		return chunks;
+	}
+
+	// Content-addressed chunk store of a receiver: every chunk it has received
+	// in dedup mode, one file per chunk named by its SHA-256 (as git objects:
+	// <root>/ab/cdef...). Thread-safe; calls hit the disk, so use the disk pool.
+	class ChunkStore
+	{
+	public:
+		explicit ChunkStore(std::filesystem::path root) : m_root(std::move(root)), m_nextTemp(std::random_device{}()) {}
+
+		// Used by connections that were not given a store explicitly: .cwstore
+		// in the working directory, which the server sets to its destination.
+		static std::shared_ptr<ChunkStore> defaultInstance()
+		{
+			static std::shared_ptr<ChunkStore> instance = std::make_shared<ChunkStore>(".cwstore");
+			return instance;
+		}
+
+		const std::filesystem::path& root() const { return m_root; }
+
+		std::filesystem::path pathFor(const cw::packet::ChunkHash& hash) const
+		{
+			std::string hex = cw::integrity::toHex(hash);
+			return m_root / hex.substr(0, 2) / hex.substr(2);
+		}
+
+		bool contains(const cw::packet::ChunkHash& hash, std::uint32_t length) const
+		{
+			std::error_code ec;
+			return std::filesystem::file_size(pathFor(hash), ec) == length && !ec;
+		}
+
+		// Adds a chunk after checking that 'data' really hashes to 'hash'.
+		// Written to a temporary name and renamed, so readers never see a partial chunk.
+		std::error_code insert(const cw::packet::ChunkHash& hash, std::span<const std::uint8_t> data)
+		{
+			if (cw::integrity::sha256(data) != hash) return std::make_error_code(std::errc::illegal_byte_sequence);
+			if (contains(hash, static_cast<std::uint32_t>(data.size()))) return {};
+
+			std::filesystem::path path = pathFor(hash);
+			std::error_code ec;
+			std::filesystem::create_directories(path.parent_path(), ec);
+			if (ec) return ec;
+
+			std::filesystem::path temp = path;
+			temp += ".tmp" + std::to_string(m_nextTemp++);
+			try {
+				FileHandle file = FileHandle::openWrite(temp);
+				ec = file.writeAt(0, data);
+			}
+			catch (const std::system_error& e) {
+				ec = e.code();
+			}
+
+			if (!ec) std::filesystem::rename(temp, path, ec);
+			if (ec) {
+				std::error_code ignored;
+				std::filesystem::remove(temp, ignored);
+			}
+			return ec;
+		}
+
+	private:
+		std::filesystem::path m_root;
+		std::atomic<std::uint64_t> m_nextTemp; // Random start: several processes may share a store
+	};
+}
@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <vector>
+
+#include "cw/file/file_handle.h"
+#include "cw/file/manifest.h"
+#include "cw/flat_hash.h"
+#include "cw/protocol/packet/packet.h"
+
+namespace cw::file {
+
+	// rsync's weak checksum: two 16-bit sums over a window, updated in O(1)
+	// as the window slides one byte. Candidates are confirmed by a strong hash.
+	class RollingChecksum
+	{
+	public:
+		void reset(const std::uint8_t* data, std::size_t length)
+		{
+			m_a = 0;
+			m_b = 0;
+			m_length = static_cast<std::uint32_t>(length);
+			for (std::size_t i = 0; i < length; ++i) {
+				m_a += data[i];
+				m_b += static_cast<std::uint32_t>(length - i) * data[i];
+			}
+		}
+
+		// Slides the window: 'out' leaves at the front, 'in' enters at the back
+		void roll(std::uint8_t out, std::uint8_t in)
+		{
+			m_a += in - out;
+			m_b += m_a - m_length * out;
+		}
+
+		std::uint32_t value() const { return (m_a & 0xFFFF) | (m_b << 16); }
+
+	private:
+		std::uint32_t m_a = 0;
+		std::uint32_t m_b = 0;
+		std::uint32_t m_length = 0;
+	};
+
+	inline std::uint64_t strongBlockHash(const std::uint8_t* data, std::size_t length)
+	{
+		Fnv1a hash;
+		hash.update(data, length);
+		return hash.value();
+	}
+
+	// About sqrt(size) like rsync, at least 4 KB, and few enough blocks for one frame.
+	inline std::uint32_t chooseBlockSize(std::uint64_t fileSize)
+	{
+		std::uint64_t size = std::max<std::uint64_t>(4096, static_cast<std::uint64_t>(std::sqrt(static_cast<double>(fileSize))));
+		size = std::max<std::uint64_t>(size, (fileSize + cw::packet::MAX_SIGNATURE_BLOCKS - 1) / cw::packet::MAX_SIGNATURE_BLOCKS);
+		return static_cast<std::uint32_t>((size + 1023) / 1024 * 1024);
+	}
+
+	// Receiver side: signatures of every whole block of its existing copy.
+	// Empty (block size 0) if there is no usable copy.
+	inline cw::packet::Signatures computeSignatures(const std::filesystem::path& path)
+	{
+		cw::packet::Signatures signatures;
+
+		std::error_code ec;
+		signatures.fileSize = std::filesystem::file_size(path, ec);
+		if (ec || signatures.fileSize == 0) {
+			signatures.fileSize = 0;
+			return signatures;
+		}
+
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return {};
+
+		signatures.blockSize = chooseBlockSize(signatures.fileSize);
+		std::vector<std::uint8_t> block(signatures.blockSize);
+		RollingChecksum weak;
+
+		while (file.read(reinterpret_cast<char*>(block.data()), block.size())) {
+			weak.reset(block.data(), block.size());
+			signatures.blocks.push_back({ weak.value(), strongBlockHash(block.data(), block.size()) });
+		}
+		return signatures;
+	}
+
+	// One step of a delta: either literal bytes or a range of the receiver's
+	// old copy, placed at 'offset' of the new file.
+	struct DeltaOp
+	{
+		std::uint64_t offset = 0;
+		std::uint64_t length = 0;
+		std::optional<std::uint64_t> sourceOffset; // Set for block references
+		std::vector<std::uint8_t> literal;
+	};
+
+	// Sender side: streams the delta of a local file against the receiver's
+	// signatures. Pull-based, so the caller can wait for the socket between ops.
+	// Literal runs are cut at 'maxLiteral' bytes; adjacent block references are
+	// merged into one op. Ops come in file order, but are positional and may be
+	// applied in any order.
+	class DeltaEncoder
+	{
+	public:
+		// Longest single block reference: bounds one copy job on the receiver
+		static constexpr std::uint64_t MAX_COPY_LENGTH = 16 * 1024 * 1024;
+
+		DeltaEncoder(const std::filesystem::path& path, const cw::packet::Signatures& signatures, std::size_t maxLiteral)
+			: m_file(path, std::ios::binary),
+			m_signatures(signatures),
+			m_blockSize(signatures.blockSize),
+			m_maxLiteral(std::max<std::size_t>(1, maxLiteral))
+		{
+			for (std::uint32_t i = 0; i < signatures.blocks.size(); ++i) {
+				m_byWeak[signatures.blocks[i].weak].push_back(i);
+			}
+		}
+
+		bool isOpen() const { return m_file.is_open(); }
+
+		// Next op, or nullopt once the whole file has been covered
+		std::optional<DeltaOp> next()
+		{
+			while (m_ready.empty() && !m_done) step();
+			if (m_ready.empty()) return std::nullopt;
+
+			DeltaOp op = std::move(m_ready.front());
+			m_ready.pop_front();
+			return op;
+		}
+
+		std::uint64_t literalBytes() const { return m_literalBytes; }
+		std::uint64_t matchedBytes() const { return m_matchedBytes; }
+
+	private:
+		void step()
+		{
+			fill();
+			std::size_t available = m_buffer.size() - m_pos;
+
+			// Literal only: no signatures, or the tail shorter than a block
+			if (m_blockSize == 0 || available < m_blockSize) {
+				emitCopy();
+				m_pos = m_buffer.size();
+				emitLiteral();
+				if (m_eof) m_done = true;
+				return;
+			}
+
+			if (!m_rollingValid) {
+				m_rolling.reset(m_buffer.data() + m_pos, m_blockSize);
+				m_rollingValid = true;
+			}
+
+			if (auto block = match()) {
+				emitLiteral();
+
+				std::uint64_t offset = m_bufferStart + m_pos;
+				std::uint64_t source = static_cast<std::uint64_t>(*block) * m_blockSize;
+				if (m_copy && m_copy->offset + m_copy->length == offset && *m_copy->sourceOffset + m_copy->length == source
+					&& m_copy->length + m_blockSize <= MAX_COPY_LENGTH) {
+					m_copy->length += m_blockSize;
+				}
+				else {
+					emitCopy();
+					m_copy = DeltaOp{ offset, m_blockSize, source, {} };
+				}
+				m_matchedBytes += m_blockSize;
+
+				m_pos += m_blockSize;
+				m_literalStart = m_pos;
+				m_rollingValid = false;
+				return;
+			}
+
+			// No match here: this byte becomes literal and the window slides
+			emitCopy();
+			++m_pos;
+			if (m_pos + m_blockSize <= m_buffer.size()) {
+				m_rolling.roll(m_buffer[m_pos - 1], m_buffer[m_pos + m_blockSize - 1]);
+			}
+			else {
+				m_rollingValid = false;
+			}
+			if (m_pos - m_literalStart >= m_maxLiteral) emitLiteral();
+		}
+
+		std::optional<std::uint32_t> match() const
+		{
+			auto it = m_byWeak.find(m_rolling.value());
+			if (it == m_byWeak.end()) return std::nullopt;
+
+			std::uint64_t strong = strongBlockHash(m_buffer.data() + m_pos, m_blockSize);
+			for (std::uint32_t block : it->second) {
+				if (m_signatures.blocks[block].strong == strong) return block;
+			}
+			return std::nullopt;
+		}
+
+		// Keeps at least one block past the window in memory (unless at EOF),
+		// dropping bytes that already went out as literal or block reference.
+		void fill()
+		{
+			if (m_eof || m_buffer.size() - m_pos > m_blockSize) return;
+
+			m_buffer.erase(m_buffer.begin(), m_buffer.begin() + static_cast<std::ptrdiff_t>(m_literalStart));
+			m_bufferStart += m_literalStart;
+			m_pos -= m_literalStart;
+			m_literalStart = 0;
+
+			std::size_t target = m_maxLiteral + 2 * static_cast<std::size_t>(m_blockSize) + 1;
+			std::size_t old = m_buffer.size();
+			if (target > old) {
+				m_buffer.resize(target);
+				m_file.read(reinterpret_cast<char*>(m_buffer.data() + old), static_cast<std::streamsize>(target - old));
+				std::size_t got = static_cast<std::size_t>(m_file.gcount());
+				m_buffer.resize(old + got);
+				if (got < target - old) m_eof = true;
+			}
+		}
+
+		void emitLiteral()
+		{
+			while (m_literalStart < m_pos) {
+				std::size_t length = std::min(m_pos - m_literalStart, m_maxLiteral);
+				auto first = m_buffer.begin() + static_cast<std::ptrdiff_t>(m_literalStart);
+
+				DeltaOp op;
+				op.offset = m_bufferStart + m_literalStart;
+				op.literal.assign(first, first + static_cast<std::ptrdiff_t>(length));
+				op.length = length;
+				m_literalBytes += length;
+				m_ready.push_back(std::move(op));
+
+				m_literalStart += length;
+			}
+		}
+
+		void emitCopy()
+		{
+			if (!m_copy) return;
+			m_ready.push_back(std::move(*m_copy));
+			m_copy.reset();
+		}
+
+	private:
+		std::ifstream m_file;
+		const cw::packet::Signatures& m_signatures;
+		std::uint32_t m_blockSize;
+		std::size_t m_maxLiteral;
+		cw::FlatHashMap<std::uint32_t, std::vector<std::uint32_t>> m_byWeak; // Looked up at every byte: nearly all misses, one group compare each
+
+		std::vector<std::uint8_t> m_buffer;
+		std::uint64_t m_bufferStart = 0; // File offset of m_buffer[0]
+		std::size_t m_pos = 0;           // Window start within m_buffer
+		std::size_t m_literalStart = 0;  // First byte not yet covered by an op
+		bool m_eof = false;
+		bool m_done = false;
+
+		RollingChecksum m_rolling;
+		bool m_rollingValid = false;
+		std::optional<DeltaOp> m_copy;
+		std::deque<DeltaOp> m_ready;
+
+		std::uint64_t m_literalBytes = 0;
+		std::uint64_t m_matchedBytes = 0;
+	};
+}
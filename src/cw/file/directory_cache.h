@@ -0,0 +1,412 @@
+#pragma once
+#include <asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cw/file/file_handle.h"
+#include "cw/flat_hash.h"
+#include "cw/file/safe_path.h"
+
+namespace cw::file {
+
+	// Directories a receiver already created, so that each FileInfo or batched
+	// file does not call create_directories (one stat per path component) on
+	// parents it made a moment ago. createAll makes a whole DirectoryManifest
+	// at once.
+	//
+	// On POSIX, relative paths (everything a sender names, resolved against
+	// the working directory) go through open directory descriptors: the last
+	// 'maxHandles' directories used stay open, and files and subdirectories
+	// are made with openat/mkdirat relative to them, so the kernel walks one
+	// component rather than the whole path. A cached directory that was
+	// renamed keeps receiving its files under the new name; one that was
+	// removed shows up as an open failing with ENOENT, and openWrite clears
+	// the cache and retries once. Absolute paths, and Windows, use paths and
+	// a set of directories known to exist.
+	//
+	// setConfined(true) keeps every write under the working directory:
+	// absolute names and ".." components are refused, and no component may
+	// be a symlink (O_NOFOLLOW), so a link planted in the destination cannot
+	// redirect a write elsewhere.
+	class DirectoryCache
+	{
+	public:
+		static constexpr std::size_t DEFAULT_MAX_HANDLES = 128;
+		static constexpr std::size_t MAX_REMEMBERED = 256 * 1024; // Directories known to exist (absolute paths, Windows)
+
+		explicit DirectoryCache(std::size_t maxHandles = DEFAULT_MAX_HANDLES) : m_maxHandles(std::max<std::size_t>(1, maxHandles)) {}
+
+		void setConfined(bool confined) { m_confined = confined; }
+		bool confined() const { return m_confined; }
+
+		// Creates 'dir' and its parents unless already known to exist
+		std::error_code ensure(const std::filesystem::path& dir)
+		{
+			std::string key = keyFor(dir);
+			if (key.empty()) return {};
+			if (auto ec = check(dir)) return ec;
+
+#if !defined(_WIN32)
+			if (dir.is_relative()) {
+				std::error_code ec;
+				resolve(key, ec);
+				return ec;
+			}
+#endif
+			{
+				std::lock_guard lock(m_mutex);
+				if (m_created.contains(hashOf(key))) return {};
+			}
+
+			std::error_code ec;
+			std::filesystem::create_directories(dir, ec);
+			if (ec) return ec;
+
+			remember(std::filesystem::path(key));
+			return {};
+		}
+
+		// FileHandle::openWrite, creating the parent directory first. A parent
+		// removed since the cache saw it costs one retry. 'direct': unbuffered
+		// (see DIRECT_IO_ALIGNMENT). Throws std::system_error.
+		FileHandle openWrite(const std::filesystem::path& path, bool truncate = true, bool direct = false)
+		{
+			if (auto ec = check(path)) throw std::system_error(ec, "DirectoryCache: refused");
+
+			for (int attempt = 0;; ++attempt) {
+				std::error_code ec;
+#if !defined(_WIN32)
+				if (path.is_relative()) {
+					auto parent = resolve(keyFor(path.parent_path()), ec);
+					if (!ec) {
+						int flags = O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0) | O_CLOEXEC | (m_confined ? O_NOFOLLOW : 0)
+							| (direct ? detail::DIRECT_OPEN_FLAG : 0);
+						int fd = ::openat(parent->native(), path.filename().c_str(), flags, 0644);
+						if (fd >= 0) {
+							if (direct) detail::finishDirectOpen(fd);
+							return FileHandle(fd);
+						}
+						ec = { errno, std::system_category() };
+					}
+				}
+				else
+#endif
+				{
+					ec = ensure(path.parent_path());
+					if (!ec) {
+						try {
+							return FileHandle::openWrite(path, truncate, direct);
+						}
+						catch (const std::system_error& e) {
+							ec = e.code();
+						}
+					}
+				}
+
+				if (attempt > 0 || ec != std::errc::no_such_file_or_directory) throw std::system_error(ec, "FileHandle: create");
+				clear();
+			}
+		}
+
+#if !defined(_WIN32)
+		// Descriptor of the directory 'path' is in, created if need be, for
+		// callers making the file themselves with *at calls (see CreateRing);
+		// null, with no error, for an absolute path, which goes by name
+		std::shared_ptr<const FileHandle> parentOf(const std::filesystem::path& path, std::error_code& ec)
+		{
+			if ((ec = check(path))) return nullptr;
+			if (!path.is_relative()) return nullptr;
+			return resolve(keyFor(path.parent_path()), ec);
+		}
+#endif
+
+		// Renames the file 'from' to 'to', replacing it, through the cached
+		// descriptors of both parents (renameat) like openWrite
+		std::error_code rename(const std::filesystem::path& from, const std::filesystem::path& to)
+		{
+			if (auto ec = check(from)) return ec;
+			if (auto ec = check(to)) return ec;
+
+			std::error_code ec;
+#if !defined(_WIN32)
+			if (from.is_relative() && to.is_relative()) {
+				std::string fromKey = keyFor(from.parent_path()), toKey = keyFor(to.parent_path());
+				auto fromDir = resolve(fromKey, ec);
+				auto toDir = fromKey == toKey || ec ? fromDir : resolve(toKey, ec);
+				if (ec) return ec;
+				if (::renameat(fromDir->native(), from.filename().c_str(), toDir->native(), to.filename().c_str()) != 0) {
+					return { errno, std::system_category() };
+				}
+				return {};
+			}
+#endif
+			std::filesystem::rename(from, to, ec);
+			return ec;
+		}
+
+		// Removes the file 'path' if it exists
+		std::error_code remove(const std::filesystem::path& path)
+		{
+			if (auto ec = check(path)) return ec;
+
+			std::error_code ec;
+#if !defined(_WIN32)
+			if (path.is_relative()) {
+				auto parent = resolve(keyFor(path.parent_path()), ec);
+				if (ec) return ec == std::errc::no_such_file_or_directory ? std::error_code() : ec;
+				if (::unlinkat(parent->native(), path.filename().c_str(), 0) != 0 && errno != ENOENT) {
+					return { errno, std::system_category() };
+				}
+				return {};
+			}
+#endif
+			std::filesystem::remove(path, ec);
+			return ec;
+		}
+
+		// Makes the entries of 'dir' (names of files created there) durable:
+		// fsync of the directory, through its cached descriptor when it has
+		// one. Nothing to do on Windows, whose file systems journal them.
+		std::error_code syncDirectory(const std::filesystem::path& dir)
+		{
+#if defined(_WIN32)
+			return {};
+#else
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Fsync);
+			std::error_code ec;
+			if (dir.is_relative()) {
+				auto handle = resolve(keyFor(dir), ec);
+				if (ec) return ec;
+				if (::fsync(handle->native()) != 0) return { errno, std::system_category() };
+				return {};
+			}
+
+			int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0) return { errno, std::system_category() };
+			if (::fsync(fd) != 0) ec = { errno, std::system_category() };
+			::close(fd);
+			return ec;
+#endif
+		}
+
+		// Creates every directory of 'dirs' on 'executor' (a thread pool), up
+		// to 'parallelism' jobs at once. Only the leaves are created (their
+		// parents come along); they are sorted so each job takes a contiguous
+		// run and siblings, which contend for their parent's lock, mostly share
+		// a job. 'onDone' runs on a pool thread with the first error, if any.
+		void createAll(std::vector<std::filesystem::path> dirs, asio::any_io_executor executor, std::size_t parallelism,
+			std::function<void(std::error_code)> onDone)
+		{
+			std::vector<std::string> keys;
+			keys.reserve(dirs.size());
+			for (const auto& dir : dirs) {
+				std::string key = keyFor(dir);
+				if (!key.empty() && !contains(dir)) keys.push_back(std::move(key));
+			}
+
+			std::sort(keys.begin(), keys.end());
+			keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+			// "a" is created along with "a/b", which sorts right after it
+			std::vector<std::filesystem::path> leaves;
+			for (std::size_t i = 0; i < keys.size(); ++i) {
+				bool parentOfNext = i + 1 < keys.size() && keys[i + 1].size() > keys[i].size()
+					&& keys[i + 1].compare(0, keys[i].size(), keys[i]) == 0 && keys[i + 1][keys[i].size()] == '/';
+				if (!parentOfNext) leaves.emplace_back(keys[i]);
+			}
+
+			if (leaves.empty()) {
+				asio::post(executor, [onDone = std::move(onDone)]() { onDone({}); });
+				return;
+			}
+
+			struct Job
+			{
+				std::vector<std::filesystem::path> leaves;
+				std::atomic<std::size_t> remaining;
+				std::mutex mutex;
+				std::error_code error;
+				std::function<void(std::error_code)> onDone;
+			};
+
+			std::size_t per = (leaves.size() + std::max<std::size_t>(1, parallelism) - 1) / std::max<std::size_t>(1, parallelism);
+			auto job = std::make_shared<Job>();
+			job->remaining = (leaves.size() + per - 1) / per;
+			job->leaves = std::move(leaves);
+			job->onDone = std::move(onDone);
+
+			for (std::size_t begin = 0; begin < job->leaves.size(); begin += per) {
+				std::size_t end = std::min(begin + per, job->leaves.size());
+				asio::post(executor, [this, job, begin, end]()
+					{
+						for (std::size_t i = begin; i < end; ++i) {
+							if (auto ec = ensure(job->leaves[i])) {
+								std::lock_guard lock(job->mutex);
+								if (!job->error) job->error = ec;
+							}
+						}
+						if (--job->remaining == 0) job->onDone(job->error);
+					});
+			}
+		}
+
+		// Known to exist: created or opened here, and not evicted since
+		bool contains(const std::filesystem::path& dir) const
+		{
+			std::string key = keyFor(dir);
+			std::lock_guard lock(m_mutex);
+			return m_created.contains(hashOf(key)) || m_handles.contains(key);
+		}
+
+		// Forgets everything: some directory was removed since it was created
+		void clear()
+		{
+			std::lock_guard lock(m_mutex);
+			m_created.clear();
+			m_handles.clear();
+			m_lru.clear();
+		}
+
+		std::size_t size() const
+		{
+			std::lock_guard lock(m_mutex);
+			return m_created.size() + m_handles.size();
+		}
+
+		// Directory descriptors held open (at most maxHandles)
+		std::size_t openHandles() const
+		{
+			std::lock_guard lock(m_mutex);
+			return m_handles.size();
+		}
+
+	private:
+		static std::string keyFor(const std::filesystem::path& dir)
+		{
+			std::string key = dir.lexically_normal().generic_string();
+			while (key.size() > 1 && key.back() == '/') key.pop_back();
+			if (key == ".") key.clear();
+			return key;
+		}
+
+		std::error_code check(const std::filesystem::path& path) const
+		{
+			if (!m_confined) return {};
+			if (!isSafeRelativePath(path)) return std::make_error_code(std::errc::permission_denied);
+			return {};
+		}
+
+		static std::size_t hashOf(const std::string& key) { return std::hash<std::string>{}(key); }
+
+		// 'dir' exists, so do all its parents. Past MAX_REMEMBERED the set
+		// starts over: a tree of millions of directories costs a stat of
+		// each one it forgot, not memory that grows with the tree.
+		void remember(std::filesystem::path dir)
+		{
+			std::lock_guard lock(m_mutex);
+			if (m_created.size() >= MAX_REMEMBERED) m_created.clear();
+			while (!dir.empty()) {
+				if (!m_created.insert(hashOf(dir.generic_string())).second) break;
+				if (!dir.has_relative_path()) break; // Root
+				dir = dir.parent_path();
+			}
+		}
+
+		using Handle = std::shared_ptr<const FileHandle>;
+
+		struct Entry
+		{
+			Handle handle;
+			std::list<std::string>::iterator position; // In m_lru
+		};
+
+#if !defined(_WIN32)
+		// Descriptor of the relative directory 'key' ("" = the working
+		// directory), opening and creating it one component at a time from
+		// the nearest cached ancestor. Handles are shared: one evicted while
+		// another thread uses it closes once that thread is done.
+		Handle resolve(const std::string& key, std::error_code& ec)
+		{
+			{
+				std::lock_guard lock(m_mutex);
+				if (key.empty()) {
+					if (m_root) return m_root;
+				}
+				else if (auto it = m_handles.find(key); it != m_handles.end()) {
+					m_lru.splice(m_lru.begin(), m_lru, it->second.position);
+					return it->second.handle;
+				}
+			}
+
+			if (key.empty()) {
+				int fd = ::open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+				if (fd < 0) {
+					ec = { errno, std::system_category() };
+					return nullptr;
+				}
+				std::lock_guard lock(m_mutex);
+				if (!m_root) m_root = std::make_shared<const FileHandle>(fd);
+				else ::close(fd);
+				return m_root;
+			}
+
+			auto slash = key.rfind('/');
+			auto parent = resolve(slash == std::string::npos ? std::string() : key.substr(0, slash), ec);
+			if (ec) return nullptr;
+
+			const char* name = key.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+			int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | (m_confined ? O_NOFOLLOW : 0);
+			int fd = ::openat(parent->native(), name, flags);
+			if (fd < 0 && errno == ENOENT) {
+				if (::mkdirat(parent->native(), name, 0777) != 0 && errno != EEXIST) {
+					ec = { errno, std::system_category() };
+					return nullptr;
+				}
+				fd = ::openat(parent->native(), name, flags);
+			}
+			if (fd < 0) {
+				ec = { errno, std::system_category() };
+				return nullptr;
+			}
+
+			auto handle = std::make_shared<const FileHandle>(fd);
+			std::lock_guard lock(m_mutex);
+			if (auto it = m_handles.find(key); it != m_handles.end()) return it->second.handle; // Another thread got there first
+
+			m_lru.push_front(key);
+			m_handles.emplace(key, Entry{ handle, m_lru.begin() });
+			while (m_handles.size() > m_maxHandles) {
+				m_handles.erase(m_lru.back());
+				m_lru.pop_back();
+			}
+			return handle;
+		}
+#endif
+
+		Handle m_root; // The working directory
+		cw::FlatHashMap<std::string, Entry> m_handles;
+		std::list<std::string> m_lru; // Most recently used first
+
+		std::size_t m_maxHandles;
+		std::atomic<bool> m_confined = false;
+		mutable std::mutex m_mutex;
+		// Hashes of the keyFor form, absolute paths and Windows. One that
+		// collides skips creating a directory, which the open of a file in it
+		// finds (ENOENT) and openWrite retries, as for one removed.
+		cw::FlatHashSet<std::size_t> m_created;
+	};
+}
@@ -0,0 +1,338 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <asio.hpp>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include "cw/file/manifest.h"
+#include "cw/log/logger.h"
+#include "cw/metrics/stage_profile.h"
+
+namespace cw::file {
+
+	// A regular file found by the scan, with what the upload needs to know
+	// about it, so nothing has to stat it again
+	struct ScannedFile
+	{
+		std::filesystem::path path;
+		std::filesystem::path relativePath; // To the scan root
+		std::uint64_t size = 0;
+		std::int64_t modifiedNs = 0;        // As cw::file::modifiedNs
+		std::uint64_t inode = 0;            // 0 where the platform has none
+		std::uint64_t diskOffset = 0;       // Of its first extent on the device (locate); 0 = not known
+	};
+
+	// Order an upload reads the files of a tree in (DirectoryUploadOptions)
+	enum class ReadOrder
+	{
+		Scan,     // As listed
+		Inode,    // By inode number, which most file systems allocate near the data
+		Physical, // By where the first extent lies on the device (locate)
+	};
+
+	// Where 'file' starts on its device, from FIEMAP (one open and one
+	// ioctl): sorted by it, files are read in the order they lie on the
+	// disk. Left 0 for empty files, file systems without FIEMAP, and
+	// platforms other than Linux.
+	inline void locate(ScannedFile& file)
+	{
+#if defined(__linux__)
+		// <linux/fs.h> has it, and macros (BLOCK_SIZE) that collide with ours
+		constexpr unsigned long FIEMAP_REQUEST = _IOWR('f', 11, fiemap);
+		if (file.size == 0) return;
+		int fd = ::open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) return;
+
+		// Room for the first extent only
+		alignas(fiemap) unsigned char request[sizeof(fiemap) + sizeof(fiemap_extent)] = {};
+		auto* map = reinterpret_cast<fiemap*>(request);
+		map->fm_length = FIEMAP_MAX_OFFSET;
+		map->fm_extent_count = 1;
+		if (::ioctl(fd, FIEMAP_REQUEST, map) == 0 && map->fm_mapped_extents > 0 &&
+			!(map->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE))) {
+			file.diskOffset = map->fm_extents[0].fe_physical;
+		}
+		::close(fd);
+#else
+		(void)file;
+#endif
+	}
+
+	namespace detail {
+
+		// Linux: the entries in one getdents64 call per 64 KB of names, their
+		// types from d_type, and one statx per regular file for size and
+		// mtime; no stat per component and none for subdirectories.
+		// Symlinks count as what they point at for files (as
+		// std::filesystem::is_regular_file), and are not followed into
+		// directories (as recursive_directory_iterator).
+		inline std::error_code listDirectory(const std::filesystem::path& dir, const std::filesystem::path& relative,
+			std::vector<ScannedFile>& files, std::vector<std::filesystem::path>& subdirectories)
+		{
+			namespace fs = std::filesystem;
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Scan);
+#if defined(__linux__)
+			int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0) return { errno, std::system_category() };
+
+			struct LinuxDirent64
+			{
+				std::uint64_t d_ino;
+				std::int64_t d_off;
+				unsigned short d_reclen;
+				unsigned char d_type;
+				char d_name[1];
+			};
+
+			// Records 'name' if it is a regular file; returns its type (0 if it vanished)
+			auto describe = [&](const char* name, bool follow) -> mode_t
+				{
+#if defined(STATX_SIZE)
+					struct statx info;
+					int flags = AT_STATX_DONT_SYNC | (follow ? 0 : AT_SYMLINK_NOFOLLOW);
+					if (::statx(fd, name, flags, STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO, &info) != 0) return 0;
+					mode_t mode = info.stx_mode;
+					std::uint64_t size = info.stx_size;
+					std::int64_t modified = static_cast<std::int64_t>(info.stx_mtime.tv_sec) * 1'000'000'000 + info.stx_mtime.tv_nsec;
+					std::uint64_t inode = info.stx_ino;
+#else
+					struct stat info;
+					if (::fstatat(fd, name, &info, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0) return 0;
+					mode_t mode = info.st_mode;
+					std::uint64_t size = static_cast<std::uint64_t>(info.st_size);
+					std::int64_t modified = static_cast<std::int64_t>(info.st_mtim.tv_sec) * 1'000'000'000 + info.st_mtim.tv_nsec;
+					std::uint64_t inode = static_cast<std::uint64_t>(info.st_ino);
+#endif
+					if (S_ISREG(mode)) files.push_back({ dir / name, relative / name, size, modified, inode });
+					return mode;
+				};
+
+			thread_local std::vector<char> buffer(64 * 1024);
+			std::error_code result;
+			for (;;) {
+				long n = ::syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+				if (n == 0) break;
+				if (n < 0) {
+					result = { errno, std::system_category() };
+					break;
+				}
+
+				for (long offset = 0; offset < n;) {
+					auto* entry = reinterpret_cast<LinuxDirent64*>(buffer.data() + offset);
+					offset += entry->d_reclen;
+
+					const char* name = entry->d_name;
+					if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+					switch (entry->d_type) {
+					case DT_DIR:
+						subdirectories.push_back(relative / name);
+						break;
+					case DT_REG:
+						describe(name, false);
+						break;
+					case DT_LNK:
+						describe(name, true);
+						break;
+					case DT_UNKNOWN: {
+						// File systems without d_type: one lstat decides
+						mode_t mode = describe(name, false);
+						if (S_ISDIR(mode)) subdirectories.push_back(relative / name);
+						else if (S_ISLNK(mode)) describe(name, true);
+						break;
+					}
+					default:
+						break; // Devices, sockets, pipes
+					}
+				}
+			}
+
+			::close(fd);
+			return result;
+#elif defined(_WIN32)
+			// FindFirstFileEx with the basic info level and large fetches: names,
+			// attributes, size and mtime come back in batches, no per-file call
+			WIN32_FIND_DATAW data;
+			HANDLE find = ::FindFirstFileExW((dir / L"*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+			if (find == INVALID_HANDLE_VALUE) return { static_cast<int>(::GetLastError()), std::system_category() };
+
+			do {
+				const wchar_t* name = data.cFileName;
+				if (name[0] == L'.' && (name[1] == L'\0' || (name[1] == L'.' && name[2] == L'\0'))) continue;
+
+				bool reparse = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+				if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+					if (!reparse) subdirectories.push_back(relative / name);
+					continue;
+				}
+				if (reparse) {
+					// A link: sized through what it points at
+					std::error_code ec;
+					if (!fs::is_regular_file(dir / name, ec)) continue;
+					auto size = fs::file_size(dir / name, ec);
+					auto modified = fs::last_write_time(dir / name, ec);
+					if (!ec) files.push_back({ dir / name, relative / name, size, cw::file::modifiedNs(modified) });
+					continue;
+				}
+
+				std::uint64_t size = (static_cast<std::uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+				std::uint64_t ticks = (static_cast<std::uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+				constexpr std::uint64_t UNIX_EPOCH_TICKS = 116444736000000000ULL; // 100 ns ticks from 1601 to 1970
+				std::int64_t modified = (static_cast<std::int64_t>(ticks) - static_cast<std::int64_t>(UNIX_EPOCH_TICKS)) * 100;
+				files.push_back({ dir / name, relative / name, size, modified });
+			} while (::FindNextFileW(find, &data));
+
+			DWORD error = ::GetLastError();
+			::FindClose(find);
+			if (error != ERROR_NO_MORE_FILES) return { static_cast<int>(error), std::system_category() };
+			return {};
+#else
+			std::error_code ec;
+			for (const auto& entry : fs::directory_iterator(dir, fs::directory_options::skip_permission_denied, ec)) {
+				std::error_code entryError;
+				if (entry.is_directory(entryError) && !entry.is_symlink(entryError)) {
+					subdirectories.push_back(relative / entry.path().filename());
+				}
+				else if (entry.is_regular_file(entryError)) {
+					auto size = entry.file_size(entryError);
+					auto modified = entry.last_write_time(entryError);
+					if (!entryError) files.push_back({ entry.path(), relative / entry.path().filename(), size, cw::file::modifiedNs(modified) });
+				}
+			}
+			return ec;
+#endif
+		}
+	}
+
+	// Tree walk for uploads of large trees: each directory is listed as its
+	// own task on 'scanExecutor' (a thread pool), up to 'parallelism' at once,
+	// so subtrees are scanned concurrently. What a directory held reaches
+	// 'sink' on 'consumer' as one call: its files, and its subdirectories
+	// (relative to the root), which the walk lists next. The walk is over once
+	// the consumer has received one call per directory (1 + the number of
+	// subdirectories reported). Listing pauses while
+	// more than 'maxBuffered' files are waiting for the consumer (see consumed).
+	// With 'locateFiles' every file found is also located (see locate) on
+	// the scan executor.
+	class DirectoryScanner : public std::enable_shared_from_this<DirectoryScanner>
+	{
+	public:
+		using Sink = std::function<void(std::vector<ScannedFile> files, std::vector<std::filesystem::path> subdirectories)>;
+
+		static std::shared_ptr<DirectoryScanner> start(std::filesystem::path root, asio::any_io_executor scanExecutor,
+			asio::any_io_executor consumer, Sink sink, std::size_t parallelism = 4, std::size_t maxBuffered = 64 * 1024, bool locateFiles = false)
+		{
+			auto scanner = std::shared_ptr<DirectoryScanner>(new DirectoryScanner(std::move(root), std::move(scanExecutor),
+				std::move(consumer), std::move(sink), parallelism, maxBuffered, locateFiles));
+			{
+				std::lock_guard lock(scanner->m_mutex);
+				scanner->m_pending.emplace_back();
+				scanner->schedule();
+			}
+			return scanner;
+		}
+
+		// The consumer has taken 'count' files off what it was handed
+		void consumed(std::size_t count)
+		{
+			std::lock_guard lock(m_mutex);
+			m_buffered -= std::min(count, m_buffered);
+			schedule();
+		}
+
+		// Lists nothing more; directories already being listed still report
+		void cancel()
+		{
+			std::lock_guard lock(m_mutex);
+			m_cancelled = true;
+		}
+
+	private:
+		DirectoryScanner(std::filesystem::path root, asio::any_io_executor scanExecutor, asio::any_io_executor consumer,
+			Sink sink, std::size_t parallelism, std::size_t maxBuffered, bool locateFiles)
+			: m_root(std::move(root)), m_scanExecutor(std::move(scanExecutor)), m_consumer(std::move(consumer)),
+			m_sink(std::move(sink)), m_parallelism(std::max<std::size_t>(1, parallelism)), m_maxBuffered(maxBuffered),
+			m_locate(locateFiles)
+		{
+		}
+
+		// Under m_mutex
+		void schedule()
+		{
+			while (!m_cancelled && !m_pending.empty() && m_active < m_parallelism && m_buffered < m_maxBuffered) {
+				auto relative = std::move(m_pending.front());
+				m_pending.pop_front();
+				++m_active;
+				asio::post(m_scanExecutor, [self = shared_from_this(), relative = std::move(relative)]() { self->list(relative); });
+			}
+
+			// Cancelled: the directories never listed still owe the consumer their call
+			if (m_cancelled) {
+				for (std::size_t i = 0; i < m_pending.size(); ++i) deliver({}, {});
+				m_pending.clear();
+			}
+		}
+
+		void list(const std::filesystem::path& relative)
+		{
+			std::vector<ScannedFile> files;
+			std::vector<std::filesystem::path> subdirectories;
+			auto dir = relative.empty() ? m_root : m_root / relative;
+			if (auto ec = detail::listDirectory(dir, relative, files, subdirectories)) {
+				if (ec != std::errc::permission_denied) CW_LOG_WARN("Cannot list ", dir, ": ", ec.message());
+			}
+			if (m_locate) {
+				for (auto& file : files) locate(file);
+			}
+
+			std::lock_guard lock(m_mutex);
+			--m_active;
+			m_buffered += files.size();
+			m_pending.insert(m_pending.end(), subdirectories.begin(), subdirectories.end());
+			deliver(std::move(files), std::move(subdirectories));
+			schedule();
+		}
+
+		void deliver(std::vector<ScannedFile> files, std::vector<std::filesystem::path> subdirectories)
+		{
+			asio::post(m_consumer, [sink = m_sink, files = std::move(files), subdirectories = std::move(subdirectories)]() mutable
+				{
+					sink(std::move(files), std::move(subdirectories));
+				});
+		}
+
+		std::filesystem::path m_root;
+		asio::any_io_executor m_scanExecutor;
+		asio::any_io_executor m_consumer;
+		Sink m_sink;
+		std::size_t m_parallelism;
+		std::size_t m_maxBuffered;
+		bool m_locate;
+
+		std::mutex m_mutex;
+		std::deque<std::filesystem::path> m_pending; // Relative to m_root
+		std::size_t m_active = 0;
+		std::size_t m_buffered = 0;
+		bool m_cancelled = false;
+	};
+}
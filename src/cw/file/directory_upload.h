@@ -0,0 +1,924 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <set>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+#include <asio/experimental/parallel_group.hpp>
+
+#include "cw/file/archive.h"
+#include "cw/file/auto_tuner.h"
+#include "cw/file/directory_scanner.h"
+#include "cw/file/directory_watcher.h"
+#include "cw/file/file.h"
+#include "cw/file/scan_index.h"
+#include "cw/file/stream_upload.h"
+#include "cw/file/subtree_digest.h"
+#include "cw/log/logger.h"
+#include "cw/network/hash_ring.h"
+
+namespace cw {
+
+	// Cluster mode: files sharded over several servers by consistent hash of
+	// their relative path, each server over connections of its own.
+	// servers[i] are the connections to ring member i.
+	struct ClusterRoute
+	{
+		cw::network::HashRing ring;
+		std::vector<std::vector<std::shared_ptr<cw::network::Connection>>> servers;
+
+		// Index of the server 'relativePath' belongs to
+		size_t serverFor(const fs::path& relativePath) const { return ring.ownerIndex(relativePath.generic_string()); }
+
+		const std::vector<std::shared_ptr<cw::network::Connection>>& connectionsFor(const fs::path& relativePath) const
+		{
+			return servers[serverFor(relativePath)];
+		}
+
+		// Every connection to every server, server by server
+		std::vector<std::shared_ptr<cw::network::Connection>> all() const
+		{
+			std::vector<std::shared_ptr<cw::network::Connection>> conns;
+			for (const auto& server : servers) conns.insert(conns.end(), server.begin(), server.end());
+			return conns;
+		}
+	};
+
+	struct DirectoryUploadOptions
+	{
+		// Files in flight at once. Each worker reads and sends one file at a time.
+		size_t workers = 4;
+
+		// Upper bound on upload data held in memory: the send queues of all
+		// connections plus the chunk or small-file batch each worker is assembling.
+		size_t maxInFlightBytes = 64 * 1024 * 1024;
+
+		// Incremental sync: send a manifest first and upload only the files the
+		// server reports as missing or different. 'syncHash' adds a content hash
+		// to the manifest (reads every file) instead of trusting size and mtime.
+		bool sync = false;
+		bool syncHash = false;
+
+		// Archive mode: files up to archiveMaxFileSize are packed, header and
+		// contents, into one continuous archive stream per worker (ArchiveInfo)
+		// instead of FileBatch frames, and the receiver unpacks them in
+		// parallel batches, for trees of many small files. Larger files are
+		// sent as usual. Falls back to batches if the peer takes no archives.
+		bool archive = false;
+		size_t archiveMaxFileSize = 1024 * 1024;
+
+		// Closed-loop tuning (see cw::asyncTune): each file that is not
+		// batched goes with the tuner's chunk size and compression of the
+		// moment, over its number of the connections. Null = as given.
+		std::shared_ptr<AutoTuner> tuner;
+
+		// Order files are read in, for sources on spinning disks, where
+		// directory order seeks back and forth. Inode and Physical sweep
+		// across the disk in one direction as the scan finds files, and
+		// start over from the low end once past the last (elevator order).
+		// Physical costs an open and a FIEMAP ioctl per file during the scan.
+		cw::file::ReadOrder order = cw::file::ReadOrder::Scan;
+
+		// Watch mode (asyncWatchDirectory): changes are sent once none has
+		// come for watchDebounce, or the first has waited watchMaxDelay
+		std::chrono::milliseconds watchDebounce{ 100 };
+		std::chrono::milliseconds watchMaxDelay{ 1000 };
+
+		// Sync mode: files unchanged since this index was saved are left out
+		// of the manifests, and everything scanned is recorded in it. The
+		// caller saves it once the server has acked the upload.
+		std::shared_ptr<cw::file::ScanIndex> scanIndex;
+
+		// Cluster mode: each file goes over the connections of the server
+		// the route places it on; the upload's 'conns' are all of them.
+		// Directory manifests go to every server. Null = any file may use
+		// any connection.
+		std::shared_ptr<const ClusterRoute> cluster;
+	};
+
+	namespace detail {
+
+		// Shared cursor over the tree, fed by a DirectoryScanner: directories
+		// are listed on the scan executor while workers upload what was already
+		// found. Only touched from the upload's executor. What it finds is
+		// planned into 'progress', when given, and handed out in 'order'.
+		class FileWalker : public std::enable_shared_from_this<FileWalker>
+		{
+		public:
+			static std::shared_ptr<FileWalker> scan(asio::any_io_executor executor, const fs::path& root,
+				std::optional<asio::any_io_executor> scanExecutor = std::nullopt,
+				std::shared_ptr<cw::metrics::TransferProgress> progress = nullptr,
+				cw::file::ReadOrder order = cw::file::ReadOrder::Scan)
+			{
+				auto walker = std::shared_ptr<FileWalker>(new FileWalker(executor, std::move(progress), order));
+				walker->m_outstanding = 1;
+				walker->m_scanner = cw::file::DirectoryScanner::start(root, scanExecutor.value_or(executor), executor,
+					[weak = walker->weak_from_this()](std::vector<cw::file::ScannedFile> files, std::vector<fs::path> subdirectories)
+					{
+						if (auto self = weak.lock()) self->onListed(std::move(files), std::move(subdirectories));
+					}, 4, 64 * 1024, order == cw::file::ReadOrder::Physical);
+				return walker;
+			}
+
+			// Walks a fixed list instead (the files a sync found out of date),
+			// located already for ReadOrder::Physical
+			static std::shared_ptr<FileWalker> list(asio::any_io_executor executor, std::vector<cw::file::ScannedFile> files,
+				std::shared_ptr<cw::metrics::TransferProgress> progress = nullptr,
+				cw::file::ReadOrder order = cw::file::ReadOrder::Scan)
+			{
+				auto walker = std::shared_ptr<FileWalker>(new FileWalker(executor, std::move(progress), order));
+				std::set<fs::path> parents;
+				for (const auto& file : files) {
+					if (file.relativePath.has_parent_path()) parents.insert(file.relativePath.parent_path());
+				}
+				walker->plan(files);
+				walker->m_directories.assign(parents.begin(), parents.end());
+				for (auto& file : files) walker->add(std::move(file));
+				return walker;
+			}
+
+			~FileWalker()
+			{
+				if (m_scanner) m_scanner->cancel();
+			}
+
+			// Next regular file, or nullopt once the walk is done
+			asio::awaitable<std::optional<cw::file::ScannedFile>> next()
+			{
+				for (;;) {
+					if (auto file = take()) {
+						if (m_scanner) m_scanner->consumed(1);
+						co_return file;
+					}
+					if (m_outstanding == 0) co_return std::nullopt;
+
+					// Woken (cancelled) when the next directory has been listed
+					std::error_code ec;
+					co_await m_listed.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+				}
+			}
+
+			// Directories (relative to the root) found since the last call
+			std::vector<fs::path> takeDirectories() { return std::exchange(m_directories, {}); }
+
+		private:
+			FileWalker(asio::any_io_executor executor, std::shared_ptr<cw::metrics::TransferProgress> progress, cw::file::ReadOrder order)
+				: m_listed(executor, asio::steady_timer::time_point::max()), m_progress(std::move(progress)), m_order(order)
+			{
+			}
+
+			void add(cw::file::ScannedFile file)
+			{
+				switch (m_order) {
+				case cw::file::ReadOrder::Scan: m_ready.push_back(std::move(file)); break;
+				case cw::file::ReadOrder::Inode: m_sorted.emplace(file.inode, std::move(file)); break;
+				case cw::file::ReadOrder::Physical: m_sorted.emplace(file.diskOffset, std::move(file)); break;
+				}
+			}
+
+			// The next file in m_order: sorted ones from where the last one
+			// was, back to the lowest once none is left beyond it
+			std::optional<cw::file::ScannedFile> take()
+			{
+				if (!m_ready.empty()) {
+					auto file = std::move(m_ready.front());
+					m_ready.pop_front();
+					return file;
+				}
+				if (m_sorted.empty()) return std::nullopt;
+
+				auto it = m_sorted.lower_bound(m_head);
+				if (it == m_sorted.end()) it = m_sorted.begin();
+				m_head = it->first;
+				auto file = std::move(it->second);
+				m_sorted.erase(it);
+				return file;
+			}
+
+			// The last files there will be once nothing is left to list
+			void plan(const std::vector<cw::file::ScannedFile>& files)
+			{
+				if (!m_progress) return;
+				uint64_t bytes = 0;
+				for (const auto& file : files) bytes += file.size;
+				m_progress->plan(files.size(), bytes);
+				if (m_outstanding == 0) m_progress->planComplete();
+			}
+
+			void onListed(std::vector<cw::file::ScannedFile> files, std::vector<fs::path> subdirectories)
+			{
+				m_outstanding += subdirectories.size();
+				--m_outstanding;
+				plan(files);
+				for (auto& file : files) add(std::move(file));
+				for (auto& subdirectory : subdirectories) m_directories.push_back(std::move(subdirectory));
+				m_listed.cancel();
+			}
+
+			std::shared_ptr<cw::file::DirectoryScanner> m_scanner;
+			std::deque<cw::file::ScannedFile> m_ready;                     // ReadOrder::Scan
+			std::multimap<std::uint64_t, cw::file::ScannedFile> m_sorted; // By inode or disk offset
+			std::uint64_t m_head = 0;                                      // Key of the file taken last
+			std::vector<fs::path> m_directories; // Not yet taken
+			size_t m_outstanding = 0; // Directories not yet heard back from
+			asio::steady_timer m_listed;
+			std::shared_ptr<cw::metrics::TransferProgress> m_progress;
+			cw::file::ReadOrder m_order;
+		};
+
+		// Send budget per connection so that all queues plus what each worker is
+		// assembling (one chunk or one batch) stay within 'maxInFlightBytes'.
+		inline size_t highWatermarkFor(const TransferOptions& options, const DirectoryUploadOptions& uploadOptions, size_t connections)
+		{
+			size_t chunk = std::min(options.adaptiveChunkSize ? options.maxChunkSize : options.chunkSize, cw::packet::MAX_CHUNK_SIZE);
+			if (options.batchMaxFileSize > 0) chunk = std::max(chunk, options.batchMaxBytes);
+			size_t reserved = uploadOptions.workers * chunk;
+			size_t available = uploadOptions.maxInFlightBytes > reserved ? uploadOptions.maxInFlightBytes - reserved : 0;
+			return std::max(chunk, available / std::max<size_t>(1, connections));
+		}
+
+		// The directories files are about to arrive in, in as few frames as fit,
+		// in the class of the files so they stay ahead of them
+		inline void sendDirectoryManifests(cw::network::Connection& conn, const std::vector<fs::path>& directories, cw::packet::Priority priority)
+		{
+			cw::packet::DirectoryManifest manifest;
+			for (const auto& directory : directories) {
+				manifest.directories.push_back(directory.generic_string());
+				if (manifest.directories.size() == cw::packet::MAX_DIRECTORY_ENTRIES) {
+					conn.send(manifest, priority);
+					manifest.directories.clear();
+				}
+			}
+			if (!manifest.directories.empty()) conn.send(manifest, priority);
+		}
+
+		// Whole contents of a small file, or nullopt if it cannot be read
+		inline std::optional<std::vector<uint8_t>> readSmallFile(const fs::path& path, uint64_t size)
+		{
+			std::vector<uint8_t> data(size);
+			std::ifstream file(path, std::ios::binary);
+			if (!file) return std::nullopt;
+
+			file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+			if (static_cast<uint64_t>(file.gcount()) != size) return std::nullopt;
+			return data;
+		}
+	}
+
+	namespace detail {
+
+		// One worker's archive stream: members are appended to chunk-sized
+		// buffers, each sent once full
+		class ArchiveSender
+		{
+		public:
+			ArchiveSender(std::shared_ptr<cw::network::Connection> conn, TransferOptions options) :
+				m_stream(std::move(conn), archiveOptions(std::move(options)))
+			{
+				cw::packet::ArchiveInfo infoPkt;
+				infoPkt.streamId = m_stream.streamId();
+				m_stream.open(infoPkt);
+			}
+
+			asio::awaitable<void> add(const std::string& name, const std::vector<uint8_t>& data)
+			{
+				auto header = cw::file::archiveHeader(name, data.size());
+				co_await append(header);
+				co_await append(data);
+				++m_files;
+			}
+
+			// Appends the end marker and ends the stream
+			asio::awaitable<void> finish()
+			{
+				co_await append(cw::file::archiveHeader({}, 0));
+				m_buffer.shrink(m_used);
+				m_stream.add(std::move(m_buffer).share(), true);
+				m_stream.finish(m_files);
+				CW_LOG_INFO("[Client] Archive of ", m_files, " files sent (", m_stream.sent(), " bytes).");
+			}
+
+		private:
+			// Members stay whole in the stream: a zero run is not a hole there
+			static TransferOptions archiveOptions(TransferOptions options)
+			{
+				options.elideZeroChunks = false;
+				options.streamId = 0;
+				return options;
+			}
+
+			asio::awaitable<void> append(std::span<const uint8_t> bytes)
+			{
+				while (!bytes.empty()) {
+					if (m_used == m_buffer.size()) {
+						if (m_buffer.size() > 0) m_stream.add(std::move(m_buffer).share(), false);
+						m_buffer = cw::buffer::PooledBuffer(co_await m_stream.asyncReserve());
+						m_used = 0;
+					}
+					size_t take = std::min(bytes.size(), m_buffer.size() - m_used);
+					std::copy_n(bytes.begin(), take, m_buffer.data() + m_used);
+					m_used += take;
+					bytes = bytes.subspan(take);
+				}
+			}
+
+			StreamSender m_stream;
+			cw::buffer::PooledBuffer m_buffer;
+			size_t m_used = 0;
+			size_t m_files = 0;
+		};
+	}
+
+	namespace detail {
+
+		// Content hashes of 'paths' (nullopt: unreadable, or an empty path,
+		// which is skipped): side by side on 'workPool' when given, otherwise
+		// one after another on 'fileExecutor' when given
+		inline asio::awaitable<std::vector<std::optional<uint64_t>>> asyncHashFiles(std::vector<fs::path> paths,
+			std::optional<asio::any_io_executor> fileExecutor,
+			std::shared_ptr<WorkPool> workPool)
+		{
+			std::vector<std::optional<uint64_t>> hashes(paths.size());
+			auto hashOne = [&paths, &hashes](size_t i)
+				{
+					if (!paths[i].empty()) hashes[i] = cw::file::contentHash(paths[i]);
+				};
+			if (workPool) {
+				co_await workPool->asyncForEach(paths.size(), hashOne, asio::use_awaitable);
+				co_return hashes;
+			}
+
+			auto executor = co_await asio::this_coro::executor;
+			if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+			for (size_t i = 0; i < paths.size(); ++i) hashOne(i);
+			if (fileExecutor) co_await asio::post(executor, asio::use_awaitable);
+			co_return hashes;
+		}
+
+		// Sync mode against a peer that compares SubtreeDigests: the tree is
+		// scanned (and hashed) first and summed up per directory. Then, from
+		// the root down, only the directories the peer finds different are
+		// looked into, a level at a time; the files directly in those make
+		// the Manifests. Holds the whole listing meanwhile.
+		inline asio::awaitable<std::vector<cw::file::ScannedFile>> asyncReconcileChangedFiles(std::shared_ptr<cw::network::Connection> conn,
+			fs::path root,
+			bool withHash,
+			std::optional<asio::any_io_executor> fileExecutor,
+			std::shared_ptr<WorkPool> workPool)
+		{
+			auto executor = co_await asio::this_coro::executor;
+			auto walker = FileWalker::scan(executor, root, fileExecutor);
+			std::vector<cw::file::ScannedFile> files;
+			while (auto file = co_await walker->next()) files.push_back(std::move(*file));
+
+			std::vector<std::optional<uint64_t>> contents;
+			if (withHash) {
+				std::vector<fs::path> paths;
+				paths.reserve(files.size());
+				for (const auto& file : files) paths.push_back(file.path);
+				contents = co_await asyncHashFiles(std::move(paths), fileExecutor, workPool);
+			}
+
+			// Names and hashes as the Manifests will carry them; a file that cannot be hashed is left out
+			std::vector<std::string> names(files.size());
+			std::vector<uint64_t> hashes(files.size());
+			std::vector<bool> listed(files.size(), true);
+			for (size_t i = 0; i < files.size(); ++i) {
+				remoteNameInto(names[i], files[i].path, files[i].relativePath);
+				if (!withHash) continue;
+				if (contents[i]) hashes[i] = *contents[i];
+				else listed[i] = false;
+			}
+
+			// Each file counts into every directory above it
+			struct Directory
+			{
+				cw::file::SubtreeSummary summary;
+				std::vector<std::string> children;
+				std::vector<size_t> files; // Directly in it
+			};
+			std::unordered_map<std::string, Directory> directories;
+			directories["."];
+			for (size_t i = 0; i < files.size(); ++i) {
+				if (!listed[i]) continue;
+				uint64_t term = cw::file::subtreeTerm(names[i], files[i].size, hashes[i]);
+				fs::path parent = files[i].relativePath.parent_path();
+				directories[cw::file::subtreeKey(parent)].files.push_back(i);
+				for (;; parent = parent.parent_path()) {
+					directories[cw::file::subtreeKey(parent)].summary.add(term, files[i].modifiedNs);
+					if (parent.empty()) break;
+				}
+			}
+			for (auto& [key, directory] : directories) {
+				if (key == ".") continue;
+				directories.find(cw::file::subtreeKey(fs::path(key).parent_path()))->second.children.push_back(key);
+			}
+
+			// Down the levels the peer differs on
+			std::vector<size_t> candidates;
+			std::vector<std::string> level{ "." };
+			size_t compared = 0;
+			uint8_t flags = cw::packet::SubtreeDigests::SUBTREE_FRESH | (withHash ? cw::packet::SubtreeDigests::SUBTREE_WITH_HASH : 0);
+			while (!level.empty()) {
+				std::vector<std::string> next;
+				for (size_t start = 0; start < level.size(); start += cw::packet::MAX_SUBTREE_ENTRIES) {
+					size_t count = std::min(cw::packet::MAX_SUBTREE_ENTRIES, level.size() - start);
+					cw::packet::SubtreeDigests request;
+					request.flags = std::exchange(flags, flags & ~cw::packet::SubtreeDigests::SUBTREE_FRESH);
+					for (size_t i = start; i < start + count; ++i) {
+						const auto& summary = directories.at(level[i]).summary;
+						request.subtrees.push_back(cw::packet::SubtreeDigest{ level[i], summary.digest, summary.newestNs });
+					}
+					compared += count;
+
+					auto differing = co_await conn->asyncRequestSubtreeDiff(std::move(request), asio::use_awaitable);
+					for (uint32_t index : differing) {
+						if (index >= count) continue;
+						const auto& directory = directories.at(level[start + index]);
+						candidates.insert(candidates.end(), directory.files.begin(), directory.files.end());
+						next.insert(next.end(), directory.children.begin(), directory.children.end());
+					}
+				}
+				level = std::move(next);
+			}
+
+			// The files of differing directories, asked about as usual
+			std::vector<cw::file::ScannedFile> changed;
+			for (size_t start = 0; start < candidates.size(); start += cw::packet::MAX_MANIFEST_ENTRIES) {
+				size_t count = std::min(cw::packet::MAX_MANIFEST_ENTRIES, candidates.size() - start);
+				cw::packet::Manifest manifest;
+				for (size_t i = start; i < start + count; ++i) {
+					size_t file = candidates[i];
+					cw::packet::ManifestEntry entry;
+					entry.fileName = names[file];
+					entry.fileSize = files[file].size;
+					entry.modifiedNs = files[file].modifiedNs;
+					entry.hash = hashes[file];
+					manifest.entries.push_back(std::move(entry));
+				}
+
+				auto indices = co_await conn->asyncRequestDiff(std::move(manifest), asio::use_awaitable);
+				for (uint32_t index : indices) {
+					if (index < count) changed.push_back(std::move(files[candidates[start + index]]));
+				}
+			}
+
+			CW_LOG_INFO("[Client] Sync: ", compared, " of ", directories.size(), " directories compared, ", candidates.size(), " of ", files.size(), " files listed");
+			CW_LOG_INFO("[Client] Sync: ", changed.size(), " of ", files.size(), " files changed");
+			co_return changed;
+		}
+	}
+
+	// Sync mode: walks the tree, exchanges manifests of MAX_MANIFEST_ENTRIES files
+	// at a time over 'conn', and returns the files the server wants sent.
+	// Sizes and mtimes come from the scan; hashes, when asked for, are
+	// computed on 'workPool', several files at a time, or else on
+	// 'fileExecutor' when given, as is the directory listing.
+	// With an 'index', files with the size, mtime and inode (or, hashed, the
+	// size and hash) it has for them are taken as on the server already, and
+	// every file scanned is recorded in it. Without one, a server that
+	// compares SubtreeDigests is only sent Manifests of the directories that
+	// differ (see detail::asyncReconcileChangedFiles).
+	inline asio::awaitable<std::vector<cw::file::ScannedFile>> asyncFindChangedFiles(std::shared_ptr<cw::network::Connection> conn,
+		fs::path root,
+		bool withHash,
+		std::optional<asio::any_io_executor> fileExecutor = std::nullopt,
+		std::shared_ptr<cw::file::ScanIndex> index = nullptr,
+		std::shared_ptr<WorkPool> workPool = nullptr)
+	{
+		// Without an index, a peer that compares directories saves listing every file
+		co_await conn->asyncWaitCapabilities(asio::use_awaitable);
+		if (!index && conn->peerComparesSubtrees()) co_return co_await detail::asyncReconcileChangedFiles(conn, root, withHash, fileExecutor, workPool);
+
+		auto executor = co_await asio::this_coro::executor;
+		auto walker = detail::FileWalker::scan(executor, root, fileExecutor);
+
+		std::vector<cw::file::ScannedFile> changed;
+		size_t total = 0;
+		size_t indexed = 0; // Unchanged since the index
+		bool done = false;
+
+		while (!done) {
+			std::vector<cw::file::ScannedFile> found;
+			while (found.size() < cw::packet::MAX_MANIFEST_ENTRIES) {
+				auto file = co_await walker->next();
+				if (!file) {
+					done = true;
+					break;
+				}
+				found.push_back(std::move(*file));
+			}
+
+			cw::packet::Manifest manifest;
+			std::vector<cw::file::ScannedFile> files;
+
+			// What the index does not vouch for is hashed, all of them at once
+			std::vector<std::string> names(found.size());
+			std::vector<std::optional<cw::file::ScanIndex::Entry>> known(found.size());
+			std::vector<bool> unchanged(found.size(), false);
+			std::vector<std::optional<uint64_t>> hashes;
+			std::vector<fs::path> toHash(withHash ? found.size() : 0);
+			for (size_t i = 0; i < found.size(); ++i) {
+				const auto& file = found[i];
+				detail::remoteNameInto(names[i], file.path, file.relativePath);
+				if (index) known[i] = index->find(names[i]);
+				unchanged[i] = known[i] && known[i]->size == file.size && known[i]->modifiedNs == file.modifiedNs && known[i]->inode == file.inode;
+				if (withHash && !unchanged[i]) toHash[i] = file.path;
+			}
+			if (withHash) hashes = co_await detail::asyncHashFiles(std::move(toHash), fileExecutor, workPool);
+
+			for (size_t i = 0; i < found.size(); ++i) {
+				auto& file = found[i];
+				cw::packet::ManifestEntry entry;
+				entry.fileName = std::move(names[i]);
+				entry.fileSize = file.size;
+				entry.modifiedNs = file.modifiedNs;
+
+				bool same = unchanged[i];
+				if (same) entry.hash = known[i]->hash;
+				else if (withHash) {
+					if (!hashes[i]) continue;
+					entry.hash = *hashes[i];
+					same = known[i] && known[i]->size == file.size && known[i]->hash == entry.hash;
+				}
+
+				if (index) index->record({ entry.fileName, file.size, file.modifiedNs, file.inode, entry.hash });
+				if (same) {
+					++indexed;
+					continue;
+				}
+				manifest.entries.push_back(std::move(entry));
+				files.push_back(std::move(file));
+			}
+
+			if (manifest.entries.empty()) continue;
+			total += manifest.entries.size();
+
+			auto indices = co_await conn->asyncRequestDiff(std::move(manifest), asio::use_awaitable);
+			for (uint32_t index : indices) {
+				if (index < files.size()) changed.push_back(std::move(files[index]));
+			}
+		}
+
+		if (index) CW_LOG_INFO("[Client] Sync: ", indexed, " files unchanged since the last run (", index->path().string(), ")");
+		CW_LOG_INFO("[Client] Sync: ", changed.size(), " of ", total, " files changed");
+		co_return changed;
+	}
+
+	// A batch dictionary (TransferOptions::batchDictionary) trained on up to
+	// 'maxSamples' of the files under 'root' that go in batches (at most
+	// 'maxFileSize' bytes), picked evenly from the whole tree. Null if zstd
+	// is not built in or the tree has too few such files to learn from.
+	inline std::shared_ptr<const cw::compression::Dictionary> trainBatchDictionary(const fs::path& root, size_t maxFileSize,
+		size_t maxSamples = 2000, int level = 0)
+	{
+		// Reservoir sample: every file has the same chance however many there are
+		std::vector<fs::path> picked;
+		std::minstd_rand random(0x5eed);
+		size_t seen = 0;
+		std::error_code ec;
+		for (auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, ec);
+			!ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+			std::error_code stat;
+			if (!it->is_regular_file(stat) || it->file_size(stat) > maxFileSize || stat) continue;
+			if (picked.size() < maxSamples) picked.push_back(it->path());
+			else if (size_t slot = std::uniform_int_distribution<size_t>(0, seen)(random); slot < maxSamples) picked[slot] = it->path();
+			++seen;
+		}
+
+		std::vector<std::vector<uint8_t>> samples;
+		for (const auto& path : picked) {
+			std::error_code size;
+			auto bytes = fs::file_size(path, size);
+			if (size) continue;
+			if (auto data = detail::readSmallFile(path, bytes)) samples.push_back(std::move(*data));
+		}
+
+		auto dictionary = cw::compression::Dictionary::train(samples, cw::compression::Dictionary::DEFAULT_CAPACITY, level);
+		if (dictionary) CW_LOG_INFO("[Client] Batch dictionary of ", dictionary->bytes().size(), " bytes from ", samples.size(), " files");
+		return dictionary;
+	}
+
+	// Sends the files collected so far as one FileBatch frame and empties the
+	// batch, compressed as one where options and peer allow (compressed on
+	// 'fileExecutor' when given). Its files count into options.progress as
+	// sent, then as acked.
+	inline asio::awaitable<void> asyncSendBatch(std::shared_ptr<cw::network::Connection> conn, cw::packet::FileBatch& batch,
+		const TransferOptions& options, std::optional<asio::any_io_executor> fileExecutor = std::nullopt)
+	{
+		if (batch.files.empty()) co_return;
+
+		if (conn->isCongested(options.priority)) {
+			co_await conn->asyncWaitWritable(options.priority, asio::use_awaitable);
+		}
+
+		std::optional<cw::packet::CompressedBatch> compressed;
+		if (conn->peerTakesCompressedBatches() && (options.batchDictionary || options.compression != cw::compression::Codec::None)) {
+			auto executor = co_await asio::this_coro::executor;
+			if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+			compressed = detail::compressBatch(options, *conn, batch);
+			if (fileExecutor) co_await asio::post(executor, asio::use_awaitable);
+		}
+
+		CW_LOG_INFO("[Client] Sending batch of ", batch.files.size(), " small files...");
+		if (options.progress) {
+			uint64_t bytes = 0;
+			for (const auto& file : batch.files) bytes += file.data.size();
+			conn->reportBatchProgress(options.progress, batch.files.size());
+			options.progress->onSent(bytes);
+			options.progress->onFilesSent(batch.files.size());
+		}
+		if (compressed) {
+			if (compressed->dictionaryId != 0) conn->shareDictionary(*options.batchDictionary, options.priority);
+			conn->send(std::move(*compressed), options.priority);
+		}
+		else {
+			conn->send(batch, options.priority);
+		}
+		batch.files.clear();
+	}
+
+	// Sends one file: deduplicated or as a delta when enabled, striped over every
+	// connection if it is large enough, else over 'conn'.
+	inline asio::awaitable<void> asyncUploadFile(const std::vector<std::shared_ptr<cw::network::Connection>>& conns,
+		std::shared_ptr<cw::network::Connection> conn,
+		fs::path path,
+		std::string remoteFileName,
+		TransferOptions options,
+		std::optional<asio::any_io_executor> fileExecutor = std::nullopt)
+	{
+		std::error_code ec;
+		uint64_t fileSize = fs::file_size(path, ec);
+
+		if (!ec && options.serverCopy && conn->peerCopiesFiles() && fileSize >= options.serverCopyMinSize) {
+			// The receiver copies it on its side; nothing to stripe or diff
+			co_await asyncSendFile(std::move(conn), std::move(path), std::move(remoteFileName), std::move(options), fileExecutor);
+		}
+		else if (!ec && options.dedup && fileSize >= options.dedupMinSize) {
+			co_await asyncSendDedup(std::move(conn), std::move(path), std::move(remoteFileName), std::move(options), fileExecutor);
+		}
+		else if (!ec && options.delta && fileSize >= options.deltaMinSize) {
+			co_await asyncSendDelta(std::move(conn), std::move(path), std::move(remoteFileName), std::move(options), fileExecutor);
+		}
+		else if (!ec && conns.size() > 1 && fileSize >= options.stripeMinSize) {
+			co_await asyncSendFileStriped(conns, std::move(path), std::move(remoteFileName), std::move(options));
+		}
+		else {
+			co_await asyncSendFile(std::move(conn), std::move(path), std::move(remoteFileName), std::move(options), fileExecutor);
+		}
+	}
+
+	namespace detail {
+
+		// The files the walker hands out, uploaded by uploadOptions.workers
+		// workers over 'conns' (see asyncUploadDirectory)
+		inline asio::awaitable<void> asyncUploadWalk(std::vector<std::shared_ptr<cw::network::Connection>> conns,
+			std::shared_ptr<FileWalker> walker,
+			TransferOptions options,
+			DirectoryUploadOptions uploadOptions,
+			std::optional<asio::any_io_executor> fileExecutor)
+		{
+			auto executor = co_await asio::this_coro::executor;
+			std::exception_ptr skipped;
+			auto worker = [&conns, &options, &uploadOptions, &fileExecutor, &skipped, executor, walker](size_t index) -> asio::awaitable<void>
+				{
+					// The connections each file may go over: all of them, or
+					// in cluster mode those of the server it belongs to
+					std::vector<std::vector<std::shared_ptr<cw::network::Connection>>> groups;
+					if (uploadOptions.cluster) groups = uploadOptions.cluster->servers;
+					else groups.push_back(conns);
+					std::vector<std::shared_ptr<cw::network::Connection>> groupConns;
+					for (const auto& group : groups) groupConns.push_back(group[index % group.size()]);
+
+					// Small files are collected here, per server, and sent as one frame
+					std::vector<cw::packet::FileBatch> batches(groups.size());
+					std::vector<size_t> batchBytes(groups.size(), 0);
+
+					// Or packed into this worker's archive, opened with its first member
+					std::vector<std::optional<ArchiveSender>> archives(groups.size());
+					bool archiving = uploadOptions.archive;
+					if (archiving) {
+						for (auto& conn : groupConns) {
+							co_await conn->asyncWaitCapabilities(asio::use_awaitable);
+							if (archiving && !conn->peerTakesArchives()) {
+								if (index == 0) CW_LOG_WARN("[Client] The server takes no archives, sending small files in batches");
+								archiving = false;
+							}
+						}
+					}
+
+					// This worker's remote name of the current file, reused from file to file
+					std::string name;
+
+					while (auto file = co_await walker->next()) {
+						// Ahead of the files in them, so the receiver creates them in bulk
+						auto directories = walker->takeDirectories();
+						for (auto& conn : groupConns) {
+							if (!directories.empty() && conn->peerTakesDirectoryManifests()) sendDirectoryManifests(*conn, directories, options.priority);
+						}
+
+						size_t server = uploadOptions.cluster ? uploadOptions.cluster->serverFor(file->relativePath) : 0;
+						const auto& group = groups[server];
+						const auto& conn = groupConns[server];
+						auto& batch = batches[server];
+						auto& archive = archives[server];
+
+						// Relative path lets the server recreate the directory structure
+						uint64_t size = file->size;
+
+						if (archiving && size <= uploadOptions.archiveMaxFileSize) {
+							if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+							auto data = readSmallFile(file->path, size);
+							if (fileExecutor) co_await asio::post(executor, asio::use_awaitable);
+
+							if (data) {
+								if (!archive) archive.emplace(conn, negotiatedOptions(options, *conn));
+								remoteNameInto(name, file->path, file->relativePath);
+								co_await archive->add(name, *data);
+								continue;
+							}
+						}
+						else if (size <= options.batchMaxFileSize && options.batchMaxFileSize > 0 && !options.chunkKey) {
+							if (batchBytes[server] + size > options.batchMaxBytes || batch.files.size() == cw::packet::MAX_BATCH_FILES) {
+								co_await asyncSendBatch(conn, batch, options, fileExecutor);
+								batchBytes[server] = 0;
+							}
+
+							if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+							auto data = readSmallFile(file->path, size);
+							if (fileExecutor) co_await asio::post(executor, asio::use_awaitable);
+
+							if (data) {
+								remoteNameInto(name, file->path, file->relativePath);
+								batch.files.push_back({ name, std::move(*data) });
+								batchBytes[server] += size;
+								continue;
+							}
+							// Changed or unreadable since the walk: let the regular path report it
+						}
+
+						CW_LOG_DEBUG("Sending: ", file->path.string());
+						try {
+							if (uploadOptions.tuner) {
+								auto setting = uploadOptions.tuner->current();
+								std::vector<std::shared_ptr<cw::network::Connection>> active(group.begin(), group.begin() + std::clamp<size_t>(setting.streams, 1, group.size()));
+								co_await asyncUploadFile(active, active[index % active.size()], file->path, file->relativePath.string(), setting.applied(options), fileExecutor);
+							}
+							else {
+								co_await asyncUploadFile(group, conn, file->path, file->relativePath.string(), options, fileExecutor);
+							}
+						}
+						catch (const std::system_error& e) {
+							// A lost connection ends the worker; a file the receiver failed does not
+							if (!std::all_of(conns.begin(), conns.end(), [](const auto& c) { return c->isOpen(); })) throw;
+							CW_LOG_WARN("[Client] Skipped ", file->path.string(), ": ", e.what());
+							if (!skipped) skipped = std::current_exception();
+						}
+					}
+
+					for (size_t server = 0; server < groups.size(); ++server) {
+						co_await asyncSendBatch(groupConns[server], batches[server], options, fileExecutor);
+						if (archives[server]) co_await archives[server]->finish();
+					}
+				};
+
+			using Operation = decltype(asio::co_spawn(executor, worker(0), asio::deferred));
+			std::vector<Operation> operations;
+			for (size_t i = 0; i < uploadOptions.workers; ++i) {
+				operations.push_back(asio::co_spawn(executor, worker(i), asio::deferred));
+			}
+
+			auto [order, errors] = co_await asio::experimental::make_parallel_group(std::move(operations))
+				.async_wait(asio::experimental::wait_for_all(), asio::use_awaitable);
+
+			for (auto& error : errors) {
+				if (error) std::rethrow_exception(error);
+			}
+			if (skipped) std::rethrow_exception(skipped);
+		}
+
+		// A walker over 'files', located first for ReadOrder::Physical
+		inline asio::awaitable<std::shared_ptr<FileWalker>> asyncListFiles(std::vector<cw::file::ScannedFile> files,
+			const TransferOptions& options,
+			const DirectoryUploadOptions& uploadOptions,
+			std::optional<asio::any_io_executor> fileExecutor)
+		{
+			auto executor = co_await asio::this_coro::executor;
+			if (uploadOptions.order == cw::file::ReadOrder::Physical) {
+				if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+				for (auto& file : files) cw::file::locate(file);
+				if (fileExecutor) co_await asio::post(executor, asio::use_awaitable);
+			}
+			co_return FileWalker::list(executor, std::move(files), options.progress, uploadOptions.order);
+		}
+	}
+
+	// Uploads a directory tree with 'workers' files in flight at once, spread over
+	// 'conns' (each file carries its own stream id, so they share connections).
+	// Disk reads happen on 'fileExecutor' when given, so workers read in parallel.
+	// Lowers the connections' watermarks to keep the whole upload within
+	// maxInFlightBytes. Rethrows the first worker failure once all have stopped.
+	// A file the receiver fails (disk full, rejected) is skipped and the rest
+	// of the tree still sent; the first such failure is rethrown at the end.
+	// In sync mode only the files the server reports as changed are uploaded;
+	// in cluster mode each server is asked in turn (a scan of the tree each,
+	// so without a scan index) about the files it holds.
+	// options.progress, when given, is planned with each file as it is found.
+	inline asio::awaitable<void> asyncUploadDirectory(std::vector<std::shared_ptr<cw::network::Connection>> conns,
+		fs::path root,
+		TransferOptions options = {},
+		DirectoryUploadOptions uploadOptions = {},
+		std::optional<asio::any_io_executor> fileExecutor = std::nullopt)
+	{
+		if (conns.empty()) co_return;
+		uploadOptions.workers = std::max<size_t>(1, uploadOptions.workers);
+
+		size_t high = detail::highWatermarkFor(options, uploadOptions, conns.size());
+		for (auto& conn : conns) conn->setWatermarks(high / 4, high);
+
+		auto executor = co_await asio::this_coro::executor;
+		std::shared_ptr<detail::FileWalker> walker;
+		if (uploadOptions.sync && uploadOptions.cluster) {
+			const auto& cluster = *uploadOptions.cluster;
+			std::vector<cw::file::ScannedFile> changed;
+			for (size_t server = 0; server < cluster.servers.size(); ++server) {
+				auto found = co_await asyncFindChangedFiles(cluster.servers[server].front(), root, uploadOptions.syncHash, fileExecutor, nullptr, options.workPool);
+				for (auto& file : found) {
+					if (cluster.serverFor(file.relativePath) == server) changed.push_back(std::move(file));
+				}
+			}
+			walker = co_await detail::asyncListFiles(std::move(changed), options, uploadOptions, fileExecutor);
+		}
+		else if (uploadOptions.sync) {
+			auto changed = co_await asyncFindChangedFiles(conns.front(), root, uploadOptions.syncHash, fileExecutor, uploadOptions.scanIndex, options.workPool);
+			walker = co_await detail::asyncListFiles(std::move(changed), options, uploadOptions, fileExecutor);
+		}
+		else {
+			walker = detail::FileWalker::scan(executor, root, fileExecutor, options.progress, uploadOptions.order);
+		}
+		co_await detail::asyncUploadWalk(std::move(conns), walker, options, uploadOptions, fileExecutor);
+	}
+
+#if defined(__linux__)
+	// Watch mode: uploads the tree (only what changed, with uploadOptions.sync),
+	// then keeps sending the files that change under it, in batches, until a
+	// connection is lost. A file the receiver fails is logged and the watch
+	// goes on. Events lost to a full inotify queue cost one sync pass over
+	// the whole tree.
+	inline asio::awaitable<void> asyncWatchDirectory(std::vector<std::shared_ptr<cw::network::Connection>> conns,
+		fs::path root,
+		TransferOptions options = {},
+		DirectoryUploadOptions uploadOptions = {},
+		std::optional<asio::any_io_executor> fileExecutor = std::nullopt)
+	{
+		if (conns.empty()) co_return;
+		auto executor = co_await asio::this_coro::executor;
+		auto allOpen = [&conns]() { return std::all_of(conns.begin(), conns.end(), [](const auto& c) { return c->isOpen(); }); };
+
+		// Watching before the first pass: what changes during it is sent after
+		auto watcher = cw::file::DirectoryWatcher::start(root, executor, uploadOptions.watchDebounce, uploadOptions.watchMaxDelay);
+		CW_LOG_INFO("[Client] Watching ", watcher->watched(), " directories under ", root.string());
+		cw::file::WatchBatch batch;
+		batch.overflowed = true;
+
+		for (;;) {
+			try {
+				if (batch.overflowed) {
+					co_await asyncUploadDirectory(conns, root, options, uploadOptions, fileExecutor);
+				}
+				else {
+					CW_LOG_INFO("[Client] Watch: ", batch.files.size(), " files changed");
+					auto walker = co_await detail::asyncListFiles(std::move(batch.files), options, uploadOptions, fileExecutor);
+					co_await detail::asyncUploadWalk(conns, walker, options, uploadOptions, fileExecutor);
+				}
+			}
+			catch (const std::system_error& e) {
+				if (!allOpen()) throw;
+				CW_LOG_WARN("[Client] Watch: ", e.what());
+			}
+
+			batch = co_await watcher->next();
+			if (!allOpen()) throw std::system_error(std::make_error_code(std::errc::not_connected), "Connection lost while watching");
+
+			// Events were lost: the whole tree is compared instead
+			if (batch.overflowed) {
+				CW_LOG_WARN("[Client] Watch: change events lost, comparing the whole tree");
+				uploadOptions.sync = true;
+			}
+		}
+	}
+#endif
+}
@@ -0,0 +1,222 @@
+#pragma once
+#if defined(__linux__)
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <set>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <asio.hpp>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "cw/file/directory_scanner.h"
+#include "cw/log/logger.h"
+
+namespace cw::file {
+
+	// Files changed under a watched tree since the last batch
+	struct WatchBatch
+	{
+		std::vector<ScannedFile> files; // As they are now, each once
+		bool overflowed = false;        // Events were lost: only a full comparison finds everything
+	};
+
+	// Changes under a tree, from inotify: one watch per directory, added as
+	// directories appear. A file counts as changed once it is closed after
+	// writing or moved in, so half-written files are not picked up; the
+	// files of a directory created or moved in count as changed with it.
+	// Events are collected until none has come for 'debounce', or the
+	// oldest has waited 'maxDelay', and handed out as one batch (next).
+	// Deletions are not reported. Only touched from its executor.
+	class DirectoryWatcher : public std::enable_shared_from_this<DirectoryWatcher>
+	{
+	public:
+		static constexpr std::uint32_t DIRECTORY_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+		// Throws std::system_error if inotify is not available or 'root' cannot be watched
+		static std::shared_ptr<DirectoryWatcher> start(std::filesystem::path root, asio::any_io_executor executor,
+			std::chrono::steady_clock::duration debounce = std::chrono::milliseconds(100),
+			std::chrono::steady_clock::duration maxDelay = std::chrono::seconds(1))
+		{
+			int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (fd < 0) throw std::system_error(errno, std::system_category(), "inotify_init1");
+
+			auto watcher = std::shared_ptr<DirectoryWatcher>(new DirectoryWatcher(std::move(root), executor, fd, debounce, maxDelay));
+			std::vector<ScannedFile> ignored;
+			if (!watcher->watchTree({}, ignored)) {
+				throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory), "Cannot watch " + watcher->m_root.string());
+			}
+			watcher->read();
+			return watcher;
+		}
+
+		DirectoryWatcher(const DirectoryWatcher&) = delete;
+		DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+		// The next batch, once there is one. Empty after cancel.
+		asio::awaitable<WatchBatch> next()
+		{
+			for (;;) {
+				if (m_cancelled) co_return WatchBatch{};
+
+				auto now = std::chrono::steady_clock::now();
+				bool pending = !m_changed.empty() || m_overflowed;
+				if (pending) {
+					auto due = std::min(m_lastEventAt + m_debounce, m_firstEventAt + m_maxDelay);
+					if (now >= due) co_return take();
+					m_wake.expires_at(due);
+				}
+				else {
+					m_wake.expires_at(asio::steady_timer::time_point::max());
+				}
+
+				// Woken (cancelled) by the first event of a batch, or at its due time
+				std::error_code ec;
+				co_await m_wake.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+			}
+		}
+
+		// Directories watched
+		std::size_t watched() const { return m_directories.size(); }
+
+		// Watches nothing more; a waiting next() returns an empty batch
+		void cancel()
+		{
+			m_cancelled = true;
+			std::error_code ec;
+			m_descriptor.close(ec);
+			m_wake.cancel();
+		}
+
+	private:
+		DirectoryWatcher(std::filesystem::path root, asio::any_io_executor executor, int fd,
+			std::chrono::steady_clock::duration debounce, std::chrono::steady_clock::duration maxDelay)
+			: m_root(std::move(root)), m_descriptor(executor, fd), m_wake(executor), m_debounce(debounce), m_maxDelay(maxDelay)
+		{
+		}
+
+		// Watches 'relative' and every directory below it, collecting the
+		// files already there; false if 'relative' itself cannot be watched
+		bool watchTree(const std::filesystem::path& relative, std::vector<ScannedFile>& files)
+		{
+			std::vector<std::filesystem::path> pending{ relative };
+			bool watchedFirst = false;
+			while (!pending.empty()) {
+				auto current = std::move(pending.back());
+				pending.pop_back();
+				auto dir = current.empty() ? m_root : m_root / current;
+
+				int wd = ::inotify_add_watch(m_descriptor.native_handle(), dir.c_str(), DIRECTORY_EVENTS);
+				if (wd < 0) {
+					if (errno == ENOSPC) CW_LOG_WARN("Cannot watch ", dir, ": out of inotify watches (fs.inotify.max_user_watches)");
+					if (current == relative) return false;
+					continue;
+				}
+				if (current == relative) watchedFirst = true;
+				m_directories[wd] = current;
+
+				// Listed after the watch is in place, so nothing written in between is missed
+				std::vector<std::filesystem::path> subdirectories;
+				detail::listDirectory(dir, current, files, subdirectories);
+				pending.insert(pending.end(), subdirectories.begin(), subdirectories.end());
+			}
+			return watchedFirst;
+		}
+
+		void read()
+		{
+			m_descriptor.async_read_some(asio::buffer(m_buffer), [weak = weak_from_this()](std::error_code ec, std::size_t n)
+				{
+					auto self = weak.lock();
+					if (!self || ec) return;
+					self->onEvents(n);
+					self->read();
+				});
+		}
+
+		void onEvents(std::size_t length)
+		{
+			bool wasPending = !m_changed.empty() || m_overflowed;
+			for (std::size_t offset = 0; offset + sizeof(inotify_event) <= length;) {
+				inotify_event event;
+				std::memcpy(&event, m_buffer.data() + offset, sizeof(event));
+				const char* name = reinterpret_cast<const char*>(m_buffer.data() + offset + sizeof(event));
+				offset += sizeof(event) + event.len;
+
+				if (event.mask & IN_Q_OVERFLOW) {
+					m_overflowed = true;
+					continue;
+				}
+				if (event.mask & IN_IGNORED) {
+					m_directories.erase(event.wd);
+					continue;
+				}
+				auto it = m_directories.find(event.wd);
+				if (it == m_directories.end() || event.len == 0) continue;
+				auto relative = it->second / name;
+
+				if (event.mask & IN_ISDIR) {
+					if (!(event.mask & (IN_CREATE | IN_MOVED_TO))) continue;
+					std::vector<ScannedFile> files;
+					watchTree(relative, files);
+					for (auto& file : files) m_changed.insert(std::move(file.relativePath));
+				}
+				else if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+					m_changed.insert(std::move(relative));
+				}
+			}
+
+			bool pending = !m_changed.empty() || m_overflowed;
+			if (!pending) return;
+			auto now = std::chrono::steady_clock::now();
+			if (!wasPending) {
+				m_firstEventAt = now;
+				m_wake.cancel();
+			}
+			m_lastEventAt = now;
+		}
+
+		// The batch collected, each file looked at once more: gone or no
+		// longer a regular file, it is left out
+		WatchBatch take()
+		{
+			WatchBatch batch;
+			batch.overflowed = std::exchange(m_overflowed, false);
+			for (auto& relative : std::exchange(m_changed, {})) {
+				std::error_code ec;
+				auto path = m_root / relative;
+				if (!std::filesystem::is_regular_file(path, ec)) continue;
+				auto size = std::filesystem::file_size(path, ec);
+				if (ec) continue;
+				auto modified = std::filesystem::last_write_time(path, ec);
+				if (ec) continue;
+				batch.files.push_back({ path, relative, size, cw::file::modifiedNs(modified) });
+			}
+			return batch;
+		}
+
+		std::filesystem::path m_root;
+		asio::posix::stream_descriptor m_descriptor;
+		asio::steady_timer m_wake;
+		std::chrono::steady_clock::duration m_debounce;
+		std::chrono::steady_clock::duration m_maxDelay;
+		std::array<std::uint8_t, 64 * 1024> m_buffer;
+
+		std::unordered_map<int, std::filesystem::path> m_directories; // Watch descriptor -> directory, relative to m_root
+		std::set<std::filesystem::path> m_changed;                   // Relative to m_root
+		bool m_overflowed = false;
+		bool m_cancelled = false;
+		std::chrono::steady_clock::time_point m_firstEventAt;
+		std::chrono::steady_clock::time_point m_lastEventAt;
+	};
+}
+#endif
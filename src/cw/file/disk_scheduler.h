@@ -0,0 +1,208 @@
+#pragma once
+#include <asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace cw::file {
+
+	// One share of the disk pool (see DiskScheduler): by default the
+	// connections of one client address. Its disk jobs wait in its own queue
+	// while other tenants' run.
+	class DiskTenant
+	{
+	public:
+		DiskTenant(std::string name, double weight) : m_name(std::move(name)), m_weight(weight) {}
+
+		const std::string& name() const { return m_name; }
+		double weight() const { return m_weight; }
+
+		// Time its jobs ran on the disk threads so far
+		std::chrono::nanoseconds busyTime() const { return std::chrono::nanoseconds(m_busyNanos.load(std::memory_order_relaxed)); }
+
+	private:
+		friend class DiskScheduler;
+
+		std::string m_name;
+		double m_weight;
+		std::atomic<std::int64_t> m_busyNanos = 0;
+
+		// Under DiskScheduler::m_mutex
+		std::deque<std::move_only_function<void()>> m_queue;
+		std::int64_t m_deficitNanos = 0;    // Disk time it may still take this round
+		std::int64_t m_estimateNanos = 0;   // What one of its jobs takes, charged up front
+		bool m_active = false;              // In the round (has queued jobs)
+	};
+
+	// Deficit round robin of disk time across tenants, ahead of a thread
+	// pool: at most 'slots' jobs are on the pool at once, and the next one
+	// comes from the tenant in turn, each taking up to its weight's quantum
+	// of disk time per round. A job's cost is not known up front (a strand
+	// runs a batch of writes as one), so it is charged what the tenant's
+	// jobs recently took and corrected by what it actually took. A client
+	// streaming one huge file then holds its share of the threads, not all
+	// of them, and a small upload next to it waits about a round.
+	class DiskScheduler
+	{
+	public:
+		using Function = std::move_only_function<void()>;
+		using Clock = std::function<std::chrono::steady_clock::time_point()>;
+
+		// Disk time per round for a tenant of weight 1
+		static constexpr std::int64_t QUANTUM_NANOS = 1'000'000;
+		// What a tenant is charged for its first job, before anything was measured
+		static constexpr std::int64_t INITIAL_ESTIMATE_NANOS = 100'000;
+		// Debt a tenant carries at most, in quanta: one long job costs it a few rounds, not its turn for good
+		static constexpr std::int64_t MAX_DEBT_QUANTA = 16;
+
+		// Runs a tenant's jobs on the scheduler's pool, in the order given
+		class executor_type
+		{
+		public:
+			executor_type(DiskScheduler& scheduler, std::shared_ptr<DiskTenant> tenant) : m_scheduler(&scheduler), m_tenant(std::move(tenant)) {}
+
+			asio::execution_context& query(asio::execution::context_t) const noexcept { return m_scheduler->m_pool.context(); }
+			static constexpr asio::execution::blocking_t query(asio::execution::blocking_t) noexcept { return asio::execution::blocking.never; }
+
+			template<typename F>
+			void execute(F&& fn) const { m_scheduler->submit(m_tenant, Function(std::forward<F>(fn))); }
+
+			bool operator==(const executor_type& other) const noexcept { return m_scheduler == other.m_scheduler && m_tenant == other.m_tenant; }
+			bool operator!=(const executor_type& other) const noexcept { return !(*this == other); }
+
+		private:
+			DiskScheduler* m_scheduler;
+			std::shared_ptr<DiskTenant> m_tenant;
+		};
+
+		DiskScheduler(asio::thread_pool::executor_type pool, std::size_t slots)
+			: m_pool(pool), m_slots(std::max<std::size_t>(slots, 1))
+		{
+		}
+
+		DiskScheduler(const DiskScheduler&) = delete;
+		DiskScheduler& operator=(const DiskScheduler&) = delete;
+
+		// Weight of the tenant 'name' from its next tenant() on; 1 unless set
+		void setWeight(const std::string& name, double weight)
+		{
+			std::lock_guard lock(m_mutex);
+			m_weights[name] = std::max(weight, 0.01);
+		}
+
+		// Where jobs are timed from; the steady clock unless a test drives it. Set before any submit()
+		void setClock(Clock clock) { m_clock = std::move(clock); }
+
+		void setDefaultWeight(double weight)
+		{
+			std::lock_guard lock(m_mutex);
+			m_defaultWeight = std::max(weight, 0.01);
+		}
+
+		// The tenant 'name', shared by everyone who asks while one holds it
+		std::shared_ptr<DiskTenant> tenant(const std::string& name)
+		{
+			std::lock_guard lock(m_mutex);
+			auto& entry = m_tenants[name];
+			if (auto tenant = entry.lock()) return tenant;
+
+			auto weight = m_weights.find(name);
+			auto tenant = std::make_shared<DiskTenant>(name, weight != m_weights.end() ? weight->second : m_defaultWeight);
+			tenant->m_estimateNanos = INITIAL_ESTIMATE_NANOS;
+			entry = tenant;
+			std::erase_if(m_tenants, [](const auto& other) { return other.second.expired(); });
+			return tenant;
+		}
+
+		executor_type executor(std::shared_ptr<DiskTenant> tenant) { return executor_type(*this, std::move(tenant)); }
+
+		// Queues 'fn' behind the tenant's earlier jobs
+		void submit(const std::shared_ptr<DiskTenant>& tenant, Function fn)
+		{
+			std::lock_guard lock(m_mutex);
+			tenant->m_queue.push_back(std::move(fn));
+			if (!tenant->m_active) {
+				// Back in the round: any debt stays, credit from before it went idle does not
+				tenant->m_active = true;
+				tenant->m_deficitNanos = std::min<std::int64_t>(tenant->m_deficitNanos, 0);
+				m_round.push_back(tenant);
+			}
+			pump();
+		}
+
+	private:
+		// Fills the free slots, by deficit round robin; under m_mutex
+		void pump()
+		{
+			while (m_running < m_slots && !m_round.empty()) {
+				auto& tenant = m_round.front();
+				if (tenant->m_deficitNanos <= 0) {
+					// Its turn is over: a quantum more for the next round, and the next tenant's turn
+					tenant->m_deficitNanos += static_cast<std::int64_t>(static_cast<double>(QUANTUM_NANOS) * tenant->m_weight);
+					m_round.push_back(std::move(tenant));
+					m_round.pop_front();
+					continue;
+				}
+
+				std::shared_ptr<DiskTenant> owner = tenant;
+				Function job = std::move(owner->m_queue.front());
+				owner->m_queue.pop_front();
+				std::int64_t charged = owner->m_estimateNanos;
+				owner->m_deficitNanos -= charged;
+				if (owner->m_queue.empty()) {
+					owner->m_active = false;
+					m_round.pop_front();
+				}
+
+				++m_running;
+				asio::post(m_pool, [this, owner = std::move(owner), charged, job = std::move(job)]() mutable
+					{
+						auto start = m_clock();
+						// Settled even if the job throws, so its slot is not lost
+						struct Settle
+						{
+							DiskScheduler* scheduler;
+							std::shared_ptr<DiskTenant>& owner;
+							std::int64_t charged;
+							std::chrono::steady_clock::time_point start;
+							~Settle() { scheduler->finished(owner, charged, scheduler->m_clock() - start); }
+						} settle{ this, owner, charged, start };
+						job();
+					});
+			}
+		}
+
+		void finished(const std::shared_ptr<DiskTenant>& tenant, std::int64_t charged, std::chrono::steady_clock::duration took)
+		{
+			std::int64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(took).count();
+			tenant->m_busyNanos.fetch_add(nanos, std::memory_order_relaxed);
+
+			std::lock_guard lock(m_mutex);
+			std::int64_t maxDebt = static_cast<std::int64_t>(static_cast<double>(MAX_DEBT_QUANTA * QUANTUM_NANOS) * tenant->m_weight);
+			tenant->m_deficitNanos = std::max(tenant->m_deficitNanos - (nanos - charged), -maxDebt);
+			tenant->m_estimateNanos = std::max<std::int64_t>((3 * tenant->m_estimateNanos + nanos) / 4, 1);
+			--m_running;
+			pump();
+		}
+
+		asio::thread_pool::executor_type m_pool;
+		std::size_t m_slots;
+		Clock m_clock = [] { return std::chrono::steady_clock::now(); };
+
+		std::mutex m_mutex;
+		std::deque<std::shared_ptr<DiskTenant>> m_round; // Tenants with queued jobs, the one in turn first
+		std::size_t m_running = 0;                       // Jobs on the pool
+		std::unordered_map<std::string, std::weak_ptr<DiskTenant>> m_tenants;
+		std::unordered_map<std::string, double> m_weights;
+		double m_defaultWeight = 1.0;
+	};
+}
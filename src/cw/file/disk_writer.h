@@ -0,0 +1,1545 @@
+#pragma once
+#include <asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <span>
+#include <string>
+#include <system_error>
+#include <variant>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#include "cw/buffer/shared_buffer.h"
+#include "cw/buffer/buffer_pool.h"
+#include "cw/buffer/memory_budget.h"
+#include "cw/file/create_ring.h"
+#include "cw/file/directory_cache.h"
+#include "cw/file/disk_scheduler.h"
+#include "cw/file/durability.h"
+#include "cw/file/file_handle.h"
+#include "cw/file/mapped_file.h"
+#include "cw/log/logger.h"
+#include "cw/file/resume_journal.h"
+#include "cw/file/splice_pipe.h"
+#include "cw/compression/codec.h"
+#include "cw/integrity/checksum.h"
+#include "cw/integrity/chunk_cipher.h"
+#include "cw/metrics/metrics.h"
+#include "cw/metrics/stage_profile.h"
+#include "cw/metrics/timeline.h"
+#include "cw/trace.h"
+#include "cw/work_pool.h"
+
+namespace cw::file {
+
+	// How received files are written (see IncomingFile), chosen per DiskWriter.
+	//   ThreadPool: WriteBehindFile, blocking positional writes on the
+	//               DiskWriter's threads; every platform
+	//   Native:     AsyncWriteFile, asio's random_access_file: io_uring on
+	//               Linux (built with CW_USE_IO_URING), IOCP on Windows
+	enum class FileBackend { ThreadPool, Native };
+
+	// Whether this build has the Native backend
+	constexpr bool hasNativeFileBackend()
+	{
+#if defined(ASIO_HAS_FILE)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	inline std::optional<FileBackend> parseFileBackend(const std::string& name)
+	{
+		if (name == "pool") return FileBackend::ThreadPool;
+		if (name == "native") return FileBackend::Native;
+		return std::nullopt;
+	}
+
+	// What a DiskWriter has on its plate, summed over its files: the bytes
+	// queued for the disk, and how long a write took to land from when its
+	// bytes came off the socket, smoothed. Read for admission control (see
+	// DiskWriter::setAdmissionLimits).
+	class DiskLoad
+	{
+	public:
+		void add(std::size_t bytes) { m_queuedBytes.fetch_add(bytes, std::memory_order_relaxed); }
+		void remove(std::size_t bytes) { m_queuedBytes.fetch_sub(bytes, std::memory_order_relaxed); }
+
+		// Files land their writes concurrently: an update lost to a race
+		// only weighs one sample less
+		void record(std::chrono::nanoseconds took)
+		{
+			std::int64_t latency = m_latencyNanos.load(std::memory_order_relaxed);
+			m_latencyNanos.store(latency + (took.count() - latency) / 8, std::memory_order_relaxed);
+		}
+
+		std::uint64_t queuedBytes() const { return m_queuedBytes.load(std::memory_order_relaxed); }
+		std::chrono::nanoseconds latency() const { return std::chrono::nanoseconds(m_latencyNanos.load(std::memory_order_relaxed)); }
+
+	private:
+		std::atomic<std::uint64_t> m_queuedBytes = 0;
+		std::atomic<std::int64_t> m_latencyNanos = 0;
+	};
+
+	// Thread pool that performs all disk work for received files, so a slow disk
+	// never stalls the network io_context. Shared by every connection of a server.
+	class DiskWriter
+	{
+	public:
+		explicit DiskWriter(std::size_t threads = 2)
+			: m_pool(threads),
+			m_threads(threads)
+		{
+		}
+
+		~DiskWriter() { m_pool.join(); }
+
+		DiskWriter(const DiskWriter&) = delete;
+		DiskWriter& operator=(const DiskWriter&) = delete;
+
+		// Used by connections that were not given a writer explicitly.
+		static std::shared_ptr<DiskWriter> defaultInstance()
+		{
+			static std::shared_ptr<DiskWriter> instance = std::make_shared<DiskWriter>();
+			return instance;
+		}
+
+		asio::thread_pool::executor_type executor() { return m_pool.get_executor(); }
+		std::size_t threads() const { return m_threads; }
+
+		// Runs 'fn' once on every pool thread, to pin them (see cw::numa).
+		// Blocks until each has run it; call before work is queued.
+		void runOnEachThread(const std::function<void()>& fn)
+		{
+			auto count = static_cast<std::ptrdiff_t>(m_threads);
+			std::latch started(count); // Holds each thread until all have one
+			std::latch finished(count);
+			for (std::size_t i = 0; i < m_threads; ++i) {
+				asio::post(m_pool, [&]()
+					{
+						fn();
+						started.arrive_and_wait();
+						finished.count_down();
+					});
+			}
+			finished.wait();
+		}
+
+		// Directories made for received files, shared by every connection
+		const std::shared_ptr<DirectoryCache>& directories() const { return m_directories; }
+
+		// When received files are acked (see Durability). Applies to files
+		// opened after the call; None by default.
+		void setDurability(Durability durability) { m_durability = durability; }
+		Durability durability() const { return m_durability; }
+		const std::shared_ptr<GroupCommitter>& groupCommitter() const { return m_committer; }
+
+		// Received files of at least 'minSize' bytes are written unbuffered
+		// (O_DIRECT, FILE_FLAG_NO_BUFFERING; see DIRECT_IO_ALIGNMENT), so a
+		// stream of huge files does not push everything else out of the page
+		// cache. 0 = off, the default. Applies to files opened after the call.
+		void setDirectIoMinSize(std::uint64_t minSize) { m_directIoMinSize = minSize; }
+		std::uint64_t directIoMinSize() const { return m_directIoMinSize; }
+
+		// Drop-behind for received files: what has been written is written
+		// back and dropped from the page cache in steps behind the transfer
+		// (see WriteBehindFile::dropBehind), a lighter way than direct I/O to
+		// keep the cache footprint of streaming writes bounded. Off by default;
+		// applies to files opened after the call.
+		void setDropBehind(bool enabled) { m_dropBehind = enabled; }
+		bool dropBehind() const { return m_dropBehind; }
+
+		// Mapped writes for received files: the preallocated file is mapped
+		// (MAP_SHARED, see WritableMapping) and chunks are copied into it
+		// rather than written one pwrite each, which pays off where the
+		// syscall is the cost (tmpfs, fast NVMe). Periodically msync'd unless
+		// Durability is None. Not with direct I/O or drop-behind, which keep
+		// the page cache out of the way instead. ThreadPool backend; off by
+		// default; applies to files opened after the call.
+		void setMappedWrites(bool enabled) { m_mappedWrites = enabled; }
+		bool mappedWrites() const { return m_mappedWrites; }
+
+		// Received files of at least 'minSize' bytes have their chunk writes
+		// spread over 'lanes' strands of the pool rather than one, by offset
+		// (see WriteBehindFile::laneFor), so one huge file can keep several
+		// disk threads writing; positional writes to disjoint ranges need no
+		// ordering between them. At most threads() lanes count. 1 = off, the
+		// default. ThreadPool backend; applies to files opened after the call.
+		void setWriteLanes(std::size_t lanes, std::uint64_t minSize = DEFAULT_WRITE_LANE_MIN_SIZE)
+		{
+			m_writeLaneMinSize = minSize;
+			m_writeLanes = std::max<std::size_t>(1, std::min(lanes, m_threads));
+		}
+		std::size_t writeLanes() const { return m_writeLanes; }
+		std::uint64_t writeLaneMinSize() const { return m_writeLaneMinSize; }
+
+		static constexpr std::uint64_t DEFAULT_WRITE_LANE_MIN_SIZE = 256 * 1024 * 1024;
+
+		// Backend of received files opened after the call. Native where the
+		// build opted into it (CW_USE_IO_URING), else ThreadPool; Native is
+		// refused (false) by builds without it.
+		bool setBackend(FileBackend backend)
+		{
+			if (backend == FileBackend::Native && !hasNativeFileBackend()) return false;
+			m_backend = backend;
+			return true;
+		}
+		FileBackend backend() const { return m_backend; }
+
+		// Compressed chunks of received files are decompressed (and checked)
+		// on this pool, several at a time, instead of on the file's strand,
+		// and written in the order they came. Null (the default) = on the
+		// strand. ThreadPool backend; applies to files opened after the call.
+		void setWorkPool(std::shared_ptr<WorkPool> pool) { m_workPool.store(std::move(pool)); }
+		std::shared_ptr<WorkPool> workPool() const { return m_workPool.load(); }
+
+		// Shares the disk threads between tenants by weight (see
+		// DiskScheduler) instead of first come, first served. Off by default;
+		// call before connections are accepted. ThreadPool backend.
+		DiskScheduler& enableFairShare()
+		{
+			std::call_once(m_fairShareOnce, [this]() { m_scheduler = std::make_unique<DiskScheduler>(m_pool.get_executor(), m_threads); });
+			return *m_scheduler;
+		}
+
+		// The tenant 'name' (a client address), or null without fair share
+		std::shared_ptr<DiskTenant> tenant(const std::string& name)
+		{
+			return m_scheduler ? m_scheduler->tenant(name) : nullptr;
+		}
+
+		// Where the disk jobs of 'tenant' go: its share of the pool, or the
+		// pool itself for none
+		asio::any_io_executor executor(const std::shared_ptr<DiskTenant>& tenant)
+		{
+			if (tenant && m_scheduler) return m_scheduler->executor(tenant);
+			return m_pool.get_executor();
+		}
+
+		const std::shared_ptr<DiskLoad>& load() const { return m_load; }
+
+		// Admission control: while more than 'maxQueuedBytes' wait for the
+		// disk, or writes take longer than 'maxLatency' to land, a new file is
+		// refused (ErrorCode::Busy) rather than queued behind the rest, and
+		// its sender retries later. 0 = no such limit, the default for both.
+		void setAdmissionLimits(std::uint64_t maxQueuedBytes, std::chrono::milliseconds maxLatency)
+		{
+			m_maxQueuedBytes = maxQueuedBytes;
+			m_maxLatency = maxLatency;
+		}
+		bool admissionLimited() const { return m_maxQueuedBytes != 0 || m_maxLatency.load().count() != 0; }
+
+		// How long a new file's sender should wait before it tries again, or
+		// nullopt if the file is taken now. Latency counts only while
+		// something is queued: an idle disk takes anything.
+		std::optional<std::chrono::milliseconds> admissionDelay() const
+		{
+			std::uint64_t queued = m_load->queuedBytes();
+			if (queued == 0) return std::nullopt;
+
+			auto latency = m_load->latency();
+			auto maxLatency = m_maxLatency.load();
+			bool overQueued = m_maxQueuedBytes != 0 && queued > m_maxQueuedBytes;
+			bool overLatency = maxLatency.count() != 0 && latency > maxLatency;
+			if (!overQueued && !overLatency) return std::nullopt;
+
+			// The queue drains in about one latency
+			return std::clamp(std::chrono::duration_cast<std::chrono::milliseconds>(latency), MIN_RETRY_AFTER, MAX_RETRY_AFTER);
+		}
+
+	private:
+		static constexpr std::chrono::milliseconds MIN_RETRY_AFTER{ 100 };
+		static constexpr std::chrono::milliseconds MAX_RETRY_AFTER{ 10'000 };
+
+		asio::thread_pool m_pool;
+		std::size_t m_threads;
+		std::shared_ptr<DiskLoad> m_load = std::make_shared<DiskLoad>();
+		std::atomic<std::uint64_t> m_maxQueuedBytes = 0;
+		std::atomic<std::chrono::milliseconds> m_maxLatency{ std::chrono::milliseconds(0) };
+		std::shared_ptr<DirectoryCache> m_directories = std::make_shared<DirectoryCache>();
+		std::atomic<Durability> m_durability = Durability::None;
+		std::atomic<std::uint64_t> m_directIoMinSize = 0;
+		std::atomic<bool> m_dropBehind = false;
+		std::atomic<bool> m_mappedWrites = false;
+		std::atomic<std::size_t> m_writeLanes = 1;
+		std::atomic<std::uint64_t> m_writeLaneMinSize = DEFAULT_WRITE_LANE_MIN_SIZE;
+		std::atomic<std::shared_ptr<WorkPool>> m_workPool;
+#if defined(CW_USE_IO_URING) && defined(ASIO_HAS_FILE)
+		std::atomic<FileBackend> m_backend = FileBackend::Native;
+#else
+		std::atomic<FileBackend> m_backend = FileBackend::ThreadPool;
+#endif
+		std::shared_ptr<GroupCommitter> m_committer = std::make_shared<GroupCommitter>(m_pool.get_executor(), m_directories);
+		std::once_flag m_fairShareOnce;
+		std::unique_ptr<DiskScheduler> m_scheduler;
+	};
+
+	// Name a file is received under until it is whole and verified; then it
+	// is renamed over 'path', so readers see the old copy or the new one, never
+	// a torn one
+	inline std::filesystem::path receivingPathFor(const std::filesystem::path& path)
+	{
+		std::filesystem::path receiving = path;
+		receiving += ".cwrecv";
+		return receiving;
+	}
+
+	// The bytes of a SealedChunk at 'offset' opened with 'cipher' into 'raw'
+	// (its rawSize), and decompressed if 'codec' says they were compressed;
+	// illegal_byte_sequence if they do not authenticate. CPU-bound.
+	inline std::error_code openSealedChunk(const cw::integrity::ChunkCipher& cipher, std::uint64_t offset, cw::compression::Codec codec,
+		std::span<const std::uint8_t> sealed, std::span<std::uint8_t> raw)
+	{
+		auto aad = cipher.associatedData(offset, static_cast<std::uint8_t>(codec), static_cast<std::uint32_t>(raw.size()));
+		auto illegal = std::make_error_code(std::errc::illegal_byte_sequence);
+		if (sealed.size() < cw::integrity::CHUNK_TAG_SIZE) return illegal;
+		if (codec == cw::compression::Codec::None) return cipher.open(offset, aad, sealed, raw) ? std::error_code{} : illegal;
+
+		cw::buffer::PooledBuffer opened(sealed.size() - cw::integrity::CHUNK_TAG_SIZE);
+		if (!cipher.open(offset, aad, sealed, opened.span())) return illegal;
+		return cw::compression::decompress(codec, opened.span(), raw);
+	}
+
+	// Write-behind state of one incoming file.
+	// Every operation is queued on a strand of the DiskWriter pool, so the writes of
+	// one file stay ordered while different files proceed in parallel. Completion
+	// callbacks are posted back to 'callbackExecutor' (the connection's executor).
+	// pendingBytes() lets the caller pause socket reads while the disk catches up.
+	class WriteBehindFile : public std::enable_shared_from_this<WriteBehindFile>
+	{
+	public:
+		using Callback = std::function<void(std::error_code)>;
+		using FinishCallback = std::function<void(std::error_code, std::uint64_t bytesWritten)>;
+		using ResumeCallback = std::function<void(std::error_code, std::uint64_t resumeOffset)>;
+
+		// 'tenant': whose share of the writer's threads its writes take (see
+		// DiskWriter::enableFairShare)
+		static std::shared_ptr<WriteBehindFile> create(DiskWriter& writer, asio::any_io_executor callbackExecutor,
+			std::shared_ptr<DiskTenant> tenant = nullptr)
+		{
+			return std::shared_ptr<WriteBehindFile>(new WriteBehindFile(writer, std::move(callbackExecutor), tenant));
+		}
+
+		// An atomic file dropped before finish (the connection went away) leaves
+		// nothing behind, unless a resume journal still points at it
+		~WriteBehindFile()
+		{
+			if (m_finished || m_journal || m_writePath.empty() || m_writePath == m_path) return;
+			m_mapping.unmap();
+			m_direct.close();
+			m_file.close();
+			m_directories->remove(m_writePath);
+		}
+
+		// Creates parent directories, opens and preallocates the file. 'atomic':
+		// write under receivingPathFor(path) until finish publishes it.
+		void open(std::filesystem::path path, std::uint64_t size, Callback onOpened, bool atomic = true)
+		{
+			auto self = shared_from_this();
+			enqueue([this, self, path = std::move(path), size, onOpened = std::move(onOpened), atomic]() mutable
+				{
+					std::error_code ec;
+					m_path = path;
+					m_writePath = atomic ? receivingPathFor(path) : path;
+					m_size = size;
+					try {
+						m_file = m_directories->openWrite(m_writePath);
+						ec = m_file.preallocate(size);
+					}
+					catch (const std::system_error& e) {
+						ec = e.code();
+					}
+					if (!ec) openDirect();
+					if (!ec) openMapping();
+					m_useLanes = m_lanes.size() > 1 && size >= m_laneMinSize;
+
+					// A fresh copy invalidates any checkpoint of an earlier attempt
+					if (!ec) ResumeJournal(path).remove();
+
+					if (ec) fail(ec);
+					CW_TRACE(file__open, m_path.c_str(), size, ec.value());
+					complete([onOpened = std::move(onOpened), ec]() { onOpened(ec); });
+				});
+		}
+
+		// Resumable open. If the journal next to 'path' describes the same source
+		// (fingerprint and size), existing contents are kept and the sender resumes
+		// at the journaled offset; otherwise the file starts over at 0. Every
+		// 'checkpointInterval' bytes written the data is synced and the journal
+		// rewritten with the ranges now on disk (see ResumeState); under
+		// Durability::GroupCommit the sync is the committer's shared flush.
+		// finish() removes it once the file is complete.
+		// Always atomic: the prefix waits under receivingPathFor(path).
+		void openResumable(std::filesystem::path path, std::uint64_t size, std::uint64_t fingerprint,
+			std::uint64_t checkpointInterval, ResumeCallback onOpened)
+		{
+			auto self = shared_from_this();
+			enqueue([this, self, path = std::move(path), size, fingerprint, checkpointInterval, onOpened = std::move(onOpened)]() mutable
+				{
+					std::error_code ec = m_directories->ensure(path.parent_path());
+					m_path = path;
+					m_writePath = receivingPathFor(path);
+					m_size = size;
+
+					ResumeJournal journal(path);
+					std::uint64_t resumeOffset = 0;
+					std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+					if (auto state = journal.load()) {
+						std::error_code existsEc;
+						if (state->fingerprint == fingerprint && state->fileSize == size
+							&& state->offset <= size && std::filesystem::exists(m_writePath, existsEc)) {
+							resumeOffset = state->offset;
+							ranges = std::move(state->ranges);
+						}
+					}
+
+					if (!ec) {
+						try {
+							m_file = m_directories->openWrite(m_writePath, resumeOffset == 0);
+							ec = m_file.preallocate(size);
+						}
+						catch (const std::system_error& e) {
+							ec = e.code();
+						}
+						if (!ec) openDirect();
+						if (!ec) openMapping();
+						m_useLanes = m_lanes.size() > 1 && size >= m_laneMinSize;
+					}
+
+					if (!ec) {
+						m_journal = journal;
+						m_resumeState = { fingerprint, size, resumeOffset, std::move(ranges) };
+						m_checkpointInterval = std::max<std::uint64_t>(1, checkpointInterval);
+						m_bytesWritten = resumeOffset;
+						ec = journal.save(m_resumeState);
+					}
+
+					if (ec) fail(ec);
+					CW_TRACE(file__open, m_path.c_str(), size, ec.value());
+					complete([onOpened = std::move(onOpened), ec, resumeOffset]() { onOpened(ec, ec ? 0 : resumeOffset); });
+				});
+		}
+
+		// Called on the callback executor with the total bytes written after each
+		// write lands. Set before the first write.
+		void onProgress(std::function<void(std::uint64_t bytesWritten)> fn) { m_onProgress = std::move(fn); }
+
+		// Where writes given an arrival time record how long they took to land
+		// (see cw::metrics::ConnectionMetrics::diskLatency). Set before the first write.
+		void recordWriteLatency(std::shared_ptr<cw::metrics::LatencyHistogram> histogram) { m_writeLatency = std::move(histogram); }
+
+		// The connection whose memory the queued bytes count against (see
+		// cw::buffer::MemoryAccount). Set before the first write.
+		void chargeTo(std::shared_ptr<cw::buffer::MemoryAccount> account) { m_memory = std::move(account); }
+
+		// Queues a positional write. Never blocks. 'arrived': when the bytes came
+		// off the socket, for the write latency histogram.
+		void write(std::uint64_t offset, cw::buffer::SharedBuffer data, cw::metrics::Clock::time_point arrived = {})
+		{
+			std::size_t length = data.size();
+			addPending(length);
+
+			enqueueStore(offset, length, arrived, [this, offset, data = std::move(data)](cw::buffer::PooledBuffer& scratch)
+				{
+					return storeData(offset, data.span(), scratch);
+				});
+		}
+
+		// Chunks that follow one another from 'offset' (one read's worth, see
+		// Connection::queueChunkWrite), queued as one write: a single pwritev
+		// instead of one pwrite each. With direct I/O they go one by one, each
+		// aligned on its own, as they do into a mapping.
+		void writeGathered(std::uint64_t offset, std::vector<cw::buffer::SharedBuffer> pieces, cw::metrics::Clock::time_point arrived = {})
+		{
+			std::size_t length = 0;
+			for (const auto& piece : pieces) length += piece.size();
+			addPending(length);
+
+			enqueueStore(offset, length, arrived, [this, offset, pieces = std::move(pieces)](cw::buffer::PooledBuffer& scratch) mutable
+				{
+					std::error_code ec;
+					if (m_direct.isOpen() || m_mapping.isMapped()) {
+						std::uint64_t at = offset;
+						for (const auto& piece : pieces) {
+							if ((ec = storeData(at, piece.span(), scratch))) break;
+							at += piece.size();
+						}
+					}
+					else {
+						std::vector<std::span<const uint8_t>, cw::buffer::PoolAllocator<std::span<const uint8_t>>> spans;
+						spans.reserve(pieces.size());
+						for (const auto& piece : pieces) spans.push_back(piece.span());
+						ec = m_file.writeAt(offset, spans);
+					}
+					cw::buffer::BufferListPool::release(std::move(pieces));
+					return ec;
+				});
+		}
+
+		// A compressed chunk: decompressed on the disk strand, or on the
+		// writer's work pool if it has one, checked against 'crc' (CRC32C of
+		// the raw bytes) if given, then written at 'offset'. A mismatch fails
+		// the file. 'rawSize' counts towards pendingBytes() meanwhile.
+		void writeCompressed(std::uint64_t offset, cw::compression::Codec codec, std::uint32_t rawSize, cw::buffer::SharedBuffer data,
+			std::optional<std::uint32_t> crc = std::nullopt, cw::metrics::Clock::time_point arrived = {})
+		{
+			writeDecoded(offset, rawSize, [codec, data = std::move(data), crc](std::span<std::uint8_t> raw)
+				{
+					return decompressChunk(codec, data, crc, raw);
+				}, arrived);
+		}
+
+		// A sealed chunk (SealedChunk): opened with 'cipher', and decompressed
+		// if it was compressed, where writeCompressed would decompress it. One
+		// that does not authenticate fails the file.
+		void writeSealed(std::uint64_t offset, std::shared_ptr<const cw::integrity::ChunkCipher> cipher, cw::compression::Codec codec,
+			std::uint32_t rawSize, cw::buffer::SharedBuffer data, cw::metrics::Clock::time_point arrived = {})
+		{
+			writeDecoded(offset, rawSize, [offset, cipher = std::move(cipher), codec, data = std::move(data)](std::span<std::uint8_t> raw)
+				{
+					return openSealedChunk(*cipher, offset, codec, data.span(), raw);
+				}, arrived);
+		}
+
+		// Copies 'length' bytes at 'sourceOffset' of 'source' to 'offset', queued
+		// like a write: delta block references, and file ranges passed by
+		// descriptor over a local socket. The kernel copies where it can,
+		// otherwise it goes through memory in COPY_PIECE steps.
+		void copyFrom(std::shared_ptr<const FileHandle> source, std::uint64_t sourceOffset, std::uint64_t offset, std::uint64_t length,
+			cw::metrics::Clock::time_point arrived = {})
+		{
+			std::size_t pending = static_cast<std::size_t>(length);
+			addPending(pending);
+
+			auto self = shared_from_this();
+			enqueue([this, self, source = std::move(source), sourceOffset, offset, length, pending, arrived]()
+				{
+					if (!m_error && m_file.isOpen()) {
+						std::uint64_t done = 0;
+						if (source) {
+							std::error_code ec = m_file.copyRangeFrom(*source, sourceOffset, offset, length, done);
+							if (ec && ec != std::errc::operation_not_supported) fail(ec);
+						}
+
+						std::vector<uint8_t> piece(done < length ? static_cast<std::size_t>(std::min<std::uint64_t>(length - done, COPY_PIECE)) : 0);
+						while (done < length && !m_error) {
+							std::span<uint8_t> span(piece.data(), static_cast<std::size_t>(std::min<std::uint64_t>(length - done, piece.size())));
+
+							std::error_code ec = source ? source->readAt(sourceOffset + done, span) : std::make_error_code(std::errc::bad_file_descriptor);
+							if (!ec) ec = writeData(offset + done, span);
+							if (ec) fail(ec);
+
+							done += span.size();
+						}
+
+						if (!m_error) {
+							recordLatency(arrived);
+							m_bytesWritten += length;
+							if (m_journal) advanceJournal(offset, static_cast<std::size_t>(length));
+							if (m_onProgress) complete([this, self, written = m_bytesWritten]() { m_onProgress(written); });
+						}
+					}
+
+					removePending(pending);
+					checkDrained();
+				});
+		}
+
+#if defined(__linux__)
+		// 'length' bytes the connection spliced from its socket into 'pipe',
+		// queued like a write and moved into the file by splice, so they are
+		// never copied through user space. With direct I/O, or a filesystem
+		// that takes no splice, what is left is read out and written instead.
+		void writeFromPipe(std::shared_ptr<SplicePipe> pipe, std::uint64_t offset, std::size_t length,
+			cw::metrics::Clock::time_point arrived = {})
+		{
+			addPending(length);
+
+			auto self = shared_from_this();
+			enqueue([this, self, pipe = std::move(pipe), offset, length, arrived]()
+				{
+					if (!m_error && m_file.isOpen()) {
+						TimelineWrite timeline(arrived, offset, length);
+						std::size_t done = 0;
+						std::error_code ec = m_direct.isOpen() ? std::make_error_code(std::errc::operation_not_supported)
+							: pipe->drainTo(m_file.native(), offset, length, done);
+						if (ec == std::errc::invalid_argument || ec == std::errc::operation_not_supported) {
+							cw::buffer::PooledBuffer rest = m_direct.isOpen() ? cw::buffer::PooledBuffer(length - done, DIRECT_IO_ALIGNMENT) : cw::buffer::PooledBuffer(length - done);
+							ec = pipe->readInto(rest.span());
+							if (!ec) ec = writeData(offset + done, rest.span());
+						}
+						else if (!ec && m_dropBehind) {
+							dropBehind(offset, length);
+						}
+
+						if (ec) fail(ec);
+						else {
+							recordLatency(arrived);
+							m_bytesWritten += length;
+							if (m_journal) advanceJournal(offset, length);
+							if (m_onProgress) complete([this, self, written = m_bytesWritten]() { m_onProgress(written); });
+						}
+					}
+
+					removePending(length);
+					checkDrained();
+				});
+		}
+#endif
+
+		// 'length' bytes already written will be written again (a repair asked
+		// for by the tree hash): queued behind the first write, so they count once
+		void unwrite(std::uint64_t length)
+		{
+			auto self = shared_from_this();
+			enqueue([this, self, length]() { m_bytesWritten -= length; });
+		}
+
+		// A range of zeros (FileHole: a hole of a sparse source, or a chunk of
+		// zeros), queued like a write: [offset, offset + length) is left
+		// unallocated (cw::file::punchHole) and counts as written.
+		void punchHole(std::uint64_t offset, std::uint64_t length)
+		{
+			auto self = shared_from_this();
+			enqueue([this, self, offset, length]()
+				{
+					if (m_error || !m_file.isOpen()) return;
+					// Stores into a punched range would have the filesystem allocate
+					// on the fault, where running out of space is a SIGBUS
+					if (std::error_code ec = closeMapping()) {
+						fail(ec);
+						return;
+					}
+					if (std::error_code ec = m_file.punchHole(offset, length)) {
+						fail(ec);
+						return;
+					}
+
+					m_bytesWritten += length;
+					if (m_journal) advanceJournal(offset, static_cast<std::size_t>(length));
+					if (m_onProgress) complete([this, self, written = m_bytesWritten]() { m_onProgress(written); });
+				});
+		}
+
+		// Server-side copy (FileCopy): fills the first 'length' bytes from
+		// 'source' without the data passing through this process, by reflink
+		// when the filesystem shares extents, else copy_file_range. Not being
+		// able to is not an error: 'onDone' gets how many leading bytes are in
+		// place, 0 when neither works, and the rest arrives as chunks.
+		void cloneFrom(std::shared_ptr<const FileHandle> source, std::uint64_t length, std::function<void(std::uint64_t copied)> onDone)
+		{
+			auto self = shared_from_this();
+			enqueue([this, self, source = std::move(source), length, onDone = std::move(onDone)]() mutable
+				{
+					std::uint64_t copied = 0;
+					if (!m_error && m_file.isOpen()) {
+						if (!m_file.cloneFrom(*source)) copied = length;
+						else m_file.copyRangeFrom(*source, 0, 0, length, copied); // A partial copy still counts
+
+						m_bytesWritten += copied;
+						if (m_journal && copied > 0) advanceJournal(0, static_cast<std::size_t>(copied));
+					}
+					complete([onDone = std::move(onDone), copied]() { onDone(copied); });
+				});
+		}
+
+		// The length of a stream opened (with size 0, so nothing is reserved)
+		// before its length was known, which finish() then checks. Before finish.
+		void setSize(std::uint64_t size)
+		{
+			enqueue([self = shared_from_this(), size]() { self->m_size = size; });
+		}
+
+		// The source's mtime and mode, set by finish() on the still-open file
+		// right after its last write. Before finish.
+		void setAttributes(FileAttributes attributes)
+		{
+			enqueue([self = shared_from_this(), attributes]() { self->m_attributes = attributes; });
+		}
+
+		// Runs after every queued write and closes the file. 'publish': the
+		// caller verified it (FileDone checksum), so once every byte is written
+		// an atomic file is renamed to its own name. Otherwise it is removed,
+		// unless it is a resumable prefix that was not refused. 'onDone' runs
+		// once the file is as durable as the writer's Durability asks.
+		void finish(FinishCallback onDone, bool publish = true)
+		{
+			auto self = shared_from_this();
+			enqueue([this, self, onDone = std::move(onDone), publish]() mutable
+				{
+					m_finished = true;
+					m_direct.close(); // Its writes are on the device; sync and publish go through m_file
+					if (std::error_code mapEc = closeMapping(); mapEc && !m_error) fail(mapEc);
+					std::error_code ec = m_error;
+					std::uint64_t written = m_bytesWritten;
+					bool atomic = m_writePath != m_path;
+
+					if (ec || !publish || written != m_size || !m_file.isOpen()) {
+						m_file.close();
+						if (m_journal && !publish) {
+							m_journal->remove();
+							m_journal.reset();
+						}
+						if (atomic && (!m_journal || !publish)) m_directories->remove(m_writePath);
+						CW_TRACE(file__close, m_path.c_str(), written, ec ? ec.value() : static_cast<int>(std::errc::operation_canceled));
+						complete([onDone = std::move(onDone), ec, written]() { onDone(ec, written); });
+						return;
+					}
+
+					// Complete: the partial-file journal is no longer needed
+					if (m_journal) {
+						m_journal->remove();
+						m_journal.reset();
+					}
+					// Best effort, as a filesystem without modes or times should not
+					// fail the file; ahead of the sync, so they are durable with it
+					if (m_attributes) m_file.applyAttributes(*m_attributes);
+
+					bool group = m_durability == Durability::GroupCommit;
+#if defined(_WIN32)
+					// Windows renames closed files only: sync this one on its own first
+					group = false;
+					if (m_durability != Durability::None) ec = m_file.sync();
+					m_file.close();
+#else
+					if (m_durability == Durability::PerFile) ec = m_file.sync();
+#endif
+					if (m_dropBehind) finishDropBehind();
+					if (!ec && atomic) ec = m_directories->rename(m_writePath, m_path);
+
+					if (!ec && group) {
+						auto file = std::make_shared<const FileHandle>(std::move(m_file));
+						m_committer->add(std::move(file), m_path.parent_path(), [self, onDone = std::move(onDone), written](std::error_code ec)
+							{
+								CW_TRACE(file__close, self->m_path.c_str(), written, ec.value());
+								self->complete([onDone = std::move(onDone), ec, written]() { onDone(ec, written); });
+							});
+						return;
+					}
+					if (!ec && m_durability != Durability::None) ec = m_directories->syncDirectory(m_path.parent_path());
+
+					m_file.close();
+					CW_TRACE(file__close, m_path.c_str(), written, ec.value());
+					complete([onDone = std::move(onDone), ec, written]() { onDone(ec, written); });
+				});
+		}
+
+		std::size_t pendingBytes() const { return m_pendingBytes; }
+
+		// Saves the resume journal at the contiguous progress so far, once the
+		// writes queued before the call have landed: a transfer cut short (the
+		// peer gone, a server draining) resumes from there rather than from the
+		// last interval checkpoint. Nothing for files opened without a journal.
+		void checkpoint()
+		{
+			auto self = shared_from_this();
+			enqueue([this, self]()
+				{
+					if (!m_journal || m_finished || m_error || !m_file.isOpen() || m_uncheckpointed == 0) return;
+					saveCheckpoint();
+				});
+		}
+
+		// Posts 'onDrained' to the callback executor once pendingBytes() <= threshold.
+		// Several waiters may be registered (one per connection feeding the file).
+		void whenDrained(std::size_t threshold, std::function<void()> onDrained)
+		{
+			std::lock_guard<std::mutex> lock(m_drainMutex);
+			if (m_pendingBytes <= threshold) {
+				asio::post(m_callbackExecutor, std::move(onDrained));
+				return;
+			}
+			m_drainWaiters.push_back({ threshold, std::move(onDrained) });
+			m_hasDrainWaiter = true;
+		}
+
+	private:
+		static constexpr std::uint64_t COPY_PIECE = 1024 * 1024;
+		static constexpr std::uint64_t DROP_BEHIND_STEP = 8 * 1024 * 1024;
+		static constexpr std::uint64_t MAPPED_SYNC_STEP = 8 * 1024 * 1024;
+		static constexpr std::uint64_t LANE_STRIPE = 4 * 1024 * 1024;
+
+		struct ByteSpan
+		{
+			std::uint64_t from = UINT64_MAX;
+			std::uint64_t to = 0;
+		};
+
+		WriteBehindFile(DiskWriter& writer, asio::any_io_executor callbackExecutor, const std::shared_ptr<DiskTenant>& tenant)
+			: m_strand(makeStrand(writer, tenant)),
+			m_directories(writer.directories()),
+			m_durability(writer.durability()),
+			m_committer(writer.groupCommitter()),
+			m_directIoMinSize(writer.directIoMinSize()),
+			m_dropBehind(writer.dropBehind()),
+			m_mappedWrites(writer.mappedWrites()),
+			m_laneMinSize(writer.writeLaneMinSize()),
+			m_callbackExecutor(std::move(callbackExecutor)),
+			m_load(writer.load())
+		{
+			if (std::size_t lanes = writer.writeLanes(); lanes > 1) {
+				for (std::size_t i = 0; i < lanes; ++i) m_lanes.push_back(std::make_unique<Lane>(makeStrand(writer, tenant)));
+			}
+			if (auto pool = writer.workPool()) {
+				auto target = std::visit([](const auto& strand) { return asio::any_io_executor(strand); }, m_strand);
+				m_resequencer = std::make_unique<Resequencer>(std::move(pool), std::move(target));
+			}
+		}
+
+		// A strand over the pool's own executor type unless a tenant's share
+		// stands in for it: one over any_io_executor allocates on every post,
+		// querying its target's properties
+		using PoolStrand = asio::strand<asio::thread_pool::executor_type>;
+		using TenantStrand = asio::strand<asio::any_io_executor>;
+
+		static std::variant<PoolStrand, TenantStrand> makeStrand(DiskWriter& writer, const std::shared_ptr<DiskTenant>& tenant)
+		{
+			if (tenant) return TenantStrand(writer.executor(tenant));
+			return PoolStrand(writer.executor());
+		}
+
+		template<typename Function>
+		void post(Function fn)
+		{
+			post(m_strand, std::move(fn));
+		}
+
+		template<typename Function>
+		static void post(const std::variant<PoolStrand, TenantStrand>& strand, Function fn)
+		{
+			std::visit([&fn](const auto& to) { asio::post(to, std::move(fn)); }, strand);
+		}
+
+		// With lane writes in flight the handles they write through stay open
+		// until those land (see laneWriteDone)
+		void fail(std::error_code ec)
+		{
+			if (!m_error) m_error = ec;
+			if (m_laneWrites > 0) return;
+			m_mapping.unmap();
+			m_direct.close();
+			m_file.close();
+		}
+
+		// Onto m_strand, behind the compressed chunks still on the work pool.
+		// With lanes, also behind every lane write queued before it, unless
+		// it is one itself (see sequence).
+		template<typename Function>
+		void enqueue(Function fn, bool barrier = true)
+		{
+			if (m_lanes.empty()) {
+				if (m_resequencer) m_resequencer->post(std::move(fn));
+				else post(std::move(fn));
+				return;
+			}
+			auto sequenced = [this, barrier, fn = std::move(fn)]() mutable { sequence(barrier, std::move(fn)); };
+			if (m_resequencer) m_resequencer->post(std::move(sequenced));
+			else post(std::move(sequenced));
+		}
+
+		// A strand of the pool, next to m_strand, that chunk writes of a file
+		// m_useLanes covers go to by offset, with scratch of its own for
+		// direct I/O
+		struct Lane
+		{
+			explicit Lane(std::variant<PoolStrand, TenantStrand> strand) : strand(std::move(strand)) {}
+
+			std::variant<PoolStrand, TenantStrand> strand;
+			cw::buffer::PooledBuffer alignedScratch;
+		};
+
+		// The lane of a write at 'offset', LANE_STRIPE bytes of the file to a
+		// lane in turn: a sequential stream keeps every lane busy while the
+		// queue is deep, and a chunk written again (a repair) lands on the
+		// lane that wrote it first, behind it. Null without lanes.
+		Lane* laneFor(std::uint64_t offset) const
+		{
+			if (!m_useLanes) return nullptr;
+			return m_lanes[(offset / LANE_STRIPE) % m_lanes.size()].get();
+		}
+
+		// Main strand. Runs 'fn' unless it has to wait: a 'barrier' (anything
+		// but a chunk write) for the lane writes in flight, and anything for
+		// what already waits, so the file's order holds
+		void sequence(bool barrier, std::move_only_function<void()> fn)
+		{
+			if (m_afterLanes.empty() && (!barrier || m_laneWrites == 0)) {
+				fn();
+				return;
+			}
+			m_afterLanes.emplace_back(barrier, std::move(fn));
+		}
+
+		// Main strand, as a lane write lands
+		void laneWriteDone()
+		{
+			if (--m_laneWrites > 0) return;
+			if (m_error) fail(m_error); // Closes what it could not before
+			while (!m_afterLanes.empty()) {
+				if (m_afterLanes.front().first && m_laneWrites > 0) return;
+				auto fn = std::move(m_afterLanes.front().second);
+				m_afterLanes.pop_front();
+				fn();
+			}
+		}
+
+		// A chunk write: 'store' writes the bytes (storeData) and returns its
+		// error, on the file's lane for the offset if it has lanes, else on
+		// m_strand; the file's own state is updated on m_strand after
+		template<typename Store>
+		void enqueueStore(std::uint64_t offset, std::size_t length, cw::metrics::Clock::time_point arrived, Store store)
+		{
+			auto self = shared_from_this();
+			enqueue([this, self, offset, length, arrived, store = std::move(store)]() mutable
+				{
+					if (m_error || !m_file.isOpen()) {
+						removePending(length);
+						checkDrained();
+						return;
+					}
+
+					Lane* lane = laneFor(offset);
+					if (!lane) {
+						TimelineWrite timeline(arrived, offset, length);
+						landed(offset, length, arrived, store(m_alignedScratch));
+						return;
+					}
+					++m_laneWrites;
+					post(lane->strand, [this, self, lane, offset, length, arrived, store = std::move(store)]() mutable
+						{
+							std::error_code ec;
+							{
+								TimelineWrite timeline(arrived, offset, length);
+								ec = store(lane->alignedScratch);
+							}
+							post([this, self, offset, length, arrived, ec]()
+								{
+									landed(offset, length, arrived, ec);
+									laneWriteDone();
+								});
+						});
+				}, false);
+		}
+
+		// On m_strand, once a chunk write's bytes are stored
+		void landed(std::uint64_t offset, std::size_t length, cw::metrics::Clock::time_point arrived, std::error_code ec)
+		{
+			if (ec) fail(ec);
+			else if (!m_error) {
+				stored(offset, length);
+				recordLatency(arrived);
+				m_bytesWritten += length;
+				if (m_journal) advanceJournal(offset, length);
+				if (m_onProgress) complete([this, self = shared_from_this(), written = m_bytesWritten]() { m_onProgress(written); });
+			}
+			removePending(length);
+			checkDrained();
+		}
+
+		// The rest of writeCompressed and writeSealed: decode(raw) fills the
+		// chunk's 'rawSize' bytes on the writer's work pool if it has one,
+		// else on the strand, and they are written at 'offset'
+		template<typename Decode>
+		void writeDecoded(std::uint64_t offset, std::uint32_t rawSize, Decode decode, cw::metrics::Clock::time_point arrived)
+		{
+			addPending(rawSize);
+
+			auto self = shared_from_this();
+			if (m_resequencer) {
+				// Aligned whether or not the file turns out to be written unbuffered:
+				// m_direct belongs to the strand
+				auto raw = std::make_shared<cw::buffer::PooledBuffer>(rawSize, DIRECT_IO_ALIGNMENT);
+				auto result = std::make_shared<std::error_code>();
+				m_resequencer->submit([decode = std::move(decode), raw, result]()
+					{
+						*result = decode(raw->span());
+					},
+					[this, self, offset, rawSize, raw, result, arrived]()
+					{
+						writeDecompressed(offset, rawSize, raw->span(), *result, arrived);
+					});
+				return;
+			}
+			post([this, self, offset, rawSize, decode = std::move(decode), arrived]()
+				{
+					cw::buffer::PooledBuffer raw = m_direct.isOpen() ? cw::buffer::PooledBuffer(rawSize, DIRECT_IO_ALIGNMENT) : cw::buffer::PooledBuffer(rawSize);
+					std::error_code ec;
+					if (!m_error && m_file.isOpen()) ec = decode(raw.span());
+					writeDecompressed(offset, rawSize, raw.span(), ec, arrived);
+				});
+		}
+
+		static std::error_code decompressChunk(cw::compression::Codec codec, const cw::buffer::SharedBuffer& data, std::optional<std::uint32_t> crc,
+			std::span<std::uint8_t> raw)
+		{
+			std::error_code ec = cw::compression::decompress(codec, data.span(), raw);
+			if (!ec && crc && cw::integrity::crc32c(raw) != *crc) ec = std::make_error_code(std::errc::illegal_byte_sequence);
+			return ec;
+		}
+
+		// The rest of writeDecoded, on the strand; 'ec' from its decode
+		void writeDecompressed(std::uint64_t offset, std::uint32_t rawSize, std::span<const std::uint8_t> raw, std::error_code ec,
+			cw::metrics::Clock::time_point arrived)
+		{
+			if (!m_error && m_file.isOpen()) {
+				TimelineWrite timeline(arrived, offset, rawSize);
+				if (!ec) ec = writeData(offset, raw);
+
+				if (ec) fail(ec);
+				else {
+					recordLatency(arrived);
+					m_bytesWritten += rawSize;
+					if (m_journal) advanceJournal(offset, rawSize);
+					if (m_onProgress) complete([this, self = shared_from_this(), written = m_bytesWritten]() { m_onProgress(written); });
+				}
+			}
+
+			removePending(rawSize);
+			checkDrained();
+		}
+
+		// A second, unbuffered handle next to m_file, for files the writer's
+		// directIoMinSize covers. A filesystem that cannot (tmpfs, some network
+		// mounts) fails the open: then everything goes through m_file.
+		void openDirect()
+		{
+			if (m_directIoMinSize == 0 || m_size < m_directIoMinSize) return;
+			try {
+				m_direct = m_directories->openWrite(m_writePath, false, true);
+			}
+			catch (const std::system_error& e) {
+				CW_LOG_DEBUG("[Disk] Unbuffered writes unavailable for ", m_writePath.string(), ": ", e.what());
+			}
+		}
+
+		// With the writer's mappedWrites, the preallocated file mapped for
+		// writes to be copied into. Where it cannot be (no allocation up front,
+		// a filesystem without shared mappings) everything goes through m_file.
+		void openMapping()
+		{
+			if (!m_mappedWrites || m_size == 0 || m_direct.isOpen() || m_dropBehind) return;
+			if (std::error_code ec = m_mapping.map(m_writePath, m_size)) {
+				CW_LOG_DEBUG("[Disk] Mapped writes unavailable for ", m_writePath.string(), ": ", ec.message());
+			}
+		}
+
+		// storeData, then stored, on m_strand
+		std::error_code writeData(std::uint64_t offset, std::span<const uint8_t> data)
+		{
+			if (std::error_code ec = storeData(offset, data, m_alignedScratch)) return ec;
+			stored(offset, data.size());
+			return {};
+		}
+
+		// Into the mapping if it covers the write. Otherwise the whole aligned
+		// blocks of a write at an aligned offset go through m_direct, via
+		// 'scratch' unless the bytes already sit at an aligned address; the
+		// rest (the tail of the file, an odd offset) through the page cache.
+		// Touches nothing but the handles, so lanes run it side by side.
+		std::error_code storeData(std::uint64_t offset, std::span<const uint8_t> data, cw::buffer::PooledBuffer& scratch)
+		{
+			if (m_mapping.write(offset, data)) return {};
+
+			std::size_t direct = m_direct.isOpen() && offset % DIRECT_IO_ALIGNMENT == 0
+				? data.size() / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT
+				: 0;
+			if (direct > 0) {
+				std::span<const uint8_t> blocks = data.first(direct);
+				if (!isDirectAligned(offset, blocks)) {
+					if (scratch.size() < direct) scratch = cw::buffer::PooledBuffer(direct, DIRECT_IO_ALIGNMENT);
+					std::copy(blocks.begin(), blocks.end(), scratch.data());
+					blocks = { scratch.data(), direct };
+				}
+				if (std::error_code ec = m_direct.writeAt(offset, blocks)) return ec;
+			}
+			return m_file.writeAt(offset + direct, data.subspan(direct));
+		}
+
+		// What follows 'length' bytes stored at 'offset': msync steps into a
+		// mapping, drop-behind otherwise
+		void stored(std::uint64_t offset, std::size_t length)
+		{
+			if (m_mapping.isMapped()) mappedStored(offset, length);
+			else if (m_dropBehind) dropBehind(offset, length);
+		}
+
+		// Every MAPPED_SYNC_STEP bytes stored into the mapping, unless
+		// Durability is None, the span of those stores is msync'd (MS_ASYNC)
+		// and starts writing back, so the sync a checkpoint or finish ends with
+		// has less left to wait for
+		void mappedStored(std::uint64_t offset, std::size_t length)
+		{
+			m_mappedDirty.from = std::min(m_mappedDirty.from, offset);
+			m_mappedDirty.to = std::max(m_mappedDirty.to, offset + length);
+			m_mappedDirtyBytes += length;
+			if (m_durability == Durability::None || m_mappedDirtyBytes < MAPPED_SYNC_STEP) return;
+			if (std::error_code ec = flushMapped(false)) fail(ec);
+		}
+
+		// msync of what was stored since the last: 'wait' until it is written
+		// (ahead of m_file.sync(), where that alone may not reach the mapping's
+		// pages), else started
+		std::error_code flushMapped(bool wait)
+		{
+			ByteSpan dirty = std::exchange(m_mappedDirty, {});
+			m_mappedDirtyBytes = 0;
+			if (dirty.from >= dirty.to) return {};
+			std::error_code ec = m_mapping.flush(dirty.from, dirty.to - dirty.from, wait);
+			if (!ec && !wait) m_file.writeBack(dirty.from, dirty.to - dirty.from, false);
+			return ec;
+		}
+
+		// Writes after this go through m_file. Unless Durability is None what
+		// was stored is flushed first: waited for under PerFile, started under
+		// GroupCommit, whose shared flush takes it from there.
+		std::error_code closeMapping()
+		{
+			if (!m_mapping.isMapped()) return {};
+			std::error_code ec;
+			if (m_durability != Durability::None) ec = flushMapped(m_durability == Durability::PerFile);
+			m_mapping.unmap();
+			m_mappedDirty = {};
+			m_mappedDirtyBytes = 0;
+			return ec;
+		}
+
+		// Every DROP_BEHIND_STEP bytes written, the span of those writes starts
+		// writing back, and the span of the step before, which has had a step's
+		// time to reach the device, is waited for and dropped from the page
+		// cache: at most two steps of the file stay cached. Writes out of order
+		// (stripes) only widen a span, and dropping a range not written yet is
+		// harmless.
+		void dropBehind(std::uint64_t offset, std::size_t length)
+		{
+			m_dropPending.from = std::min(m_dropPending.from, offset);
+			m_dropPending.to = std::max(m_dropPending.to, offset + length);
+			m_dropPendingBytes += length;
+			if (m_dropPendingBytes < DROP_BEHIND_STEP) return;
+
+			release(m_dropFlushing, true);
+			m_file.writeBack(m_dropPending.from, m_dropPending.to - m_dropPending.from, false);
+			m_dropFlushing = m_dropPending;
+			m_dropPending = {};
+			m_dropPendingBytes = 0;
+		}
+
+		// The last steps, on finish: the one already writing back is dropped,
+		// the one still dirty starts writing back and whatever of it is clean goes
+		void finishDropBehind()
+		{
+			release(m_dropFlushing, true);
+			release(m_dropPending, false);
+			m_dropFlushing = m_dropPending = {};
+			m_dropPendingBytes = 0;
+		}
+
+		void release(const ByteSpan& span, bool wait)
+		{
+			if (span.from >= span.to || !m_file.isOpen()) return;
+			m_file.writeBack(span.from, span.to - span.from, wait);
+			m_file.dropCache(span.from, span.to - span.from);
+		}
+
+		// Adds the write to the journaled ranges and checkpoints them every
+		// m_checkpointInterval bytes
+		void advanceJournal(std::uint64_t offset, std::size_t length)
+		{
+			addCommitted(offset, offset + length);
+			m_uncheckpointed += length;
+
+			bool done = m_resumeState.offset >= m_resumeState.fileSize;
+			if (!done && m_uncheckpointed < m_checkpointInterval) return;
+			saveCheckpoint();
+		}
+
+		// [from, to) into m_resumeState: the prefix, if it reaches it, else a
+		// range past it, merged with its neighbours. A hole that fills lets the
+		// prefix take in the ranges beyond it.
+		void addCommitted(std::uint64_t from, std::uint64_t to)
+		{
+			auto& ranges = m_resumeState.ranges;
+			if (to <= m_resumeState.offset) return;
+			if (from <= m_resumeState.offset) {
+				m_resumeState.offset = to;
+			}
+			else {
+				auto first = std::lower_bound(ranges.begin(), ranges.end(), from, [](const auto& range, std::uint64_t at) { return range.second < at; });
+				auto last = first;
+				for (; last != ranges.end() && last->first <= to; ++last) {
+					from = std::min(from, last->first);
+					to = std::max(to, last->second);
+				}
+				ranges.insert(ranges.erase(first, last), { from, to });
+			}
+
+			auto reached = ranges.begin();
+			for (; reached != ranges.end() && reached->first <= m_resumeState.offset; ++reached) {
+				m_resumeState.offset = std::max(m_resumeState.offset, reached->second);
+			}
+			ranges.erase(ranges.begin(), reached);
+		}
+
+		void saveCheckpoint()
+		{
+			m_uncheckpointed = 0;
+#if !defined(_WIN32)
+			if (m_durability == Durability::GroupCommit) {
+				commitCheckpoint();
+				return;
+			}
+#endif
+			// Data first, then the record that vouches for it
+			if (std::error_code ec = flushMapped(true)) {
+				fail(ec);
+				return;
+			}
+			if (std::error_code ec = m_file.sync()) {
+				fail(ec);
+				return;
+			}
+			if (std::error_code ec = m_journal->save(m_resumeState)) {
+				CW_LOG_WARN("[Disk] Could not checkpoint ", m_journal->path().string(), ": ", ec.message());
+			}
+		}
+
+#if !defined(_WIN32)
+		// Group commit: the data rides the committer's next flush, shared with
+		// the files completing and the checkpoints due meanwhile, rather than an
+		// fdatasync per file; the record is saved once that flush is done.
+		// One in flight per file; a checkpoint due meanwhile follows it, even
+		// after finish() if that kept the journal.
+		void commitCheckpoint()
+		{
+			if (m_checkpointInFlight) {
+				m_checkpointAgain = true;
+				return;
+			}
+
+			// The mapping's pages are in the page cache the committer's flush writes out
+			if (std::error_code ec = flushMapped(false)) {
+				fail(ec);
+				return;
+			}
+
+			// A handle of its own, which outlives m_file past finish()
+			if (!m_checkpointFile) {
+				int fd = ::dup(m_file.native());
+				if (fd < 0) {
+					fail({ errno, std::system_category() });
+					return;
+				}
+				m_checkpointFile = std::make_shared<const FileHandle>(fd);
+			}
+			m_checkpointInFlight = true;
+			m_committer->add(m_checkpointFile, m_writePath.parent_path(), [self = shared_from_this(), state = m_resumeState](std::error_code ec) mutable
+				{
+					self->post([self, state = std::move(state), ec]()
+						{
+							self->m_checkpointInFlight = false;
+							// Still saved after finish() if it kept the journal: the data is synced
+							if (!self->m_journal) return;
+							if (ec) {
+								if (!self->m_finished) self->fail(ec);
+								return;
+							}
+							if (std::error_code saveEc = self->m_journal->save(state)) {
+								CW_LOG_WARN("[Disk] Could not checkpoint ", self->m_journal->path().string(), ": ", saveEc.message());
+							}
+							if (std::exchange(self->m_checkpointAgain, false)) self->commitCheckpoint();
+						});
+				});
+		}
+#endif
+
+		template<typename F>
+		void complete(F&& fn)
+		{
+			asio::post(m_callbackExecutor, std::forward<F>(fn));
+		}
+
+		// A write on the session timeline: "disk queue" from the bytes' arrival
+		// to the strand reaching them, "disk write" from there to the end.
+		// Counted in the stage profile as well.
+		class TimelineWrite
+		{
+		public:
+			TimelineWrite(cw::metrics::Clock::time_point arrived, std::uint64_t offset, std::uint64_t length)
+				: m_arrived(arrived),
+				m_offset(offset),
+				m_length(length)
+			{
+				if (cw::metrics::Timeline::instance().enabled()) m_started = cw::metrics::Clock::now();
+			}
+
+			~TimelineWrite()
+			{
+				if (m_started == cw::metrics::Clock::time_point{}) return;
+				auto& timeline = cw::metrics::Timeline::instance();
+				if (m_arrived != cw::metrics::Clock::time_point{}) timeline.span("disk queue", "disk", m_arrived, m_started, m_length, m_offset);
+				timeline.span("disk write", "disk", m_started, cw::metrics::Clock::now(), m_length, m_offset);
+			}
+
+			TimelineWrite(const TimelineWrite&) = delete;
+			TimelineWrite& operator=(const TimelineWrite&) = delete;
+
+		private:
+			cw::metrics::Clock::time_point m_arrived;
+			cw::metrics::Clock::time_point m_started;
+			std::uint64_t m_offset;
+			std::uint64_t m_length;
+			cw::metrics::StageTimer m_stage{ cw::metrics::Stage::DiskWrite };
+		};
+
+		void recordLatency(cw::metrics::Clock::time_point arrived)
+		{
+			if (arrived == cw::metrics::Clock::time_point{}) return;
+			auto took = cw::metrics::Clock::now() - arrived;
+			if (m_writeLatency) m_writeLatency->record(took);
+			m_load->record(took);
+		}
+
+		void addPending(std::size_t bytes)
+		{
+			m_pendingBytes += bytes;
+			m_load->add(bytes);
+			if (m_memory) m_memory->add(cw::buffer::MemoryUse::WriteBehind, bytes);
+		}
+
+		void removePending(std::size_t bytes)
+		{
+			if (m_memory) m_memory->remove(cw::buffer::MemoryUse::WriteBehind, bytes);
+			m_load->remove(bytes);
+			m_pendingBytes -= bytes;
+		}
+
+		void checkDrained()
+		{
+			if (!m_hasDrainWaiter.load(std::memory_order_acquire)) return;
+
+			std::lock_guard<std::mutex> lock(m_drainMutex);
+			std::erase_if(m_drainWaiters, [this](DrainWaiter& waiter)
+				{
+					if (m_pendingBytes > waiter.threshold) return false;
+					asio::post(m_callbackExecutor, std::move(waiter.fn));
+					return true;
+				});
+			m_hasDrainWaiter = !m_drainWaiters.empty();
+		}
+
+	private:
+		std::variant<PoolStrand, TenantStrand> m_strand;
+		std::shared_ptr<DirectoryCache> m_directories;
+		Durability m_durability;
+		std::shared_ptr<GroupCommitter> m_committer;
+		std::uint64_t m_directIoMinSize;
+		bool m_dropBehind;
+		bool m_mappedWrites;
+		std::uint64_t m_laneMinSize;
+		asio::any_io_executor m_callbackExecutor;
+		std::shared_ptr<DiskLoad> m_load;
+		std::unique_ptr<Resequencer> m_resequencer; // Ahead of m_strand, with a work pool
+		std::vector<std::unique_ptr<Lane>> m_lanes;  // With the writer's writeLanes (see laneFor)
+
+		// Disk-thread state (only touched on m_strand)
+		FileHandle m_file;
+		FileHandle m_direct;                     // Unbuffered handle to the same file, if any (see openDirect)
+		cw::buffer::PooledBuffer m_alignedScratch; // Unaligned chunks are copied here for m_direct
+		WritableMapping m_mapping;               // The whole file, with mapped writes (see openMapping)
+		ByteSpan m_mappedDirty;                  // Stored since the last msync (see mappedStored)
+		std::uint64_t m_mappedDirtyBytes = 0;
+
+		// Lanes (see laneFor)
+		bool m_useLanes = false;
+		std::size_t m_laneWrites = 0; // Sent to a lane, not landed yet
+		std::deque<std::pair<bool, std::move_only_function<void()>>> m_afterLanes; // Waiting for them (see sequence)
+
+		// Drop-behind (see dropBehind)
+		ByteSpan m_dropPending;  // Written since the last step
+		ByteSpan m_dropFlushing; // The step before, writing back
+		std::uint64_t m_dropPendingBytes = 0;
+		std::filesystem::path m_path;      // Final name
+		std::filesystem::path m_writePath; // Written under until published
+		std::uint64_t m_size = 0;
+		std::optional<FileAttributes> m_attributes; // See setAttributes
+		bool m_finished = false;
+		std::error_code m_error;
+		std::uint64_t m_bytesWritten = 0;
+
+		// Resumable transfers only (see openResumable)
+		std::optional<ResumeJournal> m_journal;
+		ResumeState m_resumeState;
+		std::uint64_t m_checkpointInterval = 0;
+		std::uint64_t m_uncheckpointed = 0;  // Bytes journaled since the last checkpoint
+		bool m_checkpointInFlight = false;  // Waiting on the group commit (see commitCheckpoint)
+		bool m_checkpointAgain = false;
+		std::shared_ptr<const FileHandle> m_checkpointFile; // A dup of m_file's, for the committer
+
+		std::atomic<std::size_t> m_pendingBytes = 0;
+		std::shared_ptr<cw::buffer::MemoryAccount> m_memory;
+		std::function<void(std::uint64_t)> m_onProgress;
+		std::shared_ptr<cw::metrics::LatencyHistogram> m_writeLatency;
+
+		struct DrainWaiter
+		{
+			std::size_t threshold;
+			std::function<void()> fn;
+		};
+
+		std::mutex m_drainMutex;
+		std::atomic<bool> m_hasDrainWaiter = false;
+		std::vector<DrainWaiter> m_drainWaiters;
+	};
+
+	// One small, complete file of a FileBatch. 'data' is a slice of the batch payload.
+	struct SmallFile
+	{
+		std::filesystem::path path;
+		cw::buffer::SharedBuffer data;
+		std::optional<FileAttributes> attributes = {}; // Set once written, before the rename (not through the CreateRing)
+	};
+
+#if defined(CW_HAS_CREATE_RING)
+	namespace detail {
+
+		// The files of a batch with a relative name through the disk thread's
+		// CreateRing, in as few submissions as it takes; marks those written
+		// in 'done' and returns their bytes. 'anchor' is set to a directory
+		// they are in, for the group flush (syncfs covers its file system).
+		// The rest, and any the ring failed, are left to the per-file path,
+		// which retries a removed parent and reports what still fails.
+		inline std::uint64_t createThroughRing(CreateRing& ring, DirectoryCache& directories, const std::vector<SmallFile>& files,
+			std::vector<bool>& done, std::shared_ptr<const FileHandle>& anchor)
+		{
+			std::vector<std::shared_ptr<const FileHandle>> parents(files.size());
+			std::vector<std::string> receiving(files.size()), names(files.size()); // Sized once: their c_str()s stay put
+			std::vector<CreateRing::File> batch;
+			std::vector<std::size_t> indexes;
+			int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (directories.confined() ? O_NOFOLLOW : 0);
+
+			for (std::size_t i = 0; i < files.size(); ++i) {
+				if (files[i].data.size() > CreateRing::MAX_FILE_SIZE || files[i].attributes) continue;
+				std::error_code ec;
+				parents[i] = directories.parentOf(files[i].path, ec);
+				if (ec || !parents[i]) continue;
+				receiving[i] = receivingPathFor(files[i].path).filename().string();
+				names[i] = files[i].path.filename().string();
+				batch.push_back({ parents[i]->native(), receiving[i].c_str(), names[i].c_str(), files[i].data.span(), flags });
+				indexes.push_back(i);
+			}
+			if (batch.empty()) return 0;
+
+			auto results = ring.write(batch);
+			std::uint64_t written = 0;
+			for (std::size_t k = 0; k < results.size(); ++k) {
+				if (results[k] != 0) continue;
+				std::size_t i = indexes[k];
+				done[i] = true;
+				written += files[i].data.size();
+				anchor = parents[i];
+			}
+			return written;
+		}
+	}
+#endif
+
+	// Creates and writes a whole batch of small files in one job on the pool:
+	// one task per batch instead of an open/write/close round trip per file, and
+	// parent directories come from the writer's DirectoryCache. Stops at the first error.
+	// On Linux 5.15 and later, unless each file is synced, the files are
+	// made through the disk thread's CreateRing: one io_uring submission per
+	// CreateRing::SLOTS files rather than four system calls per file.
+	// Each file is written under receivingPathFor and renamed once whole.
+	// 'onDone' is posted to 'callbackExecutor' with the number of bytes written,
+	// once the batch is as durable as the writer's Durability asks: PerFile
+	// syncs each file and each distinct directory; GroupCommit joins the
+	// batch to the next group flush on Linux (one syncfs covers every file
+	// of it) and syncs like PerFile elsewhere. The batch is one job of
+	// 'tenant', if given (see DiskWriter::enableFairShare).
+	inline void writeSmallFiles(DiskWriter& writer,
+		std::vector<SmallFile> files,
+		asio::any_io_executor callbackExecutor,
+		std::function<void(std::error_code, std::uint64_t bytesWritten)> onDone,
+		const std::shared_ptr<DiskTenant>& tenant = nullptr)
+	{
+		asio::post(writer.executor(tenant),
+			[files = std::move(files), directories = writer.directories(), durability = writer.durability(), committer = writer.groupCommitter(),
+			callbackExecutor = std::move(callbackExecutor), onDone = std::move(onDone)]() mutable
+			{
+				cw::metrics::StageTimer stage(cw::metrics::Stage::DiskWrite);
+				std::error_code ec;
+				std::uint64_t written = 0;
+				std::shared_ptr<const FileHandle> last; // Anchors the group flush
+				std::set<std::filesystem::path> parents;
+
+#if defined(__linux__)
+				bool syncEach = durability == Durability::PerFile;
+#else
+				bool syncEach = durability != Durability::None;
+#endif
+				std::vector<bool> done(files.size(), false);
+#if defined(CW_HAS_CREATE_RING)
+				if (!syncEach) {
+					if (auto* ring = CreateRing::forThisThread()) {
+						std::shared_ptr<const FileHandle> anchor;
+						written += detail::createThroughRing(*ring, *directories, files, done, anchor);
+						if (anchor && durability == Durability::GroupCommit) last = std::move(anchor);
+					}
+				}
+#endif
+				for (std::size_t i = 0; i < files.size(); ++i) {
+					if (done[i]) continue;
+					const auto& file = files[i];
+					auto receiving = receivingPathFor(file.path);
+					try {
+						FileHandle handle = directories->openWrite(receiving);
+						if (!file.data.empty()) ec = handle.writeAt(0, file.data.span());
+						if (!ec && file.attributes) handle.applyAttributes(*file.attributes); // Best effort, as for a streamed file
+						if (!ec && syncEach) ec = handle.sync();
+#if defined(_WIN32)
+						handle.close(); // Windows renames closed files only
+#endif
+						if (!ec) ec = directories->rename(receiving, file.path);
+						if (!ec && durability == Durability::GroupCommit && !syncEach) last = std::make_shared<const FileHandle>(std::move(handle));
+					}
+					catch (const std::system_error& e) {
+						ec = e.code();
+					}
+					if (ec) {
+						directories->remove(receiving);
+						break;
+					}
+
+					if (syncEach) parents.insert(file.path.parent_path());
+					written += file.data.size();
+				}
+
+				for (const auto& parent : parents) {
+					if (ec) break;
+					ec = directories->syncDirectory(parent);
+				}
+
+				if (!ec && last) {
+					committer->add(std::move(last), {}, [callbackExecutor, onDone = std::move(onDone), written](std::error_code ec)
+						{
+							asio::post(callbackExecutor, [onDone = std::move(onDone), ec, written]() { onDone(ec, written); });
+						});
+					return;
+				}
+				asio::post(callbackExecutor, [onDone = std::move(onDone), ec, written]() { onDone(ec, written); });
+			});
+	}
+}
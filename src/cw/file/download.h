@@ -0,0 +1,281 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+#include <asio/experimental/parallel_group.hpp>
+
+#include "cw/file/file.h"
+#include "cw/log/logger.h"
+
+namespace cw {
+
+	namespace detail {
+
+		// Bytes [start, start + length) of 'path' on the requested stream, as
+		// part of a file of 'fileSize' bytes that begins at 'base' in 'path':
+		// chunk offsets count from 'base'. A plain range is a file of its own
+		// (base = start, fileSize = length, announced by FileInfo); a slice of
+		// a striped request is one part of the range (StripeInfo). Chunks are
+		// read as for asyncSendFile, but never as kernel ranges (those carry
+		// file offsets).
+		inline asio::awaitable<void> asyncSendFileRange(std::shared_ptr<cw::network::Connection> conn,
+			fs::path path,
+			cw::packet::FileRequest request,
+			uint64_t start,
+			uint64_t length,
+			uint64_t base,
+			uint64_t fileSize,
+			TransferOptions options,
+			std::optional<asio::any_io_executor> fileExecutor)
+		{
+			options = negotiatedOptions(std::move(options), *conn);
+
+			uint32_t streamId = conn->openStream(request.streamId);
+			auto batch = conn->makeBatch(options.priority);
+			if (request.stripeCount > 1) {
+				cw::packet::StripeInfo infoPkt;
+				infoPkt.streamId = streamId;
+				infoPkt.transferId = request.transferId;
+				infoPkt.stripeCount = request.stripeCount;
+				infoPkt.fileSize = fileSize;
+				infoPkt.fileName = request.fileName;
+				batch.add(infoPkt);
+			}
+			else {
+				cw::packet::FileInfo infoPkt;
+				infoPkt.streamId = streamId;
+				infoPkt.fileName = request.fileName;
+				infoPkt.fileSize = fileSize;
+				batch.add(infoPkt);
+			}
+
+			auto ioExecutor = co_await asio::this_coro::executor;
+			auto mode = readModeFor(options, length);
+			if (mode == cw::file::ReadMode::KernelCopy) mode = cw::file::ReadMode::MemoryMap;
+			cw::file::ChunkSource source(path, mode);
+			source.seek(start);
+			source.setReadAhead(readAheadBytes(options));
+			source.setDropBehind(options.dropBehind);
+			source.setCache(options.chunkCache);
+			ChunkSizer sizer(options);
+
+			cw::integrity::FileDigest digest(fileSize);
+			if (options.checksums) conn->serveRetransmits(streamId, path, fileSize, base);
+
+			uint64_t offset = start - base;
+			uint64_t end = offset + length;
+			while (offset < end) {
+				auto chunkStart = std::chrono::steady_clock::now();
+				size_t chunkSize = static_cast<size_t>(std::min<uint64_t>(sizer.next(), end - offset));
+
+				if (conn->isCongested(options.priority)) {
+					conn->sendBatch(batch);
+					co_await conn->asyncWaitWritable(options.priority, asio::use_awaitable);
+				}
+				if (uint64_t target = ackWaitTarget(options, offset, chunkSize)) {
+					conn->sendBatch(batch);
+					co_await conn->asyncWaitAcked(streamId, target, asio::use_awaitable);
+				}
+
+				cw::packet::SharedFileChunk chunkPkt;
+				chunkPkt.streamId = streamId;
+				chunkPkt.offset = offset;
+
+				std::optional<cw::packet::CompressedChunk> compressed;
+				if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+				chunkPkt.data = source.next(chunkSize);
+				checksumChunk(options, chunkPkt);
+				compressed = compressChunk(options, *conn, chunkPkt);
+				if (fileExecutor) co_await asio::post(ioExecutor, asio::use_awaitable);
+
+				// The file shrank since the request was checked: the requester
+				// finds the stream short and fails the download
+				if (chunkPkt.data.empty()) break;
+
+				size_t bytesRead = chunkPkt.data.size();
+				if (chunkPkt.crc) digest.add(offset, bytesRead, *chunkPkt.crc);
+				if (compressed) batch.add(std::move(*compressed));
+				else batch.add(std::move(chunkPkt));
+
+				offset += bytesRead;
+				sizer.onChunkSent(bytesRead, std::chrono::steady_clock::now() - chunkStart);
+
+				if (offset >= end) break;
+				conn->sendBatch(batch);
+				if (!fileExecutor) co_await asio::post(ioExecutor, asio::use_awaitable);
+			}
+
+			cw::packet::FileDone donePkt;
+			donePkt.streamId = streamId;
+			donePkt.fileSize = fileSize;
+			if (options.checksums) donePkt.crc = digest.value();
+			batch.add(donePkt);
+			conn->sendBatch(batch);
+			conn->releaseStream(streamId);
+			CW_LOG_INFO("[Server] Served ", offset - (start - base), " bytes of ", path.generic_string(), " from byte ", start);
+		}
+	}
+
+	// Answers one FileRequest whose path resolved to 'path': the whole file
+	// goes exactly as asyncSendFile uploads it (kernel copy, mapping, holes,
+	// resume per 'options'), a range or one slice of a striped request
+	// through detail::asyncSendFileRange.
+	inline asio::awaitable<void> asyncServeDownload(std::shared_ptr<cw::network::Connection> conn,
+		cw::packet::FileRequest request,
+		fs::path path,
+		TransferOptions options = {},
+		std::optional<asio::any_io_executor> fileExecutor = std::nullopt)
+	{
+		std::error_code ec;
+		uint64_t fileSize = fs::file_size(path, ec);
+		if (!ec && request.stripeCount > 1 && request.stripeIndex >= request.stripeCount) ec = std::make_error_code(std::errc::invalid_argument);
+		if (ec) {
+			// Gone since it was resolved, or no such slice: refused, as a FileDone alone
+			CW_LOG_WARN("[Server] Cannot serve ", path.generic_string(), ": ", ec.message());
+			cw::packet::FileDone refused;
+			refused.streamId = request.streamId;
+			refused.fileSize = 0;
+			conn->send(refused);
+			co_return;
+		}
+
+		uint64_t start = std::min(request.offset, fileSize);
+		uint64_t length = request.length ? std::min(request.length, fileSize - start) : fileSize - start;
+
+		if (request.stripeCount > 1) {
+			// Even slices, the remainder in the last one
+			uint64_t slice = length / request.stripeCount;
+			uint64_t sliceStart = start + slice * request.stripeIndex;
+			uint64_t sliceLength = request.stripeIndex + 1 == request.stripeCount ? start + length - sliceStart : slice;
+			co_await detail::asyncSendFileRange(std::move(conn), std::move(path), std::move(request), sliceStart, sliceLength, start, length, std::move(options), fileExecutor);
+		}
+		else if (start == 0 && length == fileSize) {
+			options.streamId = request.streamId;
+			co_await asyncSendFile(std::move(conn), std::move(path), std::move(request.fileName), std::move(options), fileExecutor);
+		}
+		else {
+			co_await detail::asyncSendFileRange(std::move(conn), std::move(path), std::move(request), start, length, start, length, std::move(options), fileExecutor);
+		}
+	}
+
+	// Lets the peer of 'conn' download the files under 'roots' (see
+	// Connection::setDownloadRoots), each sent on its own coroutine on the
+	// connection's executor, with 'options' as an upload would be. Disk reads
+	// run on 'fileExecutor' when given. Call before conn.start().
+	inline void serveDownloads(cw::network::Connection& conn,
+		std::vector<fs::path> roots,
+		TransferOptions options = {},
+		std::optional<asio::any_io_executor> fileExecutor = std::nullopt)
+	{
+		conn.setDownloadRoots(std::move(roots),
+			[options = std::move(options), fileExecutor](std::shared_ptr<cw::network::Connection> conn, cw::packet::FileRequest request, fs::path path)
+			{
+				auto executor = conn->socket().get_executor();
+				asio::co_spawn(executor, asyncServeDownload(std::move(conn), std::move(request), std::move(path), options, fileExecutor),
+					[](std::exception_ptr error)
+					{
+						if (!error) return;
+						try {
+							std::rethrow_exception(error);
+						}
+						catch (const std::exception& e) {
+							CW_LOG_WARN("[Server] Download stopped: ", e.what());
+						}
+					});
+			});
+	}
+
+	// Fetches 'remotePath' (relative to a root the peer serves) into
+	// 'localName' (default: its file name), through the connection's file
+	// receiver as any received file: written to a temporary, verified, then
+	// published. 'offset' and 'length' (0 = to the end) select a range, which
+	// arrives as a file of its own. Returns the bytes written; throws
+	// std::system_error if the peer serves no downloads, refuses this one
+	// (no_such_file_or_directory) or the file fails.
+	inline asio::awaitable<uint64_t> asyncDownloadFile(std::shared_ptr<cw::network::Connection> conn,
+		std::string remotePath,
+		std::string localName = "",
+		uint64_t offset = 0,
+		uint64_t length = 0)
+	{
+		co_await conn->asyncWaitCapabilities(asio::use_awaitable);
+		if (!conn->peerServesDownloads()) {
+			throw std::system_error(std::make_error_code(std::errc::operation_not_supported), "The server serves no downloads");
+		}
+
+		cw::packet::FileRequest request;
+		request.path = remotePath;
+		request.fileName = localName.empty() ? fs::path(remotePath).filename().generic_string() : std::move(localName);
+		request.offset = offset;
+		request.length = length;
+
+		CW_LOG_INFO("[Client] Downloading ", remotePath, " as ", request.fileName, "...");
+		uint64_t bytes = co_await conn->asyncDownload(std::move(request), asio::use_awaitable);
+		CW_LOG_INFO("[Client] Download Complete. Received ", bytes, " bytes.");
+		co_return bytes;
+	}
+
+	// asyncDownloadFile over several connections at once, as HTTP range
+	// downloaders do: each asks for one slice of the range, and the slices
+	// are written in place into one file, joined as the stripes of an upload
+	// are (see StripeInfo), so K TCP streams fill a link one stream's window
+	// cannot. Slices are cut by the server, which knows the file's size.
+	// Falls back to asyncDownloadFile for one connection. Returns the bytes
+	// written; throws as asyncDownloadFile does if any slice fails, or with
+	// operation_aborted if a connection went away mid-file.
+	inline asio::awaitable<uint64_t> asyncDownloadFileParallel(std::vector<std::shared_ptr<cw::network::Connection>> conns,
+		std::string remotePath,
+		std::string localName = "",
+		uint64_t offset = 0,
+		uint64_t length = 0)
+	{
+		if (conns.empty()) throw std::invalid_argument("asyncDownloadFileParallel: no connections");
+		if (conns.size() == 1) co_return co_await asyncDownloadFile(conns.front(), std::move(remotePath), std::move(localName), offset, length);
+
+		for (auto& conn : conns) {
+			co_await conn->asyncWaitCapabilities(asio::use_awaitable);
+			if (!conn->peerServesDownloads()) {
+				throw std::system_error(std::make_error_code(std::errc::operation_not_supported), "The server serves no downloads");
+			}
+		}
+
+		cw::packet::FileRequest request;
+		request.path = remotePath;
+		request.fileName = localName.empty() ? fs::path(remotePath).filename().generic_string() : std::move(localName);
+		request.offset = offset;
+		request.length = length;
+		request.transferId = detail::newTransferId();
+		request.stripeCount = static_cast<uint16_t>(std::min<size_t>(conns.size(), UINT16_MAX));
+		conns.resize(request.stripeCount);
+
+		CW_LOG_INFO("[Client] Downloading ", remotePath, " as ", request.fileName, " over ", conns.size(), " streams...");
+
+		using Operation = decltype(conns.front()->asyncDownload(request, asio::deferred));
+		std::vector<Operation> operations;
+		for (uint16_t i = 0; i < request.stripeCount; ++i) {
+			request.stripeIndex = i;
+			operations.push_back(conns[i]->asyncDownload(request, asio::deferred));
+		}
+
+		// Every slice completes with how the whole file ended
+		auto [order, errors, written] = co_await asio::experimental::make_parallel_group(std::move(operations))
+			.async_wait(asio::experimental::wait_for_all(), asio::use_awaitable);
+
+		for (auto& ec : errors) {
+			if (ec) throw std::system_error(ec, "Download of " + remotePath + " failed");
+		}
+		uint64_t bytes = written.front();
+		CW_LOG_INFO("[Client] Download Complete. Received ", bytes, " bytes.");
+		co_return bytes;
+	}
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <asio.hpp>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cw/file/directory_cache.h"
+#include "cw/file/file_handle.h"
+
+namespace cw::file {
+
+	// When a received file counts as stored, and so when it is acked.
+	//   None:        once written to the page cache (a crash may lose it)
+	//   PerFile:     after fdatasync of the file and fsync of its directory
+	//   GroupCommit: files completing together share one flush: syncfs of
+	//                their file system on Linux, elsewhere an fsync of each
+	//                file and of each distinct directory, in one job
+	enum class Durability { None, PerFile, GroupCommit };
+
+	inline std::optional<Durability> parseDurability(const std::string& name)
+	{
+		if (name == "none") return Durability::None;
+		if (name == "file") return Durability::PerFile;
+		if (name == "group") return Durability::GroupCommit;
+		return std::nullopt;
+	}
+
+	// Group commit on the disk pool. A file that is complete is added with the
+	// handle it was written through; if no flush is running one starts at
+	// once, else the file waits for the next flush, which takes everything
+	// that arrived meanwhile. Under load each flush covers many files; an
+	// idle receiver pays the same as PerFile, without waiting for a timer.
+	class GroupCommitter : public std::enable_shared_from_this<GroupCommitter>
+	{
+	public:
+		using Callback = std::function<void(std::error_code)>;
+
+		struct Stats
+		{
+			std::uint64_t flushes = 0; // syncfs / fsync rounds
+			std::uint64_t files = 0;   // Files they covered
+		};
+
+		GroupCommitter(asio::any_io_executor executor, std::shared_ptr<DirectoryCache> directories)
+			: m_executor(std::move(executor)), m_directories(std::move(directories))
+		{
+		}
+
+		// 'onDurable' runs on a pool thread once the data 'file' holds, and
+		// its name in 'directory', are on stable storage. 'file' stays open until then.
+		void add(std::shared_ptr<const FileHandle> file, std::filesystem::path directory, Callback onDurable)
+		{
+			std::lock_guard lock(m_mutex);
+			m_pending.push_back({ std::move(file), std::move(directory), std::move(onDurable) });
+			if (m_flushing) return;
+
+			m_flushing = true;
+			asio::post(m_executor, [self = shared_from_this()]() { self->flush(); });
+		}
+
+		Stats stats() const { return { m_flushes.load(), m_files.load() }; }
+
+	private:
+		struct Entry
+		{
+			std::shared_ptr<const FileHandle> file;
+			std::filesystem::path directory;
+			Callback onDurable;
+		};
+
+		void flush()
+		{
+			for (;;) {
+				std::vector<Entry> group;
+				{
+					std::lock_guard lock(m_mutex);
+					if (m_pending.empty()) {
+						m_flushing = false;
+						return;
+					}
+					group.swap(m_pending);
+				}
+
+				std::error_code ec = syncGroup(group);
+				++m_flushes;
+				m_files += group.size();
+				for (auto& entry : group) entry.onDurable(ec);
+			}
+		}
+
+		std::error_code syncGroup(const std::vector<Entry>& group)
+		{
+#if defined(__linux__)
+			// One syncfs per file system: data, metadata and directory entries
+			// of everything written there, these files included
+			std::set<dev_t> devices;
+			for (const auto& entry : group) {
+				struct stat info;
+				if (::fstat(entry.file->native(), &info) != 0) return { errno, std::system_category() };
+				if (!devices.insert(info.st_dev).second) continue;
+				if (::syncfs(entry.file->native()) != 0) return { errno, std::system_category() };
+			}
+			return {};
+#else
+			std::error_code first;
+			std::set<std::filesystem::path> directories;
+			for (const auto& entry : group) {
+				if (auto ec = entry.file->sync(); ec && !first) first = ec;
+				directories.insert(entry.directory);
+			}
+			for (const auto& directory : directories) {
+				if (auto ec = m_directories->syncDirectory(directory); ec && !first) first = ec;
+			}
+			return first;
+#endif
+		}
+
+		asio::any_io_executor m_executor;
+		std::shared_ptr<DirectoryCache> m_directories;
+
+		std::mutex m_mutex;
+		std::vector<Entry> m_pending;
+		bool m_flushing = false;
+
+		std::atomic<std::uint64_t> m_flushes = 0;
+		std::atomic<std::uint64_t> m_files = 0;
+	};
+}
@@ -2,91 +2,1679 @@
 #include <string>
 #include <filesystem>
 #include <fstream>
-#include <iostream>
-#include <thread>
-#include <chrono>
 #include <memory>
+#include <optional>
+#include <chrono>
 #include <algorithm> // Required for std::replace
+#include <mutex>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
 
 // Adjust these includes to match your project structure
 #include "cw/network/Connection.h"
+#include "cw/network/client_pool.h"
 #include "cw/protocol/packet/packet.h"
+#include "cw/file/chunk_source.h"
+#include "cw/log/logger.h"
+#include "cw/metrics/progress.h"
+#include "cw/metrics/stage_profile.h"
+#include "cw/file/manifest.h"
+#include "cw/file/delta.h"
+#include "cw/file/dedup.h"
+#include "cw/compression/codec.h"
+#include "cw/compression/dictionary.h"
+#include "cw/buffer/zero_scan.h"
+#include "cw/integrity/checksum.h"
+#include "cw/integrity/tree_hash.h"
+#include "cw/integrity/chunk_cipher.h"
+#include "cw/work_pool.h"
 
 namespace cw {
 	namespace fs = std::filesystem;
 
-	inline void sendFile(std::shared_ptr<cw::network::Connection> conn, const std::string& filePath, const std::string& remoteFileName = "") {
+	constexpr size_t DEFAULT_CHUNK_SIZE = 256 * 1024;
+
+	// Per-upload tuning. Chunk sizes are clamped to the protocol's MAX_CHUNK_SIZE.
+	struct TransferOptions
+	{
+		size_t chunkSize = DEFAULT_CHUNK_SIZE;
+
+		// Adaptive mode starts at minChunkSize and doubles while measured
+		// throughput keeps improving, up to maxChunkSize.
+		bool adaptiveChunkSize = false;
+		size_t minChunkSize = 64 * 1024;
+		size_t maxChunkSize = 1024 * 1024;
+
+		// Serve chunks from a read-only mapping of files at least this large,
+		// instead of copying them through std::ifstream.
+		bool memoryMap = false;
+		uint64_t memoryMapMinSize = 1024 * 1024;
+
+		// Chunks of the file the kernel is asked to read into the page cache
+		// ahead of the one being sent (see ChunkSource::setReadAhead), so a slow
+		// disk (HDD-backed archives) reads while earlier chunks are on the
+		// wire. 0 = only the kernel's own sequential read-ahead.
+		size_t readAheadChunks = 4;
+
+		// Read files at least directIoMinSize bytes unbuffered (O_DIRECT,
+		// FILE_FLAG_NO_BUFFERING; see ReadMode::Direct): a huge file sent once
+		// streams past the page cache instead of evicting the rest of it.
+		// Where the filesystem cannot, reads fall back to the stream.
+		bool directIo = false;
+		uint64_t directIoMinSize = 64 * 1024 * 1024;
+
+		// Lighter than directIo: the pages of what has been sent are dropped
+		// from the page cache behind the transfer (see ChunkSource::setDropBehind),
+		// so streaming a file keeps a bounded cache footprint.
+		bool dropBehind = false;
+
+		// Raw uploads only: chunk payloads are pushed by the kernel from the file
+		// to the socket (sendfile / TransmitFile) and never touch user space.
+		bool kernelCopy = false;
+
+		// Chunks read are kept in, and served again from, this cache (see
+		// cw::file::ChunkCache): for servers sending the same files to many
+		// peers, downloads and relays. With one, files are read into buffers
+		// (or unbuffered, with directIo) rather than mapped or kernel-copied.
+		std::shared_ptr<cw::file::ChunkCache> chunkCache;
+
+		// Striped uploads (several connections): smaller files use a single connection.
+		uint64_t stripeMinSize = 8 * 1024 * 1024;
+
+		// End-to-end flow control: at most this many bytes of a file are sent
+		// beyond what the receiver has acked as written to disk (0 = off).
+		// Raised to at least ACK_INTERVAL + one chunk. Not used by striped uploads.
+		uint64_t ackWindowBytes = 32 * 1024 * 1024;
+
+		// Directory uploads: files up to batchMaxFileSize are bundled into FileBatch
+		// frames of at most batchMaxBytes instead of being sent one by one (0 = off).
+		size_t batchMaxFileSize = 64 * 1024;
+		size_t batchMaxBytes = 1024 * 1024;
+
+		// Single-file uploads: a file of at most inlineMaxFileSize bytes goes
+		// whole inside its FileInfo to a receiver that announced
+		// CAP_INLINE_FILES, which creates, writes and closes it in one disk
+		// job: one frame instead of FileInfo, FileChunk and FileDone. Not with
+		// chunkKey, compression, treeHash or kernelCopy (0 = off; at most
+		// cw::packet::MAX_INLINE_FILE_SIZE).
+		size_t inlineMaxFileSize = 16 * 1024;
+
+		// Announce single-stream uploads with FileResume: if the server holds a
+		// checkpointed partial copy of the same source, only the rest is sent.
+		bool resume = false;
+
+		// Files at least serverCopyMinSize bytes go as a path (FileCopy) to a
+		// receiver that can read them itself, shared or local storage it has
+		// opted in (CAP_SERVER_COPY), and it copies them by reflink or
+		// copy_file_range; whatever it refuses or cannot copy is streamed.
+		// serverCopyPathMap rewrites a prefix of this end's absolute paths to
+		// where the receiver mounts the same storage: {"/mnt/share", "/srv/share"}.
+		bool serverCopy = false;
+		uint64_t serverCopyMinSize = 1024 * 1024;
+		std::vector<std::pair<fs::path, fs::path>> serverCopyPathMap;
+
+		// Files at least deltaMinSize bytes are sent as an rsync-style delta
+		// against the server's existing copy (see asyncSendDelta).
+		bool delta = false;
+		uint64_t deltaMinSize = 1024 * 1024;
+
+		// Files at least dedupMinSize bytes are split into content-defined chunks
+		// and only those missing from the server's chunk store are sent (see asyncSendDedup).
+		bool dedup = false;
+		uint64_t dedupMinSize = 256 * 1024;
+
+		// Per-chunk compression, used once the receiver has announced the codec.
+		// Chunks that fail the entropy check or do not shrink go raw.
+		// Level 0 picks the codec's default. Not used with kernelCopy.
+		cw::compression::Codec compression = cw::compression::Codec::None;
+		int compressionLevel = 0;
+
+		// Directory uploads: each FileBatch is compressed as one, with
+		// 'compression', to a receiver that takes CompressedBatch. With a
+		// batchDictionary (trained on files like those of the tree) zstd
+		// is used with it instead, whatever 'compression' says, where the
+		// receiver has zstd; it goes to each connection once, ahead of the
+		// first batch. Small files share little with themselves and much
+		// with each other, so this is where they shrink.
+		std::shared_ptr<const cw::compression::Dictionary> batchDictionary;
+
+		// Chunks are checksummed, hashed and compressed on this pool, several
+		// at a time, and sent in file order as each is done: one file's
+		// compression is no longer held to one core. Reads stay on the file
+		// executor. Not used with kernelCopy.
+		std::shared_ptr<WorkPool> workPool;
+
+		// Holes of sparse files (disk images) of at least sparseMinHole bytes
+		// are sent as FileHole ranges instead of chunks of zeros, to a receiver
+		// that announced CAP_SPARSE_FILES, and stay holes there. Single-stream uploads.
+		// Chunks that turn out to be all zeros go as FileHole too (same receiver
+		// capability), even in files that are not sparse.
+		bool sparse = true;
+		uint64_t sparseMinHole = 64 * 1024;
+		bool elideZeroChunks = true;
+
+		// Every chunk carries a CRC32C and FileDone a digest of the whole stream;
+		// the receiver has corrupt chunks resent. Unavailable with kernelCopy
+		// (the bytes never reach user space).
+		bool checksums = true;
+
+		// Every chunk is also hashed (SHA-256, where it was read) into a
+		// cw::integrity::TreeHash whose root and leaves go ahead of FileDone,
+		// to a receiver that announced CAP_TREE_HASH: a cryptographic check of
+		// the stream on top of the CRCs, which also names the chunks to resend.
+		// Single-stream and striped uploads; not with kernelCopy.
+		bool treeHash = false;
+
+		// Chunks go sealed (SealedChunk: AES-256-GCM or ChaCha20-Poly1305
+		// under a key derived from this one per file) to a receiver holding
+		// the same key (CAP_SEALED_CHUNKS); one without it fails the upload.
+		// For transports TLS does not cover: names and sizes still go in the
+		// clear. The tag replaces checksums and treeHash; small files are
+		// not batched, and delta, dedup and kernelCopy are not used.
+		std::shared_ptr<const cw::integrity::ChunkKey> chunkKey;
+
+		// The file's mtime and permission bits go ahead of FileDone, to a
+		// receiver that announced CAP_FILE_ATTRIBUTES, which sets them on its
+		// copy. Single-stream uploads.
+		bool attributes = true;
+
+		// Scheduling class of the upload's frames on a connection it shares
+		// with other transfers (see Connection::send): an Urgent file (a job
+		// manifest) overtakes the queued chunks of a Background one.
+		cw::packet::Priority priority = cw::packet::Priority::Normal;
+
+		// Single-stream uploads: the stream to send on, when the peer picked it
+		// (a download it asked for, see cw::serveDownloads); 0 allocates one
+		uint32_t streamId = 0;
+
+		// A receiver that announced CAP_ADMISSION_CONTROL may refuse a new
+		// file while its disk is behind (ErrorCode::Busy). The file is then
+		// held until acked and sent again up to busyRetries times, after the
+		// wait the receiver asked for or a backoff doubling from busyBackoff,
+		// whichever is longer. 0: a refused file is not sent again. asyncSendFile.
+		unsigned busyRetries = 8;
+		std::chrono::milliseconds busyBackoff{ 250 };
+
+		// A busy receiver may name a peer server with room (Error::redirect,
+		// see cw::network::LoadGossip): the file is then sent there instead,
+		// once, over a connection from this pool, while the rest of the job
+		// stays where it was. Null = the file waits for the receiver as above.
+		std::shared_ptr<cw::network::ClientPool> redirectPool;
+
+		// Counted into as the upload goes, a chunk at a time, and as the
+		// receiver acks it (see cw::metrics::ProgressMeter); null = not counted
+		std::shared_ptr<cw::metrics::TransferProgress> progress;
+	};
+
+	// Picks the size of the next chunk.
+	// Throughput is measured over windows of CHUNKS_PER_WINDOW chunks (the time
+	// includes backpressure waits, so it tracks what the socket really drains).
+	// The size doubles while a window beats the previous one by more than 5%,
+	// and steps back once if a bigger size turned out slower.
+	class ChunkSizer
+	{
+	public:
+		static constexpr size_t CHUNKS_PER_WINDOW = 8;
+
+		explicit ChunkSizer(const TransferOptions& options)
+			: m_adaptive(options.adaptiveChunkSize),
+			m_min(clamp(options.minChunkSize)),
+			m_max(std::max(m_min, clamp(options.maxChunkSize))),
+			m_current(options.adaptiveChunkSize ? m_min : clamp(options.chunkSize))
+		{
+		}
+
+		size_t next() const { return m_current; }
+
+		void onChunkSent(size_t bytes, std::chrono::steady_clock::duration elapsed)
+		{
+			if (!m_adaptive || m_settled) return;
+
+			m_windowBytes += bytes;
+			m_windowTime += elapsed;
+			if (++m_windowChunks < CHUNKS_PER_WINDOW) return;
+
+			double seconds = std::chrono::duration<double>(m_windowTime).count();
+			double throughput = seconds > 0 ? m_windowBytes / seconds : 0.0;
+
+			if (throughput > m_bestThroughput * 1.05) {
+				m_bestThroughput = throughput;
+				if (m_current < m_max) m_current = std::min(m_current * 2, m_max);
+				else m_settled = true;
+			}
+			else {
+				// Growing no longer pays off: return to the last good size and stop probing
+				if (m_current > m_min) m_current /= 2;
+				m_settled = true;
+			}
+
+			m_windowBytes = 0;
+			m_windowTime = {};
+			m_windowChunks = 0;
+		}
+
+	private:
+		static size_t clamp(size_t size)
+		{
+			return std::clamp<size_t>(size, 1, cw::packet::MAX_CHUNK_SIZE);
+		}
+
+	private:
+		bool m_adaptive;
+		size_t m_min;
+		size_t m_max;
+		size_t m_current;
+
+		bool m_settled = false;
+		double m_bestThroughput = 0.0;
+		size_t m_windowBytes = 0;
+		size_t m_windowChunks = 0;
+		std::chrono::steady_clock::duration m_windowTime{};
+	};
+
+	namespace detail {
+
+		// Name announced to the server. Separators are normalized to '/'
+		// so Windows clients can send to Linux servers correctly.
+		inline std::string remoteNameFor(const fs::path& path, std::string remoteFileName)
+		{
+			if (remoteFileName.empty()) remoteFileName = path.filename().generic_string();
+
+			std::replace(remoteFileName.begin(), remoteFileName.end(), '\\', '/');
+			return remoteFileName;
+		}
+
+		// remoteNameFor(path, relativePath) into 'out', reusing its capacity: a
+		// worker sending many files keeps one buffer and builds no temporary
+		// strings per file
+		inline void remoteNameInto(std::string& out, const fs::path& path, const fs::path& relativePath)
+		{
+			auto assign = [&out](const fs::path& name)
+				{
+					if constexpr (std::is_same_v<fs::path::value_type, char>) out.assign(name.native());
+					else out = name.generic_string();
+				};
+			if (relativePath.empty()) assign(path.filename());
+			else assign(relativePath);
+
+			std::replace(out.begin(), out.end(), '\\', '/');
+		}
+
+		// ChunkSource read-ahead window for options.readAheadChunks chunks
+		inline size_t readAheadBytes(const TransferOptions& options)
+		{
+			size_t chunk = options.adaptiveChunkSize ? options.maxChunkSize : options.chunkSize;
+			return options.readAheadChunks * std::min(chunk, cw::packet::MAX_CHUNK_SIZE);
+		}
+
+		inline cw::file::ReadMode readModeFor(const TransferOptions& options, uint64_t fileSize)
+		{
+			if (options.kernelCopy && !options.chunkCache) return cw::file::ReadMode::KernelCopy;
+			if (options.directIo && fileSize >= options.directIoMinSize) return cw::file::ReadMode::Direct;
+			if (options.chunkCache) return cw::file::ReadMode::Stream;
+			if (options.memoryMap && fileSize >= options.memoryMapMinSize) return cw::file::ReadMode::MemoryMap;
+			return cw::file::ReadMode::Stream;
+		}
+
+		// Per-chunk CRC32C (options.checksums), computed where the chunk was read
+		// while its bytes are still in cache.
+		inline void checksumChunk(const TransferOptions& options, cw::packet::SharedFileChunk& chunk)
+		{
+			if (!options.checksums || chunk.data.empty()) return;
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Hash);
+			chunk.crc = cw::integrity::crc32c(chunk.data.span());
+		}
+
+		// The chunk's TreeHash leaf (options.treeHash), likewise hashed where
+		// it was read; the sending coroutine adds it to the tree
+		inline std::optional<cw::integrity::Sha256Digest> hashChunk(const TransferOptions& options, const cw::packet::SharedFileChunk& chunk)
+		{
+			if (!options.treeHash || chunk.data.empty()) return std::nullopt;
+			return cw::integrity::TreeHash::hashLeaf(chunk.offset, chunk.data.span());
+		}
+
+		// What goes ahead of the FileDone of 'path' (read as it ends, so a
+		// touch during the upload shows), or nullopt if not asked for or the
+		// file is gone
+		inline std::optional<cw::packet::FileAttributes> attributesFor(const TransferOptions& options, uint32_t streamId, const fs::path& path)
+		{
+			if (!options.attributes) return std::nullopt;
+			std::error_code ec;
+			auto status = fs::status(path, ec);
+			if (ec) return std::nullopt;
+			auto modified = fs::last_write_time(path, ec);
+			if (ec) return std::nullopt;
+
+			cw::packet::FileAttributes attributes;
+			attributes.streamId = streamId;
+			attributes.modifiedNs = cw::file::modifiedNs(modified);
+			attributes.mode = static_cast<std::uint32_t>(status.permissions() & fs::perms::all);
+			return attributes;
+		}
+
+		// A file of 'fileSize' bytes may go inline (see TransferOptions::inlineMaxFileSize)
+		inline bool mayInline(const TransferOptions& options, const cw::network::Connection& conn, uint64_t fileSize)
+		{
+			return fileSize <= std::min<uint64_t>(options.inlineMaxFileSize, cw::packet::MAX_INLINE_FILE_SIZE) && conn.peerTakesInlineFiles()
+				&& !options.chunkKey && !conn.peerAccepts(options.compression) && !options.treeHash && !options.kernelCopy;
+		}
+
+		// Reads 'path' into the extensions of 'info' that carry it whole, with
+		// its CRC and attributes as options ask; false (and 'info' left as it
+		// was) if it is no longer 'fileSize' bytes, to go as chunks instead
+		inline bool readInline(const TransferOptions& options, const fs::path& path, uint64_t fileSize, cw::packet::FileInfo& info)
+		{
+			std::vector<uint8_t> content(static_cast<size_t>(fileSize));
+			{
+				cw::metrics::StageTimer stage(cw::metrics::Stage::Read);
+				std::ifstream in(path, std::ios::binary);
+				if (!in.read(reinterpret_cast<char*>(content.data()), static_cast<std::streamsize>(content.size())) || in.peek() != std::ifstream::traits_type::eof()) return false;
+			}
+
+			info.extensions.set(cw::packet::FILE_INFO_CONTENT, content);
+			if (options.checksums && !content.empty()) {
+				cw::metrics::StageTimer stage(cw::metrics::Stage::Hash);
+				info.extensions.setInteger(cw::packet::FILE_INFO_CONTENT_CRC, cw::integrity::crc32c(content));
+			}
+			if (auto attributes = attributesFor(options, info.streamId, path)) {
+				uint8_t value[sizeof(int64_t) + sizeof(uint32_t)];
+				cw::binary::writeBigEndian(value, static_cast<uint64_t>(attributes->modifiedNs));
+				cw::binary::writeBigEndian(value + sizeof(int64_t), attributes->mode);
+				info.extensions.set(cw::packet::FILE_INFO_ATTRIBUTES, value);
+			}
+			return true;
+		}
+
+		// What goes ahead of the FileDone of a stream hashed into 'tree'
+		inline cw::packet::TreeDigest treeDigestFor(uint32_t streamId, const cw::integrity::TreeHash& tree)
+		{
+			cw::packet::TreeDigest digest;
+			digest.streamId = streamId;
+			digest.root = tree.root();
+			if (tree.size() <= cw::packet::MAX_TREE_LEAVES) digest.leaves = tree.leaves();
+			return digest;
+		}
+
+		// Compressed form of 'batch' as one (see TransferOptions::batchDictionary),
+		// or nullopt if the peer takes no compressed batches or it does not pay
+		// off. CPU-bound, like compressChunk.
+		inline std::optional<cw::packet::CompressedBatch> compressBatch(const TransferOptions& options,
+			const cw::network::Connection& conn, const cw::packet::FileBatch& batch)
+		{
+			const auto& dictionary = options.batchDictionary;
+			bool withDictionary = dictionary && conn.peerAccepts(cw::compression::Codec::Zstd);
+			if (!conn.peerTakesCompressedBatches() || (!withDictionary && !conn.peerAccepts(options.compression))) return std::nullopt;
+
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Compress);
+			std::vector<uint8_t> payload(batch.payloadSize());
+			cw::binary::ByteWriter out(payload.data());
+			batch.serialize(out);
+			if (!cw::compression::looksCompressible(payload)) return std::nullopt;
+
+			auto compressed = withDictionary ? dictionary->compress(payload)
+				: cw::compression::compress(options.compression, payload, options.compressionLevel);
+			if (!compressed) return std::nullopt;
+
+			cw::packet::CompressedBatch packet;
+			packet.codec = static_cast<uint8_t>(withDictionary ? cw::compression::Codec::Zstd : options.compression);
+			packet.dictionaryId = withDictionary ? dictionary->id() : 0;
+			packet.rawSize = static_cast<uint32_t>(payload.size());
+			packet.data = std::move(*compressed);
+			return packet;
+		}
+
+		// Compressed form of 'chunk' if the peer accepts options.compression and it
+		// pays off, else nullopt (send the chunk as is). CPU-bound: call it on the
+		// file executor, not the network thread.
+		inline std::optional<cw::packet::CompressedChunk> compressChunk(const TransferOptions& options,
+			const cw::network::Connection& conn, const cw::packet::SharedFileChunk& chunk)
+		{
+			if (!conn.peerAccepts(options.compression)) return std::nullopt;
+
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Compress);
+			if (!cw::compression::looksCompressible(chunk.data.span())) return std::nullopt;
+			auto compressed = cw::compression::compress(options.compression, chunk.data.span(), options.compressionLevel);
+			if (!compressed) return std::nullopt;
+
+			cw::packet::CompressedChunk packet;
+			packet.streamId = chunk.streamId;
+			packet.offset = chunk.offset;
+			packet.codec = static_cast<uint8_t>(options.compression);
+			packet.rawSize = static_cast<uint32_t>(chunk.data.size());
+			packet.data = cw::buffer::SharedBuffer::fromVector(std::move(*compressed));
+			packet.crc = chunk.crc;
+			return packet;
+		}
+
+		// The cipher a file's chunks are sealed with (options.chunkKey), under a
+		// salt of its own; null without a key
+		inline std::shared_ptr<const cw::integrity::ChunkCipher> cipherFor(const TransferOptions& options)
+		{
+			if (!options.chunkKey) return nullptr;
+			return cw::integrity::ChunkCipher::derive(*options.chunkKey, cw::integrity::ChunkCipher::newSalt(), cw::integrity::preferredChunkCipherSuite());
+		}
+
+		// 'chunk' sealed with 'cipher', in its 'compressed' form if it has one.
+		// CPU-bound, like compressChunk.
+		inline cw::packet::SealedChunk sealChunk(const cw::integrity::ChunkCipher& cipher, const cw::packet::SharedFileChunk& chunk,
+			const std::optional<cw::packet::CompressedChunk>& compressed)
+		{
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Hash);
+			cw::packet::SealedChunk packet;
+			packet.streamId = chunk.streamId;
+			packet.offset = chunk.offset;
+			packet.suite = static_cast<uint8_t>(cipher.suite());
+			packet.codec = compressed ? compressed->codec : static_cast<uint8_t>(cw::compression::Codec::None);
+			packet.rawSize = static_cast<uint32_t>(chunk.data.size());
+			packet.salt = cipher.salt();
+
+			auto plain = compressed ? compressed->data.span() : chunk.data.span();
+			cw::buffer::PooledBuffer sealed(cw::integrity::ChunkCipher::sealedSize(plain.size()));
+			if (!cipher.seal(chunk.offset, cipher.associatedData(chunk.offset, packet.codec, packet.rawSize), plain, sealed.span())) {
+				throw std::runtime_error("SealedChunk: sealing failed.");
+			}
+			packet.data = std::move(sealed).share();
+			return packet;
+		}
+
+		// KernelCopy mode: queue the next file range as a sendfile frame, or over
+		// a local socket as the file's descriptor. Returns its size, 0 at EOF.
+		inline size_t sendNextRange(cw::network::Connection& conn, uint32_t streamId, cw::file::ChunkSource& source, uint64_t offset, size_t chunkSize,
+			cw::packet::Priority priority)
+		{
+			cw::packet::FileRangeChunk chunkPkt;
+			chunkPkt.streamId = streamId;
+			chunkPkt.offset = offset;
+			chunkPkt.segment = source.nextSegment(chunkSize);
+
+			if (chunkPkt.segment.empty()) return 0;
+
+			if (conn.passesDescriptors()) {
+				cw::packet::FileRange range;
+				range.streamId = streamId;
+				range.offset = offset;
+				range.sourceOffset = chunkPkt.segment.offset;
+				range.length = static_cast<uint32_t>(chunkPkt.segment.length);
+				range.file = chunkPkt.segment.file;
+				conn.send(range, priority);
+			}
+			else {
+				conn.send(chunkPkt, priority);
+			}
+			return chunkPkt.segment.length;
+		}
+
+		// Progress of the upload, if it is counted: 'bytes' more of a file sent
+		inline void reportSent(const TransferOptions& options, uint64_t bytes)
+		{
+			if (options.progress) options.progress->onSent(bytes);
+		}
+
+		inline void reportFileSent(const TransferOptions& options)
+		{
+			if (options.progress) options.progress->onFilesSent(1);
+		}
+
+		// Has the acks of 'streamId' credited to the upload's progress. 'from'
+		// bytes the receiver already had (resumed, copied) count as done.
+		// 'stream', when given, is the file's progress from an earlier
+		// connection, which it continues.
+		inline void reportStream(const TransferOptions& options, cw::network::Connection& conn, uint32_t streamId, uint64_t fileSize, uint64_t from = 0,
+			std::shared_ptr<cw::metrics::StreamProgress> stream = nullptr)
+		{
+			if (stream) {
+				stream->skipTo(from);
+				conn.reportProgress(streamId, std::move(stream));
+				return;
+			}
+			if (!options.progress) return;
+			if (from > 0) options.progress->onSkipped(from);
+			conn.reportProgress(streamId, std::make_shared<cw::metrics::StreamProgress>(options.progress, fileSize, 1, from));
+		}
+
+		// Connections a single file may go through before its upload gives up
+		constexpr unsigned MAX_FILE_RECONNECTS = 16;
+
+		constexpr std::chrono::milliseconds MAX_BUSY_BACKOFF{ 30'000 };
+
+		// How long to wait before the retry after refusal 'refusal' (from 0) of
+		// a busy receiver: what it asked for or the doubled backoff, whichever is
+		// longer, plus up to a quarter more at random, so the senders it
+		// refused together do not all come back together
+		inline std::chrono::milliseconds busyDelay(const TransferOptions& options, const cw::network::Connection& conn, unsigned refusal)
+		{
+			auto backoff = std::min(MAX_BUSY_BACKOFF, options.busyBackoff * (1u << std::min(refusal, 16u)));
+			auto delay = std::max(backoff, conn.busyRetryAfter());
+			thread_local std::minstd_rand generator{ std::random_device{}() };
+			return delay + std::chrono::milliseconds(std::uniform_int_distribution<std::int64_t>(0, delay.count() / 4)(generator));
+		}
+
+		// Ack offset the sender must wait for before sending 'chunkSize' more bytes
+		// at 'offset', or 0 if the window still has room.
+		inline uint64_t ackWaitTarget(const TransferOptions& options, uint64_t offset, size_t chunkSize)
+		{
+			if (options.ackWindowBytes == 0) return 0;
+
+			// The receiver acks every ACK_INTERVAL bytes, so a smaller window could stall
+			uint64_t window = std::max<uint64_t>(options.ackWindowBytes, cw::packet::ACK_INTERVAL + chunkSize);
+			uint64_t end = offset + chunkSize;
+			return end > window ? end - window : 0;
+		}
+
+		// The receiver failed 'streamId' (an Error naming it): the stream is let
+		// go and the upload ends with that error
+		inline void throwIfStreamFailed(cw::network::Connection& conn, uint32_t streamId)
+		{
+			if (std::error_code ec = conn.streamError(streamId)) {
+				conn.releaseStream(streamId);
+				throw std::system_error(ec);
+			}
+		}
+
+		// asyncWaitAcked that lets the stream go before throwing (a failed
+		// stream, a lost connection)
+		inline asio::awaitable<void> waitAcked(cw::network::Connection& conn, uint32_t streamId, uint64_t offset)
+		{
+			std::error_code ec;
+			co_await conn.asyncWaitAcked(streamId, offset, asio::redirect_error(asio::use_awaitable, ec));
+			if (ec) {
+				conn.releaseStream(streamId);
+				throw std::system_error(ec);
+			}
+		}
+
+		inline cw::packet::FileResume resumePacketFor(uint32_t streamId, const fs::path& path, const std::string& nameToSend, uint64_t fileSize)
+		{
+			cw::packet::FileResume resumePkt;
+			resumePkt.streamId = streamId;
+			resumePkt.fileSize = fileSize;
+			resumePkt.fingerprint = cw::file::fileFingerprint(path, fileSize);
+			resumePkt.fileName = nameToSend;
+			return resumePkt;
+		}
+
+		// 'options' within what the receiver asked for in its Capabilities:
+		// chunks no larger than its maxChunkSize, no more unacked bytes than its
+		// receiveWindow. Unchanged while those have not arrived.
+		inline TransferOptions negotiatedOptions(TransferOptions options, const cw::network::Connection& conn)
+		{
+			if (size_t maxChunk = conn.peerMaxChunkSize()) {
+				options.chunkSize = std::min(options.chunkSize, maxChunk);
+				options.minChunkSize = std::min(options.minChunkSize, maxChunk);
+				options.maxChunkSize = std::min(options.maxChunkSize, maxChunk);
+			}
+			if (uint64_t window = conn.peerReceiveWindow()) {
+				options.ackWindowBytes = options.ackWindowBytes ? std::min(options.ackWindowBytes, window) : window;
+			}
+			if (!conn.peerChecksTreeHash()) options.treeHash = false;
+			if (!conn.peerSetsAttributes()) options.attributes = false;
+			if (options.chunkKey) {
+				if (!conn.peerTakesSealedChunks()) throw std::system_error(std::make_error_code(std::errc::operation_not_supported), "peer does not take sealed chunks");
+				options.kernelCopy = false;
+				options.checksums = false;
+				options.treeHash = false;
+				options.batchMaxFileSize = 0;
+				options.delta = false;
+				options.dedup = false;
+			}
+			return options;
+		}
+
+		// A chunk just read that should go as a FileHole: all zeros, to a
+		// receiver that takes holes. Checked before the chunk is checksummed
+		// or compressed, which it then needs neither.
+		inline bool isZeroChunk(const TransferOptions& options, const cw::network::Connection& conn, const cw::buffer::SharedBuffer& data)
+		{
+			return options.elideZeroChunks && conn.peerTakesHoles() && cw::buffer::isAllZero(data.span());
+		}
+
+		inline void sendZeros(cw::network::Connection& conn, uint32_t streamId, uint64_t offset, uint64_t length, cw::packet::Priority priority)
+		{
+			cw::packet::FileHole hole;
+			hole.streamId = streamId;
+			hole.offset = offset;
+			hole.length = length;
+			conn.send(hole, priority);
+		}
+
+		// A chunk as read, and what is done to it before it is sent; a chunk of
+		// zeros is neither checksummed nor compressed: it goes as a FileHole
+		struct PreparedChunk
+		{
+			cw::packet::SharedFileChunk chunk;
+			std::optional<cw::packet::CompressedChunk> compressed;
+			std::shared_ptr<const cw::integrity::ChunkCipher> cipher; // The file's, with options.chunkKey
+			std::optional<cw::packet::SealedChunk> sealed;
+			std::optional<cw::integrity::Sha256Digest> leaf;
+			bool zeros = false;
+			std::chrono::steady_clock::time_point start;
+		};
+
+		// Thread-safe: run on the file executor or a WorkPool
+		inline void prepareChunk(const TransferOptions& options, const cw::network::Connection& conn, PreparedChunk& prepared)
+		{
+			prepared.zeros = isZeroChunk(options, conn, prepared.chunk.data);
+			if (prepared.zeros) return;
+			checksumChunk(options, prepared.chunk);
+			prepared.leaf = hashChunk(options, prepared.chunk);
+			prepared.compressed = compressChunk(options, conn, prepared.chunk);
+			if (prepared.cipher) prepared.sealed = sealChunk(*prepared.cipher, prepared.chunk, prepared.compressed);
+		}
+
+		// Chunks prepared on the pool at once, each kept until those before it are sent
+		inline size_t workDepth(const TransferOptions& options)
+		{
+			return options.workPool ? std::clamp<size_t>(options.workPool->threads(), 2, 16) : 0;
+		}
+
+		// The holes of 'path' past 'offset' to send as FileHole, if any
+		inline std::vector<cw::file::FileExtent> holesFor(const TransferOptions& options, const cw::network::Connection& conn,
+			const fs::path& path, uint64_t offset, uint64_t fileSize)
+		{
+			if (!options.sparse || !conn.peerTakesHoles() || fileSize - std::min(offset, fileSize) < options.sparseMinHole) return {};
+
+			std::vector<cw::file::FileExtent> holes;
+			try {
+				holes = cw::file::findHoles(cw::file::FileHandle::openRead(path), fileSize, options.sparseMinHole);
+			}
+			catch (const std::system_error&) {
+				return {};
+			}
+
+			// A resumed upload: only what is left of the holes it has not reached
+			std::erase_if(holes, [offset](const cw::file::FileExtent& hole) { return hole.offset + hole.length <= offset; });
+			if (!holes.empty() && holes.front().offset < offset) {
+				holes.front().length -= offset - holes.front().offset;
+				holes.front().offset = offset;
+			}
+			return holes;
+		}
+
+		// FileCopy for 'path' when the receiver should copy it itself, else nullopt
+		inline std::optional<cw::packet::FileCopy> copyPacketFor(const TransferOptions& options, const cw::network::Connection& conn,
+			uint32_t streamId, const fs::path& path, const std::string& nameToSend, uint64_t fileSize)
+		{
+			if (!options.serverCopy || !conn.peerCopiesFiles() || fileSize < options.serverCopyMinSize) return std::nullopt;
+
+			std::error_code ec;
+			fs::path source = fs::absolute(path, ec).lexically_normal();
+			if (ec) return std::nullopt;
+
+			for (const auto& [local, remote] : options.serverCopyPathMap) {
+				fs::path rest = source.lexically_relative(local.lexically_normal());
+				if (!rest.empty() && *rest.begin() != "..") {
+					source = (remote / rest).lexically_normal();
+					break;
+				}
+			}
+
+			cw::packet::FileCopy copyPkt;
+			copyPkt.streamId = streamId;
+			copyPkt.fileSize = fileSize;
+			copyPkt.fingerprint = cw::file::fileFingerprint(path, fileSize);
+			copyPkt.fileName = nameToSend;
+			copyPkt.sourcePath = source.generic_string();
+			if (copyPkt.sourcePath.size() > cw::packet::MAX_STRING_LENGTH) return std::nullopt;
+			return copyPkt;
+		}
+
+		// Random id the server uses to join the stripes of one file
+		inline uint64_t newTransferId()
+		{
+			static std::mt19937_64 generator{ std::random_device{}() };
+			static std::mutex mutex;
+			std::lock_guard<std::mutex> lock(mutex);
+			return generator();
+		}
+
+		// Picks the stripe for each chunk by what each connection actually
+		// drains: the uncongested one whose queue, this chunk included, would go
+		// out soonest at its measured rate. Stripes over different paths (NICs,
+		// source addresses) so each carry the share their path sustains rather
+		// than an equal one, and a slow path does not hold back the end of the
+		// file. Rates are the bytes each socket wrote, smoothed over intervals of
+		// RATE_INTERVAL; until one is measured all stripes count as equal, and
+		// ties go round-robin.
+		class StripeScheduler
+		{
+		public:
+			using Clock = std::chrono::steady_clock;
+
+			explicit StripeScheduler(const std::vector<std::shared_ptr<cw::network::Connection>>& conns) :
+				m_paths(conns.size()), m_measuredAt(Clock::now())
+			{
+				for (size_t i = 0; i < conns.size(); ++i) m_paths[i].sent = conns[i]->metrics()->bytesSent();
+			}
+
+			// Bytes per second stripe 'index' has been sending at, 0 = not measured yet
+			double rate(size_t index) const { return m_paths[index].rate; }
+
+			// Index of the stripe to carry the next 'chunk' bytes. All of them
+			// congested, the one that would drain soonest anyway.
+			size_t pick(const std::vector<std::shared_ptr<cw::network::Connection>>& conns, cw::packet::Priority priority, size_t chunk)
+			{
+				measure(conns);
+
+				std::optional<size_t> best;
+				double bestFinish = 0;
+				bool bestCongested = true;
+				for (size_t i = 0; i < conns.size(); ++i) {
+					size_t index = (m_next + i) % conns.size();
+					bool congested = conns[index]->isCongested(priority);
+					double finish = static_cast<double>(conns[index]->queuedBytes() + chunk) / effectiveRate(index);
+					if (!best || (bestCongested && !congested) || (bestCongested == congested && finish < bestFinish)) {
+						best = index;
+						bestFinish = finish;
+						bestCongested = congested;
+					}
+				}
+				m_next = *best + 1;
+				return *best;
+			}
+
+		private:
+			static constexpr auto RATE_INTERVAL = std::chrono::milliseconds(100);
+			static constexpr double SMOOTHING = 0.25; // Weight of the newest interval
+
+			struct Path
+			{
+				std::uint64_t sent = 0;
+				double rate = 0;
+			};
+
+			void measure(const std::vector<std::shared_ptr<cw::network::Connection>>& conns)
+			{
+				auto now = Clock::now();
+				if (now - m_measuredAt < RATE_INTERVAL) return;
+				double seconds = std::chrono::duration<double>(now - m_measuredAt).count();
+				m_measuredAt = now;
+
+				for (size_t i = 0; i < conns.size(); ++i) {
+					std::uint64_t sent = conns[i]->metrics()->bytesSent();
+					double rate = static_cast<double>(sent - m_paths[i].sent) / seconds;
+					m_paths[i].sent = sent;
+					// An idle interval (nothing queued) says nothing about the path
+					if (rate == 0 && conns[i]->queuedBytes() == 0) continue;
+					m_paths[i].rate = m_paths[i].rate == 0 ? rate : m_paths[i].rate + SMOOTHING * (rate - m_paths[i].rate);
+				}
+			}
+
+			// Unmeasured stripes count as the fastest measured one, so each gets
+			// tried; a stalled one still counts as a trickle rather than never
+			double effectiveRate(size_t index) const
+			{
+				double fastest = 0;
+				for (const auto& path : m_paths) fastest = std::max(fastest, path.rate);
+				if (fastest == 0) return 1;
+				return m_paths[index].rate == 0 ? fastest : std::max(m_paths[index].rate, fastest / 1000);
+			}
+
+			std::vector<Path> m_paths;
+			Clock::time_point m_measuredAt;
+			size_t m_next = 0;
+		};
+	}
+
+	inline void sendFile(std::shared_ptr<cw::network::Connection> conn, const std::string& filePath, const std::string& remoteFileName = "", const TransferOptions& requested = {}) {
+
+		TransferOptions options = detail::negotiatedOptions(requested, *conn);
 
 		// 1. VALIDATE FILE
 		fs::path path(filePath);
 		if (!fs::exists(path)) {
-			std::cerr << "File not found: " << filePath << "\n";
+			CW_LOG_ERROR("File not found: ", filePath);
 			return;
 		}
 
 		uint64_t fileSize = fs::file_size(path);
+		cw::packet::FileInfo infoPkt;
+		infoPkt.fileName = detail::remoteNameFor(path, remoteFileName);
+		const std::string& nameToSend = infoPkt.fileName;
+
+		CW_LOG_INFO("[Client] Sending ", nameToSend, " (", fileSize, " bytes)...");
 
-		// --- LOGIC CHANGE START ---
-		std::string nameToSend;
-		if (!remoteFileName.empty()) {
-			nameToSend = remoteFileName;
+		// 2. SEND HEADER (FileInfo, or FileCopy / FileResume and wait for where to continue)
+		// Own stream id: other files may be in flight on the same connection
+		infoPkt.streamId = options.streamId ? conn->openStream(options.streamId) : conn->allocateStreamId();
+		infoPkt.fileSize = fileSize;
+
+		uint64_t offset = 0;
+		std::optional<cw::network::Connection::Cork> cork;
+		if (auto copyPkt = detail::copyPacketFor(options, *conn, infoPkt.streamId, path, nameToSend, fileSize)) {
+			if (std::error_code ec = conn->sendCopy(*copyPkt, offset)) {
+				CW_LOG_WARN("[Client] Upload aborted: ", ec.message());
+				return;
+			}
+			offset = std::min(offset, fileSize);
+			if (offset > 0) CW_LOG_INFO("[Client] Server copied ", offset, " bytes itself");
+		}
+		else if (options.resume) {
+			if (std::error_code ec = conn->sendResume(detail::resumePacketFor(infoPkt.streamId, path, nameToSend, fileSize), offset)) {
+				CW_LOG_WARN("[Client] Upload aborted: ", ec.message());
+				return;
+			}
+			offset = std::min(offset, fileSize);
+			if (offset > 0) CW_LOG_INFO("[Client] Resuming at byte ", offset);
+		}
+		else if (detail::mayInline(options, *conn, fileSize) && detail::readInline(options, path, fileSize, infoPkt)) {
+			// The whole file in its header: nothing else goes on the stream
+			detail::reportStream(options, *conn, infoPkt.streamId, fileSize);
+			conn->send(infoPkt, options.priority);
+			detail::reportSent(options, fileSize);
+			conn->releaseStream(infoPkt.streamId);
+			detail::reportFileSent(options);
+			CW_LOG_INFO("[Client] Upload Complete. Sent ", fileSize, " bytes inline.");
+			return;
 		}
 		else {
-			// Use generic_string() to prefer forward slashes, but we force sanitize below anyway
-			nameToSend = path.filename().generic_string();
+			// A file of one chunk: header, chunk and footer leave in one write
+			if (fileSize <= ChunkSizer(options).next()) cork.emplace(conn);
+			conn->send(infoPkt, options.priority);
 		}
 
-		// CRITICAL FIX: Normalize path separators to forward slashes '/'
-		// This ensures Windows clients can send to Linux servers correctly.
-		std::replace(nameToSend.begin(), nameToSend.end(), '\\', '/');
-		// --- LOGIC CHANGE END ---
+		detail::reportStream(options, *conn, infoPkt.streamId, fileSize, offset);
 
-		std::cout << "[Client] Sending " << nameToSend << " (" << fileSize << " bytes)...\n";
+		// 3. THE SLICER LOOP
+		cw::file::ChunkSource source(path, detail::readModeFor(options, fileSize));
+		source.seek(offset);
+		source.setReadAhead(detail::readAheadBytes(options));
+		source.setDropBehind(options.dropBehind);
+		source.setCache(options.chunkCache);
+		ChunkSizer sizer(options);
 
-		// 2. SEND HEADER (FileInfo)
-		cw::packet::FileInfo infoPkt;
-		infoPkt.fileName = nameToSend;
-		infoPkt.fileSize = fileSize;
-		conn->send(infoPkt);
+		bool checked = options.checksums && !source.isKernelCopy();
+		cw::integrity::FileDigest digest(fileSize);
+		if (checked) conn->serveRetransmits(infoPkt.streamId, path, fileSize);
+		auto cipher = detail::cipherFor(options);
 
-		// 3. THE SLICER LOOP
-		std::ifstream file(filePath, std::ios::binary);
-		constexpr size_t CHUNK_SIZE = 4096;
+		// Sparse source: chunks stop at each hole, which goes as one FileHole
+		auto holes = detail::holesFor(options, *conn, path, offset, fileSize);
+		size_t nextHole = 0;
+		if (!holes.empty()) CW_LOG_DEBUG("[Client] ", nameToSend, " has ", holes.size(), " holes");
 
-		uint64_t offset = 0;
+		while (true) {
+			auto chunkStart = std::chrono::steady_clock::now();
+
+			// The receiver failed the stream: the rest would only be dropped
+			if (std::error_code ec = conn->streamError(infoPkt.streamId)) {
+				CW_LOG_WARN("[Client] Upload aborted: ", ec.message());
+				conn->releaseStream(infoPkt.streamId);
+				return;
+			}
+
+			if (nextHole < holes.size() && offset >= holes[nextHole].offset) {
+				const auto& hole = holes[nextHole++];
+				detail::sendZeros(*conn, infoPkt.streamId, hole.offset, hole.length, options.priority);
+
+				digest.addZeros(hole.length);
+				detail::reportSent(options, hole.offset + hole.length - offset);
+				offset = hole.offset + hole.length;
+				source.seek(offset);
+				continue;
+			}
+			size_t chunkSize = nextHole < holes.size()
+				? static_cast<size_t>(std::min<uint64_t>(sizer.next(), holes[nextHole].offset - offset))
+				: sizer.next();
 
-		while (file) {
 			// --- BACKPRESSURE CHECK ---
-			while (conn->isCongested()) {
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			// Park until the write loop drains below the low watermark (no polling)
+			if (conn->isCongested(options.priority)) {
+				if (std::error_code ec = conn->waitWritable(options.priority)) {
+					CW_LOG_WARN("[Client] Upload aborted: ", ec.message());
+					return;
+				}
+			}
+
+			// --- ACK WINDOW ---
+			// Park until the receiver's disk has caught up with what we sent
+			if (uint64_t target = detail::ackWaitTarget(options, offset, chunkSize)) {
+				if (std::error_code ec = conn->waitAcked(infoPkt.streamId, target)) {
+					CW_LOG_WARN("[Client] Upload aborted: ", ec.message());
+					conn->releaseStream(infoPkt.streamId);
+					return;
+				}
+			}
+
+			if (source.isKernelCopy()) {
+				size_t length = detail::sendNextRange(*conn, infoPkt.streamId, source, offset, chunkSize, options.priority);
+				if (length == 0) break;
+
+				offset += length;
+				detail::reportSent(options, length);
+				sizer.onChunkSent(length, std::chrono::steady_clock::now() - chunkStart);
+				continue;
 			}
 
 			// --- OPTIMIZED READ ---
-			cw::packet::FileChunk chunkPkt;
+			// The chunk is read from disk once (or is a view into the mapping); the frame
+			// references this buffer as its payload segment, so it reaches the socket without further copies.
+			cw::packet::SharedFileChunk chunkPkt;
+			chunkPkt.streamId = infoPkt.streamId;
 			chunkPkt.offset = offset;
+			chunkPkt.data = source.next(chunkSize);
+
+			if (chunkPkt.data.empty()) break;
+
+			size_t bytesRead = chunkPkt.data.size();
+			if (detail::isZeroChunk(options, *conn, chunkPkt.data)) {
+				detail::sendZeros(*conn, infoPkt.streamId, offset, bytesRead, options.priority);
+				digest.addZeros(bytesRead);
+			}
+			else {
+				detail::checksumChunk(options, chunkPkt);
+				if (chunkPkt.crc) digest.add(offset, bytesRead, *chunkPkt.crc);
+
+				auto compressed = detail::compressChunk(options, *conn, chunkPkt);
+				if (cipher) conn->send(detail::sealChunk(*cipher, chunkPkt, compressed), options.priority);
+				else if (compressed) conn->send(*compressed, options.priority);
+				else conn->send(chunkPkt, options.priority);
+			}
 
-			// Resize creates zero-initialized elements. 
-			// This is safe, though slightly slower than reserve+push_back, it's cleaner for file.read
-			chunkPkt.data.resize(CHUNK_SIZE);
+			offset += bytesRead;
+			detail::reportSent(options, bytesRead);
+			sizer.onChunkSent(bytesRead, std::chrono::steady_clock::now() - chunkStart);
+		}
+
+		// 4. SEND FOOTER (FileDone)
+		cw::packet::FileDone donePkt;
+		donePkt.streamId = infoPkt.streamId;
+		donePkt.fileSize = fileSize;
+		if (checked) donePkt.crc = digest.value();
+		if (auto attributes = detail::attributesFor(options, infoPkt.streamId, path)) conn->send(*attributes, options.priority);
+		conn->send(donePkt, options.priority);
+		cork.reset();
+		conn->releaseStream(infoPkt.streamId);
+		detail::reportFileSent(options);
+		CW_LOG_INFO("[Client] Upload Complete. Sent ", offset, " bytes.");
+	}
 
-			file.read(reinterpret_cast<char*>(chunkPkt.data.data()), CHUNK_SIZE);
-			size_t bytesRead = file.gcount();
+	// One attempt of asyncSendFile, on one connection. 'untilAcked': the file
+	// is not let go before the receiver has acked it to its end, and a lost
+	// connection ends the attempt at once; 'stream' carries its progress over
+	// from the attempts before.
+	inline asio::awaitable<void> asyncSendFileOn(std::shared_ptr<cw::network::Connection> conn,
+		fs::path path,
+		std::string remoteFileName,
+		TransferOptions options,
+		std::optional<asio::any_io_executor> fileExecutor,
+		bool untilAcked,
+		std::shared_ptr<cw::metrics::StreamProgress> stream)
+	{
+		options = detail::negotiatedOptions(std::move(options), *conn);
 
-			if (bytesRead == 0) break;
+		// 1. VALIDATE FILE
+		if (!fs::exists(path)) {
+			CW_LOG_ERROR("File not found: ", path);
+			co_return;
+		}
 
-			if (bytesRead < CHUNK_SIZE) {
-				chunkPkt.data.resize(bytesRead);
+		uint64_t fileSize = fs::file_size(path);
+		cw::packet::FileInfo infoPkt;
+		infoPkt.fileName = detail::remoteNameFor(path, std::move(remoteFileName));
+		const std::string& nameToSend = infoPkt.fileName;
+
+		CW_LOG_INFO("[Client] Sending ", nameToSend, " (", fileSize, " bytes)...");
+
+		// 2. SEND HEADER (FileInfo, or FileCopy / FileResume and wait for where to continue)
+		// Own stream id: other files may be in flight on the same connection
+		infoPkt.streamId = options.streamId ? conn->openStream(options.streamId) : conn->allocateStreamId();
+		infoPkt.fileSize = fileSize;
+
+		// Header, first chunk and footer of a file that fits one chunk go to
+		// the connection as one batch: one hand-off, one gathered write
+		auto batch = conn->makeBatch(options.priority);
+		auto ioExecutor = co_await asio::this_coro::executor;
+
+		uint64_t offset = 0;
+		bool inlined = false;
+		if (auto copyPkt = detail::copyPacketFor(options, *conn, infoPkt.streamId, path, nameToSend, fileSize)) {
+			uint64_t copied = co_await conn->asyncSendCopy(std::move(*copyPkt), asio::use_awaitable);
+			offset = std::min(copied, fileSize);
+			if (offset > 0) CW_LOG_INFO("[Client] Server copied ", offset, " bytes itself");
+		}
+		else if (options.resume) {
+			uint64_t resumeOffset = co_await conn->asyncSendResume(
+				detail::resumePacketFor(infoPkt.streamId, path, nameToSend, fileSize), asio::use_awaitable);
+			offset = std::min(resumeOffset, fileSize);
+			if (offset > 0) CW_LOG_INFO("[Client] Resuming at byte ", offset);
+		}
+		else {
+			if (detail::mayInline(options, *conn, fileSize)) {
+				if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+				inlined = detail::readInline(options, path, fileSize, infoPkt);
+				if (fileExecutor) co_await asio::post(ioExecutor, asio::use_awaitable);
 			}
+			batch.add(infoPkt);
+		}
 
-			conn->send(chunkPkt);
+		detail::reportStream(options, *conn, infoPkt.streamId, fileSize, offset, std::move(stream));
 
-			offset += bytesRead;
+		// The whole file in its header: nothing else goes on the stream
+		if (inlined) {
+			conn->sendBatch(batch);
+			detail::reportSent(options, fileSize);
+			if (untilAcked) co_await detail::waitAcked(*conn, infoPkt.streamId, fileSize);
+			conn->releaseStream(infoPkt.streamId);
+			detail::reportFileSent(options);
+			CW_LOG_INFO("[Client] Upload Complete. Sent ", fileSize, " bytes inline.");
+			co_return;
+		}
+
+		// 3. THE SLICER LOOP
+		cw::file::ChunkSource source(path, detail::readModeFor(options, fileSize));
+		source.seek(offset);
+		source.setReadAhead(detail::readAheadBytes(options));
+		source.setDropBehind(options.dropBehind);
+		source.setCache(options.chunkCache);
+		ChunkSizer sizer(options);
+
+		bool checked = options.checksums && !source.isKernelCopy();
+		cw::integrity::FileDigest digest(fileSize);
+		if (checked) conn->serveRetransmits(infoPkt.streamId, path, fileSize);
+		std::optional<cw::integrity::TreeHash> tree;
+		if (options.treeHash && !source.isKernelCopy()) tree.emplace();
+		auto cipher = detail::cipherFor(options);
+
+		// Sparse source: chunks stop at each hole, which goes as one FileHole
+		auto holes = detail::holesFor(options, *conn, path, offset, fileSize);
+		size_t nextHole = 0;
+		if (!holes.empty()) CW_LOG_DEBUG("[Client] ", nameToSend, " has ", holes.size(), " holes");
+
+		// 'offset' is how far the file has been read, 'sent' how far it has
+		// gone to the connection: with a work pool, chunks in between are
+		// being prepared there
+		std::optional<OrderedJobs<detail::PreparedChunk>> jobs;
+		std::shared_ptr<const TransferOptions> jobOptions; // Outlives the jobs, should the upload end first
+		if (options.workPool && !source.isKernelCopy()) {
+			jobs.emplace(options.workPool, ioExecutor);
+			jobOptions = std::make_shared<const TransferOptions>(options);
+		}
+		size_t depth = detail::workDepth(options);
+		uint64_t sent = offset;
+		auto emit = [&](detail::PreparedChunk prepared)
+			{
+				const auto& chunkPkt = prepared.chunk;
+				size_t bytesRead = chunkPkt.data.size();
+				if (prepared.zeros) {
+					conn->sendBatch(batch);
+					detail::sendZeros(*conn, infoPkt.streamId, chunkPkt.offset, bytesRead, options.priority);
+					digest.addZeros(bytesRead);
+				}
+				else {
+					if (chunkPkt.crc) digest.add(chunkPkt.offset, bytesRead, *chunkPkt.crc);
+					if (tree && prepared.leaf) tree->add(chunkPkt.offset, static_cast<uint32_t>(bytesRead), *prepared.leaf);
+					if (prepared.sealed) batch.add(*prepared.sealed);
+					else if (prepared.compressed) batch.add(*prepared.compressed);
+					else batch.add(chunkPkt);
+				}
+				sent = chunkPkt.offset + bytesRead;
+				detail::reportSent(options, bytesRead);
+				sizer.onChunkSent(bytesRead, std::chrono::steady_clock::now() - prepared.start);
+
+				// The last chunk waits for FileDone
+				if (sent < fileSize) conn->sendBatch(batch);
+			};
+
+		while (true) {
+			auto chunkStart = std::chrono::steady_clock::now();
+
+			// Nothing sent from here on would arrive: on to the next connection
+			if (untilAcked && !conn->isOpen()) throw std::system_error(asio::error::connection_aborted);
+			detail::throwIfStreamFailed(*conn, infoPkt.streamId);
+
+			if (nextHole < holes.size() && offset >= holes[nextHole].offset) {
+				while (jobs && !jobs->empty()) {
+					auto done = co_await jobs->next();
+					emit(std::move(done));
+				}
+				const auto& hole = holes[nextHole++];
+				conn->sendBatch(batch);
+				detail::sendZeros(*conn, infoPkt.streamId, hole.offset, hole.length, options.priority);
+
+				digest.addZeros(hole.length);
+				detail::reportSent(options, hole.offset + hole.length - offset);
+				offset = hole.offset + hole.length;
+				sent = offset;
+				source.seek(offset);
+				continue;
+			}
+			size_t chunkSize = nextHole < holes.size()
+				? static_cast<size_t>(std::min<uint64_t>(sizer.next(), holes[nextHole].offset - offset))
+				: sizer.next();
+
+			// --- BACKPRESSURE ---
+			if (conn->isCongested(options.priority)) {
+				conn->sendBatch(batch);
+				co_await conn->asyncWaitWritable(options.priority, asio::use_awaitable);
+			}
+
+			// --- ACK WINDOW ---
+			// Acks come every ACK_INTERVAL bytes: what is waited for must be that far behind what was sent
+			if (uint64_t target = detail::ackWaitTarget(options, offset, chunkSize)) {
+				while (jobs && !jobs->empty() && sent < target + cw::packet::ACK_INTERVAL) {
+					auto done = co_await jobs->next();
+					emit(std::move(done));
+				}
+				conn->sendBatch(batch);
+				co_await detail::waitAcked(*conn, infoPkt.streamId, target);
+			}
+
+			if (source.isKernelCopy()) {
+				conn->sendBatch(batch);
+				size_t length = detail::sendNextRange(*conn, infoPkt.streamId, source, offset, chunkSize, options.priority);
+				if (length == 0) break;
+
+				offset += length;
+				detail::reportSent(options, length);
+				sizer.onChunkSent(length, std::chrono::steady_clock::now() - chunkStart);
+				co_await asio::post(ioExecutor, asio::use_awaitable);
+				continue;
+			}
+
+			detail::PreparedChunk prepared;
+			prepared.chunk.streamId = infoPkt.streamId;
+			prepared.chunk.offset = offset;
+			prepared.cipher = cipher;
+			prepared.start = chunkStart;
+
+			// Read (checksum and compress) on the file executor when there is
+			// one; with a work pool, only read there
+			if (fileExecutor) {
+				co_await asio::post(*fileExecutor, asio::use_awaitable);
+				prepared.chunk.data = source.next(chunkSize);
+				if (!jobs) detail::prepareChunk(options, *conn, prepared);
+				co_await asio::post(ioExecutor, asio::use_awaitable);
+			}
+			else {
+				prepared.chunk.data = source.next(chunkSize);
+				if (!jobs) detail::prepareChunk(options, *conn, prepared);
+			}
+
+			if (prepared.chunk.data.empty()) break;
+
+			offset += prepared.chunk.data.size();
+			if (jobs) {
+				jobs->submit([jobOptions, conn, prepared = std::move(prepared)]() mutable
+					{
+						detail::prepareChunk(*jobOptions, *conn, prepared);
+						return std::move(prepared);
+					});
+				while (jobs->size() >= depth || jobs->ready()) {
+					auto done = co_await jobs->next();
+					emit(std::move(done));
+				}
+			}
+			else {
+				emit(std::move(prepared));
+			}
+
+			if (offset >= fileSize) break;
+
+			// Let the queued write start before reading the next chunk
+			if (!fileExecutor) {
+				co_await asio::post(ioExecutor, asio::use_awaitable);
+			}
+		}
+		while (jobs && !jobs->empty()) {
+			auto done = co_await jobs->next();
+			emit(std::move(done));
 		}
 
 		// 4. SEND FOOTER (FileDone)
 		cw::packet::FileDone donePkt;
+		donePkt.streamId = infoPkt.streamId;
+		donePkt.fileSize = fileSize;
+		if (checked) donePkt.crc = digest.value();
+		if (tree) batch.add(detail::treeDigestFor(infoPkt.streamId, *tree));
+		if (auto attributes = detail::attributesFor(options, infoPkt.streamId, path)) batch.add(*attributes);
+		batch.add(donePkt);
+		conn->sendBatch(batch);
+		if (untilAcked) co_await detail::waitAcked(*conn, infoPkt.streamId, fileSize);
+		conn->releaseStream(infoPkt.streamId);
+		detail::reportFileSent(options);
+		CW_LOG_INFO("[Client] Upload Complete. Sent ", offset, " bytes.");
+	}
+
+	// Coroutine version of sendFile: runs on the connection's io_context, so no
+	// thread per transfer is needed. Backpressure is a co_await on the send queue.
+	// Disk reads happen on 'fileExecutor' when given (the coroutine hops there and
+	// back per chunk); otherwise inline, yielding after every chunk so the socket
+	// write of chunk N runs while chunk N+1 is being read.
+	// Throws std::system_error if the connection fails mid-transfer, unless it
+	// reconnects (Client::SetReconnect): then the file goes on over the new
+	// connection from where the receiver's disk got to (FileResume), and is
+	// held until acked, so one lost with its connection is sent again.
+	// A receiver that refuses the file as busy gets it again later (see
+	// TransferOptions::busyRetries), or the peer it points to gets it
+	// (TransferOptions::redirectPool).
+	inline asio::awaitable<void> asyncSendFile(std::shared_ptr<cw::network::Connection> conn,
+		fs::path path,
+		std::string remoteFileName = "",
+		TransferOptions options = {},
+		std::optional<asio::any_io_executor> fileExecutor = std::nullopt)
+	{
+		bool retriesBusy = options.busyRetries > 0 && conn->peerRefusesWhenBusy();
+		if (!conn->reconnects() && !retriesBusy) {
+			co_await asyncSendFileOn(std::move(conn), std::move(path), std::move(remoteFileName), std::move(options), fileExecutor, false, nullptr);
+			co_return;
+		}
+
+		if (conn->reconnects()) options.resume = true;
+		std::shared_ptr<cw::metrics::StreamProgress> stream;
+		std::error_code sizeEc;
+		uint64_t fileSize = fs::file_size(path, sizeEc);
+		if (options.progress && !sizeEc) stream = std::make_shared<cw::metrics::StreamProgress>(options.progress, fileSize);
+
+		unsigned refusals = 0;
+		std::optional<cw::network::PooledConnection> redirected; // Held until the file is acked there
+		for (unsigned attempt = 0;;) {
+			conn = conn->latest();
+			std::exception_ptr lost;
+			bool refused = false;
+			try {
+				co_await asyncSendFileOn(conn, path, remoteFileName, options, fileExecutor, true, stream);
+				co_return;
+			}
+			catch (const std::system_error& e) {
+				if (e.code() == std::errc::resource_unavailable_try_again && retriesBusy && refusals < options.busyRetries) refused = true;
+				else if (conn->isOpen() || !conn->reconnects() || attempt + 1 >= detail::MAX_FILE_RECONNECTS) throw;
+				else lost = std::current_exception();
+			}
+
+			// Refused before anything of it was written: the whole file again, to
+			// the peer the receiver named (once), or later
+			if (refused && options.redirectPool && !redirected) {
+				auto target = cw::network::splitHostPort(conn->busyRedirect());
+				if (target) {
+					std::error_code ec;
+					auto lease = co_await options.redirectPool->asyncAcquire(target->first, target->second, asio::redirect_error(asio::use_awaitable, ec));
+					if (!ec) {
+						CW_LOG_INFO("[Client] Receiver busy, sending ", path.filename().string(), " to ", conn->busyRedirect(), " instead");
+						redirected = std::move(lease);
+						conn = redirected->get();
+						retriesBusy = options.busyRetries > 0 && conn->peerRefusesWhenBusy();
+						continue;
+					}
+					CW_LOG_WARN("[Client] Could not reach ", conn->busyRedirect(), ": ", ec.message());
+				}
+			}
+			if (refused) {
+				auto delay = detail::busyDelay(options, *conn, refusals++);
+				CW_LOG_INFO("[Client] Receiver busy, sending ", path.filename().string(), " again in ", delay.count(), " ms");
+				asio::steady_timer timer(co_await asio::this_coro::executor, delay);
+				co_await timer.async_wait(asio::use_awaitable);
+				continue;
+			}
+
+			++attempt;
+			CW_LOG_WARN("[Client] Connection lost while sending ", path.filename().string());
+			std::error_code ec;
+			conn = co_await conn->asyncReconnect(asio::redirect_error(asio::use_awaitable, ec));
+			if (ec) std::rethrow_exception(lost);
+		}
+	}
+
+	// Striped upload: one file over several connections, joined by the server
+	// into a single destination file. The file is still read once, sequentially;
+	// each chunk goes to the connection that would send it soonest (see
+	// StripeScheduler), so K TCP streams together fill a link a single stream's
+	// window cannot, or several links at their own speeds.
+	// Falls back to asyncSendFile for one connection.
+	inline asio::awaitable<void> asyncSendFileStriped(std::vector<std::shared_ptr<cw::network::Connection>> conns,
+		fs::path path,
+		std::string remoteFileName = "",
+		TransferOptions options = {})
+	{
+		if (conns.empty()) co_return;
+		if (conns.size() == 1) {
+			co_await asyncSendFile(conns.front(), std::move(path), std::move(remoteFileName), std::move(options));
+			co_return;
+		}
+
+		// 1. VALIDATE FILE
+		if (!fs::exists(path)) {
+			CW_LOG_ERROR("File not found: ", path);
+			co_return;
+		}
+
+		uint64_t fileSize = fs::file_size(path);
+		std::string nameToSend = detail::remoteNameFor(path, remoteFileName);
+
+		CW_LOG_INFO("[Client] Sending ", nameToSend, " (", fileSize, " bytes) over ", conns.size(), " streams...");
+
+		// 2. SEND HEADER (StripeInfo on every stream)
+		cw::packet::StripeInfo infoPkt;
+		infoPkt.transferId = detail::newTransferId();
+		infoPkt.stripeCount = static_cast<uint16_t>(std::min<size_t>(conns.size(), UINT16_MAX));
+		infoPkt.fileSize = fileSize;
+		infoPkt.fileName = nameToSend;
+
+		conns.resize(infoPkt.stripeCount);
+
+		// Each connection has its own id space, so every stripe gets its own stream id
+		std::vector<uint32_t> streamIds;
+		for (auto& conn : conns) {
+			infoPkt.streamId = conn->allocateStreamId();
+			streamIds.push_back(infoPkt.streamId);
+			conn->send(infoPkt, options.priority);
+		}
+
+		// 3. THE SLICER LOOP
+		// Chunks may go to any stripe: within every receiver's limits
+		for (auto& conn : conns) options = detail::negotiatedOptions(std::move(options), *conn);
+		auto ioExecutor = co_await asio::this_coro::executor;
+		cw::file::ChunkSource source(path, detail::readModeFor(options, fileSize));
+		source.setReadAhead(detail::readAheadBytes(options));
+		source.setDropBehind(options.dropBehind);
+		source.setCache(options.chunkCache);
+		ChunkSizer sizer(options);
+
+		uint64_t offset = 0;
+		detail::StripeScheduler scheduler(conns);
+
+		// Each stripe's FileDone carries the digest of the chunks it carried
+		bool checked = options.checksums && !source.isKernelCopy();
+		std::vector<cw::integrity::FileDigest> digests(conns.size(), cw::integrity::FileDigest(fileSize));
+		if (checked) {
+			for (size_t i = 0; i < conns.size(); ++i) conns[i]->serveRetransmits(streamIds[i], path, fileSize);
+		}
+		// Its TreeDigest covers the same chunks: each receiving connection checks its own
+		bool treeHashed = options.treeHash && !source.isKernelCopy();
+		std::vector<cw::integrity::TreeHash> trees(treeHashed ? conns.size() : 0);
+		auto cipher = detail::cipherFor(options);
+
+		// Only the last stripe to finish is acked, with the whole file
+		if (options.progress) {
+			auto progress = std::make_shared<cw::metrics::StreamProgress>(options.progress, fileSize);
+			for (size_t i = 0; i < conns.size(); ++i) conns[i]->reportProgress(streamIds[i], progress);
+		}
+
+		while (true) {
+			auto chunkStart = std::chrono::steady_clock::now();
+
+			// --- BACKPRESSURE (only when every stream is full) ---
+			size_t chunkSize = sizer.next();
+			size_t stripe = scheduler.pick(conns, options.priority, chunkSize);
+			const auto& conn = conns[stripe];
+			if (conn->isCongested(options.priority)) {
+				co_await conn->asyncWaitWritable(options.priority, asio::use_awaitable);
+			}
+
+			size_t length = 0;
+			if (source.isKernelCopy()) {
+				length = detail::sendNextRange(*conn, streamIds[stripe], source, offset, chunkSize, options.priority);
+			}
+			else {
+				cw::packet::SharedFileChunk chunkPkt;
+				chunkPkt.streamId = streamIds[stripe];
+				chunkPkt.offset = offset;
+				chunkPkt.data = source.next(chunkSize);
+				length = chunkPkt.data.size();
+				detail::checksumChunk(options, chunkPkt);
+				if (chunkPkt.crc) digests[stripe].add(offset, length, *chunkPkt.crc);
+				if (auto leaf = detail::hashChunk(options, chunkPkt); leaf && treeHashed) trees[stripe].add(offset, static_cast<uint32_t>(length), *leaf);
+
+				if (length == 0) {}
+				else if (auto compressed = detail::compressChunk(options, *conn, chunkPkt); cipher) conn->send(detail::sealChunk(*cipher, chunkPkt, compressed), options.priority);
+				else if (compressed) conn->send(*compressed, options.priority);
+				else conn->send(chunkPkt, options.priority);
+			}
+
+			if (length == 0) break;
+
+			offset += length;
+			detail::reportSent(options, length);
+			sizer.onChunkSent(length, std::chrono::steady_clock::now() - chunkStart);
+			co_await asio::post(ioExecutor, asio::use_awaitable);
+		}
+
+		// 4. SEND FOOTER (FileDone on every stream)
+		cw::packet::FileDone donePkt;
 		donePkt.fileSize = fileSize;
-		conn->send(donePkt);
-		std::cout << "[Client] Upload Complete. Sent " << offset << " bytes.\n";
+		for (size_t i = 0; i < conns.size(); ++i) {
+			donePkt.streamId = streamIds[i];
+			if (checked) donePkt.crc = digests[i].value();
+			if (treeHashed) conns[i]->send(detail::treeDigestFor(streamIds[i], trees[i]), options.priority);
+			conns[i]->send(donePkt, options.priority);
+			conns[i]->releaseStream(streamIds[i]);
+		}
+		detail::reportFileSent(options);
+		CW_LOG_INFO("[Client] Upload Complete. Sent ", offset, " bytes.");
+	}
+
+	// Delta upload of a file the server already holds a version of: it sends the
+	// block signatures of its copy, we send only the bytes that changed plus
+	// references to blocks it already has. The server checks the whole-file hash
+	// before replacing its copy. Without a usable copy this is asyncSendFile.
+	inline asio::awaitable<void> asyncSendDelta(std::shared_ptr<cw::network::Connection> conn,
+		fs::path path,
+		std::string remoteFileName = "",
+		TransferOptions options = {},
+		std::optional<asio::any_io_executor> fileExecutor = std::nullopt)
+	{
+		options = detail::negotiatedOptions(std::move(options), *conn);
+
+		// Literal bytes would go in the clear
+		if (options.chunkKey) {
+			co_await asyncSendFile(std::move(conn), std::move(path), std::move(remoteFileName), std::move(options), fileExecutor);
+			co_return;
+		}
+
+		// 1. VALIDATE FILE
+		if (!fs::exists(path)) {
+			CW_LOG_ERROR("File not found: ", path);
+			co_return;
+		}
+
+		uint64_t fileSize = fs::file_size(path);
+		std::string nameToSend = detail::remoteNameFor(path, remoteFileName);
+
+		// 2. FETCH SIGNATURES of the server's copy
+		cw::packet::SignatureRequest request;
+		request.fileName = nameToSend;
+		auto signatures = co_await conn->asyncRequestSignatures(std::move(request), asio::use_awaitable);
+
+		if (signatures.blocks.empty()) {
+			co_await asyncSendFile(std::move(conn), std::move(path), std::move(remoteFileName), std::move(options), fileExecutor);
+			co_return;
+		}
+
+		CW_LOG_INFO("[Client] Sending delta of ", nameToSend, " (", fileSize, " bytes, ", signatures.blocks.size(), " blocks on the server)...");
+
+		// 3. SEND HEADER (DeltaInfo)
+		cw::packet::DeltaInfo infoPkt;
+		infoPkt.streamId = conn->allocateStreamId();
+		infoPkt.fileSize = fileSize;
+		infoPkt.fileName = nameToSend;
+		conn->send(infoPkt, options.priority);
+		if (options.checksums) conn->serveRetransmits(infoPkt.streamId, path, fileSize);
+		detail::reportStream(options, *conn, infoPkt.streamId, fileSize);
+
+		// 4. THE DELTA LOOP: literal runs as FileChunks, matches as BlockCopys
+		auto ioExecutor = co_await asio::this_coro::executor;
+		size_t maxLiteral = std::min(std::max<size_t>(1, options.chunkSize), cw::packet::MAX_CHUNK_SIZE);
+		cw::file::DeltaEncoder encoder(path, signatures, maxLiteral);
+
+		uint64_t covered = 0;
+		while (true) {
+			detail::throwIfStreamFailed(*conn, infoPkt.streamId);
+			if (conn->isCongested(options.priority)) {
+				co_await conn->asyncWaitWritable(options.priority, asio::use_awaitable);
+			}
+
+			// Acks count bytes written (literal or copied), so the window uses 'covered'
+			if (uint64_t target = detail::ackWaitTarget(options, covered, maxLiteral)) {
+				co_await detail::waitAcked(*conn, infoPkt.streamId, target);
+			}
+
+			// Matching is CPU and disk work: off the network thread when possible
+			if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+			auto op = encoder.next();
+			if (fileExecutor) co_await asio::post(ioExecutor, asio::use_awaitable);
+
+			if (!op) break;
+
+			if (op->sourceOffset) {
+				cw::packet::BlockCopy copyPkt;
+				copyPkt.streamId = infoPkt.streamId;
+				copyPkt.offset = op->offset;
+				copyPkt.sourceOffset = *op->sourceOffset;
+				copyPkt.length = op->length;
+				conn->send(copyPkt, options.priority);
+			}
+			else {
+				cw::packet::SharedFileChunk chunkPkt;
+				chunkPkt.streamId = infoPkt.streamId;
+				chunkPkt.offset = op->offset;
+				chunkPkt.data = cw::buffer::SharedBuffer::fromVector(std::move(op->literal));
+				detail::checksumChunk(options, chunkPkt);
+				conn->send(chunkPkt, options.priority);
+			}
+			covered += op->length;
+			detail::reportSent(options, op->length);
+
+			if (!fileExecutor) co_await asio::post(ioExecutor, asio::use_awaitable);
+		}
+
+		// 5. SEND FOOTER (DeltaDone with the hash the rebuilt file must match)
+		if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+		auto hash = cw::file::contentHash(path);
+		if (fileExecutor) co_await asio::post(ioExecutor, asio::use_awaitable);
+
+		cw::packet::DeltaDone donePkt;
+		donePkt.streamId = infoPkt.streamId;
+		donePkt.fileSize = fileSize;
+		donePkt.hash = hash.value_or(0);
+		conn->send(donePkt, options.priority);
+		conn->releaseStream(infoPkt.streamId);
+		detail::reportFileSent(options);
+
+		CW_LOG_INFO("[Client] Delta Complete. Sent ", encoder.literalBytes(), " literal bytes, referenced ", encoder.matchedBytes(), " bytes.");
+	}
+
+	// Deduplicated upload: the file is cut into content-defined chunks (FastCDC)
+	// and announced as a list of their SHA-256 hashes. The server fills every
+	// chunk its store already holds, from any earlier file, and asks for the
+	// rest, which are sent as ordinary chunks. Falls back to asyncSendFile when
+	// the file cannot be chunked or has too many chunks for one manifest.
+	inline asio::awaitable<void> asyncSendDedup(std::shared_ptr<cw::network::Connection> conn,
+		fs::path path,
+		std::string remoteFileName = "",
+		TransferOptions options = {},
+		std::optional<asio::any_io_executor> fileExecutor = std::nullopt)
+	{
+		options = detail::negotiatedOptions(std::move(options), *conn);
+
+		// The chunks it asks for would go unsealed
+		if (options.chunkKey) {
+			co_await asyncSendFile(std::move(conn), std::move(path), std::move(remoteFileName), std::move(options), fileExecutor);
+			co_return;
+		}
+
+		// 1. VALIDATE FILE
+		if (!fs::exists(path)) {
+			CW_LOG_ERROR("File not found: ", path);
+			co_return;
+		}
+
+		uint64_t fileSize = fs::file_size(path);
+		std::string nameToSend = detail::remoteNameFor(path, remoteFileName);
+
+		// 2. CHUNK the file (a full read and hash: off the network thread when possible)
+		auto ioExecutor = co_await asio::this_coro::executor;
+		if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+		auto chunks = cw::file::chunkFile(path);
+		if (fileExecutor) co_await asio::post(ioExecutor, asio::use_awaitable);
+
+		if (!chunks || chunks->size() > cw::packet::MAX_DEDUP_CHUNKS) {
+			co_await asyncSendFile(std::move(conn), std::move(path), std::move(remoteFileName), std::move(options), fileExecutor);
+			co_return;
+		}
+
+		// 3. SEND HEADER (ChunkManifest) and wait for the chunks the server lacks
+		cw::packet::ChunkManifest manifest;
+		manifest.streamId = conn->allocateStreamId();
+		manifest.fileSize = fileSize;
+		manifest.fileName = nameToSend;
+		manifest.chunks = *chunks;
+
+		uint32_t streamId = manifest.streamId;
+		CW_LOG_INFO("[Client] Sending ", nameToSend, " (", fileSize, " bytes, ", chunks->size(), " chunks)...");
+		if (options.checksums) conn->serveRetransmits(streamId, path, fileSize);
+		detail::reportStream(options, *conn, streamId, fileSize);
+		auto requested = co_await conn->asyncSendChunkManifest(std::move(manifest), asio::use_awaitable);
+
+		std::vector<uint64_t> offsets;
+		offsets.reserve(chunks->size());
+		uint64_t position = 0;
+		for (const auto& chunk : *chunks) {
+			offsets.push_back(position);
+			position += chunk.length;
+		}
+
+		// What the server's store fills is as good as sent
+		uint64_t missing = 0;
+		for (uint32_t index : requested) {
+			if (index < chunks->size()) missing += (*chunks)[index].length;
+		}
+		detail::reportSent(options, fileSize - std::min(missing, fileSize));
+
+		// 4. SEND the requested chunks
+		auto file = std::make_shared<cw::file::FileHandle>(cw::file::FileHandle::openRead(path));
+		cw::integrity::FileDigest digest(fileSize);
+		uint64_t sent = 0;
+
+		for (uint32_t index : requested) {
+			if (index >= chunks->size()) continue;
+			uint32_t length = (*chunks)[index].length;
+
+			detail::throwIfStreamFailed(*conn, streamId);
+			if (conn->isCongested(options.priority)) {
+				co_await conn->asyncWaitWritable(options.priority, asio::use_awaitable);
+			}
+
+			if (uint64_t target = detail::ackWaitTarget(options, sent, length)) {
+				co_await detail::waitAcked(*conn, streamId, target);
+			}
+
+			cw::packet::SharedFileChunk chunkPkt;
+			chunkPkt.streamId = streamId;
+			chunkPkt.offset = offsets[index];
+
+			if (fileExecutor) co_await asio::post(*fileExecutor, asio::use_awaitable);
+			cw::buffer::PooledBuffer bytes(length);
+			std::error_code ec = file->readAt(chunkPkt.offset, bytes.span());
+			chunkPkt.data = std::move(bytes).share();
+			std::optional<cw::packet::CompressedChunk> compressed;
+			if (!ec) {
+				detail::checksumChunk(options, chunkPkt);
+				compressed = detail::compressChunk(options, *conn, chunkPkt);
+			}
+			if (fileExecutor) co_await asio::post(ioExecutor, asio::use_awaitable);
+
+			if (ec) throw std::system_error(ec, "Cannot read " + path.string());
+
+			if (chunkPkt.crc) digest.add(chunkPkt.offset, length, *chunkPkt.crc);
+			if (compressed) conn->send(*compressed, options.priority);
+			else conn->send(chunkPkt, options.priority);
+			sent += length;
+			detail::reportSent(options, length);
+
+			if (!fileExecutor) co_await asio::post(ioExecutor, asio::use_awaitable);
+		}
+
+		// 5. SEND FOOTER (FileDone; the digest covers the chunks sent)
+		cw::packet::FileDone donePkt;
+		donePkt.streamId = streamId;
+		donePkt.fileSize = fileSize;
+		if (options.checksums) donePkt.crc = digest.value();
+		conn->send(donePkt, options.priority);
+		conn->releaseStream(streamId);
+		detail::reportFileSent(options);
+
+		CW_LOG_INFO("[Client] Dedup Complete. Sent ", requested.size(), " of ", chunks->size(), " chunks (", sent, " bytes).");
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,660 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <filesystem>
+#include <system_error>
+#include <algorithm>
+#include <utility>
+#include <span>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <climits>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <linux/falloc.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "cw/metrics/stage_profile.h"
+
+namespace cw::file {
+
+#if defined(_WIN32)
+	using NativeHandle = HANDLE;
+	inline const NativeHandle INVALID_NATIVE_HANDLE = INVALID_HANDLE_VALUE;
+#else
+	using NativeHandle = int;
+	constexpr NativeHandle INVALID_NATIVE_HANDLE = -1;
+#endif
+
+	inline std::system_error lastSystemError(const char* what)
+	{
+#if defined(_WIN32)
+		return std::system_error(static_cast<int>(GetLastError()), std::system_category(), what);
+#else
+		return std::system_error(errno, std::system_category(), what);
+#endif
+	}
+
+	// Unbuffered I/O (the 'direct' opens below): transfers go straight between
+	// the device and the caller's buffer, bypassing the page cache, so a huge
+	// sequential file read or written once does not evict everything else
+	// cached. Offsets, lengths and buffer addresses must be multiples of this
+	// (the logical block size of most devices, and the page size).
+	constexpr std::size_t DIRECT_IO_ALIGNMENT = 4096;
+
+	inline bool isDirectAligned(std::uint64_t offset, std::span<const uint8_t> data)
+	{
+		return offset % DIRECT_IO_ALIGNMENT == 0 && data.size() % DIRECT_IO_ALIGNMENT == 0
+			&& reinterpret_cast<std::uintptr_t>(data.data()) % DIRECT_IO_ALIGNMENT == 0;
+	}
+
+#if !defined(_WIN32)
+	namespace detail {
+
+		// O_DIRECT on Linux and the BSDs. macOS has no such flag: the cache is
+		// turned off per descriptor with F_NOCACHE (no alignment required).
+#if defined(O_DIRECT)
+		constexpr int DIRECT_OPEN_FLAG = O_DIRECT;
+#else
+		constexpr int DIRECT_OPEN_FLAG = 0;
+#endif
+
+		inline void finishDirectOpen(int fd)
+		{
+#if defined(F_NOCACHE)
+			::fcntl(fd, F_NOCACHE, 1);
+#else
+			(void)fd;
+#endif
+		}
+	}
+#endif
+
+	// What a received file keeps of its source besides the contents (see
+	// cw::packet::FileAttributes)
+	struct FileAttributes
+	{
+		std::int64_t modifiedNs = 0; // Nanoseconds since the Unix epoch
+		std::uint32_t mode = 0;      // Permission bits (0777); 0 leaves the receiver's default
+	};
+
+	// RAII wrapper over a raw OS file handle (fd / HANDLE).
+	// Used where the iostream layer is in the way: kernel-side copies, positional I/O.
+	class FileHandle
+	{
+	public:
+		FileHandle() = default;
+		explicit FileHandle(NativeHandle handle) : m_handle(handle) {}
+
+		~FileHandle() { close(); }
+
+		FileHandle(FileHandle&& other) noexcept
+			: m_handle(std::exchange(other.m_handle, INVALID_NATIVE_HANDLE))
+		{
+		}
+
+		FileHandle& operator=(FileHandle&& other) noexcept
+		{
+			if (this != &other) {
+				close();
+				m_handle = std::exchange(other.m_handle, INVALID_NATIVE_HANDLE);
+			}
+			return *this;
+		}
+
+		FileHandle(const FileHandle&) = delete;
+		FileHandle& operator=(const FileHandle&) = delete;
+
+		// Throws std::system_error on failure. 'direct': unbuffered (see
+		// DIRECT_IO_ALIGNMENT); filesystems that cannot (tmpfs, some network
+		// mounts) fail the open with EINVAL, and callers fall back to a normal one.
+		static FileHandle openRead(const std::filesystem::path& path, bool direct = false)
+		{
+#if defined(_WIN32)
+			HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | (direct ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN), nullptr);
+			if (h == INVALID_HANDLE_VALUE) throw lastSystemError("FileHandle: open");
+			return FileHandle(h);
+#else
+			int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | (direct ? detail::DIRECT_OPEN_FLAG : 0));
+			if (fd < 0) throw lastSystemError("FileHandle: open");
+			if (direct) detail::finishDirectOpen(fd);
+			return FileHandle(fd);
+#endif
+		}
+
+		// Creates (or truncates) a file for positional writes. With truncate == false
+		// existing contents are kept (resumed transfers). 'direct' as for openRead.
+		// Throws std::system_error on failure.
+		static FileHandle openWrite(const std::filesystem::path& path, bool truncate = true, bool direct = false)
+		{
+#if defined(_WIN32)
+			// Shared for writing: a WriteBehindFile holds a direct handle next to a buffered one
+			HANDLE h = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+				truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | (direct ? FILE_FLAG_NO_BUFFERING : 0), nullptr);
+			if (h == INVALID_HANDLE_VALUE) throw lastSystemError("FileHandle: create");
+			return FileHandle(h);
+#else
+			int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0) | O_CLOEXEC | (direct ? detail::DIRECT_OPEN_FLAG : 0), 0644);
+			if (fd < 0) throw lastSystemError("FileHandle: create");
+			if (direct) detail::finishDirectOpen(fd);
+			return FileHandle(fd);
+#endif
+		}
+
+		// Positional write (pwrite / WriteFile with an OVERLAPPED offset).
+		// No seek, no shared file position: chunks may land in any order.
+		std::error_code writeAt(std::uint64_t offset, std::span<const uint8_t> data) const
+		{
+			while (!data.empty())
+			{
+#if defined(_WIN32)
+				OVERLAPPED ov{};
+				ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+				ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+				DWORD toWrite = static_cast<DWORD>(std::min<std::size_t>(data.size(), 1u << 30));
+				DWORD written = 0;
+				if (!WriteFile(m_handle, data.data(), toWrite, &written, &ov))
+					return std::error_code(static_cast<int>(GetLastError()), std::system_category());
+#else
+				ssize_t written = ::pwrite(m_handle, data.data(), data.size(), static_cast<off_t>(offset));
+				if (written < 0) {
+					if (errno == EINTR) continue;
+					return std::error_code(errno, std::system_category());
+				}
+				if (written == 0) return std::make_error_code(std::errc::io_error);
+#endif
+				offset += static_cast<std::uint64_t>(written);
+				data = data.subspan(static_cast<std::size_t>(written));
+			}
+			return {};
+		}
+
+		// Gathered positional write (pwritev): 'pieces' land back to back from
+		// 'offset', up to IOV_BATCH per call, their iovecs on the stack.
+		std::error_code writeAt(std::uint64_t offset, std::span<const std::span<const uint8_t>> pieces) const
+		{
+#if defined(_WIN32)
+			for (auto piece : pieces) {
+				if (std::error_code ec = writeAt(offset, piece)) return ec;
+				offset += piece.size();
+			}
+			return {};
+#else
+			std::array<iovec, IOV_BATCH> iov;
+			std::size_t count = 0; // Of 'iov' in use
+			std::size_t next = 0;  // First piece not in 'iov' yet
+			std::size_t skip = 0;  // Of pieces[next - count] already written
+			while (next < pieces.size() || count > 0) {
+				while (next < pieces.size() && count < iov.size()) {
+					auto piece = pieces[next++];
+					if (!piece.empty()) iov[count++] = iovec{ const_cast<uint8_t*>(piece.data()), piece.size() };
+				}
+				if (count == 0) break;
+				iov.front().iov_base = static_cast<uint8_t*>(iov.front().iov_base) + skip;
+				iov.front().iov_len -= skip;
+				skip = 0;
+
+				ssize_t written = ::pwritev(m_handle, iov.data(), static_cast<int>(count), static_cast<off_t>(offset));
+				if (written < 0) {
+					if (errno == EINTR) continue;
+					return std::error_code(errno, std::system_category());
+				}
+				if (written == 0) return std::make_error_code(std::errc::io_error);
+				offset += static_cast<std::uint64_t>(written);
+
+				// Drop what went out; a piece written in part stays, trimmed
+				std::size_t left = static_cast<std::size_t>(written);
+				std::size_t done = 0;
+				while (done < count && left >= iov[done].iov_len) left -= iov[done++].iov_len;
+				std::copy(iov.begin() + done, iov.begin() + count, iov.begin());
+				count -= done;
+				skip = left;
+			}
+			return {};
+#endif
+		}
+
+		// Positional read of exactly data.size() bytes; io_error on a short file.
+		std::error_code readAt(std::uint64_t offset, std::span<uint8_t> data) const
+		{
+			std::size_t bytesRead = 0;
+			std::error_code ec = readAt(offset, data, bytesRead);
+			if (!ec && bytesRead < data.size()) ec = std::make_error_code(std::errc::io_error);
+			return ec;
+		}
+
+		// Same, but stopping at end of file: 'bytesRead' says how much landed.
+		// An unbuffered read of whole blocks past the end is one of these.
+		std::error_code readAt(std::uint64_t offset, std::span<uint8_t> data, std::size_t& bytesRead) const
+		{
+			bytesRead = 0;
+			while (!data.empty())
+			{
+#if defined(_WIN32)
+				OVERLAPPED ov{};
+				ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+				ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+				DWORD toRead = static_cast<DWORD>(std::min<std::size_t>(data.size(), 1u << 30));
+				DWORD read = 0;
+				if (!ReadFile(m_handle, data.data(), toRead, &read, &ov)) {
+					if (GetLastError() == ERROR_HANDLE_EOF) break;
+					return std::error_code(static_cast<int>(GetLastError()), std::system_category());
+				}
+#else
+				ssize_t read = ::pread(m_handle, data.data(), data.size(), static_cast<off_t>(offset));
+				if (read < 0) {
+					if (errno == EINTR) continue;
+					return std::error_code(errno, std::system_category());
+				}
+#endif
+				if (read == 0) break;
+
+				offset += static_cast<std::uint64_t>(read);
+				bytesRead += static_cast<std::size_t>(read);
+				data = data.subspan(static_cast<std::size_t>(read));
+			}
+			return {};
+		}
+
+		// Kernel-side copy of 'length' bytes at 'sourceOffset' of 'source' to
+		// 'offset' (copy_file_range): no user-space buffer, and the filesystem
+		// may share the extents instead (reflink on btrfs, XFS). 'copied' counts
+		// what landed before an error; where the kernel cannot copy between the
+		// two files the error is operation_not_supported with nothing copied,
+		// and the caller copies through memory instead.
+		std::error_code copyRangeFrom(const FileHandle& source, std::uint64_t sourceOffset, std::uint64_t offset,
+			std::uint64_t length, std::uint64_t& copied) const
+		{
+			copied = 0;
+#if defined(__linux__)
+			while (copied < length)
+			{
+				off64_t in = static_cast<off64_t>(sourceOffset + copied);
+				off64_t out = static_cast<off64_t>(offset + copied);
+				ssize_t n = ::copy_file_range(source.m_handle, &in, m_handle, &out, static_cast<std::size_t>(length - copied), 0);
+				if (n < 0) {
+					if (errno == EINTR) continue;
+					// Different filesystems (older kernels), special files, no syscall
+					if (copied == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)) {
+						return std::make_error_code(std::errc::operation_not_supported);
+					}
+					return std::error_code(errno, std::system_category());
+				}
+				if (n == 0) return std::make_error_code(std::errc::io_error); // Source too short
+				copied += static_cast<std::uint64_t>(n);
+			}
+			return {};
+#else
+			(void)source; (void)sourceOffset; (void)offset; (void)length;
+			return std::make_error_code(std::errc::operation_not_supported);
+#endif
+		}
+
+		// Makes this file a copy of all of 'source' by sharing its extents
+		// (FICLONE: btrfs, XFS, and NFS 4.2 servers that clone). Instant whatever
+		// the size. operation_not_supported where the filesystem cannot.
+		std::error_code cloneFrom(const FileHandle& source) const
+		{
+#if defined(__linux__)
+			// <linux/fs.h> has it, and macros (BLOCK_SIZE) that collide with ours
+			constexpr unsigned long FICLONE_REQUEST = _IOW(0x94, 9, int);
+			if (::ioctl(m_handle, FICLONE_REQUEST, source.m_handle) == 0) return {};
+			if (errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOTTY || errno == EPERM) {
+				return std::make_error_code(std::errc::operation_not_supported);
+			}
+			return std::error_code(errno, std::system_category());
+#else
+			(void)source;
+			return std::make_error_code(std::errc::operation_not_supported);
+#endif
+		}
+
+		// See cw::file::preallocate
+		std::error_code preallocate(std::uint64_t size) const;
+
+		// See cw::file::punchHole
+		std::error_code punchHole(std::uint64_t offset, std::uint64_t length) const;
+
+		// See cw::file::applyAttributes
+		std::error_code applyAttributes(const FileAttributes& attributes) const;
+
+		// See cw::file::prefetch, cw::file::dropCache and cw::file::writeBack
+		void prefetch(std::uint64_t offset, std::uint64_t length) const;
+		void dropCache(std::uint64_t offset, std::uint64_t length) const;
+		void writeBack(std::uint64_t offset, std::uint64_t length, bool wait) const;
+
+		// Flushes written data to stable storage (fdatasync / FlushFileBuffers)
+		std::error_code sync() const
+		{
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Fsync);
+#if defined(_WIN32)
+			if (!FlushFileBuffers(m_handle))
+				return std::error_code(static_cast<int>(GetLastError()), std::system_category());
+#elif defined(__APPLE__)
+			if (::fsync(m_handle) != 0) return std::error_code(errno, std::system_category());
+#else
+			if (::fdatasync(m_handle) != 0) return std::error_code(errno, std::system_category());
+#endif
+			return {};
+		}
+
+		bool isOpen() const { return m_handle != INVALID_NATIVE_HANDLE; }
+		NativeHandle native() const { return m_handle; }
+
+		// Gives up ownership: the caller closes the handle
+		NativeHandle release() { return std::exchange(m_handle, INVALID_NATIVE_HANDLE); }
+
+		std::uint64_t size() const
+		{
+#if defined(_WIN32)
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(m_handle, &fileSize)) throw lastSystemError("FileHandle: size");
+			return static_cast<std::uint64_t>(fileSize.QuadPart);
+#else
+			struct stat st {};
+			if (fstat(m_handle, &st) != 0) throw lastSystemError("FileHandle: fstat");
+			return static_cast<std::uint64_t>(st.st_size);
+#endif
+		}
+
+		void close()
+		{
+			if (!isOpen()) return;
+#if defined(_WIN32)
+			CloseHandle(m_handle);
+#else
+			::close(m_handle);
+#endif
+			m_handle = INVALID_NATIVE_HANDLE;
+		}
+
+	private:
+#if !defined(_WIN32)
+		// Pieces per pwritev: a gathered chunk run (Connection's MAX_RUN_CHUNKS) in one call
+		static constexpr std::size_t IOV_BATCH = std::min<std::size_t>(IOV_MAX, 64);
+#endif
+
+		NativeHandle m_handle = INVALID_NATIVE_HANDLE;
+	};
+
+	// Reserves disk space for the whole file up front: contiguous extents, fewer
+	// metadata updates, and ENOSPC now rather than 90% into the transfer.
+	// Filesystems without support are not an error (returns success, no-op).
+	inline std::error_code preallocate(NativeHandle handle, std::uint64_t size)
+	{
+		if (size == 0) return {};
+#if defined(_WIN32)
+		FILE_ALLOCATION_INFO info{};
+		info.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+		if (!SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info))) {
+			DWORD error = GetLastError();
+			if (error == ERROR_DISK_FULL) return std::make_error_code(std::errc::no_space_on_device);
+		}
+		return {};
+#elif defined(__linux__)
+		// fallocate (not posix_fallocate): never falls back to writing zeros
+		while (::fallocate(handle, 0, 0, static_cast<off_t>(size)) != 0) {
+			if (errno == EINTR) continue;
+			if (errno == EOPNOTSUPP || errno == ENOSYS) return {};
+			return std::error_code(errno, std::system_category());
+		}
+		return {};
+#elif defined(__APPLE__)
+		fstore_t store{ F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, static_cast<off_t>(size), 0 };
+		if (::fcntl(handle, F_PREALLOCATE, &store) == -1) {
+			store.fst_flags = F_ALLOCATEALL;
+			if (::fcntl(handle, F_PREALLOCATE, &store) == -1) {
+				if (errno == ENOSPC) return std::error_code(errno, std::system_category());
+			}
+		}
+		return {};
+#else
+		return {};
+#endif
+	}
+
+	inline std::error_code FileHandle::preallocate(std::uint64_t size) const
+	{
+		return cw::file::preallocate(m_handle, size);
+	}
+
+	// Leaves [offset, offset + length) of a file being received unallocated:
+	// the blocks preallocate reserved there are given back (a hole), and the
+	// file grows to cover the range if it is shorter. The range must not have
+	// been written, so where the filesystem cannot punch holes it still reads
+	// as zeros and only the space stays reserved.
+	inline std::error_code punchHole(NativeHandle handle, std::uint64_t offset, std::uint64_t length)
+	{
+		if (length == 0) return {};
+		std::uint64_t end = offset + length;
+#if defined(_WIN32)
+		DWORD returned = 0;
+		FILE_SET_SPARSE_BUFFER sparse{ TRUE };
+		if (DeviceIoControl(handle, FSCTL_SET_SPARSE, &sparse, sizeof(sparse), nullptr, 0, &returned, nullptr)) {
+			FILE_ZERO_DATA_INFORMATION zero{};
+			zero.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+			zero.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(end);
+			DeviceIoControl(handle, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), nullptr, 0, &returned, nullptr);
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(handle, &size)) return std::error_code(static_cast<int>(GetLastError()), std::system_category());
+		if (static_cast<std::uint64_t>(size.QuadPart) < end) {
+			FILE_END_OF_FILE_INFO eof{};
+			eof.EndOfFile.QuadPart = static_cast<LONGLONG>(end);
+			if (!SetFileInformationByHandle(handle, FileEndOfFileInfo, &eof, sizeof(eof)))
+				return std::error_code(static_cast<int>(GetLastError()), std::system_category());
+		}
+		return {};
+#else
+#if defined(__linux__)
+		while (::fallocate(handle, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(length)) != 0) {
+			if (errno == EINTR) continue;
+			if (errno == EOPNOTSUPP || errno == ENOSYS) break;
+			return std::error_code(errno, std::system_category());
+		}
+#endif
+		struct stat st {};
+		if (::fstat(handle, &st) != 0) return std::error_code(errno, std::system_category());
+		if (static_cast<std::uint64_t>(st.st_size) < end && ::ftruncate(handle, static_cast<off_t>(end)) != 0)
+			return std::error_code(errno, std::system_category());
+		return {};
+#endif
+	}
+
+	inline std::error_code FileHandle::punchHole(std::uint64_t offset, std::uint64_t length) const
+	{
+		return cw::file::punchHole(m_handle, offset, length);
+	}
+
+	// Sets the modification time and permission bits of an open file: on the
+	// descriptor, after its last write (a later write would bump the time)
+	// and before it is closed, with no path lookups. Windows keeps only the
+	// time: a read-only file could not be replaced by the next upload.
+	inline std::error_code applyAttributes(NativeHandle handle, const FileAttributes& attributes)
+	{
+#if defined(_WIN32)
+		// FILETIME: 100 ns intervals since 1601
+		constexpr std::int64_t UNIX_EPOCH_FILETIME = 116444736000000000;
+		std::int64_t ticks = attributes.modifiedNs / 100 + UNIX_EPOCH_FILETIME;
+		FILETIME modified{ static_cast<DWORD>(ticks), static_cast<DWORD>(static_cast<std::uint64_t>(ticks) >> 32) };
+		if (!SetFileTime(handle, nullptr, nullptr, &modified)) return std::error_code(static_cast<int>(GetLastError()), std::system_category());
+		return {};
+#else
+		// Never set-id or sticky bits: they are the receiver's to grant
+		if (attributes.mode != 0 && ::fchmod(handle, static_cast<mode_t>(attributes.mode & 0777)) != 0)
+			return std::error_code(errno, std::system_category());
+
+		struct timespec times[2];
+		times[0].tv_sec = 0;
+		times[0].tv_nsec = UTIME_OMIT; // Access time: left alone
+		times[1].tv_sec = static_cast<time_t>(attributes.modifiedNs / 1'000'000'000);
+		times[1].tv_nsec = static_cast<long>(attributes.modifiedNs % 1'000'000'000);
+		if (times[1].tv_nsec < 0) {
+			times[1].tv_sec -= 1;
+			times[1].tv_nsec += 1'000'000'000;
+		}
+		if (::futimens(handle, times) != 0) return std::error_code(errno, std::system_category());
+		return {};
+#endif
+	}
+
+	inline std::error_code FileHandle::applyAttributes(const FileAttributes& attributes) const
+	{
+		return cw::file::applyAttributes(m_handle, attributes);
+	}
+
+	// Asks the kernel to start reading [offset, offset + length) of a file into
+	// the page cache now, in the background (posix_fadvise WILLNEED, F_RDADVISE
+	// on macOS), so a later read of it is a memory copy instead of a wait on the
+	// disk. Only advice: ignored where unsupported (Windows, which reads ahead
+	// of handles opened FILE_FLAG_SEQUENTIAL_SCAN on its own).
+	inline void prefetch(NativeHandle handle, std::uint64_t offset, std::uint64_t length)
+	{
+		if (length == 0) return;
+#if defined(__APPLE__)
+		radvisory advice{ static_cast<off_t>(offset), static_cast<int>(std::min<std::uint64_t>(length, INT32_MAX)) };
+		::fcntl(handle, F_RDADVISE, &advice);
+#elif defined(_WIN32)
+		(void)handle;
+		(void)offset;
+#else
+		::posix_fadvise(handle, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+#endif
+	}
+
+	inline void FileHandle::prefetch(std::uint64_t offset, std::uint64_t length) const
+	{
+		cw::file::prefetch(m_handle, offset, length);
+	}
+
+	// Drop-behind for streaming transfers: tells the kernel the cached pages
+	// of [offset, offset + length) will not be needed again (posix_fadvise
+	// DONTNEED), so a file streamed through once keeps a bounded page cache
+	// footprint instead of evicting what others use. Clean pages go at once;
+	// dirty ones stay until written back (see writeBack). Only advice:
+	// ignored where unsupported (Windows, macOS).
+	inline void dropCache(NativeHandle handle, std::uint64_t offset, std::uint64_t length)
+	{
+		if (length == 0) return;
+#if defined(__APPLE__) || defined(_WIN32)
+		(void)handle;
+		(void)offset;
+#else
+		::posix_fadvise(handle, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+#endif
+	}
+
+	// Starts writing the dirty pages of [offset, offset + length) back to the
+	// device (sync_file_range); 'wait': and waits until they are, so
+	// dropCache can then let them go. Not a durability barrier: no metadata,
+	// no device cache flush (that is sync()). Linux only; elsewhere nothing.
+	inline void writeBack(NativeHandle handle, std::uint64_t offset, std::uint64_t length, bool wait)
+	{
+		if (length == 0) return;
+#if defined(__linux__)
+		unsigned int flags = SYNC_FILE_RANGE_WRITE;
+		if (wait) flags |= SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WAIT_AFTER;
+		while (::sync_file_range(handle, static_cast<off64_t>(offset), static_cast<off64_t>(length), flags) != 0 && errno == EINTR) {}
+#else
+		(void)handle;
+		(void)offset;
+		(void)wait;
+#endif
+	}
+
+	inline void FileHandle::dropCache(std::uint64_t offset, std::uint64_t length) const
+	{
+		cw::file::dropCache(m_handle, offset, length);
+	}
+
+	inline void FileHandle::writeBack(std::uint64_t offset, std::uint64_t length, bool wait) const
+	{
+		cw::file::writeBack(m_handle, offset, length, wait);
+	}
+
+	// A range of a file
+	struct FileExtent
+	{
+		std::uint64_t offset = 0;
+		std::uint64_t length = 0;
+	};
+
+	// The holes of 'file' (ranges the filesystem stores no blocks for, which
+	// read as zeros) that are at least 'minLength' bytes, in order, found with
+	// SEEK_HOLE/SEEK_DATA, or FSCTL_QUERY_ALLOCATED_RANGES on Windows. Empty
+	// for a file without holes, or where the filesystem cannot tell.
+	inline std::vector<FileExtent> findHoles(const FileHandle& file, std::uint64_t size, std::uint64_t minLength)
+	{
+		std::vector<FileExtent> holes;
+		auto addHole = [&](std::uint64_t begin, std::uint64_t end)
+			{
+				if (end > begin && end - begin >= std::max<std::uint64_t>(1, minLength)) holes.push_back({ begin, end - begin });
+			};
+#if defined(_WIN32)
+		FILE_ALLOCATED_RANGE_BUFFER query{};
+		query.Length.QuadPart = static_cast<LONGLONG>(size);
+		std::vector<FILE_ALLOCATED_RANGE_BUFFER> ranges(64);
+		std::uint64_t dataEnd = 0;
+		for (;;) {
+			DWORD returned = 0;
+			BOOL ok = DeviceIoControl(file.native(), FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+				ranges.data(), static_cast<DWORD>(ranges.size() * sizeof(ranges[0])), &returned, nullptr);
+			if (!ok && GetLastError() != ERROR_MORE_DATA) return {};
+
+			std::size_t count = returned / sizeof(ranges[0]);
+			for (std::size_t i = 0; i < count; ++i) {
+				auto begin = static_cast<std::uint64_t>(ranges[i].FileOffset.QuadPart);
+				addHole(dataEnd, begin);
+				dataEnd = begin + static_cast<std::uint64_t>(ranges[i].Length.QuadPart);
+			}
+			if (ok || count == 0) break;
+
+			// More ranges than fit: continue after the last one
+			query.FileOffset.QuadPart = static_cast<LONGLONG>(dataEnd);
+			query.Length.QuadPart = static_cast<LONGLONG>(size - std::min(size, dataEnd));
+		}
+		addHole(dataEnd, size);
+#elif defined(SEEK_HOLE) && defined(SEEK_DATA)
+		off_t position = 0;
+		while (static_cast<std::uint64_t>(position) < size) {
+			off_t hole = ::lseek(file.native(), position, SEEK_HOLE);
+			if (hole < 0) return {};
+			if (static_cast<std::uint64_t>(hole) >= size) break; // The implicit hole at the end
+
+			off_t data = ::lseek(file.native(), hole, SEEK_DATA);
+			if (data < 0 && errno != ENXIO) return {};
+			std::uint64_t dataAt = data < 0 ? size : std::min<std::uint64_t>(static_cast<std::uint64_t>(data), size);
+			addHole(static_cast<std::uint64_t>(hole), dataAt);
+			position = static_cast<off_t>(dataAt);
+		}
+#else
+		(void)file; (void)size;
+#endif
+		return holes;
+	}
+
+	// A byte range of an open file, to be pushed to a socket by the kernel
+	// (sendfile / TransmitFile) without passing through user space.
+	struct FileSegment
+	{
+		std::shared_ptr<const FileHandle> file; // Keeps the handle open until written
+		std::uint64_t offset = 0;
+		std::size_t length = 0;
+
+		bool empty() const { return !file || length == 0; }
+	};
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <asio.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "cw/buffer/shared_buffer.h"
+#include "cw/compression/codec.h"
+#include "cw/file/async_write_file.h"
+#include "cw/file/disk_writer.h"
+#include "cw/file/file_handle.h"
+#include "cw/file/splice_pipe.h"
+#include "cw/metrics/metrics.h"
+
+namespace cw::file {
+
+	// Sink used by Connection for received files: one interface over every
+	// backend this build has (see FileBackend), so positional writes,
+	// compressed chunks, holes, kernel copies, direct I/O and the durability
+	// modes are written once against it and each backend's optimizations
+	// reach every receive path. The backend is picked per file from the
+	// DiskWriter at run time; calls are forwarded through a variant, not a
+	// vtable. Every backend has the member set WriteBehindFile documents.
+	class IncomingFile
+	{
+	public:
+		using Callback = std::function<void(std::error_code)>;
+		using FinishCallback = std::function<void(std::error_code, std::uint64_t bytesWritten)>;
+		using ResumeCallback = std::function<void(std::error_code, std::uint64_t resumeOffset)>;
+
+#if defined(ASIO_HAS_FILE)
+		using Backend = std::variant<std::shared_ptr<WriteBehindFile>, std::shared_ptr<AsyncWriteFile>>;
+#else
+		using Backend = std::variant<std::shared_ptr<WriteBehindFile>>;
+#endif
+
+		explicit IncomingFile(Backend backend) : m_backend(std::move(backend)) {}
+
+		FileBackend backend() const { return m_backend.index() == 0 ? FileBackend::ThreadPool : FileBackend::Native; }
+
+		void open(std::filesystem::path path, std::uint64_t size, Callback onOpened, bool atomic = true)
+		{
+			visit([&](auto& file) { file->open(std::move(path), size, std::move(onOpened), atomic); });
+		}
+
+		void openResumable(std::filesystem::path path, std::uint64_t size, std::uint64_t fingerprint,
+			std::uint64_t checkpointInterval, ResumeCallback onOpened)
+		{
+			visit([&](auto& file) { file->openResumable(std::move(path), size, fingerprint, checkpointInterval, std::move(onOpened)); });
+		}
+
+		void onProgress(std::function<void(std::uint64_t bytesWritten)> fn)
+		{
+			visit([&](auto& file) { file->onProgress(std::move(fn)); });
+		}
+
+		void recordWriteLatency(std::shared_ptr<cw::metrics::LatencyHistogram> histogram)
+		{
+			visit([&](auto& file) { file->recordWriteLatency(std::move(histogram)); });
+		}
+
+		void chargeTo(std::shared_ptr<cw::buffer::MemoryAccount> account)
+		{
+			visit([&](auto& file) { file->chargeTo(std::move(account)); });
+		}
+
+		void write(std::uint64_t offset, cw::buffer::SharedBuffer data, cw::metrics::Clock::time_point arrived = {})
+		{
+			visit([&](auto& file) { file->write(offset, std::move(data), arrived); });
+		}
+
+		void writeGathered(std::uint64_t offset, std::vector<cw::buffer::SharedBuffer> pieces, cw::metrics::Clock::time_point arrived = {})
+		{
+			visit([&](auto& file) { file->writeGathered(offset, std::move(pieces), arrived); });
+		}
+
+		void writeCompressed(std::uint64_t offset, cw::compression::Codec codec, std::uint32_t rawSize, cw::buffer::SharedBuffer data,
+			std::optional<std::uint32_t> crc = std::nullopt, cw::metrics::Clock::time_point arrived = {})
+		{
+			visit([&](auto& file) { file->writeCompressed(offset, codec, rawSize, std::move(data), crc, arrived); });
+		}
+
+		void writeSealed(std::uint64_t offset, std::shared_ptr<const cw::integrity::ChunkCipher> cipher, cw::compression::Codec codec,
+			std::uint32_t rawSize, cw::buffer::SharedBuffer data, cw::metrics::Clock::time_point arrived = {})
+		{
+			visit([&](auto& file) { file->writeSealed(offset, std::move(cipher), codec, rawSize, std::move(data), arrived); });
+		}
+
+		void copyFrom(std::shared_ptr<const FileHandle> source, std::uint64_t sourceOffset, std::uint64_t offset, std::uint64_t length,
+			cw::metrics::Clock::time_point arrived = {})
+		{
+			visit([&](auto& file) { file->copyFrom(std::move(source), sourceOffset, offset, length, arrived); });
+		}
+
+#if defined(__linux__)
+		void writeFromPipe(std::shared_ptr<SplicePipe> pipe, std::uint64_t offset, std::size_t length,
+			cw::metrics::Clock::time_point arrived = {})
+		{
+			visit([&](auto& file) { file->writeFromPipe(std::move(pipe), offset, length, arrived); });
+		}
+#endif
+
+		void unwrite(std::uint64_t length)
+		{
+			visit([&](auto& file) { file->unwrite(length); });
+		}
+
+		void punchHole(std::uint64_t offset, std::uint64_t length)
+		{
+			visit([&](auto& file) { file->punchHole(offset, length); });
+		}
+
+		void cloneFrom(std::shared_ptr<const FileHandle> source, std::uint64_t length, std::function<void(std::uint64_t copied)> onDone)
+		{
+			visit([&](auto& file) { file->cloneFrom(std::move(source), length, std::move(onDone)); });
+		}
+
+		void setSize(std::uint64_t size)
+		{
+			visit([&](auto& file) { file->setSize(size); });
+		}
+
+		void setAttributes(FileAttributes attributes)
+		{
+			visit([&](auto& file) { file->setAttributes(attributes); });
+		}
+
+		void finish(FinishCallback onDone, bool publish = true)
+		{
+			visit([&](auto& file) { file->finish(std::move(onDone), publish); });
+		}
+
+		std::size_t pendingBytes() const
+		{
+			return std::visit([](const auto& file) { return file->pendingBytes(); }, m_backend);
+		}
+
+		void whenDrained(std::size_t threshold, std::function<void()> onDrained)
+		{
+			visit([&](auto& file) { file->whenDrained(threshold, std::move(onDrained)); });
+		}
+
+		void checkpoint()
+		{
+			visit([](auto& file) { file->checkpoint(); });
+		}
+
+	private:
+		template<typename F>
+		void visit(F&& fn) { std::visit(std::forward<F>(fn), m_backend); }
+
+		Backend m_backend;
+	};
+
+	// A received file on the writer's backend, completing on 'executor';
+	// written in the share of 'tenant' (ThreadPool backend, see DiskScheduler)
+	inline std::shared_ptr<IncomingFile> makeIncomingFile(DiskWriter& writer, asio::any_io_executor executor,
+		std::shared_ptr<DiskTenant> tenant = nullptr)
+	{
+#if defined(ASIO_HAS_FILE)
+		if (writer.backend() == FileBackend::Native)
+			return std::make_shared<IncomingFile>(AsyncWriteFile::create(std::move(executor), writer.directories(), writer.durability(), writer.load()));
+#endif
+		return std::make_shared<IncomingFile>(WriteBehindFile::create(writer, std::move(executor), std::move(tenant)));
+	}
+}
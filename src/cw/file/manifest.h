@@ -0,0 +1,135 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "cw/protocol/packet/packet.h"
+
+namespace cw::file {
+
+	// 64-bit FNV-1a. Not cryptographic: detects changed files, not tampering.
+	class Fnv1a
+	{
+	public:
+		void update(const std::uint8_t* data, std::size_t length)
+		{
+			for (std::size_t i = 0; i < length; ++i) {
+				m_hash ^= data[i];
+				m_hash *= 1099511628211ull;
+			}
+		}
+
+		void update(std::uint64_t value)
+		{
+			std::uint8_t bytes[sizeof(value)];
+			for (std::size_t i = 0; i < sizeof(value); ++i) bytes[i] = static_cast<std::uint8_t>(value >> (8 * i));
+			update(bytes, sizeof(bytes));
+		}
+
+		std::uint64_t value() const { return m_hash; }
+
+	private:
+		std::uint64_t m_hash = 14695981039346656037ull;
+	};
+
+	// Portable modification time: both ends may use different file clocks.
+	inline std::int64_t modifiedNs(std::filesystem::file_time_type time)
+	{
+		auto system = std::chrono::file_clock::to_sys(time);
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(system.time_since_epoch()).count();
+	}
+
+	// Hash of the whole contents; never 0, which the manifest reserves for "none".
+	inline std::optional<std::uint64_t> contentHash(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return std::nullopt;
+
+		Fnv1a hash;
+		std::vector<char> buffer(1024 * 1024);
+		while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+			hash.update(reinterpret_cast<const std::uint8_t*>(buffer.data()), static_cast<std::size_t>(file.gcount()));
+		}
+		if (file.bad()) return std::nullopt;
+
+		return hash.value() == 0 ? 1 : hash.value();
+	}
+
+	// Identifies the source contents for FileResume and FileCopy: FNV-1a over
+	// the size, the modification time and the first and last 64 KB. Cheap, and
+	// changes when the file is rewritten or appended to, which is what a resume
+	// (or a server copying the file itself) must detect.
+	inline uint64_t fileFingerprint(const std::filesystem::path& path, uint64_t fileSize)
+	{
+		constexpr size_t SAMPLE_SIZE = 64 * 1024;
+
+		Fnv1a hash;
+		hash.update(fileSize);
+
+		std::error_code ec;
+		auto modified = std::filesystem::last_write_time(path, ec);
+		if (!ec) hash.update(static_cast<uint64_t>(modified.time_since_epoch().count()));
+
+		std::ifstream file(path, std::ios::binary);
+		std::vector<uint8_t> sample(static_cast<size_t>(std::min<uint64_t>(SAMPLE_SIZE, fileSize)));
+		if (file.read(reinterpret_cast<char*>(sample.data()), sample.size())) hash.update(sample.data(), sample.size());
+
+		if (fileSize > SAMPLE_SIZE) {
+			file.seekg(static_cast<std::streamoff>(fileSize - sample.size()));
+			if (file.read(reinterpret_cast<char*>(sample.data()), sample.size())) hash.update(sample.data(), sample.size());
+		}
+		return hash.value();
+	}
+
+	// Sender side of a sync. nullopt if the file vanished or cannot be hashed.
+	inline std::optional<cw::packet::ManifestEntry> describeFile(const std::filesystem::path& path, std::string remoteName, bool withHash)
+	{
+		std::error_code ec;
+		cw::packet::ManifestEntry entry;
+		entry.fileName = std::move(remoteName);
+		entry.fileSize = std::filesystem::file_size(path, ec);
+		if (ec) return std::nullopt;
+
+		auto modified = std::filesystem::last_write_time(path, ec);
+		if (ec) return std::nullopt;
+		entry.modifiedNs = modifiedNs(modified);
+
+		if (withHash) {
+			auto hash = contentHash(path);
+			if (!hash) return std::nullopt;
+			entry.hash = *hash;
+		}
+		return entry;
+	}
+
+	// Receiver side: true if 'local' already holds what 'entry' describes.
+	// With a hash the contents decide. Without one, a copy of the same size
+	// written no earlier than the source was last modified counts as current:
+	// received files carry their arrival time, so an unchanged source stays older.
+	inline bool isUpToDate(const cw::packet::ManifestEntry& entry, const std::filesystem::path& local)
+	{
+		std::error_code ec;
+		if (!std::filesystem::is_regular_file(local, ec)) return false;
+		if (std::filesystem::file_size(local, ec) != entry.fileSize || ec) return false;
+
+		if (entry.hash != 0) return contentHash(local) == entry.hash;
+
+		auto modified = std::filesystem::last_write_time(local, ec);
+		return !ec && modifiedNs(modified) >= entry.modifiedNs;
+	}
+
+	// Indices of the entries 'isUpToDate' rejects (the reply to a Manifest).
+	inline std::vector<std::uint32_t> changedEntries(const std::vector<cw::packet::ManifestEntry>& entries)
+	{
+		std::vector<std::uint32_t> changed;
+		for (std::uint32_t i = 0; i < entries.size(); ++i) {
+			if (!isUpToDate(entries[i], std::filesystem::path(entries[i].fileName))) changed.push_back(i);
+		}
+		return changed;
+	}
+}
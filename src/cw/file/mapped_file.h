@@ -0,0 +1,258 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <filesystem>
+#include <system_error>
+#include <utility>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cw/buffer/shared_buffer.h"
+#include "cw/file/file_handle.h"
+
+namespace cw::file {
+
+	// Read-only mapping of a whole file.
+	// Chunks handed out by slice() keep the mapping alive (shared owner), so the
+	// payload of every FileChunk is a view into the page cache rather than a heap copy.
+	class MappedFile : public std::enable_shared_from_this<MappedFile>
+	{
+	public:
+		// Throws std::system_error if the file cannot be opened or mapped.
+		static std::shared_ptr<MappedFile> open(const std::filesystem::path& path)
+		{
+			auto file = std::shared_ptr<MappedFile>(new MappedFile());
+			file->map(path);
+			return file;
+		}
+
+		~MappedFile()
+		{
+#if defined(_WIN32)
+			if (m_data) UnmapViewOfFile(m_data);
+			if (m_mapping) CloseHandle(m_mapping);
+			if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+			if (m_data) munmap(m_data, m_size);
+			if (m_fd >= 0) ::close(m_fd);
+#endif
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		std::uint64_t size() const { return m_size; }
+
+		// Has [offset, offset + length) of the mapping paged in in the background
+		// (madvise WILLNEED, PrefetchVirtualMemory), ahead of the slices that
+		// will be sent from it. Clamped to the end of the file; only advice.
+		void prefetch(std::uint64_t offset, std::uint64_t length)
+		{
+			if (offset >= m_size || length == 0) return;
+			length = std::min(length, m_size - offset);
+#if defined(_WIN32)
+			WIN32_MEMORY_RANGE_ENTRY range{ static_cast<uint8_t*>(m_data) + offset, static_cast<SIZE_T>(length) };
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+			static const std::uint64_t page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+			std::uint64_t start = offset / page * page;
+			madvise(static_cast<uint8_t*>(m_data) + start, static_cast<std::size_t>(offset + length - start), MADV_WILLNEED);
+#endif
+		}
+
+		// Drop-behind (see cw::file::dropCache): unmaps the pages of [offset,
+		// offset + length) from this process (madvise DONTNEED; a slice still
+		// being sent faults them back in from the file), then lets the page
+		// cache drop them. Only whole pages inside the range. Nothing on Windows.
+		void dropCache(std::uint64_t offset, std::uint64_t length)
+		{
+			if (offset >= m_size || length == 0) return;
+			length = std::min(length, m_size - offset);
+#if !defined(_WIN32)
+			static const std::uint64_t page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+			std::uint64_t start = (offset + page - 1) / page * page;
+			std::uint64_t end = offset + length == m_size ? m_size : (offset + length) / page * page;
+			if (start >= end) return;
+			madvise(static_cast<uint8_t*>(m_data) + start, static_cast<std::size_t>(end - start), MADV_DONTNEED);
+			cw::file::dropCache(m_fd, start, end - start);
+#endif
+		}
+
+		// Zero-copy chunk of the mapping. Clamped to the end of the file.
+		cw::buffer::SharedBuffer slice(std::uint64_t offset, std::size_t length)
+		{
+			if (offset >= m_size) return {};
+
+			std::size_t available = static_cast<std::size_t>(std::min<std::uint64_t>(length, m_size - offset));
+			std::span<const uint8_t> view(static_cast<const uint8_t*>(m_data) + offset, available);
+			return cw::buffer::SharedBuffer(shared_from_this(), view);
+		}
+
+	private:
+		MappedFile() = default;
+
+		void map(const std::filesystem::path& path)
+		{
+#if defined(_WIN32)
+			m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (m_file == INVALID_HANDLE_VALUE) throw lastSystemError("MappedFile: open");
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(m_file, &fileSize)) throw lastSystemError("MappedFile: size");
+			m_size = static_cast<std::uint64_t>(fileSize.QuadPart);
+			if (m_size == 0) return;
+
+			m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!m_mapping) throw lastSystemError("MappedFile: CreateFileMapping");
+
+			m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+			if (!m_data) throw lastSystemError("MappedFile: MapViewOfFile");
+#else
+			m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (m_fd < 0) throw lastSystemError("MappedFile: open");
+
+			struct stat st {};
+			if (fstat(m_fd, &st) != 0) throw lastSystemError("MappedFile: fstat");
+			m_size = static_cast<std::uint64_t>(st.st_size);
+			if (m_size == 0) return;
+
+			void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+			if (data == MAP_FAILED) throw lastSystemError("MappedFile: mmap");
+			m_data = data;
+
+			// Streaming access: aggressive read-ahead, early reclaim behind us
+			madvise(m_data, m_size, MADV_SEQUENTIAL);
+#endif
+		}
+
+	private:
+		void* m_data = nullptr;
+		std::uint64_t m_size = 0;
+#if defined(_WIN32)
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+#else
+		int m_fd = -1;
+#endif
+	};
+
+	// Writable shared mapping of a file being received (see
+	// DiskWriter::setMappedWrites): chunks are copied into the page cache
+	// with memcpy rather than handed to the kernel one pwrite each. Only a
+	// file already as long as the mapping, every block of it allocated (see
+	// cw::file::preallocate), is mapped: a store into a page the filesystem
+	// cannot back raises SIGBUS instead of returning ENOSPC. Unsupported on
+	// Windows. Not thread-safe.
+	class WritableMapping
+	{
+	public:
+		WritableMapping() = default;
+		~WritableMapping() { unmap(); }
+
+		WritableMapping(WritableMapping&& other) noexcept
+			: m_data(std::exchange(other.m_data, nullptr)),
+			m_size(std::exchange(other.m_size, 0))
+		{
+		}
+
+		WritableMapping& operator=(WritableMapping&& other) noexcept
+		{
+			if (this != &other) {
+				unmap();
+				m_data = std::exchange(other.m_data, nullptr);
+				m_size = std::exchange(other.m_size, 0);
+			}
+			return *this;
+		}
+
+		WritableMapping(const WritableMapping&) = delete;
+		WritableMapping& operator=(const WritableMapping&) = delete;
+
+		// Maps the first 'size' bytes of 'path' (through a handle of its own,
+		// as a mapping needs read access). operation_not_supported for a file
+		// shorter than that or not fully allocated.
+		std::error_code map(const std::filesystem::path& path, std::uint64_t size)
+		{
+			unmap();
+			if (size == 0) return std::make_error_code(std::errc::invalid_argument);
+#if defined(_WIN32)
+			(void)path;
+			return std::make_error_code(std::errc::operation_not_supported);
+#else
+			int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+			if (fd < 0) return { errno, std::system_category() };
+
+			std::error_code ec;
+			struct stat st {};
+			if (fstat(fd, &st) != 0) ec = { errno, std::system_category() };
+			else if (static_cast<std::uint64_t>(st.st_size) < size || static_cast<std::uint64_t>(st.st_blocks) * 512 < size)
+				ec = std::make_error_code(std::errc::operation_not_supported);
+			else {
+				void* data = mmap(nullptr, static_cast<std::size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (data == MAP_FAILED) ec = { errno, std::system_category() };
+				else {
+					m_data = data;
+					m_size = size;
+				}
+			}
+			::close(fd); // The mapping keeps the file
+			return ec;
+#endif
+		}
+
+		bool isMapped() const { return m_data != nullptr; }
+		std::uint64_t size() const { return m_size; }
+
+		// Copies 'data' to 'offset'; false, nothing copied, if it does not fit
+		// inside the mapping
+		bool write(std::uint64_t offset, std::span<const uint8_t> data)
+		{
+			if (!m_data || offset > m_size || data.size() > m_size - offset) return false;
+			std::memcpy(static_cast<uint8_t*>(m_data) + offset, data.data(), data.size());
+			return true;
+		}
+
+		// msync of the pages of [offset, offset + length): 'wait' (MS_SYNC)
+		// until they are written, else (MS_ASYNC) only scheduled
+		std::error_code flush(std::uint64_t offset, std::uint64_t length, bool wait)
+		{
+			if (!m_data || offset >= m_size || length == 0) return {};
+#if defined(_WIN32)
+			(void)wait;
+			return {};
+#else
+			length = std::min(length, m_size - offset);
+			static const std::uint64_t page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+			std::uint64_t start = offset / page * page;
+			if (msync(static_cast<uint8_t*>(m_data) + start, static_cast<std::size_t>(offset + length - start), wait ? MS_SYNC : MS_ASYNC) != 0)
+				return { errno, std::system_category() };
+			return {};
+#endif
+		}
+
+		// What was stored stays in the page cache, for the file's own sync
+		void unmap()
+		{
+#if !defined(_WIN32)
+			if (m_data) munmap(m_data, static_cast<std::size_t>(m_size));
+#endif
+			m_data = nullptr;
+			m_size = 0;
+		}
+
+	private:
+		void* m_data = nullptr;
+		std::uint64_t m_size = 0;
+	};
+}
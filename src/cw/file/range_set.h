@@ -0,0 +1,113 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace cw::file {
+
+	// Disjoint byte ranges [from, to) of a file, merged as they touch: what
+	// of it has been received, whatever order the chunks came in. A stream
+	// received in order stays one range; each hole costs one more. Not
+	// thread-safe (see IncomingTransfer::markReceived).
+	class RangeSet
+	{
+	public:
+		using Range = std::pair<std::uint64_t, std::uint64_t>;
+
+		// Adds [from, to); returns how many of its bytes were not in the set
+		// (0: all were, a duplicate)
+		std::uint64_t insert(std::uint64_t from, std::uint64_t to)
+		{
+			if (from >= to) return 0;
+			std::uint64_t added = to - from;
+
+			// The first range that touches or follows 'from'
+			auto it = m_ranges.upper_bound(from);
+			if (it != m_ranges.begin() && std::prev(it)->second >= from) --it;
+
+			if (it == m_ranges.end() || it->first > to) {
+				m_ranges.emplace_hint(it, from, to);
+				m_covered += added;
+				return added;
+			}
+
+			// Merged into the first touching range's node, re-keyed rather
+			// than reallocated: an in-order stream inserts without the heap
+			auto node = m_ranges.extract(it++);
+			added -= overlap(node.key(), node.mapped(), from, to);
+			from = std::min(from, node.key());
+			to = std::max(to, node.mapped());
+			for (; it != m_ranges.end() && it->first <= to; it = m_ranges.erase(it)) {
+				added -= overlap(it->first, it->second, from, to);
+				to = std::max(to, it->second);
+			}
+			node.key() = from;
+			node.mapped() = to;
+			m_ranges.insert(it, std::move(node));
+			m_covered += added;
+			return added;
+		}
+
+		// Takes [from, to) out; returns how many of its bytes were in the set
+		std::uint64_t erase(std::uint64_t from, std::uint64_t to)
+		{
+			if (from >= to) return 0;
+			std::uint64_t removed = 0;
+
+			auto it = m_ranges.upper_bound(from);
+			if (it != m_ranges.begin() && std::prev(it)->second > from) --it;
+
+			while (it != m_ranges.end() && it->first < to) {
+				auto [start, end] = *it;
+				removed += overlap(start, end, from, to);
+				it = m_ranges.erase(it);
+				if (start < from) m_ranges.emplace_hint(it, start, from);
+				if (end > to) it = m_ranges.emplace_hint(it, to, end);
+			}
+			m_covered -= removed;
+			return removed;
+		}
+
+		// Whether every byte of [from, to) is in the set
+		bool contains(std::uint64_t from, std::uint64_t to) const
+		{
+			if (from >= to) return true;
+			auto it = m_ranges.upper_bound(from);
+			if (it == m_ranges.begin()) return false;
+			--it;
+			return it->first <= from && it->second >= to;
+		}
+
+		// The ranges of [0, size) not in the set, in order
+		std::vector<Range> gaps(std::uint64_t size) const
+		{
+			std::vector<Range> missing;
+			std::uint64_t at = 0;
+			for (const auto& [from, to] : m_ranges) {
+				if (from >= size) break;
+				if (from > at) missing.emplace_back(at, from);
+				at = std::max(at, to);
+			}
+			if (at < size) missing.emplace_back(at, size);
+			return missing;
+		}
+
+		std::uint64_t covered() const { return m_covered; }
+		std::size_t rangeCount() const { return m_ranges.size(); }
+
+	private:
+		static std::uint64_t overlap(std::uint64_t aFrom, std::uint64_t aTo, std::uint64_t bFrom, std::uint64_t bTo)
+		{
+			std::uint64_t from = std::max(aFrom, bFrom);
+			std::uint64_t to = std::min(aTo, bTo);
+			return to > from ? to - from : 0;
+		}
+
+		std::map<std::uint64_t, std::uint64_t> m_ranges; // from -> to
+		std::uint64_t m_covered = 0;
+	};
+}
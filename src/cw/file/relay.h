@@ -0,0 +1,104 @@
+#pragma once
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "cw/file/file.h"
+#include "cw/log/logger.h"
+
+namespace cw {
+
+	// Passes every file received by the connections it is attached to on to
+	// the next servers, once the file is verified and published: chain
+	// replication (A -> B -> C, each node relaying to one more) or a tree
+	// (each relaying to several), so distributing one file to many nodes
+	// costs the source one upload and every node at most its own hops.
+	// Files are forwarded whole from the published copy, by asyncSendFile
+	// with 'options' (kernel copy or mapping of what is still in the page
+	// cache), each on its own coroutine on the next hop's executor.
+	// Thread-safe; a next hop gets the files published after it was added.
+	class FileRelay : public std::enable_shared_from_this<FileRelay>
+	{
+	public:
+		explicit FileRelay(TransferOptions options = {}, std::optional<asio::any_io_executor> fileExecutor = std::nullopt) :
+			m_options(std::move(options)), m_fileExecutor(std::move(fileExecutor))
+		{
+		}
+
+		// A connected (or at least started) connection to a server files are passed to
+		void addNextHop(std::shared_ptr<cw::network::Connection> conn)
+		{
+			std::lock_guard lock(m_mutex);
+			m_nextHops.push_back(std::move(conn));
+		}
+
+		std::size_t nextHopCount() const
+		{
+			std::lock_guard lock(m_mutex);
+			return m_nextHops.size();
+		}
+
+		// Files 'conn' receives are relayed. Call before conn.start().
+		void attach(cw::network::Connection& conn)
+		{
+			conn.onFilePublished([weak = weak_from_this()](fs::path path)
+				{
+					if (auto self = weak.lock()) self->forward(std::move(path));
+				});
+		}
+
+		// Sends 'path' (relative to the working directory, where received files land) to every next hop
+		void forward(fs::path path)
+		{
+			std::vector<std::shared_ptr<cw::network::Connection>> nextHops;
+			{
+				std::lock_guard lock(m_mutex);
+				nextHops = m_nextHops;
+			}
+
+			for (auto& conn : nextHops) {
+				if (!conn->isOpen()) {
+					CW_LOG_WARN("[Relay] Next hop closed, not relaying ", path.generic_string());
+					continue;
+				}
+				auto executor = conn->socket().get_executor();
+				asio::co_spawn(executor, relayFile(conn, path, m_options, m_fileExecutor),
+					[name = path.generic_string()](std::exception_ptr error)
+					{
+						if (!error) return;
+						try {
+							std::rethrow_exception(error);
+						}
+						catch (const std::exception& e) {
+							CW_LOG_WARN("[Relay] ", name, " not relayed: ", e.what());
+						}
+					});
+			}
+		}
+
+	private:
+		static asio::awaitable<void> relayFile(std::shared_ptr<cw::network::Connection> conn,
+			fs::path path,
+			TransferOptions options,
+			std::optional<asio::any_io_executor> fileExecutor)
+		{
+			// Options are negotiated against what the next hop announced
+			co_await conn->asyncWaitCapabilities(asio::use_awaitable);
+
+			CW_LOG_INFO("[Relay] Passing on ", path.generic_string());
+			std::string name = path.generic_string();
+			co_await asyncSendFile(std::move(conn), std::move(path), std::move(name), std::move(options), fileExecutor);
+		}
+
+		mutable std::mutex m_mutex;
+		std::vector<std::shared_ptr<cw::network::Connection>> m_nextHops;
+		TransferOptions m_options;
+		std::optional<asio::any_io_executor> m_fileExecutor;
+	};
+}
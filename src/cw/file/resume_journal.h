@@ -0,0 +1,160 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "cw/endian.h"
+
+namespace cw::file {
+
+	// What a partial destination file holds: the first 'offset' bytes of the
+	// source identified by 'fingerprint'/'fileSize' are on stable storage,
+	// and so are the 'ranges' past it ([from, to), sorted, apart), chunks
+	// that landed ahead of a hole. The sender resumes at 'offset'; the
+	// ranges let the prefix grow over them once the hole fills.
+	struct ResumeState
+	{
+		std::uint64_t fingerprint = 0;
+		std::uint64_t fileSize = 0;
+		std::uint64_t offset = 0;
+		std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges = {};
+	};
+
+	// Sidecar "<file>.cwpart" next to a partially received file. Rewritten
+	// (write + rename) at each checkpoint, removed once the file is complete.
+	// Version 01 records are the prefix alone; 02 adds the ranges.
+	class ResumeJournal
+	{
+	public:
+		static constexpr std::array<char, 8> MAGIC = { 'C', 'W', 'P', 'A', 'R', 'T', '0', '2' };
+		static constexpr std::array<char, 8> MAGIC_V1 = { 'C', 'W', 'P', 'A', 'R', 'T', '0', '1' };
+		static constexpr std::size_t RECORD_SIZE = MAGIC.size() + 3 * sizeof(std::uint64_t);
+		static constexpr std::size_t MAX_RANGES = 4096; // Past it, the furthest ones are left out
+
+		explicit ResumeJournal(const std::filesystem::path& target)
+			: m_path(pathFor(target))
+		{
+		}
+
+		static std::filesystem::path pathFor(const std::filesystem::path& target)
+		{
+			std::filesystem::path journal = target;
+			journal += ".cwpart";
+			return journal;
+		}
+
+		const std::filesystem::path& path() const { return m_path; }
+
+		// The file a journal path belongs to (its name less ".cwpart")
+		static std::filesystem::path targetOf(const std::filesystem::path& journal)
+		{
+			std::filesystem::path target = journal;
+			target.replace_extension();
+			return target;
+		}
+
+		// nullopt if there is no journal or it is unreadable
+		std::optional<ResumeState> load() const
+		{
+			std::ifstream in(m_path, std::ios::binary);
+			std::array<uint8_t, RECORD_SIZE> record{};
+			if (!in.read(reinterpret_cast<char*>(record.data()), record.size())) return std::nullopt;
+			bool ranged = std::memcmp(record.data(), MAGIC.data(), MAGIC.size()) == 0;
+			if (!ranged && std::memcmp(record.data(), MAGIC_V1.data(), MAGIC_V1.size()) != 0) return std::nullopt;
+
+			const uint8_t* cursor = record.data() + MAGIC.size();
+			ResumeState state;
+			state.fingerprint = cw::binary::readBigEndian<uint64_t>(cursor);
+			state.fileSize = cw::binary::readBigEndian<uint64_t>(cursor + sizeof(uint64_t));
+			state.offset = cw::binary::readBigEndian<uint64_t>(cursor + 2 * sizeof(uint64_t));
+			if (!ranged) return state;
+
+			// A torn or inconsistent range list costs the ranges, not the prefix
+			std::array<uint8_t, sizeof(uint32_t)> countBytes{};
+			if (!in.read(reinterpret_cast<char*>(countBytes.data()), countBytes.size())) return state;
+			std::uint32_t count = cw::binary::readBigEndian<uint32_t>(countBytes.data());
+			if (count > MAX_RANGES) return state;
+			std::vector<uint8_t> ranges(count * 2 * sizeof(uint64_t));
+			if (!in.read(reinterpret_cast<char*>(ranges.data()), ranges.size())) return state;
+
+			std::uint64_t last = state.offset;
+			for (std::uint32_t i = 0; i < count; ++i) {
+				std::uint64_t from = cw::binary::readBigEndian<uint64_t>(ranges.data() + i * 2 * sizeof(uint64_t));
+				std::uint64_t to = cw::binary::readBigEndian<uint64_t>(ranges.data() + (i * 2 + 1) * sizeof(uint64_t));
+				if (from <= last || to <= from || to > state.fileSize) {
+					state.ranges.clear();
+					return state;
+				}
+				state.ranges.emplace_back(from, to);
+				last = to;
+			}
+			return state;
+		}
+
+		std::error_code save(const ResumeState& state) const
+		{
+			std::vector<uint8_t> record(MAGIC.begin(), MAGIC.end());
+			cw::binary::writeBigEndian(record, state.fingerprint);
+			cw::binary::writeBigEndian(record, state.fileSize);
+			cw::binary::writeBigEndian(record, state.offset);
+			std::size_t count = std::min(state.ranges.size(), MAX_RANGES);
+			cw::binary::writeBigEndian(record, static_cast<uint32_t>(count));
+			for (std::size_t i = 0; i < count; ++i) {
+				cw::binary::writeBigEndian(record, state.ranges[i].first);
+				cw::binary::writeBigEndian(record, state.ranges[i].second);
+			}
+
+			std::filesystem::path temp = m_path;
+			temp += ".tmp";
+			{
+				std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+				out.write(reinterpret_cast<const char*>(record.data()), record.size());
+				if (!out) return std::make_error_code(std::errc::io_error);
+			}
+
+			// Rename is atomic: a crash leaves either the old or the new checkpoint
+			std::error_code ec;
+			std::filesystem::rename(temp, m_path, ec);
+			return ec;
+		}
+
+		void remove() const
+		{
+			std::error_code ignored;
+			std::filesystem::remove(m_path, ignored);
+		}
+
+	private:
+		std::filesystem::path m_path;
+	};
+
+	// A partial file found by findInterrupted and where it resumes
+	struct InterruptedTransfer
+	{
+		std::filesystem::path target; // The file's final name
+		ResumeState state;
+	};
+
+	// The journals under 'root': after a restart, the transfers a crash or a
+	// shutdown cut short, each resumable where its journal says, as a journal
+	// is only written once the data it vouches for is synced. Unreadable
+	// journals are left out.
+	inline std::vector<InterruptedTransfer> findInterrupted(const std::filesystem::path& root)
+	{
+		std::vector<InterruptedTransfer> found;
+		std::error_code ec;
+		for (std::filesystem::recursive_directory_iterator it(root, std::filesystem::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec)) {
+			if (it->path().extension() != ".cwpart" || !it->is_regular_file(ec)) continue;
+			std::filesystem::path target = ResumeJournal::targetOf(it->path());
+			if (auto state = ResumeJournal(target).load()) found.push_back({ std::move(target), std::move(*state) });
+		}
+		return found;
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <concepts>
+#include <filesystem>
+#include <string_view>
+
+namespace cw::file {
+
+	namespace detail {
+
+		template <typename CharT>
+		constexpr bool isSafeRelativePath(std::basic_string_view<CharT> name)
+		{
+			if (name.empty()) return false;
+			if (name.front() == CharT('/') || name.front() == CharT('\\')) return false;
+			if (name.size() >= 2 && name[1] == CharT(':')) return false; // "C:", "C:x" and alike
+
+			// Component by component: [start, i) is the one being read
+			std::size_t start = 0;
+			for (std::size_t i = 0; i <= name.size(); ++i) {
+				CharT c = i < name.size() ? name[i] : CharT('/');
+				if (c == CharT('\0')) return false;
+				if (c != CharT('/') && c != CharT('\\')) continue;
+				if (i - start == 2 && name[start] == CharT('.') && name[start + 1] == CharT('.')) return false;
+				start = i + 1;
+			}
+			return true;
+		}
+	}
+
+	// True if 'name', a file a peer asked this end to write, stays under the
+	// directory it is resolved against: not empty, not absolute, no drive,
+	// no ".." component, no NUL. Both '/' and '\' separate components, as
+	// either does for a Windows receiver. One pass over the name, nothing
+	// allocated or asked of the filesystem, so every received name pays it;
+	// links planted in the destination are DirectoryCache's confined mode.
+	constexpr bool isSafeRelativePath(std::string_view name) { return detail::isSafeRelativePath(name); }
+
+	// A path itself, not whatever converts to one (a string is a name above)
+	template <std::same_as<std::filesystem::path> Path>
+	bool isSafeRelativePath(const Path& path)
+	{
+		return detail::isSafeRelativePath(std::basic_string_view<std::filesystem::path::value_type>(path.native()));
+	}
+}
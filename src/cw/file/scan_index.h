@@ -0,0 +1,209 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "cw/buffer/shared_buffer.h"
+#include "cw/endian.h"
+#include "cw/file/manifest.h"
+#include "cw/file/mapped_file.h"
+
+namespace cw::file {
+
+	// The client's record of a tree as it stood at the end of the last sync
+	// that completed (DirectoryUploadOptions::scanIndex): path, size, mtime,
+	// inode and content hash of each file. A file that still matches its
+	// record was on the server then, so the next sync leaves it out of the
+	// manifests and never hashes it. The file is mapped, not parsed: fixed
+	// size records sorted by path, then the paths, so an index of millions
+	// of files opens at once and is read only where it is looked up.
+	//
+	// Layout: MAGIC, record count (8 bytes), records, paths; big endian.
+	// A record is the offset and length of its path (from the start of the
+	// paths), size, mtime, inode and hash, 8 bytes each.
+	class ScanIndex
+	{
+	public:
+		struct Entry
+		{
+			std::string path; // Remote name, as in the manifest
+			std::uint64_t size = 0;
+			std::int64_t modifiedNs = 0;
+			std::uint64_t inode = 0; // 0 where the platform has none
+			std::uint64_t hash = 0;  // contentHash; 0 = not computed
+		};
+
+		static constexpr std::array<char, 8> MAGIC = { 'C', 'W', 'S', 'C', 'A', 'N', '0', '1' };
+		static constexpr std::size_t HEADER_SIZE = MAGIC.size() + sizeof(std::uint64_t);
+		static constexpr std::size_t RECORD_SIZE = 6 * sizeof(std::uint64_t);
+
+		// $XDG_CACHE_HOME/connectwith/index/<hash of root and destination>
+		// (~/.cache on Unix, %LOCALAPPDATA% on Windows): one per tree and server
+		static std::filesystem::path defaultPath(const std::filesystem::path& root, const std::string& destination)
+		{
+			std::filesystem::path base;
+			if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache && *cache) base = cache;
+			else if (const char* local = std::getenv("LOCALAPPDATA"); local && *local) base = local;
+			else if (const char* home = std::getenv("HOME"); home && *home) base = std::filesystem::path(home) / ".cache";
+			else base = std::filesystem::temp_directory_path();
+
+			std::error_code ec;
+			auto absolute = std::filesystem::absolute(root, ec).lexically_normal().generic_string();
+			Fnv1a key;
+			key.update(reinterpret_cast<const std::uint8_t*>(absolute.data()), absolute.size());
+			key.update(reinterpret_cast<const std::uint8_t*>("\n"), 1);
+			key.update(reinterpret_cast<const std::uint8_t*>(destination.data()), destination.size());
+
+			char name[17];
+			std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key.value()));
+			return base / "connectwith" / "index" / name;
+		}
+
+		// Maps the index at 'path'; empty if there is none or it is damaged
+		explicit ScanIndex(std::filesystem::path path) : m_path(std::move(path))
+		{
+			std::error_code ec;
+			if (!std::filesystem::is_regular_file(m_path, ec)) return;
+			try {
+				auto file = MappedFile::open(m_path);
+				m_mapping = file->slice(0, static_cast<std::size_t>(file->size()));
+			}
+			catch (const std::system_error&) {
+				return;
+			}
+
+			if (m_mapping.size() < HEADER_SIZE || std::memcmp(m_mapping.data(), MAGIC.data(), MAGIC.size()) != 0) {
+				m_mapping = {};
+				return;
+			}
+			std::uint64_t count = cw::binary::readBigEndian<std::uint64_t>(m_mapping.data() + MAGIC.size());
+			if (count > (m_mapping.size() - HEADER_SIZE) / RECORD_SIZE) {
+				m_mapping = {};
+				return;
+			}
+			m_count = static_cast<std::size_t>(count);
+		}
+
+		ScanIndex(const ScanIndex&) = delete;
+		ScanIndex& operator=(const ScanIndex&) = delete;
+
+		const std::filesystem::path& path() const { return m_path; }
+
+		// Files in the index that was opened
+		std::size_t size() const { return m_count; }
+
+		// The opened index's record of 'path'
+		std::optional<Entry> find(std::string_view path) const
+		{
+			std::size_t low = 0, high = m_count;
+			while (low < high) {
+				std::size_t middle = low + (high - low) / 2;
+				auto name = pathAt(middle);
+				if (!name) return std::nullopt; // Damaged
+				int order = name->compare(path);
+				if (order == 0) return entryAt(middle, *name);
+				if (order < 0) low = middle + 1;
+				else high = middle;
+			}
+			return std::nullopt;
+		}
+
+		// A file as this run found it, for the index save writes. The last
+		// record of a path wins.
+		void record(Entry entry) { m_recorded.push_back(std::move(entry)); }
+
+		std::size_t recorded() const { return m_recorded.size(); }
+
+		// Writes what was recorded as the new index: to a temporary file,
+		// renamed over the old one. The mapping stays on the old contents.
+		std::error_code save() const
+		{
+			std::vector<const Entry*> entries;
+			entries.reserve(m_recorded.size());
+			for (const auto& entry : m_recorded) entries.push_back(&entry);
+			std::stable_sort(entries.begin(), entries.end(), [](const Entry* a, const Entry* b) { return a->path < b->path; });
+
+			// Last recorded of each path
+			std::vector<const Entry*> unique;
+			for (std::size_t i = 0; i < entries.size(); ++i) {
+				if (i + 1 < entries.size() && entries[i + 1]->path == entries[i]->path) continue;
+				unique.push_back(entries[i]);
+			}
+
+			std::vector<std::uint8_t> header(MAGIC.begin(), MAGIC.end());
+			cw::binary::writeBigEndian(header, static_cast<std::uint64_t>(unique.size()));
+			std::vector<std::uint8_t> records;
+			records.reserve(unique.size() * RECORD_SIZE);
+			std::uint64_t pathOffset = 0;
+			for (const Entry* entry : unique) {
+				cw::binary::writeBigEndian(records, pathOffset);
+				cw::binary::writeBigEndian(records, static_cast<std::uint64_t>(entry->path.size()));
+				cw::binary::writeBigEndian(records, entry->size);
+				cw::binary::writeBigEndian(records, static_cast<std::uint64_t>(entry->modifiedNs));
+				cw::binary::writeBigEndian(records, entry->inode);
+				cw::binary::writeBigEndian(records, entry->hash);
+				pathOffset += entry->path.size();
+			}
+
+			std::error_code ec;
+			std::filesystem::create_directories(m_path.parent_path(), ec);
+			std::filesystem::path temporary = m_path;
+			temporary += ".tmp";
+			{
+				std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+				out.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+				out.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size()));
+				for (const Entry* entry : unique) out.write(entry->path.data(), static_cast<std::streamsize>(entry->path.size()));
+				if (!out.flush()) return std::make_error_code(std::errc::io_error);
+			}
+			std::filesystem::rename(temporary, m_path, ec);
+			return ec;
+		}
+
+	private:
+		const std::uint8_t* recordAt(std::size_t index) const
+		{
+			return m_mapping.data() + HEADER_SIZE + index * RECORD_SIZE;
+		}
+
+		// nullopt if it points outside the file
+		std::optional<std::string_view> pathAt(std::size_t index) const
+		{
+			const std::uint8_t* record = recordAt(index);
+			std::uint64_t offset = cw::binary::readBigEndian<std::uint64_t>(record);
+			std::uint64_t length = cw::binary::readBigEndian<std::uint64_t>(record + sizeof(std::uint64_t));
+			std::size_t paths = HEADER_SIZE + m_count * RECORD_SIZE;
+			std::size_t available = m_mapping.size() - paths;
+			if (offset > available || length > available - offset) return std::nullopt;
+			return std::string_view(reinterpret_cast<const char*>(m_mapping.data() + paths + offset), static_cast<std::size_t>(length));
+		}
+
+		Entry entryAt(std::size_t index, std::string_view path) const
+		{
+			const std::uint8_t* field = recordAt(index) + 2 * sizeof(std::uint64_t);
+			Entry entry;
+			entry.path = std::string(path);
+			entry.size = cw::binary::readBigEndian<std::uint64_t>(field);
+			entry.modifiedNs = static_cast<std::int64_t>(cw::binary::readBigEndian<std::uint64_t>(field + 8));
+			entry.inode = cw::binary::readBigEndian<std::uint64_t>(field + 16);
+			entry.hash = cw::binary::readBigEndian<std::uint64_t>(field + 24);
+			return entry;
+		}
+
+		std::filesystem::path m_path;
+		cw::buffer::SharedBuffer m_mapping; // Of the index opened; keeps the mapping alive
+		std::size_t m_count = 0;
+		std::vector<Entry> m_recorded;
+	};
+}
@@ -0,0 +1,223 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
+#include "cw/endian.h"
+#include "cw/file/delta.h"
+#include "cw/file/manifest.h"
+#include "cw/log/logger.h"
+
+namespace cw::file {
+
+	// Receiver side: the block signatures of its copies (computeSignatures),
+	// kept under a directory of their own so that a delta of a file that has
+	// not changed since costs no read of it. An entry is good while the file
+	// has the size, mtime and inode it had when it was read; anything that
+	// rewrites or replaces the file changes one of them. Entries are refreshed
+	// when a file is published (refresh), while its pages are likely still
+	// cached, so the next delta against it finds them ready.
+	//
+	// One file per copy, named by a hash of its absolute path: MAGIC, size,
+	// mtime, inode (8 bytes each), block size, block count, path length (4
+	// bytes each), the path, then weak (4) and strong (8) of each block; big
+	// endian. Keep the directory out of the tree it serves: its entries are
+	// files like any other.
+	//
+	// Thread-safe; signatures() and refresh() may read a whole file, so run
+	// them on the disk pool.
+	class SignatureCache
+	{
+	public:
+		static constexpr std::array<char, 8> MAGIC = { 'C', 'W', 'S', 'I', 'G', 'S', '0', '1' };
+		static constexpr std::size_t HEADER_SIZE = MAGIC.size() + 3 * sizeof(std::uint64_t) + 3 * sizeof(std::uint32_t);
+
+		// Smaller files are read again each time: cheaper than an entry
+		static constexpr std::uint64_t MIN_SIZE = 1024 * 1024;
+
+		explicit SignatureCache(std::filesystem::path root) : m_root(std::move(root)), m_nextTemp(std::random_device{}()) {}
+
+		const std::filesystem::path& root() const { return m_root; }
+
+		// Requests answered from an entry, and by reading the file
+		std::uint64_t hits() const { return m_hits.load(std::memory_order_relaxed); }
+		std::uint64_t misses() const { return m_misses.load(std::memory_order_relaxed); }
+
+		std::filesystem::path entryFor(const std::filesystem::path& path) const
+		{
+			std::string key = keyOf(path);
+			Fnv1a hash;
+			hash.update(reinterpret_cast<const std::uint8_t*>(key.data()), key.size());
+			char name[17];
+			std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash.value()));
+			return m_root / std::string(name, 2) / (name + 2);
+		}
+
+		// Signatures of 'path': from its entry if the file is as it was then,
+		// otherwise read from the file and stored
+		cw::packet::Signatures signatures(const std::filesystem::path& path)
+		{
+			auto stamp = stampOf(path);
+			if (stamp && stamp->size >= MIN_SIZE) {
+				if (auto cached = load(path, *stamp)) {
+					m_hits.fetch_add(1, std::memory_order_relaxed);
+					return std::move(*cached);
+				}
+			}
+			m_misses.fetch_add(1, std::memory_order_relaxed);
+			return computeAndStore(path, stamp);
+		}
+
+		// Reads 'path' and stores its signatures, as it is now
+		void refresh(const std::filesystem::path& path)
+		{
+			auto stamp = stampOf(path);
+			if (!stamp || stamp->size < MIN_SIZE) return;
+			computeAndStore(path, stamp);
+		}
+
+	private:
+		struct Stamp
+		{
+			std::uint64_t size = 0;
+			std::int64_t modifiedNs = 0;
+			std::uint64_t inode = 0; // 0 where the platform has none
+		};
+
+		static std::string keyOf(const std::filesystem::path& path)
+		{
+			std::error_code ec;
+			return std::filesystem::absolute(path, ec).lexically_normal().generic_string();
+		}
+
+		static std::optional<Stamp> stampOf(const std::filesystem::path& path)
+		{
+#if !defined(_WIN32)
+			struct stat info;
+			if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) return std::nullopt;
+			return Stamp{ static_cast<std::uint64_t>(info.st_size),
+				static_cast<std::int64_t>(info.st_mtim.tv_sec) * 1'000'000'000 + info.st_mtim.tv_nsec,
+				static_cast<std::uint64_t>(info.st_ino) };
+#else
+			std::error_code ec;
+			if (!std::filesystem::is_regular_file(path, ec)) return std::nullopt;
+			Stamp stamp;
+			stamp.size = std::filesystem::file_size(path, ec);
+			if (ec) return std::nullopt;
+			auto modified = std::filesystem::last_write_time(path, ec);
+			if (ec) return std::nullopt;
+			stamp.modifiedNs = cw::file::modifiedNs(modified);
+			return stamp;
+#endif
+		}
+
+		cw::packet::Signatures computeAndStore(const std::filesystem::path& path, const std::optional<Stamp>& before)
+		{
+			cw::packet::Signatures signatures = computeSignatures(path);
+			if (!before || before->size < MIN_SIZE || signatures.blockSize == 0) return signatures;
+
+			// Rewritten while it was read: the signatures are of neither version
+			auto after = stampOf(path);
+			if (!after || after->size != before->size || after->modifiedNs != before->modifiedNs || after->inode != before->inode) {
+				return signatures;
+			}
+			if (auto ec = store(path, *before, signatures)) {
+				CW_LOG_WARN("[Delta] Cannot cache signatures of ", path.generic_string(), ": ", ec.message());
+			}
+			return signatures;
+		}
+
+		std::optional<cw::packet::Signatures> load(const std::filesystem::path& path, const Stamp& stamp) const
+		{
+			std::ifstream in(entryFor(path), std::ios::binary);
+			if (!in) return std::nullopt;
+			std::vector<std::uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			if (data.size() < HEADER_SIZE || std::memcmp(data.data(), MAGIC.data(), MAGIC.size()) != 0) return std::nullopt;
+
+			const std::uint8_t* field = data.data() + MAGIC.size();
+			std::uint64_t size = cw::binary::readBigEndian<std::uint64_t>(field);
+			std::int64_t modified = static_cast<std::int64_t>(cw::binary::readBigEndian<std::uint64_t>(field + 8));
+			std::uint64_t inode = cw::binary::readBigEndian<std::uint64_t>(field + 16);
+			std::uint32_t blockSize = cw::binary::readBigEndian<std::uint32_t>(field + 24);
+			std::uint32_t count = cw::binary::readBigEndian<std::uint32_t>(field + 28);
+			std::uint32_t keyLength = cw::binary::readBigEndian<std::uint32_t>(field + 32);
+			if (size != stamp.size || modified != stamp.modifiedNs || inode != stamp.inode) return std::nullopt;
+
+			// Another path with the same hash, or cut short
+			std::string key = keyOf(path);
+			std::size_t blocksAt = HEADER_SIZE + keyLength;
+			if (keyLength != key.size() || data.size() != blocksAt + std::size_t{ count } * cw::packet::Signatures::BLOCK_SIZE) return std::nullopt;
+			if (std::memcmp(data.data() + HEADER_SIZE, key.data(), key.size()) != 0) return std::nullopt;
+			if (blockSize == 0 || count != size / blockSize) return std::nullopt;
+
+			cw::packet::Signatures signatures;
+			signatures.blockSize = blockSize;
+			signatures.fileSize = size;
+			signatures.blocks.reserve(count);
+			for (const std::uint8_t* block = data.data() + blocksAt; block < data.data() + data.size(); block += cw::packet::Signatures::BLOCK_SIZE) {
+				signatures.blocks.push_back({ cw::binary::readBigEndian<std::uint32_t>(block),
+					cw::binary::readBigEndian<std::uint64_t>(block + sizeof(std::uint32_t)) });
+			}
+			return signatures;
+		}
+
+		// Written under a temporary name and renamed over the old entry
+		std::error_code store(const std::filesystem::path& path, const Stamp& stamp, const cw::packet::Signatures& signatures)
+		{
+			std::string key = keyOf(path);
+			std::vector<std::uint8_t> data(MAGIC.begin(), MAGIC.end());
+			data.reserve(HEADER_SIZE + key.size() + signatures.blocks.size() * cw::packet::Signatures::BLOCK_SIZE);
+			cw::binary::writeBigEndian(data, stamp.size);
+			cw::binary::writeBigEndian(data, static_cast<std::uint64_t>(stamp.modifiedNs));
+			cw::binary::writeBigEndian(data, stamp.inode);
+			cw::binary::writeBigEndian(data, signatures.blockSize);
+			cw::binary::writeBigEndian(data, static_cast<std::uint32_t>(signatures.blocks.size()));
+			cw::binary::writeBigEndian(data, static_cast<std::uint32_t>(key.size()));
+			data.insert(data.end(), key.begin(), key.end());
+			for (const auto& block : signatures.blocks) {
+				cw::binary::writeBigEndian(data, block.weak);
+				cw::binary::writeBigEndian(data, block.strong);
+			}
+
+			std::filesystem::path entry = entryFor(path);
+			std::error_code ec;
+			std::filesystem::create_directories(entry.parent_path(), ec);
+			if (ec) return ec;
+			std::filesystem::path temporary = entry;
+			temporary += ".tmp" + std::to_string(m_nextTemp++);
+			{
+				std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+				out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+				if (!out.flush()) {
+					std::filesystem::remove(temporary, ec);
+					return std::make_error_code(std::errc::io_error);
+				}
+			}
+			std::filesystem::rename(temporary, entry, ec);
+			if (ec) {
+				std::error_code ignored;
+				std::filesystem::remove(temporary, ignored);
+			}
+			return ec;
+		}
+
+		std::filesystem::path m_root;
+		std::atomic<std::uint64_t> m_nextTemp; // Random start: several processes may share a cache
+		std::atomic<std::uint64_t> m_hits{ 0 };
+		std::atomic<std::uint64_t> m_misses{ 0 };
+	};
+}
@@ -0,0 +1,142 @@
+#pragma once
+#if defined(__linux__)
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace cw::file {
+
+	// A pipe for splice(2): received bytes move socket -> pipe -> file as
+	// page references and never pass through this process (see
+	// Connection::setSpliceReceive). The network thread fills it, the disk
+	// pool drains it into the file. Pipes come from a process-wide pool:
+	// making one costs two descriptors and an fcntl per chunk otherwise.
+	class SplicePipe
+	{
+	public:
+		// Asked for; the kernel may cap it at /proc/sys/fs/pipe-max-size
+		static constexpr std::size_t WANTED_CAPACITY = 1024 * 1024;
+		static constexpr std::size_t MAX_POOLED = 64;
+
+		// An empty pipe, from the pool or new; null if none can be made
+		static std::shared_ptr<SplicePipe> acquire()
+		{
+			std::unique_ptr<SplicePipe> pipe;
+			{
+				std::lock_guard lock(pool().mutex);
+				if (!pool().free.empty()) {
+					pipe = std::move(pool().free.back());
+					pool().free.pop_back();
+				}
+			}
+			if (!pipe) {
+				pipe.reset(new SplicePipe());
+				if (pipe->m_read < 0) return nullptr;
+			}
+			return std::shared_ptr<SplicePipe>(pipe.release(), [](SplicePipe* released) { recycle(released); });
+		}
+
+		~SplicePipe()
+		{
+			if (m_read >= 0) ::close(m_read);
+			if (m_write >= 0) ::close(m_write);
+		}
+
+		SplicePipe(const SplicePipe&) = delete;
+		SplicePipe& operator=(const SplicePipe&) = delete;
+
+		std::size_t capacity() const { return m_capacity; }
+
+		// Moves up to 'want' bytes from 'socket' (non-blocking) into the pipe.
+		// resource_unavailable_try_again: nothing to read yet; 'moved' 0 with
+		// no error: the peer closed.
+		std::error_code fill(int socket, std::size_t want, std::size_t& moved)
+		{
+			moved = 0;
+			ssize_t n = ::splice(socket, nullptr, m_write, nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0) return { errno == EWOULDBLOCK ? EAGAIN : errno, std::system_category() };
+			moved = static_cast<std::size_t>(n);
+			return {};
+		}
+
+		// Moves 'length' bytes from the pipe to 'fd' at 'offset'. 'done' is how
+		// many went before an error (a filesystem without splice: EINVAL).
+		std::error_code drainTo(int fd, std::uint64_t offset, std::size_t length, std::size_t& done)
+		{
+			done = 0;
+			while (done < length) {
+				loff_t at = static_cast<loff_t>(offset + done);
+				ssize_t n = ::splice(m_read, nullptr, fd, &at, length - done, SPLICE_F_MOVE);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) return { errno, std::system_category() };
+				if (n == 0) return std::make_error_code(std::errc::io_error);
+				done += static_cast<std::size_t>(n);
+			}
+			return {};
+		}
+
+		// The next out.size() bytes of the pipe, read out instead
+		std::error_code readInto(std::span<std::uint8_t> out)
+		{
+			std::size_t done = 0;
+			while (done < out.size()) {
+				ssize_t n = ::read(m_read, out.data() + done, out.size() - done);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) return { errno, std::system_category() };
+				if (n == 0) return std::make_error_code(std::errc::io_error);
+				done += static_cast<std::size_t>(n);
+			}
+			return {};
+		}
+
+	private:
+		SplicePipe()
+		{
+			int fds[2];
+			if (::pipe2(fds, O_CLOEXEC) != 0) return;
+			m_read = fds[0];
+			m_write = fds[1];
+			int capacity = ::fcntl(m_write, F_SETPIPE_SZ, static_cast<int>(WANTED_CAPACITY));
+			if (capacity < 0) capacity = ::fcntl(m_write, F_GETPIPE_SZ);
+			m_capacity = capacity > 0 ? static_cast<std::size_t>(capacity) : 0;
+		}
+
+		struct Pool
+		{
+			std::mutex mutex;
+			std::vector<std::unique_ptr<SplicePipe>> free;
+		};
+
+		static Pool& pool()
+		{
+			static Pool instance;
+			return instance;
+		}
+
+		// Back to the pool if it was drained (an error may have left bytes in it)
+		static void recycle(SplicePipe* pipe)
+		{
+			std::unique_ptr<SplicePipe> owned(pipe);
+			int queued = 0;
+			if (::ioctl(pipe->m_read, FIONREAD, &queued) != 0 || queued != 0) return;
+
+			std::lock_guard lock(pool().mutex);
+			if (pool().free.size() < MAX_POOLED) pool().free.push_back(std::move(owned));
+		}
+
+		int m_read = -1;
+		int m_write = -1;
+		std::size_t m_capacity = 0;
+	};
+}
+#endif
@@ -0,0 +1,206 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <asio.hpp>
+
+#include "cw/file/file.h"
+#include "cw/log/logger.h"
+
+namespace cw {
+
+	namespace detail {
+
+		// Sends a stream of bytes produced as it goes, of a length known only at
+		// its end: what asyncSendStream reads from its source, the archive a
+		// directory upload packs. Chunks are checksummed, compressed and elided
+		// as zeros as asyncSendFile's are; since they cannot be read again, each
+		// is kept for the peer's retransmit requests until it acks past it (see
+		// Connection::keepForRetransmit). 'options' are already negotiated.
+		class StreamSender
+		{
+		public:
+			StreamSender(std::shared_ptr<cw::network::Connection> conn, TransferOptions options) :
+				m_conn(std::move(conn)),
+				m_options(std::move(options)),
+				m_streamId(m_options.streamId ? m_conn->openStream(m_options.streamId) : m_conn->allocateStreamId()),
+				m_batch(m_conn->makeBatch(m_options.priority)),
+				m_sizer(m_options),
+				m_digest(cw::integrity::FileDigest::UNKNOWN_SIZE),
+				m_cipher(detail::cipherFor(m_options))
+			{
+				// Sized by finish(), once the end is known
+				if (m_options.progress) {
+					m_progress = std::make_shared<cw::metrics::StreamProgress>(m_options.progress, cw::packet::UNKNOWN_FILE_SIZE);
+					m_conn->reportProgress(m_streamId, m_progress);
+				}
+			}
+
+			std::uint32_t streamId() const { return m_streamId; }
+			uint64_t sent() const { return m_offset; }
+
+			// The packet opening the stream (FileInfo, ArchiveInfo), sent with its first chunk
+			template<typename Packet>
+			void open(const Packet& pkt) { m_batch.add(pkt); }
+
+			// Waits for room on the connection and in the ack window, and
+			// returns the size of the next chunk to fill
+			asio::awaitable<size_t> asyncReserve()
+			{
+				m_chunkStart = std::chrono::steady_clock::now();
+				size_t chunkSize = m_sizer.next();
+
+				// --- BACKPRESSURE ---
+				if (m_conn->isCongested(m_options.priority)) {
+					m_conn->sendBatch(m_batch);
+					co_await m_conn->asyncWaitWritable(m_options.priority, asio::use_awaitable);
+				}
+
+				// --- ACK WINDOW ---
+				if (uint64_t target = detail::ackWaitTarget(m_options, m_offset, chunkSize)) {
+					m_conn->sendBatch(m_batch);
+					co_await m_conn->asyncWaitAcked(m_streamId, target, asio::use_awaitable);
+				}
+				co_return chunkSize;
+			}
+
+			// The next bytes of the stream; the 'last' chunk waits for finish()
+			void add(cw::buffer::SharedBuffer data, bool last)
+			{
+				size_t length = data.size();
+
+				cw::packet::SharedFileChunk chunkPkt;
+				chunkPkt.streamId = m_streamId;
+				chunkPkt.offset = m_offset;
+				chunkPkt.data = std::move(data);
+
+				if (detail::isZeroChunk(m_options, *m_conn, chunkPkt.data)) {
+					m_conn->sendBatch(m_batch);
+					detail::sendZeros(*m_conn, m_streamId, m_offset, length, m_options.priority);
+					m_digest.addZeros(length);
+				}
+				else {
+					detail::checksumChunk(m_options, chunkPkt);
+					auto compressed = detail::compressChunk(m_options, *m_conn, chunkPkt);
+					if (chunkPkt.crc) {
+						m_digest.add(m_offset, length, *chunkPkt.crc);
+						m_conn->keepForRetransmit(m_streamId, m_offset, chunkPkt.data);
+					}
+					if (m_cipher) m_batch.add(detail::sealChunk(*m_cipher, chunkPkt, compressed));
+					else if (compressed) m_batch.add(std::move(*compressed));
+					else m_batch.add(std::move(chunkPkt));
+				}
+
+				m_offset += length;
+				detail::reportSent(m_options, length);
+				m_sizer.onChunkSent(length, std::chrono::steady_clock::now() - m_chunkStart);
+				if (!last) m_conn->sendBatch(m_batch);
+			}
+
+			// Ends the stream with a FileDone carrying its size and digest;
+			// 'files' is what it counts for in the progress (archive members)
+			void finish(uint64_t files = 1)
+			{
+				if (m_progress) {
+					m_progress->setSize(m_offset, files);
+					m_options.progress->onFilesSent(files);
+				}
+
+				cw::packet::FileDone donePkt;
+				donePkt.streamId = m_streamId;
+				donePkt.fileSize = m_offset;
+				if (m_options.checksums) {
+					m_digest.setFileSize(m_offset);
+					donePkt.crc = m_digest.value();
+				}
+				end(donePkt);
+			}
+
+			// A FileDone of unknown size: the receiver drops what it has
+			void fail()
+			{
+				cw::packet::FileDone donePkt;
+				donePkt.streamId = m_streamId;
+				donePkt.fileSize = cw::packet::UNKNOWN_FILE_SIZE;
+				end(donePkt);
+			}
+
+		private:
+			void end(const cw::packet::FileDone& donePkt)
+			{
+				m_batch.add(donePkt);
+				m_conn->sendBatch(m_batch);
+				m_conn->releaseStream(m_streamId);
+			}
+
+			std::shared_ptr<cw::network::Connection> m_conn;
+			TransferOptions m_options;
+			std::uint32_t m_streamId;
+			cw::network::FrameBatch m_batch;
+			ChunkSizer m_sizer;
+			cw::integrity::FileDigest m_digest;
+			std::shared_ptr<const cw::integrity::ChunkCipher> m_cipher; // With options.chunkKey
+			std::shared_ptr<cw::metrics::StreamProgress> m_progress;
+			uint64_t m_offset = 0;
+			std::chrono::steady_clock::time_point m_chunkStart;
+		};
+	}
+
+	// Uploads what 'source' yields until it ends (asio::error::eof) as
+	// 'remoteFileName', for producers whose output has no size up front: a
+	// pipe from tar or a database dump, stdin, a socket, a generator behind
+	// any AsyncReadStream. Nothing is staged on disk: the FileInfo announces
+	// UNKNOWN_FILE_SIZE and the FileDone carries the size (CAP_UNSIZED_FILES),
+	// and the receiver writes, verifies and publishes the file as any other.
+	// Chunks go out as detail::StreamSender sends them. Kernel copies, holes
+	// found by seeking, resume and server-side copies need a file and are
+	// not used. Returns the bytes sent; throws std::system_error if the peer
+	// takes no files of unknown size (operation_not_supported) or reading
+	// 'source' fails, in which case the peer is told to drop the file.
+	template<typename AsyncReadStream>
+	asio::awaitable<uint64_t> asyncSendStream(std::shared_ptr<cw::network::Connection> conn,
+		AsyncReadStream& source,
+		std::string remoteFileName,
+		TransferOptions options = {})
+	{
+		co_await conn->asyncWaitCapabilities(asio::use_awaitable);
+		if (!conn->peerTakesUnsizedFiles()) {
+			throw std::system_error(std::make_error_code(std::errc::operation_not_supported), "The server takes no files of unknown size");
+		}
+		options = detail::negotiatedOptions(std::move(options), *conn);
+
+		CW_LOG_INFO("[Client] Streaming ", remoteFileName, "...");
+
+		detail::StreamSender sender(conn, std::move(options));
+		cw::packet::FileInfo infoPkt;
+		infoPkt.streamId = sender.streamId();
+		infoPkt.fileName = std::move(remoteFileName);
+		infoPkt.fileSize = cw::packet::UNKNOWN_FILE_SIZE;
+		sender.open(infoPkt);
+
+		for (bool ended = false; !ended;) {
+			size_t chunkSize = co_await sender.asyncReserve();
+
+			// A full chunk, unless the source ends first
+			cw::buffer::PooledBuffer buffer(chunkSize);
+			auto [ec, length] = co_await asio::async_read(source, asio::buffer(buffer.data(), chunkSize), asio::as_tuple(asio::use_awaitable));
+			if (ec == asio::error::eof) ended = true;
+			else if (ec) {
+				sender.fail();
+				throw std::system_error(ec, "Cannot read the stream for " + infoPkt.fileName);
+			}
+			if (length == 0) break;
+			buffer.shrink(length);
+			sender.add(std::move(buffer).share(), ended);
+		}
+		sender.finish();
+
+		CW_LOG_INFO("[Client] Upload Complete. Sent ", sender.sent(), " bytes.");
+		co_return sender.sent();
+	}
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "cw/file/directory_scanner.h"
+#include "cw/file/manifest.h"
+
+namespace cw::file {
+
+	// What the files of a directory and those below it add up to, so that
+	// two copies of a tree can be compared directory by directory instead of
+	// file by file (SubtreeDigests)
+	struct SubtreeSummary
+	{
+		std::uint64_t digest = 0; // Sum of subtreeTerm over the files
+		std::int64_t oldestNs = std::numeric_limits<std::int64_t>::max();
+		std::int64_t newestNs = std::numeric_limits<std::int64_t>::min();
+
+		void add(std::uint64_t term, std::int64_t modifiedNs)
+		{
+			digest += term;
+			oldestNs = std::min(oldestNs, modifiedNs);
+			newestNs = std::max(newestNs, modifiedNs);
+		}
+
+		void add(const SubtreeSummary& other)
+		{
+			digest += other.digest;
+			oldestNs = std::min(oldestNs, other.oldestNs);
+			newestNs = std::max(newestNs, other.newestNs);
+		}
+	};
+
+	// Directory key of a path relative to the root: "." for the root itself
+	inline std::string subtreeKey(const std::filesystem::path& relative)
+	{
+		return relative.empty() ? std::string(".") : relative.generic_string();
+	}
+
+	// One file's share of the digests of the directories above it, from its
+	// name relative to the root, size and, when hashing, contents hash.
+	// Summed, so files can be added in whatever order they are found.
+	inline std::uint64_t subtreeTerm(std::string_view name, std::uint64_t size, std::uint64_t hash)
+	{
+		Fnv1a term;
+		term.update(reinterpret_cast<const std::uint8_t*>(name.data()), name.size());
+		term.update(size);
+		term.update(hash);
+		return term.value();
+	}
+
+	// Receiver side: whether its copy of a subtree, summed up as 'local',
+	// holds what the sender's digest of it says, by the rules of
+	// isUpToDate: the same names and sizes and, with hashes, contents; or
+	// without, nothing older than the newest of the sender's files.
+	inline bool subtreeMatches(const SubtreeSummary& local, std::uint64_t digest, std::int64_t newestNs, bool withHash)
+	{
+		return local.digest == digest && (withHash || local.oldestNs >= newestNs);
+	}
+
+	// Sums up 'directory' (relative to 'base') and every directory below it
+	// into 'out', by subtreeKey, in one walk; each file is read through with
+	// 'withHash'. Directories already in 'out' are taken as they are.
+	inline void summarizeTree(const std::filesystem::path& base, const std::filesystem::path& directory, bool withHash,
+		std::unordered_map<std::string, SubtreeSummary>& out)
+	{
+		if (out.contains(subtreeKey(directory))) return;
+
+		// Listed parents first, then summed up children first
+		std::vector<std::filesystem::path> order{ directory };
+		std::vector<SubtreeSummary> own;
+		for (std::size_t i = 0; i < order.size(); ++i) {
+			std::vector<ScannedFile> files;
+			std::vector<std::filesystem::path> subdirectories;
+			auto relative = order[i];
+			detail::listDirectory(relative.empty() ? base : base / relative, relative, files, subdirectories);
+
+			SubtreeSummary summary;
+			for (const auto& file : files) {
+				std::uint64_t hash = 0;
+				if (withHash) {
+					auto contents = contentHash(file.path);
+					if (!contents) continue;
+					hash = *contents;
+				}
+				summary.add(subtreeTerm(file.relativePath.generic_string(), file.size, hash), file.modifiedNs);
+			}
+			for (auto& subdirectory : subdirectories) {
+				auto known = out.find(subtreeKey(subdirectory));
+				if (known != out.end()) summary.add(known->second);
+				else order.push_back(std::move(subdirectory));
+			}
+			own.push_back(summary);
+		}
+
+		std::unordered_map<std::string, std::size_t> positions;
+		for (std::size_t i = 0; i < order.size(); ++i) positions.emplace(subtreeKey(order[i]), i);
+		for (std::size_t i = order.size(); i-- > 0;) {
+			out[subtreeKey(order[i])] = own[i];
+			if (i == 0) continue;
+			auto parent = positions.find(subtreeKey(order[i].parent_path()));
+			if (parent != positions.end()) own[parent->second].add(own[i]);
+		}
+	}
+}
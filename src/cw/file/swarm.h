@@ -0,0 +1,294 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+#include <asio/experimental/parallel_group.hpp>
+
+#include "cw/file/download.h"
+#include "cw/log/logger.h"
+#include "cw/network/client_pool.h"
+#include "cw/network/resolver.h"
+#include "cw/network/swarm_tracker.h"
+
+namespace cw {
+
+	// A member of a swarm coordinated by a SwarmTracker on the origin: fetches
+	// a file the origin serves piece by piece, each from the origin (a range
+	// download) or from another member (the piece whole), as the tracker
+	// assigns them. Pieces land as files under 'pieceDirectory', relative to
+	// the working directory as any received file, which the member's own
+	// server must serve as a download root: that is where the others fetch
+	// them from, while it is still fetching and after, as long as it goes on
+	// announcing them (until stop()). Once every piece is in, they are joined
+	// into the file; the pieces stay for the swarm, at the cost of the file's
+	// size on disk a second time. Every piece is a download of its own, so it
+	// is verified as one.
+	class SwarmMember : public std::enable_shared_from_this<SwarmMember>
+	{
+	public:
+		struct Options
+		{
+			std::string tracker; // host:port of the tracker (UDP)
+			std::string address; // host:port this member's server is reached on
+			fs::path pieceDirectory = ".cw-swarm";
+			std::size_t parallel = 4; // Pieces fetched at once
+			std::chrono::milliseconds waitInterval{ 200 };
+			std::chrono::milliseconds queryTimeout{ 1000 };
+			unsigned queryAttempts = 5;
+			// Under the tracker's member timeout, so a member only serving stays known
+			std::chrono::milliseconds announceInterval{ 5000 };
+		};
+
+		// Where piece 'piece' of 'name' is kept, under the piece directory
+		static std::string pieceName(const std::string& name, std::uint32_t piece)
+		{
+			return name + ".piece-" + std::to_string(piece);
+		}
+
+		// Throws std::invalid_argument if the tracker cannot be resolved
+		static std::shared_ptr<SwarmMember> create(asio::io_context& io, std::shared_ptr<cw::network::ClientPool> pool, Options options)
+		{
+			auto tracker = cw::network::splitHostPort(options.tracker);
+			asio::ip::udp::resolver resolver(io);
+			std::error_code ec;
+			auto results = tracker ? resolver.resolve(asio::ip::udp::v4(), tracker->first, std::to_string(tracker->second), ec)
+				: asio::ip::udp::resolver::results_type{};
+			if (!tracker || ec || results.empty()) throw std::invalid_argument("Cannot resolve the swarm tracker " + options.tracker);
+
+			auto member = std::shared_ptr<SwarmMember>(new SwarmMember(io, std::move(pool), std::move(options), results.begin()->endpoint()));
+			asio::co_spawn(member->m_strand, member->announce(), asio::detached);
+			return member;
+		}
+
+		// Fetches 'name' into 'output' (default: 'name'); returns its size.
+		// Throws std::system_error if the origin serves no such file
+		// (no_such_file_or_directory) or the tracker stops answering.
+		asio::awaitable<std::uint64_t> asyncFetch(std::string name, fs::path output = {})
+		{
+			auto self = shared_from_this();
+			co_await asio::post(m_strand, asio::use_awaitable);
+			if (output.empty()) output = name;
+
+			auto fetch = std::make_shared<Fetch>();
+			fetch->name = name;
+			CW_LOG_INFO("[Swarm] Fetching ", name, " (", m_options.parallel, " pieces at once)");
+
+			using Operation = decltype(asio::co_spawn(m_strand, fetchPieces(fetch), asio::deferred));
+			std::vector<Operation> operations;
+			for (std::size_t i = 0; i < std::max<std::size_t>(1, m_options.parallel); ++i) {
+				operations.push_back(asio::co_spawn(m_strand, fetchPieces(fetch), asio::deferred));
+			}
+			auto [order, errors] = co_await asio::experimental::make_parallel_group(std::move(operations))
+				.async_wait(asio::experimental::wait_for_all(), asio::use_awaitable);
+			for (auto& error : errors) {
+				if (error) std::rethrow_exception(error);
+			}
+
+			join(*fetch, output);
+			m_seeding[name] = fetch->have;
+			CW_LOG_INFO("[Swarm] ", name, " complete: ", fetch->fileSize, " bytes in ", fetch->have.size(), " pieces, ",
+				fetch->fromPeers, " of them from other members");
+			co_return fetch->fileSize;
+		}
+
+		// Stops announcing the pieces held; the server goes on serving them
+		void stop()
+		{
+			asio::post(m_strand, [self = shared_from_this()]()
+				{
+					self->m_stopped = true;
+					self->m_announceTimer.cancel();
+				});
+		}
+
+	private:
+		struct Fetch
+		{
+			std::string name;
+			bool known = false; // Size and pieces, from the tracker's first answer
+			std::uint64_t fileSize = 0;
+			std::uint32_t pieceSize = 0;
+			cw::network::PieceMap have;
+			std::uint64_t fromPeers = 0;
+		};
+
+		SwarmMember(asio::io_context& io, std::shared_ptr<cw::network::ClientPool> pool, Options options, asio::ip::udp::endpoint tracker)
+			: m_strand(asio::make_strand(io)),
+			m_pool(std::move(pool)),
+			m_options(std::move(options)),
+			m_tracker(tracker),
+			m_announceSocket(m_strand, asio::ip::udp::v4()),
+			m_announceTimer(m_strand)
+		{
+		}
+
+		// One of the coroutines fetching pieces until the tracker says the member has them all
+		asio::awaitable<void> fetchPieces(std::shared_ptr<Fetch> fetch)
+		{
+			asio::ip::udp::socket socket(m_strand, asio::ip::udp::v4());
+			asio::steady_timer timer(m_strand);
+			cw::network::SwarmQuery query;
+			query.name = fetch->name;
+			query.address = m_options.address;
+
+			for (;;) {
+				query.have = fetch->have;
+				auto answer = co_await ask(socket, query);
+				query.failedPiece = cw::network::SwarmQuery::NO_PIECE;
+				query.failedSource.clear();
+
+				if (answer.status == cw::network::SwarmAssignment::Status::Unknown) {
+					throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory), "The origin serves no " + fetch->name);
+				}
+				if (!fetch->known) {
+					fetch->known = true;
+					fetch->fileSize = answer.fileSize;
+					fetch->pieceSize = std::max<std::uint32_t>(1, answer.pieceSize);
+					fetch->have = cw::network::PieceMap(static_cast<std::uint32_t>((answer.fileSize + fetch->pieceSize - 1) / fetch->pieceSize));
+					query.have = fetch->have;
+				}
+				if (answer.status == cw::network::SwarmAssignment::Status::Done || fetch->have.complete()) co_return;
+				if (answer.status == cw::network::SwarmAssignment::Status::Wait || fetch->have.has(answer.piece)) {
+					timer.expires_after(m_options.waitInterval);
+					co_await timer.async_wait(asio::use_awaitable);
+					continue;
+				}
+
+				if (!co_await fetchPiece(*fetch, answer)) {
+					query.failedPiece = answer.piece;
+					query.failedSource = answer.source;
+				}
+			}
+		}
+
+		// False if the piece did not arrive
+		asio::awaitable<bool> fetchPiece(Fetch& fetch, const cw::network::SwarmAssignment& answer)
+		{
+			std::uint64_t offset = static_cast<std::uint64_t>(answer.piece) * fetch.pieceSize;
+			std::uint64_t length = std::min<std::uint64_t>(fetch.pieceSize, fetch.fileSize - std::min(offset, fetch.fileSize));
+			auto source = cw::network::splitHostPort(answer.source);
+			if (!source || length == 0) co_return false;
+
+			std::string local = (m_options.pieceDirectory / pieceName(fetch.name, answer.piece)).generic_string();
+			std::error_code ec;
+			auto lease = co_await m_pool->asyncAcquire(source->first, source->second, asio::redirect_error(asio::use_awaitable, ec));
+			if (!ec) {
+				try {
+					// The origin has the file whole; a member, the piece as a file
+					std::uint64_t bytes = 0;
+					if (answer.fromOrigin) bytes = co_await asyncDownloadFile(lease.get(), fetch.name, local, offset, length);
+					else bytes = co_await asyncDownloadFile(lease.get(), pieceName(fetch.name, answer.piece), local);
+					if (bytes != length) ec = std::make_error_code(std::errc::io_error);
+				}
+				catch (const std::system_error& e) {
+					ec = e.code();
+				}
+			}
+
+			if (ec) {
+				CW_LOG_WARN("[Swarm] Piece ", answer.piece, " of ", fetch.name, " from ", answer.source, " failed: ", ec.message());
+				if (lease) lease.discard();
+				co_return false;
+			}
+			fetch.have.set(answer.piece);
+			if (!answer.fromOrigin) ++fetch.fromPeers;
+			co_return true;
+		}
+
+		// Sends 'query' until the tracker answers it
+		asio::awaitable<cw::network::SwarmAssignment> ask(asio::ip::udp::socket& socket, cw::network::SwarmQuery query)
+		{
+			query.nonce = ++m_nonce;
+			auto datagram = cw::network::encode(query);
+			std::vector<std::uint8_t> reply(cw::network::detail::SWARM_MAX_DATAGRAM);
+			asio::steady_timer timeout(m_strand);
+
+			for (unsigned attempt = 0; attempt < std::max(1u, m_options.queryAttempts); ++attempt) {
+				co_await socket.async_send_to(asio::buffer(datagram), m_tracker, asio::use_awaitable);
+				timeout.expires_after(m_options.queryTimeout);
+				timeout.async_wait([&socket](std::error_code ec) { if (!ec) socket.cancel(); });
+				for (;;) {
+					asio::ip::udp::endpoint sender;
+					auto [ec, length] = co_await socket.async_receive_from(asio::buffer(reply), sender, asio::as_tuple(asio::use_awaitable));
+					if (ec == asio::error::operation_aborted) break;
+					if (ec) continue;
+					auto answer = cw::network::decodeAssignment(reply.data(), length);
+					if (!answer || answer->nonce != query.nonce) continue; // A late answer to an earlier try
+					timeout.cancel();
+					co_return *answer;
+				}
+			}
+			throw std::system_error(std::make_error_code(std::errc::timed_out), "The swarm tracker " + m_options.tracker + " does not answer");
+		}
+
+		// Tells the tracker, every interval, about the files this member has
+		// whole, so it keeps sending other members here for their pieces
+		asio::awaitable<void> announce()
+		{
+			auto self = shared_from_this();
+			while (!m_stopped) {
+				for (const auto& [name, have] : m_seeding) {
+					cw::network::SwarmQuery query;
+					query.name = name;
+					query.address = m_options.address;
+					query.have = have;
+					std::error_code ignored;
+					m_announceSocket.send_to(asio::buffer(cw::network::encode(query)), m_tracker, 0, ignored);
+				}
+				m_announceTimer.expires_after(m_options.announceInterval);
+				co_await m_announceTimer.async_wait(asio::redirect_error(asio::use_awaitable, m_announceError));
+			}
+			std::error_code ignored;
+			m_announceSocket.close(ignored);
+		}
+
+		// The pieces, in order, into 'output', through a temporary renamed over it
+		void join(const Fetch& fetch, const fs::path& output) const
+		{
+			fs::path partial = output;
+			partial += ".cw-swarm-part";
+			if (output.has_parent_path()) fs::create_directories(output.parent_path());
+			{
+				std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+				std::vector<char> buffer(1024 * 1024);
+				for (std::uint32_t piece = 0; piece < fetch.have.size(); ++piece) {
+					std::ifstream in(m_options.pieceDirectory / pieceName(fetch.name, piece), std::ios::binary);
+					while (in && out) {
+						in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+						out.write(buffer.data(), in.gcount());
+					}
+				}
+				if (!out.flush()) throw std::system_error(std::make_error_code(std::errc::io_error), "Cannot write " + partial.generic_string());
+			}
+			if (fs::file_size(partial) != fetch.fileSize) {
+				fs::remove(partial);
+				throw std::system_error(std::make_error_code(std::errc::io_error), "Pieces of " + fetch.name + " went missing");
+			}
+			fs::rename(partial, output);
+		}
+
+		asio::strand<asio::io_context::executor_type> m_strand;
+		std::shared_ptr<cw::network::ClientPool> m_pool;
+		Options m_options;
+		asio::ip::udp::endpoint m_tracker;
+		std::uint32_t m_nonce = 0;
+
+		// On the strand
+		std::map<std::string, cw::network::PieceMap> m_seeding; // Files held whole, by name
+		asio::ip::udp::socket m_announceSocket;
+		asio::steady_timer m_announceTimer;
+		std::error_code m_announceError;
+		bool m_stopped = false;
+	};
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+#include "cw/file/incoming_file.h"
+#include "cw/flat_hash.h"
+#include "cw/file/range_set.h"
+#include "cw/metrics/metrics.h"
+
+namespace cw::file {
+
+	// One destination file being received. A plain upload is fed by a single
+	// connection; a striped one by 'stripeCount' connections at once, each writing
+	// its own chunk offsets into the same file. Counters are shared by all stripes.
+	struct IncomingTransfer
+	{
+		std::shared_ptr<IncomingFile> file;
+		std::filesystem::path path; // Name it is published under
+		std::uint64_t expectedSize = 0;
+		std::uint16_t stripeCount = 1;
+
+		std::atomic<std::uint64_t> receivedBytes = 0; // Bytes of m_received, for status displays
+		std::atomic<std::uint16_t> stripesDone = 0;
+		std::atomic<bool> corrupt = false; // A stream's FileDone checksum did not match
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		// Where its time went, for the sender's TransferStats
+		std::shared_ptr<cw::metrics::LatencyHistogram> diskLatency; // This file's writes
+		std::atomic<std::uint64_t> stallNanos = 0;                   // Reads paused for its disk queue
+
+		// True for the stripe whose FileDone completes the transfer
+		bool markStripeDone() { return ++stripesDone == stripeCount; }
+
+		// Records [offset, offset + length) as received (written, copied or
+		// on disk from before); returns the bytes that were not already, by
+		// which receivedBytes grows. Stripes on several threads call it.
+		std::uint64_t markReceived(std::uint64_t offset, std::uint64_t length)
+		{
+			std::lock_guard<std::mutex> lock(m_receivedMutex);
+			std::uint64_t added = m_received.insert(offset, offset + length);
+			receivedBytes += added;
+			return added;
+		}
+
+		// A range whose first copy was bad and is asked for again
+		void unmarkReceived(std::uint64_t offset, std::uint64_t length)
+		{
+			std::lock_guard<std::mutex> lock(m_receivedMutex);
+			receivedBytes -= m_received.erase(offset, offset + length);
+		}
+
+		// Whether all of [offset, offset + length) is in already: a duplicate
+		bool receivedAlready(std::uint64_t offset, std::uint64_t length) const
+		{
+			std::lock_guard<std::mutex> lock(m_receivedMutex);
+			return length != 0 && m_received.contains(offset, offset + length);
+		}
+
+		// Every byte of a file of 'size' is in, whatever order it came in
+		bool receivedAll(std::uint64_t size) const
+		{
+			std::lock_guard<std::mutex> lock(m_receivedMutex);
+			return m_received.covered() == size && m_received.contains(0, size);
+		}
+
+		// The ranges of a file of 'size' not received
+		std::vector<RangeSet::Range> missingRanges(std::uint64_t size) const
+		{
+			std::lock_guard<std::mutex> lock(m_receivedMutex);
+			return m_received.gaps(size);
+		}
+
+		// 'waiter' learns how the file ended (error, bytes written) from the
+		// stripe that completes it: how the other stripes of a download hear
+		// of it. Register before markStripeDone().
+		void onFinished(std::function<void(std::error_code, std::uint64_t)> waiter)
+		{
+			std::lock_guard<std::mutex> lock(m_waitersMutex);
+			m_finishWaiters.push_back(std::move(waiter));
+		}
+
+		void finished(std::error_code ec, std::uint64_t written)
+		{
+			std::vector<std::function<void(std::error_code, std::uint64_t)>> waiters;
+			{
+				std::lock_guard<std::mutex> lock(m_waitersMutex);
+				waiters.swap(m_finishWaiters);
+			}
+			for (auto& waiter : waiters) waiter(ec, written);
+		}
+
+	private:
+		mutable std::mutex m_receivedMutex;
+		RangeSet m_received;
+		std::mutex m_waitersMutex;
+		std::vector<std::function<void(std::error_code, std::uint64_t)>> m_finishWaiters;
+	};
+
+	// One open transfer as a status display shows it (see TransferRegistry::status)
+	struct TransferStatus
+	{
+		std::filesystem::path path;
+		std::uint64_t expectedSize = 0; // UNKNOWN_FILE_SIZE until the stream ends
+		std::uint64_t receivedBytes = 0;
+		std::uint16_t stripeCount = 1;
+		std::chrono::steady_clock::duration elapsed{};
+	};
+
+	// Striped transfers in progress, shared by every connection of a process so
+	// stripes accepted on different threads/shards find each other. Also keeps
+	// sight of every open transfer for status().
+	class TransferRegistry
+	{
+	public:
+		using Factory = std::function<std::shared_ptr<IncomingTransfer>()>;
+
+		static std::shared_ptr<TransferRegistry> defaultInstance()
+		{
+			static std::shared_ptr<TransferRegistry> instance = std::make_shared<TransferRegistry>();
+			return instance;
+		}
+
+		// Returns the transfer registered under 'id'. The first stripe to arrive
+		// creates it with 'create' (called under the registry lock).
+		std::shared_ptr<IncomingTransfer> join(std::uint64_t id, const Factory& create)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto& transfer = m_transfers[id];
+			if (!transfer) transfer = create();
+			return transfer;
+		}
+
+		void remove(std::uint64_t id)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_transfers.erase(id);
+		}
+
+		std::size_t size() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_transfers.size();
+		}
+
+		// Lists 'transfer' in status() until it is finished or released. Once
+		// per stream that opens it; the stripes of one file are listed once.
+		void track(const std::shared_ptr<IncomingTransfer>& transfer)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_tracked.size() >= m_sweepAt) {
+				// Finished transfers are dropped once the table doubles, not on every
+				// call: a sweep per file would make a tree of n files cost n^2
+				for (auto it = m_tracked.begin(); it != m_tracked.end(); ++it) {
+					if (it->second.expired()) m_tracked.erase(it);
+				}
+				m_sweepAt = std::max<std::size_t>(MIN_SWEEP, m_tracked.size() * 2);
+			}
+			m_tracked.emplace(transfer.get(), transfer);
+		}
+
+		// The transfers open right now. Reads their counters as they are, for a
+		// status display; never blocks a receiving connection for longer than
+		// the registry lock.
+		std::vector<TransferStatus> status() const
+		{
+			auto now = std::chrono::steady_clock::now();
+			std::vector<TransferStatus> open;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (const auto& [key, weak] : m_tracked) {
+				auto transfer = weak.lock();
+				if (!transfer || transfer->stripesDone.load(std::memory_order_relaxed) >= transfer->stripeCount) continue;
+				open.push_back({ transfer->path, transfer->expectedSize, transfer->receivedBytes.load(std::memory_order_relaxed),
+					transfer->stripeCount, now - transfer->started });
+			}
+			return open;
+		}
+
+	private:
+		static constexpr std::size_t MIN_SWEEP = 64;
+
+		mutable std::mutex m_mutex;
+		cw::FlatHashMap<std::uint64_t, std::shared_ptr<IncomingTransfer>> m_transfers;
+		cw::FlatHashMap<const IncomingTransfer*, std::weak_ptr<IncomingTransfer>> m_tracked;
+		std::size_t m_sweepAt = MIN_SWEEP; // m_tracked's size at which the next track() drops finished transfers
+	};
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cw/file/disk_writer.h"
+#include "cw/file/manifest.h"
+
+namespace cw::file {
+
+	// How a VolumeSet spreads received files over its volumes.
+	//   Hash:        by name, so a name always lands on the same volume and a
+	//                resumed or repeated transfer finds what it left there
+	//   LeastLoaded: on the volume with the fewest bytes queued for its disk
+	//                when the file opens; for write-once ingest, as a name sent
+	//                again may land elsewhere
+	enum class Placement { Hash, LeastLoaded };
+
+	inline std::optional<Placement> parsePlacement(const std::string& name)
+	{
+		if (name == "hash") return Placement::Hash;
+		if (name == "least-loaded") return Placement::LeastLoaded;
+		return std::nullopt;
+	}
+
+	// Destination roots on independent drives (no RAID between them), each
+	// with a DiskWriter of its own, so received files spread over them and
+	// the disk bandwidth adds up. A file is placed whole when it opens; the
+	// sender's relative name is kept under the root it lands on. The first
+	// volume is the receiver's own destination (its root empty: the working
+	// directory) and writer, which everything not placed (small-file
+	// batches, directory manifests, delta bases) keeps using.
+	class VolumeSet
+	{
+	public:
+		struct Volume
+		{
+			std::filesystem::path root; // Empty: the working directory
+			std::shared_ptr<DiskWriter> writer;
+		};
+
+		explicit VolumeSet(std::vector<Volume> volumes, Placement placement = Placement::Hash)
+			: m_volumes(std::move(volumes)),
+			m_placement(placement)
+		{
+			if (m_volumes.empty()) throw std::invalid_argument("VolumeSet: no volumes");
+		}
+
+		std::size_t size() const { return m_volumes.size(); }
+		const Volume& operator[](std::size_t i) const { return m_volumes[i]; }
+		const std::vector<Volume>& volumes() const { return m_volumes; }
+		Placement placement() const { return m_placement; }
+
+		// The volume a received file named 'name' is written to. Thread-safe.
+		const Volume& place(const std::filesystem::path& name) const
+		{
+			if (m_volumes.size() == 1) return m_volumes.front();
+			if (m_placement == Placement::Hash) {
+				std::string key = name.generic_string();
+				Fnv1a hash;
+				hash.update(reinterpret_cast<const std::uint8_t*>(key.data()), key.size());
+				return m_volumes[hash.value() % m_volumes.size()];
+			}
+
+			// Idle volumes take files in turn rather than all going to the first
+			std::size_t start = m_next.fetch_add(1, std::memory_order_relaxed);
+			const Volume* best = nullptr;
+			std::uint64_t least = UINT64_MAX;
+			for (std::size_t i = 0; i < m_volumes.size(); ++i) {
+				const Volume& volume = m_volumes[(start + i) % m_volumes.size()];
+				std::uint64_t queued = volume.writer->load()->queuedBytes();
+				if (queued < least) {
+					least = queued;
+					best = &volume;
+				}
+			}
+			return *best;
+		}
+
+		// Where 'name' is written on 'volume'
+		static std::filesystem::path pathOn(const Volume& volume, const std::filesystem::path& name)
+		{
+			return volume.root.empty() ? name : volume.root / name;
+		}
+
+	private:
+		std::vector<Volume> m_volumes;
+		Placement m_placement;
+		mutable std::atomic<std::size_t> m_next = 0;
+	};
+}
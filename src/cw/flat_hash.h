@@ -0,0 +1,455 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CW_FLAT_HASH_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define CW_FLAT_HASH_NEON 1
+#endif
+
+namespace cw {
+
+	namespace detail {
+
+		// One control byte per slot: EMPTY, DELETED (a tombstone), or the 7 low
+		// bits of the hash of the key in it
+		inline constexpr std::int8_t FLAT_EMPTY = -128;
+		inline constexpr std::int8_t FLAT_DELETED = -2;
+		inline constexpr std::size_t FLAT_GROUP_WIDTH = 16;
+
+		// The control bytes of GROUP_WIDTH slots, compared all at once: one
+		// SSE2 compare and movemask (NEON on ARM), else a byte loop the
+		// compiler vectorizes. Masks have bit i for slot i of the group.
+		class FlatGroup
+		{
+		public:
+			explicit FlatGroup(const std::int8_t* control)
+			{
+#if defined(CW_FLAT_HASH_SSE2)
+				m_control = _mm_loadu_si128(reinterpret_cast<const __m128i*>(control));
+#elif defined(CW_FLAT_HASH_NEON)
+				m_control = vld1q_s8(control);
+#else
+				std::memcpy(m_control, control, FLAT_GROUP_WIDTH);
+#endif
+			}
+
+			// Slots whose byte is 'h2'
+			std::uint32_t match(std::int8_t h2) const
+			{
+#if defined(CW_FLAT_HASH_SSE2)
+				return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), m_control)));
+#elif defined(CW_FLAT_HASH_NEON)
+				return toMask(vceqq_s8(vdupq_n_s8(h2), m_control));
+#else
+				std::uint32_t mask = 0;
+				for (std::size_t i = 0; i < FLAT_GROUP_WIDTH; ++i) mask |= static_cast<std::uint32_t>(m_control[i] == h2) << i;
+				return mask;
+#endif
+			}
+
+			std::uint32_t matchEmpty() const { return match(FLAT_EMPTY); }
+
+			// EMPTY or DELETED: both have the sign bit set, full slots never
+			std::uint32_t matchFree() const
+			{
+#if defined(CW_FLAT_HASH_SSE2)
+				return static_cast<std::uint32_t>(_mm_movemask_epi8(m_control));
+#elif defined(CW_FLAT_HASH_NEON)
+				return toMask(vcltq_s8(m_control, vdupq_n_s8(0)));
+#else
+				std::uint32_t mask = 0;
+				for (std::size_t i = 0; i < FLAT_GROUP_WIDTH; ++i) mask |= static_cast<std::uint32_t>(m_control[i] < 0) << i;
+				return mask;
+#endif
+			}
+
+		private:
+#if defined(CW_FLAT_HASH_SSE2)
+			__m128i m_control;
+#elif defined(CW_FLAT_HASH_NEON)
+			// NEON has no movemask: each lane keeps its own bit, then lanes are summed
+			static std::uint32_t toMask(uint8x16_t lanes)
+			{
+				static const std::uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+				uint8x16_t masked = vandq_u8(lanes, vld1q_u8(bits));
+				return static_cast<std::uint32_t>(vaddv_u8(vget_low_u8(masked))) | static_cast<std::uint32_t>(vaddv_u8(vget_high_u8(masked))) << 8;
+			}
+			int8x16_t m_control;
+#else
+			std::int8_t m_control[FLAT_GROUP_WIDTH];
+#endif
+		};
+
+		// std::hash is the identity for integers in most standard libraries:
+		// mixed, so that the low bits (the control byte) and the high ones
+		// (the group) both depend on every bit of the key
+		inline std::uint64_t flatMix(std::uint64_t hash)
+		{
+			hash ^= hash >> 33;
+			hash *= 0xFF51AFD7ED558CCDull;
+			hash ^= hash >> 33;
+			return hash;
+		}
+
+		// Open addressing after SwissTable: slots in one flat array, with a
+		// control byte each; a lookup hashes once, then compares the 7-bit
+		// fingerprints of a whole group of slots in one instruction, and
+		// touches a slot only where its fingerprint matches. Groups are probed
+		// quadratically; a group with an empty slot ends the probe. Erasing
+		// leaves a tombstone only where a probe could have gone past the slot.
+		// At most 7/8 full. Inserting may move every entry (rehash):
+		// references and iterators are valid until the next insert, as for
+		// std::vector, not std::unordered_map. Erasing moves nothing, so a loop
+		// may erase the entry it is on and go on. Not thread-safe.
+		template<typename Policy, typename Hash, typename Equal>
+		class FlatTable
+		{
+		public:
+			using key_type = typename Policy::key_type;
+			using slot_type = typename Policy::slot_type;
+			using value_type = slot_type;
+			using size_type = std::size_t;
+
+			template<bool Const>
+			class Iterator
+			{
+			public:
+				using iterator_category = std::forward_iterator_tag;
+				using value_type = typename Policy::slot_type;
+				using difference_type = std::ptrdiff_t;
+				using reference = std::conditional_t<Const || Policy::KEY_ONLY, const value_type&, value_type&>;
+				using pointer = std::conditional_t<Const || Policy::KEY_ONLY, const value_type*, value_type*>;
+
+				Iterator() = default;
+				operator Iterator<true>() const { return { m_control, m_slot, m_end }; }
+
+				reference operator*() const { return *m_slot; }
+				pointer operator->() const { return m_slot; }
+				Iterator& operator++()
+				{
+					++m_control;
+					++m_slot;
+					skipFree();
+					return *this;
+				}
+				Iterator operator++(int)
+				{
+					Iterator before = *this;
+					++*this;
+					return before;
+				}
+				bool operator==(const Iterator& other) const { return m_control == other.m_control; }
+
+			private:
+				friend class FlatTable;
+				template<bool> friend class Iterator;
+
+				Iterator(const std::int8_t* control, slot_type* slot, const std::int8_t* end) : m_control(control), m_slot(slot), m_end(end) {}
+				void skipFree()
+				{
+					while (m_control != m_end && *m_control < 0) {
+						++m_control;
+						++m_slot;
+					}
+				}
+
+				const std::int8_t* m_control = nullptr;
+				slot_type* m_slot = nullptr;
+				const std::int8_t* m_end = nullptr;
+			};
+			using iterator = Iterator<false>;
+			using const_iterator = Iterator<true>;
+
+			FlatTable() = default;
+			~FlatTable() { destroy(); }
+
+			FlatTable(FlatTable&& other) noexcept { swap(other); }
+			FlatTable& operator=(FlatTable&& other) noexcept
+			{
+				if (this != &other) {
+					FlatTable(std::move(other)).swap(*this);
+				}
+				return *this;
+			}
+			FlatTable(const FlatTable&) = delete;
+			FlatTable& operator=(const FlatTable&) = delete;
+
+			std::size_t size() const { return m_size; }
+			bool empty() const { return m_size == 0; }
+			std::size_t capacity() const { return m_capacity; }
+
+			iterator begin()
+			{
+				iterator it{ m_control, m_slots, m_control + m_capacity };
+				it.skipFree();
+				return it;
+			}
+			iterator end() { return { m_control + m_capacity, m_slots + m_capacity, m_control + m_capacity }; }
+			const_iterator begin() const { return const_cast<FlatTable*>(this)->begin(); }
+			const_iterator end() const { return const_cast<FlatTable*>(this)->end(); }
+
+			template<typename K>
+			iterator find(const K& key)
+			{
+				std::size_t at = locate(key, flatMix(Hash{}(key)));
+				return at == NOT_FOUND ? end() : iteratorAt(at);
+			}
+			template<typename K>
+			const_iterator find(const K& key) const { return const_cast<FlatTable*>(this)->find(key); }
+			template<typename K>
+			bool contains(const K& key) const { return locate(key, flatMix(Hash{}(key))) != NOT_FOUND; }
+			template<typename K>
+			std::size_t count(const K& key) const { return contains(key) ? 1 : 0; }
+
+			// Constructs the slot of 'key' from 'args' (piecewise for a map)
+			// unless the key is there already
+			template<typename K, typename... Args>
+			std::pair<iterator, bool> tryEmplace(K&& key, Args&&... args)
+			{
+				std::uint64_t hash = flatMix(Hash{}(key));
+				if (std::size_t at = locate(key, hash); at != NOT_FOUND) return { iteratorAt(at), false };
+
+				std::size_t at = prepareInsert(hash);
+				Policy::construct(m_slots + at, std::forward<K>(key), std::forward<Args>(args)...);
+				setControl(at, static_cast<std::int8_t>(hash & 0x7F));
+				++m_size;
+				return { iteratorAt(at), true };
+			}
+
+			void erase(const_iterator it) { eraseAt(static_cast<std::size_t>(it.m_control - m_control)); }
+			void erase(iterator it) { erase(const_iterator(it)); }
+
+			template<typename K>
+			std::size_t erase(const K& key)
+			{
+				std::size_t at = locate(key, flatMix(Hash{}(key)));
+				if (at == NOT_FOUND) return 0;
+				eraseAt(at);
+				return 1;
+			}
+
+			// Room for 'count' entries without a rehash
+			void reserve(std::size_t count)
+			{
+				std::size_t capacity = FLAT_GROUP_WIDTH;
+				while (capacity * 7 / 8 < count) capacity *= 2;
+				if (capacity > m_capacity) rehash(capacity);
+			}
+
+			// Empties the table and gives its memory back
+			void clear() { FlatTable().swap(*this); }
+
+			void swap(FlatTable& other) noexcept
+			{
+				std::swap(m_control, other.m_control);
+				std::swap(m_slots, other.m_slots);
+				std::swap(m_capacity, other.m_capacity);
+				std::swap(m_size, other.m_size);
+				std::swap(m_growthLeft, other.m_growthLeft);
+			}
+
+		private:
+			static constexpr std::size_t NOT_FOUND = SIZE_MAX;
+
+			iterator iteratorAt(std::size_t at) { return { m_control + at, m_slots + at, m_control + m_capacity }; }
+
+			// Group 'probe' of the sequence of 'hash': quadratic over groups
+			std::size_t groupAt(std::uint64_t hash, std::size_t probe) const
+			{
+				std::size_t groups = m_capacity / FLAT_GROUP_WIDTH;
+				return ((static_cast<std::size_t>(hash >> 7) + probe * (probe + 1) / 2) & (groups - 1)) * FLAT_GROUP_WIDTH;
+			}
+
+			template<typename K>
+			std::size_t locate(const K& key, std::uint64_t hash) const
+			{
+				if (m_capacity == 0) return NOT_FOUND;
+				auto h2 = static_cast<std::int8_t>(hash & 0x7F);
+				for (std::size_t probe = 0;; ++probe) {
+					std::size_t first = groupAt(hash, probe);
+					FlatGroup group(m_control + first);
+					for (std::uint32_t mask = group.match(h2); mask != 0; mask &= mask - 1) {
+						std::size_t at = first + static_cast<std::size_t>(std::countr_zero(mask));
+						if (Equal{}(Policy::key(m_slots[at]), key)) return at;
+					}
+					if (group.matchEmpty() != 0) return NOT_FOUND;
+				}
+			}
+
+			// A free slot on the probe sequence of 'hash', growing first if the
+			// table would pass 7/8 full
+			std::size_t prepareInsert(std::uint64_t hash)
+			{
+				std::size_t at = firstFree(hash);
+				if (m_growthLeft == 0 && (m_capacity == 0 || m_control[at] != FLAT_DELETED)) {
+					// Mostly tombstones: clean them up in place rather than double
+					rehash(m_capacity == 0 ? FLAT_GROUP_WIDTH : (m_size * 2 <= m_capacity * 7 / 8 / 2 ? m_capacity : m_capacity * 2));
+					at = firstFree(hash);
+				}
+				if (m_control[at] == FLAT_EMPTY) --m_growthLeft;
+				return at;
+			}
+
+			std::size_t firstFree(std::uint64_t hash) const
+			{
+				if (m_capacity == 0) return 0;
+				for (std::size_t probe = 0;; ++probe) {
+					std::size_t first = groupAt(hash, probe);
+					if (std::uint32_t mask = FlatGroup(m_control + first).matchFree()) return first + static_cast<std::size_t>(std::countr_zero(mask));
+				}
+			}
+
+			void setControl(std::size_t at, std::int8_t value) { m_control[at] = value; }
+
+			void eraseAt(std::size_t at)
+			{
+				std::destroy_at(m_slots + at);
+				--m_size;
+
+				// A probe that reached this group stopped in it if the group has an
+				// empty slot, so none needs a tombstone here to go on
+				std::size_t first = at & ~(FLAT_GROUP_WIDTH - 1);
+				if (FlatGroup(m_control + first).matchEmpty() != 0) {
+					setControl(at, FLAT_EMPTY);
+					++m_growthLeft;
+				}
+				else {
+					setControl(at, FLAT_DELETED);
+				}
+			}
+
+			void rehash(std::size_t capacity)
+			{
+				FlatTable old;
+				swap(old);
+				allocate(capacity);
+				for (std::size_t i = 0; i < old.m_capacity; ++i) {
+					if (old.m_control[i] < 0) continue;
+					std::uint64_t hash = flatMix(Hash{}(Policy::key(old.m_slots[i])));
+					std::size_t at = firstFree(hash);
+					::new (static_cast<void*>(m_slots + at)) slot_type(std::move(old.m_slots[i]));
+					setControl(at, static_cast<std::int8_t>(hash & 0x7F));
+					--m_growthLeft;
+					++m_size;
+				}
+			}
+
+			void allocate(std::size_t capacity)
+			{
+				m_control = static_cast<std::int8_t*>(::operator new(capacity));
+				std::memset(m_control, static_cast<unsigned char>(FLAT_EMPTY), capacity);
+				try {
+					m_slots = std::allocator<slot_type>().allocate(capacity);
+				}
+				catch (...) {
+					::operator delete(m_control);
+					m_control = nullptr;
+					throw;
+				}
+				m_capacity = capacity;
+				m_growthLeft = capacity * 7 / 8;
+			}
+
+			void destroy()
+			{
+				if (m_capacity == 0) return;
+				for (std::size_t i = 0; i < m_capacity; ++i) {
+					if (m_control[i] >= 0) std::destroy_at(m_slots + i);
+				}
+				std::allocator<slot_type>().deallocate(m_slots, m_capacity);
+				::operator delete(m_control);
+			}
+
+			std::int8_t* m_control = nullptr;
+			slot_type* m_slots = nullptr;
+			std::size_t m_capacity = 0; // 0, or a power of two at least FLAT_GROUP_WIDTH
+			std::size_t m_size = 0;
+			std::size_t m_growthLeft = 0; // Empty slots that may still be filled before a rehash
+		};
+
+		template<typename Key, typename Value>
+		struct FlatMapPolicy
+		{
+			using key_type = Key;
+			using slot_type = std::pair<const Key, Value>;
+			static constexpr bool KEY_ONLY = false;
+
+			static const Key& key(const slot_type& slot) { return slot.first; }
+
+			template<typename K, typename... Args>
+			static void construct(slot_type* slot, K&& key, Args&&... args)
+			{
+				::new (static_cast<void*>(slot)) slot_type(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+			}
+		};
+
+		template<typename Key>
+		struct FlatSetPolicy
+		{
+			using key_type = Key;
+			using slot_type = Key;
+			static constexpr bool KEY_ONLY = true;
+
+			static const Key& key(const slot_type& slot) { return slot; }
+
+			template<typename K>
+			static void construct(slot_type* slot, K&& key)
+			{
+				::new (static_cast<void*>(slot)) slot_type(std::forward<K>(key));
+			}
+		};
+	}
+
+	// Flat open-addressing hash map (see detail::FlatTable) for lookups on
+	// the path of every file: a find is one hash, one 16-byte compare of
+	// control bytes, and usually one key compare, all in a cache line or
+	// two, where std::unordered_map chases a bucket and a heap node per
+	// entry. Unlike it, inserting may move entries.
+	template<typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<>>
+	class FlatHashMap : public detail::FlatTable<detail::FlatMapPolicy<Key, Value>, Hash, Equal>
+	{
+		using Base = detail::FlatTable<detail::FlatMapPolicy<Key, Value>, Hash, Equal>;
+
+	public:
+		using mapped_type = Value;
+		using typename Base::iterator;
+
+		template<typename K, typename... Args>
+		std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) { return this->tryEmplace(std::forward<K>(key), std::forward<Args>(args)...); }
+
+		template<typename K, typename V>
+		std::pair<iterator, bool> emplace(K&& key, V&& value) { return this->tryEmplace(std::forward<K>(key), std::forward<V>(value)); }
+
+		template<typename K>
+		Value& operator[](K&& key) { return this->tryEmplace(std::forward<K>(key)).first->second; }
+	};
+
+	// The keys alone, as std::unordered_set
+	template<typename Key, typename Hash = std::hash<Key>, typename Equal = std::equal_to<>>
+	class FlatHashSet : public detail::FlatTable<detail::FlatSetPolicy<Key>, Hash, Equal>
+	{
+		using Base = detail::FlatTable<detail::FlatSetPolicy<Key>, Hash, Equal>;
+
+	public:
+		using typename Base::iterator;
+
+		template<typename K>
+		std::pair<iterator, bool> insert(K&& key) { return this->tryEmplace(std::forward<K>(key)); }
+
+		template<typename K>
+		std::pair<iterator, bool> emplace(K&& key) { return this->tryEmplace(std::forward<K>(key)); }
+	};
+}
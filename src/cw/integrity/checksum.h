@@ -0,0 +1,290 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+#if defined(CW_HAS_ISAL)
+#include <isa-l/crc.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#define CW_CRC32C_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CW_CRC32C_ARM 1
+#endif
+
+namespace cw::integrity {
+
+	namespace detail {
+
+		constexpr std::uint32_t CRC32C_POLY = 0x82F63B78; // Castagnoli, bit-reflected
+
+		// Slice-by-8 tables for CPUs without CRC32C instructions
+		constexpr std::array<std::array<std::uint32_t, 256>, 8> makeCrc32cTables()
+		{
+			std::array<std::array<std::uint32_t, 256>, 8> tables{};
+			for (std::uint32_t i = 0; i < 256; ++i) {
+				std::uint32_t crc = i;
+				for (int bit = 0; bit < 8; ++bit) crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+				tables[0][i] = crc;
+			}
+			for (std::size_t t = 1; t < 8; ++t) {
+				for (std::uint32_t i = 0; i < 256; ++i) {
+					tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFF];
+				}
+			}
+			return tables;
+		}
+
+		inline constexpr auto CRC32C_TABLES = makeCrc32cTables();
+
+		// Register-level update (no pre/post inversion)
+		inline std::uint32_t crc32cSoftware(std::uint32_t crc, const std::uint8_t* data, std::size_t length)
+		{
+			const auto& t = CRC32C_TABLES;
+			while (length >= 8) {
+				std::uint32_t low = crc ^ (std::uint32_t(data[0]) | std::uint32_t(data[1]) << 8 | std::uint32_t(data[2]) << 16 | std::uint32_t(data[3]) << 24);
+				crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+					^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+				data += 8;
+				length -= 8;
+			}
+			while (length--) crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+			return crc;
+		}
+
+		inline std::uint32_t shiftZeros(std::uint32_t crc, std::uint64_t length);
+
+#if defined(CW_HAS_ISAL)
+		// ISA-L picks its fastest kernel for the CPU itself (PCLMULQDQ folding
+		// where there is one) at its first call
+		inline std::uint32_t crc32cIsal(std::uint32_t crc, const std::uint8_t* data, std::size_t length)
+		{
+			constexpr std::size_t MAX_PIECE = std::size_t(1) << 30; // Its lengths are ints
+			while (length > 0) {
+				std::size_t piece = std::min(length, MAX_PIECE);
+				crc = crc32_iscsi(const_cast<unsigned char*>(data), static_cast<int>(piece), crc);
+				data += piece;
+				length -= piece;
+			}
+			return crc;
+		}
+#endif
+
+#if defined(CW_CRC32C_X86)
+		// Below this, one stream of crc32 instructions; above, three side by side
+		constexpr std::size_t CRC32C_LANES_MIN = 4096;
+
+#if defined(__GNUC__) || defined(__clang__)
+		__attribute__((target("sse4.2")))
+#endif
+		inline std::uint32_t crc32cHardware(std::uint32_t crc, const std::uint8_t* data, std::size_t length)
+		{
+			std::uint64_t crc64 = crc;
+
+			// crc32 takes 3 cycles and issues one per cycle: three independent
+			// lanes keep it busy, and are joined as crc32cCombine does
+			if (length >= CRC32C_LANES_MIN) {
+				std::size_t lane = (length / 3) & ~std::size_t(7);
+				const std::uint8_t* b = data + lane;
+				const std::uint8_t* c = b + lane;
+				std::uint64_t crcB = 0;
+				std::uint64_t crcC = 0;
+				for (std::size_t i = 0; i < lane; i += 8) {
+					std::uint64_t wordA, wordB, wordC;
+					std::memcpy(&wordA, data + i, sizeof(wordA));
+					std::memcpy(&wordB, b + i, sizeof(wordB));
+					std::memcpy(&wordC, c + i, sizeof(wordC));
+					crc64 = _mm_crc32_u64(crc64, wordA);
+					crcB = _mm_crc32_u64(crcB, wordB);
+					crcC = _mm_crc32_u64(crcC, wordC);
+				}
+				std::uint32_t joined = shiftZeros(static_cast<std::uint32_t>(crc64), lane) ^ static_cast<std::uint32_t>(crcB);
+				crc64 = shiftZeros(joined, lane) ^ static_cast<std::uint32_t>(crcC);
+				data += 3 * lane;
+				length -= 3 * lane;
+			}
+
+			while (length >= 8) {
+				std::uint64_t word;
+				std::memcpy(&word, data, sizeof(word));
+				crc64 = _mm_crc32_u64(crc64, word);
+				data += 8;
+				length -= 8;
+			}
+			crc = static_cast<std::uint32_t>(crc64);
+			while (length--) crc = _mm_crc32_u8(crc, *data++);
+			return crc;
+		}
+
+		// SSE4.2 is checked once at run time, so the binary still runs on older CPUs
+		inline bool hasHardwareCrc32c()
+		{
+#if defined(__SSE4_2__)
+			return true;
+#elif defined(_MSC_VER)
+			static const bool supported = []() { int info[4]; __cpuid(info, 1); return (info[2] & (1 << 20)) != 0; }();
+			return supported;
+#else
+			static const bool supported = __builtin_cpu_supports("sse4.2");
+			return supported;
+#endif
+		}
+#elif defined(CW_CRC32C_ARM)
+		inline std::uint32_t crc32cHardware(std::uint32_t crc, const std::uint8_t* data, std::size_t length)
+		{
+			while (length >= 8) {
+				std::uint64_t word;
+				std::memcpy(&word, data, sizeof(word));
+				crc = __crc32cd(crc, word);
+				data += 8;
+				length -= 8;
+			}
+			while (length--) crc = __crc32cb(crc, *data++);
+			return crc;
+		}
+
+		inline bool hasHardwareCrc32c() { return true; }
+#endif
+
+		// Product of two polynomials modulo the CRC polynomial (GF(2), reflected)
+		inline std::uint32_t multiplyModPoly(std::uint32_t a, std::uint32_t b)
+		{
+			std::uint32_t product = 0;
+			for (std::uint32_t mask = std::uint32_t(1) << 31; mask != 0; mask >>= 1) {
+				if (a & mask) product ^= b;
+				b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+			}
+			return product;
+		}
+
+		// x^(2^k) mod P for k = 0..63
+		inline const std::array<std::uint32_t, 64>& powerTable()
+		{
+			static const std::array<std::uint32_t, 64> table = []()
+				{
+					std::array<std::uint32_t, 64> powers{};
+					std::uint32_t p = std::uint32_t(1) << 30; // x^1
+					for (auto& power : powers) {
+						power = p;
+						p = multiplyModPoly(p, p);
+					}
+					return powers;
+				}();
+			return table;
+		}
+
+		// Advances a CRC register over 'length' zero bytes in O(log length)
+		inline std::uint32_t shiftZeros(std::uint32_t crc, std::uint64_t length)
+		{
+			const auto& powers = powerTable();
+			std::uint64_t bits = length;
+			for (std::size_t k = 3; bits != 0 && k < powers.size(); ++k, bits >>= 1) {
+				if (bits & 1) crc = multiplyModPoly(powers[k], crc);
+			}
+			return crc;
+		}
+	}
+
+	// Which implementation crc32c() runs on this CPU: ISA-L where the build
+	// has it (CW_HAS_ISAL), else the CPU's CRC32C instructions, else tables
+	inline std::string_view crc32cBackend()
+	{
+#if defined(CW_HAS_ISAL)
+		return "isa-l";
+#else
+#if defined(CW_CRC32C_X86)
+		if (detail::hasHardwareCrc32c()) return "sse4.2";
+#elif defined(CW_CRC32C_ARM)
+		if (detail::hasHardwareCrc32c()) return "armv8";
+#endif
+		return "software";
+#endif
+	}
+
+	// CRC32C (Castagnoli) of 'data', continuing from 'crc' (the CRC of the bytes
+	// before it), by crc32cBackend()
+	inline std::uint32_t crc32c(std::span<const std::uint8_t> data, std::uint32_t crc = 0)
+	{
+		std::uint32_t reg = ~crc;
+#if defined(CW_HAS_ISAL)
+		return ~detail::crc32cIsal(reg, data.data(), data.size());
+#else
+#if defined(CW_CRC32C_X86) || defined(CW_CRC32C_ARM)
+		if (detail::hasHardwareCrc32c()) return ~detail::crc32cHardware(reg, data.data(), data.size());
+#endif
+		return ~detail::crc32cSoftware(reg, data.data(), data.size());
+#endif
+	}
+
+	// CRC of A followed by B, from the CRCs of both and the length of B (as zlib's crc32_combine)
+	inline std::uint32_t crc32cCombine(std::uint32_t crcA, std::uint32_t crcB, std::uint64_t lengthB)
+	{
+		return detail::shiftZeros(crcA, lengthB) ^ crcB;
+	}
+
+	// Whole-file CRC32C assembled from the CRCs of its chunks, in any order.
+	// CRC is linear, so each chunk's contribution is shifted to its place in
+	// the file: no second pass over the data, and chunks arriving out of order
+	// (stripes) need no reordering. Covering every byte exactly once yields
+	// crc32c() of the whole file; otherwise both ends still agree as long as they
+	// added the same chunks (e.g. a resumed upload's remainder).
+	// Of UNKNOWN_SIZE (a stream whose length comes at its end), contributions
+	// are kept relative to the furthest byte added so far and moved on as the
+	// stream grows, until setFileSize().
+	class FileDigest
+	{
+	public:
+		static constexpr std::uint64_t UNKNOWN_SIZE = UINT64_MAX;
+
+		// Not explicit: aggregates holding one (ActiveTransfer, a receiver's
+		// Stream) are brace-initialized without naming it
+		FileDigest() = default;
+		explicit FileDigest(std::uint64_t fileSize) : m_fileSize(fileSize) {}
+
+		void add(std::uint64_t offset, std::uint64_t length, std::uint32_t crc)
+		{
+			// The chunk's CRC without its initial ~0 register, moved to end of file
+			std::uint32_t linear = ~crc ^ detail::shiftZeros(~std::uint32_t(0), length);
+			m_bytes += length;
+			if (m_fileSize != UNKNOWN_SIZE) {
+				m_linear ^= detail::shiftZeros(linear, m_fileSize - offset - length);
+				return;
+			}
+
+			std::uint64_t end = offset + length;
+			if (end > m_end) {
+				m_linear = detail::shiftZeros(m_linear, end - m_end);
+				m_end = end;
+			}
+			m_linear ^= detail::shiftZeros(linear, m_end - end);
+		}
+
+		// The stream of UNKNOWN_SIZE ended at 'fileSize'
+		void setFileSize(std::uint64_t fileSize)
+		{
+			if (m_fileSize == UNKNOWN_SIZE && fileSize >= m_end) m_linear = detail::shiftZeros(m_linear, fileSize - m_end);
+			m_fileSize = fileSize;
+		}
+
+		// A range of zeros (a hole): it adds nothing to the linear part
+		void addZeros(std::uint64_t length) { m_bytes += length; }
+
+		std::uint32_t value() const { return ~(detail::shiftZeros(~std::uint32_t(0), m_fileSize) ^ m_linear); }
+		std::uint64_t bytes() const { return m_bytes; }
+
+	private:
+		std::uint64_t m_fileSize = 0;
+		std::uint32_t m_linear = 0;
+		std::uint64_t m_bytes = 0;
+		std::uint64_t m_end = 0; // Of UNKNOWN_SIZE: where m_linear is relative to
+	};
+}
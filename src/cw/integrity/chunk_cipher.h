@@ -0,0 +1,252 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#if defined(CW_HAS_TLS)
+#define CW_HAS_CHUNK_CIPHER 1
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+namespace cw::integrity {
+
+	// Authenticated ciphers a sealed chunk may be in
+	enum class ChunkCipherSuite : std::uint8_t
+	{
+		Aes256Gcm = 1,        // Where the CPU has AES instructions (AES-NI, ARMv8 crypto)
+		ChaCha20Poly1305 = 2, // Faster without them
+	};
+
+	constexpr std::size_t CHUNK_KEY_SIZE = 32;
+	constexpr std::size_t CHUNK_SALT_SIZE = 16;
+	constexpr std::size_t CHUNK_TAG_SIZE = 16;
+	constexpr std::size_t CHUNK_NONCE_SIZE = 12;
+
+	// Pre-shared secret of both ends: chunks are sealed under keys derived from it
+	using ChunkKey = std::array<std::uint8_t, CHUNK_KEY_SIZE>;
+	// Random per file, sent with each of its chunks: names the file's key
+	using ChunkSalt = std::array<std::uint8_t, CHUNK_SALT_SIZE>;
+
+	// A key from its 64 hex digits, or nullopt
+	inline std::optional<ChunkKey> parseChunkKey(std::string_view hex)
+	{
+		while (!hex.empty() && (hex.back() == '\n' || hex.back() == '\r' || hex.back() == ' ')) hex.remove_suffix(1);
+		if (hex.size() != 2 * CHUNK_KEY_SIZE) return std::nullopt;
+
+		auto nibble = [](char c) -> int
+			{
+				if (c >= '0' && c <= '9') return c - '0';
+				if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+				if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+				return -1;
+			};
+		ChunkKey key;
+		for (std::size_t i = 0; i < key.size(); ++i) {
+			int high = nibble(hex[2 * i]);
+			int low = nibble(hex[2 * i + 1]);
+			if (high < 0 || low < 0) return std::nullopt;
+			key[i] = static_cast<std::uint8_t>(high << 4 | low);
+		}
+		return key;
+	}
+
+	// The key in 'path': a file holding its hex digits, as openssl rand -hex 32 writes them
+	inline std::optional<ChunkKey> readChunkKey(const std::filesystem::path& path)
+	{
+		std::FILE* file = std::fopen(path.string().c_str(), "rb");
+		if (!file) return std::nullopt;
+		char text[2 * CHUNK_KEY_SIZE + 4] = {};
+		std::size_t length = std::fread(text, 1, sizeof(text), file);
+		std::fclose(file);
+		return parseChunkKey(std::string_view(text, length));
+	}
+
+	// AES-GCM where this CPU has AES instructions, ChaCha20-Poly1305 elsewhere
+	inline ChunkCipherSuite preferredChunkCipherSuite()
+	{
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+		static const bool aes = __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+		return aes ? ChunkCipherSuite::Aes256Gcm : ChunkCipherSuite::ChaCha20Poly1305;
+#elif defined(__aarch64__) && defined(__linux__)
+		static const bool aes = (::getauxval(AT_HWCAP) & HWCAP_AES) != 0 && (::getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+		return aes ? ChunkCipherSuite::Aes256Gcm : ChunkCipherSuite::ChaCha20Poly1305;
+#elif defined(_M_X64) || (defined(__aarch64__) && defined(__APPLE__))
+		return ChunkCipherSuite::Aes256Gcm;
+#else
+		return ChunkCipherSuite::ChaCha20Poly1305;
+#endif
+	}
+
+	// Per-chunk authenticated encryption, for transports TLS does not cover
+	// (UdpTunnel, relays): each chunk is sealed on its own, so chunks are
+	// sealed and opened on as many cores as there are, in any order. A
+	// file's chunks are under a key of its own, HKDF-SHA256 of the shared
+	// ChunkKey and the file's random salt, which also gives a 4-byte nonce
+	// prefix; a chunk's nonce is that prefix and its offset. An offset is
+	// only ever sealed again with the same bytes (a retransmit), so no nonce
+	// is reused with different plaintext. OpenSSL's EVP, which picks the
+	// AES-NI/ARMv8/AVX-512 code for the CPU. Thread-safe.
+	class ChunkCipher
+	{
+	public:
+		// Built with OpenSSL (CW_HAS_TLS)
+		static constexpr bool available()
+		{
+#if defined(CW_HAS_CHUNK_CIPHER)
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		static ChunkSalt newSalt()
+		{
+			ChunkSalt salt{};
+#if defined(CW_HAS_CHUNK_CIPHER)
+			if (RAND_bytes(salt.data(), static_cast<int>(salt.size())) != 1) throw std::runtime_error("ChunkCipher: no random bytes.");
+#endif
+			return salt;
+		}
+
+		// The cipher of the file whose chunks carry 'salt'
+		static std::shared_ptr<const ChunkCipher> derive(const ChunkKey& key, const ChunkSalt& salt, ChunkCipherSuite suite)
+		{
+#if defined(CW_HAS_CHUNK_CIPHER)
+			if (suite != ChunkCipherSuite::Aes256Gcm && suite != ChunkCipherSuite::ChaCha20Poly1305) {
+				throw std::runtime_error("ChunkCipher: unknown suite.");
+			}
+			std::array<std::uint8_t, CHUNK_KEY_SIZE + 4> okm{};
+			const std::uint8_t info[] = { 'c', 'w', ' ', 'c', 'h', 'u', 'n', 'k', ' ', 'v', '1', static_cast<std::uint8_t>(suite) };
+
+			EVP_PKEY_CTX* context = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+			std::size_t length = okm.size();
+			bool ok = context && EVP_PKEY_derive_init(context) == 1
+				&& EVP_PKEY_CTX_set_hkdf_md(context, EVP_sha256()) == 1
+				&& EVP_PKEY_CTX_set1_hkdf_salt(context, salt.data(), static_cast<int>(salt.size())) == 1
+				&& EVP_PKEY_CTX_set1_hkdf_key(context, key.data(), static_cast<int>(key.size())) == 1
+				&& EVP_PKEY_CTX_add1_hkdf_info(context, info, static_cast<int>(sizeof(info))) == 1
+				&& EVP_PKEY_derive(context, okm.data(), &length) == 1 && length == okm.size();
+			EVP_PKEY_CTX_free(context);
+			if (!ok) throw std::runtime_error("ChunkCipher: key derivation failed.");
+
+			auto cipher = std::shared_ptr<ChunkCipher>(new ChunkCipher());
+			cipher->m_suite = suite;
+			std::copy_n(okm.begin(), CHUNK_KEY_SIZE, cipher->m_key.begin());
+			std::copy_n(okm.begin() + CHUNK_KEY_SIZE, 4, cipher->m_noncePrefix.begin());
+			cipher->m_salt = salt;
+			return cipher;
+#else
+			(void)key, (void)salt, (void)suite;
+			throw std::system_error(std::make_error_code(std::errc::operation_not_supported), "ChunkCipher: built without OpenSSL");
+#endif
+		}
+
+		ChunkCipherSuite suite() const noexcept { return m_suite; }
+		const ChunkSalt& salt() const noexcept { return m_salt; }
+
+		static constexpr std::size_t sealedSize(std::size_t plainSize) noexcept { return plainSize + CHUNK_TAG_SIZE; }
+
+		// What a chunk's tag covers besides its bytes: its offset, this suite,
+		// the codec of the sealed bytes and their size once decompressed
+		std::array<std::uint8_t, 14> associatedData(std::uint64_t offset, std::uint8_t codec, std::uint32_t rawSize) const noexcept
+		{
+			std::array<std::uint8_t, 14> aad;
+			for (int i = 0; i < 8; ++i) aad[i] = static_cast<std::uint8_t>(offset >> (56 - 8 * i));
+			aad[8] = static_cast<std::uint8_t>(m_suite);
+			aad[9] = codec;
+			for (int i = 0; i < 4; ++i) aad[10 + i] = static_cast<std::uint8_t>(rawSize >> (24 - 8 * i));
+			return aad;
+		}
+
+		// 'plain', the chunk at 'offset', into 'out' (sealedSize of it): the
+		// ciphertext, then the tag over it and 'aad'
+		bool seal(std::uint64_t offset, std::span<const std::uint8_t> aad, std::span<const std::uint8_t> plain, std::span<std::uint8_t> out) const
+		{
+			if (out.size() != sealedSize(plain.size())) return false;
+#if defined(CW_HAS_CHUNK_CIPHER)
+			EVP_CIPHER_CTX* context = threadContext();
+			auto nonce = nonceFor(offset);
+			int length = 0;
+			if (EVP_EncryptInit_ex(context, evpCipher(), nullptr, m_key.data(), nonce.data()) != 1) return false;
+			if (!aad.empty() && EVP_EncryptUpdate(context, nullptr, &length, aad.data(), static_cast<int>(aad.size())) != 1) return false;
+			if (EVP_EncryptUpdate(context, out.data(), &length, plain.data(), static_cast<int>(plain.size())) != 1) return false;
+			int tail = 0;
+			if (EVP_EncryptFinal_ex(context, out.data() + length, &tail) != 1) return false;
+			return EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_AEAD_GET_TAG, static_cast<int>(CHUNK_TAG_SIZE), out.data() + plain.size()) == 1;
+#else
+			(void)offset, (void)aad;
+			return false;
+#endif
+		}
+
+		// The chunk at 'offset' out of 'sealed' into 'out' (its plain size);
+		// false if it was not sealed under this key with this 'aad'
+		bool open(std::uint64_t offset, std::span<const std::uint8_t> aad, std::span<const std::uint8_t> sealed, std::span<std::uint8_t> out) const
+		{
+			if (sealed.size() < CHUNK_TAG_SIZE || out.size() != sealed.size() - CHUNK_TAG_SIZE) return false;
+#if defined(CW_HAS_CHUNK_CIPHER)
+			EVP_CIPHER_CTX* context = threadContext();
+			auto nonce = nonceFor(offset);
+			int length = 0;
+			if (EVP_DecryptInit_ex(context, evpCipher(), nullptr, m_key.data(), nonce.data()) != 1) return false;
+			if (!aad.empty() && EVP_DecryptUpdate(context, nullptr, &length, aad.data(), static_cast<int>(aad.size())) != 1) return false;
+			if (EVP_DecryptUpdate(context, out.data(), &length, sealed.data(), static_cast<int>(out.size())) != 1) return false;
+			std::array<std::uint8_t, CHUNK_TAG_SIZE> tag;
+			std::copy_n(sealed.data() + out.size(), CHUNK_TAG_SIZE, tag.begin());
+			if (EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_AEAD_SET_TAG, static_cast<int>(CHUNK_TAG_SIZE), tag.data()) != 1) return false;
+			int tail = 0;
+			return EVP_DecryptFinal_ex(context, out.data() + length, &tail) == 1;
+#else
+			(void)offset, (void)aad;
+			return false;
+#endif
+		}
+
+	private:
+		ChunkCipher() = default;
+
+		std::array<std::uint8_t, CHUNK_NONCE_SIZE> nonceFor(std::uint64_t offset) const noexcept
+		{
+			std::array<std::uint8_t, CHUNK_NONCE_SIZE> nonce;
+			std::copy(m_noncePrefix.begin(), m_noncePrefix.end(), nonce.begin());
+			for (int i = 0; i < 8; ++i) nonce[4 + i] = static_cast<std::uint8_t>(offset >> (56 - 8 * i));
+			return nonce;
+		}
+
+#if defined(CW_HAS_CHUNK_CIPHER)
+		const EVP_CIPHER* evpCipher() const noexcept
+		{
+			return m_suite == ChunkCipherSuite::Aes256Gcm ? EVP_aes_256_gcm() : EVP_chacha20_poly1305();
+		}
+
+		// One context per thread, reinitialized for each chunk: the key
+		// schedule is nothing next to a chunk
+		static EVP_CIPHER_CTX* threadContext()
+		{
+			thread_local std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+			return context.get();
+		}
+#endif
+
+		ChunkCipherSuite m_suite = ChunkCipherSuite::Aes256Gcm;
+		std::array<std::uint8_t, CHUNK_KEY_SIZE> m_key{};
+		std::array<std::uint8_t, 4> m_noncePrefix{};
+		ChunkSalt m_salt{};
+	};
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace cw::integrity {
+
+	namespace detail {
+
+		// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D), as most
+		// Reed-Solomon codes; 2 generates its multiplicative group
+		struct Gf256Tables
+		{
+			std::array<std::uint8_t, 512> exp{}; // Doubled: exp[log a + log b] needs no modulo
+			std::array<std::uint8_t, 256> log{};
+		};
+
+		constexpr Gf256Tables makeGf256Tables()
+		{
+			Gf256Tables tables;
+			unsigned value = 1;
+			for (unsigned i = 0; i < 255; ++i) {
+				tables.exp[i] = static_cast<std::uint8_t>(value);
+				tables.log[value] = static_cast<std::uint8_t>(i);
+				value <<= 1;
+				if (value & 0x100) value ^= 0x11D;
+			}
+			for (unsigned i = 255; i < 512; ++i) tables.exp[i] = tables.exp[i - 255];
+			return tables;
+		}
+
+		inline constexpr Gf256Tables GF256 = makeGf256Tables();
+
+		constexpr std::uint8_t gfMul(std::uint8_t a, std::uint8_t b)
+		{
+			if (a == 0 || b == 0) return 0;
+			return GF256.exp[GF256.log[a] + GF256.log[b]];
+		}
+
+		constexpr std::uint8_t gfInv(std::uint8_t a) { return GF256.exp[255 - GF256.log[a]]; }
+
+		// Every product, one row per coefficient: the inner loop is a lookup
+		using Gf256MulTable = std::array<std::array<std::uint8_t, 256>, 256>;
+
+		constexpr Gf256MulTable makeGf256MulTable()
+		{
+			Gf256MulTable table{};
+			for (unsigned a = 0; a < 256; ++a) {
+				for (unsigned b = 0; b < 256; ++b) table[a][b] = gfMul(static_cast<std::uint8_t>(a), static_cast<std::uint8_t>(b));
+			}
+			return table;
+		}
+
+		inline constexpr Gf256MulTable GF256_MUL = makeGf256MulTable();
+
+		// out ^= c * in, over the length of 'in' (shorter shards count as zero-padded)
+		inline void gfMulAdd(std::uint8_t c, std::span<const std::uint8_t> in, std::span<std::uint8_t> out)
+		{
+			if (c == 0) return;
+			const auto& row = GF256_MUL[c];
+			for (std::size_t i = 0; i < in.size(); ++i) out[i] ^= row[in[i]];
+		}
+	}
+
+	// Systematic Reed-Solomon erasure code: 'dataShards' shards go out as they
+	// are, followed by 'parityShards' parity shards, and any 'dataShards' of
+	// the whole group recover the rest. The generator is a Cauchy matrix
+	// (parity i, data j: 1 / (x_i + y_j), x_i = k + i, y_j = j), every square
+	// submatrix of which is invertible, so any choice of survivors decodes.
+	// Shards may be shorter than 'shardSize' and count as zero-padded.
+	// k + m <= 256. Stateless beyond its shape; any thread.
+	class ReedSolomon
+	{
+	public:
+		static constexpr std::size_t MAX_SHARDS = 256;
+
+		ReedSolomon(std::size_t dataShards, std::size_t parityShards) : m_data(dataShards), m_parity(parityShards)
+		{
+			if (dataShards == 0 || parityShards == 0 || dataShards + parityShards > MAX_SHARDS)
+				throw std::invalid_argument("Reed-Solomon group out of range");
+		}
+
+		std::size_t dataShards() const { return m_data; }
+		std::size_t parityShards() const { return m_parity; }
+
+		// Parity shard 'index' of 'data' (m_data shards) into 'parity', which
+		// is as long as the longest of them
+		void encode(std::size_t index, std::span<const std::span<const std::uint8_t>> data, std::span<std::uint8_t> parity) const
+		{
+			std::fill(parity.begin(), parity.end(), std::uint8_t{ 0 });
+			for (std::size_t j = 0; j < m_data; ++j) detail::gfMulAdd(coefficient(index, j), data[j], parity);
+		}
+
+		// Fills in the missing ('nullopt') data shards, each 'shardSize' long,
+		// from the others and the parity shards received (index, bytes). False
+		// if fewer than m_data shards survived; 'data' is then left as it was.
+		bool reconstruct(std::vector<std::optional<std::vector<std::uint8_t>>>& data,
+			std::span<const std::pair<std::size_t, std::span<const std::uint8_t>>> parity, std::size_t shardSize) const
+		{
+			std::vector<std::size_t> missing;
+			for (std::size_t j = 0; j < m_data; ++j) {
+				if (!data[j]) missing.push_back(j);
+			}
+			if (missing.empty()) return true;
+			if (missing.size() > parity.size()) return false;
+			std::size_t n = missing.size();
+
+			// What each parity shard still owes to the missing shards, once the
+			// survivors' share is taken out of it
+			std::vector<std::vector<std::uint8_t>> owed(n);
+			for (std::size_t r = 0; r < n; ++r) {
+				auto [index, bytes] = parity[r];
+				owed[r].assign(shardSize, 0);
+				std::copy_n(bytes.begin(), std::min(bytes.size(), shardSize), owed[r].begin());
+				for (std::size_t j = 0; j < m_data; ++j) {
+					if (data[j]) detail::gfMulAdd(coefficient(index, j), std::span<const std::uint8_t>(data[j]->data(), std::min(data[j]->size(), shardSize)), owed[r]);
+				}
+			}
+
+			// Invert the n x n Cauchy submatrix (parity rows x missing columns)
+			std::vector<std::vector<std::uint8_t>> matrix(n, std::vector<std::uint8_t>(2 * n, 0));
+			for (std::size_t r = 0; r < n; ++r) {
+				for (std::size_t c = 0; c < n; ++c) matrix[r][c] = coefficient(parity[r].first, missing[c]);
+				matrix[r][n + r] = 1;
+			}
+			for (std::size_t c = 0; c < n; ++c) {
+				std::size_t pivot = c;
+				while (matrix[pivot][c] == 0) ++pivot; // Invertible, so there always is one
+				std::swap(matrix[pivot], matrix[c]);
+				std::uint8_t scale = detail::gfInv(matrix[c][c]);
+				for (auto& value : matrix[c]) value = detail::gfMul(value, scale);
+				for (std::size_t r = 0; r < n; ++r) {
+					std::uint8_t factor = matrix[r][c];
+					if (r == c || factor == 0) continue;
+					for (std::size_t k = 0; k < 2 * n; ++k) matrix[r][k] ^= detail::gfMul(factor, matrix[c][k]);
+				}
+			}
+
+			for (std::size_t c = 0; c < n; ++c) {
+				std::vector<std::uint8_t> shard(shardSize, 0);
+				for (std::size_t r = 0; r < n; ++r) detail::gfMulAdd(matrix[c][n + r], owed[r], shard);
+				data[missing[c]] = std::move(shard);
+			}
+			return true;
+		}
+
+	private:
+		std::uint8_t coefficient(std::size_t parity, std::size_t data) const
+		{
+			return detail::gfInv(static_cast<std::uint8_t>((m_data + parity) ^ data));
+		}
+
+		std::size_t m_data;
+		std::size_t m_parity;
+	};
+}
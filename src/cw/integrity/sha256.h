@@ -0,0 +1,146 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+
+namespace cw::integrity {
+
+	using Sha256Digest = std::array<std::uint8_t, 32>;
+
+	// FIPS 180-4 SHA-256, incremental. Names content-addressed chunks, where a
+	// collision would silently splice one chunk's bytes into another file.
+	class Sha256
+	{
+	public:
+		void update(std::span<const std::uint8_t> data)
+		{
+			m_length += data.size();
+
+			if (m_buffered > 0) {
+				std::size_t take = std::min(data.size(), m_block.size() - m_buffered);
+				std::memcpy(m_block.data() + m_buffered, data.data(), take);
+				m_buffered += take;
+				data = data.subspan(take);
+				if (m_buffered < m_block.size()) return;
+				compress(m_block.data());
+				m_buffered = 0;
+			}
+
+			while (data.size() >= m_block.size()) {
+				compress(data.data());
+				data = data.subspan(m_block.size());
+			}
+
+			std::memcpy(m_block.data(), data.data(), data.size());
+			m_buffered = data.size();
+		}
+
+		Sha256Digest digest()
+		{
+			std::uint64_t bits = m_length * 8;
+
+			std::uint8_t pad[72] = { 0x80 };
+			std::size_t padLength = (m_buffered < 56 ? 56 : 120) - m_buffered;
+			for (int i = 0; i < 8; ++i) pad[padLength + i] = static_cast<std::uint8_t>(bits >> (56 - 8 * i));
+			update(std::span<const std::uint8_t>(pad, padLength + 8));
+
+			Sha256Digest out;
+			for (std::size_t i = 0; i < 8; ++i) {
+				for (std::size_t b = 0; b < 4; ++b) out[4 * i + b] = static_cast<std::uint8_t>(m_state[i] >> (24 - 8 * b));
+			}
+			return out;
+		}
+
+	private:
+		static std::uint32_t rotr(std::uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+		void compress(const std::uint8_t* block)
+		{
+			static constexpr std::uint32_t K[64] = {
+				0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+				0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+				0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+				0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+				0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+				0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+				0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+				0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+			};
+
+			std::uint32_t w[64];
+			for (int i = 0; i < 16; ++i) {
+				w[i] = std::uint32_t(block[4 * i]) << 24 | std::uint32_t(block[4 * i + 1]) << 16
+					| std::uint32_t(block[4 * i + 2]) << 8 | std::uint32_t(block[4 * i + 3]);
+			}
+			for (int i = 16; i < 64; ++i) {
+				std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			std::uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+			std::uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+			for (int i = 0; i < 64; ++i) {
+				std::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+				std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+				h = g; g = f; f = e; e = d + t1;
+				d = c; c = b; b = a; a = t1 + t2;
+			}
+
+			m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d;
+			m_state[4] += e; m_state[5] += f; m_state[6] += g; m_state[7] += h;
+		}
+
+	private:
+		std::uint32_t m_state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+		std::array<std::uint8_t, 64> m_block{};
+		std::size_t m_buffered = 0;
+		std::uint64_t m_length = 0;
+	};
+
+	inline Sha256Digest sha256(std::span<const std::uint8_t> data)
+	{
+		Sha256 hash;
+		hash.update(data);
+		return hash.digest();
+	}
+
+	// HMAC-SHA256 (RFC 2104), as AWS Signature Version 4 chains it
+	inline Sha256Digest hmacSha256(std::span<const std::uint8_t> key, std::span<const std::uint8_t> message)
+	{
+		std::array<std::uint8_t, 64> block{};
+		if (key.size() > block.size()) {
+			Sha256Digest hashed = sha256(key);
+			std::copy(hashed.begin(), hashed.end(), block.begin());
+		}
+		else std::copy(key.begin(), key.end(), block.begin());
+
+		std::array<std::uint8_t, 64> pad;
+		Sha256 inner;
+		for (std::size_t i = 0; i < pad.size(); ++i) pad[i] = block[i] ^ 0x36;
+		inner.update(pad);
+		inner.update(message);
+		Sha256Digest innerDigest = inner.digest();
+
+		Sha256 outer;
+		for (std::size_t i = 0; i < pad.size(); ++i) pad[i] = block[i] ^ 0x5c;
+		outer.update(pad);
+		outer.update(innerDigest);
+		return outer.digest();
+	}
+
+	inline std::string toHex(const Sha256Digest& digest)
+	{
+		static constexpr char DIGITS[] = "0123456789abcdef";
+		std::string hex;
+		hex.reserve(digest.size() * 2);
+		for (std::uint8_t byte : digest) {
+			hex.push_back(DIGITS[byte >> 4]);
+			hex.push_back(DIGITS[byte & 0xF]);
+		}
+		return hex;
+	}
+}
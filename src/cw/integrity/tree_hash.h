@@ -0,0 +1,110 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <map>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "cw/endian.h"
+#include "cw/integrity/sha256.h"
+
+namespace cw::integrity {
+
+	// One leaf of a TreeHash: a chunk of the stream and the hash of its bytes
+	struct TreeLeaf
+	{
+		std::uint64_t offset = 0;
+		std::uint32_t length = 0;
+		Sha256Digest hash{};
+
+		bool operator==(const TreeLeaf&) const = default;
+	};
+
+	// Merkle tree (SHA-256) over the chunks a stream carried. Each leaf is
+	// hashed wherever its chunk happens to be, as it is read on one end and
+	// received on the other, in any order and on any core; the tree is only
+	// assembled, in offset order, once the stream is done. Like FileDigest,
+	// both ends agree as long as they saw the same chunks. Unlike it, a
+	// mismatch names the leaves that differ (mismatches()), so only those
+	// ranges need to be sent again. Leaves and inner nodes are hashed with
+	// different prefixes (as RFC 6962), so a leaf cannot pass for a subtree,
+	// and a leaf covers its offset, so a chunk cannot be moved.
+	// One thread at a time; hashLeaf() is free to run anywhere.
+	class TreeHash
+	{
+	public:
+		static Sha256Digest hashLeaf(std::uint64_t offset, std::span<const std::uint8_t> data)
+		{
+			std::array<std::uint8_t, 1 + sizeof(offset)> prefix{ LEAF_PREFIX };
+			cw::binary::writeBigEndian(prefix.data() + 1, offset);
+			Sha256 sha;
+			sha.update(prefix);
+			sha.update(data);
+			return sha.digest();
+		}
+
+		// A chunk sent again replaces the leaf at its offset
+		void add(std::uint64_t offset, std::uint32_t length, const Sha256Digest& hash) { m_leaves[offset] = { length, hash }; }
+
+		void add(std::uint64_t offset, std::span<const std::uint8_t> data)
+		{
+			add(offset, static_cast<std::uint32_t>(data.size()), hashLeaf(offset, data));
+		}
+
+		std::size_t size() const { return m_leaves.size(); }
+
+		std::vector<TreeLeaf> leaves() const
+		{
+			std::vector<TreeLeaf> out;
+			out.reserve(m_leaves.size());
+			for (const auto& [offset, leaf] : m_leaves) out.push_back({ offset, leaf.first, leaf.second });
+			return out;
+		}
+
+		// Pairs are hashed level by level; an odd node out moves up as it is
+		Sha256Digest root() const
+		{
+			std::vector<Sha256Digest> level;
+			level.reserve(m_leaves.size());
+			for (const auto& [offset, leaf] : m_leaves) level.push_back(leaf.second);
+			if (level.empty()) return sha256({});
+
+			while (level.size() > 1) {
+				std::size_t pairs = level.size() / 2;
+				for (std::size_t i = 0; i < pairs; ++i) level[i] = hashNode(level[2 * i], level[2 * i + 1]);
+				if (level.size() % 2) level[pairs++] = level.back();
+				level.resize(pairs);
+			}
+			return level.front();
+		}
+
+		// The ranges of 'expected' (the other end's leaves) this tree does not
+		// have a matching leaf for: what to ask for again
+		std::vector<std::pair<std::uint64_t, std::uint32_t>> mismatches(std::span<const TreeLeaf> expected) const
+		{
+			std::vector<std::pair<std::uint64_t, std::uint32_t>> ranges;
+			for (const auto& leaf : expected) {
+				auto it = m_leaves.find(leaf.offset);
+				if (it == m_leaves.end() || it->second.first != leaf.length || it->second.second != leaf.hash) ranges.emplace_back(leaf.offset, leaf.length);
+			}
+			return ranges;
+		}
+
+	private:
+		static constexpr std::uint8_t LEAF_PREFIX = 0x00;
+		static constexpr std::uint8_t NODE_PREFIX = 0x01;
+
+		static Sha256Digest hashNode(const Sha256Digest& left, const Sha256Digest& right)
+		{
+			const std::uint8_t prefix = NODE_PREFIX;
+			Sha256 sha;
+			sha.update(std::span<const std::uint8_t>(&prefix, 1));
+			sha.update(left);
+			sha.update(right);
+			return sha.digest();
+		}
+
+		std::map<std::uint64_t, std::pair<std::uint32_t, Sha256Digest>> m_leaves; // Offset -> length, hash
+	};
+}
@@ -0,0 +1,254 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+// Messages below this level are compiled out, arguments included:
+// 0 trace, 1 debug, 2 info, 3 warn, 4 error, 5 nothing.
+#ifndef CW_LOG_LEVEL
+#define CW_LOG_LEVEL 2
+#endif
+
+namespace cw::log {
+
+	enum class Level : std::uint8_t
+	{
+		Trace = 0,
+		Debug = 1,
+		Info = 2,
+		Warn = 3,
+		Error = 4,
+		Off = 5
+	};
+
+	constexpr bool enabled(Level level) { return static_cast<int>(level) >= CW_LOG_LEVEL; }
+
+	// Leveled, asynchronous logger. Callers format into a fixed-size record
+	// and push it onto a lock-free ring (bounded MPMC queue after Vyukov); a
+	// background thread drains the ring and writes whole batches with one
+	// fwrite/fflush, so logging never blocks on the console. Info and below
+	// go to 'out', warnings and errors to 'err'. When the ring is full the
+	// record is dropped and counted rather than stalling the caller.
+	class Logger
+	{
+	public:
+		static constexpr std::size_t RECORD_SIZE = 256;  // Longer messages are truncated
+		static constexpr std::size_t CAPACITY = 4096;    // Records; a power of two
+
+		explicit Logger(std::FILE* out = stdout, std::FILE* err = stderr)
+			: m_out(out), m_err(err)
+		{
+			for (std::size_t i = 0; i < CAPACITY; ++i) m_cells[i].sequence.store(i, std::memory_order_relaxed);
+			m_flusher = std::thread([this]() { run(); });
+		}
+
+		~Logger()
+		{
+			m_stopping.store(true, std::memory_order_release);
+			wake();
+			m_flusher.join();
+		}
+
+		Logger(const Logger&) = delete;
+		Logger& operator=(const Logger&) = delete;
+
+		static Logger& instance()
+		{
+			static Logger logger;
+			return logger;
+		}
+
+		// Runtime filter on top of the compile-time one
+		void setLevel(Level level) { m_level.store(level, std::memory_order_relaxed); }
+		bool accepts(Level level) const { return level >= m_level.load(std::memory_order_relaxed); }
+
+		template<typename... Args>
+		void write(Level level, const Args&... args)
+		{
+			if (!accepts(level)) return;
+
+			Record record;
+			record.level = level;
+			(append(record, args), ...);
+			if (record.length < RECORD_SIZE) record.text[record.length++] = '\n';
+			else record.text[RECORD_SIZE - 1] = '\n';
+
+			if (!push(record)) {
+				m_dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			wake();
+		}
+
+		// Blocks until everything logged so far has been written
+		void flush()
+		{
+			std::uint64_t target = m_pushed.load(std::memory_order_acquire);
+			wake();
+			while (m_written.load(std::memory_order_acquire) < target) std::this_thread::yield();
+		}
+
+		std::uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+	private:
+		struct Record
+		{
+			Level level = Level::Info;
+			std::uint16_t length = 0;
+			char text[RECORD_SIZE];
+		};
+
+		struct Cell
+		{
+			std::atomic<std::size_t> sequence;
+			Record record;
+		};
+
+		static void appendText(Record& record, std::string_view text)
+		{
+			std::size_t take = std::min(text.size(), RECORD_SIZE - 1 - record.length);
+			std::copy_n(text.data(), take, record.text + record.length);
+			record.length = static_cast<std::uint16_t>(record.length + take);
+		}
+
+		template<typename T>
+		static void append(Record& record, const T& value)
+		{
+			if constexpr (std::is_same_v<T, char>) {
+				appendText(record, std::string_view(&value, 1));
+			}
+			else if constexpr (std::is_same_v<T, bool>) {
+				appendText(record, value ? "true" : "false");
+			}
+			else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+				appendText(record, std::string_view(value));
+			}
+			else if constexpr (std::is_same_v<T, std::filesystem::path>) {
+				appendText(record, value.string());
+			}
+			else if constexpr (std::is_enum_v<T>) {
+				append(record, static_cast<std::underlying_type_t<T>>(value));
+			}
+			else if constexpr (std::is_arithmetic_v<T>) {
+				char digits[32];
+				auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+				if (ec == std::errc{}) appendText(record, std::string_view(digits, static_cast<std::size_t>(end - digits)));
+			}
+			else {
+				// Rare types (endpoints...) take the slow path through a stream
+				std::ostringstream stream;
+				stream << value;
+				appendText(record, stream.str());
+			}
+		}
+
+		bool push(const Record& record)
+		{
+			std::size_t position = m_enqueue.load(std::memory_order_relaxed);
+			while (true) {
+				Cell& cell = m_cells[position & (CAPACITY - 1)];
+				std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+
+				if (diff == 0) {
+					if (m_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+						std::copy_n(record.text, record.length, cell.record.text);
+						cell.record.length = record.length;
+						cell.record.level = record.level;
+						cell.sequence.store(position + 1, std::memory_order_release);
+						m_pushed.fetch_add(1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0) {
+					return false; // Full
+				}
+				else {
+					position = m_enqueue.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// Flusher thread only
+		bool pop(Record& record)
+		{
+			Cell& cell = m_cells[m_dequeue & (CAPACITY - 1)];
+			if (cell.sequence.load(std::memory_order_acquire) != m_dequeue + 1) return false;
+
+			record.level = cell.record.level;
+			record.length = cell.record.length;
+			std::copy_n(cell.record.text, cell.record.length, record.text);
+			cell.sequence.store(m_dequeue + CAPACITY, std::memory_order_release);
+			++m_dequeue;
+			return true;
+		}
+
+		void wake()
+		{
+			m_signal.fetch_add(1, std::memory_order_release);
+			m_signal.notify_one();
+		}
+
+		void run()
+		{
+			Record record;
+			while (true) {
+				std::uint32_t signal = m_signal.load(std::memory_order_acquire);
+
+				std::uint64_t count = 0;
+				bool wroteOut = false, wroteErr = false;
+				while (pop(record)) {
+					bool isError = record.level >= Level::Warn;
+					std::fwrite(record.text, 1, record.length, isError ? m_err : m_out);
+					(isError ? wroteErr : wroteOut) = true;
+					++count;
+				}
+				if (wroteOut) std::fflush(m_out);
+				if (wroteErr) std::fflush(m_err);
+				if (count) m_written.fetch_add(count, std::memory_order_release);
+
+				if (m_stopping.load(std::memory_order_acquire) && m_written.load() == m_pushed.load()) return;
+				if (count == 0) m_signal.wait(signal, std::memory_order_acquire);
+			}
+		}
+
+	private:
+		std::FILE* m_out;
+		std::FILE* m_err;
+		std::atomic<Level> m_level = Level::Trace;
+
+		std::array<Cell, CAPACITY> m_cells;
+		alignas(64) std::atomic<std::size_t> m_enqueue = 0;
+		alignas(64) std::size_t m_dequeue = 0;
+
+		std::atomic<std::uint64_t> m_pushed = 0;
+		std::atomic<std::uint64_t> m_written = 0;
+		std::atomic<std::uint64_t> m_dropped = 0;
+		std::atomic<std::uint32_t> m_signal = 0;
+		std::atomic<bool> m_stopping = false;
+		std::thread m_flusher;
+	};
+}
+
+// Logs the concatenation of the arguments as one line at 'level' (Trace,
+// Debug, Info, Warn or Error). Compiled out entirely below CW_LOG_LEVEL.
+#define CW_LOG(level, ...)                                                                 \
+	do {                                                                                   \
+		if constexpr (::cw::log::enabled(::cw::log::Level::level))                         \
+			::cw::log::Logger::instance().write(::cw::log::Level::level, __VA_ARGS__);     \
+	} while (0)
+
+#define CW_LOG_TRACE(...) CW_LOG(Trace, __VA_ARGS__)
+#define CW_LOG_DEBUG(...) CW_LOG(Debug, __VA_ARGS__)
+#define CW_LOG_INFO(...) CW_LOG(Info, __VA_ARGS__)
+#define CW_LOG_WARN(...) CW_LOG(Warn, __VA_ARGS__)
+#define CW_LOG_ERROR(...) CW_LOG(Error, __VA_ARGS__)
@@ -0,0 +1,453 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cw/trace.h"
+
+namespace cw::metrics {
+
+	using Clock = std::chrono::steady_clock;
+
+	inline std::int64_t nowNanos()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+	}
+
+	// Upper bounds (seconds) of the per-file duration buckets; one more bucket
+	// takes everything slower.
+	inline constexpr std::array<double, 7> FILE_DURATION_BOUNDS = { 0.01, 0.05, 0.25, 1, 5, 30, 120 };
+	inline constexpr std::size_t FILE_DURATION_BUCKETS = FILE_DURATION_BOUNDS.size() + 1;
+
+	// Latency distribution with HDR-histogram style buckets: eight linear
+	// sub-buckets per power of two of nanoseconds, so any recorded value is
+	// known to within 12.5% from 1 ns to about 18 minutes, in a fixed array.
+	struct LatencySnapshot
+	{
+		static constexpr unsigned SUB_BITS = 3;
+		static constexpr std::size_t SUB_BUCKETS = std::size_t(1) << SUB_BITS;
+		static constexpr unsigned MAX_EXPONENT = 40; // Values from 2^40 ns up share the last bucket
+		static constexpr std::size_t BUCKETS = (MAX_EXPONENT - SUB_BITS + 1) * SUB_BUCKETS;
+
+		std::array<std::uint64_t, BUCKETS> counts{};
+		std::uint64_t count = 0;
+		std::uint64_t sumNanos = 0;
+
+		static constexpr std::size_t bucketFor(std::uint64_t nanos)
+		{
+			if (nanos < SUB_BUCKETS) return static_cast<std::size_t>(nanos);
+			unsigned exponent = static_cast<unsigned>(std::bit_width(nanos)) - 1;
+			if (exponent >= MAX_EXPONENT) return BUCKETS - 1;
+			std::size_t sub = static_cast<std::size_t>(nanos >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+			return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+		}
+
+		// Smallest value that lands in 'bucket'
+		static constexpr std::uint64_t lowerBound(std::size_t bucket)
+		{
+			if (bucket < SUB_BUCKETS) return bucket;
+			unsigned exponent = static_cast<unsigned>(bucket / SUB_BUCKETS) + SUB_BITS - 1;
+			return (SUB_BUCKETS + bucket % SUB_BUCKETS) << (exponent - SUB_BITS);
+		}
+
+		// Value at quantile q (0..1): the upper end of the bucket it falls in
+		std::uint64_t quantile(double q) const
+		{
+			if (count == 0) return 0;
+			auto rank = static_cast<std::uint64_t>(q * static_cast<double>(count - 1)) + 1;
+			std::uint64_t seen = 0;
+			for (std::size_t i = 0; i < BUCKETS; ++i) {
+				seen += counts[i];
+				if (seen >= rank) return i + 1 < BUCKETS ? lowerBound(i + 1) - 1 : lowerBound(i);
+			}
+			return lowerBound(BUCKETS - 1);
+		}
+
+		LatencySnapshot& operator+=(const LatencySnapshot& other)
+		{
+			for (std::size_t i = 0; i < BUCKETS; ++i) counts[i] += other.counts[i];
+			count += other.count;
+			sumNanos += other.sumNanos;
+			return *this;
+		}
+
+		// What was recorded after 'before' (an earlier snapshot of the same counters)
+		LatencySnapshot since(const LatencySnapshot& before) const
+		{
+			LatencySnapshot d;
+			for (std::size_t i = 0; i < BUCKETS; ++i) d.counts[i] = counts[i] - before.counts[i];
+			d.count = count - before.count;
+			d.sumNanos = sumNanos - before.sumNanos;
+			return d;
+		}
+	};
+
+	// The recording side: one relaxed atomic add per bucket, count and sum, so
+	// any thread can record and it is cheap enough to leave on.
+	class LatencyHistogram
+	{
+	public:
+		// A histogram of a part (one file) recording into 'total' as well
+		explicit LatencyHistogram(std::shared_ptr<LatencyHistogram> total = nullptr) : m_total(std::move(total)) {}
+
+		void record(Clock::duration elapsed)
+		{
+			auto nanos = static_cast<std::uint64_t>(std::max<std::int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+			m_counts[LatencySnapshot::bucketFor(nanos)].fetch_add(1, std::memory_order_relaxed);
+			m_count.fetch_add(1, std::memory_order_relaxed);
+			m_sumNanos.fetch_add(nanos, std::memory_order_relaxed);
+			if (m_total) m_total->record(elapsed);
+		}
+
+		LatencySnapshot snapshot() const
+		{
+			LatencySnapshot s;
+			for (std::size_t i = 0; i < LatencySnapshot::BUCKETS; ++i) s.counts[i] = m_counts[i].load(std::memory_order_relaxed);
+			s.count = m_count.load(std::memory_order_relaxed);
+			s.sumNanos = m_sumNanos.load(std::memory_order_relaxed);
+			return s;
+		}
+
+	private:
+		std::array<std::atomic<std::uint64_t>, LatencySnapshot::BUCKETS> m_counts{};
+		std::atomic<std::uint64_t> m_count = 0;
+		std::atomic<std::uint64_t> m_sumNanos = 0;
+		std::shared_ptr<LatencyHistogram> m_total;
+	};
+
+	// Plain sum of counters, as read at one instant.
+	struct Snapshot
+	{
+		std::uint64_t bytesSent = 0;
+		std::uint64_t bytesReceived = 0;
+		std::uint64_t framesSent = 0;
+		std::uint64_t framesReceived = 0;
+		std::uint64_t queuedBytes = 0;      // Gauge: accepted by send() but not yet written
+		std::uint64_t congestedNanos = 0;   // Time spent above the high watermark
+		std::uint64_t congestionEvents = 0;
+		std::uint64_t pacedNanos = 0;       // Time writes were held back by rate limits
+		std::uint64_t memoryPauses = 0;     // Reads paused for a memory quota or budget
+		std::uint64_t filesReceived = 0;
+		std::uint64_t fileBytes = 0;
+		std::uint64_t fileNanos = 0;        // Sum over the files in 'fileDurations'
+		std::array<std::uint64_t, FILE_DURATION_BUCKETS> fileDurations{};
+		std::uint64_t connectionsOpen = 0;
+		std::uint64_t connectionsTotal = 0;
+		LatencySnapshot sendLatency;        // Connection::send to socket write completion
+		LatencySnapshot diskLatency;        // Chunk arrival to its write landing on disk
+
+		Snapshot& operator+=(const Snapshot& other)
+		{
+			bytesSent += other.bytesSent;
+			bytesReceived += other.bytesReceived;
+			framesSent += other.framesSent;
+			framesReceived += other.framesReceived;
+			queuedBytes += other.queuedBytes;
+			congestedNanos += other.congestedNanos;
+			congestionEvents += other.congestionEvents;
+			pacedNanos += other.pacedNanos;
+			memoryPauses += other.memoryPauses;
+			filesReceived += other.filesReceived;
+			fileBytes += other.fileBytes;
+			fileNanos += other.fileNanos;
+			for (std::size_t i = 0; i < FILE_DURATION_BUCKETS; ++i) fileDurations[i] += other.fileDurations[i];
+			connectionsOpen += other.connectionsOpen;
+			connectionsTotal += other.connectionsTotal;
+			sendLatency += other.sendLatency;
+			diskLatency += other.diskLatency;
+			return *this;
+		}
+	};
+
+	// Counters of one connection. The traffic counters are written by one
+	// thread at a time (the connection's strand) and read by anyone, so their
+	// updates are relaxed load/store pairs rather than locked read-modify-writes.
+	// The queue gauge, the congestion start and the per-file counters (files
+	// also complete on the disk pool) are shared and updated atomically.
+	class ConnectionMetrics
+	{
+	public:
+		void onBytesSent(std::uint64_t bytes, std::uint64_t frames)
+		{
+			bump(m_bytesSent, bytes);
+			bump(m_framesSent, frames);
+		}
+
+		void onBytesReceived(std::uint64_t bytes) { bump(m_bytesReceived, bytes); }
+		void onFrameReceived() { bump(m_framesReceived, 1); }
+
+		void setQueuedBytes(std::uint64_t bytes) { m_queuedBytes.store(bytes, std::memory_order_relaxed); }
+
+		// The send queue went above its high watermark (any thread; repeats are ignored)
+		void onCongested()
+		{
+			std::int64_t idle = 0;
+			if (m_congestedSince.load(std::memory_order_relaxed) == 0
+				&& m_congestedSince.compare_exchange_strong(idle, nowNanos(), std::memory_order_relaxed)) {
+				CW_TRACE(congestion__enter, this);
+			}
+		}
+
+		// ... and drained back to the low watermark (strand)
+		void onDrained()
+		{
+			if (m_congestedSince.load(std::memory_order_relaxed) == 0) return;
+			std::int64_t since = m_congestedSince.exchange(0, std::memory_order_relaxed);
+			if (since == 0) return;
+			std::int64_t congested = nowNanos() - since;
+			CW_TRACE(congestion__exit, this, congested);
+			bump(m_congestedNanos, static_cast<std::uint64_t>(congested));
+			bump(m_congestionEvents, 1);
+		}
+
+		// A write waited 'delay' for a rate limit (strand)
+		void onPaced(Clock::duration delay)
+		{
+			bump(m_pacedNanos, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count()));
+		}
+
+		// Reads paused because the connection was over its memory quota or budget (strand)
+		void onMemoryPause() { bump(m_memoryPauses, 1); }
+
+		// A received file was written and verified
+		void onFileReceived(std::uint64_t bytes, Clock::duration elapsed)
+		{
+			auto nanos = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+			double seconds = static_cast<double>(nanos) / 1e9;
+
+			std::size_t bucket = 0;
+			while (bucket < FILE_DURATION_BOUNDS.size() && seconds > FILE_DURATION_BOUNDS[bucket]) ++bucket;
+
+			m_filesReceived.fetch_add(1, std::memory_order_relaxed);
+			m_fileBytes.fetch_add(bytes, std::memory_order_relaxed);
+			m_fileNanos.fetch_add(nanos, std::memory_order_relaxed);
+			m_fileDurations[bucket].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// Files that arrived without a duration of their own (a FileBatch)
+		void onFilesReceived(std::uint64_t count, std::uint64_t bytes)
+		{
+			m_filesReceived.fetch_add(count, std::memory_order_relaxed);
+			m_fileBytes.fetch_add(bytes, std::memory_order_relaxed);
+		}
+
+		// Recorded by the connection for each frame written, and by the sinks of
+		// the files it opens for each chunk written (on the disk threads)
+		LatencyHistogram& sendLatency() { return m_sendLatency; }
+		const std::shared_ptr<LatencyHistogram>& diskLatency() const { return m_diskLatency; }
+
+		// Written to the socket so far, without taking a whole snapshot
+		std::uint64_t bytesSent() const { return read(m_bytesSent); }
+
+		Snapshot snapshot() const
+		{
+			Snapshot s;
+			s.bytesSent = read(m_bytesSent);
+			s.bytesReceived = read(m_bytesReceived);
+			s.framesSent = read(m_framesSent);
+			s.framesReceived = read(m_framesReceived);
+			s.queuedBytes = read(m_queuedBytes);
+			s.congestedNanos = read(m_congestedNanos);
+			s.congestionEvents = read(m_congestionEvents);
+			s.pacedNanos = read(m_pacedNanos);
+			s.memoryPauses = read(m_memoryPauses);
+			s.filesReceived = read(m_filesReceived);
+			s.fileBytes = read(m_fileBytes);
+			s.fileNanos = read(m_fileNanos);
+			for (std::size_t i = 0; i < FILE_DURATION_BUCKETS; ++i) s.fileDurations[i] = read(m_fileDurations[i]);
+			s.sendLatency = m_sendLatency.snapshot();
+			s.diskLatency = m_diskLatency->snapshot();
+
+			// A congestion still going on counts up to now
+			if (std::int64_t since = m_congestedSince.load(std::memory_order_relaxed); since != 0)
+				s.congestedNanos += static_cast<std::uint64_t>(std::max<std::int64_t>(0, nowNanos() - since));
+			return s;
+		}
+
+	private:
+		using Counter = std::atomic<std::uint64_t>;
+
+		static void bump(Counter& counter, std::uint64_t n)
+		{
+			counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		static std::uint64_t read(const Counter& counter) { return counter.load(std::memory_order_relaxed); }
+
+		Counter m_bytesSent = 0;
+		Counter m_bytesReceived = 0;
+		Counter m_framesSent = 0;
+		Counter m_framesReceived = 0;
+		Counter m_queuedBytes = 0;
+		Counter m_congestedNanos = 0;
+		Counter m_congestionEvents = 0;
+		Counter m_pacedNanos = 0;
+		Counter m_memoryPauses = 0;
+		Counter m_filesReceived = 0;
+		Counter m_fileBytes = 0;
+		Counter m_fileNanos = 0;
+		std::array<Counter, FILE_DURATION_BUCKETS> m_fileDurations{};
+		std::atomic<std::int64_t> m_congestedSince = 0;
+		LatencyHistogram m_sendLatency;
+		std::shared_ptr<LatencyHistogram> m_diskLatency = std::make_shared<LatencyHistogram>(); // Sinks may outlive the connection
+	};
+
+	// Aggregates the counters of every connection a server accepted. Closed
+	// connections are folded into a running total the next time a snapshot is
+	// taken, so counters never go backwards. Shared by all shards of a process.
+	class MetricsRegistry
+	{
+	public:
+		static std::shared_ptr<MetricsRegistry> defaultInstance()
+		{
+			static std::shared_ptr<MetricsRegistry> instance = std::make_shared<MetricsRegistry>();
+			return instance;
+		}
+
+		void track(std::shared_ptr<ConnectionMetrics> connection)
+		{
+			std::lock_guard lock(m_mutex);
+			m_live.push_back(std::move(connection));
+			++m_retired.connectionsTotal;
+		}
+
+		Snapshot snapshot()
+		{
+			std::lock_guard lock(m_mutex);
+
+			Snapshot total;
+			for (std::size_t i = 0; i < m_live.size();) {
+				Snapshot s = m_live[i]->snapshot();
+				if (m_live[i].use_count() == 1) {
+					// The connection is gone: nothing queued any more
+					s.queuedBytes = 0;
+					m_retired += s;
+					m_live[i] = std::move(m_live.back());
+					m_live.pop_back();
+					continue;
+				}
+				total += s;
+				++total.connectionsOpen;
+				++i;
+			}
+			total += m_retired;
+			return total;
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::vector<std::shared_ptr<ConnectionMetrics>> m_live;
+		Snapshot m_retired; // Closed connections, and the connection count
+	};
+
+	// Prometheus text exposition format (version 0.0.4)
+	inline std::string toPrometheus(const Snapshot& s)
+	{
+		std::string out;
+		char line[512];
+
+		auto metric = [&](const char* name, const char* type, const char* help, std::uint64_t value)
+			{
+				std::snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+					name, help, name, type, name, static_cast<unsigned long long>(value));
+				out += line;
+			};
+
+		metric("cw_sent_bytes_total", "counter", "Bytes written to sockets.", s.bytesSent);
+		metric("cw_received_bytes_total", "counter", "Bytes read from sockets.", s.bytesReceived);
+		metric("cw_sent_frames_total", "counter", "Frames written to sockets.", s.framesSent);
+		metric("cw_received_frames_total", "counter", "Frames received and dispatched.", s.framesReceived);
+		metric("cw_queued_bytes", "gauge", "Bytes accepted for sending but not yet written.", s.queuedBytes);
+		metric("cw_congestion_events_total", "counter", "Times a send queue went above its high watermark.", s.congestionEvents);
+		metric("cw_memory_pauses_total", "counter", "Times reads paused for a memory quota or budget.", s.memoryPauses);
+		metric("cw_connections_open", "gauge", "Connections currently open.", s.connectionsOpen);
+		metric("cw_connections_total", "counter", "Connections accepted.", s.connectionsTotal);
+		metric("cw_received_files_total", "counter", "Files received and verified.", s.filesReceived);
+		metric("cw_received_file_bytes_total", "counter", "Bytes of the files received and verified.", s.fileBytes);
+
+		std::snprintf(line, sizeof(line), "# HELP cw_congested_seconds_total Time send queues spent above their high watermark.\n"
+			"# TYPE cw_congested_seconds_total counter\ncw_congested_seconds_total %.6f\n", static_cast<double>(s.congestedNanos) / 1e9);
+		out += line;
+
+		std::snprintf(line, sizeof(line), "# HELP cw_paced_seconds_total Time writes were held back by rate limits.\n"
+			"# TYPE cw_paced_seconds_total counter\ncw_paced_seconds_total %.6f\n", static_cast<double>(s.pacedNanos) / 1e9);
+		out += line;
+
+		out += "# HELP cw_file_duration_seconds Time from FileInfo to the verified last write, per streamed file.\n";
+		out += "# TYPE cw_file_duration_seconds histogram\n";
+		std::uint64_t cumulative = 0;
+		for (std::size_t i = 0; i < FILE_DURATION_BUCKETS; ++i) {
+			cumulative += s.fileDurations[i];
+			if (i < FILE_DURATION_BOUNDS.size())
+				std::snprintf(line, sizeof(line), "cw_file_duration_seconds_bucket{le=\"%g\"} %llu\n", FILE_DURATION_BOUNDS[i], static_cast<unsigned long long>(cumulative));
+			else
+				std::snprintf(line, sizeof(line), "cw_file_duration_seconds_bucket{le=\"+Inf\"} %llu\n", static_cast<unsigned long long>(cumulative));
+			out += line;
+		}
+		std::snprintf(line, sizeof(line), "cw_file_duration_seconds_sum %.6f\ncw_file_duration_seconds_count %llu\n",
+			static_cast<double>(s.fileNanos) / 1e9, static_cast<unsigned long long>(cumulative));
+		out += line;
+
+		auto latency = [&](const char* name, const char* help, const LatencySnapshot& h)
+			{
+				std::snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s summary\n", name, help, name);
+				out += line;
+				for (double q : { 0.5, 0.9, 0.99, 0.999 }) {
+					std::snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %.9f\n", name, q, static_cast<double>(h.quantile(q)) / 1e9);
+					out += line;
+				}
+				std::snprintf(line, sizeof(line), "%s_sum %.9f\n%s_count %llu\n", name, static_cast<double>(h.sumNanos) / 1e9,
+					name, static_cast<unsigned long long>(h.count));
+				out += line;
+			};
+		latency("cw_send_latency_seconds", "Time from Connection::send to the socket write completing, since start.", s.sendLatency);
+		latency("cw_disk_latency_seconds", "Time from a chunk arriving to its write landing on disk, since start.", s.diskLatency);
+		return out;
+	}
+
+	// One-line summary of the interval between two snapshots, for the periodic dump
+	inline std::string summarize(const Snapshot& now, const Snapshot& before, Clock::duration interval)
+	{
+		double seconds = std::max(1e-9, std::chrono::duration<double>(interval).count());
+		auto rate = [seconds](std::uint64_t a, std::uint64_t b) { return static_cast<double>(a - b) / seconds; };
+
+		std::uint64_t files = 0, fileNanos = now.fileNanos - before.fileNanos;
+		for (std::size_t i = 0; i < FILE_DURATION_BUCKETS; ++i) files += now.fileDurations[i] - before.fileDurations[i];
+
+		char line[256];
+		std::snprintf(line, sizeof(line),
+			"in %.2f MB/s (%.0f frames/s), out %.2f MB/s (%.0f frames/s), queued %llu bytes, congested %.0f ms, "
+			"%llu files (avg %.1f ms), %llu connections",
+			rate(now.bytesReceived, before.bytesReceived) / 1e6, rate(now.framesReceived, before.framesReceived),
+			rate(now.bytesSent, before.bytesSent) / 1e6, rate(now.framesSent, before.framesSent),
+			static_cast<unsigned long long>(now.queuedBytes),
+			static_cast<double>(now.congestedNanos - before.congestedNanos) / 1e6,
+			static_cast<unsigned long long>(now.filesReceived - before.filesReceived),
+			files ? static_cast<double>(fileNanos) / 1e6 / static_cast<double>(files) : 0.0,
+			static_cast<unsigned long long>(now.connectionsOpen));
+		return line;
+	}
+
+	// Latency quantiles over the interval between two snapshots: the network
+	// side (send) against the disk side (receive-to-disk)
+	inline std::string summarizeLatency(const Snapshot& now, const Snapshot& before)
+	{
+		LatencySnapshot send = now.sendLatency.since(before.sendLatency);
+		LatencySnapshot disk = now.diskLatency.since(before.diskLatency);
+		auto ms = [](std::uint64_t nanos) { return static_cast<double>(nanos) / 1e6; };
+
+		char line[256];
+		std::snprintf(line, sizeof(line), "send p50 %.3f ms, p99 %.3f ms, max %.3f ms; disk p50 %.3f ms, p99 %.3f ms, max %.3f ms",
+			ms(send.quantile(0.5)), ms(send.quantile(0.99)), ms(send.quantile(1)),
+			ms(disk.quantile(0.5)), ms(disk.quantile(0.99)), ms(disk.quantile(1)));
+		return line;
+	}
+}
@@ -0,0 +1,260 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "cw/metrics/metrics.h"
+
+namespace cw::metrics {
+
+	// Plain copy of a TransferProgress, as read at one instant.
+	struct ProgressSnapshot
+	{
+		std::uint64_t filesPlanned = 0;  // Found so far (all of them once planComplete)
+		std::uint64_t bytesPlanned = 0;
+		bool planComplete = false;
+		std::uint64_t bytesSent = 0;     // File bytes handed to the connections (or skipped: resumed, copied, deduplicated)
+		std::uint64_t filesSent = 0;
+		std::uint64_t bytesAcked = 0;    // File bytes the receiver has acked as written
+		std::uint64_t filesAcked = 0;    // Files the receiver has acked as complete
+		Clock::duration elapsed{};
+	};
+
+	// Progress of one upload (a file or a tree, over any number of
+	// connections). Written at chunk granularity by the upload and by the
+	// connections as acks arrive, read by whoever shows it: every counter is a
+	// relaxed atomic, no update takes a lock or prints. Pass it in
+	// TransferOptions::progress; sample it with a ProgressMeter.
+	class TransferProgress
+	{
+	public:
+		TransferProgress() : m_started(Clock::now()) {}
+
+		// More work found: a directory listed, the file to send
+		void plan(std::uint64_t files, std::uint64_t bytes)
+		{
+			m_filesPlanned.fetch_add(files, std::memory_order_relaxed);
+			m_bytesPlanned.fetch_add(bytes, std::memory_order_relaxed);
+		}
+
+		// Nothing more will be planned: from here on there is an ETA
+		void planComplete()
+		{
+			m_planComplete.store(true);
+			checkComplete();
+		}
+
+		void onSent(std::uint64_t bytes) { m_bytesSent.fetch_add(bytes, std::memory_order_relaxed); }
+		void onFilesSent(std::uint64_t files) { m_filesSent.fetch_add(files, std::memory_order_relaxed); }
+		void onAcked(std::uint64_t bytes) { m_bytesAcked.fetch_add(bytes, std::memory_order_relaxed); }
+
+		void onFilesAcked(std::uint64_t files)
+		{
+			m_filesAcked.fetch_add(files);
+			checkComplete();
+		}
+
+		// Every planned file has been acked: the receiver has all of them
+		bool complete() const { return m_planComplete.load() && m_filesAcked.load() >= m_filesPlanned.load(std::memory_order_relaxed); }
+
+		// Runs 'fn' once complete(), on the thread whose ack (or planComplete)
+		// completed the upload, or right away if it already is. One waiter at a
+		// time; until one is set, the ack path only reads a flag.
+		void onComplete(std::function<void()> fn)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_completeMutex);
+				m_onComplete = std::move(fn);
+				m_hasCompleteWaiter.store(true);
+			}
+			checkComplete();
+		}
+
+		// Bytes the receiver had before anything was sent (a resume, a
+		// server-side copy, chunks found in its dedup store)
+		void onSkipped(std::uint64_t bytes)
+		{
+			onSent(bytes);
+			onAcked(bytes);
+		}
+
+		ProgressSnapshot snapshot() const
+		{
+			ProgressSnapshot s;
+			s.filesPlanned = m_filesPlanned.load(std::memory_order_relaxed);
+			s.bytesPlanned = m_bytesPlanned.load(std::memory_order_relaxed);
+			s.planComplete = m_planComplete.load(std::memory_order_relaxed);
+			s.bytesSent = m_bytesSent.load(std::memory_order_relaxed);
+			s.filesSent = m_filesSent.load(std::memory_order_relaxed);
+			s.bytesAcked = m_bytesAcked.load(std::memory_order_relaxed);
+			s.filesAcked = m_filesAcked.load(std::memory_order_relaxed);
+			s.elapsed = Clock::now() - m_started;
+			return s;
+		}
+
+	private:
+		std::atomic<std::uint64_t> m_filesPlanned = 0;
+		std::atomic<std::uint64_t> m_bytesPlanned = 0;
+		std::atomic<bool> m_planComplete = false;
+		std::atomic<std::uint64_t> m_bytesSent = 0;
+		std::atomic<std::uint64_t> m_filesSent = 0;
+		std::atomic<std::uint64_t> m_bytesAcked = 0;
+		std::atomic<std::uint64_t> m_filesAcked = 0;
+		Clock::time_point m_started;
+
+		// Sequentially consistent with the counters complete() reads, so a
+		// waiter set as the last ack lands is run by one side or the other
+		void checkComplete()
+		{
+			if (!m_hasCompleteWaiter.load() || !complete()) return;
+			std::function<void()> fn;
+			{
+				std::lock_guard<std::mutex> lock(m_completeMutex);
+				fn = std::exchange(m_onComplete, nullptr);
+				m_hasCompleteWaiter.store(false);
+			}
+			if (fn) fn();
+		}
+
+		std::atomic<bool> m_hasCompleteWaiter = false;
+		std::mutex m_completeMutex;
+		std::function<void()> m_onComplete;
+	};
+
+	// The acks of one outgoing file, credited to its TransferProgress as they
+	// arrive (see Connection::reportProgress). A striped file registers one
+	// on each of its connections; whichever stripe is acked to the end
+	// credits the file, once.
+	class StreamProgress
+	{
+	public:
+		// 'acked' is what the receiver already had when the stream began (a resume offset)
+		StreamProgress(std::shared_ptr<TransferProgress> progress, std::uint64_t size, std::uint64_t files = 1, std::uint64_t acked = 0)
+			: m_progress(std::move(progress)), m_size(size), m_files(files), m_acked(acked)
+		{
+		}
+
+		// For a stream whose size (or file count) was only known at its end
+		void setSize(std::uint64_t size, std::uint64_t files = 1)
+		{
+			m_files.store(files, std::memory_order_relaxed);
+			m_size.store(size, std::memory_order_release);
+		}
+
+		// The receiver has 'offset' bytes; true once the stream is complete
+		bool onAck(std::uint64_t offset)
+		{
+			std::uint64_t acked = m_acked.load(std::memory_order_relaxed);
+			while (offset > acked && !m_acked.compare_exchange_weak(acked, offset, std::memory_order_relaxed)) {}
+			if (offset > acked) m_progress->onAcked(offset - acked);
+
+			if (offset < m_size.load(std::memory_order_acquire)) return false;
+			if (!m_done.exchange(true, std::memory_order_relaxed)) m_progress->onFilesAcked(m_files.load(std::memory_order_relaxed));
+			return true;
+		}
+
+		// The receiver has 'offset' bytes without their being sent again (an
+		// upload resumed on a new connection): what is new counts as skipped
+		void skipTo(std::uint64_t offset)
+		{
+			std::uint64_t acked = m_acked.load(std::memory_order_relaxed);
+			if (offset > acked) m_progress->onSent(offset - acked);
+			onAck(offset);
+		}
+
+		bool done() const { return m_done.load(std::memory_order_relaxed); }
+
+	private:
+		std::shared_ptr<TransferProgress> m_progress;
+		std::atomic<std::uint64_t> m_size;
+		std::atomic<std::uint64_t> m_files;
+		std::atomic<std::uint64_t> m_acked;
+		std::atomic<bool> m_done = false;
+	};
+
+	// What a progress display shows: the counters, the current rate and the
+	// time left at that rate.
+	struct ProgressReport
+	{
+		ProgressSnapshot totals;
+		double bytesPerSecond = 0;        // Acked, smoothed over the last samples
+		std::optional<Clock::duration> eta; // Once the plan is complete and there is a rate
+	};
+
+	// The reading side, for one thread (a UI, a status timer): each sample()
+	// reads the counters once and updates a rate smoothed over the last few
+	// samples. Rates follow acked bytes, which the receiver's disk sets, not
+	// what the send queues happen to take in.
+	class ProgressMeter
+	{
+	public:
+		// Weight of the newest sample in the smoothed rate
+		static constexpr double SMOOTHING = 0.3;
+
+		explicit ProgressMeter(std::shared_ptr<const TransferProgress> progress) : m_progress(std::move(progress)) {}
+
+		ProgressReport sample()
+		{
+			ProgressReport report;
+			report.totals = m_progress->snapshot();
+
+			if (m_last) {
+				double seconds = std::chrono::duration<double>(report.totals.elapsed - m_last->elapsed).count();
+				if (seconds > 0) {
+					double rate = static_cast<double>(report.totals.bytesAcked - m_last->bytesAcked) / seconds;
+					m_rate = m_rated ? SMOOTHING * rate + (1 - SMOOTHING) * m_rate : rate;
+					m_rated = true;
+				}
+			}
+			m_last = report.totals;
+			report.bytesPerSecond = m_rate;
+
+			if (report.totals.planComplete && m_rate > 0) {
+				std::uint64_t left = report.totals.bytesPlanned - std::min(report.totals.bytesPlanned, report.totals.bytesAcked);
+				report.eta = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(static_cast<double>(left) / m_rate));
+			}
+			return report;
+		}
+
+	private:
+		std::shared_ptr<const TransferProgress> m_progress;
+		std::optional<ProgressSnapshot> m_last;
+		double m_rate = 0;
+		bool m_rated = false;
+	};
+
+	// One line for a terminal: "412.0 of 1024.0 MB (40%), 37 of 120 files, 98.3 MB/s, ETA 0:06"
+	inline std::string formatProgress(const ProgressReport& report)
+	{
+		const ProgressSnapshot& t = report.totals;
+		double mb = 1e6;
+		char line[192];
+		int length = 0;
+		if (t.bytesPlanned > 0) {
+			length = std::snprintf(line, sizeof(line), "%.1f of %.1f%s MB (%.0f%%), %llu of %llu%s files, %.1f MB/s",
+				static_cast<double>(t.bytesAcked) / mb, static_cast<double>(t.bytesPlanned) / mb, t.planComplete ? "" : "+",
+				100.0 * static_cast<double>(std::min(t.bytesAcked, t.bytesPlanned)) / static_cast<double>(t.bytesPlanned),
+				static_cast<unsigned long long>(t.filesAcked), static_cast<unsigned long long>(t.filesPlanned), t.planComplete ? "" : "+",
+				report.bytesPerSecond / mb);
+		}
+		else {
+			length = std::snprintf(line, sizeof(line), "%.1f MB, %llu files, %.1f MB/s", static_cast<double>(t.bytesAcked) / mb,
+				static_cast<unsigned long long>(t.filesAcked), report.bytesPerSecond / mb);
+		}
+
+		if (report.eta && length > 0 && static_cast<std::size_t>(length) < sizeof(line)) {
+			auto seconds = std::chrono::duration_cast<std::chrono::seconds>(*report.eta).count();
+			std::snprintf(line + length, sizeof(line) - static_cast<std::size_t>(length), ", ETA %lld:%02lld",
+				static_cast<long long>(seconds / 60), static_cast<long long>(seconds % 60));
+		}
+		return line;
+	}
+}
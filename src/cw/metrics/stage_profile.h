@@ -0,0 +1,246 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define CW_STAGE_TSC 1
+#endif
+
+#include "cw/metrics/metrics.h"
+
+namespace cw::metrics {
+
+	// Where a transfer's CPU time goes, stage by stage
+	enum class Stage : std::uint8_t
+	{
+		Scan,        // Listing directories
+		Read,        // Reading chunks from files
+		Hash,        // Chunk CRCs, sent and checked, and chunk seals
+		Compress,    // Compressing chunks and batches
+		Serialize,   // Building frames
+		SocketWrite, // Issuing socket writes
+		Parse,       // Parsing and handling received frames
+		DiskWrite,   // Writing received data
+		Fsync,       // Flushing files to stable storage
+	};
+	inline constexpr std::size_t STAGES = 9;
+	inline constexpr std::array<const char*, STAGES> STAGE_NAMES = { "scan", "read", "hash", "compress", "serialize", "socket write", "parse", "disk write", "fsync" };
+
+	// Opt-in per-stage CPU accounting of a session: call sites bracket the
+	// work of a stage with a StageTimer, and at the end the time per stage
+	// is rolled up across threads into a breakdown, which tells an operator
+	// which optimization is worth enabling on a host (compression starving
+	// the socket, CRCs next to the reads, fsync dominating the disk).
+	// Sampled: one call in sampleEvery per thread and stage is timed, with
+	// the time stamp counter where there is one, and the stage's total is
+	// the sampled time scaled by its calls. A timer started inside another
+	// is always timed, and its time is taken out of the outer one's, so
+	// nested stages are not counted twice. Counters are the recording
+	// thread's own (relaxed atomics nobody else writes). Off by default:
+	// then a call site costs one relaxed load.
+	class StageProfile
+	{
+	public:
+		static constexpr unsigned DEFAULT_SAMPLE_EVERY = 8;
+
+		struct StageTime
+		{
+			const char* name = nullptr;
+			std::uint64_t calls = 0;
+			std::uint64_t sampled = 0;
+			double seconds = 0; // Estimated, from the sampled calls
+			double share = 0;   // Of the time of every stage
+		};
+
+		struct Breakdown
+		{
+			std::array<StageTime, STAGES> stages{};
+			double seconds = 0;     // Of every stage
+			double wallSeconds = 0; // Since start()
+
+			const StageTime& operator[](Stage stage) const { return stages[static_cast<std::size_t>(stage)]; }
+
+			// A total line, then one per stage that ran, the busiest first
+			std::string format() const
+			{
+				std::array<const StageTime*, STAGES> order;
+				for (std::size_t i = 0; i < STAGES; ++i) order[i] = &stages[i];
+				std::stable_sort(order.begin(), order.end(), [](const StageTime* a, const StageTime* b) { return a->seconds > b->seconds; });
+
+				char line[160];
+				std::snprintf(line, sizeof(line), "CPU by stage: %.3f s over %.3f s of wall time", seconds, wallSeconds);
+				std::string out = line;
+				for (const StageTime* stage : order) {
+					if (stage->calls == 0) continue;
+					std::snprintf(line, sizeof(line), "\n  %-12s %5.1f%% %10.3f ms %12llu calls", stage->name, stage->share * 100, stage->seconds * 1000,
+						static_cast<unsigned long long>(stage->calls));
+					out += line;
+				}
+				return out;
+			}
+		};
+
+		static StageProfile& instance()
+		{
+			static StageProfile profile;
+			return profile;
+		}
+
+		// Starts a session, zeroing the counts of an earlier one
+		void start(unsigned sampleEvery = DEFAULT_SAMPLE_EVERY)
+		{
+			std::lock_guard lock(m_threadsMutex);
+			for (auto& thread : m_threads) {
+				for (auto& counters : thread->stages) {
+					counters.calls.store(0, std::memory_order_relaxed);
+					counters.sampled.store(0, std::memory_order_relaxed);
+					counters.ticks.store(0, std::memory_order_relaxed);
+				}
+			}
+			m_sampleEvery = std::max(1u, sampleEvery);
+			m_startTicks = ticks();
+			m_startedAt = Clock::now();
+			m_enabled.store(true, std::memory_order_release);
+		}
+
+		void stop() { m_enabled.store(false, std::memory_order_release); }
+		bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+		unsigned sampleEvery() const { return m_sampleEvery; }
+
+		// The counts so far, across every thread that recorded any
+		Breakdown breakdown() const
+		{
+			Breakdown breakdown;
+			std::array<double, STAGES> ticksPerStage{};
+			{
+				std::lock_guard lock(m_threadsMutex);
+				for (auto& thread : m_threads) {
+					for (std::size_t i = 0; i < STAGES; ++i) {
+						const Counters& counters = thread->stages[i];
+						std::uint64_t calls = counters.calls.load(std::memory_order_relaxed);
+						std::uint64_t sampled = counters.sampled.load(std::memory_order_relaxed);
+						breakdown.stages[i].calls += calls;
+						breakdown.stages[i].sampled += sampled;
+						if (sampled != 0) ticksPerStage[i] += static_cast<double>(counters.ticks.load(std::memory_order_relaxed)) * static_cast<double>(calls) / static_cast<double>(sampled);
+					}
+				}
+			}
+
+			breakdown.wallSeconds = std::chrono::duration<double>(Clock::now() - m_startedAt).count();
+			double elapsedTicks = static_cast<double>(ticks() - m_startTicks);
+			double secondsPerTick = elapsedTicks > 0 ? breakdown.wallSeconds / elapsedTicks : 0;
+			for (std::size_t i = 0; i < STAGES; ++i) {
+				breakdown.stages[i].name = STAGE_NAMES[i];
+				breakdown.stages[i].seconds = ticksPerStage[i] * secondsPerTick;
+				breakdown.seconds += breakdown.stages[i].seconds;
+			}
+			for (auto& stage : breakdown.stages) stage.share = breakdown.seconds > 0 ? stage.seconds / breakdown.seconds : 0;
+			return breakdown;
+		}
+
+		// The time stamp counter, else the steady clock's nanoseconds
+		static std::uint64_t ticks() noexcept
+		{
+#if defined(CW_STAGE_TSC)
+			return __rdtsc();
+#else
+			return static_cast<std::uint64_t>(nowNanos());
+#endif
+		}
+
+	private:
+		friend class StageTimer;
+
+		struct Counters
+		{
+			std::atomic<std::uint64_t> calls = 0;
+			std::atomic<std::uint64_t> sampled = 0;
+			std::atomic<std::uint64_t> ticks = 0;
+		};
+
+		struct ThreadCounters
+		{
+			std::array<Counters, STAGES> stages;
+		};
+
+		StageProfile() = default;
+
+		// The calling thread's counters, registered on first use. They outlive
+		// their threads, so a session counts pool threads gone since.
+		ThreadCounters& local()
+		{
+			thread_local std::shared_ptr<ThreadCounters> counters;
+			if (!counters) {
+				counters = std::make_shared<ThreadCounters>();
+				std::lock_guard lock(m_threadsMutex);
+				m_threads.push_back(counters);
+			}
+			return *counters;
+		}
+
+		std::atomic<bool> m_enabled = false;
+		unsigned m_sampleEvery = DEFAULT_SAMPLE_EVERY;
+		std::uint64_t m_startTicks = 0;
+		Clock::time_point m_startedAt;
+		mutable std::mutex m_threadsMutex;
+		std::vector<std::shared_ptr<ThreadCounters>> m_threads;
+	};
+
+	// Counts the work from construction to destruction to 'stage', if the
+	// profile was enabled when it began
+	class StageTimer
+	{
+	public:
+		explicit StageTimer(Stage stage)
+		{
+			auto& profile = StageProfile::instance();
+			if (!profile.enabled()) return;
+
+			m_counters = &profile.local().stages[static_cast<std::size_t>(stage)];
+			std::uint64_t call = m_counters->calls.load(std::memory_order_relaxed);
+			m_counters->calls.store(call + 1, std::memory_order_relaxed);
+			if (call % profile.m_sampleEvery != 0 && !t_active) return;
+
+			m_outer = t_active;
+			t_active = this;
+			m_begin = StageProfile::ticks();
+		}
+
+		~StageTimer()
+		{
+			if (m_begin == 0) return;
+			std::uint64_t elapsed = StageProfile::ticks() - m_begin;
+			t_active = m_outer;
+			if (m_outer) m_outer->m_nested += elapsed;
+
+			std::uint64_t own = elapsed > m_nested ? elapsed - m_nested : 0;
+			m_counters->sampled.store(m_counters->sampled.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			m_counters->ticks.store(m_counters->ticks.load(std::memory_order_relaxed) + own, std::memory_order_relaxed);
+		}
+
+		StageTimer(const StageTimer&) = delete;
+		StageTimer& operator=(const StageTimer&) = delete;
+
+	private:
+		// The innermost timer running on this thread
+		static inline thread_local StageTimer* t_active = nullptr;
+
+		StageProfile::Counters* m_counters = nullptr;
+		StageTimer* m_outer = nullptr;
+		std::uint64_t m_begin = 0;
+		std::uint64_t m_nested = 0;
+	};
+}
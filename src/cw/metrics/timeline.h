@@ -0,0 +1,244 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "cw/metrics/metrics.h"
+
+namespace cw::metrics {
+
+	// Opt-in timeline of one transfer session, for deep dives into where the
+	// client -> wire -> disk pipeline stalls: every chunk read, socket write,
+	// frame handled on receipt and disk write is recorded as a span, and at
+	// the end the lot is written as a Chrome trace (the JSON trace event
+	// format), which ui.perfetto.dev and chrome://tracing open. The gaps
+	// between spans are the pipeline's bubbles.
+	// Events go to a buffer of the thread that records them (one uncontended
+	// lock per event), bounded per thread; past the bound they are counted as
+	// dropped. Off by default: then a call site costs one relaxed load.
+	// Timestamps are the steady clock's (boot time on Linux), so the traces
+	// of a client and a server on one host line up when loaded together.
+	class Timeline
+	{
+	public:
+		static constexpr std::size_t DEFAULT_EVENTS_PER_THREAD = 1 << 20;
+
+		struct Event
+		{
+			const char* name;     // String literals only: events keep the pointer
+			const char* category;
+			std::int64_t begin;   // Nanoseconds of the steady clock
+			std::int64_t duration;
+			std::uint64_t bytes;
+			std::uint64_t offset;
+		};
+
+		static Timeline& instance()
+		{
+			static Timeline timeline;
+			return timeline;
+		}
+
+		// Starts a session, dropping the events of an earlier one
+		void start(std::size_t maxEventsPerThread = DEFAULT_EVENTS_PER_THREAD)
+		{
+			std::lock_guard<std::mutex> lock(m_threadsMutex);
+			for (auto& thread : m_threads) {
+				std::lock_guard<std::mutex> threadLock(thread->mutex);
+				thread->events.clear();
+				thread->dropped = 0;
+			}
+			m_maxEvents = maxEventsPerThread;
+			m_enabled.store(true, std::memory_order_release);
+		}
+
+		void stop() { m_enabled.store(false, std::memory_order_release); }
+		bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+		// Names the calling thread in the trace ("io", "disk"); else "thread N"
+		void nameThisThread(std::string name)
+		{
+			auto& thread = local();
+			std::lock_guard<std::mutex> lock(thread.mutex);
+			thread.name = std::move(name);
+		}
+
+		// [begin, end) on the calling thread. Ignored unless enabled().
+		void span(const char* name, const char* category, Clock::time_point begin, Clock::time_point end,
+			std::uint64_t bytes = 0, std::uint64_t offset = 0)
+		{
+			if (!enabled()) return;
+			record({ name, category, nanosOf(begin), nanosOf(end) - nanosOf(begin), bytes, offset });
+		}
+
+		std::size_t eventCount() const
+		{
+			std::lock_guard<std::mutex> lock(m_threadsMutex);
+			std::size_t count = 0;
+			for (auto& thread : m_threads) {
+				std::lock_guard<std::mutex> threadLock(thread->mutex);
+				count += thread->events.size();
+			}
+			return count;
+		}
+
+		// Every recorded event, as a JSON trace object: complete ("X") events
+		// with bytes and offset as args, thread names as metadata events, and
+		// the dropped count under otherData
+		std::string toJson() const
+		{
+			std::string out = "{\"traceEvents\":[\n";
+			std::uint64_t dropped = 0;
+			bool first = true;
+			auto separator = [&]()
+				{
+					if (!first) out += ",\n";
+					first = false;
+				};
+			char line[384];
+
+			std::lock_guard<std::mutex> lock(m_threadsMutex);
+			for (auto& thread : m_threads) {
+				std::lock_guard<std::mutex> threadLock(thread->mutex);
+				dropped += thread->dropped;
+
+				separator();
+				std::snprintf(line, sizeof(line), R"({"name":"thread_name","ph":"M","pid":%llu,"tid":%u,"args":{"name":")",
+					static_cast<unsigned long long>(processId()), thread->id);
+				out += line;
+				appendEscaped(out, thread->name.empty() ? "thread " + std::to_string(thread->id) : thread->name);
+				out += "\"}}";
+
+				for (const Event& event : thread->events) {
+					separator();
+					std::snprintf(line, sizeof(line),
+						R"({"name":"%s","cat":"%s","ph":"X","ts":%.3f,"dur":%.3f,"pid":%llu,"tid":%u,"args":{"bytes":%llu,"offset":%llu}})",
+						event.name, event.category, event.begin / 1000.0, event.duration / 1000.0,
+						static_cast<unsigned long long>(processId()), thread->id,
+						static_cast<unsigned long long>(event.bytes), static_cast<unsigned long long>(event.offset));
+					out += line;
+				}
+			}
+
+			out += "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":" + std::to_string(dropped) + "}}\n";
+			return out;
+		}
+
+		bool writeJson(const std::filesystem::path& path) const
+		{
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			out << toJson();
+			return static_cast<bool>(out);
+		}
+
+	private:
+		struct ThreadBuffer
+		{
+			std::mutex mutex;
+			std::vector<Event> events;
+			std::uint64_t dropped = 0;
+			std::uint32_t id = 0;
+			std::string name;
+		};
+
+		Timeline() = default;
+
+		static std::int64_t nanosOf(Clock::time_point at)
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(at.time_since_epoch()).count();
+		}
+
+		static std::uint64_t processId()
+		{
+#if defined(_WIN32)
+			return ::GetCurrentProcessId();
+#else
+			return static_cast<std::uint64_t>(::getpid());
+#endif
+		}
+
+		static void appendEscaped(std::string& out, const std::string& text)
+		{
+			for (char c : text) {
+				if (c == '"' || c == '\\') out += '\\';
+				if (static_cast<unsigned char>(c) >= 0x20) out += c;
+			}
+		}
+
+		void record(const Event& event)
+		{
+			auto& thread = local();
+			std::lock_guard<std::mutex> lock(thread.mutex);
+			if (thread.events.size() >= m_maxEvents) {
+				++thread.dropped;
+				return;
+			}
+			thread.events.push_back(event);
+		}
+
+		// The calling thread's buffer, registered on first use. Buffers outlive
+		// their threads, so a session sees the events of pool threads gone since.
+		ThreadBuffer& local()
+		{
+			thread_local std::shared_ptr<ThreadBuffer> buffer;
+			if (!buffer) {
+				buffer = std::make_shared<ThreadBuffer>();
+				std::lock_guard<std::mutex> lock(m_threadsMutex);
+				buffer->id = static_cast<std::uint32_t>(m_threads.size() + 1);
+				m_threads.push_back(buffer);
+			}
+			return *buffer;
+		}
+
+		std::atomic<bool> m_enabled = false;
+		std::size_t m_maxEvents = DEFAULT_EVENTS_PER_THREAD;
+		mutable std::mutex m_threadsMutex;
+		std::vector<std::shared_ptr<ThreadBuffer>> m_threads;
+	};
+
+	// A span from construction to destruction, recorded if the timeline was
+	// enabled when it began: the idiom for a call site that brackets work.
+	class TimelineSpan
+	{
+	public:
+		TimelineSpan(const char* name, const char* category, std::uint64_t bytes = 0, std::uint64_t offset = 0)
+			: m_name(name),
+			m_category(category),
+			m_bytes(bytes),
+			m_offset(offset)
+		{
+			if (Timeline::instance().enabled()) m_begin = Clock::now();
+		}
+
+		~TimelineSpan()
+		{
+			if (m_begin != Clock::time_point{}) Timeline::instance().span(m_name, m_category, m_begin, Clock::now(), m_bytes, m_offset);
+		}
+
+		TimelineSpan(const TimelineSpan&) = delete;
+		TimelineSpan& operator=(const TimelineSpan&) = delete;
+
+		// Known only once the work is done (a read's length)
+		void setBytes(std::uint64_t bytes) { m_bytes = bytes; }
+
+	private:
+		const char* m_name;
+		const char* m_category;
+		std::uint64_t m_bytes;
+		std::uint64_t m_offset;
+		Clock::time_point m_begin;
+	};
+}
@@ -1,14 +1,32 @@
 #pragma once
 #include <asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <functional>
-#include <iostream>
+#include <random>
 #include <string>
 #include "Connection.h"
+#include "cw/network/resolver.h"
+#include "cw/network/socket_options.h"
+#include "cw/network/tls.h"
+#include "cw/file/file.h"
+#include "cw/log/logger.h"
 
 namespace cw::network {
 
 	using asio::ip::tcp;
 
+	// How a client replaces a lost connection (see Client::SetReconnect):
+	// 'attempts' tries, the first at once, then after 'backoff', doubling up
+	// to 'maxBackoff'
+	struct ReconnectOptions
+	{
+		unsigned attempts = 5;
+		std::chrono::milliseconds backoff{ 200 };
+		std::chrono::milliseconds maxBackoff{ 5000 };
+	};
+
 	class Client {
 	public:
 		Client(asio::io_context& context)
@@ -16,49 +34,265 @@ namespace cw::network {
 		{
 		}
 
-		// Connects to a specific IP and Port
-		// Note: ip_address must be an IP literal (e.g., "127.0.0.1"), not a hostname.
-		void Connect(const std::string& ip_address, unsigned short port, std::function<void()> onConnect = nullptr) {
-
-			m_connection = Connection::create(m_context);
-
-			// 1. Create the endpoint directly from the IP string and port
-			asio::ip::tcp::endpoint endpoint(
-				asio::ip::make_address(ip_address),
-				port
-			);
+		// Connects to 'host' (a name or an IP literal) on 'port'. Names go
+		// through the process-wide ResolverCache; with several addresses,
+		// IPv6 and IPv4 ones are raced (RFC 8305, see asyncConnectRacing).
+		// 'onError' is called instead of 'onConnect' if no connection is made.
+		void Connect(const std::string& host, unsigned short port, std::function<void()> onConnect = nullptr,
+			std::function<void(std::error_code)> onError = nullptr) {
 
-			// 2. Use the socket's MEMBER function (much simpler than resolver iterator)
-			m_connection->socket().async_connect(endpoint,
-				[this, onConnect](std::error_code ec) {
-					if (!ec) {
-						std::cout << "[Client] Connected to Server!\n";
+			m_dial = [this, host, port](std::function<void()> onConnect, std::function<void(std::error_code)> onError)
+				{
+					connect(host, port, std::move(onConnect), std::move(onError));
+				};
+			m_dial(joinSession(std::move(onConnect)), std::move(onError));
+		}
 
-						m_connection->start();
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+		// Connects to a Server on this host through its Unix domain socket (see
+		// Server::listenLocal). Socket options and TLS do not apply. With
+		// kernel-copy transfers (TransferOptions::kernelCopy) file data goes
+		// over as descriptors instead of bytes.
+		void ConnectLocal(const std::string& path, std::function<void()> onConnect = nullptr, std::function<void(std::error_code)> onError = nullptr) {
 
-						if (onConnect) {
-							onConnect();
-						}
-					}
-					else {
-						std::cerr << "[Client] Connection failed: " << ec.message() << "\n";
-					}
-				});
+			m_dial = [this, path](std::function<void()> onConnect, std::function<void(std::error_code)> onError)
+				{
+					connectLocal(path, std::move(onConnect), std::move(onError));
+				};
+			m_dial(joinSession(std::move(onConnect)), std::move(onError));
 		}
+#endif
 
+		// Pass an rvalue to hand a FileChunk's buffer to the socket uncopied
 		template <typename PacketType>
-		void Send(const PacketType& packet) {
+		void Send(PacketType&& packet) {
 			if (m_connection) {
-				m_connection->send(packet);
+				m_connection->send(std::forward<PacketType>(packet));
 			}
 		}
 
+		// The current connection: after a reconnect, the one that replaced the first
 		std::shared_ptr<Connection> GetConnection() {
 			return m_connection;
 		}
 
+		// Chunking used by uploads started through this client
+		void SetTransferOptions(const cw::TransferOptions& options) {
+			m_transferOptions = options;
+		}
+
+		const cw::TransferOptions& GetTransferOptions() const {
+			return m_transferOptions;
+		}
+
+		// TCP tuning, applied by the next Connect
+		void SetSocketOptions(const SocketOptions& options) {
+			m_socketOptions = options;
+		}
+
+		// Writes of the next Connect are capped by 'limiter', which other
+		// clients may share (Connection::addRateLimiter); null = no cap
+		void SetRateLimiter(std::shared_ptr<RateLimiter> limiter) {
+			m_rateLimiter = std::move(limiter);
+		}
+
+		// Connections made by the next Connect are replaced when lost (a
+		// reset, a load balancer failover, a NAT rebinding): asyncSendFile
+		// continues each file on the new connection from what the server has
+		// on disk, announced with FileResume, rather than failing. Every
+		// connection of this client carries one random session id, so a
+		// server that did not notice the old one fail closes it first (see
+		// cw::packet::Session). Uploads striped, batched, deduplicated or
+		// sent as deltas are not carried over.
+		void SetReconnect(ReconnectOptions options) {
+			m_reconnect = options;
+			std::random_device random;
+			do {
+				m_sessionId = (static_cast<std::uint64_t>(random()) << 32) | random();
+			} while (m_sessionId == 0);
+		}
+
+		std::uint64_t GetSessionId() const {
+			return m_sessionId;
+		}
+
+#if defined(CW_HAS_TLS)
+		// Encrypt the next Connect: TLS handshake, then kTLS (cw/network/tls.h).
+		// 'serverName' is sent as SNI and checked against the certificate.
+		void SetTls(std::shared_ptr<asio::ssl::context> context, std::string serverName = {}) {
+			m_tls = std::move(context);
+			m_tlsServerName = std::move(serverName);
+		}
+#endif
+
 	private:
+		void connect(const std::string& host, unsigned short port, std::function<void()> onConnect,
+			std::function<void(std::error_code)> onError) {
+
+			m_connection = newConnection();
+			auto executor = m_connection->socket().get_executor();
+
+			ResolverCache::instance().asyncResolve(executor, host, port,
+				[this, host, port, onConnect, onError, executor](std::error_code ec, Endpoints endpoints) {
+					if (ec) {
+						CW_LOG_ERROR("[Client] Could not resolve ", host, ": ", ec.message());
+						if (onError) onError(ec);
+						return;
+					}
+
+					// Options go on before the handshake: the window scale is negotiated
+					// from the receive buffer in place at connect time
+					asyncConnectRacing(executor, std::move(endpoints),
+						[this](Connection::Socket& socket)
+						{
+							if (m_socketOptions.registeredIo) openForRegisteredIo(socket);
+							applySocketOptions(socket, m_socketOptions);
+							applySourceBinding(socket, m_socketOptions);
+						},
+						[this, host, port, onConnect, onError](std::error_code ec, Connection::Socket socket, tcp::endpoint endpoint) {
+							if (ec) {
+								CW_LOG_ERROR("[Client] Connection failed: ", ec.message());
+								ResolverCache::instance().forget(host, port);
+								if (onError) onError(ec);
+								return;
+							}
+
+							CW_LOG_INFO("[Client] Connected to Server!");
+							ResolverCache::instance().prefer(host, port, endpoint);
+							m_connection->socket() = std::move(socket);
+#if defined(CW_HAS_TLS)
+							if (m_tls) {
+								startTls(onConnect, onError);
+								return;
+							}
+#endif
+							m_connection->start();
+
+							if (onConnect) {
+								onConnect();
+							}
+						});
+				});
+		}
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+		void connectLocal(const std::string& path, std::function<void()> onConnect, std::function<void(std::error_code)> onError) {
+
+			m_connection = newConnection();
+
+			m_connection->socket().async_connect(asio::local::stream_protocol::endpoint(path),
+				[this, onConnect, onError, path](std::error_code ec) {
+					if (ec) {
+						CW_LOG_ERROR("[Client] Connection to ", path, " failed: ", ec.message());
+						if (onError) onError(ec);
+						return;
+					}
+
+					CW_LOG_INFO("[Client] Connected to Server at ", path);
+					m_connection->start();
+					if (onConnect) onConnect();
+				});
+		}
+#endif
+
+		std::shared_ptr<Connection> newConnection() {
+			auto connection = Connection::create(m_context);
+			connection->addRateLimiter(m_rateLimiter);
+			connection->setRegisteredIo(m_socketOptions.registeredIo);
+			if (m_sessionId != 0) {
+				connection->setReconnector([this](Connection::ReconnectHandler done) { redial(std::move(done), 0); });
+			}
+			return connection;
+		}
+
+		// The first connection tells the server its session in the
+		// background: there is nothing of it to close yet
+		std::function<void()> joinSession(std::function<void()> onConnect) {
+			if (m_sessionId == 0) return onConnect;
+			return [this, onConnect = std::move(onConnect)]() {
+				openSession(m_connection, [](std::error_code) {});
+				if (onConnect) onConnect();
+			};
+		}
+
+		// Capabilities first (every upload needs them, and they say whether
+		// the server takes Session), then the session, if it does
+		void openSession(std::shared_ptr<Connection> connection, std::function<void(std::error_code)> done) {
+			connection->asyncWaitCapabilities([this, connection, done = std::move(done)](std::error_code ec) {
+				if (ec || !connection->peerResumesSessions()) {
+					done(ec);
+					return;
+				}
+				connection->asyncOpenSession(m_sessionId, std::move(done));
+			});
+		}
+
+		// One more try at replacing the lost connection, after the backoff
+		void redial(Connection::ReconnectHandler done, unsigned attempt) {
+			auto delay = attempt == 0 ? std::chrono::milliseconds(0)
+				: std::min(m_reconnect.maxBackoff, m_reconnect.backoff * (1u << std::min(attempt - 1, 16u)));
+			auto timer = std::make_shared<asio::steady_timer>(m_context, delay);
+			timer->async_wait([this, timer, done = std::move(done), attempt](std::error_code) mutable {
+				CW_LOG_WARN("[Client] Connection lost, reconnecting (attempt ", attempt + 1, " of ", m_reconnect.attempts, ")");
+				auto retry = [this, done, attempt](std::error_code ec) {
+					if (attempt + 1 >= m_reconnect.attempts) {
+						CW_LOG_ERROR("[Client] Could not reconnect: ", ec.message());
+						done(ec, nullptr);
+						return;
+					}
+					redial(done, attempt + 1);
+				};
+				m_dial([this, done, retry]() {
+					auto connection = m_connection;
+					openSession(connection, [connection, done, retry](std::error_code ec) {
+						if (ec) {
+							retry(ec);
+							return;
+						}
+						CW_LOG_INFO("[Client] Reconnected");
+						done({}, connection);
+					});
+				}, retry);
+			});
+		}
+
+#if defined(CW_HAS_TLS)
+		void startTls(std::function<void()> onConnect, std::function<void(std::error_code)> onError)
+		{
+			auto conn = m_connection;
+			asio::co_spawn(conn->socket().get_executor(), asyncTlsHandshake(conn->socket(), m_tls, false, m_tlsServerName),
+				[conn, onConnect, onError](std::exception_ptr error)
+				{
+					if (error) {
+						try {
+							std::rethrow_exception(error);
+						}
+						catch (const std::exception& e) {
+							CW_LOG_ERROR("[Client] ", e.what());
+						}
+						std::error_code ignored;
+						conn->socket().close(ignored);
+						if (onError) onError(std::make_error_code(std::errc::connection_aborted));
+						return;
+					}
+
+					conn->start();
+					if (onConnect) onConnect();
+				});
+		}
+#endif
+
 		asio::io_context& m_context;
 		std::shared_ptr<Connection> m_connection;
+		std::function<void(std::function<void()>, std::function<void(std::error_code)>)> m_dial; // The last Connect, again
+		ReconnectOptions m_reconnect;
+		std::uint64_t m_sessionId = 0; // Set by SetReconnect
+		std::shared_ptr<RateLimiter> m_rateLimiter;
+		cw::TransferOptions m_transferOptions;
+		SocketOptions m_socketOptions;
+#if defined(CW_HAS_TLS)
+		std::shared_ptr<asio::ssl::context> m_tls;
+		std::string m_tlsServerName;
+#endif
 	};
 }
\ No newline at end of file
@@ -1,52 +1,538 @@
 #pragma once
-#include <iostream>
 #include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
 #include "cw/network/Connection.h" // Your existing Connection class
+#include "cw/network/load_gossip.h"
+#include "cw/network/socket_options.h"
+#include "cw/network/tls.h"
+#include "cw/file/content_store.h"
+#include "cw/file/signature_cache.h"
+#include "cw/file/download.h"
+#include "cw/file/relay.h"
+#include "cw/file/transfer_registry.h"
+#include "cw/file/volume_set.h"
+#include "cw/log/logger.h"
+#include "cw/metrics/metrics.h"
 
 namespace cw::network {
 
 	class Server {
 	public:
 		// Constructor: Starts listening immediately
-		Server(asio::io_context& io_context, uint16_t port)
+		// Received files are written by 'diskWriter' (shared by all connections).
+		// With 'reusePort' several Servers (one per io_context) can listen on the same
+		// port and the kernel load-balances new connections between them (SO_REUSEPORT).
+		Server(asio::io_context& io_context, uint16_t port, std::shared_ptr<cw::file::DiskWriter> diskWriter = nullptr, bool reusePort = false)
 			: m_ioContext(io_context),
-			m_acceptor(io_context, tcp::endpoint(tcp::v4(), port))
+			m_acceptor(makeAcceptor(io_context, port, reusePort)),
+			m_diskWriter(diskWriter ? std::move(diskWriter) : cw::file::DiskWriter::defaultInstance())
 		{
-			std::cout << "[Server] Started on port " << port << "\n";
-			doAccept();
+			CW_LOG_INFO("[Server] Started on port ", port);
+			for (std::size_t i = 0; i < m_pendingAccepts; ++i) doAccept(m_acceptor);
+		}
+
+		// Accepts posted at once on each listener, each with its Connection
+		// ready. When a storm of clients connects, one wakeup of the acceptor
+		// takes in up to this many instead of one per round trip through the
+		// accept handler. Only raises the count; call before the io_context runs.
+		void setPendingAccepts(std::size_t count)
+		{
+			for (std::size_t i = m_pendingAccepts; i < count; ++i) {
+				doAccept(m_acceptor);
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+				if (m_localAcceptor) doAccept(*m_localAcceptor);
+#endif
+			}
+			m_pendingAccepts = std::max(m_pendingAccepts, count);
+		}
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+		// Also accepts on a Unix domain socket at 'path', for clients on this
+		// host (containers sharing a volume with it, sidecars). No TCP/IP stack
+		// on the way, and file ranges arrive as descriptors the disk pool copies
+		// in the kernel (see cw::packet::FileRange). A stale socket file is
+		// replaced; access is governed by the file's permissions. No TLS here.
+		void listenLocal(const std::string& path)
+		{
+			std::error_code ignored;
+			std::filesystem::remove(path, ignored);
+
+			m_localAcceptor.emplace(asio::make_strand(m_ioContext), asio::local::stream_protocol::endpoint(path));
+			CW_LOG_INFO("[Server] Listening on local socket ", path);
+			for (std::size_t i = 0; i < m_pendingAccepts; ++i) doAccept(*m_localAcceptor);
+		}
+#endif
+
+		// Hands accepted connections to these contexts round-robin instead of the
+		// acceptor's own (used where SO_REUSEPORT is unavailable).
+		// Call before the acceptor's io_context starts running.
+		void distributeTo(std::vector<asio::io_context*> contexts)
+		{
+			m_connectionContexts = std::move(contexts);
+		}
+
+		// Where accepted connections report their counters. Defaults to the
+		// process-wide registry, so the shards of a ShardedServer add up.
+		void setMetrics(std::shared_ptr<cw::metrics::MetricsRegistry> metrics) { m_metrics = std::move(metrics); }
+
+		// Files being received right now, by every connection of the process
+		// (the shards of a ShardedServer share one registry). Any thread.
+		std::vector<cw::file::TransferStatus> transfers() const { return cw::file::TransferRegistry::defaultInstance()->status(); }
+
+		// TCP tuning for accepted sockets. Also applied to the listening socket
+		// right away, so connections accepted from now on handshake with the
+		// new receive buffer.
+		void setSocketOptions(SocketOptions options)
+		{
+			m_socketOptions = std::move(options);
+			applySocketOptions(m_acceptor, m_socketOptions);
+		}
+
+		// Clients may ask for server-side copies of files under these directories
+		// (see Connection::setServerCopyRoots). Off unless set.
+		void setServerCopyRoots(std::vector<std::filesystem::path> roots) { m_serverCopyRoots = std::move(roots); }
+
+		// Clients may download the files under these directories, sent with
+		// 'options' as uploads are (see cw::serveDownloads). Off unless set.
+		void setDownloadRoots(std::vector<std::filesystem::path> roots, cw::TransferOptions options = {})
+		{
+			m_downloadRoots = std::move(roots);
+			m_downloadOptions = std::move(options);
+		}
+
+		// Every file received is passed on to the relay's next hops once
+		// published (see cw::FileRelay). Off unless set.
+		void setFileRelay(std::shared_ptr<cw::FileRelay> relay) { m_relay = std::move(relay); }
+
+		// Connections accepted from now on pass the files they receive on to
+		// 'downstream' as they arrive (see Connection::forwardTo), all over that
+		// one connection. Any thread, so it can be set once the next hop has
+		// answered; nullptr stops it for later connections.
+		void setForwarding(std::shared_ptr<Connection> downstream, ForwardMode mode = ForwardMode::WriteToo)
+		{
+			std::lock_guard lock(m_forwardMutex);
+			m_downstream = std::move(downstream);
+			m_forwardMode = mode;
+		}
+
+		// Limits announced to clients in the handshake (see Connection::setReceiveLimits)
+		void setReceiveLimits(std::uint32_t maxChunkSize, std::uint64_t receiveWindow)
+		{
+			m_maxChunkSize = maxChunkSize;
+			m_receiveWindow = receiveWindow;
+		}
+
+		// At most 'limit' connections open at once (0 = no limit); one accepted
+		// beyond it is closed right away. Shards pass one 'counter' so the
+		// limit holds across them.
+		void setMaxConnections(std::size_t limit, std::shared_ptr<std::atomic<std::size_t>> counter = nullptr)
+		{
+			m_maxConnections = limit;
+			if (counter) m_openConnections = std::move(counter);
+		}
+
+		// Runs on every accepted connection just before it starts, for what has
+		// no setter here: a handler in place of the file receiver (see
+		// Connection::setHandler, cw::network::ObjectStoreReceiver).
+		void setConnectionSetup(std::function<void(Connection&)> setup) { m_connectionSetup = std::move(setup); }
+
+		// Every file received is deduplicated against 'store' once published,
+		// on the disk pool (see cw::file::ContentStore). Off unless set.
+		void setContentStore(std::shared_ptr<cw::file::ContentStore> store) { m_contentStore = std::move(store); }
+
+		// Received files are spread over 'volumes' (see
+		// Connection::setVolumes), whose first volume should be this server's
+		// writer. Off unless set.
+		void setVolumes(std::shared_ptr<const cw::file::VolumeSet> volumes) { m_volumes = std::move(volumes); }
+
+		// Files refused as busy are pointed at a peer server with room that
+		// 'gossip' has heard from (see Connection::setLoadGossip). Off unless set.
+		void setLoadGossip(std::shared_ptr<const LoadGossip> gossip) { m_loadGossip = std::move(gossip); }
+
+		// Delta signatures of received files are kept in 'cache' (see
+		// Connection::setSignatureCache). Off unless set.
+		void setSignatureCache(std::shared_ptr<cw::file::SignatureCache> cache) { m_signatureCache = std::move(cache); }
+
+		// Accepted connections close after this long without traffic (see
+		// Connection::setIdleTimeout); 0 = never
+		void setIdleTimeout(std::chrono::steady_clock::duration timeout) { m_idleTimeout = timeout; }
+
+		// Incoming files that receive nothing for this long are failed (see
+		// Connection::setStallTimeout); 0 = never
+		void setStallTimeout(std::chrono::steady_clock::duration timeout) { m_stallTimeout = timeout; }
+
+		// Accepted connections ping a quiet peer every 'interval' and close
+		// after 'missed' intervals without an answer (see
+		// Connection::setHeartbeat); 0 = off
+		void setHeartbeat(std::chrono::steady_clock::duration interval, unsigned missed = 3)
+		{
+			m_heartbeatInterval = interval;
+			m_heartbeatMissed = missed;
+		}
+
+		// Clients may ask for the server's counters, disk load and files in
+		// flight over the data protocol (StatsRequest; see
+		// Connection::serveStats). Off unless set.
+		void setServeStats(bool enabled) { m_serveStats = enabled; }
+
+		// Accepted connections hash what they receive into TreeHashes and
+		// check senders' TreeDigests (see Connection::setTreeHash)
+		void setTreeHash(bool enabled) { m_treeHash = enabled; }
+
+		// Accepted connections take file data only as SealedChunks under
+		// 'key' (see Connection::setChunkKey); null = in the clear
+		void setChunkKey(std::shared_ptr<const cw::integrity::ChunkKey> key) { m_chunkKey = std::move(key); }
+
+		// Connections send inline from their own strand (see
+		// Connection::setInlineSends); ShardedServer's shards do
+		void setInlineSends(bool enabled) { m_inlineSends = enabled; }
+
+		// Accepted connections splice raw chunk data straight from the socket
+		// into files (see Connection::setSpliceReceive; Linux only)
+		void setSpliceReceive(bool enabled) { m_spliceReceive = enabled; }
+
+		// Accepted connections map the pages of large chunks instead of
+		// copying them (see Connection::setZeroCopyReceive; Linux only)
+		void setZeroCopyReceive(bool enabled) { m_zeroCopyReceive = enabled; }
+
+		// What accepted connections write, at most 'bytesPerSecond' each
+		// (see Connection::setRateLimit); 0 = no cap
+		void setConnectionRateLimit(std::uint64_t bytesPerSecond) { m_connectionRateLimit = bytesPerSecond; }
+
+		// Every accepted connection also writes under 'limiter', which caps
+		// them together; shards pass one so the cap is for the whole server.
+		// Its rate can change while connections run (RateLimiter::setRate).
+		void setRateLimiter(std::shared_ptr<RateLimiter> limiter) { m_rateLimiter = std::move(limiter); }
+
+		// What accepted connections buffer counts against 'budget' (see
+		// Connection::setMemoryBudget), and each may hold 'connectionQuota'
+		// bytes of it at most; 0 = no quota
+		void setMemoryBudget(std::shared_ptr<cw::buffer::MemoryBudget> budget, std::size_t connectionQuota = 0)
+		{
+			m_memoryBudget = std::move(budget);
+			m_connectionMemoryQuota = connectionQuota;
+		}
+
+#if defined(CW_HAS_TLS)
+		// Every accepted connection completes a TLS handshake (and moves to
+		// kTLS) before it starts; one that cannot is dropped.
+		void setTls(std::shared_ptr<asio::ssl::context> context) { m_tls = std::move(context); }
+#endif
+
+		// Graceful stop, for rolling restarts: stops accepting, lets the
+		// transfers in flight finish, and closes the connections once no file
+		// is open, nothing has arrived for a poll interval and the write-behind
+		// queues are empty. Connections still busy after 'timeout' are closed
+		// anyway; their resumable files keep a checkpoint of what reached the
+		// disk. 'onDrained' runs on the server's io_context once all are closed.
+		void drain(std::chrono::steady_clock::duration timeout, std::function<void()> onDrained)
+		{
+			m_draining = true;
+			asio::post(m_acceptor.get_executor(), [this]()
+				{
+					std::error_code ignored;
+					m_acceptor.close(ignored);
+				});
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+			if (m_localAcceptor) {
+				asio::post(m_localAcceptor->get_executor(), [this]()
+					{
+						std::error_code ignored;
+						m_localAcceptor->close(ignored);
+					});
+			}
+#endif
+			auto drain = std::make_shared<Drain>(m_ioContext, std::chrono::steady_clock::now() + timeout, std::move(onDrained));
+			CW_LOG_INFO("[Server] Draining: no new connections, ", openConnections().size(), " open");
+			pollDrain(drain);
+		}
+
+		// The listening TCP port (the one picked, if constructed with 0)
+		uint16_t port() const { return m_acceptor.local_endpoint().port(); }
+
+		static bool reusePortSupported()
+		{
+#if defined(SO_REUSEPORT)
+			return true;
+#else
+			return false;
+#endif
 		}
 
 	private:
-		void doAccept() {
+		static constexpr std::size_t DEFAULT_PENDING_ACCEPTS = 8;
+
+		// How often a drain looks at the connections, and how long they must
+		// have been quiet to be closed
+		static constexpr std::chrono::milliseconds DRAIN_POLL{ 250 };
+
+		struct Drain
+		{
+			Drain(asio::io_context& io, std::chrono::steady_clock::time_point deadline, std::function<void()> onDrained)
+				: timer(io), deadline(deadline), onDrained(std::move(onDrained))
+			{
+			}
+
+			asio::steady_timer timer;
+			std::chrono::steady_clock::time_point deadline;
+			std::function<void()> onDrained;
+			std::optional<std::uint64_t> received; // Bytes received by the last poll
+			bool timedOut = false;
+		};
+
+		void pollDrain(std::shared_ptr<Drain> drain)
+		{
+			auto open = openConnections();
+			if (open.empty()) {
+				CW_LOG_INFO("[Server] Drained");
+				if (drain->onDrained) drain->onDrained();
+				return;
+			}
+
+			std::uint64_t received = m_metrics->snapshot().bytesReceived;
+			std::size_t transfers = cw::file::TransferRegistry::defaultInstance()->status().size();
+			bool quiet = drain->received == received && transfers == 0 && m_memoryBudget->used(cw::buffer::MemoryUse::WriteBehind) == 0;
+			drain->received = received;
+
+			if (!quiet && !drain->timedOut && std::chrono::steady_clock::now() >= drain->deadline) {
+				CW_LOG_WARN("[Server] Drain timed out: closing ", open.size(), " connections, ", transfers, " files left to resume");
+				drain->timedOut = true;
+			}
+			if (quiet || drain->timedOut) {
+				for (auto& conn : open) conn->shutdown();
+			}
+
+			// The closes land on the connections' strands: look again shortly
+			drain->timer.expires_after(DRAIN_POLL);
+			drain->timer.async_wait([this, drain](std::error_code ec)
+				{
+					if (!ec) pollDrain(drain);
+				});
+		}
+
+		std::vector<std::shared_ptr<Connection>> openConnections()
+		{
+			std::lock_guard lock(m_connectionsMutex);
+			std::erase_if(m_connections, [](const std::weak_ptr<Connection>& weak) { return weak.expired(); });
+			std::vector<std::shared_ptr<Connection>> open;
+			for (auto& weak : m_connections) {
+				if (auto conn = weak.lock(); conn && conn->isOpen()) open.push_back(std::move(conn));
+			}
+			return open;
+		}
+
+		// Dual stack: one IPv6 socket that takes IPv4 clients too (as mapped
+		// addresses); IPv4 only where the host has no IPv6
+		static tcp::acceptor makeAcceptor(asio::io_context& io_context, uint16_t port, bool reusePort)
+		{
+			// On a strand: with several accepts pending, their handlers may
+			// otherwise run at once on different network threads
+			tcp::acceptor acceptor(asio::make_strand(io_context));
+
+			std::error_code ec;
+			tcp::endpoint endpoint(tcp::v6(), port);
+			acceptor.open(endpoint.protocol(), ec);
+			if (!ec) acceptor.set_option(asio::ip::v6_only(false), ec);
+			if (ec) {
+				std::error_code ignored;
+				acceptor.close(ignored);
+				endpoint = tcp::endpoint(tcp::v4(), port);
+				acceptor.open(endpoint.protocol());
+			}
+
+			acceptor.set_option(tcp::acceptor::reuse_address(true));
+#if defined(SO_REUSEPORT)
+			if (reusePort) {
+				acceptor.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+			}
+#else
+			(void)reusePort;
+#endif
+			acceptor.bind(endpoint);
+			acceptor.listen();
+			return acceptor;
+		}
+
+		asio::io_context& nextConnectionContext()
+		{
+			if (m_connectionContexts.empty()) return m_ioContext;
+			return *m_connectionContexts[m_nextContext.fetch_add(1, std::memory_order_relaxed) % m_connectionContexts.size()];
+		}
+
+		// TCP or local acceptor
+		template<typename Acceptor>
+		void doAccept(Acceptor& acceptor) {
 			// 1. Create the Connection wrapper (Eager allocation)
 			// We create this *before* the connection is finalized so we have a socket to give to the acceptor.
-			auto new_conn = Connection::create(m_ioContext);
+			auto new_conn = Connection::create(nextConnectionContext());
+			new_conn->setDiskWriter(m_diskWriter);
 
 			// 2. Async Accept
-			m_acceptor.async_accept(
+			acceptor.async_accept(
 				new_conn->socket(), // We use the socket inside the connection
-				[this, new_conn](std::error_code ec) {
+				[this, &acceptor, new_conn](std::error_code ec) {
 
-					if (!ec) {
+					if (!ec && !admit(*new_conn)) {
+						CW_LOG_WARN("[Server] Refusing ", new_conn->peerName(), ": ", m_maxConnections, " connections open");
+						std::error_code ignored;
+						new_conn->socket().close(ignored);
+					}
+					else if (!ec) {
 						// Success: Start the connection's read loop
-						std::cout << "[Server] Client Connected: "
-							<< new_conn->socket().remote_endpoint() << "\n";
+						CW_LOG_INFO("[Server] Client Connected: ", new_conn->peerName());
+						m_metrics->track(new_conn->metrics());
+						// Connections of one client address share its part of the disk threads
+						if (auto tenant = m_diskWriter->tenant(new_conn->peerAddress())) new_conn->setDiskTenant(std::move(tenant));
+						// Here, not at creation: the first accept is posted by the constructor
+						if (!m_serverCopyRoots.empty()) new_conn->setServerCopyRoots(m_serverCopyRoots);
+						if (m_volumes) new_conn->setVolumes(m_volumes);
+						if (m_loadGossip) new_conn->setLoadGossip(m_loadGossip);
+						if (!m_downloadRoots.empty()) cw::serveDownloads(*new_conn, m_downloadRoots, m_downloadOptions);
+						if (m_relay) m_relay->attach(*new_conn);
+						if (m_contentStore) {
+							new_conn->onFilePublished([store = m_contentStore, executor = m_diskWriter->executor()](std::filesystem::path path)
+								{
+									asio::post(executor, [store, path = std::move(path)]() { store->adopt(path); });
+								});
+						}
+						if (m_signatureCache) new_conn->setSignatureCache(m_signatureCache);
+						{
+							std::lock_guard lock(m_forwardMutex);
+							if (m_downstream) new_conn->forwardTo(m_downstream, m_forwardMode);
+						}
+						new_conn->setReceiveLimits(m_maxChunkSize, m_receiveWindow);
+						new_conn->setIdleTimeout(m_idleTimeout);
+						new_conn->setStallTimeout(m_stallTimeout);
+						new_conn->setHeartbeat(m_heartbeatInterval, m_heartbeatMissed);
+						new_conn->setTreeHash(m_treeHash);
+						new_conn->setChunkKey(m_chunkKey);
+						new_conn->setInlineSends(m_inlineSends);
+						if (m_serveStats) new_conn->serveStats(m_metrics);
+						new_conn->setSpliceReceive(m_spliceReceive);
+						new_conn->setZeroCopyReceive(m_zeroCopyReceive);
+						if (m_connectionRateLimit) new_conn->setRateLimit(m_connectionRateLimit);
+						new_conn->addRateLimiter(m_rateLimiter);
+						new_conn->setMemoryBudget(m_memoryBudget, m_connectionMemoryQuota);
+						if (m_connectionSetup) m_connectionSetup(*new_conn);
+						{
+							std::lock_guard lock(m_connectionsMutex);
+							std::erase_if(m_connections, [](const std::weak_ptr<Connection>& weak) { return weak.expired(); });
+							m_connections.push_back(new_conn);
+						}
 
-						new_conn->start();
+						if constexpr (std::is_same_v<Acceptor, tcp::acceptor>) {
+							applySocketOptions(new_conn->socket(), m_socketOptions);
+							startConnection(new_conn);
+						}
+						else {
+							new_conn->start();
+						}
 					}
-					else {
-						std::cerr << "[Server] Accept Error: " << ec.message() << "\n";
+					else if (!m_draining) {
+						CW_LOG_ERROR("[Server] Accept Error: ", ec.message());
 					}
 
 					// 3. Loop: Only continue if the acceptor is still open
-					if (m_acceptor.is_open()) {
-						doAccept();
+					if (acceptor.is_open()) {
+						doAccept(acceptor);
 					}
 				});
 		}
 
+		// Takes one of the m_maxConnections slots for 'conn' until it closes
+		bool admit(Connection& conn)
+		{
+			if (m_maxConnections == 0) return true;
+
+			if (m_openConnections->fetch_add(1) >= m_maxConnections) {
+				m_openConnections->fetch_sub(1);
+				return false;
+			}
+			conn.holdSlot(std::shared_ptr<void>(nullptr, [counter = m_openConnections](void*) { counter->fetch_sub(1); }));
+			return true;
+		}
+
+		void startConnection(std::shared_ptr<Connection> conn)
+		{
+#if defined(CW_HAS_TLS)
+			if (m_tls) {
+				asio::co_spawn(conn->socket().get_executor(), asyncTlsHandshake(conn->socket(), m_tls, true),
+					[conn](std::exception_ptr error)
+					{
+						if (!error) {
+							conn->start();
+							return;
+						}
+						try {
+							std::rethrow_exception(error);
+						}
+						catch (const std::exception& e) {
+							CW_LOG_WARN("[Server] Dropping ", conn->peerName(), ": ", e.what());
+						}
+						std::error_code ignored;
+						conn->socket().close(ignored);
+					});
+				return;
+			}
+#endif
+			conn->start();
+		}
+
 	private:
 		asio::io_context& m_ioContext;
 		asio::ip::tcp::acceptor m_acceptor;
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+		std::optional<asio::local::stream_protocol::acceptor> m_localAcceptor;
+#endif
+		std::shared_ptr<cw::file::DiskWriter> m_diskWriter;
+		std::shared_ptr<cw::metrics::MetricsRegistry> m_metrics = cw::metrics::MetricsRegistry::defaultInstance();
+		SocketOptions m_socketOptions;
+		std::vector<std::filesystem::path> m_serverCopyRoots;
+		std::vector<std::filesystem::path> m_downloadRoots;
+		cw::TransferOptions m_downloadOptions;
+		std::shared_ptr<cw::FileRelay> m_relay;
+		std::shared_ptr<cw::file::ContentStore> m_contentStore;
+		std::shared_ptr<const cw::file::VolumeSet> m_volumes;
+		std::shared_ptr<const LoadGossip> m_loadGossip;
+		std::shared_ptr<cw::file::SignatureCache> m_signatureCache;
+		std::function<void(Connection&)> m_connectionSetup;
+		std::mutex m_forwardMutex; // setForwarding may come from another thread
+		std::shared_ptr<Connection> m_downstream;
+		ForwardMode m_forwardMode = ForwardMode::WriteToo;
+		std::uint32_t m_maxChunkSize = 0;
+		std::uint64_t m_receiveWindow = 0;
+		std::size_t m_maxConnections = 0;
+		std::shared_ptr<std::atomic<std::size_t>> m_openConnections = std::make_shared<std::atomic<std::size_t>>(0);
+		std::chrono::steady_clock::duration m_idleTimeout{};
+		std::chrono::steady_clock::duration m_stallTimeout{};
+		std::chrono::steady_clock::duration m_heartbeatInterval{};
+		unsigned m_heartbeatMissed = 3;
+		bool m_treeHash = false;
+		std::shared_ptr<const cw::integrity::ChunkKey> m_chunkKey;
+		bool m_inlineSends = false;
+		bool m_serveStats = false;
+		bool m_spliceReceive = false;
+		bool m_zeroCopyReceive = false;
+		std::uint64_t m_connectionRateLimit = 0;
+		std::shared_ptr<RateLimiter> m_rateLimiter; // Null = no shared cap
+		std::shared_ptr<cw::buffer::MemoryBudget> m_memoryBudget = cw::buffer::MemoryBudget::defaultInstance();
+		std::size_t m_connectionMemoryQuota = 0;
+		std::mutex m_connectionsMutex; // Accepted on the TCP and local acceptors' strands
+		std::vector<std::weak_ptr<Connection>> m_connections;
+		std::atomic<bool> m_draining = false;
+#if defined(CW_HAS_TLS)
+		std::shared_ptr<asio::ssl::context> m_tls;
+#endif
+		std::vector<asio::io_context*> m_connectionContexts;
+		std::atomic<std::size_t> m_nextContext = 0; // TCP and local acceptors run on their own strands
+		std::size_t m_pendingAccepts = DEFAULT_PENDING_ACCEPTS;
 	};
 }
\ No newline at end of file
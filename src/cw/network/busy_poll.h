@@ -0,0 +1,53 @@
+#pragma once
+#include <asio.hpp>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace cw::network {
+
+	// SO_BUSY_POLL the spinning mode puts on sockets unless one was given
+	inline constexpr int DEFAULT_BUSY_POLL_MICROS = 50;
+
+	// Busy polls before a pause hint between empty polls of runSpinning
+	inline constexpr std::size_t SPIN_BEFORE_PAUSE = 64;
+
+	inline void cpuRelax()
+	{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+		_mm_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+
+	// io.run(), without ever sleeping: the thread calls io.poll() in a loop,
+	// each a non-blocking epoll_wait (or GetQueuedCompletionStatus), so a
+	// frame that arrives is handled without the wakeup of a thread blocked
+	// in the kernel, microseconds on an ack round trip. With SO_BUSY_POLL on
+	// the sockets (SocketOptions::busyPollMicros) the reads also spin on the
+	// device queue instead of waiting for its interrupt. Takes the core
+	// whole: for latency-bound tools on machines with one to spare. Returns,
+	// like run(), once the context is stopped or out of work.
+	inline void runSpinning(asio::io_context& io)
+	{
+		std::size_t idle = 0;
+		while (!io.stopped()) {
+			if (io.poll() != 0) {
+				idle = 0;
+				continue;
+			}
+			// A sibling hyperthread gets the pipeline meanwhile; the loop stays hot
+			if (++idle >= SPIN_BEFORE_PAUSE) cpuRelax();
+		}
+	}
+
+	// io.run(), or runSpinning when 'spin'
+	inline void runEventLoop(asio::io_context& io, bool spin)
+	{
+		if (spin) runSpinning(io);
+		else io.run();
+	}
+}
@@ -0,0 +1,324 @@
+#pragma once
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cw/network/Connection.h"
+#include "cw/network/resolver.h"
+#include "cw/network/socket_options.h"
+#include "cw/network/tls.h"
+#include "cw/log/logger.h"
+
+namespace cw::network {
+
+	class ClientPool;
+
+	struct ClientPoolOptions
+	{
+		std::size_t maxPerEndpoint = 8;
+		std::chrono::steady_clock::duration idleTimeout = std::chrono::seconds(60);
+		std::chrono::steady_clock::duration healthCheckInterval = std::chrono::seconds(5);
+		SocketOptions socketOptions;
+		std::uint64_t connectionRateLimit = 0; // Bytes/s each connection writes, 0 = no cap
+		std::shared_ptr<RateLimiter> rateLimiter; // Shared by all the pool's connections, null = no cap
+#if defined(CW_HAS_TLS)
+		std::shared_ptr<asio::ssl::context> tls; // Null = plain TCP
+		std::string tlsServerName;
+#endif
+	};
+
+	// A connection taken from a ClientPool. Goes back to the pool when
+	// destroyed, unless it failed or was discarded; release it only once the
+	// transfers started on it have completed.
+	class PooledConnection
+	{
+	public:
+		PooledConnection() = default;
+		PooledConnection(PooledConnection&&) noexcept = default;
+		PooledConnection& operator=(PooledConnection&& other) noexcept
+		{
+			if (this != &other) {
+				release();
+				m_pool = std::move(other.m_pool);
+				m_host = std::move(other.m_host);
+				m_port = other.m_port;
+				m_connection = std::move(other.m_connection);
+			}
+			return *this;
+		}
+		~PooledConnection() { release(); }
+
+		const std::shared_ptr<Connection>& get() const { return m_connection; }
+		Connection* operator->() const { return m_connection.get(); }
+		explicit operator bool() const { return m_connection != nullptr; }
+
+		// Closes the connection instead of handing it to the next transfer
+		// (a transfer on it failed half way, say)
+		inline void discard();
+		inline void release();
+
+	private:
+		friend class ClientPool;
+
+		PooledConnection(std::weak_ptr<ClientPool> pool, std::string host, std::uint16_t port, std::shared_ptr<Connection> connection)
+			: m_pool(std::move(pool)), m_host(std::move(host)), m_port(port), m_connection(std::move(connection))
+		{
+		}
+
+		std::weak_ptr<ClientPool> m_pool;
+		std::string m_host;
+		std::uint16_t m_port = 0;
+		std::shared_ptr<Connection> m_connection;
+	};
+
+	// Warm connections for processes that upload many small outputs to the
+	// same servers: a transfer takes an established connection (connected,
+	// TLS done, Capabilities exchanged) instead of paying for the TCP and TLS
+	// handshakes each time. At most maxPerEndpoint connections per host:port,
+	// idle or in use; transfers beyond that wait for one to be released.
+	// Idle connections are checked every healthCheckInterval: ones the
+	// server closed (its idle timeout, a restart) are dropped, as are ones
+	// idle for longer than idleTimeout. TCP keepalive catches peers that
+	// vanished without closing.
+	class ClientPool : public std::enable_shared_from_this<ClientPool>
+	{
+	public:
+		using Options = ClientPoolOptions;
+
+		struct Stats
+		{
+			std::uint64_t connects = 0; // New connections established
+			std::uint64_t reuses = 0;   // Acquires served by an idle connection
+		};
+
+		static std::shared_ptr<ClientPool> create(asio::io_context& io, Options options = {})
+		{
+			auto pool = std::shared_ptr<ClientPool>(new ClientPool(io, std::move(options)));
+			pool->scheduleHealthCheck();
+			return pool;
+		}
+
+		~ClientPool()
+		{
+			for (auto& [key, endpoint] : m_endpoints) {
+				for (auto& idle : endpoint.idle) idle.connection->shutdown();
+			}
+		}
+
+		// Completes with a connection to host:port that is ready for transfers
+		// (cw::asyncSendFile and friends take PooledConnection::get()).
+		template<typename CompletionToken>
+		auto asyncAcquire(std::string host, std::uint16_t port, CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code, PooledConnection)>(
+				[self = shared_from_this(), host = std::move(host), port](auto handler) mutable
+				{
+					Waiter waiter{ asio::get_associated_executor(handler, self->m_strand), std::move(handler) };
+					asio::post(self->m_strand, [self, host = std::move(host), port, waiter = std::move(waiter)]() mutable
+						{
+							Key key{ host, port };
+							self->m_endpoints[key].waiters.push_back(std::move(waiter));
+							self->serve(key);
+						});
+				}, token);
+		}
+
+		Stats stats() const { return { m_connects.load(), m_reuses.load() }; }
+
+		// The cap shared by the pool's connections (Options::rateLimiter),
+		// null without one; adjust it with RateLimiter::setRate
+		const std::shared_ptr<RateLimiter>& rateLimiter() const { return m_options.rateLimiter; }
+
+	private:
+		friend class PooledConnection;
+
+		using Key = std::pair<std::string, std::uint16_t>;
+
+		struct Waiter
+		{
+			asio::any_io_executor executor; // Where the handler runs
+			asio::any_completion_handler<void(std::error_code, PooledConnection)> handler;
+		};
+
+		struct Idle
+		{
+			std::shared_ptr<Connection> connection;
+			std::chrono::steady_clock::time_point since;
+		};
+
+		struct Endpoint
+		{
+			std::vector<Idle> idle;         // Most recently used last
+			std::deque<Waiter> waiters;
+			std::size_t open = 0;           // Idle, lent out or connecting
+		};
+
+		ClientPool(asio::io_context& io, Options options)
+			: m_io(io), m_strand(asio::make_strand(io)), m_healthTimer(m_strand), m_options(std::move(options))
+		{
+		}
+
+		void complete(Waiter waiter, std::error_code ec, PooledConnection connection)
+		{
+			asio::post(waiter.executor, [handler = std::move(waiter.handler), ec, connection = std::move(connection)]() mutable
+				{
+					handler(ec, std::move(connection));
+				});
+		}
+
+		// Hands idle connections to waiters, and opens new ones while under the limit
+		void serve(const Key& key)
+		{
+			auto& endpoint = m_endpoints[key];
+			while (!endpoint.waiters.empty()) {
+				while (!endpoint.idle.empty() && !endpoint.idle.back().connection->isOpen()) {
+					endpoint.idle.pop_back();
+					--endpoint.open;
+				}
+
+				if (!endpoint.idle.empty()) {
+					auto connection = std::move(endpoint.idle.back().connection);
+					endpoint.idle.pop_back();
+					++m_reuses;
+					complete(std::move(endpoint.waiters.front()), {}, PooledConnection(weak_from_this(), key.first, key.second, std::move(connection)));
+					endpoint.waiters.pop_front();
+					continue;
+				}
+
+				if (endpoint.open >= m_options.maxPerEndpoint) return;
+
+				++endpoint.open;
+				auto waiter = std::move(endpoint.waiters.front());
+				endpoint.waiters.pop_front();
+				asio::co_spawn(m_strand, connect(key.first, key.second),
+					[self = shared_from_this(), key, waiter = std::move(waiter)](std::exception_ptr error, std::shared_ptr<Connection> connection) mutable
+					{
+						if (error) {
+							--self->m_endpoints[key].open;
+							std::error_code ec = asio::error::connection_refused;
+							try {
+								std::rethrow_exception(error);
+							}
+							catch (const std::exception& e) {
+								if (auto system = dynamic_cast<const std::system_error*>(&e)) ec = system->code();
+								CW_LOG_WARN("[ClientPool] ", key.first, ":", key.second, ": ", e.what());
+							}
+							self->complete(std::move(waiter), ec, {});
+							self->serve(key);
+							return;
+						}
+
+						++self->m_connects;
+						self->complete(std::move(waiter), {}, PooledConnection(self->weak_from_this(), key.first, key.second, std::move(connection)));
+					});
+			}
+		}
+
+		asio::awaitable<std::shared_ptr<Connection>> connect(std::string host, std::uint16_t port)
+		{
+			auto connection = Connection::create(m_io);
+			auto executor = connection->socket().get_executor();
+			if (m_options.connectionRateLimit) connection->setRateLimit(m_options.connectionRateLimit);
+			connection->addRateLimiter(m_options.rateLimiter);
+			connection->setRegisteredIo(m_options.socketOptions.registeredIo);
+
+			auto endpoints = co_await ResolverCache::instance().asyncResolve(executor, host, port, asio::use_awaitable);
+			auto [socket, reached] = co_await asyncConnectRacing(executor, std::move(endpoints),
+				[this](Connection::Socket& socket)
+				{
+					if (m_options.socketOptions.registeredIo) openForRegisteredIo(socket);
+					applySocketOptions(socket, m_options.socketOptions);
+					applySourceBinding(socket, m_options.socketOptions);
+					std::error_code ignored;
+					socket.set_option(asio::socket_base::keep_alive(true), ignored);
+				}, asio::use_awaitable);
+			ResolverCache::instance().prefer(host, port, reached);
+			connection->socket() = std::move(socket);
+
+#if defined(CW_HAS_TLS)
+			if (m_options.tls) co_await asyncTlsHandshake(connection->socket(), m_options.tls, false, m_options.tlsServerName);
+#endif
+			connection->start();
+
+			// Chunk limits and feature bits are known before the first transfer
+			co_await connection->asyncWaitCapabilities(asio::use_awaitable);
+			CW_LOG_DEBUG("[ClientPool] Connected to ", reached);
+			co_return connection;
+		}
+
+		void giveBack(const Key& key, std::shared_ptr<Connection> connection)
+		{
+			auto& endpoint = m_endpoints[key];
+			if (connection->isOpen()) {
+				endpoint.idle.push_back({ std::move(connection), std::chrono::steady_clock::now() });
+			}
+			else {
+				connection->shutdown();
+				--endpoint.open;
+			}
+			serve(key);
+		}
+
+		void scheduleHealthCheck()
+		{
+			m_healthTimer.expires_after(m_options.healthCheckInterval);
+			m_healthTimer.async_wait([weak = weak_from_this()](std::error_code ec)
+				{
+					auto self = weak.lock();
+					if (ec || !self) return;
+					self->checkIdle();
+					self->scheduleHealthCheck();
+				});
+		}
+
+		void checkIdle()
+		{
+			auto now = std::chrono::steady_clock::now();
+			for (auto& [key, endpoint] : m_endpoints) {
+				std::erase_if(endpoint.idle, [&](Idle& idle)
+					{
+						if (idle.connection->isOpen() && now - idle.since < m_options.idleTimeout) return false;
+						idle.connection->shutdown();
+						--endpoint.open;
+						return true;
+					});
+			}
+		}
+
+	private:
+		asio::io_context& m_io;
+		asio::strand<asio::io_context::executor_type> m_strand; // All pool state
+		asio::steady_timer m_healthTimer;
+		Options m_options;
+		std::map<Key, Endpoint> m_endpoints;
+		std::atomic<std::uint64_t> m_connects = 0;
+		std::atomic<std::uint64_t> m_reuses = 0;
+	};
+
+	inline void PooledConnection::discard()
+	{
+		if (m_connection) m_connection->shutdown();
+		release();
+	}
+
+	inline void PooledConnection::release()
+	{
+		if (!m_connection) return;
+
+		auto connection = std::move(m_connection);
+		auto pool = m_pool.lock();
+		if (!pool) return;
+
+		asio::post(pool->m_strand, [pool, key = ClientPool::Key{ std::move(m_host), m_port }, connection = std::move(connection)]() mutable
+			{
+				pool->giveBack(key, std::move(connection));
+			});
+	}
+}
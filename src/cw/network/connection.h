@@ -1,265 +1,5364 @@
 #pragma once
 
 #include <asio.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <vector>
 #include <memory>
 #include <deque>
 #include <atomic>
-#include <iostream>
-#include <array>
-#include <fstream>
 #include <filesystem> // [Added] For directory creation
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#elif defined(_WIN32)
+#include <mswsock.h>
+#endif
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#endif
 
 // Project Headers
 #include "../Frame.h"
 #include "../protocol/packet/packet.h"
+#include "../protocol/packet/packet_registry.h"
+#include "../log/logger.h"
+#include "../trace.h"
+#include "../metrics/timeline.h"
+#include "../metrics/stage_profile.h"
+#include "../flat_hash.h"
+#include "../buffer/receive_buffer.h"
+#include "../buffer/buffer_pool.h"
+#include "../buffer/memory_budget.h"
+#include "../file/file_handle.h"
+#include "../file/disk_writer.h"
+#include "../file/archive.h"
+#include "../file/incoming_file.h"
+#include "../file/transfer_registry.h"
+#include "../file/manifest.h"
+#include "../file/delta.h"
+#include "../file/dedup.h"
+#include "../file/safe_path.h"
+#include "../file/signature_cache.h"
+#include "../file/subtree_digest.h"
+#include "../file/volume_set.h"
+#include "../compression/codec.h"
+#include "../compression/dictionary.h"
+#include "../metrics/metrics.h"
+#include "../metrics/progress.h"
+#include "../integrity/checksum.h"
+#include "../integrity/tree_hash.h"
+#include "../network/rate_limiter.h"
+#include "../network/registered_io.h"
+#include "../network/ring_queue.h"
+#include "../network/handler_memory.h"
+#include "../network/load_gossip.h"
+#include "../network/metrics_endpoint.h"
+#include "../network/pending_requests.h"
+#include "../network/session_table.h"
+#include "../network/stream_table.h"
+#include "../network/submission_queue.h"
+#include "../network/timer_wheel.h"
+#include "../network/zero_copy.h"
+#include "../network/zero_copy_receive.h"
 
 namespace cw::network {
 
 	using asio::ip::tcp;
 	namespace fs = std::filesystem; // [Added] Alias
 
+	class Connection;
+
+	using Priority = cw::packet::Priority;
+
+	// Packets framed for one hand-off to a Connection (see sendBatch): a
+	// whole small file (FileInfo, its chunk, FileDone), a burst of acks.
+	// Made by Connection::makeBatch, in the frame format and priority class
+	// it will be sent with; reusable once sent.
+	// The stream whose file data 'packet' carries, 0 for other packets: a
+	// receiver's Error naming the stream drops its frames still queued
+	template<typename P>
+	std::uint32_t dataStreamOf(const P& packet)
+	{
+		using cw::packet::PacketType;
+		constexpr PacketType type = P::type;
+		if constexpr (type == PacketType::FileChunk || type == PacketType::CompressedChunk || type == PacketType::SealedChunk || type == PacketType::FileHole
+			|| type == PacketType::FileRange || type == PacketType::TreeDigest) {
+			return packet.streamId;
+		}
+		else {
+			return 0;
+		}
+	}
+
+	class FrameBatch
+	{
+	public:
+		template<typename PacketT>
+		void add(PacketT&& packet)
+		{
+			std::uint32_t streamId = dataStreamOf(packet);
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Serialize);
+			auto frame = cw::packet::buildOutgoingFrame(std::forward<PacketT>(packet), m_format);
+			frame.priority = m_priority;
+			frame.streamId = streamId;
+			m_bytes += frame.size();
+			m_frames.push_back(std::move(frame));
+		}
+
+		bool empty() const { return m_frames.empty(); }
+		std::size_t size() const { return m_frames.size(); }
+		std::size_t bytes() const { return m_bytes; }
+		Priority priority() const { return m_priority; }
+
+	private:
+		friend class Connection;
+
+		FrameBatch(cw::packet::FrameFormat format, Priority priority) : m_format(format), m_priority(priority) {}
+
+		std::vector<cw::packet::OutgoingFrame> m_frames;
+		std::size_t m_bytes = 0;
+		cw::packet::FrameFormat m_format;
+		Priority m_priority;
+	};
+
+	// What a connection does with the files it passes on (see forwardTo):
+	// writes its own copy as well, or only passes them on
+	enum class ForwardMode { WriteToo, ForwardOnly };
+
+	// A receiver plugged into a Connection (see setHandler) takes packet P when
+	// it has an onPacket(Connection&, P) overload; P is what the registry
+	// decodes it to (FileChunkView for a FileChunk, FileInfoView for a
+	// FileInfo, see ReceivedAs).
+	template<typename H, typename P>
+	concept HandlesPacket = requires(H& handler, Connection& conn, P&& packet) {
+		handler.onPacket(conn, std::move(packet));
+	};
+
+	// ... and hears once that the connection is gone when it has an
+	// onClosed(Connection&, std::error_code)
+	template<typename H>
+	concept HandlesClose = requires(H& handler, Connection& conn, std::error_code ec) {
+		handler.onClosed(conn, ec);
+	};
+
 	class Connection : public std::enable_shared_from_this<Connection>
 	{
 
 	public:
+		// The object and its control block come from cw::buffer::BufferPool as
+		// one block, so a storm of short-lived connections recycles memory
+		// instead of going to the heap for each
 		static std::shared_ptr<Connection> create(asio::io_context& io)
 		{
-			return std::shared_ptr<Connection>(new Connection(io));
+			struct Pooled : Connection
+			{
+				explicit Pooled(asio::io_context& io) : Connection(io) {}
+			};
+			return std::allocate_shared<Pooled>(cw::buffer::PoolAllocator<Pooled>{}, io);
 		}
 
-		tcp::socket& socket() { return m_socket; }
+		// A stream socket of any family: TCP, or a Unix domain socket between
+		// processes on one host (see Server::listenLocal, Client::ConnectLocal)
+		using Socket = asio::generic::stream_protocol::socket;
+
+		Socket& socket() { return m_socket; }
 
-		bool isCongested() const
+		// The peer's address for log lines, "local" over a Unix domain socket
+		std::string peerName() const
 		{
-			// If we have more than 1MB pending in RAM, tell the file reader to wait.
-			return m_queueSize > 1024 * 1024;
+			auto ip = peerEndpoint();
+			if (!ip) return peerAddress();
+			if (ip->address().is_v6()) return "[" + peerAddress() + "]:" + std::to_string(ip->port());
+			return peerAddress() + ":" + std::to_string(ip->port());
 		}
-		template<typename PacketT>
-		void send(const PacketT& packet)
+
+		// The peer's address without the port: "local" on a Unix domain
+		// socket, "unknown" once disconnected
+		std::string peerAddress() const
 		{
-			auto frame = cw::packet::buildFrame(packet);
+			std::error_code ec;
+			m_socket.remote_endpoint(ec);
+			if (ec) return "unknown";
+			auto ip = peerEndpoint();
+			return ip ? ip->address().to_string() : "local";
+		}
 
-			auto self = shared_from_this();
-			asio::post(m_socket.get_executor(),
-				[this, self, msg = std::move(frame)]()
-				{
-					doWrite(std::move(msg));
-				});
+		// True once started on a Unix domain socket
+		bool isLocal() const { return m_local; }
+
+		// False once closed, or once the peer hung up or the stream failed
+		bool isOpen() const { return !m_failed && m_socket.is_open(); }
+
+		// Closes the socket from any thread; whatever awaits this connection
+		// completes with operation_aborted
+		void shutdown()
+		{
+			asio::post(m_socket.get_executor(), [self = shared_from_this()]() { self->close(); });
 		}
 
-		void start()
+		// Makes a new connection to the same peer when this one is lost (see
+		// Client::SetReconnect): completes, on any thread, with the new one,
+		// started and with the peer's Capabilities in, or with why none could be made
+		using ReconnectHandler = std::function<void(std::error_code, std::shared_ptr<Connection>)>;
+		using Reconnector = std::function<void(ReconnectHandler)>;
+
+		// Lets asyncReconnect replace this connection through 'reconnector'.
+		// Call before start().
+		void setReconnector(Reconnector reconnector) { m_reconnector = std::move(reconnector); }
+
+		bool reconnects() const { return static_cast<bool>(m_reconnector); }
+
+		// The connection that replaced this one, the one that replaced that,
+		// and so on: this one until asyncReconnect has completed
+		std::shared_ptr<Connection> latest()
 		{
-			std::cout << "[Connection] Client Handshake Complete. Ready.\n";
-			doRead();
+			std::shared_ptr<Connection> conn = shared_from_this();
+			while (auto next = conn->successor()) conn = std::move(next);
+			return conn;
 		}
 
-	private:
-		void doRead()
+		// Completes with the connection replacing this one (closed first if it
+		// is still open), made once however many callers ask: the transfers
+		// that were on this one resume there. Completes with
+		// operation_not_supported without a reconnector, and with the last
+		// error if the reconnector gave up.
+		template<typename CompletionToken>
+		auto asyncReconnect(CompletionToken&& token)
 		{
-			auto self = shared_from_this();
+			return asio::async_initiate<CompletionToken, void(std::error_code, std::shared_ptr<Connection>)>(
+				[self = shared_from_this()](auto handler)
+				{
+					asio::post(self->m_socket.get_executor(),
+						[self, h = std::move(handler)]() mutable
+						{
+							if (auto next = self->successor()) {
+								asio::dispatch(asio::append(std::move(h), std::error_code{}, std::move(next)));
+								return;
+							}
+							if (!self->m_reconnector) {
+								asio::dispatch(asio::append(std::move(h), std::error_code(asio::error::operation_not_supported), std::shared_ptr<Connection>{}));
+								return;
+							}
+
+							self->m_reconnectWaiters.push_back(std::move(h));
+							if (self->m_reconnectWaiters.size() > 1) return;
+							if (self->isOpen()) self->close();
+							self->m_reconnector([self](std::error_code ec, std::shared_ptr<Connection> next)
+								{
+									asio::post(self->m_socket.get_executor(), [self, ec, next = std::move(next)]()
+										{
+											self->replacedBy(ec, next);
+										});
+								});
+						});
+				}, token);
+		}
+
+		// The peer takes Session: it closes what it still holds of a session
+		// when the client comes back on a new connection
+		bool peerResumesSessions() const { return (m_peerFeatures & cw::packet::CAP_SESSIONS) != 0; }
 
-			m_socket.async_read_some(asio::buffer(m_tempBuffer),
-				[this, self](std::error_code ec, std::size_t length)
+		// The peer takes AckBatch: acks to it are delayed and batched (sendAck)
+		bool peerTakesAckBatches() const { return (m_peerFeatures & cw::packet::CAP_ACK_BATCH) != 0; }
+
+		// The peer answers Pings (see setHeartbeat)
+		bool peerAnswersPings() const { return (m_peerFeatures & cw::packet::CAP_HEARTBEAT) != 0; }
+
+		// Sends Session 'sessionId' and completes once the peer echoes it, any
+		// older connection of the session closed at its end. Completes with
+		// operation_aborted if the connection fails first.
+		template<typename CompletionToken>
+		auto asyncOpenSession(std::uint64_t sessionId, CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code)>(
+				[self = shared_from_this(), sessionId](auto handler)
 				{
-					if (!ec)
-					{
-						m_incomingBuffer.insert(m_incomingBuffer.end(),
-							m_tempBuffer.begin(),
-							m_tempBuffer.begin() + length);
+					asio::post(self->m_socket.get_executor(),
+						[self, sessionId, h = std::move(handler)]() mutable
+						{
+							if (!self->isOpen()) {
+								asio::dispatch(asio::append(std::move(h), std::error_code(asio::error::operation_aborted)));
+								return;
+							}
 
-						processBuffer();
+							self->m_sessionWaiters.push_back(std::move(h));
+							cw::packet::Session session;
+							session.sessionId = sessionId;
+							self->send(session);
+						});
+				}, token);
+		}
 
-						doRead();
-					}
-					else {
-						// Socket closed or error
-						std::cout << "[Connection] Disconnected: " << ec.message() << "\n";
-					}
+		// File ranges go to the peer as descriptors (FileRange) instead of bytes:
+		// a local connection to a peer that takes them
+		bool passesDescriptors() const
+		{
+			return m_local && (m_peerFeatures & cw::packet::CAP_DESCRIPTORS) != 0;
+		}
 
-				});
+		// Lets the peer ask for server-side copies (FileCopy) of files under these
+		// directories, which this end can read itself: shared or local storage.
+		// Empty (the default) refuses every copy. Call before start().
+		void setServerCopyRoots(std::vector<fs::path> roots)
+		{
+			m_serverCopyRoots = canonicalRoots(std::move(roots));
 		}
 
-		void processBuffer()
+		// Streams a requested file that resolved inside a download root: the
+		// FileInfo, chunks and FileDone go out on the request's stream (see
+		// cw::serveDownloads, which sends it as uploads are sent)
+		using DownloadSender = std::function<void(std::shared_ptr<Connection>, cw::packet::FileRequest, fs::path)>;
+
+		// Serves the peer the files under these directories that it asks for
+		// (FileRequest), through 'sender'. Paths that resolve (symlinks
+		// followed) outside every root, or to anything but a regular file, are
+		// refused. No roots (the default) refuses every request. Call before start().
+		void setDownloadRoots(std::vector<fs::path> roots, DownloadSender sender)
 		{
-			using namespace cw::packet;
+			m_downloadRoots = canonicalRoots(std::move(roots));
+			m_downloadSender = std::move(sender);
+		}
 
-			while (true)
-			{
-				try
+		// Passes the file streams this connection receives on to 'downstream'
+		// as they arrive, chunk by chunk, for multi-hop topologies across
+		// network zones: a chunk read into a pooled buffer goes back out of
+		// that same buffer, uncopied, and a hop adds the latency of a chunk,
+		// not of a file. With ForwardMode::ForwardOnly nothing lands here and
+		// the next hop's acks and retransmit requests travel back to the
+		// sender, so it still hears from the end of the chain; with WriteToo
+		// this end keeps (and acks) a copy of its own. Holes, directory
+		// manifests and small-file batches are passed on too; resumed, striped,
+		// delta, deduplicated and server-copied files are not, and are written
+		// here as usual. What is announced to the peer is cut to what the next
+		// hop takes. Call before start(), once 'downstream' has its peer's
+		// Capabilities. Not with a handler (setHandler).
+		void forwardTo(std::shared_ptr<Connection> downstream, ForwardMode mode = ForwardMode::WriteToo)
+		{
+			m_downstream = std::move(downstream);
+			m_forwardMode = mode;
+		}
+
+		// Called with the name of every file this connection receives, once
+		// verified and published: streamed, batched or rebuilt from a delta
+		// (that one on the disk pool, the others on this connection's thread).
+		// See cw::FileRelay and cw::file::ContentStore. Several may be set; they
+		// run in the order they were. Call before start().
+		void onFilePublished(std::function<void(fs::path)> fn)
+		{
+			if (!m_onFilePublished) {
+				m_onFilePublished = std::move(fn);
+				return;
+			}
+			m_onFilePublished = [first = std::move(m_onFilePublished), next = std::move(fn)](fs::path path)
+				{
+					first(path);
+					next(std::move(path));
+				};
+		}
+
+		// Delta signatures of this end's copies are taken from 'cache' where
+		// it has them and stored there where not, and every file published is
+		// read into it again on the disk pool, so a delta against a file that
+		// has not changed since needs no read of it (cw::file::SignatureCache).
+		// Call before start().
+		void setSignatureCache(std::shared_ptr<cw::file::SignatureCache> cache)
+		{
+			m_signatureCache = std::move(cache);
+			if (!m_signatureCache) return;
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+			onFilePublished([cache = m_signatureCache, executor = m_diskWriter->executor()](fs::path path)
 				{
-					// A. Attempt Zero-Copy Parse
-					// If buffer is too small (header or body), this THROWS.
-					ParsedFrame view = parseFrame(m_incomingBuffer);
+					asio::post(executor, [cache, path = std::move(path)]() { cache->refresh(path); });
+				});
+		}
 
-					// B. Calculate Total Size (Header + Payload)
-					constexpr size_t HEADER_SIZE = 10;
-					size_t totalFrameSize = HEADER_SIZE + view.size;
+		// Called (on the strand) with the receiver's TransferStats of each
+		// file this end sent: where its time went on the far side, for a
+		// tuner choosing chunk size, streams or compression. They are logged
+		// either way.
+		void onTransferStats(std::function<void(const cw::packet::TransferStats&)> fn) { m_onTransferStats = std::move(fn); }
 
-					// C. Handle the Packet
-					dispatchPacket(view);
+		// The peer serves files it is sent a FileRequest for
+		bool peerServesDownloads() const { return (m_peerFeatures & cw::packet::CAP_DOWNLOADS) != 0; }
 
-					// D. Consume Data (The Shift)
-					m_incomingBuffer.erase(m_incomingBuffer.begin(),
-						m_incomingBuffer.begin() + totalFrameSize);
+		// The peer takes files whose size is only known at their end
+		bool peerTakesUnsizedFiles() const { return (m_peerFeatures & cw::packet::CAP_UNSIZED_FILES) != 0; }
 
-					// E. Exit if empty
-					if (m_incomingBuffer.empty()) break;
-				}
-				catch (const std::runtime_error&)
+		// The peer unpacks archive streams (ArchiveInfo)
+		bool peerTakesArchives() const { return (m_peerFeatures & cw::packet::CAP_ARCHIVES) != 0; }
+
+		// Sends 'request' (its stream id is picked here) and completes with the
+		// bytes written once the file it asked for has arrived, been verified
+		// and been published, as any received file is. Completes with
+		// no_such_file_or_directory if the peer refused the request, with the
+		// write's or illegal_byte_sequence (corrupt) if the file failed, and
+		// with operation_aborted if the connection fails first.
+		template<typename CompletionToken>
+		auto asyncDownload(cw::packet::FileRequest request, CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code, std::uint64_t)>(
+				[self = shared_from_this(), request = std::move(request)](auto handler) mutable
 				{
-					// FRAGMENTATION DETECTED
-					break;
-				}
+					asio::post(self->m_socket.get_executor(),
+						[self, request = std::move(request), h = std::move(handler)]() mutable
+						{
+							if (!self->m_socket.is_open()) {
+								asio::dispatch(asio::append(std::move(h), std::error_code(asio::error::operation_aborted), std::uint64_t{ 0 }));
+								return;
+							}
+
+							// The peer's streams to this end are only ever downloads,
+							// so ids from this end's counter cannot clash with them
+							request.streamId = self->nextStreamId();
+							self->m_downloadWaiters.emplace(request.streamId, std::move(h));
+							self->send(request);
+						});
+				}, token);
+		}
+
+		// The peer copies files it can reach itself when sent a FileCopy
+		bool peerCopiesFiles() const { return (m_peerFeatures & cw::packet::CAP_SERVER_COPY) != 0; }
+
+		// The peer creates the directories of a DirectoryManifest ahead of their files
+		bool peerTakesDirectoryManifests() const { return (m_peerFeatures & cw::packet::CAP_DIRECTORY_MANIFEST) != 0; }
+
+		// The peer compares SubtreeDigests of a sync against its copy
+		bool peerComparesSubtrees() const { return (m_peerFeatures & cw::packet::CAP_SUBTREE_DIGESTS) != 0; }
+
+		// The peer takes FileBatch payloads compressed as one (CompressedBatch),
+		// with the codecs it announced and dictionaries it was sent
+		bool peerTakesCompressedBatches() const { return (m_peerFeatures & cw::packet::CAP_BATCH_COMPRESSION) != 0; }
+
+		// The peer takes FileInfo names front-coded against the previous one
+		// (FrontCodedFileInfo); send() codes them
+		bool peerTakesFrontCodedPaths() const { return (m_peerFeatures & cw::packet::CAP_FRONT_CODED_PATHS) != 0; }
+
+		// The peer sets the mtime and mode of a FileAttributes on the file it closes
+		bool peerSetsAttributes() const { return (m_peerFeatures & cw::packet::CAP_FILE_ATTRIBUTES) != 0; }
+
+		// The peer may refuse a new file while its disk is behind (an Error of
+		// ErrorCode::Busy naming the stream); see busyRetryAfter and busyRedirect
+		bool peerRefusesWhenBusy() const { return (m_peerFeatures & cw::packet::CAP_ADMISSION_CONTROL) != 0; }
+
+		// The peer wants a TransferStats after each file it sends
+		bool peerTakesTransferStats() const { return (m_peerFeatures & cw::packet::CAP_TRANSFER_STATS) != 0; }
+
+		// The peer takes holes of sparse files as FileHole ranges
+		bool peerTakesHoles() const { return (m_peerFeatures & cw::packet::CAP_SPARSE_FILES) != 0; }
+
+		// Files the peer acked are on its stable storage, not just its page cache
+		bool peerAcksDurably() const { return (m_peerFeatures & cw::packet::CAP_DURABLE_ACKS) != 0; }
+
+		// The peer hashes what it receives into a TreeHash and checks a TreeDigest
+		bool peerChecksTreeHash() const { return (m_peerFeatures & cw::packet::CAP_TREE_HASH) != 0; }
+
+		// The peer holds the shared ChunkKey and takes SealedChunk (see setChunkKey)
+		bool peerTakesSealedChunks() const { return (m_peerFeatures & cw::packet::CAP_SEALED_CHUNKS) != 0; }
+
+		// The peer takes a whole small file in its FileInfo (FILE_INFO_CONTENT)
+		bool peerTakesInlineFiles() const { return (m_peerFeatures & cw::packet::CAP_INLINE_FILES) != 0; }
+
+		// Disk pool used for received files. Defaults to a process-wide writer.
+		void setDiskWriter(std::shared_ptr<cw::file::DiskWriter> writer) { m_diskWriter = std::move(writer); }
+
+		// Whose share of the disk writer's threads received files take (see
+		// DiskWriter::enableFairShare). None by default: first come, first served.
+		void setDiskTenant(std::shared_ptr<cw::file::DiskTenant> tenant) { m_diskTenant = std::move(tenant); }
+
+		// Received files are spread over 'volumes', each written by its
+		// volume's writer (see cw::file::VolumeSet); its first volume should be
+		// this connection's writer and working directory. Off unless set.
+		void setVolumes(std::shared_ptr<const cw::file::VolumeSet> volumes) { m_volumes = std::move(volumes); }
+
+		// A new file refused as busy (admission control) is pointed at the
+		// least loaded peer 'gossip' knows to have room, if any (see
+		// cw::network::LoadGossip). Off unless set.
+		void setLoadGossip(std::shared_ptr<const LoadGossip> gossip) { m_loadGossip = std::move(gossip); }
+
+		// Answers the peer's StatsRequests with 'registry' (see statsText),
+		// the files this connection's transfer registry holds and its disk
+		// writer's load. Off unless set; call before start().
+		void serveStats(std::shared_ptr<cw::metrics::MetricsRegistry> registry) { m_statsRegistry = std::move(registry); }
+
+		// Where striped uploads are joined. Defaults to a process-wide registry.
+		void setTransferRegistry(std::shared_ptr<cw::file::TransferRegistry> registry) { m_transferRegistry = std::move(registry); }
+
+		// Where the sessions of reconnecting peers are looked up (see
+		// cw::packet::Session). Defaults to a process-wide table.
+		void setSessionTable(std::shared_ptr<SessionTable> sessions) { m_sessions = std::move(sessions); }
+
+		// Content-addressed store used by dedup uploads. Defaults to .cwstore in
+		// the working directory.
+		void setChunkStore(std::shared_ptr<cw::file::ChunkStore> store) { m_chunkStore = std::move(store); }
+
+		// Hands received packets to 'handler' instead of the built-in file
+		// receiver: each packet it has an onPacket(Connection&, P) overload for.
+		// Everything else (acks, replies to this side's requests, packets it
+		// does not take) keeps the built-in handling. The dispatch table is
+		// generated for H at compile time: no virtual calls. Set before start();
+		// the handler runs on this connection's strand.
+		template<typename H>
+		void setHandler(std::shared_ptr<H> handler)
+		{
+			m_handler = std::move(handler);
+			m_dispatch = &dispatchTo<H>;
+			if constexpr (HandlesClose<H>) {
+				m_handlerClosed = [](Connection& conn, std::error_code ec) { static_cast<H*>(conn.m_handler.get())->onClosed(conn, ec); };
 			}
 		}
 
-		void doWrite(std::vector<uint8_t> frame)
+		// For handlers: the bytes of the packet being handled (a FileChunkView's
+		// data) as a buffer the handler may keep, uncopied when they came in a
+		// large frame of their own (see retainPayload)
+		cw::buffer::SharedBuffer keepPayload(std::span<const uint8_t> bytes) const { return retainPayload(bytes); }
+
+		// For handlers whose consumer is behind: stops reading the socket, so
+		// TCP flow control slows the sender down, until resumeReading().
+		// pauseReading on the strand, resumeReading from any thread.
+		void pauseReading() { m_readPaused = true; }
+
+		void resumeReading()
 		{
-			m_queueSize += frame.size();
+			asio::dispatch(m_socket.get_executor(), [this, self = shared_from_this()]()
+				{
+					// Paused for more than one reason: the read loop is already back
+					if (!m_readPaused) return;
+					m_readPaused = false;
+					if (!m_socket.is_open()) return;
+					if (processBuffer() && !m_readPaused) doRead();
+				});
+		}
 
-			m_writeQueue.push_back(std::move(frame));
+		// Socket reads pause while more than this many bytes wait for the disk
+		void setMaxPendingDiskBytes(std::size_t bytes) { m_maxPendingDiskBytes = bytes; }
 
-			if (m_writeQueue.size() > 1) return;
-			writeQueueFront();
+		// Charges the send queue, receive buffer and write-behind queues of this
+		// connection to 'budget' (cw::buffer::MemoryBudget::defaultInstance()
+		// otherwise), under a quota of its own of 'quota' bytes (0: none). Over
+		// either, producers are held at the low watermark and reads pause until
+		// this connection's chunks are on disk. Call before start().
+		void setMemoryBudget(std::shared_ptr<cw::buffer::MemoryBudget> budget, std::size_t quota = 0)
+		{
+			m_memory = std::make_shared<cw::buffer::MemoryAccount>(std::move(budget), quota);
+		}
+
+		void setMemoryQuota(std::size_t bytes) { m_memory->setQuota(bytes); }
+
+		// What this connection holds, by use
+		const cw::buffer::MemoryAccount& memory() const { return *m_memory; }
+
+		// Upper bound on bytes gathered into a single socket write
+		void setMaxWriteBatchBytes(std::size_t bytes) { m_maxWriteBatchBytes = bytes; }
 
+		// Backpressure thresholds (bytes queued but not yet written).
+		// Producers stop above 'high' and are woken once the queue drains to 'low'.
+		void setWatermarks(std::size_t low, std::size_t high)
+		{
+			m_lowWatermark = low;
+			m_highWatermark = high;
 		}
 
-		// The actual Async Write call
-		void writeQueueFront()
+		// Caps what this connection writes to 'bytesPerSecond' (0 = no cap),
+		// paced as small evenly spaced writes rather than bursts. Any thread,
+		// any time; takes effect from the next write.
+		void setRateLimit(std::uint64_t bytesPerSecond) { m_rateLimiter.setRate(bytesPerSecond); }
+		std::uint64_t rateLimit() const { return m_rateLimiter.rate(); }
+
+		// Also holds writes to 'limiter', shared with other connections: a cap
+		// for a whole server or ClientPool, or for the process. Writes wait for
+		// the slowest limiter they are under. Call before start().
+		void addRateLimiter(std::shared_ptr<RateLimiter> limiter)
 		{
-			auto self = shared_from_this();
-			asio::async_write(m_socket,
-				asio::buffer(m_writeQueue.front()),
-				[this, self](std::error_code ec, std::size_t length)
-				{
-					if (!ec)
-					{
-						// TRACKING: Subtract size (packet sent)
-						m_queueSize -= m_writeQueue.front().size();
+			if (limiter) m_sharedLimiters.push_back(std::move(limiter));
+		}
 
-						m_writeQueue.pop_front();
+		// Frames of each priority class are held back separately: a background
+		// upload filling its share of the queue does not stall urgent producers
+		bool isCongested(Priority priority = Priority::Normal) const
+		{
+			// If we have more than the high watermark pending in RAM, tell the file reader to wait.
+			// Over the memory quota or budget the low watermark is the limit: asyncWaitWritable
+			// still wakes once this class drains to it, whatever other connections hold.
+			std::size_t queued = m_classQueued[classOf(priority)];
+			return queued > m_highWatermark || (queued > m_lowWatermark && m_memory->constrained());
+		}
 
-						if (!m_writeQueue.empty()) writeQueueFront();
-					}
+		std::size_t queuedBytes() const { return m_queueSize; }
 
-					else
-					{
-						std::cerr << "[Connection] Write Error: " << ec.message() << "\n";
-						m_socket.close();
-					}
-				});
+		// Reads, writes and flushes whose state went to the heap rather than
+		// this connection's handler memory: none in steady state
+		std::size_t handlerHeapAllocations() const
+		{
+			return m_readMemory.misses() + m_writeMemory.misses() + m_flushMemory.misses();
 		}
 
-		// 4. THE ROUTER (Business Logic)
-		void dispatchPacket(const cw::packet::ParsedFrame& view)
+		// Sends made with MSG_ZEROCOPY: large payloads once SO_ZEROCOPY is set
+		// on the socket (SocketOptions::zeroCopy), until the kernel says it
+		// copies them anyway. Their frames are held until it is done with them.
+		std::size_t zeroCopySends() const
 		{
-			using namespace cw::packet;
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+			return m_zeroCopy.sent();
+#else
+			return 0;
+#endif
+		}
 
-			switch (view.type)
-			{
-			case PacketType::Ack:
-			{
-				auto pkt = Ack::deserialize(view.payload_view, view.size);
-				std::cout << "[Recv] Ack (Offset: " << pkt.offset << ")\n";
-				break;
-			}
-			case PacketType::FileInfo:
-			{
-				auto pkt = FileInfo::deserialize(view.payload_view, view.size);
-				std::cout << "[Recv] Starting Download: " << pkt.fileName << " (" << pkt.fileSize << " bytes)\n";
+		// Traffic counters of this connection (see cw::metrics::MetricsRegistry)
+		std::shared_ptr<cw::metrics::ConnectionMetrics> metrics() const { return m_metrics; }
 
-				// [FIX] Handle Directories & 1-1 Mapping
-				// 1. Convert to filesystem path
-				fs::path targetPath(pkt.fileName);
+		// Completes once the frames of 'priority' queued here are at or below
+		// the low watermark (immediately if they already are). Completes with
+		// operation_aborted if the connection fails first. Works with callbacks,
+		// use_awaitable, use_future...
+		template<typename CompletionToken>
+		auto asyncWaitWritable(Priority priority, CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code)>(
+				[self = shared_from_this(), priority](auto handler)
+				{
+					asio::post(self->m_socket.get_executor(),
+						[self, priority, h = std::move(handler)]() mutable
+						{
+							if (!self->m_socket.is_open()) {
+								asio::dispatch(asio::append(std::move(h), std::error_code(asio::error::operation_aborted)));
+							}
+							else if (self->m_classQueued[classOf(priority)] <= self->m_lowWatermark) {
+								asio::dispatch(asio::append(std::move(h), std::error_code{}));
+							}
+							else {
+								self->m_writableWaiters.push_back({ priority, std::move(h) });
+							}
+						});
+				}, token);
+		}
 
-				// 2. Create parent directories if they don't exist
-				if (targetPath.has_parent_path()) {
-					std::error_code ec;
-					fs::create_directories(targetPath.parent_path(), ec);
-					if (ec) {
-						std::cerr << "[Error] Failed to create directory: " << ec.message() << "\n";
+		template<typename CompletionToken>
+		auto asyncWaitWritable(CompletionToken&& token)
+		{
+			return asyncWaitWritable(Priority::Normal, std::forward<CompletionToken>(token));
+		}
+
+		// send() for coroutines and other composed operations: queues 'packet'
+		// once its class is no longer congested (at once if it is not), so a
+		// producer awaiting each send never runs ahead of the socket, e.g.
+		//   co_await conn->asyncSend(chunk, asio::use_awaitable);
+		// Completes with operation_aborted, nothing queued, if the connection
+		// fails first. Receiving is cw::network::PacketChannel.
+		template<typename PacketT, typename CompletionToken>
+		auto asyncSend(PacketT packet, Priority priority, CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code)>(
+				[self = shared_from_this(), priority](auto handler, PacketT packet) mutable
+				{
+					if (!self->isOpen()) {
+						asio::post(asio::append(std::move(handler), std::error_code(asio::error::operation_aborted)));
+						return;
 					}
-				}
+					if (!self->isCongested(priority)) {
+						self->send(std::move(packet), priority);
+						asio::post(asio::append(std::move(handler), std::error_code{}));
+						return;
+					}
+					self->asyncWaitWritable(priority, [self, priority, packet = std::move(packet), h = std::move(handler)](std::error_code ec) mutable
+						{
+							if (!ec) self->send(std::move(packet), priority);
+							asio::dispatch(asio::append(std::move(h), ec));
+						});
+				}, token, std::move(packet));
+		}
+
+		template<typename PacketT, typename CompletionToken>
+		auto asyncSend(PacketT packet, CompletionToken&& token)
+		{
+			return asyncSend(std::move(packet), Priority::Normal, std::forward<CompletionToken>(token));
+		}
+
+		// Completes once the peer's Capabilities have arrived, so what it offers
+		// (server-side copy, descriptors, codecs) is known before an upload
+		// starts. Completes with operation_aborted if the connection fails first.
+		template<typename CompletionToken>
+		auto asyncWaitCapabilities(CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code)>(
+				[self = shared_from_this()](auto handler)
+				{
+					asio::post(self->m_socket.get_executor(),
+						[self, h = std::move(handler)]() mutable
+						{
+							if (self->m_peerAnnounced) {
+								asio::dispatch(asio::append(std::move(h), std::error_code{}));
+							}
+							else if (!self->m_socket.is_open()) {
+								asio::dispatch(asio::append(std::move(h), std::error_code(asio::error::operation_aborted)));
+							}
+							else {
+								self->m_capabilityWaiters.emplace_back(std::move(h));
+							}
+						});
+				}, token);
+		}
 
-				// 3. Open File (Exact path, no prefix)
-				m_outFile.open(targetPath, std::ios::binary);
+		// Graceful close: once every frame queued so far is written, stops
+		// sending (a half-close, so the peer reads to the end and then sees
+		// EOF) and completes when the peer closes its side too. Its acks for
+		// what it still finishes arrive meanwhile. Completes with
+		// operation_aborted if the connection fails before the half-close.
+		template<typename CompletionToken>
+		auto asyncClose(CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code)>(
+				[self = shared_from_this()](auto handler)
+				{
+					asio::post(self->m_socket.get_executor(),
+						[self, h = std::move(handler)]() mutable
+						{
+							if (!self->isOpen()) {
+								std::error_code ec = self->m_sendClosed ? std::error_code{} : std::error_code(asio::error::operation_aborted);
+								asio::dispatch(asio::append(std::move(h), ec));
+								return;
+							}
+							self->m_closeWaiters.emplace_back(std::move(h));
+							self->m_closing = true;
+							self->flushAcks();
+							self->closeSendingIfFlushed();
+						});
+				}, token);
+		}
+
+		// Blocking variant for producer threads. Must NOT be called from the io_context thread.
+		std::error_code waitWritable(Priority priority = Priority::Normal)
+		{
+			std::promise<std::error_code> ready;
+			auto result = ready.get_future();
+			asyncWaitWritable(priority, [&ready](std::error_code ec) { ready.set_value(ec); });
+			return result.get();
+		}
 
-				if (!m_outFile.is_open()) {
-					std::cerr << "[Error] Could not open file for writing: " << targetPath << "\n";
+		// Queues 'packet' in the class 'priority': frames of one class go out in
+		// the order sent, classes share the socket by weight (see scheduleBatch).
+		// Frames that must stay in order go in one class. A FileChunk passed as
+		// an rvalue hands over its buffer as the frame's payload, uncopied. A
+		// FileInfo without extensions leaves as a FrontCodedFileInfo to a peer
+		// that takes them.
+		template<typename PacketT>
+		void send(PacketT&& packet, Priority priority = Priority::Normal)
+		{
+			if constexpr (std::is_same_v<std::decay_t<PacketT>, cw::packet::FileInfo> || std::is_same_v<std::decay_t<PacketT>, cw::packet::FileInfoView>) {
+				if (peerTakesFrontCodedPaths() && packet.extensions.empty()) {
+					sendFrontCoded(packet.streamId, packet.fileSize, packet.fileName, priority);
 					return;
 				}
-
-				m_expectedSize = pkt.fileSize;
-				m_receivedBytes = 0;
-				break;
 			}
-			case PacketType::FileChunk:
-			{
-				// 2. Write Chunk
-				if (!m_outFile.is_open()) return;
 
-				auto pkt = FileChunk::deserialize(view.payload_view, view.size);
+			std::uint32_t streamId = dataStreamOf(packet);
+			cw::packet::OutgoingFrame frame;
+			{
+				cw::metrics::StageTimer stage(cw::metrics::Stage::Serialize);
+				frame = cw::packet::buildOutgoingFrame(std::forward<PacketT>(packet), frameFormat());
+			}
+			frame.enqueuedAt = cw::metrics::Clock::now();
+			frame.priority = priority;
+			frame.streamId = streamId;
+			frame.keepalive = std::is_same_v<std::decay_t<PacketT>, cw::packet::Ping> || std::is_same_v<std::decay_t<PacketT>, cw::packet::Pong>;
+			CW_TRACE(frame__queued, this, static_cast<unsigned>(std::decay_t<PacketT>::type), frame.size(), classOf(priority));
 
-				// Using seekp handles out-of-order packets if we add parallel sending later
-				m_outFile.seekp(pkt.offset);
-				m_outFile.write(reinterpret_cast<const char*>(pkt.data.data()), pkt.data.size());
+			account(priority, frame.size());
+			if (m_inlineSends && onOwnStrand()) {
+				sendInline(std::move(frame));
+				return;
+			}
+			m_submissions.push(std::move(frame));
+			if (!m_flushPosted.exchange(true, std::memory_order_acq_rel)) postFlush();
+		}
 
-				m_receivedBytes += pkt.data.size();
-				break;
+		// Acks 'offset' of stream 'streamId' (progress of a received stream, or
+		// its end). To a peer that takes AckBatch the ack waits up to the ack
+		// delay: a later ack of the same stream replaces it, and whatever is
+		// pending leaves as one frame ahead of the next frame this end writes,
+		// or when the delay runs out. Acks that answer a request (a FileResume,
+		// a FileCopy) go with send(). Any thread.
+		void sendAck(std::uint32_t streamId, std::uint64_t offset)
+		{
+			if (m_ackDelay.count() == 0 || !peerTakesAckBatches()) {
+				cw::packet::Ack ack;
+				ack.streamId = streamId;
+				ack.offset = offset;
+				send(ack);
+				return;
 			}
-			case PacketType::FileDone:
-			{
-				// 3. Finish
-				auto pkt = FileDone::deserialize(view.payload_view, view.size);
-				if (m_outFile.is_open()) {
-					m_outFile.close();
-					std::cout << "[Recv] File Download Complete.\n";
-				}
+			asio::dispatch(m_socket.get_executor(), [self = shared_from_this(), streamId, offset]() { self->delayAck(streamId, offset); });
+		}
 
-				if (m_receivedBytes == pkt.fileSize) {
-					std::cout << "[Check] Integrity Validated (" << m_receivedBytes << " bytes).\n";
+		// Holds back socket writes while a burst of packets is queued (a
+		// FileInfo, the chunk of a small file and its FileDone), so they leave
+		// together in full segments instead of each in its own as the write
+		// loop catches them. Nestable, from any thread; the last uncork()
+		// flushes. Frames past the high watermark are written anyway, so a
+		// producer waiting for room while corked is not stuck. Hold it only
+		// while queuing, not across waits for acks.
+		void cork() { m_corks.fetch_add(1, std::memory_order_acq_rel); }
 
-					// Send Ack back to client
-					Ack ack;
-					ack.offset = m_receivedBytes;
-					send(ack);
-				}
-				else {
-					std::cerr << "[Check] CORRUPTION DETECTED! Expected " << pkt.fileSize << " but got " << m_receivedBytes << "\n";
-				}
-				break;
-			}
-			case PacketType::Error:
+		void uncork()
+		{
+			if (m_corks.fetch_sub(1, std::memory_order_acq_rel) == 1 && !m_flushPosted.exchange(true, std::memory_order_acq_rel)) postFlush();
+		}
+
+		// cork() for a scope
+		class Cork
+		{
+		public:
+			explicit Cork(std::shared_ptr<Connection> conn) : m_conn(std::move(conn)) { if (m_conn) m_conn->cork(); }
+			~Cork() { release(); }
+			Cork(const Cork&) = delete;
+			Cork& operator=(const Cork&) = delete;
+
+			// Uncorks before the scope ends
+			void release()
 			{
-				auto pkt = Error::deserialize(view.payload_view, view.size);
-				std::cerr << "[Recv] Error: " << pkt.message << "\n";
-				break;
+				if (m_conn) std::exchange(m_conn, nullptr)->uncork();
 			}
-			default:
-				std::cout << "[Recv] Unknown Packet Type: " << (int)view.type << "\n";
+
+		private:
+			std::shared_ptr<Connection> m_conn;
+		};
+
+		// An empty batch for sendBatch, framed as send() would frame its packets
+		FrameBatch makeBatch(Priority priority = Priority::Normal) const { return FrameBatch(frameFormat(), priority); }
+
+		// Queues every packet of 'batch', in order, with one accounting step,
+		// one append to the submission queue and at most one post; the write
+		// scheduler then gathers them into as few socket writes as fit.
+		// Leaves 'batch' empty, ready for more.
+		void sendBatch(FrameBatch& batch)
+		{
+			if (batch.empty()) return;
+
+			auto now = cw::metrics::Clock::now();
+			for (auto& frame : batch.m_frames) frame.enqueuedAt = now;
+			CW_TRACE(batch__queued, this, batch.m_frames.size(), batch.m_bytes);
+
+			account(batch.m_priority, batch.m_bytes);
+			m_submissions.pushRange(std::make_move_iterator(batch.m_frames.begin()), batch.m_frames.size());
+			batch.m_frames.clear();
+			batch.m_bytes = 0;
+			if (!m_flushPosted.exchange(true, std::memory_order_acq_rel)) postFlush();
+		}
+
+		// Every packet of 'packets' (all of one type) as one batch; an rvalue
+		// range gives up its packets' buffers as send() does
+		template<std::ranges::input_range R>
+		void sendRange(R&& packets, Priority priority = Priority::Normal)
+		{
+			auto batch = makeBatch(priority);
+			for (auto&& packet : packets) {
+				if constexpr (std::is_lvalue_reference_v<R>) batch.add(std::as_const(packet));
+				else batch.add(std::move(packet));
 			}
+			sendBatch(batch);
 		}
 
-		Connection(asio::io_context& io) :
-			m_socket(io)
+		// Fresh stream id for a file sent on this connection (see FileInfo).
+		// Acks for it are tracked until releaseStream().
+		std::uint32_t allocateStreamId()
 		{
-			// std::array is POD, no need to init explicitly but {} is fine
-			m_tempBuffer = {};
-			m_incomingBuffer.reserve(8192);
+			return openStream(nextStreamId());
 		}
 
+		// allocateStreamId for a stream whose id the peer picked: a download
+		// it asked for (FileRequest)
+		std::uint32_t openStream(std::uint32_t streamId)
+		{
+			// Posted before the FileInfo is, so it is in place before any ack arrives
+			asio::post(m_socket.get_executor(), [self = shared_from_this(), streamId]() { self->m_ackedOffsets.emplace(streamId, 0); });
+			return streamId;
+		}
 
-	private:
-		asio::ip::tcp::socket m_socket;
+		// Completes once the peer has acked at least 'offset' bytes of 'streamId'
+		// (the sender's ack window), or at once for a released stream. Completes
+		// with operation_aborted if the connection fails first, with the
+		// receiver's error if it fails the stream (see streamError).
+		template<typename CompletionToken>
+		auto asyncWaitAcked(std::uint32_t streamId, std::uint64_t offset, CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code)>(
+				[self = shared_from_this(), streamId, offset](auto handler)
+				{
+					asio::post(self->m_socket.get_executor(),
+						[self, streamId, offset, h = std::move(handler)]() mutable
+						{
+							// Failed, the socket possibly still open to flush: no ack is coming
+							if (!self->isOpen()) {
+								asio::dispatch(asio::append(std::move(h), std::error_code(asio::error::operation_aborted)));
+							}
+							else if (std::error_code failed = self->streamError(streamId)) {
+								asio::dispatch(asio::append(std::move(h), failed));
+							}
+							else if (auto it = self->m_ackedOffsets.find(streamId); it == self->m_ackedOffsets.end() || it->second >= offset) {
+								asio::dispatch(asio::append(std::move(h), std::error_code{}));
+							}
+							else {
+								self->m_ackWaiters.push_back({ streamId, offset, std::move(h) });
+							}
+						});
+				}, token);
+		}
 
-		std::array<uint8_t, 8192> m_tempBuffer;
-		std::vector<uint8_t> m_incomingBuffer;
-		std::deque<std::vector<uint8_t>> m_writeQueue;
-		std::atomic<size_t> m_queueSize = 0;
-		// --- File Transfer State ---
-		std::ofstream m_outFile;
-		std::uint64_t m_expectedSize = 0;
-		std::uint64_t m_receivedBytes = 0;
+		// Sends 'resume' and completes with the offset of the first ack for its
+		// stream: where the receiver wants the upload to continue. Completes with
+		// operation_aborted if the connection fails first.
+		template<typename CompletionToken>
+		auto asyncSendResume(cw::packet::FileResume resume, CompletionToken&& token)
+		{
+			return asyncSendOpening(std::move(resume), std::forward<CompletionToken>(token));
+		}
+
+		// Blocking variant for producer threads. Must NOT be called from the io_context thread.
+		std::error_code sendResume(const cw::packet::FileResume& resume, std::uint64_t& offset)
+		{
+			return sendOpening(resume, offset);
+		}
+
+		// Sends 'copy' and completes with the offset of the first ack for its
+		// stream: how much the receiver copied itself, the rest is to be sent.
+		// Completes with operation_aborted if the connection fails first.
+		template<typename CompletionToken>
+		auto asyncSendCopy(cw::packet::FileCopy copy, CompletionToken&& token)
+		{
+			return asyncSendOpening(std::move(copy), std::forward<CompletionToken>(token));
+		}
+
+		// Blocking variant for producer threads. Must NOT be called from the io_context thread.
+		std::error_code sendCopy(const cw::packet::FileCopy& copy, std::uint64_t& offset)
+		{
+			return sendOpening(copy, offset);
+		}
+
+		// Sends 'manifest' (its requestId is assigned here) and completes with the
+		// indices of the entries the peer wants sent: its ManifestDiff.
+		template<typename CompletionToken>
+		auto asyncRequestDiff(cw::packet::Manifest manifest, CompletionToken&& token)
+		{
+			return asyncRequest<std::vector<std::uint32_t>>(std::move(manifest), std::forward<CompletionToken>(token));
+		}
+
+		// Sends 'digests' (its requestId is assigned here) and completes with the
+		// indices of the directories whose copy on the peer differs: its ManifestDiff.
+		template<typename CompletionToken>
+		auto asyncRequestSubtreeDiff(cw::packet::SubtreeDigests digests, CompletionToken&& token)
+		{
+			return asyncRequest<std::vector<std::uint32_t>>(std::move(digests), std::forward<CompletionToken>(token));
+		}
+
+		// The peer answers a StatsRequest
+		bool peerServesStats() const { return (m_peerFeatures & cw::packet::CAP_STATS) != 0; }
+
+		// Asks the peer for its live counters and completes with them, in the
+		// Prometheus text format (see statsText). Completes with
+		// operation_not_supported if the peer does not serve them, and with
+		// operation_aborted if the connection fails first.
+		template<typename CompletionToken>
+		auto asyncQueryStats(CompletionToken&& token)
+		{
+			return asyncRequest<std::string>(cw::packet::StatsRequest{}, std::forward<CompletionToken>(token), &Connection::peerServesStats);
+		}
+
+		// Delta mode: sends 'request' (its requestId is assigned here) and completes
+		// with the block signatures of the peer's copy of the file.
+		template<typename CompletionToken>
+		auto asyncRequestSignatures(cw::packet::SignatureRequest request, CompletionToken&& token)
+		{
+			return asyncRequest<cw::packet::Signatures>(std::move(request), std::forward<CompletionToken>(token));
+		}
+
+		// Sends 'request' (its requestId is assigned here) and completes with
+		// the Result its reply carries, once the onPacket for the reply type
+		// hands that to m_requests.complete under the echoed id. Requests are
+		// pipelined: send any number without waiting, the replies complete
+		// them in whatever order they come. Completes with operation_aborted
+		// if the connection fails first, and with operation_not_supported if
+		// 'supported' (a peer capability) is given and false. A new kind of
+		// request is a packet pair with a requestId and one onPacket line.
+		template<typename Result, typename Request, typename CompletionToken>
+		auto asyncRequest(Request request, CompletionToken&& token, bool (Connection::*supported)() const = nullptr)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code, Result)>(
+				[self = shared_from_this(), request = std::move(request), supported](auto handler) mutable
+				{
+					asio::post(self->m_socket.get_executor(),
+						[self, request = std::move(request), supported, h = std::move(handler)]() mutable
+						{
+							if (!self->m_socket.is_open()) {
+								asio::dispatch(asio::append(std::move(h), std::error_code(asio::error::operation_aborted), Result{}));
+								return;
+							}
+							if (supported && !((*self).*supported)()) {
+								asio::dispatch(asio::append(std::move(h), std::make_error_code(std::errc::operation_not_supported), Result{}));
+								return;
+							}
+
+							request.requestId = self->m_requests.nextId();
+							self->m_requests.add<Result>(request.requestId, std::move(h));
+							self->send(request);
+						});
+				}, token);
+		}
+
+		// Dedup mode: sends 'manifest' (starting its stream) and completes with the
+		// indices of the chunks the peer's store lacks: its ChunkRequest.
+		template<typename CompletionToken>
+		auto asyncSendChunkManifest(cw::packet::ChunkManifest manifest, CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code, std::vector<std::uint32_t>)>(
+				[self = shared_from_this(), manifest = std::move(manifest)](auto handler) mutable
+				{
+					asio::post(self->m_socket.get_executor(),
+						[self, manifest = std::move(manifest), h = std::move(handler)]() mutable
+						{
+							if (!self->m_socket.is_open()) {
+								asio::dispatch(asio::append(std::move(h), std::error_code(asio::error::operation_aborted), std::vector<std::uint32_t>{}));
+								return;
+							}
+
+							self->m_chunkRequestWaiters.emplace(manifest.streamId, std::move(h));
+							self->send(manifest);
+						});
+				}, token);
+		}
+
+		// Blocking variant for producer threads. Must NOT be called from the io_context thread.
+		std::error_code waitAcked(std::uint32_t streamId, std::uint64_t offset)
+		{
+			std::promise<std::error_code> ready;
+			auto result = ready.get_future();
+			asyncWaitAcked(streamId, offset, [&ready](std::error_code ec) { ready.set_value(ec); });
+			return result.get();
+		}
+
+		// Drops the ack state of a stream the sender has finished with (or
+		// given up on); later acks for it are ignored.
+		void releaseStream(std::uint32_t streamId)
+		{
+			asio::post(m_socket.get_executor(), [self = shared_from_this(), streamId]()
+				{
+					self->m_ackedOffsets.erase(streamId);
+					{
+						std::lock_guard lock(self->m_failedStreamsMutex);
+						self->m_failedStreams.erase(streamId);
+					}
+					self->notifyAcked({});
+				});
+		}
+
+		// Why the receiver failed outgoing stream 'streamId' (an Error naming
+		// it: disk full, rejected, checksum mismatch), or no error. The
+		// stream's frames still queued have been dropped and later ones are;
+		// the sender stops and releases the stream. Any thread.
+		std::error_code streamError(std::uint32_t streamId) const
+		{
+			if (!m_anyStreamFailed.load(std::memory_order_acquire)) return {};
+			std::lock_guard lock(m_failedStreamsMutex);
+			auto it = m_failedStreams.find(streamId);
+			return it == m_failedStreams.end() ? std::error_code{} : it->second;
+		}
+
+		// How long the peer asked to wait in its latest Busy refusal, 0 before one
+		std::chrono::milliseconds busyRetryAfter() const { return std::chrono::milliseconds(m_busyRetryAfterMs.load(std::memory_order_relaxed)); }
+
+		// The peer server (host:port) the latest Busy refusal sent us to,
+		// empty if it named none
+		std::string busyRedirect() const
+		{
+			std::lock_guard lock(m_busyRedirectMutex);
+			return m_busyRedirect;
+		}
+
+		// Lets the peer's Retransmit requests for 'streamId' be served from 'path'
+		// (re-read on the disk pool) until it acks all 'fileSize' bytes or the
+		// connection closes. Call before the stream's first chunk is sent.
+		void serveRetransmits(std::uint32_t streamId, fs::path path, std::uint64_t fileSize, std::uint64_t baseOffset = 0)
+		{
+			asio::post(m_socket.get_executor(), [self = shared_from_this(), streamId, path = std::move(path), fileSize, baseOffset]() mutable
+				{
+					self->m_retransmitSources[streamId] = { std::move(path), fileSize, baseOffset };
+				});
+		}
+
+		// For sources that cannot be read again (see cw::asyncSendStream): the
+		// peer's Retransmit requests for this chunk of 'streamId' are served
+		// from 'data', kept until the peer acks past it or the connection closes
+		void keepForRetransmit(std::uint32_t streamId, std::uint64_t offset, cw::buffer::SharedBuffer data)
+		{
+			asio::post(m_socket.get_executor(), [self = shared_from_this(), streamId, offset, data = std::move(data)]() mutable
+				{
+					self->m_retainedChunks[streamId].push_back({ offset, std::move(data) });
+				});
+		}
+
+		// Credits the peer's acks of 'streamId' to 'progress' until it is acked
+		// to its end. Call before the stream's first chunk is sent; a striped
+		// file passes the same 'progress' on each of its connections.
+		void reportProgress(std::uint32_t streamId, std::shared_ptr<cw::metrics::StreamProgress> progress)
+		{
+			asio::post(m_socket.get_executor(), [self = shared_from_this(), streamId, progress = std::move(progress)]() mutable
+				{
+					// Other stripes of files acked on another connection
+					std::erase_if(self->m_streamProgress, [](const auto& entry) { return entry.second->done(); });
+					self->m_streamProgress[streamId] = std::move(progress);
+				});
+		}
+
+		// Credits the ack of the next FileBatch sent here ('files' files) to
+		// 'progress'. Batches are acked in the order they were sent; call
+		// before sending it.
+		void reportBatchProgress(std::shared_ptr<cw::metrics::TransferProgress> progress, std::uint64_t files)
+		{
+			asio::post(m_socket.get_executor(), [self = shared_from_this(), progress = std::move(progress), files]() mutable
+				{
+					self->m_batchProgress.push_back({ std::move(progress), files });
+				});
+		}
+
+		// Sends 'dictionary' (BatchDictionary) unless this connection has sent
+		// it before. Call ahead of each CompressedBatch that names it, with
+		// the batch's priority, so it is queued first.
+		void shareDictionary(const cw::compression::Dictionary& dictionary, cw::packet::Priority priority = cw::packet::Priority::Normal)
+		{
+			std::lock_guard lock(m_dictionaryMutex);
+			if (!m_sharedDictionaries.insert(dictionary.id()).second) return;
+
+			cw::packet::BatchDictionary packet;
+			packet.dictionaryId = dictionary.id();
+			packet.data.assign(dictionary.bytes().begin(), dictionary.bytes().end());
+			send(std::move(packet), priority);
+		}
+
+		// What this end asks of senders in its Capabilities: chunks of at most
+		// 'maxChunkSize' bytes and at most 'receiveWindow' unacked bytes per
+		// file (0 = no preference). Call before start().
+		void setReceiveLimits(std::uint32_t maxChunkSize, std::uint64_t receiveWindow)
+		{
+			m_maxChunkSize = maxChunkSize;
+			m_receiveWindow = receiveWindow;
+		}
+
+		// Closes the connection once nothing has been read or written for
+		// 'timeout' (0 = never), unless it is only quiet because reads are
+		// paused for the disk or a write is stuck. Pings and Pongs (see
+		// setHeartbeat) do not count. Call before start().
+		void setIdleTimeout(std::chrono::steady_clock::duration timeout) { m_idleTimeout = timeout; }
+
+		// Fails an incoming file that has received nothing for 'timeout' (0 =
+		// never) with an Error naming its stream, so the sender stops too.
+		// Time with reads paused for the disk does not count. Call before start().
+		void setStallTimeout(std::chrono::steady_clock::duration timeout) { m_stallTimeout = timeout; }
+
+		// Pings the peer after 'interval' without a frame from it, and closes
+		// the connection once 'missed' intervals have passed in silence: a
+		// peer gone without closing (a half-open connection) is found in
+		// seconds, and its buffers and open files are let go. Only with a
+		// peer that answers Pings; time with reads paused for the disk does
+		// not count. 0 = off. Call before start().
+		void setHeartbeat(std::chrono::steady_clock::duration interval, unsigned missed = 3)
+		{
+			m_heartbeatInterval = interval;
+			m_heartbeatMissed = std::max(1u, missed);
+		}
+
+		// Every chunk received is also hashed into its stream's TreeHash, on
+		// this connection's thread, and checked against the sender's
+		// TreeDigest (CAP_TREE_HASH). Call before start().
+		void setTreeHash(bool enabled) { m_treeHash = enabled; }
+
+		// Per-chunk encryption for transports TLS does not cover (UdpTunnel,
+		// relays): the peer is told it may send SealedChunks under 'key'
+		// (CAP_SEALED_CHUNKS), which are opened where compressed chunks are
+		// decompressed, on the disk side; and file data in the clear
+		// (FileChunk, CompressedChunk, batches of small files, a FileInfo
+		// carrying its file) closes the connection. Names and sizes still
+		// go in the clear. Needs a build with OpenSSL
+		// (ChunkCipher::available). Call before start().
+		void setChunkKey(std::shared_ptr<const cw::integrity::ChunkKey> key) { m_chunkKey = std::move(key); }
+
+		// Linux: the data of large chunks sent without a CRC (the sender's
+		// sendfile path) goes socket -> pipe -> file with splice(2), never
+		// copied into this process; the disk pool moves it from the pipe at
+		// the chunk's offset. Chunks with a CRC, or for a handler, a relay, a
+		// dedup or tree-hashed stream, are read as before. Call before start().
+		void setSpliceReceive(bool enabled) { m_spliceReceive = enabled; }
+
+		// Linux: the data of chunks of MappedReceive::MIN_CHUNK or more is
+		// received with TCP_ZEROCOPY_RECEIVE, its pages mapped into this
+		// process rather than copied, and written from there; what cannot map
+		// is read with recv. CRCs are checked on the mapping. Streams the
+		// splice path takes (setSpliceReceive) go that way; the rest as for
+		// setSpliceReceive. A socket the kernel cannot map keeps the normal
+		// reads. Call before start().
+		void setZeroCopyReceive(bool enabled) { m_zeroCopyReceive = enabled; }
+
+		// Windows, built with CW_USE_REGISTERED_IO: frames are sent through
+		// Registered I/O (RegisteredIo) instead of overlapped WSASend, cheaper
+		// per send for many small frames. The socket must have been opened
+		// for it (SocketOptions::registeredIo); on one that was not, and on
+		// other builds, sends stay as they were. Reads, file bodies
+		// (TransmitFile) and descriptors keep their paths. Call before start().
+		void setRegisteredIo(bool enabled) { m_registeredIoWanted = enabled; }
+
+		// send() from the connection's own strand skips the hand-off: the
+		// frame goes straight to the class queues and, with no write in
+		// flight, out at once, without a posted flush. For a shard's
+		// connections, whose senders (but the disk and work pools) all run on
+		// the shard's one thread. Frames sent together from one handler then
+		// no longer leave as one write unless corked (cork()). Call before
+		// start().
+		void setInlineSends(bool enabled) { m_inlineSends = enabled; }
+
+		// How long sendAck holds an ack for others to join it (0 = send each
+		// at once). Call before start().
+		void setAckDelay(std::chrono::microseconds delay) { m_ackDelay = delay; }
+
+		// Kept until the connection closes or fails, then dropped: a Server
+		// counts its open connections by these (see Server::setMaxConnections)
+		void holdSlot(std::shared_ptr<void> slot) { m_slot = std::move(slot); }
+
+		// Bytes held for incoming frames; 0 while the connection is idle
+		std::size_t receiveBufferCapacity() const { return m_incomingBuffer.capacity(); }
+
+		// From the peer's Capabilities: 0 until they arrive, and for limits it
+		// did not set
+		std::uint16_t peerVersion() const { return m_peerVersion; }
+		std::uint32_t peerMaxChunkSize() const { return m_peerMaxChunkSize; }
+		std::uint64_t peerReceiveWindow() const { return m_peerReceiveWindow; }
+
+		// True once the peer has announced it can decompress 'codec'. Until its
+		// Capabilities arrive, chunks go raw.
+		bool peerAccepts(cw::compression::Codec codec) const
+		{
+			return codec != cw::compression::Codec::None && (m_peerCodecs & cw::compression::codecBit(codec)) != 0;
+		}
+
+		void start()
+		{
+			std::error_code ec;
+			m_local = m_socket.local_endpoint(ec).protocol().family() == AF_UNIX && !ec;
+#if defined(TCP_ZEROCOPY_RECEIVE)
+			if (m_zeroCopyReceive && (m_local || !MappedReceive::supportedOn(m_socket.native_handle()))) {
+				if (!m_local) CW_LOG_INFO("[Connection] Received pages cannot be mapped on this socket; reading them");
+				m_zeroCopyReceive = false;
+			}
+#endif
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+			m_sendsZeroCopy = !m_local && ZeroCopyTracker::enabledOn(m_socket.native_handle());
+#endif
+			if (m_registeredIoWanted && !m_local) m_registeredIo = RegisteredIo::create(m_socket.native_handle(), m_socket.get_executor());
+
+			// Handshake: our Capabilities go out first, the peer's arrive as its
+			// first frame. They say which chunk codecs we can decompress, and
+			// whether the peer may pass us descriptors (a local socket) or ask
+			// for server-side copies (roots configured), that it takes
+			// directory manifests and holes, and whether our acks mean
+			// durable (a disk writer with a Durability). These need the
+			// built-in file receiver: a handler would not see the data. Compact
+			// frame headers are always read; until the peer's Capabilities
+			// arrive we send classic ones
+			cw::packet::Capabilities caps;
+			caps.version = cw::packet::PROTOCOL_VERSION;
+			caps.maxChunkSize = m_maxChunkSize;
+			caps.receiveWindow = m_receiveWindow;
+			caps.codecs = cw::compression::supportedCodecs();
+#if !defined(_WIN32)
+			if (m_local && !m_handler) caps.features |= cw::packet::CAP_DESCRIPTORS;
+#endif
+			if (!m_serverCopyRoots.empty() && !m_handler) caps.features |= cw::packet::CAP_SERVER_COPY;
+			if (!m_downloadRoots.empty() && m_downloadSender) caps.features |= cw::packet::CAP_DOWNLOADS;
+			if (!m_handler) caps.features |= cw::packet::CAP_DIRECTORY_MANIFEST | cw::packet::CAP_SPARSE_FILES | cw::packet::CAP_UNSIZED_FILES | cw::packet::CAP_ARCHIVES | cw::packet::CAP_SUBTREE_DIGESTS | cw::packet::CAP_BATCH_COMPRESSION
+				| cw::packet::CAP_FRONT_CODED_PATHS | cw::packet::CAP_FILE_ATTRIBUTES;
+			if (!m_handler && !m_chunkKey) caps.features |= cw::packet::CAP_INLINE_FILES; // Inline content is never sealed
+			if (!m_handler && m_diskWriter && m_diskWriter->durability() != cw::file::Durability::None) caps.features |= cw::packet::CAP_DURABLE_ACKS;
+			if (!m_handler && m_diskWriter && m_diskWriter->admissionLimited()) caps.features |= cw::packet::CAP_ADMISSION_CONTROL;
+			if (m_statsRegistry) caps.features |= cw::packet::CAP_STATS;
+			caps.features |= cw::packet::CAP_COMPACT_FRAMES | cw::packet::CAP_TRANSFER_STATS | cw::packet::CAP_SESSIONS | cw::packet::CAP_ACK_BATCH | cw::packet::CAP_HEARTBEAT;
+			if constexpr (std::endian::native == std::endian::little) caps.features |= cw::packet::CAP_NATIVE_FRAMES;
+			if (!m_handler && m_treeHash) caps.features |= cw::packet::CAP_TREE_HASH;
+			if (!m_handler && m_chunkKey && cw::integrity::ChunkCipher::available()) caps.features |= cw::packet::CAP_SEALED_CHUNKS;
+			if (m_downstream) limitToDownstream(caps);
+			send(caps);
+
+			// Called from the acceptor's handler; enter the strand first
+			asio::dispatch(m_socket.get_executor(), [self = shared_from_this()]()
+				{
+					self->m_lastReadAt = self->m_lastUsedAt = cw::metrics::Clock::now();
+					if (self->m_idleTimeout.count() > 0) self->armIdleTimer(self->m_idleTimeout);
+					if (self->m_heartbeatInterval.count() > 0) self->armHeartbeat(self->m_heartbeatInterval);
+					self->doRead();
+				});
+		}
+
+	private:
+		// Wraps after 2^32 streams on a long-lived connection, skipping 0
+		// (TransferOptions::streamId's "allocate one")
+		std::uint32_t nextStreamId()
+		{
+			std::uint32_t streamId = m_nextStreamId++;
+			return streamId != 0 ? streamId : m_nextStreamId++;
+		}
+
+		// Opening packet of a stream that the receiver answers with an Ack
+		// (FileResume, FileCopy); completes with that ack's offset.
+		template<typename Packet, typename CompletionToken>
+		auto asyncSendOpening(Packet opening, CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code, std::uint64_t)>(
+				[self = shared_from_this(), opening = std::move(opening)](auto handler) mutable
+				{
+					asio::post(self->m_socket.get_executor(),
+						[self, opening = std::move(opening), h = std::move(handler)]() mutable
+						{
+							if (!self->isOpen()) {
+								asio::dispatch(asio::append(std::move(h), std::error_code(asio::error::operation_aborted), std::uint64_t{ 0 }));
+								return;
+							}
+
+							// Waiter first: the answer cannot overtake it
+							self->m_resumeWaiters.emplace(opening.streamId, std::move(h));
+							self->send(opening);
+						});
+				}, token);
+		}
+
+		template<typename Packet>
+		std::error_code sendOpening(const Packet& opening, std::uint64_t& offset)
+		{
+			std::promise<std::pair<std::error_code, std::uint64_t>> ready;
+			auto result = ready.get_future();
+			asyncSendOpening(opening, [&ready](std::error_code ec, std::uint64_t at) { ready.set_value({ ec, at }); });
+			auto [ec, at] = result.get();
+			offset = at;
+			return ec;
+		}
+
+		void doRead()
+		{
+			// A large frame whose header is in: its body is read on its own
+			if (readLargeFrame()) return;
+
+			auto self = shared_from_this();
+
+			// Idle, the receive buffer released: the next bytes land in a few
+			// inline ones, and the buffer is only allocated again once they arrive
+			if (m_incomingBuffer.capacity() == 0) {
+				readSome(asio::buffer(m_idleRead),
+					[this, self = std::move(self)](std::error_code ec, std::size_t length)
+					{
+						if (ec) {
+							onReadError(ec);
+							return;
+						}
+						auto writable = m_incomingBuffer.prepare(std::max(length, m_readSize.current()));
+						std::memcpy(writable.data(), m_idleRead.data(), length);
+						onRead(m_idleRead.size(), length);
+					});
+				return;
+			}
+
+			// Read straight into the free tail of the receive buffer (no staging copy)
+			// Short of memory: no more than a chunk at a time, the buffer does not grow for bursts
+			std::size_t want = m_readSize.next(pendingFrameBytes());
+			if (m_memory->constrained()) want = std::min(want, READ_CHUNK_SIZE);
+			auto writable = m_incomingBuffer.prepare(want);
+			std::size_t offered = std::min(writable.size(), want);
+
+			readSome(asio::buffer(writable.data(), offered),
+				[this, self = std::move(self), offered](std::error_code ec, std::size_t length)
+				{
+					if (!ec) {
+						onRead(offered, length);
+					}
+					else {
+						onReadError(ec);
+					}
+
+				});
+		}
+
+		// 'length' bytes were read into the free tail of the receive buffer
+		void onRead(std::size_t offered, std::size_t length)
+		{
+			m_incomingBuffer.commit(length);
+			m_lastReadAt = cw::metrics::Clock::now();
+			m_metrics->onBytesReceived(length);
+			m_readSize.record(offered, length);
+
+			if (!processBuffer()) return;
+
+			// Quiet link, everything parsed and the socket drained: an idle
+			// connection holds no receive buffer at all
+			if (m_incomingBuffer.empty() && length < offered && m_readSize.current() <= READ_CHUNK_SIZE) {
+				m_incomingBuffer.release();
+			}
+			// Traffic fell off after a burst: keep a buffer sized for what arrives now
+			else if (m_incomingBuffer.capacity() > 4 * m_readSize.current()) {
+				m_incomingBuffer.shrink(2 * m_readSize.current());
+			}
+			accountReceiveBuffers();
+
+			if (!m_readPaused) doRead();
+		}
+
+		// Checks for idleness every 'after'; the deadline holds no reference,
+		// so it never keeps a finished connection alive
+		void armIdleTimer(std::chrono::steady_clock::duration after)
+		{
+			m_idleDeadline.expiresAfter(after, [weak = weak_from_this()]()
+				{
+					auto self = weak.lock();
+					if (!self || !self->m_socket.is_open()) return;
+
+					auto quiet = cw::metrics::Clock::now() - std::max(self->m_lastUsedAt, self->m_lastWriteAt);
+					if (quiet < self->m_idleTimeout || self->m_readPaused || self->m_writeInProgress) {
+						self->armIdleTimer(quiet < self->m_idleTimeout ? self->m_idleTimeout - quiet : self->m_idleTimeout);
+						return;
+					}
+
+					CW_LOG_INFO("[Connection] Idle for ", std::chrono::duration_cast<std::chrono::seconds>(quiet).count(), " s, closing ", self->peerName());
+					self->close();
+				});
+		}
+
+		// Looks at the peer's silence every 'after': a Ping once it has been
+		// quiet for an interval, closed after m_heartbeatMissed of them
+		void armHeartbeat(std::chrono::steady_clock::duration after)
+		{
+			m_heartbeatDeadline.expiresAfter(after, [weak = weak_from_this()]()
+				{
+					auto self = weak.lock();
+					if (!self || !self->m_socket.is_open()) return;
+
+					auto interval = self->m_heartbeatInterval;
+					auto now = cw::metrics::Clock::now();
+					if (self->m_readPaused || !self->peerAnswersPings()) {
+						// Not reading, or no answer to expect: the silence starts over
+						self->m_heartbeatHeldAt = now;
+						self->armHeartbeat(interval);
+						return;
+					}
+
+					auto quiet = now - std::max(self->m_lastReadAt, self->m_heartbeatHeldAt);
+					if (quiet >= interval * self->m_heartbeatMissed) {
+						CW_LOG_WARN("[Connection] No answer for ", std::chrono::duration_cast<std::chrono::milliseconds>(quiet).count(), " ms, closing ", self->peerName());
+						self->close();
+						return;
+					}
+					if (quiet < interval) {
+						self->armHeartbeat(interval - quiet);
+						return;
+					}
+
+					cw::packet::Ping ping;
+					ping.nonce = ++self->m_pingsSent;
+					self->send(ping, Priority::Urgent);
+					self->armHeartbeat(interval);
+				});
+		}
+
+		// async_read_some, except on a local socket: there it is recvmsg, which is
+		// what picks up descriptors the peer passed (see FileRange). A plain read
+		// would have the kernel close them.
+		template<typename Handler>
+		void readSome(asio::mutable_buffer buffer, Handler handler)
+		{
+#if !defined(_WIN32)
+			if (m_local) {
+				receiveWithDescriptors(buffer, std::move(handler));
+				return;
+			}
+#endif
+			m_socket.async_read_some(buffer, bindHandlerMemory(m_readMemory, std::move(handler)));
+		}
+
+		// async_read, through readSome
+		template<typename Handler>
+		void readExactly(asio::mutable_buffer buffer, Handler handler, std::size_t done = 0)
+		{
+			if (!m_local) {
+				asio::async_read(m_socket, buffer, bindHandlerMemory(m_readMemory, std::move(handler)));
+				return;
+			}
+
+			readSome(buffer + done, [this, self = shared_from_this(), buffer, handler = std::move(handler), done](std::error_code ec, std::size_t length) mutable
+				{
+					done += length;
+					if (ec || done == buffer.size()) handler(ec, done);
+					else readExactly(buffer, std::move(handler), done);
+				});
+		}
+
+#if !defined(_WIN32)
+		template<typename Handler>
+		void receiveWithDescriptors(asio::mutable_buffer buffer, Handler handler)
+		{
+			m_socket.async_wait(Socket::wait_read, bindHandlerMemory(m_readMemory, [this, self = shared_from_this(), buffer, handler = std::move(handler)](std::error_code ec) mutable
+				{
+					if (ec) {
+						handler(ec, 0);
+						return;
+					}
+
+					iovec iov{ buffer.data(), buffer.size() };
+					alignas(cmsghdr) char control[CMSG_SPACE(MAX_PASSED_DESCRIPTORS * sizeof(int))];
+					msghdr msg{};
+					msg.msg_iov = &iov;
+					msg.msg_iovlen = 1;
+					msg.msg_control = control;
+					msg.msg_controllen = sizeof(control);
+
+					int flags = MSG_DONTWAIT;
+#if defined(MSG_CMSG_CLOEXEC)
+					flags |= MSG_CMSG_CLOEXEC;
+#endif
+					ssize_t n = ::recvmsg(m_socket.native_handle(), &msg, flags);
+					if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+						receiveWithDescriptors(buffer, std::move(handler));
+						return;
+					}
+					if (n < 0) {
+						handler(std::error_code(errno, std::system_category()), 0);
+						return;
+					}
+
+					for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+						if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+						std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+						for (std::size_t i = 0; i < count; ++i) {
+							int fd;
+							std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+							m_passedFiles.push_back(std::make_shared<const cw::file::FileHandle>(fd));
+						}
+					}
+
+					// Descriptors were dropped (out of fds): the rest would pair with the wrong frames
+					if (msg.msg_flags & MSG_CTRUNC) handler(std::make_error_code(std::errc::too_many_files_open), 0);
+					else if (n == 0) handler(asio::error::eof, 0);
+					else handler(std::error_code{}, static_cast<std::size_t>(n));
+				}));
+		}
+#endif
+
+		// Two-phase read: once the header announces a payload of LARGE_FRAME_SIZE
+		// or more, the body goes straight into a pooled buffer of exactly its
+		// size. The receive buffer never grows to hold it, the frame is parsed
+		// once, and the chunk handlers keep slices of that buffer instead of
+		// copying the payload out. Returns false if the normal read applies.
+		bool readLargeFrame()
+		{
+			using namespace cw::packet;
+
+			ParseResult header = tryParseFrameHeader(m_incomingBuffer.data(), m_incomingBuffer.size());
+			if (header.status != ParseStatus::Complete) return false;
+
+			std::size_t payloadSize = header.frame.size;
+			std::size_t have = m_incomingBuffer.size() - header.headerSize;
+			if (payloadSize < LARGE_FRAME_SIZE || have >= payloadSize) return false;
+
+#if defined(__linux__)
+			if (m_spliceReceive && !m_chunkKey && header.frame.type == PacketType::FileChunk && spliceChunk(header.headerSize, payloadSize, header.frame.order)) return true;
+#endif
+#if defined(TCP_ZEROCOPY_RECEIVE)
+			if (m_zeroCopyReceive && !m_chunkKey && header.frame.type == PacketType::FileChunk && payloadSize >= MappedReceive::MIN_CHUNK && mapChunk(header.headerSize, payloadSize, header.frame.order)) return true;
+#endif
+
+			// processBuffer stopped at this frame, so everything buffered belongs to it
+			m_largeFrameType = header.frame.type;
+			m_largeFrameOrder = header.frame.order;
+			m_largeBody = cw::buffer::PooledBuffer(payloadSize);
+			std::memcpy(m_largeBody.data(), m_incomingBuffer.data() + header.headerSize, have);
+			m_incomingBuffer.consume(m_incomingBuffer.size());
+			accountReceiveBuffers();
+
+			auto rest = m_largeBody.span().subspan(have);
+			readExactly(asio::buffer(rest.data(), rest.size()),
+				[this, self = shared_from_this()](std::error_code ec, std::size_t length)
+				{
+					if (ec) {
+						m_largeBody = {};
+						accountReceiveBuffers();
+						onReadError(ec);
+						return;
+					}
+
+					m_lastReadAt = cw::metrics::Clock::now();
+					m_metrics->onBytesReceived(length);
+
+					bool more = dispatchLargeFrame();
+					accountReceiveBuffers();
+					if (more && !m_readPaused) doRead();
+				});
+			return true;
+		}
+
+#if defined(__linux__)
+		// setSpliceReceive: a large FileChunk whose header is in, for a stream
+		// that may take it, has the data the last read brought written as
+		// usual and the rest spliced in pipe-sized pieces, each handed to the
+		// file (IncomingFile::writeFromPipe). Returns false if the normal read
+		// applies.
+		bool spliceChunk(std::size_t headerSize, std::size_t payloadSize, cw::packet::WireOrder order)
+		{
+			using namespace cw::packet;
+
+			std::size_t have = m_incomingBuffer.size() - headerSize;
+			if (m_local || m_handler || have < ChunkHeader::Layout::SIZE) return false;
+
+			ChunkHeader chunk = ChunkHeader::read(m_incomingBuffer.data() + headerSize, order);
+			if (chunk.crc || chunk.length > MAX_CHUNK_SIZE || payloadSize != ChunkHeader::Layout::SIZE + chunk.length) return false;
+			if (m_archives.contains(chunk.streamId) || m_forwarded.contains(chunk.streamId)) return false;
+
+			auto it = m_transfers.find(chunk.streamId);
+			if (it == m_transfers.end() || it->second.dedup || it->second.tree) return false;
+			if (it->second.transfer->file->backend() != cw::file::FileBackend::ThreadPool) return false;
+
+			// splice blocks on a blocking socket whatever its flags say
+			std::error_code ec;
+			if (!m_socket.non_blocking()) m_socket.non_blocking(true, ec);
+			if (ec) return false;
+
+			auto buffered = std::span<const uint8_t>(m_incomingBuffer.data() + headerSize + ChunkHeader::Layout::SIZE, have - ChunkHeader::Layout::SIZE);
+			auto& transfer = it->second.transfer;
+			if (!buffered.empty()) transfer->file->write(chunk.offset, cw::buffer::pooledCopy(buffered), m_lastReadAt);
+
+			m_splice = SpliceState{ transfer, chunk.streamId, chunk.offset, chunk.length, buffered.size() };
+			m_incomingBuffer.consume(m_incomingBuffer.size());
+			accountReceiveBuffers();
+			continueSplice();
+			return true;
+		}
+
+		// Fills pipes from the socket until the chunk is in, waiting for the
+		// socket when it runs dry
+		void continueSplice()
+		{
+			auto& splice = *m_splice;
+			while (splice.done < splice.length) {
+				if (!splice.pipe) splice.pipe = cw::file::SplicePipe::acquire();
+				if (!splice.pipe || splice.pipe->capacity() == 0) {
+					m_splice.reset();
+					onReadError(std::make_error_code(std::errc::too_many_files_open));
+					return;
+				}
+
+				std::size_t want = std::min(splice.length - splice.done - splice.filled, splice.pipe->capacity() - splice.filled);
+				std::size_t moved = 0;
+				std::error_code ec = splice.pipe->fill(m_socket.native_handle(), want, moved);
+				if (ec == std::errc::resource_unavailable_try_again) {
+					m_socket.async_wait(Socket::wait_read, bindHandlerMemory(m_readMemory, [this, self = shared_from_this()](std::error_code ec)
+						{
+							if (ec) {
+								m_splice.reset();
+								onReadError(ec);
+							}
+							else continueSplice();
+						}));
+					return;
+				}
+				if (!ec && moved == 0) ec = asio::error::eof;
+				if (ec) {
+					m_splice.reset();
+					onReadError(ec);
+					return;
+				}
+
+				m_lastReadAt = m_lastUsedAt = cw::metrics::Clock::now();
+				m_metrics->onBytesReceived(moved);
+				splice.filled += moved;
+				if (splice.filled == splice.pipe->capacity() || splice.done + splice.filled == splice.length) {
+					splice.transfer->file->writeFromPipe(std::move(splice.pipe), splice.offset + splice.done, splice.filled, m_lastReadAt);
+					splice.done += splice.filled;
+					splice.filled = 0;
+				}
+			}
+			finishSplice();
+		}
+
+		// The chunk is in: what onPacket(FileChunkView) does after its write
+		void finishSplice()
+		{
+			SpliceState splice = std::move(*m_splice);
+			m_splice.reset();
+			m_metrics->onFrameReceived();
+
+			if (auto it = m_transfers.find(splice.streamId); it != m_transfers.end() && it->second.transfer == splice.transfer) {
+				auto& active = it->second;
+				trackChecksum(active, splice.offset, splice.length, std::nullopt);
+				splice.transfer->markReceived(splice.offset, splice.length);
+				holdForDisk(splice.transfer);
+				if (std::erase_if(active.repairs, [&splice](const auto& range) { return range.first == splice.offset; })) settle(active);
+			}
+
+			if (!m_readPaused) doRead();
+		}
+#endif
+
+#if defined(TCP_ZEROCOPY_RECEIVE)
+		// setZeroCopyReceive: a large FileChunk whose header is in, for a
+		// stream that may take it, is received in pieces, mapped or read, and
+		// written once all are in and its CRC matched. Returns false if the
+		// normal read applies.
+		bool mapChunk(std::size_t headerSize, std::size_t payloadSize, cw::packet::WireOrder order)
+		{
+			using namespace cw::packet;
+
+			std::size_t have = m_incomingBuffer.size() - headerSize;
+			if (m_handler || have < ChunkHeader::Layout::SIZE) return false;
+
+			ChunkHeader chunk = ChunkHeader::read(m_incomingBuffer.data() + headerSize, order);
+			if (chunk.length > MAX_CHUNK_SIZE || payloadSize != ChunkHeader::Layout::SIZE + chunk.length) return false;
+			if (m_archives.contains(chunk.streamId) || m_forwarded.contains(chunk.streamId)) return false;
+
+			auto it = m_transfers.find(chunk.streamId);
+			if (it == m_transfers.end() || it->second.dedup || it->second.tree) return false;
+
+			auto region = MappedReceive::reserve(m_socket.native_handle(), chunk.length);
+			if (!region) return false;
+
+			m_mapped = MappedState{ it->second.transfer, std::move(region), chunk.streamId, chunk.offset, chunk.length, chunk.crc };
+			auto buffered = std::span<const uint8_t>(m_incomingBuffer.data() + headerSize + ChunkHeader::Layout::SIZE, have - ChunkHeader::Layout::SIZE);
+			if (!buffered.empty()) addMappedPiece(cw::buffer::pooledCopy(buffered));
+			m_incomingBuffer.consume(m_incomingBuffer.size());
+			accountReceiveBuffers();
+			continueMapped();
+			return true;
+		}
+
+		void addMappedPiece(cw::buffer::SharedBuffer piece)
+		{
+			auto& mapped = *m_mapped;
+			if (mapped.crc) mapped.runningCrc = cw::integrity::crc32c(piece.span(), mapped.runningCrc);
+			mapped.done += piece.size();
+			mapped.pieces.push_back(std::move(piece));
+		}
+
+		// Maps or reads the rest of the chunk, waiting for the socket when it
+		// runs dry
+		void continueMapped()
+		{
+			auto& mapped = *m_mapped;
+			int socket = m_socket.native_handle();
+			while (mapped.done < mapped.length) {
+				std::size_t want = mapped.length - mapped.done;
+				cw::buffer::SharedBuffer piece;
+				std::size_t skip = want;
+				if (m_zeroCopyReceive) {
+					if (auto ec = mapped.region->map(socket, want, piece, skip)) {
+						// Mapping works on this socket or not at all: read from here on
+						CW_LOG_WARN("[Connection] TCP_ZEROCOPY_RECEIVE failed (", ec.message(), "); reading instead");
+						m_zeroCopyReceive = false;
+						skip = want;
+					}
+				}
+
+				std::size_t received = piece.size();
+				if (!piece.empty()) addMappedPiece(std::move(piece));
+				else if (skip != 0) {
+					cw::buffer::PooledBuffer copy(std::min(skip, want));
+					ssize_t n = ::recv(socket, copy.data(), copy.size(), MSG_DONTWAIT);
+					if (n < 0 && errno == EINTR) continue;
+					if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+						m_mapped.reset();
+						onReadError(std::error_code(errno, std::system_category()));
+						return;
+					}
+					if (n == 0) {
+						m_mapped.reset();
+						onReadError(asio::error::eof);
+						return;
+					}
+					if (n > 0) {
+						received = static_cast<std::size_t>(n);
+						addMappedPiece(std::move(copy).share().slice(0, received));
+					}
+				}
+
+				if (received == 0) {
+					m_socket.async_wait(Socket::wait_read, bindHandlerMemory(m_readMemory, [this, self = shared_from_this()](std::error_code ec)
+						{
+							if (ec) {
+								m_mapped.reset();
+								onReadError(ec);
+							}
+							else continueMapped();
+						}));
+					return;
+				}
+				m_lastReadAt = m_lastUsedAt = cw::metrics::Clock::now();
+				m_metrics->onBytesReceived(received);
+			}
+			finishMapped();
+		}
+
+		// The chunk is in: what onPacket(FileChunkView) does with it
+		void finishMapped()
+		{
+			MappedState mapped = std::move(*m_mapped);
+			m_mapped.reset();
+			m_metrics->onFrameReceived();
+
+			auto it = m_transfers.find(mapped.streamId);
+			if (it != m_transfers.end() && it->second.transfer == mapped.transfer) {
+				auto& active = it->second;
+				if (mapped.crc && mapped.runningCrc != *mapped.crc) {
+					requestRetransmit(mapped.streamId, active, mapped.offset, static_cast<std::uint32_t>(mapped.length));
+				}
+				else {
+					trackChecksum(active, mapped.offset, mapped.length, mapped.crc);
+					std::uint64_t at = mapped.offset;
+					for (auto& piece : mapped.pieces) {
+						std::size_t size = piece.size();
+						mapped.transfer->file->write(at, std::move(piece), m_lastReadAt);
+						at += size;
+					}
+					mapped.transfer->markReceived(mapped.offset, mapped.length);
+					holdForDisk(mapped.transfer);
+					if (std::erase_if(active.repairs, [&mapped](const auto& range) { return range.first == mapped.offset; })) settle(active);
+				}
+			}
+
+			if (!m_readPaused) doRead();
+		}
+#endif
+
+		// The receive buffer as allocated, and a large frame's own buffer while
+		// it is read in (once dispatched, what its chunks still hold is write-behind)
+		void accountReceiveBuffers()
+		{
+			m_memory->set(cw::buffer::MemoryUse::ReceiveBuffer, m_incomingBuffer.capacity() + m_largeBody.size());
+		}
+
+		bool dispatchLargeFrame()
+		{
+			m_largeFrame = std::move(m_largeBody).share();
+			cw::packet::ParsedFrame frame{ m_largeFrame.data(), m_largeFrame.size(), m_largeFrameType, m_largeFrameOrder };
+
+			try
+			{
+				dispatchPacket(frame);
+				m_metrics->onFrameReceived();
+			}
+			catch (const std::exception& e)
+			{
+				CW_LOG_ERROR("[Connection] Malformed Packet: ", e.what(), ". Closing.");
+				flushChunkRun();
+				m_largeFrame = {};
+				close();
+				return false;
+			}
+
+			flushChunkRun();
+			m_largeFrame = {};
+			return true;
+		}
+
+		// Payload bytes that must outlive the frame being dispatched (queued for
+		// the disk): a slice of a large frame's own buffer, otherwise a pooled
+		// copy, since the receive buffer is reused by the next read.
+		cw::buffer::SharedBuffer retainPayload(std::span<const uint8_t> bytes) const
+		{
+			const uint8_t* begin = m_largeFrame.data();
+			if (begin != nullptr && bytes.data() >= begin && bytes.data() + bytes.size() <= begin + m_largeFrame.size()) {
+				return m_largeFrame.slice(static_cast<std::size_t>(bytes.data() - begin), bytes.size());
+			}
+			return cw::buffer::pooledCopy(bytes);
+		}
+
+		void onReadError(std::error_code ec)
+		{
+			// Socket closed or error
+			CW_LOG_INFO("[Connection] Disconnected: ", ec.message());
+			m_failed = true;
+			m_idleDeadline.cancel();
+			m_heartbeatDeadline.cancel();
+			if (m_paceTimer) m_paceTimer->cancel();
+			dropAcks();
+			m_slot.reset();
+			abandonTransfers();
+			leaveSession();
+			notifyWritable(asio::error::operation_aborted);
+			notifyAcked(asio::error::operation_aborted);
+			abortRequests(asio::error::operation_aborted);
+
+			// The peer is done sending (asyncClose at its end): so is this end,
+			// once what is already queued is written
+			if (ec == asio::error::eof) {
+				m_closing = true;
+				closeSendingIfFlushed();
+			}
+		}
+
+		// Bytes still to come for the frame at the read cursor, 0 while its
+		// header is incomplete. An oversized length is left to processBuffer.
+		std::size_t pendingFrameBytes() const
+		{
+			using namespace cw::packet;
+
+			ParseResult header = tryParseFrameHeader(m_incomingBuffer.data(), m_incomingBuffer.size());
+			if (header.status != ParseStatus::Complete) return 0;
+
+			std::size_t total = header.headerSize + header.frame.size;
+			return total > m_incomingBuffer.size() ? total - m_incomingBuffer.size() : 0;
+		}
+
+		// Returns false if the stream is corrupt and the connection was closed.
+		bool processBuffer()
+		{
+			using namespace cw::packet;
+
+			while (!m_incomingBuffer.empty() && !m_readPaused)
+			{
+				// A. Zero-Copy Parse (in place, straight from the read cursor)
+				ParseResult result = tryParseFrame(m_incomingBuffer.data(), m_incomingBuffer.size());
+
+				// FRAGMENTATION: wait for more bytes
+				if (result.status == ParseStatus::NeedMoreData) break;
+
+				if (result.status == ParseStatus::ProtocolError) {
+					CW_LOG_ERROR("[Connection] Protocol Error: invalid frame length. Closing.");
+					flushChunkRun();
+					close();
+					return false;
+				}
+
+				// B. Calculate Total Size (Header + Payload)
+				size_t totalFrameSize = result.headerSize + result.frame.size;
+				CW_TRACE(frame__parsed, this, static_cast<unsigned>(result.frame.type), totalFrameSize);
+
+				// C. Handle the Packet
+				// A deserialize failure here is a real error, not fragmentation.
+				try
+				{
+					dispatchPacket(result.frame);
+					m_metrics->onFrameReceived();
+				}
+				catch (const std::exception& e)
+				{
+					CW_LOG_ERROR("[Connection] Malformed Packet: ", e.what(), ". Closing.");
+					flushChunkRun();
+					close();
+					return false;
+				}
+
+				// D. Consume Data (cursor advance, no shift)
+				m_incomingBuffer.consume(totalFrameSize);
+			}
+
+			flushChunkRun();
+			return true;
+		}
+
+		// BACKPRESSURE: stop reading the socket while the disk is behind (TCP
+		// flow control then slows the sender down), or while memory is short and
+		// this file has chunks waiting: those drain whatever other peers hold.
+		void holdForDisk(const std::shared_ptr<cw::file::IncomingTransfer>& transfer)
+		{
+			std::size_t pending = transfer->file->pendingBytes() + (m_chunkRun.file == transfer->file ? m_chunkRun.bytes : 0);
+			if (pending > m_maxPendingDiskBytes) {
+				flushChunkRun();
+				pauseReading(transfer, m_maxPendingDiskBytes / 2);
+			}
+			else if (pending > 0 && m_memory->constrained()) {
+				flushChunkRun();
+				m_metrics->onMemoryPause();
+				pauseReading(transfer, 0);
+			}
+		}
+
+		// Chunks parsed from one read that continue one another in the same
+		// file are written together (IncomingFile::writeGathered): one
+		// pwritev per run instead of a pwrite per chunk. The run is written
+		// when the next chunk does not continue it, before any other packet is
+		// handled, and at the end of the read's frames.
+		void queueChunkWrite(const std::shared_ptr<cw::file::IncomingTransfer>& transfer, std::uint64_t offset, cw::buffer::SharedBuffer data)
+		{
+			auto& run = m_chunkRun;
+			if (run.file && (run.file != transfer->file || run.next != offset || run.pieces.size() == MAX_RUN_CHUNKS)) flushChunkRun();
+			if (!run.file) {
+				run.file = transfer->file;
+				run.offset = run.next = offset;
+				run.arrived = m_lastReadAt;
+				run.pieces = cw::buffer::BufferListPool::acquire(MAX_RUN_CHUNKS);
+			}
+			run.next += data.size();
+			run.bytes += data.size();
+			run.pieces.push_back(std::move(data));
+		}
+
+		void flushChunkRun()
+		{
+			auto& run = m_chunkRun;
+			if (!run.file) return;
+			if (run.pieces.size() == 1) {
+				run.file->write(run.offset, std::move(run.pieces.front()), run.arrived);
+				cw::buffer::BufferListPool::release(std::move(run.pieces));
+			}
+			else run.file->writeGathered(run.offset, std::move(run.pieces), run.arrived);
+			run = {};
+		}
+
+		// Write-behind backpressure: park the read loop until the file's queue drains to 'threshold'.
+		// Frames already buffered stay in m_incomingBuffer and are parsed on resume.
+		// The pause counts as the transfer's stall time.
+		void pauseReading(const std::shared_ptr<cw::file::IncomingTransfer>& transfer, std::size_t threshold)
+		{
+			pauseReading();
+
+			// The file may belong to another connection's executor (striped
+			// uploads): resumeReading hops back onto this connection's strand
+			transfer->file->whenDrained(threshold, [self = shared_from_this(), transfer, paused = cw::metrics::Clock::now()]()
+				{
+					auto stalled = std::chrono::duration_cast<std::chrono::nanoseconds>(cw::metrics::Clock::now() - paused).count();
+					transfer->stallNanos.fetch_add(static_cast<std::uint64_t>(stalled), std::memory_order_relaxed);
+					self->resumeReading();
+				});
+		}
+
+		void close()
+		{
+			std::error_code ignored;
+			m_socket.close(ignored);
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+			m_zeroCopy.clear();
+#endif
+			m_failed = true;
+			m_idleDeadline.cancel();
+			m_heartbeatDeadline.cancel();
+			if (m_paceTimer) m_paceTimer->cancel();
+			dropAcks();
+			m_slot.reset();
+			abandonTransfers();
+			leaveSession();
+			notifyWritable(asio::error::operation_aborted);
+			notifyAcked(asio::error::operation_aborted);
+			abortRequests(asio::error::operation_aborted);
+		}
+
+		// asyncClose: the half-close, once nothing queued is left to write
+		void closeSendingIfFlushed()
+		{
+			if (m_sendClosed || m_writeInProgress || m_queueSize != 0) return;
+			std::error_code ignored;
+			m_socket.shutdown(Socket::shutdown_send, ignored);
+			m_sendClosed = true;
+		}
+
+		// Wake every producer parked in asyncWaitWritable
+		void notifyWritable(std::error_code ec)
+		{
+			if (m_writableWaiters.empty()) return;
+
+			auto waiters = std::move(m_writableWaiters);
+			m_writableWaiters.clear();
+
+			for (auto& waiter : waiters) {
+				asio::dispatch(asio::append(std::move(waiter.handler), ec));
+			}
+		}
+
+		// Wake the producers whose class drained to the low watermark
+		void notifyDrained()
+		{
+			auto ready = std::stable_partition(m_writableWaiters.begin(), m_writableWaiters.end(),
+				[this](const WritableWaiter& waiter) { return m_classQueued[classOf(waiter.priority)] > m_lowWatermark; });
+			if (ready == m_writableWaiters.end()) return;
+
+			std::vector<WritableWaiter> woken(std::make_move_iterator(ready), std::make_move_iterator(m_writableWaiters.end()));
+			m_writableWaiters.erase(ready, m_writableWaiters.end());
+			for (auto& waiter : woken) {
+				asio::dispatch(asio::append(std::move(waiter.handler), std::error_code{}));
+			}
+		}
+
+		// Compact headers once the peer has said it reads them, native chunk
+		// headers once it has said it is little-endian as this host is
+		cw::packet::FrameFormat frameFormat() const
+		{
+			std::uint32_t features = m_peerFeatures;
+			if (std::endian::native == std::endian::little && (features & cw::packet::CAP_NATIVE_FRAMES)) return cw::packet::FrameFormat::Native;
+			return (features & cw::packet::CAP_COMPACT_FRAMES) ? cw::packet::FrameFormat::Compact : cw::packet::FrameFormat::Classic;
+		}
+
+		// Account at enqueue time so producers see backpressure immediately,
+		// not only after the flush has run on the io thread.
+		void account(Priority priority, std::size_t bytes)
+		{
+			m_classQueued[classOf(priority)] += bytes;
+			m_memory->add(cw::buffer::MemoryUse::SendQueue, bytes);
+			std::size_t queued = m_queueSize += bytes;
+			m_metrics->setQueuedBytes(queued);
+			if (queued > m_highWatermark) m_metrics->onCongested();
+		}
+
+		// Lock-free hand-off to the strand. One flush drains whatever
+		// producers queued until it runs: a post, and a reference to this
+		// connection, per burst of frames rather than per frame.
+		void postFlush()
+		{
+			asio::post(m_socket.get_executor(), bindHandlerMemory(m_flushMemory, [self = shared_from_this()]() { self->flushSubmissions(); }));
+		}
+
+		// Moves what send() queued to the class queues and starts a write.
+		// The flag is cleared first: a frame pushed from here on posts a new
+		// flush, so none is left behind, even one whose producer was still
+		// linking it in while this drain ran.
+		void flushSubmissions()
+		{
+			m_flushPosted.exchange(false, std::memory_order_acq_rel);
+			bool dropping = m_anyStreamFailed.load(std::memory_order_acquire);
+			std::size_t taken = m_submissions.drain([this, dropping](cw::packet::OutgoingFrame&& frame) { takeFrame(std::move(frame), dropping); }, MAX_FLUSH_FRAMES);
+			if (dropping) afterDrops();
+
+			// Other handlers on the strand get a turn under a flood of frames
+			if (taken == MAX_FLUSH_FRAMES && !m_submissions.empty() && !m_flushPosted.exchange(true, std::memory_order_acq_rel)) postFlush();
+
+			// A write is in flight: its completion picks these frames up in the next batch
+			if (m_writeInProgress || !hasFramesToWrite()) return;
+			if (heldByCork()) return;
+			writeQueueFront();
+		}
+
+		// A frame of a stream that failed meanwhile goes no further
+		void takeFrame(cw::packet::OutgoingFrame&& frame, bool dropping)
+		{
+			if (dropping && frame.streamId != 0 && streamError(frame.streamId)) dropFrame(frame);
+			else enqueueFrame(std::move(frame));
+		}
+
+		// Whether the caller runs inside this connection's strand
+		bool onOwnStrand()
+		{
+			const auto* strand = m_socket.get_executor().target<asio::strand<asio::io_context::executor_type>>();
+			return strand && strand->running_in_this_thread();
+		}
+
+		// send() on the strand (setInlineSends). What other threads queued
+		// goes first: it may have been sent before this frame (a chunk from
+		// the disk pool, then its FileDone from here).
+		void sendInline(cw::packet::OutgoingFrame frame)
+		{
+			bool dropping = m_anyStreamFailed.load(std::memory_order_acquire);
+			m_submissions.drain([this, dropping](cw::packet::OutgoingFrame&& queued) { takeFrame(std::move(queued), dropping); });
+			takeFrame(std::move(frame), dropping);
+			if (dropping) afterDrops();
+
+			if (m_writeInProgress || !hasFramesToWrite() || heldByCork()) return;
+			writeQueueFront();
+		}
+
+		// Codes the name against the last one sent in the class and queues it
+		// under the same lock, so the peer decodes the class's names in the
+		// order they were coded
+		void sendFrontCoded(std::uint32_t streamId, std::uint64_t fileSize, std::string_view name, Priority priority)
+		{
+			std::size_t chain = classOf(priority);
+			std::scoped_lock lock(m_sentNamesMutex);
+			std::string& previous = m_sentNames[chain];
+			send(cw::packet::FrontCodedFileInfo::code(streamId, fileSize, static_cast<std::uint8_t>(chain), name, previous), priority);
+			previous = name;
+		}
+
+		void enqueueFrame(cw::packet::OutgoingFrame frame)
+		{
+			// A class that was idle starts at the current virtual time: its
+			// idle spell earns it no credit over the classes that kept sending
+			std::size_t c = classOf(frame.priority);
+			if (m_pendingFrames[c].empty()) m_classTag[c] = std::max(m_classTag[c], m_virtualTime);
+			m_pendingFrames[c].push_back(std::move(frame));
+		}
+
+		static constexpr std::size_t classOf(Priority priority) { return static_cast<std::size_t>(priority); }
+
+		// The peer's TCP endpoint, IPv4 clients of a dual-stack listener
+		// (::ffff:a.b.c.d) as IPv4; nullopt on a Unix domain socket
+		std::optional<tcp::endpoint> peerEndpoint() const
+		{
+			std::error_code ec;
+			auto endpoint = m_socket.remote_endpoint(ec);
+			if (ec) return std::nullopt;
+
+			int family = endpoint.protocol().family();
+			if (family != AF_INET && family != AF_INET6) return std::nullopt;
+
+			tcp::endpoint ip;
+			std::memcpy(ip.data(), endpoint.data(), std::min<std::size_t>(endpoint.size(), ip.capacity()));
+
+			auto address = ip.address();
+			if (address.is_v6() && address.to_v6().is_v4_mapped()) ip.address(asio::ip::make_address_v4(asio::ip::v4_mapped, address.to_v6()));
+			return ip;
+		}
+
+		// Writes wait for uncork(), unless the queue is past the high watermark
+		bool heldByCork() const
+		{
+			return m_corks.load(std::memory_order_acquire) != 0 && m_queueSize <= m_highWatermark;
+		}
+
+		// Share of the socket per class when all have frames queued (16:4:1)
+		static constexpr std::array<std::uint64_t, cw::packet::PRIORITY_CLASSES> CLASS_COST = { 1, 4, 16 };
+
+		bool hasFramesToWrite() const
+		{
+			if (!m_writeQueue.empty()) return true;
+			return std::any_of(m_pendingFrames.begin(), m_pendingFrames.end(), [](const auto& queue) { return !queue.empty(); });
+		}
+
+		// Moves the next batch (up to 'limit' bytes, at least one frame) from
+		// the class queues to m_writeQueue. Weighted fair queuing at frame
+		// granularity: each class carries a virtual time that grows by the
+		// bytes it sent times its cost, and the class behind the others goes
+		// next. File ranges and passed descriptors make a batch of their own.
+		void scheduleBatch(std::size_t limit)
+		{
+			std::size_t bytes = 0;
+			for (;;) {
+				std::size_t next = cw::packet::PRIORITY_CLASSES;
+				for (std::size_t c = 0; c < cw::packet::PRIORITY_CLASSES; ++c) {
+					if (m_pendingFrames[c].empty()) continue;
+					if (next == cw::packet::PRIORITY_CLASSES || m_classTag[c] < m_classTag[next]) next = c;
+				}
+				if (next == cw::packet::PRIORITY_CLASSES) return;
+
+				auto& queue = m_pendingFrames[next];
+				const auto& frame = queue.front();
+				bool alone = !frame.file.empty() || frame.descriptor;
+				if (!m_writeQueue.empty() && (alone || bytes + frame.size() > limit)) return;
+
+				m_virtualTime = m_classTag[next];
+				m_classTag[next] += frame.size() * CLASS_COST[next];
+				bytes += frame.size();
+				m_writeQueue.push_back(std::move(queue.front()));
+				queue.pop_front();
+				if (alone) return;
+			}
+		}
+
+		// The actual Async Write call
+		// Coalesces every queued frame (up to m_maxWriteBatchBytes) into one gathered
+		// write, so a burst of small chunks costs one writev instead of one per chunk.
+		// Under a rate limit batches shrink to the pacing quantum and each waits
+		// for its bytes to be booked.
+		void writeQueueFront()
+		{
+			std::size_t maxBatch = m_maxWriteBatchBytes;
+			if (std::uint64_t quantum = paceQuantum(); quantum != 0) maxBatch = std::min<std::size_t>(maxBatch, quantum);
+			if (m_writeQueue.empty()) scheduleBatch(maxBatch);
+
+			// Delayed acks ride along with whatever goes out
+			if (!m_pendingAcks.empty()) m_writeQueue.push_front(takeAcks());
+
+			// Kernel-copied file ranges and passed descriptors are written on their own
+			const auto& front = m_writeQueue.front();
+			if (!front.file.empty() || front.descriptor) {
+				bool file = !front.file.empty();
+				afterPacing(front.size(), [this, file]()
+					{
+						markWriteStart();
+						file ? writeFileFrame() : writeDescriptorFrame();
+					});
+				return;
+			}
+
+			std::size_t batchBytes = 0;
+			std::size_t batchFrames = 0;
+
+			for (const auto& frame : m_writeQueue)
+			{
+				// Always send at least one frame, even if it exceeds the limit
+				if (batchFrames > 0 && batchBytes + frame.size() > maxBatch) break;
+				if (!frame.file.empty() || frame.descriptor) break;
+
+				batchBytes += frame.size();
+				++batchFrames;
+			}
+
+			afterPacing(batchBytes, [this, batchFrames, batchBytes]()
+				{
+					markWriteStart();
+					writeBatch(batchFrames, batchBytes);
+				});
+		}
+
+		// When the write about to be issued began, for the session timeline
+		void markWriteStart()
+		{
+			if (cw::metrics::Timeline::instance().enabled()) m_writeStartedAt = cw::metrics::Clock::now();
+		}
+
+		// The first 'frames' queued frames in one gathered write
+		void writeBatch(std::size_t frames, std::size_t bytes)
+		{
+			cw::metrics::StageTimer stage(cw::metrics::Stage::SocketWrite);
+			m_writeBuffers.clear();
+			for (std::size_t i = 0; i < frames; ++i)
+			{
+				const auto& frame = m_writeQueue[i];
+				m_writeBuffers.push_back(asio::buffer(frame.header));
+				if (!frame.payload.empty())
+					m_writeBuffers.push_back(asio::buffer(frame.payload.data(), frame.payload.size()));
+			}
+
+			m_writeInProgress = true;
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+			auto large = [](const cw::packet::OutgoingFrame& frame) { return frame.payload.size() >= ZeroCopyTracker::MIN_PAYLOAD; };
+			if (m_sendsZeroCopy && std::any_of(m_writeQueue.begin(), m_writeQueue.begin() + frames, large)) {
+				writeZeroCopy(frames, bytes, 0);
+				return;
+			}
+#endif
+
+			// More frames are queued behind this batch: MSG_MORE keeps the kernel
+			// from pushing its tail out as a short segment, the next write
+			// (started from this one's completion) fills it
+			m_flaggedWrites.flags = 0;
+#if defined(MSG_MORE)
+			if (!m_local && (m_writeQueue.size() > frames || std::any_of(m_pendingFrames.begin(), m_pendingFrames.end(), [](const auto& queue) { return !queue.empty(); })))
+				m_flaggedWrites.flags = MSG_MORE;
+#endif
+
+			auto written = bindHandlerMemory(m_writeMemory, [this, self = shared_from_this(), frames, bytes](std::error_code ec, std::size_t)
+				{
+					onWriteComplete(ec, frames, bytes);
+				});
+			if (m_registeredIo) {
+				asio::async_write(*m_registeredIo, std::span<const asio::const_buffer>(m_writeBuffers), std::move(written));
+				return;
+			}
+			// A span, not the vector: the operation holds a copy of the sequence
+			asio::async_write(m_flaggedWrites, std::span<const asio::const_buffer>(m_writeBuffers), std::move(written));
+		}
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+		// writeBatch by sendmsg(MSG_ZEROCOPY), from byte 'done' on: the kernel
+		// pins the pages instead of copying them, and the frames are held
+		// (onWriteComplete) until it reports them sent. Out of optmem
+		// (ENOBUFS) a send copies; a socket that refuses the flag (kTLS) stops
+		// using it.
+		void writeZeroCopy(std::size_t frames, std::size_t bytes, std::size_t done)
+		{
+			while (done < bytes) {
+				m_zeroCopyIov.clear();
+				std::size_t skip = done;
+				for (const auto& buffer : m_writeBuffers) {
+					if (skip >= buffer.size()) {
+						skip -= buffer.size();
+						continue;
+					}
+					m_zeroCopyIov.push_back(iovec{ const_cast<char*>(static_cast<const char*>(buffer.data())) + skip, buffer.size() - skip });
+					skip = 0;
+				}
+
+				msghdr msg{};
+				msg.msg_iov = m_zeroCopyIov.data();
+				msg.msg_iovlen = std::min<std::size_t>(m_zeroCopyIov.size(), IOV_MAX);
+				int flags = MSG_DONTWAIT | MSG_NOSIGNAL | (m_sendsZeroCopy ? MSG_ZEROCOPY : 0);
+				ssize_t n = ::sendmsg(m_socket.native_handle(), &msg, flags);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					m_socket.async_wait(Socket::wait_write, bindHandlerMemory(m_writeMemory, [this, self = shared_from_this(), frames, bytes, done](std::error_code ec)
+						{
+							if (ec) onWriteComplete(ec, frames, bytes);
+							else writeZeroCopy(frames, bytes, done);
+						}));
+					return;
+				}
+				if (n < 0 && m_sendsZeroCopy && (errno == ENOBUFS || errno == EOPNOTSUPP || errno == EINVAL)) {
+					if (errno != ENOBUFS) m_sendsZeroCopy = false;
+					n = ::sendmsg(m_socket.native_handle(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+					if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+				}
+				else if (n >= 0 && m_sendsZeroCopy) {
+					m_zeroCopy.onSent();
+					m_batchZeroCopy = true;
+				}
+				if (n < 0) {
+					onWriteComplete(std::error_code(errno, std::system_category()), frames, bytes);
+					return;
+				}
+				done += static_cast<std::size_t>(n);
+			}
+			onWriteComplete({}, frames, bytes);
+		}
+
+		// Releases the frames of the zero-copy sends the kernel is done with.
+		// A wait for the next notification is armed before the queue is read,
+		// so one arriving meanwhile still wakes it.
+		void reapZeroCopy()
+		{
+			if (m_zeroCopy.held() != 0 && !m_zeroCopyWaiting && m_socket.is_open()) {
+				m_zeroCopyWaiting = true;
+				m_socket.async_wait(Socket::wait_error, [this, self = shared_from_this()](std::error_code ec)
+					{
+						m_zeroCopyWaiting = false;
+						if (!ec && m_socket.is_open()) reapZeroCopy();
+					});
+			}
+			m_zeroCopy.reap(m_socket.native_handle());
+
+			if (m_sendsZeroCopy && m_zeroCopy.copied()) {
+				CW_LOG_INFO("[Connection] The kernel copies zero-copy sends on this path; sending by copy");
+				m_sendsZeroCopy = false;
+			}
+		}
+#endif
+
+		// Smallest pacing quantum of the limits this connection is under (0 = none)
+		std::uint64_t paceQuantum() const
+		{
+			std::uint64_t quantum = m_rateLimiter.paceQuantum();
+			for (const auto& limiter : m_sharedLimiters) {
+				std::uint64_t q = limiter->paceQuantum();
+				if (q != 0 && (quantum == 0 || q < quantum)) quantum = q;
+			}
+			return quantum;
+		}
+
+		// Books 'bytes' with every limiter and runs 'write' once the slowest
+		// allows it: at once when none holds it back, else off a timer, with
+		// the write counted as in progress meanwhile
+		template<typename Write>
+		void afterPacing(std::size_t bytes, Write write)
+		{
+			auto now = RateLimiter::Clock::now();
+			auto delay = m_rateLimiter.reserve(bytes, now);
+			for (const auto& limiter : m_sharedLimiters) delay = std::max(delay, limiter->reserve(bytes, now));
+
+			if (delay <= RateLimiter::Clock::duration::zero()) {
+				write();
+				return;
+			}
+
+			m_writeInProgress = true;
+			m_metrics->onPaced(delay);
+			if (!m_paceTimer) m_paceTimer = std::make_unique<asio::steady_timer>(m_socket.get_executor());
+			m_paceTimer->expires_after(delay);
+			m_paceTimer->async_wait([this, self = shared_from_this(), write = std::move(write)](std::error_code ec)
+				{
+					m_writeInProgress = false;
+					if (ec || !m_socket.is_open()) return; // Closed meanwhile
+					write();
+				});
+		}
+
+		void onWriteComplete(std::error_code ec, std::size_t frames, std::size_t bytes)
+		{
+			m_writeInProgress = false;
+			CW_TRACE(write__done, this, frames, bytes, ec.value());
+
+			if (!ec)
+			{
+				// TRACKING: Subtract size (batch sent)
+				m_queueSize -= bytes;
+				m_memory->remove(cw::buffer::MemoryUse::SendQueue, bytes);
+				m_metrics->onBytesSent(bytes, frames);
+				m_metrics->setQueuedBytes(m_queueSize);
+
+				auto now = cw::metrics::Clock::now();
+				if (std::any_of(m_writeQueue.begin(), m_writeQueue.begin() + frames, [](const auto& frame) { return !frame.keepalive; })) m_lastWriteAt = now;
+				for (std::size_t i = 0; i < frames; ++i) m_metrics->sendLatency().record(now - m_writeQueue[i].enqueuedAt);
+				if (auto& timeline = cw::metrics::Timeline::instance(); timeline.enabled() && m_writeStartedAt != cw::metrics::Clock::time_point{}) {
+					for (std::size_t i = 0; i < frames; ++i)
+						timeline.span("queued", "send", m_writeQueue[i].enqueuedAt, m_writeStartedAt, m_writeQueue[i].size());
+					timeline.span("socket write", "send", m_writeStartedAt, now, bytes);
+				}
+
+				// Headers go back to the pool; payload blocks return as their last
+				// reference drops. Zero-copy sent frames wait for the kernel first.
+				for (std::size_t i = 0; i < frames; ++i) {
+					m_classQueued[classOf(m_writeQueue[i].priority)] -= m_writeQueue[i].size();
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+					if (m_batchZeroCopy) {
+						m_zeroCopy.hold(std::move(m_writeQueue[i]));
+						continue;
+					}
+#endif
+					cw::buffer::HeaderPool::release(std::move(m_writeQueue[i].header));
+				}
+				m_writeQueue.erase(m_writeQueue.begin(), m_writeQueue.begin() + frames);
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+				if (std::exchange(m_batchZeroCopy, false)) reapZeroCopy();
+#endif
+
+				if (m_queueSize <= m_lowWatermark) m_metrics->onDrained();
+				notifyDrained();
+
+				// A write may have started already, from an inline send in a waiter woken above
+				if (hasFramesToWrite()) {
+					if (!m_writeInProgress && !heldByCork()) writeQueueFront();
+				}
+				else if (m_closing) closeSendingIfFlushed();
+			}
+
+			else
+			{
+				// After the half-close, frames still sent (a late ack) have nowhere to go
+				if (!m_sendClosed) CW_LOG_ERROR("[Connection] Write Error: ", ec.message());
+				close();
+			}
+		}
+
+		// Header through the normal write path, then the file range by the kernel.
+		void writeFileFrame()
+		{
+			auto self = shared_from_this();
+			m_writeInProgress = true;
+
+			asio::async_write(m_socket,
+				asio::buffer(m_writeQueue.front().header),
+				[this, self](std::error_code ec, std::size_t)
+				{
+					if (ec) {
+						onWriteComplete(ec, 1, 0);
+						return;
+					}
+					sendFileBody(0);
+				});
+		}
+
+		// One sendmsg with the descriptor attached (SCM_RIGHTS): the peer's
+		// recvmsg gets it along with the frame's first bytes. A partial send
+		// leaves the rest of the header to a normal write.
+		void writeDescriptorFrame()
+		{
+			m_writeInProgress = true;
+			const auto& frame = m_writeQueue.front();
+
+#if !defined(_WIN32)
+			if (m_local) {
+				int fd = frame.descriptor->native();
+				iovec iov{ const_cast<uint8_t*>(frame.header.data()), frame.header.size() };
+				alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+				msghdr msg{};
+				msg.msg_iov = &iov;
+				msg.msg_iovlen = 1;
+				msg.msg_control = control;
+				msg.msg_controllen = sizeof(control);
+
+				cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+				cmsg->cmsg_level = SOL_SOCKET;
+				cmsg->cmsg_type = SCM_RIGHTS;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+				std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+				int flags = MSG_DONTWAIT;
+#if defined(MSG_NOSIGNAL)
+				flags |= MSG_NOSIGNAL;
+#endif
+				ssize_t n;
+				do {
+					n = ::sendmsg(m_socket.native_handle(), &msg, flags);
+				} while (n < 0 && errno == EINTR);
+
+				if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					m_socket.async_wait(Socket::wait_write, [this, self = shared_from_this()](std::error_code ec)
+						{
+							if (ec) onWriteComplete(ec, 1, 0);
+							else writeDescriptorFrame();
+						});
+					return;
+				}
+				if (n < 0) {
+					onWriteComplete(std::error_code(errno, std::system_category()), 1, 0);
+					return;
+				}
+
+				std::size_t sent = static_cast<std::size_t>(n);
+				std::size_t frameBytes = frame.size();
+				if (sent == frame.header.size()) {
+					onWriteComplete({}, 1, frameBytes);
+					return;
+				}
+
+				asio::async_write(m_socket, asio::buffer(frame.header.data() + sent, frame.header.size() - sent),
+					[this, self = shared_from_this(), frameBytes](std::error_code ec, std::size_t)
+					{
+						onWriteComplete(ec, 1, frameBytes);
+					});
+				return;
+			}
+#endif
+			// Only local connections pass descriptors (see passesDescriptors)
+			onWriteComplete(std::make_error_code(std::errc::operation_not_supported), 1, 0);
+		}
+
+#if defined(__linux__)
+		// sendfile(2): page cache -> socket, no user-space copy.
+		// Runs until the socket would block, then waits for writability and resumes.
+		void sendFileBody(std::size_t sent)
+		{
+			const auto& frame = m_writeQueue.front();
+			const auto& segment = frame.file;
+
+			std::error_code ec;
+			m_socket.native_non_blocking(true, ec);
+
+			while (!ec && sent < segment.length)
+			{
+				off_t offset = static_cast<off_t>(segment.offset + sent);
+				ssize_t n = ::sendfile(m_socket.native_handle(), segment.file->native(), &offset, segment.length - sent);
+
+				if (n > 0) {
+					sent += static_cast<std::size_t>(n);
+				}
+				else if (n < 0 && errno == EINTR) {
+					continue;
+				}
+				else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					auto self = shared_from_this();
+					m_socket.async_wait(Socket::wait_write,
+						[this, self, sent](std::error_code waitEc)
+						{
+							if (waitEc) onWriteComplete(waitEc, 1, 0);
+							else sendFileBody(sent);
+						});
+					return;
+				}
+				else {
+					// n == 0: the file shrank under us; the frame can no longer be completed
+					ec = n == 0 ? std::make_error_code(std::errc::io_error)
+						: std::error_code(errno, std::system_category());
+				}
+			}
+
+			onWriteComplete(ec, 1, frame.size());
+		}
+#elif defined(ASIO_HAS_WINDOWS_OVERLAPPED_PTR)
+		// TransmitFile: the file range goes out through IOCP without entering user space.
+		void sendFileBody(std::size_t)
+		{
+			auto self = shared_from_this();
+			const auto& frame = m_writeQueue.front();
+			const auto& segment = frame.file;
+			std::size_t frameBytes = frame.size();
+
+			asio::windows::overlapped_ptr overlapped(m_socket.get_executor(),
+				[this, self, frameBytes](std::error_code ec, std::size_t)
+				{
+					onWriteComplete(ec, 1, frameBytes);
+				});
+
+			overlapped.get()->Offset = static_cast<DWORD>(segment.offset & 0xFFFFFFFF);
+			overlapped.get()->OffsetHigh = static_cast<DWORD>(segment.offset >> 32);
+
+			BOOL ok = ::TransmitFile(m_socket.native_handle(), segment.file->native(),
+				static_cast<DWORD>(segment.length), 0, overlapped.get(), nullptr, 0);
+			DWORD lastError = ::GetLastError();
+
+			if (!ok && lastError != ERROR_IO_PENDING) {
+				overlapped.complete(std::error_code(lastError, asio::error::get_system_category()), 0);
+			}
+			else {
+				overlapped.release();
+			}
+		}
+#else
+		// Portable fallback: positional read into a buffer, then a normal write.
+		void sendFileBody(std::size_t)
+		{
+			auto self = shared_from_this();
+			auto& frame = m_writeQueue.front();
+			const auto& segment = frame.file;
+
+			cw::buffer::PooledBuffer bytes(segment.length);
+			ssize_t n = ::pread(segment.file->native(), bytes.data(), bytes.size(), static_cast<off_t>(segment.offset));
+			if (n != static_cast<ssize_t>(bytes.size())) {
+				onWriteComplete(std::make_error_code(std::errc::io_error), 1, 0);
+				return;
+			}
+
+			std::size_t frameBytes = frame.size();
+			frame.payload = std::move(bytes).share();
+
+			asio::async_write(m_socket,
+				asio::buffer(frame.payload.data(), frame.payload.size()),
+				[this, self, frameBytes](std::error_code ec, std::size_t)
+				{
+					onWriteComplete(ec, 1, frameBytes);
+				});
+		}
+#endif
+
+		// 4. THE ROUTER (Business Logic)
+		void dispatchPacket(const cw::packet::ParsedFrame& view)
+		{
+			// Anything but another chunk may depend on the run being queued (FileDone)
+			if (view.type != cw::packet::PacketType::FileChunk) flushChunkRun();
+			if (m_chunkKey && carriesClearData(view.type)) throw std::runtime_error("file data in the clear on a connection that takes sealed chunks");
+			if (view.type != cw::packet::PacketType::Ping && view.type != cw::packet::PacketType::Pong) m_lastUsedAt = m_lastReadAt;
+			CW_TRACE(dispatch__begin, this, static_cast<unsigned>(view.type));
+			cw::metrics::TimelineSpan span("receive", "receive", view.size);
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Parse);
+			m_dispatch(*this, view);
+			CW_TRACE(dispatch__end, this, static_cast<unsigned>(view.type));
+		}
+
+		// Built-in handling: one indirect call through the registry's table, the
+		// matching onPacket overload below gets the decoded packet
+		static void dispatchBuiltIn(Connection& conn, const cw::packet::ParsedFrame& view)
+		{
+			cw::packet::PacketList::dispatch(view, [&conn](auto&& packet) { conn.onPacket(std::forward<decltype(packet)>(packet)); });
+		}
+
+		// With a handler of type H: the same table, generated for H
+		template<typename H>
+		static void dispatchTo(Connection& conn, const cw::packet::ParsedFrame& view)
+		{
+			auto& handler = *static_cast<H*>(conn.m_handler.get());
+			cw::packet::PacketList::dispatch(view, [&conn, &handler](auto&& packet)
+				{
+					using P = std::decay_t<decltype(packet)>;
+					if constexpr (HandlesPacket<H, P>) handler.onPacket(conn, std::move(packet));
+					else conn.onPacket(std::forward<decltype(packet)>(packet));
+				});
+		}
+
+		void onPacket(const cw::packet::ParsedFrame& view)
+		{
+			CW_LOG_WARN("[Recv] Unknown Packet Type: ", view.type);
+		}
+
+		void onPacket(cw::packet::Ack pkt)
+		{
+			onAck(pkt.streamId, pkt.offset);
+		}
+
+		void onPacket(cw::packet::AckBatch pkt)
+		{
+			for (const auto& ack : pkt.acks) onAck(ack.streamId, ack.offset);
+		}
+
+		void onPacket(cw::packet::Ping pkt)
+		{
+			cw::packet::Pong pong;
+			pong.nonce = pkt.nonce;
+			send(pong, Priority::Urgent);
+		}
+
+		// Arriving is all it has to do (m_lastReadAt)
+		void onPacket(cw::packet::Pong) {}
+
+		void onPacket(cw::packet::StatsRequest pkt)
+		{
+			if (!m_statsRegistry) return;
+			cw::packet::StatsResponse response;
+			response.requestId = pkt.requestId;
+			response.text = statsText(*m_statsRegistry, registry(), m_diskWriter ? m_diskWriter->load().get() : nullptr);
+			send(response);
+		}
+
+		void onPacket(cw::packet::StatsResponse pkt)
+		{
+			m_requests.complete(pkt.requestId, std::move(pkt.text));
+		}
+
+		// Ahead of the stream's FileDone: the chunks whose leaves differ from
+		// the sender's are asked for again, and FileDone waits for them. Their
+		// first copies passed the CRC32C and are in the stream's digest, so
+		// from there on the tree alone checks the stream.
+		void onPacket(cw::packet::TreeDigest pkt)
+		{
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end() || !it->second.tree || it->second.treePartial) return;
+			auto& active = it->second;
+
+			active.treeRoot = pkt.root;
+			if (active.tree->root() == pkt.root) return;
+
+			auto ranges = active.tree->mismatches(pkt.leaves);
+			if (ranges.empty()) return;
+			// The tree alone checks the stream from here, and the first copies
+			// of these chunks were counted as received and written: their
+			// repairs will be
+			active.unchecked = true;
+			for (auto [offset, length] : ranges) {
+				active.transfer->unmarkReceived(offset, length);
+				active.transfer->file->unwrite(length);
+				requestRetransmit(pkt.streamId, active, offset, length, "tree hash");
+			}
+		}
+
+		void onPacket(cw::packet::TransferStats pkt)
+		{
+			auto ms = [](std::uint64_t nanos) { return static_cast<double>(nanos) / 1e6; };
+			CW_LOG_INFO("[Stats] Receiver took ", ms(pkt.receiveNanos), " ms for stream ", pkt.streamId, " (", pkt.fileSize, " bytes): stalled on disk ",
+				ms(pkt.stallNanos), " ms, ", pkt.diskWrites, " writes of ", ms(pkt.diskMeanNanos), " ms mean, ", ms(pkt.diskP99Nanos), " ms p99");
+			if (m_onTransferStats) m_onTransferStats(pkt);
+		}
+
+		void onPacket(cw::packet::FileInfoView pkt)
+		{
+			requireSafeName(pkt.fileName, pkt.streamId);
+			if (refuseWhenBusy(pkt.streamId, pkt.fileName)) return;
+			if (auto content = pkt.extensions.find(cw::packet::FILE_INFO_CONTENT)) {
+				receiveInline(pkt, *content);
+				return;
+			}
+			if (m_downstream) {
+				openForwarded(pkt);
+				if (m_forwardMode == ForwardMode::ForwardOnly) return;
+			}
+
+			if (pkt.fileSize == cw::packet::UNKNOWN_FILE_SIZE) CW_LOG_INFO("[Recv] Starting Download: ", pkt.fileName, " (size known at its end)");
+			else CW_LOG_INFO("[Recv] Starting Download: ", pkt.fileName, " (", pkt.fileSize, " bytes)");
+
+			auto transfer = std::make_shared<cw::file::IncomingTransfer>();
+			transfer->expectedSize = pkt.fileSize;
+			openIncoming(transfer, pkt.streamId, pkt.fileName);
+			sendProgressAcks(*transfer->file, pkt.streamId);
+
+			beginTransfer(pkt.streamId, { transfer, std::nullopt });
+		}
+
+		void onPacket(cw::packet::FrontCodedFileInfo pkt)
+		{
+			if (pkt.chain >= m_receivedNames.size()) throw std::runtime_error("FrontCodedFileInfo: unknown chain");
+			std::string& name = m_receivedNames[pkt.chain];
+			pkt.decodeInto(name);
+			onPacket(cw::packet::FileInfoView{ pkt.streamId, pkt.fileSize, name });
+		}
+
+		void onPacket(cw::packet::ArchiveInfo pkt)
+		{
+			if (m_archives.contains(pkt.streamId) || m_transfers.contains(pkt.streamId))
+				throw std::runtime_error("stream id " + std::to_string(pkt.streamId) + " is already open");
+			if (m_archives.size() >= MAX_OPEN_TRANSFERS)
+				throw std::runtime_error("too many archives open on one connection");
+
+			CW_LOG_INFO("[Recv] Starting Archive on stream ", pkt.streamId);
+			m_archives.emplace(pkt.streamId, std::make_shared<IncomingArchive>());
+		}
+
+		void onPacket(cw::packet::FileResume pkt)
+		{
+			// Like FileInfo, but keeps a checkpointed partial copy of the same
+			// source and tells the sender where to continue.
+			requireSafeName(pkt.fileName);
+			if (refuseWhenBusy(pkt.streamId, pkt.fileName)) return;
+			CW_LOG_INFO("[Recv] Resumable Download: ", pkt.fileName, " (", pkt.fileSize, " bytes)");
+
+			auto transfer = std::make_shared<cw::file::IncomingTransfer>();
+			transfer->expectedSize = pkt.fileSize;
+			openResumable(transfer, pkt.fileName, pkt.fingerprint, pkt.streamId);
+			sendProgressAcks(*transfer->file, pkt.streamId);
+
+			beginTransfer(pkt.streamId, { transfer, std::nullopt });
+		}
+
+		void onPacket(cw::packet::FileCopy pkt)
+		{
+			// Like FileResume, but this end fills the file from a path it can
+			// read itself. The path is not trusted: checks and the fingerprint
+			// read run on the disk pool, and a refused copy is streamed instead.
+			requireSafeName(pkt.fileName);
+			CW_LOG_INFO("[Recv] Server-side copy: ", pkt.sourcePath, " -> ", pkt.fileName, " (", pkt.fileSize, " bytes)");
+
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			auto self = shared_from_this();
+			asio::post(m_diskWriter->executor(), [self, pkt = std::move(pkt)]() mutable
+				{
+					auto source = self->openCopySource(pkt);
+					asio::post(self->m_socket.get_executor(), [self, pkt = std::move(pkt), source = std::move(source)]() mutable
+						{
+							self->beginCopy(std::move(pkt), std::move(source));
+						});
+				});
+		}
+
+		void onPacket(cw::packet::Manifest pkt)
+		{
+			using namespace cw::packet;
+
+			// Sync mode: compare on the disk pool (hashing may read whole files)
+			CW_LOG_INFO("[Recv] Manifest of ", pkt.entries.size(), " files");
+			for (const auto& entry : pkt.entries) requireSafeName(entry.fileName);
+
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			auto self = shared_from_this();
+			asio::post(m_diskWriter->executor(), [self, pkt = std::move(pkt)]()
+				{
+					ManifestDiff diff;
+					diff.requestId = pkt.requestId;
+					diff.changed = cw::file::changedEntries(pkt.entries);
+
+					CW_LOG_INFO("[Sync] ", diff.changed.size(), " of ", pkt.entries.size(), " files need sending");
+					self->send(diff);
+				});
+		}
+
+		void onPacket(cw::packet::SubtreeDigests pkt)
+		{
+			using namespace cw::packet;
+
+			// Sync mode: each directory asked about is walked (and hashed) on the
+			// disk pool once per sync; the directories below it are summed up in
+			// the same walk for the requests that look into them next
+			for (const auto& subtree : pkt.subtrees) requireSafeName(subtree.directory);
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			auto self = shared_from_this();
+			asio::post(m_diskWriter->executor(), [self, pkt = std::move(pkt)]()
+				{
+					bool withHash = (pkt.flags & SubtreeDigests::SUBTREE_WITH_HASH) != 0;
+					ManifestDiff diff;
+					diff.requestId = pkt.requestId;
+					{
+						std::lock_guard lock(self->m_subtreesMutex);
+						if (pkt.flags & SubtreeDigests::SUBTREE_FRESH) self->m_subtrees.clear();
+						for (std::uint32_t i = 0; i < pkt.subtrees.size(); ++i) {
+							const auto& subtree = pkt.subtrees[i];
+							fs::path directory = fs::path(subtree.directory).lexically_normal();
+							if (directory == ".") directory.clear();
+							cw::file::summarizeTree(".", directory, withHash, self->m_subtrees);
+							if (!cw::file::subtreeMatches(self->m_subtrees[cw::file::subtreeKey(directory)], subtree.digest, subtree.newestNs, withHash)) {
+								diff.changed.push_back(i);
+							}
+						}
+					}
+
+					CW_LOG_INFO("[Sync] ", diff.changed.size(), " of ", pkt.subtrees.size(), " directories differ");
+					self->send(diff);
+				});
+		}
+
+		void onPacket(cw::packet::DirectoryManifest pkt)
+		{
+			// Created on the disk pool, several at once; files arriving meanwhile
+			// create their own parents, so nothing waits for this
+			CW_LOG_INFO("[Recv] Directory Manifest: ", pkt.directories.size(), " directories");
+			for (const auto& directory : pkt.directories) requireSafeName(directory);
+
+			if (m_downstream) {
+				m_downstream->send(pkt);
+				if (m_forwardMode == ForwardMode::ForwardOnly) return;
+			}
+
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			std::vector<fs::path> directories(pkt.directories.begin(), pkt.directories.end());
+			m_diskWriter->directories()->createAll(std::move(directories), m_diskWriter->executor(), m_diskWriter->threads(),
+				[count = pkt.directories.size()](std::error_code ec)
+				{
+					if (ec) CW_LOG_WARN("[Recv] Creating ", count, " directories: ", ec.message());
+				});
+		}
+
+		void onPacket(cw::packet::ManifestDiff pkt)
+		{
+			m_requests.complete(pkt.requestId, std::move(pkt.changed));
+		}
+
+		void onPacket(cw::packet::StripeInfo pkt)
+		{
+			// One of several connections carrying the same file: the first stripe
+			// to arrive opens it, the others join its transfer by id.
+			requireSafeName(pkt.fileName, pkt.streamId);
+			CW_LOG_INFO("[Recv] Stripe of ", pkt.fileName, " (", pkt.fileSize, " bytes, ", pkt.stripeCount, " streams)");
+
+			auto transfer = registry().join(pkt.transferId, [this, &pkt]()
+				{
+					auto transfer = std::make_shared<cw::file::IncomingTransfer>();
+					transfer->expectedSize = pkt.fileSize;
+					transfer->stripeCount = pkt.stripeCount;
+					openIncoming(transfer, pkt.streamId, pkt.fileName);
+					return transfer;
+				});
+
+			if (transfer->expectedSize != pkt.fileSize || transfer->stripeCount != pkt.stripeCount)
+				throw std::runtime_error("StripeInfo does not match the transfer it joins");
+
+			beginTransfer(pkt.streamId, { transfer, pkt.transferId });
+		}
+
+		// Whether a chunk's bytes fail its CRC (none sent: never)
+		static bool corrupt(std::span<const uint8_t> data, std::optional<std::uint32_t> crc)
+		{
+			if (!crc) return false;
+			cw::metrics::StageTimer stage(cw::metrics::Stage::Hash);
+			return cw::integrity::crc32c(data) != *crc;
+		}
+
+		void onPacket(cw::packet::FileChunkView pkt)
+		{
+			if (auto archive = m_archives.find(pkt.streamId); archive != m_archives.end()) {
+				auto incoming = archive->second;
+				if (corrupt(pkt.data, pkt.crc)) {
+					askForRange(pkt.streamId, incoming->retransmits, pkt.offset, static_cast<std::uint32_t>(pkt.data.size()));
+					return;
+				}
+				acceptArchiveChunk(pkt.streamId, incoming, pkt.offset, retainPayload(pkt.data), pkt.crc);
+				return;
+			}
+
+			// Checked at the end of the chain, which asks the sender for a repair
+			auto forwarded = m_forwarded.find(pkt.streamId);
+			if (forwarded != m_forwarded.end() && m_forwardMode == ForwardMode::ForwardOnly) {
+				forwardChunk(forwarded->second, pkt.offset, retainPayload(pkt.data), pkt.crc);
+				return;
+			}
+
+			// 2. Write Chunk
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end()) return;
+			auto& active = it->second;
+			auto& transfer = active.transfer;
+
+			// A chunk already in whole, come twice: writing it again would be
+			// harmless, folding it into the digest again is not
+			if (transfer->receivedAlready(pkt.offset, pkt.data.size())) {
+				CW_LOG_DEBUG("[Recv] Duplicate chunk at ", pkt.offset, " of stream ", pkt.streamId, " dropped");
+				return;
+			}
+
+			// INTEGRITY: a corrupt chunk is dropped and asked for again
+			if (corrupt(pkt.data, pkt.crc)) {
+				requestRetransmit(pkt.streamId, active, pkt.offset, static_cast<std::uint32_t>(pkt.data.size()));
+				return;
+			}
+			trackChecksum(active, pkt.offset, pkt.data.size(), pkt.crc);
+			if (active.tree) active.tree->add(pkt.offset, pkt.data);
+
+			// The write-behind queue needs bytes of its own (see retainPayload).
+			// Dedup streams write the chunk's duplicates too: not batched.
+			auto data = retainPayload(pkt.data);
+			if (active.dedup) transfer->file->write(pkt.offset, data, m_lastReadAt);
+			else queueChunkWrite(transfer, pkt.offset, data);
+			if (forwarded != m_forwarded.end()) forwardChunk(forwarded->second, pkt.offset, data, pkt.crc);
+
+			transfer->markReceived(pkt.offset, pkt.data.size());
+
+			// Dedup: the chunk also fills its duplicates and joins the store
+			if (active.dedup) acceptDedupChunk(active, pkt.offset, data);
+
+			holdForDisk(transfer);
+
+			// A resent chunk may be the last thing its FileDone was waiting for,
+			// which must find it queued
+			if (std::erase_if(active.repairs, [&pkt](const auto& range) { return range.first == pkt.offset; })) {
+				flushChunkRun();
+				settle(active);
+			}
+		}
+
+		void onPacket(cw::packet::FileRange pkt)
+		{
+			// Its descriptor came in with the frame's first bytes
+			if (m_passedFiles.empty()) throw std::runtime_error("FileRange without a passed descriptor");
+			auto source = std::move(m_passedFiles.front());
+			m_passedFiles.erase(m_passedFiles.begin());
+
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end()) return;
+			auto& active = it->second;
+			auto& transfer = active.transfer;
+
+			// Copied file to file by the kernel: no CRC, like a sendfile chunk
+			trackChecksum(active, pkt.offset, pkt.length, std::nullopt);
+			active.treePartial = true;
+			transfer->file->copyFrom(std::move(source), pkt.sourceOffset, pkt.offset, pkt.length, m_lastReadAt);
+			transfer->markReceived(pkt.offset, pkt.length);
+
+			holdForDisk(transfer);
+		}
+
+		void onPacket(cw::packet::FileHole pkt)
+		{
+			if (auto forwarded = m_forwarded.find(pkt.streamId); forwarded != m_forwarded.end()) {
+				cw::packet::FileHole hole = pkt;
+				hole.streamId = forwarded->second.streamId;
+				m_downstream->send(hole);
+				if (m_forwardMode == ForwardMode::ForwardOnly) return;
+			}
+
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end()) return;
+			auto& active = it->second;
+			auto& transfer = active.transfer;
+
+			if (pkt.offset > transfer->expectedSize || pkt.length > transfer->expectedSize - pkt.offset)
+				throw std::runtime_error("FileHole: range past the end of the file");
+
+			// Zeros leave the stream's digest as it is
+			active.digest.addZeros(pkt.length);
+			transfer->file->punchHole(pkt.offset, pkt.length);
+			transfer->markReceived(pkt.offset, pkt.length);
+		}
+
+		void onPacket(cw::packet::SignatureRequest pkt)
+		{
+			using namespace cw::packet;
+
+			// Delta mode: signatures are computed on the disk pool (reads the
+			// whole copy, unless the signature cache has them)
+			requireSafeName(pkt.fileName);
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			auto self = shared_from_this();
+			asio::post(m_diskWriter->executor(), [self, pkt = std::move(pkt)]()
+				{
+					Signatures signatures = self->m_signatureCache
+						? self->m_signatureCache->signatures(fs::path(pkt.fileName))
+						: cw::file::computeSignatures(fs::path(pkt.fileName));
+					signatures.requestId = pkt.requestId;
+					CW_LOG_INFO("[Delta] ", signatures.blocks.size(), " block signatures for ", pkt.fileName);
+					self->send(signatures);
+				});
+		}
+
+		void onPacket(cw::packet::Signatures pkt)
+		{
+			std::uint32_t requestId = pkt.requestId;
+			m_requests.complete(requestId, std::move(pkt));
+		}
+
+		void onPacket(cw::packet::DeltaInfo pkt)
+		{
+			// The new version is built beside the old copy, which BlockCopys read from
+			requireSafeName(pkt.fileName);
+			CW_LOG_INFO("[Recv] Delta of ", pkt.fileName, " (", pkt.fileSize, " bytes)");
+
+			auto delta = std::make_shared<DeltaTarget>();
+			delta->path = fs::path(pkt.fileName);
+			delta->tempPath = delta->path;
+			delta->tempPath += ".cwdelta";
+			try {
+				delta->base = std::make_shared<cw::file::FileHandle>(cw::file::FileHandle::openRead(delta->path));
+			}
+			catch (const std::system_error& e) {
+				// Block references will fail and so will the transfer
+				CW_LOG_WARN("[Delta] Old copy unavailable: ", e.what());
+			}
+
+			auto transfer = std::make_shared<cw::file::IncomingTransfer>();
+			transfer->expectedSize = pkt.fileSize;
+			openIncoming(transfer, pkt.streamId, delta->tempPath.string(), false); // Already a temporary name
+			sendProgressAcks(*transfer->file, pkt.streamId);
+
+			beginTransfer(pkt.streamId, { transfer, std::nullopt, std::move(delta) });
+		}
+
+		void onPacket(cw::packet::BlockCopy pkt)
+		{
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end() || !it->second.delta) return;
+
+			if (pkt.length > cw::file::DeltaEncoder::MAX_COPY_LENGTH)
+				throw std::runtime_error("BlockCopy: length exceeds protocol limit");
+
+			auto& transfer = it->second.transfer;
+			transfer->file->copyFrom(it->second.delta->base, pkt.sourceOffset, pkt.offset, pkt.length);
+			transfer->markReceived(pkt.offset, pkt.length);
+
+			holdForDisk(transfer);
+		}
+
+		void onPacket(cw::packet::DeltaDone pkt)
+		{
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end() || !it->second.delta) return;
+
+			// Literal chunks that failed their CRC are still on their way back
+			if (!it->second.settled()) {
+				it->second.onSettled = [this, pkt]() { finishDelta(pkt); };
+				return;
+			}
+			finishDelta(pkt);
+		}
+
+		void onPacket(cw::packet::Capabilities pkt)
+		{
+			if (pkt.version < cw::packet::MIN_PROTOCOL_VERSION) {
+				CW_LOG_ERROR("[Connection] Peer speaks protocol version ", pkt.version, ", at least ", cw::packet::MIN_PROTOCOL_VERSION, " is needed. Closing.");
+				close();
+				return;
+			}
+
+			m_peerVersion = pkt.version;
+			m_peerMaxChunkSize = pkt.maxChunkSize;
+			m_peerReceiveWindow = pkt.receiveWindow;
+			m_peerCodecs = pkt.codecs;
+			m_peerFeatures = pkt.features;
+			m_peerAnnounced = true;
+			CW_LOG_DEBUG("[Connection] Handshake complete: peer version ", pkt.version, ", features ", pkt.features);
+
+			auto waiters = std::exchange(m_capabilityWaiters, {});
+			for (auto& handler : waiters) asio::dispatch(asio::append(std::move(handler), std::error_code{}));
+		}
+
+		void onPacket(cw::packet::Session pkt)
+		{
+			// The echo of this end's own Session (asyncOpenSession)
+			if (!m_sessionWaiters.empty()) {
+				auto waiters = std::exchange(m_sessionWaiters, {});
+				for (auto& handler : waiters) asio::dispatch(asio::append(std::move(handler), std::error_code{}));
+				return;
+			}
+
+			// A client (re)joining its session. What it left behind on another
+			// connection is closed before the echo, so its files are
+			// checkpointed and no longer written to when it sends FileResume
+			// for them here.
+			if (!m_sessions) m_sessions = SessionTable::defaultInstance();
+			if (m_sessionId != 0 && m_sessionId != pkt.sessionId) m_sessions->release(m_sessionId, this);
+			m_sessionId = pkt.sessionId;
+
+			auto previous = m_sessions->claim(pkt.sessionId, weak_from_this());
+			if (!previous || previous.get() == this) {
+				send(pkt);
+				return;
+			}
+
+			CW_LOG_INFO("[Session] ", peerName(), " is back; closing the connection it left behind");
+			asio::post(previous->m_socket.get_executor(), [previous, self = shared_from_this(), pkt]()
+				{
+					if (previous->m_socket.is_open()) previous->close();
+					asio::post(self->m_socket.get_executor(), [self, pkt]() { self->send(pkt); });
+				});
+		}
+
+		void onPacket(cw::packet::CompressedChunkView pkt)
+		{
+			// Archive members are parsed here, so the chunk is decompressed here too
+			if (auto archive = m_archives.find(pkt.streamId); archive != m_archives.end()) {
+				auto incoming = archive->second;
+				std::vector<std::uint8_t> raw(pkt.rawSize);
+				std::error_code ec = cw::compression::decompress(static_cast<cw::compression::Codec>(pkt.codec), pkt.data, raw);
+				if (ec || (pkt.crc && cw::integrity::crc32c(raw) != *pkt.crc)) {
+					askForRange(pkt.streamId, incoming->retransmits, pkt.offset, pkt.rawSize);
+					return;
+				}
+				acceptArchiveChunk(pkt.streamId, incoming, pkt.offset, cw::buffer::SharedBuffer::fromVector(std::move(raw)), pkt.crc);
+				return;
+			}
+
+			// Passed on still compressed: the next hop takes every codec announced
+			if (auto forwarded = m_forwarded.find(pkt.streamId); forwarded != m_forwarded.end()) {
+				cw::packet::CompressedChunk chunk;
+				chunk.streamId = forwarded->second.streamId;
+				chunk.offset = pkt.offset;
+				chunk.codec = pkt.codec;
+				chunk.rawSize = pkt.rawSize;
+				chunk.data = retainPayload(pkt.data);
+				chunk.crc = pkt.crc;
+				m_downstream->send(std::move(chunk));
+				throttleForDownstream();
+				if (m_forwardMode == ForwardMode::ForwardOnly) return;
+			}
+
+			// Decompressed on the disk side, never on this thread
+
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end()) return;
+			auto& transfer = it->second.transfer;
+
+			// Its CRC covers the raw bytes, so the sink checks it after decompressing
+			// (and the raw bytes are never here to be hashed into the tree)
+			trackChecksum(it->second, pkt.offset, pkt.rawSize, pkt.crc);
+			it->second.treePartial = true;
+
+			transfer->file->writeCompressed(pkt.offset, static_cast<cw::compression::Codec>(pkt.codec), pkt.rawSize,
+				retainPayload(pkt.data), pkt.crc, m_lastReadAt);
+
+			transfer->markReceived(pkt.offset, pkt.rawSize);
+
+			holdForDisk(transfer);
+		}
+
+		void onPacket(cw::packet::SealedChunkView pkt)
+		{
+			// Passed on still sealed: the next hop holds the key (CAP_SEALED_CHUNKS),
+			// a ForwardOnly hop need not
+			if (auto forwarded = m_forwarded.find(pkt.streamId); forwarded != m_forwarded.end()) {
+				cw::packet::SealedChunk chunk;
+				chunk.streamId = forwarded->second.streamId;
+				chunk.offset = pkt.offset;
+				chunk.suite = pkt.suite;
+				chunk.codec = pkt.codec;
+				chunk.rawSize = pkt.rawSize;
+				chunk.salt = pkt.salt;
+				chunk.data = retainPayload(pkt.data);
+				m_downstream->send(std::move(chunk));
+				throttleForDownstream();
+				if (m_forwardMode == ForwardMode::ForwardOnly) return;
+			}
+			if (!m_chunkKey) throw std::runtime_error("SealedChunk on a connection without a chunk key");
+			auto codec = static_cast<cw::compression::Codec>(pkt.codec);
+
+			// Archive members are parsed here, so the chunk is opened here too
+			if (auto archive = m_archives.find(pkt.streamId); archive != m_archives.end()) {
+				auto incoming = archive->second;
+				std::vector<std::uint8_t> raw(pkt.rawSize);
+				if (cw::file::openSealedChunk(*cipherFor(m_archiveCipher, pkt), pkt.offset, codec, pkt.data, raw)) {
+					throw std::runtime_error("SealedChunk does not authenticate");
+				}
+				acceptArchiveChunk(pkt.streamId, incoming, pkt.offset, cw::buffer::SharedBuffer::fromVector(std::move(raw)), std::nullopt);
+				return;
+			}
+
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end()) return;
+			auto& active = it->second;
+			auto& transfer = active.transfer;
+
+			// The tag checks the bytes, opened off this thread; one that fails fails the file
+			trackChecksum(active, pkt.offset, pkt.rawSize, std::nullopt);
+			active.treePartial = true;
+			transfer->file->writeSealed(pkt.offset, cipherFor(active.cipher, pkt), codec, pkt.rawSize, retainPayload(pkt.data), m_lastReadAt);
+			transfer->markReceived(pkt.offset, pkt.rawSize);
+
+			holdForDisk(transfer);
+		}
+
+		// The cipher of the file 'pkt' is a chunk of, derived once per file
+		// and kept in 'cached'
+		const std::shared_ptr<const cw::integrity::ChunkCipher>& cipherFor(std::shared_ptr<const cw::integrity::ChunkCipher>& cached,
+			const cw::packet::SealedChunkView& pkt)
+		{
+			auto suite = static_cast<cw::integrity::ChunkCipherSuite>(pkt.suite);
+			if (!cached || cached->salt() != pkt.salt || cached->suite() != suite) {
+				cached = cw::integrity::ChunkCipher::derive(*m_chunkKey, pkt.salt, suite);
+			}
+			return cached;
+		}
+
+		// Packets that carry file bytes as they are, refused with setChunkKey
+		// (as is a FileInfo with FILE_INFO_CONTENT, see receiveInline)
+		static bool carriesClearData(cw::packet::PacketType type)
+		{
+			using cw::packet::PacketType;
+			return type == PacketType::FileChunk || type == PacketType::CompressedChunk
+				|| type == PacketType::FileBatch || type == PacketType::CompressedBatch;
+		}
+
+		void onPacket(cw::packet::FileDone pkt)
+		{
+			if (auto archive = m_archives.find(pkt.streamId); archive != m_archives.end()) {
+				archive->second->done = pkt;
+				settleArchive(pkt.streamId);
+				return;
+			}
+
+			// Passed on as it came: the next hop verifies the file itself
+			if (m_forwardMode == ForwardMode::ForwardOnly && forwardDone(pkt)) return;
+
+			// 3. Finish (after every queued write of this file has landed)
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end()) {
+				if (forwardDone(pkt)) return;
+
+				// Alone on a stream this end asked for: the request was refused
+				completeDownload(pkt.streamId, std::make_error_code(std::errc::no_such_file_or_directory), 0);
+				return;
+			}
+
+			// Ranges that never came are asked for like corrupt chunks
+			askForMissing(pkt, it->second);
+
+			// Resent chunks still on their way, or stored chunks not yet queued
+			// (also what the next hop must get before the FileDone)
+			if (!it->second.settled()) {
+				it->second.onSettled = [this, pkt]()
+					{
+						forwardDone(pkt);
+						finishFile(pkt);
+					};
+				return;
+			}
+			forwardDone(pkt);
+			finishFile(pkt);
+		}
+
+		void onPacket(cw::packet::FileAttributes pkt)
+		{
+			if (auto forwarded = m_forwarded.find(pkt.streamId); forwarded != m_forwarded.end() && m_downstream->peerSetsAttributes()) {
+				cw::packet::FileAttributes passed = pkt;
+				passed.streamId = forwarded->second.streamId;
+				m_downstream->send(passed);
+			}
+
+			// Kept by the file until finish(), which applies them after its last write
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end()) return;
+			it->second.transfer->file->setAttributes({ pkt.modifiedNs, pkt.mode });
+		}
+
+		void onPacket(cw::packet::RawPacket<cw::packet::FileBatch> pkt)
+		{
+			// Many small files in one frame: one copy of the payload, one disk job
+			receiveBatch(retainPayload(pkt.payload));
+		}
+
+		void onPacket(cw::packet::BatchDictionary pkt)
+		{
+			auto dictionary = std::make_shared<const cw::compression::Dictionary>(std::move(pkt.data));
+			if (dictionary->id() != pkt.dictionaryId) throw std::runtime_error("BatchDictionary: id does not match its contents.");
+			CW_LOG_INFO("[Recv] Batch dictionary ", pkt.dictionaryId, " (", dictionary->bytes().size(), " bytes)");
+			m_batchDictionaries[pkt.dictionaryId] = std::move(dictionary);
+		}
+
+		void onPacket(cw::packet::CompressedBatchView pkt)
+		{
+			// A batch is a few MB at most: decompressed here, then received as any other
+			auto codec = static_cast<cw::compression::Codec>(pkt.codec);
+			std::vector<std::uint8_t> raw(pkt.rawSize);
+			std::error_code ec;
+			if (pkt.dictionaryId != 0) {
+				auto dictionary = m_batchDictionaries.find(pkt.dictionaryId);
+				if (dictionary == m_batchDictionaries.end() || codec != cw::compression::Codec::Zstd) {
+					throw std::runtime_error("CompressedBatch: unknown dictionary.");
+				}
+				ec = dictionary->second->decompress(pkt.data, raw);
+			}
+			else {
+				ec = cw::compression::decompress(codec, pkt.data, raw);
+			}
+			if (ec) throw std::runtime_error("CompressedBatch: cannot decompress: " + ec.message());
+
+			receiveBatch(cw::buffer::SharedBuffer::fromVector(std::move(raw)));
+		}
+
+		// The payload of a FileBatch, plain or decompressed
+		void receiveBatch(cw::buffer::SharedBuffer payload)
+		{
+			using namespace cw::packet;
+
+			auto batch = FileBatchView::deserialize(payload.data(), payload.size());
+			CW_LOG_INFO("[Recv] File Batch: ", batch.files.size(), " files");
+			for (const auto& entry : batch.files) requireSafeName(entry.fileName);
+
+			// Small files: a copy of each costs less than tracking the batch.
+			// Batches are not acked by name, so the next hop's ack stays there.
+			if (m_downstream) {
+				FileBatch forwarded;
+				forwarded.files.reserve(batch.files.size());
+				for (const auto& entry : batch.files) {
+					forwarded.files.push_back({ std::string(entry.fileName), std::vector<uint8_t>(entry.data.begin(), entry.data.end()) });
+				}
+				m_downstream->send(std::move(forwarded));
+				throttleForDownstream();
+				if (m_forwardMode == ForwardMode::ForwardOnly) return;
+			}
+
+			std::vector<cw::file::SmallFile> files;
+			files.reserve(batch.files.size());
+			for (const auto& entry : batch.files) {
+				files.push_back({ fs::path(entry.fileName),
+					payload.slice(static_cast<std::size_t>(entry.data.data() - payload.data()), entry.data.size()) });
+			}
+
+			std::vector<fs::path> names;
+			if (m_onFilePublished) {
+				for (const auto& file : files) names.push_back(file.path);
+			}
+
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			auto self = shared_from_this();
+			std::size_t count = files.size();
+			cw::file::writeSmallFiles(*m_diskWriter, std::move(files), m_socket.get_executor(),
+				[this, self, count, names = std::move(names)](std::error_code ec, uint64_t written)
+				{
+					if (ec) {
+						CW_LOG_ERROR("[Check] BATCH WRITE FAILED: ", ec.message());
+
+						Error err;
+						err.code = static_cast<uint16_t>(ec == std::errc::no_space_on_device ? ErrorCode::DiskFull : ErrorCode::Unknown);
+						err.message = "Cannot write file batch: " + ec.message();
+						err.message.resize(std::min(err.message.size(), MAX_STRING_LENGTH));
+						send(err);
+						return;
+					}
+
+					CW_LOG_INFO("[Check] Batch of ", count, " files written (", written, " bytes).");
+					m_metrics->onFilesReceived(count, written);
+					sendAck(0, written);
+					for (const auto& name : names) m_onFilePublished(name);
+				}, m_diskTenant);
+		}
+
+		// A FileInfo carrying its whole file (FILE_INFO_CONTENT): written as a
+		// batch of one, created, written and renamed in one disk job, then
+		// acked as a stream is once written. The next hop gets it as an
+		// ordinary stream, so it need not take inline files itself.
+		void receiveInline(const cw::packet::FileInfoView& pkt, std::span<const std::uint8_t> content)
+		{
+			using namespace cw::packet;
+
+			if (m_chunkKey) throw std::runtime_error("file data in the clear on a connection that takes sealed chunks");
+			if (content.size() != pkt.fileSize) throw std::runtime_error("FileInfo: inline content does not match the file size.");
+
+			auto crc = pkt.extensions.integer<std::uint32_t>(FILE_INFO_CONTENT_CRC);
+			if (crc && cw::integrity::crc32c(content) != *crc) {
+				CW_LOG_ERROR("[Check] CHECKSUM MISMATCH on stream ", pkt.streamId, ": the file will not be acked");
+				sendError(ErrorCode::ChecksumMismatch, "File checksum mismatch on stream " + std::to_string(pkt.streamId), pkt.streamId);
+				return;
+			}
+
+			std::optional<cw::file::FileAttributes> attributes;
+			if (auto value = pkt.extensions.find(FILE_INFO_ATTRIBUTES); value && value->size() == sizeof(std::int64_t) + sizeof(std::uint32_t)) {
+				attributes = cw::file::FileAttributes{ static_cast<std::int64_t>(cw::binary::readBigEndian<std::uint64_t>(value->data())),
+					cw::binary::readBigEndian<std::uint32_t>(value->data() + sizeof(std::int64_t)) };
+			}
+
+			// Small: a copy costs less than holding on to the receive buffer
+			auto data = cw::buffer::SharedBuffer::fromVector(std::vector<std::uint8_t>(content.begin(), content.end()));
+			if (m_downstream) {
+				forwardInline(pkt, data, crc, attributes);
+				if (m_forwardMode == ForwardMode::ForwardOnly) return;
+			}
+
+			CW_LOG_INFO("[Recv] Inline file: ", pkt.fileName, " (", pkt.fileSize, " bytes)");
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+			Placed placed = placeIncoming(pkt.streamId, pkt.fileName);
+			std::vector<cw::file::SmallFile> files;
+			files.push_back({ placed.path, std::move(data), attributes });
+
+			// BACKPRESSURE: as for files, while the pool is behind
+			m_inlineBytes += pkt.fileSize;
+			if (m_inlineBytes > m_maxPendingDiskBytes && !m_inlinePaused) {
+				m_inlinePaused = true;
+				pauseReading();
+			}
+
+			cw::file::writeSmallFiles(*placed.writer, std::move(files), m_socket.get_executor(),
+				[this, self = shared_from_this(), streamId = pkt.streamId, path = placed.path, size = pkt.fileSize, started = cw::metrics::Clock::now()](std::error_code ec, uint64_t written)
+				{
+					m_inlineBytes -= size;
+					if (m_inlinePaused && m_inlineBytes <= m_maxPendingDiskBytes / 2) {
+						m_inlinePaused = false;
+						resumeReading();
+					}
+
+					if (ec) {
+						CW_LOG_ERROR("[Check] WRITE FAILED: ", ec.message());
+						sendError(errorCodeFor(ec), "Cannot write stream " + std::to_string(streamId) + ": " + ec.message(), streamId);
+						completeDownload(streamId, ec, written);
+						return;
+					}
+
+					m_metrics->onFileReceived(written, cw::metrics::Clock::now() - started);
+					sendAck(streamId, written);
+					completeDownload(streamId, {}, written);
+					if (m_onFilePublished) m_onFilePublished(path);
+				}, placed.tenant);
+		}
+
+		void onPacket(cw::packet::ChunkManifest pkt)
+		{
+			// Dedup mode: look the chunks up in the store on the disk pool, then
+			// fill the known ones from it and ask the sender for the rest
+			requireSafeName(pkt.fileName);
+			CW_LOG_INFO("[Recv] Dedup Download: ", pkt.fileName, " (", pkt.fileSize, " bytes, ", pkt.chunks.size(), " chunks)");
+
+			auto transfer = std::make_shared<cw::file::IncomingTransfer>();
+			transfer->expectedSize = pkt.fileSize;
+			openIncoming(transfer, pkt.streamId, pkt.fileName);
+			sendProgressAcks(*transfer->file, pkt.streamId);
+
+			auto dedup = std::make_shared<DedupTarget>();
+			dedup->chunks = std::move(pkt.chunks);
+			dedup->offsets.reserve(dedup->chunks.size());
+			std::uint64_t offset = 0;
+			for (const auto& chunk : dedup->chunks) {
+				dedup->offsets.push_back(offset);
+				offset += chunk.length;
+			}
+
+			ActiveTransfer active{ transfer, std::nullopt };
+			active.dedup = dedup;
+			beginTransfer(pkt.streamId, std::move(active));
+			lookUpChunks(pkt.streamId, dedup, transfer);
+		}
+
+		void onPacket(cw::packet::ChunkRequest pkt)
+		{
+			auto it = m_chunkRequestWaiters.find(pkt.streamId);
+			if (it == m_chunkRequestWaiters.end()) return;
+
+			auto handler = std::move(it->second);
+			m_chunkRequestWaiters.erase(it);
+			asio::dispatch(asio::append(std::move(handler), std::error_code{}, std::move(pkt.indices)));
+		}
+
+		void onPacket(cw::packet::Retransmit pkt)
+		{
+			// A stream passed on for a ForwardOnly hop: its sender resends
+			if (auto route = m_replyRoutes.find(pkt.streamId); route != m_replyRoutes.end()) {
+				if (auto upstream = route->second.upstream.lock()) {
+					pkt.streamId = route->second.streamId;
+					upstream->send(pkt);
+				}
+				return;
+			}
+			serveRetransmit(pkt);
+		}
+
+		void onPacket(cw::packet::FileRequest pkt)
+		{
+			CW_LOG_INFO("[Recv] File Request: ", pkt.path, " (stream ", pkt.streamId, ")");
+
+			if (m_downloadRoots.empty() || !m_downloadSender) {
+				refuseDownload(pkt.streamId);
+				return;
+			}
+
+			// Resolved on the disk pool: the path is not trusted
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			auto self = shared_from_this();
+			asio::post(m_diskWriter->executor(), [self, pkt = std::move(pkt)]() mutable
+				{
+					auto source = self->resolveDownload(pkt.path);
+					asio::post(self->m_socket.get_executor(), [self, pkt = std::move(pkt), source = std::move(source)]() mutable
+						{
+							if (source.empty()) self->refuseDownload(pkt.streamId);
+							else self->m_downloadSender(self, std::move(pkt), std::move(source));
+						});
+				});
+		}
+
+		void onPacket(cw::packet::Error pkt)
+		{
+			if (pkt.code == static_cast<uint16_t>(cw::packet::ErrorCode::Busy)) {
+				CW_LOG_WARN("[Recv] Busy: ", pkt.message);
+				m_busyRetryAfterMs.store(pkt.retryAfterMs, std::memory_order_relaxed);
+				std::lock_guard lock(m_busyRedirectMutex);
+				m_busyRedirect = pkt.redirect;
+			}
+			else {
+				CW_LOG_ERROR("[Recv] Error: ", pkt.message);
+			}
+			if (pkt.streamId == 0) return;
+
+			// A relayed stream's sender is upstream
+			if (auto route = m_replyRoutes.find(pkt.streamId); route != m_replyRoutes.end()) {
+				if (auto upstream = route->second.upstream.lock()) {
+					pkt.streamId = route->second.streamId;
+					upstream->send(pkt);
+				}
+				m_replyRoutes.erase(route);
+				return;
+			}
+			failStream(pkt.streamId, errorFor(static_cast<cw::packet::ErrorCode>(pkt.code)));
+		}
+
+		// Strand. The receiver gave up on outgoing stream 'streamId': its
+		// frames still queued go (those in a write already started finish),
+		// what it retains for resends goes, and whoever waits on it hears 'ec'
+		void failStream(std::uint32_t streamId, std::error_code ec)
+		{
+			// Only a stream this end is sending and has not released
+			auto resume = m_resumeWaiters.find(streamId);
+			if (!m_ackedOffsets.contains(streamId) && resume == m_resumeWaiters.end()) return;
+			CW_LOG_WARN("[Send] Receiver failed stream ", streamId, ": ", ec.message());
+
+			{
+				std::lock_guard lock(m_failedStreamsMutex);
+				m_failedStreams.emplace(streamId, ec);
+			}
+			m_anyStreamFailed.store(true, std::memory_order_release);
+
+			for (auto& queue : m_pendingFrames) {
+				erase_if(queue, [this, streamId](cw::packet::OutgoingFrame& frame)
+					{
+						if (frame.streamId != streamId) return false;
+						dropFrame(frame);
+						return true;
+					});
+			}
+			if (!m_writeInProgress) {
+				erase_if(m_writeQueue, [this, streamId](cw::packet::OutgoingFrame& frame)
+					{
+						if (frame.streamId != streamId) return false;
+						dropFrame(frame);
+						return true;
+					});
+			}
+			afterDrops();
+
+			m_retransmitSources.erase(streamId);
+			m_retainedChunks.erase(streamId);
+			if (resume != m_resumeWaiters.end()) {
+				auto handler = std::move(resume->second);
+				m_resumeWaiters.erase(resume);
+				asio::dispatch(asio::append(std::move(handler), ec, std::uint64_t{ 0 }));
+			}
+
+			std::vector<asio::any_completion_handler<void(std::error_code)>> failed;
+			std::erase_if(m_ackWaiters, [streamId, &failed](AckWaiter& waiter)
+				{
+					if (waiter.streamId != streamId) return false;
+					failed.push_back(std::move(waiter.handler));
+					return true;
+				});
+			for (auto& handler : failed) asio::dispatch(asio::append(std::move(handler), ec));
+		}
+
+		// A queued frame that will not be written, unaccounted
+		void dropFrame(cw::packet::OutgoingFrame& frame)
+		{
+			std::size_t size = frame.size();
+			m_classQueued[classOf(frame.priority)] -= size;
+			m_memory->remove(cw::buffer::MemoryUse::SendQueue, size);
+			m_queueSize -= size;
+			cw::buffer::HeaderPool::release(std::move(frame.header));
+		}
+
+		// The queue shrank without a write: wake producers as a write would
+		void afterDrops()
+		{
+			m_metrics->setQueuedBytes(m_queueSize);
+			if (m_queueSize <= m_lowWatermark) m_metrics->onDrained();
+			notifyDrained();
+			if (m_closing && !hasFramesToWrite()) closeSendingIfFlushed();
+		}
+
+		// Every name a peer asks this end to write (or read, for signatures and
+		// manifests) must stay under the working directory: checked as it
+		// arrives, in one pass over the name (cw::file::isSafeRelativePath), and
+		// one escaping it is a protocol error. Files this end asked to download
+		// carry its own name for them, which may be anywhere.
+		void requireSafeName(std::string_view name, std::optional<std::uint32_t> streamId = std::nullopt) const
+		{
+			if (cw::file::isSafeRelativePath(name)) return;
+			if (streamId && m_downloadWaiters.contains(*streamId)) return;
+			throw std::runtime_error("refused file name outside the destination: " + std::string(name.substr(0, 256)));
+		}
+
+		// Creates, opens and preallocates the destination file of 'transfer'.
+		// Directory creation, open and preallocation run on the disk-writer
+		// pool (or through asio's file backend, see IncomingFile); chunks
+		// arriving meanwhile are queued behind the open.
+		// Atomic unless told otherwise: the file is published on its verified FileDone.
+		void openIncoming(const std::shared_ptr<cw::file::IncomingTransfer>& transfer, std::uint32_t streamId, std::string_view fileName, bool atomic = true)
+		{
+			// [FIX] Handle Directories & 1-1 Mapping
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			// A delta's temporary file stays next to its basis
+			Placed placed = atomic ? placeIncoming(streamId, fileName) : Placed{ m_diskWriter, m_diskTenant, fs::path(fileName) };
+			transfer->file = cw::file::makeIncomingFile(*placed.writer, m_socket.get_executor(), std::move(placed.tenant));
+			transfer->diskLatency = std::make_shared<cw::metrics::LatencyHistogram>(m_metrics->diskLatency());
+			transfer->file->recordWriteLatency(transfer->diskLatency);
+			transfer->file->chargeTo(m_memory);
+			transfer->path = std::move(placed.path);
+
+			// Nothing to reserve for a stream of unknown size: it is set at its end
+			std::uint64_t reserve = transfer->expectedSize == cw::packet::UNKNOWN_FILE_SIZE ? 0 : transfer->expectedSize;
+
+			auto self = shared_from_this();
+			transfer->file->open(transfer->path, reserve,
+				[this, self, weak = std::weak_ptr(transfer), streamId, path = transfer->path, size = reserve](std::error_code ec)
+				{
+					if (!ec) return;
+
+					// Reserve failed: tell the sender now, not at 90%
+					std::string name = path.generic_string();
+					CW_LOG_ERROR("[Error] Could not open/reserve ", size, " bytes for ", name, ": ", ec.message());
+					failIncoming(streamId, weak.lock(), ec, "Cannot write " + name + ": " + ec.message());
+				},
+				atomic);
+		}
+
+		struct Placed
+		{
+			std::shared_ptr<cw::file::DiskWriter> writer;
+			std::shared_ptr<cw::file::DiskTenant> tenant;
+			fs::path path;
+		};
+
+		// The writer, tenant and name a received file is written with: with
+		// volumes (see setVolumes), those of the volume it is placed on, its
+		// name under that volume's root. A file this end asked to download
+		// keeps its own name.
+		Placed placeIncoming(std::uint32_t streamId, std::string_view fileName) const
+		{
+			if (!m_volumes || m_downloadWaiters.contains(streamId)) return { m_diskWriter, m_diskTenant, fs::path(fileName) };
+			const auto& volume = m_volumes->place(fileName);
+			// A tenant is a share of the connection's own writer only
+			auto tenant = volume.writer == m_diskWriter ? m_diskTenant : nullptr;
+			return { volume.writer, std::move(tenant), cw::file::VolumeSet::pathOn(volume, fileName) };
+		}
+
+		// Strand. Stream 'streamId' cannot be written: its sender is told to
+		// stop (an Error naming the stream), and a plain file's stream ends
+		// here, the file dropped unpublished; chunks still on their way find
+		// no stream and are ignored. Stripes, deltas and dedup streams end at
+		// their FileDone as before.
+		void failIncoming(std::uint32_t streamId, const std::shared_ptr<cw::file::IncomingTransfer>& transfer, std::error_code ec, std::string message)
+		{
+			sendError(errorCodeFor(ec), std::move(message), streamId);
+
+			auto it = m_transfers.find(streamId);
+			if (!transfer || it == m_transfers.end() || it->second.transfer != transfer) return;
+			if (it->second.stripeId || it->second.delta || it->second.dedup) return;
+
+			flushChunkRun();
+			m_transfers.erase(it);
+			transfer->file->finish([](std::error_code, std::uint64_t) {}, false);
+			completeDownload(streamId, ec, 0);
+			transfer->finished(ec, 0);
+		}
+
+		// openIncoming for a FileResume. Answers with Ack{resume offset} once the
+		// journal has been checked; the sender sends no chunks before that.
+		void openResumable(std::shared_ptr<cw::file::IncomingTransfer> transfer, const std::string& fileName,
+			std::uint64_t fingerprint, std::uint32_t streamId)
+		{
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			Placed placed = placeIncoming(streamId, fileName);
+			transfer->file = cw::file::makeIncomingFile(*placed.writer, m_socket.get_executor(), std::move(placed.tenant));
+			transfer->diskLatency = std::make_shared<cw::metrics::LatencyHistogram>(m_metrics->diskLatency());
+			transfer->file->recordWriteLatency(transfer->diskLatency);
+			transfer->file->chargeTo(m_memory);
+			transfer->path = std::move(placed.path);
+
+			auto self = shared_from_this();
+			transfer->file->openResumable(transfer->path, transfer->expectedSize, fingerprint, RESUME_CHECKPOINT_INTERVAL,
+				[this, self, transfer, name = fileName, streamId](std::error_code ec, std::uint64_t resumeOffset)
+				{
+					if (ec) {
+						CW_LOG_ERROR("[Error] Could not open ", name, " for resume: ", ec.message());
+						sendError(errorCodeFor(ec), "Cannot write " + name + ": " + ec.message(), streamId);
+					}
+					else if (resumeOffset > 0) {
+						CW_LOG_INFO("[Recv] Resuming ", name, " at byte ", resumeOffset);
+					}
+
+					// Bytes already on disk count as received for the integrity check
+					transfer->markReceived(0, resumeOffset);
+
+					cw::packet::Ack ack;
+					ack.streamId = streamId;
+					ack.offset = resumeOffset;
+					send(ack);
+				});
+		}
+
+		struct CopySource
+		{
+			std::shared_ptr<const cw::file::FileHandle> file; // Null: refused, stream it
+			bool inPlace = false;                             // Source is the destination
+		};
+
+		// Disk pool. The source of 'pkt' if it may and can be copied: it resolves
+		// (symlinks followed) inside a server-copy root, and is the file the
+		// sender read, same size and fingerprint.
+		// Roots as paths are compared: absolute, symlinks resolved, no trailing separator
+		static std::vector<fs::path> canonicalRoots(std::vector<fs::path> roots)
+		{
+			std::vector<fs::path> result;
+			for (auto& root : roots) {
+				std::error_code ec;
+				fs::path canonical = fs::weakly_canonical(fs::absolute(root, ec), ec);
+				if (!canonical.has_filename()) canonical = canonical.parent_path(); // Trailing separator
+				if (!ec) result.push_back(std::move(canonical));
+			}
+			return result;
+		}
+
+		static bool isUnder(const fs::path& root, const fs::path& path)
+		{
+			auto [rootEnd, pathEnd] = std::mismatch(root.begin(), root.end(), path.begin(), path.end());
+			return rootEnd == root.end();
+		}
+
+		// Disk pool. The regular file 'requested' names under the first download
+		// root it resolves inside (relative to each root in turn), or empty
+		fs::path resolveDownload(const std::string& requested) const
+		{
+			fs::path relative(requested);
+			for (const auto& root : m_downloadRoots) {
+				std::error_code ec;
+				fs::path source = fs::canonical(relative.is_absolute() ? relative : root / relative, ec);
+				if (ec || !isUnder(root, source)) continue;
+				if (fs::is_regular_file(source, ec) && !ec) return source;
+			}
+			CW_LOG_WARN("[Recv] File request refused: ", requested, " is not a file under the served roots");
+			return {};
+		}
+
+		void refuseDownload(std::uint32_t streamId)
+		{
+			cw::packet::FileDone done;
+			done.streamId = streamId;
+			done.fileSize = 0;
+			send(done);
+		}
+
+		// The download of 'streamId' this end asked for has finished (if it did ask)
+		void completeDownload(std::uint32_t streamId, std::error_code ec, std::uint64_t bytes)
+		{
+			auto it = m_downloadWaiters.find(streamId);
+			if (it == m_downloadWaiters.end()) return;
+
+			auto handler = std::move(it->second);
+			m_downloadWaiters.erase(it);
+			asio::dispatch(asio::append(std::move(handler), ec, bytes));
+		}
+
+		CopySource openCopySource(const cw::packet::FileCopy& pkt) const
+		{
+			std::error_code ec;
+			fs::path source = fs::canonical(fs::path(pkt.sourcePath), ec);
+			if (ec) {
+				CW_LOG_WARN("[Recv] Server-side copy refused, cannot resolve ", pkt.sourcePath, ": ", ec.message());
+				return {};
+			}
+
+			bool allowed = std::any_of(m_serverCopyRoots.begin(), m_serverCopyRoots.end(), [&source](const fs::path& root) { return isUnder(root, source); });
+			if (!allowed) {
+				CW_LOG_WARN("[Recv] Server-side copy refused, ", source, " is outside the allowed roots");
+				return {};
+			}
+
+			if (!fs::is_regular_file(source, ec) || fs::file_size(source, ec) != pkt.fileSize || ec
+				|| cw::file::fileFingerprint(source, pkt.fileSize) != pkt.fingerprint) {
+				CW_LOG_INFO("[Recv] Server-side copy skipped, ", source, " differs from what the sender read");
+				return {};
+			}
+
+			// Opening the destination would truncate the source
+			if (fs::equivalent(source, fs::path(pkt.fileName), ec)) return { nullptr, true };
+
+			try {
+				return { std::make_shared<const cw::file::FileHandle>(cw::file::FileHandle::openRead(source)) };
+			}
+			catch (const std::system_error& e) {
+				CW_LOG_WARN("[Recv] Server-side copy refused: ", e.what());
+				return {};
+			}
+		}
+
+		// Strand. Opens the destination as for a FileInfo, copies what it can,
+		// and answers with Ack{bytes copied}; the sender streams the rest.
+		void beginCopy(cw::packet::FileCopy pkt, CopySource source)
+		{
+			auto ack = [this](std::uint32_t streamId, std::uint64_t offset) {
+				cw::packet::Ack ack;
+				ack.streamId = streamId;
+				ack.offset = offset;
+				send(ack);
+			};
+
+			if (source.inPlace) {
+				// Nothing to write; the FileDone that follows finds no transfer
+				CW_LOG_INFO("[Recv] ", pkt.fileName, " is already the source file");
+				ack(pkt.streamId, pkt.fileSize);
+				return;
+			}
+
+			auto transfer = std::make_shared<cw::file::IncomingTransfer>();
+			transfer->expectedSize = pkt.fileSize;
+			openIncoming(transfer, pkt.streamId, pkt.fileName);
+			sendProgressAcks(*transfer->file, pkt.streamId);
+			beginTransfer(pkt.streamId, { transfer, std::nullopt });
+
+			if (!source.file) {
+				ack(pkt.streamId, 0);
+				return;
+			}
+
+			transfer->file->cloneFrom(std::move(source.file), pkt.fileSize,
+				[this, self = shared_from_this(), transfer, ack, name = pkt.fileName, streamId = pkt.streamId](std::uint64_t copied)
+				{
+					CW_LOG_INFO("[Recv] Copied ", copied, " of ", transfer->expectedSize, " bytes of ", name, " on this side");
+
+					// Copied bytes count as received for the integrity check
+					transfer->markReceived(0, copied);
+					ack(streamId, copied);
+				});
+		}
+
+		cw::file::TransferRegistry& registry()
+		{
+			if (!m_transferRegistry) m_transferRegistry = cw::file::TransferRegistry::defaultInstance();
+			return *m_transferRegistry;
+		}
+
+		// A delta transfer: the file is built at tempPath from literal chunks and
+		// ranges of 'base' (the old copy), then renamed over 'path'.
+		struct DeltaTarget
+		{
+			fs::path path;
+			fs::path tempPath;
+			std::shared_ptr<const cw::file::FileHandle> base;
+		};
+
+		// A dedup transfer: chunks the store holds are copied in from it on the
+		// disk pool, the others arrive as FileChunks and are added to the store.
+		// Written on the strand only, except 'nextKnown' (the fill job's cursor).
+		struct DedupTarget
+		{
+			std::vector<cw::packet::ChunkRef> chunks;
+			std::vector<std::uint64_t> offsets;  // Start of each chunk in the file
+			std::vector<std::uint32_t> known;    // Chunks to copy from the store
+			std::size_t nextKnown = 0;
+			cw::FlatHashMap<std::uint32_t, std::vector<std::uint32_t>> copiesOf; // Requested chunk -> same chunk elsewhere in the file
+			bool filled = false;                 // Every stored chunk has been queued
+			std::atomic<bool> abandoned = false; // Stops the fill job
+		};
+
+		struct ActiveTransfer
+		{
+			std::shared_ptr<cw::file::IncomingTransfer> transfer;
+			std::optional<std::uint64_t> stripeId = {}; // Set when this is a joined stripe
+			std::shared_ptr<DeltaTarget> delta = {};    // Set for DeltaInfo streams
+
+			// Integrity (per stream: each stripe's FileDone carries its own digest)
+			cw::integrity::FileDigest digest = {};
+			bool unchecked = false;                                            // A chunk came without a CRC
+			std::vector<std::pair<std::uint64_t, std::uint32_t>> repairs = {}; // Ranges asked for again
+			std::function<void()> onSettled = {};                              // Deferred FileDone/DeltaDone
+			unsigned retransmits = 0;
+			std::optional<cw::integrity::TreeHash> tree = {};                  // With setTreeHash
+			std::shared_ptr<const cw::integrity::ChunkCipher> cipher = {};     // Of its SealedChunks (see cipherFor)
+			std::optional<cw::integrity::Sha256Digest> treeRoot = {};          // From the sender's TreeDigest
+			bool treePartial = false;                                          // Some chunks were not hashed here
+
+			std::shared_ptr<DedupTarget> dedup = {}; // Set for ChunkManifest streams
+
+			std::unique_ptr<Timeout> stall = {}; // With setStallTimeout
+			std::uint64_t stallMark = 0;         // receivedBytes when it last fired
+
+			// Nothing is outstanding that the stream's completion must wait for
+			bool settled() const { return repairs.empty() && (!dedup || dedup->filled); }
+		};
+
+		// Runs a deferred FileDone/DeltaDone once the stream has settled
+		static void settle(ActiveTransfer& active)
+		{
+			if (active.settled() && active.onSettled) std::exchange(active.onSettled, nullptr)();
+		}
+
+		// FileDone of 'pkt.streamId', once no resent chunk is outstanding.
+		// Checks the stream's CRC32C digest, then acks after the last write lands.
+		void finishFile(const cw::packet::FileDone& pkt)
+		{
+			using namespace cw::packet;
+
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end()) return;
+
+			auto transfer = std::move(it->second.transfer);
+			auto stripeId = it->second.stripeId;
+
+			// A stream of unknown size learns it here
+			if (transfer->expectedSize == UNKNOWN_FILE_SIZE) {
+				transfer->expectedSize = pkt.fileSize;
+				it->second.digest.setFileSize(pkt.fileSize);
+				transfer->file->setSize(pkt.fileSize);
+			}
+			bool intact = checksumMatches(it->second, pkt.crc) && treeMatches(it->second);
+			m_transfers.erase(it);
+
+			if (!intact) {
+				CW_LOG_ERROR("[Check] CHECKSUM MISMATCH on stream ", pkt.streamId, ": the file will not be acked");
+				transfer->corrupt = true;
+				sendError(ErrorCode::ChecksumMismatch, "File checksum mismatch on stream " + std::to_string(pkt.streamId), pkt.streamId);
+			}
+
+			// A stripe of a download this end asked for hears how the file
+			// ended from whichever stripe completes it
+			if (transfer->stripeCount > 1 && m_downloadWaiters.contains(pkt.streamId)) {
+				transfer->onFinished([weak = weak_from_this(), streamId = pkt.streamId](std::error_code ec, std::uint64_t written)
+					{
+						auto self = weak.lock();
+						if (!self) return;
+						asio::post(self->m_socket.get_executor(), [self, streamId, ec, written]() { self->completeDownload(streamId, ec, written); });
+					});
+			}
+
+			// A striped file completes with the FileDone of its last stripe
+			if (!transfer->markStripeDone()) {
+				CW_LOG_DEBUG("[Recv] Stripe finished, waiting for the other streams.");
+				return;
+			}
+			if (stripeId) registry().remove(*stripeId);
+
+			// Published under its name only if verified: readers never see a torn or corrupt copy
+			bool verified = !transfer->corrupt && transfer->receivedAll(pkt.fileSize);
+			auto self = shared_from_this();
+			transfer->file->finish([this, self, transfer, streamId = pkt.streamId, expected = pkt.fileSize](std::error_code ec, uint64_t written)
+				{
+					CW_LOG_INFO("[Recv] File Download Complete.");
+					if (!ec && !transfer->corrupt && transfer->receivedAll(expected) && written == expected) {
+						CW_LOG_INFO("[Check] Integrity Validated (", written, " bytes).");
+						m_metrics->onFileReceived(written, cw::metrics::Clock::now() - transfer->started);
+
+						// Send Ack back to client
+						sendAck(streamId, written);
+						sendTransferStats(streamId, *transfer, written);
+						completeDownload(streamId, {}, written);
+						transfer->finished({}, written);
+						if (m_onFilePublished) m_onFilePublished(transfer->path);
+					}
+					else if (ec) {
+						CW_LOG_ERROR("[Check] WRITE FAILED: ", ec.message());
+						sendError(errorCodeFor(ec), "Cannot write stream " + std::to_string(streamId) + ": " + ec.message(), streamId);
+						completeDownload(streamId, ec, written);
+						transfer->finished(ec, written);
+					}
+					else {
+						if (!transfer->corrupt) CW_LOG_ERROR("[Check] CORRUPTION DETECTED! Expected ", expected, " but got ", written);
+						completeDownload(streamId, std::make_error_code(std::errc::illegal_byte_sequence), written);
+						transfer->finished(std::make_error_code(std::errc::illegal_byte_sequence), written);
+					}
+				},
+				verified);
+		}
+
+		// Where the time of a file just acked went, for a sender that wants to know
+		void sendTransferStats(std::uint32_t streamId, const cw::file::IncomingTransfer& transfer, std::uint64_t written)
+		{
+			if (!peerTakesTransferStats()) return;
+
+			auto nanos = [](auto duration) { return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()); };
+			cw::packet::TransferStats stats;
+			stats.streamId = streamId;
+			stats.fileSize = written;
+			stats.receiveNanos = nanos(std::chrono::steady_clock::now() - transfer.started);
+			stats.stallNanos = transfer.stallNanos.load(std::memory_order_relaxed);
+			if (transfer.diskLatency) {
+				cw::metrics::LatencySnapshot disk = transfer.diskLatency->snapshot();
+				stats.diskWrites = disk.count;
+				stats.diskMeanNanos = disk.count ? disk.sumNanos / disk.count : 0;
+				stats.diskP99Nanos = disk.quantile(0.99);
+			}
+			send(stats);
+		}
+
+		// DeltaDone of 'pkt.streamId', once no resent literal is outstanding:
+		// verifies the rebuilt file's hash and swaps it in for the old copy.
+		void finishDelta(const cw::packet::DeltaDone& pkt)
+		{
+			auto it = m_transfers.find(pkt.streamId);
+			if (it == m_transfers.end() || !it->second.delta) return;
+
+			auto transfer = std::move(it->second.transfer);
+			auto delta = std::move(it->second.delta);
+			m_transfers.erase(it);
+
+			auto self = shared_from_this();
+			transfer->file->finish([this, self, transfer, delta, pkt](std::error_code ec, uint64_t written)
+				{
+					if (ec || written != pkt.fileSize || !transfer->receivedAll(pkt.fileSize)) {
+						CW_LOG_ERROR("[Delta] Rebuild of ", delta->path, " failed", (ec ? ": " + ec.message() : std::string()));
+						std::error_code ignored;
+						fs::remove(delta->tempPath, ignored);
+						return;
+					}
+
+					// Verify and swap in on the disk pool: hashing reads the whole file
+					asio::post(m_diskWriter->executor(), [this, self, delta, pkt, started = transfer->started]()
+						{
+							delta->base.reset();
+
+							std::error_code ec;
+							if (cw::file::contentHash(delta->tempPath) == pkt.hash) {
+								fs::rename(delta->tempPath, delta->path, ec);
+							}
+							else {
+								ec = std::make_error_code(std::errc::illegal_byte_sequence);
+							}
+
+							if (ec) {
+								std::error_code ignored;
+								fs::remove(delta->tempPath, ignored);
+								CW_LOG_WARN("[Delta] ", delta->path, " not replaced: ", ec.message());
+
+								cw::packet::Error err;
+								err.streamId = pkt.streamId;
+								err.message = "Delta of " + delta->path.string() + " failed: " + ec.message();
+								err.message.resize(std::min(err.message.size(), cw::packet::MAX_STRING_LENGTH));
+								send(err);
+								return;
+							}
+
+							CW_LOG_INFO("[Check] Delta Validated (", pkt.fileSize, " bytes).");
+							m_metrics->onFileReceived(pkt.fileSize, cw::metrics::Clock::now() - started);
+							sendAck(pkt.streamId, pkt.fileSize);
+							if (m_onFilePublished) m_onFilePublished(delta->path);
+						});
+				});
+		}
+
+		// Dedup, step 1 (disk pool): which chunks the store already holds. Each
+		// distinct chunk is checked once; unknown ones are requested once and
+		// their repeats within the file are filled when they arrive.
+		void lookUpChunks(std::uint32_t streamId, std::shared_ptr<DedupTarget> dedup, std::shared_ptr<cw::file::IncomingTransfer> transfer)
+		{
+			if (!m_chunkStore) m_chunkStore = cw::file::ChunkStore::defaultInstance();
+
+			auto self = shared_from_this();
+			asio::post(m_diskWriter->executor(), [self, streamId, dedup, transfer, store = m_chunkStore]()
+				{
+					struct HashOfChunk
+					{
+						std::size_t operator()(const cw::packet::ChunkHash& hash) const
+						{
+							std::size_t value;
+							std::memcpy(&value, hash.data(), sizeof(value));
+							return value;
+						}
+					};
+
+					cw::FlatHashMap<cw::packet::ChunkHash, std::uint32_t, HashOfChunk> firstOf;
+					firstOf.reserve(dedup->chunks.size());
+					std::vector<bool> stored(dedup->chunks.size(), false);
+					std::vector<std::uint32_t> known;
+					cw::packet::ChunkRequest request;
+					request.streamId = streamId;
+					cw::FlatHashMap<std::uint32_t, std::vector<std::uint32_t>> copiesOf;
+
+					for (std::uint32_t i = 0; i < dedup->chunks.size(); ++i) {
+						const auto& chunk = dedup->chunks[i];
+						auto [first, inserted] = firstOf.emplace(chunk.hash, i);
+						if (inserted) stored[i] = store->contains(chunk.hash, chunk.length);
+
+						if (stored[first->second]) known.push_back(i);
+						else if (inserted) request.indices.push_back(i);
+						else copiesOf[first->second].push_back(i);
+					}
+
+					asio::post(self->m_socket.get_executor(),
+						[self, streamId, dedup, transfer, known = std::move(known), request = std::move(request), copiesOf = std::move(copiesOf)]() mutable
+						{
+							auto it = self->m_transfers.find(streamId);
+							if (it == self->m_transfers.end() || it->second.dedup != dedup) return;
+
+							CW_LOG_INFO("[Dedup] ", known.size(), " of ", dedup->chunks.size(), " chunks already stored, requesting ", request.indices.size());
+
+							dedup->known = std::move(known);
+							dedup->copiesOf = std::move(copiesOf);
+							self->send(request);
+							self->fillFromStore(streamId, dedup, transfer);
+						});
+				});
+		}
+
+		// Dedup, step 2 (disk pool): queues copies of the stored chunks into the
+		// file, pausing while its write queue is full. Settles the stream when done.
+		void fillFromStore(std::uint32_t streamId, std::shared_ptr<DedupTarget> dedup, std::shared_ptr<cw::file::IncomingTransfer> transfer)
+		{
+			auto self = shared_from_this();
+			asio::post(m_diskWriter->executor(), [self, streamId, dedup, transfer, store = m_chunkStore, limit = m_maxPendingDiskBytes]()
+				{
+					while (dedup->nextKnown < dedup->known.size()) {
+						if (dedup->abandoned) return;
+
+						if (transfer->file->pendingBytes() > limit) {
+							transfer->file->whenDrained(limit / 2, [self, streamId, dedup, transfer]()
+								{
+									asio::dispatch(self->m_socket.get_executor(), [self, streamId, dedup, transfer]() { self->fillFromStore(streamId, dedup, transfer); });
+								});
+							return;
+						}
+
+						std::uint32_t index = dedup->known[dedup->nextKnown++];
+						const auto& chunk = dedup->chunks[index];
+
+						// A chunk missing from the store leaves the file short: it fails its check
+						std::shared_ptr<const cw::file::FileHandle> source;
+						try {
+							source = std::make_shared<const cw::file::FileHandle>(cw::file::FileHandle::openRead(store->pathFor(chunk.hash)));
+						}
+						catch (const std::system_error& e) {
+							CW_LOG_WARN("[Dedup] Stored chunk unavailable: ", e.what());
+						}
+
+						transfer->file->copyFrom(std::move(source), 0, dedup->offsets[index], chunk.length);
+						transfer->markReceived(dedup->offsets[index], chunk.length);
+					}
+
+					asio::post(self->m_socket.get_executor(), [self, streamId, dedup]()
+						{
+							dedup->filled = true;
+							auto it = self->m_transfers.find(streamId);
+							if (it != self->m_transfers.end() && it->second.dedup == dedup) settle(it->second);
+						});
+				});
+		}
+
+		// Dedup, step 3: a requested chunk arrived. It is written to its repeats
+		// in the file as well, and added to the store on the disk pool.
+		void acceptDedupChunk(ActiveTransfer& active, std::uint64_t offset, const cw::buffer::SharedBuffer& data)
+		{
+			auto& dedup = *active.dedup;
+			auto at = std::lower_bound(dedup.offsets.begin(), dedup.offsets.end(), offset);
+			if (at == dedup.offsets.end() || *at != offset) return;
+
+			auto index = static_cast<std::uint32_t>(at - dedup.offsets.begin());
+			const auto& chunk = dedup.chunks[index];
+			if (chunk.length != data.size()) return;
+
+			if (auto copies = dedup.copiesOf.find(index); copies != dedup.copiesOf.end()) {
+				for (std::uint32_t copy : copies->second) {
+					active.transfer->file->write(dedup.offsets[copy], data);
+					active.transfer->markReceived(dedup.offsets[copy], chunk.length);
+				}
+				dedup.copiesOf.erase(copies);
+			}
+
+			asio::post(m_diskWriter->executor(), [store = m_chunkStore, hash = chunk.hash, data]()
+				{
+					if (std::error_code ec = store->insert(hash, data.span())) {
+						CW_LOG_WARN("[Dedup] Chunk not stored: ", ec.message());
+					}
+				});
+		}
+
+		// An archive stream being unpacked (ArchiveInfo). Shared with its disk jobs.
+		struct IncomingArchive
+		{
+			cw::file::ArchiveUnpacker unpacker;
+			cw::integrity::FileDigest digest{ cw::integrity::FileDigest::UNKNOWN_SIZE };
+			bool unchecked = false;
+			unsigned retransmits = 0;
+			std::uint64_t lastAcked = 0;
+
+			std::size_t writesInFlight = 0;   // writeSmallFiles jobs on the pool
+			std::uint64_t pendingBytes = 0;   // Members handed to them, not yet written
+			std::size_t files = 0;            // Written
+			std::uint64_t writtenBytes = 0;
+			bool readPaused = false;
+			std::optional<cw::packet::FileDone> done;
+		};
+
+		// Members are written in batches of about this many bytes, each one job
+		// on the disk pool, so several batches are written at once
+		static constexpr std::uint64_t ARCHIVE_BATCH_BYTES = 1024 * 1024;
+
+		void acceptArchiveChunk(std::uint32_t streamId, const std::shared_ptr<IncomingArchive>& archive, std::uint64_t offset,
+			cw::buffer::SharedBuffer data, const std::optional<std::uint32_t>& crc)
+		{
+			std::size_t length = data.size();
+			if (!archive->unpacker.add(offset, std::move(data))) return;
+			if (crc) archive->digest.add(offset, length, *crc);
+			else archive->unchecked = true;
+
+			// Progress acks keep the sender's ack window moving and free what it retains for resends
+			std::uint64_t received = archive->unpacker.received();
+			if (received - archive->lastAcked >= cw::packet::ACK_INTERVAL) {
+				archive->lastAcked = received;
+				sendAck(streamId, received);
+			}
+
+			if (archive->unpacker.readyBytes() >= ARCHIVE_BATCH_BYTES || archive->unpacker.readyCount() >= cw::packet::MAX_BATCH_FILES) {
+				writeArchiveMembers(streamId, archive);
+			}
+
+			// BACKPRESSURE: as for files, while the pool is behind
+			if (archive->pendingBytes + archive->unpacker.bufferedBytes() > m_maxPendingDiskBytes && !archive->readPaused) {
+				archive->readPaused = true;
+				pauseReading();
+			}
+
+			if (archive->done) settleArchive(streamId);
+		}
+
+		// Hands the members completed so far to the disk pool as one batch
+		void writeArchiveMembers(std::uint32_t streamId, const std::shared_ptr<IncomingArchive>& archive)
+		{
+			auto files = archive->unpacker.takeReady();
+			if (files.empty()) return;
+
+			std::vector<fs::path> names;
+			if (m_onFilePublished) {
+				for (const auto& file : files) names.push_back(file.path);
+			}
+
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			std::size_t count = files.size();
+			std::uint64_t bytes = 0;
+			for (const auto& file : files) bytes += file.data.size();
+			++archive->writesInFlight;
+			archive->pendingBytes += bytes;
+
+			cw::file::writeSmallFiles(*m_diskWriter, std::move(files), m_socket.get_executor(),
+				[this, self = shared_from_this(), streamId, archive, count, bytes, names = std::move(names)](std::error_code ec, uint64_t written)
+				{
+					--archive->writesInFlight;
+					archive->pendingBytes -= bytes;
+					if (archive->readPaused && archive->pendingBytes <= m_maxPendingDiskBytes / 2) {
+						archive->readPaused = false;
+						resumeReading();
+					}
+
+					auto it = m_archives.find(streamId);
+					bool current = it != m_archives.end() && it->second == archive;
+
+					if (ec) {
+						CW_LOG_ERROR("[Check] ARCHIVE WRITE FAILED: ", ec.message());
+						sendError(errorCodeFor(ec), "Cannot write archive members: " + ec.message(), streamId);
+
+						// What is still to come of it is dropped with it
+						if (current) m_archives.erase(it);
+						return;
+					}
+
+					archive->files += count;
+					archive->writtenBytes += written;
+					m_metrics->onFilesReceived(count, written);
+					for (const auto& name : names) m_onFilePublished(name);
+					if (current) settleArchive(streamId);
+				}, m_diskTenant);
+		}
+
+		// The archive's FileDone, once every byte up to it has been parsed
+		// (resent chunks may still be on their way) and every member written
+		void settleArchive(std::uint32_t streamId)
+		{
+			using namespace cw::packet;
+
+			auto it = m_archives.find(streamId);
+			if (it == m_archives.end() || !it->second->done) return;
+			auto archive = it->second;
+			const FileDone& done = *archive->done;
+
+			// The sender gave up: the members written so far stay
+			if (done.fileSize == UNKNOWN_FILE_SIZE) {
+				CW_LOG_WARN("[Recv] Archive on stream ", streamId, " abandoned by the sender after ", archive->files, " files");
+				m_archives.erase(it);
+				return;
+			}
+
+			std::uint64_t received = archive->unpacker.received();
+			if (received < done.fileSize) return;
+			if (received > done.fileSize || !archive->unpacker.ended())
+				throw std::runtime_error("archive on stream " + std::to_string(streamId) + " does not end where its FileDone says");
+
+			writeArchiveMembers(streamId, archive);
+			if (archive->writesInFlight > 0) return;
+			m_archives.erase(it);
+
+			if (done.crc && !archive->unchecked) {
+				archive->digest.setFileSize(done.fileSize);
+				if (archive->digest.value() != *done.crc) {
+					CW_LOG_ERROR("[Check] ARCHIVE DIGEST MISMATCH on stream ", streamId);
+					sendError(ErrorCode::ChecksumMismatch, "Archive on stream " + std::to_string(streamId) + " failed its digest", streamId);
+					return;
+				}
+			}
+
+			CW_LOG_INFO("[Check] Archive unpacked: ", archive->files, " files (", archive->writtenBytes, " bytes).");
+			sendAck(streamId, done.fileSize);
+		}
+
+		// A chunk failed its CRC32C: drop it, tell the sender and ask for the range
+		// again. Completion of the stream waits until it has been resent.
+		void requestRetransmit(std::uint32_t streamId, ActiveTransfer& active, std::uint64_t offset, std::uint32_t length, const char* check = "CRC32C")
+		{
+			askForRange(streamId, active.retransmits, offset, length, check);
+			active.repairs.emplace_back(offset, length);
+		}
+
+		// FileDone of a stream with ranges of its file not received: a checked
+		// stream's sender can resend them, in pieces of MISSING_PIECE, and the
+		// FileDone waits as for a corrupt chunk. A striped file's ranges may
+		// be on their way on other stripes; it is checked whole at the last
+		// FileDone instead.
+		void askForMissing(const cw::packet::FileDone& pkt, ActiveTransfer& active)
+		{
+			if (!pkt.crc || active.transfer->stripeCount != 1 || active.dedup || active.delta) return;
+
+			std::vector<std::pair<std::uint64_t, std::uint32_t>> pieces;
+			for (auto [from, to] : active.transfer->missingRanges(pkt.fileSize)) {
+				for (std::uint64_t at = from; at < to; at += MISSING_PIECE) {
+					auto length = static_cast<std::uint32_t>(std::min<std::uint64_t>(MISSING_PIECE, to - at));
+					bool repairing = std::ranges::any_of(active.repairs, [&](const auto& range) { return range.first < at + length && at < range.first + range.second; });
+					if (!repairing) pieces.emplace_back(at, length);
+				}
+			}
+			if (pieces.empty()) return;
+			if (active.retransmits + pieces.size() > MAX_RETRANSMITS) {
+				CW_LOG_ERROR("[Recv] Stream ", pkt.streamId, " ended ", pieces.size(), " ranges short, too many to ask for");
+				return;
+			}
+
+			CW_LOG_WARN("[Recv] Stream ", pkt.streamId, " ended ", pieces.size(), " ranges short, requesting them");
+			for (auto [offset, length] : pieces) {
+				++active.retransmits;
+				cw::packet::Retransmit retransmit;
+				retransmit.streamId = pkt.streamId;
+				retransmit.offset = offset;
+				retransmit.length = length;
+				send(retransmit);
+				active.repairs.emplace_back(offset, length);
+			}
+		}
+
+		// The Retransmit itself, counted against the stream's MAX_RETRANSMITS
+		void askForRange(std::uint32_t streamId, unsigned& retransmits, std::uint64_t offset, std::uint32_t length, const char* check = "CRC32C")
+		{
+			if (++retransmits > MAX_RETRANSMITS)
+				throw std::runtime_error("stream " + std::to_string(streamId) + " keeps failing its checksums");
+
+			CW_LOG_WARN("[Check] Chunk at ", offset, " of stream ", streamId, " failed its ", check, ", requesting it again");
+			sendError(cw::packet::ErrorCode::ChecksumMismatch,
+				"Chunk at " + std::to_string(offset) + " of stream " + std::to_string(streamId) + " is corrupt");
+
+			cw::packet::Retransmit retransmit;
+			retransmit.streamId = streamId;
+			retransmit.offset = offset;
+			retransmit.length = length;
+			send(retransmit);
+		}
+
+		// Folds an accepted chunk into the stream's FileDone digest
+		static void trackChecksum(ActiveTransfer& active, std::uint64_t offset, std::uint64_t length, const std::optional<std::uint32_t>& crc)
+		{
+			if (crc) active.digest.add(offset, length, *crc);
+			else active.unchecked = true;
+		}
+
+		// Streams with unchecked (kernel-copied) chunks carry no digest
+		static bool checksumMatches(const ActiveTransfer& active, const std::optional<std::uint32_t>& crc)
+		{
+			return !crc || active.unchecked || active.digest.value() == *crc;
+		}
+
+		// The stream's tree, resent ranges included, against the sender's root, if it sent one
+		static bool treeMatches(const ActiveTransfer& active)
+		{
+			if (!active.treeRoot || !active.tree) return true;
+			if (active.tree->root() == *active.treeRoot) return true;
+			CW_LOG_ERROR("[Check] Tree root of ", active.tree->size(), " chunks differs from the sender's");
+			return false;
+		}
+
+		// Peer asked for a chunk again: re-read it on the disk pool and resend it
+		void serveRetransmit(const cw::packet::Retransmit& pkt)
+		{
+			// From a source that cannot be read again: the chunk as it was sent
+			if (auto retained = m_retainedChunks.find(pkt.streamId); retained != m_retainedChunks.end()) {
+				for (const auto& kept : retained->second) {
+					if (kept.offset != pkt.offset || kept.data.size() < pkt.length) continue;
+					cw::packet::SharedFileChunk chunk;
+					chunk.streamId = pkt.streamId;
+					chunk.offset = pkt.offset;
+					chunk.data = kept.data.slice(0, pkt.length);
+					chunk.crc = cw::integrity::crc32c(chunk.data.span());
+					send(chunk);
+					return;
+				}
+				CW_LOG_ERROR("[Check] Chunk at ", pkt.offset, " of stream ", pkt.streamId, " is no longer kept, cannot resend it");
+				return;
+			}
+
+			auto it = m_retransmitSources.find(pkt.streamId);
+			if (it == m_retransmitSources.end() || pkt.offset + pkt.length > it->second.fileSize) {
+				CW_LOG_ERROR("[Check] Cannot resend ", pkt.length, " bytes of stream ", pkt.streamId);
+				return;
+			}
+
+			if (!m_diskWriter) m_diskWriter = cw::file::DiskWriter::defaultInstance();
+
+			auto self = shared_from_this();
+			asio::post(m_diskWriter->executor(), [self, pkt, path = it->second.path, base = it->second.baseOffset]()
+				{
+					std::vector<uint8_t> bytes(pkt.length);
+					std::error_code ec;
+					try {
+						ec = cw::file::FileHandle::openRead(path).readAt(base + pkt.offset, bytes);
+					}
+					catch (const std::system_error& e) {
+						ec = e.code();
+					}
+					if (ec) {
+						CW_LOG_ERROR("[Check] Cannot resend chunk at ", pkt.offset, " of ", path, ": ", ec.message());
+						return;
+					}
+
+					cw::packet::SharedFileChunk chunk;
+					chunk.streamId = pkt.streamId;
+					chunk.offset = pkt.offset;
+					chunk.crc = cw::integrity::crc32c(bytes);
+					chunk.data = cw::buffer::SharedBuffer::fromVector(std::move(bytes));
+					self->send(chunk);
+				});
+		}
+
+		// Strand. See sendAck
+		void delayAck(std::uint32_t streamId, std::uint64_t offset)
+		{
+			if (m_failed) return;
+
+			// Acks of stream 0 each count one FileBatch: never merged
+			auto same = streamId == 0 ? m_pendingAcks.end()
+				: std::find_if(m_pendingAcks.begin(), m_pendingAcks.end(), [streamId](const cw::packet::Ack& ack) { return ack.streamId == streamId; });
+			if (same != m_pendingAcks.end()) {
+				same->offset = std::max(same->offset, offset);
+			}
+			else {
+				cw::packet::Ack ack;
+				ack.streamId = streamId;
+				ack.offset = offset;
+				m_pendingAcks.push_back(ack);
+			}
+
+			if (m_pendingAcks.size() >= cw::packet::MAX_ACK_BATCH) {
+				flushAcks();
+				return;
+			}
+			if (m_ackTimerArmed) return;
+
+			if (!m_ackTimer) m_ackTimer = std::make_unique<asio::steady_timer>(m_socket.get_executor());
+			m_ackTimerArmed = true;
+			m_ackTimer->expires_after(m_ackDelay);
+			m_ackTimer->async_wait([weak = weak_from_this()](std::error_code ec)
+				{
+					auto self = weak.lock();
+					if (!self) return;
+					self->m_ackTimerArmed = false;
+					if (!ec) self->flushAcks();
+				});
+		}
+
+		// Strand. The pending acks as one frame, accounted as queued: a
+		// lone Ack as itself, more as an AckBatch
+		cw::packet::OutgoingFrame takeAcks()
+		{
+			cw::packet::OutgoingFrame frame;
+			if (m_pendingAcks.size() == 1) {
+				frame = cw::packet::buildOutgoingFrame(m_pendingAcks.front(), frameFormat());
+			}
+			else {
+				cw::packet::AckBatch batch;
+				batch.acks = std::move(m_pendingAcks);
+				frame = cw::packet::buildOutgoingFrame(batch, frameFormat());
+			}
+			m_pendingAcks.clear();
+
+			frame.enqueuedAt = cw::metrics::Clock::now();
+			frame.priority = Priority::Urgent;
+			account(frame.priority, frame.size());
+			return frame;
+		}
+
+		// Strand. The delay ran out (or the connection is closing): the
+		// pending acks go with the next write, or start one
+		void flushAcks()
+		{
+			if (m_pendingAcks.empty() || m_failed) return;
+			if (!m_writeInProgress && !heldByCork()) {
+				writeQueueFront();
+				return;
+			}
+			enqueueFrame(takeAcks());
+		}
+
+		void dropAcks()
+		{
+			m_pendingAcks.clear();
+			if (m_ackTimer) m_ackTimer->cancel();
+		}
+
+		static cw::packet::ErrorCode errorCodeFor(std::error_code ec)
+		{
+			if (ec == std::errc::no_space_on_device) return cw::packet::ErrorCode::DiskFull;
+			if (ec == std::errc::illegal_byte_sequence) return cw::packet::ErrorCode::ChecksumMismatch;
+			if (ec == std::errc::permission_denied) return cw::packet::ErrorCode::Rejected;
+			if (ec == std::errc::timed_out) return cw::packet::ErrorCode::TimedOut;
+			if (ec == std::errc::resource_unavailable_try_again) return cw::packet::ErrorCode::Busy;
+			return cw::packet::ErrorCode::Unknown;
+		}
+
+		// The sender's side of errorCodeFor
+		static std::error_code errorFor(cw::packet::ErrorCode code)
+		{
+			switch (code) {
+			case cw::packet::ErrorCode::DiskFull: return std::make_error_code(std::errc::no_space_on_device);
+			case cw::packet::ErrorCode::ChecksumMismatch: return std::make_error_code(std::errc::illegal_byte_sequence);
+			case cw::packet::ErrorCode::Rejected: return std::make_error_code(std::errc::permission_denied);
+			case cw::packet::ErrorCode::TimedOut: return std::make_error_code(std::errc::timed_out);
+			case cw::packet::ErrorCode::Busy: return std::make_error_code(std::errc::resource_unavailable_try_again);
+			default: return std::make_error_code(std::errc::io_error);
+			}
+		}
+
+		// Admission control (DiskWriter::setAdmissionLimits): while the disk is
+		// behind, the new file on 'streamId' is refused with how long to wait
+		// (and a peer with room, see setLoadGossip), and its chunks, finding no transfer, are dropped. Files only
+		// forwarded do not land here and are not refused.
+		bool refuseWhenBusy(std::uint32_t streamId, std::string_view fileName)
+		{
+			if (!m_diskWriter || (m_downstream && m_forwardMode == ForwardMode::ForwardOnly)) return false;
+			auto delay = m_diskWriter->admissionDelay();
+			if (!delay) return false;
+
+			CW_LOG_WARN("[Recv] Disk busy, refused ", fileName, " (retry after ", delay->count(), " ms)");
+			cw::packet::Error err;
+			err.code = static_cast<uint16_t>(cw::packet::ErrorCode::Busy);
+			err.streamId = streamId;
+			err.retryAfterMs = static_cast<std::uint32_t>(delay->count());
+			err.message = "Disk busy, retry after " + std::to_string(delay->count()) + " ms";
+			if (m_loadGossip) {
+				if (auto peer = m_loadGossip->redirectTarget()) {
+					err.redirect = *peer;
+					err.message += " or send to " + *peer;
+				}
+			}
+			send(err);
+			return true;
+		}
+
+		// 'streamId' when the error ends one stream: its sender stops sending it
+		void sendError(cw::packet::ErrorCode code, std::string message, std::uint32_t streamId = 0)
+		{
+			cw::packet::Error err;
+			err.code = static_cast<uint16_t>(code);
+			err.streamId = streamId;
+			err.message = std::move(message);
+			err.message.resize(std::min(err.message.size(), cw::packet::MAX_STRING_LENGTH));
+			send(err);
+		}
+
+		// Acks 'streamId' every cw::packet::ACK_INTERVAL bytes as its data reaches the disk,
+		// so the sender's window follows our disk rather than our socket.
+		void sendProgressAcks(cw::file::IncomingFile& file, std::uint32_t streamId)
+		{
+			file.onProgress([weak = weak_from_this(), streamId, lastAcked = std::uint64_t{ 0 }](std::uint64_t written) mutable
+				{
+					if (written - lastAcked < cw::packet::ACK_INTERVAL) return;
+					auto self = weak.lock();
+					if (!self) return;
+
+					lastAcked = written;
+					self->sendAck(streamId, written);
+				});
+		}
+
+		void onAck(std::uint32_t streamId, std::uint64_t offset)
+		{
+			// Acks of a stream passed on for a ForwardOnly hop go to its sender
+			if (auto route = m_replyRoutes.find(streamId); route != m_replyRoutes.end()) {
+				if (auto upstream = route->second.upstream.lock()) upstream->sendAck(route->second.streamId, offset);
+				if (offset >= route->second.fileSize) m_replyRoutes.erase(route);
+				return;
+			}
+
+			// A FileBatch has no stream: its ack carries the bytes written
+			if (streamId == 0 && !m_batchProgress.empty()) {
+				auto [progress, files] = std::move(m_batchProgress.front());
+				m_batchProgress.pop_front();
+				progress->onAcked(offset);
+				progress->onFilesAcked(files);
+			}
+			if (auto progress = m_streamProgress.find(streamId); progress != m_streamProgress.end() && progress->second->onAck(offset)) {
+				m_streamProgress.erase(progress);
+			}
+
+			// Everything is on the peer's disk: nothing left to resend
+			if (auto source = m_retransmitSources.find(streamId); source != m_retransmitSources.end() && offset >= source->second.fileSize) {
+				m_retransmitSources.erase(source);
+			}
+			if (auto retained = m_retainedChunks.find(streamId); retained != m_retainedChunks.end()) {
+				auto& chunks = retained->second;
+				while (!chunks.empty() && chunks.front().offset + chunks.front().data.size() <= offset) chunks.pop_front();
+				if (chunks.empty()) m_retainedChunks.erase(retained);
+			}
+
+			if (auto resume = m_resumeWaiters.find(streamId); resume != m_resumeWaiters.end()) {
+				auto handler = std::move(resume->second);
+				m_resumeWaiters.erase(resume);
+				asio::dispatch(asio::append(std::move(handler), std::error_code{}, offset));
+			}
+
+			auto it = m_ackedOffsets.find(streamId);
+			if (it == m_ackedOffsets.end()) return;
+
+			it->second = std::max(it->second, offset);
+			notifyAcked({});
+		}
+
+		// Wake ack-window waiters: those now satisfied, or all of them on error
+		void notifyAcked(std::error_code ec)
+		{
+			std::vector<asio::any_completion_handler<void(std::error_code)>> ready;
+			std::erase_if(m_ackWaiters, [this, ec, &ready](AckWaiter& waiter)
+				{
+					auto it = m_ackedOffsets.find(waiter.streamId);
+					if (!ec && it != m_ackedOffsets.end() && it->second < waiter.offset) return false;
+					ready.push_back(std::move(waiter.handler));
+					return true;
+				});
+
+			for (auto& handler : ready) {
+				asio::dispatch(asio::append(std::move(handler), ec));
+			}
+
+		}
+
+		// Connection lost: fail every request still waiting for its reply
+		void abortRequests(std::error_code ec)
+		{
+			// ... except a close this end asked for, which has happened
+			auto closeWaiters = std::exchange(m_closeWaiters, {});
+			for (auto& handler : closeWaiters) asio::dispatch(asio::append(std::move(handler), m_sendClosed ? std::error_code{} : ec));
+
+			auto capabilityWaiters = std::exchange(m_capabilityWaiters, {});
+			for (auto& handler : capabilityWaiters) asio::dispatch(asio::append(std::move(handler), ec));
+
+			auto sessionWaiters = std::exchange(m_sessionWaiters, {});
+			for (auto& handler : sessionWaiters) asio::dispatch(asio::append(std::move(handler), ec));
+
+			if (auto closed = std::exchange(m_handlerClosed, nullptr)) closed(*this, ec);
+
+			auto resumeWaiters = std::exchange(m_resumeWaiters, {});
+			for (auto& [streamId, handler] : resumeWaiters) {
+				asio::dispatch(asio::append(std::move(handler), ec, std::uint64_t{ 0 }));
+			}
+
+			auto downloadWaiters = std::exchange(m_downloadWaiters, {});
+			for (auto& [streamId, handler] : downloadWaiters) {
+				asio::dispatch(asio::append(std::move(handler), ec, std::uint64_t{ 0 }));
+			}
+
+			m_requests.failAll(ec);
+
+			auto chunkRequestWaiters = std::exchange(m_chunkRequestWaiters, {});
+			for (auto& [streamId, handler] : chunkRequestWaiters) {
+				asio::dispatch(asio::append(std::move(handler), ec, std::vector<std::uint32_t>{}));
+			}
+		}
+
+		// Closing: the peer's session no longer points here
+		void leaveSession()
+		{
+			if (m_sessionId == 0 || !m_sessions) return;
+			m_sessions->release(m_sessionId, this);
+			m_sessionId = 0;
+		}
+
+		std::shared_ptr<Connection> successor() const
+		{
+			std::lock_guard<std::mutex> lock(m_successorMutex);
+			return m_successor;
+		}
+
+		// asyncReconnect's outcome, for everyone waiting on it. The new
+		// connection keeps this one's watermarks (an upload may have set them).
+		void replacedBy(std::error_code ec, std::shared_ptr<Connection> next)
+		{
+			if (!ec && next) {
+				next->setWatermarks(m_lowWatermark, m_highWatermark);
+				std::lock_guard<std::mutex> lock(m_successorMutex);
+				m_successor = next;
+			}
+			else if (!ec) {
+				ec = asio::error::operation_aborted;
+			}
+
+			auto waiters = std::exchange(m_reconnectWaiters, {});
+			for (auto& handler : waiters) asio::dispatch(asio::append(std::move(handler), ec, next));
+		}
+
+		// Registers a file opened by FileInfo/StripeInfo under its stream id
+		void beginTransfer(std::uint32_t streamId, ActiveTransfer active)
+		{
+			if (m_transfers.contains(streamId))
+				throw std::runtime_error("stream id " + std::to_string(streamId) + " is already open");
+			if (m_transfers.size() >= MAX_OPEN_TRANSFERS)
+				throw std::runtime_error("too many files open on one connection");
+
+			std::uint64_t size = active.transfer->expectedSize;
+			active.digest = cw::integrity::FileDigest(size == cw::packet::UNKNOWN_FILE_SIZE ? cw::integrity::FileDigest::UNKNOWN_SIZE : size);
+			if (m_treeHash) active.tree.emplace();
+			registry().track(active.transfer);
+			if (m_stallTimeout.count() > 0) active.stall = std::make_unique<Timeout>(m_wheel, m_socket.get_executor());
+			auto& added = m_transfers.emplace(streamId, std::move(active)).first->second;
+			if (added.stall) armStallTimer(streamId, added);
+		}
+
+		// Checks every m_stallTimeout that the stream received something since
+		void armStallTimer(std::uint32_t streamId, ActiveTransfer& active)
+		{
+			active.stallMark = active.transfer->receivedBytes;
+			active.stall->expiresAfter(m_stallTimeout, [weak = weak_from_this(), streamId, transfer = std::weak_ptr(active.transfer)]()
+				{
+					auto self = weak.lock();
+					auto current = transfer.lock();
+					if (!self || !current || !self->m_socket.is_open()) return;
+					auto it = self->m_transfers.find(streamId);
+					if (it == self->m_transfers.end() || it->second.transfer != current) return;
+
+					if (current->receivedBytes != it->second.stallMark || self->m_readPaused) {
+						self->armStallTimer(streamId, it->second);
+						return;
+					}
+
+					CW_LOG_WARN("[Recv] Stream ", streamId, " stalled, nothing received for ",
+						std::chrono::duration_cast<std::chrono::seconds>(self->m_stallTimeout).count(), " s");
+					self->failIncoming(streamId, current, std::make_error_code(std::errc::timed_out), "Stream " + std::to_string(streamId) + " stalled");
+				});
+		}
+
+		// A stream passed on to m_downstream
+		struct ForwardedStream
+		{
+			std::uint32_t streamId; // On m_downstream
+			std::uint64_t fileSize;
+		};
+
+		// Where the replies to a stream passed on for a ForwardOnly hop go
+		struct ReplyRoute
+		{
+			std::weak_ptr<Connection> upstream;
+			std::uint32_t streamId; // On 'upstream'
+			std::uint64_t fileSize;
+		};
+
+		// What passes through unchanged must suit the next hop too: its chunk
+		// limits, its codecs and the packets it takes. Holes and directory
+		// manifests are passed on, descriptors, server-side copies and archives are not;
+		// a ForwardOnly hop's acks are the next hop's.
+		void limitToDownstream(cw::packet::Capabilities& caps) const
+		{
+			using namespace cw::packet;
+
+			const Connection& next = *m_downstream;
+			std::uint32_t nextFeatures = next.m_peerFeatures.load();
+
+			auto tighter = [](auto ours, auto theirs) { return ours == 0 ? theirs : theirs == 0 ? ours : std::min(ours, theirs); };
+			caps.maxChunkSize = tighter(caps.maxChunkSize, next.m_peerMaxChunkSize.load());
+			caps.receiveWindow = tighter(caps.receiveWindow, next.m_peerReceiveWindow.load());
+			caps.codecs &= next.m_peerCodecs.load();
+
+			std::uint32_t passedOn = CAP_DIRECTORY_MANIFEST | CAP_SPARSE_FILES | CAP_UNSIZED_FILES | CAP_SEALED_CHUNKS;
+			caps.features &= ~(CAP_DESCRIPTORS | CAP_SERVER_COPY | CAP_ARCHIVES | (passedOn & ~nextFeatures));
+			if (m_forwardMode == ForwardMode::ForwardOnly) {
+				std::uint32_t theirs = CAP_DURABLE_ACKS | CAP_SEALED_CHUNKS;
+				caps.features = (caps.features & ~theirs) | (nextFeatures & theirs);
+			}
+		}
+
+		// Opens the next hop's stream for 'pkt' and announces it there
+		void openForwarded(const cw::packet::FileInfoView& pkt)
+		{
+			// Nowhere to go: a ForwardOnly hop has nothing to do with the file
+			if (!m_downstream->isOpen()) {
+				CW_LOG_WARN("[Forward] Next hop closed, not passing on ", pkt.fileName);
+				if (m_forwardMode == ForwardMode::ForwardOnly) close();
+				return;
+			}
+
+			std::uint32_t streamId = m_downstream->nextStreamId();
+			m_forwarded[pkt.streamId] = { streamId, pkt.fileSize };
+
+			// Posted before the FileInfo is, so it is in place before any ack arrives
+			if (m_forwardMode == ForwardMode::ForwardOnly) {
+				asio::post(m_downstream->m_socket.get_executor(),
+					[downstream = m_downstream, streamId, route = ReplyRoute{ weak_from_this(), pkt.streamId, pkt.fileSize }]()
+					{
+						downstream->m_replyRoutes[streamId] = route;
+					});
+			}
+
+			CW_LOG_INFO("[Forward] ", pkt.fileName, " (", pkt.fileSize, " bytes) passed on as stream ", streamId);
+			cw::packet::FileInfoView info = pkt;
+			info.streamId = streamId;
+			m_downstream->send(info);
+		}
+
+		// An inline file (see receiveInline) passed on as FileInfo, chunk,
+		// attributes and FileDone
+		void forwardInline(const cw::packet::FileInfoView& pkt, const cw::buffer::SharedBuffer& data, std::optional<std::uint32_t> crc,
+			const std::optional<cw::file::FileAttributes>& attributes)
+		{
+			openForwarded(cw::packet::FileInfoView{ pkt.streamId, pkt.fileSize, pkt.fileName });
+			auto forwarded = m_forwarded.find(pkt.streamId);
+			if (forwarded == m_forwarded.end()) return; // The next hop is gone
+			if (!data.empty()) forwardChunk(forwarded->second, 0, data, crc);
+
+			if (attributes && m_downstream->peerSetsAttributes()) {
+				cw::packet::FileAttributes passed;
+				passed.streamId = forwarded->second.streamId;
+				passed.modifiedNs = attributes->modifiedNs;
+				passed.mode = attributes->mode;
+				m_downstream->send(passed);
+			}
+
+			// One chunk covering the file: its CRC is the stream's digest
+			cw::packet::FileDone done;
+			done.streamId = pkt.streamId;
+			done.fileSize = pkt.fileSize;
+			if (!data.empty()) done.crc = crc;
+			forwardDone(done);
+		}
+
+		void forwardChunk(const ForwardedStream& forwarded, std::uint64_t offset, cw::buffer::SharedBuffer data, std::optional<std::uint32_t> crc)
+		{
+			cw::packet::SharedFileChunk chunk;
+			chunk.streamId = forwarded.streamId;
+			chunk.offset = offset;
+			chunk.data = std::move(data);
+			chunk.crc = crc;
+			m_downstream->send(chunk);
+			throttleForDownstream();
+		}
+
+		// Passes 'pkt' on if its stream is forwarded; false if it is not
+		bool forwardDone(const cw::packet::FileDone& pkt)
+		{
+			auto it = m_forwarded.find(pkt.streamId);
+			if (it == m_forwarded.end()) return false;
+
+			cw::packet::FileDone done = pkt;
+			done.streamId = it->second.streamId;
+			m_forwarded.erase(it);
+			m_downstream->send(done);
+			return true;
+		}
+
+		// The next hop is slower than the sender: stop reading until its queue
+		// drains, so TCP slows the sender down as for a slow disk
+		void throttleForDownstream()
+		{
+			if (m_readPaused || !m_downstream->isCongested(Priority::Normal)) return;
+
+			pauseReading();
+			m_downstream->asyncWaitWritable(Priority::Normal, [self = shared_from_this()](std::error_code) { self->resumeReading(); });
+		}
+
+		// The peer went away mid-file. Striped transfers can no longer complete,
+		// so drop them from the registry (a retry starts a fresh one); the
+		// other stripes of a download stop waiting for them.
+		void abandonTransfers()
+		{
+			// The next hop gets a FileDone it cannot verify unless every byte
+			// was already passed on, so it drops the file rather than waiting
+			for (auto& [streamId, forwarded] : m_forwarded) {
+				cw::packet::FileDone done;
+				done.streamId = forwarded.streamId;
+				done.fileSize = forwarded.fileSize;
+				m_downstream->send(done);
+			}
+			m_forwarded.clear();
+
+			for (auto& [streamId, active] : m_transfers) {
+				if (active.stripeId) {
+					registry().remove(*active.stripeId);
+					active.transfer->finished(asio::error::operation_aborted, 0);
+				}
+				if (active.dedup) active.dedup->abandoned = true;
+
+				// A half-built delta is useless: the old copy stays as it was
+				if (active.delta) {
+					active.transfer->file->finish([delta = active.delta](std::error_code, uint64_t)
+						{
+							std::error_code ignored;
+							fs::remove(delta->tempPath, ignored);
+						});
+				}
+				// A resumable file keeps what reached the disk, not just the last interval checkpoint
+				else {
+					active.transfer->file->checkpoint();
+				}
+			}
+			m_transfers.clear();
+		}
+
+		Connection(asio::io_context& io) :
+			m_socket(asio::make_strand(io)),
+			m_wheel(TimerWheel::of(io)),
+			m_idleDeadline(m_wheel, m_socket.get_executor()),
+			m_heartbeatDeadline(m_wheel, m_socket.get_executor())
+		{
+		}
+
+
+	private:
+		// Bytes offered to each async_read_some: start here, adapt between the
+		// bounds (cw::buffer::AdaptiveReadSize)
+		static constexpr std::size_t MIN_READ_SIZE = 4096;
+		static constexpr std::size_t READ_CHUNK_SIZE = 8192;
+		static constexpr std::size_t MAX_FLUSH_FRAMES = 4096; // Per flushSubmissions
+		static constexpr std::size_t MAX_READ_SIZE = 2 * 1024 * 1024;
+
+		// Acks wait this long for company by default (setAckDelay): enough for
+		// the acks of a run of small files to share a frame, far too little
+		// to stall an ack window
+		static constexpr std::chrono::microseconds DEFAULT_ACK_DELAY{ 2000 };
+
+		// Inline read of an idle connection, whose receive buffer is released
+		static constexpr std::size_t IDLE_READ_SIZE = 256;
+
+		// Per operation in flight (see HandlerMemory): a socket read or write,
+		// asio's own state included, or a flush
+		static constexpr std::size_t HANDLER_MEMORY_SIZE = 512;
+
+		// Payloads from this size up are read into a buffer of their own (readLargeFrame)
+		static constexpr std::size_t LARGE_FRAME_SIZE = 256 * 1024;
+
+		// Descriptors accepted by one recvmsg; the sender attaches one per FileRange
+		static constexpr std::size_t MAX_PASSED_DESCRIPTORS = 4;
+
+		// Files one peer may have open at once
+		static constexpr std::size_t MAX_OPEN_TRANSFERS = 256;
+
+		// Contiguous bytes between resume checkpoints (fsync + journal rewrite)
+		static constexpr std::uint64_t RESUME_CHECKPOINT_INTERVAL = 16 * 1024 * 1024;
+
+		// Corrupt chunks tolerated per stream before the link is given up on
+		static constexpr unsigned MAX_RETRANSMITS = 16;
+		static constexpr std::uint32_t MISSING_PIECE = 1024 * 1024; // See askForMissing
+
+		// An outgoing file whose chunks the peer may ask for again
+		struct RetransmitSource
+		{
+			fs::path path;
+			std::uint64_t fileSize = 0;   // Of the stream
+			std::uint64_t baseOffset = 0; // Where the stream starts in the file (a ranged download)
+		};
+
+		struct AckWaiter
+		{
+			std::uint32_t streamId;
+			std::uint64_t offset;
+			asio::any_completion_handler<void(std::error_code)> handler;
+		};
+
+		// On its own strand: every handler of this connection runs there, so the
+		// io_context can be run by several threads without locking the queue or
+		// file state
+		Socket m_socket;
+		bool m_local = false; // Unix domain socket, set by start()
+		std::vector<std::shared_ptr<const cw::file::FileHandle>> m_passedFiles; // Received, for the FileRanges they came with
+
+		cw::buffer::ReceiveBuffer m_incomingBuffer{ 0 }; // Allocated by the first read, see onRead
+		std::array<std::uint8_t, IDLE_READ_SIZE> m_idleRead; // Read target while the buffer is released
+		cw::buffer::AdaptiveReadSize m_readSize{ MIN_READ_SIZE, READ_CHUNK_SIZE, MAX_READ_SIZE };
+		cw::buffer::PooledBuffer m_largeBody;      // Large frame payload being read
+		cw::packet::PacketType m_largeFrameType{};
+		cw::packet::WireOrder m_largeFrameOrder{};
+		cw::buffer::SharedBuffer m_largeFrame;     // Large frame payload being dispatched
+		cw::metrics::Clock::time_point m_lastReadAt; // Arrival of the frames being dispatched
+		cw::metrics::Clock::time_point m_lastUsedAt;  // Arrival of the last frame but a Ping or Pong
+		cw::metrics::Clock::time_point m_lastWriteAt; // Of the last frames but Pings and Pongs
+		cw::metrics::Clock::time_point m_writeStartedAt; // Set only while the timeline records
+		std::chrono::steady_clock::duration m_idleTimeout{}; // See setIdleTimeout
+		std::chrono::steady_clock::duration m_stallTimeout{}; // See setStallTimeout
+		bool m_treeHash = false; // See setTreeHash
+		std::shared_ptr<const cw::integrity::ChunkKey> m_chunkKey; // See setChunkKey
+		std::shared_ptr<const cw::integrity::ChunkCipher> m_archiveCipher; // Of the last archive member opened (see cipherFor)
+		// See queueChunkWrite
+		static constexpr std::size_t MAX_RUN_CHUNKS = 64;
+		struct ChunkRun
+		{
+			std::shared_ptr<cw::file::IncomingFile> file; // Null: no run
+			std::uint64_t offset = 0;
+			std::uint64_t next = 0; // Where the next chunk continues it
+			std::size_t bytes = 0;
+			cw::metrics::Clock::time_point arrived;
+			std::vector<cw::buffer::SharedBuffer> pieces; // From BufferListPool
+		};
+		ChunkRun m_chunkRun;
+		bool m_spliceReceive = false; // See setSpliceReceive
+		bool m_zeroCopyReceive = false; // See setZeroCopyReceive
+#if defined(TCP_ZEROCOPY_RECEIVE)
+		// The chunk being received by mapChunk
+		struct MappedState
+		{
+			std::shared_ptr<cw::file::IncomingTransfer> transfer;
+			std::shared_ptr<MappedReceive> region;
+			std::uint32_t streamId = 0;
+			std::uint64_t offset = 0;
+			std::size_t length = 0;
+			std::optional<std::uint32_t> crc;
+			std::size_t done = 0;
+			std::uint32_t runningCrc = 0;
+			std::vector<cw::buffer::SharedBuffer> pieces = {}; // In order, from 'offset'
+		};
+		std::optional<MappedState> m_mapped;
+#endif
+#if defined(__linux__)
+		// The chunk being spliced (see spliceChunk)
+		struct SpliceState
+		{
+			std::shared_ptr<cw::file::IncomingTransfer> transfer;
+			std::uint32_t streamId = 0;
+			std::uint64_t offset = 0;
+			std::size_t length = 0;
+			std::size_t done = 0;   // Handed to the file
+			std::size_t filled = 0; // In 'pipe', not handed yet
+			std::shared_ptr<cw::file::SplicePipe> pipe = {};
+		};
+		std::optional<SpliceState> m_splice;
+#endif
+		TimerWheel& m_wheel;      // This io_context's, for the deadlines below
+		Timeout m_idleDeadline;   // See setIdleTimeout
+		Timeout m_heartbeatDeadline; // See setHeartbeat
+		std::chrono::steady_clock::duration m_heartbeatInterval{};
+		unsigned m_heartbeatMissed = 3;
+		cw::metrics::Clock::time_point m_heartbeatHeldAt; // Silence is counted from here at the earliest
+		std::uint64_t m_pingsSent = 0;
+		std::chrono::microseconds m_ackDelay = DEFAULT_ACK_DELAY;
+		std::vector<cw::packet::Ack> m_pendingAcks;      // See sendAck; strand only
+		std::unique_ptr<asio::steady_timer> m_ackTimer;  // Sends m_pendingAcks when the delay runs out
+		bool m_ackTimerArmed = false;
+		std::unique_ptr<asio::steady_timer> m_paceTimer; // Only once a rate limit held a write back
+		RateLimiter m_rateLimiter; // See setRateLimit
+		std::vector<std::shared_ptr<RateLimiter>> m_sharedLimiters; // See addRateLimiter
+		std::shared_ptr<void> m_slot; // See holdSlot
+		std::atomic<bool> m_failed = false; // See isOpen
+		SubmissionQueue<cw::packet::OutgoingFrame> m_submissions; // From send(), on any thread
+		std::atomic<bool> m_flushPosted = false; // A flushSubmissions is on its way
+		RingQueue<cw::packet::OutgoingFrame> m_writeQueue; // The batch being written
+		std::array<RingQueue<cw::packet::OutgoingFrame>, cw::packet::PRIORITY_CLASSES> m_pendingFrames; // Waiting for a batch, per class
+		std::array<std::uint64_t, cw::packet::PRIORITY_CLASSES> m_classTag{}; // Virtual time of each class (see scheduleBatch)
+		std::uint64_t m_virtualTime = 0;
+		std::array<std::atomic<std::size_t>, cw::packet::PRIORITY_CLASSES> m_classQueued{}; // Bytes queued per class, for backpressure
+		std::vector<asio::const_buffer> m_writeBuffers; // Reused gather list
+		HandlerMemory<HANDLER_MEMORY_SIZE> m_readMemory;  // One read in flight at a time
+		HandlerMemory<HANDLER_MEMORY_SIZE> m_writeMemory; // One write, see m_writeInProgress
+		HandlerMemory<HANDLER_MEMORY_SIZE> m_flushMemory; // One flush, see m_flushPosted
+		std::atomic<int> m_corks = 0; // See cork()
+
+		// The socket as writeBatch's stream: each write carries 'flags'
+		struct FlaggedWrites
+		{
+			using executor_type = Socket::executor_type;
+			Socket& socket;
+			Socket::message_flags flags = 0;
+
+			executor_type get_executor() { return socket.get_executor(); }
+
+			template<typename ConstBufferSequence, typename Token>
+			auto async_write_some(const ConstBufferSequence& buffers, Token&& token)
+			{
+				return socket.async_send(buffers, flags, std::forward<Token>(token));
+			}
+		};
+		FlaggedWrites m_flaggedWrites{ m_socket };
+		bool m_registeredIoWanted = false; // See setRegisteredIo
+		bool m_inlineSends = false;        // See setInlineSends
+		std::unique_ptr<RegisteredIo> m_registeredIo;
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+		// See writeZeroCopy
+		bool m_sendsZeroCopy = false;    // SO_ZEROCOPY is on and worth it
+		bool m_batchZeroCopy = false;    // The batch being written made a zero-copy send
+		bool m_zeroCopyWaiting = false;  // reapZeroCopy's wait is armed
+		ZeroCopyTracker m_zeroCopy;
+		std::vector<iovec> m_zeroCopyIov; // Reused
+#endif
+		std::size_t m_maxWriteBatchBytes = 1024 * 1024;
+		bool m_writeInProgress = false;
+		std::atomic<size_t> m_queueSize = 0;
+		std::size_t m_lowWatermark = 256 * 1024;
+		std::size_t m_highWatermark = 1024 * 1024;
+		struct WritableWaiter
+		{
+			Priority priority;
+			asio::any_completion_handler<void(std::error_code)> handler;
+		};
+		std::vector<WritableWaiter> m_writableWaiters;
+		StreamTable<std::uint64_t> m_ackedOffsets; // Highest ack per open outgoing stream
+		std::unordered_map<std::uint32_t, std::error_code> m_failedStreams; // See streamError; until releaseStream
+		mutable std::mutex m_failedStreamsMutex;
+		std::atomic<bool> m_anyStreamFailed = false; // Set once: the checks cost nothing before
+		std::vector<AckWaiter> m_ackWaiters;
+		std::unordered_map<std::uint32_t, asio::any_completion_handler<void(std::error_code, std::uint64_t)>> m_resumeWaiters;
+		PendingRequests m_requests; // Awaiting ManifestDiffs, Signatures, StatsResponses (see asyncRequest)
+		std::unordered_map<std::string, cw::file::SubtreeSummary> m_subtrees; // Of this end's tree, summed up for the peer's sync
+		std::mutex m_subtreesMutex; // Requests are summed up on the disk pool
+		std::unordered_map<std::uint32_t, asio::any_completion_handler<void(std::error_code, std::vector<std::uint32_t>)>> m_chunkRequestWaiters;
+		std::unordered_map<std::uint32_t, RetransmitSource> m_retransmitSources;
+		std::unordered_map<std::uint32_t, std::shared_ptr<cw::metrics::StreamProgress>> m_streamProgress; // See reportProgress
+		std::deque<std::pair<std::shared_ptr<cw::metrics::TransferProgress>, std::uint64_t>> m_batchProgress; // Files of each unacked batch
+
+		// Sent chunks of sources that cannot be read again (see keepForRetransmit)
+		struct RetainedChunk
+		{
+			std::uint64_t offset;
+			cw::buffer::SharedBuffer data;
+		};
+		std::unordered_map<std::uint32_t, std::deque<RetainedChunk>> m_retainedChunks;
+		std::shared_ptr<void> m_handler;   // See setHandler
+		void (*m_dispatch)(Connection&, const cw::packet::ParsedFrame&) = &dispatchBuiltIn;
+		void (*m_handlerClosed)(Connection&, std::error_code) = nullptr; // See HandlesClose
+		// --- File Transfer State ---
+		std::shared_ptr<cw::file::DiskWriter> m_diskWriter;
+		std::shared_ptr<cw::file::DiskTenant> m_diskTenant;
+		std::shared_ptr<const cw::file::VolumeSet> m_volumes; // See setVolumes
+		std::shared_ptr<const LoadGossip> m_loadGossip;       // See setLoadGossip
+		std::shared_ptr<cw::file::TransferRegistry> m_transferRegistry;
+		std::shared_ptr<cw::metrics::MetricsRegistry> m_statsRegistry; // See serveStats
+		std::shared_ptr<cw::file::ChunkStore> m_chunkStore;
+		std::vector<fs::path> m_serverCopyRoots; // See setServerCopyRoots
+		std::vector<fs::path> m_downloadRoots;   // See setDownloadRoots
+		DownloadSender m_downloadSender;
+		std::function<void(fs::path)> m_onFilePublished;
+		std::shared_ptr<cw::file::SignatureCache> m_signatureCache; // See setSignatureCache
+		std::unordered_map<std::uint32_t, std::shared_ptr<const cw::compression::Dictionary>> m_batchDictionaries; // Received, by id
+		std::mutex m_dictionaryMutex; // Guards m_sharedDictionaries: batches are sent from any thread
+		std::array<std::string, cw::packet::PRIORITY_CLASSES> m_sentNames; // Last FrontCodedFileInfo name per class
+		std::mutex m_sentNamesMutex; // Guards m_sentNames: files are sent from any thread
+		std::array<std::string, cw::packet::PRIORITY_CLASSES> m_receivedNames; // Strand only
+		std::unordered_set<std::uint32_t> m_sharedDictionaries; // Sent to the peer, by id
+		std::function<void(const cw::packet::TransferStats&)> m_onTransferStats;
+
+		// Streams passed on to m_downstream (see forwardTo), by this end's stream id
+		std::shared_ptr<Connection> m_downstream;
+		ForwardMode m_forwardMode = ForwardMode::WriteToo;
+		StreamTable<ForwardedStream> m_forwarded;
+
+		// On a downstream connection: where the acks of streams passed on for
+		// ForwardOnly hops go back to, by this end's stream id
+		std::unordered_map<std::uint32_t, ReplyRoute> m_replyRoutes;
+		std::unordered_map<std::uint32_t, asio::any_completion_handler<void(std::error_code, std::uint64_t)>> m_downloadWaiters; // By stream
+		StreamTable<ActiveTransfer> m_transfers; // Open files by stream id
+		StreamTable<std::shared_ptr<IncomingArchive>> m_archives; // Open archive streams by stream id
+		std::size_t m_maxPendingDiskBytes = 8 * 1024 * 1024;
+		std::uint64_t m_inlineBytes = 0; // Of inline files handed to the disk pool, not yet written
+		bool m_inlinePaused = false;     // Reads paused for them
+		std::shared_ptr<cw::buffer::MemoryAccount> m_memory = std::make_shared<cw::buffer::MemoryAccount>();
+		bool m_readPaused = false;
+		std::atomic<std::uint32_t> m_nextStreamId = 1;
+		std::atomic<std::uint32_t> m_peerCodecs = 0; // From the peer's Capabilities
+		std::atomic<std::uint32_t> m_peerFeatures = 0;
+		std::atomic<std::uint32_t> m_busyRetryAfterMs = 0; // See busyRetryAfter
+		mutable std::mutex m_busyRedirectMutex;
+		std::string m_busyRedirect; // See busyRedirect
+		std::atomic<std::uint16_t> m_peerVersion = 0;
+		std::atomic<std::uint32_t> m_peerMaxChunkSize = 0;
+		std::atomic<std::uint64_t> m_peerReceiveWindow = 0;
+		std::uint32_t m_maxChunkSize = 0;  // Advertised, see setReceiveLimits
+		std::uint64_t m_receiveWindow = 0;
+		bool m_peerAnnounced = false; // Capabilities received; strand only
+		std::vector<asio::any_completion_handler<void(std::error_code)>> m_capabilityWaiters;
+		std::vector<asio::any_completion_handler<void(std::error_code)>> m_closeWaiters;
+		std::vector<asio::any_completion_handler<void(std::error_code)>> m_sessionWaiters; // See asyncOpenSession
+		std::shared_ptr<SessionTable> m_sessions;
+		std::uint64_t m_sessionId = 0; // The peer's, once it sent Session; strand only
+		Reconnector m_reconnector;     // See setReconnector
+		std::vector<asio::any_completion_handler<void(std::error_code, std::shared_ptr<Connection>)>> m_reconnectWaiters;
+		mutable std::mutex m_successorMutex;
+		std::shared_ptr<Connection> m_successor; // See latest
+		bool m_closing = false;    // asyncClose: half-close once the queue is written
+		bool m_sendClosed = false; // ... and it has been
+		std::shared_ptr<cw::metrics::ConnectionMetrics> m_metrics = std::allocate_shared<cw::metrics::ConnectionMetrics>(cw::buffer::PoolAllocator<cw::metrics::ConnectionMetrics>{});
 	};
 }
\ No newline at end of file
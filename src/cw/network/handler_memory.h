@@ -0,0 +1,79 @@
+#pragma once
+#include <asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace cw::network {
+
+	// Storage for the state of one asynchronous operation at a time (the
+	// operation object asio allocates, holding the completion handler), so a
+	// connection's steady stream of reads, writes and flushes never calls
+	// malloc. asio frees an operation's memory before it runs the handler,
+	// so the next operation started from the handler gets the same block.
+	// One that does not fit, or starts while the block is taken, goes to the
+	// heap and is counted. Allocation and release may be on different threads.
+	template<std::size_t Size>
+	class HandlerMemory
+	{
+	public:
+		HandlerMemory() = default;
+		HandlerMemory(const HandlerMemory&) = delete;
+		HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+		void* allocate(std::size_t size)
+		{
+			if (size <= Size && !m_inUse.exchange(true, std::memory_order_acquire)) return m_storage;
+			m_misses.fetch_add(1, std::memory_order_relaxed);
+			return ::operator new(size);
+		}
+
+		void deallocate(void* pointer)
+		{
+			if (pointer == m_storage) m_inUse.store(false, std::memory_order_release);
+			else ::operator delete(pointer);
+		}
+
+		// Operations that went to the heap
+		std::size_t misses() const { return m_misses.load(std::memory_order_relaxed); }
+
+	private:
+		alignas(std::max_align_t) unsigned char m_storage[Size];
+		std::atomic<bool> m_inUse = false;
+		std::atomic<std::size_t> m_misses = 0;
+	};
+
+	// The allocator asio finds associated with a handler (see bindHandlerMemory)
+	template<typename T, std::size_t Size>
+	class HandlerAllocator
+	{
+	public:
+		using value_type = T;
+
+		template<typename U>
+		struct rebind { using other = HandlerAllocator<U, Size>; };
+
+		explicit HandlerAllocator(HandlerMemory<Size>& memory) noexcept : m_memory(&memory) {}
+
+		template<typename U>
+		HandlerAllocator(const HandlerAllocator<U, Size>& other) noexcept : m_memory(other.m_memory) {}
+
+		T* allocate(std::size_t n) { return static_cast<T*>(m_memory->allocate(sizeof(T) * n)); }
+		void deallocate(T* pointer, std::size_t) noexcept { m_memory->deallocate(pointer); }
+
+		template<typename U>
+		bool operator==(const HandlerAllocator<U, Size>& other) const noexcept { return m_memory == other.m_memory; }
+
+	private:
+		template<typename, std::size_t> friend class HandlerAllocator;
+		HandlerMemory<Size>* m_memory;
+	};
+
+	// 'handler', its operation's state allocated from 'memory'
+	template<std::size_t Size, typename Handler>
+	auto bindHandlerMemory(HandlerMemory<Size>& memory, Handler&& handler)
+	{
+		return asio::bind_allocator(HandlerAllocator<void, Size>(memory), std::forward<Handler>(handler));
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "cw/file/manifest.h"
+
+namespace cw::network {
+
+	// Consistent hashing of names (paths) over a set of members (servers):
+	// each member is placed at 'virtualNodes' points around a 64-bit ring and
+	// a name belongs to the first point at or after its hash. Adding or
+	// removing a member only moves the names between it and its neighbours,
+	// about 1/N of them, so a cluster that grows or loses a server keeps most
+	// files where a resumed or repeated transfer left them. Not thread-safe
+	// while members change; lookups are.
+	class HashRing
+	{
+	public:
+		static constexpr std::size_t DEFAULT_VIRTUAL_NODES = 160;
+
+		explicit HashRing(std::size_t virtualNodes = DEFAULT_VIRTUAL_NODES)
+			: m_virtualNodes(std::max<std::size_t>(1, virtualNodes))
+		{
+		}
+
+		explicit HashRing(std::vector<std::string> members, std::size_t virtualNodes = DEFAULT_VIRTUAL_NODES)
+			: HashRing(virtualNodes)
+		{
+			for (auto& member : members) add(std::move(member));
+		}
+
+		std::size_t size() const { return m_members.size(); }
+		bool empty() const { return m_members.empty(); }
+		const std::vector<std::string>& members() const { return m_members; }
+
+		// False if 'member' is in the ring already
+		bool add(std::string member)
+		{
+			if (std::find(m_members.begin(), m_members.end(), member) != m_members.end()) return false;
+			m_members.push_back(std::move(member));
+			rebuild();
+			return true;
+		}
+
+		// False if 'member' was not in the ring. The members after it move
+		// down one index.
+		bool remove(const std::string& member)
+		{
+			auto it = std::find(m_members.begin(), m_members.end(), member);
+			if (it == m_members.end()) return false;
+			m_members.erase(it);
+			rebuild();
+			return true;
+		}
+
+		// Index in members() of the member 'key' belongs to
+		std::size_t ownerIndex(std::string_view key) const
+		{
+			if (m_points.empty()) throw std::logic_error("HashRing: no members");
+			auto it = std::lower_bound(m_points.begin(), m_points.end(), Point{ hash(key), 0 });
+			if (it == m_points.end()) it = m_points.begin();
+			return it->member;
+		}
+
+		const std::string& owner(std::string_view key) const { return m_members[ownerIndex(key)]; }
+
+		// FNV-1a, finished with a 64-bit mix: FNV alone leaves names that
+		// differ in their last characters (a member's virtual nodes, the
+		// files of one directory) close together on the ring
+		static std::uint64_t hash(std::string_view key)
+		{
+			cw::file::Fnv1a fnv;
+			fnv.update(reinterpret_cast<const std::uint8_t*>(key.data()), key.size());
+			std::uint64_t h = fnv.value();
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ull;
+			h ^= h >> 33;
+			return h;
+		}
+
+	private:
+		struct Point
+		{
+			std::uint64_t position;
+			std::size_t member;
+
+			// Ties (all but impossible) go to the lower index, the same on every client
+			friend bool operator<(const Point& a, const Point& b)
+			{
+				return a.position != b.position ? a.position < b.position : a.member < b.member;
+			}
+		};
+
+		void rebuild()
+		{
+			m_points.clear();
+			m_points.reserve(m_members.size() * m_virtualNodes);
+			for (std::size_t i = 0; i < m_members.size(); ++i) {
+				for (std::size_t v = 0; v < m_virtualNodes; ++v) {
+					m_points.push_back({ hash(m_members[i] + "#" + std::to_string(v)), i });
+				}
+			}
+			std::sort(m_points.begin(), m_points.end());
+		}
+
+		std::size_t m_virtualNodes;
+		std::vector<std::string> m_members; // In the order added
+		std::vector<Point> m_points;        // Sorted by position
+	};
+}
@@ -0,0 +1,190 @@
+#pragma once
+#include <asio.hpp>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "cw/endian.h"
+#include "cw/file/disk_writer.h"
+#include "cw/log/logger.h"
+
+namespace cw::network {
+
+	// What a peer server last said about itself
+	struct PeerLoad
+	{
+		std::string address;            // host:port its clients connect to
+		std::uint64_t queuedBytes = 0;  // Waiting for its disk
+		bool busy = false;              // Refusing new files itself (admission control)
+		std::chrono::steady_clock::time_point heard;
+	};
+
+	// Load gossip between the servers of an ingest cluster, over UDP: every
+	// interval each server tells its peers the address clients reach it on,
+	// the bytes queued for its disk and whether it is refusing new files, and
+	// keeps what it hears from them. A server refusing a file as busy names
+	// the least loaded peer that is not busy itself, heard from lately, for
+	// the sender to go to instead (see Connection::setLoadGossip). Datagrams
+	// are not authenticated: for the cluster's private network.
+	class LoadGossip : public std::enable_shared_from_this<LoadGossip>
+	{
+	public:
+		static constexpr std::chrono::milliseconds DEFAULT_INTERVAL{ 500 };
+		// A peer not heard from for this many intervals is not redirected to
+		static constexpr unsigned STALE_INTERVALS = 4;
+
+		// Gossips on UDP 'port' (0: any) about 'writer' as 'advertised'
+		static std::shared_ptr<LoadGossip> start(asio::io_context& io, std::uint16_t port, std::string advertised,
+			std::shared_ptr<cw::file::DiskWriter> writer, std::vector<asio::ip::udp::endpoint> peers = {},
+			std::chrono::milliseconds interval = DEFAULT_INTERVAL)
+		{
+			auto gossip = std::shared_ptr<LoadGossip>(new LoadGossip(io, port, std::move(advertised), std::move(writer), std::move(peers), interval));
+			CW_LOG_INFO("[Gossip] ", gossip->m_advertised, " on UDP port ", gossip->port(), ", ", gossip->m_endpoints.size(), " peers");
+			gossip->receive();
+			gossip->tell();
+			return gossip;
+		}
+
+		std::uint16_t port() const { return m_socket.local_endpoint().port(); }
+		const std::string& advertised() const { return m_advertised; }
+
+		void addPeer(asio::ip::udp::endpoint peer)
+		{
+			asio::post(m_socket.get_executor(), [self = shared_from_this(), peer]() { self->m_endpoints.push_back(peer); });
+		}
+
+		void stop()
+		{
+			asio::post(m_socket.get_executor(), [self = shared_from_this()]()
+				{
+					self->m_timer.cancel();
+					std::error_code ignored;
+					self->m_socket.close(ignored);
+				});
+		}
+
+		// The peer to send a new file to instead of this server, or nullopt
+		// if none is known to have room. Thread-safe.
+		std::optional<std::string> redirectTarget() const
+		{
+			auto now = std::chrono::steady_clock::now();
+			std::lock_guard lock(m_mutex);
+			const PeerLoad* best = nullptr;
+			for (const auto& [address, peer] : m_peers) {
+				if (peer.busy || now - peer.heard > m_interval * STALE_INTERVALS) continue;
+				if (!best || peer.queuedBytes < best->queuedBytes) best = &peer;
+			}
+			if (!best) return std::nullopt;
+			return best->address;
+		}
+
+		std::vector<PeerLoad> peers() const
+		{
+			std::lock_guard lock(m_mutex);
+			std::vector<PeerLoad> peers;
+			for (const auto& [address, peer] : m_peers) peers.push_back(peer);
+			return peers;
+		}
+
+		// Records what a peer said; what the datagrams it sends land in
+		void heard(PeerLoad load)
+		{
+			if (load.address == m_advertised) return;
+			std::lock_guard lock(m_mutex);
+			m_peers[load.address] = std::move(load);
+		}
+
+		// One report: magic, flags (bit 0: busy), queued bytes, then the
+		// address, its length first; big-endian
+		static std::vector<std::uint8_t> encode(const PeerLoad& load)
+		{
+			std::vector<std::uint8_t> datagram(HEADER_SIZE + load.address.size());
+			cw::binary::ByteWriter out(datagram.data());
+			out.write(MAGIC);
+			out.write(static_cast<std::uint8_t>(load.busy ? 1 : 0));
+			out.write(load.queuedBytes);
+			out.write(static_cast<std::uint16_t>(load.address.size()));
+			out.bytes(load.address.begin(), load.address.end());
+			return datagram;
+		}
+
+		static std::optional<PeerLoad> decode(const std::uint8_t* data, std::size_t size)
+		{
+			if (size < HEADER_SIZE || cw::binary::readBigEndian<std::uint32_t>(data) != MAGIC) return std::nullopt;
+			PeerLoad load;
+			load.busy = (data[4] & 1) != 0;
+			load.queuedBytes = cw::binary::readBigEndian<std::uint64_t>(data + 5);
+			std::uint16_t length = cw::binary::readBigEndian<std::uint16_t>(data + 13);
+			if (length == 0 || size - HEADER_SIZE < length) return std::nullopt;
+			load.address.assign(reinterpret_cast<const char*>(data + HEADER_SIZE), length);
+			load.heard = std::chrono::steady_clock::now();
+			return load;
+		}
+
+	private:
+		static constexpr std::uint32_t MAGIC = 0x43574c47; // "CWLG"
+		static constexpr std::size_t HEADER_SIZE = 4 + 1 + 8 + 2;
+		static constexpr std::size_t MAX_ADDRESS = 1024;
+
+		LoadGossip(asio::io_context& io, std::uint16_t port, std::string advertised, std::shared_ptr<cw::file::DiskWriter> writer,
+			std::vector<asio::ip::udp::endpoint> peers, std::chrono::milliseconds interval)
+			: m_socket(io, asio::ip::udp::endpoint(asio::ip::udp::v4(), port)),
+			m_timer(io),
+			m_advertised(advertised.substr(0, MAX_ADDRESS)),
+			m_writer(std::move(writer)),
+			m_endpoints(std::move(peers)),
+			m_interval(interval)
+		{
+		}
+
+		// Sends this server's load to every peer, then again after an interval
+		void tell()
+		{
+			PeerLoad self{ m_advertised, m_writer->load()->queuedBytes(), m_writer->admissionDelay().has_value(), {} };
+			m_report = encode(self);
+			for (const auto& peer : m_endpoints) {
+				std::error_code ignored;
+				m_socket.send_to(asio::buffer(m_report), peer, 0, ignored);
+			}
+
+			m_timer.expires_after(m_interval);
+			m_timer.async_wait([weak = weak_from_this()](std::error_code ec)
+				{
+					auto self = weak.lock();
+					if (!ec && self && self->m_socket.is_open()) self->tell();
+				});
+		}
+
+		void receive()
+		{
+			m_socket.async_receive_from(asio::buffer(m_receiveBuffer), m_sender, [weak = weak_from_this()](std::error_code ec, std::size_t length)
+				{
+					auto self = weak.lock();
+					if (!self || ec == asio::error::operation_aborted || !self->m_socket.is_open()) return;
+					if (!ec) {
+						if (auto load = decode(self->m_receiveBuffer.data(), length)) self->heard(std::move(*load));
+					}
+					self->receive();
+				});
+		}
+
+		asio::ip::udp::socket m_socket;
+		asio::steady_timer m_timer;
+		std::string m_advertised;
+		std::shared_ptr<cw::file::DiskWriter> m_writer;
+		std::vector<asio::ip::udp::endpoint> m_endpoints; // Peers told, on the socket's executor
+		std::chrono::milliseconds m_interval;
+		std::vector<std::uint8_t> m_report;
+		std::array<std::uint8_t, HEADER_SIZE + MAX_ADDRESS> m_receiveBuffer{};
+		asio::ip::udp::endpoint m_sender;
+
+		mutable std::mutex m_mutex;
+		std::map<std::string, PeerLoad> m_peers; // By address
+	};
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "cw/network/Connection.h"
+#include "cw/compression/codec.h"
+#include "cw/integrity/checksum.h"
+
+namespace cw::network {
+
+	// Receiver that keeps uploaded files in memory instead of writing them to
+	// disk: plugged into a Connection with setHandler(), it takes FileInfo,
+	// the chunks and FileDone, and hands every completed file to a callback.
+	// Also the template for other sinks (an object store, a pipe): the
+	// Connection still does framing, backpressure and replies to requests.
+	// Single-stream uploads only (no StripeInfo, delta or dedup).
+	class MemoryReceiver
+	{
+	public:
+		struct File
+		{
+			std::string name;
+			std::vector<std::uint8_t> data;
+		};
+
+		// Runs on the connection's strand for each file that arrived intact
+		explicit MemoryReceiver(std::function<void(File)> onFile) : m_onFile(std::move(onFile)) {}
+
+		void onPacket(Connection&, cw::packet::FileInfoView pkt)
+		{
+			if (pkt.fileSize > MAX_FILE_SIZE) throw std::runtime_error("MemoryReceiver: file too large to hold in memory");
+
+			auto& stream = m_streams[pkt.streamId];
+			stream.file.name = std::string(pkt.fileName);
+			stream.file.data.assign(static_cast<std::size_t>(pkt.fileSize), 0);
+			stream.digest = cw::integrity::FileDigest(pkt.fileSize);
+		}
+
+		void onPacket(Connection& conn, cw::packet::FileChunkView pkt)
+		{
+			if (pkt.crc && cw::integrity::crc32c(pkt.data) != *pkt.crc) {
+				fail(conn, pkt.streamId, "Chunk checksum mismatch");
+				return;
+			}
+			store(conn, pkt.streamId, pkt.offset, pkt.data, pkt.crc);
+		}
+
+		void onPacket(Connection& conn, cw::packet::CompressedChunkView pkt)
+		{
+			std::vector<std::uint8_t> raw(pkt.rawSize);
+			std::error_code ec = cw::compression::decompress(static_cast<cw::compression::Codec>(pkt.codec), pkt.data, raw);
+			if (!ec && pkt.crc && cw::integrity::crc32c(raw) != *pkt.crc) ec = std::make_error_code(std::errc::illegal_byte_sequence);
+			if (ec) {
+				fail(conn, pkt.streamId, "Cannot decompress chunk: " + ec.message());
+				return;
+			}
+			store(conn, pkt.streamId, pkt.offset, raw, pkt.crc);
+		}
+
+		void onPacket(Connection& conn, cw::packet::FileDone pkt)
+		{
+			auto it = m_streams.find(pkt.streamId);
+			if (it == m_streams.end()) return;
+
+			Stream stream = std::move(it->second);
+			m_streams.erase(it);
+
+			bool intact = stream.received == stream.file.data.size() && pkt.fileSize == stream.file.data.size()
+				&& (!pkt.crc || stream.unchecked || stream.digest.value() == *pkt.crc);
+			if (!intact) {
+				sendError(conn, cw::packet::ErrorCode::ChecksumMismatch, "Stream " + std::to_string(pkt.streamId) + " arrived incomplete or corrupt", pkt.streamId);
+				return;
+			}
+
+			conn.sendAck(pkt.streamId, stream.received);
+
+			if (m_onFile) m_onFile(std::move(stream.file));
+		}
+
+	private:
+		static constexpr std::uint64_t MAX_FILE_SIZE = 1024 * 1024 * 1024;
+
+		struct Stream
+		{
+			File file;
+			cw::integrity::FileDigest digest;
+			std::uint64_t received = 0;
+			std::uint64_t lastAcked = 0;
+			bool unchecked = false;
+		};
+
+		void store(Connection& conn, std::uint32_t streamId, std::uint64_t offset, std::span<const std::uint8_t> bytes,
+			const std::optional<std::uint32_t>& crc)
+		{
+			auto it = m_streams.find(streamId);
+			if (it == m_streams.end()) return;
+			auto& stream = it->second;
+
+			if (offset > stream.file.data.size() || bytes.size() > stream.file.data.size() - offset)
+				throw std::runtime_error("MemoryReceiver: chunk beyond the end of the file");
+
+			std::copy(bytes.begin(), bytes.end(), stream.file.data.begin() + static_cast<std::ptrdiff_t>(offset));
+			stream.received += bytes.size();
+			if (crc) stream.digest.add(offset, bytes.size(), *crc);
+			else stream.unchecked = true;
+
+			// Progress acks keep the sender's ack window moving
+			if (stream.received - stream.lastAcked >= cw::packet::ACK_INTERVAL) {
+				stream.lastAcked = stream.received;
+				conn.sendAck(streamId, stream.received);
+			}
+		}
+
+		void fail(Connection& conn, std::uint32_t streamId, const std::string& reason)
+		{
+			m_streams.erase(streamId);
+			sendError(conn, cw::packet::ErrorCode::ChecksumMismatch, reason, streamId);
+		}
+
+		static void sendError(Connection& conn, cw::packet::ErrorCode code, std::string message, std::uint32_t streamId)
+		{
+			cw::packet::Error err;
+			err.code = static_cast<std::uint16_t>(code);
+			err.streamId = streamId;
+			err.message = std::move(message);
+			err.message.resize(std::min(err.message.size(), cw::packet::MAX_STRING_LENGTH));
+			conn.send(err);
+		}
+
+	private:
+		std::function<void(File)> m_onFile;
+		std::unordered_map<std::uint32_t, Stream> m_streams;
+	};
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include <asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "cw/file/disk_writer.h"
+#include "cw/file/transfer_registry.h"
+#include "cw/log/logger.h"
+#include "cw/metrics/metrics.h"
+#include "cw/protocol/packet/packet.h"
+
+namespace cw::network {
+
+	// Minimal HTTP listener for Prometheus scrapes: every request, whatever its
+	// path, is answered with the registry's counters in the text format and
+	// the connection is closed. Meant for a private port, not the data port.
+	class MetricsEndpoint
+	{
+	public:
+		MetricsEndpoint(asio::io_context& io, uint16_t port, std::shared_ptr<cw::metrics::MetricsRegistry> registry = nullptr)
+			: m_acceptor(io, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)),
+			m_registry(registry ? std::move(registry) : cw::metrics::MetricsRegistry::defaultInstance())
+		{
+			CW_LOG_INFO("[Metrics] Serving on port ", m_acceptor.local_endpoint().port());
+			doAccept();
+		}
+
+		uint16_t port() const { return m_acceptor.local_endpoint().port(); }
+
+	private:
+		struct Exchange
+		{
+			explicit Exchange(asio::any_io_executor executor) : socket(std::move(executor)) {}
+
+			asio::ip::tcp::socket socket;
+			asio::streambuf request;
+			std::string response;
+		};
+
+		void doAccept()
+		{
+			auto exchange = std::make_shared<Exchange>(m_acceptor.get_executor());
+			m_acceptor.async_accept(exchange->socket, [this, exchange](std::error_code ec)
+				{
+					if (!ec) respond(exchange);
+					if (m_acceptor.is_open()) doAccept();
+				});
+		}
+
+		void respond(std::shared_ptr<Exchange> exchange)
+		{
+			// Only the end of the request headers matters, not what was asked for
+			asio::async_read_until(exchange->socket, exchange->request, "\r\n\r\n",
+				[this, exchange](std::error_code ec, std::size_t)
+				{
+					if (ec) return;
+
+					std::string body = cw::metrics::toPrometheus(m_registry->snapshot());
+					exchange->response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+						+ std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+					asio::async_write(exchange->socket, asio::buffer(exchange->response), [exchange](std::error_code, std::size_t)
+						{
+							std::error_code ignored;
+							exchange->socket.shutdown(asio::ip::tcp::socket::shutdown_both, ignored);
+						});
+				});
+		}
+
+	private:
+		asio::ip::tcp::acceptor m_acceptor;
+		std::shared_ptr<cw::metrics::MetricsRegistry> m_registry;
+	};
+
+	// One line per open transfer: "photos/a.raw 412.0 of 1024.0 MB (40%), 3 stripes, 51.2 MB/s"
+	inline std::string describeTransfer(const cw::file::TransferStatus& status)
+	{
+		double mb = 1e6;
+		double seconds = std::max(1e-9, std::chrono::duration<double>(status.elapsed).count());
+		double received = static_cast<double>(status.receivedBytes);
+		char line[128];
+		if (status.expectedSize == cw::packet::UNKNOWN_FILE_SIZE || status.expectedSize == 0) {
+			std::snprintf(line, sizeof(line), " %.1f MB, %u stripes, %.1f MB/s", received / mb, static_cast<unsigned>(status.stripeCount),
+				received / mb / seconds);
+		}
+		else {
+			double expected = static_cast<double>(status.expectedSize);
+			std::snprintf(line, sizeof(line), " %.1f of %.1f MB (%.0f%%), %u stripes, %.1f MB/s", received / mb, expected / mb,
+				100.0 * std::min(received, expected) / expected, static_cast<unsigned>(status.stripeCount), received / mb / seconds);
+		}
+		return status.path.generic_string() + line;
+	}
+
+	// 'value' as a label value of the Prometheus text format
+	inline std::string prometheusLabel(std::string_view value)
+	{
+		std::string out;
+		out.reserve(value.size());
+		for (char c : value) {
+			if (c == '\\' || c == '"') out += '\\';
+			if (c == '\n') out += "\\n";
+			else out += c;
+		}
+		return out;
+	}
+
+	// What a StatsRequest is answered with: the registry's counters as the
+	// metrics port serves them, then the disk writer's load when given, and
+	// a sample of each file being received, as many as fit MAX_STATS_SIZE
+	inline std::string statsText(cw::metrics::MetricsRegistry& registry, const cw::file::TransferRegistry& transfers,
+		const cw::file::DiskLoad* disk)
+	{
+		std::string out = cw::metrics::toPrometheus(registry.snapshot());
+		char line[256];
+
+		if (disk) {
+			std::snprintf(line, sizeof(line), "# HELP cw_disk_queued_bytes Bytes queued for the disk across received files.\n"
+				"# TYPE cw_disk_queued_bytes gauge\ncw_disk_queued_bytes %llu\n", static_cast<unsigned long long>(disk->queuedBytes()));
+			out += line;
+			std::snprintf(line, sizeof(line), "# HELP cw_disk_write_latency_seconds Time from a chunk arriving to its write landing, smoothed.\n"
+				"# TYPE cw_disk_write_latency_seconds gauge\ncw_disk_write_latency_seconds %.9f\n",
+				std::chrono::duration<double>(disk->latency()).count());
+			out += line;
+		}
+
+		// One family after the other, as the format wants
+		std::string received = "# HELP cw_transfer_received_bytes Bytes of each file being received so far.\n# TYPE cw_transfer_received_bytes gauge\n";
+		std::string expected = "# HELP cw_transfer_expected_bytes Size of each file being received, where known.\n# TYPE cw_transfer_expected_bytes gauge\n";
+		for (const auto& status : transfers.status()) {
+			std::string label = prometheusLabel(status.path.generic_string());
+			std::string receivedSample = "cw_transfer_received_bytes{path=\"" + label + "\"} " + std::to_string(status.receivedBytes) + "\n";
+			std::string expectedSample;
+			if (status.expectedSize != cw::packet::UNKNOWN_FILE_SIZE) {
+				expectedSample = "cw_transfer_expected_bytes{path=\"" + label + "\"} " + std::to_string(status.expectedSize) + "\n";
+			}
+			if (out.size() + received.size() + expected.size() + receivedSample.size() + expectedSample.size() > cw::packet::MAX_STATS_SIZE) break;
+			received += receivedSample;
+			expected += expectedSample;
+		}
+		out += received;
+		out += expected;
+		return out;
+	}
+
+	// Logs a one-line summary of the registry every 'interval': throughput and
+	// frame rates over the interval, the send queues, congestion and files;
+	// then a line for each file still being received (see TransferRegistry::status).
+	class StatsReporter
+	{
+	public:
+		StatsReporter(asio::io_context& io, std::chrono::steady_clock::duration interval,
+			std::shared_ptr<cw::metrics::MetricsRegistry> registry = nullptr,
+			std::shared_ptr<cw::file::TransferRegistry> transfers = nullptr)
+			: m_timer(io),
+			m_interval(interval),
+			m_registry(registry ? std::move(registry) : cw::metrics::MetricsRegistry::defaultInstance()),
+			m_transfers(transfers ? std::move(transfers) : cw::file::TransferRegistry::defaultInstance()),
+			m_last(m_registry->snapshot()),
+			m_lastTime(std::chrono::steady_clock::now())
+		{
+			schedule();
+		}
+
+	private:
+		void schedule()
+		{
+			m_timer.expires_after(m_interval);
+			m_timer.async_wait([this](std::error_code ec)
+				{
+					if (ec) return;
+
+					auto now = std::chrono::steady_clock::now();
+					cw::metrics::Snapshot current = m_registry->snapshot();
+					CW_LOG_INFO("[Stats] ", cw::metrics::summarize(current, m_last, now - m_lastTime));
+					CW_LOG_INFO("[Stats] ", cw::metrics::summarizeLatency(current, m_last));
+					for (const auto& transfer : m_transfers->status()) CW_LOG_INFO("[Stats] Receiving ", describeTransfer(transfer));
+					m_last = current;
+					m_lastTime = now;
+					schedule();
+				});
+		}
+
+	private:
+		asio::steady_timer m_timer;
+		std::chrono::steady_clock::duration m_interval;
+		std::shared_ptr<cw::metrics::MetricsRegistry> m_registry;
+		std::shared_ptr<cw::file::TransferRegistry> m_transfers;
+		cw::metrics::Snapshot m_last;
+		std::chrono::steady_clock::time_point m_lastTime;
+	};
+}
@@ -0,0 +1,383 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "cw/network/Connection.h"
+#include "cw/buffer/shared_buffer.h"
+#include "cw/compression/codec.h"
+#include "cw/integrity/checksum.h"
+#include "cw/log/logger.h"
+
+namespace cw::network {
+
+	// One uploaded part of a multipart upload, as the completion lists it
+	struct ObjectPart
+	{
+		unsigned number = 0; // From 1
+		std::string etag;
+	};
+
+	// An object store taking multipart uploads (S3's CreateMultipartUpload,
+	// UploadPart, CompleteMultipartUpload, AbortMultipartUpload; see
+	// S3Store). Each call returns at once and runs its handler later, on any
+	// thread; parts of one upload may be in flight together.
+	template<typename S>
+	concept MultipartStore = requires(S& store, std::string text, unsigned number, cw::buffer::SharedBuffer data, std::vector<ObjectPart> parts) {
+		store.createUpload(text, std::function<void(std::error_code, std::string)>());
+		store.uploadPart(text, text, number, data, std::function<void(std::error_code, std::string)>());
+		store.completeUpload(text, text, parts, std::function<void(std::error_code)>());
+		store.abortUpload(text, text);
+	};
+
+	// Receiver that streams uploaded files into an object store instead of
+	// the local disk, for servers that only relay data there: plugged into a
+	// Connection with setHandler(), it cuts each file into parts of
+	// 'partSize' bytes at fixed offsets (part n holds [(n - 1) * partSize,
+	// n * partSize)), copies the chunks of each part into one buffer and
+	// uploads it as soon as it is full, up to 'maxParallelParts' at once.
+	// Backpressure: while more than 'maxBufferedBytes' of parts are held
+	// (filling, waiting or in flight), the socket is not read and TCP slows
+	// the sender. The file's Ack comes once the upload is completed, so an
+	// acked file is in the store; one that arrives corrupt, or that the
+	// store refuses, is aborted and answered with an Error. Single-stream
+	// uploads of known size only, as StreamReceiver; uploads still open
+	// when the connection goes away are aborted.
+	template<MultipartStore Store>
+	class ObjectStoreReceiver : public std::enable_shared_from_this<ObjectStoreReceiver<Store>>
+	{
+	public:
+		static constexpr std::size_t MIN_PART_SIZE = 5 * 1024 * 1024; // All parts but the last (S3)
+		static constexpr std::size_t MAX_PARTS = 10000;
+
+		struct Options
+		{
+			std::string prefix;                              // Prepended to each file's name to make its key
+			std::size_t partSize = 8 * 1024 * 1024;          // Raised for files that would need more than MAX_PARTS
+			std::size_t maxParallelParts = 4;                // Per file
+			std::size_t maxBufferedBytes = 64 * 1024 * 1024; // For the connection
+		};
+
+		// 'onObject' runs on the connection's strand for each file stored
+		explicit ObjectStoreReceiver(std::shared_ptr<Store> store, Options options = {},
+			std::function<void(const std::string& key, std::uint64_t size)> onObject = nullptr) :
+			m_store(std::move(store)), m_options(std::move(options)), m_onObject(std::move(onObject))
+		{
+			m_options.partSize = std::max(m_options.partSize, MIN_PART_SIZE);
+			m_options.maxParallelParts = std::max<std::size_t>(m_options.maxParallelParts, 1);
+		}
+
+		~ObjectStoreReceiver()
+		{
+			for (auto& [streamId, upload] : m_uploads) abort(*upload);
+		}
+
+		void onPacket(Connection& conn, cw::packet::FileInfoView pkt)
+		{
+			if (m_conn.expired()) m_conn = conn.weak_from_this();
+
+			auto upload = std::make_shared<Upload>();
+			upload->key = m_options.prefix + std::string(pkt.fileName);
+			upload->fileSize = pkt.fileSize;
+			upload->partSize = partSizeFor(pkt.fileSize);
+			upload->digest = cw::integrity::FileDigest(pkt.fileSize);
+			if (auto old = m_uploads.find(pkt.streamId); old != m_uploads.end()) drop(*old->second);
+			m_uploads[pkt.streamId] = upload;
+
+			if (pkt.fileSize == cw::packet::UNKNOWN_FILE_SIZE) {
+				fail(conn, pkt.streamId, "Object store uploads need the file's size up front", cw::packet::ErrorCode::Rejected);
+				return;
+			}
+
+			CW_LOG_INFO("[Object] Starting upload of ", upload->key, " (", pkt.fileSize, " bytes, parts of ", upload->partSize, ")");
+			m_store->createUpload(upload->key, [this, weak = this->weak_from_this(), streamId = pkt.streamId, upload](std::error_code ec, std::string uploadId)
+				{
+					onStore(weak, [this, streamId, upload, ec, uploadId = std::move(uploadId)]() mutable
+						{
+							if (!current(streamId, upload)) {
+								if (!ec) m_store->abortUpload(upload->key, uploadId);
+								return;
+							}
+							if (ec) {
+								withConnection([&](Connection& conn) { fail(conn, streamId, "Cannot start the upload of " + upload->key + ": " + ec.message()); });
+								return;
+							}
+							upload->uploadId = std::move(uploadId);
+							pump(streamId, upload);
+						});
+				});
+		}
+
+		void onPacket(Connection& conn, cw::packet::FileChunkView pkt)
+		{
+			if (pkt.crc && cw::integrity::crc32c(pkt.data) != *pkt.crc) {
+				fail(conn, pkt.streamId, "Chunk checksum mismatch", cw::packet::ErrorCode::ChecksumMismatch);
+				return;
+			}
+			store(conn, pkt.streamId, pkt.offset, pkt.data, pkt.crc);
+		}
+
+		void onPacket(Connection& conn, cw::packet::CompressedChunkView pkt)
+		{
+			std::vector<std::uint8_t> raw(pkt.rawSize);
+			std::error_code ec = cw::compression::decompress(static_cast<cw::compression::Codec>(pkt.codec), pkt.data, raw);
+			if (!ec && pkt.crc && cw::integrity::crc32c(raw) != *pkt.crc) ec = std::make_error_code(std::errc::illegal_byte_sequence);
+			if (ec) {
+				fail(conn, pkt.streamId, "Cannot decompress chunk: " + ec.message(), cw::packet::ErrorCode::ChecksumMismatch);
+				return;
+			}
+			store(conn, pkt.streamId, pkt.offset, raw, pkt.crc);
+		}
+
+		void onPacket(Connection& conn, cw::packet::FileDone pkt)
+		{
+			auto it = m_uploads.find(pkt.streamId);
+			if (it == m_uploads.end()) return;
+			auto upload = it->second;
+
+			bool intact = upload->received == upload->fileSize && pkt.fileSize == upload->fileSize
+				&& (!pkt.crc || upload->unchecked || upload->digest.value() == *pkt.crc);
+			if (!intact) {
+				fail(conn, pkt.streamId, "Stream " + std::to_string(pkt.streamId) + " arrived incomplete or corrupt", cw::packet::ErrorCode::ChecksumMismatch);
+				return;
+			}
+
+			// An empty file is still one (empty) part
+			if (upload->fileSize == 0) upload->ready.push_back({ 1, {} });
+			upload->done = true;
+			pump(pkt.streamId, upload);
+		}
+
+		// Bytes of parts held: filling, waiting for a slot, or being uploaded
+		std::size_t bufferedBytes() const { return m_buffered; }
+
+	private:
+		struct Upload
+		{
+			std::string key;
+			std::uint64_t fileSize = 0;
+			std::size_t partSize = 0;
+			std::optional<std::string> uploadId;
+			cw::integrity::FileDigest digest;
+			std::uint64_t received = 0;
+			std::uint64_t lastAcked = 0;
+			bool unchecked = false;
+
+			std::map<unsigned, std::pair<std::vector<std::uint8_t>, std::size_t>> filling; // Part -> bytes, filled so far
+			std::deque<std::pair<unsigned, std::vector<std::uint8_t>>> ready;             // Full, waiting for a slot (or the upload id)
+			std::vector<ObjectPart> parts;                                                // Uploaded
+			std::size_t inFlight = 0;
+			bool done = false;       // Verified at its FileDone: complete once every part is up
+			bool completing = false;
+		};
+
+		std::size_t partSizeFor(std::uint64_t fileSize) const
+		{
+			if (fileSize == cw::packet::UNKNOWN_FILE_SIZE) return m_options.partSize;
+			// Whole MiB, so the parts of a huge file stay aligned
+			constexpr std::uint64_t MIB = 1024 * 1024;
+			std::uint64_t least = (fileSize + MAX_PARTS - 1) / MAX_PARTS;
+			least = (least + MIB - 1) / MIB * MIB;
+			return static_cast<std::size_t>(std::max<std::uint64_t>(m_options.partSize, least));
+		}
+
+		std::size_t partLength(const Upload& upload, unsigned number) const
+		{
+			std::uint64_t start = std::uint64_t(number - 1) * upload.partSize;
+			return static_cast<std::size_t>(std::min<std::uint64_t>(upload.partSize, upload.fileSize - start));
+		}
+
+		// Copies a chunk into the parts it covers; full parts go up
+		void store(Connection& conn, std::uint32_t streamId, std::uint64_t offset, std::span<const std::uint8_t> data,
+			const std::optional<std::uint32_t>& crc)
+		{
+			auto it = m_uploads.find(streamId);
+			if (it == m_uploads.end()) return;
+			auto upload = it->second;
+			if (offset > upload->fileSize || data.size() > upload->fileSize - offset)
+				throw std::runtime_error("ObjectStoreReceiver: chunk beyond the end of the file");
+
+			upload->received += data.size();
+			if (crc) upload->digest.add(offset, data.size(), *crc);
+			else upload->unchecked = true;
+
+			while (!data.empty()) {
+				unsigned number = static_cast<unsigned>(offset / upload->partSize) + 1;
+				std::size_t length = partLength(*upload, number);
+				auto [part, inserted] = upload->filling.try_emplace(number);
+				if (inserted) {
+					part->second.first.resize(length);
+					hold(conn, length);
+				}
+
+				std::size_t at = static_cast<std::size_t>(offset - std::uint64_t(number - 1) * upload->partSize);
+				std::size_t take = std::min(data.size(), length - at);
+				std::copy_n(data.begin(), take, part->second.first.begin() + static_cast<std::ptrdiff_t>(at));
+				part->second.second += take;
+				if (part->second.second >= length) {
+					upload->ready.emplace_back(number, std::move(part->second.first));
+					upload->filling.erase(part);
+				}
+				offset += take;
+				data = data.subspan(take);
+			}
+
+			// Progress acks keep the sender's ack window moving; the last waits for the store
+			if (upload->received - upload->lastAcked >= cw::packet::ACK_INTERVAL && upload->received < upload->fileSize) {
+				upload->lastAcked = upload->received;
+				conn.sendAck(streamId, upload->received);
+			}
+			pump(streamId, upload);
+		}
+
+		// Starts what can start: ready parts while there are slots, then the completion
+		void pump(std::uint32_t streamId, const std::shared_ptr<Upload>& upload)
+		{
+			if (!upload->uploadId) return;
+
+			while (!upload->ready.empty() && upload->inFlight < m_options.maxParallelParts) {
+				auto [number, bytes] = std::move(upload->ready.front());
+				upload->ready.pop_front();
+				++upload->inFlight;
+
+				std::size_t length = bytes.size();
+				m_store->uploadPart(upload->key, *upload->uploadId, number, cw::buffer::SharedBuffer::fromVector(std::move(bytes)),
+					[this, weak = this->weak_from_this(), streamId, upload, number, length](std::error_code ec, std::string etag)
+					{
+						onStore(weak, [this, streamId, upload, number, length, ec, etag = std::move(etag)]() mutable
+							{
+								--upload->inFlight;
+								release(length);
+								if (!current(streamId, upload)) return;
+								if (ec) {
+									withConnection([&](Connection& conn) { fail(conn, streamId, "Cannot upload part " + std::to_string(number) + " of " + upload->key + ": " + ec.message()); });
+									return;
+								}
+								upload->parts.push_back({ number, std::move(etag) });
+								pump(streamId, upload);
+							});
+					});
+			}
+
+			if (upload->done && !upload->completing && upload->ready.empty() && upload->inFlight == 0) complete(streamId, upload);
+		}
+
+		void complete(std::uint32_t streamId, const std::shared_ptr<Upload>& upload)
+		{
+			upload->completing = true;
+			std::ranges::sort(upload->parts, {}, &ObjectPart::number);
+			m_store->completeUpload(upload->key, *upload->uploadId, upload->parts, [this, weak = this->weak_from_this(), streamId, upload](std::error_code ec)
+				{
+					onStore(weak, [this, streamId, upload, ec]()
+						{
+							if (!current(streamId, upload)) return;
+							withConnection([&](Connection& conn)
+								{
+									if (ec) {
+										fail(conn, streamId, "Cannot complete the upload of " + upload->key + ": " + ec.message());
+										return;
+									}
+									m_uploads.erase(streamId);
+									CW_LOG_INFO("[Object] Stored ", upload->key, " (", upload->fileSize, " bytes in ", upload->parts.size(), " parts)");
+
+									conn.sendAck(streamId, upload->fileSize);
+									if (m_onObject) m_onObject(upload->key, upload->fileSize);
+								});
+						});
+				});
+		}
+
+		// Store handlers run anywhere: back onto the connection's strand, if
+		// the receiver is still there
+		void onStore(const std::weak_ptr<ObjectStoreReceiver>& weak, std::function<void()> fn)
+		{
+			auto self = weak.lock();
+			auto conn = m_conn.lock();
+			if (!self || !conn) return;
+			asio::post(conn->socket().get_executor(), [self, fn = std::move(fn)]() { fn(); });
+		}
+
+		template<typename F>
+		void withConnection(F&& fn)
+		{
+			if (auto conn = m_conn.lock()) fn(*conn);
+		}
+
+		bool current(std::uint32_t streamId, const std::shared_ptr<Upload>& upload) const
+		{
+			auto it = m_uploads.find(streamId);
+			return it != m_uploads.end() && it->second == upload;
+		}
+
+		void hold(Connection& conn, std::size_t bytes)
+		{
+			m_buffered += bytes;
+			if (m_buffered > m_options.maxBufferedBytes && !m_paused) {
+				m_paused = true;
+				conn.pauseReading();
+			}
+		}
+
+		// Reading goes on at half the limit
+		void release(std::size_t bytes)
+		{
+			m_buffered -= std::min(bytes, m_buffered);
+			if (!m_paused || m_buffered > m_options.maxBufferedBytes / 2) return;
+			m_paused = false;
+			withConnection([](Connection& conn) { conn.resumeReading(); });
+		}
+
+		// Parts not in flight are freed here; those in flight when they land
+		void drop(Upload& upload)
+		{
+			for (auto& [number, part] : upload.filling) release(part.first.size());
+			for (auto& [number, bytes] : upload.ready) release(bytes.size());
+			upload.filling.clear();
+			upload.ready.clear();
+			abort(upload);
+		}
+
+		void abort(Upload& upload)
+		{
+			if (upload.uploadId) m_store->abortUpload(upload.key, *upload.uploadId);
+			upload.uploadId.reset();
+		}
+
+		void fail(Connection& conn, std::uint32_t streamId, const std::string& reason, cw::packet::ErrorCode code = cw::packet::ErrorCode::Unknown)
+		{
+			auto it = m_uploads.find(streamId);
+			if (it == m_uploads.end()) return;
+			CW_LOG_ERROR("[Object] ", reason);
+			auto upload = std::move(it->second);
+			m_uploads.erase(it);
+			drop(*upload);
+
+			cw::packet::Error err;
+			err.code = static_cast<std::uint16_t>(code);
+			err.streamId = streamId;
+			err.message = reason;
+			err.message.resize(std::min(err.message.size(), cw::packet::MAX_STRING_LENGTH));
+			conn.send(err);
+		}
+
+		std::shared_ptr<Store> m_store;
+		Options m_options;
+		std::function<void(const std::string&, std::uint64_t)> m_onObject;
+		std::weak_ptr<Connection> m_conn;
+		std::unordered_map<std::uint32_t, std::shared_ptr<Upload>> m_uploads;
+		std::size_t m_buffered = 0;
+		bool m_paused = false;
+	};
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include <asio.hpp>
+#include <asio/experimental/concurrent_channel.hpp>
+
+#include "cw/network/Connection.h"
+#include "cw/protocol/packet/packet_registry.h"
+
+namespace cw::network {
+
+	// Receiver for code that reads packets in a loop instead of being called
+	// back: plugged into a Connection with setHandler(), it takes the packet
+	// types listed and queues them, in arrival order, for asyncReceive:
+	//   auto channel = std::make_shared<PacketChannel<Ack, Error>>(io.get_executor());
+	//   conn->setHandler(channel);
+	//   for (;;) {
+	//       auto packet = co_await channel->asyncReceive(asio::use_awaitable);
+	//       ...
+	//   }
+	// Everything else keeps the built-in handling. While the channel is full
+	// the socket is not read, and TCP slows the peer. Once the connection is
+	// gone, asyncReceive completes with operation_aborted after the packets
+	// already queued. Packets received as views of the receive buffer
+	// (FileInfo, FileChunk; see cw::packet::ReceivedAs) cannot be queued.
+	template<typename... Packets>
+	class PacketChannel
+	{
+		static_assert(sizeof...(Packets) > 0, "PacketChannel: no packet types");
+		static_assert((std::is_same_v<typename cw::packet::ReceivedAs<Packets>::type, Packets> && ...),
+			"PacketChannel: these packets are views of the receive buffer");
+
+	public:
+		using Packet = std::variant<Packets...>;
+		using Channel = asio::experimental::concurrent_channel<void(std::error_code, Packet)>;
+
+		static constexpr std::size_t DEFAULT_CAPACITY = 64;
+
+		explicit PacketChannel(asio::any_io_executor executor, std::size_t capacity = DEFAULT_CAPACITY) :
+			m_channel(std::move(executor), capacity), m_flow(std::make_shared<Flow>())
+		{
+		}
+
+		// The next packet: void(std::error_code, Packet)
+		template<typename CompletionToken>
+		auto asyncReceive(CompletionToken&& token)
+		{
+			return m_channel.async_receive(std::forward<CompletionToken>(token));
+		}
+
+		template<typename P>
+			requires (std::is_same_v<P, Packets> || ...)
+		void onPacket(Connection& conn, P packet)
+		{
+			deliver(conn, std::error_code{}, Packet(std::in_place_type<P>, std::move(packet)));
+		}
+
+		void onClosed(Connection& conn, std::error_code ec)
+		{
+			deliver(conn, ec, Packet{});
+		}
+
+	private:
+		// Shared with the sends still waiting for room, which may complete
+		// after the receiver is gone
+		struct Flow
+		{
+			std::atomic<std::size_t> waiting = 0;
+			std::weak_ptr<Connection> conn;
+		};
+
+		void deliver(Connection& conn, std::error_code ec, Packet packet)
+		{
+			// Set before any send can wait, read where they complete
+			if (!m_bound) {
+				m_flow->conn = conn.weak_from_this();
+				m_bound = true;
+			}
+			if (m_flow->waiting.load() == 0 && m_channel.try_send(ec, std::move(packet))) return;
+
+			// Full: the packets behind this one wait until the consumer takes it
+			if (m_flow->waiting++ == 0) conn.pauseReading();
+			m_channel.async_send(ec, std::move(packet), [flow = m_flow](std::error_code)
+				{
+					if (--flow->waiting != 0) return;
+					if (auto c = flow->conn.lock()) c->resumeReading();
+				});
+		}
+
+		Channel m_channel;
+		std::shared_ptr<Flow> m_flow;
+		bool m_bound = false; // On the connection's strand
+	};
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <asio.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+namespace cw::network {
+
+	// The requests a Connection has sent and awaits replies to, by request
+	// id: the id its request packet carries and the reply echoes. Each
+	// waiter completes with what its reply carries (a ManifestDiff's
+	// indices, a StatsResponse's text), whatever packet type that is, so one
+	// table serves every request/reply pair and any number of requests may
+	// be outstanding, answered in any order. Strand only.
+	class PendingRequests
+	{
+	public:
+		// A fresh id for a request: never 0, which packets leave unset
+		std::uint32_t nextId()
+		{
+			if (m_nextId == 0) ++m_nextId;
+			return m_nextId++;
+		}
+
+		template<typename Result>
+		void add(std::uint32_t id, asio::any_completion_handler<void(std::error_code, Result)> handler)
+		{
+			m_waiters[id] = std::make_unique<TypedWaiter<Result>>(std::move(handler));
+		}
+
+		// Completes request 'id' with 'result'. False for an id not awaited,
+		// or one awaiting another kind of reply (the peer's mistake): the
+		// waiter is left for the right reply or the connection's close.
+		template<typename Result>
+		bool complete(std::uint32_t id, Result result)
+		{
+			auto it = m_waiters.find(id);
+			if (it == m_waiters.end()) return false;
+			auto* waiter = dynamic_cast<TypedWaiter<Result>*>(it->second.get());
+			if (!waiter) return false;
+
+			auto handler = std::move(waiter->handler);
+			m_waiters.erase(it);
+			asio::dispatch(asio::append(std::move(handler), std::error_code{}, std::move(result)));
+			return true;
+		}
+
+		// The connection closed: every waiter completes with 'ec' and an empty result
+		void failAll(std::error_code ec)
+		{
+			auto waiters = std::exchange(m_waiters, {});
+			for (auto& [id, waiter] : waiters) waiter->fail(ec);
+		}
+
+		std::size_t size() const { return m_waiters.size(); }
+
+	private:
+		struct Waiter
+		{
+			virtual ~Waiter() = default;
+			virtual void fail(std::error_code ec) = 0;
+		};
+
+		template<typename Result>
+		struct TypedWaiter : Waiter
+		{
+			explicit TypedWaiter(asio::any_completion_handler<void(std::error_code, Result)> h) : handler(std::move(h)) {}
+
+			void fail(std::error_code ec) override { asio::dispatch(asio::append(std::move(handler), ec, Result{})); }
+
+			asio::any_completion_handler<void(std::error_code, Result)> handler;
+		};
+
+		std::unordered_map<std::uint32_t, std::unique_ptr<Waiter>> m_waiters;
+		std::uint32_t m_nextId = 1;
+	};
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace cw::network {
+
+	// Token bucket for bytes written to sockets, shared by every connection
+	// it is attached to (see Connection::addRateLimiter): one per connection,
+	// per server, or across a ClientPool. Kept as the time the bucket is next
+	// empty (GCRA): reserve() books bytes at the rate and returns how long the
+	// caller waits before writing them, so writers are spaced out evenly and
+	// never send more than 'burst' bytes ahead of the rate. Thread-safe; the
+	// rate can change at any time, 0 = unlimited.
+	class RateLimiter
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		// Below this a burst would stall every write of a full frame
+		static constexpr std::uint64_t MIN_BURST = 64 * 1024;
+
+		// Writes cover about this much time each at the rate (see paceQuantum)
+		static constexpr std::chrono::milliseconds PACE_INTERVAL{ 5 };
+
+		explicit RateLimiter(std::uint64_t bytesPerSecond = 0, std::uint64_t burstBytes = 0) { setRate(bytesPerSecond, burstBytes); }
+
+		// 'burstBytes' = 0 picks 10 ms at the rate, at least MIN_BURST
+		void setRate(std::uint64_t bytesPerSecond, std::uint64_t burstBytes = 0)
+		{
+			std::lock_guard lock(m_mutex);
+			m_rate.store(bytesPerSecond, std::memory_order_relaxed);
+			m_burst = burstBytes ? burstBytes : std::max<std::uint64_t>(MIN_BURST, bytesPerSecond / 100);
+		}
+
+		std::uint64_t rate() const { return m_rate.load(std::memory_order_relaxed); }
+		bool limited() const { return rate() != 0; }
+
+		// Bytes one write should carry to keep to the rate without bursts
+		// (0 when unlimited)
+		std::uint64_t paceQuantum() const
+		{
+			std::uint64_t r = rate();
+			if (r == 0) return 0;
+			return std::max<std::uint64_t>(16 * 1024, r * PACE_INTERVAL.count() / 1000);
+		}
+
+		// Books 'bytes' and returns how long to wait before sending them
+		// (zero while within the burst)
+		Clock::duration reserve(std::uint64_t bytes, Clock::time_point now = Clock::now())
+		{
+			std::uint64_t r = rate();
+			if (r == 0) return Clock::duration::zero();
+
+			std::lock_guard lock(m_mutex);
+			// Idle time earns no more than one burst
+			Clock::time_point start = std::max(m_emptyAt, now);
+			m_emptyAt = start + toDuration(bytes, r);
+
+			auto wait = m_emptyAt - now - toDuration(m_burst, r);
+			return std::max(wait, Clock::duration::zero());
+		}
+
+	private:
+		static Clock::duration toDuration(std::uint64_t bytes, std::uint64_t rate)
+		{
+			auto nanos = static_cast<std::int64_t>(static_cast<double>(bytes) * 1e9 / static_cast<double>(rate));
+			return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(nanos));
+		}
+
+		std::mutex m_mutex;
+		std::atomic<std::uint64_t> m_rate = 0;
+		std::uint64_t m_burst = MIN_BURST;
+		Clock::time_point m_emptyAt{};
+	};
+}
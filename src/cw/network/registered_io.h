@@ -0,0 +1,336 @@
+#pragma once
+#include <asio.hpp>
+#include <memory>
+#include <system_error>
+
+// Registered I/O is opt-in (CMake CW_USE_REGISTERED_IO, Windows only);
+// elsewhere RegisteredIo is a stub that is never created, so the callers
+// compile the same on every platform
+#if defined(_WIN32) && defined(CW_USE_REGISTERED_IO)
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <winsock2.h>
+#include <mswsock.h>
+
+#include "cw/buffer/buffer_pool.h"
+#include "cw/log/logger.h"
+
+namespace cw::network {
+
+	// Windows Registered I/O for a Connection's sends (SocketOptions::registeredIo,
+	// Connection::enableRegisteredIo). An overlapped WSASend probes and locks
+	// its buffers and posts an IOCP packet every call, which is most of what
+	// a small frame costs; RIO sends from memory registered once and reports
+	// completions in batches on a queue of its own. Pays off for streams of
+	// small frames: many small files.
+	//
+	// Each connection registers a send area, a block from the BufferPool,
+	// that frames are gathered into; payloads in the huge page arena
+	// (BufferPool::useHugePages), registered as a whole once per process,
+	// go out from where they lie instead. The completion queue signals an
+	// event that asio waits on. A stream for asio::async_write, one write
+	// at a time (Connection has one in flight, see m_writeInProgress).
+	class RegisteredIo
+	{
+	public:
+		static constexpr std::size_t SEND_AREA_SIZE = 1024 * 1024;
+		// RIOSends outstanding at most: one per registered span of a write
+		static constexpr std::size_t MAX_SENDS = 64;
+		// Arena payloads from this size go out in place; smaller ones are copied next to their header
+		static constexpr std::size_t MIN_IN_PLACE = 16 * 1024;
+
+		using executor_type = asio::any_io_executor;
+
+		// RIO on a connected 'socket' opened by openForRegisteredIo; null if
+		// the system or the socket does not support it
+		static std::unique_ptr<RegisteredIo> create(SOCKET socket, executor_type executor)
+		{
+			const RIO_EXTENSION_FUNCTION_TABLE* rio = functions(socket);
+			if (!rio) return nullptr;
+
+			std::unique_ptr<RegisteredIo> io(new RegisteredIo(*rio, executor));
+			if (!io->open(socket)) return nullptr;
+			return io;
+		}
+
+		~RegisteredIo()
+		{
+			if (m_completions != RIO_INVALID_CQ) m_rio.RIOCloseCompletionQueue(m_completions);
+			if (m_areaId != RIO_INVALID_BUFFERID && !m_areaInArena) m_rio.RIODeregisterBuffer(m_areaId);
+			if (m_area) cw::buffer::BufferPool::instance().deallocate(m_area, SEND_AREA_SIZE);
+		}
+
+		RegisteredIo(const RegisteredIo&) = delete;
+		RegisteredIo& operator=(const RegisteredIo&) = delete;
+
+		executor_type get_executor() { return m_event.get_executor(); }
+
+		// Sends what fits the send area and MAX_SENDS of 'buffers'; completes
+		// with the bytes sent once every RIOSend of it has
+		template<typename ConstBufferSequence, typename Token>
+		auto async_write_some(const ConstBufferSequence& buffers, Token&& token)
+		{
+			return asio::async_initiate<Token, void(std::error_code, std::size_t)>(
+				[this](auto handler, const ConstBufferSequence& buffers)
+				{
+					std::size_t bytes = stage(buffers);
+					m_handler = std::move(handler);
+					m_error.clear();
+					m_written = bytes;
+					m_pending = 0;
+
+					for (std::size_t i = 0; i < m_sends.size(); ++i) {
+						// Deferred but the last, which submits them all in one go
+						DWORD flags = i + 1 < m_sends.size() ? RIO_MSG_DEFER : 0;
+						if (!m_rio.RIOSend(m_requests, &m_sends[i], 1, flags, nullptr)) {
+							m_error = std::error_code(::WSAGetLastError(), asio::error::get_system_category());
+							if (i > 0) m_rio.RIOSend(m_requests, nullptr, 0, RIO_MSG_COMMIT_ONLY, nullptr);
+							break;
+						}
+						++m_pending;
+					}
+					if (m_pending == 0) {
+						asio::post(get_executor(), [this]() { complete(); });
+						return;
+					}
+					waitForCompletions();
+				}, token, buffers);
+		}
+
+	private:
+		RegisteredIo(const RIO_EXTENSION_FUNCTION_TABLE& rio, executor_type executor)
+			: m_rio(rio), m_event(executor)
+		{
+		}
+
+		// RIO's entry points, looked up once per process
+		static const RIO_EXTENSION_FUNCTION_TABLE* functions(SOCKET socket)
+		{
+			static std::once_flag once;
+			static RIO_EXTENSION_FUNCTION_TABLE table{};
+			static bool loaded = false;
+			std::call_once(once, [socket]()
+				{
+					GUID id = WSAID_MULTIPLE_RIO;
+					table.cbSize = sizeof(table);
+					DWORD bytes = 0;
+					loaded = ::WSAIoctl(socket, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &id, sizeof(id), &table, sizeof(table), &bytes, nullptr, nullptr) == 0;
+					if (!loaded) CW_LOG_WARN("[RIO] Registered I/O is not available: ", ::WSAGetLastError());
+				});
+			return loaded ? &table : nullptr;
+		}
+
+		// The huge page arena, registered on first use; RIO_INVALID_BUFFERID without one
+		RIO_BUFFERID arenaId(const cw::buffer::HugePageArena* arena)
+		{
+			static std::once_flag once;
+			static RIO_BUFFERID id = RIO_INVALID_BUFFERID;
+			if (!arena) return RIO_INVALID_BUFFERID;
+			std::call_once(once, [this, arena]()
+				{
+					auto region = arena->region();
+					id = m_rio.RIORegisterBuffer(reinterpret_cast<PCHAR>(region.data()), static_cast<DWORD>(region.size()));
+					if (id == RIO_INVALID_BUFFERID) CW_LOG_WARN("[RIO] Could not register the huge page arena: ", ::WSAGetLastError());
+				});
+			return id;
+		}
+
+		bool open(SOCKET socket)
+		{
+			m_arena = cw::buffer::BufferPool::instance().hugePages();
+			m_arenaId = arenaId(m_arena);
+
+			m_area = static_cast<std::uint8_t*>(cw::buffer::BufferPool::instance().allocate(SEND_AREA_SIZE));
+			if (m_arenaId != RIO_INVALID_BUFFERID && m_arena->owns(m_area)) {
+				m_areaId = m_arenaId;
+				m_areaInArena = true;
+				m_areaOffset = static_cast<ULONG>(m_area - m_arena->region().data());
+			}
+			else {
+				m_areaId = m_rio.RIORegisterBuffer(reinterpret_cast<PCHAR>(m_area), static_cast<DWORD>(SEND_AREA_SIZE));
+			}
+
+			HANDLE event = ::CreateEventW(nullptr, FALSE, FALSE, nullptr);
+			if (!event) return fail("CreateEvent");
+			m_event.assign(event);
+
+			RIO_NOTIFICATION_COMPLETION notify{};
+			notify.Type = RIO_EVENT_COMPLETION;
+			notify.Event.EventHandle = m_event.native_handle();
+			notify.Event.NotifyReset = FALSE;
+			m_completions = m_rio.RIOCreateCompletionQueue(static_cast<DWORD>(MAX_SENDS), &notify);
+			if (m_areaId == RIO_INVALID_BUFFERID) return fail("RIORegisterBuffer");
+			if (m_completions == RIO_INVALID_CQ) return fail("RIOCreateCompletionQueue");
+
+			// Receives stay on asio's overlapped path: one slot, never used
+			m_requests = m_rio.RIOCreateRequestQueue(socket, 1, 1, static_cast<ULONG>(MAX_SENDS), 1, m_completions, m_completions, this);
+			if (m_requests == RIO_INVALID_RQ) return fail("RIOCreateRequestQueue");
+			return true;
+		}
+
+		bool fail(const char* what)
+		{
+			CW_LOG_WARN("[RIO] ", what, " failed: ", ::WSAGetLastError());
+			return false;
+		}
+
+		// m_sends for a prefix of 'buffers': copied into the send area, but
+		// large arena payloads; returns its size
+		template<typename ConstBufferSequence>
+		std::size_t stage(const ConstBufferSequence& buffers)
+		{
+			m_sends.clear();
+			std::size_t staged = 0;
+			std::size_t bytes = 0;
+			for (auto it = asio::buffer_sequence_begin(buffers); it != asio::buffer_sequence_end(buffers); ++it) {
+				asio::const_buffer buffer = *it;
+				if (buffer.size() == 0) continue;
+				if (m_sends.size() == MAX_SENDS) break;
+
+				const auto* data = static_cast<const std::uint8_t*>(buffer.data());
+				if (m_arenaId != RIO_INVALID_BUFFERID && buffer.size() >= MIN_IN_PLACE && m_arena->owns(data)) {
+					m_sends.push_back({ m_arenaId, static_cast<ULONG>(data - m_arena->region().data()), static_cast<ULONG>(buffer.size()) });
+					bytes += buffer.size();
+					continue;
+				}
+
+				std::size_t n = std::min(buffer.size(), SEND_AREA_SIZE - staged);
+				if (n == 0) break;
+				std::memcpy(m_area + staged, data, n);
+				ULONG offset = m_areaOffset + static_cast<ULONG>(staged);
+				// Contiguous with the previous copy: one send for both
+				if (!m_sends.empty() && m_sends.back().BufferId == m_areaId && m_sends.back().Offset + m_sends.back().Length == offset)
+					m_sends.back().Length += static_cast<ULONG>(n);
+				else
+					m_sends.push_back({ m_areaId, offset, static_cast<ULONG>(n) });
+				staged += n;
+				bytes += n;
+				if (n < buffer.size()) break;
+			}
+			return bytes;
+		}
+
+		void waitForCompletions()
+		{
+			m_rio.RIONotify(m_completions);
+			m_event.async_wait([this](std::error_code ec)
+				{
+					if (ec) {
+						m_error = ec;
+						complete();
+						return;
+					}
+
+					std::array<RIORESULT, MAX_SENDS> results;
+					ULONG count = m_rio.RIODequeueCompletion(m_completions, results.data(), static_cast<ULONG>(results.size()));
+					if (count == RIO_CORRUPT_CQ) {
+						m_error = std::make_error_code(std::errc::io_error);
+						m_pending = 0;
+					}
+					else {
+						for (ULONG i = 0; i < count; ++i) {
+							if (results[i].Status != 0 && !m_error) m_error = std::error_code(results[i].Status, asio::error::get_system_category());
+							--m_pending;
+						}
+					}
+
+					if (m_pending > 0) waitForCompletions();
+					else complete();
+				});
+		}
+
+		void complete()
+		{
+			auto handler = std::move(m_handler);
+			handler(m_error, m_error ? 0 : m_written);
+		}
+
+		RIO_EXTENSION_FUNCTION_TABLE m_rio;
+		asio::windows::object_handle m_event;
+		RIO_CQ m_completions = RIO_INVALID_CQ;
+		RIO_RQ m_requests = RIO_INVALID_RQ;
+
+		const cw::buffer::HugePageArena* m_arena = nullptr;
+		RIO_BUFFERID m_arenaId = RIO_INVALID_BUFFERID;
+		std::uint8_t* m_area = nullptr;
+		RIO_BUFFERID m_areaId = RIO_INVALID_BUFFERID;
+		ULONG m_areaOffset = 0; // Within m_areaId
+		bool m_areaInArena = false;
+
+		// The write in flight
+		std::vector<RIO_BUF> m_sends;
+		std::size_t m_pending = 0;
+		std::size_t m_written = 0;
+		std::error_code m_error;
+		asio::any_completion_handler<void(std::error_code, std::size_t)> m_handler;
+	};
+
+	// Reopens an opened, unconnected socket with WSA_FLAG_REGISTERED_IO,
+	// which RIO needs from creation (SocketOptions::registeredIo); first,
+	// before its other options. Best effort: the socket stays as it was if
+	// that fails.
+	template<typename Socket>
+	void openForRegisteredIo(Socket& socket)
+	{
+		WSAPROTOCOL_INFOW info{};
+		int length = sizeof(info);
+		if (::getsockopt(socket.native_handle(), SOL_SOCKET, SO_PROTOCOL_INFOW, reinterpret_cast<char*>(&info), &length) != 0) return;
+
+		SOCKET reopened = ::WSASocketW(info.iAddressFamily, info.iSocketType, info.iProtocol, nullptr, 0, WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+		if (reopened == INVALID_SOCKET) {
+			CW_LOG_WARN("[RIO] Could not open a socket for Registered I/O: ", ::WSAGetLastError());
+			return;
+		}
+
+		auto protocol = info.iAddressFamily == AF_INET6 ? Socket::protocol_type::v6() : Socket::protocol_type::v4();
+		std::error_code ec;
+		socket.close(ec);
+		socket.assign(protocol, reopened, ec);
+		if (ec) {
+			CW_LOG_WARN("[RIO] Could not use the Registered I/O socket: ", ec.message());
+			::closesocket(reopened);
+		}
+	}
+}
+#else
+namespace cw::network {
+
+	// Without Registered I/O: create() finds nothing and sends stay on the socket
+	class RegisteredIo
+	{
+	public:
+		using executor_type = asio::any_io_executor;
+
+		template<typename Handle>
+		static std::unique_ptr<RegisteredIo> create(Handle, executor_type) { return nullptr; }
+
+		RegisteredIo(const RegisteredIo&) = delete;
+		RegisteredIo& operator=(const RegisteredIo&) = delete;
+
+		executor_type get_executor() { return m_executor; }
+
+		template<typename ConstBufferSequence, typename Token>
+		auto async_write_some(const ConstBufferSequence&, Token&& token)
+		{
+			return asio::async_initiate<Token, void(std::error_code, std::size_t)>(
+				[this](auto handler)
+				{
+					asio::post(m_executor, [handler = std::move(handler)]() mutable { std::move(handler)(asio::error::operation_not_supported, 0); });
+				}, token);
+		}
+
+	private:
+		executor_type m_executor;
+	};
+
+	template<typename Socket>
+	void openForRegisteredIo(Socket&)
+	{
+	}
+}
+#endif
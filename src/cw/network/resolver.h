@@ -0,0 +1,330 @@
+#pragma once
+#include <asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cw/log/logger.h"
+
+namespace cw::network {
+
+	using Endpoints = std::vector<asio::ip::tcp::endpoint>;
+
+	// RFC 8305 section 4: alternate address families, starting with the one
+	// the resolver listed first, so a broken IPv6 path costs one attempt
+	// delay rather than one per IPv6 address
+	inline Endpoints interleaveFamilies(const Endpoints& endpoints)
+	{
+		if (endpoints.empty()) return {};
+
+		bool firstV6 = endpoints.front().address().is_v6();
+		Endpoints preferred, other;
+		for (const auto& endpoint : endpoints) {
+			(endpoint.address().is_v6() == firstV6 ? preferred : other).push_back(endpoint);
+		}
+
+		Endpoints ordered;
+		ordered.reserve(endpoints.size());
+		for (std::size_t i = 0; i < std::max(preferred.size(), other.size()); ++i) {
+			if (i < preferred.size()) ordered.push_back(preferred[i]);
+			if (i < other.size()) ordered.push_back(other[i]);
+		}
+		return ordered;
+	}
+
+	// "host:port", "[v6-literal]:port": the host (without brackets) and the
+	// port, or nullopt if there is no valid port
+	inline std::optional<std::pair<std::string, std::uint16_t>> splitHostPort(const std::string& address)
+	{
+		auto colon = address.rfind(':');
+		if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) return std::nullopt;
+		std::string host = address.substr(0, colon);
+		if (host.size() > 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+		else if (host.find(':') != std::string::npos) return std::nullopt; // A bare IPv6 literal is ambiguous
+		unsigned long port = 0;
+		for (char c : address.substr(colon + 1)) {
+			if (c < '0' || c > '9') return std::nullopt;
+			port = port * 10 + static_cast<unsigned long>(c - '0');
+			if (port > UINT16_MAX) return std::nullopt;
+		}
+		if (port == 0) return std::nullopt;
+		return std::pair{ std::move(host), static_cast<std::uint16_t>(port) };
+	}
+
+	// Resolved addresses of host:port, kept for a while so the many short
+	// jobs connecting to one server pay for one DNS lookup, not one each.
+	// Lookups of a name already in flight wait for that one. getaddrinfo
+	// reports no TTLs: entries are simply dropped after 'ttl', or when every
+	// address failed to connect (see forget).
+	class ResolverCache
+	{
+	public:
+		static constexpr std::chrono::seconds DEFAULT_TTL{ 30 };
+
+		struct Stats
+		{
+			std::uint64_t lookups = 0; // Went to the resolver
+			std::uint64_t hits = 0;    // Answered from the cache or a lookup in flight
+		};
+
+		explicit ResolverCache(std::chrono::steady_clock::duration ttl = DEFAULT_TTL) : m_ttl(ttl) {}
+
+		static ResolverCache& instance()
+		{
+			static ResolverCache cache;
+			return cache;
+		}
+
+		// Completes with the addresses of host:port, families interleaved.
+		// IP literals complete without a lookup. The handler runs on its
+		// associated executor, else on 'executor'.
+		template<typename CompletionToken>
+		auto asyncResolve(asio::any_io_executor executor, std::string host, std::uint16_t port, CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code, Endpoints)>(
+				[this, executor, host = std::move(host), port](auto handler) mutable
+				{
+					Waiter waiter{ asio::get_associated_executor(handler, executor), std::move(handler) };
+					resolve(executor, std::move(host), port, std::move(waiter));
+				}, token);
+		}
+
+		std::optional<Endpoints> lookup(const std::string& host, std::uint16_t port)
+		{
+			std::lock_guard lock(m_mutex);
+			auto it = m_entries.find({ host, port });
+			if (it == m_entries.end()) return std::nullopt;
+			if (std::chrono::steady_clock::now() >= it->second.expires) {
+				m_entries.erase(it);
+				return std::nullopt;
+			}
+			return it->second.endpoints;
+		}
+
+		// The address that connected goes first next time: later connections
+		// to the same host skip the race
+		void prefer(const std::string& host, std::uint16_t port, const asio::ip::tcp::endpoint& endpoint)
+		{
+			std::lock_guard lock(m_mutex);
+			auto it = m_entries.find({ host, port });
+			if (it == m_entries.end()) return;
+
+			auto& endpoints = it->second.endpoints;
+			auto found = std::find(endpoints.begin(), endpoints.end(), endpoint);
+			if (found != endpoints.end()) std::rotate(endpoints.begin(), found, found + 1);
+		}
+
+		// None of the addresses answered: they may be stale
+		void forget(const std::string& host, std::uint16_t port)
+		{
+			std::lock_guard lock(m_mutex);
+			m_entries.erase({ host, port });
+		}
+
+		Stats stats() const
+		{
+			std::lock_guard lock(m_mutex);
+			return m_stats;
+		}
+
+	private:
+		using Key = std::pair<std::string, std::uint16_t>;
+		struct Waiter
+		{
+			asio::any_io_executor executor; // Where the handler runs
+			asio::any_completion_handler<void(std::error_code, Endpoints)> handler;
+		};
+
+		struct Entry
+		{
+			Endpoints endpoints;
+			std::chrono::steady_clock::time_point expires;
+		};
+
+		static void complete(Waiter waiter, std::error_code ec, Endpoints endpoints)
+		{
+			asio::post(waiter.executor, [handler = std::move(waiter.handler), ec, endpoints = std::move(endpoints)]() mutable
+				{
+					handler(ec, std::move(endpoints));
+				});
+		}
+
+		void resolve(asio::any_io_executor executor, std::string host, std::uint16_t port, Waiter waiter)
+		{
+			std::error_code literal;
+			auto address = asio::ip::make_address(host, literal);
+			if (!literal) {
+				complete(std::move(waiter), {}, { asio::ip::tcp::endpoint(address, port) });
+				return;
+			}
+
+			if (auto cached = lookup(host, port)) {
+				{
+					std::lock_guard lock(m_mutex);
+					++m_stats.hits;
+				}
+				complete(std::move(waiter), {}, std::move(*cached));
+				return;
+			}
+
+			{
+				std::lock_guard lock(m_mutex);
+				auto& waiters = m_inFlight[{ host, port }];
+				waiters.push_back(std::move(waiter));
+				if (waiters.size() > 1) {
+					++m_stats.hits;
+					return;
+				}
+				++m_stats.lookups;
+			}
+
+			auto resolver = std::make_shared<asio::ip::tcp::resolver>(executor);
+			resolver->async_resolve(host, std::to_string(port),
+				[this, resolver, key = Key{ host, port }](std::error_code ec, asio::ip::tcp::resolver::results_type results)
+				{
+					Endpoints endpoints;
+					for (const auto& result : results) endpoints.push_back(result.endpoint());
+					endpoints = interleaveFamilies(endpoints);
+					if (!ec && endpoints.empty()) ec = asio::error::host_not_found;
+
+					std::vector<Waiter> waiters;
+					{
+						std::lock_guard lock(m_mutex);
+						if (!ec) m_entries[key] = { endpoints, std::chrono::steady_clock::now() + m_ttl };
+						waiters = std::move(m_inFlight[key]);
+						m_inFlight.erase(key);
+					}
+
+					if (ec) CW_LOG_WARN("[Resolver] ", key.first, ": ", ec.message());
+					for (auto& waiter : waiters) complete(std::move(waiter), ec, endpoints);
+				});
+		}
+
+		std::chrono::steady_clock::duration m_ttl;
+		mutable std::mutex m_mutex;
+		std::map<Key, Entry> m_entries;
+		std::map<Key, std::vector<Waiter>> m_inFlight;
+		Stats m_stats;
+	};
+
+	// RFC 8305 connection racing: connects to the endpoints in order, starting
+	// the next attempt when the previous one fails or has not answered within
+	// 'attemptDelay', and keeps the first to succeed; the others are closed.
+	// A dead address family (IPv6 without a route) then costs 250 ms instead
+	// of a connect timeout. 'prepare' runs on every socket after open and
+	// before connect (socket options, a source address); closing the socket
+	// skips that endpoint, as unreachable from there. Completes with the connected socket,
+	// created on 'executor' (a strand, if its io_context runs on several
+	// threads), and the endpoint it reached; if all fail, with the last error.
+	template<typename CompletionToken>
+	auto asyncConnectRacing(asio::any_io_executor executor, Endpoints endpoints,
+		std::function<void(asio::generic::stream_protocol::socket&)> prepare, CompletionToken&& token,
+		std::chrono::steady_clock::duration attemptDelay = std::chrono::milliseconds(250))
+	{
+		using Socket = asio::generic::stream_protocol::socket;
+		using Handler = asio::any_completion_handler<void(std::error_code, Socket, asio::ip::tcp::endpoint)>;
+
+		struct Race : std::enable_shared_from_this<Race>
+		{
+			Race(asio::any_io_executor executor) : executor(executor), timer(executor) {}
+
+			asio::any_io_executor executor;
+			asio::steady_timer timer;
+			Endpoints endpoints;
+			std::function<void(Socket&)> prepare;
+			std::chrono::steady_clock::duration delay{};
+			Handler handler;
+			std::vector<std::unique_ptr<Socket>> attempts;
+			std::size_t pending = 0;
+			std::error_code lastError = asio::error::host_not_found;
+			bool done = false;
+
+			void startNext()
+			{
+				if (done || attempts.size() == endpoints.size()) return;
+
+				std::size_t index = attempts.size();
+				const auto& endpoint = endpoints[index];
+				attempts.push_back(std::make_unique<Socket>(executor));
+				++pending;
+
+				std::error_code ec;
+				attempts[index]->open(endpoint.protocol(), ec);
+				if (ec) {
+					asio::post(executor, [self = this->shared_from_this(), index, ec]() { self->onAttempt(index, ec); });
+					return;
+				}
+				if (prepare) prepare(*attempts[index]);
+				if (!attempts[index]->is_open()) {
+					asio::post(executor, [self = this->shared_from_this(), index]() { self->onAttempt(index, std::make_error_code(std::errc::address_not_available)); });
+					return;
+				}
+
+				attempts[index]->async_connect(endpoint, [self = this->shared_from_this(), index](std::error_code ec) { self->onAttempt(index, ec); });
+
+				// No answer in time: race the next address alongside this one
+				timer.expires_after(delay);
+				timer.async_wait([self = this->shared_from_this()](std::error_code ec)
+					{
+						if (!ec) self->startNext();
+					});
+			}
+
+			void onAttempt(std::size_t index, std::error_code ec)
+			{
+				--pending;
+				if (done) return;
+
+				if (!ec) {
+					done = true;
+					timer.cancel();
+					for (std::size_t i = 0; i < attempts.size(); ++i) {
+						std::error_code ignored;
+						if (i != index) attempts[i]->close(ignored);
+					}
+					asio::dispatch(asio::append(std::move(handler), std::error_code{}, std::move(*attempts[index]), endpoints[index]));
+					return;
+				}
+
+				CW_LOG_DEBUG("[Connect] ", endpoints[index], ": ", ec.message());
+				lastError = ec;
+				if (attempts.size() < endpoints.size()) {
+					startNext();
+				}
+				else if (pending == 0) {
+					done = true;
+					timer.cancel();
+					asio::dispatch(asio::append(std::move(handler), lastError, Socket(executor), asio::ip::tcp::endpoint{}));
+				}
+			}
+		};
+
+		return asio::async_initiate<CompletionToken, void(std::error_code, Socket, asio::ip::tcp::endpoint)>(
+			[executor, endpoints = std::move(endpoints), prepare = std::move(prepare), attemptDelay](auto handler) mutable
+			{
+				auto race = std::make_shared<Race>(executor);
+				race->endpoints = std::move(endpoints);
+				race->prepare = std::move(prepare);
+				race->delay = attemptDelay;
+				race->handler = asio::bind_executor(asio::get_associated_executor(handler, executor), std::move(handler));
+
+				asio::post(executor, [race]()
+					{
+						if (!race->endpoints.empty()) {
+							race->startNext();
+							return;
+						}
+						race->done = true;
+						asio::dispatch(asio::append(std::move(race->handler), race->lastError, Socket(race->executor), asio::ip::tcp::endpoint{}));
+					});
+			}, token);
+	}
+}
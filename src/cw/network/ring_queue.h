@@ -0,0 +1,165 @@
+#pragma once
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cw::network {
+
+	// A double-ended queue in one ring of slots that doubles when full and
+	// never shrinks: a connection's frame queues, which std::deque would
+	// allocate and free a node for every few frames as they move through.
+	// A slot given up is reset to T{}, so what its element held is released
+	// then, not when the slot is reused. Not thread-safe.
+	template<typename T>
+	class RingQueue
+	{
+		template<typename Value, typename Queue>
+		class Iterator
+		{
+		public:
+			using iterator_category = std::random_access_iterator_tag;
+			using value_type = std::remove_const_t<Value>;
+			using difference_type = std::ptrdiff_t;
+			using pointer = Value*;
+			using reference = Value&;
+
+			Iterator() = default;
+			Iterator(Queue* queue, std::size_t index) : m_queue(queue), m_index(index) {}
+
+			reference operator*() const { return (*m_queue)[m_index]; }
+			pointer operator->() const { return &(*m_queue)[m_index]; }
+			reference operator[](difference_type n) const { return (*m_queue)[m_index + n]; }
+
+			Iterator& operator++() { ++m_index; return *this; }
+			Iterator operator++(int) { Iterator it = *this; ++m_index; return it; }
+			Iterator& operator--() { --m_index; return *this; }
+			Iterator operator--(int) { Iterator it = *this; --m_index; return it; }
+			Iterator& operator+=(difference_type n) { m_index += n; return *this; }
+			Iterator& operator-=(difference_type n) { m_index -= n; return *this; }
+
+			friend Iterator operator+(Iterator it, difference_type n) { return it += n; }
+			friend Iterator operator+(difference_type n, Iterator it) { return it += n; }
+			friend Iterator operator-(Iterator it, difference_type n) { return it -= n; }
+			friend difference_type operator-(const Iterator& a, const Iterator& b)
+			{
+				return static_cast<difference_type>(a.m_index) - static_cast<difference_type>(b.m_index);
+			}
+			friend bool operator==(const Iterator& a, const Iterator& b) { return a.m_index == b.m_index; }
+			friend auto operator<=>(const Iterator& a, const Iterator& b) { return a.m_index <=> b.m_index; }
+
+			std::size_t index() const { return m_index; }
+
+		private:
+			Queue* m_queue = nullptr;
+			std::size_t m_index = 0;
+		};
+
+	public:
+		using value_type = T;
+		using iterator = Iterator<T, RingQueue>;
+		using const_iterator = Iterator<const T, const RingQueue>;
+
+		bool empty() const { return m_size == 0; }
+		std::size_t size() const { return m_size; }
+		std::size_t capacity() const { return m_slots.size(); }
+
+		T& operator[](std::size_t i) { return m_slots[slot(i)]; }
+		const T& operator[](std::size_t i) const { return m_slots[slot(i)]; }
+		T& front() { return m_slots[m_head]; }
+		const T& front() const { return m_slots[m_head]; }
+		T& back() { return (*this)[m_size - 1]; }
+		const T& back() const { return (*this)[m_size - 1]; }
+
+		iterator begin() { return { this, 0 }; }
+		iterator end() { return { this, m_size }; }
+		const_iterator begin() const { return { this, 0 }; }
+		const_iterator end() const { return { this, m_size }; }
+
+		void push_back(T value)
+		{
+			grow();
+			m_slots[slot(m_size)] = std::move(value);
+			++m_size;
+		}
+
+		void push_front(T value)
+		{
+			grow();
+			m_head = (m_head + m_slots.size() - 1) & (m_slots.size() - 1);
+			m_slots[m_head] = std::move(value);
+			++m_size;
+		}
+
+		void pop_front()
+		{
+			m_slots[m_head] = T{};
+			m_head = (m_head + 1) & (m_slots.size() - 1);
+			--m_size;
+		}
+
+		void pop_back()
+		{
+			back() = T{};
+			--m_size;
+		}
+
+		// Removes [first, last), those behind it moving up; from the front
+		// (the usual case) it only advances the head
+		iterator erase(iterator first, iterator last)
+		{
+			std::size_t from = first.index();
+			std::size_t count = last.index() - from;
+			if (from == 0) {
+				for (std::size_t i = 0; i < count; ++i) pop_front();
+				return begin();
+			}
+			std::move(last, end(), first);
+			for (std::size_t i = 0; i < count; ++i) pop_back();
+			return { this, from };
+		}
+
+		void clear()
+		{
+			while (!empty()) pop_front();
+			m_head = 0;
+		}
+
+		// The elements 'pred' picks, removed in place, the rest in their order;
+		// returns how many
+		template<typename Predicate>
+		friend std::size_t erase_if(RingQueue& queue, Predicate pred)
+		{
+			std::size_t kept = 0;
+			for (std::size_t i = 0; i < queue.m_size; ++i) {
+				if (pred(queue[i])) continue;
+				if (kept != i) queue[kept] = std::move(queue[i]);
+				++kept;
+			}
+			std::size_t removed = queue.m_size - kept;
+			while (queue.m_size > kept) queue.pop_back();
+			return removed;
+		}
+
+	private:
+		static constexpr std::size_t MIN_CAPACITY = 16;
+
+		std::size_t slot(std::size_t i) const { return (m_head + i) & (m_slots.size() - 1); }
+
+		void grow()
+		{
+			if (m_size < m_slots.size()) return;
+			std::vector<T> slots(std::max(MIN_CAPACITY, m_slots.size() * 2));
+			for (std::size_t i = 0; i < m_size; ++i) slots[i] = std::move((*this)[i]);
+			m_slots = std::move(slots);
+			m_head = 0;
+		}
+
+		std::vector<T> m_slots; // A power of two of them, or none yet
+		std::size_t m_head = 0;
+		std::size_t m_size = 0;
+	};
+}
@@ -0,0 +1,344 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "cw/buffer/shared_buffer.h"
+#include "cw/integrity/sha256.h"
+#include "cw/log/logger.h"
+#include "cw/network/object_store_receiver.h"
+
+namespace cw::network {
+
+	// Where an S3Store puts objects: path-style (http://host:port/bucket/key)
+	struct S3Config
+	{
+		std::string host;
+		std::uint16_t port = 80;
+		std::string bucket;
+		std::string region = "us-east-1";
+		std::string accessKey;
+		std::string secretKey;
+	};
+
+	// AWS Signature Version 4, for requests with their headers in the
+	// Authorization header
+	namespace sigv4 {
+
+		using Params = std::vector<std::pair<std::string, std::string>>;
+
+		// RFC 3986 unreserved characters kept, everything else %XX; '/' kept in paths
+		inline std::string uriEncode(std::string_view text, bool keepSlash)
+		{
+			static constexpr char DIGITS[] = "0123456789ABCDEF";
+			std::string out;
+			out.reserve(text.size());
+			for (unsigned char c : text) {
+				if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || (keepSlash && c == '/')) out.push_back(static_cast<char>(c));
+				else {
+					out.push_back('%');
+					out.push_back(DIGITS[c >> 4]);
+					out.push_back(DIGITS[c & 0xF]);
+				}
+			}
+			return out;
+		}
+
+		// name=value pairs, encoded and sorted; "uploads=" for a bare name
+		inline std::string canonicalQuery(const Params& query)
+		{
+			std::vector<std::string> pairs;
+			for (const auto& [name, value] : query) pairs.push_back(uriEncode(name, false) + "=" + uriEncode(value, false));
+			std::ranges::sort(pairs);
+			std::string out;
+			for (const auto& pair : pairs) out += (out.empty() ? "" : "&") + pair;
+			return out;
+		}
+
+		// "20150830T123600Z"
+		inline std::string amzDate(std::chrono::system_clock::time_point when)
+		{
+			std::time_t t = std::chrono::system_clock::to_time_t(when);
+			std::tm utc{};
+#if defined(_WIN32)
+			gmtime_s(&utc, &t);
+#else
+			gmtime_r(&t, &utc);
+#endif
+			char text[17];
+			std::strftime(text, sizeof(text), "%Y%m%dT%H%M%SZ", &utc);
+			return text;
+		}
+
+		// The Authorization header of a request whose 'headers' (lowercase
+		// names, all of them signed) include host and x-amz-date = 'date'
+		inline std::string authorization(std::string_view method, std::string_view path, const Params& query, Params headers,
+			std::string_view payloadHash, std::string_view date, std::string_view region, std::string_view service,
+			std::string_view accessKey, std::string_view secretKey)
+		{
+			auto bytes = [](std::string_view text) { return std::span<const std::uint8_t>(reinterpret_cast<const std::uint8_t*>(text.data()), text.size()); };
+
+			std::ranges::sort(headers);
+			std::string canonicalHeaders;
+			std::string signedHeaders;
+			for (const auto& [name, value] : headers) {
+				canonicalHeaders += name + ":" + value + "\n";
+				signedHeaders += (signedHeaders.empty() ? "" : ";") + name;
+			}
+
+			std::string canonical = std::string(method) + "\n" + uriEncode(path, true) + "\n" + canonicalQuery(query) + "\n"
+				+ canonicalHeaders + "\n" + signedHeaders + "\n" + std::string(payloadHash);
+			std::string day(date.substr(0, 8));
+			std::string scope = day + "/" + std::string(region) + "/" + std::string(service) + "/aws4_request";
+			std::string toSign = "AWS4-HMAC-SHA256\n" + std::string(date) + "\n" + scope + "\n" + cw::integrity::toHex(cw::integrity::sha256(bytes(canonical)));
+
+			std::string secret = "AWS4" + std::string(secretKey);
+			auto key = cw::integrity::hmacSha256(bytes(secret), bytes(day));
+			key = cw::integrity::hmacSha256(key, bytes(region));
+			key = cw::integrity::hmacSha256(key, bytes(service));
+			key = cw::integrity::hmacSha256(key, bytes("aws4_request"));
+			std::string signature = cw::integrity::toHex(cw::integrity::hmacSha256(key, bytes(toSign)));
+
+			return "AWS4-HMAC-SHA256 Credential=" + std::string(accessKey) + "/" + scope + ", SignedHeaders=" + signedHeaders + ", Signature=" + signature;
+		}
+	}
+
+	// MultipartStore over the S3 REST API, for ObjectStoreReceiver: AWS S3
+	// or any service speaking it (MinIO, Ceph RGW), signed with SigV4, each
+	// part's payload hashed into its signature. Plain HTTP, one connection
+	// per request, so parts go up in parallel: meant for an endpoint on the
+	// same network (a gateway, a local MinIO); put TLS in front otherwise.
+	// Requests run on 'executor' (give it threads: payloads are hashed
+	// there), and throttled (5xx) or dropped ones are tried again.
+	class S3Store : public std::enable_shared_from_this<S3Store>
+	{
+	public:
+		using UploadHandler = std::function<void(std::error_code, std::string uploadId)>;
+		using PartHandler = std::function<void(std::error_code, std::string etag)>;
+		using DoneHandler = std::function<void(std::error_code)>;
+
+		static constexpr unsigned MAX_ATTEMPTS = 3;
+
+		S3Store(asio::any_io_executor executor, S3Config config) : m_executor(std::move(executor)), m_config(std::move(config)) {}
+
+		const S3Config& config() const { return m_config; }
+
+		void createUpload(std::string key, UploadHandler onDone)
+		{
+			asio::co_spawn(m_executor, createTask(shared_from_this(), std::move(key)),
+				[onDone = std::move(onDone)](std::exception_ptr error, std::string uploadId) { onDone(errorOf(error), std::move(uploadId)); });
+		}
+
+		void uploadPart(std::string key, std::string uploadId, unsigned number, cw::buffer::SharedBuffer data, PartHandler onDone)
+		{
+			asio::co_spawn(m_executor, partTask(shared_from_this(), std::move(key), std::move(uploadId), number, std::move(data)),
+				[onDone = std::move(onDone)](std::exception_ptr error, std::string etag) { onDone(errorOf(error), std::move(etag)); });
+		}
+
+		void completeUpload(std::string key, std::string uploadId, std::vector<ObjectPart> parts, DoneHandler onDone)
+		{
+			asio::co_spawn(m_executor, completeTask(shared_from_this(), std::move(key), std::move(uploadId), std::move(parts)),
+				[onDone = std::move(onDone)](std::exception_ptr error) { onDone(errorOf(error)); });
+		}
+
+		// Best effort: the parts of an upload never completed are dropped
+		void abortUpload(std::string key, std::string uploadId)
+		{
+			asio::co_spawn(m_executor, abortTask(shared_from_this(), std::move(key), std::move(uploadId)),
+				[](std::exception_ptr error)
+				{
+					if (auto ec = errorOf(error)) CW_LOG_WARN("[S3] Abort failed: ", ec.message());
+				});
+		}
+
+	private:
+		struct Response
+		{
+			unsigned status = 0;
+			std::string etag;
+			std::string body;
+		};
+
+		static std::error_code errorOf(std::exception_ptr error)
+		{
+			if (!error) return {};
+			try {
+				std::rethrow_exception(error);
+			}
+			catch (const std::system_error& e) {
+				return e.code();
+			}
+			catch (const std::exception&) {
+				return std::make_error_code(std::errc::io_error);
+			}
+		}
+
+		static std::string between(const std::string& text, std::string_view open, std::string_view close)
+		{
+			auto start = text.find(open);
+			if (start == std::string::npos) return {};
+			start += open.size();
+			auto end = text.find(close, start);
+			return end == std::string::npos ? std::string() : text.substr(start, end - start);
+		}
+
+		static asio::awaitable<std::string> createTask(std::shared_ptr<S3Store> self, std::string key)
+		{
+			sigv4::Params query{ { "uploads", "" } };
+			Response response = co_await self->request("POST", key, query, cw::buffer::SharedBuffer());
+			std::string uploadId = between(response.body, "<UploadId>", "</UploadId>");
+			if (uploadId.empty()) throw std::system_error(std::make_error_code(std::errc::protocol_error), "no UploadId");
+			co_return uploadId;
+		}
+
+		static asio::awaitable<std::string> partTask(std::shared_ptr<S3Store> self, std::string key, std::string uploadId, unsigned number,
+			cw::buffer::SharedBuffer data)
+		{
+			sigv4::Params query{ { "partNumber", std::to_string(number) }, { "uploadId", uploadId } };
+			Response response = co_await self->request("PUT", key, query, data);
+			if (response.etag.empty()) throw std::system_error(std::make_error_code(std::errc::protocol_error), "no ETag");
+			co_return response.etag;
+		}
+
+		static asio::awaitable<void> completeTask(std::shared_ptr<S3Store> self, std::string key, std::string uploadId, std::vector<ObjectPart> parts)
+		{
+			std::string xml = "<CompleteMultipartUpload>";
+			for (const auto& part : parts)
+				xml += "<Part><PartNumber>" + std::to_string(part.number) + "</PartNumber><ETag>" + part.etag + "</ETag></Part>";
+			xml += "</CompleteMultipartUpload>";
+
+			sigv4::Params query{ { "uploadId", uploadId } };
+			std::vector<std::uint8_t> body(xml.begin(), xml.end());
+			Response response = co_await self->request("POST", key, query, cw::buffer::SharedBuffer::fromVector(std::move(body)));
+
+			// A 200 that failed half way says so in its body
+			if (response.body.find("<Error>") != std::string::npos) {
+				CW_LOG_ERROR("[S3] Completing ", key, " failed: ", between(response.body, "<Message>", "</Message>"));
+				throw std::system_error(std::make_error_code(std::errc::io_error));
+			}
+		}
+
+		static asio::awaitable<void> abortTask(std::shared_ptr<S3Store> self, std::string key, std::string uploadId)
+		{
+			sigv4::Params query{ { "uploadId", uploadId } };
+			co_await self->request("DELETE", key, query, cw::buffer::SharedBuffer());
+		}
+
+		// One request, tried again after a 5xx or a failed exchange
+		asio::awaitable<Response> request(std::string method, std::string key, sigv4::Params query, cw::buffer::SharedBuffer body)
+		{
+			for (unsigned attempt = 1;; ++attempt) {
+				std::error_code ec;
+				Response response;
+				try {
+					response = co_await exchange(method, key, query, body.span());
+				}
+				catch (const std::system_error& e) {
+					ec = e.code();
+				}
+				if (!ec && response.status == 0) ec = std::make_error_code(std::errc::protocol_error);
+
+				if (!ec && response.status < 500) {
+					if (response.status >= 300) {
+						CW_LOG_ERROR("[S3] ", method, " ", key, ": HTTP ", response.status, " ", between(response.body, "<Code>", "</Code>"));
+						throw std::system_error(errorForStatus(response.status));
+					}
+					co_return response;
+				}
+				if (attempt == MAX_ATTEMPTS) throw std::system_error(ec ? ec : errorForStatus(response.status));
+
+				CW_LOG_WARN("[S3] ", method, " ", key, " failed (", ec ? ec.message() : "HTTP " + std::to_string(response.status), "), trying again");
+				asio::steady_timer backoff(m_executor, std::chrono::milliseconds(200 * attempt));
+				co_await backoff.async_wait(asio::use_awaitable);
+			}
+		}
+
+		static std::error_code errorForStatus(unsigned status)
+		{
+			if (status == 403) return std::make_error_code(std::errc::permission_denied);
+			if (status == 404) return std::make_error_code(std::errc::no_such_file_or_directory);
+			return std::make_error_code(std::errc::io_error);
+		}
+
+		asio::awaitable<Response> exchange(const std::string& method, const std::string& key, const sigv4::Params& query,
+			std::span<const std::uint8_t> body)
+		{
+			std::string path = "/" + m_config.bucket + "/" + key;
+			std::string host = m_config.port == 80 ? m_config.host : m_config.host + ":" + std::to_string(m_config.port);
+			std::string payloadHash = cw::integrity::toHex(cw::integrity::sha256(body));
+			std::string date = sigv4::amzDate(std::chrono::system_clock::now());
+			sigv4::Params headers{ { "host", host }, { "x-amz-content-sha256", payloadHash }, { "x-amz-date", date } };
+
+			std::string head = method + " " + sigv4::uriEncode(path, true);
+			if (!query.empty()) head += "?" + sigv4::canonicalQuery(query);
+			head += " HTTP/1.1\r\n";
+			for (const auto& [name, value] : headers) head += name + ": " + value + "\r\n";
+			head += "Authorization: " + sigv4::authorization(method, path, query, headers, payloadHash, date, m_config.region, "s3",
+				m_config.accessKey, m_config.secretKey) + "\r\n";
+			head += "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+
+			asio::ip::tcp::resolver resolver(m_executor);
+			auto endpoints = co_await resolver.async_resolve(m_config.host, std::to_string(m_config.port), asio::use_awaitable);
+			asio::ip::tcp::socket socket(m_executor);
+			co_await asio::async_connect(socket, endpoints, asio::use_awaitable);
+
+			std::array<asio::const_buffer, 2> buffers{ asio::buffer(head), asio::buffer(body.data(), body.size()) };
+			co_await asio::async_write(socket, buffers, asio::use_awaitable);
+
+			std::string received;
+			std::size_t headerEnd = co_await asio::async_read_until(socket, asio::dynamic_buffer(received), "\r\n\r\n", asio::use_awaitable);
+
+			Response response;
+			std::optional<std::size_t> contentLength;
+			std::string_view headerText(received.data(), headerEnd);
+			std::size_t lineEnd = headerText.find("\r\n");
+			std::string_view statusLine = headerText.substr(0, lineEnd);
+			if (auto space = statusLine.find(' '); space != std::string_view::npos) response.status = static_cast<unsigned>(std::atoi(std::string(statusLine.substr(space + 1, 3)).c_str()));
+
+			while (lineEnd != std::string_view::npos && lineEnd + 2 < headerText.size()) {
+				std::size_t next = headerText.find("\r\n", lineEnd + 2);
+				std::string_view line = headerText.substr(lineEnd + 2, next - lineEnd - 2);
+				lineEnd = next;
+				auto colon = line.find(':');
+				if (colon == std::string_view::npos) continue;
+				std::string name(line.substr(0, colon));
+				std::ranges::transform(name, name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+				std::string_view value = line.substr(colon + 1);
+				while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+				if (name == "etag") response.etag = std::string(value);
+				else if (name == "content-length") contentLength = static_cast<std::size_t>(std::stoull(std::string(value)));
+			}
+
+			// The rest is the body: Content-Length of it, or all until the server closes
+			response.body = received.substr(headerEnd);
+			std::error_code ec;
+			if (contentLength && response.body.size() < *contentLength) {
+				co_await asio::async_read(socket, asio::dynamic_buffer(response.body), asio::transfer_exactly(*contentLength - response.body.size()),
+					asio::redirect_error(asio::use_awaitable, ec));
+			}
+			else if (!contentLength) {
+				co_await asio::async_read(socket, asio::dynamic_buffer(response.body), asio::redirect_error(asio::use_awaitable, ec));
+			}
+			if (ec && ec != asio::error::eof) throw std::system_error(ec);
+			co_return response;
+		}
+
+		asio::any_io_executor m_executor;
+		S3Config m_config;
+	};
+}
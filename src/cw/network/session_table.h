@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace cw::network {
+
+	class Connection;
+
+	// The connection each client session (cw::packet::Session) is on, for a
+	// receiver whose clients reconnect: when one comes back on a new
+	// connection, the one it left behind is found here and closed, even if
+	// this end never saw it fail (a NAT rebinding, a load balancer failover).
+	// Shared by every connection of a process, whichever thread it runs on.
+	class SessionTable
+	{
+	public:
+		static std::shared_ptr<SessionTable> defaultInstance()
+		{
+			static std::shared_ptr<SessionTable> instance = std::make_shared<SessionTable>();
+			return instance;
+		}
+
+		// 'conn' is now the session's connection; returns the one it was on
+		// before, if that one is still around
+		std::shared_ptr<Connection> claim(std::uint64_t sessionId, std::weak_ptr<Connection> conn)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto& entry = m_sessions[sessionId];
+			auto previous = entry.lock();
+			entry = std::move(conn);
+			return previous;
+		}
+
+		// 'conn' is closing: the session is forgotten, unless it has moved on
+		// to another connection already
+		void release(std::uint64_t sessionId, const Connection* conn)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_sessions.find(sessionId);
+			if (it == m_sessions.end()) return;
+			auto current = it->second.lock();
+			if (!current || current.get() == conn) m_sessions.erase(it);
+		}
+
+		std::size_t size() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_sessions.size();
+		}
+
+	private:
+		mutable std::mutex m_mutex;
+		std::unordered_map<std::uint64_t, std::weak_ptr<Connection>> m_sessions;
+	};
+}
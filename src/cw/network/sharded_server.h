@@ -0,0 +1,337 @@
+#pragma once
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "cw/network/Server.h"
+#include "cw/network/busy_poll.h"
+#include "cw/buffer/buffer_pool.h"
+#include "cw/log/logger.h"
+#include "cw/numa.h"
+
+namespace cw::network {
+
+	// Best effort: a failure only costs locality, so it is logged and ignored.
+	inline void pinCurrentThreadToCore(std::size_t core)
+	{
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core % CPU_SETSIZE, &set);
+		if (int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); rc != 0) {
+			CW_LOG_WARN("[Server] Could not pin thread to core ", core, " (error ", rc, ")");
+		}
+#elif defined(_WIN32)
+		DWORD_PTR mask = DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8));
+		if (::SetThreadAffinityMask(::GetCurrentThread(), mask) == 0) {
+			CW_LOG_WARN("[Server] Could not pin thread to core ", core);
+		}
+#else
+		(void)core;
+#endif
+	}
+
+	// Where a ShardedServer's threads run on a NUMA machine: the shards on
+	// the CPUs of the NIC's node, the disk pool on those of the disk's, each
+	// thread allocating its pages and trading pooled buffers on its node, so
+	// receive buffers are not filled across the interconnect. Unset: shards
+	// are pinned to cores 0..N-1 and the disk pool floats.
+	struct NumaPlacement
+	{
+		std::optional<int> networkNode;
+		std::optional<int> diskNode;
+	};
+
+	// Shard-per-core server: N single-threaded io_contexts, each run by a thread
+	// pinned to its own core. With SO_REUSEPORT every shard has its own acceptor
+	// on the same port and the kernel spreads new connections across them, so a
+	// connection lives and dies on one thread and Connection::send never wakes
+	// another core. Without SO_REUSEPORT, shard 0 accepts and hands connections
+	// to the shards round-robin.
+	class ShardedServer {
+	public:
+		ShardedServer(uint16_t port, std::size_t shards, std::shared_ptr<cw::file::DiskWriter> diskWriter = nullptr)
+		{
+			shards = std::max<std::size_t>(1, shards);
+			if (!diskWriter) diskWriter = cw::file::DiskWriter::defaultInstance();
+			m_diskWriter = diskWriter;
+
+			for (std::size_t i = 0; i < shards; ++i) {
+				// Each context is only ever run by one thread: concurrency hint 1
+				// (handlers posted from it skip the queue's lock), and no lock per
+				// socket, whose operations only that thread starts. Posts from the
+				// disk pool and registrations from the accepting shard stay locked.
+				m_contexts.push_back(std::make_unique<asio::io_context>(asio::config_from_string("scheduler.concurrency_hint=1\nreactor.io_locking=0")));
+			}
+
+			if (Server::reusePortSupported()) {
+				for (auto& io : m_contexts) {
+					m_servers.push_back(std::make_unique<Server>(*io, port, diskWriter, true));
+					m_servers.back()->setInlineSends(true);
+					port = m_servers.back()->port(); // Port 0: the rest join the one the first was given
+				}
+			}
+			else {
+				auto server = std::make_unique<Server>(*m_contexts.front(), port, diskWriter);
+				server->setInlineSends(true);
+
+				std::vector<asio::io_context*> targets;
+				for (auto& io : m_contexts) targets.push_back(io.get());
+				server->distributeTo(std::move(targets));
+
+				m_servers.push_back(std::move(server));
+			}
+		}
+
+		// Applied to every shard's listener and the sockets it accepts
+		void setSocketOptions(const SocketOptions& options)
+		{
+			for (auto& server : m_servers) server->setSocketOptions(options);
+		}
+
+		void setServerCopyRoots(const std::vector<std::filesystem::path>& roots)
+		{
+			for (auto& server : m_servers) server->setServerCopyRoots(roots);
+		}
+
+		void setDownloadRoots(const std::vector<std::filesystem::path>& roots, const cw::TransferOptions& options = {})
+		{
+			for (auto& server : m_servers) server->setDownloadRoots(roots, options);
+		}
+
+		// One relay for all shards: it is thread-safe
+		void setFileRelay(const std::shared_ptr<cw::FileRelay>& relay)
+		{
+			for (auto& server : m_servers) server->setFileRelay(relay);
+		}
+
+		// Runs on the shard thread that accepted the connection
+		void setConnectionSetup(const std::function<void(Connection&)>& setup)
+		{
+			for (auto& server : m_servers) server->setConnectionSetup(setup);
+		}
+
+		// One store for all shards: it is thread-safe
+		void setContentStore(const std::shared_ptr<cw::file::ContentStore>& store)
+		{
+			for (auto& server : m_servers) server->setContentStore(store);
+		}
+
+		// One set for all shards: placing is thread-safe
+		void setVolumes(const std::shared_ptr<const cw::file::VolumeSet>& volumes)
+		{
+			for (auto& server : m_servers) server->setVolumes(volumes);
+		}
+
+		// One gossip for all shards: its table is thread-safe
+		void setLoadGossip(const std::shared_ptr<const LoadGossip>& gossip)
+		{
+			for (auto& server : m_servers) server->setLoadGossip(gossip);
+		}
+
+		// One cache for all shards: it is thread-safe
+		void setSignatureCache(const std::shared_ptr<cw::file::SignatureCache>& cache)
+		{
+			for (auto& server : m_servers) server->setSignatureCache(cache);
+		}
+
+		// One next hop for all shards: sends to it are thread-safe
+		void setForwarding(const std::shared_ptr<Connection>& downstream, ForwardMode mode = ForwardMode::WriteToo)
+		{
+			for (auto& server : m_servers) server->setForwarding(downstream, mode);
+		}
+
+		void setReceiveLimits(std::uint32_t maxChunkSize, std::uint64_t receiveWindow)
+		{
+			for (auto& server : m_servers) server->setReceiveLimits(maxChunkSize, receiveWindow);
+		}
+
+		// One count for all shards: the limit is for the whole server
+		void setMaxConnections(std::size_t limit)
+		{
+			auto open = std::make_shared<std::atomic<std::size_t>>(0);
+			for (auto& server : m_servers) server->setMaxConnections(limit, open);
+		}
+
+		void setIdleTimeout(std::chrono::steady_clock::duration timeout)
+		{
+			for (auto& server : m_servers) server->setIdleTimeout(timeout);
+		}
+
+		void setStallTimeout(std::chrono::steady_clock::duration timeout)
+		{
+			for (auto& server : m_servers) server->setStallTimeout(timeout);
+		}
+
+		void setHeartbeat(std::chrono::steady_clock::duration interval, unsigned missed = 3)
+		{
+			for (auto& server : m_servers) server->setHeartbeat(interval, missed);
+		}
+
+		void setTreeHash(bool enabled)
+		{
+			for (auto& server : m_servers) server->setTreeHash(enabled);
+		}
+
+		void setChunkKey(const std::shared_ptr<const cw::integrity::ChunkKey>& key)
+		{
+			for (auto& server : m_servers) server->setChunkKey(key);
+		}
+
+		void setServeStats(bool enabled)
+		{
+			for (auto& server : m_servers) server->setServeStats(enabled);
+		}
+
+		void setSpliceReceive(bool enabled)
+		{
+			for (auto& server : m_servers) server->setSpliceReceive(enabled);
+		}
+
+		void setZeroCopyReceive(bool enabled)
+		{
+			for (auto& server : m_servers) server->setZeroCopyReceive(enabled);
+		}
+
+		void setConnectionRateLimit(std::uint64_t bytesPerSecond)
+		{
+			for (auto& server : m_servers) server->setConnectionRateLimit(bytesPerSecond);
+		}
+
+		// One limiter for all shards: the cap is for the whole server
+		void setRateLimiter(std::shared_ptr<RateLimiter> limiter)
+		{
+			for (auto& server : m_servers) server->setRateLimiter(limiter);
+		}
+
+		// One budget for all shards, a quota for each connection
+		void setMemoryBudget(std::shared_ptr<cw::buffer::MemoryBudget> budget, std::size_t connectionQuota = 0)
+		{
+			for (auto& server : m_servers) server->setMemoryBudget(budget, connectionQuota);
+		}
+
+		// Per shard: each has its own listener
+		void setPendingAccepts(std::size_t count)
+		{
+			for (auto& server : m_servers) server->setPendingAccepts(count);
+		}
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+		// Local connections are few and share one shard
+		void listenLocal(const std::string& path) { m_servers.front()->listenLocal(path); }
+#endif
+
+#if defined(CW_HAS_TLS)
+		void setTls(std::shared_ptr<asio::ssl::context> context)
+		{
+			for (auto& server : m_servers) server->setTls(context);
+		}
+#endif
+
+		// Pins the disk pool now and the shards when run() starts them
+		void setNumaPlacement(const NumaPlacement& placement)
+		{
+			m_networkNode = placement.networkNode;
+			if (!placement.diskNode) return;
+
+			int node = *placement.diskNode;
+			auto cpus = cw::numa::cpusOfNode(node);
+			if (cpus.empty()) CW_LOG_WARN("[Server] NUMA node ", node, " has no CPUs, disk threads not pinned");
+			m_diskWriter->runOnEachThread([node, cpus]()
+				{
+					cw::numa::pinCurrentThreadToNode(node, cpus);
+					cw::buffer::BufferPool::setThreadNode(node);
+				});
+			CW_LOG_INFO("[Server] Disk threads on NUMA node ", node);
+		}
+
+		std::size_t shardCount() const { return m_contexts.size(); }
+
+		// The port every shard listens on, the one picked when given 0
+		uint16_t port() const { return m_servers.front()->port(); }
+
+		// Shard threads spin on their context instead of sleeping in it
+		// (runSpinning): a core each. Call before run().
+		void setSpinning(bool spin) { m_spin = spin; }
+
+		// For work that should run alongside a shard (timers, the metrics endpoint)
+		asio::io_context& context(std::size_t shard) { return *m_contexts.at(shard); }
+
+		// Blocks until stop() is called. Shard 0 runs on the calling thread.
+		void run()
+		{
+			// Keeps idle shards alive while they wait for their first connection
+			std::vector<asio::executor_work_guard<asio::io_context::executor_type>> guards;
+			for (auto& io : m_contexts) guards.push_back(asio::make_work_guard(*io));
+
+			std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+
+			// One core of the node per shard, round-robin when there are more shards
+			std::vector<std::size_t> nodeCpus;
+			if (m_networkNode) {
+				nodeCpus = cw::numa::cpusOfNode(*m_networkNode);
+				if (nodeCpus.empty()) CW_LOG_WARN("[Server] NUMA node ", *m_networkNode, " has no CPUs, shards pinned to cores");
+				else CW_LOG_INFO("[Server] Shards on NUMA node ", *m_networkNode);
+			}
+			auto pin = [this, &nodeCpus, cores](std::size_t shard)
+				{
+					if (nodeCpus.empty()) {
+						pinCurrentThreadToCore(shard % cores);
+						return;
+					}
+					cw::numa::pinCurrentThreadToNode(*m_networkNode, { nodeCpus[shard % nodeCpus.size()] });
+					cw::buffer::BufferPool::setThreadNode(*m_networkNode);
+				};
+
+			std::vector<std::thread> threads;
+			for (std::size_t i = 1; i < m_contexts.size(); ++i) {
+				threads.emplace_back([this, i, &pin]()
+					{
+						pin(i);
+						runEventLoop(*m_contexts[i], m_spin);
+					});
+			}
+
+			pin(0);
+			runEventLoop(*m_contexts.front(), m_spin);
+
+			for (auto& thread : threads) thread.join();
+		}
+
+		// Drains every shard (see Server::drain); 'onDrained' runs once all
+		// have, on the last shard to finish
+		void drain(std::chrono::steady_clock::duration timeout, std::function<void()> onDrained)
+		{
+			auto left = std::make_shared<std::atomic<std::size_t>>(m_servers.size());
+			auto done = std::make_shared<std::function<void()>>(std::move(onDrained));
+			for (auto& server : m_servers) {
+				server->drain(timeout, [left, done]()
+					{
+						if (left->fetch_sub(1) == 1 && *done) (*done)();
+					});
+			}
+		}
+
+		void stop()
+		{
+			for (auto& io : m_contexts) io->stop();
+		}
+
+	private:
+		std::vector<std::unique_ptr<asio::io_context>> m_contexts;
+		bool m_spin = false;
+		std::vector<std::unique_ptr<Server>> m_servers;
+		std::shared_ptr<cw::file::DiskWriter> m_diskWriter;
+		std::optional<int> m_networkNode;
+	};
+}
@@ -0,0 +1,188 @@
+#pragma once
+#include <asio.hpp>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "cw/log/logger.h"
+
+namespace cw::network {
+
+	// TCP tuning applied to listening, accepted and connected sockets. Every
+	// field defaults to "leave the kernel's setting alone"; options the
+	// platform lacks are skipped.
+	struct SocketOptions
+	{
+		// Disable Nagle: small control packets (acks, resume offsets, diffs)
+		// go out at once instead of waiting behind unacknowledged data
+		bool noDelay = false;
+
+		// SO_SNDBUF / SO_RCVBUF in bytes, 0 = kernel default (autotuned on
+		// Linux). High bandwidth-delay links need at least bandwidth x RTT.
+		// The receive buffer is set before listen/connect so that the window
+		// scale negotiated in the handshake can use it.
+		std::size_t sendBufferSize = 0;
+		std::size_t receiveBufferSize = 0;
+
+		// TCP_NOTSENT_LOWAT in bytes (Linux, macOS): the socket reports
+		// writable only while less than this much is unsent, so a large send
+		// buffer holds data in flight without queueing it behind the window.
+		std::size_t notSentLowWatermark = 0;
+
+		// SO_BUSY_POLL in microseconds (Linux): spin on the device queue
+		// before sleeping in a read. Trades CPU for receive latency.
+		int busyPollMicros = 0;
+
+		// TCP_CONGESTION (Linux), e.g. "bbr" or "cubic". Empty = system default.
+		// The algorithm's module must be loaded and allowed for unprivileged use.
+		std::string congestionControl;
+
+		// SO_ZEROCOPY (Linux 4.14+): a Connection on the socket sends large
+		// payloads with MSG_ZEROCOPY, the kernel reading them from the send
+		// queue's pages instead of copying them. Pays off from tens of KB per
+		// send on a real NIC; over loopback the kernel copies anyway, and the
+		// connection goes back to plain sends.
+		bool zeroCopy = false;
+
+		// Local source of outgoing connections (Client, ClientPool): an IP address, so
+		// the stream leaves from it (and, with source routing, through its NIC),
+		// or an interface name (SO_BINDTODEVICE, Linux). Empty = the routing
+		// table's choice. See bindLocal.
+		std::string bindTo;
+
+		// Windows, built with CW_USE_REGISTERED_IO: outgoing sockets are opened for Registered I/O and their
+		// Connection sends through it (Client, ClientPool; see
+		// Connection::setRegisteredIo). For high rates of small frames.
+		bool registeredIo = false;
+	};
+
+	// Best effort, like thread pinning: an option the kernel refuses only costs
+	// performance, so it is logged and the others are still applied.
+	// Works on tcp::socket and tcp::acceptor alike; Linux copies every one of
+	// these from a listening socket to the sockets it accepts.
+	template<typename Socket>
+	void applySocketOptions(Socket& socket, const SocketOptions& options)
+	{
+		std::error_code ec;
+		auto check = [&ec](const char* name)
+			{
+				if (ec) CW_LOG_WARN("[Socket] Could not set ", name, ": ", ec.message());
+				ec.clear();
+			};
+
+		if (options.noDelay) {
+			socket.set_option(asio::ip::tcp::no_delay(true), ec);
+			check("TCP_NODELAY");
+		}
+		if (options.sendBufferSize != 0) {
+			socket.set_option(asio::socket_base::send_buffer_size(static_cast<int>(options.sendBufferSize)), ec);
+			check("SO_SNDBUF");
+		}
+		if (options.receiveBufferSize != 0) {
+			socket.set_option(asio::socket_base::receive_buffer_size(static_cast<int>(options.receiveBufferSize)), ec);
+			check("SO_RCVBUF");
+		}
+
+		if (options.notSentLowWatermark != 0) {
+#if defined(TCP_NOTSENT_LOWAT)
+			socket.set_option(asio::detail::socket_option::integer<IPPROTO_TCP, TCP_NOTSENT_LOWAT>(static_cast<int>(options.notSentLowWatermark)), ec);
+			check("TCP_NOTSENT_LOWAT");
+#else
+			CW_LOG_WARN("[Socket] TCP_NOTSENT_LOWAT is not supported on this platform");
+#endif
+		}
+
+		if (options.busyPollMicros != 0) {
+#if defined(SO_BUSY_POLL)
+			socket.set_option(asio::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL>(options.busyPollMicros), ec);
+			check("SO_BUSY_POLL");
+#else
+			CW_LOG_WARN("[Socket] SO_BUSY_POLL is not supported on this platform");
+#endif
+		}
+
+		if (!options.congestionControl.empty()) {
+#if defined(TCP_CONGESTION)
+			// A string option, which asio has no wrapper for
+			if (::setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_CONGESTION,
+				options.congestionControl.data(), static_cast<socklen_t>(options.congestionControl.size())) != 0) {
+				ec.assign(errno, asio::error::get_system_category());
+			}
+			check("TCP_CONGESTION");
+#else
+			CW_LOG_WARN("[Socket] TCP_CONGESTION is not supported on this platform");
+#endif
+		}
+
+		if (options.zeroCopy) {
+#if defined(SO_ZEROCOPY)
+			socket.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_ZEROCOPY>(true), ec);
+			check("SO_ZEROCOPY");
+#else
+			CW_LOG_WARN("[Socket] SO_ZEROCOPY is not supported on this platform");
+#endif
+		}
+	}
+
+	// Binds an opened, unconnected socket to 'source' (SocketOptions::bindTo).
+	// Unlike the options above this is not best effort: a stream meant for one
+	// path must not quietly take another. An address of the other family than
+	// the socket fails, so only the matching endpoints of a race are tried.
+	template<typename Socket>
+	std::error_code bindLocal(Socket& socket, const std::string& source)
+	{
+		std::error_code ec;
+		asio::ip::address address = asio::ip::make_address(source, ec);
+		if (!ec) {
+			asio::ip::tcp::endpoint local(address, 0);
+			auto unbound = socket.local_endpoint(ec);
+			if (ec) return ec;
+			if (unbound.protocol().family() != local.protocol().family()) return asio::error::address_family_not_supported;
+			socket.bind(typename Socket::endpoint_type(local), ec);
+			return ec;
+		}
+
+		ec.clear();
+#if defined(SO_BINDTODEVICE)
+		if (::setsockopt(socket.native_handle(), SOL_SOCKET, SO_BINDTODEVICE, source.data(), static_cast<socklen_t>(source.size())) != 0)
+			ec.assign(errno, asio::error::get_system_category());
+#else
+		ec = asio::error::operation_not_supported;
+#endif
+		return ec;
+	}
+
+	// Before connecting: binds to options.bindTo, if set, or closes the socket
+	// so that this connect attempt fails and the race goes on without it
+	template<typename Socket>
+	void applySourceBinding(Socket& socket, const SocketOptions& options)
+	{
+		if (options.bindTo.empty()) return;
+		if (auto ec = bindLocal(socket, options.bindTo)) {
+			if (ec != asio::error::address_family_not_supported)
+				CW_LOG_WARN("[Socket] Could not bind to ", options.bindTo, ": ", ec.message());
+			std::error_code ignored;
+			socket.close(ignored);
+		}
+	}
+
+	// Command-line form shared by the Server and Client mains. Returns false
+	// when 'arg' is not a socket option.
+	//   --nodelay --sndbuf-kb=N --rcvbuf-kb=N --notsent-lowat-kb=N --busy-poll-us=N --congestion=NAME --zerocopy --rio
+	inline bool parseSocketOption(std::string_view arg, SocketOptions& options)
+	{
+		auto value = [arg](std::string_view prefix) { return std::stoul(std::string(arg.substr(prefix.size()))); };
+
+		if (arg == "--nodelay") options.noDelay = true;
+		else if (arg.starts_with("--sndbuf-kb=")) options.sendBufferSize = value("--sndbuf-kb=") * 1024;
+		else if (arg.starts_with("--rcvbuf-kb=")) options.receiveBufferSize = value("--rcvbuf-kb=") * 1024;
+		else if (arg.starts_with("--notsent-lowat-kb=")) options.notSentLowWatermark = value("--notsent-lowat-kb=") * 1024;
+		else if (arg.starts_with("--busy-poll-us=")) options.busyPollMicros = static_cast<int>(value("--busy-poll-us="));
+		else if (arg.starts_with("--congestion=")) options.congestionControl = std::string(arg.substr(13));
+		else if (arg == "--zerocopy") options.zeroCopy = true;
+		else if (arg == "--rio") options.registeredIo = true;
+		else return false;
+
+		return true;
+	}
+}
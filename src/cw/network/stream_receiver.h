@@ -0,0 +1,266 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+#include <asio/experimental/concurrent_channel.hpp>
+
+#include "cw/network/Connection.h"
+#include "cw/buffer/shared_buffer.h"
+#include "cw/compression/codec.h"
+#include "cw/integrity/checksum.h"
+
+namespace cw::network {
+
+	// Receiver that hands uploaded files to code as they stream in, for
+	// applications that process them in process instead of writing them and
+	// reading them back: plugged into a Connection with setHandler(), it
+	// delivers each chunk's payload as a SharedBuffer, a view of the bytes
+	// the socket read (see Connection::keepPayload; decompressed chunks are
+	// the one copy), to a callback or a coroutine channel. Backpressure: while
+	// the consumer holds more than 'maxHeldBytes' of delivered buffers, or
+	// the channel is full, the socket is not read, and TCP slows the sender.
+	// Chunks arrive in order for a single-stream upload, resent ones aside;
+	// whether the file was intact is only known at its End. Single-stream
+	// uploads only, as MemoryReceiver, and one receiver per connection; a
+	// stream cut short by the connection going away gets no End.
+	class StreamReceiver
+	{
+	public:
+		struct Event
+		{
+			enum class Kind { Begin, Data, End };
+
+			Kind kind = Kind::Data;
+			std::uint32_t streamId = 0;
+			std::string name;              // Begin
+			std::uint64_t fileSize = 0;    // Begin
+			std::uint64_t offset = 0;      // Data
+			cw::buffer::SharedBuffer data; // Data
+			std::error_code error;         // End: illegal_byte_sequence if the file arrived incomplete or corrupt
+		};
+
+		using Channel = asio::experimental::concurrent_channel<void(std::error_code, Event)>;
+
+		static constexpr std::size_t DEFAULT_MAX_HELD_BYTES = 64 * 1024 * 1024;
+
+		// Runs on the connection's strand for every event
+		explicit StreamReceiver(std::function<void(Event)> onEvent, std::size_t maxHeldBytes = DEFAULT_MAX_HELD_BYTES) :
+			m_onEvent(std::move(onEvent)), m_flow(std::make_shared<Flow>(maxHeldBytes))
+		{
+		}
+
+		// Events are sent to 'channel', for a coroutine to async_receive
+		explicit StreamReceiver(std::shared_ptr<Channel> channel, std::size_t maxHeldBytes = DEFAULT_MAX_HELD_BYTES) :
+			m_channel(std::move(channel)), m_flow(std::make_shared<Flow>(maxHeldBytes))
+		{
+		}
+
+		void onPacket(Connection& conn, cw::packet::FileInfoView pkt)
+		{
+			// Set before any buffer is handed out, read where they are dropped
+			if (m_flow->conn.expired()) m_flow->conn = conn.weak_from_this();
+
+			auto& stream = m_streams[pkt.streamId];
+			stream = Stream{};
+			stream.fileSize = pkt.fileSize;
+			stream.digest = cw::integrity::FileDigest(pkt.fileSize);
+
+			Event event;
+			event.kind = Event::Kind::Begin;
+			event.streamId = pkt.streamId;
+			event.name = std::string(pkt.fileName);
+			event.fileSize = pkt.fileSize;
+			deliver(conn, std::move(event));
+		}
+
+		void onPacket(Connection& conn, cw::packet::FileChunkView pkt)
+		{
+			if (pkt.crc && cw::integrity::crc32c(pkt.data) != *pkt.crc) {
+				fail(conn, pkt.streamId, "Chunk checksum mismatch");
+				return;
+			}
+			if (!m_streams.contains(pkt.streamId)) return;
+			pass(conn, pkt.streamId, pkt.offset, conn.keepPayload(pkt.data), pkt.crc);
+		}
+
+		void onPacket(Connection& conn, cw::packet::CompressedChunkView pkt)
+		{
+			std::vector<std::uint8_t> raw(pkt.rawSize);
+			std::error_code ec = cw::compression::decompress(static_cast<cw::compression::Codec>(pkt.codec), pkt.data, raw);
+			if (!ec && pkt.crc && cw::integrity::crc32c(raw) != *pkt.crc) ec = std::make_error_code(std::errc::illegal_byte_sequence);
+			if (ec) {
+				fail(conn, pkt.streamId, "Cannot decompress chunk: " + ec.message());
+				return;
+			}
+			if (!m_streams.contains(pkt.streamId)) return;
+			pass(conn, pkt.streamId, pkt.offset, cw::buffer::SharedBuffer::fromVector(std::move(raw)), pkt.crc);
+		}
+
+		void onPacket(Connection& conn, cw::packet::FileDone pkt)
+		{
+			auto it = m_streams.find(pkt.streamId);
+			if (it == m_streams.end()) return;
+
+			Stream stream = std::move(it->second);
+			m_streams.erase(it);
+
+			bool intact = stream.received == stream.fileSize && pkt.fileSize == stream.fileSize
+				&& (!pkt.crc || stream.unchecked || stream.digest.value() == *pkt.crc);
+			if (!intact) {
+				sendError(conn, cw::packet::ErrorCode::ChecksumMismatch, "Stream " + std::to_string(pkt.streamId) + " arrived incomplete or corrupt", pkt.streamId);
+				end(conn, pkt.streamId, std::make_error_code(std::errc::illegal_byte_sequence));
+				return;
+			}
+
+			conn.sendAck(pkt.streamId, stream.received);
+			end(conn, pkt.streamId, {});
+		}
+
+		// Bytes delivered and not yet dropped by the consumer
+		std::size_t heldBytes() const { return m_flow->held.load(); }
+
+	private:
+		struct Stream
+		{
+			std::uint64_t fileSize = 0;
+			cw::integrity::FileDigest digest;
+			std::uint64_t received = 0;
+			std::uint64_t lastAcked = 0;
+			bool unchecked = false;
+		};
+
+		// Shared with the buffers handed out, which may be dropped on any
+		// thread after the receiver is gone
+		struct Flow
+		{
+			explicit Flow(std::size_t maxHeldBytes) : maxHeld(maxHeldBytes) {}
+
+			const std::size_t maxHeld;
+			std::atomic<std::size_t> held = 0;
+			std::atomic<bool> sending = false; // A channel send waits for room
+			std::atomic<bool> paused = false;
+			std::weak_ptr<Connection> conn;
+
+			// Reading goes on at half the limit, and once the channel has room
+			void maybeResume()
+			{
+				if (held.load() > maxHeld / 2 || sending.load()) return;
+				if (!paused.exchange(false)) return;
+				if (auto c = conn.lock()) c->resumeReading();
+			}
+		};
+
+		void pass(Connection& conn, std::uint32_t streamId, std::uint64_t offset, cw::buffer::SharedBuffer data,
+			const std::optional<std::uint32_t>& crc)
+		{
+			auto& stream = m_streams[streamId];
+			if (offset > stream.fileSize || data.size() > stream.fileSize - offset)
+				throw std::runtime_error("StreamReceiver: chunk beyond the end of the file");
+
+			stream.received += data.size();
+			if (crc) stream.digest.add(offset, data.size(), *crc);
+			else stream.unchecked = true;
+
+			// Progress acks keep the sender's ack window moving
+			if (stream.received - stream.lastAcked >= cw::packet::ACK_INTERVAL) {
+				stream.lastAcked = stream.received;
+				conn.sendAck(streamId, stream.received);
+			}
+
+			Event event;
+			event.kind = Event::Kind::Data;
+			event.streamId = streamId;
+			event.offset = offset;
+			event.data = hold(conn, std::move(data));
+			deliver(conn, std::move(event));
+		}
+
+		// 'data', counted as held until the consumer drops its last copy
+		cw::buffer::SharedBuffer hold(Connection& conn, cw::buffer::SharedBuffer data)
+		{
+			std::size_t size = data.size();
+			auto span = data.span();
+			std::shared_ptr<const void> owner(new cw::buffer::SharedBuffer(std::move(data)),
+				[flow = m_flow, size](const cw::buffer::SharedBuffer* held)
+				{
+					delete held;
+					flow->held -= size;
+					flow->maybeResume();
+				});
+
+			std::size_t held = m_flow->held += size;
+			if (held > m_flow->maxHeld) pause(conn);
+			return cw::buffer::SharedBuffer(std::move(owner), span);
+		}
+
+		void pause(Connection& conn)
+		{
+			if (m_flow->paused.exchange(true)) return;
+			conn.pauseReading();
+
+			// Everything may have been dropped before 'paused' was set
+			m_flow->maybeResume();
+		}
+
+		void deliver(Connection& conn, Event event)
+		{
+			if (!m_channel) {
+				if (m_onEvent) m_onEvent(std::move(event));
+				return;
+			}
+			if (m_channel->try_send(std::error_code{}, std::move(event))) return;
+
+			// Full: the packets behind this one wait until the consumer takes it
+			m_flow->sending = true;
+			pause(conn);
+			m_channel->async_send(std::error_code{}, std::move(event), [flow = m_flow](std::error_code)
+				{
+					flow->sending = false;
+					flow->maybeResume();
+				});
+		}
+
+		void end(Connection& conn, std::uint32_t streamId, std::error_code error)
+		{
+			Event event;
+			event.kind = Event::Kind::End;
+			event.streamId = streamId;
+			event.error = error;
+			deliver(conn, std::move(event));
+		}
+
+		void fail(Connection& conn, std::uint32_t streamId, const std::string& reason)
+		{
+			if (m_streams.erase(streamId) == 0) return;
+			sendError(conn, cw::packet::ErrorCode::ChecksumMismatch, reason, streamId);
+			end(conn, streamId, std::make_error_code(std::errc::illegal_byte_sequence));
+		}
+
+		static void sendError(Connection& conn, cw::packet::ErrorCode code, std::string message, std::uint32_t streamId)
+		{
+			cw::packet::Error err;
+			err.code = static_cast<std::uint16_t>(code);
+			err.streamId = streamId;
+			err.message = std::move(message);
+			err.message.resize(std::min(err.message.size(), cw::packet::MAX_STRING_LENGTH));
+			conn.send(err);
+		}
+
+	private:
+		std::function<void(Event)> m_onEvent;
+		std::shared_ptr<Channel> m_channel;
+		std::shared_ptr<Flow> m_flow;
+		std::unordered_map<std::uint32_t, Stream> m_streams;
+	};
+}
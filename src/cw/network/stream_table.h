@@ -0,0 +1,248 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cw::network {
+
+	// Per-stream state of a connection, by stream id: what an
+	// std::unordered_map<std::uint32_t, T> is used as, without a heap node
+	// and a bucket list per entry. The index is a flat open-addressing table
+	// (linear probing, Fibonacci hashing, deletions shift the run back
+	// rather than leave tombstones) of 16-byte slots; entries live in blocks
+	// of nodes recycled through a free list, so opening and closing a
+	// million streams costs no allocation once the peak is reached, and
+	// what is held is set by the streams open at once (the window), not by
+	// how many went through. The index shrinks again as they close.
+	// References to entries stay valid until they are erased; iterators,
+	// until the next insert or erase. Not thread-safe, like the maps it
+	// replaces: used from the connection's strand.
+	template<typename T>
+	class StreamTable
+	{
+	public:
+		using key_type = std::uint32_t;
+		using mapped_type = T;
+		using value_type = std::pair<const std::uint32_t, T>;
+
+		static constexpr std::size_t MIN_CAPACITY = 16;
+		static constexpr std::size_t NODES_PER_BLOCK = 32;
+
+	private:
+		struct Slot
+		{
+			std::uint32_t key = 0;
+			value_type* node = nullptr; // Null: empty
+		};
+
+	public:
+		template<bool Const>
+		class Iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = StreamTable::value_type;
+			using difference_type = std::ptrdiff_t;
+			using reference = std::conditional_t<Const, const value_type&, value_type&>;
+			using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+
+			Iterator() = default;
+			operator Iterator<true>() const { return { m_slot, m_end }; }
+
+			reference operator*() const { return *m_slot->node; }
+			pointer operator->() const { return m_slot->node; }
+			Iterator& operator++()
+			{
+				++m_slot;
+				skipEmpty();
+				return *this;
+			}
+			Iterator operator++(int)
+			{
+				Iterator before = *this;
+				++*this;
+				return before;
+			}
+			bool operator==(const Iterator& other) const { return m_slot == other.m_slot; }
+
+		private:
+			friend class StreamTable;
+			template<bool> friend class Iterator;
+			using SlotPointer = std::conditional_t<Const, const Slot*, Slot*>;
+
+			Iterator(SlotPointer slot, SlotPointer end) : m_slot(slot), m_end(end) {}
+			void skipEmpty()
+			{
+				while (m_slot != m_end && !m_slot->node) ++m_slot;
+			}
+
+			SlotPointer m_slot = nullptr;
+			SlotPointer m_end = nullptr;
+		};
+		using iterator = Iterator<false>;
+		using const_iterator = Iterator<true>;
+
+		StreamTable() : m_slots(MIN_CAPACITY) {}
+		~StreamTable() { destroyAll(); }
+
+		StreamTable(const StreamTable&) = delete;
+		StreamTable& operator=(const StreamTable&) = delete;
+
+		std::size_t size() const { return m_size; }
+		bool empty() const { return m_size == 0; }
+		std::size_t capacity() const { return m_slots.size(); }
+
+		iterator begin()
+		{
+			iterator it{ m_slots.data(), m_slots.data() + m_slots.size() };
+			it.skipEmpty();
+			return it;
+		}
+		iterator end() { return { m_slots.data() + m_slots.size(), m_slots.data() + m_slots.size() }; }
+		const_iterator begin() const { return const_cast<StreamTable*>(this)->begin(); }
+		const_iterator end() const { return const_cast<StreamTable*>(this)->end(); }
+
+		iterator find(std::uint32_t key)
+		{
+			std::size_t at = locate(key);
+			return m_slots[at].node ? iterator{ &m_slots[at], m_slots.data() + m_slots.size() } : end();
+		}
+		const_iterator find(std::uint32_t key) const { return const_cast<StreamTable*>(this)->find(key); }
+		bool contains(std::uint32_t key) const { return m_slots[locate(key)].node != nullptr; }
+		std::size_t count(std::uint32_t key) const { return contains(key) ? 1 : 0; }
+
+		// Constructs the entry of 'key' from 'args' unless there is one
+		template<typename... Args>
+		std::pair<iterator, bool> try_emplace(std::uint32_t key, Args&&... args)
+		{
+			if ((m_size + 1) * 4 > m_slots.size() * 3) rehash(m_slots.size() * 2);
+			std::size_t at = locate(key);
+			Slot& slot = m_slots[at];
+			if (slot.node) return { iterator{ &slot, m_slots.data() + m_slots.size() }, false };
+
+			void* storage = allocate();
+			try {
+				slot.node = ::new (storage) value_type(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+			}
+			catch (...) {
+				release(storage);
+				throw;
+			}
+			slot.key = key;
+			++m_size;
+			return { iterator{ &slot, m_slots.data() + m_slots.size() }, true };
+		}
+
+		template<typename... Args>
+		std::pair<iterator, bool> emplace(std::uint32_t key, Args&&... args) { return try_emplace(key, std::forward<Args>(args)...); }
+
+		T& operator[](std::uint32_t key) { return try_emplace(key).first->second; }
+
+		void erase(const_iterator it) { eraseAt(static_cast<std::size_t>(it.m_slot - m_slots.data())); }
+
+		std::size_t erase(std::uint32_t key)
+		{
+			std::size_t at = locate(key);
+			if (!m_slots[at].node) return 0;
+			eraseAt(at);
+			return 1;
+		}
+
+		// Empties the table and gives its memory back
+		void clear()
+		{
+			destroyAll();
+			m_slots.assign(MIN_CAPACITY, Slot{});
+			m_slots.shrink_to_fit();
+			m_size = 0;
+			m_free.clear();
+			m_free.shrink_to_fit();
+			m_blocks.clear();
+		}
+
+	private:
+		struct alignas(value_type) Storage
+		{
+			std::byte bytes[sizeof(value_type)];
+		};
+
+		void destroyAll()
+		{
+			for (Slot& slot : m_slots) {
+				if (slot.node) slot.node->~value_type();
+			}
+		}
+
+		// Stream ids are mostly consecutive: the multiply spreads them over the high bits
+		std::size_t home(std::uint32_t key) const
+		{
+			return static_cast<std::size_t>((key * 0x9E3779B9u) >> (32 - std::countr_zero(m_slots.size())));
+		}
+
+		// The slot holding 'key', or the empty one ending its probe
+		std::size_t locate(std::uint32_t key) const
+		{
+			std::size_t mask = m_slots.size() - 1;
+			std::size_t at = home(key);
+			while (m_slots[at].node && m_slots[at].key != key) at = (at + 1) & mask;
+			return at;
+		}
+
+		void eraseAt(std::size_t at)
+		{
+			m_slots[at].node->~value_type();
+			release(m_slots[at].node);
+			--m_size;
+
+			// Entries further along the run move up to fill the gap, unless that
+			// would take them before their home slot
+			std::size_t mask = m_slots.size() - 1;
+			std::size_t gap = at;
+			for (std::size_t next = (gap + 1) & mask; m_slots[next].node; next = (next + 1) & mask) {
+				std::size_t wanted = home(m_slots[next].key);
+				if (((next - wanted) & mask) >= ((next - gap) & mask)) {
+					m_slots[gap] = m_slots[next];
+					gap = next;
+				}
+			}
+			m_slots[gap] = Slot{};
+
+			if (m_slots.size() > MIN_CAPACITY && m_size * 8 < m_slots.size()) rehash(m_slots.size() / 2);
+		}
+
+		void rehash(std::size_t capacity)
+		{
+			std::vector<Slot> old(capacity);
+			old.swap(m_slots);
+			for (const Slot& slot : old) {
+				if (slot.node) m_slots[locate(slot.key)] = slot;
+			}
+		}
+
+		void* allocate()
+		{
+			if (m_free.empty()) {
+				auto block = std::make_unique<Storage[]>(NODES_PER_BLOCK);
+				for (std::size_t i = NODES_PER_BLOCK; i-- > 0;) m_free.push_back(&block[i]);
+				m_blocks.push_back(std::move(block));
+			}
+			void* storage = m_free.back();
+			m_free.pop_back();
+			return storage;
+		}
+
+		void release(void* storage) { m_free.push_back(static_cast<Storage*>(storage)); }
+
+		std::vector<Slot> m_slots; // Power-of-two sized
+		std::size_t m_size = 0;
+		std::vector<std::unique_ptr<Storage[]>> m_blocks; // As many as the most entries held at once need
+		std::vector<Storage*> m_free;
+	};
+}
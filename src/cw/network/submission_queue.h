@@ -0,0 +1,172 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+
+#include "cw/buffer/buffer_pool.h"
+
+namespace cw::network {
+
+	// Lock-free multi-producer, single-consumer queue, in blocks of
+	// BLOCK_SLOTS elements (the scheme of crossbeam's SegQueue). A producer
+	// claims its slots with one compare-exchange on the tail index and marks
+	// each ready once the element is in; no lock, no wakeup, and one block from
+	// cw::buffer::BufferPool per BLOCK_SLOTS elements instead of a node per
+	// element. The consumer drains ready slots in claim order (per producer:
+	// push order) and stops at the first slot still being written, so
+	// drain() may stop short of elements pushed after it: callers that
+	// schedule the consumer after pushing (see Connection::send) never lose
+	// one that way.
+	template<typename T>
+	class SubmissionQueue
+	{
+	public:
+		static constexpr std::size_t BLOCK_SLOTS = 63;
+
+		SubmissionQueue() : m_tailIndex(0), m_tailBlock(newBlock()), m_headBlock(m_tailBlock.load(std::memory_order_relaxed)) {}
+
+		~SubmissionQueue()
+		{
+			drain([](T&&) {});
+			while (m_headBlock) {
+				Block* next = m_headBlock->next.load(std::memory_order_relaxed);
+				deleteBlock(m_headBlock);
+				m_headBlock = next;
+			}
+		}
+
+		SubmissionQueue(const SubmissionQueue&) = delete;
+		SubmissionQueue& operator=(const SubmissionQueue&) = delete;
+
+		// Any thread
+		void push(T value) { pushRange(std::make_move_iterator(&value), 1); }
+
+		// Any thread: 'count' elements from 'first', in order. Claims as many
+		// slots as are left in the tail block with each compare-exchange: one
+		// for a batch that fits, which then sits in the queue as a single run.
+		template<typename It>
+		void pushRange(It first, std::size_t count)
+		{
+			Block* next = nullptr; // Made ahead by whoever is about to take a block's last slot
+
+			while (count > 0) {
+				std::uint64_t tail = m_tailIndex.load(std::memory_order_acquire);
+				Block* block = m_tailBlock.load(std::memory_order_acquire);
+
+				for (;;) {
+					std::size_t offset = static_cast<std::size_t>(tail % LAP);
+
+					// Another producer took the last slot and is installing the next block
+					if (offset == BLOCK_SLOTS) {
+						std::this_thread::yield();
+						tail = m_tailIndex.load(std::memory_order_acquire);
+						block = m_tailBlock.load(std::memory_order_acquire);
+						continue;
+					}
+
+					std::size_t take = std::min(count, BLOCK_SLOTS - offset);
+					bool last = offset + take == BLOCK_SLOTS;
+					if (last && next == nullptr) next = newBlock();
+
+					if (!m_tailIndex.compare_exchange_weak(tail, tail + take, std::memory_order_seq_cst, std::memory_order_acquire)) {
+						block = m_tailBlock.load(std::memory_order_acquire);
+						continue;
+					}
+
+					if (last) {
+						// Linked before these slots are marked ready, so the
+						// consumer finds it when it gets to the end of 'block'
+						m_tailBlock.store(next, std::memory_order_release);
+						m_tailIndex.store(tail + take + 1, std::memory_order_release);
+						block->next.store(next, std::memory_order_release);
+						next = nullptr;
+					}
+
+					for (std::size_t i = 0; i < take; ++i, ++first) {
+						Slot& slot = block->slots[offset + i];
+						::new (static_cast<void*>(slot.storage)) T(std::move(*first));
+						slot.ready.store(true, std::memory_order_release);
+					}
+					count -= take;
+					break;
+				}
+			}
+
+			if (next) deleteBlock(next);
+		}
+
+		// Consumer only: hands up to 'limit' elements to 'consume' and
+		// returns how many it took
+		template<typename F>
+		std::size_t drain(F&& consume, std::size_t limit = SIZE_MAX)
+		{
+			std::size_t taken = 0;
+			while (taken < limit) {
+				Slot& slot = m_headBlock->slots[m_headOffset];
+				if (!slot.ready.load(std::memory_order_acquire)) break;
+
+				T* value = std::launder(reinterpret_cast<T*>(slot.storage));
+				consume(std::move(*value));
+				value->~T();
+				++taken;
+
+				if (++m_headOffset == BLOCK_SLOTS) {
+					// Every slot was written, so the producers are done with it
+					// and the one that took the last slot linked the next block
+					Block* next = m_headBlock->next.load(std::memory_order_acquire);
+					deleteBlock(m_headBlock);
+					m_headBlock = next;
+					m_headOffset = 0;
+				}
+			}
+			return taken;
+		}
+
+		// Consumer only: the next slot holds nothing to take yet
+		bool empty() const { return !m_headBlock->slots[m_headOffset].ready.load(std::memory_order_acquire); }
+
+	private:
+		// Tail indexes run through BLOCK_SLOTS + 1 values per block: the
+		// extra one marks the hand-over to the next block
+		static constexpr std::uint64_t LAP = BLOCK_SLOTS + 1;
+
+		struct Slot
+		{
+			std::atomic<bool> ready = false;
+			alignas(T) unsigned char storage[sizeof(T)];
+		};
+
+		struct Block
+		{
+			std::atomic<Block*> next = nullptr;
+			Slot slots[BLOCK_SLOTS];
+		};
+
+		using Allocator = cw::buffer::PoolAllocator<Block>;
+
+		static Block* newBlock()
+		{
+			return ::new (static_cast<void*>(Allocator{}.allocate(1))) Block();
+		}
+
+		static void deleteBlock(Block* block) noexcept
+		{
+			block->~Block();
+			Allocator{}.deallocate(block, 1);
+		}
+
+		// Padded apart rather than alignas(64): the queue lives inside pooled
+		// objects (Connection), whose blocks are only new-aligned
+		std::atomic<std::uint64_t> m_tailIndex; // Producers: next slot to claim
+		std::atomic<Block*> m_tailBlock;        // Producers: the block it is in
+		char m_padding[64 - sizeof(std::atomic<std::uint64_t>) - sizeof(std::atomic<Block*>)];
+		Block* m_headBlock;                     // Consumer
+		std::size_t m_headOffset = 0;
+	};
+}
@@ -0,0 +1,435 @@
+#pragma once
+#include <asio.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cw/endian.h"
+#include "cw/file/manifest.h"
+#include "cw/log/logger.h"
+
+namespace cw::network {
+
+	// Which pieces of a file a swarm member holds, one bit each, lowest
+	// piece in the lowest bit of the first byte
+	class PieceMap
+	{
+	public:
+		PieceMap() = default;
+		explicit PieceMap(std::uint32_t pieces) : m_pieces(pieces), m_bits((pieces + 7) / 8) {}
+
+		std::uint32_t size() const { return m_pieces; }
+		std::uint32_t count() const { return m_count; }
+		bool complete() const { return m_count == m_pieces; }
+		bool has(std::uint32_t piece) const { return piece < m_pieces && (m_bits[piece / 8] >> (piece % 8) & 1) != 0; }
+
+		void set(std::uint32_t piece)
+		{
+			if (piece >= m_pieces || has(piece)) return;
+			m_bits[piece / 8] |= static_cast<std::uint8_t>(1u << (piece % 8));
+			++m_count;
+		}
+
+		const std::vector<std::uint8_t>& bytes() const { return m_bits; }
+
+		// Nullopt if 'size' bytes cannot be the map of 'pieces' pieces
+		static std::optional<PieceMap> fromBytes(std::uint32_t pieces, const std::uint8_t* data, std::size_t size)
+		{
+			PieceMap map(pieces);
+			if (size != map.m_bits.size()) return std::nullopt;
+			for (std::uint32_t piece = 0; piece < pieces; ++piece) {
+				if (data[piece / 8] >> (piece % 8) & 1) map.set(piece);
+			}
+			return map;
+		}
+
+	private:
+		std::uint32_t m_pieces = 0;
+		std::uint32_t m_count = 0;
+		std::vector<std::uint8_t> m_bits;
+	};
+
+	// What a swarm member tells the tracker each time it wants a piece (and
+	// every few seconds while it only serves them)
+	struct SwarmQuery
+	{
+		static constexpr std::uint32_t NO_PIECE = UINT32_MAX;
+
+		std::uint32_t nonce = 0;             // Echoed in the answer
+		std::string name;                    // The file, as the origin serves it
+		std::string address;                 // host:port the member serves its pieces on
+		PieceMap have;                       // Empty until it knows the piece count
+		std::uint32_t failedPiece = NO_PIECE; // A piece that just failed to arrive...
+		std::string failedSource;            // ...and who failed to send it
+	};
+
+	// The tracker's answer: the piece to fetch next and who from
+	struct SwarmAssignment
+	{
+		enum class Status : std::uint8_t
+		{
+			Fetch,   // 'piece' from 'source'
+			Wait,    // Every missing piece is on its way or its holders are full: ask again shortly
+			Done,    // The member has every piece
+			Unknown, // The origin has no such file
+		};
+
+		std::uint32_t nonce = 0;
+		Status status = Status::Unknown;
+		std::uint64_t fileSize = 0;
+		std::uint32_t pieceSize = 0;
+		std::uint32_t piece = 0;
+		bool fromOrigin = false; // The origin serves 'name' whole; a member, each piece as a file
+		std::string source;      // host:port
+	};
+
+	namespace detail {
+
+		inline constexpr std::uint32_t SWARM_MAGIC = 0x43575357; // "CWSW"
+		inline constexpr std::size_t SWARM_MAX_DATAGRAM = 65507;
+
+		inline void putString(std::vector<std::uint8_t>& out, const std::string& text)
+		{
+			cw::binary::writeBigEndian(out, static_cast<std::uint16_t>(text.size()));
+			out.insert(out.end(), text.begin(), text.end());
+		}
+
+		// Bounds-checked reads from a datagram; any short read fails the whole
+		struct SwarmReader
+		{
+			const std::uint8_t* data;
+			std::size_t size;
+			std::size_t at = 0;
+			bool ok = true;
+
+			template<cw::binary::Integer T>
+			T read()
+			{
+				if (!ok || size - at < sizeof(T)) {
+					ok = false;
+					return 0;
+				}
+				T value = cw::binary::readBigEndian<T>(data + at);
+				at += sizeof(T);
+				return value;
+			}
+
+			std::string string()
+			{
+				std::uint16_t length = read<std::uint16_t>();
+				if (!ok || size - at < length) {
+					ok = false;
+					return {};
+				}
+				std::string text(reinterpret_cast<const char*>(data + at), length);
+				at += length;
+				return text;
+			}
+		};
+	}
+
+	// Query: magic, nonce, name, address, failed piece, failed source, piece
+	// count, then the piece map; strings as a u16 length and bytes; big-endian
+	inline std::vector<std::uint8_t> encode(const SwarmQuery& query)
+	{
+		std::vector<std::uint8_t> out;
+		cw::binary::writeBigEndian(out, detail::SWARM_MAGIC);
+		cw::binary::writeBigEndian(out, query.nonce);
+		detail::putString(out, query.name);
+		detail::putString(out, query.address);
+		cw::binary::writeBigEndian(out, query.failedPiece);
+		detail::putString(out, query.failedSource);
+		cw::binary::writeBigEndian(out, query.have.size());
+		out.insert(out.end(), query.have.bytes().begin(), query.have.bytes().end());
+		return out;
+	}
+
+	inline std::optional<SwarmQuery> decodeQuery(const std::uint8_t* data, std::size_t size)
+	{
+		detail::SwarmReader in{ data, size };
+		if (in.read<std::uint32_t>() != detail::SWARM_MAGIC) return std::nullopt;
+		SwarmQuery query;
+		query.nonce = in.read<std::uint32_t>();
+		query.name = in.string();
+		query.address = in.string();
+		query.failedPiece = in.read<std::uint32_t>();
+		query.failedSource = in.string();
+		std::uint32_t pieces = in.read<std::uint32_t>();
+		if (!in.ok || query.name.empty() || query.address.empty()) return std::nullopt;
+		auto have = PieceMap::fromBytes(pieces, data + in.at, size - in.at);
+		if (!have) return std::nullopt;
+		query.have = std::move(*have);
+		return query;
+	}
+
+	// Answer: magic, nonce, status, file size, piece size, piece, from-origin, source
+	inline std::vector<std::uint8_t> encode(const SwarmAssignment& answer)
+	{
+		std::vector<std::uint8_t> out;
+		cw::binary::writeBigEndian(out, detail::SWARM_MAGIC);
+		cw::binary::writeBigEndian(out, answer.nonce);
+		cw::binary::writeBigEndian(out, static_cast<std::uint8_t>(answer.status));
+		cw::binary::writeBigEndian(out, answer.fileSize);
+		cw::binary::writeBigEndian(out, answer.pieceSize);
+		cw::binary::writeBigEndian(out, answer.piece);
+		cw::binary::writeBigEndian(out, static_cast<std::uint8_t>(answer.fromOrigin ? 1 : 0));
+		detail::putString(out, answer.source);
+		return out;
+	}
+
+	inline std::optional<SwarmAssignment> decodeAssignment(const std::uint8_t* data, std::size_t size)
+	{
+		detail::SwarmReader in{ data, size };
+		if (in.read<std::uint32_t>() != detail::SWARM_MAGIC) return std::nullopt;
+		SwarmAssignment answer;
+		answer.nonce = in.read<std::uint32_t>();
+		std::uint8_t status = in.read<std::uint8_t>();
+		answer.fileSize = in.read<std::uint64_t>();
+		answer.pieceSize = in.read<std::uint32_t>();
+		answer.piece = in.read<std::uint32_t>();
+		answer.fromOrigin = in.read<std::uint8_t>() != 0;
+		answer.source = in.string();
+		if (!in.ok || status > static_cast<std::uint8_t>(SwarmAssignment::Status::Unknown)) return std::nullopt;
+		answer.status = static_cast<SwarmAssignment::Status>(status);
+		return answer;
+	}
+
+	// Coordinates a swarm from the origin server, over UDP: members fetching
+	// a file the origin serves ask it, piece by piece, what to fetch next and
+	// from whom, sending the map of the pieces they hold. Pieces go rarest
+	// first, each from the holder with the fewest uploads in flight (a member
+	// before the origin), at most 'uploadSlots' at once per member and
+	// 'originSlots' from the origin, so after the first copies the members
+	// feed each other and the time to reach N members grows with log N, not
+	// N. A member silent for 'memberTimeout', or named by another as having
+	// failed to send a piece, is forgotten. Datagrams are not authenticated:
+	// for the fleet's private network.
+	class SwarmTracker : public std::enable_shared_from_this<SwarmTracker>
+	{
+	public:
+		// The size of a file the origin serves, or nullopt if it serves none such
+		using Resolver = std::function<std::optional<std::uint64_t>(const std::string& name)>;
+
+		struct Options
+		{
+			std::uint32_t pieceSize = 4 * 1024 * 1024; // Grown for files of more than MAX_PIECES
+			std::size_t uploadSlots = 4;
+			std::size_t originSlots = 8;
+			std::chrono::steady_clock::duration assignmentTimeout = std::chrono::seconds(60);
+			std::chrono::steady_clock::duration memberTimeout = std::chrono::seconds(30);
+		};
+
+		struct Stats
+		{
+			std::uint64_t fromOrigin = 0; // Pieces assigned from the origin
+			std::uint64_t fromPeers = 0;  // ...and from members
+			std::size_t members = 0;
+		};
+
+		// Keeps a piece map within a datagram
+		static constexpr std::uint32_t MAX_PIECES = 8 * 60000;
+
+		// Tracks on UDP 'port' (0: any) the files 'resolve' knows, served by
+		// the origin at 'origin' (host:port)
+		static std::shared_ptr<SwarmTracker> start(asio::io_context& io, std::uint16_t port, std::string origin, Resolver resolve, Options options)
+		{
+			auto tracker = std::shared_ptr<SwarmTracker>(new SwarmTracker(io, port, std::move(origin), std::move(resolve), options));
+			CW_LOG_INFO("[Swarm] Tracking on UDP port ", tracker->port(), " for origin ", tracker->m_origin);
+			tracker->receive();
+			return tracker;
+		}
+
+		static std::shared_ptr<SwarmTracker> start(asio::io_context& io, std::uint16_t port, std::string origin, Resolver resolve)
+		{
+			return start(io, port, std::move(origin), std::move(resolve), Options{});
+		}
+
+		std::uint16_t port() const { return m_socket.local_endpoint().port(); }
+
+		void stop()
+		{
+			asio::post(m_socket.get_executor(), [self = shared_from_this()]()
+				{
+					std::error_code ignored;
+					self->m_socket.close(ignored);
+				});
+		}
+
+		Stats stats() const
+		{
+			std::lock_guard lock(m_mutex);
+			Stats stats = m_stats;
+			for (const auto& [name, swarm] : m_swarms) stats.members += swarm.members.size();
+			return stats;
+		}
+
+		// The answer to 'query'; what each datagram received is given to. Thread-safe.
+		SwarmAssignment answer(const SwarmQuery& query)
+		{
+			auto now = std::chrono::steady_clock::now();
+			SwarmAssignment answer;
+			answer.nonce = query.nonce;
+
+			std::lock_guard lock(m_mutex);
+			auto it = m_swarms.find(query.name);
+			if (it == m_swarms.end()) {
+				auto size = m_resolve(query.name);
+				if (!size) return answer;
+				it = m_swarms.emplace(query.name, Swarm(*size, m_options.pieceSize)).first;
+			}
+			Swarm& swarm = it->second;
+			answer.fileSize = swarm.fileSize;
+			answer.pieceSize = swarm.pieceSize;
+
+			if (!query.failedSource.empty() && query.failedSource != m_origin) {
+				CW_LOG_WARN("[Swarm] ", query.failedSource, " failed to send a piece of ", query.name, ", dropped");
+				swarm.members.erase(query.failedSource);
+			}
+
+			Member& member = swarm.members[query.address];
+			member.heard = now;
+			if (query.have.size() == swarm.pieces) member.have = query.have;
+			else if (member.have.size() != swarm.pieces) member.have = PieceMap(swarm.pieces);
+			std::erase_if(member.inFlight, [&](const auto& entry)
+				{
+					return member.have.has(entry.first) || entry.first == query.failedPiece || now > entry.second.deadline;
+				});
+			std::erase_if(swarm.members, [&](const auto& entry) { return now - entry.second.heard > m_options.memberTimeout; });
+
+			if (member.have.complete()) {
+				answer.status = SwarmAssignment::Status::Done;
+				return answer;
+			}
+			assign(swarm, query.address, now, answer);
+			return answer;
+		}
+
+	private:
+		struct Fetch
+		{
+			std::string source;
+			std::chrono::steady_clock::time_point deadline;
+		};
+
+		struct Member
+		{
+			PieceMap have;
+			std::map<std::uint32_t, Fetch> inFlight; // By piece
+			std::chrono::steady_clock::time_point heard;
+		};
+
+		struct Swarm
+		{
+			Swarm(std::uint64_t size, std::uint32_t pieceSize)
+				: fileSize(size),
+				pieceSize(std::max<std::uint32_t>(pieceSize, static_cast<std::uint32_t>(std::min<std::uint64_t>(UINT32_MAX, (size + MAX_PIECES - 1) / MAX_PIECES)))),
+				pieces(static_cast<std::uint32_t>((size + this->pieceSize - 1) / this->pieceSize))
+			{
+			}
+
+			std::uint64_t fileSize;
+			std::uint32_t pieceSize;
+			std::uint32_t pieces;
+			std::map<std::string, Member> members; // By address
+		};
+
+		SwarmTracker(asio::io_context& io, std::uint16_t port, std::string origin, Resolver resolve, Options options)
+			: m_socket(io, asio::ip::udp::endpoint(asio::ip::udp::v4(), port)),
+			m_origin(std::move(origin)),
+			m_resolve(std::move(resolve)),
+			m_options(options)
+		{
+		}
+
+		// The rarest piece 'address' lacks and is not fetching, from the least
+		// busy holder with a free slot; the scan starts at a point of its own
+		// so members holding equally rare pieces pick different ones
+		void assign(Swarm& swarm, const std::string& address, std::chrono::steady_clock::time_point now, SwarmAssignment& answer)
+		{
+			std::map<std::string, std::size_t> uploads;
+			std::vector<std::uint32_t> holders(swarm.pieces, 0);
+			for (const auto& [peer, member] : swarm.members) {
+				for (const auto& [piece, fetch] : member.inFlight) ++uploads[fetch.source];
+				for (std::uint32_t piece = 0; piece < swarm.pieces; ++piece) holders[piece] += member.have.has(piece) ? 1 : 0;
+			}
+
+			Member& self = swarm.members[address];
+			std::uint32_t start = static_cast<std::uint32_t>(hashOf(address) % std::max<std::uint32_t>(1, swarm.pieces));
+			std::optional<std::uint32_t> best;
+			std::string bestSource;
+			for (std::uint32_t i = 0; i < swarm.pieces; ++i) {
+				std::uint32_t piece = (start + i) % swarm.pieces;
+				if (self.have.has(piece) || self.inFlight.contains(piece)) continue;
+				if (best && holders[piece] >= holders[*best]) continue;
+
+				// A member with a free slot, the least busy; else the origin
+				std::string source;
+				std::size_t least = m_options.uploadSlots;
+				for (const auto& [peer, member] : swarm.members) {
+					if (peer == address || !member.have.has(piece) || uploads[peer] >= least) continue;
+					least = uploads[peer];
+					source = peer;
+				}
+				if (source.empty() && uploads[m_origin] < m_options.originSlots) source = m_origin;
+				if (source.empty()) continue;
+				best = piece;
+				bestSource = std::move(source);
+			}
+
+			if (!best) {
+				answer.status = SwarmAssignment::Status::Wait;
+				return;
+			}
+			answer.status = SwarmAssignment::Status::Fetch;
+			answer.piece = *best;
+			answer.fromOrigin = bestSource == m_origin;
+			answer.source = bestSource;
+			self.inFlight[*best] = { bestSource, now + m_options.assignmentTimeout };
+			++(answer.fromOrigin ? m_stats.fromOrigin : m_stats.fromPeers);
+		}
+
+		static std::uint64_t hashOf(const std::string& text)
+		{
+			cw::file::Fnv1a hash;
+			hash.update(reinterpret_cast<const std::uint8_t*>(text.data()), text.size());
+			return hash.value();
+		}
+
+		void receive()
+		{
+			m_socket.async_receive_from(asio::buffer(m_receiveBuffer), m_sender, [weak = weak_from_this()](std::error_code ec, std::size_t length)
+				{
+					auto self = weak.lock();
+					if (!self || ec == asio::error::operation_aborted || !self->m_socket.is_open()) return;
+					if (!ec) {
+						if (auto query = decodeQuery(self->m_receiveBuffer.data(), length)) {
+							auto reply = encode(self->answer(*query));
+							std::error_code ignored;
+							self->m_socket.send_to(asio::buffer(reply), self->m_sender, 0, ignored);
+						}
+					}
+					self->receive();
+				});
+		}
+
+		asio::ip::udp::socket m_socket;
+		std::string m_origin;
+		Resolver m_resolve;
+		Options m_options;
+		std::array<std::uint8_t, detail::SWARM_MAX_DATAGRAM> m_receiveBuffer{};
+		asio::ip::udp::endpoint m_sender;
+
+		mutable std::mutex m_mutex;
+		std::map<std::string, Swarm> m_swarms; // By file name
+		Stats m_stats;
+	};
+}
@@ -0,0 +1,249 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+
+namespace cw::network {
+
+	class TimerWheel;
+
+	// A deadline kept on its io_context's TimerWheel: arming, re-arming and
+	// cancelling cost O(1) however many deadlines there are, where a
+	// steady_timer each keeps them all in one heap. The handler is posted to
+	// 'executor' once the time has passed, to the wheel's resolution. One
+	// already posted when the deadline is re-armed or cancelled still runs.
+	class Timeout
+	{
+	public:
+		Timeout(TimerWheel& wheel, asio::any_io_executor executor) : m_wheel(&wheel), m_executor(std::move(executor)) {}
+		~Timeout() { cancel(); }
+
+		Timeout(const Timeout&) = delete;
+		Timeout& operator=(const Timeout&) = delete;
+
+		// Replaces the deadline and handler armed before, if any
+		void expiresAfter(std::chrono::steady_clock::duration after, std::function<void()> handler);
+		void cancel();
+		bool armed() const;
+
+	private:
+		friend class TimerWheel;
+
+		TimerWheel* m_wheel;
+		asio::any_io_executor m_executor;
+		std::function<void()> m_handler;
+
+		// Place on the wheel, guarded by its mutex
+		Timeout** m_slot = nullptr; // Head of the list it is on; null when not armed
+		Timeout* m_prev = nullptr;
+		Timeout* m_next = nullptr;
+		std::uint64_t m_due = 0;    // Tick it expires at
+	};
+
+	// Hierarchical timing wheel, one per io_context (of(io)): LEVELS rings of
+	// SLOTS lists, a slot of level l spanning SLOTS^l ticks. A deadline goes
+	// into the slot of the lowest level that reaches it and moves down a
+	// level each time that slot comes round, so every deadline is touched at
+	// most LEVELS times. One steady_timer ticks while any deadline is armed;
+	// deadlines further out than the top level reaches wait there and are
+	// placed again.
+	class TimerWheel : public asio::io_context::service
+	{
+	public:
+		inline static asio::io_context::id id;
+
+		static constexpr std::chrono::milliseconds DEFAULT_RESOLUTION{ 10 };
+		static constexpr std::size_t LEVELS = 4;
+		static constexpr std::size_t SLOT_BITS = 6;
+		static constexpr std::size_t SLOTS = std::size_t{ 1 } << SLOT_BITS;
+
+		explicit TimerWheel(asio::io_context& io) :
+			asio::io_context::service(io),
+			m_tick(io),
+			m_start(std::chrono::steady_clock::now())
+		{
+			for (auto& level : m_slots) level.fill(nullptr);
+		}
+
+		static TimerWheel& of(asio::io_context& io) { return asio::use_service<TimerWheel>(io); }
+
+		// Length of a tick: deadlines fire up to this late. Takes effect for
+		// deadlines armed after the wheel has emptied.
+		void setResolution(std::chrono::steady_clock::duration resolution)
+		{
+			std::lock_guard lock(m_mutex);
+			m_nextResolution = std::max<std::chrono::steady_clock::duration>(resolution, std::chrono::milliseconds(1));
+		}
+
+		// Deadlines armed
+		std::size_t size() const
+		{
+			std::lock_guard lock(m_mutex);
+			return m_size;
+		}
+
+	private:
+		friend class Timeout;
+
+		using Expired = std::vector<std::pair<asio::any_io_executor, std::function<void()>>>;
+
+		void shutdown() override
+		{
+			std::lock_guard lock(m_mutex);
+			m_tick.cancel();
+			for (auto& level : m_slots) {
+				for (auto& slot : level) {
+					while (slot) {
+						Timeout* timeout = slot;
+						unlink(*timeout);
+						timeout->m_handler = nullptr;
+					}
+				}
+			}
+		}
+
+		void arm(Timeout& timeout, std::chrono::steady_clock::duration after, std::function<void()> handler)
+		{
+			std::lock_guard lock(m_mutex);
+			if (timeout.m_slot) unlink(timeout);
+
+			// Idle: nothing to process between then and now
+			if (m_size == 0) {
+				m_resolution = m_nextResolution;
+				m_start = std::chrono::steady_clock::now();
+				m_now = 0;
+			}
+
+			auto at = std::chrono::steady_clock::now() + std::max<std::chrono::steady_clock::duration>(after, {}) - m_start;
+			std::uint64_t due = static_cast<std::uint64_t>((at + m_resolution - std::chrono::steady_clock::duration(1)) / m_resolution);
+			timeout.m_due = std::max(due, m_now + 1);
+			timeout.m_handler = std::move(handler);
+			link(timeout);
+			scheduleTick();
+		}
+
+		void disarm(Timeout& timeout)
+		{
+			std::lock_guard lock(m_mutex);
+			if (timeout.m_slot) unlink(timeout);
+			timeout.m_handler = nullptr;
+		}
+
+		bool isArmed(const Timeout& timeout) const
+		{
+			std::lock_guard lock(m_mutex);
+			return timeout.m_slot != nullptr;
+		}
+
+		// Into the slot that comes round at or before its tick (m_due > m_now)
+		void link(Timeout& timeout)
+		{
+			std::uint64_t delta = timeout.m_due - m_now;
+			std::size_t level = 0;
+			while (level + 1 < LEVELS && delta >= (std::uint64_t{ 1 } << (SLOT_BITS * (level + 1)))) ++level;
+
+			// Beyond the top level: parked one turn out, placed again from there
+			std::uint64_t placed = std::min(timeout.m_due, m_now + (std::uint64_t{ 1 } << (SLOT_BITS * LEVELS)) - 1);
+			Timeout*& head = m_slots[level][(placed >> (SLOT_BITS * level)) & (SLOTS - 1)];
+
+			timeout.m_slot = &head;
+			timeout.m_prev = nullptr;
+			timeout.m_next = head;
+			if (head) head->m_prev = &timeout;
+			head = &timeout;
+			++m_size;
+		}
+
+		void unlink(Timeout& timeout)
+		{
+			if (timeout.m_prev) timeout.m_prev->m_next = timeout.m_next;
+			else *timeout.m_slot = timeout.m_next;
+			if (timeout.m_next) timeout.m_next->m_prev = timeout.m_prev;
+			timeout.m_slot = nullptr;
+			timeout.m_prev = timeout.m_next = nullptr;
+			--m_size;
+		}
+
+		// Takes the list of a slot off the wheel
+		Timeout* take(Timeout*& head)
+		{
+			Timeout* list = std::exchange(head, nullptr);
+			for (Timeout* timeout = list; timeout; timeout = timeout->m_next) {
+				timeout->m_slot = nullptr;
+				--m_size;
+			}
+			return list;
+		}
+
+		// One tick on: slots of the upper levels that come round move down,
+		// then the deadlines of the tick's slot expire
+		void advance(Expired& expired)
+		{
+			++m_now;
+			for (std::size_t level = 1; level < LEVELS; ++level) {
+				if ((m_now & ((std::uint64_t{ 1 } << (SLOT_BITS * level)) - 1)) != 0) break;
+				Timeout* list = take(m_slots[level][(m_now >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+				while (list) link(*std::exchange(list, list->m_next));
+			}
+
+			Timeout* list = take(m_slots[0][m_now & (SLOTS - 1)]);
+			while (list) {
+				Timeout* timeout = std::exchange(list, list->m_next);
+				if (timeout->m_due > m_now) link(*timeout);
+				else expired.emplace_back(timeout->m_executor, std::move(timeout->m_handler));
+			}
+		}
+
+		void scheduleTick()
+		{
+			if (m_ticking || m_size == 0) return;
+			m_ticking = true;
+			m_tick.expires_at(m_start + m_resolution * static_cast<std::int64_t>(m_now + 1));
+			m_tick.async_wait([this](std::error_code ec)
+				{
+					if (!ec) onTick();
+				});
+		}
+
+		void onTick()
+		{
+			Expired expired;
+			{
+				std::lock_guard lock(m_mutex);
+				m_ticking = false;
+				auto elapsed = static_cast<std::uint64_t>((std::chrono::steady_clock::now() - m_start) / m_resolution);
+				while (m_now < elapsed && m_size > 0) advance(expired);
+				if (m_size == 0) m_now = std::max(m_now, elapsed);
+				scheduleTick();
+			}
+			for (auto& [executor, handler] : expired) asio::post(executor, std::move(handler));
+		}
+
+		mutable std::mutex m_mutex;
+		std::array<std::array<Timeout*, SLOTS>, LEVELS> m_slots;
+		asio::steady_timer m_tick;
+		bool m_ticking = false;
+		std::chrono::steady_clock::time_point m_start; // Tick 0
+		std::chrono::steady_clock::duration m_resolution = DEFAULT_RESOLUTION;
+		std::chrono::steady_clock::duration m_nextResolution = DEFAULT_RESOLUTION;
+		std::uint64_t m_now = 0; // Ticks processed
+		std::size_t m_size = 0;
+	};
+
+	inline void Timeout::expiresAfter(std::chrono::steady_clock::duration after, std::function<void()> handler)
+	{
+		m_wheel->arm(*this, after, std::move(handler));
+	}
+
+	inline void Timeout::cancel() { m_wheel->disarm(*this); }
+
+	inline bool Timeout::armed() const { return m_wheel->isArmed(*this); }
+}
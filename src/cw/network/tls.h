@@ -0,0 +1,152 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+#if defined(CW_HAS_TLS)
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+#include <memory>
+#include <system_error>
+
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "cw/log/logger.h"
+#endif
+
+namespace cw::network {
+
+	// Encrypted transport without a user-space record layer: OpenSSL runs the
+	// handshake on the socket itself, then hands the session keys to the kernel
+	// (kTLS). From there on the socket is read and written exactly as a plain
+	// one, so Connection is unchanged, gathered writes and sendfile included,
+	// and the crypto runs in the kernel or on a NIC that offloads it.
+	//
+	// There is deliberately no user-space fallback: Connection writes to the file
+	// descriptor directly, so without kTLS a TLS connection is refused rather
+	// than silently sent in clear. Requires Linux with the 'tls' module loaded
+	// and an OpenSSL built with kTLS support.
+	struct TlsOptions
+	{
+		std::string certificateFile;  // PEM chain: the server's, or the client's for mutual TLS
+		std::string privateKeyFile;
+		std::string caFile;           // Verify the peer against these roots; empty = no verification
+		std::string serverName;       // Client: SNI and the name the certificate must carry
+		bool enabled = false;
+	};
+
+	// Command-line form shared by the Server and Client mains; any of them
+	// turns TLS on. Returns false when 'arg' is not a TLS option.
+	//   --tls --tls-cert=PEM --tls-key=PEM --tls-ca=PEM --tls-name=HOST
+	inline bool parseTlsOption(std::string_view arg, TlsOptions& options)
+	{
+		auto value = [arg]() { return std::string(arg.substr(arg.find('=') + 1)); };
+
+		if (arg == "--tls") {}
+		else if (arg.starts_with("--tls-cert=")) options.certificateFile = value();
+		else if (arg.starts_with("--tls-key=")) options.privateKeyFile = value();
+		else if (arg.starts_with("--tls-ca=")) options.caFile = value();
+		else if (arg.starts_with("--tls-name=")) options.serverName = value();
+		else return false;
+
+		options.enabled = true;
+		return true;
+	}
+
+#if defined(CW_HAS_TLS)
+
+	// TLS 1.2 with the AES-GCM suites kTLS implements. TLS 1.3 too where the
+	// OpenSSL can hand a 1.3 receive key to the kernel (3.2 and later).
+	inline std::shared_ptr<asio::ssl::context> makeTlsContext(bool server, const TlsOptions& options)
+	{
+		auto context = std::make_shared<asio::ssl::context>(server ? asio::ssl::context::tls_server : asio::ssl::context::tls_client);
+		SSL_CTX* native = context->native_handle();
+
+		SSL_CTX_set_min_proto_version(native, TLS1_2_VERSION);
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+		SSL_CTX_set_max_proto_version(native, TLS1_2_VERSION);
+#endif
+		SSL_CTX_set_cipher_list(native, "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+			"ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384");
+		SSL_CTX_set_ciphersuites(native, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384");
+
+		// Nothing may arrive after the handshake that is not application data:
+		// the kernel hands control records to plain reads as errors
+		SSL_CTX_set_options(native, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+		SSL_CTX_set_num_tickets(native, 0);
+
+		if (!options.certificateFile.empty()) context->use_certificate_chain_file(options.certificateFile);
+		if (!options.privateKeyFile.empty()) context->use_private_key_file(options.privateKeyFile, asio::ssl::context::pem);
+
+		if (!options.caFile.empty()) {
+			context->load_verify_file(options.caFile);
+			// A server with roots configured requires client certificates (mutual TLS)
+			context->set_verify_mode(server ? asio::ssl::verify_peer | asio::ssl::verify_fail_if_no_peer_cert : asio::ssl::verify_peer);
+		}
+
+		return context;
+	}
+
+	// Handshake on 'socket' (TCP, already connected or accepted), then kTLS in both
+	// directions. Throws std::system_error on a failed handshake, and with
+	// errc::operation_not_supported if the kernel did not take the keys.
+	template<typename Socket>
+	asio::awaitable<void> asyncTlsHandshake(Socket& socket, std::shared_ptr<asio::ssl::context> context,
+		bool server, std::string serverName = {})
+	{
+		std::unique_ptr<SSL, decltype(&SSL_free)> ssl(SSL_new(context->native_handle()), SSL_free);
+		if (!ssl) throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "SSL_new");
+
+		// A socket BIO on the descriptor itself, which is what lets OpenSSL
+		// install the keys into it; readiness is awaited through asio
+		socket.non_blocking(true);
+		SSL_set_fd(ssl.get(), static_cast<int>(socket.native_handle()));
+
+		if (server) {
+			SSL_set_accept_state(ssl.get());
+		}
+		else {
+			SSL_set_connect_state(ssl.get());
+			if (!serverName.empty()) {
+				SSL_set_tlsext_host_name(ssl.get(), serverName.c_str());
+				SSL_set1_host(ssl.get(), serverName.c_str());
+			}
+		}
+
+		for (;;) {
+			ERR_clear_error();
+			int rc = SSL_do_handshake(ssl.get());
+			if (rc == 1) break;
+
+			int error = SSL_get_error(ssl.get(), rc);
+			if (error == SSL_ERROR_WANT_READ) {
+				co_await socket.async_wait(Socket::wait_read, asio::use_awaitable);
+			}
+			else if (error == SSL_ERROR_WANT_WRITE) {
+				co_await socket.async_wait(Socket::wait_write, asio::use_awaitable);
+			}
+			else {
+				unsigned long reason = ERR_get_error();
+				std::error_code ec = reason != 0
+					? std::error_code(static_cast<int>(reason), asio::error::get_ssl_category())
+					: std::error_code(asio::error::connection_reset);
+				throw std::system_error(ec, "TLS handshake");
+			}
+		}
+
+		if (!BIO_get_ktls_send(SSL_get_wbio(ssl.get())) || !BIO_get_ktls_recv(SSL_get_rbio(ssl.get()))) {
+			throw std::system_error(std::make_error_code(std::errc::operation_not_supported),
+				"TLS handshake done but the kernel did not take the keys (kTLS unavailable)");
+		}
+
+		CW_LOG_DEBUG("[TLS] ", SSL_get_version(ssl.get()), " ", SSL_get_cipher_name(ssl.get()), ", offloaded to the kernel");
+
+		socket.non_blocking(false);
+
+		// The kernel now holds the session. Freeing the SSL leaves the descriptor
+		// open; no close_notify is sent at the end, that would take user-space TLS.
+		SSL_set_quiet_shutdown(ssl.get(), 1);
+	}
+#endif
+}
@@ -0,0 +1,1002 @@
+#pragma once
+#include <asio.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cw/endian.h"
+#include "cw/integrity/reed_solomon.h"
+#include "cw/log/logger.h"
+#include "cw/network/xdp_socket.h"
+
+namespace cw::network {
+
+	// Reliable streams over UDP for long lossy links, where one TCP flow is
+	// held back by head-of-line blocking and by reading every random loss as
+	// congestion. Each TCP connection through the tunnel becomes its own stream
+	// with selective acknowledgements and retransmits, so a loss on one stream
+	// (one stripe of a striped upload) never stalls the others, and the sender
+	// paces at a configured rate instead of halving its window on loss.
+	//
+	// The tunnel carries bytes, not packets: Connection, and with it every
+	// FileInfo/FileChunk/FileDone, runs unchanged over loopback TCP to the
+	// tunnel ends. The dialing end listens on a local TCP port; the listening
+	// end connects every new stream to the real Server.
+	struct UdpTunnelOptions
+	{
+		// Stream bytes per datagram. 1200 fits any path that carries QUIC.
+		std::size_t maxPayload = 1200;
+
+		// Pacing rate per peer. Rate based, like UDT: loss does not slow the
+		// sender down, so set this to what the path can carry.
+		std::uint64_t rateBytesPerSecond = 125'000'000; // 1 Gbit/s
+
+		// Per stream and direction: bytes read from TCP but not yet
+		// acknowledged, and bytes received but not yet written to TCP.
+		std::size_t streamBufferBytes = 16 * 1024 * 1024;
+
+		// A stream whose data goes unacknowledged this long is reset
+		std::chrono::milliseconds idleTimeout{ 30'000 };
+
+		// Forward error correction: after each group of up to fecGroup data
+		// datagrams of a stream, ceil(group x fecOverhead) Reed-Solomon parity
+		// datagrams, from which the receiver rebuilds as many lost ones without
+		// waiting a round trip for their retransmit. For long links with random
+		// loss (satellite); costs fecOverhead more bandwidth, and each parity
+		// datagram is 2 bytes per group member larger than a data one. Set on
+		// the sending end; any receiver uses what arrives. 0 = off.
+		double fecOverhead = 0;
+		std::size_t fecGroup = 16;
+
+		// Kernel bypass (Linux): datagrams through an AF_XDP socket on queue
+		// xdpQueue of this interface instead of the kernel's UDP stack, for
+		// dedicated links. Needs the XDP program and the pinned XSKMAP
+		// described at XdpSocket. "" = off.
+		std::string xdpInterface;
+		std::uint32_t xdpQueue = 0;
+		std::string xdpMap = "/sys/fs/bpf/cw_xsks";
+
+		// Testing: drop this fraction of outgoing datagrams
+		double simulatedLoss = 0;
+	};
+
+	class UdpTunnel : public std::enable_shared_from_this<UdpTunnel>
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		// Streams from any peer arriving on 'udpPort' are connected to 'target'
+		static std::shared_ptr<UdpTunnel> listen(asio::io_context& io, uint16_t udpPort, asio::ip::tcp::endpoint target,
+			UdpTunnelOptions options = {})
+		{
+			auto tunnel = std::shared_ptr<UdpTunnel>(new UdpTunnel(io, asio::ip::udp::endpoint(asio::ip::udp::v4(), udpPort), options));
+			tunnel->m_target = target;
+			tunnel->start();
+			CW_LOG_INFO("[UDP] Listening on port ", tunnel->udpPort(), ", forwarding to ", target);
+			return tunnel;
+		}
+
+		// TCP connections to localPort() (on loopback, 0 = any free port) are
+		// carried to the listening tunnel at 'remote'
+		static std::shared_ptr<UdpTunnel> dial(asio::io_context& io, asio::ip::udp::endpoint remote, uint16_t localPort = 0,
+			UdpTunnelOptions options = {})
+		{
+			auto tunnel = std::shared_ptr<UdpTunnel>(new UdpTunnel(io, asio::ip::udp::endpoint(remote.protocol(), 0), options));
+			tunnel->m_remote = remote;
+			tunnel->m_acceptor.emplace(tunnel->m_strand, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), localPort));
+			tunnel->start();
+			tunnel->doAccept();
+			return tunnel;
+		}
+
+		uint16_t udpPort() const { return m_socket.local_endpoint().port(); }
+		uint16_t localPort() const { return m_acceptor ? m_acceptor->local_endpoint().port() : 0; }
+
+		void close()
+		{
+			asio::dispatch(m_strand, [self = shared_from_this()]()
+				{
+					std::error_code ignored;
+					self->m_socket.close(ignored);
+#if defined(__linux__)
+					if (self->m_xdpWait) self->m_xdpWait->close(ignored);
+#endif
+					if (self->m_acceptor) self->m_acceptor->close(ignored);
+					self->m_timer.cancel();
+					for (auto& [key, stream] : self->m_streams) stream->socket.close(ignored);
+					self->m_streams.clear();
+				});
+		}
+
+		// Datagrams retransmitted so far (all streams)
+		std::uint64_t retransmits() const { return m_retransmits; }
+
+		// Lost datagrams rebuilt from parity instead (all streams)
+		std::uint64_t recovered() const { return m_recovered; }
+
+	private:
+		enum class FrameType : uint8_t { Data = 1, Ack = 2, Reset = 3, Parity = 4 };
+
+		// [type 1][stream 4][offset 8][flags 1][payload...]
+		static constexpr std::size_t DATA_HEADER_SIZE = 1 + 4 + 8 + 1;
+		static constexpr uint8_t DATA_FIN = 1;
+		static constexpr uint8_t DATA_GROUPED = 2; // Covered by parity: worth keeping a while
+		// [type 1][stream 4][cumulative 8][window 4][count 1][start 8, end 8]...
+		static constexpr std::size_t ACK_HEADER_SIZE = 1 + 4 + 8 + 4 + 1;
+		static constexpr std::size_t MAX_ACK_RANGES = 32;
+		// [type 1][stream 4][first offset 8][count 1][parities 1][index 1][length 2]...[parity...]
+		static constexpr std::size_t PARITY_HEADER_SIZE = 1 + 4 + 8 + 1 + 1 + 1;
+		static constexpr std::size_t MAX_FEC_GROUP = 64;
+		static constexpr std::size_t MAX_DATAGRAM = 64 * 1024;
+
+		static constexpr auto TICK = std::chrono::milliseconds(1);
+		static constexpr auto ACK_DELAY = std::chrono::milliseconds(2);
+		static constexpr auto INITIAL_RTO = std::chrono::milliseconds(200);
+		static constexpr auto MIN_RTO = std::chrono::milliseconds(20);
+		static constexpr auto MAX_RTO = std::chrono::milliseconds(2000);
+		// Later data acknowledged this far beyond a segment marks it lost
+		static constexpr std::size_t REORDER_SEGMENTS = 3;
+
+		// A FIN takes one offset after the last byte, like TCP, so that its
+		// acknowledgement is an ordinary cumulative ack
+		struct Segment
+		{
+			std::vector<uint8_t> data;
+			bool fin = false;
+			bool grouped = false;     // Covered by parity
+			bool sent = false;
+			bool retransmitted = false;
+			Clock::time_point sentAt;
+			std::uint64_t groupFirst = 0; // Sending end, once its parity is made
+			std::uint64_t groupEnd = 0;
+			std::size_t groupParities = 0;
+
+			std::uint64_t length() const { return data.size() + (fin ? 1 : 0); }
+		};
+
+		// One parity datagram, held until the last of its group has gone out
+		struct ParityDatagram
+		{
+			std::uint64_t end = 0; // Of its group
+			std::vector<uint8_t> frame;
+		};
+
+		// A group some parity of which arrived before all of its data
+		struct FecGroup
+		{
+			std::vector<std::uint16_t> lengths;
+			std::size_t parities = 0;
+			std::uint64_t end = 0;
+			std::map<std::size_t, std::vector<uint8_t>> parity; // By index
+		};
+
+		// Per remote endpoint: round-trip estimate and the pacing budget
+		struct Peer
+		{
+			Clock::duration srtt{};
+			Clock::duration rttvar{};
+			Clock::duration rto = INITIAL_RTO;
+			bool hasRtt = false;
+			double tokens = 0;
+			Clock::time_point refilled = Clock::now();
+		};
+
+		struct Stream
+		{
+			Stream(asio::strand<asio::io_context::executor_type>& strand) : socket(strand) {}
+
+			asio::ip::udp::endpoint peer;
+			std::uint32_t id = 0;
+			asio::ip::tcp::socket socket;
+			bool connected = false;
+
+			// TCP -> UDP
+			std::map<std::uint64_t, Segment> segments; // Unacknowledged, by offset
+			std::size_t segmentBytes = 0;
+			std::uint64_t nextOffset = 0;               // For the next byte read from TCP
+			std::uint64_t acked = 0;                    // Cumulative
+			std::uint64_t highestAcked = 0;             // Largest offset covered by any ack
+			std::uint64_t peerWindow = 0;
+			std::vector<uint8_t> readBuffer;
+			bool reading = false;
+			bool readEof = false;
+			Clock::time_point lastProgress = Clock::now();
+			std::vector<std::uint64_t> fecGroup;        // Offsets of the group being filled
+			std::deque<ParityDatagram> parity;
+			std::uint64_t sentOnce = 0;                 // End of the data sent at least once
+
+			// UDP -> TCP
+			std::uint64_t received = 0;                 // Contiguous, FIN included
+			std::map<std::uint64_t, Segment> outOfOrder;
+			std::size_t outOfOrderBytes = 0;
+			std::optional<std::uint64_t> finOffset;
+			bool finReceived = false;
+			std::deque<std::vector<uint8_t>> writeQueue;
+			std::size_t writeQueueBytes = 0;
+			bool writing = false;
+			bool writeShutdown = false;
+			unsigned unackedDatagrams = 0;
+			std::optional<Clock::time_point> ackDue;
+			std::map<std::uint64_t, FecGroup> fecGroups; // By first offset
+			std::map<std::uint64_t, std::vector<uint8_t>> delivered; // Recent grouped data, of use to a group still short
+
+			bool sendDone() const { return readEof && acked == nextOffset; }
+			bool receiveDone() const { return finReceived && writeQueue.empty() && !writing; }
+		};
+
+		using StreamKey = std::pair<asio::ip::udp::endpoint, std::uint32_t>;
+
+		UdpTunnel(asio::io_context& io, asio::ip::udp::endpoint local, UdpTunnelOptions options)
+			: m_strand(asio::make_strand(io)),
+			m_socket(m_strand, local),
+			m_timer(m_strand),
+			m_options(options),
+			m_receiveBuffer(MAX_DATAGRAM)
+		{
+			m_options.maxPayload = std::clamp<std::size_t>(m_options.maxPayload, 64, MAX_DATAGRAM - PARITY_HEADER_SIZE - 2 * MAX_FEC_GROUP);
+			m_options.fecGroup = std::clamp<std::size_t>(m_options.fecGroup, 1, MAX_FEC_GROUP);
+			m_socket.non_blocking(true);
+
+			if (!m_options.xdpInterface.empty()) {
+#if defined(__linux__)
+				// The kernel socket stays: it holds the port, and carries what goes to peers not heard from yet
+				m_xdp = std::make_unique<XdpSocket>(m_options.xdpInterface, m_options.xdpQueue, m_options.xdpMap, m_socket.local_endpoint().port());
+				m_xdpWait.emplace(m_strand, ::dup(m_xdp->fd()));
+				// No IP fragments past the kernel: every datagram fits a frame
+				m_options.maxPayload = std::min(m_options.maxPayload, m_xdp->maxDatagram() - PARITY_HEADER_SIZE - 2 * MAX_FEC_GROUP);
+				CW_LOG_INFO("[UDP] AF_XDP on ", m_options.xdpInterface, " queue ", m_options.xdpQueue, m_xdp->zeroCopy() ? " (zero copy)" : " (copy mode)");
+#else
+				throw std::runtime_error("AF_XDP needs Linux");
+#endif
+			}
+		}
+
+		void start()
+		{
+			doReceive();
+#if defined(__linux__)
+			if (m_xdp) doReceiveXdp();
+#endif
+			schedule();
+		}
+
+		// --- Local TCP side ---
+
+		void doAccept()
+		{
+			auto stream = std::make_shared<Stream>(m_strand);
+			m_acceptor->async_accept(stream->socket, [this, self = shared_from_this(), stream](std::error_code ec)
+				{
+					if (ec) return;
+
+					stream->peer = *m_remote;
+					stream->id = m_nextStreamId++;
+					stream->connected = true;
+					stream->peerWindow = m_options.streamBufferBytes;
+					m_streams[{ stream->peer, stream->id }] = stream;
+					doReadTcp(stream);
+					doAccept();
+				});
+		}
+
+		void connectTarget(const std::shared_ptr<Stream>& stream)
+		{
+			stream->socket.async_connect(m_target, [this, self = shared_from_this(), stream](std::error_code ec)
+				{
+					if (ec) {
+						CW_LOG_WARN("[UDP] Cannot reach ", m_target, ": ", ec.message());
+						reset(stream, true);
+						return;
+					}
+					stream->connected = true;
+					doReadTcp(stream);
+					doWriteTcp(stream);
+				});
+		}
+
+		void doReadTcp(const std::shared_ptr<Stream>& stream)
+		{
+			if (stream->reading || stream->readEof || !stream->connected) return;
+			// Backpressure: TCP flow control holds the local sender while the link is behind
+			if (stream->segmentBytes >= m_options.streamBufferBytes) return;
+
+			stream->readBuffer.resize(std::max<std::size_t>(64 * 1024, m_options.maxPayload));
+			stream->reading = true;
+			stream->socket.async_read_some(asio::buffer(stream->readBuffer), [this, self = shared_from_this(), stream](std::error_code ec, std::size_t length)
+				{
+					stream->reading = false;
+					if (!m_socket.is_open()) return;
+
+					if (ec == asio::error::eof) {
+						queueSegment(*stream, {}, true);
+						stream->readEof = true;
+					}
+					else if (ec) {
+						reset(stream, true);
+						return;
+					}
+					else {
+						for (std::size_t pos = 0; pos < length; pos += m_options.maxPayload) {
+							std::size_t n = std::min(m_options.maxPayload, length - pos);
+							queueSegment(*stream, std::vector<uint8_t>(stream->readBuffer.begin() + pos, stream->readBuffer.begin() + pos + n), false);
+						}
+						// A group never waits for the next read, which may be long in coming
+						encodeGroup(*stream);
+					}
+
+					sendPending();
+					doReadTcp(stream);
+				});
+		}
+
+		void queueSegment(Stream& stream, std::vector<uint8_t> data, bool fin)
+		{
+			Segment segment;
+			segment.data = std::move(data);
+			segment.fin = fin;
+			// The FIN is left out of groups: it carries no data to rebuild
+			segment.grouped = m_options.fecOverhead > 0 && !fin;
+			std::uint64_t length = segment.length();
+			stream.segmentBytes += segment.data.size();
+			stream.segments.emplace(stream.nextOffset, std::move(segment));
+
+			if (m_options.fecOverhead > 0 && !fin) {
+				stream.fecGroup.push_back(stream.nextOffset);
+				if (stream.fecGroup.size() >= m_options.fecGroup) encodeGroup(stream);
+			}
+			stream.nextOffset += length;
+		}
+
+		// Parity of the group being filled, queued to follow its data
+		void encodeGroup(Stream& stream)
+		{
+			if (stream.fecGroup.empty()) return;
+
+			std::size_t count = stream.fecGroup.size();
+			auto parities = static_cast<std::size_t>(std::ceil(static_cast<double>(count) * m_options.fecOverhead));
+			parities = std::clamp<std::size_t>(parities, 1, cw::integrity::ReedSolomon::MAX_SHARDS - count);
+
+			std::vector<std::span<const uint8_t>> shards;
+			std::size_t shardSize = 0;
+			for (std::uint64_t offset : stream.fecGroup) {
+				const auto& data = stream.segments.at(offset).data;
+				shards.emplace_back(data);
+				shardSize = std::max(shardSize, data.size());
+			}
+
+			for (std::uint64_t offset : stream.fecGroup) {
+				Segment& segment = stream.segments.at(offset);
+				segment.groupFirst = stream.fecGroup.front();
+				segment.groupEnd = stream.fecGroup.back() + shards.back().size();
+				segment.groupParities = parities;
+			}
+
+			cw::integrity::ReedSolomon code(count, parities);
+			std::size_t headerSize = PARITY_HEADER_SIZE + 2 * count;
+			for (std::size_t index = 0; index < parities; ++index) {
+				ParityDatagram parity;
+				parity.end = stream.fecGroup.back() + shards.back().size();
+				parity.frame.resize(headerSize + shardSize);
+				cw::binary::ByteWriter writer(parity.frame.data());
+				writer.write<uint8_t>(static_cast<uint8_t>(FrameType::Parity));
+				writer.write<uint32_t>(stream.id);
+				writer.write<uint64_t>(stream.fecGroup.front());
+				writer.write<uint8_t>(static_cast<uint8_t>(count));
+				writer.write<uint8_t>(static_cast<uint8_t>(parities));
+				writer.write<uint8_t>(static_cast<uint8_t>(index));
+				for (const auto& shard : shards) writer.write<uint16_t>(static_cast<uint16_t>(shard.size()));
+				code.encode(index, shards, std::span<uint8_t>(parity.frame).subspan(headerSize));
+				stream.parity.push_back(std::move(parity));
+			}
+			stream.fecGroup.clear();
+		}
+
+		void doWriteTcp(const std::shared_ptr<Stream>& stream)
+		{
+			if (stream->writing || !stream->connected) return;
+
+			if (stream->writeQueue.empty()) {
+				if (stream->finReceived && !stream->writeShutdown) {
+					std::error_code ignored;
+					stream->socket.shutdown(asio::ip::tcp::socket::shutdown_send, ignored);
+					stream->writeShutdown = true;
+				}
+				maybeFinish(stream);
+				return;
+			}
+
+			stream->writing = true;
+			asio::async_write(stream->socket, asio::buffer(stream->writeQueue.front()), [this, self = shared_from_this(), stream](std::error_code ec, std::size_t)
+				{
+					stream->writing = false;
+					if (!m_socket.is_open()) return;
+					if (ec) {
+						reset(stream, true);
+						return;
+					}
+
+					stream->writeQueueBytes -= stream->writeQueue.front().size();
+					stream->writeQueue.pop_front();
+					// The window opened: let the sender know soon
+					if (!stream->ackDue) stream->ackDue = Clock::now() + ACK_DELAY;
+					doWriteTcp(stream);
+				});
+		}
+
+		void maybeFinish(const std::shared_ptr<Stream>& stream)
+		{
+			if (!stream->sendDone() || !stream->receiveDone()) return;
+
+			// Our last ack may still be needed by the peer; it resends its FIN
+			// and gets a reset, which a finished stream treats as a close
+			flushAck(*stream);
+			std::error_code ignored;
+			stream->socket.close(ignored);
+			forget(*stream);
+		}
+
+		void reset(const std::shared_ptr<Stream>& stream, bool notifyPeer)
+		{
+			if (notifyPeer) sendReset(stream->peer, stream->id);
+			std::error_code ignored;
+			stream->socket.close(ignored);
+			forget(*stream);
+		}
+
+		void forget(const Stream& stream)
+		{
+			StreamKey key{ stream.peer, stream.id };
+			if (m_streams.erase(key) == 0) return;
+			m_closed[key] = Clock::now();
+		}
+
+		// --- UDP side ---
+
+		void doReceive()
+		{
+			m_socket.async_receive_from(asio::buffer(m_receiveBuffer), m_sender, [this, self = shared_from_this()](std::error_code ec, std::size_t length)
+				{
+					if (ec == asio::error::operation_aborted || !m_socket.is_open()) return;
+					if (!ec) {
+						try {
+							onDatagram(m_sender, m_receiveBuffer.data(), length);
+						}
+						catch (const std::exception& e) {
+							CW_LOG_WARN("[UDP] Bad datagram from ", m_sender, ": ", e.what());
+						}
+					}
+					doReceive();
+				});
+		}
+
+#if defined(__linux__)
+		// Datagrams read where the driver put them in UMEM
+		void doReceiveXdp()
+		{
+			m_xdpWait->async_wait(asio::posix::stream_descriptor::wait_read, [this, self = shared_from_this()](std::error_code ec)
+				{
+					if (ec == asio::error::operation_aborted || !m_socket.is_open()) return;
+					if (ec) {
+						CW_LOG_WARN("[UDP] AF_XDP socket failed: ", ec.message());
+						return;
+					}
+					m_xdp->receive([this](const asio::ip::udp::endpoint& from, std::span<const uint8_t> payload)
+						{
+							try {
+								onDatagram(from, payload.data(), payload.size());
+							}
+							catch (const std::exception& e) {
+								CW_LOG_WARN("[UDP] Bad datagram from ", from, ": ", e.what());
+							}
+						});
+					doReceiveXdp();
+				});
+		}
+#endif
+
+		void onDatagram(const asio::ip::udp::endpoint& from, const uint8_t* data, std::size_t length)
+		{
+			using cw::binary::readBigEndian;
+			if (length < 5) throw std::runtime_error("short datagram");
+
+			auto type = static_cast<FrameType>(data[0]);
+			std::uint32_t id = readBigEndian<uint32_t>(data + 1);
+			StreamKey key{ from, id };
+
+			auto it = m_streams.find(key);
+			if (type == FrameType::Reset) {
+				if (it == m_streams.end()) return;
+				auto stream = it->second;
+				// Its FIN was answered, then we went quiet: a close, not an abort
+				if (stream->sendDone() || (stream->readEof && stream->finReceived)) {
+					stream->acked = stream->nextOffset;
+					stream->segments.clear();
+					stream->segmentBytes = 0;
+					maybeFinish(stream);
+				}
+				else {
+					reset(stream, false);
+				}
+				return;
+			}
+
+			if (it == m_streams.end()) {
+				// New streams only come from dialers, and never twice
+				if (m_remote || type != FrameType::Data || m_closed.contains(key)) {
+					if (type == FrameType::Data) sendReset(from, id);
+					return;
+				}
+				auto stream = std::make_shared<Stream>(m_strand);
+				stream->peer = from;
+				stream->id = id;
+				stream->peerWindow = m_options.streamBufferBytes;
+				it = m_streams.emplace(key, stream).first;
+				connectTarget(stream);
+			}
+
+			auto stream = it->second;
+			if (type == FrameType::Data) onData(stream, data, length);
+			else if (type == FrameType::Ack) onAck(stream, data, length);
+			else if (type == FrameType::Parity) onParity(stream, data, length);
+		}
+
+		void onData(const std::shared_ptr<Stream>& stream, const uint8_t* data, std::size_t length)
+		{
+			using cw::binary::readBigEndian;
+			if (length < DATA_HEADER_SIZE) throw std::runtime_error("short data frame");
+
+			std::uint64_t offset = readBigEndian<uint64_t>(data + 5);
+			Segment segment;
+			segment.data.assign(data + DATA_HEADER_SIZE, data + length);
+			segment.fin = (data[13] & DATA_FIN) != 0;
+			segment.grouped = (data[13] & DATA_GROUPED) != 0;
+			accept(stream, offset, std::move(segment));
+		}
+
+		void accept(const std::shared_ptr<Stream>& stream, std::uint64_t offset, Segment segment)
+		{
+			Stream& s = *stream;
+			bool inOrder = offset == s.received;
+
+			if (offset + segment.length() <= s.received) {
+				// A duplicate: our ack was lost, resend it now
+				s.ackDue = Clock::now();
+			}
+			else if (offset > s.received) {
+				if (offset + segment.length() - s.received <= m_options.streamBufferBytes && !s.outOfOrder.contains(offset)) {
+					s.outOfOrderBytes += segment.data.size();
+					s.outOfOrder.emplace(offset, std::move(segment));
+				}
+				// A gap: report it at once so the sender can fill it
+				s.ackDue = Clock::now();
+			}
+			else {
+				deliver(s, std::move(segment));
+				while (!s.outOfOrder.empty() && s.outOfOrder.begin()->first == s.received) {
+					auto node = s.outOfOrder.extract(s.outOfOrder.begin());
+					s.outOfOrderBytes -= node.mapped().data.size();
+					deliver(s, std::move(node.mapped()));
+				}
+				std::erase_if(s.fecGroups, [&s](const auto& entry) { return entry.second.end <= s.received; });
+				doWriteTcp(stream);
+			}
+
+			if (inOrder && ++s.unackedDatagrams >= 2) s.ackDue = Clock::now();
+			else if (!s.ackDue) s.ackDue = Clock::now() + ACK_DELAY;
+		}
+
+		void deliver(Stream& s, Segment segment)
+		{
+			// Kept a while: a later member of its group may be lost
+			if (segment.grouped) {
+				s.delivered.emplace(s.received, segment.data);
+				if (s.delivered.size() > 2 * MAX_FEC_GROUP) s.delivered.erase(s.delivered.begin());
+			}
+
+			s.received += segment.length();
+			if (segment.fin) s.finReceived = true;
+			if (segment.data.empty()) return;
+			s.writeQueueBytes += segment.data.size();
+			s.writeQueue.push_back(std::move(segment.data));
+		}
+
+		void onParity(const std::shared_ptr<Stream>& stream, const uint8_t* data, std::size_t length)
+		{
+			using cw::binary::readBigEndian;
+			if (length < PARITY_HEADER_SIZE) throw std::runtime_error("short parity frame");
+
+			std::uint64_t first = readBigEndian<uint64_t>(data + 5);
+			std::size_t count = data[13];
+			std::size_t parities = data[14];
+			std::size_t index = data[15];
+			std::size_t headerSize = PARITY_HEADER_SIZE + 2 * count;
+			if (count == 0 || index >= parities || count + parities > cw::integrity::ReedSolomon::MAX_SHARDS || length < headerSize)
+				throw std::runtime_error("bad parity frame");
+
+			std::vector<std::uint16_t> lengths(count);
+			std::uint64_t end = first;
+			for (std::size_t i = 0; i < count; ++i) {
+				lengths[i] = readBigEndian<uint16_t>(data + PARITY_HEADER_SIZE + 2 * i);
+				if (lengths[i] > length - headerSize) throw std::runtime_error("bad parity frame");
+				end += lengths[i];
+			}
+
+			Stream& s = *stream;
+			if (end <= s.received) return; // All of its group arrived
+
+			FecGroup& group = s.fecGroups[first];
+			if (group.lengths.empty()) {
+				group.lengths = std::move(lengths);
+				group.parities = parities;
+				group.end = end;
+			}
+			group.parity.try_emplace(index, data + headerSize, data + length);
+			recover(stream, first);
+		}
+
+		// Rebuilds the lost members of a group once enough of it is here
+		void recover(const std::shared_ptr<Stream>& stream, std::uint64_t first)
+		{
+			Stream& s = *stream;
+			auto it = s.fecGroups.find(first);
+			FecGroup& group = it->second;
+			std::size_t count = group.lengths.size();
+
+			// What of the group is here, delivered (and kept) or waiting out of order
+			std::vector<const std::vector<uint8_t>*> found(count, nullptr);
+			std::vector<std::uint64_t> offsets(count);
+			std::size_t present = 0;
+			bool lost = false;
+			std::uint64_t offset = first;
+			for (std::size_t i = 0; i < count; ++i) {
+				offsets[i] = offset;
+				std::uint16_t length = group.lengths[i];
+				if (auto waiting = s.outOfOrder.find(offset); waiting != s.outOfOrder.end() && waiting->second.data.size() == length) found[i] = &waiting->second.data;
+				else if (auto kept = s.delivered.find(offset); kept != s.delivered.end() && kept->second.size() == length) found[i] = &kept->second;
+				if (found[i]) ++present;
+				else if (offset + length > s.received) lost = true;
+				offset += length;
+			}
+			if (!lost) {
+				s.fecGroups.erase(it);
+				return;
+			}
+			if (present + group.parity.size() < count) return;
+
+			std::vector<std::optional<std::vector<uint8_t>>> shards(count);
+			std::size_t shardSize = 0;
+			for (std::size_t i = 0; i < count; ++i) {
+				if (found[i]) shards[i] = *found[i];
+				shardSize = std::max<std::size_t>(shardSize, group.lengths[i]);
+			}
+			std::vector<std::pair<std::size_t, std::span<const uint8_t>>> parity;
+			for (const auto& [index, bytes] : group.parity) parity.emplace_back(index, bytes);
+
+			cw::integrity::ReedSolomon code(count, group.parities);
+			if (!code.reconstruct(shards, parity, shardSize)) return;
+			std::vector<std::uint16_t> lengths = std::move(group.lengths);
+			s.fecGroups.erase(it);
+
+			for (std::size_t i = 0; i < count; ++i) {
+				// Delivered already, only its bytes were missing here
+				if (found[i] || offsets[i] + lengths[i] <= s.received) continue;
+				Segment segment;
+				segment.data = std::move(*shards[i]);
+				segment.data.resize(lengths[i]);
+				segment.grouped = true;
+				++m_recovered;
+				accept(stream, offsets[i], std::move(segment));
+			}
+		}
+
+		void onAck(const std::shared_ptr<Stream>& stream, const uint8_t* data, std::size_t length)
+		{
+			using cw::binary::readBigEndian;
+			if (length < ACK_HEADER_SIZE) throw std::runtime_error("short ack frame");
+
+			Stream& s = *stream;
+			Peer& peer = m_peers[s.peer];
+			auto now = Clock::now();
+
+			std::uint64_t cumulative = readBigEndian<uint64_t>(data + 5);
+			s.peerWindow = readBigEndian<uint32_t>(data + 13);
+			std::size_t count = std::min<std::size_t>(data[17], (length - ACK_HEADER_SIZE) / 16);
+
+			std::optional<Clock::duration> sample;
+			auto acknowledge = [&](std::map<std::uint64_t, Segment>::iterator it)
+				{
+					if (it->second.sent && !it->second.retransmitted) sample = now - it->second.sentAt;
+					s.segmentBytes -= it->second.data.size();
+					return s.segments.erase(it);
+				};
+
+			if (cumulative > s.acked) {
+				s.acked = cumulative;
+				s.lastProgress = now;
+			}
+			s.highestAcked = std::max(s.highestAcked, cumulative);
+			for (auto it = s.segments.begin(); it != s.segments.end() && it->first + it->second.length() <= cumulative;) {
+				it = acknowledge(it);
+			}
+
+			for (std::size_t i = 0; i < count; ++i) {
+				const uint8_t* range = data + ACK_HEADER_SIZE + i * 16;
+				std::uint64_t start = readBigEndian<uint64_t>(range);
+				std::uint64_t end = readBigEndian<uint64_t>(range + 8);
+				s.highestAcked = std::max(s.highestAcked, end);
+				for (auto it = s.segments.lower_bound(start); it != s.segments.end() && it->first + it->second.length() <= end;) {
+					it = acknowledge(it);
+				}
+			}
+
+			if (sample) updateRtt(peer, *sample);
+
+			// Selective retransmit: a segment well below what the peer already
+			// has, and older than a fraction of the RTT, was lost. One of a group
+			// its parity can still repair is given until the ack that follows the
+			// parity could be back: the peer may have rebuilt it.
+			std::uint64_t reorder = REORDER_SEGMENTS * m_options.maxPayload;
+			std::optional<std::pair<std::uint64_t, bool>> repairable; // Of the last group looked at
+			for (auto& [offset, segment] : s.segments) {
+				if (offset + segment.length() + reorder > s.highestAcked) break;
+				if (!segment.sent || now - segment.sentAt <= peer.srtt / 4) continue;
+
+				if (segment.groupParities != 0 && !segment.retransmitted && now - segment.sentAt <= peer.srtt + fecDelay()) {
+					if (!repairable || repairable->first != segment.groupFirst) {
+						repairable.emplace(segment.groupFirst, seemLost(s, segment.groupFirst, segment.groupEnd, reorder) <= segment.groupParities);
+					}
+					if (repairable->second) continue;
+				}
+				segment.sent = false;
+				segment.retransmitted = true;
+			}
+
+			sendPending();
+			doReadTcp(stream);
+			maybeFinish(stream);
+		}
+
+		// Segments of [first, end) still unacknowledged well below what the peer has
+		static std::size_t seemLost(const Stream& s, std::uint64_t first, std::uint64_t end, std::uint64_t reorder)
+		{
+			std::size_t lost = 0;
+			for (auto it = s.segments.lower_bound(first); it != s.segments.end() && it->first < end; ++it) {
+				if (it->first + it->second.length() + reorder <= s.highestAcked) ++lost;
+			}
+			return lost;
+		}
+
+		// Sending a group and its parity at the pacing rate, and the ack after it
+		Clock::duration fecDelay() const
+		{
+			double bytes = static_cast<double>(m_options.fecGroup * m_options.maxPayload) * (1 + m_options.fecOverhead);
+			return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(bytes / static_cast<double>(m_options.rateBytesPerSecond))) + ACK_DELAY;
+		}
+
+		void updateRtt(Peer& peer, Clock::duration sample)
+		{
+			if (!peer.hasRtt) {
+				peer.srtt = sample;
+				peer.rttvar = sample / 2;
+				peer.hasRtt = true;
+			}
+			else {
+				auto delta = peer.srtt > sample ? peer.srtt - sample : sample - peer.srtt;
+				peer.rttvar = (3 * peer.rttvar + delta) / 4;
+				peer.srtt = (7 * peer.srtt + sample) / 8;
+			}
+			peer.rto = std::clamp<Clock::duration>(peer.srtt + 4 * peer.rttvar, MIN_RTO, MAX_RTO);
+		}
+
+		// --- Sending ---
+
+		void refill(Peer& peer, Clock::time_point now)
+		{
+			double elapsed = std::chrono::duration<double>(now - peer.refilled).count();
+			peer.refilled = now;
+			// At most a few ticks' worth of burst
+			double cap = static_cast<double>(m_options.rateBytesPerSecond) * 0.004 + 2.0 * static_cast<double>(MAX_DATAGRAM);
+			peer.tokens = std::min(cap, peer.tokens + elapsed * static_cast<double>(m_options.rateBytesPerSecond));
+		}
+
+		// Retransmits first (lowest offset first), then new data within the
+		// peer's window, while the pacing budget lasts
+		void sendPending()
+		{
+			auto now = Clock::now();
+			for (auto& [key, stream] : m_streams) {
+				Stream& s = *stream;
+				if (s.segments.empty()) continue;
+
+				Peer& peer = m_peers[s.peer];
+				refill(peer, now);
+
+				for (auto& [offset, segment] : s.segments) {
+					if (segment.sent) continue;
+					if (offset + segment.length() > s.acked + std::max<std::uint64_t>(s.peerWindow, m_options.maxPayload)) break;
+					if (peer.tokens < static_cast<double>(segment.data.size() + DATA_HEADER_SIZE)) break;
+
+					if (!sendData(s, offset, segment)) return;
+					peer.tokens -= static_cast<double>(segment.data.size() + DATA_HEADER_SIZE);
+					if (segment.retransmitted) ++m_retransmits;
+					else s.sentOnce = std::max(s.sentOnce, offset + segment.length());
+					segment.sent = true;
+					segment.sentAt = now;
+					if (!sendParity(s, peer)) return;
+				}
+				if (!sendParity(s, peer)) return;
+			}
+		}
+
+		// The parity of the groups sent so far, right behind them; a group
+		// acknowledged meanwhile needs none. False once the socket is full.
+		bool sendParity(Stream& s, Peer& peer)
+		{
+			while (!s.parity.empty() && s.parity.front().end <= s.sentOnce) {
+				const auto& frame = s.parity.front().frame;
+				if (s.parity.front().end > s.acked) {
+					if (peer.tokens < static_cast<double>(frame.size())) return true;
+					std::copy(frame.begin(), frame.end(), m_sendBuffer.begin());
+					if (!sendDatagram(s.peer, frame.size())) return false;
+					peer.tokens -= static_cast<double>(frame.size());
+				}
+				s.parity.pop_front();
+			}
+			return true;
+		}
+
+		bool sendData(const Stream& s, std::uint64_t offset, const Segment& segment)
+		{
+			uint8_t* out = m_sendBuffer.data();
+			cw::binary::ByteWriter writer(out);
+			writer.write<uint8_t>(static_cast<uint8_t>(FrameType::Data));
+			writer.write<uint32_t>(s.id);
+			writer.write<uint64_t>(offset);
+			writer.write<uint8_t>(static_cast<uint8_t>((segment.fin ? DATA_FIN : 0) | (segment.grouped ? DATA_GROUPED : 0)));
+			writer.bytes(segment.data.begin(), segment.data.end());
+			return sendDatagram(s.peer, static_cast<std::size_t>(writer.position() - out));
+		}
+
+		void flushAck(Stream& s)
+		{
+			uint8_t* out = m_sendBuffer.data();
+			cw::binary::ByteWriter writer(out);
+			writer.write<uint8_t>(static_cast<uint8_t>(FrameType::Ack));
+			writer.write<uint32_t>(s.id);
+			writer.write<uint64_t>(s.received);
+
+			std::size_t buffered = s.writeQueueBytes + s.outOfOrderBytes;
+			std::size_t window = buffered < m_options.streamBufferBytes ? m_options.streamBufferBytes - buffered : 0;
+			writer.write<uint32_t>(static_cast<uint32_t>(std::min<std::size_t>(window, UINT32_MAX)));
+
+			// Merge the out-of-order segments into ranges
+			std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+			for (const auto& [offset, segment] : s.outOfOrder) {
+				std::uint64_t end = offset + segment.length();
+				if (!ranges.empty() && ranges.back().second == offset) ranges.back().second = end;
+				else if (ranges.size() < MAX_ACK_RANGES) ranges.emplace_back(offset, end);
+				else break;
+			}
+			writer.write<uint8_t>(static_cast<uint8_t>(ranges.size()));
+			for (auto [start, end] : ranges) {
+				writer.write<uint64_t>(start);
+				writer.write<uint64_t>(end);
+			}
+
+			sendDatagram(s.peer, static_cast<std::size_t>(writer.position() - out), true);
+			s.unackedDatagrams = 0;
+			s.ackDue.reset();
+		}
+
+		void sendReset(const asio::ip::udp::endpoint& peer, std::uint32_t id)
+		{
+			uint8_t* out = m_sendBuffer.data();
+			cw::binary::ByteWriter writer(out);
+			writer.write<uint8_t>(static_cast<uint8_t>(FrameType::Reset));
+			writer.write<uint32_t>(id);
+			sendDatagram(peer, 5, true);
+		}
+
+		// Non-blocking: a full socket buffer ends this round (data stays queued)
+		bool sendDatagram(const asio::ip::udp::endpoint& peer, std::size_t length, bool control = false)
+		{
+			if (!control && m_options.simulatedLoss > 0 && m_lossDistribution(m_lossRng) < m_options.simulatedLoss) return true;
+
+#if defined(__linux__)
+			if (m_xdp && m_xdp->hasRoute(peer)) return m_xdp->send(peer, std::span<const uint8_t>(m_sendBuffer.data(), length));
+#endif
+			std::error_code ec;
+			m_socket.send_to(asio::buffer(m_sendBuffer.data(), length), peer, 0, ec);
+			return !(ec == asio::error::would_block || ec == asio::error::try_again);
+		}
+
+		// --- Timers ---
+
+		void schedule()
+		{
+			m_timer.expires_after(TICK);
+			m_timer.async_wait([this, self = shared_from_this()](std::error_code ec)
+				{
+					if (ec || !m_socket.is_open()) return;
+					onTick();
+					schedule();
+				});
+		}
+
+		void onTick()
+		{
+			auto now = Clock::now();
+			std::vector<std::shared_ptr<Stream>> stale;
+
+			for (auto& [key, stream] : m_streams) {
+				Stream& s = *stream;
+				Peer& peer = m_peers[s.peer];
+
+				if (s.ackDue && *s.ackDue <= now) flushAck(s);
+
+				// Retransmission timeout: the oldest unacknowledged segment
+				bool timedOut = false;
+				for (auto& [offset, segment] : s.segments) {
+					if (!segment.sent) break;
+					if (now - segment.sentAt > peer.rto) {
+						segment.sent = false;
+						segment.retransmitted = true;
+						timedOut = true;
+					}
+				}
+				if (timedOut) peer.rto = std::min<Clock::duration>(peer.rto * 2, MAX_RTO);
+
+				if (!s.segments.empty() && now - s.lastProgress > m_options.idleTimeout) stale.push_back(stream);
+			}
+
+			for (auto& stream : stale) {
+				CW_LOG_WARN("[UDP] Stream ", stream->id, " to ", stream->peer, " timed out");
+				reset(stream, true);
+			}
+
+			// Closed streams are remembered long enough for their last datagrams
+			std::erase_if(m_closed, [&](const auto& entry) { return now - entry.second > m_options.idleTimeout; });
+
+			sendPending();
+		}
+
+	private:
+		asio::strand<asio::io_context::executor_type> m_strand;
+		asio::ip::udp::socket m_socket;
+		asio::steady_timer m_timer;
+		UdpTunnelOptions m_options;
+
+		std::optional<asio::ip::tcp::acceptor> m_acceptor; // Dialing end
+		std::optional<asio::ip::udp::endpoint> m_remote;   // Dialing end
+		asio::ip::tcp::endpoint m_target;                   // Listening end
+		std::uint32_t m_nextStreamId = 1;
+
+		std::map<StreamKey, std::shared_ptr<Stream>> m_streams;
+		std::map<StreamKey, Clock::time_point> m_closed;
+		std::map<asio::ip::udp::endpoint, Peer> m_peers;
+
+		std::vector<uint8_t> m_receiveBuffer;
+		asio::ip::udp::endpoint m_sender;
+		std::array<uint8_t, MAX_DATAGRAM> m_sendBuffer{};
+		std::uint64_t m_retransmits = 0;
+		std::uint64_t m_recovered = 0;
+
+#if defined(__linux__)
+		std::unique_ptr<XdpSocket> m_xdp;
+		std::optional<asio::posix::stream_descriptor> m_xdpWait; // A duplicate of its descriptor, to wait on
+#endif
+
+		std::mt19937 m_lossRng{ 7 };
+		std::uniform_real_distribution<double> m_lossDistribution{ 0.0, 1.0 };
+	};
+}
@@ -0,0 +1,252 @@
+#pragma once
+#include <asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cw/log/logger.h"
+
+namespace cw::network {
+
+	// The path a WanEmulator stands in for, the same in both directions
+	struct WanProfile
+	{
+		std::chrono::microseconds rtt{ 0 };    // Round trip: each direction adds half
+		std::chrono::microseconds jitter{ 0 }; // Up to this much more per segment, uniformly
+		std::uint64_t bandwidthBitsPerSecond = 0; // Bottleneck rate, 0 = unlimited
+		double lossRate = 0;                      // Share of segments lost, 0 to 1
+
+		// The bottleneck's buffer: bytes in flight per direction before the
+		// emulator stops reading and the sender's TCP window fills. A few
+		// times bandwidth x RTT keeps the link busy; less emulates a
+		// shallow-buffered path.
+		std::size_t queueBytes = 16 * 1024 * 1024;
+		std::uint64_t seed = 1; // Jitter and loss replay the same for the same seed
+
+		bool shapes() const { return rtt.count() > 0 || jitter.count() > 0 || bandwidthBitsPerSecond > 0 || lossRate > 0; }
+	};
+
+	// --wan-rtt-ms=N --wan-jitter-ms=N --wan-mbit=N --wan-loss=PCT --wan-queue-kb=N;
+	// false for anything else
+	inline bool parseWanOption(std::string_view arg, WanProfile& profile)
+	{
+		auto value = [arg](std::string_view prefix) { return std::stod(std::string(arg.substr(prefix.size()))); };
+		auto micros = [](double ms) { return std::chrono::microseconds(static_cast<std::int64_t>(ms * 1000)); };
+
+		if (arg.starts_with("--wan-rtt-ms=")) profile.rtt = micros(value("--wan-rtt-ms="));
+		else if (arg.starts_with("--wan-jitter-ms=")) profile.jitter = micros(value("--wan-jitter-ms="));
+		else if (arg.starts_with("--wan-mbit=")) profile.bandwidthBitsPerSecond = static_cast<std::uint64_t>(value("--wan-mbit=") * 1e6);
+		else if (arg.starts_with("--wan-loss=")) profile.lossRate = std::clamp(value("--wan-loss=") / 100, 0.0, 1.0);
+		else if (arg.starts_with("--wan-queue-kb=")) profile.queueBytes = static_cast<std::size_t>(value("--wan-queue-kb=")) * 1024;
+		else return false;
+
+		return true;
+	}
+
+	// A TCP relay on loopback that makes the path through it look like a
+	// WAN: Client connects to port(), the emulator connects on to 'target'
+	// (a Server in the same process, usually) and forwards both ways, each
+	// segment read held for half the RTT plus jitter, after the bottleneck
+	// serialized it at the profile's rate. Delivery stays in order, as TCP's
+	// is: jitter delays what follows rather than reordering it. A lost
+	// segment arrives one RTT late, the head-of-line stall of a fast
+	// retransmit; the sender's congestion response to the loss is not
+	// emulated, as its kernel never sees one. For benchmarks without netem
+	// or root; run it on an io_context of its own so its timers stay on time.
+	class WanEmulator
+	{
+	public:
+		WanEmulator(asio::io_context& io, asio::ip::tcp::endpoint target, WanProfile profile)
+			: m_io(io),
+			m_acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0)),
+			m_target(target),
+			m_state(std::make_shared<State>(profile))
+		{
+			asio::co_spawn(m_acceptor.get_executor(), accept(), asio::detached);
+		}
+
+		~WanEmulator() { stop(); }
+
+		WanEmulator(const WanEmulator&) = delete;
+		WanEmulator& operator=(const WanEmulator&) = delete;
+
+		std::uint16_t port() const { return m_acceptor.local_endpoint().port(); }
+
+		// Stops accepting; relayed connections run on until either end closes
+		void stop()
+		{
+			std::error_code ignored;
+			m_acceptor.close(ignored);
+		}
+
+	private:
+		static constexpr std::size_t SEGMENT_SIZE = 64 * 1024;
+
+		// Shared by every relayed connection: one seeded generator
+		struct State
+		{
+			explicit State(const WanProfile& p) : profile(p), rng(p.seed) {}
+
+			WanProfile profile;
+			std::mt19937_64 rng;
+		};
+
+		// One direction of one connection: the bottleneck and the segments on the wire
+		struct Pipe
+		{
+			Pipe(asio::ip::tcp::socket& from, asio::ip::tcp::socket& to)
+				: from(from), to(to), ready(to.get_executor()), space(to.get_executor())
+			{
+				ready.expires_at(asio::steady_timer::time_point::max());
+				space.expires_at(asio::steady_timer::time_point::max());
+			}
+
+			struct Segment
+			{
+				std::chrono::steady_clock::time_point arrival;
+				std::vector<std::uint8_t> data; // Empty: the sender shut down
+			};
+
+			asio::ip::tcp::socket& from;
+			asio::ip::tcp::socket& to;
+			std::deque<Segment> wire;
+			std::size_t queued = 0;
+			std::chrono::steady_clock::time_point linkFree{};   // The bottleneck is sending until then
+			std::chrono::steady_clock::time_point lastArrival{};
+			asio::steady_timer ready; // Cancelled when a segment is queued
+			asio::steady_timer space; // Cancelled when one is delivered
+		};
+
+		// Both sockets and both directions; owned by the coroutines relaying it
+		struct Link
+		{
+			explicit Link(asio::io_context& io) : client(io), server(io), up(client, server), down(server, client) {}
+
+			void close()
+			{
+				std::error_code ignored;
+				client.close(ignored);
+				server.close(ignored);
+				for (Pipe* pipe : { &up, &down }) {
+					pipe->ready.cancel();
+					pipe->space.cancel();
+				}
+			}
+
+			asio::ip::tcp::socket client;
+			asio::ip::tcp::socket server;
+			Pipe up;
+			Pipe down;
+		};
+
+		asio::awaitable<void> accept()
+		{
+			for (;;) {
+				auto link = std::make_shared<Link>(m_io);
+				std::error_code ec;
+				co_await m_acceptor.async_accept(link->client, asio::redirect_error(asio::use_awaitable, ec));
+				if (ec == asio::error::operation_aborted || !m_acceptor.is_open()) co_return;
+				if (ec) continue;
+
+				co_await link->server.async_connect(m_target, asio::redirect_error(asio::use_awaitable, ec));
+				if (ec) {
+					CW_LOG_WARN("[WAN] Cannot reach ", m_target.address().to_string(), ":", m_target.port(), ": ", ec.message());
+					link->close();
+					continue;
+				}
+				for (auto* socket : { &link->client, &link->server }) socket->set_option(asio::ip::tcp::no_delay(true), ec);
+
+				for (Pipe* pipe : { &link->up, &link->down }) {
+					asio::co_spawn(m_acceptor.get_executor(), read(link, *pipe, m_state), asio::detached);
+					asio::co_spawn(m_acceptor.get_executor(), deliver(link, *pipe), asio::detached);
+				}
+			}
+		}
+
+		// Takes in what the sender sends while the bottleneck's buffer has room.
+		// 'link' keeps 'pipe' alive while this runs.
+		static asio::awaitable<void> read([[maybe_unused]] std::shared_ptr<Link> link, Pipe& pipe, std::shared_ptr<State> state)
+		{
+			const WanProfile& profile = state->profile;
+			for (;;) {
+				while (pipe.queued >= profile.queueBytes) {
+					std::error_code ec;
+					co_await pipe.space.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+					pipe.space.expires_at(asio::steady_timer::time_point::max());
+					if (!pipe.from.is_open()) co_return;
+				}
+
+				std::vector<std::uint8_t> data(SEGMENT_SIZE);
+				std::error_code ec;
+				std::size_t n = co_await pipe.from.async_read_some(asio::buffer(data), asio::redirect_error(asio::use_awaitable, ec));
+				data.resize(n);
+
+				auto now = std::chrono::steady_clock::now();
+				auto departure = std::max(now, pipe.linkFree);
+				if (profile.bandwidthBitsPerSecond > 0) {
+					departure += std::chrono::nanoseconds(static_cast<std::int64_t>(n * 8 * 1'000'000'000ull / profile.bandwidthBitsPerSecond));
+				}
+				pipe.linkFree = departure;
+
+				auto arrival = departure + profile.rtt / 2;
+				if (profile.jitter.count() > 0) {
+					arrival += std::chrono::microseconds(static_cast<std::int64_t>(state->rng() % static_cast<std::uint64_t>(profile.jitter.count() + 1)));
+				}
+				if (profile.lossRate > 0 && std::uniform_real_distribution<double>(0, 1)(state->rng) < profile.lossRate) arrival += profile.rtt;
+				arrival = std::max(arrival, pipe.lastArrival);
+				pipe.lastArrival = arrival;
+
+				pipe.queued += n;
+				pipe.wire.push_back({ arrival, std::move(data) });
+				pipe.ready.cancel();
+				if (ec) co_return; // The empty segment passes the end on
+			}
+		}
+
+		// Hands each segment to the receiver once it has crossed the path
+		static asio::awaitable<void> deliver(std::shared_ptr<Link> link, Pipe& pipe)
+		{
+			asio::steady_timer clock(pipe.to.get_executor());
+			for (;;) {
+				while (pipe.wire.empty()) {
+					std::error_code ec;
+					co_await pipe.ready.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+					pipe.ready.expires_at(asio::steady_timer::time_point::max());
+					if (!pipe.to.is_open()) co_return;
+				}
+
+				auto& segment = pipe.wire.front();
+				clock.expires_at(segment.arrival);
+				std::error_code ec;
+				co_await clock.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+
+				if (segment.data.empty()) {
+					// Half-close, as the sender did; the other direction carries on
+					pipe.to.shutdown(asio::socket_base::shutdown_send, ec);
+					co_return;
+				}
+
+				co_await asio::async_write(pipe.to, asio::buffer(segment.data), asio::redirect_error(asio::use_awaitable, ec));
+				if (ec) {
+					link->close();
+					co_return;
+				}
+				pipe.queued -= segment.data.size();
+				pipe.wire.pop_front();
+				pipe.space.cancel();
+			}
+		}
+
+		asio::io_context& m_io;
+		asio::ip::tcp::acceptor m_acceptor;
+		asio::ip::tcp::endpoint m_target;
+		std::shared_ptr<State> m_state;
+	};
+}
@@ -0,0 +1,440 @@
+#pragma once
+#include <asio.hpp>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+
+#include "cw/endian.h"
+
+#if defined(__linux__)
+#include <atomic>
+#include <cerrno>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+#endif
+
+namespace cw::network {
+
+	// Ethernet + IPv4 + UDP framing, for datagrams that bypass the kernel's
+	// stack (XdpSocket). IPv4 without options or fragments only.
+	namespace xdp {
+
+		static constexpr std::size_t ETHERNET_HEADER_SIZE = 14;
+		static constexpr std::size_t HEADERS_SIZE = ETHERNET_HEADER_SIZE + 20 + 8;
+		static constexpr std::uint16_t ETHERTYPE_IPV4 = 0x0800;
+		static constexpr std::uint8_t PROTOCOL_UDP = 17;
+
+		using MacAddress = std::array<std::uint8_t, 6>;
+
+		// One end of a frame
+		struct Address
+		{
+			MacAddress mac{};
+			asio::ip::udp::endpoint endpoint;
+		};
+
+		// One's complement sum of 16-bit words, not yet folded
+		inline std::uint32_t checksumAdd(const std::uint8_t* data, std::size_t length, std::uint32_t sum = 0)
+		{
+			for (; length > 1; data += 2, length -= 2) sum += static_cast<std::uint32_t>(data[0] << 8 | data[1]);
+			if (length) sum += static_cast<std::uint32_t>(data[0] << 8);
+			return sum;
+		}
+
+		inline std::uint16_t checksumFold(std::uint32_t sum)
+		{
+			while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+			return static_cast<std::uint16_t>(~sum);
+		}
+
+		// UDP checksum over the pseudo header and 'udp' (header and payload)
+		inline std::uint16_t udpChecksum(std::uint32_t source, std::uint32_t destination, const std::uint8_t* udp, std::size_t length)
+		{
+			std::uint32_t sum = (source >> 16) + (source & 0xFFFF) + (destination >> 16) + (destination & 0xFFFF);
+			sum += PROTOCOL_UDP + static_cast<std::uint32_t>(length);
+			std::uint16_t checksum = checksumFold(checksumAdd(udp, length, sum));
+			return checksum == 0 ? 0xFFFF : checksum; // 0 means "none"
+		}
+
+		// Headers in front of the 'length' payload bytes already at out + HEADERS_SIZE
+		inline void writeHeaders(std::uint8_t* out, const Address& from, const Address& to, std::size_t length, std::uint16_t id)
+		{
+			using cw::binary::writeBigEndian;
+			std::memcpy(out, to.mac.data(), 6);
+			std::memcpy(out + 6, from.mac.data(), 6);
+			writeBigEndian<std::uint16_t>(out + 12, ETHERTYPE_IPV4);
+
+			std::uint8_t* ip = out + ETHERNET_HEADER_SIZE;
+			std::uint32_t source = from.endpoint.address().to_v4().to_uint();
+			std::uint32_t destination = to.endpoint.address().to_v4().to_uint();
+			ip[0] = 0x45; // Version 4, 5 words
+			ip[1] = 0;
+			writeBigEndian<std::uint16_t>(ip + 2, static_cast<std::uint16_t>(20 + 8 + length));
+			writeBigEndian<std::uint16_t>(ip + 4, id);
+			writeBigEndian<std::uint16_t>(ip + 6, 0x4000); // Don't fragment
+			ip[8] = 64;
+			ip[9] = PROTOCOL_UDP;
+			writeBigEndian<std::uint16_t>(ip + 10, 0);
+			writeBigEndian<std::uint32_t>(ip + 12, source);
+			writeBigEndian<std::uint32_t>(ip + 16, destination);
+			writeBigEndian<std::uint16_t>(ip + 10, checksumFold(checksumAdd(ip, 20)));
+
+			std::uint8_t* udp = ip + 20;
+			writeBigEndian<std::uint16_t>(udp, from.endpoint.port());
+			writeBigEndian<std::uint16_t>(udp + 2, to.endpoint.port());
+			writeBigEndian<std::uint16_t>(udp + 4, static_cast<std::uint16_t>(8 + length));
+			writeBigEndian<std::uint16_t>(udp + 6, 0);
+			writeBigEndian<std::uint16_t>(udp + 6, udpChecksum(source, destination, udp, 8 + length));
+		}
+
+		// The UDP payload of 'frame', with both ends; nullopt for anything
+		// else, a fragment or a bad checksum
+		inline std::optional<std::span<const std::uint8_t>> parseFrame(std::span<const std::uint8_t> frame, Address& from, Address& to)
+		{
+			using cw::binary::readBigEndian;
+			if (frame.size() < HEADERS_SIZE) return std::nullopt;
+			if (readBigEndian<std::uint16_t>(frame.data() + 12) != ETHERTYPE_IPV4) return std::nullopt;
+
+			const std::uint8_t* ip = frame.data() + ETHERNET_HEADER_SIZE;
+			std::size_t ipHeader = static_cast<std::size_t>(ip[0] & 0x0F) * 4;
+			if ((ip[0] >> 4) != 4 || ipHeader < 20 || ip[9] != PROTOCOL_UDP) return std::nullopt;
+			if (readBigEndian<std::uint16_t>(ip + 6) & 0x3FFF) return std::nullopt; // More fragments, or an offset
+			std::size_t total = readBigEndian<std::uint16_t>(ip + 2);
+			if (total < ipHeader + 8 || ETHERNET_HEADER_SIZE + total > frame.size()) return std::nullopt;
+			if (checksumFold(checksumAdd(ip, ipHeader)) != 0) return std::nullopt;
+
+			const std::uint8_t* udp = ip + ipHeader;
+			std::size_t length = readBigEndian<std::uint16_t>(udp + 4);
+			if (length < 8 || length > total - ipHeader) return std::nullopt;
+
+			std::uint32_t source = readBigEndian<std::uint32_t>(ip + 12);
+			std::uint32_t destination = readBigEndian<std::uint32_t>(ip + 16);
+			if (readBigEndian<std::uint16_t>(udp + 6) != 0) {
+				std::uint32_t sum = (source >> 16) + (source & 0xFFFF) + (destination >> 16) + (destination & 0xFFFF);
+				sum += PROTOCOL_UDP + static_cast<std::uint32_t>(length);
+				if (checksumFold(checksumAdd(udp, length, sum)) != 0) return std::nullopt;
+			}
+
+			std::memcpy(to.mac.data(), frame.data(), 6);
+			std::memcpy(from.mac.data(), frame.data() + 6, 6);
+			from.endpoint = { asio::ip::address_v4(source), readBigEndian<std::uint16_t>(udp) };
+			to.endpoint = { asio::ip::address_v4(destination), readBigEndian<std::uint16_t>(udp + 2) };
+			return std::span<const std::uint8_t>(udp + 8, length - 8);
+		}
+	}
+
+#if defined(__linux__)
+	// Kernel bypass for the UDP tunnel (UdpTunnelOptions::xdpInterface): an
+	// AF_XDP socket on one queue of a NIC. Frames land in UMEM, memory this
+	// process shares with the driver (which DMAs into it in zero-copy mode),
+	// and the tunnel reads its datagrams where they landed; the Ethernet, IP
+	// and UDP headers are read and written here instead of by the kernel.
+	//
+	// Needs an XDP program on the interface that redirects the tunnel's
+	// datagrams on that queue (to the listening port; at the dialing end,
+	// from the remote's) into an XSKMAP pinned on bpffs, and passes the rest
+	// on; this socket puts itself into the map at its queue. The NIC's flow
+	// steering must put those datagrams on the queue. IPv4 only and no IP
+	// fragments: for dedicated links where both ends are ours. Takes
+	// CAP_NET_RAW and CAP_BPF (or root).
+	//
+	// A peer's next-hop hardware address is learned from its datagrams, so
+	// a peer that has not sent anything yet is reached through the kernel
+	// (hasRoute). Not thread-safe: the tunnel uses it from its strand.
+	class XdpSocket
+	{
+	public:
+		static constexpr std::uint32_t FRAME_SIZE = 4096;
+		// Entries of each ring; as many frames for receiving, as many for sending
+		static constexpr std::uint32_t RING_SIZE = 2048;
+
+		// Binds to 'queue' of 'interface' for datagrams to 'port'; throws std::system_error
+		XdpSocket(const std::string& interface, std::uint32_t queue, const std::string& mapPath, std::uint16_t port)
+		{
+			try {
+				open(interface, queue, mapPath, port);
+			}
+			catch (...) {
+				release();
+				throw;
+			}
+		}
+
+		~XdpSocket() { release(); }
+
+		XdpSocket(const XdpSocket&) = delete;
+		XdpSocket& operator=(const XdpSocket&) = delete;
+
+		// Readable when frames arrived
+		int fd() const { return m_fd; }
+
+		// Whether the driver DMAs straight into UMEM (else it copies, XDP_COPY)
+		bool zeroCopy() const { return m_zeroCopy; }
+
+		// Largest UDP payload a frame carries on this interface
+		std::size_t maxDatagram() const { return std::min<std::size_t>(FRAME_SIZE, m_mtu + xdp::ETHERNET_HEADER_SIZE) - xdp::HEADERS_SIZE; }
+
+		// Calls fn(from, payload) for each datagram that arrived, the payload
+		// in UMEM and valid only during the call (fn must not throw); then
+		// gives the frames back to the driver. Returns how many there were.
+		template<typename Function>
+		std::size_t receive(Function&& fn)
+		{
+			std::size_t count = 0;
+			for (;;) {
+				std::uint32_t consumer = m_rx.consumer();
+				std::uint32_t available = m_rx.producer() - consumer;
+				if (available == 0) break;
+
+				std::uint32_t fill = m_fill.producer();
+				for (std::uint32_t i = 0; i < available; ++i) {
+					const xdp_desc& desc = m_rx.entry<xdp_desc>(consumer + i);
+					xdp::Address from, to;
+					auto payload = xdp::parseFrame({ m_umem + desc.addr, desc.len }, from, to);
+					if (payload && to.endpoint == m_local.endpoint) {
+						m_routes[from.endpoint.address().to_v4().to_uint()] = from.mac;
+						fn(from.endpoint, *payload);
+					}
+					m_fill.entry<std::uint64_t>(fill + i) = desc.addr & ~std::uint64_t(FRAME_SIZE - 1);
+				}
+				m_rx.release(consumer + available);
+				m_fill.submit(fill + available);
+				count += available;
+			}
+			if (m_fill.needsWakeup()) ::recvfrom(m_fd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+			return count;
+		}
+
+		// Whether 'to' can be reached through this socket: an IPv4 peer we heard from
+		bool hasRoute(const asio::ip::udp::endpoint& to) const
+		{
+			return to.address().is_v4() && m_routes.contains(to.address().to_v4().to_uint());
+		}
+
+		// Queues 'payload' (one copy into a UMEM frame) for sending to 'to',
+		// which hasRoute; false while every frame is in flight
+		bool send(const asio::ip::udp::endpoint& to, std::span<const std::uint8_t> payload)
+		{
+			reclaim();
+			if (m_freeTx.empty() || payload.size() > maxDatagram()) return false;
+
+			std::uint64_t addr = m_freeTx.back();
+			m_freeTx.pop_back();
+			std::uint8_t* frame = m_umem + addr;
+			std::memcpy(frame + xdp::HEADERS_SIZE, payload.data(), payload.size());
+			xdp::writeHeaders(frame, m_local, { m_routes.at(to.address().to_v4().to_uint()), to }, payload.size(), m_nextId++);
+
+			std::uint32_t producer = m_tx.producer();
+			m_tx.entry<xdp_desc>(producer) = { addr, static_cast<std::uint32_t>(xdp::HEADERS_SIZE + payload.size()), 0 };
+			m_tx.submit(producer + 1);
+			// Copy mode transmits in the syscall; zero copy only when the driver went idle
+			if (!m_zeroCopy || m_tx.needsWakeup()) ::sendto(m_fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+			return true;
+		}
+
+	private:
+		// One of the four rings shared with the kernel: a producer and a
+		// consumer index and the entries, in memory mapped from the socket
+		class Ring
+		{
+		public:
+			void map(int fd, const xdp_ring_offset& offsets, off_t pageOffset, std::size_t entrySize)
+			{
+				m_size = offsets.desc + RING_SIZE * entrySize;
+				void* mapped = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pageOffset);
+				if (mapped == MAP_FAILED) {
+					m_size = 0;
+					throw std::system_error(errno, std::system_category(), "mmap AF_XDP ring");
+				}
+				m_map = static_cast<std::uint8_t*>(mapped);
+				m_producer = reinterpret_cast<std::uint32_t*>(m_map + offsets.producer);
+				m_consumer = reinterpret_cast<std::uint32_t*>(m_map + offsets.consumer);
+				m_flags = reinterpret_cast<std::uint32_t*>(m_map + offsets.flags);
+				m_entries = m_map + offsets.desc;
+			}
+
+			void unmap()
+			{
+				if (m_map) ::munmap(m_map, m_size);
+				m_map = nullptr;
+			}
+
+			std::uint32_t producer() const { return std::atomic_ref(*m_producer).load(std::memory_order_acquire); }
+			std::uint32_t consumer() const { return std::atomic_ref(*m_consumer).load(std::memory_order_acquire); }
+
+			template<typename T>
+			T& entry(std::uint32_t index) { return reinterpret_cast<T*>(m_entries)[index & (RING_SIZE - 1)]; }
+
+			// Entries up to 'producer' filled in, for the kernel
+			void submit(std::uint32_t producer) { std::atomic_ref(*m_producer).store(producer, std::memory_order_release); }
+			// Entries up to 'consumer' read, back to the kernel
+			void release(std::uint32_t consumer) { std::atomic_ref(*m_consumer).store(consumer, std::memory_order_release); }
+
+			bool needsWakeup() const { return std::atomic_ref(*m_flags).load(std::memory_order_relaxed) & XDP_RING_NEED_WAKEUP; }
+
+		private:
+			std::uint8_t* m_map = nullptr;
+			std::size_t m_size = 0;
+			std::uint32_t* m_producer = nullptr;
+			std::uint32_t* m_consumer = nullptr;
+			std::uint32_t* m_flags = nullptr;
+			std::uint8_t* m_entries = nullptr;
+		};
+
+		[[noreturn]] static void fail(const char* what) { throw std::system_error(errno, std::system_category(), what); }
+
+		template<typename T>
+		void setOption(int name, const T& value, const char* what)
+		{
+			if (::setsockopt(m_fd, SOL_XDP, name, &value, sizeof(value)) != 0) fail(what);
+		}
+
+		void open(const std::string& interface, std::uint32_t queue, const std::string& mapPath, std::uint16_t port)
+		{
+			unsigned ifindex = ::if_nametoindex(interface.c_str());
+			if (ifindex == 0) fail("unknown interface");
+			readInterface(interface);
+			m_local.endpoint.port(port);
+
+			m_umemSize = std::size_t(FRAME_SIZE) * RING_SIZE * 2;
+			void* umem = ::mmap(nullptr, m_umemSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+			if (umem == MAP_FAILED) fail("mmap UMEM");
+			m_umem = static_cast<std::uint8_t*>(umem);
+
+			m_fd = ::socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+			if (m_fd < 0) fail("socket(AF_XDP)");
+
+			xdp_umem_reg reg{};
+			reg.addr = reinterpret_cast<std::uint64_t>(m_umem);
+			reg.len = m_umemSize;
+			reg.chunk_size = FRAME_SIZE;
+			setOption(XDP_UMEM_REG, reg, "XDP_UMEM_REG");
+			setOption(XDP_UMEM_FILL_RING, RING_SIZE, "XDP_UMEM_FILL_RING");
+			setOption(XDP_UMEM_COMPLETION_RING, RING_SIZE, "XDP_UMEM_COMPLETION_RING");
+			setOption(XDP_RX_RING, RING_SIZE, "XDP_RX_RING");
+			setOption(XDP_TX_RING, RING_SIZE, "XDP_TX_RING");
+
+			xdp_mmap_offsets offsets{};
+			socklen_t length = sizeof(offsets);
+			if (::getsockopt(m_fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &length) != 0) fail("XDP_MMAP_OFFSETS");
+			m_fill.map(m_fd, offsets.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(std::uint64_t));
+			m_completion.map(m_fd, offsets.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(std::uint64_t));
+			m_rx.map(m_fd, offsets.rx, XDP_PGOFF_RX_RING, sizeof(xdp_desc));
+			m_tx.map(m_fd, offsets.tx, XDP_PGOFF_TX_RING, sizeof(xdp_desc));
+
+			// The first half of UMEM for the driver to receive into, the second for sending
+			for (std::uint32_t i = 0; i < RING_SIZE; ++i) m_fill.entry<std::uint64_t>(i) = std::uint64_t(i) * FRAME_SIZE;
+			m_fill.submit(RING_SIZE);
+			for (std::uint32_t i = 0; i < RING_SIZE; ++i) m_freeTx.push_back(std::uint64_t(RING_SIZE + i) * FRAME_SIZE);
+
+			sockaddr_xdp address{};
+			address.sxdp_family = AF_XDP;
+			address.sxdp_ifindex = ifindex;
+			address.sxdp_queue_id = queue;
+			address.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+			if (::bind(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+				// The driver has no zero-copy support: it copies into UMEM instead
+				address.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+				m_zeroCopy = false;
+				if (::bind(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) fail("bind AF_XDP");
+			}
+
+			// Into the redirecting program's map, at our queue
+			bpf_attr attr{};
+			attr.pathname = reinterpret_cast<std::uint64_t>(mapPath.c_str());
+			int map = static_cast<int>(::syscall(__NR_bpf, BPF_OBJ_GET, &attr, sizeof(attr)));
+			if (map < 0) fail("open XSKMAP");
+			attr = {};
+			attr.map_fd = static_cast<std::uint32_t>(map);
+			attr.key = reinterpret_cast<std::uint64_t>(&queue);
+			attr.value = reinterpret_cast<std::uint64_t>(&m_fd);
+			attr.flags = BPF_ANY;
+			long updated = ::syscall(__NR_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr));
+			int error = errno;
+			::close(map);
+			if (updated != 0) {
+				errno = error;
+				fail("update XSKMAP");
+			}
+		}
+
+		// Our hardware and IPv4 address and the MTU
+		void readInterface(const std::string& interface)
+		{
+			int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+			if (fd < 0) fail("socket");
+			ifreq request{};
+			interface.copy(request.ifr_name, IFNAMSIZ - 1);
+			bool ok = ::ioctl(fd, SIOCGIFHWADDR, &request) == 0;
+			if (ok) std::memcpy(m_local.mac.data(), request.ifr_hwaddr.sa_data, 6);
+			ok = ok && ::ioctl(fd, SIOCGIFADDR, &request) == 0;
+			if (ok) {
+				const auto* in = reinterpret_cast<const sockaddr_in*>(&request.ifr_addr);
+				m_local.endpoint.address(asio::ip::address_v4(ntohl(in->sin_addr.s_addr)));
+			}
+			ok = ok && ::ioctl(fd, SIOCGIFMTU, &request) == 0;
+			if (ok) m_mtu = static_cast<std::size_t>(request.ifr_mtu);
+			int error = errno;
+			::close(fd);
+			if (!ok) {
+				errno = error;
+				fail("interface address");
+			}
+		}
+
+		// Frames the driver finished sending, free again
+		void reclaim()
+		{
+			std::uint32_t consumer = m_completion.consumer();
+			std::uint32_t available = m_completion.producer() - consumer;
+			for (std::uint32_t i = 0; i < available; ++i) m_freeTx.push_back(m_completion.entry<std::uint64_t>(consumer + i));
+			if (available) m_completion.release(consumer + available);
+		}
+
+		void release()
+		{
+			m_rx.unmap();
+			m_tx.unmap();
+			m_fill.unmap();
+			m_completion.unmap();
+			if (m_fd >= 0) ::close(m_fd);
+			m_fd = -1;
+			if (m_umem) ::munmap(m_umem, m_umemSize);
+			m_umem = nullptr;
+		}
+
+		int m_fd = -1;
+		bool m_zeroCopy = true;
+		std::uint8_t* m_umem = nullptr;
+		std::size_t m_umemSize = 0;
+		Ring m_fill, m_completion, m_rx, m_tx;
+		std::vector<std::uint64_t> m_freeTx; // Sending frames not in flight
+
+		xdp::Address m_local;
+		std::size_t m_mtu = 1500;
+		std::uint16_t m_nextId = 0;
+		std::unordered_map<std::uint32_t, xdp::MacAddress> m_routes; // Next hop by peer IPv4 address
+	};
+#endif
+}
@@ -0,0 +1,106 @@
+#pragma once
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#endif
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+
+#include "cw/Frame.h"
+#include "cw/buffer/buffer_pool.h"
+
+namespace cw::network {
+
+	// MSG_ZEROCOPY bookkeeping for one socket (SocketOptions::zeroCopy). A
+	// zero-copy send pins the pages it was given instead of copying them, so
+	// the frames written by it (header and payload block) are held here
+	// until the kernel is done with them. The kernel numbers the zero-copy
+	// sends of a socket from 0 and reports ranges of them done on the
+	// socket's error queue; TCP completes them in order, so one counter of
+	// the sends done is enough.
+	class ZeroCopyTracker
+	{
+	public:
+		// A payload smaller than this is copied: pinning its pages and taking
+		// the notification cost more than copying a few KB
+		static constexpr std::size_t MIN_PAYLOAD = 16 * 1024;
+
+		// Whether SO_ZEROCOPY is set on 'socket'
+		static bool enabledOn(int socket)
+		{
+			int enabled = 0;
+			socklen_t size = sizeof(enabled);
+			return ::getsockopt(socket, SOL_SOCKET, SO_ZEROCOPY, &enabled, &size) == 0 && enabled != 0;
+		}
+
+		// A send made with MSG_ZEROCOPY
+		void onSent() { ++m_sent; }
+		std::uint32_t sent() const { return m_sent; }
+
+		// 'frame' went out (in part) by the zero-copy sends made so far
+		void hold(cw::packet::OutgoingFrame frame)
+		{
+			m_held.push_back(Held{ m_sent, std::move(frame) });
+		}
+
+		std::size_t held() const { return m_held.size(); }
+
+		// The kernel copied a send after all (loopback, a device without
+		// scatter-gather): zero-copy only adds cost on this socket
+		bool copied() const { return m_copied; }
+
+		// Reads the notifications queued on 'socket', without waiting, and
+		// releases the frames of every send they complete
+		void reap(int socket)
+		{
+			for (;;) {
+				alignas(cmsghdr) char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+				msghdr msg{};
+				msg.msg_control = control;
+				msg.msg_controllen = sizeof(control);
+				if (::recvmsg(socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+					if (errno == EINTR) continue;
+					break;
+				}
+
+				for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+					bool recvErr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+					if (!recvErr) continue;
+					const auto* err = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+					if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0) continue;
+
+					// [ee_info, ee_data] are done
+					m_done = err->ee_data + 1;
+					if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) m_copied = true;
+				}
+			}
+
+			// Sends are numbered modulo 2^32
+			while (!m_held.empty() && static_cast<std::int32_t>(m_done - m_held.front().sends) >= 0) {
+				cw::buffer::HeaderPool::release(std::move(m_held.front().frame.header));
+				m_held.pop_front();
+			}
+		}
+
+		// The socket is closed: nothing will be reported
+		void clear() { m_held.clear(); }
+
+	private:
+		struct Held
+		{
+			std::uint32_t sends; // Released once this many sends are done
+			cw::packet::OutgoingFrame frame;
+		};
+
+		std::deque<Held> m_held;
+		std::uint32_t m_sent = 0;
+		std::uint32_t m_done = 0;
+		bool m_copied = false;
+	};
+}
+#endif
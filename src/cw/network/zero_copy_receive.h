@@ -0,0 +1,99 @@
+#pragma once
+#if !defined(_WIN32)
+#include <netinet/tcp.h>
+#endif
+#if defined(TCP_ZEROCOPY_RECEIVE)
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cw/buffer/shared_buffer.h"
+
+namespace cw::network {
+
+	// Address space that TCP_ZEROCOPY_RECEIVE maps received pages into
+	// (Connection::setZeroCopyReceive): the kernel hands over the pages the
+	// NIC wrote the payload into instead of copying them out. Only whole,
+	// page-aligned pages of payload map, which takes an MTU of 4 KB of
+	// payload or more, or a NIC that splits headers; the bytes around them
+	// are read with recv. The region is unmapped once the last piece of it
+	// is released (after the disk pool wrote it).
+	class MappedReceive : public std::enable_shared_from_this<MappedReceive>
+	{
+	public:
+		// Mapping pays for its page table updates from chunks this large
+		static constexpr std::size_t MIN_CHUNK = 1024 * 1024;
+
+		static std::size_t pageSize()
+		{
+			static const std::size_t size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+			return size;
+		}
+
+		// Whether 'socket' can be mapped at all (a TCP socket, a kernel with
+		// TCP_ZEROCOPY_RECEIVE)
+		static bool supportedOn(int socket)
+		{
+			return reserve(socket, pageSize()) != nullptr;
+		}
+
+		// Room for 'length' bytes of 'socket'; null if the kernel refuses
+		static std::shared_ptr<MappedReceive> reserve(int socket, std::size_t length)
+		{
+			std::size_t size = (length + pageSize() - 1) / pageSize() * pageSize();
+			void* address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, socket, 0);
+			if (address == MAP_FAILED) return nullptr;
+			return std::shared_ptr<MappedReceive>(new MappedReceive(static_cast<std::uint8_t*>(address), size));
+		}
+
+		~MappedReceive() { ::munmap(m_address, m_size); }
+
+		MappedReceive(const MappedReceive&) = delete;
+		MappedReceive& operator=(const MappedReceive&) = delete;
+
+		// Maps the next received bytes of 'socket', up to 'want' rounded down
+		// to whole pages, after what this region holds already. 'piece' is
+		// what was mapped (empty if nothing was); 'skip' how many bytes have
+		// to be read with recv before more can map. Both empty: nothing has
+		// arrived.
+		std::error_code map(int socket, std::size_t want, cw::buffer::SharedBuffer& piece, std::size_t& skip)
+		{
+			piece = {};
+			skip = 0;
+			std::size_t pages = std::min(want, m_size - m_used) / pageSize() * pageSize();
+			if (pages == 0) {
+				skip = want;
+				return {};
+			}
+
+			tcp_zerocopy_receive zc{};
+			zc.address = reinterpret_cast<std::uint64_t>(m_address + m_used);
+			zc.length = static_cast<std::uint32_t>(pages);
+			socklen_t size = sizeof(zc);
+			if (::getsockopt(socket, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &zc, &size) != 0) return { errno, std::system_category() };
+
+			if (zc.length != 0) {
+				piece = cw::buffer::SharedBuffer(shared_from_this(), std::span<const std::uint8_t>(m_address + m_used, zc.length));
+				m_used += zc.length;
+			}
+			skip = zc.recv_skip_hint;
+			return {};
+		}
+
+	private:
+		MappedReceive(std::uint8_t* address, std::size_t size) : m_address(address), m_size(size) {}
+
+		std::uint8_t* m_address;
+		std::size_t m_size;
+		std::size_t m_used = 0; // Mapped so far
+	};
+}
+#endif
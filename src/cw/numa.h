@@ -0,0 +1,141 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+#include "cw/log/logger.h"
+
+namespace cw::numa {
+
+	// NUMA placement from what Linux publishes in sysfs, without libnuma: which
+	// node a NIC or a disk hangs off, which CPUs belong to a node, and pinning a
+	// thread's CPUs and page allocations to it. Elsewhere every device is on
+	// node 0 of one and pinning does nothing. Best effort, like core pinning:
+	// a failure only costs locality, so it is logged and ignored.
+
+	// "0-3,8,10-11" (a sysfs cpulist) as the CPUs it names; empty if malformed
+	inline std::vector<std::size_t> parseCpuList(const std::string& list)
+	{
+		std::vector<std::size_t> cpus;
+		std::size_t pos = 0;
+		while (pos < list.size()) {
+			std::size_t end = list.find(',', pos);
+			if (end == std::string::npos) end = list.size();
+			std::string range = list.substr(pos, end - pos);
+			while (!range.empty() && (range.back() == '\n' || range.back() == ' ')) range.pop_back();
+			pos = end + 1;
+			if (range.empty()) continue;
+
+			try {
+				std::size_t dash = range.find('-');
+				std::size_t first = std::stoul(range.substr(0, dash));
+				std::size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+				if (last < first) return {};
+				for (std::size_t cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+			}
+			catch (const std::exception&) {
+				return {};
+			}
+		}
+		return cpus;
+	}
+
+	namespace detail {
+
+		// A sysfs numa_node file: -1 (no affinity) reads as nullopt
+		inline std::optional<int> readNode(const std::filesystem::path& file)
+		{
+			std::ifstream in(file);
+			int node = -1;
+			if (!(in >> node) || node < 0) return std::nullopt;
+			return node;
+		}
+	}
+
+	// Node of network interface 'name' ("eth0"), if it has one
+	inline std::optional<int> nodeOfInterface(const std::string& name)
+	{
+#if defined(__linux__)
+		return detail::readNode(std::filesystem::path("/sys/class/net") / name / "device" / "numa_node");
+#else
+		(void)name;
+		return std::nullopt;
+#endif
+	}
+
+	// Node of the block device 'path' is stored on, if it has one. A
+	// partition's node is its disk's.
+	inline std::optional<int> nodeOfPath(const std::filesystem::path& path)
+	{
+#if defined(__linux__)
+		struct stat st {};
+		if (::stat(path.c_str(), &st) != 0) return std::nullopt;
+
+		std::error_code ec;
+		auto device = std::filesystem::canonical("/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev)), ec);
+		if (ec) return std::nullopt;
+		if (auto node = detail::readNode(device / "device" / "numa_node")) return node;
+		return detail::readNode(device.parent_path() / "device" / "numa_node");
+#else
+		(void)path;
+		return std::nullopt;
+#endif
+	}
+
+	// CPUs of node 'node'; empty if there is no such node
+	inline std::vector<std::size_t> cpusOfNode(int node)
+	{
+#if defined(__linux__)
+		std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		std::string list;
+		if (!std::getline(in, list)) return {};
+		return parseCpuList(list);
+#else
+		(void)node;
+		return {};
+#endif
+	}
+
+	// Runs the calling thread on 'cpus' and has the pages it faults in come
+	// from 'node' when it has free memory (MPOL_PREFERRED), so the buffers
+	// it fills are local to the CPUs and device that use them
+	inline void pinCurrentThreadToNode(int node, const std::vector<std::size_t>& cpus)
+	{
+#if defined(__linux__)
+		if (!cpus.empty()) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for (std::size_t cpu : cpus) CPU_SET(cpu % CPU_SETSIZE, &set);
+			if (int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); rc != 0) {
+				CW_LOG_WARN("[Numa] Could not pin thread to node ", node, " (error ", rc, ")");
+			}
+		}
+
+		constexpr std::size_t BITS = sizeof(unsigned long) * 8;
+		if (node < 0 || static_cast<std::size_t>(node) >= BITS) return;
+		unsigned long mask = 1ul << node;
+		// maxnode counts one past the last bit the kernel reads
+		if (::syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, BITS + 1) != 0) {
+			CW_LOG_WARN("[Numa] Could not prefer memory of node ", node);
+		}
+#else
+		(void)node;
+		(void)cpus;
+#endif
+	}
+}
@@ -0,0 +1,182 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "../../endian.h"
+
+namespace cw::packet {
+
+	// Optional fields appended to a packet after the last byte its layout
+	// defines, so a field can be added without changing that layout or
+	// bumping the protocol version:
+	//
+	//     [present: u32 bitmap][size: u32][entries: size bytes]
+	//     entry: [type: u8][length: u16][value: length bytes]
+	//
+	// Entries are in ascending type order, each type at most once, and bit
+	// 'type' of 'present' is set for each. A decoder older than the block
+	// never looks past the layout it knows, so it skips the block without
+	// reading it; a newer one answers has() from the bitmap and steps over
+	// entries of types it does not know by their length. No fields, no
+	// block: a packet without any is byte for byte what it was before.
+	// Types are given out per packet type; big-endian like the rest.
+	constexpr std::size_t EXTENSION_TYPES = 32;
+	constexpr std::size_t EXTENSION_BLOCK_HEADER_SIZE = 2 * sizeof(std::uint32_t);
+	constexpr std::size_t EXTENSION_ENTRY_HEADER_SIZE = sizeof(std::uint8_t) + sizeof(std::uint16_t);
+	constexpr std::size_t MAX_EXTENSION_SIZE = UINT16_MAX;
+
+	// The fields of a received packet: a view into the buffer it was parsed
+	// from, valid as long as that buffer is
+	class ExtensionsView
+	{
+	public:
+		ExtensionsView() = default;
+
+		// The block of 'size' bytes at 'data' (none if 'size' is 0). Checks
+		// every entry once, so that lookups need not; throws if corrupt.
+		static ExtensionsView parse(const std::uint8_t* data, std::size_t size)
+		{
+			if (size == 0) return {};
+			if (size < EXTENSION_BLOCK_HEADER_SIZE) throw std::runtime_error("Extensions: block too small.");
+
+			std::uint32_t present = cw::binary::readBigEndian<std::uint32_t>(data);
+			std::uint32_t entriesSize = cw::binary::readBigEndian<std::uint32_t>(data + sizeof(std::uint32_t));
+			if (size - EXTENSION_BLOCK_HEADER_SIZE != entriesSize) throw std::runtime_error("Extensions: size mismatch.");
+
+			ExtensionsView view(present, { data + EXTENSION_BLOCK_HEADER_SIZE, entriesSize });
+			std::uint32_t seen = 0;
+			int last = -1;
+			for (auto entry = view.m_entries; !entry.empty();) {
+				if (entry.size() < EXTENSION_ENTRY_HEADER_SIZE) throw std::runtime_error("Extensions: truncated entry.");
+				std::uint8_t type = entry[0];
+				std::size_t length = cw::binary::readBigEndian<std::uint16_t>(entry.data() + 1);
+				if (type >= EXTENSION_TYPES || type <= last) throw std::runtime_error("Extensions: types out of order.");
+				if (entry.size() - EXTENSION_ENTRY_HEADER_SIZE < length) throw std::runtime_error("Extensions: truncated entry.");
+				seen |= 1u << type;
+				last = type;
+				entry = entry.subspan(EXTENSION_ENTRY_HEADER_SIZE + length);
+			}
+			if (seen != present) throw std::runtime_error("Extensions: presence bitmap mismatch.");
+			return view;
+		}
+
+		bool empty() const noexcept { return m_present == 0; }
+		std::uint32_t present() const noexcept { return m_present; }
+		bool has(std::uint8_t type) const noexcept { return type < EXTENSION_TYPES && (m_present >> type & 1) != 0; }
+
+		// The value of field 'type', if present
+		std::optional<std::span<const std::uint8_t>> find(std::uint8_t type) const noexcept
+		{
+			if (!has(type)) return std::nullopt;
+			for (auto entry = m_entries; !entry.empty();) {
+				std::uint8_t at = entry[0];
+				std::size_t length = cw::binary::readBigEndian<std::uint16_t>(entry.data() + 1);
+				if (at == type) return entry.subspan(EXTENSION_ENTRY_HEADER_SIZE, length);
+				entry = entry.subspan(EXTENSION_ENTRY_HEADER_SIZE + length);
+			}
+			return std::nullopt;
+		}
+
+		// Field 'type' as an integer; nullopt if absent or of another width
+		template<cw::binary::Integer T>
+		std::optional<T> integer(std::uint8_t type) const noexcept
+		{
+			auto value = find(type);
+			if (!value || value->size() != sizeof(T)) return std::nullopt;
+			return cw::binary::readBigEndian<T>(value->data());
+		}
+
+		std::size_t encodedSize() const noexcept { return empty() ? 0 : EXTENSION_BLOCK_HEADER_SIZE + m_entries.size(); }
+
+		// The whole block, fields of unknown types included: a relay passes
+		// on what it could not read itself
+		void write(cw::binary::ByteWriter& out) const noexcept
+		{
+			if (empty()) return;
+			out.write(m_present);
+			out.write(static_cast<std::uint32_t>(m_entries.size()));
+			out.bytes(m_entries.begin(), m_entries.end());
+		}
+
+	private:
+		friend class Extensions;
+
+		ExtensionsView(std::uint32_t present, std::span<const std::uint8_t> entries) noexcept : m_present(present), m_entries(entries) {}
+
+		std::uint32_t m_present = 0;
+		std::span<const std::uint8_t> m_entries;
+	};
+
+	// The fields of a packet being sent. Reads go through view().
+	class Extensions
+	{
+	public:
+		Extensions() = default;
+
+		// A copy of received fields, e.g. to keep them past the receive buffer
+		static Extensions copyOf(const ExtensionsView& view)
+		{
+			Extensions extensions;
+			extensions.m_present = view.m_present;
+			extensions.m_entries.assign(view.m_entries.begin(), view.m_entries.end());
+			return extensions;
+		}
+
+		// Sets field 'type' to 'value', replacing it if present
+		void set(std::uint8_t type, std::span<const std::uint8_t> value)
+		{
+			if (type >= EXTENSION_TYPES) throw std::out_of_range("Extensions: type out of range.");
+			if (value.size() > MAX_EXTENSION_SIZE) throw std::length_error("Extensions: value too long.");
+
+			erase(type);
+			auto at = m_entries.begin() + static_cast<std::ptrdiff_t>(offsetOf(type));
+			std::uint8_t header[EXTENSION_ENTRY_HEADER_SIZE] = { type };
+			cw::binary::writeBigEndian(header + 1, static_cast<std::uint16_t>(value.size()));
+			at = m_entries.insert(at, std::begin(header), std::end(header));
+			m_entries.insert(at + EXTENSION_ENTRY_HEADER_SIZE, value.begin(), value.end());
+			m_present |= 1u << type;
+		}
+
+		template<cw::binary::Integer T>
+		void setInteger(std::uint8_t type, T value)
+		{
+			std::uint8_t bytes[sizeof(T)];
+			cw::binary::writeBigEndian(bytes, value);
+			set(type, bytes);
+		}
+
+		void erase(std::uint8_t type)
+		{
+			if (!view().has(type)) return;
+			std::size_t offset = offsetOf(type);
+			std::size_t length = cw::binary::readBigEndian<std::uint16_t>(m_entries.data() + offset + 1);
+			auto at = m_entries.begin() + static_cast<std::ptrdiff_t>(offset);
+			m_entries.erase(at, at + static_cast<std::ptrdiff_t>(EXTENSION_ENTRY_HEADER_SIZE + length));
+			m_present &= ~(1u << type);
+		}
+
+		ExtensionsView view() const noexcept { return { m_present, m_entries }; }
+		bool empty() const noexcept { return m_present == 0; }
+		std::size_t encodedSize() const noexcept { return view().encodedSize(); }
+		void write(cw::binary::ByteWriter& out) const noexcept { view().write(out); }
+
+	private:
+		// Where the entry of 'type' is, or would go
+		std::size_t offsetOf(std::uint8_t type) const noexcept
+		{
+			std::size_t offset = 0;
+			while (offset < m_entries.size() && m_entries[offset] < type) {
+				offset += EXTENSION_ENTRY_HEADER_SIZE + cw::binary::readBigEndian<std::uint16_t>(m_entries.data() + offset + 1);
+			}
+			return offset;
+		}
+
+		std::uint32_t m_present = 0;
+		std::vector<std::uint8_t> m_entries;
+	};
+}
@@ -1,70 +1,137 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <cstring>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <stdexcept>
 #include <limits>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
 #include "packet_type.h"
 #include "../endian.h"
+#include "wire_layout.h"
+#include "extensions.h"
+#include "cw/buffer/shared_buffer.h"
+#include "cw/file/file_handle.h"
+#include "cw/integrity/chunk_cipher.h"
+#include "cw/integrity/tree_hash.h"
 
 namespace cw::packet
 {
 
 	constexpr size_t MAX_STRING_LENGTH = 4096;        // 4 KB limit for messages/filenames
 	constexpr size_t MAX_CHUNK_SIZE = 10 * 1024 * 1024; // 10 MB limit for file chunks
+	constexpr size_t MAX_BATCH_FILES = 4096;            // Files per FileBatch frame
+	constexpr size_t MAX_MANIFEST_ENTRIES = 1024;       // Files per Manifest frame (fits a frame with maximal names)
+	constexpr size_t MAX_DIRECTORY_ENTRIES = 2048;      // Directories per DirectoryManifest frame (likewise)
+	constexpr size_t MAX_SUBTREE_ENTRIES = 2048;        // Directories per SubtreeDigests frame (likewise)
+	constexpr size_t MAX_DICTIONARY_SIZE = 1024 * 1024; // Bytes of a BatchDictionary
+	constexpr size_t MAX_BATCH_RAW_SIZE = 16 * 1024 * 1024; // Decompressed CompressedBatch (one frame's payload)
+	constexpr size_t MAX_SIGNATURE_BLOCKS = 1024 * 1024; // Blocks per Signatures frame (12 MB)
+	constexpr size_t MAX_DEDUP_CHUNKS = 256 * 1024;     // Chunks per ChunkManifest frame (9 MB, ~16 GB of file)
+	constexpr size_t MAX_TREE_LEAVES = 256 * 1024;      // Leaves per TreeDigest frame (11 MB)
+	constexpr uint64_t ACK_INTERVAL = 1024 * 1024;      // Receivers ack a stream at least this often
+	constexpr size_t MAX_ACK_BATCH = 1024;              // Acks per AckBatch frame (12 KB)
+	constexpr size_t MAX_STATS_SIZE = 1024 * 1024;      // Bytes of a StatsResponse's text
 
-	struct Ack
+	// Optional CRC32C field: a presence byte, then the value (0 when absent).
+	// Absent where the sender never sees the bytes (kernel-copied chunks).
+	constexpr size_t CHECKSUM_FIELD_SIZE = sizeof(uint8_t) + sizeof(uint32_t);
+	static_assert(detail::WireField<std::optional<uint32_t>>::SIZE == CHECKSUM_FIELD_SIZE);
+
+	inline void writeChecksum(cw::binary::ByteWriter& out, const std::optional<uint32_t>& crc)
 	{
-		static constexpr PacketType type = PacketType::Ack;
-		std::uint64_t offset;
+		out.write(static_cast<uint8_t>(crc.has_value()));
+		out.write<uint32_t>(crc.value_or(0));
+	}
 
-		std::size_t payloadSize() const { return sizeof(offset); }
+	inline std::optional<uint32_t> readChecksum(const uint8_t* buf)
+	{
+		if (buf[0] == 0) return std::nullopt;
+		return cw::binary::readBigEndian<uint32_t>(buf + 1);
+	}
 
-		void serialize(std::vector<uint8_t>& out) const
-		{
-			cw::binary::writeBigEndian<uint64_t>(out, offset);
-		}
+	// Receiver progress: 'offset' bytes of stream 'streamId' are on disk.
+	// Sent periodically while a file streams in (the sender's ack window) and
+	// once more after FileDone. Stream 0 acks FileBatch frames.
+	struct Ack : FixedLayoutPacket<Ack>
+	{
+		static constexpr PacketType type = PacketType::Ack;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset;
 
-		static Ack deserialize(const uint8_t* buf, size_t size)
-		{
-			if (size < sizeof(offset))
-				throw std::runtime_error("Ack: payload too small.");
+		using Layout = WireLayout<&Ack::streamId, &Ack::offset>;
+	};
 
-			Ack packet;
-			packet.offset = cw::binary::readBigEndian<uint64_t>(buf);
-			return packet;
-		}
+	// Values carried in Error::code
+	enum class ErrorCode : uint16_t
+	{
+		Unknown = 0,
+		DiskFull = 1,          // Destination could not reserve space for the file
+		ChecksumMismatch = 2,  // Data failed its CRC32C (a chunk is resent, a file is not)
+		Rejected = 3,          // The receiver will not take the file (its policy, not a failure)
+		TimedOut = 4,          // The stream stalled past the receiver's deadline
+		Busy = 5,              // The receiver's disk is behind: send the file again after Error::retryAfterMs, or to Error::redirect
 	};
 
-	struct Error
+	// Error, FileChunk and FileInfo own heap memory (a string, a byte vector),
+	// so they take the allocator it comes from. The plain names use the
+	// default one; the cw::packet::pmr names take a std::pmr memory resource,
+	// so a request's packets can be built in a monotonic arena and released
+	// with it at once. deserialize() allocates from the allocator it is given.
+	template<typename Allocator = std::allocator<char>>
+	struct BasicError
 	{
+		using allocator_type = Allocator;
+		using string_type = std::basic_string<char, std::char_traits<char>, Allocator>;
+
 		static constexpr PacketType type = PacketType::Error;
 		std::uint16_t code;
-		std::string message;
+		string_type message;
+		// The stream it ends: its sender stops sending it at once. 0: not about
+		// one stream (and what an older peer's Error, without the field, reads as)
+		std::uint32_t streamId = 0;
+		// With ErrorCode::Busy: how long the sender should wait before it tries again
+		std::uint32_t retryAfterMs = 0;
+		// With ErrorCode::Busy: a peer server (host:port) with room to send
+		// the file to instead. Empty: none, and then not on the wire at all
+		string_type redirect = {};
 
 		std::size_t payloadSize() const {
-			return sizeof(code) + sizeof(uint32_t) + message.size();
+			return sizeof(code) + sizeof(uint32_t) + message.size() + sizeof(streamId) + sizeof(retryAfterMs)
+				+ (redirect.empty() ? 0 : sizeof(uint16_t) + redirect.size());
 		}
 
-		void serialize(std::vector<uint8_t>& out) const
+		void serialize(cw::binary::ByteWriter& out) const
 		{
 			if (message.size() > MAX_STRING_LENGTH)
 				throw std::length_error("Error: Message exceeds protocol limit.");
 
-			cw::binary::writeBigEndian(out, code);
-			cw::binary::writeBigEndian(out, static_cast<uint32_t>(message.size()));
-			out.insert(out.end(), message.begin(), message.end());
+			out.write(code);
+			out.write(static_cast<uint32_t>(message.size()));
+			out.bytes(message.begin(), message.end());
+			out.write(streamId);
+			out.write(retryAfterMs);
+			if (!redirect.empty()) {
+				if (redirect.size() > UINT16_MAX) throw std::length_error("Error: Redirect exceeds protocol limit.");
+				out.write(static_cast<uint16_t>(redirect.size()));
+				out.bytes(redirect.begin(), redirect.end());
+			}
 		}
 
-		static Error deserialize(const uint8_t* buf, size_t size)
+		static BasicError deserialize(const uint8_t* buf, size_t size, const Allocator& allocator = Allocator())
 		{
 			constexpr size_t MIN_SIZE = sizeof(code) + sizeof(uint32_t);
 			if (size < MIN_SIZE)
 				throw std::runtime_error("Error: payload too small");
 
-			Error p;
+			BasicError p{ 0, string_type(allocator), 0, 0, string_type(allocator) };
 			size_t cursor = 0;
 
 			p.code = cw::binary::readBigEndian<uint16_t>(buf + cursor);
@@ -83,127 +150,603 @@ namespace cw::packet
 
 			if (msgLen > 0)
 				p.message.assign(reinterpret_cast<const char*>(buf + cursor), msgLen);
+			cursor += msgLen;
 
+			if (size - cursor >= sizeof(p.streamId)) {
+				p.streamId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+				cursor += sizeof(p.streamId);
+			}
+			if (size - cursor >= sizeof(p.retryAfterMs)) {
+				p.retryAfterMs = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+				cursor += sizeof(p.retryAfterMs);
+			}
+			if (size - cursor >= sizeof(uint16_t)) {
+				uint16_t redirectLen = cw::binary::readBigEndian<uint16_t>(buf + cursor);
+				cursor += sizeof(redirectLen);
+				if (size - cursor < redirectLen)
+					throw std::runtime_error("Error: declared redirect length exceeds buffer.");
+				p.redirect.assign(reinterpret_cast<const char*>(buf + cursor), redirectLen);
+			}
 			return p;
 		}
 	};
+	using Error = BasicError<>;
+
+	// Fixed fields ahead of a chunk's bytes, the same in every FileChunk form
+	struct ChunkHeader
+	{
+		std::uint32_t streamId = 0;
+		std::uint64_t offset = 0;
+		std::uint32_t length = 0;
+		std::optional<uint32_t> crc;
+
+		using Layout = WireLayout<&ChunkHeader::streamId, &ChunkHeader::offset, &ChunkHeader::length, &ChunkHeader::crc>;
+
+		// The same fields little-endian, as a native frame carries them: on
+		// the little-endian hosts that negotiate those, one copy each way
+		// instead of a byteswap per field
+#pragma pack(push, 1)
+		struct Packed
+		{
+			std::uint32_t streamId;
+			std::uint64_t offset;
+			std::uint32_t length;
+			std::uint8_t hasCrc;
+			std::uint32_t crc;
+		};
+#pragma pack(pop)
+		static_assert(sizeof(Packed) == Layout::SIZE);
+
+		// From Layout::SIZE bytes at 'src', which the caller checked are there
+		static ChunkHeader read(const std::uint8_t* src, WireOrder order) noexcept
+		{
+			ChunkHeader header;
+			if (order == WireOrder::BigEndian) {
+				Layout::read(header, src);
+				return header;
+			}
+
+			Packed packed;
+			std::memcpy(&packed, src, sizeof(packed));
+			header.streamId = littleEndian(packed.streamId);
+			header.offset = littleEndian(packed.offset);
+			header.length = littleEndian(packed.length);
+			if (packed.hasCrc) header.crc = littleEndian(packed.crc);
+			return header;
+		}
+
+		void write(cw::binary::ByteWriter& out, WireOrder order) const noexcept
+		{
+			if (order == WireOrder::BigEndian) {
+				Layout::write(*this, out);
+				return;
+			}
+
+			Packed packed{ littleEndian(streamId), littleEndian(offset), littleEndian(length), static_cast<std::uint8_t>(crc.has_value()), littleEndian(crc.value_or(0)) };
+			std::memcpy(out.take(sizeof(packed)), &packed, sizeof(packed));
+		}
+
+	private:
+		// A no-op but on big-endian hosts, which never send native frames
+		template<cw::binary::Integer T>
+		static constexpr T littleEndian(T value) noexcept
+		{
+			if constexpr (std::endian::native == std::endian::little) return value;
+			else return std::byteswap(value);
+		}
+	};
 
-	struct FileChunk
+	template<typename Allocator = std::allocator<uint8_t>>
+	struct BasicFileChunk
 	{
+		using allocator_type = Allocator;
+
 		static constexpr PacketType type = PacketType::FileChunk;
+		std::uint32_t streamId = 0;
 		std::uint64_t offset;
 		// REMOVED: std::uint32_t length; -> Redundant. data.size() is the truth.
-		std::vector<uint8_t> data;
+		std::vector<uint8_t, Allocator> data;
+		std::optional<uint32_t> crc; // CRC32C of 'data'
 
-		std::size_t payloadSize() const {
-			return sizeof(offset) + sizeof(uint32_t) + data.size();
-		}
+		std::size_t payloadSize() const { return ChunkHeader::Layout::SIZE + data.size(); }
 
-		void serialize(std::vector<uint8_t>& out) const
+		void serializeHeader(cw::binary::ByteWriter& out, WireOrder order = WireOrder::BigEndian) const
 		{
 			if (data.size() > MAX_CHUNK_SIZE)
 				throw std::length_error("Chunk: Data exceeds protocol limit.");
 
-			// Explicitly cast size to uint32 check to ensure it fits field
-			if (data.size() > UINT32_MAX)
-				throw std::length_error("Chunk: Data too large for u32 field.");
+			ChunkHeader{ streamId, offset, static_cast<uint32_t>(data.size()), crc }.write(out, order);
+		}
 
-			cw::binary::writeBigEndian(out, offset);
-			cw::binary::writeBigEndian(out, static_cast<uint32_t>(data.size()));
-			out.insert(out.end(), data.begin(), data.end());
+		void serialize(cw::binary::ByteWriter& out, WireOrder order = WireOrder::BigEndian) const
+		{
+			serializeHeader(out, order);
+			out.bytes(data.begin(), data.end());
 		}
 
-		static FileChunk deserialize(const uint8_t* buf, size_t size)
+		// For a chunk being sent as an rvalue: 'data' becomes the frame's
+		// payload segment instead of being copied into it (leaves it empty)
+		std::size_t payloadSegmentSize() const { return data.size(); }
+		cw::buffer::SharedBuffer takePayloadSegment()
 		{
-			constexpr size_t HEADER_SIZE = sizeof(offset) + sizeof(uint32_t);
-			if (size < HEADER_SIZE) throw std::runtime_error("FileChunk: payload too small.");
+			if (data.empty()) return {};
+			return cw::buffer::SharedBuffer::fromAllocatedVector(std::move(data));
+		}
 
-			FileChunk chunk;
-			size_t cursor = 0;
+		static BasicFileChunk deserialize(const uint8_t* buf, size_t size, const Allocator& allocator = Allocator());
+	};
+
+	// Non-owning FileChunk: 'data' points into the buffer it was parsed from
+	// (or into caller-owned memory when sending). Same wire format as FileChunk.
+	// The view is only valid as long as that buffer is.
+	struct FileChunkView
+	{
+		static constexpr PacketType type = PacketType::FileChunk;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset;
+		std::span<const uint8_t> data;
+		std::optional<uint32_t> crc;
+
+		std::size_t payloadSize() const { return ChunkHeader::Layout::SIZE + data.size(); }
+
+		void serialize(cw::binary::ByteWriter& out, WireOrder order = WireOrder::BigEndian) const
+		{
+			if (data.size() > MAX_CHUNK_SIZE)
+				throw std::length_error("Chunk: Data exceeds protocol limit.");
+
+			ChunkHeader{ streamId, offset, static_cast<uint32_t>(data.size()), crc }.write(out, order);
+			out.bytes(data.begin(), data.end());
+		}
 
-			chunk.offset = binary::readBigEndian<uint64_t>(buf + cursor);
-			cursor += sizeof(offset);
+		static FileChunkView deserialize(const uint8_t* buf, size_t size, WireOrder order = WireOrder::BigEndian)
+		{
+			constexpr size_t HEADER_SIZE = ChunkHeader::Layout::SIZE;
+			if (size < HEADER_SIZE) throw std::runtime_error("FileChunk: payload too small.");
 
-			uint32_t dataLen = binary::readBigEndian<uint32_t>(buf + cursor);
-			cursor += sizeof(dataLen);
+			ChunkHeader header = ChunkHeader::read(buf, order);
 
 			// SECURITY: Check logic
-			if (dataLen > MAX_CHUNK_SIZE)
+			if (header.length > MAX_CHUNK_SIZE)
 				throw std::runtime_error("FileChunk: Size unreasonable (DoS protection).");
 
 			// SAFETY: Overflow check
-			if (size - cursor < dataLen)
+			if (size - HEADER_SIZE < header.length)
 				throw std::runtime_error("FileChunk: corrupted length mismatch");
 
-			// Allocation
-			chunk.data.assign(buf + cursor, buf + cursor + dataLen);
+			// No allocation, no copy
+			return { header.streamId, header.offset, std::span<const uint8_t>(buf + HEADER_SIZE, header.length), header.crc };
+		}
+	};
+
+	// Send-side FileChunk whose payload is a ref-counted buffer.
+	// buildOutgoingFrame references 'data' instead of copying it into the frame,
+	// so a chunk read from disk goes to the socket with no intermediate copies.
+	struct SharedFileChunk
+	{
+		static constexpr PacketType type = PacketType::FileChunk;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset;
+		cw::buffer::SharedBuffer data;
+		std::optional<uint32_t> crc; // Computed where the chunk was read
+
+		std::size_t payloadSize() const { return ChunkHeader::Layout::SIZE + data.size(); }
 
-			return chunk;
+		void serializeHeader(cw::binary::ByteWriter& out, WireOrder order = WireOrder::BigEndian) const
+		{
+			if (data.size() > MAX_CHUNK_SIZE)
+				throw std::length_error("Chunk: Data exceeds protocol limit.");
+
+			ChunkHeader{ streamId, offset, static_cast<uint32_t>(data.size()), crc }.write(out, order);
+		}
+
+		const cw::buffer::SharedBuffer& payloadSegment() const { return data; }
+
+		void serialize(cw::binary::ByteWriter& out, WireOrder order = WireOrder::BigEndian) const
+		{
+			serializeHeader(out, order);
+			out.bytes(data.data(), data.data() + data.size());
+		}
+	};
+
+	// Send-side FileChunk whose payload never enters user space: the Connection
+	// writes the header, then has the kernel copy 'segment' from the file straight
+	// to the socket (sendfile / TransmitFile). Same wire format as FileChunk.
+	struct FileRangeChunk
+	{
+		static constexpr PacketType type = PacketType::FileChunk;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset;
+		cw::file::FileSegment segment;
+
+		std::size_t payloadSize() const { return ChunkHeader::Layout::SIZE + segment.length; }
+
+		void serializeHeader(cw::binary::ByteWriter& out, WireOrder order = WireOrder::BigEndian) const
+		{
+			if (segment.length > MAX_CHUNK_SIZE)
+				throw std::length_error("Chunk: Data exceeds protocol limit.");
+
+			// No checksum: the bytes never pass through us
+			ChunkHeader{ streamId, offset, static_cast<uint32_t>(segment.length), std::nullopt }.write(out, order);
+		}
+
+		const cw::file::FileSegment& fileSegment() const { return segment; }
+	};
+
+	// A FileChunk whose bytes stay in the sender's file. Over a local socket the
+	// file's descriptor travels with the frame (SCM_RIGHTS) and the receiver has
+	// the kernel copy the range into its own file (copy_file_range, a reflink
+	// where the filesystem can): the data crosses neither the socket nor user
+	// space. Only sent to a peer that announced CAP_DESCRIPTORS.
+	struct FileRange : FixedLayoutPacket<FileRange>
+	{
+		static constexpr PacketType type = PacketType::FileRange;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset = 0;       // In the transferred file
+		std::uint64_t sourceOffset = 0; // In the passed descriptor
+		std::uint32_t length = 0;
+		std::shared_ptr<const cw::file::FileHandle> file; // Send side: the descriptor to pass
+
+		using Layout = WireLayout<&FileRange::streamId, &FileRange::offset, &FileRange::sourceOffset, &FileRange::length>;
+
+		const std::shared_ptr<const cw::file::FileHandle>& descriptor() const { return file; }
+
+		void validate() const
+		{
+			if (length > MAX_CHUNK_SIZE)
+				throw std::runtime_error("FileRange: length exceeds protocol limit.");
 		}
 	};
 
-	struct FileDone
+	template<typename Allocator>
+	BasicFileChunk<Allocator> BasicFileChunk<Allocator>::deserialize(const uint8_t* buf, size_t size, const Allocator& allocator)
+	{
+		FileChunkView view = FileChunkView::deserialize(buf, size);
+
+		return BasicFileChunk{
+			.streamId = view.streamId,
+			.offset = view.offset,
+			.data = std::vector<uint8_t, Allocator>(view.data.begin(), view.data.end(), allocator),
+			.crc = view.crc,
+		};
+	}
+	using FileChunk = BasicFileChunk<>;
+
+	struct FileDone : FixedLayoutPacket<FileDone>
 	{
 		static constexpr PacketType type = PacketType::FileDone;
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize;
+		// Whole-stream CRC32C (see cw::integrity::FileDigest) of the chunks this
+		// stream carried. Absent if any of them had no checksum of its own.
+		std::optional<uint32_t> crc = {};
+
+		using Layout = WireLayout<&FileDone::streamId, &FileDone::fileSize, &FileDone::crc>;
+	};
+
+	// The source file's modification time and permission bits, ahead of the
+	// FileDone of its stream (in the same priority class). The receiver sets
+	// them on the file as it closes it (cw::file::applyAttributes). Only to a
+	// peer advertising CAP_FILE_ATTRIBUTES.
+	struct FileAttributes : FixedLayoutPacket<FileAttributes>
+	{
+		static constexpr PacketType type = PacketType::FileAttributes;
+		std::uint32_t streamId = 0;
+		std::int64_t modifiedNs = 0; // Nanoseconds since the Unix epoch
+		std::uint32_t mode = 0;      // Permission bits, 0 = none known
+
+		using Layout = WireLayout<&FileAttributes::streamId, &FileAttributes::modifiedNs, &FileAttributes::mode>;
+	};
+
+	// FileInfo::fileSize of a stream whose length is only known at its end
+	// (a pipe, a generator): its FileDone carries the size (CAP_UNSIZED_FILES)
+	constexpr std::uint64_t UNKNOWN_FILE_SIZE = UINT64_MAX;
+
+	// Extension types of FileInfo (see Extensions). A FileInfo carrying
+	// FILE_INFO_CONTENT is its stream whole: the receiver writes the file
+	// from it and acks it, and no FileChunk or FileDone follows. Only to a
+	// peer advertising CAP_INLINE_FILES.
+	constexpr std::uint8_t FILE_INFO_CONTENT = 0;     // The file's bytes, fileSize of them
+	constexpr std::uint8_t FILE_INFO_CONTENT_CRC = 1; // u32: CRC32C of FILE_INFO_CONTENT
+	constexpr std::uint8_t FILE_INFO_ATTRIBUTES = 2;  // i64 modifiedNs, u32 mode: a FileAttributes for FILE_INFO_CONTENT
+	constexpr std::uint64_t MAX_INLINE_FILE_SIZE = MAX_EXTENSION_SIZE;
+
+	// Fixed fields ahead of a FileInfo's name
+	struct FileInfoHeader
+	{
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize = 0;
+		std::uint32_t nameLength = 0;
+
+		using Layout = WireLayout<&FileInfoHeader::streamId, &FileInfoHeader::fileSize, &FileInfoHeader::nameLength>;
+	};
+
+	// Starts a file on stream 'streamId'. Several files may be open on one
+	// connection at once; their FileChunks and FileDone carry the same id.
+	// Ids are chosen by the sender and may be reused once FileDone was sent.
+	// Optional fields follow the name (see Extensions).
+	template<typename Allocator = std::allocator<char>>
+	struct BasicFileInfo
+	{
+		using allocator_type = Allocator;
+		using string_type = std::basic_string<char, std::char_traits<char>, Allocator>;
+
+		static constexpr PacketType type = PacketType::FileInfo;
+		std::uint32_t streamId = 0;
 		std::uint64_t fileSize;
+		string_type fileName;
+		Extensions extensions = {};
 
-		std::size_t payloadSize() const { return sizeof(fileSize); }
+		std::size_t payloadSize() const { return FileInfoHeader::Layout::SIZE + fileName.size() + extensions.encodedSize(); }
 
-		void serialize(std::vector<uint8_t>& out) const
+		void serialize(cw::binary::ByteWriter& out) const
 		{
-			cw::binary::writeBigEndian<uint64_t>(out, fileSize);
+			if (fileName.empty()) throw std::length_error("FileInfo: Filename empty");
+			if (fileName.size() > MAX_STRING_LENGTH) throw std::length_error("FileInfo: Filename too long");
+
+			FileInfoHeader::Layout::write(FileInfoHeader{ streamId, fileSize, static_cast<uint32_t>(fileName.size()) }, out);
+			out.bytes(fileName.begin(), fileName.end());
+			extensions.write(out);
 		}
 
-		static FileDone deserialize(const uint8_t* buf, size_t size)
+		static BasicFileInfo deserialize(const uint8_t* buf, size_t size, const Allocator& allocator = Allocator());
+	};
+
+	// Non-owning FileInfo: 'fileName' points into the buffer it was parsed
+	// from, so receiving one costs no allocation. Same wire format as FileInfo;
+	// valid as long as that buffer is.
+	struct FileInfoView
+	{
+		static constexpr PacketType type = PacketType::FileInfo;
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize;
+		std::string_view fileName;
+		ExtensionsView extensions = {};
+
+		std::size_t payloadSize() const { return FileInfoHeader::Layout::SIZE + fileName.size() + extensions.encodedSize(); }
+
+		void serialize(cw::binary::ByteWriter& out) const
 		{
-			if (size < sizeof(fileSize))
-				throw std::runtime_error("FileDone: payload too small.");
+			if (fileName.empty()) throw std::length_error("FileInfo: Filename empty");
+			if (fileName.size() > MAX_STRING_LENGTH) throw std::length_error("FileInfo: Filename too long");
 
-			FileDone packet;
-			packet.fileSize = cw::binary::readBigEndian<uint64_t>(buf);
-			return packet;
+			FileInfoHeader::Layout::write(FileInfoHeader{ streamId, fileSize, static_cast<uint32_t>(fileName.size()) }, out);
+			out.bytes(fileName.begin(), fileName.end());
+			extensions.write(out);
+		}
+
+		static FileInfoView deserialize(const uint8_t* buf, size_t size)
+		{
+			constexpr size_t MIN_SIZE = FileInfoHeader::Layout::SIZE;
+			if (size < MIN_SIZE) throw std::runtime_error("FileInfo: payload too small.");
+
+			FileInfoHeader header;
+			FileInfoHeader::Layout::read(header, buf);
+
+			if (header.nameLength > MAX_STRING_LENGTH)
+				throw std::runtime_error("FileInfo: Filename too long (DoS protection).");
+
+			if (size - MIN_SIZE < header.nameLength)
+				throw std::runtime_error("FileInfo: corrupted name length mismatch.");
+
+			std::size_t named = MIN_SIZE + header.nameLength;
+			return { header.streamId, header.fileSize, std::string_view(reinterpret_cast<const char*>(buf + MIN_SIZE), header.nameLength),
+				ExtensionsView::parse(buf + named, size - named) };
 		}
 	};
 
-	struct FileInfo
+	template<typename Allocator>
+	BasicFileInfo<Allocator> BasicFileInfo<Allocator>::deserialize(const uint8_t* buf, size_t size, const Allocator& allocator)
 	{
-		static constexpr PacketType type = PacketType::FileInfo;
+		FileInfoView view = FileInfoView::deserialize(buf, size);
+
+		return BasicFileInfo{
+			.streamId = view.streamId,
+			.fileSize = view.fileSize,
+			.fileName = string_type(view.fileName, allocator),
+			.extensions = Extensions::copyOf(view.extensions),
+		};
+	}
+	using FileInfo = BasicFileInfo<>;
+
+	struct FrontCodedFileInfoHeader
+	{
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize = 0;
+		std::uint8_t chain = 0;
+		std::uint16_t prefixLength = 0;
+		std::uint16_t suffixLength = 0;
+
+		using Layout = WireLayout<&FrontCodedFileInfoHeader::streamId, &FrontCodedFileInfoHeader::fileSize, &FrontCodedFileInfoHeader::chain,
+			&FrontCodedFileInfoHeader::prefixLength, &FrontCodedFileInfoHeader::suffixLength>;
+	};
+
+	// A FileInfo whose name is front-coded: the first 'prefixLength' bytes of
+	// the name in the previous FrontCodedFileInfo of the same 'chain' on this
+	// connection, then 'suffix'. Each priority class is a chain of its own,
+	// as frames keep their order only within a class. Only to a peer
+	// advertising CAP_FRONT_CODED_PATHS; 'suffix' is a view, valid as long as
+	// the name or buffer it points into.
+	struct FrontCodedFileInfo
+	{
+		static constexpr PacketType type = PacketType::FrontCodedFileInfo;
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize = 0;
+		std::uint8_t chain = 0;
+		std::uint16_t prefixLength = 0;
+		std::string_view suffix;
+
+		std::size_t payloadSize() const { return FrontCodedFileInfoHeader::Layout::SIZE + suffix.size(); }
+
+		// Codes 'name' against 'previous', the name last coded in the chain
+		static FrontCodedFileInfo code(std::uint32_t streamId, std::uint64_t fileSize, std::uint8_t chain, std::string_view name, std::string_view previous)
+		{
+			std::size_t shared = std::ranges::mismatch(name, previous).in1 - name.begin();
+			return { streamId, fileSize, chain, static_cast<std::uint16_t>(shared), name.substr(shared) };
+		}
+
+		// Rebuilds the name in 'previous' (the chain's last name), in place
+		void decodeInto(std::string& previous) const
+		{
+			if (prefixLength > previous.size()) throw std::runtime_error("FrontCodedFileInfo: prefix longer than the previous name.");
+			if (prefixLength + suffix.size() == 0) throw std::runtime_error("FrontCodedFileInfo: Filename empty.");
+			if (prefixLength + suffix.size() > MAX_STRING_LENGTH) throw std::runtime_error("FrontCodedFileInfo: Filename too long (DoS protection).");
+			previous.resize(prefixLength);
+			previous.append(suffix);
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (prefixLength + suffix.size() == 0) throw std::length_error("FrontCodedFileInfo: Filename empty");
+			if (prefixLength + suffix.size() > MAX_STRING_LENGTH) throw std::length_error("FrontCodedFileInfo: Filename too long");
+
+			FrontCodedFileInfoHeader::Layout::write(FrontCodedFileInfoHeader{ streamId, fileSize, chain, prefixLength, static_cast<std::uint16_t>(suffix.size()) }, out);
+			out.bytes(suffix.begin(), suffix.end());
+		}
+
+		static FrontCodedFileInfo deserialize(const uint8_t* buf, size_t size)
+		{
+			constexpr size_t MIN_SIZE = FrontCodedFileInfoHeader::Layout::SIZE;
+			if (size < MIN_SIZE) throw std::runtime_error("FrontCodedFileInfo: payload too small.");
+
+			FrontCodedFileInfoHeader header;
+			FrontCodedFileInfoHeader::Layout::read(header, buf);
+
+			if (size - MIN_SIZE < header.suffixLength)
+				throw std::runtime_error("FrontCodedFileInfo: corrupted name length mismatch.");
+
+			return { header.streamId, header.fileSize, header.chain, header.prefixLength,
+				std::string_view(reinterpret_cast<const char*>(buf + MIN_SIZE), header.suffixLength) };
+		}
+	};
+
+	namespace pmr {
+		using Error = BasicError<std::pmr::polymorphic_allocator<char>>;
+		using FileInfo = BasicFileInfo<std::pmr::polymorphic_allocator<char>>;
+		using FileChunk = BasicFileChunk<std::pmr::polymorphic_allocator<uint8_t>>;
+	}
+
+	// Announces that this connection carries one stripe of a file that is split
+	// across 'stripeCount' connections. Every stripe sends the same header; the
+	// receiver joins them into one destination file by 'transferId'. The stripe's
+	// FileChunks (absolute offsets) and FileDone follow as for a FileInfo.
+	struct StripeInfo
+	{
+		static constexpr PacketType type = PacketType::StripeInfo;
+		std::uint32_t streamId = 0;
+		std::uint64_t transferId;
+		std::uint16_t stripeCount;
 		std::uint64_t fileSize;
 		std::string fileName;
 
 		std::size_t payloadSize() const {
-			return sizeof(fileSize) + sizeof(uint32_t) + fileName.size();
+			return sizeof(streamId) + sizeof(transferId) + sizeof(stripeCount) + sizeof(fileSize) + sizeof(uint32_t) + fileName.size();
 		}
 
-		void serialize(std::vector<uint8_t>& out) const
+		void serialize(cw::binary::ByteWriter& out) const
 		{
-			if (fileName.empty()) throw std::length_error("FileInfo: Filename empty");
-			if (fileName.size() > MAX_STRING_LENGTH) throw std::length_error("FileInfo: Filename too long");
+			if (fileName.empty()) throw std::length_error("StripeInfo: Filename empty");
+			if (fileName.size() > MAX_STRING_LENGTH) throw std::length_error("StripeInfo: Filename too long");
 
-			cw::binary::writeBigEndian(out, fileSize);
-			cw::binary::writeBigEndian(out, static_cast<uint32_t>(fileName.size()));
-			out.insert(out.end(), fileName.begin(), fileName.end());
+			out.write(streamId);
+			out.write(transferId);
+			out.write(stripeCount);
+			out.write(fileSize);
+			out.write(static_cast<uint32_t>(fileName.size()));
+			out.bytes(fileName.begin(), fileName.end());
 		}
 
-		static FileInfo deserialize(const uint8_t* buf, size_t size)
+		static StripeInfo deserialize(const uint8_t* buf, size_t size)
 		{
-			constexpr size_t MIN_SIZE = sizeof(fileSize) + sizeof(uint32_t);
-			if (size < MIN_SIZE) throw std::runtime_error("FileInfo: payload too small.");
+			constexpr size_t MIN_SIZE = sizeof(streamId) + sizeof(transferId) + sizeof(stripeCount) + sizeof(fileSize) + sizeof(uint32_t);
+			if (size < MIN_SIZE) throw std::runtime_error("StripeInfo: payload too small.");
 
-			FileInfo info;
+			StripeInfo info;
 			size_t cursor = 0;
 
+			info.streamId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(info.streamId);
+
+			info.transferId = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(info.transferId);
+
+			info.stripeCount = cw::binary::readBigEndian<uint16_t>(buf + cursor);
+			cursor += sizeof(info.stripeCount);
+
 			info.fileSize = cw::binary::readBigEndian<uint64_t>(buf + cursor);
 			cursor += sizeof(info.fileSize);
 
 			uint32_t nameLen = cw::binary::readBigEndian<uint32_t>(buf + cursor);
 			cursor += sizeof(nameLen);
 
+			if (info.stripeCount == 0)
+				throw std::runtime_error("StripeInfo: stripe count is zero.");
+
 			if (nameLen > MAX_STRING_LENGTH)
-				throw std::runtime_error("FileInfo: Filename too long (DoS protection).");
+				throw std::runtime_error("StripeInfo: Filename too long (DoS protection).");
 
 			if (size - cursor < nameLen)
-				throw std::runtime_error("FileInfo: corrupted name length mismatch.");
+				throw std::runtime_error("StripeInfo: corrupted name length mismatch.");
+
+			if (nameLen > 0)
+				info.fileName.assign(reinterpret_cast<const char*>(buf + cursor), nameLen);
+
+			return info;
+		}
+	};
+
+	// Resumable FileInfo. 'fingerprint' identifies the source contents; if the
+	// receiver holds a checkpointed partial copy of the same source it keeps it.
+	// Either way it answers with Ack{offset = bytes already stored}, and the
+	// sender continues from there with FileChunks and a FileDone as usual.
+	struct FileResume
+	{
+		static constexpr PacketType type = PacketType::FileResume;
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize;
+		std::uint64_t fingerprint;
+		std::string fileName;
+
+		std::size_t payloadSize() const {
+			return sizeof(streamId) + sizeof(fileSize) + sizeof(fingerprint) + sizeof(uint32_t) + fileName.size();
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (fileName.empty()) throw std::length_error("FileResume: Filename empty");
+			if (fileName.size() > MAX_STRING_LENGTH) throw std::length_error("FileResume: Filename too long");
+
+			out.write(streamId);
+			out.write(fileSize);
+			out.write(fingerprint);
+			out.write(static_cast<uint32_t>(fileName.size()));
+			out.bytes(fileName.begin(), fileName.end());
+		}
+
+		static FileResume deserialize(const uint8_t* buf, size_t size)
+		{
+			constexpr size_t MIN_SIZE = sizeof(streamId) + sizeof(fileSize) + sizeof(fingerprint) + sizeof(uint32_t);
+			if (size < MIN_SIZE) throw std::runtime_error("FileResume: payload too small.");
+
+			FileResume info;
+			size_t cursor = 0;
+
+			info.streamId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(info.streamId);
+
+			info.fileSize = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(info.fileSize);
+
+			info.fingerprint = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(info.fingerprint);
+
+			uint32_t nameLen = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(nameLen);
+
+			if (nameLen > MAX_STRING_LENGTH)
+				throw std::runtime_error("FileResume: Filename too long (DoS protection).");
+
+			if (size - cursor < nameLen)
+				throw std::runtime_error("FileResume: corrupted name length mismatch.");
 
 			if (nameLen > 0)
 				info.fileName.assign(reinterpret_cast<const char*>(buf + cursor), nameLen);
@@ -211,4 +754,1488 @@ namespace cw::packet
 			return info;
 		}
 	};
+
+	// FileResume for a source the receiver can read itself (shared or local
+	// storage): asks it to copy 'sourcePath' into 'fileName' on its own side, by
+	// reflink or copy_file_range, so no data crosses the network. Only sent to a
+	// peer advertising CAP_SERVER_COPY. The receiver answers with Ack{offset =
+	// bytes copied}: fileSize when done, 0 when it would not or could not, and
+	// the sender streams whatever is left with FileChunks and a FileDone.
+	struct FileCopy
+	{
+		static constexpr PacketType type = PacketType::FileCopy;
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize;
+		std::uint64_t fingerprint;  // Of the source as the sender read it (fileFingerprint)
+		std::string fileName;
+		std::string sourcePath;     // Absolute, as the receiver sees it
+
+		std::size_t payloadSize() const {
+			return sizeof(streamId) + sizeof(fileSize) + sizeof(fingerprint) + 2 * sizeof(uint32_t) + fileName.size() + sourcePath.size();
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (fileName.empty()) throw std::length_error("FileCopy: Filename empty");
+			if (fileName.size() > MAX_STRING_LENGTH) throw std::length_error("FileCopy: Filename too long");
+			if (sourcePath.empty()) throw std::length_error("FileCopy: Source path empty");
+			if (sourcePath.size() > MAX_STRING_LENGTH) throw std::length_error("FileCopy: Source path too long");
+
+			out.write(streamId);
+			out.write(fileSize);
+			out.write(fingerprint);
+			out.write(static_cast<uint32_t>(fileName.size()));
+			out.bytes(fileName.begin(), fileName.end());
+			out.write(static_cast<uint32_t>(sourcePath.size()));
+			out.bytes(sourcePath.begin(), sourcePath.end());
+		}
+
+		static FileCopy deserialize(const uint8_t* buf, size_t size)
+		{
+			constexpr size_t MIN_SIZE = sizeof(streamId) + sizeof(fileSize) + sizeof(fingerprint) + 2 * sizeof(uint32_t);
+			if (size < MIN_SIZE) throw std::runtime_error("FileCopy: payload too small.");
+
+			FileCopy copy;
+			size_t cursor = 0;
+
+			copy.streamId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(copy.streamId);
+
+			copy.fileSize = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(copy.fileSize);
+
+			copy.fingerprint = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(copy.fingerprint);
+
+			auto readString = [&](std::string& out) {
+				if (size - cursor < sizeof(uint32_t))
+					throw std::runtime_error("FileCopy: payload too small.");
+				uint32_t len = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+				cursor += sizeof(len);
+
+				if (len > MAX_STRING_LENGTH)
+					throw std::runtime_error("FileCopy: string too long (DoS protection).");
+				if (size - cursor < len)
+					throw std::runtime_error("FileCopy: corrupted string length mismatch.");
+
+				out.assign(reinterpret_cast<const char*>(buf + cursor), len);
+				cursor += len;
+			};
+			readString(copy.fileName);
+			readString(copy.sourcePath);
+
+			return copy;
+		}
+	};
+
+	// Many small, complete files in one frame: replaces FileInfo + FileChunk +
+	// FileDone per file. Each entry is {u32 nameLen, name, u32 dataLen, data}.
+	// The receiver acks the whole batch with Ack{offset = total data bytes}.
+	struct FileBatch
+	{
+		static constexpr PacketType type = PacketType::FileBatch;
+
+		struct Entry
+		{
+			std::string fileName;
+			std::vector<uint8_t> data;
+		};
+		std::vector<Entry> files;
+
+		static constexpr size_t ENTRY_OVERHEAD = 2 * sizeof(uint32_t);
+
+		std::size_t payloadSize() const {
+			std::size_t size = sizeof(uint32_t);
+			for (const auto& file : files) size += ENTRY_OVERHEAD + file.fileName.size() + file.data.size();
+			return size;
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (files.size() > MAX_BATCH_FILES) throw std::length_error("FileBatch: too many files");
+
+			out.write(static_cast<uint32_t>(files.size()));
+			for (const auto& file : files) {
+				if (file.fileName.empty()) throw std::length_error("FileBatch: Filename empty");
+				if (file.fileName.size() > MAX_STRING_LENGTH) throw std::length_error("FileBatch: Filename too long");
+				if (file.data.size() > MAX_CHUNK_SIZE) throw std::length_error("FileBatch: File exceeds protocol limit.");
+
+				out.write(static_cast<uint32_t>(file.fileName.size()));
+				out.bytes(file.fileName.begin(), file.fileName.end());
+				out.write(static_cast<uint32_t>(file.data.size()));
+				out.bytes(file.data.begin(), file.data.end());
+			}
+		}
+
+		static FileBatch deserialize(const uint8_t* buf, size_t size);
+	};
+
+	// Non-owning FileBatch: names and contents point into the parsed buffer.
+	struct FileBatchView
+	{
+		static constexpr PacketType type = PacketType::FileBatch;
+
+		struct Entry
+		{
+			std::string_view fileName;
+			std::span<const uint8_t> data;
+		};
+		std::vector<Entry> files;
+
+		static FileBatchView deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < sizeof(uint32_t)) throw std::runtime_error("FileBatch: payload too small.");
+
+			size_t cursor = 0;
+			uint32_t count = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(count);
+
+			if (count > MAX_BATCH_FILES)
+				throw std::runtime_error("FileBatch: too many files (DoS protection).");
+
+			// Every entry needs at least its two length fields
+			if ((size - cursor) / FileBatch::ENTRY_OVERHEAD < count)
+				throw std::runtime_error("FileBatch: count exceeds buffer.");
+
+			FileBatchView batch;
+			batch.files.reserve(count);
+
+			for (uint32_t i = 0; i < count; ++i) {
+				Entry entry;
+
+				if (size - cursor < sizeof(uint32_t)) throw std::runtime_error("FileBatch: truncated entry.");
+				uint32_t nameLen = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+				cursor += sizeof(nameLen);
+
+				if (nameLen == 0 || nameLen > MAX_STRING_LENGTH)
+					throw std::runtime_error("FileBatch: bad filename length.");
+				if (size - cursor < nameLen) throw std::runtime_error("FileBatch: corrupted name length mismatch.");
+				entry.fileName = std::string_view(reinterpret_cast<const char*>(buf + cursor), nameLen);
+				cursor += nameLen;
+
+				if (size - cursor < sizeof(uint32_t)) throw std::runtime_error("FileBatch: truncated entry.");
+				uint32_t dataLen = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+				cursor += sizeof(dataLen);
+
+				if (dataLen > MAX_CHUNK_SIZE) throw std::runtime_error("FileBatch: Size unreasonable (DoS protection).");
+				if (size - cursor < dataLen) throw std::runtime_error("FileBatch: corrupted length mismatch");
+				entry.data = std::span<const uint8_t>(buf + cursor, dataLen);
+				cursor += dataLen;
+
+				batch.files.push_back(entry);
+			}
+
+			return batch;
+		}
+	};
+
+	inline FileBatch FileBatch::deserialize(const uint8_t* buf, size_t size)
+	{
+		FileBatchView view = FileBatchView::deserialize(buf, size);
+
+		FileBatch batch;
+		batch.files.reserve(view.files.size());
+		for (const auto& entry : view.files) {
+			batch.files.push_back({ std::string(entry.fileName), std::vector<uint8_t>(entry.data.begin(), entry.data.end()) });
+		}
+		return batch;
+	}
+
+	// What the sender holds for one file of a sync (see Manifest).
+	struct ManifestEntry
+	{
+		std::string fileName;
+		std::uint64_t fileSize = 0;
+		std::int64_t modifiedNs = 0; // Nanoseconds since the Unix epoch
+		std::uint64_t hash = 0;      // Content hash, 0 = not computed
+
+		static constexpr size_t FIXED_SIZE = sizeof(uint32_t) + sizeof(fileSize) + sizeof(modifiedNs) + sizeof(hash);
+	};
+
+	// Sync mode: the sender lists files it is about to upload and the receiver
+	// answers with a ManifestDiff naming those its copy does not match. Only
+	// those are sent. 'requestId' pairs the reply with its request.
+	struct Manifest
+	{
+		static constexpr PacketType type = PacketType::Manifest;
+		std::uint32_t requestId = 0;
+		std::vector<ManifestEntry> entries;
+
+		std::size_t payloadSize() const {
+			std::size_t size = sizeof(requestId) + sizeof(uint32_t);
+			for (const auto& entry : entries) size += ManifestEntry::FIXED_SIZE + entry.fileName.size();
+			return size;
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (entries.size() > MAX_MANIFEST_ENTRIES) throw std::length_error("Manifest: too many entries");
+
+			out.write(requestId);
+			out.write(static_cast<uint32_t>(entries.size()));
+			for (const auto& entry : entries) {
+				if (entry.fileName.empty()) throw std::length_error("Manifest: Filename empty");
+				if (entry.fileName.size() > MAX_STRING_LENGTH) throw std::length_error("Manifest: Filename too long");
+
+				out.write(static_cast<uint32_t>(entry.fileName.size()));
+				out.bytes(entry.fileName.begin(), entry.fileName.end());
+				out.write(entry.fileSize);
+				out.write(static_cast<uint64_t>(entry.modifiedNs));
+				out.write(entry.hash);
+			}
+		}
+
+		static Manifest deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < 2 * sizeof(uint32_t)) throw std::runtime_error("Manifest: payload too small.");
+
+			Manifest manifest;
+			size_t cursor = 0;
+
+			manifest.requestId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(manifest.requestId);
+
+			uint32_t count = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(count);
+
+			if (count > MAX_MANIFEST_ENTRIES)
+				throw std::runtime_error("Manifest: too many entries (DoS protection).");
+			if ((size - cursor) / ManifestEntry::FIXED_SIZE < count)
+				throw std::runtime_error("Manifest: count exceeds buffer.");
+
+			manifest.entries.reserve(count);
+			for (uint32_t i = 0; i < count; ++i) {
+				ManifestEntry entry;
+
+				if (size - cursor < sizeof(uint32_t)) throw std::runtime_error("Manifest: truncated entry.");
+				uint32_t nameLen = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+				cursor += sizeof(nameLen);
+
+				if (nameLen == 0 || nameLen > MAX_STRING_LENGTH)
+					throw std::runtime_error("Manifest: bad filename length.");
+				if (size - cursor < nameLen + ManifestEntry::FIXED_SIZE - sizeof(uint32_t))
+					throw std::runtime_error("Manifest: truncated entry.");
+
+				entry.fileName.assign(reinterpret_cast<const char*>(buf + cursor), nameLen);
+				cursor += nameLen;
+
+				entry.fileSize = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+				cursor += sizeof(entry.fileSize);
+
+				entry.modifiedNs = static_cast<int64_t>(cw::binary::readBigEndian<uint64_t>(buf + cursor));
+				cursor += sizeof(entry.modifiedNs);
+
+				entry.hash = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+				cursor += sizeof(entry.hash);
+
+				manifest.entries.push_back(std::move(entry));
+			}
+
+			return manifest;
+		}
+	};
+
+	// Directory uploads: the directories (relative paths) files are about to
+	// arrive in, sent ahead of them so the receiver creates them in bulk
+	// rather than checking the parents of every file. Nothing is answered.
+	// Only sent to a peer advertising CAP_DIRECTORY_MANIFEST.
+	struct DirectoryManifest
+	{
+		static constexpr PacketType type = PacketType::DirectoryManifest;
+		std::vector<std::string> directories;
+
+		std::size_t payloadSize() const {
+			std::size_t size = sizeof(uint32_t);
+			for (const auto& directory : directories) size += sizeof(uint32_t) + directory.size();
+			return size;
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (directories.size() > MAX_DIRECTORY_ENTRIES) throw std::length_error("DirectoryManifest: too many entries");
+
+			out.write(static_cast<uint32_t>(directories.size()));
+			for (const auto& directory : directories) {
+				if (directory.empty()) throw std::length_error("DirectoryManifest: Name empty");
+				if (directory.size() > MAX_STRING_LENGTH) throw std::length_error("DirectoryManifest: Name too long");
+
+				out.write(static_cast<uint32_t>(directory.size()));
+				out.bytes(directory.begin(), directory.end());
+			}
+		}
+
+		static DirectoryManifest deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < sizeof(uint32_t)) throw std::runtime_error("DirectoryManifest: payload too small.");
+
+			DirectoryManifest manifest;
+			size_t cursor = 0;
+
+			uint32_t count = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(count);
+
+			if (count > MAX_DIRECTORY_ENTRIES)
+				throw std::runtime_error("DirectoryManifest: too many entries (DoS protection).");
+			if ((size - cursor) / sizeof(uint32_t) < count)
+				throw std::runtime_error("DirectoryManifest: count exceeds buffer.");
+
+			manifest.directories.reserve(count);
+			for (uint32_t i = 0; i < count; ++i) {
+				if (size - cursor < sizeof(uint32_t)) throw std::runtime_error("DirectoryManifest: truncated entry.");
+				uint32_t nameLen = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+				cursor += sizeof(nameLen);
+
+				if (nameLen == 0 || nameLen > MAX_STRING_LENGTH)
+					throw std::runtime_error("DirectoryManifest: bad name length.");
+				if (size - cursor < nameLen) throw std::runtime_error("DirectoryManifest: truncated entry.");
+
+				manifest.directories.emplace_back(reinterpret_cast<const char*>(buf + cursor), nameLen);
+				cursor += nameLen;
+			}
+
+			return manifest;
+		}
+	};
+
+	// A range of a file that holds only zeros (a hole of a sparse source),
+	// sent instead of chunks of zeros. The receiver leaves it unallocated
+	// and counts it as received. Only sent to a peer advertising CAP_SPARSE_FILES.
+	struct FileHole : FixedLayoutPacket<FileHole>
+	{
+		static constexpr PacketType type = PacketType::FileHole;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset = 0;
+		std::uint64_t length = 0;
+
+		using Layout = WireLayout<&FileHole::streamId, &FileHole::offset, &FileHole::length>;
+	};
+
+	// Asks the peer for a file under the roots it serves (CAP_DOWNLOADS):
+	// 'path' relative to one of them, bytes [offset, offset + length) of it
+	// (length 0 = to the end). The file comes back on 'streamId', picked by
+	// the requester, as an upload would: FileInfo (or FileResume) named
+	// 'fileName', its chunks at offsets from the start of the range,
+	// FileDone. A refused request is answered with a FileDone alone.
+	// With 'stripeCount' > 1 the range is split in as many slices and this
+	// asks for slice 'stripeIndex' only, announced with a StripeInfo of
+	// 'transferId': requests on several connections fill one file together.
+	struct FileRequest
+	{
+		static constexpr PacketType type = PacketType::FileRequest;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset = 0;
+		std::uint64_t length = 0;
+		std::uint64_t transferId = 0;
+		std::uint16_t stripeIndex = 0;
+		std::uint16_t stripeCount = 1;
+		std::string path;
+		std::string fileName;
+
+		std::size_t payloadSize() const {
+			return sizeof(streamId) + sizeof(offset) + sizeof(length) + sizeof(transferId) + sizeof(stripeIndex) + sizeof(stripeCount) +
+				2 * sizeof(uint32_t) + path.size() + fileName.size();
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (path.empty()) throw std::length_error("FileRequest: Path empty");
+			if (path.size() > MAX_STRING_LENGTH) throw std::length_error("FileRequest: Path too long");
+			if (fileName.empty()) throw std::length_error("FileRequest: Filename empty");
+			if (fileName.size() > MAX_STRING_LENGTH) throw std::length_error("FileRequest: Filename too long");
+
+			out.write(streamId);
+			out.write(offset);
+			out.write(length);
+			out.write(transferId);
+			out.write(stripeIndex);
+			out.write(stripeCount);
+			out.write(static_cast<uint32_t>(path.size()));
+			out.bytes(path.begin(), path.end());
+			out.write(static_cast<uint32_t>(fileName.size()));
+			out.bytes(fileName.begin(), fileName.end());
+		}
+
+		static FileRequest deserialize(const uint8_t* buf, size_t size)
+		{
+			constexpr size_t MIN_SIZE = sizeof(streamId) + sizeof(offset) + sizeof(length) + sizeof(transferId) + sizeof(stripeIndex) + sizeof(stripeCount) +
+				2 * sizeof(uint32_t);
+			if (size < MIN_SIZE) throw std::runtime_error("FileRequest: payload too small.");
+
+			FileRequest request;
+			size_t cursor = 0;
+
+			request.streamId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(request.streamId);
+
+			request.offset = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(request.offset);
+
+			request.length = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(request.length);
+
+			request.transferId = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(request.transferId);
+
+			request.stripeIndex = cw::binary::readBigEndian<uint16_t>(buf + cursor);
+			cursor += sizeof(request.stripeIndex);
+
+			request.stripeCount = cw::binary::readBigEndian<uint16_t>(buf + cursor);
+			cursor += sizeof(request.stripeCount);
+
+			auto readString = [&](std::string& out) {
+				if (size - cursor < sizeof(uint32_t))
+					throw std::runtime_error("FileRequest: payload too small.");
+				uint32_t len = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+				cursor += sizeof(len);
+
+				if (len > MAX_STRING_LENGTH)
+					throw std::runtime_error("FileRequest: string too long (DoS protection).");
+				if (size - cursor < len)
+					throw std::runtime_error("FileRequest: corrupted string length mismatch.");
+
+				out.assign(reinterpret_cast<const char*>(buf + cursor), len);
+				cursor += len;
+			};
+			readString(request.path);
+			readString(request.fileName);
+
+			return request;
+		}
+	};
+
+	// Starts a tar-like archive on stream 'streamId' (CAP_ARCHIVES): many small
+	// files packed into one byte stream, sent as a file's chunks are
+	// (FileChunk or CompressedChunk, resent on Retransmit) and ended by a
+	// FileDone with the stream's size and digest. The receiver unpacks the
+	// members as they complete (see cw::file::ArchiveUnpacker for the layout).
+	// 'fileSize' is the archive's length, UNKNOWN_FILE_SIZE while it is packed.
+	struct ArchiveInfo : FixedLayoutPacket<ArchiveInfo>
+	{
+		static constexpr PacketType type = PacketType::ArchiveInfo;
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize = UNKNOWN_FILE_SIZE;
+
+		using Layout = WireLayout<&ArchiveInfo::streamId, &ArchiveInfo::fileSize>;
+	};
+
+	// Sent by the receiver right after the Ack completing a file, to a peer
+	// advertising CAP_TRANSFER_STATS: where the file's time went on its side,
+	// so the sender can log the receiver's bottleneck and tune chunk size,
+	// streams and compression to it. Times are in nanoseconds; disk times
+	// run from a chunk leaving the socket to its write landing.
+	struct TransferStats : FixedLayoutPacket<TransferStats>
+	{
+		static constexpr PacketType type = PacketType::TransferStats;
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize = 0;
+		std::uint64_t receiveNanos = 0; // Opening packet to the file being published
+		std::uint64_t stallNanos = 0;   // Socket reads paused while the disk caught up
+		std::uint64_t diskWrites = 0;
+		std::uint64_t diskMeanNanos = 0;
+		std::uint64_t diskP99Nanos = 0;
+
+		using Layout = WireLayout<&TransferStats::streamId, &TransferStats::fileSize, &TransferStats::receiveNanos, &TransferStats::stallNanos,
+			&TransferStats::diskWrites, &TransferStats::diskMeanNanos, &TransferStats::diskP99Nanos>;
+	};
+
+	// Sent just ahead of a stream's FileDone, on the same connection, to a
+	// peer advertising CAP_TREE_HASH: the root of the cw::integrity::TreeHash
+	// of the chunks the stream carried and, up to MAX_TREE_LEAVES, its leaves.
+	// The receiver asks again for the ranges whose leaves differ from its own
+	// and fails the file if the roots still differ at FileDone.
+	struct TreeDigest
+	{
+		static constexpr PacketType type = PacketType::TreeDigest;
+		std::uint32_t streamId = 0;
+		cw::integrity::Sha256Digest root{};
+		std::vector<cw::integrity::TreeLeaf> leaves; // In offset order; empty if there were too many
+
+		static constexpr size_t LEAF_WIRE_SIZE = sizeof(std::uint64_t) + sizeof(std::uint32_t) + sizeof(cw::integrity::Sha256Digest);
+
+		std::size_t payloadSize() const {
+			return sizeof(streamId) + sizeof(cw::integrity::Sha256Digest) + sizeof(uint32_t) + leaves.size() * LEAF_WIRE_SIZE;
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (leaves.size() > MAX_TREE_LEAVES) throw std::length_error("TreeDigest: too many leaves");
+
+			out.write(streamId);
+			out.bytes(root.begin(), root.end());
+			out.write(static_cast<uint32_t>(leaves.size()));
+			for (const auto& leaf : leaves) {
+				out.write(leaf.offset);
+				out.write(leaf.length);
+				out.bytes(leaf.hash.begin(), leaf.hash.end());
+			}
+		}
+
+		static TreeDigest deserialize(const uint8_t* buf, size_t size)
+		{
+			constexpr size_t MIN_SIZE = sizeof(uint32_t) + sizeof(cw::integrity::Sha256Digest) + sizeof(uint32_t);
+			if (size < MIN_SIZE) throw std::runtime_error("TreeDigest: payload too small.");
+
+			TreeDigest packet;
+			packet.streamId = cw::binary::readBigEndian<uint32_t>(buf);
+			std::memcpy(packet.root.data(), buf + sizeof(uint32_t), packet.root.size());
+			uint32_t count = cw::binary::readBigEndian<uint32_t>(buf + sizeof(uint32_t) + sizeof(cw::integrity::Sha256Digest));
+			size_t cursor = MIN_SIZE;
+
+			if (count > MAX_TREE_LEAVES)
+				throw std::runtime_error("TreeDigest: too many leaves (DoS protection).");
+			if ((size - cursor) / LEAF_WIRE_SIZE < count)
+				throw std::runtime_error("TreeDigest: count exceeds buffer.");
+
+			packet.leaves.resize(count);
+			for (auto& leaf : packet.leaves) {
+				leaf.offset = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+				leaf.length = cw::binary::readBigEndian<uint32_t>(buf + cursor + sizeof(uint64_t));
+				std::memcpy(leaf.hash.data(), buf + cursor + sizeof(uint64_t) + sizeof(uint32_t), leaf.hash.size());
+				cursor += LEAF_WIRE_SIZE;
+
+				if (leaf.length == 0 || leaf.length > MAX_CHUNK_SIZE)
+					throw std::runtime_error("TreeDigest: leaf length invalid.");
+			}
+			return packet;
+		}
+	};
+
+	// Reply to a Manifest: indices (into its entries) of the files to send.
+	struct ManifestDiff
+	{
+		static constexpr PacketType type = PacketType::ManifestDiff;
+		std::uint32_t requestId = 0;
+		std::vector<uint32_t> changed;
+
+		std::size_t payloadSize() const {
+			return sizeof(requestId) + sizeof(uint32_t) + changed.size() * sizeof(uint32_t);
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (changed.size() > MAX_MANIFEST_ENTRIES) throw std::length_error("ManifestDiff: too many entries");
+
+			out.write(requestId);
+			out.write(static_cast<uint32_t>(changed.size()));
+			out.array(changed.data(), changed.size());
+		}
+
+		static ManifestDiff deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < 2 * sizeof(uint32_t)) throw std::runtime_error("ManifestDiff: payload too small.");
+
+			ManifestDiff diff;
+			diff.requestId = cw::binary::readBigEndian<uint32_t>(buf);
+			uint32_t count = cw::binary::readBigEndian<uint32_t>(buf + sizeof(uint32_t));
+
+			if (count > MAX_MANIFEST_ENTRIES)
+				throw std::runtime_error("ManifestDiff: too many entries (DoS protection).");
+			if ((size - 2 * sizeof(uint32_t)) / sizeof(uint32_t) < count)
+				throw std::runtime_error("ManifestDiff: count exceeds buffer.");
+
+			diff.changed.resize(count);
+			cw::binary::readBigEndianArray(buf + 2 * sizeof(uint32_t), diff.changed.data(), count);
+			return diff;
+		}
+	};
+
+	// Delta mode, step 1: the sender asks for the block signatures of the
+	// receiver's current copy of 'fileName'.
+	struct SignatureRequest
+	{
+		static constexpr PacketType type = PacketType::SignatureRequest;
+		std::uint32_t requestId = 0;
+		std::string fileName;
+
+		std::size_t payloadSize() const {
+			return sizeof(requestId) + sizeof(uint32_t) + fileName.size();
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (fileName.empty()) throw std::length_error("SignatureRequest: Filename empty");
+			if (fileName.size() > MAX_STRING_LENGTH) throw std::length_error("SignatureRequest: Filename too long");
+
+			out.write(requestId);
+			out.write(static_cast<uint32_t>(fileName.size()));
+			out.bytes(fileName.begin(), fileName.end());
+		}
+
+		static SignatureRequest deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < 2 * sizeof(uint32_t)) throw std::runtime_error("SignatureRequest: payload too small.");
+
+			SignatureRequest request;
+			request.requestId = cw::binary::readBigEndian<uint32_t>(buf);
+			uint32_t nameLen = cw::binary::readBigEndian<uint32_t>(buf + sizeof(uint32_t));
+
+			if (nameLen == 0 || nameLen > MAX_STRING_LENGTH)
+				throw std::runtime_error("SignatureRequest: bad filename length.");
+			if (size - 2 * sizeof(uint32_t) < nameLen)
+				throw std::runtime_error("SignatureRequest: corrupted name length mismatch.");
+
+			request.fileName.assign(reinterpret_cast<const char*>(buf + 2 * sizeof(uint32_t)), nameLen);
+			return request;
+		}
+	};
+
+	struct BlockSignature
+	{
+		std::uint32_t weak;   // Rolling checksum
+		std::uint64_t strong; // Confirms a weak match
+	};
+
+	// Step 2: signatures of every whole 'blockSize' block of the receiver's
+	// copy. blockSize == 0 means there is no copy to build on.
+	struct Signatures
+	{
+		static constexpr PacketType type = PacketType::Signatures;
+		std::uint32_t requestId = 0;
+		std::uint32_t blockSize = 0;
+		std::uint64_t fileSize = 0;
+		std::vector<BlockSignature> blocks;
+
+		static constexpr size_t HEADER_SIZE = 2 * sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+		static constexpr size_t BLOCK_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+		std::size_t payloadSize() const {
+			return HEADER_SIZE + blocks.size() * BLOCK_SIZE;
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (blocks.size() > MAX_SIGNATURE_BLOCKS) throw std::length_error("Signatures: too many blocks");
+
+			out.write(requestId);
+			out.write(blockSize);
+			out.write(fileSize);
+			out.write(static_cast<uint32_t>(blocks.size()));
+			for (const auto& block : blocks) {
+				out.write(block.weak);
+				out.write(block.strong);
+			}
+		}
+
+		static Signatures deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < HEADER_SIZE) throw std::runtime_error("Signatures: payload too small.");
+
+			Signatures signatures;
+			size_t cursor = 0;
+
+			signatures.requestId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(signatures.requestId);
+
+			signatures.blockSize = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(signatures.blockSize);
+
+			signatures.fileSize = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(signatures.fileSize);
+
+			uint32_t count = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(count);
+
+			if (count > MAX_SIGNATURE_BLOCKS)
+				throw std::runtime_error("Signatures: too many blocks (DoS protection).");
+			if ((size - cursor) / BLOCK_SIZE < count)
+				throw std::runtime_error("Signatures: count exceeds buffer.");
+			if (count > 0 && signatures.blockSize == 0)
+				throw std::runtime_error("Signatures: blocks without a block size.");
+
+			signatures.blocks.reserve(count);
+			for (uint32_t i = 0; i < count; ++i) {
+				BlockSignature block;
+				block.weak = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+				block.strong = cw::binary::readBigEndian<uint64_t>(buf + cursor + sizeof(uint32_t));
+				cursor += BLOCK_SIZE;
+				signatures.blocks.push_back(block);
+			}
+			return signatures;
+		}
+	};
+
+	// Step 3: a delta-encoded file follows on 'streamId'. The receiver builds it
+	// next to its old copy from FileChunks (literal bytes) and BlockCopys
+	// (ranges of the old copy), and replaces the old copy at DeltaDone.
+	struct DeltaInfo
+	{
+		static constexpr PacketType type = PacketType::DeltaInfo;
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize;
+		std::string fileName;
+
+		std::size_t payloadSize() const {
+			return sizeof(streamId) + sizeof(fileSize) + sizeof(uint32_t) + fileName.size();
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (fileName.empty()) throw std::length_error("DeltaInfo: Filename empty");
+			if (fileName.size() > MAX_STRING_LENGTH) throw std::length_error("DeltaInfo: Filename too long");
+
+			out.write(streamId);
+			out.write(fileSize);
+			out.write(static_cast<uint32_t>(fileName.size()));
+			out.bytes(fileName.begin(), fileName.end());
+		}
+
+		static DeltaInfo deserialize(const uint8_t* buf, size_t size)
+		{
+			constexpr size_t MIN_SIZE = sizeof(streamId) + sizeof(fileSize) + sizeof(uint32_t);
+			if (size < MIN_SIZE) throw std::runtime_error("DeltaInfo: payload too small.");
+
+			DeltaInfo info;
+			info.streamId = cw::binary::readBigEndian<uint32_t>(buf);
+			info.fileSize = cw::binary::readBigEndian<uint64_t>(buf + sizeof(uint32_t));
+			uint32_t nameLen = cw::binary::readBigEndian<uint32_t>(buf + sizeof(uint32_t) + sizeof(uint64_t));
+
+			if (nameLen == 0 || nameLen > MAX_STRING_LENGTH)
+				throw std::runtime_error("DeltaInfo: bad filename length.");
+			if (size - MIN_SIZE < nameLen)
+				throw std::runtime_error("DeltaInfo: corrupted name length mismatch.");
+
+			info.fileName.assign(reinterpret_cast<const char*>(buf + MIN_SIZE), nameLen);
+			return info;
+		}
+	};
+
+	// 'length' bytes at 'sourceOffset' of the receiver's old copy belong at
+	// 'offset' of the file being built.
+	struct BlockCopy : FixedLayoutPacket<BlockCopy>
+	{
+		static constexpr PacketType type = PacketType::BlockCopy;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset;
+		std::uint64_t sourceOffset;
+		std::uint64_t length;
+
+		using Layout = WireLayout<&BlockCopy::streamId, &BlockCopy::offset, &BlockCopy::sourceOffset, &BlockCopy::length>;
+	};
+
+	// Step 4: end of a delta. 'hash' (cw::file::contentHash of the whole new
+	// file) is checked before the rebuilt file replaces the old copy.
+	struct DeltaDone : FixedLayoutPacket<DeltaDone>
+	{
+		static constexpr PacketType type = PacketType::DeltaDone;
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize;
+		std::uint64_t hash;
+
+		using Layout = WireLayout<&DeltaDone::streamId, &DeltaDone::fileSize, &DeltaDone::hash>;
+	};
+
+	// The connection handshake: sent by both ends as their first frame, each
+	// without waiting for the other's, so it costs no round trip. Everything a
+	// performance feature needs agreed is in here; a sender uses a feature
+	// only once the peer's Capabilities have arrived (asyncWaitCapabilities).
+	// Fields were appended over time, and absent ones read as an older peer's:
+	// version 1, nothing offered, no limits.
+	constexpr std::uint16_t PROTOCOL_VERSION = 2;     // 1: before version and tunables were sent
+	constexpr std::uint16_t MIN_PROTOCOL_VERSION = 1; // Oldest peer this end talks to
+
+	// Capabilities::features bits
+	constexpr std::uint32_t CAP_DESCRIPTORS = 1u << 0; // Takes FileRange with a passed descriptor
+	constexpr std::uint32_t CAP_SERVER_COPY = 1u << 1; // Takes FileCopy (copies paths under its allowed roots)
+	constexpr std::uint32_t CAP_COMPACT_FRAMES = 1u << 2; // Reads compact frame headers (FrameFormat::Compact)
+	constexpr std::uint32_t CAP_DIRECTORY_MANIFEST = 1u << 3; // Takes DirectoryManifest
+	constexpr std::uint32_t CAP_DURABLE_ACKS = 1u << 4; // Acks a file only once it is on stable storage
+	constexpr std::uint32_t CAP_SPARSE_FILES = 1u << 5; // Takes FileHole
+	constexpr std::uint32_t CAP_DOWNLOADS = 1u << 6; // Serves files it is sent a FileRequest for
+	constexpr std::uint32_t CAP_UNSIZED_FILES = 1u << 7; // Takes FileInfo of UNKNOWN_FILE_SIZE
+	constexpr std::uint32_t CAP_ARCHIVES = 1u << 8; // Takes ArchiveInfo streams
+	constexpr std::uint32_t CAP_TRANSFER_STATS = 1u << 9; // Takes a TransferStats after each file it sends
+	constexpr std::uint32_t CAP_TREE_HASH = 1u << 10; // Hashes the chunks it receives and checks a TreeDigest
+	constexpr std::uint32_t CAP_SESSIONS = 1u << 11; // Takes Session: a reconnecting peer takes over its older connection
+	constexpr std::uint32_t CAP_ACK_BATCH = 1u << 12; // Takes AckBatch
+	constexpr std::uint32_t CAP_HEARTBEAT = 1u << 13; // Answers a Ping with a Pong
+	constexpr std::uint32_t CAP_SUBTREE_DIGESTS = 1u << 14; // Answers SubtreeDigests
+	constexpr std::uint32_t CAP_BATCH_COMPRESSION = 1u << 15; // Takes CompressedBatch and BatchDictionary
+	constexpr std::uint32_t CAP_FRONT_CODED_PATHS = 1u << 16; // Takes FrontCodedFileInfo
+	constexpr std::uint32_t CAP_FILE_ATTRIBUTES = 1u << 17; // Sets the mtime and mode of a FileAttributes on the file
+	constexpr std::uint32_t CAP_ADMISSION_CONTROL = 1u << 18; // May refuse a new file with ErrorCode::Busy while its disk is behind
+	constexpr std::uint32_t CAP_STATS = 1u << 19; // Answers a StatsRequest
+	constexpr std::uint32_t CAP_NATIVE_FRAMES = 1u << 20; // Little-endian host, reads native frames (FrameFormat::Native)
+	constexpr std::uint32_t CAP_SEALED_CHUNKS = 1u << 21; // Holds the shared ChunkKey and takes SealedChunk
+	constexpr std::uint32_t CAP_INLINE_FILES = 1u << 22; // Takes a whole small file in its FileInfo (FILE_INFO_CONTENT)
+
+	struct Capabilities
+	{
+		static constexpr PacketType type = PacketType::Capabilities;
+		std::uint32_t codecs = 0;   // cw::compression::codecBit values this end can decompress
+		std::uint32_t features = 0; // CAP_* bits
+		std::uint16_t version = 1;
+		std::uint32_t maxChunkSize = 0;  // Largest chunk this end wants to receive; 0 = MAX_CHUNK_SIZE
+		std::uint64_t receiveWindow = 0; // Most unacked bytes per file it wants in flight; 0 = sender's choice
+
+		static constexpr size_t BASE_SIZE = 2 * sizeof(uint32_t); // codecs, features
+
+		std::size_t payloadSize() const { return BASE_SIZE + sizeof(version) + sizeof(maxChunkSize) + sizeof(receiveWindow); }
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			out.write(codecs);
+			out.write(features);
+			out.write(version);
+			out.write(maxChunkSize);
+			out.write(receiveWindow);
+		}
+
+		static Capabilities deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < sizeof(uint32_t)) throw std::runtime_error("Capabilities: payload too small.");
+
+			Capabilities caps;
+			caps.codecs = cw::binary::readBigEndian<uint32_t>(buf);
+			if (size >= BASE_SIZE) caps.features = cw::binary::readBigEndian<uint32_t>(buf + 4);
+			if (size >= BASE_SIZE + 2 + 4 + 8) {
+				caps.version = cw::binary::readBigEndian<uint16_t>(buf + BASE_SIZE);
+				caps.maxChunkSize = cw::binary::readBigEndian<uint32_t>(buf + BASE_SIZE + 2);
+				caps.receiveWindow = cw::binary::readBigEndian<uint64_t>(buf + BASE_SIZE + 6);
+			}
+			return caps;
+		}
+	};
+
+	// A FileChunk whose data is compressed with 'codec'. Chunks that did not
+	// shrink travel as plain FileChunks, so the packet type is the per-chunk flag.
+	// The payload segment is the compressed bytes; 'rawSize' is what they expand to.
+	struct CompressedChunk
+	{
+		static constexpr PacketType type = PacketType::CompressedChunk;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset;
+		std::uint8_t codec;
+		std::uint32_t rawSize;
+		cw::buffer::SharedBuffer data;
+		std::optional<uint32_t> crc; // CRC32C of the raw bytes, checked after decompression
+
+		static constexpr size_t HEADER_SIZE = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint8_t) + 2 * sizeof(uint32_t) + CHECKSUM_FIELD_SIZE;
+
+		std::size_t payloadSize() const { return HEADER_SIZE + data.size(); }
+
+		void serializeHeader(cw::binary::ByteWriter& out) const
+		{
+			if (data.size() > MAX_CHUNK_SIZE || rawSize > MAX_CHUNK_SIZE)
+				throw std::length_error("CompressedChunk: Data exceeds protocol limit.");
+
+			out.write(streamId);
+			out.write(offset);
+			out.write<uint8_t>(codec);
+			out.write(rawSize);
+			out.write(static_cast<uint32_t>(data.size()));
+			writeChecksum(out, crc);
+		}
+
+		const cw::buffer::SharedBuffer& payloadSegment() const { return data; }
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			serializeHeader(out);
+			out.bytes(data.data(), data.data() + data.size());
+		}
+	};
+
+	// Receive-side CompressedChunk: 'data' points into the parsed buffer.
+	struct CompressedChunkView
+	{
+		static constexpr PacketType type = PacketType::CompressedChunk;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset;
+		std::uint8_t codec;
+		std::uint32_t rawSize;
+		std::span<const uint8_t> data;
+		std::optional<uint32_t> crc;
+
+		static CompressedChunkView deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < CompressedChunk::HEADER_SIZE) throw std::runtime_error("CompressedChunk: payload too small.");
+
+			CompressedChunkView chunk;
+			size_t cursor = 0;
+
+			chunk.streamId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(chunk.streamId);
+
+			chunk.offset = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(chunk.offset);
+
+			chunk.codec = buf[cursor];
+			cursor += sizeof(chunk.codec);
+
+			chunk.rawSize = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(chunk.rawSize);
+
+			uint32_t length = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(length);
+
+			chunk.crc = readChecksum(buf + cursor);
+			cursor += CHECKSUM_FIELD_SIZE;
+
+			if (chunk.rawSize > MAX_CHUNK_SIZE)
+				throw std::runtime_error("CompressedChunk: raw size exceeds protocol limit.");
+			if (size - cursor < length)
+				throw std::runtime_error("CompressedChunk: corrupted length mismatch.");
+
+			chunk.data = std::span<const uint8_t>(buf + cursor, length);
+			return chunk;
+		}
+	};
+
+	// A FileChunk or CompressedChunk sealed with its file's ChunkCipher (see
+	// cw::integrity::ChunkCipher), for transports without TLS: 'data' is the
+	// ciphertext and tag of the chunk's bytes, compressed first if 'codec'
+	// is not None, and the tag also covers offset, suite, codec and rawSize
+	// (ChunkCipher::associatedData). The salt names the file's key; the
+	// stream id is not covered, so a relay may renumber it. No CRC: the tag
+	// checks the bytes.
+	struct SealedChunk
+	{
+		static constexpr PacketType type = PacketType::SealedChunk;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset = 0;
+		std::uint8_t suite = 0;      // cw::integrity::ChunkCipherSuite
+		std::uint8_t codec = 0;      // cw::compression::Codec of the sealed bytes
+		std::uint32_t rawSize = 0;   // Of the chunk once opened and decompressed
+		cw::integrity::ChunkSalt salt{};
+		cw::buffer::SharedBuffer data;
+
+		static constexpr size_t HEADER_SIZE = sizeof(uint32_t) + sizeof(uint64_t) + 2 * sizeof(uint8_t) + 2 * sizeof(uint32_t) + cw::integrity::CHUNK_SALT_SIZE;
+
+		std::size_t payloadSize() const { return HEADER_SIZE + data.size(); }
+
+		void serializeHeader(cw::binary::ByteWriter& out) const
+		{
+			if (rawSize > MAX_CHUNK_SIZE || data.size() > MAX_CHUNK_SIZE + cw::integrity::CHUNK_TAG_SIZE)
+				throw std::length_error("SealedChunk: Data exceeds protocol limit.");
+
+			out.write(streamId);
+			out.write(offset);
+			out.write<uint8_t>(suite);
+			out.write<uint8_t>(codec);
+			out.write(rawSize);
+			out.bytes(salt.begin(), salt.end());
+			out.write(static_cast<uint32_t>(data.size()));
+		}
+
+		const cw::buffer::SharedBuffer& payloadSegment() const { return data; }
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			serializeHeader(out);
+			out.bytes(data.data(), data.data() + data.size());
+		}
+	};
+
+	// Receive-side SealedChunk: 'data' points into the parsed buffer
+	struct SealedChunkView
+	{
+		static constexpr PacketType type = PacketType::SealedChunk;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset = 0;
+		std::uint8_t suite = 0;
+		std::uint8_t codec = 0;
+		std::uint32_t rawSize = 0;
+		cw::integrity::ChunkSalt salt{};
+		std::span<const uint8_t> data;
+
+		static SealedChunkView deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < SealedChunk::HEADER_SIZE) throw std::runtime_error("SealedChunk: payload too small.");
+
+			SealedChunkView chunk;
+			size_t cursor = 0;
+			chunk.streamId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(chunk.streamId);
+			chunk.offset = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(chunk.offset);
+			chunk.suite = buf[cursor++];
+			chunk.codec = buf[cursor++];
+			chunk.rawSize = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(chunk.rawSize);
+			std::copy_n(buf + cursor, chunk.salt.size(), chunk.salt.begin());
+			cursor += chunk.salt.size();
+			uint32_t length = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(length);
+
+			if (chunk.rawSize > MAX_CHUNK_SIZE)
+				throw std::runtime_error("SealedChunk: raw size exceeds protocol limit.");
+			if (length < cw::integrity::CHUNK_TAG_SIZE || size - cursor < length)
+				throw std::runtime_error("SealedChunk: corrupted length mismatch.");
+
+			chunk.data = std::span<const uint8_t>(buf + cursor, length);
+			return chunk;
+		}
+	};
+
+	// Receiver -> sender: 'length' bytes at 'offset' of stream 'streamId' failed
+	// their CRC32C and were dropped; send them again as a FileChunk. The
+	// receiver holds back the stream's completion until they are in.
+	struct Retransmit : FixedLayoutPacket<Retransmit>
+	{
+		static constexpr PacketType type = PacketType::Retransmit;
+		std::uint32_t streamId = 0;
+		std::uint64_t offset = 0;
+		std::uint32_t length = 0;
+
+		using Layout = WireLayout<&Retransmit::streamId, &Retransmit::offset, &Retransmit::length>;
+
+		void validate() const
+		{
+			if (length > MAX_CHUNK_SIZE)
+				throw std::runtime_error("Retransmit: length exceeds protocol limit.");
+		}
+	};
+
+	// Sender -> receiver, first on every connection of a client that
+	// reconnects: 'sessionId' (random, picked by the client) names the client
+	// across its connections. A receiver that still holds an older connection
+	// of the session closes it (its files keep what reached the disk for
+	// FileResume) and then echoes the packet back. An identifier, not a
+	// credential.
+	struct Session : FixedLayoutPacket<Session>
+	{
+		static constexpr PacketType type = PacketType::Session;
+		std::uint64_t sessionId = 0;
+
+		using Layout = WireLayout<&Session::sessionId>;
+	};
+
+	// Receiver progress on several streams in one frame: each entry reads as
+	// an Ack, in order. Sent to a peer advertising CAP_ACK_BATCH in place of
+	// the Acks that piled up over the ack delay (Connection::sendAck).
+	struct AckBatch
+	{
+		static constexpr PacketType type = PacketType::AckBatch;
+		std::vector<Ack> acks;
+
+		static constexpr size_t ENTRY_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+		std::size_t payloadSize() const {
+			return sizeof(uint32_t) + acks.size() * ENTRY_SIZE;
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (acks.size() > MAX_ACK_BATCH) throw std::length_error("AckBatch: too many acks");
+
+			out.write(static_cast<uint32_t>(acks.size()));
+			for (const auto& ack : acks) {
+				out.write(ack.streamId);
+				out.write(ack.offset);
+			}
+		}
+
+		static AckBatch deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < sizeof(uint32_t)) throw std::runtime_error("AckBatch: payload too small.");
+
+			uint32_t count = cw::binary::readBigEndian<uint32_t>(buf);
+			if (count > MAX_ACK_BATCH)
+				throw std::runtime_error("AckBatch: too many acks (DoS protection).");
+			if ((size - sizeof(uint32_t)) / ENTRY_SIZE < count)
+				throw std::runtime_error("AckBatch: count exceeds buffer.");
+
+			AckBatch packet;
+			packet.acks.resize(count);
+			const uint8_t* cursor = buf + sizeof(uint32_t);
+			for (auto& ack : packet.acks) {
+				ack.streamId = cw::binary::readBigEndian<uint32_t>(cursor);
+				ack.offset = cw::binary::readBigEndian<uint64_t>(cursor + sizeof(uint32_t));
+				cursor += ENTRY_SIZE;
+			}
+			return packet;
+		}
+	};
+
+	// Liveness probe, sent to a peer advertising CAP_HEARTBEAT after a quiet
+	// spell (Connection::setHeartbeat). It answers at once with a Pong
+	// echoing the nonce.
+	struct Ping : FixedLayoutPacket<Ping>
+	{
+		static constexpr PacketType type = PacketType::Ping;
+		std::uint64_t nonce = 0;
+
+		using Layout = WireLayout<&Ping::nonce>;
+	};
+
+	struct Pong : FixedLayoutPacket<Pong>
+	{
+		static constexpr PacketType type = PacketType::Pong;
+		std::uint64_t nonce = 0;
+
+		using Layout = WireLayout<&Pong::nonce>;
+	};
+
+	// Asks a peer advertising CAP_STATS for its live counters: it answers
+	// with a StatsResponse echoing 'requestId'
+	struct StatsRequest : FixedLayoutPacket<StatsRequest>
+	{
+		static constexpr PacketType type = PacketType::StatsRequest;
+		std::uint32_t requestId = 0;
+
+		using Layout = WireLayout<&StatsRequest::requestId>;
+	};
+
+	// The peer's counters, disk load and the files it is receiving, in the
+	// Prometheus text format (see cw::network::statsText), as its metrics
+	// port would serve them
+	struct StatsResponse
+	{
+		static constexpr PacketType type = PacketType::StatsResponse;
+		std::uint32_t requestId = 0;
+		std::string text;
+
+		std::size_t payloadSize() const {
+			return sizeof(requestId) + sizeof(uint32_t) + text.size();
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (text.size() > MAX_STATS_SIZE) throw std::length_error("StatsResponse: text exceeds protocol limit.");
+
+			out.write(requestId);
+			out.write(static_cast<uint32_t>(text.size()));
+			out.bytes(text.begin(), text.end());
+		}
+
+		static StatsResponse deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < 2 * sizeof(uint32_t)) throw std::runtime_error("StatsResponse: payload too small.");
+
+			StatsResponse response;
+			response.requestId = cw::binary::readBigEndian<uint32_t>(buf);
+			uint32_t length = cw::binary::readBigEndian<uint32_t>(buf + sizeof(uint32_t));
+			if (length > MAX_STATS_SIZE) throw std::runtime_error("StatsResponse: text too long (DoS protection).");
+			if (size - 2 * sizeof(uint32_t) < length) throw std::runtime_error("StatsResponse: declared length exceeds buffer.");
+
+			response.text.assign(reinterpret_cast<const char*>(buf + 2 * sizeof(uint32_t)), length);
+			return response;
+		}
+	};
+
+	// A directory of the sender's tree summed up (cw::file::SubtreeSummary):
+	// the digest of its files and those below, and the newest mtime among them
+	struct SubtreeDigest
+	{
+		std::string directory;       // Relative to the root, "." for the root itself
+		std::uint64_t digest = 0;
+		std::int64_t newestNs = 0;   // Nanoseconds since the Unix epoch
+
+		static constexpr size_t FIXED_SIZE = sizeof(uint32_t) + sizeof(digest) + sizeof(newestNs);
+	};
+
+	// Sync mode, before any Manifest, to a peer advertising
+	// CAP_SUBTREE_DIGESTS: the receiver answers with a ManifestDiff naming
+	// the directories whose copy does not match, and the sender looks only
+	// into those, down to Manifests of the files they hold directly. What
+	// goes over the wire then grows with the changes, not the tree.
+	// SUBTREE_FRESH drops what the receiver summed up for earlier requests.
+	struct SubtreeDigests
+	{
+		static constexpr PacketType type = PacketType::SubtreeDigests;
+		static constexpr std::uint8_t SUBTREE_WITH_HASH = 1 << 0; // Digests cover content hashes, not mtimes
+		static constexpr std::uint8_t SUBTREE_FRESH = 1 << 1;
+
+		std::uint32_t requestId = 0;
+		std::uint8_t flags = 0;
+		std::vector<SubtreeDigest> subtrees;
+
+		std::size_t payloadSize() const {
+			std::size_t size = sizeof(requestId) + sizeof(flags) + sizeof(uint32_t);
+			for (const auto& subtree : subtrees) size += SubtreeDigest::FIXED_SIZE + subtree.directory.size();
+			return size;
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (subtrees.size() > MAX_SUBTREE_ENTRIES) throw std::length_error("SubtreeDigests: too many entries");
+
+			out.write(requestId);
+			out.write(flags);
+			out.write(static_cast<uint32_t>(subtrees.size()));
+			for (const auto& subtree : subtrees) {
+				if (subtree.directory.empty()) throw std::length_error("SubtreeDigests: Name empty");
+				if (subtree.directory.size() > MAX_STRING_LENGTH) throw std::length_error("SubtreeDigests: Name too long");
+
+				out.write(static_cast<uint32_t>(subtree.directory.size()));
+				out.bytes(subtree.directory.begin(), subtree.directory.end());
+				out.write(subtree.digest);
+				out.write(static_cast<uint64_t>(subtree.newestNs));
+			}
+		}
+
+		static SubtreeDigests deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t)) throw std::runtime_error("SubtreeDigests: payload too small.");
+
+			SubtreeDigests packet;
+			size_t cursor = 0;
+
+			packet.requestId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(packet.requestId);
+			packet.flags = buf[cursor];
+			cursor += sizeof(packet.flags);
+
+			uint32_t count = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(count);
+
+			if (count > MAX_SUBTREE_ENTRIES)
+				throw std::runtime_error("SubtreeDigests: too many entries (DoS protection).");
+			if ((size - cursor) / SubtreeDigest::FIXED_SIZE < count)
+				throw std::runtime_error("SubtreeDigests: count exceeds buffer.");
+
+			packet.subtrees.reserve(count);
+			for (uint32_t i = 0; i < count; ++i) {
+				SubtreeDigest subtree;
+
+				if (size - cursor < sizeof(uint32_t)) throw std::runtime_error("SubtreeDigests: truncated entry.");
+				uint32_t nameLen = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+				cursor += sizeof(nameLen);
+
+				if (nameLen == 0 || nameLen > MAX_STRING_LENGTH)
+					throw std::runtime_error("SubtreeDigests: bad name length.");
+				if (size - cursor < nameLen + SubtreeDigest::FIXED_SIZE - sizeof(uint32_t))
+					throw std::runtime_error("SubtreeDigests: truncated entry.");
+
+				subtree.directory.assign(reinterpret_cast<const char*>(buf + cursor), nameLen);
+				cursor += nameLen;
+				subtree.digest = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+				cursor += sizeof(subtree.digest);
+				subtree.newestNs = static_cast<int64_t>(cw::binary::readBigEndian<uint64_t>(buf + cursor));
+				cursor += sizeof(subtree.newestNs);
+
+				packet.subtrees.push_back(std::move(subtree));
+			}
+
+			return packet;
+		}
+	};
+
+	// A zstd dictionary (cw::compression::Dictionary) for the CompressedBatch
+	// frames that name it, sent once per connection ahead of the first. Only
+	// to a peer advertising CAP_BATCH_COMPRESSION.
+	struct BatchDictionary
+	{
+		static constexpr PacketType type = PacketType::BatchDictionary;
+		std::uint32_t dictionaryId = 0;
+		std::vector<uint8_t> data;
+
+		std::size_t payloadSize() const { return sizeof(dictionaryId) + data.size(); }
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (data.empty() || data.size() > MAX_DICTIONARY_SIZE) throw std::length_error("BatchDictionary: bad size");
+
+			out.write(dictionaryId);
+			out.bytes(data.begin(), data.end());
+		}
+
+		static BatchDictionary deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size <= sizeof(uint32_t)) throw std::runtime_error("BatchDictionary: payload too small.");
+			if (size - sizeof(uint32_t) > MAX_DICTIONARY_SIZE) throw std::runtime_error("BatchDictionary: too large (DoS protection).");
+
+			BatchDictionary packet;
+			packet.dictionaryId = cw::binary::readBigEndian<uint32_t>(buf);
+			packet.data.assign(buf + sizeof(uint32_t), buf + size);
+			return packet;
+		}
+	};
+
+	// The payload of a FileBatch compressed as one: names and contents of
+	// many small files together, so what they share is found across them,
+	// with the dictionary 'dictionaryId' (a BatchDictionary sent before) or
+	// none (0). Acked as the FileBatch it holds. Only to a peer advertising
+	// CAP_BATCH_COMPRESSION, and with a codec it announced.
+	struct CompressedBatch
+	{
+		static constexpr PacketType type = PacketType::CompressedBatch;
+		std::uint8_t codec = 0;
+		std::uint32_t dictionaryId = 0;
+		std::uint32_t rawSize = 0;
+		std::vector<uint8_t> data;
+
+		static constexpr size_t HEADER_SIZE = sizeof(uint8_t) + 2 * sizeof(uint32_t);
+
+		std::size_t payloadSize() const { return HEADER_SIZE + data.size(); }
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			out.write<uint8_t>(codec);
+			out.write(dictionaryId);
+			out.write(rawSize);
+			out.bytes(data.begin(), data.end());
+		}
+
+		static CompressedBatch deserialize(const uint8_t* buf, size_t size);
+	};
+
+	// Receive-side CompressedBatch: 'data' points into the parsed buffer.
+	struct CompressedBatchView
+	{
+		static constexpr PacketType type = PacketType::CompressedBatch;
+		std::uint8_t codec = 0;
+		std::uint32_t dictionaryId = 0;
+		std::uint32_t rawSize = 0;
+		std::span<const uint8_t> data;
+
+		static CompressedBatchView deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < CompressedBatch::HEADER_SIZE) throw std::runtime_error("CompressedBatch: payload too small.");
+
+			CompressedBatchView batch;
+			batch.codec = buf[0];
+			batch.dictionaryId = cw::binary::readBigEndian<uint32_t>(buf + sizeof(uint8_t));
+			batch.rawSize = cw::binary::readBigEndian<uint32_t>(buf + sizeof(uint8_t) + sizeof(uint32_t));
+
+			if (batch.rawSize > MAX_BATCH_RAW_SIZE)
+				throw std::runtime_error("CompressedBatch: raw size exceeds protocol limit.");
+
+			batch.data = std::span<const uint8_t>(buf + CompressedBatch::HEADER_SIZE, size - CompressedBatch::HEADER_SIZE);
+			return batch;
+		}
+	};
+
+	inline CompressedBatch CompressedBatch::deserialize(const uint8_t* buf, size_t size)
+	{
+		CompressedBatchView view = CompressedBatchView::deserialize(buf, size);
+
+		CompressedBatch batch;
+		batch.codec = view.codec;
+		batch.dictionaryId = view.dictionaryId;
+		batch.rawSize = view.rawSize;
+		batch.data.assign(view.data.begin(), view.data.end());
+		return batch;
+	}
+
+	using ChunkHash = std::array<uint8_t, 32>; // SHA-256 of a content-defined chunk
+
+	// One content-defined chunk of a file. Offsets are implied: chunks are listed
+	// in file order and tile it.
+	struct ChunkRef
+	{
+		ChunkHash hash{};
+		std::uint32_t length = 0;
+
+		static constexpr size_t WIRE_SIZE = sizeof(ChunkHash) + sizeof(uint32_t);
+	};
+
+	// Dedup mode, step 1: starts file 'streamId' by listing its chunks. The
+	// receiver fills every chunk its content-addressed store already holds and
+	// answers with a ChunkRequest for the rest, which then come as FileChunks;
+	// a FileDone completes the file as usual.
+	struct ChunkManifest
+	{
+		static constexpr PacketType type = PacketType::ChunkManifest;
+		std::uint32_t streamId = 0;
+		std::uint64_t fileSize = 0;
+		std::string fileName;
+		std::vector<ChunkRef> chunks;
+
+		std::size_t payloadSize() const {
+			return sizeof(streamId) + sizeof(fileSize) + 2 * sizeof(uint32_t) + fileName.size() + chunks.size() * ChunkRef::WIRE_SIZE;
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (fileName.empty()) throw std::length_error("ChunkManifest: Filename empty");
+			if (fileName.size() > MAX_STRING_LENGTH) throw std::length_error("ChunkManifest: Filename too long");
+			if (chunks.size() > MAX_DEDUP_CHUNKS) throw std::length_error("ChunkManifest: too many chunks");
+
+			out.write(streamId);
+			out.write(fileSize);
+			out.write(static_cast<uint32_t>(fileName.size()));
+			out.bytes(fileName.begin(), fileName.end());
+			out.write(static_cast<uint32_t>(chunks.size()));
+			for (const auto& chunk : chunks) {
+				out.bytes(chunk.hash.begin(), chunk.hash.end());
+				out.write(chunk.length);
+			}
+		}
+
+		static ChunkManifest deserialize(const uint8_t* buf, size_t size)
+		{
+			constexpr size_t MIN_SIZE = sizeof(uint32_t) + sizeof(uint64_t) + 2 * sizeof(uint32_t);
+			if (size < MIN_SIZE) throw std::runtime_error("ChunkManifest: payload too small.");
+
+			ChunkManifest packet;
+			size_t cursor = 0;
+
+			packet.streamId = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(packet.streamId);
+			packet.fileSize = cw::binary::readBigEndian<uint64_t>(buf + cursor);
+			cursor += sizeof(packet.fileSize);
+
+			uint32_t nameLen = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(nameLen);
+			if (nameLen == 0 || nameLen > MAX_STRING_LENGTH)
+				throw std::runtime_error("ChunkManifest: Filename length invalid.");
+			if (size - cursor < nameLen + sizeof(uint32_t))
+				throw std::runtime_error("ChunkManifest: Filename exceeds buffer.");
+			packet.fileName.assign(reinterpret_cast<const char*>(buf + cursor), nameLen);
+			cursor += nameLen;
+
+			uint32_t count = cw::binary::readBigEndian<uint32_t>(buf + cursor);
+			cursor += sizeof(count);
+			if (count > MAX_DEDUP_CHUNKS)
+				throw std::runtime_error("ChunkManifest: too many chunks (DoS protection).");
+			if ((size - cursor) / ChunkRef::WIRE_SIZE < count)
+				throw std::runtime_error("ChunkManifest: count exceeds buffer.");
+
+			packet.chunks.resize(count);
+			uint64_t total = 0;
+			for (auto& chunk : packet.chunks) {
+				std::memcpy(chunk.hash.data(), buf + cursor, chunk.hash.size());
+				chunk.length = cw::binary::readBigEndian<uint32_t>(buf + cursor + chunk.hash.size());
+				cursor += ChunkRef::WIRE_SIZE;
+
+				if (chunk.length == 0 || chunk.length > MAX_CHUNK_SIZE)
+					throw std::runtime_error("ChunkManifest: chunk length invalid.");
+				total += chunk.length;
+			}
+			if (total != packet.fileSize)
+				throw std::runtime_error("ChunkManifest: chunks do not add up to the file size.");
+			return packet;
+		}
+	};
+
+	// Dedup mode, step 2: indices (into the ChunkManifest) of the chunks the
+	// receiver lacks. Each distinct unknown chunk is asked for once.
+	struct ChunkRequest
+	{
+		static constexpr PacketType type = PacketType::ChunkRequest;
+		std::uint32_t streamId = 0;
+		std::vector<uint32_t> indices;
+
+		std::size_t payloadSize() const {
+			return sizeof(streamId) + sizeof(uint32_t) + indices.size() * sizeof(uint32_t);
+		}
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			if (indices.size() > MAX_DEDUP_CHUNKS) throw std::length_error("ChunkRequest: too many chunks");
+
+			out.write(streamId);
+			out.write(static_cast<uint32_t>(indices.size()));
+			out.array(indices.data(), indices.size());
+		}
+
+		static ChunkRequest deserialize(const uint8_t* buf, size_t size)
+		{
+			if (size < 2 * sizeof(uint32_t)) throw std::runtime_error("ChunkRequest: payload too small.");
+
+			ChunkRequest packet;
+			packet.streamId = cw::binary::readBigEndian<uint32_t>(buf);
+			uint32_t count = cw::binary::readBigEndian<uint32_t>(buf + sizeof(uint32_t));
+
+			if (count > MAX_DEDUP_CHUNKS)
+				throw std::runtime_error("ChunkRequest: too many chunks (DoS protection).");
+			if ((size - 2 * sizeof(uint32_t)) / sizeof(uint32_t) < count)
+				throw std::runtime_error("ChunkRequest: count exceeds buffer.");
+
+			packet.indices.resize(count);
+			cw::binary::readBigEndianArray(buf + 2 * sizeof(uint32_t), packet.indices.data(), count);
+			return packet;
+		}
+	};
 }
\ No newline at end of file
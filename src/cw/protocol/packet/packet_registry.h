@@ -1 +1,147 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "packet.h"
+#include "packet_type.h"
+#include "../../Frame.h"
+
+namespace cw::packet {
+
+	// Undecoded payload of a P frame, for handlers that keep the bytes as a
+	// whole (a FileBatch copies its payload once and slices the files out).
+	template<typename P>
+	struct RawPacket
+	{
+		static constexpr PacketType type = P::type;
+		std::span<const uint8_t> payload;
+
+		static RawPacket deserialize(const uint8_t* buf, size_t size) { return { { buf, size } }; }
+	};
+
+	// What a received P is decoded into. Bulk packets decode to views into the
+	// receive buffer, so their payload is copied at most once, by the handler.
+	template<typename P> struct ReceivedAs { using type = P; };
+	template<> struct ReceivedAs<FileInfo> { using type = FileInfoView; };
+	template<> struct ReceivedAs<FileChunk> { using type = FileChunkView; };
+	template<> struct ReceivedAs<CompressedChunk> { using type = CompressedChunkView; };
+	template<> struct ReceivedAs<FileBatch> { using type = RawPacket<FileBatch>; };
+	template<> struct ReceivedAs<CompressedBatch> { using type = CompressedBatchView; };
+	template<> struct ReceivedAs<SealedChunk> { using type = SealedChunkView; };
+
+	template<typename T>
+	concept Decodable = requires(const uint8_t* buf, std::size_t size) {
+		{ T::type } -> std::convertible_to<PacketType>;
+		{ T::deserialize(buf, size) } -> std::same_as<T>;
+	};
+
+	// Compile-time packet registry: every wire packet, and a dense table of
+	// decoders indexed by PacketType generated from the list. dispatch() is a
+	// bounds clamp and one indirect call into a function that decodes the
+	// payload and hands the typed packet to the handler; adding a packet is a
+	// line in PacketList below and an overload in the handler, and costs
+	// nothing at run time.
+	template<FrameBuildable... Packets>
+	class PacketRegistry
+	{
+	public:
+		static constexpr std::size_t TABLE_SIZE = std::max({ static_cast<std::size_t>(Packets::type)... }) + 1;
+
+		// Calls handler(decoded packet) for a known type, handler(frame) otherwise.
+		// Decoding errors propagate (std::runtime_error), as from deserialize.
+		template<typename Handler>
+		static void dispatch(const ParsedFrame& frame, Handler&& handler)
+		{
+			using Fn = void (*)(const ParsedFrame&, Handler&);
+			static constexpr std::array<Fn, TABLE_SIZE + 1> table = makeTable<Handler, Fn>();
+
+			// Unknown types land in the last slot
+			std::size_t index = std::min(static_cast<std::size_t>(frame.type), TABLE_SIZE);
+			table[index](frame, handler);
+		}
+
+	private:
+		static_assert(sizeof...(Packets) > 0);
+
+		// Every type id in 1..TABLE_SIZE-1 is listed exactly once
+		static constexpr bool isDense()
+		{
+			std::array<int, TABLE_SIZE> seen{};
+			(++seen[static_cast<std::size_t>(Packets::type)], ...);
+			return seen[0] == 0 && std::all_of(seen.begin() + 1, seen.end(), [](int count) { return count == 1; });
+		}
+		static_assert(isDense(), "PacketRegistry must list each PacketType exactly once, without gaps");
+
+		template<typename P, typename Handler>
+		static void decode(const ParsedFrame& frame, Handler& handler)
+		{
+			using Decoded = typename ReceivedAs<P>::type;
+			static_assert(Decodable<Decoded>);
+			if constexpr (requires { Decoded::deserialize(frame.payload_view, frame.size, frame.order); })
+				handler(Decoded::deserialize(frame.payload_view, frame.size, frame.order));
+			else
+				handler(Decoded::deserialize(frame.payload_view, frame.size));
+		}
+
+		template<typename Handler>
+		static void unknown(const ParsedFrame& frame, Handler& handler)
+		{
+			handler(frame);
+		}
+
+		template<typename Handler, typename Fn>
+		static constexpr std::array<Fn, TABLE_SIZE + 1> makeTable()
+		{
+			std::array<Fn, TABLE_SIZE + 1> table{};
+			table.fill(&unknown<Handler>);
+			((table[static_cast<std::size_t>(Packets::type)] = &decode<Packets, Handler>), ...);
+			return table;
+		}
+	};
+
+	using PacketList = PacketRegistry<
+		FileInfo,
+		FileChunk,
+		FileDone,
+		Error,
+		Ack,
+		StripeInfo,
+		FileBatch,
+		FileResume,
+		Manifest,
+		ManifestDiff,
+		SignatureRequest,
+		Signatures,
+		DeltaInfo,
+		BlockCopy,
+		DeltaDone,
+		Capabilities,
+		CompressedChunk,
+		Retransmit,
+		ChunkManifest,
+		ChunkRequest,
+		FileRange,
+		FileCopy,
+		DirectoryManifest,
+		FileHole,
+		FileRequest,
+		ArchiveInfo,
+		TransferStats,
+		TreeDigest,
+		Session,
+		AckBatch,
+		Ping,
+		Pong,
+		SubtreeDigests,
+		BatchDictionary,
+		CompressedBatch,
+		FrontCodedFileInfo,
+		FileAttributes,
+		StatsRequest,
+		StatsResponse,
+		SealedChunk>;
+}
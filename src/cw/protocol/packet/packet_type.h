@@ -11,7 +11,42 @@ namespace cw {
 			FileChunk,
 			FileDone,
 			Error,
-			Ack
+			Ack,
+			StripeInfo,
+			FileBatch,
+			FileResume,
+			Manifest,
+			ManifestDiff,
+			SignatureRequest,
+			Signatures,
+			DeltaInfo,
+			BlockCopy,
+			DeltaDone,
+			Capabilities,
+			CompressedChunk,
+			Retransmit,
+			ChunkManifest,
+			ChunkRequest,
+			FileRange,
+			FileCopy,
+			DirectoryManifest,
+			FileHole,
+			FileRequest,
+			ArchiveInfo,
+			TransferStats,
+			TreeDigest,
+			Session,
+			AckBatch,
+			Ping,
+			Pong,
+			SubtreeDigests,
+			BatchDictionary,
+			CompressedBatch,
+			FrontCodedFileInfo,
+			FileAttributes,
+			StatsRequest,
+			StatsResponse,
+			SealedChunk
 		};
 	}
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "packet_type.h"
+#include "../../endian.h"
+
+namespace cw::packet {
+
+	// Compile-time wire schemas. A fixed-size packet (or the fixed header of a
+	// variable one) lists its fields once, in wire order, as member pointers:
+	//
+	//     using Layout = WireLayout<&Ack::streamId, &Ack::offset>;
+	//
+	// and gets its size and every field's offset as constants. Writing is a
+	// byteswapped store per field at a constant offset, reading one bounds
+	// check for the whole layout and then plain loads: no cursor, no running
+	// length checks. Fields are big-endian integers or an optional CRC32C
+	// (a presence byte, then the value; see CHECKSUM_FIELD_SIZE).
+	// Byte order of a frame's fixed fields: big-endian, except in the chunk
+	// header of a native frame (FrameFormat::Native), which is little-endian
+	enum class WireOrder : std::uint8_t
+	{
+		BigEndian,
+		LittleEndian
+	};
+
+	namespace detail {
+
+		template<typename M> struct MemberPointer;
+		template<typename C, typename T> struct MemberPointer<T C::*> { using Type = T; };
+
+		template<typename T> struct WireField;
+
+		template<cw::binary::Integer T>
+		struct WireField<T>
+		{
+			static constexpr std::size_t SIZE = sizeof(T);
+			static void write(std::uint8_t* dest, T value) noexcept { cw::binary::writeBigEndian(dest, value); }
+			static void read(const std::uint8_t* src, T& value) noexcept { value = cw::binary::readBigEndian<T>(src); }
+		};
+
+		template<>
+		struct WireField<std::optional<std::uint32_t>>
+		{
+			static constexpr std::size_t SIZE = sizeof(std::uint8_t) + sizeof(std::uint32_t);
+
+			static void write(std::uint8_t* dest, const std::optional<std::uint32_t>& value) noexcept
+			{
+				dest[0] = static_cast<std::uint8_t>(value.has_value());
+				cw::binary::writeBigEndian<std::uint32_t>(dest + 1, value.value_or(0));
+			}
+
+			static void read(const std::uint8_t* src, std::optional<std::uint32_t>& value) noexcept
+			{
+				if (src[0] == 0) value.reset();
+				else value = cw::binary::readBigEndian<std::uint32_t>(src + 1);
+			}
+		};
+
+		template<auto Member>
+		using FieldOf = WireField<typename MemberPointer<decltype(Member)>::Type>;
+	}
+
+	template<auto... Members>
+	struct WireLayout
+	{
+		static constexpr std::size_t FIELD_COUNT = sizeof...(Members);
+		static constexpr std::size_t SIZE = (std::size_t(0) + ... + detail::FieldOf<Members>::SIZE);
+
+		// Byte offset of each field from the start of the layout
+		static constexpr std::array<std::size_t, FIELD_COUNT> OFFSETS = []()
+			{
+				std::array<std::size_t, FIELD_COUNT> offsets{};
+				std::size_t sizes[] = { detail::FieldOf<Members>::SIZE... };
+				std::size_t at = 0;
+				for (std::size_t i = 0; i < FIELD_COUNT; ++i) {
+					offsets[i] = at;
+					at += sizes[i];
+				}
+				return offsets;
+			}();
+
+		// SIZE bytes at 'dest'
+		template<typename P>
+		static void write(const P& packet, std::uint8_t* dest) noexcept { writeFields(packet, dest, std::make_index_sequence<FIELD_COUNT>{}); }
+
+		template<typename P>
+		static void write(const P& packet, cw::binary::ByteWriter& out) noexcept { write(packet, out.take(SIZE)); }
+
+		// From SIZE bytes at 'src', which the caller checked are there
+		template<typename P>
+		static void read(P& packet, const std::uint8_t* src) noexcept { readFields(packet, src, std::make_index_sequence<FIELD_COUNT>{}); }
+
+	private:
+		template<typename P, std::size_t... I>
+		static void writeFields(const P& packet, std::uint8_t* dest, std::index_sequence<I...>) noexcept
+		{
+			(detail::FieldOf<Members>::write(dest + OFFSETS[I], packet.*Members), ...);
+		}
+
+		template<typename P, std::size_t... I>
+		static void readFields(P& packet, const std::uint8_t* src, std::index_sequence<I...>) noexcept
+		{
+			(detail::FieldOf<Members>::read(src + OFFSETS[I], packet.*Members), ...);
+		}
+	};
+
+	// Base of a packet whose whole payload is its P::Layout: payloadSize,
+	// serialize and deserialize are generated from it. A P::validate() const,
+	// if declared, checks field values (limits) on both ends and throws.
+	// The packet stays an aggregate, so designated initializers still work.
+	template<typename P>
+	struct FixedLayoutPacket
+	{
+		static constexpr std::size_t payloadSize() noexcept { return P::Layout::SIZE; }
+
+		void serialize(cw::binary::ByteWriter& out) const
+		{
+			const P& packet = static_cast<const P&>(*this);
+			if constexpr (requires { packet.validate(); }) packet.validate();
+			P::Layout::write(packet, out);
+		}
+
+		static P deserialize(const std::uint8_t* buf, std::size_t size)
+		{
+			if (size < P::Layout::SIZE)
+				throw std::runtime_error("Packet " + std::to_string(static_cast<std::uint16_t>(P::type)) + ": payload too small.");
+
+			P packet{};
+			P::Layout::read(packet, buf);
+			if constexpr (requires { packet.validate(); }) packet.validate();
+			return packet;
+		}
+	};
+}
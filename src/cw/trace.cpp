@@ -0,0 +1,23 @@
+// The ETW provider behind CW_TRACE on Windows (see trace.h), registered for
+// the life of the process. Nothing here on other platforms or without
+// CW_ENABLE_TRACEPOINTS: USDT probes need no registration.
+#include "cw/trace.h"
+
+#if defined(CW_ENABLE_TRACEPOINTS) && defined(_WIN32)
+
+// {c1d1210f-e84a-47fa-8a58-63014d6ff77f}
+TRACELOGGING_DEFINE_PROVIDER(cwTraceProvider, "ConnectWith",
+	(0xc1d1210f, 0xe84a, 0x47fa, 0x8a, 0x58, 0x63, 0x01, 0x4d, 0x6f, 0xf7, 0x7f));
+
+namespace {
+
+	struct ProviderRegistration
+	{
+		ProviderRegistration() { TraceLoggingRegister(cwTraceProvider); }
+		~ProviderRegistration() { TraceLoggingUnregister(cwTraceProvider); }
+	};
+
+	ProviderRegistration registration;
+}
+
+#endif
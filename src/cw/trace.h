@@ -0,0 +1,56 @@
+#pragma once
+
+// Static tracepoints on the frame and file hot paths, for profiling a
+// production build with bpftrace/perf (USDT) or WPR/xperf (ETW) without
+// rebuilding it. Compiled in with CW_ENABLE_TRACEPOINTS (CMake option of
+// the same name); otherwise CW_TRACE expands to nothing and its arguments
+// are not evaluated.
+//
+//   CW_TRACE(probe, args...)   1 to 4 integer or pointer arguments
+//
+// On Linux each probe is a USDT probe "cw:probe" (sys/sdt.h, from
+// systemtap-sdt-dev): a nop until a tracer attaches, with its arguments
+// left in registers. A "__" in the name reads as "-", as DTrace has it:
+//
+//   bpftrace -e 'usdt:./Server:cw:write__done { @bytes = hist(arg2); }'
+//
+// On Windows each probe is a TraceLogging event of the "ConnectWith"
+// provider (see trace.cpp), its arguments fields arg0..arg3.
+//
+// Probes (the connection or file is always the first argument):
+//   frame__queued(conn, type, bytes, class)   Connection::send
+//   batch__queued(conn, frames, bytes)        Connection::sendBatch
+//   write__done(conn, frames, bytes, error)   a socket write completed
+//   frame__parsed(conn, type, bytes)          a whole frame at the read cursor
+//   dispatch__begin(conn, type), dispatch__end(conn, type)
+//   file__open(path, size, error), file__close(path, bytes, error)
+//                                             a received file; a close that
+//                                             discarded it reports ECANCELED
+//   congestion__enter(metrics), congestion__exit(metrics, nanoseconds)
+
+#if defined(CW_ENABLE_TRACEPOINTS)
+#if defined(_WIN32)
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+
+TRACELOGGING_DECLARE_PROVIDER(cwTraceProvider);
+
+// Needs a conforming preprocessor (/Zc:preprocessor) for the argument count
+#define CW_TRACE_FIELD_1(a) , TraceLoggingValue(a, "arg0")
+#define CW_TRACE_FIELD_2(a, b) CW_TRACE_FIELD_1(a), TraceLoggingValue(b, "arg1")
+#define CW_TRACE_FIELD_3(a, b, c) CW_TRACE_FIELD_2(a, b), TraceLoggingValue(c, "arg2")
+#define CW_TRACE_FIELD_4(a, b, c, d) CW_TRACE_FIELD_3(a, b, c), TraceLoggingValue(d, "arg3")
+#define CW_TRACE_SELECT(_1, _2, _3, _4, NAME, ...) NAME
+#define CW_TRACE_FIELDS(...) CW_TRACE_SELECT(__VA_ARGS__, CW_TRACE_FIELD_4, CW_TRACE_FIELD_3, CW_TRACE_FIELD_2, CW_TRACE_FIELD_1)(__VA_ARGS__)
+
+#define CW_TRACE(probe, ...) TraceLoggingWrite(cwTraceProvider, #probe CW_TRACE_FIELDS(__VA_ARGS__))
+#elif __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+
+#define CW_TRACE(probe, ...) STAP_PROBEV(cw, probe, __VA_ARGS__)
+#endif
+#endif
+
+#if !defined(CW_TRACE)
+#define CW_TRACE(probe, ...) ((void)0)
+#endif
@@ -0,0 +1,485 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "cw/log/logger.h"
+
+namespace cw {
+
+	namespace detail {
+
+		// Completion signature of WorkPool::asyncRun
+		template<typename Result>
+		struct RunSignature
+		{
+			using type = void(std::exception_ptr, Result);
+		};
+
+		template<>
+		struct RunSignature<void>
+		{
+			using type = void(std::exception_ptr);
+		};
+	}
+
+	// The scheduler for CPU-bound work of every stage (compressing and
+	// decompressing chunks, checksums, content hashes), apart from the
+	// network and disk threads, so that it uses every core instead of one.
+	//
+	// Work stealing: each thread has a deque of its own. A task scheduled
+	// from one of the threads goes to the back of that thread's deque, which
+	// it works from the back, while its cache is warm; one from outside goes
+	// to a bounded injection queue, and the caller waits while that is full,
+	// so a fast producer cannot queue more than the pool can hold. A thread
+	// with nothing of its own takes from the injection queue, then steals
+	// from the front of the others' deques.
+	//
+	// executor() is an asio executor (asio::post onto it); asyncRun hands a
+	// function's result straight to the caller's executor, an io_context's
+	// or a coroutine's. Tasks finish out of order; OrderedJobs and
+	// Resequencer put their results back in order.
+	class WorkPool : public asio::execution_context
+	{
+	public:
+		using Task = std::move_only_function<void()>;
+
+		static constexpr std::size_t DEFAULT_INJECTION_CAPACITY = 4096;
+
+		class executor_type
+		{
+		public:
+			explicit executor_type(WorkPool& pool) : m_pool(&pool) {}
+
+			WorkPool& query(asio::execution::context_t) const noexcept { return *m_pool; }
+			static constexpr asio::execution::blocking_t query(asio::execution::blocking_t) noexcept { return asio::execution::blocking.never; }
+
+			template<typename Function>
+			void execute(Function&& fn) const { m_pool->schedule(Task(std::forward<Function>(fn))); }
+
+			bool operator==(const executor_type& other) const noexcept { return m_pool == other.m_pool; }
+			bool operator!=(const executor_type& other) const noexcept { return m_pool != other.m_pool; }
+
+		private:
+			WorkPool* m_pool;
+		};
+
+		explicit WorkPool(std::size_t threads = defaultThreads(), std::size_t injectionCapacity = DEFAULT_INJECTION_CAPACITY)
+			: m_injectionCapacity(std::max<std::size_t>(injectionCapacity, 1))
+		{
+			threads = std::max<std::size_t>(threads, 1);
+			for (std::size_t i = 0; i < threads; ++i) m_workers.push_back(std::make_unique<Worker>());
+			for (std::size_t i = 0; i < threads; ++i) m_workers[i]->thread = std::thread([this, i]() { run(i); });
+		}
+
+		// Runs what is queued, then stops
+		~WorkPool()
+		{
+			{
+				std::lock_guard lock(m_idleMutex);
+				m_stopping = true;
+			}
+			m_idle.notify_all();
+			{
+				std::lock_guard lock(m_injectionMutex);
+			}
+			m_notFull.notify_all();
+			for (auto& worker : m_workers) worker->thread.join();
+		}
+
+		WorkPool(const WorkPool&) = delete;
+		WorkPool& operator=(const WorkPool&) = delete;
+
+		static std::size_t defaultThreads() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+		// One per process, a thread per core, for callers that were not given one
+		static std::shared_ptr<WorkPool> defaultInstance()
+		{
+			static std::shared_ptr<WorkPool> instance = std::make_shared<WorkPool>();
+			return instance;
+		}
+
+		executor_type executor() { return executor_type(*this); }
+		std::size_t threads() const { return m_workers.size(); }
+
+		// Tasks one thread took from another's deque
+		std::uint64_t steals() const { return m_steals.load(std::memory_order_relaxed); }
+
+		// Whether the calling thread is one of this pool's
+		bool runningInThisThread() const { return t_current.pool == this; }
+
+		void schedule(Task task)
+		{
+			if (t_current.pool == this) {
+				auto& worker = *m_workers[t_current.index];
+				std::lock_guard lock(worker.mutex);
+				worker.tasks.push_back(std::move(task));
+			}
+			else {
+				std::unique_lock lock(m_injectionMutex);
+				m_notFull.wait(lock, [this]() { return m_injection.size() < m_injectionCapacity || m_stopping; });
+				m_injection.push_back(std::move(task));
+			}
+			m_pending.fetch_add(1);
+			if (m_sleeping.load() > 0) {
+				std::lock_guard lock(m_idleMutex);
+				m_idle.notify_one();
+			}
+		}
+
+		// Runs fn() here, then calls the handler on its associated executor
+		// with (exception_ptr) or (exception_ptr, result): co_await
+		// pool.asyncRun(fn, asio::use_awaitable) resumes the coroutine where
+		// it was, with fn()'s result or its exception. Results must be
+		// default-constructible.
+		template<typename Function, typename CompletionToken>
+		auto asyncRun(Function fn, CompletionToken&& token)
+		{
+			using Result = std::invoke_result_t<Function&>;
+			using Signature = typename detail::RunSignature<Result>::type;
+			return asio::async_initiate<CompletionToken, Signature>(
+				[this](auto handler, Function fn)
+				{
+					auto work = asio::make_work_guard(asio::get_associated_executor(handler));
+					schedule([handler = std::move(handler), fn = std::move(fn), work = std::move(work)]() mutable
+						{
+							std::exception_ptr error;
+							if constexpr (std::is_void_v<Result>) {
+								try {
+									fn();
+								}
+								catch (...) {
+									error = std::current_exception();
+								}
+								asio::post(work.get_executor(), [handler = std::move(handler), error]() mutable { std::move(handler)(error); });
+							}
+							else {
+								Result result{};
+								try {
+									result = fn();
+								}
+								catch (...) {
+									error = std::current_exception();
+								}
+								asio::post(work.get_executor(), [handler = std::move(handler), error, result = std::move(result)]() mutable
+									{
+										std::move(handler)(error, std::move(result));
+									});
+							}
+						});
+				},
+				token, std::move(fn));
+		}
+
+		// fn(i) for every i below 'count', split over the threads; then the
+		// handler (exception_ptr: the first exception thrown) on its executor
+		template<typename Function, typename CompletionToken>
+		auto asyncForEach(std::size_t count, Function fn, CompletionToken&& token)
+		{
+			return asio::async_initiate<CompletionToken, void(std::exception_ptr)>(
+				[this](auto handler, std::size_t count, Function fn)
+				{
+					auto work = asio::make_work_guard(asio::get_associated_executor(handler));
+					if (count == 0) {
+						asio::post(work.get_executor(), [handler = std::move(handler)]() mutable { std::move(handler)(std::exception_ptr()); });
+						return;
+					}
+
+					// A few tasks per thread, so stealing evens out uneven items
+					std::size_t tasks = std::min(count, threads() * 4);
+					struct Shared
+					{
+						explicit Shared(Function fn, std::size_t tasks) : fn(std::move(fn)), remaining(tasks) {}
+						Function fn;
+						std::atomic<std::size_t> remaining;
+						std::mutex mutex;
+						std::exception_ptr error;
+					};
+					auto shared = std::make_shared<Shared>(std::move(fn), tasks);
+					auto done = std::make_shared<std::optional<std::pair<decltype(handler), decltype(work)>>>();
+					done->emplace(std::move(handler), std::move(work));
+					for (std::size_t task = 0; task < tasks; ++task) {
+						std::size_t from = count * task / tasks;
+						std::size_t to = count * (task + 1) / tasks;
+						schedule([shared, done, from, to]()
+							{
+								for (std::size_t i = from; i < to; ++i) {
+									try {
+										shared->fn(i);
+									}
+									catch (...) {
+										std::lock_guard lock(shared->mutex);
+										if (!shared->error) shared->error = std::current_exception();
+									}
+								}
+								if (shared->remaining.fetch_sub(1) != 1) return;
+								auto [handler, work] = std::move(**done);
+								asio::post(work.get_executor(), [handler = std::move(handler), error = shared->error]() mutable { std::move(handler)(error); });
+							});
+					}
+				},
+				token, count, std::move(fn));
+		}
+
+	private:
+		struct Worker
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+			std::thread thread;
+		};
+
+		struct Current
+		{
+			const WorkPool* pool;
+			std::size_t index;
+		};
+		static inline thread_local Current t_current{ nullptr, 0 };
+
+		void run(std::size_t index)
+		{
+			t_current = { this, index };
+			while (true) {
+				if (auto task = take(index)) {
+					m_pending.fetch_sub(1);
+					try {
+						(*task)();
+					}
+					catch (const std::exception& e) {
+						CW_LOG_ERROR("[Work] Task failed: ", e.what());
+					}
+					continue;
+				}
+
+				std::unique_lock lock(m_idleMutex);
+				m_sleeping.fetch_add(1);
+				m_idle.wait(lock, [this]() { return m_pending.load() > 0 || m_stopping; });
+				m_sleeping.fetch_sub(1);
+				if (m_stopping && m_pending.load() == 0) return;
+			}
+		}
+
+		// Own deque from the back, then the injection queue, then the front of another's
+		std::optional<Task> take(std::size_t index)
+		{
+			{
+				auto& own = *m_workers[index];
+				std::lock_guard lock(own.mutex);
+				if (!own.tasks.empty()) {
+					Task task = std::move(own.tasks.back());
+					own.tasks.pop_back();
+					return task;
+				}
+			}
+			{
+				std::lock_guard lock(m_injectionMutex);
+				if (!m_injection.empty()) {
+					Task task = std::move(m_injection.front());
+					m_injection.pop_front();
+					m_notFull.notify_one();
+					return task;
+				}
+			}
+			for (std::size_t i = 1; i < m_workers.size(); ++i) {
+				auto& victim = *m_workers[(index + i) % m_workers.size()];
+				std::lock_guard lock(victim.mutex);
+				if (!victim.tasks.empty()) {
+					Task task = std::move(victim.tasks.front());
+					victim.tasks.pop_front();
+					m_steals.fetch_add(1, std::memory_order_relaxed);
+					return task;
+				}
+			}
+			return std::nullopt;
+		}
+
+		std::vector<std::unique_ptr<Worker>> m_workers;
+
+		std::mutex m_injectionMutex;
+		std::condition_variable m_notFull;
+		std::deque<Task> m_injection;
+		std::size_t m_injectionCapacity;
+
+		// Tasks queued anywhere; threads sleep on m_idle only while there are none
+		std::atomic<std::int64_t> m_pending{ 0 };
+		std::atomic<std::size_t> m_sleeping{ 0 };
+		std::mutex m_idleMutex;
+		std::condition_variable m_idle;
+		std::atomic<bool> m_stopping{ false };
+		std::atomic<std::uint64_t> m_steals{ 0 };
+	};
+
+	// Jobs run on a WorkPool side by side, their results taken (next) in the
+	// order the jobs were submitted: chunks compressed several at a time
+	// still go out in file order. A job's exception is rethrown by the next()
+	// that takes it. Only touched from 'executor', which must not run two
+	// handlers at once (one thread, or a strand). Jobs still running when it
+	// is destroyed finish, and their results are dropped; what they use must
+	// be theirs (captured by value).
+	template<typename Result>
+	class OrderedJobs
+	{
+	public:
+		OrderedJobs(std::shared_ptr<WorkPool> pool, asio::any_io_executor executor)
+			: m_pool(std::move(pool)), m_executor(executor), m_wake(std::make_shared<asio::steady_timer>(executor))
+		{
+		}
+
+		OrderedJobs(const OrderedJobs&) = delete;
+		OrderedJobs& operator=(const OrderedJobs&) = delete;
+
+		// Runs job() -> Result on the pool
+		template<typename Job>
+		void submit(Job job)
+		{
+			auto slot = std::make_shared<Slot>();
+			m_slots.push_back(slot);
+			asio::post(m_pool->executor(), [executor = m_executor, wake = m_wake, slot, job = std::move(job)]() mutable
+				{
+					std::optional<Result> result;
+					std::exception_ptr error;
+					try {
+						result.emplace(job());
+					}
+					catch (...) {
+						error = std::current_exception();
+					}
+					asio::post(executor, [wake, slot, result = std::move(result), error]() mutable
+						{
+							slot->result = std::move(result);
+							slot->error = error;
+							slot->done = true;
+							wake->cancel();
+						});
+				});
+		}
+
+		// Submitted and not taken yet
+		std::size_t size() const { return m_slots.size(); }
+		bool empty() const { return m_slots.empty(); }
+
+		// Whether next() would not wait
+		bool ready() const { return !m_slots.empty() && m_slots.front()->done; }
+
+		// The result of the oldest job, once it is done. Call only when not empty.
+		asio::awaitable<Result> next()
+		{
+			auto slot = m_slots.front();
+			while (!slot->done) {
+				m_wake->expires_at(asio::steady_timer::time_point::max());
+				std::error_code ec;
+				co_await m_wake->async_wait(asio::redirect_error(asio::use_awaitable, ec));
+			}
+			m_slots.pop_front();
+			if (slot->error) std::rethrow_exception(slot->error);
+			co_return std::move(*slot->result);
+		}
+
+	private:
+		struct Slot
+		{
+			bool done = false;
+			std::optional<Result> result;
+			std::exception_ptr error;
+		};
+
+		std::shared_ptr<WorkPool> m_pool;
+		asio::any_io_executor m_executor;
+		std::shared_ptr<asio::steady_timer> m_wake; // Cancelled as each job is done
+		std::deque<std::shared_ptr<Slot>> m_slots;
+	};
+
+	// Hands work to a WorkPool and its follow-up to 'target' (a file's
+	// strand) in the order it was submitted, whichever job finishes first:
+	// chunks decompressed side by side are written in the order they came,
+	// and what is posted with no work waits behind them. Thread-safe; work
+	// still running when it is destroyed is followed up all the same.
+	class Resequencer
+	{
+	public:
+		using Function = std::move_only_function<void()>;
+
+		Resequencer(std::shared_ptr<WorkPool> pool, asio::any_io_executor target)
+			: m_pool(std::move(pool)), m_queue(std::make_shared<Queue>(std::move(target)))
+		{
+		}
+
+		Resequencer(const Resequencer&) = delete;
+		Resequencer& operator=(const Resequencer&) = delete;
+
+		// work() on the pool, then apply() on the target, after everything
+		// submitted or posted before it
+		void submit(Function work, Function apply)
+		{
+			auto slot = std::make_shared<Slot>();
+			slot->apply = std::move(apply);
+			{
+				std::lock_guard lock(m_queue->mutex);
+				m_queue->slots.push_back(slot);
+			}
+			asio::post(m_pool->executor(), [queue = m_queue, slot, work = std::move(work)]() mutable
+				{
+					work();
+					std::lock_guard lock(queue->mutex);
+					slot->ready = true;
+					queue->flush();
+				});
+		}
+
+		// apply() on the target, after everything submitted or posted before it
+		void post(Function apply)
+		{
+			std::lock_guard lock(m_queue->mutex);
+			if (m_queue->slots.empty()) {
+				asio::post(m_queue->target, std::move(apply));
+				return;
+			}
+			auto slot = std::make_shared<Slot>();
+			slot->apply = std::move(apply);
+			slot->ready = true;
+			m_queue->slots.push_back(std::move(slot));
+		}
+
+	private:
+		struct Slot
+		{
+			bool ready = false;
+			Function apply;
+		};
+
+		struct Queue
+		{
+			explicit Queue(asio::any_io_executor target) : target(std::move(target)) {}
+
+			// Posts the ready slots at the front, in order; under 'mutex'
+			void flush()
+			{
+				while (!slots.empty() && slots.front()->ready) {
+					asio::post(target, std::move(slots.front()->apply));
+					slots.pop_front();
+				}
+			}
+
+			asio::any_io_executor target;
+			std::mutex mutex;
+			std::deque<std::shared_ptr<Slot>> slots;
+		};
+
+		std::shared_ptr<WorkPool> m_pool;
+		std::shared_ptr<Queue> m_queue;
+	};
+}
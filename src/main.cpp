@@ -2,16 +2,37 @@
 #include <vector>
 #include <iomanip>
 #include <cassert>
+#include <csignal>
+#include <cstdlib>
 #include <cstring>
 #include <asio.hpp>
+#include <atomic>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
 
 #include "cw/endian.h"
 #include "packet/packet.h"
 #include "cw/Frame.h"
+#include "cw/network/Client.h"
 #include "cw/network/Connection.h"
 #include "cw/network/Server.h"
+#include "cw/network/load_gossip.h"
+#include "cw/network/swarm_tracker.h"
+#include "cw/network/sharded_server.h"
+#include "cw/network/metrics_endpoint.h"
+#include "cw/network/s3_store.h"
+#include "cw/network/socket_options.h"
+#include "cw/network/busy_poll.h"
+#include "cw/network/tls.h"
+#include "cw/network/udp_tunnel.h"
+#include "cw/log/logger.h"
+#include "cw/metrics/stage_profile.h"
+#include "cw/metrics/timeline.h"
 #include "cw/file/file.h" 
+#include "cw/file/swarm.h"
 
 namespace fs = std::filesystem;
 
@@ -19,29 +40,470 @@ int main(int argc, char* argv[])
 {
 	// 1. Argument Parsing
 	// The server takes an argument determining where to put all incoming data.
-	if (argc != 2) {
-		std::cerr << "Usage: " << argv[0] << " <destination_folder>" << std::endl;
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <destination_folder> [--volume=DIR]... [--placement=hash|least-loaded] [--threads=N | --shards=N [--numa-node=N|IFACE] [--disk-numa-node=N|auto]] [--disk-threads=N] [--work-threads=N] [--huge-pages-mb=N] [--metrics-port=N] [--serve-stats] [--stats-interval=S] [--trace-out=FILE] [--cpu-profile] [--nodelay] [--sndbuf-kb=N] [--rcvbuf-kb=N] [--notsent-lowat-kb=N] [--busy-poll-us=N] [--spin] [--congestion=NAME] [--zerocopy] [--tls-cert=PEM --tls-key=PEM [--tls-ca=PEM]] [--udp-port=N [--udp-fec=PCT] [--udp-xdp=IFACE[:QUEUE] [--udp-xdp-map=PATH]]] [--local-socket=PATH] [--server-copy-root=DIR]... [--download-root=DIR]... [--download-kernel-copy] [--chunk-cache-mb=N] [--relay-to=HOST]... [--swarm-tracker-port=N] [--swarm-join=HOST:PORT --swarm-fetch=NAME...] [--forward-to=HOST [--forward-only]] [--max-chunk-kb=N] [--window-mb=N] [--max-connections=N] [--idle-timeout=S] [--stall-timeout=S] [--heartbeat=S] [--drain-timeout=S] [--pending-accepts=N] [--confine] [--durability=none|file|group] [--file-backend=pool|native] [--direct-io[=MIN_MB]] [--drop-behind] [--mapped-writes] [--write-lanes=N[:MIN_MB]] [--disk-fair-share] [--disk-weight=ADDR=WEIGHT]... [--admit-queue-mb=N] [--admit-latency-ms=N] [--gossip-port=N --advertise=HOST[:PORT] [--gossip-peer=HOST:PORT]...] [--rate-limit-mbit=N] [--connection-rate-limit-mbit=N] [--memory-limit-mb=N] [--connection-memory-mb=N] [--tree-hash] [--chunk-key=FILE] [--splice-receive] [--zerocopy-receive] [--content-store=DIR [--reflink]] [--signature-cache=DIR] [--s3=HOST[:PORT]/BUCKET[/PREFIX]]" << std::endl;
 		return 1;
 	}
 
 	std::string destination_folder = argv[1];
+
+	std::size_t io_threads = 1;
+	std::size_t shards = 0;
+	std::size_t disk_threads = 2;
+	std::size_t work_threads = 0; // Decompress received chunks side by side on these, 0 = on the disk threads
+	std::string numa_node;      // Shards' NUMA node: a number or the NIC whose node it is
+	std::string disk_numa_node; // Disk pool's NUMA node: a number or "auto" (the destination's disk)
+	std::size_t huge_pages_mb = 0; // Buffer pool arena of huge pages, 0 = heap blocks
+	uint16_t metrics_port = 0;        // 0 = no Prometheus endpoint
+	bool serve_stats = false;         // Clients may query the counters over the data port
+	std::size_t stats_interval = 0;   // Seconds between stats lines, 0 = none
+	std::string trace_out;            // Chrome trace of the session, written on SIGINT/SIGTERM
+	bool cpu_profile = false;         // CPU time by stage, logged on SIGINT/SIGTERM
+	uint16_t udp_port = 0;            // 0 = TCP only
+	cw::network::UdpTunnelOptions udp_options;
+	std::string local_socket;         // Unix domain socket path, empty = none
+	std::vector<fs::path> server_copy_roots; // Clients may have files under these copied here
+	std::vector<fs::path> volume_roots; // More destinations, on drives of their own: received files spread over them
+	auto placement = cw::file::Placement::Hash; // Which of the destinations a received file goes to
+	std::vector<fs::path> download_roots;    // Clients may download files under these
+	cw::TransferOptions download_options;
+	download_options.memoryMap = true;
+	std::vector<std::string> relay_hosts;    // Every received file is passed on to these servers
+	uint16_t swarm_tracker_port = 0;         // UDP port swarms fetching the download roots' files are coordinated on, 0 = none
+	std::string swarm_tracker;               // host:port of the tracker of the swarms this server joins
+	std::vector<std::string> swarm_fetch;    // Files fetched through those swarms
+	std::size_t chunk_cache_mb = 0;          // Chunks downloads and relays read, kept for the next reader; 0 = none
+	std::string forward_host;                // Received streams are passed on to this server as they arrive
+	auto forward_mode = cw::network::ForwardMode::WriteToo;
+	uint32_t max_chunk_size = 0;     // Announced in the handshake, 0 = no limit
+	uint64_t receive_window = 0;
+	std::size_t max_connections = 0; // 0 = no limit
+	std::size_t idle_timeout = 0;    // Seconds, 0 = never
+	std::size_t stall_timeout = 0;   // Seconds, 0 = never
+	std::size_t heartbeat = 0;       // Seconds, 0 = off
+	std::size_t drain_timeout = 30;  // Seconds a stop waits for transfers in flight
+	std::size_t pending_accepts = 0; // 0 = the Server's default
+	bool confine = false;            // Refuse writes outside the destination folder
+	auto durability = cw::file::Durability::None; // When received files are acked
+	uint64_t direct_io_min_size = 0;    // Received files this large are written unbuffered (0 = never)
+	std::optional<cw::file::FileBackend> file_backend; // How received files are written, else the build's default
+	bool drop_behind = false;           // Received files leave the page cache behind the transfer
+	bool mapped_writes = false;         // Received files are copied into a shared mapping
+	std::size_t write_lanes = 1;        // Disk threads one large received file's chunk writes spread over
+	uint64_t write_lane_min_size = cw::file::DiskWriter::DEFAULT_WRITE_LANE_MIN_SIZE;
+	bool disk_fair_share = false;       // Disk threads shared between clients by weight
+	std::vector<std::pair<std::string, double>> disk_weights; // Client address -> weight
+	uint64_t admit_queue = 0;           // New files refused while more bytes wait for the disk, 0 = no limit
+	std::size_t admit_latency_ms = 0;   // New files refused while writes take longer to land, 0 = no limit
+	uint16_t gossip_port = 0;           // UDP port load is gossiped on with peer servers, 0 = none
+	std::string advertise;              // host:port clients redirected here connect to
+	std::vector<std::string> gossip_peers; // Their gossip host:port
+	uint64_t rate_limit = 0;            // Bytes/s all connections send together, 0 = no cap
+	uint64_t connection_rate_limit = 0; // Bytes/s each connection sends, 0 = no cap
+	size_t memory_limit = 0;            // Bytes all connections buffer together, 0 = no cap
+	size_t connection_memory = 0;       // Bytes each connection buffers, 0 = no cap
+	bool tree_hash = false;             // Received chunks are hashed into a Merkle tree and checked
+	std::shared_ptr<const cw::integrity::ChunkKey> chunk_key; // Chunks arrive sealed under it, none in the clear
+	bool splice_receive = false;        // Raw chunk data is spliced from the socket into files
+	bool zerocopy_receive = false;      // Pages of large chunks are mapped, not copied
+	bool spin = false;                  // Network threads poll without sleeping
+	fs::path content_store_dir;         // Received files with the same content are linked to one copy (relative to the destination)
+	auto content_link = cw::file::ContentStore::Link::Hardlink;
+	fs::path signature_cache_dir;       // Delta block signatures of received files (relative to the destination)
+	std::optional<cw::network::S3Config> s3;  // Received files go to this bucket instead of the disk
+	std::string s3_prefix;
+	cw::network::SocketOptions socket_options;
+	cw::network::TlsOptions tls_options;
+	for (int i = 2; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (cw::network::parseSocketOption(arg, socket_options)) {
+			// TCP tuning for accepted connections
+		}
+		else if (cw::network::parseTlsOption(arg, tls_options)) {
+			// Encrypted connections, offloaded to kTLS after the handshake
+		}
+		else if (arg.starts_with("--threads=")) {
+			// 0 = one network thread per core
+			io_threads = std::stoul(arg.substr(10));
+			if (io_threads == 0) io_threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		else if (arg.starts_with("--shards=")) {
+			// 0 = one shard per core
+			shards = std::stoul(arg.substr(9));
+			if (shards == 0) shards = std::max(1u, std::thread::hardware_concurrency());
+		}
+		else if (arg.starts_with("--disk-threads=")) {
+			disk_threads = std::max<std::size_t>(1, std::stoul(arg.substr(15)));
+		}
+		else if (arg.starts_with("--work-threads=")) {
+			work_threads = std::stoul(arg.substr(15));
+		}
+		else if (arg.starts_with("--huge-pages-mb=")) {
+			huge_pages_mb = std::stoul(arg.substr(16));
+		}
+		else if (arg.starts_with("--numa-node=")) {
+			// Sharded mode: shard threads and their buffers stay on the NIC's node
+			numa_node = arg.substr(12);
+		}
+		else if (arg.starts_with("--disk-numa-node=")) {
+			disk_numa_node = arg.substr(17);
+		}
+		else if (arg.starts_with("--trace-out=")) {
+			trace_out = arg.substr(12);
+		}
+		else if (arg == "--cpu-profile") {
+			cpu_profile = true;
+		}
+		else if (arg.starts_with("--metrics-port=")) {
+			metrics_port = static_cast<uint16_t>(std::stoul(arg.substr(15)));
+		}
+		else if (arg == "--serve-stats") {
+			// The metrics port's counters, plus disk load and files in flight, answer StatsRequests
+			serve_stats = true;
+		}
+		else if (arg.starts_with("--stats-interval=")) {
+			stats_interval = std::stoul(arg.substr(17));
+		}
+		else if (arg.starts_with("--udp-port=")) {
+			// Also accept streams over UDP (Client --transport=udp), for lossy long-haul links
+			udp_port = static_cast<uint16_t>(std::stoul(arg.substr(11)));
+		}
+		else if (arg.starts_with("--udp-fec=")) {
+			// Parity datagrams per hundred data ones on streams sent back over UDP (downloads)
+			udp_options.fecOverhead = std::stod(arg.substr(10)) / 100;
+		}
+		else if (arg.starts_with("--udp-xdp=")) {
+			// Kernel bypass for the UDP datagrams (Linux AF_XDP), IFACE[:QUEUE]: dedicated links only
+			std::string xdp = arg.substr(10);
+			auto colon = xdp.find(':');
+			udp_options.xdpInterface = xdp.substr(0, colon);
+			if (colon != std::string::npos) udp_options.xdpQueue = static_cast<uint32_t>(std::stoul(xdp.substr(colon + 1)));
+		}
+		else if (arg.starts_with("--udp-xdp-map=")) {
+			// The XSKMAP its XDP program redirects into, pinned on bpffs
+			udp_options.xdpMap = arg.substr(14);
+		}
+		else if (arg.starts_with("--local-socket=")) {
+			// Same-host clients: no TCP stack, files arrive as descriptors
+			local_socket = arg.substr(15);
+		}
+		else if (arg.starts_with("--max-chunk-kb=")) {
+			// Clients send chunks no larger than this (e.g. to bound memory per connection)
+			max_chunk_size = static_cast<uint32_t>(std::min<uint64_t>(std::stoull(arg.substr(15)) * 1024, cw::packet::MAX_CHUNK_SIZE));
+		}
+		else if (arg.starts_with("--window-mb=")) {
+			// Unacked bytes per file a client may have in flight
+			receive_window = std::stoull(arg.substr(12)) * 1024 * 1024;
+		}
+		else if (arg.starts_with("--max-connections=")) {
+			// Connections beyond this are closed as soon as they are accepted
+			max_connections = std::stoul(arg.substr(18));
+		}
+		else if (arg.starts_with("--idle-timeout=")) {
+			// Close connections that send and receive nothing for this many seconds
+			idle_timeout = std::stoul(arg.substr(15));
+		}
+		else if (arg.starts_with("--stall-timeout=")) {
+			// Fail incoming files that receive nothing for this many seconds
+			stall_timeout = std::stoul(arg.substr(16));
+		}
+		else if (arg.starts_with("--heartbeat=")) {
+			// Ping quiet peers this often; close those that miss three in a row
+			heartbeat = std::stoul(arg.substr(12));
+		}
+		else if (arg.starts_with("--drain-timeout=")) {
+			// On SIGINT/SIGTERM, wait this long for transfers in flight before closing them
+			drain_timeout = std::stoul(arg.substr(16));
+		}
+		else if (arg.starts_with("--pending-accepts=")) {
+			// Accepts kept posted per listener, for reconnect storms
+			pending_accepts = std::stoul(arg.substr(18));
+		}
+		else if (arg == "--tree-hash") {
+			// SHA-256 tree over each received stream, checked against the sender's (uploads with --tree-hash)
+			tree_hash = true;
+		}
+		else if (arg.starts_with("--chunk-key=")) {
+			// Key shared with clients (64 hex digits in FILE): only sealed chunks taken (uploads with --chunk-key)
+			auto key = cw::integrity::readChunkKey(arg.substr(12));
+			if (!key) {
+				std::cerr << "Cannot read a chunk key (64 hex digits) from " << arg.substr(12) << std::endl;
+				return 1;
+			}
+			if (!cw::integrity::ChunkCipher::available()) {
+				std::cerr << "This build cannot open sealed chunks (no OpenSSL)" << std::endl;
+				return 1;
+			}
+			chunk_key = std::make_shared<const cw::integrity::ChunkKey>(*key);
+		}
+		else if (arg == "--splice-receive") {
+			// Linux: raw chunk data goes socket -> pipe -> file without a copy into the process
+			splice_receive = true;
+		}
+		else if (arg == "--zerocopy-receive") {
+			// Linux: pages of multi-MB chunks mapped with TCP_ZEROCOPY_RECEIVE instead of copied
+			zerocopy_receive = true;
+		}
+		else if (arg == "--spin") {
+			// Lowest latency for small transfers: every network thread busy polls a core (with SO_BUSY_POLL)
+			spin = true;
+		}
+		else if (arg.starts_with("--content-store=")) {
+			// Whole-file dedup: each published file is hashed, and copies become links to one object under DIR
+			content_store_dir = arg.substr(16);
+		}
+		else if (arg == "--reflink") {
+			// Store copies as reflinks (btrfs, XFS) rather than hardlinks, so each stays its own file
+			content_link = cw::file::ContentStore::Link::Reflink;
+		}
+		else if (arg.starts_with("--signature-cache=")) {
+			// Delta block signatures kept under DIR, so a delta against an unchanged file reads nothing of it
+			signature_cache_dir = arg.substr(18);
+		}
+		else if (arg.starts_with("--s3=")) {
+			// Object-storage sink: files stream into multipart uploads, credentials from AWS_* variables
+			std::string spec = arg.substr(5);
+			auto slash = spec.find('/');
+			if (slash == std::string::npos || slash + 1 == spec.size()) {
+				std::cerr << "--s3 needs HOST[:PORT]/BUCKET" << std::endl;
+				return 1;
+			}
+			cw::network::S3Config config;
+			config.host = spec.substr(0, slash);
+			if (auto colon = config.host.find(':'); colon != std::string::npos) {
+				config.port = static_cast<uint16_t>(std::stoul(config.host.substr(colon + 1)));
+				config.host.resize(colon);
+			}
+			std::string path = spec.substr(slash + 1);
+			auto prefix = path.find('/');
+			config.bucket = path.substr(0, prefix);
+			if (prefix != std::string::npos) s3_prefix = path.substr(prefix + 1);
+			if (!s3_prefix.empty() && !s3_prefix.ends_with('/')) s3_prefix += '/';
+			auto env = [](const char* name) { const char* value = std::getenv(name); return std::string(value ? value : ""); };
+			config.accessKey = env("AWS_ACCESS_KEY_ID");
+			config.secretKey = env("AWS_SECRET_ACCESS_KEY");
+			if (auto region = env("AWS_REGION"); !region.empty()) config.region = region;
+			s3 = std::move(config);
+		}
+		else if (arg == "--confine") {
+			// No absolute names, no "..", no symlinks followed: writes stay under the destination
+			confine = true;
+		}
+		else if (arg.starts_with("--durability=")) {
+			// Ack files once written (none), once each is synced (file), or after a shared flush (group)
+			auto parsed = cw::file::parseDurability(arg.substr(13));
+			if (!parsed) {
+				std::cerr << "Unknown durability: " << arg.substr(13) << std::endl;
+				return 1;
+			}
+			durability = *parsed;
+		}
+		else if (arg.starts_with("--file-backend=")) {
+			// Blocking writes on the disk threads (pool), or asio's file support: io_uring, IOCP (native)
+			file_backend = cw::file::parseFileBackend(arg.substr(15));
+			if (!file_backend) {
+				std::cerr << "Unknown file backend: " << arg.substr(15) << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--drop-behind") {
+			drop_behind = true;
+		}
+		else if (arg == "--mapped-writes") {
+			mapped_writes = true;
+		}
+		else if (arg.starts_with("--write-lanes=")) {
+			// Chunk writes of files of at least MIN_MB (256 by default) on N disk threads at once
+			std::string spec = arg.substr(14);
+			auto colon = spec.find(':');
+			write_lanes = std::stoul(spec.substr(0, colon));
+			if (colon != std::string::npos) write_lane_min_size = std::stoull(spec.substr(colon + 1)) * 1024 * 1024;
+		}
+		else if (arg == "--disk-fair-share") {
+			// Disk threads shared between client addresses by weight, not first come, first served
+			disk_fair_share = true;
+		}
+		else if (arg.starts_with("--disk-weight=")) {
+			// ADDR=WEIGHT: that client's share against the others' (1 each unless given)
+			std::string spec = arg.substr(14);
+			auto equals = spec.rfind('=');
+			if (equals == std::string::npos || equals == 0) {
+				std::cerr << "Expected --disk-weight=ADDR=WEIGHT, got: " << arg << std::endl;
+				return 1;
+			}
+			disk_weights.emplace_back(spec.substr(0, equals), std::stod(spec.substr(equals + 1)));
+			disk_fair_share = true;
+		}
+		else if (arg.starts_with("--admit-queue-mb=")) {
+			// Past this much queued for the disk, new files are told to come back later
+			admit_queue = std::stoull(arg.substr(17)) * 1024 * 1024;
+		}
+		else if (arg.starts_with("--admit-latency-ms=")) {
+			admit_latency_ms = std::stoul(arg.substr(19));
+		}
+		else if (arg.starts_with("--gossip-port=")) {
+			// Tell peer servers our load, hear theirs: files refused as busy go to one with room
+			gossip_port = static_cast<uint16_t>(std::stoul(arg.substr(14)));
+		}
+		else if (arg.starts_with("--gossip-peer=")) {
+			gossip_peers.push_back(arg.substr(14));
+		}
+		else if (arg.starts_with("--advertise=")) {
+			advertise = arg.substr(12);
+			if (!cw::network::splitHostPort(advertise)) advertise += ":8080";
+		}
+		else if (arg == "--direct-io" || arg.starts_with("--direct-io=")) {
+			// Huge files stream to disk past the page cache (64 MB and up unless given)
+			direct_io_min_size = (arg.size() > 11 ? std::stoull(arg.substr(12)) : 64) * 1024 * 1024;
+		}
+		else if (arg.starts_with("--rate-limit-mbit=")) {
+			// What the server sends (acks, signatures, downloads) shares the link with other traffic
+			rate_limit = std::stoull(arg.substr(18)) * 1000 * 1000 / 8;
+		}
+		else if (arg.starts_with("--connection-rate-limit-mbit=")) {
+			connection_rate_limit = std::stoull(arg.substr(29)) * 1000 * 1000 / 8;
+		}
+		else if (arg.starts_with("--memory-limit-mb=")) {
+			// Send queues, receive buffers and chunks waiting for the disk, over every connection
+			memory_limit = std::stoull(arg.substr(18)) * 1024 * 1024;
+		}
+		else if (arg.starts_with("--connection-memory-mb=")) {
+			connection_memory = std::stoull(arg.substr(23)) * 1024 * 1024;
+		}
+		else if (arg.starts_with("--volume=")) {
+			// Another destination with a disk pool of its own; the disk bandwidth adds up
+			volume_roots.push_back(fs::absolute(arg.substr(9)));
+		}
+		else if (arg.starts_with("--placement=")) {
+			// By name (hash), or onto the destination with the least queued (least-loaded)
+			auto parsed = cw::file::parsePlacement(arg.substr(12));
+			if (!parsed) {
+				std::cerr << "Unknown placement: " << arg.substr(12) << std::endl;
+				return 1;
+			}
+			placement = *parsed;
+		}
+		else if (arg.starts_with("--server-copy-root=")) {
+			// Storage this server can read too: clients with --server-copy send paths, not bytes
+			server_copy_roots.push_back(fs::absolute(arg.substr(19)));
+		}
+		else if (arg.starts_with("--download-root=")) {
+			// Serve the files under this directory to clients (Client --download=PATH)
+			download_roots.push_back(fs::absolute(arg.substr(16)));
+		}
+		else if (arg == "--download-kernel-copy") {
+			// Whole-file downloads go with sendfile: no reads, and so no chunk checksums
+			download_options.kernelCopy = true;
+		}
+		else if (arg.starts_with("--chunk-cache-mb=")) {
+			// Many clients fetching the same files: recently sent chunks are served from memory
+			chunk_cache_mb = std::stoul(arg.substr(17));
+		}
+		else if (arg.starts_with("--relay-to=")) {
+			// Chain/tree distribution: pass every received file on to this server too
+			relay_hosts.push_back(arg.substr(11));
+		}
+		else if (arg.starts_with("--swarm-tracker-port=")) {
+			// Origin of a swarm: receivers fetch its files from each other, as this tracker says
+			swarm_tracker_port = static_cast<uint16_t>(std::stoul(arg.substr(21)));
+		}
+		else if (arg.starts_with("--swarm-join=")) {
+			swarm_tracker = arg.substr(13);
+		}
+		else if (arg.starts_with("--swarm-fetch=")) {
+			swarm_fetch.push_back(arg.substr(14));
+		}
+		else if (arg.starts_with("--forward-to=")) {
+			// Store-and-forward hop: pass received streams on chunk by chunk
+			forward_host = arg.substr(13);
+		}
+		else if (arg == "--forward-only") {
+			// ...without keeping a copy here
+			forward_mode = cw::network::ForwardMode::ForwardOnly;
+		}
+		else {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return 1;
+		}
+	}
+	if (spin && socket_options.busyPollMicros == 0) socket_options.busyPollMicros = cw::network::DEFAULT_BUSY_POLL_MICROS;
+#if !defined(CW_HAS_TLS)
+	if (tls_options.enabled) {
+		std::cerr << "This build has no TLS support (OpenSSL not found)" << std::endl;
+		return 1;
+	}
+#endif
+	if (gossip_port != 0 && advertise.empty()) {
+		std::cerr << "--gossip-port needs --advertise=HOST[:PORT], where redirected clients reach this server" << std::endl;
+		return 1;
+	}
+	if ((swarm_tracker_port != 0 || !swarm_tracker.empty()) && advertise.empty()) {
+		std::cerr << "Swarms need --advertise=HOST[:PORT], where the other members reach this server" << std::endl;
+		return 1;
+	}
+	if (swarm_tracker_port != 0 && download_roots.empty()) {
+		std::cerr << "--swarm-tracker-port needs --download-root, the files the swarms fetch" << std::endl;
+		return 1;
+	}
+	if (swarm_tracker.empty() != swarm_fetch.empty()) {
+		std::cerr << "--swarm-join and --swarm-fetch go together" << std::endl;
+		return 1;
+	}
+	if (gossip_port == 0 && !gossip_peers.empty()) {
+		std::cerr << "--gossip-peer needs --gossip-port" << std::endl;
+		return 1;
+	}
+
 	fs::path dest_path(destination_folder);
+	if (confine && !volume_roots.empty()) {
+		// Confinement walks the destination from the working directory
+		std::cerr << "--confine takes a single destination, not --volume" << std::endl;
+		return 1;
+	}
 
 	// 2. Directory Setup
-	// Ensure the base destination folder exists
-	if (!fs::exists(dest_path)) {
+	// Ensure the base destination folder exists, and every volume's
+	std::vector<fs::path> roots{ dest_path };
+	roots.insert(roots.end(), volume_roots.begin(), volume_roots.end());
+	for (const auto& root : roots) {
+		if (!fs::exists(root)) {
+			try {
+				fs::create_directories(root);
+				CW_LOG_INFO("[Server] Created base directory: ", fs::absolute(root));
+			}
+			catch (const std::exception& e) {
+				std::cerr << "Error creating directory: " << e.what() << std::endl;
+				return 1;
+			}
+		}
+		else {
+			CW_LOG_INFO("[Server] Saving to existing directory: ", fs::absolute(root));
+		}
+	}
+
+	// The socket path is relative to where we were started too
+	if (!local_socket.empty()) local_socket = fs::absolute(local_socket).string();
+#if !defined(ASIO_HAS_LOCAL_SOCKETS)
+	if (!local_socket.empty()) {
+		std::cerr << "Local sockets are not supported on this platform" << std::endl;
+		return 1;
+	}
+#endif
+
+	// Certificate paths are relative to where we were started, so load them
+	// before moving into the destination folder
+#if defined(CW_HAS_TLS)
+	std::shared_ptr<asio::ssl::context> tls_context;
+	if (tls_options.enabled) {
 		try {
-			fs::create_directories(dest_path);
-			std::cout << "[Server] Created base directory: " << fs::absolute(dest_path) << std::endl;
+			tls_context = cw::network::makeTlsContext(true, tls_options);
 		}
 		catch (const std::exception& e) {
-			std::cerr << "Error creating directory: " << e.what() << std::endl;
+			std::cerr << "TLS setup failed: " << e.what() << std::endl;
 			return 1;
 		}
 	}
-	else {
-		std::cout << "[Server] Saving to existing directory: " << fs::absolute(dest_path) << std::endl;
-	}
+#endif
 
 	// 3. Set Working Directory (CRITICAL FIX)
 	// We change the process's current working directory to the destination folder.
@@ -49,7 +511,19 @@ int main(int argc, char* argv[])
 	// rather than next to the executable.
 	try {
 		fs::current_path(dest_path);
-		std::cout << "[Server] Working directory changed to: " << fs::current_path() << std::endl;
+		CW_LOG_INFO("[Server] Working directory changed to: ", fs::current_path());
+
+		// Transfers a crash or restart cut short: their senders resume where the journals say
+		auto interrupted = cw::file::findInterrupted(fs::current_path());
+		for (const auto& root : volume_roots) {
+			auto more = cw::file::findInterrupted(root);
+			interrupted.insert(interrupted.end(), std::make_move_iterator(more.begin()), std::make_move_iterator(more.end()));
+		}
+		if (!interrupted.empty()) {
+			std::uint64_t kept = 0;
+			for (const auto& transfer : interrupted) kept += transfer.state.offset;
+			CW_LOG_INFO("[Server] ", interrupted.size(), " interrupted transfers resumable, ", kept / (1024 * 1024), " MB kept");
+		}
 	}
 	catch (const std::exception& e) {
 		std::cerr << "Failed to change working directory: " << e.what() << std::endl;
@@ -57,15 +531,357 @@ int main(int argc, char* argv[])
 	}
 
 	try {
+		CW_LOG_INFO("[Server] CRC32C: ", cw::integrity::crc32cBackend());
+		// Chunk buffers from one huge-page mapping: fewer TLB misses at high rates
+		if (huge_pages_mb > 0) {
+			auto backing = cw::buffer::BufferPool::instance().useHugePages(huge_pages_mb * 1024 * 1024);
+			CW_LOG_INFO("[Server] Buffer pool: ", huge_pages_mb, " MB of ", cw::buffer::HugePageArena::describe(backing));
+		}
+
+		// Disk writes run on their own pool so a slow disk never stalls the network thread
+		auto work_pool = work_threads > 0 ? std::make_shared<cw::WorkPool>(work_threads) : nullptr;
+		auto make_disk_writer = [&]()
+			{
+				auto writer = std::make_shared<cw::file::DiskWriter>(disk_threads);
+				writer->setDurability(durability);
+				writer->setDirectIoMinSize(direct_io_min_size);
+				writer->setDropBehind(drop_behind);
+				writer->setMappedWrites(mapped_writes);
+				writer->setWriteLanes(write_lanes, write_lane_min_size);
+				if (work_pool) writer->setWorkPool(work_pool);
+				if (file_backend) writer->setBackend(*file_backend);
+				return writer;
+			};
+		auto disk_writer = make_disk_writer();
+		disk_writer->directories()->setConfined(confine);
+		if (disk_fair_share) {
+			auto& scheduler = disk_writer->enableFairShare();
+			for (const auto& [address, weight] : disk_weights) scheduler.setWeight(address, weight);
+		}
+		disk_writer->setAdmissionLimits(admit_queue, std::chrono::milliseconds(admit_latency_ms));
+		if (file_backend && disk_writer->backend() != *file_backend) {
+			CW_LOG_WARN("[Server] This build has no native file backend; writing through the disk threads");
+		}
+
+		// The destination is the first volume; each more has a disk pool of its own
+		std::shared_ptr<const cw::file::VolumeSet> volumes;
+		if (!volume_roots.empty()) {
+			std::vector<cw::file::VolumeSet::Volume> list{ { {}, disk_writer } };
+			for (const auto& root : volume_roots) list.push_back({ root, make_disk_writer() });
+			volumes = std::make_shared<const cw::file::VolumeSet>(std::move(list), placement);
+			CW_LOG_INFO("[Server] Received files spread over ", volumes->size(), " volumes by ",
+				placement == cw::file::Placement::Hash ? "name" : "load");
+		}
+		auto rate_limiter = rate_limit ? std::make_shared<cw::network::RateLimiter>(rate_limit) : nullptr;
+		auto content_store = content_store_dir.empty() ? nullptr : std::make_shared<cw::file::ContentStore>(content_store_dir, content_link);
+		auto signature_cache = signature_cache_dir.empty() ? nullptr : std::make_shared<cw::file::SignatureCache>(signature_cache_dir);
+
+		// With --s3 every connection hands its files to the bucket, parts going
+		// up from threads of their own
+		std::optional<asio::thread_pool> s3_threads;
+		std::function<void(cw::network::Connection&)> connection_setup;
+		if (s3) {
+			s3_threads.emplace(4);
+			auto store = std::make_shared<cw::network::S3Store>(s3_threads->get_executor(), *s3);
+			cw::network::ObjectStoreReceiver<cw::network::S3Store>::Options object_options;
+			object_options.prefix = s3_prefix;
+			connection_setup = [store, object_options](cw::network::Connection& conn)
+				{
+					conn.setHandler(std::make_shared<cw::network::ObjectStoreReceiver<cw::network::S3Store>>(store, object_options));
+				};
+			CW_LOG_INFO("[Server] Storing received files in s3://", s3->bucket, "/", s3_prefix, " at ", s3->host, ":", s3->port);
+		}
+		auto memory_budget = cw::buffer::MemoryBudget::defaultInstance();
+		memory_budget->setLimit(memory_limit);
+
+		// One cache for downloads and relays alike: a file relayed is often fetched too
+		std::shared_ptr<cw::file::ChunkCache> chunk_cache;
+		if (chunk_cache_mb > 0) {
+			chunk_cache = std::make_shared<cw::file::ChunkCache>(chunk_cache_mb * 1024 * 1024);
+			download_options.chunkCache = chunk_cache;
+			if (download_options.kernelCopy) CW_LOG_WARN("[Server] --chunk-cache-mb reads downloads into buffers instead of --download-kernel-copy");
+		}
+
+		// Next hops, each a Client connection, joined to the relay once connected
+		std::shared_ptr<cw::FileRelay> relay;
+		std::vector<std::unique_ptr<cw::network::Client>> relay_clients;
+		auto start_relay = [&](asio::io_context& io)
+			{
+				if (relay_hosts.empty()) return;
+				cw::TransferOptions relay_options;
+				relay_options.memoryMap = true;
+				relay_options.chunkCache = chunk_cache;
+				relay = std::make_shared<cw::FileRelay>(relay_options);
+				for (const auto& host : relay_hosts) {
+					relay_clients.push_back(std::make_unique<cw::network::Client>(io));
+					auto* client = relay_clients.back().get();
+					client->SetSocketOptions(socket_options);
+					client->Connect(host, 8080, [relay, client, host]()
+						{
+							CW_LOG_INFO("[Relay] Passing received files on to ", host);
+							relay->addNextHop(client->GetConnection());
+						});
+				}
+			};
+
+		// The next hop of this store-and-forward hop, used by the connections
+		// accepted once it has announced what it takes
+		std::unique_ptr<cw::network::Client> forward_client;
+		auto start_forwarding = [&](asio::io_context& io, auto& server)
+			{
+				if (forward_host.empty()) return;
+				forward_client = std::make_unique<cw::network::Client>(io);
+				auto* client = forward_client.get();
+				client->SetSocketOptions(socket_options);
+				client->Connect(forward_host, 8080, [&server, client, host = forward_host, mode = forward_mode]()
+					{
+						auto downstream = client->GetConnection();
+						downstream->asyncWaitCapabilities([&server, downstream, host, mode](std::error_code ec)
+							{
+								if (ec) return;
+								CW_LOG_INFO("[Forward] Passing received streams on to ", host);
+								server.setForwarding(downstream, mode);
+							});
+					});
+			};
+
+		// Swarm distribution: the origin tracks who holds which pieces of its
+		// files; a member serves the pieces it fetched from its piece directory
+		std::shared_ptr<cw::network::SwarmTracker> swarm_tracker_service;
+		std::shared_ptr<cw::SwarmMember> swarm_member;
+		cw::SwarmMember::Options swarm_options;
+		if (!swarm_tracker.empty()) {
+			fs::create_directories(swarm_options.pieceDirectory);
+			download_roots.push_back(fs::absolute(swarm_options.pieceDirectory));
+		}
+		auto start_swarm = [&](asio::io_context& io)
+			{
+				if (swarm_tracker_port != 0) {
+					auto resolve = [roots = download_roots](const std::string& name) -> std::optional<uint64_t>
+						{
+							if (!cw::file::isSafeRelativePath(name)) return std::nullopt;
+							for (const auto& root : roots) {
+								std::error_code ec;
+								auto size = fs::file_size(root / name, ec);
+								if (!ec) return size;
+							}
+							return std::nullopt;
+						};
+					swarm_tracker_service = cw::network::SwarmTracker::start(io, swarm_tracker_port, advertise, resolve);
+				}
+				if (swarm_tracker.empty()) return;
+				swarm_options.tracker = swarm_tracker;
+				swarm_options.address = advertise;
+				cw::network::ClientPoolOptions pool_options;
+				pool_options.socketOptions = socket_options;
+				swarm_member = cw::SwarmMember::create(io, cw::network::ClientPool::create(io, pool_options), swarm_options);
+				for (const auto& name : swarm_fetch) {
+					asio::co_spawn(io, swarm_member->asyncFetch(name), [name](std::exception_ptr error, uint64_t)
+						{
+							if (!error) return;
+							try {
+								std::rethrow_exception(error);
+							}
+							catch (const std::exception& e) {
+								CW_LOG_ERROR("[Swarm] ", name, " not fetched: ", e.what());
+							}
+						});
+				}
+			};
+
+		// Stats dump and scrape endpoint, on the first network context (they only read counters)
+		std::optional<cw::network::MetricsEndpoint> metrics_endpoint;
+		std::optional<cw::network::StatsReporter> stats_reporter;
+		std::shared_ptr<cw::network::UdpTunnel> udp_tunnel;
+
+		// Load gossip with the peer servers, on the first network context; a
+		// file refused as busy is pointed at a peer with room
+		auto start_gossip = [&](asio::io_context& io) -> std::shared_ptr<cw::network::LoadGossip>
+			{
+				if (gossip_port == 0) return nullptr;
+				if (!disk_writer->admissionLimited()) CW_LOG_WARN("[Server] --gossip-port redirects only files refused by --admit-queue-mb or --admit-latency-ms");
+				std::vector<asio::ip::udp::endpoint> peers;
+				asio::ip::udp::resolver resolver(io);
+				for (const auto& peer : gossip_peers) {
+					auto target = cw::network::splitHostPort(peer);
+					std::error_code ec;
+					auto results = target ? resolver.resolve(asio::ip::udp::v4(), target->first, std::to_string(target->second), ec)
+						: asio::ip::udp::resolver::results_type{};
+					if (!target || ec || results.empty()) {
+						CW_LOG_WARN("[Server] Cannot gossip with ", peer, ", skipped");
+						continue;
+					}
+					peers.push_back(results.begin()->endpoint());
+				}
+				return cw::network::LoadGossip::start(io, gossip_port, advertise, disk_writer, std::move(peers));
+			};
+
+		// SIGINT/SIGTERM drain the server (see Server::drain): no new
+		// connections, the transfers in flight finish, then the session
+		// timeline, if recorded, is written out, the CPU by stage, if
+		// counted, logged, and the network contexts stop.
+		// A second signal stops at once. What is still queued for the disk is
+		// written before the disk pool exits.
+		std::optional<asio::signal_set> signals;
+		auto handle_signals = [&](asio::io_context& io, auto& server, std::function<void()> stop)
+			{
+				auto& timeline = cw::metrics::Timeline::instance();
+				if (!trace_out.empty()) {
+					timeline.start();
+					disk_writer->runOnEachThread([&timeline]() { timeline.nameThisThread("disk"); });
+				}
+				auto& stages = cw::metrics::StageProfile::instance();
+				if (cpu_profile) stages.start();
+				auto stopped = std::make_shared<std::atomic<bool>>(false);
+				auto finish = [&timeline, &trace_out, &stages, stop = std::move(stop), stopped]()
+					{
+						if (stopped->exchange(true)) return;
+						if (stages.enabled()) {
+							stages.stop();
+							CW_LOG_INFO("[Server] ", stages.breakdown().format());
+						}
+						if (!trace_out.empty()) {
+							timeline.stop();
+							if (timeline.writeJson(trace_out)) CW_LOG_INFO("[Server] Trace of ", timeline.eventCount(), " events written to ", trace_out);
+							else CW_LOG_ERROR("[Server] Could not write the trace to ", trace_out);
+						}
+						stop();
+					};
+				signals.emplace(io, SIGINT, SIGTERM);
+				signals->async_wait([&signals, &server, finish, timeout = drain_timeout](std::error_code ec, int)
+					{
+						if (ec) return;
+						CW_LOG_INFO("[Server] Stopping: draining for up to ", timeout, " s (signal again to stop now)");
+						signals->async_wait([finish](std::error_code ec, int) { if (!ec) finish(); });
+						server.drain(std::chrono::seconds(timeout), finish);
+					});
+			};
+		auto start_metrics = [&](asio::io_context& io)
+			{
+				if (metrics_port != 0) metrics_endpoint.emplace(io, metrics_port);
+				if (stats_interval != 0) stats_reporter.emplace(io, std::chrono::seconds(stats_interval));
+				// Streams arriving over UDP are handed to our own TCP port
+				if (udp_port != 0) {
+					udp_tunnel = cw::network::UdpTunnel::listen(io, udp_port, { asio::ip::address_v4::loopback(), 8080 }, udp_options);
+				}
+			};
+
+		if ((!numa_node.empty() || !disk_numa_node.empty()) && shards == 0) {
+			CW_LOG_WARN("[Server] --numa-node and --disk-numa-node take effect with --shards only");
+		}
+
+		if (shards > 0) {
+			// One pinned io_context + acceptor per core; connections never migrate
+			cw::network::ShardedServer server(8080, shards, disk_writer);
+
+			// A node number, or the node of the NIC / disk named
+			auto resolve_node = [](const std::string& spec, auto node_of) -> std::optional<int>
+				{
+					if (spec.empty()) return std::nullopt;
+					if (spec.find_first_not_of("0123456789") == std::string::npos) return std::stoi(spec);
+					auto node = node_of(spec);
+					if (!node) CW_LOG_WARN("[Server] No NUMA node known for ", spec, ", not pinning to one");
+					return node;
+				};
+			cw::network::NumaPlacement numa;
+			numa.networkNode = resolve_node(numa_node, cw::numa::nodeOfInterface);
+			numa.diskNode = resolve_node(disk_numa_node, [](const std::string& spec) -> std::optional<int>
+				{
+					if (spec != "auto") return std::nullopt;
+					return cw::numa::nodeOfPath(fs::current_path());
+				});
+			server.setNumaPlacement(numa);
+			server.setSocketOptions(socket_options);
+			server.setServerCopyRoots(server_copy_roots);
+			server.setDownloadRoots(download_roots, download_options);
+			start_swarm(server.context(0));
+			start_relay(server.context(0));
+			server.setFileRelay(relay);
+			server.setContentStore(content_store);
+			server.setVolumes(volumes);
+			server.setLoadGossip(start_gossip(server.context(0)));
+			server.setSignatureCache(signature_cache);
+			server.setConnectionSetup(connection_setup);
+			start_forwarding(server.context(0), server);
+			server.setReceiveLimits(max_chunk_size, receive_window);
+			server.setMaxConnections(max_connections);
+			server.setIdleTimeout(std::chrono::seconds(idle_timeout));
+			server.setStallTimeout(std::chrono::seconds(stall_timeout));
+			server.setHeartbeat(std::chrono::seconds(heartbeat));
+			server.setTreeHash(tree_hash);
+			server.setChunkKey(chunk_key);
+			server.setServeStats(serve_stats);
+			server.setSpliceReceive(splice_receive);
+			server.setZeroCopyReceive(zerocopy_receive);
+			server.setConnectionRateLimit(connection_rate_limit);
+			server.setRateLimiter(rate_limiter);
+			server.setMemoryBudget(memory_budget, connection_memory);
+			server.setPendingAccepts(pending_accepts);
+			server.setSpinning(spin);
+#if defined(CW_HAS_TLS)
+			server.setTls(tls_context);
+#endif
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+			if (!local_socket.empty()) server.listenLocal(local_socket);
+#endif
+			CW_LOG_INFO("[Server] Listening on port 8080 (", server.shardCount(), " shards)...");
+			start_metrics(server.context(0));
+			handle_signals(server.context(0), server, [&server]() { server.stop(); });
+			server.run();
+			signals.reset();
+			return 0;
+		}
+
 		asio::io_context io_context;
 
 		// The Server object sets up the accept loop in its constructor
-		cw::network::Server server(io_context, 8080);
+		cw::network::Server server(io_context, 8080, disk_writer);
+		server.setSocketOptions(socket_options);
+		server.setServerCopyRoots(server_copy_roots);
+		server.setDownloadRoots(download_roots, download_options);
+		start_swarm(io_context);
+		start_relay(io_context);
+		server.setFileRelay(relay);
+		server.setContentStore(content_store);
+		server.setVolumes(volumes);
+		server.setLoadGossip(start_gossip(io_context));
+		server.setSignatureCache(signature_cache);
+		server.setConnectionSetup(connection_setup);
+		start_forwarding(io_context, server);
+		server.setReceiveLimits(max_chunk_size, receive_window);
+		server.setMaxConnections(max_connections);
+		server.setIdleTimeout(std::chrono::seconds(idle_timeout));
+		server.setStallTimeout(std::chrono::seconds(stall_timeout));
+		server.setHeartbeat(std::chrono::seconds(heartbeat));
+		server.setTreeHash(tree_hash);
+		server.setChunkKey(chunk_key);
+		server.setServeStats(serve_stats);
+		server.setSpliceReceive(splice_receive);
+		server.setZeroCopyReceive(zerocopy_receive);
+		server.setConnectionRateLimit(connection_rate_limit);
+		server.setRateLimiter(rate_limiter);
+		server.setMemoryBudget(memory_budget, connection_memory);
+		server.setPendingAccepts(pending_accepts);
+#if defined(CW_HAS_TLS)
+		server.setTls(tls_context);
+#endif
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+		if (!local_socket.empty()) server.listenLocal(local_socket);
+#endif
+
+		CW_LOG_INFO("[Server] Listening on port 8080 (", io_threads, " network threads)...");
+		start_metrics(io_context);
+		handle_signals(io_context, server, [&io_context]() { io_context.stop(); });
 
-		std::cout << "[Server] Listening on port 8080...\n";
+		// Run the blocking loop on every thread; connections serialize on their strands
+		std::vector<std::thread> workers;
+		for (std::size_t i = 1; i < io_threads; ++i) {
+			workers.emplace_back([&io_context, spin]() { cw::network::runEventLoop(io_context, spin); });
+		}
+		cw::network::runEventLoop(io_context, spin);
 
-		// Run the blocking loop
-		io_context.run();
+		for (auto& worker : workers) worker.join();
+		signals.reset();
 	}
 	catch (std::exception& e) {
 		std::cerr << "Exception: " << e.what() << "\n";
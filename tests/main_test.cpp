@@ -1,18 +1,80 @@
 #include <gtest/gtest.h>
 #include <vector>
 #include <string>
+#include <cstring>
+#include <thread>
+#include <map>
+#include <fstream>
+#include <future>
+#include <numeric>
 
 // Include your project headers
 #include "../protocol/packet/packet.h"
+#include "../protocol/packet/packet_registry.h"
 #include "../Frame.h"
+#include "cw/flat_hash.h"
+#include "cw/numa.h"
+#include "cw/trace.h"
+#include "cw/metrics/stage_profile.h"
+#include "cw/metrics/timeline.h"
+#include "cw/buffer/receive_buffer.h"
+#include "cw/buffer/memory_budget.h"
+#include "cw/file/file.h"
+#include "cw/network/memory_receiver.h"
+#include "cw/network/packet_channel.h"
+#include "cw/network/stream_receiver.h"
+#include "cw/log/logger.h"
+#include "cw/network/metrics_endpoint.h"
+#include "cw/network/socket_options.h"
+#include "cw/network/tls.h"
+#include "cw/network/udp_tunnel.h"
+#include "cw/network/busy_poll.h"
+#include "cw/network/wan_emulator.h"
+#include "cw/network/Server.h"
+#include "cw/network/sharded_server.h"
+#include "cw/network/resolver.h"
+#include "cw/network/ring_queue.h"
+#include "cw/network/stream_table.h"
+#include "cw/network/client_pool.h"
+#include "cw/network/Client.h"
+#include "cw/network/s3_store.h"
+#include "cw/file/directory_upload.h"
+#include "cw/file/download.h"
+#include "cw/file/relay.h"
+#include "cw/file/swarm.h"
+#include "cw/file/stream_upload.h"
+#include "cw/file/archive.h"
+#include "cw/file/safe_path.h"
+#include "cw/file/splice_pipe.h"
+#include "cw/file/auto_tuner.h"
+#include "cw/file/content_store.h"
 
 using namespace cw::packet;
 
+// Whole files written and read back, for the tests that check what arrived
+static void writeBytes(const std::filesystem::path& path, const std::vector<uint8_t>& bytes)
+{
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+}
+
+static std::vector<uint8_t> readBytes(const std::filesystem::path& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	return { std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+}
+
+static std::string readText(const std::filesystem::path& path)
+{
+	std::ifstream in(path);
+	return { std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+}
+
 // 1. SIMPLE TEST CASE
 // Syntax: TEST(TestSuiteName, TestName)
 TEST(AckPacketTest, SerializationRoundTrip) {
 	// Arrange
 	Ack original;
+	original.streamId = 42;
 	original.offset = 0xDEADBEEF;
 
 	// Act
@@ -22,9 +84,10 @@ TEST(AckPacketTest, SerializationRoundTrip) {
 
 	// Assert
 	// ASSERT_EQ stops the test if it fails. EXPECT_EQ continues.
-	EXPECT_EQ(frame.size(), 18); // Header(10) + Payload(8)
+	EXPECT_EQ(frame.size(), 22); // Header(10) + Payload(4 + 8)
 	EXPECT_EQ(view.type, PacketType::Ack);
 	EXPECT_EQ(original.offset, reconstructed.offset);
+	EXPECT_EQ(original.streamId, reconstructed.streamId);
 }
 
 // 2. EXCEPTION TESTING (The "Garbage Data" Test)
@@ -61,15 +124,9288 @@ protected:
 // Note: Use TEST_F (F for Fixture) to access the class members
 TEST_F(FileInfoTest, CorrectHeaderSize) {
 	auto frame = buildFrame(pkt);
-	// Header (10) + Size (8) + NameLen (4) + Name (11) = 33 bytes
-	ASSERT_EQ(frame.size(), 33);
+	// Header (10) + StreamId (4) + Size (8) + NameLen (4) + Name (11) = 37 bytes
+	ASSERT_EQ(frame.size(), 37);
 }
 
 TEST_F(FileInfoTest, ContentIntegrity) {
+	pkt.streamId = 7;
 	auto frame = buildFrame(pkt);
 	auto view = parseFrame(frame);
 	auto decoded = FileInfo::deserialize(view.payload_view, view.size);
 
 	EXPECT_EQ(decoded.fileName, "config.json");
 	EXPECT_EQ(decoded.fileSize, 1024);
-}
\ No newline at end of file
+	EXPECT_EQ(decoded.streamId, 7u);
+}
+
+// 4. RECEIVE BUFFER (Parse in place, consume without shifting)
+TEST(ReceiveBufferTest, ParsesBackToBackFramesInPlace) {
+	Ack first;
+	first.offset = 1;
+	Ack second;
+	second.offset = 2;
+
+	auto a = buildFrame(first);
+	auto b = buildFrame(second);
+
+	cw::buffer::ReceiveBuffer buffer(16);
+	buffer.append(a.data(), a.size());
+	buffer.append(b.data(), b.size() - 3); // Fragmented second frame
+
+	ParsedFrame view = parseFrame(buffer.data(), buffer.size());
+	EXPECT_EQ(Ack::deserialize(view.payload_view, view.size).offset, 1u);
+	buffer.consume(FRAME_HEADER_SIZE + view.size);
+
+	EXPECT_THROW(parseFrame(buffer.data(), buffer.size()), std::runtime_error);
+
+	buffer.append(b.data() + b.size() - 3, 3);
+	view = parseFrame(buffer.data(), buffer.size());
+	EXPECT_EQ(Ack::deserialize(view.payload_view, view.size).offset, 2u);
+	buffer.consume(FRAME_HEADER_SIZE + view.size);
+
+	EXPECT_TRUE(buffer.empty());
+}
+
+TEST(ReceiveBufferTest, PrepareCommitExposesFreeTail) {
+	cw::buffer::ReceiveBuffer buffer(8);
+
+	auto tail = buffer.prepare(32); // Larger than capacity: must grow
+	ASSERT_GE(tail.size(), 32u);
+	std::memset(tail.data(), 0xAB, 5);
+	buffer.commit(5);
+
+	EXPECT_EQ(buffer.size(), 5u);
+	EXPECT_EQ(buffer.data()[4], 0xAB);
+}
+
+// 5. NON-THROWING PARSE (Fragmentation is a status, not an exception)
+TEST(FrameParseTest, TryParseReportsStatus) {
+	Ack ack;
+	ack.offset = 7;
+	auto frame = buildFrame(ack);
+
+	EXPECT_EQ(tryParseFrame(frame.data(), 4).status, ParseStatus::NeedMoreData);
+	EXPECT_EQ(tryParseFrame(frame.data(), frame.size() - 1).status, ParseStatus::NeedMoreData);
+
+	ParseResult ok = tryParseFrame(frame.data(), frame.size());
+	ASSERT_EQ(ok.status, ParseStatus::Complete);
+	EXPECT_EQ(ok.frame.type, PacketType::Ack);
+	EXPECT_EQ(ok.frame.size, 12u);
+
+	std::vector<uint8_t> garbage = {
+		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+		0x00, 0x01
+	};
+	EXPECT_EQ(tryParseFrame(garbage.data(), garbage.size()).status, ParseStatus::ProtocolError);
+}
+
+TEST(FileChunkViewTest, ViewPointsIntoFrameBuffer) {
+	FileChunk chunk;
+	chunk.streamId = 3;
+	chunk.offset = 4096;
+	chunk.data = { 1, 2, 3, 4, 5 };
+
+	auto frame = buildFrame(chunk);
+	auto view = parseFrame(frame);
+	auto decoded = FileChunkView::deserialize(view.payload_view, view.size);
+
+	EXPECT_EQ(decoded.streamId, 3u);
+	EXPECT_EQ(decoded.offset, 4096u);
+	ASSERT_EQ(decoded.data.size(), 5u);
+	EXPECT_EQ(decoded.data[4], 5);
+	// Zero-copy: the span aliases the frame bytes
+	EXPECT_GE(decoded.data.data(), frame.data());
+	EXPECT_LT(decoded.data.data(), frame.data() + frame.size());
+}
+
+// 6. SCATTER/GATHER FRAMES (Header + referenced payload == contiguous frame)
+TEST(OutgoingFrameTest, SegmentedChunkMatchesContiguousFrame) {
+	std::vector<uint8_t> bytes(1000);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i);
+
+	FileChunk owned;
+	owned.offset = 123;
+	owned.data = bytes;
+
+	SharedFileChunk shared;
+	shared.offset = 123;
+	shared.data = cw::buffer::SharedBuffer::fromVector(std::move(bytes));
+
+	OutgoingFrame frame = buildOutgoingFrame(shared);
+	EXPECT_EQ(frame.header.size(), FRAME_HEADER_SIZE + 21); // StreamId + Offset + Length + CRC field
+	EXPECT_EQ(frame.payload.data(), shared.data.data()); // Referenced, not copied
+
+	std::vector<uint8_t> joined = frame.header;
+	joined.insert(joined.end(), frame.payload.data(), frame.payload.data() + frame.payload.size());
+
+	EXPECT_EQ(joined, buildFrame(owned));
+}
+
+TEST(OutgoingFrameTest, MovedChunkGivesUpItsBuffer) {
+	FileChunk owned;
+	owned.streamId = 4;
+	owned.offset = 123;
+	owned.data.assign(1000, 9);
+	owned.crc = 0xABCDu;
+	std::vector<uint8_t> contiguous = buildFrame(owned);
+
+	const uint8_t* buffer = owned.data.data();
+	OutgoingFrame frame = buildOutgoingFrame(std::move(owned));
+	EXPECT_EQ(frame.payload.data(), buffer); // The chunk's own buffer, not a copy
+	EXPECT_TRUE(owned.data.empty());
+
+	std::vector<uint8_t> joined = frame.header;
+	joined.insert(joined.end(), frame.payload.data(), frame.payload.data() + frame.payload.size());
+	EXPECT_EQ(joined, contiguous);
+
+	// An lvalue is still copied whole into the frame
+	FileChunk kept;
+	kept.offset = 0;
+	kept.data.assign(16, 1);
+	OutgoingFrame copied = buildOutgoingFrame(kept);
+	EXPECT_TRUE(copied.payload.empty());
+	EXPECT_EQ(kept.data.size(), 16u);
+}
+
+// 7. ADAPTIVE CHUNK SIZING
+TEST(ChunkSizerTest, GrowsWhileThroughputImprovesThenSettles) {
+	cw::TransferOptions options;
+	options.adaptiveChunkSize = true;
+	options.minChunkSize = 64 * 1024;
+	options.maxChunkSize = 1024 * 1024;
+
+	cw::ChunkSizer sizer(options);
+	EXPECT_EQ(sizer.next(), 64u * 1024);
+
+	auto feedWindow = [&](std::chrono::microseconds perChunk) {
+		for (size_t i = 0; i < cw::ChunkSizer::CHUNKS_PER_WINDOW; ++i)
+			sizer.onChunkSent(sizer.next(), perChunk);
+	};
+
+	// Constant per-chunk latency: bigger chunks mean more throughput
+	feedWindow(std::chrono::microseconds(100));
+	EXPECT_EQ(sizer.next(), 128u * 1024);
+	feedWindow(std::chrono::microseconds(100));
+	EXPECT_EQ(sizer.next(), 256u * 1024);
+
+	// Throughput collapses: step back and stay there
+	feedWindow(std::chrono::microseconds(10000));
+	EXPECT_EQ(sizer.next(), 128u * 1024);
+	feedWindow(std::chrono::microseconds(1));
+	EXPECT_EQ(sizer.next(), 128u * 1024);
+}
+
+TEST(ChunkSizerTest, FixedSizeIsClampedToProtocolLimit) {
+	cw::TransferOptions options;
+	options.chunkSize = 64 * 1024 * 1024;
+
+	cw::ChunkSizer sizer(options);
+	EXPECT_EQ(sizer.next(), MAX_CHUNK_SIZE);
+}
+
+// 8. CHUNK SOURCES (mmap and stream produce the same chunks)
+TEST(ChunkSourceTest, MappedAndStreamReadsAgree) {
+	auto path = std::filesystem::temp_directory_path() / "cw_chunk_source_test.bin";
+	{
+		std::ofstream out(path, std::ios::binary);
+		for (int i = 0; i < 10000; ++i) out.put(static_cast<char>(i * 7));
+	}
+
+	{
+		cw::file::ChunkSource mapped(path, cw::file::ReadMode::MemoryMap);
+		cw::file::ChunkSource stream(path, cw::file::ReadMode::Stream);
+		EXPECT_TRUE(mapped.isMapped());
+		EXPECT_FALSE(stream.isMapped());
+
+		size_t total = 0;
+		while (true) {
+			auto a = mapped.next(4096);
+			auto b = stream.next(4096);
+			ASSERT_EQ(a.size(), b.size());
+			if (a.empty()) break;
+			EXPECT_EQ(0, std::memcmp(a.data(), b.data(), a.size()));
+			total += a.size();
+		}
+		EXPECT_EQ(total, 10000u);
+	}
+
+	std::filesystem::remove(path);
+}
+
+// 9. POSITIONAL WRITES (Out-of-order chunks land in place)
+TEST(FileHandleTest, WriteAtAcceptsOutOfOrderChunks) {
+	auto path = std::filesystem::temp_directory_path() / "cw_write_at_test.bin";
+	{
+		auto file = cw::file::FileHandle::openWrite(path);
+		std::vector<uint8_t> tail = { 'w', 'o', 'r', 'l', 'd' };
+		std::vector<uint8_t> head = { 'h', 'e', 'l', 'l', 'o', ' ' };
+		EXPECT_FALSE(file.writeAt(6, tail));
+		EXPECT_FALSE(file.writeAt(0, head));
+	}
+
+	std::ifstream in(path, std::ios::binary);
+	std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	EXPECT_EQ(content, "hello world");
+
+	std::filesystem::remove(path);
+}
+
+TEST(FileHandleTest, PreallocateReservesSpace) {
+	auto path = std::filesystem::temp_directory_path() / "cw_prealloc_test.bin";
+	{
+		auto file = cw::file::FileHandle::openWrite(path);
+		EXPECT_FALSE(file.preallocate(1024 * 1024));
+		std::vector<uint8_t> byte = { 1 };
+		EXPECT_FALSE(file.writeAt(0, byte));
+	}
+	std::filesystem::remove(path);
+}
+
+// 10. WRITE-BEHIND (Disk work on the pool, results on the caller's executor)
+TEST(WriteBehindFileTest, WritesLandBeforeFinishCompletes) {
+	auto path = std::filesystem::temp_directory_path() / "cw_write_behind" / "nested" / "out.bin";
+	asio::io_context io;
+	cw::file::DiskWriter writer(2);
+
+	auto file = cw::file::WriteBehindFile::create(writer, io.get_executor());
+
+	std::error_code openResult = asio::error::would_block;
+	file->open(path, 8, [&](std::error_code ec) { openResult = ec; });
+
+	file->write(4, cw::buffer::SharedBuffer::fromVector({ 5, 6, 7, 8 }));
+	file->write(0, cw::buffer::SharedBuffer::fromVector({ 1, 2, 3, 4 }));
+
+	// Callbacks are posted back to 'io' from the disk threads
+	auto work = asio::make_work_guard(io);
+
+	uint64_t written = 0;
+	file->finish([&](std::error_code ec, uint64_t bytes) { EXPECT_FALSE(ec); written = bytes; work.reset(); });
+
+	io.run();
+
+	EXPECT_FALSE(openResult);
+	EXPECT_EQ(written, 8u);
+	EXPECT_EQ(file->pendingBytes(), 0u);
+	EXPECT_EQ(std::filesystem::file_size(path), 8u);
+
+	std::filesystem::remove_all(std::filesystem::temp_directory_path() / "cw_write_behind");
+}
+
+// 11. STRIPED UPLOADS (Stripes of one file join a single transfer)
+TEST(StripeTest, StripesJoinOneTransfer) {
+	StripeInfo original;
+	original.transferId = 0x0123456789ABCDEFull;
+	original.stripeCount = 3;
+	original.fileSize = 1ull << 33;
+	original.fileName = "big/file.bin";
+
+	auto frame = cw::packet::buildFrame(original);
+	auto view = cw::packet::parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::StripeInfo);
+
+	auto decoded = StripeInfo::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(decoded.transferId, original.transferId);
+	EXPECT_EQ(decoded.stripeCount, 3);
+	EXPECT_EQ(decoded.fileSize, original.fileSize);
+	EXPECT_EQ(decoded.fileName, original.fileName);
+
+	cw::file::TransferRegistry registry;
+	int created = 0;
+	auto factory = [&]() {
+		++created;
+		auto transfer = std::make_shared<cw::file::IncomingTransfer>();
+		transfer->stripeCount = decoded.stripeCount;
+		return transfer;
+	};
+
+	auto first = registry.join(decoded.transferId, factory);
+	auto second = registry.join(decoded.transferId, factory);
+	auto third = registry.join(decoded.transferId, factory);
+	EXPECT_EQ(created, 1);
+	EXPECT_EQ(first, third);
+
+	// Only the last stripe's FileDone completes the file
+	EXPECT_FALSE(first->markStripeDone());
+	EXPECT_FALSE(second->markStripeDone());
+	EXPECT_TRUE(third->markStripeDone());
+
+	registry.remove(decoded.transferId);
+	EXPECT_EQ(registry.size(), 0u);
+}
+
+// 12. FILE BATCH (Many small files in one frame)
+TEST(FileBatchTest, RoundTripAndTruncation) {
+	FileBatch original;
+	original.files.push_back({ "src/a.cpp", { 1, 2, 3 } });
+	original.files.push_back({ "empty.txt", {} });
+	original.files.push_back({ "cfg/b.json", std::vector<uint8_t>(300, 9) });
+
+	auto frame = buildFrame(original);
+	auto view = parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::FileBatch);
+	ASSERT_EQ(view.size, original.payloadSize());
+
+	auto decoded = FileBatchView::deserialize(view.payload_view, view.size);
+	ASSERT_EQ(decoded.files.size(), 3u);
+	EXPECT_EQ(decoded.files[0].fileName, "src/a.cpp");
+	EXPECT_EQ(decoded.files[0].data.size(), 3u);
+	EXPECT_TRUE(decoded.files[1].data.empty());
+	EXPECT_EQ(decoded.files[2].data[299], 9);
+
+	// Views alias the frame bytes
+	EXPECT_GE(decoded.files[2].data.data(), frame.data());
+	EXPECT_LT(decoded.files[2].data.data(), frame.data() + frame.size());
+
+	EXPECT_THROW(FileBatchView::deserialize(view.payload_view, view.size - 1), std::runtime_error);
+}
+
+// 13. RESUMABLE TRANSFERS (Checkpointed prefix survives a dropped connection)
+TEST(ResumeTest, ReopenContinuesAtCheckpoint) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_resume";
+	auto path = dir / "part.bin";
+	std::filesystem::remove_all(dir);
+
+	asio::io_context io;
+	cw::file::DiskWriter writer(1);
+
+	// One attempt: open with 'fingerprint', write 'chunk' at the resume offset, finish
+	auto attempt = [&](uint64_t fingerprint, std::vector<uint8_t> chunk) {
+		auto file = cw::file::WriteBehindFile::create(writer, io.get_executor());
+		auto work = asio::make_work_guard(io);
+		uint64_t resumeOffset = UINT64_MAX;
+
+		file->openResumable(path, 8, fingerprint, 4, [&, chunk](std::error_code ec, uint64_t at) mutable
+			{
+				EXPECT_FALSE(ec);
+				resumeOffset = at;
+				if (!chunk.empty()) file->write(at, cw::buffer::SharedBuffer::fromVector(std::move(chunk)));
+				file->finish([&](std::error_code, uint64_t) { work.reset(); });
+			});
+
+		io.restart();
+		io.run();
+		return resumeOffset;
+	};
+
+	// First attempt: only the first half arrives before the connection drops
+	EXPECT_EQ(attempt(42, { 1, 2, 3, 4 }), 0u);
+	auto state = cw::file::ResumeJournal(path).load();
+	ASSERT_TRUE(state.has_value());
+	EXPECT_EQ(state->offset, 4u);
+
+	// Same source: continue at the checkpoint; the journal goes once complete
+	EXPECT_EQ(attempt(42, { 5, 6, 7, 8 }), 4u);
+	EXPECT_FALSE(std::filesystem::exists(cw::file::ResumeJournal::pathFor(path)));
+
+	std::ifstream in(path, std::ios::binary);
+	std::vector<char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(contents, std::vector<char>({ 1, 2, 3, 4, 5, 6, 7, 8 }));
+	in.close();
+
+	// A different source never reuses the old bytes
+	cw::file::ResumeJournal(path).save({ 7, 8, 4 });
+	EXPECT_EQ(attempt(43, {}), 0u);
+
+	std::filesystem::remove_all(dir);
+}
+
+TEST(ResumeTest, JournalsRangesPastAHoleUnderGroupCommit) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_resume_ranges";
+	auto path = dir / "part.bin";
+	std::filesystem::remove_all(dir);
+
+	asio::io_context io;
+	cw::file::DiskWriter writer(1);
+	writer.setDurability(cw::file::Durability::GroupCommit);
+
+	// One attempt: open, write each (offset, bytes) in turn, finish
+	auto attempt = [&](std::vector<std::pair<uint64_t, std::vector<uint8_t>>> writes) {
+		auto file = cw::file::WriteBehindFile::create(writer, io.get_executor());
+		auto work = asio::make_work_guard(io);
+		uint64_t resumeOffset = UINT64_MAX;
+
+		file->openResumable(path, 16, 42, 4, [&, writes](std::error_code ec, uint64_t at) mutable
+			{
+				EXPECT_FALSE(ec);
+				resumeOffset = at;
+				for (auto& [offset, bytes] : writes) file->write(offset, cw::buffer::SharedBuffer::fromVector(std::move(bytes)));
+				file->finish([&](std::error_code, uint64_t) { work.reset(); });
+			});
+
+		io.restart();
+		io.run();
+		return resumeOffset;
+	};
+
+	// The second half lands, then the first quarter: a hole at [4, 8)
+	EXPECT_EQ(attempt({ { 8, { 9, 10, 11, 12 } }, { 12, { 13, 14, 15, 16 } }, { 0, { 1, 2, 3, 4 } } }), 0u);
+
+	// The checkpoints ride group commits and may land after finish
+	std::optional<cw::file::ResumeState> state;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	for (; std::chrono::steady_clock::now() < deadline; std::this_thread::sleep_for(std::chrono::milliseconds(5))) {
+		state = cw::file::ResumeJournal(path).load();
+		if (state && state->offset == 4 && !state->ranges.empty()) break;
+	}
+	ASSERT_TRUE(state.has_value());
+	EXPECT_EQ(state->offset, 4u);
+	using Ranges = std::vector<std::pair<uint64_t, uint64_t>>;
+	EXPECT_EQ(state->ranges, Ranges({ { 8, 16 } }));
+	EXPECT_GE(writer.groupCommitter()->stats().flushes, 1u);
+
+	// Found after a restart
+	auto interrupted = cw::file::findInterrupted(dir);
+	ASSERT_EQ(interrupted.size(), 1u);
+	EXPECT_EQ(interrupted[0].target, path);
+	EXPECT_EQ(interrupted[0].state.offset, 4u);
+
+	// The sender resumes at the hole and sends the rest
+	EXPECT_EQ(attempt({ { 4, { 5, 6, 7, 8 } }, { 8, { 9, 10, 11, 12 } }, { 12, { 13, 14, 15, 16 } } }), 4u);
+	EXPECT_FALSE(std::filesystem::exists(cw::file::ResumeJournal::pathFor(path)));
+	std::ifstream in(path, std::ios::binary);
+	std::vector<char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(contents, std::vector<char>({ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 }));
+	in.close();
+
+	std::filesystem::remove_all(dir);
+}
+
+// 14. SYNC MANIFEST (Only missing or changed files are requested)
+TEST(ManifestTest, RoundTripAndChangeDetection) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_manifest";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	auto same = dir / "same.txt";
+	auto edited = dir / "edited.txt";
+	std::ofstream(same) << "unchanged";
+	std::ofstream(edited) << "old text!";
+
+	Manifest original;
+	original.requestId = 7;
+	original.entries.push_back(*cw::file::describeFile(same, same.string(), false));
+	original.entries.push_back(*cw::file::describeFile(edited, edited.string(), true));
+	original.entries.push_back({ (dir / "missing.txt").string(), 1, 0, 0 });
+
+	auto frame = buildFrame(original);
+	auto view = parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::Manifest);
+	ASSERT_EQ(view.size, original.payloadSize());
+
+	auto decoded = Manifest::deserialize(view.payload_view, view.size);
+	ASSERT_EQ(decoded.entries.size(), 3u);
+	EXPECT_EQ(decoded.entries[0].modifiedNs, original.entries[0].modifiedNs);
+	EXPECT_NE(decoded.entries[1].hash, 0u);
+
+	// Same size, newer write time, different contents: only the hash catches it
+	std::ofstream(edited) << "new text!";
+	auto changed = cw::file::changedEntries(decoded.entries);
+	EXPECT_EQ(changed, std::vector<uint32_t>({ 1, 2 }));
+
+	ManifestDiff diff{ decoded.requestId, changed };
+	auto diffFrame = buildFrame(diff);
+	auto diffView = parseFrame(diffFrame);
+	auto decodedDiff = ManifestDiff::deserialize(diffView.payload_view, diffView.size);
+	EXPECT_EQ(decodedDiff.requestId, 7u);
+	EXPECT_EQ(decodedDiff.changed, changed);
+
+	EXPECT_THROW(Manifest::deserialize(view.payload_view, view.size - 1), std::runtime_error);
+	std::filesystem::remove_all(dir);
+}
+
+// 15. DELTA TRANSFERS (Rolling checksum finds shifted blocks)
+TEST(DeltaTest, RebuildsFromLiteralsAndBlockReferences) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_delta";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+
+	std::vector<uint8_t> oldData(200 * 1024);
+	for (size_t i = 0; i < oldData.size(); ++i) oldData[i] = static_cast<uint8_t>((i * 2654435761u) >> 13);
+
+	// Insert 100 bytes near the start: every later block moves off its old offset
+	std::vector<uint8_t> newData = oldData;
+	newData.insert(newData.begin() + 5000, 100, 0xAB);
+
+	auto write = [](const std::filesystem::path& path, const std::vector<uint8_t>& data) {
+		std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(data.data()), data.size());
+	};
+	write(dir / "old.bin", oldData);
+	write(dir / "new.bin", newData);
+
+	// Round trip the signatures through the wire format
+	auto frame = buildFrame(cw::file::computeSignatures(dir / "old.bin"));
+	auto view = parseFrame(frame);
+	auto signatures = Signatures::deserialize(view.payload_view, view.size);
+	ASSERT_EQ(signatures.blockSize, cw::file::chooseBlockSize(oldData.size()));
+	ASSERT_EQ(signatures.blocks.size(), oldData.size() / signatures.blockSize);
+
+	cw::file::DeltaEncoder encoder(dir / "new.bin", signatures, 8192);
+	std::vector<uint8_t> rebuilt(newData.size());
+	uint64_t expectedOffset = 0;
+	while (auto op = encoder.next()) {
+		EXPECT_EQ(op->offset, expectedOffset);
+		if (op->sourceOffset) std::memcpy(rebuilt.data() + op->offset, oldData.data() + *op->sourceOffset, op->length);
+		else std::memcpy(rebuilt.data() + op->offset, op->literal.data(), op->length);
+		expectedOffset += op->length;
+	}
+
+	EXPECT_EQ(rebuilt, newData);
+	EXPECT_EQ(encoder.literalBytes() + encoder.matchedBytes(), newData.size());
+	// Only the block holding the insertion (plus the unaligned tail) goes literally
+	EXPECT_LT(encoder.literalBytes(), 2 * signatures.blockSize + 100);
+
+	std::filesystem::remove_all(dir);
+}
+
+// 16. CHUNK COMPRESSION (Entropy check, round trip for every built-in codec)
+TEST(CompressionTest, RoundTripAndIncompressibleData) {
+	using cw::compression::Codec;
+
+	std::vector<uint8_t> text;
+	for (int i = 0; text.size() < 64 * 1024; ++i) {
+		std::string line = "line " + std::to_string(i % 100) + ": the quick brown fox\n";
+		text.insert(text.end(), line.begin(), line.end());
+	}
+
+	std::vector<uint8_t> noise(64 * 1024);
+	uint64_t state = 88172645463325252ull;
+	for (auto& byte : noise) { state ^= state << 13; state ^= state >> 7; state ^= state << 17; byte = static_cast<uint8_t>(state); }
+
+	EXPECT_TRUE(cw::compression::looksCompressible(text));
+	EXPECT_FALSE(cw::compression::looksCompressible(noise));
+	EXPECT_FALSE(cw::compression::compress(Codec::None, text).has_value());
+
+	for (Codec codec : { Codec::Lz4, Codec::Zstd }) {
+		if (!(cw::compression::supportedCodecs() & cw::compression::codecBit(codec))) continue;
+
+		auto compressed = cw::compression::compress(codec, text);
+		ASSERT_TRUE(compressed.has_value());
+		EXPECT_LT(compressed->size(), text.size() / 2);
+
+		std::vector<uint8_t> restored(text.size());
+		EXPECT_FALSE(cw::compression::decompress(codec, *compressed, restored));
+		EXPECT_EQ(restored, text);
+
+		// A wrong raw size is corruption, not a short write
+		std::vector<uint8_t> tooBig(text.size() + 1);
+		EXPECT_TRUE(cw::compression::decompress(codec, *compressed, tooBig));
+	}
+
+	// Wire format: the compressed bytes are the payload segment
+	CompressedChunk chunk;
+	chunk.streamId = 3;
+	chunk.offset = 1ull << 40;
+	chunk.codec = static_cast<uint8_t>(Codec::Lz4);
+	chunk.rawSize = 1000;
+	chunk.data = cw::buffer::SharedBuffer::fromVector({ 1, 2, 3, 4, 5 });
+
+	auto frame = buildFrame(chunk);
+	auto view = parseFrame(frame);
+	auto decoded = CompressedChunkView::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(decoded.offset, chunk.offset);
+	EXPECT_EQ(decoded.codec, chunk.codec);
+	EXPECT_EQ(decoded.rawSize, 1000u);
+	EXPECT_EQ(decoded.data.size(), 5u);
+}
+
+// 17. INTEGRITY CHECKSUMS (CRC32C, and a whole-file digest from out-of-order chunks)
+TEST(ChecksumTest, Crc32cAndOutOfOrderFileDigest) {
+	const std::string check = "123456789";
+	std::vector<uint8_t> checkBytes(check.begin(), check.end());
+	EXPECT_EQ(cw::integrity::crc32c(checkBytes), 0xE3069283u);
+
+	std::vector<uint8_t> bytes(100003);
+	uint64_t state = 88172645463325252ull;
+	for (auto& byte : bytes) { state ^= state << 13; state ^= state >> 7; state ^= state << 17; byte = static_cast<uint8_t>(state); }
+	std::span<const uint8_t> all(bytes);
+	uint32_t whole = cw::integrity::crc32c(all);
+
+	// Whatever the CPU path, every length and alignment agrees with the tables
+	for (size_t start : { 0, 1, 7 }) {
+		auto part = all.subspan(start, 1000 + start);
+		EXPECT_EQ(cw::integrity::crc32c(part), ~cw::integrity::detail::crc32cSoftware(~0u, part.data(), part.size()));
+	}
+
+	auto head = all.first(40000);
+	auto tail = all.subspan(40000);
+	EXPECT_EQ(cw::integrity::crc32c(tail, cw::integrity::crc32c(head)), whole);
+	EXPECT_EQ(cw::integrity::crc32cCombine(cw::integrity::crc32c(head), cw::integrity::crc32c(tail), tail.size()), whole);
+
+	// Chunks added in any order yield the CRC of the whole file
+	cw::integrity::FileDigest digest(bytes.size());
+	for (size_t offset : { 60000, 0, 90000, 30000 }) {
+		size_t length = std::min<size_t>(30000, bytes.size() - offset);
+		digest.add(offset, length, cw::integrity::crc32c(all.subspan(offset, length)));
+	}
+	EXPECT_EQ(digest.bytes(), bytes.size());
+	EXPECT_EQ(digest.value(), whole);
+
+	// A chunk placed at the wrong offset changes the digest
+	cw::integrity::FileDigest shifted(bytes.size());
+	shifted.add(0, 50000, cw::integrity::crc32c(all.subspan(50000, 50000)));
+	shifted.add(50000, 50000, cw::integrity::crc32c(all.subspan(0, 50000)));
+	shifted.add(100000, 3, cw::integrity::crc32c(all.subspan(100000)));
+	EXPECT_NE(shifted.value(), whole);
+
+	// Wire format: the checksum travels in the chunk header, absent for kernel copies
+	SharedFileChunk chunk;
+	chunk.offset = 4096;
+	chunk.data = cw::buffer::SharedBuffer::fromVector(std::vector<uint8_t>(checkBytes));
+	chunk.crc = 0xE3069283u;
+
+	OutgoingFrame frame = buildOutgoingFrame(chunk);
+	std::vector<uint8_t> joined = frame.header;
+	joined.insert(joined.end(), frame.payload.data(), frame.payload.data() + frame.payload.size());
+	auto view = parseFrame(joined);
+	auto decoded = FileChunkView::deserialize(view.payload_view, view.size);
+	ASSERT_TRUE(decoded.crc.has_value());
+	EXPECT_EQ(*decoded.crc, cw::integrity::crc32c(decoded.data));
+
+	FileChunk unchecked;
+	unchecked.data = { 1, 2, 3 };
+	auto uncheckedFrame = buildFrame(unchecked);
+	auto uncheckedView = parseFrame(uncheckedFrame);
+	EXPECT_FALSE(FileChunkView::deserialize(uncheckedView.payload_view, uncheckedView.size).crc.has_value());
+}
+
+// 18. DEDUPLICATION (SHA-256, stable content-defined cuts, chunk store)
+TEST(DedupTest, ChunkBoundariesSurviveInsertAndStoreRoundTrip) {
+	const std::string abc = "abc";
+	EXPECT_EQ(cw::integrity::toHex(cw::integrity::sha256(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(abc.data()), abc.size()))),
+		"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	EXPECT_EQ(cw::integrity::toHex(cw::integrity::sha256({})),
+		"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+
+	auto dir = std::filesystem::temp_directory_path() / "cw_dedup";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+
+	std::vector<uint8_t> bytes(2 * 1024 * 1024);
+	uint64_t state = 88172645463325252ull;
+	for (auto& byte : bytes) { state ^= state << 13; state ^= state >> 7; state ^= state << 17; byte = static_cast<uint8_t>(state); }
+	std::vector<uint8_t> inserted = bytes;
+	inserted.insert(inserted.begin() + 1000, { 'n', 'e', 'w' });
+
+	auto write = [](const std::filesystem::path& path, const std::vector<uint8_t>& data)
+		{
+			std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		};
+	write(dir / "a.bin", bytes);
+	write(dir / "b.bin", inserted);
+
+	auto a = cw::file::chunkFile(dir / "a.bin");
+	auto b = cw::file::chunkFile(dir / "b.bin");
+	ASSERT_TRUE(a && b);
+	ASSERT_GT(a->size(), 4u);
+
+	// Only the chunk holding the insertion differs
+	size_t shared = 0;
+	for (const auto& chunk : *b) {
+		shared += std::count_if(a->begin(), a->end(), [&chunk](const ChunkRef& other) { return other.hash == chunk.hash; });
+	}
+	EXPECT_EQ(shared, a->size() - 1);
+	for (const auto& chunk : *a) EXPECT_LE(chunk.length, cw::file::FastCdc::MAX_SIZE);
+
+	cw::file::ChunkStore store(dir / "store");
+	std::span<const uint8_t> first(bytes.data(), a->front().length);
+	EXPECT_FALSE(store.contains(a->front().hash, a->front().length));
+	EXPECT_TRUE(store.insert(a->back().hash, first)); // Bytes that do not match the hash
+	EXPECT_FALSE(store.insert(a->front().hash, first));
+	EXPECT_TRUE(store.contains(a->front().hash, a->front().length));
+
+	ChunkManifest manifest;
+	manifest.streamId = 3;
+	manifest.fileSize = bytes.size();
+	manifest.fileName = "a.bin";
+	manifest.chunks = *a;
+	auto frame = buildFrame(manifest);
+	auto view = parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::ChunkManifest);
+	auto decoded = ChunkManifest::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(decoded.chunks.size(), a->size());
+	EXPECT_EQ(decoded.chunks.back().hash, a->back().hash);
+
+	// Chunk lengths must add up to the file size
+	manifest.fileSize += 1;
+	auto badFrame = buildFrame(manifest);
+	auto badView = parseFrame(badFrame);
+	EXPECT_THROW(ChunkManifest::deserialize(badView.payload_view, badView.size), std::runtime_error);
+
+	std::filesystem::remove_all(dir);
+}
+
+// 19. BUFFER POOL (Steady-state chunks reuse blocks, also across threads)
+TEST(BufferPoolTest, ChunksReuseBlocksInSteadyState) {
+	auto& pool = cw::buffer::BufferPool::instance();
+
+	// Same thread: the second chunk gets the first one's block back
+	const uint8_t* first = nullptr;
+	for (int i = 0; i < 2; ++i) {
+		cw::buffer::PooledBuffer buffer(256 * 1024);
+		if (i == 0) first = buffer.data();
+		else EXPECT_EQ(buffer.data(), first);
+	}
+
+	auto copy = cw::buffer::pooledCopy(std::vector<uint8_t>{ 1, 2, 3 });
+	EXPECT_EQ(copy.size(), 3u);
+	EXPECT_EQ(copy.data()[2], 3);
+
+	// Read on one thread, released on another (file pool -> socket write):
+	// blocks flow back through the depot, so the heap is only hit while warming up
+	auto roundTrips = [](int count)
+		{
+			for (int i = 0; i < count; ++i) {
+				std::vector<cw::buffer::SharedBuffer> chunks;
+				std::thread reader([&chunks]()
+					{
+						for (int k = 0; k < 4; ++k) {
+							cw::buffer::PooledBuffer buffer(256 * 1024);
+							buffer.shrink(1000);
+							chunks.push_back(std::move(buffer).share());
+						}
+					});
+				reader.join();
+				chunks.clear();
+			}
+		};
+	roundTrips(50);
+	auto warm = pool.stats();
+	roundTrips(200);
+	EXPECT_EQ(pool.stats().heapAllocations, warm.heapAllocations);
+	EXPECT_GE(pool.stats().reused, warm.reused + 800);
+
+	// Frame headers are recycled once written
+	Ack ack;
+	auto frame = buildFrame(ack);
+	const uint8_t* header = frame.data();
+	cw::buffer::HeaderPool::release(std::move(frame));
+	EXPECT_EQ(buildFrame(ack).data(), header);
+}
+
+// 20. PACKET REGISTRY (Table dispatch to typed handlers)
+struct RecordingHandler
+{
+	std::vector<std::string> calls;
+	void operator()(Ack pkt) { calls.push_back("ack " + std::to_string(pkt.offset)); }
+	void operator()(FileChunkView pkt) { calls.push_back("chunk " + std::to_string(pkt.data.size())); }
+	void operator()(RawPacket<FileBatch> pkt) { calls.push_back("batch " + std::to_string(pkt.payload.size())); }
+	void operator()(const ParsedFrame& frame) { calls.push_back("unknown " + std::to_string(static_cast<int>(frame.type))); }
+	template<typename P> void operator()(P) { calls.push_back("other"); }
+};
+
+TEST(PacketRegistryTest, DispatchesDecodedPacketsByType) {
+	static_assert(PacketList::TABLE_SIZE == static_cast<size_t>(PacketType::SealedChunk) + 1);
+
+	RecordingHandler handler;
+	Ack ack;
+	ack.offset = 7;
+	auto ackFrame = buildFrame(ack);
+	PacketList::dispatch(parseFrame(ackFrame), handler);
+
+	FileChunk chunk;
+	chunk.data = { 1, 2, 3 };
+	auto chunkFrame = buildFrame(chunk);
+	PacketList::dispatch(parseFrame(chunkFrame), handler);
+
+	FileBatch batch;
+	auto batchFrame = buildFrame(batch);
+	PacketList::dispatch(parseFrame(batchFrame), handler);
+
+	auto doneFrame = buildFrame(FileDone{});
+	PacketList::dispatch(parseFrame(doneFrame), handler);
+
+	// Type ids outside the table, including 0, reach the fallback
+	for (uint16_t type : { 0, 999 }) {
+		ParsedFrame frame{ ackFrame.data() + FRAME_HEADER_SIZE, 0, static_cast<PacketType>(type) };
+		PacketList::dispatch(frame, handler);
+	}
+
+	EXPECT_EQ(handler.calls, std::vector<std::string>({ "ack 7", "chunk 3", "batch 4", "other", "unknown 0", "unknown 999" }));
+
+	// Decoding errors surface as before
+	ParsedFrame truncated = parseFrame(ackFrame);
+	truncated.size = 3;
+	EXPECT_THROW(PacketList::dispatch(truncated, handler), std::runtime_error);
+}
+
+// 21. PLUGGABLE RECEIVER (Uploads into memory over a loopback connection)
+TEST(MemoryReceiverTest, UploadLandsInMemory) {
+	auto path = std::filesystem::temp_directory_path() / "cw_memory_upload.bin";
+	std::vector<uint8_t> bytes(3 * 1024 * 1024 + 123);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 31 + (i >> 12));
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	std::vector<cw::network::MemoryReceiver::File> received;
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(std::make_shared<cw::network::MemoryReceiver>([&](cw::network::MemoryReceiver::File file)
+		{
+			received.push_back(std::move(file));
+			io.stop();
+		}));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+
+			cw::TransferOptions options;
+			options.chunkSize = 64 * 1024;
+			options.ackWindowBytes = 2 * 1024 * 1024; // Needs the receiver's progress acks
+			asio::co_spawn(io, cw::asyncSendFile(client, path, "in/memory.bin", options), asio::detached);
+		});
+
+	io.run_for(std::chrono::seconds(10));
+
+	ASSERT_EQ(received.size(), 1u);
+	EXPECT_EQ(received[0].name, "in/memory.bin");
+	EXPECT_EQ(received[0].data, bytes);
+	EXPECT_FALSE(std::filesystem::exists("in/memory.bin"));
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------
+// 22. ASYNC LOGGER (Levels filter, records are drained in order)
+// ---------------------------------------------------------
+TEST(LoggerTest, WritesFilteredLinesInOrder) {
+	auto outPath = std::filesystem::temp_directory_path() / "cw_logger_out.txt";
+	auto errPath = std::filesystem::temp_directory_path() / "cw_logger_err.txt";
+	std::FILE* out = std::fopen(outPath.string().c_str(), "w");
+	std::FILE* err = std::fopen(errPath.string().c_str(), "w");
+	ASSERT_TRUE(out && err);
+
+	{
+		cw::log::Logger logger(out, err);
+		logger.setLevel(cw::log::Level::Info);
+		logger.write(cw::log::Level::Debug, "hidden");
+		for (int i = 0; i < 100; ++i) logger.write(cw::log::Level::Info, "line ", i, " of ", std::filesystem::path("a/b"));
+		logger.write(cw::log::Level::Error, "failed: ", std::uint64_t(42));
+		logger.flush();
+		EXPECT_EQ(logger.dropped(), 0u);
+	}
+
+	std::fclose(out);
+	std::fclose(err);
+
+	std::string expected;
+	for (int i = 0; i < 100; ++i) expected += "line " + std::to_string(i) + " of a/b\n";
+	EXPECT_EQ(readText(outPath), expected);
+	EXPECT_EQ(readText(errPath), "failed: 42\n");
+	std::filesystem::remove(outPath);
+	std::filesystem::remove(errPath);
+}
+
+// ---------------------------------------------------------
+// 23. METRICS (Per-connection counters, aggregation, Prometheus scrape)
+// ---------------------------------------------------------
+TEST(MetricsTest, AggregatesConnectionsAndServesPrometheusText) {
+	auto registry = std::make_shared<cw::metrics::MetricsRegistry>();
+
+	auto open = std::make_shared<cw::metrics::ConnectionMetrics>();
+	auto closed = std::make_shared<cw::metrics::ConnectionMetrics>();
+	registry->track(open);
+	registry->track(closed);
+
+	open->onBytesReceived(1000);
+	open->onFrameReceived();
+	open->setQueuedBytes(64);
+	closed->onBytesSent(500, 2);
+	closed->onFileReceived(500, std::chrono::milliseconds(20));
+	closed->setQueuedBytes(99);
+	closed.reset();
+
+	cw::metrics::Snapshot s = registry->snapshot();
+	EXPECT_EQ(s.bytesReceived, 1000u);
+	EXPECT_EQ(s.framesReceived, 1u);
+	EXPECT_EQ(s.bytesSent, 500u);
+	EXPECT_EQ(s.framesSent, 2u);
+	EXPECT_EQ(s.queuedBytes, 64u); // The closed connection's queue is gone
+	EXPECT_EQ(s.filesReceived, 1u);
+	EXPECT_EQ(s.fileDurations[1], 1u); // 20 ms: the 50 ms bucket
+	EXPECT_EQ(s.connectionsOpen, 1u);
+	EXPECT_EQ(s.connectionsTotal, 2u);
+
+	// Folded counters survive the next snapshot
+	EXPECT_EQ(registry->snapshot().bytesSent, 500u);
+
+	asio::io_context io;
+	cw::network::MetricsEndpoint endpoint(io, 0, registry);
+
+	std::string reply;
+	asio::ip::tcp::socket client(io);
+	client.async_connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), endpoint.port()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			static const std::string request = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+			asio::write(client, asio::buffer(request));
+			asio::async_read(client, asio::dynamic_buffer(reply), [&](std::error_code, std::size_t) { io.stop(); });
+		});
+	io.run_for(std::chrono::seconds(5));
+
+	EXPECT_TRUE(reply.starts_with("HTTP/1.1 200 OK\r\n"));
+	EXPECT_NE(reply.find("\ncw_received_bytes_total 1000\n"), std::string::npos);
+	EXPECT_NE(reply.find("\ncw_connections_total 2\n"), std::string::npos);
+	EXPECT_NE(reply.find("cw_file_duration_seconds_bucket{le=\"0.05\"} 1\n"), std::string::npos);
+	EXPECT_NE(reply.find("cw_file_duration_seconds_count 1\n"), std::string::npos);
+}
+
+// ---------------------------------------------------------
+// 24. LATENCY HISTOGRAMS (Log-linear buckets, quantiles, send latency)
+// ---------------------------------------------------------
+TEST(LatencyHistogramTest, QuantilesStayWithinBucketPrecision) {
+	using cw::metrics::LatencySnapshot;
+
+	// Every bucket's lower bound maps back to it, and buckets are contiguous
+	for (std::size_t i = 0; i + 1 < LatencySnapshot::BUCKETS; ++i) {
+		EXPECT_EQ(LatencySnapshot::bucketFor(LatencySnapshot::lowerBound(i)), i);
+		EXPECT_EQ(LatencySnapshot::bucketFor(LatencySnapshot::lowerBound(i + 1) - 1), i);
+	}
+
+	cw::metrics::LatencyHistogram histogram;
+	for (int us = 1; us <= 1000; ++us) histogram.record(std::chrono::microseconds(us));
+	LatencySnapshot s = histogram.snapshot();
+
+	EXPECT_EQ(s.count, 1000u);
+	EXPECT_EQ(s.sumNanos, 500500u * 1000u);
+	for (double q : { 0.5, 0.9, 0.99 }) {
+		double exact = q * 1000 * 1000; // ns
+		EXPECT_NEAR(static_cast<double>(s.quantile(q)), exact, exact * 0.125 + 1000) << q;
+	}
+
+	LatencySnapshot later = s;
+	later.counts[LatencySnapshot::bucketFor(5'000'000)] += 1;
+	later.count += 1;
+	EXPECT_EQ(later.since(s).count, 1u);
+	EXPECT_GE(later.since(s).quantile(0.5), 5'000'000u);
+}
+
+TEST(LatencyHistogramTest, SendRecordsEnqueueToWireTime) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			for (int i = 0; i < 10; ++i) {
+				cw::packet::Ack ack;
+				ack.streamId = 1000 + i;
+				client->send(ack);
+			}
+		});
+
+	io.run_for(std::chrono::milliseconds(300));
+
+	// Capabilities on start, then the ten acks
+	cw::metrics::Snapshot s = client->metrics()->snapshot();
+	EXPECT_EQ(s.sendLatency.count, 11u);
+	EXPECT_EQ(s.framesSent, 11u);
+	EXPECT_GT(s.sendLatency.sumNanos, 0u);
+	EXPECT_GE(server->metrics()->snapshot().framesReceived, 11u);
+}
+
+// ---------------------------------------------------------
+// 25. SOCKET OPTIONS (Applied best effort, parsed from the command line)
+// ---------------------------------------------------------
+TEST(SocketOptionsTest, AppliesRequestedOptions) {
+	asio::io_context io;
+	asio::ip::tcp::socket socket(io);
+	socket.open(asio::ip::tcp::v4());
+
+	cw::network::SocketOptions options;
+	options.noDelay = true;
+	options.receiveBufferSize = 16 * 1024;
+	cw::network::applySocketOptions(socket, options);
+
+	asio::ip::tcp::no_delay noDelay;
+	socket.get_option(noDelay);
+	EXPECT_TRUE(noDelay.value());
+
+	// Linux reports double the requested size (it counts its bookkeeping);
+	// the default receive buffer is far larger than either
+	asio::socket_base::receive_buffer_size receive;
+	socket.get_option(receive);
+	EXPECT_GE(receive.value(), 16 * 1024);
+	EXPECT_LE(receive.value(), 2 * 16 * 1024);
+}
+
+TEST(SocketOptionsTest, UnknownCongestionControlIsNotFatal) {
+	asio::io_context io;
+	asio::ip::tcp::socket socket(io);
+	socket.open(asio::ip::tcp::v4());
+
+	cw::network::SocketOptions options;
+	options.congestionControl = "no-such-algorithm";
+	options.noDelay = true;
+	cw::network::applySocketOptions(socket, options);
+
+	// The failure is logged; the options after it are unaffected
+	asio::ip::tcp::no_delay noDelay;
+	socket.get_option(noDelay);
+	EXPECT_TRUE(noDelay.value());
+}
+
+TEST(SocketOptionsTest, ParsesCommandLineForm) {
+	cw::network::SocketOptions options;
+	EXPECT_TRUE(cw::network::parseSocketOption("--nodelay", options));
+	EXPECT_TRUE(cw::network::parseSocketOption("--rcvbuf-kb=8192", options));
+	EXPECT_TRUE(cw::network::parseSocketOption("--notsent-lowat-kb=128", options));
+	EXPECT_TRUE(cw::network::parseSocketOption("--congestion=bbr", options));
+	EXPECT_TRUE(cw::network::parseSocketOption("--zerocopy", options));
+	EXPECT_TRUE(cw::network::parseSocketOption("--rio", options));
+	EXPECT_FALSE(cw::network::parseSocketOption("--streams=4", options));
+
+	EXPECT_TRUE(options.noDelay);
+	EXPECT_EQ(options.receiveBufferSize, 8192u * 1024);
+	EXPECT_EQ(options.notSentLowWatermark, 128u * 1024);
+	EXPECT_EQ(options.congestionControl, "bbr");
+	EXPECT_TRUE(options.zeroCopy);
+	EXPECT_TRUE(options.registeredIo);
+	EXPECT_EQ(options.sendBufferSize, 0u);
+}
+
+#if !defined(CW_USE_REGISTERED_IO)
+TEST(SocketOptionsTest, RegisteredIoLeavesSocketsAsTheyAreWhenNotBuiltIn) {
+	asio::io_context io;
+	asio::ip::tcp::socket socket(io);
+	socket.open(asio::ip::tcp::v4());
+	auto handle = socket.native_handle();
+
+	cw::network::openForRegisteredIo(socket);
+	EXPECT_TRUE(socket.is_open());
+	EXPECT_EQ(socket.native_handle(), handle);
+	EXPECT_EQ(cw::network::RegisteredIo::create(handle, io.get_executor()), nullptr);
+}
+#endif
+
+// ---------------------------------------------------------
+// 26. ADAPTIVE READS (Read size follows traffic, buffer shrinks after bursts)
+// ---------------------------------------------------------
+TEST(AdaptiveReadSizeTest, GrowsForBulkShrinksWhenQuiet) {
+	cw::buffer::AdaptiveReadSize size(4096, 8192, 64 * 1024);
+
+	for (int i = 0; i < 10; ++i) size.record(size.current(), size.current());
+	EXPECT_EQ(size.current(), 64u * 1024); // Capped
+
+	// One short read is noise, two in a row halve
+	size.record(size.current(), 100);
+	EXPECT_EQ(size.current(), 64u * 1024);
+	size.record(size.current(), 100);
+	EXPECT_EQ(size.current(), 32u * 1024);
+
+	for (int i = 0; i < 20; ++i) size.record(size.current(), 10);
+	EXPECT_EQ(size.current(), 4096u); // Floor
+}
+
+TEST(AdaptiveReadSizeTest, ReachesForTheRestOfAFrame) {
+	cw::buffer::AdaptiveReadSize size(4096, 8192, 2 * 1024 * 1024);
+
+	EXPECT_EQ(size.next(0), 8192u);
+	EXPECT_EQ(size.next(100), 8192u);
+	EXPECT_EQ(size.next(1024 * 1024), 1024u * 1024);
+	EXPECT_EQ(size.next(16 * 1024 * 1024), 2u * 1024 * 1024);
+}
+
+TEST(ReceiveBufferTest, ShrinkOnlyWhenEmpty) {
+	cw::buffer::ReceiveBuffer buffer(16);
+	buffer.prepare(1024);
+	buffer.commit(10);
+	ASSERT_GE(buffer.capacity(), 1024u);
+
+	buffer.shrink(16);
+	EXPECT_GE(buffer.capacity(), 1024u); // Holds unread bytes
+	EXPECT_EQ(buffer.size(), 10u);
+
+	buffer.consume(10);
+	buffer.shrink(16);
+	EXPECT_EQ(buffer.capacity(), 16u);
+	EXPECT_TRUE(buffer.empty());
+}
+
+TEST(ConnectionTest, LargeFramesReadStraightIntoTheirOwnBuffer) {
+	auto path = std::filesystem::temp_directory_path() / "cw_large_frames.bin";
+	std::vector<uint8_t> bytes(5 * 1024 * 1024 + 77);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + (i >> 10));
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	std::vector<cw::network::MemoryReceiver::File> received;
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(std::make_shared<cw::network::MemoryReceiver>([&](cw::network::MemoryReceiver::File file)
+		{
+			received.push_back(std::move(file));
+			io.stop();
+		}));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+
+			// 1 MB chunks: every frame but the last small ones takes the two-phase read
+			cw::TransferOptions options;
+			options.chunkSize = 1024 * 1024;
+			options.ackWindowBytes = 4 * 1024 * 1024;
+			asio::co_spawn(io, cw::asyncSendFile(client, path, "in/large.bin", options), asio::detached);
+		});
+
+	io.run_for(std::chrono::seconds(10));
+
+	ASSERT_EQ(received.size(), 1u);
+	EXPECT_EQ(received[0].data, bytes);
+	EXPECT_GE(server->metrics()->snapshot().framesReceived, 6u);
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------
+// 27. TLS (Handshake on the socket, then kTLS; refused without it)
+// ---------------------------------------------------------
+TEST(TlsTest, ParsesCommandLineForm) {
+	cw::network::TlsOptions options;
+	EXPECT_FALSE(cw::network::parseTlsOption("--streams=2", options));
+	EXPECT_FALSE(options.enabled);
+
+	EXPECT_TRUE(cw::network::parseTlsOption("--tls-ca=roots.pem", options));
+	EXPECT_TRUE(cw::network::parseTlsOption("--tls-name=files.example", options));
+	EXPECT_TRUE(options.enabled);
+	EXPECT_EQ(options.caFile, "roots.pem");
+	EXPECT_EQ(options.serverName, "files.example");
+}
+
+#if defined(CW_HAS_TLS)
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+namespace {
+	// Self-signed P-256 certificate for "localhost", written as PEM files
+	void writeTestCertificate(const std::filesystem::path& certPath, const std::filesystem::path& keyPath)
+	{
+		EVP_PKEY* key = EVP_EC_gen("P-256");
+		X509* cert = X509_new();
+		X509_set_version(cert, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+		X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+		X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+		X509_set_pubkey(cert, key);
+
+		X509_NAME* name = X509_get_subject_name(cert);
+		X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+		X509_set_issuer_name(cert, name);
+
+		X509V3_CTX ctx;
+		X509V3_set_ctx_nodb(&ctx);
+		X509V3_set_ctx(&ctx, cert, cert, nullptr, nullptr, 0);
+		for (auto [nid, value] : { std::pair{ NID_subject_alt_name, "DNS:localhost" }, std::pair{ NID_basic_constraints, "critical,CA:TRUE" } }) {
+			X509_EXTENSION* ext = X509V3_EXT_conf_nid(nullptr, &ctx, nid, value);
+			X509_add_ext(cert, ext, -1);
+			X509_EXTENSION_free(ext);
+		}
+		X509_sign(cert, key, EVP_sha256());
+
+		FILE* out = std::fopen(certPath.string().c_str(), "w");
+		PEM_write_X509(out, cert);
+		std::fclose(out);
+		out = std::fopen(keyPath.string().c_str(), "w");
+		PEM_write_PrivateKey(out, key, nullptr, nullptr, 0, nullptr, nullptr);
+		std::fclose(out);
+
+		X509_free(cert);
+		EVP_PKEY_free(key);
+	}
+
+	struct TlsPair
+	{
+		std::exception_ptr server;
+		std::exception_ptr client;
+		bool serverDone = false;
+		bool clientDone = false;
+	};
+
+	TlsPair runHandshake(const std::string& serverName)
+	{
+		auto dir = std::filesystem::temp_directory_path();
+		writeTestCertificate(dir / "cw_tls_cert.pem", dir / "cw_tls_key.pem");
+
+		cw::network::TlsOptions serverOptions;
+		serverOptions.certificateFile = (dir / "cw_tls_cert.pem").string();
+		serverOptions.privateKeyFile = (dir / "cw_tls_key.pem").string();
+		cw::network::TlsOptions clientOptions;
+		clientOptions.caFile = serverOptions.certificateFile;
+		clientOptions.serverName = serverName;
+
+		auto serverContext = cw::network::makeTlsContext(true, serverOptions);
+		auto clientContext = cw::network::makeTlsContext(false, clientOptions);
+
+		asio::io_context io;
+		asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+		asio::ip::tcp::socket serverSocket(io);
+		asio::ip::tcp::socket clientSocket(io);
+		TlsPair result;
+
+		acceptor.async_accept(serverSocket, [&](std::error_code ec)
+			{
+				ASSERT_FALSE(ec);
+				asio::co_spawn(io, cw::network::asyncTlsHandshake(serverSocket, serverContext, true),
+					[&](std::exception_ptr e) { result.server = e; result.serverDone = true; serverSocket.close(); });
+			});
+		clientSocket.async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+			{
+				ASSERT_FALSE(ec);
+				asio::co_spawn(io, cw::network::asyncTlsHandshake(clientSocket, clientContext, false, serverName),
+					[&](std::exception_ptr e) { result.client = e; result.clientDone = true; clientSocket.close(); });
+			});
+
+		io.run_for(std::chrono::seconds(5));
+		std::filesystem::remove(dir / "cw_tls_cert.pem");
+		std::filesystem::remove(dir / "cw_tls_key.pem");
+		return result;
+	}
+
+	std::error_code codeOf(std::exception_ptr error)
+	{
+		try {
+			if (error) std::rethrow_exception(error);
+		}
+		catch (const std::system_error& e) {
+			return e.code();
+		}
+		return {};
+	}
+}
+
+TEST(TlsTest, HandshakeEndsInKernelTlsOrIsRefused) {
+	TlsPair result = runHandshake("localhost");
+	ASSERT_TRUE(result.serverDone);
+	ASSERT_TRUE(result.clientDone);
+
+	// The handshake itself must succeed; what follows depends on the kernel
+	for (std::error_code ec : { codeOf(result.server), codeOf(result.client) }) {
+		if (ec) {
+			EXPECT_EQ(ec, std::make_error_code(std::errc::operation_not_supported)) << ec.message();
+		}
+	}
+}
+
+TEST(TlsTest, WrongServerNameFailsTheHandshake) {
+	TlsPair result = runHandshake("not-localhost.example");
+	ASSERT_TRUE(result.clientDone);
+
+	std::error_code ec = codeOf(result.client);
+	EXPECT_TRUE(ec);
+	EXPECT_NE(ec, std::make_error_code(std::errc::operation_not_supported));
+}
+#endif
+
+// ---------------------------------------------------------
+// 28. UDP TRANSPORT (Connection streams carried over lossy UDP)
+// ---------------------------------------------------------
+TEST(UdpTunnelTest, UploadSurvivesPacketLoss) {
+	auto path = std::filesystem::temp_directory_path() / "cw_udp_upload.bin";
+	std::vector<uint8_t> bytes(2 * 1024 * 1024 + 77);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + (i >> 10));
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	std::vector<cw::network::MemoryReceiver::File> received;
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(std::make_shared<cw::network::MemoryReceiver>([&](cw::network::MemoryReceiver::File file)
+		{
+			received.push_back(std::move(file));
+			io.stop();
+		}));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	// One in ten datagrams is dropped, both ways
+	cw::network::UdpTunnelOptions options;
+	options.simulatedLoss = 0.1;
+	auto listener = cw::network::UdpTunnel::listen(io, 0, acceptor.local_endpoint(), options);
+	auto dialer = cw::network::UdpTunnel::dial(io, { asio::ip::make_address("127.0.0.1"), listener->udpPort() }, 0, options);
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), dialer->localPort()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+
+			cw::TransferOptions transfer;
+			transfer.chunkSize = 64 * 1024;
+			transfer.ackWindowBytes = 1024 * 1024; // Progress acks travel back through the tunnel
+			asio::co_spawn(io, cw::asyncSendFile(client, path, "over/udp.bin", transfer), asio::detached);
+		});
+
+	io.run_for(std::chrono::seconds(20));
+
+	ASSERT_EQ(received.size(), 1u);
+	EXPECT_EQ(received[0].name, "over/udp.bin");
+	EXPECT_EQ(received[0].data, bytes);
+	EXPECT_GT(dialer->retransmits(), 0u);
+
+	listener->close();
+	dialer->close();
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------
+// 29. LOCAL TRANSPORT (Unix domain socket, file ranges passed as descriptors)
+// ---------------------------------------------------------
+TEST(FileHandleTest, CopyRangeFromCopiesInTheKernelOrSaysSo) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_copy_range";
+	std::filesystem::create_directories(dir);
+	std::vector<uint8_t> bytes(300000);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 7 + (i >> 9));
+	std::ofstream(dir / "src.bin", std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+	{
+		auto source = cw::file::FileHandle::openRead(dir / "src.bin");
+		auto target = cw::file::FileHandle::openWrite(dir / "dst.bin");
+		uint64_t copied = 0;
+		std::error_code ec = target.copyRangeFrom(source, 1000, 10, 200000, copied);
+		if (ec) {
+			EXPECT_EQ(ec, std::make_error_code(std::errc::operation_not_supported)) << ec.message();
+			EXPECT_EQ(copied, 0u);
+			std::filesystem::remove_all(dir);
+			return;
+		}
+		EXPECT_EQ(copied, 200000u);
+	}
+
+	std::ifstream in(dir / "dst.bin", std::ios::binary);
+	std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	ASSERT_EQ(contents.size(), 200010u);
+	EXPECT_TRUE(std::equal(contents.begin() + 10, contents.end(), bytes.begin() + 1000));
+	in.close();
+	std::filesystem::remove_all(dir);
+}
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+TEST(LocalTransportTest, KernelCopyUploadPassesDescriptors) {
+	auto source = std::filesystem::temp_directory_path() / "cw_local_upload.bin";
+	auto socketPath = (std::filesystem::temp_directory_path() / "cw_local_test.sock").string();
+	std::vector<uint8_t> bytes(3 * 1024 * 1024 + 5);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 29 + (i >> 11));
+	std::ofstream(source, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	std::filesystem::remove_all("cw_local");
+	std::filesystem::remove(socketPath);
+
+	asio::io_context io;
+	asio::local::stream_protocol::acceptor acceptor(io, asio::local::stream_protocol::endpoint(socketPath));
+
+	auto server = cw::network::Connection::create(io);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(asio::local::stream_protocol::endpoint(socketPath), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+
+			cw::TransferOptions options;
+			options.chunkSize = 256 * 1024;
+			options.kernelCopy = true;
+			// Wait for the server's Capabilities first, so every range goes as a descriptor
+			asio::co_spawn(io, [client, source, options]() -> asio::awaitable<void>
+				{
+					asio::steady_timer timer(co_await asio::this_coro::executor);
+					while (!client->passesDescriptors()) {
+						timer.expires_after(std::chrono::milliseconds(1));
+						co_await timer.async_wait(asio::use_awaitable);
+					}
+					co_await cw::asyncSendFile(client, source, "cw_local/copy.bin", options);
+				}, asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (server->metrics()->snapshot().filesReceived == 0 && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+
+	EXPECT_TRUE(server->isLocal());
+	EXPECT_TRUE(client->passesDescriptors());
+	EXPECT_EQ(server->peerName(), "local");
+
+	std::ifstream in("cw_local/copy.bin", std::ios::binary);
+	std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(contents, bytes);
+	in.close();
+
+	// Only frame headers crossed the socket, not the file
+	EXPECT_LT(server->metrics()->snapshot().bytesReceived, 64 * 1024u);
+
+	std::filesystem::remove_all("cw_local");
+	std::filesystem::remove(socketPath);
+	std::filesystem::remove(source);
+}
+#endif
+
+// ---------------------------------------------------------
+// 30. SERVER-SIDE COPY (FileCopy: the receiver copies a path it can read)
+// ---------------------------------------------------------
+namespace {
+	// Uploads 'source' with serverCopy on, to a receiver allowed to copy from
+	// 'root'; returns the bytes that crossed the socket.
+	uint64_t uploadWithServerCopy(const std::filesystem::path& source, const std::filesystem::path& root, const std::string& remoteName)
+	{
+		asio::io_context io;
+		asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+		auto server = cw::network::Connection::create(io);
+		server->setServerCopyRoots({ root });
+		acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+		auto client = cw::network::Connection::create(io);
+		client->socket().async_connect(asio::ip::tcp::endpoint(acceptor.local_endpoint()), [&](std::error_code ec)
+			{
+				ASSERT_FALSE(ec);
+				client->start();
+
+				cw::TransferOptions options;
+				options.serverCopy = true;
+				// Wait for the server's Capabilities, so the file goes as a FileCopy
+				asio::co_spawn(io, [client, source, remoteName, options]() -> asio::awaitable<void>
+					{
+						co_await client->asyncWaitCapabilities(asio::use_awaitable);
+						EXPECT_TRUE(client->peerCopiesFiles());
+						co_await cw::asyncSendFile(client, source, remoteName, options);
+					}, asio::detached);
+			});
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (server->metrics()->snapshot().filesReceived == 0 && std::chrono::steady_clock::now() < deadline) {
+			io.run_for(std::chrono::milliseconds(10));
+		}
+		return server->metrics()->snapshot().bytesReceived;
+	}
+}
+
+TEST(ServerCopyTest, SourceUnderAllowedRootIsCopiedNotSent) {
+	auto root = std::filesystem::temp_directory_path() / "cw_server_copy_root";
+	std::filesystem::create_directories(root);
+	std::vector<uint8_t> bytes(4 * 1024 * 1024 + 17);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + (i >> 10));
+	std::ofstream(root / "big.bin", std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	std::filesystem::remove_all("cw_server_copy");
+
+	uint64_t received = uploadWithServerCopy(root / "big.bin", root, "cw_server_copy/big.bin");
+
+	EXPECT_EQ(readBytes("cw_server_copy/big.bin"), bytes);
+	// Where the filesystem cannot copy in the kernel it is streamed instead
+	uint64_t probe = 0;
+	bool kernelCopies = !cw::file::FileHandle::openWrite(root / "probe.bin")
+		.copyRangeFrom(cw::file::FileHandle::openRead(root / "big.bin"), 0, 0, 4096, probe);
+	if (kernelCopies) {
+		EXPECT_LT(received, 64 * 1024u);
+	}
+
+	std::filesystem::remove_all("cw_server_copy");
+	std::filesystem::remove_all(root);
+}
+
+TEST(ServerCopyTest, SourceOutsideAllowedRootsIsStreamed) {
+	auto root = std::filesystem::temp_directory_path() / "cw_server_copy_allowed";
+	auto outside = std::filesystem::temp_directory_path() / "cw_server_copy_outside.bin";
+	std::filesystem::create_directories(root);
+	std::vector<uint8_t> bytes(2 * 1024 * 1024 + 3);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 31 + (i >> 8));
+	std::ofstream(outside, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	std::filesystem::remove_all("cw_server_copy");
+
+	uint64_t received = uploadWithServerCopy(outside, root, "cw_server_copy/outside.bin");
+
+	EXPECT_EQ(readBytes("cw_server_copy/outside.bin"), bytes);
+	EXPECT_GE(received, bytes.size());
+
+	std::filesystem::remove_all("cw_server_copy");
+	std::filesystem::remove_all(root);
+	std::filesystem::remove(outside);
+}
+
+// ---------------------------------------------------------
+// 31. BULK ENDIAN CONVERSION (SIMD blocks and scalar tails agree with readBigEndian)
+// ---------------------------------------------------------
+template<typename T>
+static void expectBulkMatchesScalar(size_t count)
+{
+	std::vector<T> values(count);
+	for (size_t i = 0; i < count; ++i) values[i] = static_cast<T>(0x0123456789abcdefull * (i + 1));
+
+	std::vector<uint8_t> bytes(count * sizeof(T) + 1);
+	cw::binary::writeBigEndianArray(bytes.data() + 1, values.data(), count); // Unaligned on purpose
+	for (size_t i = 0; i < count; ++i) {
+		ASSERT_EQ(cw::binary::readBigEndian<T>(bytes.data() + 1 + i * sizeof(T)), values[i]) << "value " << i << " of " << count;
+	}
+
+	std::vector<T> decoded(count);
+	cw::binary::readBigEndianArray(bytes.data() + 1, decoded.data(), count);
+	EXPECT_EQ(decoded, values);
+}
+
+TEST(EndianTest, BulkConversionMatchesScalarForEveryWidthAndTail) {
+	for (size_t count : { 0, 1, 7, 8, 9, 16, 17, 31, 1000 }) {
+		expectBulkMatchesScalar<uint16_t>(count);
+		expectBulkMatchesScalar<uint32_t>(count);
+		expectBulkMatchesScalar<uint64_t>(count);
+		expectBulkMatchesScalar<int32_t>(count);
+	}
+}
+
+TEST(EndianTest, IndexListsRoundTripThroughBulkConversion) {
+	ManifestDiff diff;
+	diff.requestId = 7;
+	for (uint32_t i = 0; i < 1001; ++i) diff.changed.push_back(i * 2654435761u);
+
+	std::vector<uint8_t> frame = buildFrame(diff);
+	ParsedFrame view = parseFrame(frame);
+	EXPECT_EQ(ManifestDiff::deserialize(view.payload_view, view.size).changed, diff.changed);
+}
+
+// ---------------------------------------------------------
+// 32. COMPACT FRAME HEADERS (Version byte + 1-byte type + varint length)
+// ---------------------------------------------------------
+TEST(CompactFrameTest, AckShrinksAndRoundTrips) {
+	Ack ack;
+	ack.streamId = 9;
+	ack.offset = 123456789;
+
+	auto classic = buildFrame(ack);
+	auto compact = buildFrame(ack, FrameFormat::Compact);
+	EXPECT_EQ(classic.size(), 22u);
+	EXPECT_EQ(compact.size(), 15u); // Version + type + 1 length byte + 12-byte payload
+
+	ParseResult result = tryParseFrame(compact.data(), compact.size());
+	ASSERT_EQ(result.status, ParseStatus::Complete);
+	EXPECT_EQ(result.headerSize, 3u);
+	EXPECT_EQ(result.frame.type, PacketType::Ack);
+	EXPECT_EQ(Ack::deserialize(result.frame.payload_view, result.frame.size).offset, ack.offset);
+}
+
+TEST(CompactFrameTest, VarintLengthsAtEveryBoundary) {
+	for (size_t length : { 0, 1, 127, 128, 16383, 16384, 1 << 20 }) {
+		FileChunk chunk;
+		chunk.streamId = 1;
+		chunk.offset = 0;
+		chunk.data.assign(length, 0x5A);
+
+		auto frame = buildFrame(chunk, FrameFormat::Compact);
+		// Cut anywhere in the header or body: never a false Complete or an error
+		for (size_t cut : { size_t(1), size_t(2), size_t(3), frame.size() - 1 }) {
+			if (cut >= frame.size()) continue;
+			EXPECT_EQ(tryParseFrame(frame.data(), cut).status, ParseStatus::NeedMoreData) << length << " cut at " << cut;
+		}
+
+		ParseResult result = tryParseFrame(frame.data(), frame.size());
+		ASSERT_EQ(result.status, ParseStatus::Complete) << length;
+		EXPECT_EQ(result.headerSize + result.frame.size, frame.size());
+		EXPECT_EQ(FileChunk::deserialize(result.frame.payload_view, result.frame.size).data, chunk.data);
+	}
+}
+
+TEST(CompactFrameTest, BothFormatsShareOneStream) {
+	Ack first;
+	first.offset = 1;
+	Ack second;
+	second.offset = 2;
+	auto a = buildFrame(first);
+	auto b = buildFrame(second, FrameFormat::Compact);
+
+	cw::buffer::ReceiveBuffer buffer(16);
+	buffer.append(b.data(), b.size());
+	buffer.append(a.data(), a.size());
+	buffer.append(b.data(), b.size());
+
+	std::vector<uint64_t> offsets;
+	while (!buffer.empty()) {
+		ParseResult result = tryParseFrame(buffer.data(), buffer.size());
+		ASSERT_EQ(result.status, ParseStatus::Complete);
+		offsets.push_back(Ack::deserialize(result.frame.payload_view, result.frame.size).offset);
+		buffer.consume(result.headerSize + result.frame.size);
+	}
+	EXPECT_EQ(offsets, (std::vector<uint64_t>{ 2, 1, 2 }));
+}
+
+TEST(CompactFrameTest, MalformedHeadersAreProtocolErrors) {
+	// Unknown version byte
+	std::vector<uint8_t> unknown{ 0x07, 0x05, 0x00 };
+	EXPECT_EQ(tryParseFrame(unknown.data(), unknown.size()).status, ParseStatus::ProtocolError);
+
+	// Varint longer than any legal length
+	std::vector<uint8_t> endless{ COMPACT_FRAME_VERSION, 0x05, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 };
+	EXPECT_EQ(tryParseFrame(endless.data(), endless.size()).status, ParseStatus::ProtocolError);
+
+	// Length over MAX_FRAME_PAYLOAD_SIZE
+	std::vector<uint8_t> huge{ COMPACT_FRAME_VERSION, 0x05, 0xFF, 0xFF, 0xFF, 0x7F };
+	EXPECT_EQ(tryParseFrame(huge.data(), huge.size()).status, ParseStatus::ProtocolError);
+}
+
+// ---------------------------------------------------------
+// 33. HANDSHAKE (Capabilities carry the version and the receiver's limits)
+// ---------------------------------------------------------
+TEST(HandshakeTest, CapabilitiesRoundTripAndOlderPeersReadAsVersionOne) {
+	Capabilities caps;
+	caps.codecs = 3;
+	caps.features = CAP_COMPACT_FRAMES;
+	caps.version = PROTOCOL_VERSION;
+	caps.maxChunkSize = 128 * 1024;
+	caps.receiveWindow = 4 * 1024 * 1024;
+
+	auto frame = buildFrame(caps);
+	ParsedFrame view = parseFrame(frame);
+	Capabilities back = Capabilities::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(back.version, PROTOCOL_VERSION);
+	EXPECT_EQ(back.maxChunkSize, caps.maxChunkSize);
+	EXPECT_EQ(back.receiveWindow, caps.receiveWindow);
+	EXPECT_EQ(back.features, caps.features);
+
+	// Codecs and features only, as sent before the handshake had tunables
+	Capabilities old = Capabilities::deserialize(view.payload_view, Capabilities::BASE_SIZE);
+	EXPECT_EQ(old.version, 1u);
+	EXPECT_EQ(old.features, caps.features);
+	EXPECT_EQ(old.maxChunkSize, 0u);
+	EXPECT_EQ(old.receiveWindow, 0u);
+}
+
+TEST(HandshakeTest, SenderHonoursReceiverLimits) {
+	auto source = std::filesystem::temp_directory_path() / "cw_handshake.bin";
+	std::vector<uint8_t> bytes(1024 * 1024 + 11);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 3 + (i >> 12));
+	std::ofstream(source, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	std::filesystem::remove_all("cw_handshake");
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	server->setReceiveLimits(64 * 1024, 256 * 1024);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	cw::TransferOptions negotiated;
+	client->socket().async_connect(asio::ip::tcp::endpoint(acceptor.local_endpoint()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, [client, source, &negotiated]() -> asio::awaitable<void>
+				{
+					co_await client->asyncWaitCapabilities(asio::use_awaitable);
+					cw::TransferOptions options;
+					options.chunkSize = 1024 * 1024;
+					negotiated = cw::detail::negotiatedOptions(options, *client);
+					co_await cw::asyncSendFile(client, source, "cw_handshake/copy.bin", options);
+				}, asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (server->metrics()->snapshot().filesReceived == 0 && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+
+	EXPECT_EQ(client->peerVersion(), PROTOCOL_VERSION);
+	EXPECT_EQ(client->peerMaxChunkSize(), 64 * 1024u);
+	EXPECT_EQ(negotiated.chunkSize, 64 * 1024u);
+	EXPECT_EQ(negotiated.ackWindowBytes, 256 * 1024u);
+
+	// 1 MiB in 64 KiB chunks: the Capabilities, a FileInfo, 17 chunks and a FileDone
+	EXPECT_GE(server->metrics()->snapshot().framesReceived, 20u);
+
+	std::ifstream in("cw_handshake/copy.bin", std::ios::binary);
+	std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(contents, bytes);
+	in.close();
+	std::filesystem::remove_all("cw_handshake");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------
+// 34. IDLE CONNECTIONS (released buffers, idle timeout, connection limit)
+// ---------------------------------------------------------
+TEST(IdleConnectionTest, ReleasesReceiveBufferThenTimesOut) {
+	cw::buffer::ReceiveBuffer lazy(0);
+	EXPECT_EQ(lazy.capacity(), 0u);
+	lazy.append(reinterpret_cast<const uint8_t*>("abc"), 3);
+	lazy.release(); // Not while bytes are unread
+	EXPECT_EQ(lazy.size(), 3u);
+	lazy.consume(3);
+	lazy.release();
+	EXPECT_EQ(lazy.capacity(), 0u);
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	server->setIdleTimeout(std::chrono::milliseconds(300));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(asio::ip::tcp::endpoint(acceptor.local_endpoint()), [client](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+		});
+
+	auto started = std::chrono::steady_clock::now();
+	while (client->peerVersion() == 0 || server->peerVersion() == 0) {
+		ASSERT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(5));
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	io.run_for(std::chrono::milliseconds(20));
+
+	// Capabilities exchanged, nothing more to read: no receive buffer held
+	EXPECT_EQ(server->receiveBufferCapacity(), 0u);
+	EXPECT_EQ(client->receiveBufferCapacity(), 0u);
+	EXPECT_TRUE(server->socket().is_open());
+
+	while (server->socket().is_open() && std::chrono::steady_clock::now() - started < std::chrono::seconds(5)) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+	EXPECT_FALSE(server->socket().is_open());
+	EXPECT_GE(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(300));
+}
+
+TEST(IdleConnectionTest, ServerRefusesConnectionsBeyondLimit) {
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	server.setMaxConnections(1);
+	asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(), server.port());
+
+	// Accepted: the server's Capabilities arrive. Refused: end of stream.
+	auto firstBytes = [&io, endpoint](asio::ip::tcp::socket& socket)
+		{
+			socket.connect(endpoint);
+			std::error_code result = asio::error::timed_out;
+			std::array<uint8_t, 64> bytes;
+			socket.async_read_some(asio::buffer(bytes), [&result](std::error_code ec, std::size_t) { result = ec; });
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+			while (result == asio::error::timed_out && std::chrono::steady_clock::now() < deadline) {
+				io.run_for(std::chrono::milliseconds(5));
+			}
+			return result;
+		};
+
+	asio::ip::tcp::socket first(io), second(io), third(io);
+	EXPECT_FALSE(firstBytes(first));
+	EXPECT_EQ(firstBytes(second), asio::error::eof);
+
+	// The slot is freed once the first one goes away
+	first.close();
+	io.run_for(std::chrono::milliseconds(50));
+	EXPECT_FALSE(firstBytes(third));
+}
+
+TEST(IdleConnectionTest, ServerAbsorbsConnectionStorm) {
+	auto registry = std::make_shared<cw::metrics::MetricsRegistry>();
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	server.setMetrics(registry);
+	server.setPendingAccepts(16);
+
+	// More clients than pending accepts, all connecting at once
+	std::vector<std::unique_ptr<asio::ip::tcp::socket>> clients;
+	for (int i = 0; i < 64; ++i) {
+		clients.push_back(std::make_unique<asio::ip::tcp::socket>(io));
+		clients.back()->async_connect({ asio::ip::address_v4::loopback(), server.port() }, [](std::error_code ec) { EXPECT_FALSE(ec); });
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (registry->snapshot().connectionsTotal < clients.size() && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	EXPECT_EQ(registry->snapshot().connectionsTotal, clients.size());
+}
+
+// ---------------------------------------------------------
+// 35. RESOLVING AND CONNECTING (cached lookups, happy eyeballs, dual stack)
+// ---------------------------------------------------------
+TEST(ResolverTest, InterleavesFamiliesAndCachesLookups) {
+	using asio::ip::make_address;
+	cw::network::Endpoints mixed = {
+		{ make_address("2001:db8::1"), 1 }, { make_address("2001:db8::2"), 1 },
+		{ make_address("192.0.2.1"), 1 }, { make_address("192.0.2.2"), 1 }, { make_address("192.0.2.3"), 1 } };
+	auto ordered = cw::network::interleaveFamilies(mixed);
+	ASSERT_EQ(ordered.size(), 5u);
+	EXPECT_EQ(ordered[0], mixed[0]);
+	EXPECT_EQ(ordered[1], mixed[2]);
+	EXPECT_EQ(ordered[2], mixed[1]);
+	EXPECT_EQ(ordered[3], mixed[3]);
+	EXPECT_EQ(ordered[4], mixed[4]);
+
+	asio::io_context io;
+	cw::network::ResolverCache cache;
+	int answered = 0;
+	auto expectLoopback = [&answered](std::error_code ec, cw::network::Endpoints endpoints)
+		{
+			EXPECT_FALSE(ec);
+			ASSERT_FALSE(endpoints.empty());
+			EXPECT_TRUE(endpoints.front().address().is_loopback());
+			++answered;
+		};
+
+	// Two at once share one lookup; a literal needs none
+	cache.asyncResolve(io.get_executor(), "localhost", 80, expectLoopback);
+	cache.asyncResolve(io.get_executor(), "localhost", 80, expectLoopback);
+	cache.asyncResolve(io.get_executor(), "127.0.0.1", 80, expectLoopback);
+	io.run();
+	EXPECT_EQ(answered, 3);
+	EXPECT_EQ(cache.stats().lookups, 1u);
+
+	io.restart();
+	cache.asyncResolve(io.get_executor(), "localhost", 80, expectLoopback);
+	io.run();
+	EXPECT_EQ(answered, 4);
+	EXPECT_EQ(cache.stats().lookups, 1u);
+	EXPECT_EQ(cache.stats().hits, 2u);
+}
+
+TEST(ResolverTest, RacingSkipsAddressesThatDoNotAnswer) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor listener(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	asio::ip::tcp::socket accepted(io);
+	listener.async_accept(accepted, [](std::error_code) {});
+
+	// A closed port refuses at once, a documentation address never answers
+	asio::ip::tcp::acceptor closed(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto refused = closed.local_endpoint();
+	closed.close();
+	cw::network::Endpoints endpoints = { refused, { asio::ip::make_address("192.0.2.1"), 9 }, listener.local_endpoint() };
+
+	auto strand = asio::make_strand(io);
+	std::error_code result = asio::error::timed_out;
+	asio::ip::tcp::endpoint reached;
+	int prepared = 0;
+	auto started = std::chrono::steady_clock::now();
+	cw::network::asyncConnectRacing(strand, endpoints,
+		[&prepared](asio::generic::stream_protocol::socket&) { ++prepared; },
+		[&](std::error_code ec, asio::generic::stream_protocol::socket socket, asio::ip::tcp::endpoint endpoint)
+		{
+			result = ec;
+			reached = endpoint;
+			EXPECT_TRUE(socket.is_open());
+		}, std::chrono::milliseconds(50));
+	while (result == asio::error::timed_out && std::chrono::steady_clock::now() - started < std::chrono::seconds(5)) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+
+	EXPECT_FALSE(result);
+	EXPECT_EQ(reached, listener.local_endpoint());
+	EXPECT_EQ(prepared, 3);
+	EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(2));
+}
+
+TEST(ResolverTest, ServerListensOnBothFamilies) {
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+
+	for (auto address : { asio::ip::make_address("127.0.0.1"), asio::ip::make_address("::1") }) {
+		asio::ip::tcp::socket socket(io);
+		std::error_code ec;
+		socket.connect({ address, server.port() }, ec);
+		if (address.is_v6() && ec == asio::error::address_family_not_supported) continue; // Host without IPv6
+		EXPECT_FALSE(ec) << address;
+	}
+}
+
+// ---------------------------------------------------------
+// 36. CLIENT POOL (warm connections reused across transfers)
+// ---------------------------------------------------------
+static asio::awaitable<void> pooledUploads(std::shared_ptr<cw::network::ClientPool> pool, uint16_t port,
+	std::filesystem::path source, std::vector<std::shared_ptr<cw::network::Connection>>* used, bool* done)
+{
+	for (int i = 0; i < 3; ++i) {
+		auto lease = co_await pool->asyncAcquire("localhost", port, asio::use_awaitable);
+		used->push_back(lease.get());
+		co_await cw::asyncSendFile(lease.get(), source, "cw_pool/out" + std::to_string(i) + ".bin", {});
+	}
+
+	// One connection allowed: a second acquire waits for the first lease
+	auto first = co_await pool->asyncAcquire("localhost", port, asio::use_awaitable);
+	bool second = false;
+	pool->asyncAcquire("localhost", port, [&second](std::error_code ec, cw::network::PooledConnection lease)
+		{
+			EXPECT_FALSE(ec);
+			EXPECT_TRUE(lease);
+			second = true;
+		});
+	asio::steady_timer pause(co_await asio::this_coro::executor, std::chrono::milliseconds(50));
+	co_await pause.async_wait(asio::use_awaitable);
+	EXPECT_FALSE(second);
+	first.release();
+	pause.expires_after(std::chrono::milliseconds(50));
+	co_await pause.async_wait(asio::use_awaitable);
+	EXPECT_TRUE(second);
+	*done = true;
+}
+
+TEST(ClientPoolTest, ReusesConnectionsAndDropsOnesTheServerClosed) {
+	auto source = std::filesystem::temp_directory_path() / "cw_pool.bin";
+	std::ofstream(source, std::ios::binary) << std::string(10000, 'p');
+	std::filesystem::remove_all("cw_pool");
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	server.setIdleTimeout(std::chrono::milliseconds(300));
+
+	cw::network::ClientPoolOptions options;
+	options.maxPerEndpoint = 1;
+	options.healthCheckInterval = std::chrono::milliseconds(20);
+	auto pool = cw::network::ClientPool::create(io, options);
+
+	std::vector<std::shared_ptr<cw::network::Connection>> used;
+	bool done = false;
+	asio::co_spawn(io, pooledUploads(pool, server.port(), source, &used, &done), asio::detached);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!done && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_TRUE(done);
+
+	ASSERT_EQ(used.size(), 3u);
+	EXPECT_EQ(used[0], used[1]);
+	EXPECT_EQ(used[1], used[2]);
+	EXPECT_EQ(pool->stats().connects, 1u);
+	EXPECT_EQ(pool->stats().reuses, 4u);
+	EXPECT_TRUE(std::filesystem::exists("cw_pool/out2.bin"));
+
+	// The server closes the idle connection; the pool notices and reconnects
+	io.run_for(std::chrono::milliseconds(500));
+	EXPECT_FALSE(used[0]->isOpen());
+	std::error_code result = asio::error::timed_out;
+	pool->asyncAcquire("127.0.0.1", server.port(), [&result](std::error_code ec, cw::network::PooledConnection lease)
+		{
+			result = ec;
+			EXPECT_TRUE(lease->isOpen());
+		});
+	deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (result == asio::error::timed_out && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	EXPECT_FALSE(result);
+	EXPECT_EQ(pool->stats().connects, 2u);
+
+	std::filesystem::remove_all("cw_pool");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------
+// 37. DIRECTORY SCANNER (parallel listing with one stat per file)
+// ---------------------------------------------------------
+static asio::awaitable<void> walkAll(std::shared_ptr<cw::detail::FileWalker> walker, std::vector<cw::file::ScannedFile>* found)
+{
+	while (auto file = co_await walker->next()) found->push_back(std::move(*file));
+}
+
+class DirectoryScannerTest : public ::testing::Test {
+protected:
+	void SetUp() override
+	{
+		m_root = std::filesystem::temp_directory_path() / "cw_scan";
+		std::filesystem::remove_all(m_root);
+		std::filesystem::create_directories(m_root / "sub" / "deeper");
+		writeFile(m_root / "a.txt", 3);
+		writeFile(m_root / "sub" / "b.bin", 1000);
+		writeFile(m_root / "sub" / "deeper" / "c", 0);
+		for (int i = 0; i < 50; ++i) writeFile(m_root / ("dir" + std::to_string(i)) / "f", i);
+
+		std::error_code ec;
+		std::filesystem::create_symlink(m_root / "a.txt", m_root / "link.txt", ec);
+		std::filesystem::create_directory_symlink(m_root / "sub", m_root / "linked_dir", ec);
+	}
+
+	void TearDown() override { std::filesystem::remove_all(m_root); }
+
+	static void writeFile(const std::filesystem::path& path, size_t size)
+	{
+		std::filesystem::create_directories(path.parent_path());
+		std::ofstream(path, std::ios::binary) << std::string(size, 'x');
+	}
+
+	// What a plain recursive walk finds, by relative path
+	std::map<std::string, uint64_t> expected() const
+	{
+		std::map<std::string, uint64_t> files;
+		for (const auto& entry : std::filesystem::recursive_directory_iterator(m_root)) {
+			if (entry.is_regular_file()) files[entry.path().lexically_relative(m_root).string()] = entry.file_size();
+		}
+		return files;
+	}
+
+	std::filesystem::path m_root;
+};
+
+TEST_F(DirectoryScannerTest, FindsWhatRecursiveWalkFinds) {
+	asio::io_context io;
+	asio::thread_pool pool(4);
+
+	auto work = asio::make_work_guard(io); // The listing runs on the pool
+	std::vector<cw::file::ScannedFile> found;
+	size_t outstanding = 1;
+	auto scanner = cw::file::DirectoryScanner::start(m_root, pool.get_executor(), io.get_executor(),
+		[&](std::vector<cw::file::ScannedFile> files, std::vector<std::filesystem::path> subdirectories)
+		{
+			outstanding += subdirectories.size();
+			--outstanding;
+			for (auto& file : files) found.push_back(std::move(file));
+		}, 4);
+
+	while (outstanding > 0 && io.run_one_for(std::chrono::seconds(5))) {}
+	ASSERT_EQ(outstanding, 0u);
+
+	std::map<std::string, uint64_t> sizes;
+	for (const auto& file : found) {
+		sizes[file.relativePath.string()] = file.size;
+		EXPECT_EQ(file.path, m_root / file.relativePath);
+		EXPECT_EQ(file.modifiedNs, cw::file::modifiedNs(std::filesystem::last_write_time(file.path)));
+	}
+	EXPECT_EQ(sizes, expected());
+	EXPECT_EQ(found.size(), sizes.size());
+	EXPECT_EQ(sizes.count("linked_dir/b.bin"), 0u); // Directory links are not followed
+	pool.join();
+}
+
+TEST_F(DirectoryScannerTest, WalkerHandsOutEveryFileOnce) {
+	asio::io_context io;
+	asio::thread_pool pool(2);
+
+	// Two consumers pulling from one walker, as upload workers do
+	auto walker = cw::detail::FileWalker::scan(io.get_executor(), m_root, pool.get_executor());
+	std::vector<cw::file::ScannedFile> first, second;
+	asio::co_spawn(io, walkAll(walker, &first), asio::detached);
+	asio::co_spawn(io, walkAll(walker, &second), asio::detached);
+	io.run_for(std::chrono::seconds(5));
+
+	std::map<std::string, uint64_t> sizes;
+	for (auto* files : { &first, &second }) {
+		for (const auto& file : *files) EXPECT_TRUE(sizes.emplace(file.relativePath.string(), file.size).second);
+	}
+	EXPECT_EQ(sizes, expected());
+	pool.join();
+}
+
+#if defined(__linux__)
+TEST_F(DirectoryScannerTest, WalkerSweepsByInode) {
+	asio::io_context io;
+	asio::thread_pool pool(2);
+
+	auto walker = cw::detail::FileWalker::scan(io.get_executor(), m_root, pool.get_executor(), nullptr, cw::file::ReadOrder::Inode);
+	std::vector<cw::file::ScannedFile> found;
+	asio::co_spawn(io, walkAll(walker, &found), asio::detached);
+	io.run_for(std::chrono::seconds(5));
+
+	// Found as the scan goes: each sweep ascends, and starts over lower
+	ASSERT_EQ(found.size(), expected().size());
+	size_t sweeps = 1;
+	for (size_t i = 0; i < found.size(); ++i) {
+		struct stat info;
+		ASSERT_EQ(::stat(found[i].path.c_str(), &info), 0);
+		EXPECT_EQ(found[i].inode, static_cast<uint64_t>(info.st_ino));
+		if (i > 0 && found[i].inode < found[i - 1].inode) ++sweeps;
+	}
+	EXPECT_LT(sweeps, found.size() / 2);
+	pool.join();
+}
+#endif
+
+TEST(ReadOrderTest, ListedFilesGoInOneSweepFromTheLowest) {
+	asio::io_context io;
+	std::vector<cw::file::ScannedFile> files;
+	for (uint64_t offset : { 700, 100, 900, 300, 0 }) {
+		cw::file::ScannedFile file;
+		file.path = "f" + std::to_string(offset);
+		file.relativePath = file.path;
+		file.diskOffset = offset;
+		files.push_back(file);
+	}
+
+	auto walker = cw::detail::FileWalker::list(io.get_executor(), files, nullptr, cw::file::ReadOrder::Physical);
+	std::vector<cw::file::ScannedFile> found;
+	asio::co_spawn(io, walkAll(walker, &found), asio::detached);
+	io.run();
+
+	std::vector<uint64_t> offsets;
+	for (const auto& file : found) offsets.push_back(file.diskOffset);
+	EXPECT_EQ(offsets, (std::vector<uint64_t>{ 0, 100, 300, 700, 900 }));
+
+	// Where the file system maps extents, a file with data gets its offset
+	auto path = std::filesystem::temp_directory_path() / "cw_locate.bin";
+	std::ofstream(path, std::ios::binary) << std::string(64 * 1024, 'l');
+	cw::file::ScannedFile located;
+	located.path = path;
+	located.size = 64 * 1024;
+	cw::file::locate(located);
+	cw::file::ScannedFile empty;
+	empty.path = path;
+	cw::file::locate(empty);
+	EXPECT_EQ(empty.diskOffset, 0u);
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------
+// 38. DIRECTORY MANIFEST (receiver creates directories once, in bulk)
+// ---------------------------------------------------------
+TEST(DirectoryManifestTest, RoundTripAndBulkCreate) {
+	DirectoryManifest original;
+	original.directories = { "a", "a/b/c", "a/b", "d/e", "d/e" };
+
+	auto frame = buildFrame(original);
+	auto view = parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::DirectoryManifest);
+	ASSERT_EQ(view.size, original.payloadSize());
+	auto decoded = DirectoryManifest::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(decoded.directories, original.directories);
+
+	auto root = std::filesystem::temp_directory_path() / "cw_dir_cache";
+	std::filesystem::remove_all(root);
+	std::vector<std::filesystem::path> dirs;
+	for (const auto& name : decoded.directories) dirs.push_back(root / name);
+
+	asio::thread_pool pool(4);
+	cw::file::DirectoryCache cache;
+	std::promise<std::error_code> created;
+	cache.createAll(dirs, pool.get_executor(), 4, [&created](std::error_code ec) { created.set_value(ec); });
+	EXPECT_FALSE(created.get_future().get());
+
+	EXPECT_TRUE(std::filesystem::is_directory(root / "a" / "b" / "c"));
+	EXPECT_TRUE(std::filesystem::is_directory(root / "d" / "e"));
+	EXPECT_TRUE(cache.contains(root / "a"));       // Parents of created leaves too
+	EXPECT_TRUE(cache.contains(root / "d" / "e/")); // Same key however it is spelled
+	EXPECT_FALSE(cache.contains(root / "x"));
+
+	// Removed behind the cache's back: the open fails once, then the cache is rebuilt
+	std::filesystem::remove_all(root / "d");
+	auto file = cache.openWrite(root / "d" / "e" / "f.bin");
+	EXPECT_TRUE(file.isOpen());
+	EXPECT_TRUE(std::filesystem::exists(root / "d" / "e" / "f.bin"));
+	EXPECT_TRUE(cache.contains(root / "d" / "e"));
+	EXPECT_FALSE(cache.contains(root / "a" / "b" / "c"));
+
+	pool.join();
+	std::filesystem::remove_all(root);
+}
+
+static asio::awaitable<void> uploadTree(std::shared_ptr<cw::network::ClientPool> pool, uint16_t port, std::filesystem::path root, bool* done)
+{
+	auto lease = co_await pool->asyncAcquire("127.0.0.1", port, asio::use_awaitable);
+	EXPECT_TRUE(lease->peerTakesDirectoryManifests());
+	std::vector<std::shared_ptr<cw::network::Connection>> conns{ lease.get() };
+	co_await cw::asyncUploadDirectory(conns, root);
+	*done = true;
+}
+
+TEST(DirectoryManifestTest, UploadCreatesDirectoriesAheadOfFiles) {
+	// Names are relative to 'source', and the server writes to the working directory
+	auto source = std::filesystem::temp_directory_path() / "cw_dirman_src";
+	std::filesystem::remove_all(source);
+	std::filesystem::remove_all("cw_dirman");
+	std::filesystem::create_directories(source / "cw_dirman" / "a" / "b");
+	std::filesystem::create_directories(source / "cw_dirman" / "empty" / "inner");
+	std::ofstream(source / "cw_dirman" / "a" / "b" / "f.txt") << "nested";
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	auto pool = cw::network::ClientPool::create(io);
+
+	bool done = false;
+	asio::co_spawn(io, uploadTree(pool, server.port(), source, &done), asio::detached);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while ((!done || !std::filesystem::exists("cw_dirman/a/b/f.txt") || !std::filesystem::is_directory("cw_dirman/empty/inner"))
+		&& std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	EXPECT_TRUE(done);
+	EXPECT_TRUE(std::filesystem::exists("cw_dirman/a/b/f.txt"));
+
+	// No file lives there; only the manifest could have created it
+	EXPECT_TRUE(std::filesystem::is_directory("cw_dirman/empty/inner"));
+
+	std::filesystem::remove_all("cw_dirman");
+	std::filesystem::remove_all(source);
+}
+
+// ---------------------------------------------------------
+// 39. DIRECTORY HANDLES (openat relative to cached directory descriptors)
+// ---------------------------------------------------------
+#if !defined(_WIN32)
+TEST(DirectoryHandleTest, OpensRelativeToCachedDescriptorsAndConfines) {
+	std::filesystem::remove_all("cw_dirfd");
+	auto outside = std::filesystem::temp_directory_path() / "cw_dirfd_outside";
+	std::filesystem::remove_all(outside);
+	std::filesystem::create_directories(outside);
+
+	cw::file::DirectoryCache cache(2);
+	EXPECT_TRUE(cache.openWrite("cw_dirfd/a/b/c/one.bin").isOpen());
+	EXPECT_TRUE(cache.openWrite("cw_dirfd/a/b/c/two.bin").isOpen());
+	EXPECT_TRUE(cache.openWrite("cw_dirfd/x/three.bin").isOpen());
+	EXPECT_TRUE(std::filesystem::exists("cw_dirfd/a/b/c/two.bin"));
+	EXPECT_TRUE(std::filesystem::exists("cw_dirfd/x/three.bin"));
+	EXPECT_LE(cache.openHandles(), 2u); // Least recently used descriptors are closed
+	EXPECT_TRUE(cache.contains("cw_dirfd/x"));
+
+	// Removed while its descriptor was cached: one retry recreates it
+	std::filesystem::remove_all("cw_dirfd/x");
+	EXPECT_TRUE(cache.openWrite("cw_dirfd/x/three.bin").isOpen());
+	EXPECT_TRUE(std::filesystem::exists("cw_dirfd/x/three.bin"));
+
+	// Unconfined, a symlinked directory is followed as before
+	std::filesystem::create_directory_symlink(outside, "cw_dirfd/link");
+	EXPECT_TRUE(cache.openWrite("cw_dirfd/link/followed.bin").isOpen());
+	EXPECT_TRUE(std::filesystem::exists(outside / "followed.bin"));
+
+	cw::file::DirectoryCache confined;
+	confined.setConfined(true);
+	auto refused = [&confined](const std::filesystem::path& path)
+		{
+			try {
+				confined.openWrite(path);
+				return false;
+			}
+			catch (const std::system_error&) {
+				return true;
+			}
+		};
+	EXPECT_TRUE(refused("cw_dirfd/../cw_dirfd_escape.bin"));
+	EXPECT_TRUE(refused(outside / "absolute.bin"));
+	EXPECT_TRUE(refused("cw_dirfd/link/escaped.bin"));
+	EXPECT_FALSE(std::filesystem::exists(outside / "escaped.bin"));
+	EXPECT_FALSE(refused("cw_dirfd/a/inside.bin"));
+	EXPECT_TRUE(confined.ensure("cw_dirfd/link/sub"));
+
+	std::filesystem::remove_all("cw_dirfd");
+	std::filesystem::remove_all(outside);
+}
+#endif
+
+// ---------------------------------------------------------
+// 40. DURABILITY (files are acked once synced, group commit shares flushes)
+// ---------------------------------------------------------
+TEST(DurabilityTest, GroupCommitCoversFilesArrivingDuringAFlush) {
+	EXPECT_EQ(cw::file::parseDurability("group"), cw::file::Durability::GroupCommit);
+	EXPECT_EQ(cw::file::parseDurability("file"), cw::file::Durability::PerFile);
+	EXPECT_FALSE(cw::file::parseDurability("always").has_value());
+
+	auto dir = std::filesystem::temp_directory_path() / "cw_group_commit";
+	std::filesystem::create_directories(dir);
+	asio::thread_pool pool(1);
+	auto committer = std::make_shared<cw::file::GroupCommitter>(pool.get_executor(), std::make_shared<cw::file::DirectoryCache>());
+
+	// The only pool thread is busy: every file joins the flush queued behind it
+	std::promise<void> release;
+	asio::post(pool, [started = release.get_future().share()]() { started.wait(); });
+
+	constexpr int FILES = 8;
+	std::atomic<int> durable = 0;
+	for (int i = 0; i < FILES; ++i) {
+		auto file = std::make_shared<const cw::file::FileHandle>(cw::file::FileHandle::openWrite(dir / ("f" + std::to_string(i))));
+		committer->add(file, dir, [&durable](std::error_code ec) { EXPECT_FALSE(ec); ++durable; });
+	}
+	release.set_value();
+	pool.join();
+
+	EXPECT_EQ(durable.load(), FILES);
+	EXPECT_EQ(committer->stats().files, static_cast<std::uint64_t>(FILES));
+	EXPECT_EQ(committer->stats().flushes, 1u);
+
+	std::filesystem::remove_all(dir);
+}
+
+TEST(DurabilityTest, DurableModesStillAckEveryWrite) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_durability";
+	for (auto durability : { cw::file::Durability::PerFile, cw::file::Durability::GroupCommit }) {
+		std::filesystem::remove_all(dir);
+		asio::io_context io;
+		cw::file::DiskWriter writer(2);
+		writer.setDurability(durability);
+		auto work = asio::make_work_guard(io);
+		int acks = 0;
+
+		auto file = cw::file::WriteBehindFile::create(writer, io.get_executor());
+		file->open(dir / "big" / "out.bin", 4, [](std::error_code ec) { EXPECT_FALSE(ec); });
+		file->write(0, cw::buffer::SharedBuffer::fromVector({ 1, 2, 3, 4 }));
+		file->finish([&](std::error_code ec, uint64_t bytes) { EXPECT_FALSE(ec); EXPECT_EQ(bytes, 4u); if (++acks == 2) work.reset(); });
+
+		std::vector<cw::file::SmallFile> small;
+		small.push_back({ dir / "a" / "one.txt", cw::buffer::SharedBuffer::fromVector({ 'o', 'n', 'e' }) });
+		small.push_back({ dir / "b" / "two.txt", cw::buffer::SharedBuffer::fromVector({ 't', 'w', 'o' }) });
+		cw::file::writeSmallFiles(writer, std::move(small), io.get_executor(),
+			[&](std::error_code ec, uint64_t bytes) { EXPECT_FALSE(ec); EXPECT_EQ(bytes, 6u); if (++acks == 2) work.reset(); });
+
+		io.run();
+		EXPECT_EQ(acks, 2);
+		EXPECT_EQ(std::filesystem::file_size(dir / "big" / "out.bin"), 4u);
+		EXPECT_EQ(std::filesystem::file_size(dir / "b" / "two.txt"), 3u);
+	}
+	std::filesystem::remove_all(dir);
+}
+
+// ---------------------------------------------------------
+// 41. ATOMIC PUBLISH (received under a temporary name, renamed once verified)
+// ---------------------------------------------------------
+TEST(AtomicPublishTest, ReadersSeeTheOldCopyOrTheVerifiedNewOne) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_atomic";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	auto path = dir / "out.bin";
+	std::ofstream(path) << "old";
+
+	asio::io_context io;
+	cw::file::DiskWriter writer(2);
+
+	// One attempt: open, write 'bytes' at 0, check what readers see, finish
+	auto attempt = [&](std::vector<uint8_t> bytes, bool publish) {
+		auto file = cw::file::WriteBehindFile::create(writer, io.get_executor());
+		auto work = asio::make_work_guard(io);
+		file->open(path, 4, [&, file, bytes, publish](std::error_code ec) mutable
+			{
+				EXPECT_FALSE(ec);
+				file->write(0, cw::buffer::SharedBuffer::fromVector(std::move(bytes)));
+				file->whenDrained(0, [&, file, publish]()
+					{
+						EXPECT_EQ(std::filesystem::file_size(path), 3u); // Still the old copy
+						EXPECT_TRUE(std::filesystem::exists(cw::file::receivingPathFor(path)));
+						file->finish([&](std::error_code ec, uint64_t) { EXPECT_FALSE(ec); work.reset(); }, publish);
+					});
+			});
+		io.restart();
+		io.run();
+	};
+
+	// Refused (a checksum mismatch): the new bytes go, the old copy stays
+	attempt({ 9, 9, 9, 9 }, false);
+	EXPECT_EQ(std::filesystem::file_size(path), 3u);
+	EXPECT_FALSE(std::filesystem::exists(cw::file::receivingPathFor(path)));
+
+	attempt({ 1, 2, 3, 4 }, true);
+	EXPECT_EQ(std::filesystem::file_size(path), 4u);
+	EXPECT_FALSE(std::filesystem::exists(cw::file::receivingPathFor(path)));
+
+	// Dropped before finish (the connection went away): nothing is left behind
+	{
+		auto file = cw::file::WriteBehindFile::create(writer, io.get_executor());
+		auto work = asio::make_work_guard(io);
+		file->open(dir / "dropped.bin", 4, [&](std::error_code) { work.reset(); });
+		io.restart();
+		io.run();
+	}
+	// The disk thread may still hold the last reference for a moment
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+	while (std::filesystem::exists(cw::file::receivingPathFor(dir / "dropped.bin")) && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_FALSE(std::filesystem::exists(cw::file::receivingPathFor(dir / "dropped.bin")));
+	EXPECT_FALSE(std::filesystem::exists(dir / "dropped.bin"));
+
+	// Batched small files are renamed into place one by one
+	std::vector<cw::file::SmallFile> small;
+	small.push_back({ dir / "small.txt", cw::buffer::SharedBuffer::fromVector({ 'n', 'e', 'w' }) });
+	auto work = asio::make_work_guard(io);
+	cw::file::writeSmallFiles(writer, std::move(small), io.get_executor(), [&](std::error_code ec, uint64_t) { EXPECT_FALSE(ec); work.reset(); });
+	io.restart();
+	io.run();
+	EXPECT_EQ(std::filesystem::file_size(dir / "small.txt"), 3u);
+	EXPECT_FALSE(std::filesystem::exists(cw::file::receivingPathFor(dir / "small.txt")));
+
+	std::filesystem::remove_all(dir);
+}
+
+// ---------------------------------------------------------
+// 42. SPARSE FILES (holes go as FileHole ranges and stay holes)
+// ---------------------------------------------------------
+TEST(SparseFileTest, HolesAreFoundAndPunched) {
+	FileHole original;
+	original.streamId = 3;
+	original.offset = 1ull << 32;
+	original.length = 1ull << 20;
+	auto frame = cw::packet::buildFrame(original);
+	auto view = cw::packet::parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::FileHole);
+	auto decoded = FileHole::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(decoded.streamId, 3u);
+	EXPECT_EQ(decoded.offset, original.offset);
+	EXPECT_EQ(decoded.length, original.length);
+
+	// A stream's digest does not change over a run of zeros
+	std::vector<uint8_t> zeros(4096, 0);
+	cw::integrity::FileDigest withChunk(8192), withHole(8192);
+	std::vector<uint8_t> data(4096, 7);
+	withChunk.add(0, data.size(), cw::integrity::crc32c(data));
+	withChunk.add(4096, zeros.size(), cw::integrity::crc32c(zeros));
+	withHole.add(0, data.size(), cw::integrity::crc32c(data));
+	withHole.addZeros(zeros.size());
+	EXPECT_EQ(withChunk.value(), withHole.value());
+
+	auto path = std::filesystem::temp_directory_path() / "cw_sparse.bin";
+	std::filesystem::remove(path);
+	{
+		auto file = cw::file::FileHandle::openWrite(path);
+		ASSERT_FALSE(file.preallocate(4 << 20));
+		EXPECT_FALSE(file.writeAt(0, data));
+		EXPECT_FALSE(file.writeAt(3 << 20, data));
+		EXPECT_FALSE(file.punchHole(1 << 20, 1 << 20));
+		EXPECT_FALSE(file.punchHole(4 << 20, 1 << 20)); // Past the end: the file grows
+	}
+	EXPECT_EQ(std::filesystem::file_size(path), 5u << 20);
+
+	std::vector<uint8_t> back(4096, 1);
+	auto file = cw::file::FileHandle::openRead(path);
+	EXPECT_FALSE(file.readAt((1 << 20) + 100, back));
+	EXPECT_EQ(back, zeros);
+
+	// Where the filesystem reports holes, the punched range is one of them
+	auto holes = cw::file::findHoles(file, file.size(), 64 * 1024);
+	for (const auto& hole : holes) {
+		EXPECT_TRUE((hole.offset >= 4096 && hole.offset + hole.length <= (3u << 20)) || hole.offset >= (3u << 20) + 4096);
+	}
+#if defined(__linux__)
+	EXPECT_TRUE(std::any_of(holes.begin(), holes.end(), [](const auto& hole) { return hole.offset <= (1u << 20) && hole.offset + hole.length >= (2u << 20); }));
+#endif
+
+	std::filesystem::remove(path);
+}
+
+// Uploads 'path' as 'name' over a connection from 'pool' and counts it in
+// 'sent'. 'prepare' runs on the connection first: handlers to set, checks
+// of what the peer takes.
+static asio::awaitable<void> uploadFile(std::shared_ptr<cw::network::ClientPool> pool, uint16_t port, std::filesystem::path path,
+	std::string name, size_t* sent, cw::TransferOptions options = {}, std::function<void(cw::network::Connection&)> prepare = {})
+{
+	auto lease = co_await pool->asyncAcquire("127.0.0.1", port, asio::use_awaitable);
+	if (prepare) prepare(*lease.get());
+	co_await cw::asyncSendFile(lease.get(), path, name, options);
+	++*sent;
+}
+
+// A Server on an ephemeral loopback port and a ClientPool to reach it, on
+// one io_context: the scaffold of the upload round trips. Configure
+// 'server' before starting uploads; they run as runUntil drives 'io'.
+struct LoopbackServer
+{
+	explicit LoopbackServer(cw::network::ClientPool::Options poolOptions = {}, std::shared_ptr<cw::file::DiskWriter> diskWriter = nullptr)
+		: server(io, 0, std::move(diskWriter)), pool(cw::network::ClientPool::create(io, std::move(poolOptions)))
+	{
+		server.setMetrics(metrics);
+	}
+
+	// See uploadFile; 'sent' counts the uploads that have returned
+	void upload(std::filesystem::path path, std::string name, cw::TransferOptions options = {}, std::function<void(cw::network::Connection&)> prepare = {})
+	{
+		asio::co_spawn(io, uploadFile(pool, server.port(), std::move(path), std::move(name), &sent, std::move(options), std::move(prepare)), asio::detached);
+	}
+
+	// For uploads that drive the connection themselves: 'upload' gets a
+	// connection from the pool, which goes back to it when released
+	void spawn(std::function<asio::awaitable<void>(cw::network::PooledConnection)> upload)
+	{
+		asio::co_spawn(io, [this, upload = std::move(upload)]() -> asio::awaitable<void>
+			{
+				co_await upload(co_await pool->asyncAcquire("127.0.0.1", server.port(), asio::use_awaitable));
+			}, asio::detached);
+	}
+
+	// Runs 'io' until 'done' holds or 'timeout' has passed; returns done()
+	bool runUntil(const std::function<bool()>& done, std::chrono::steady_clock::duration timeout = std::chrono::seconds(10))
+	{
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		while (!done() && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+		return done();
+	}
+
+	uint64_t filesReceived() const { return metrics->snapshot().filesReceived; }
+
+	asio::io_context io;
+	std::shared_ptr<cw::metrics::MetricsRegistry> metrics = std::make_shared<cw::metrics::MetricsRegistry>();
+	cw::network::Server server;
+	std::shared_ptr<cw::network::ClientPool> pool;
+	size_t sent = 0;
+};
+
+TEST(SparseFileTest, UploadKeepsTheSparseLayout) {
+	auto source = std::filesystem::temp_directory_path() / "cw_sparse_src.bin";
+	std::vector<uint8_t> head(100 * 1024, 1), tail(50 * 1024, 2);
+	{
+		auto file = cw::file::FileHandle::openWrite(source);
+		EXPECT_FALSE(file.writeAt(0, head));
+		EXPECT_FALSE(file.writeAt(6 << 20, tail));
+		EXPECT_FALSE(file.punchHole((6 << 20) + tail.size(), 2 << 20)); // Ends in a hole
+	}
+	auto size = std::filesystem::file_size(source);
+	std::filesystem::remove("cw_sparse_dst.bin");
+
+	LoopbackServer loopback;
+	loopback.upload(source, "cw_sparse_dst.bin", {}, [](cw::network::Connection& conn) { EXPECT_TRUE(conn.peerTakesHoles()); });
+	loopback.runUntil([&] { return loopback.sent == 1 && std::filesystem::exists("cw_sparse_dst.bin"); });
+	ASSERT_TRUE(std::filesystem::exists("cw_sparse_dst.bin"));
+	EXPECT_EQ(std::filesystem::file_size("cw_sparse_dst.bin"), size);
+
+	std::vector<uint8_t> expected(size), received(size);
+	EXPECT_FALSE(cw::file::FileHandle::openRead(source).readAt(0, expected));
+	EXPECT_FALSE(cw::file::FileHandle::openRead("cw_sparse_dst.bin").readAt(0, received));
+	EXPECT_TRUE(expected == received);
+
+#if defined(__linux__)
+	// The 6 MB hole was not written out: well under the file's size is allocated
+	struct stat info {};
+	ASSERT_EQ(::stat("cw_sparse_dst.bin", &info), 0);
+	EXPECT_LT(static_cast<uint64_t>(info.st_blocks) * 512, size / 2);
+#endif
+
+	std::filesystem::remove("cw_sparse_dst.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------
+// 43. ZERO CHUNKS (SIMD zero scan, chunks of zeros go as FileHole)
+// ---------------------------------------------------------
+TEST(ZeroChunkTest, ScanFindsAnyNonZeroByte) {
+	EXPECT_FALSE(cw::buffer::isAllZero({}));
+	for (std::size_t size : { 1u, 7u, 8u, 255u, 256u, 257u, 4096u, 4099u }) {
+		std::vector<uint8_t> data(size, 0);
+		EXPECT_TRUE(cw::buffer::isAllZero(data)) << size;
+
+		// First word, inside a SIMD stride, and in the scalar tail
+		for (std::size_t at : { std::size_t(0), size / 2, size - 1 }) {
+			data[at] = 0x80;
+			EXPECT_FALSE(cw::buffer::isAllZero(data)) << size << " at " << at;
+			data[at] = 0;
+		}
+	}
+}
+
+TEST(ZeroChunkTest, ZeroRegionsOfDenseFilesAreNotWritten) {
+	// No holes on the sending side: 4 MB of written zeros between data
+	auto source = std::filesystem::temp_directory_path() / "cw_zeros_src.bin";
+	std::vector<uint8_t> contents(5 << 20, 0);
+	std::fill_n(contents.begin(), 300 * 1024, uint8_t(3));
+	std::fill(contents.end() - 700 * 1024, contents.end(), uint8_t(4));
+	{
+		auto file = cw::file::FileHandle::openWrite(source);
+		EXPECT_FALSE(file.writeAt(0, contents));
+	}
+	std::filesystem::remove("cw_zeros_dst.bin");
+
+	LoopbackServer loopback;
+	loopback.upload(source, "cw_zeros_dst.bin", {}, [](cw::network::Connection& conn) { EXPECT_TRUE(conn.peerTakesHoles()); });
+	loopback.runUntil([&] { return loopback.sent == 1 && std::filesystem::exists("cw_zeros_dst.bin"); });
+	ASSERT_TRUE(std::filesystem::exists("cw_zeros_dst.bin"));
+
+	std::vector<uint8_t> received(contents.size());
+	EXPECT_FALSE(cw::file::FileHandle::openRead("cw_zeros_dst.bin").readAt(0, received));
+	EXPECT_TRUE(received == contents);
+
+#if defined(__linux__)
+	struct stat info {};
+	ASSERT_EQ(::stat("cw_zeros_dst.bin", &info), 0);
+	EXPECT_LT(static_cast<uint64_t>(info.st_blocks) * 512, contents.size() / 2);
+#endif
+
+	std::filesystem::remove("cw_zeros_dst.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------
+// 44. RATE LIMITS (token bucket shared by connections, paced writes)
+// ---------------------------------------------------------
+TEST(RateLimitTest, BucketBooksBytesAtTheRate) {
+	using namespace std::chrono_literals;
+	cw::network::RateLimiter limiter(10'000'000, 100'000); // 10 MB/s, 100 KB burst
+	auto now = cw::network::RateLimiter::Clock::now();
+
+	// Within the burst nothing waits; past it each byte is booked at the rate
+	EXPECT_EQ(limiter.reserve(100'000, now), 0ns);
+	auto wait = limiter.reserve(1'000'000, now);
+	EXPECT_GE(wait, 99ms);
+	EXPECT_LE(wait, 101ms);
+
+	// Later bookings queue behind earlier ones
+	EXPECT_GE(limiter.reserve(10'000, now), wait + 999us);
+
+	// Idle time earns a single burst, not more
+	auto later = now + 10s;
+	EXPECT_EQ(limiter.reserve(100'000, later), 0ns);
+	EXPECT_GT(limiter.reserve(1'000, later), 0ns);
+
+	EXPECT_EQ(limiter.paceQuantum(), 50'000u); // 5 ms at the rate
+	limiter.setRate(0);
+	EXPECT_FALSE(limiter.limited());
+	EXPECT_EQ(limiter.reserve(1'000'000'000, later), 0ns);
+	EXPECT_EQ(limiter.paceQuantum(), 0u);
+}
+
+TEST(RateLimitTest, PoolUploadsKeepToTheSharedRate) {
+	auto source = std::filesystem::temp_directory_path() / "cw_rate_src.bin";
+	std::vector<uint8_t> contents(2 << 20);
+	for (std::size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 131 + (i >> 11));
+	{
+		auto file = cw::file::FileHandle::openWrite(source);
+		EXPECT_FALSE(file.writeAt(0, contents));
+	}
+	std::filesystem::remove("cw_rate_dst.bin");
+
+	cw::network::ClientPool::Options options;
+	options.rateLimiter = std::make_shared<cw::network::RateLimiter>(4 << 20); // 4 MB/s
+	LoopbackServer loopback(options);
+	ASSERT_EQ(loopback.pool->rateLimiter(), options.rateLimiter);
+
+	auto start = std::chrono::steady_clock::now();
+	loopback.upload(source, "cw_rate_dst.bin");
+	loopback.runUntil([&] { return loopback.sent == 1 && std::filesystem::exists("cw_rate_dst.bin"); });
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	ASSERT_TRUE(std::filesystem::exists("cw_rate_dst.bin"));
+
+	// 2 MB at 4 MB/s, less one burst: about half a second
+	EXPECT_GE(elapsed, std::chrono::milliseconds(400));
+	EXPECT_LT(elapsed, std::chrono::seconds(5));
+
+	std::vector<uint8_t> received(contents.size());
+	EXPECT_FALSE(cw::file::FileHandle::openRead("cw_rate_dst.bin").readAt(0, received));
+	EXPECT_TRUE(received == contents);
+
+	std::filesystem::remove("cw_rate_dst.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------
+// 45. PRIORITY CLASSES (weighted fair queuing of a shared connection)
+// ---------------------------------------------------------
+namespace {
+	struct ArrivalRecorder
+	{
+		std::vector<std::pair<uint32_t, uint64_t>> arrivals; // Stream, offset
+		std::size_t expected = 0;
+		asio::io_context* io = nullptr;
+
+		void onPacket(cw::network::Connection&, FileChunkView pkt)
+		{
+			arrivals.emplace_back(pkt.streamId, pkt.offset);
+			if (arrivals.size() == expected) io->stop();
+		}
+	};
+
+	// 'counts[c]' chunks of 64 KB in class c, all queued before any is written;
+	// returns the streams (1 + class) in the order the peer got them
+	std::vector<std::pair<uint32_t, uint64_t>> deliveryOrder(std::array<std::size_t, 3> counts, bool urgentLast)
+	{
+		asio::io_context io;
+		asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+		auto recorder = std::make_shared<ArrivalRecorder>();
+		recorder->expected = counts[0] + counts[1] + counts[2];
+		recorder->io = &io;
+		auto server = cw::network::Connection::create(io);
+		server->setHandler(recorder);
+		acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+		auto client = cw::network::Connection::create(io);
+		client->setWatermarks(64 << 20, 256 << 20);
+		client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+			{
+				ASSERT_FALSE(ec);
+				client->start();
+
+				FileChunk chunk;
+				chunk.data.assign(64 * 1024, 5);
+				auto queue = [&](std::size_t c)
+					{
+						for (std::size_t i = 0; i < counts[c]; ++i) {
+							chunk.streamId = static_cast<uint32_t>(1 + c);
+							chunk.offset = i * chunk.data.size();
+							client->send(chunk, static_cast<cw::network::Priority>(c));
+						}
+					};
+				queue(2);
+				queue(1);
+				if (urgentLast) queue(0);
+			});
+
+		io.run_for(std::chrono::seconds(10));
+		return recorder->arrivals;
+	}
+}
+
+TEST(PriorityTest, UrgentFramesOvertakeQueuedUploads) {
+	auto order = deliveryOrder({ 4, 0, 200 }, true);
+	ASSERT_EQ(order.size(), 204u);
+
+	// The urgent stream arrives right behind the batch already being written
+	std::size_t lastUrgent = 0;
+	for (std::size_t i = 0; i < order.size(); ++i) {
+		if (order[i].first == 1) lastUrgent = i;
+	}
+	EXPECT_LT(lastUrgent, 24u);
+
+	// Each stream still arrives in order
+	std::map<uint32_t, uint64_t> next;
+	for (const auto& [stream, offset] : order) {
+		EXPECT_EQ(offset, next[stream]) << stream;
+		next[stream] = offset + 64 * 1024;
+	}
+}
+
+TEST(PriorityTest, ClassesShareTheSocketByWeight) {
+	// Normal gets 4 for each frame of Background while both have frames queued
+	auto order = deliveryOrder({ 0, 200, 200 }, false);
+	ASSERT_EQ(order.size(), 400u);
+
+	std::size_t background = 0;
+	for (std::size_t i = 0; i < 100; ++i) background += order[i].first == 3;
+	EXPECT_GE(background, 12u);
+	EXPECT_LE(background, 30u);
+}
+
+// ---------------------------------------------------------
+// 46. SUBMISSION QUEUE (lock-free MPSC hand-off behind Connection::send)
+// ---------------------------------------------------------
+TEST(SubmissionQueueTest, ProducersKeepTheirOrderAndNothingIsLost) {
+	constexpr std::size_t PRODUCERS = 4;
+	constexpr std::uint64_t PER_PRODUCER = 200000;
+	cw::network::SubmissionQueue<std::uint64_t> queue;
+
+	std::atomic<std::size_t> running = PRODUCERS;
+	std::vector<std::thread> producers;
+	for (std::size_t p = 0; p < PRODUCERS; ++p) {
+		producers.emplace_back([&queue, &running, p]()
+			{
+				for (std::uint64_t i = 0; i < PER_PRODUCER; ++i) queue.push((std::uint64_t(p) << 32) | i);
+				running.fetch_sub(1);
+			});
+	}
+
+	// Drained while they push, in bounded batches as the connection does
+	std::array<std::uint64_t, PRODUCERS> next{};
+	std::size_t received = 0;
+	bool ordered = true;
+	auto consume = [&](std::uint64_t value)
+		{
+			auto producer = static_cast<std::size_t>(value >> 32);
+			ordered = ordered && (value & 0xFFFFFFFF) == next[producer];
+			++next[producer];
+			++received;
+		};
+	while (running.load() > 0) queue.drain(consume, 4096);
+	for (auto& producer : producers) producer.join();
+	queue.drain(consume);
+
+	EXPECT_TRUE(ordered);
+	EXPECT_EQ(received, PRODUCERS * PER_PRODUCER);
+	EXPECT_TRUE(queue.empty());
+
+	// Whatever is left when the queue goes is destroyed with it
+	auto tracked = std::make_shared<int>(1);
+	{
+		cw::network::SubmissionQueue<std::shared_ptr<int>> owning;
+		for (int i = 0; i < 10; ++i) owning.push(tracked);
+		EXPECT_EQ(tracked.use_count(), 11);
+	}
+	EXPECT_EQ(tracked.use_count(), 1);
+}
+
+// ---------------------------------------------------------
+// 47. BATCH SEND (many packets per hand-off: Connection::sendBatch)
+// ---------------------------------------------------------
+TEST(BatchSendTest, RangesRunAcrossBlocksInOrder) {
+	cw::network::SubmissionQueue<std::size_t> queue;
+	std::vector<std::size_t> values(500);
+	std::iota(values.begin(), values.end(), 1);
+
+	// Starts part way into a block, so the range is split over several
+	queue.push(0);
+	queue.pushRange(values.begin(), values.size());
+	queue.push(501);
+
+	std::vector<std::size_t> drained;
+	queue.drain([&](std::size_t value) { drained.push_back(value); });
+	ASSERT_EQ(drained.size(), 502u);
+	for (std::size_t i = 0; i < drained.size(); ++i) EXPECT_EQ(drained[i], i);
+	EXPECT_TRUE(queue.empty());
+}
+
+TEST(BatchSendTest, BatchesArriveInOrderWithSingleSends) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	auto recorder = std::make_shared<ArrivalRecorder>();
+	recorder->expected = 102;
+	recorder->io = &io;
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(recorder);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+
+			FileChunk chunk;
+			chunk.streamId = 1;
+			chunk.offset = 0;
+			chunk.data.assign(1000, 7);
+			client->send(chunk);
+
+			std::vector<FileChunk> chunks(100, chunk);
+			for (std::size_t i = 0; i < chunks.size(); ++i) chunks[i].offset = (i + 1) * 1000;
+			client->sendRange(chunks);
+
+			// One batch is counted at once, and empties for reuse
+			auto batch = client->makeBatch();
+			chunk.offset = 101 * 1000;
+			batch.add(chunk);
+			EXPECT_EQ(batch.size(), 1u);
+			std::size_t expected = client->queuedBytes() + batch.bytes();
+			client->sendBatch(batch);
+			EXPECT_EQ(client->queuedBytes(), expected);
+			EXPECT_TRUE(batch.empty());
+			EXPECT_EQ(batch.bytes(), 0u);
+		});
+
+	io.run_for(std::chrono::seconds(10));
+	ASSERT_EQ(recorder->arrivals.size(), 102u);
+	for (std::size_t i = 0; i < recorder->arrivals.size(); ++i) EXPECT_EQ(recorder->arrivals[i].second, i * 1000);
+	EXPECT_EQ(client->queuedBytes(), 0u);
+}
+
+// ---------------------------------------------------------
+// 48. DOWNLOADS (FileRequest: files under a root served back to the client)
+// ---------------------------------------------------------
+namespace {
+	asio::awaitable<void> downloadAll(std::shared_ptr<cw::network::Connection> conn, std::vector<uint64_t>* received, std::error_code* refused, bool* done)
+	{
+		received->push_back(co_await cw::asyncDownloadFile(conn, "sub/data.bin", "cw_dl_whole.bin"));
+		received->push_back(co_await cw::asyncDownloadFile(conn, "sub/data.bin", "cw_dl_range.bin", 1000000, 500000));
+		try {
+			co_await cw::asyncDownloadFile(conn, "../cw_download_outside.bin", "cw_dl_refused.bin");
+		}
+		catch (const std::system_error& e) {
+			*refused = e.code();
+		}
+		*done = true;
+	}
+}
+
+TEST(DownloadTest, WholeFilesAndRangesComeBackVerified) {
+	auto temp = std::filesystem::temp_directory_path();
+	auto root = temp / "cw_download_root";
+	std::filesystem::create_directories(root / "sub");
+	std::vector<uint8_t> contents(3 << 20);
+	for (std::size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 31 + (i >> 12));
+	{
+		std::ofstream(root / "sub" / "data.bin", std::ios::binary).write(reinterpret_cast<const char*>(contents.data()), contents.size());
+		std::ofstream(temp / "cw_download_outside.bin") << "not served";
+	}
+	for (const char* name : { "cw_dl_whole.bin", "cw_dl_range.bin", "cw_dl_refused.bin" }) std::filesystem::remove(name);
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	server.setDownloadRoots({ root });
+
+	std::vector<uint64_t> received;
+	std::error_code refused;
+	bool done = false;
+	auto conn = cw::network::Connection::create(io);
+	conn->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()),
+		[&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			conn->start();
+			asio::co_spawn(io, downloadAll(conn, &received, &refused, &done), asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!done && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_TRUE(done);
+
+	ASSERT_EQ(received.size(), 2u);
+	EXPECT_EQ(received[0], contents.size());
+	EXPECT_EQ(received[1], 500000u);
+
+	EXPECT_TRUE(readBytes("cw_dl_whole.bin") == contents);
+	EXPECT_TRUE(readBytes("cw_dl_range.bin") == std::vector<uint8_t>(contents.begin() + 1000000, contents.begin() + 1500000));
+
+	// Outside the root: refused, nothing written
+	EXPECT_EQ(refused, std::errc::no_such_file_or_directory);
+	EXPECT_FALSE(std::filesystem::exists("cw_dl_refused.bin"));
+
+	for (const char* name : { "cw_dl_whole.bin", "cw_dl_range.bin" }) std::filesystem::remove(name);
+	std::filesystem::remove_all(root);
+	std::filesystem::remove(temp / "cw_download_outside.bin");
+}
+
+// ---------------------------------------------------------
+// 49. PARALLEL DOWNLOADS (slices of one file over several connections)
+// ---------------------------------------------------------
+namespace {
+	asio::awaitable<void> downloadSliced(std::vector<std::shared_ptr<cw::network::Connection>> conns, std::vector<uint64_t>* received, bool* done)
+	{
+		received->push_back(co_await cw::asyncDownloadFileParallel(conns, "data.bin", "cw_pdl_whole.bin"));
+		received->push_back(co_await cw::asyncDownloadFileParallel(conns, "data.bin", "cw_pdl_range.bin", 100001, 2000000));
+		*done = true;
+	}
+}
+
+TEST(ParallelDownloadTest, SlicesFillOneFile) {
+	auto root = std::filesystem::temp_directory_path() / "cw_parallel_download_root";
+	std::filesystem::create_directories(root);
+	std::vector<uint8_t> contents((5 << 20) + 7);
+	for (std::size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 17 + (i >> 10));
+	std::ofstream(root / "data.bin", std::ios::binary).write(reinterpret_cast<const char*>(contents.data()), contents.size());
+	for (const char* name : { "cw_pdl_whole.bin", "cw_pdl_range.bin" }) std::filesystem::remove(name);
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	server.setDownloadRoots({ root });
+
+	std::vector<uint64_t> received;
+	bool done = false;
+	std::vector<std::shared_ptr<cw::network::Connection>> conns;
+	std::size_t connected = 0;
+	for (int i = 0; i < 3; ++i) {
+		auto conn = cw::network::Connection::create(io);
+		conns.push_back(conn);
+		conn->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()),
+			[&, conn](std::error_code ec)
+			{
+				ASSERT_FALSE(ec);
+				conn->start();
+				if (++connected == 3) asio::co_spawn(io, downloadSliced(conns, &received, &done), asio::detached);
+			});
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!done && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_TRUE(done);
+
+	ASSERT_EQ(received.size(), 2u);
+	EXPECT_EQ(received[0], contents.size());
+	EXPECT_EQ(received[1], 2000000u);
+
+	EXPECT_TRUE(readBytes("cw_pdl_whole.bin") == contents);
+	EXPECT_TRUE(readBytes("cw_pdl_range.bin") == std::vector<uint8_t>(contents.begin() + 100001, contents.begin() + 2100001));
+
+	for (auto& conn : conns) conn->shutdown();
+	for (const char* name : { "cw_pdl_whole.bin", "cw_pdl_range.bin" }) std::filesystem::remove(name);
+	std::filesystem::remove_all(root);
+}
+
+// ---------------------------------------------------------
+// 50. FILE RELAY (received files passed on to the next server)
+// ---------------------------------------------------------
+TEST(FileRelayTest, ReceivedFileIsPassedOn) {
+	auto path = std::filesystem::temp_directory_path() / "cw_relay_source.bin";
+	std::vector<uint8_t> bytes(2 * 1024 * 1024 + 77);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + (i >> 11));
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	std::filesystem::remove_all("cw_relay");
+
+	asio::io_context io;
+
+	// The next hop keeps what it is relayed in memory
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	std::vector<cw::network::MemoryReceiver::File> relayed;
+	auto nextHop = cw::network::Connection::create(io);
+	nextHop->setHandler(std::make_shared<cw::network::MemoryReceiver>([&](cw::network::MemoryReceiver::File file)
+		{
+			relayed.push_back(std::move(file));
+			io.stop();
+		}));
+	acceptor.async_accept(nextHop->socket(), [nextHop](std::error_code ec) { if (!ec) nextHop->start(); });
+
+	auto relay = std::make_shared<cw::FileRelay>();
+	cw::network::Server server(io, 0);
+	server.setFileRelay(relay);
+
+	auto toNextHop = cw::network::Connection::create(io);
+	toNextHop->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			toNextHop->start();
+			relay->addNextHop(toNextHop);
+
+			auto client = cw::network::Connection::create(io);
+			client->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()),
+				[&, client](std::error_code ec)
+				{
+					ASSERT_FALSE(ec);
+					client->start();
+					asio::co_spawn(io, cw::asyncSendFile(client, path, "cw_relay/model.bin"), asio::detached);
+				});
+		});
+
+	io.run_for(std::chrono::seconds(10));
+
+	EXPECT_EQ(relay->nextHopCount(), 1u);
+	ASSERT_EQ(relayed.size(), 1u);
+	EXPECT_EQ(relayed[0].name, "cw_relay/model.bin");
+	EXPECT_EQ(relayed[0].data, bytes);
+
+	// Kept here too: a relay is a full copy that passes files on
+	std::ifstream in("cw_relay/model.bin", std::ios::binary);
+	EXPECT_TRUE(std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {}) == bytes);
+
+	std::filesystem::remove_all("cw_relay");
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// 51. FORWARDING (received streams passed on chunk by chunk, not stored)
+// ---------------------------------------------------------------------------
+TEST(ForwardingTest, ForwardOnlyHopStoresNothing) {
+	auto path = std::filesystem::temp_directory_path() / "cw_forward_source.bin";
+	std::vector<uint8_t> bytes(3 * 1024 * 1024 + 501);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 29 + (i >> 13));
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	std::filesystem::remove_all("cw_forward");
+
+	asio::io_context io;
+
+	// The next hop keeps what it is passed in memory
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	std::vector<cw::network::MemoryReceiver::File> forwarded;
+	auto nextHop = cw::network::Connection::create(io);
+	nextHop->setHandler(std::make_shared<cw::network::MemoryReceiver>([&](cw::network::MemoryReceiver::File file)
+		{
+			forwarded.push_back(std::move(file));
+		}));
+	acceptor.async_accept(nextHop->socket(), [nextHop](std::error_code ec) { if (!ec) nextHop->start(); });
+
+	cw::network::Server server(io, 0);
+
+	bool sent = false;
+	auto downstream = cw::network::Connection::create(io);
+	downstream->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			downstream->start();
+			downstream->asyncWaitCapabilities([&](std::error_code ec)
+				{
+					ASSERT_FALSE(ec);
+					server.setForwarding(downstream, cw::network::ForwardMode::ForwardOnly);
+
+					auto client = cw::network::Connection::create(io);
+					client->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()),
+						[&, client](std::error_code ec)
+						{
+							ASSERT_FALSE(ec);
+							client->start();
+							asio::co_spawn(io, cw::asyncSendFile(client, path, "cw_forward/model.bin"),
+								[&](std::exception_ptr error)
+								{
+									EXPECT_FALSE(error);
+									sent = true;
+								});
+						});
+				});
+		});
+
+	io.run_for(std::chrono::milliseconds(200));
+	for (int i = 0; i < 100 && (forwarded.empty() || !sent); ++i) io.run_for(std::chrono::milliseconds(100));
+
+	ASSERT_EQ(forwarded.size(), 1u);
+	EXPECT_EQ(forwarded[0].name, "cw_forward/model.bin");
+	EXPECT_EQ(forwarded[0].data, bytes);
+	EXPECT_TRUE(sent);
+
+	// Passed through, never landed here
+	EXPECT_FALSE(std::filesystem::exists("cw_forward"));
+
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// 52. STREAM RECEIVER (chunks handed to code as they arrive, with backpressure)
+// ---------------------------------------------------------------------------
+TEST(StreamReceiverTest, ConsumerHoldingBuffersPausesReading) {
+	auto path = std::filesystem::temp_directory_path() / "cw_stream_source.bin";
+	std::vector<uint8_t> bytes(4 * 1024 * 1024 + 123);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 7 + (i >> 12));
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	// Keeps every buffer it is handed until told to let go
+	constexpr std::size_t maxHeld = 512 * 1024;
+	std::vector<cw::network::StreamReceiver::Event> held;
+	std::optional<std::error_code> ended;
+	auto receiver = std::make_shared<cw::network::StreamReceiver>([&](cw::network::StreamReceiver::Event event)
+		{
+			if (event.kind == cw::network::StreamReceiver::Event::Kind::End) ended = event.error;
+			else held.push_back(std::move(event));
+		}, maxHeld);
+
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(receiver);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, cw::asyncSendFile(client, path, "streamed.bin"), asio::detached);
+		});
+
+	io.run_for(std::chrono::milliseconds(500));
+
+	// Reading stopped once the consumer sat on more than the limit
+	EXPECT_FALSE(ended);
+	EXPECT_GT(receiver->heldBytes(), maxHeld);
+	EXPECT_LT(receiver->heldBytes(), maxHeld + cw::packet::MAX_CHUNK_SIZE);
+
+	// Draining the buffers lets the rest in
+	std::vector<uint8_t> received(bytes.size());
+	auto drain = [&]()
+		{
+			for (auto& event : held) {
+				if (event.kind != cw::network::StreamReceiver::Event::Kind::Data) continue;
+				std::copy(event.data.span().begin(), event.data.span().end(), received.begin() + static_cast<std::ptrdiff_t>(event.offset));
+			}
+			held.clear();
+		};
+	for (int i = 0; i < 200 && !ended; ++i) {
+		drain();
+		io.run_for(std::chrono::milliseconds(20));
+	}
+	drain();
+
+	ASSERT_TRUE(ended);
+	EXPECT_FALSE(*ended);
+	EXPECT_EQ(receiver->heldBytes(), 0u);
+	EXPECT_TRUE(received == bytes);
+
+	std::filesystem::remove(path);
+}
+
+TEST(StreamReceiverTest, DeliversToCoroutineChannel) {
+	auto path = std::filesystem::temp_directory_path() / "cw_stream_channel.bin";
+	std::vector<uint8_t> bytes(1024 * 1024 + 9);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i ^ (i >> 9));
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	// One event at a time: the connection waits on the consumer
+	auto channel = std::make_shared<cw::network::StreamReceiver::Channel>(io, 1);
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(std::make_shared<cw::network::StreamReceiver>(channel));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	std::string name;
+	std::vector<uint8_t> received;
+	std::optional<std::error_code> ended;
+	asio::co_spawn(io, [&]() -> asio::awaitable<void>
+		{
+			for (;;) {
+				auto event = co_await channel->async_receive(asio::use_awaitable);
+				if (event.kind == cw::network::StreamReceiver::Event::Kind::Begin) {
+					name = event.name;
+					received.resize(static_cast<size_t>(event.fileSize));
+				}
+				else if (event.kind == cw::network::StreamReceiver::Event::Kind::Data) {
+					std::copy(event.data.span().begin(), event.data.span().end(), received.begin() + static_cast<std::ptrdiff_t>(event.offset));
+				}
+				else {
+					ended = event.error;
+					io.stop();
+					co_return;
+				}
+			}
+		}, asio::detached);
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, cw::asyncSendFile(client, path, "channel.bin"), asio::detached);
+		});
+
+	io.run_for(std::chrono::seconds(10));
+
+	ASSERT_TRUE(ended);
+	EXPECT_FALSE(*ended);
+	EXPECT_EQ(name, "channel.bin");
+	EXPECT_TRUE(received == bytes);
+
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// 53. STREAM UPLOADS (sources of unknown length, sized by their FileDone)
+// ---------------------------------------------------------------------------
+TEST(StreamUploadTest, DigestOfUnknownSizeMatchesWholeStream) {
+	std::vector<uint8_t> bytes(300 * 1000 + 17);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 31 + (i >> 7));
+
+	// Chunks out of order, then trailing zeros the stream ends with
+	std::vector<std::pair<size_t, size_t>> chunks = { { 65536, 65536 }, { 0, 65536 }, { 200000, 100017 }, { 131072, 68928 } };
+	cw::integrity::FileDigest digest(cw::integrity::FileDigest::UNKNOWN_SIZE);
+	for (auto [offset, length] : chunks) {
+		digest.add(offset, length, cw::integrity::crc32c(std::span<const uint8_t>(bytes.data() + offset, length)));
+	}
+	std::vector<uint8_t> padded = bytes;
+	padded.resize(bytes.size() + 4096, 0);
+	digest.setFileSize(padded.size());
+
+	EXPECT_EQ(digest.value(), cw::integrity::crc32c(padded));
+}
+
+#if defined(ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+TEST(StreamUploadTest, PipeIsPublishedWithoutKnownSize) {
+	std::vector<uint8_t> bytes(2 * 1024 * 1024 + 4321);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 11 + (i >> 10));
+	std::filesystem::remove_all("cw_streamed");
+
+	int fds[2];
+	ASSERT_EQ(::pipe(fds), 0);
+
+	// The producer writes in odd pieces, then closes its end
+	std::thread producer([&bytes, fd = fds[1]]()
+		{
+			for (size_t done = 0; done < bytes.size();) {
+				size_t piece = std::min<size_t>(bytes.size() - done, 70001);
+				ssize_t written = ::write(fd, bytes.data() + done, piece);
+				if (written <= 0) break;
+				done += static_cast<size_t>(written);
+			}
+			::close(fd);
+		});
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	asio::posix::stream_descriptor source(io, fds[0]);
+
+	std::optional<uint64_t> sent;
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, cw::asyncSendStream(client, source, "cw_streamed/dump.bin"),
+				[&](std::exception_ptr error, uint64_t bytesSent)
+				{
+					EXPECT_FALSE(error);
+					sent = bytesSent;
+				});
+		});
+
+	auto published = [&]() { std::error_code ec; return std::filesystem::file_size("cw_streamed/dump.bin", ec) == bytes.size(); };
+	for (int i = 0; i < 100 && !(sent && published()); ++i) io.run_for(std::chrono::milliseconds(50));
+	producer.join();
+
+	EXPECT_EQ(sent, bytes.size());
+	std::ifstream in("cw_streamed/dump.bin", std::ios::binary);
+	EXPECT_TRUE(std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {}) == bytes);
+
+	std::filesystem::remove_all("cw_streamed");
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// 54. ARCHIVE STREAMS (small files packed into one stream, unpacked in batches)
+// ---------------------------------------------------------------------------
+TEST(ArchiveTest, UnpackerParsesMembersAcrossChunksInAnyOrder) {
+	std::vector<uint8_t> stream;
+	auto append = [&stream](const std::vector<uint8_t>& bytes) { stream.insert(stream.end(), bytes.begin(), bytes.end()); };
+	std::vector<uint8_t> big(5000, 7), small = { 1, 2, 3 };
+	append(cw::file::archiveHeader("a/big.bin", big.size()));
+	append(big);
+	append(cw::file::archiveHeader("empty.txt", 0));
+	append(cw::file::archiveHeader("b/small.bin", small.size()));
+	append(small);
+	append(cw::file::archiveHeader({}, 0));
+
+	// Cut mid-header and mid-member; the second piece comes last, and twice
+	auto piece = [&stream](size_t from, size_t to)
+		{
+			return cw::buffer::SharedBuffer::fromVector(std::vector<uint8_t>(stream.begin() + from, stream.begin() + to));
+		};
+	size_t cutA = 5, cutB = 3000;
+	cw::file::ArchiveUnpacker unpacker;
+	EXPECT_TRUE(unpacker.add(0, piece(0, cutA)));
+	EXPECT_TRUE(unpacker.add(cutB, piece(cutB, stream.size())));
+	EXPECT_EQ(unpacker.received(), cutA);
+	EXPECT_TRUE(unpacker.add(cutA, piece(cutA, cutB)));
+	EXPECT_FALSE(unpacker.add(cutA, piece(cutA, cutB)));
+	EXPECT_EQ(unpacker.received(), stream.size());
+	EXPECT_TRUE(unpacker.ended());
+	EXPECT_EQ(unpacker.bufferedBytes(), 0u);
+
+	auto members = unpacker.takeReady();
+	ASSERT_EQ(members.size(), 3u);
+	EXPECT_EQ(members[0].path, std::filesystem::path("a/big.bin"));
+	EXPECT_TRUE(std::ranges::equal(members[0].data.span(), big));
+	EXPECT_TRUE(members[1].data.empty());
+	EXPECT_TRUE(std::ranges::equal(members[2].data.span(), small));
+
+	// Nothing may follow the end marker
+	cw::file::ArchiveUnpacker trailing;
+	auto bad = cw::file::archiveHeader({}, 0);
+	bad.push_back(0);
+	EXPECT_THROW(trailing.add(0, cw::buffer::SharedBuffer::fromVector(std::move(bad))), std::runtime_error);
+}
+
+static asio::awaitable<void> uploadArchive(std::shared_ptr<cw::network::Connection> conn, std::filesystem::path root, bool* done)
+{
+	co_await conn->asyncWaitCapabilities(asio::use_awaitable);
+	EXPECT_TRUE(conn->peerTakesArchives());
+
+	// Small chunks: members span them and straddle their ends
+	cw::TransferOptions options;
+	options.chunkSize = 16 * 1024;
+	cw::DirectoryUploadOptions uploadOptions;
+	uploadOptions.archive = true;
+	uploadOptions.workers = 2;
+	std::vector<std::shared_ptr<cw::network::Connection>> conns{ conn };
+	co_await cw::asyncUploadDirectory(conns, root, options, uploadOptions);
+	*done = true;
+}
+
+TEST(ArchiveTest, DirectoryOfSmallFilesArrivesAsArchive) {
+	auto source = std::filesystem::temp_directory_path() / "cw_archive_src";
+	std::filesystem::remove_all(source);
+	std::filesystem::remove_all("cw_archive");
+	std::filesystem::create_directories(source / "cw_archive" / "sub");
+
+	std::vector<std::pair<std::string, std::string>> files;
+	for (int i = 0; i < 200; ++i) {
+		std::string name = (i % 3 ? "cw_archive/sub/f" : "cw_archive/f") + std::to_string(i) + ".txt";
+		std::string contents(static_cast<size_t>(i * 97 % 40000), static_cast<char>('a' + i % 26));
+		std::ofstream(source / name, std::ios::binary) << contents;
+		files.emplace_back(name, contents);
+	}
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	auto client = cw::network::Connection::create(io);
+
+	bool done = false;
+	client->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, uploadArchive(client, source, &done), asio::detached);
+		});
+
+	auto arrived = [&files]()
+		{
+			for (const auto& [name, contents] : files) {
+				std::error_code ec;
+				if (std::filesystem::file_size(name, ec) != contents.size() || ec) return false;
+			}
+			return true;
+		};
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!(done && arrived()) && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	EXPECT_TRUE(done);
+
+	for (const auto& [name, contents] : files) {
+		std::ifstream in(name, std::ios::binary);
+		EXPECT_EQ(std::string(std::istreambuf_iterator<char>(in), {}), contents) << name;
+	}
+
+	std::filesystem::remove_all("cw_archive");
+	std::filesystem::remove_all(source);
+}
+
+// ---------------------------------------------------------------------------
+// 55. NUMA PLACEMENT (sysfs topology, per-node buffer depots, pinned disk threads)
+// ---------------------------------------------------------------------------
+TEST(NumaTest, ParsesCpuLists) {
+	EXPECT_EQ(cw::numa::parseCpuList("0-3,8,10-11\n"), (std::vector<std::size_t>{ 0, 1, 2, 3, 8, 10, 11 }));
+	EXPECT_EQ(cw::numa::parseCpuList("5"), (std::vector<std::size_t>{ 5 }));
+	EXPECT_TRUE(cw::numa::parseCpuList("").empty());
+	EXPECT_TRUE(cw::numa::parseCpuList("3-1").empty());
+	EXPECT_TRUE(cw::numa::parseCpuList("a-b").empty());
+}
+
+TEST(NumaTest, BlocksAreOnlyReusedOnTheirNode) {
+	auto& pool = cw::buffer::BufferPool::instance();
+	constexpr size_t SIZE = 3 * 1024 * 1024; // A class no other test uses
+
+	// Freed by a thread of node 3: its exit spills the block to node 3's depot
+	const uint8_t* freed = nullptr;
+	auto onNode = [](int node, auto fn) { std::thread([node, &fn]() { cw::buffer::BufferPool::setThreadNode(node); fn(); }).join(); };
+	onNode(3, [&]() { cw::buffer::PooledBuffer buffer(SIZE); freed = buffer.data(); });
+
+	auto before = pool.stats();
+	onNode(5, [&]() { cw::buffer::PooledBuffer buffer(SIZE); EXPECT_NE(buffer.data(), freed); });
+	EXPECT_EQ(pool.stats().heapAllocations, before.heapAllocations + 1);
+	EXPECT_EQ(pool.stats().reused, before.reused);
+
+	onNode(3, [&]() { cw::buffer::PooledBuffer buffer(SIZE); EXPECT_EQ(buffer.data(), freed); });
+	EXPECT_EQ(pool.stats().reused, before.reused + 1);
+}
+
+TEST(NumaTest, DiskWriterRunsOnEveryThreadOnce) {
+	cw::file::DiskWriter writer(4);
+	std::mutex mutex;
+	std::set<std::thread::id> threads;
+	int runs = 0;
+	writer.runOnEachThread([&]()
+		{
+			std::lock_guard lock(mutex);
+			threads.insert(std::this_thread::get_id());
+			++runs;
+		});
+	EXPECT_EQ(runs, 4);
+	EXPECT_EQ(threads.size(), 4u);
+}
+
+// ---------------------------------------------------------------------------
+// 56. HUGE PAGES (buffer pool blocks carved from one huge-page arena)
+// ---------------------------------------------------------------------------
+TEST(HugePageArenaTest, HandsOutAlignedBlocksUntilFull) {
+	cw::buffer::HugePageArena arena(3 * 1024 * 1024);
+	EXPECT_EQ(arena.size(), 2 * cw::buffer::HugePageArena::HUGE_PAGE_SIZE);
+	EXPECT_EQ(reinterpret_cast<std::uintptr_t>(arena.region().data()) % cw::buffer::HugePageArena::HUGE_PAGE_SIZE, 0u);
+
+	std::vector<void*> blocks;
+	while (void* block = arena.take(1000 * 1000 + 1)) {
+		EXPECT_EQ(reinterpret_cast<std::uintptr_t>(block) % cw::buffer::HugePageArena::BLOCK_ALIGNMENT, 0u);
+		EXPECT_TRUE(arena.owns(block));
+		std::memset(block, 0xab, 1000 * 1000 + 1);
+		blocks.push_back(block);
+	}
+	EXPECT_EQ(blocks.size(), 4u);
+	EXPECT_FALSE(arena.owns(&blocks));
+	EXPECT_LE(arena.used(), arena.size());
+}
+
+TEST(HugePageArenaTest, PoolTakesColdBlocksFromTheArena) {
+	auto& pool = cw::buffer::BufferPool::instance();
+	pool.useHugePages(16 * 1024 * 1024);
+	ASSERT_NE(pool.hugePages(), nullptr);
+
+	// A node whose depot is empty: the block is new, so it comes from the arena,
+	// and back in the depot it stays pooled
+	auto before = pool.stats();
+	const uint8_t* first = nullptr;
+	std::thread([&]()
+		{
+			cw::buffer::BufferPool::setThreadNode(6);
+			cw::buffer::PooledBuffer buffer(3 * 1024 * 1024);
+			first = buffer.data();
+			EXPECT_TRUE(pool.hugePages()->owns(buffer.data()));
+		}).join();
+	EXPECT_EQ(pool.stats().heapAllocations, before.heapAllocations);
+
+	std::thread([&]()
+		{
+			cw::buffer::BufferPool::setThreadNode(6);
+			cw::buffer::PooledBuffer buffer(3 * 1024 * 1024);
+			EXPECT_EQ(buffer.data(), first);
+		}).join();
+}
+
+// ---------------------------------------------------------------------------
+// 57. PMR PACKETS (packets and frames built in a std::pmr arena)
+// ---------------------------------------------------------------------------
+TEST(PmrPacketTest, ArenaPacketsFrameLikeDefaultOnes) {
+	alignas(std::max_align_t) std::array<std::byte, 8192> storage;
+	std::pmr::monotonic_buffer_resource arena(storage.data(), storage.size(), std::pmr::null_memory_resource());
+	auto inArena = [&](const void* p)
+		{
+			auto* byte = static_cast<const std::byte*>(p);
+			return byte >= storage.data() && byte < storage.data() + storage.size();
+		};
+
+	cw::packet::pmr::FileInfo info{ .streamId = 3, .fileSize = 42, .fileName = { "a/rather/long/file/name/beyond/sso.bin", &arena } };
+	FileInfo plain{ .streamId = 3, .fileSize = 42, .fileName = "a/rather/long/file/name/beyond/sso.bin" };
+	EXPECT_TRUE(inArena(info.fileName.data()));
+
+	auto frame = buildFrame(info, std::pmr::polymorphic_allocator<uint8_t>(&arena));
+	EXPECT_TRUE(inArena(frame.data()));
+	auto expected = buildFrame(plain);
+	EXPECT_TRUE(std::equal(frame.begin(), frame.end(), expected.begin(), expected.end()));
+
+	auto decoded = cw::packet::pmr::FileInfo::deserialize(expected.data() + FRAME_HEADER_SIZE, expected.size() - FRAME_HEADER_SIZE, &arena);
+	EXPECT_EQ(decoded.fileName, info.fileName);
+	EXPECT_TRUE(inArena(decoded.fileName.data()));
+}
+
+TEST(PmrPacketTest, ChunkAndErrorDecodeIntoTheArena) {
+	alignas(std::max_align_t) std::array<std::byte, 4096> storage;
+	std::pmr::monotonic_buffer_resource arena(storage.data(), storage.size(), std::pmr::null_memory_resource());
+
+	FileChunk chunk{ .streamId = 1, .offset = 512, .data = std::vector<uint8_t>(300, 0x5a), .crc = 7u };
+	auto chunkFrame = buildFrame(chunk);
+	auto decoded = cw::packet::pmr::FileChunk::deserialize(chunkFrame.data() + FRAME_HEADER_SIZE, chunkFrame.size() - FRAME_HEADER_SIZE, &arena);
+	EXPECT_EQ(decoded.offset, 512u);
+	EXPECT_EQ(decoded.crc, 7u);
+	EXPECT_TRUE(std::equal(decoded.data.begin(), decoded.data.end(), chunk.data.begin(), chunk.data.end()));
+	EXPECT_EQ(decoded.data.get_allocator().resource(), &arena);
+
+	// As a payload segment the bytes are shared, not copied
+	const uint8_t* bytes = decoded.data.data();
+	EXPECT_EQ(decoded.takePayloadSegment().data(), bytes);
+
+	Error error{ 2, "checksum mismatch on a chunk beyond the small string buffer" };
+	auto errorFrame = buildFrame(error);
+	auto decodedError = cw::packet::pmr::Error::deserialize(errorFrame.data() + FRAME_HEADER_SIZE, errorFrame.size() - FRAME_HEADER_SIZE, &arena);
+	EXPECT_EQ(decodedError.code, 2);
+	EXPECT_EQ(std::string_view(decodedError.message), error.message);
+	EXPECT_EQ(decodedError.message.get_allocator().resource(), &arena);
+}
+
+// ---------------------------------------------------------------------------
+// 58. FILEINFO VIEWS (names decoded in place, sender names built in a reused buffer)
+// ---------------------------------------------------------------------------
+TEST(FileInfoViewTest, NamePointsIntoTheReceiveBuffer) {
+	FileInfo info{ .streamId = 9, .fileSize = 1234, .fileName = "photos/2024/a-long-enough-name.jpg" };
+	auto frame = buildFrame(info);
+
+	auto view = FileInfoView::deserialize(frame.data() + FRAME_HEADER_SIZE, frame.size() - FRAME_HEADER_SIZE);
+	EXPECT_EQ(view.streamId, 9u);
+	EXPECT_EQ(view.fileSize, 1234u);
+	EXPECT_EQ(view.fileName, info.fileName);
+	EXPECT_GE(reinterpret_cast<const uint8_t*>(view.fileName.data()), frame.data());
+	EXPECT_LT(reinterpret_cast<const uint8_t*>(view.fileName.data()), frame.data() + frame.size());
+
+	// Passed on as is, it frames like the owning packet
+	EXPECT_EQ(buildFrame(view), frame);
+	static_assert(std::same_as<ReceivedAs<FileInfo>::type, FileInfoView>);
+
+	auto truncated = frame;
+	truncated.pop_back();
+	EXPECT_THROW(FileInfoView::deserialize(truncated.data() + FRAME_HEADER_SIZE, truncated.size() - FRAME_HEADER_SIZE), std::runtime_error);
+}
+
+TEST(FileInfoViewTest, RemoteNameReusesTheWorkerBuffer) {
+	std::string name;
+	name.reserve(256);
+	const char* storage = name.data();
+
+	cw::detail::remoteNameInto(name, "/src/root/sub/dir/file.txt", std::filesystem::path("sub") / "dir" / "file.txt");
+	EXPECT_EQ(name, "sub/dir/file.txt");
+	cw::detail::remoteNameInto(name, "/src/root/other.bin", "");
+	EXPECT_EQ(name, "other.bin");
+	EXPECT_EQ(name.data(), storage);
+
+	EXPECT_EQ(cw::detail::remoteNameFor("/src/root/other.bin", ""), "other.bin");
+	EXPECT_EQ(cw::detail::remoteNameFor("/src/x", "given\\name"), "given/name");
+}
+
+// ---------------------------------------------------------------------------
+// 59. WIRE LAYOUTS (fixed packets serialized from compile-time schemas)
+// ---------------------------------------------------------------------------
+TEST(WireLayoutTest, SizesAndOffsetsAreCompileTimeConstants) {
+	static_assert(Ack::payloadSize() == 12);
+	static_assert(FileDone::Layout::OFFSETS == std::array<std::size_t, 3>{ 0, 4, 12 });
+	static_assert(FileDone::payloadSize() == 12 + CHECKSUM_FIELD_SIZE);
+	static_assert(ChunkHeader::Layout::SIZE == 21);
+	static_assert(fixedFrameSize<Ack>() == FRAME_HEADER_SIZE + 12);
+	static_assert(fixedFrameSize<Ack>(FrameFormat::Compact) == 3 + 12);
+	static_assert(FixedFrameBuildable<Retransmit> && !FixedFrameBuildable<FileChunk>);
+
+	Ack ack;
+	ack.streamId = 0x01020304;
+	ack.offset = 0x05060708090a0b0c;
+	auto frame = buildFrame(ack);
+	ASSERT_EQ(frame.size(), fixedFrameSize<Ack>());
+	const std::vector<uint8_t> payload = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+	EXPECT_TRUE(std::equal(payload.begin(), payload.end(), frame.begin() + FRAME_HEADER_SIZE));
+}
+
+TEST(WireLayoutTest, FixedPacketsRoundTripAndValidate) {
+	FileDone done;
+	done.streamId = 7;
+	done.fileSize = 1ull << 40;
+	done.crc = 0xdeadbeef;
+	auto frame = buildFrame(done);
+	auto decoded = FileDone::deserialize(frame.data() + FRAME_HEADER_SIZE, frame.size() - FRAME_HEADER_SIZE);
+	EXPECT_EQ(decoded.streamId, 7u);
+	EXPECT_EQ(decoded.fileSize, 1ull << 40);
+	EXPECT_EQ(decoded.crc, 0xdeadbeefu);
+
+	done.crc.reset();
+	frame = buildFrame(done);
+	EXPECT_FALSE(FileDone::deserialize(frame.data() + FRAME_HEADER_SIZE, frame.size() - FRAME_HEADER_SIZE).crc);
+	EXPECT_THROW(FileDone::deserialize(frame.data() + FRAME_HEADER_SIZE, FileDone::payloadSize() - 1), std::runtime_error);
+
+	// validate() runs on both ends
+	Retransmit tooLong;
+	tooLong.streamId = 1;
+	tooLong.length = static_cast<uint32_t>(MAX_CHUNK_SIZE + 1);
+	EXPECT_THROW(buildFrame(tooLong), std::runtime_error);
+	std::array<uint8_t, Retransmit::Layout::SIZE> bytes{};
+	Retransmit::Layout::write(tooLong, bytes.data());
+	EXPECT_THROW(Retransmit::deserialize(bytes.data(), bytes.size()), std::runtime_error);
+
+	// Header layouts keep the chunk wire format
+	FileChunk chunk{ .streamId = 3, .offset = 99, .data = { 1, 2, 3 }, .crc = 5u };
+	auto chunkFrame = buildFrame(chunk);
+	auto view = FileChunkView::deserialize(chunkFrame.data() + FRAME_HEADER_SIZE, chunkFrame.size() - FRAME_HEADER_SIZE);
+	EXPECT_EQ(view.offset, 99u);
+	EXPECT_EQ(view.crc, 5u);
+	EXPECT_TRUE(std::equal(view.data.begin(), view.data.end(), chunk.data.begin(), chunk.data.end()));
+}
+
+// Claims a byte more than serialize() writes
+struct MisSizedPacket
+{
+	static constexpr PacketType type = PacketType::Ack;
+	std::size_t payloadSize() const { return 5; }
+	void serialize(cw::binary::ByteWriter& out) const { out.write<uint32_t>(7); }
+};
+
+TEST(WireLayoutTest, SizeThatDisagreesWithSerializeIsCaught) {
+	// The frame is sized once from payloadSize(): a debug build stops on a
+	// packet that then writes a different number of bytes
+	GTEST_FLAG_SET(death_test_style, "threadsafe");
+	EXPECT_DEBUG_DEATH(buildFrame(MisSizedPacket{}), "payloadSize\\(\\) disagrees with serialize\\(\\)");
+	EXPECT_DEBUG_DEATH(buildFrame(MisSizedPacket{}, FrameFormat::Compact), "payloadSize\\(\\) disagrees");
+}
+
+// ---------------------------------------------------------------------------
+// 60. READ-AHEAD (the disk reads ahead of the chunk on the wire)
+// ---------------------------------------------------------------------------
+TEST(ReadAheadTest, ChunksAreUnchangedInEveryMode) {
+	auto path = std::filesystem::temp_directory_path() / "cw_read_ahead.bin";
+	std::vector<uint8_t> contents(3 * 1024 * 1024 + 123);
+	for (size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 31 + (i >> 12));
+	{
+		std::ofstream out(path, std::ios::binary);
+		out.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+	}
+
+	for (auto mode : { cw::file::ReadMode::Stream, cw::file::ReadMode::MemoryMap }) {
+		cw::file::ChunkSource source(path, mode);
+		source.seek(1000);
+		source.setReadAhead(4 * 256 * 1024);
+
+		std::vector<uint8_t> read(contents.begin(), contents.begin() + 1000);
+		while (true) {
+			auto chunk = source.next(256 * 1024);
+			if (chunk.empty()) break;
+			read.insert(read.end(), chunk.data(), chunk.data() + chunk.size());
+		}
+		EXPECT_EQ(read, contents);
+	}
+
+	// Advice past the end of the file is harmless
+	cw::file::FileHandle::openRead(path).prefetch(contents.size(), 1024 * 1024);
+
+	cw::TransferOptions options;
+	options.chunkSize = 128 * 1024;
+	options.readAheadChunks = 3;
+	EXPECT_EQ(cw::detail::readAheadBytes(options), 3u * 128 * 1024);
+	options.adaptiveChunkSize = true;
+	EXPECT_EQ(cw::detail::readAheadBytes(options), 3 * options.maxChunkSize);
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// 61. DIRECT I/O (huge files read and written past the page cache)
+// ---------------------------------------------------------------------------
+TEST(DirectIoTest, AlignedBuffersAndShortReads) {
+	for (size_t size : { size_t(1), size_t(4096), size_t(256 * 1024 + 7) }) {
+		cw::buffer::PooledBuffer buffer(size, cw::file::DIRECT_IO_ALIGNMENT);
+		EXPECT_EQ(buffer.size(), size);
+		EXPECT_EQ(reinterpret_cast<std::uintptr_t>(buffer.data()) % cw::file::DIRECT_IO_ALIGNMENT, 0u);
+		buffer.data()[size - 1] = 0x5a;
+		auto shared = std::move(buffer).share();
+		EXPECT_EQ(shared.size(), size);
+		EXPECT_EQ(shared.data()[size - 1], 0x5a);
+	}
+
+	auto path = std::filesystem::temp_directory_path() / "cw_direct_short.bin";
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << "0123456789";
+	}
+	auto file = cw::file::FileHandle::openRead(path);
+	std::vector<uint8_t> bytes(64);
+	size_t bytesRead = 0;
+	EXPECT_FALSE(file.readAt(4, bytes, bytesRead));
+	EXPECT_EQ(bytesRead, 6u);
+	EXPECT_EQ(bytes[0], '4');
+	EXPECT_EQ(file.readAt(4, bytes), std::errc::io_error);
+	file.close();
+	std::filesystem::remove(path);
+}
+
+TEST(DirectIoTest, ChunksAreUnchangedAndFallBack) {
+	auto path = std::filesystem::temp_directory_path() / "cw_direct_read.bin";
+	std::vector<uint8_t> contents(2 * 1024 * 1024 + 321);
+	for (size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 17 + (i >> 10));
+	{
+		std::ofstream out(path, std::ios::binary);
+		out.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+	}
+
+	// Buffered reads where the filesystem refuses O_DIRECT; the same bytes either way
+	cw::file::ChunkSource source(path, cw::file::ReadMode::Direct);
+	ASSERT_TRUE(source.isOpen());
+	source.seek(1000);
+	source.setReadAhead(1024 * 1024);
+
+	std::vector<uint8_t> read(contents.begin(), contents.begin() + 1000);
+	while (true) {
+		auto chunk = source.next(256 * 1024);
+		if (chunk.empty()) break;
+		EXPECT_LE(chunk.size(), 256u * 1024);
+		read.insert(read.end(), chunk.data(), chunk.data() + chunk.size());
+	}
+	EXPECT_EQ(read, contents);
+
+	cw::TransferOptions options;
+	EXPECT_EQ(cw::detail::readModeFor(options, 1ull << 30), cw::file::ReadMode::Stream);
+	options.directIo = true;
+	EXPECT_EQ(cw::detail::readModeFor(options, 1ull << 30), cw::file::ReadMode::Direct);
+	EXPECT_EQ(cw::detail::readModeFor(options, options.directIoMinSize - 1), cw::file::ReadMode::Stream);
+	std::filesystem::remove(path);
+}
+
+TEST(DirectIoTest, UnbufferedWritesKeepEveryByte) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_direct_write";
+	auto path = dir / "out.bin";
+	asio::io_context io;
+	cw::file::DiskWriter writer(1);
+	writer.setDirectIoMinSize(1);
+
+	// Aligned chunks from unaligned memory, a chunk with an unaligned tail,
+	// an unaligned offset, and a compressed-size tail
+	std::vector<uint8_t> contents(3 * 65536 + 5000);
+	for (size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 7 + 3);
+	auto piece = [&](size_t from, size_t length)
+		{
+			return cw::buffer::pooledCopy(std::span<const uint8_t>(contents).subspan(from, length));
+		};
+
+	auto file = cw::file::WriteBehindFile::create(writer, io.get_executor());
+	file->open(path, contents.size(), [](std::error_code ec) { EXPECT_FALSE(ec); });
+	file->write(0, piece(0, 65536));
+	file->write(65536, piece(65536, 65536 + 100));
+	file->write(2 * 65536 + 100, piece(2 * 65536 + 100, 65436));
+	file->write(3 * 65536, piece(3 * 65536, 5000));
+
+	auto work = asio::make_work_guard(io);
+	uint64_t written = 0;
+	file->finish([&](std::error_code ec, uint64_t bytes) { EXPECT_FALSE(ec); written = bytes; work.reset(); });
+	io.run();
+
+	EXPECT_EQ(written, contents.size());
+	std::ifstream in(path, std::ios::binary);
+	std::vector<uint8_t> back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(back, contents);
+	std::filesystem::remove_all(dir);
+}
+
+// ---------------------------------------------------------------------------
+// 62. DROP-BEHIND (streamed files leave the page cache behind the transfer)
+// ---------------------------------------------------------------------------
+TEST(DropBehindTest, ReadsAreUnchanged) {
+	auto path = std::filesystem::temp_directory_path() / "cw_drop_behind_read.bin";
+	std::vector<uint8_t> contents(20 * 1024 * 1024 + 77);
+	for (size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 13 + (i >> 16));
+	{
+		std::ofstream out(path, std::ios::binary);
+		out.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+	}
+
+	// Mapped slices still held when their pages are dropped fault back in
+	for (auto mode : { cw::file::ReadMode::Stream, cw::file::ReadMode::MemoryMap }) {
+		std::vector<cw::buffer::SharedBuffer> chunks;
+		{
+			cw::file::ChunkSource source(path, mode);
+			source.seek(4096);
+			source.setDropBehind(true);
+			while (true) {
+				auto chunk = source.next(1024 * 1024);
+				if (chunk.empty()) break;
+				chunks.push_back(std::move(chunk));
+			}
+		}
+
+		std::vector<uint8_t> read(contents.begin(), contents.begin() + 4096);
+		for (auto& chunk : chunks) read.insert(read.end(), chunk.data(), chunk.data() + chunk.size());
+		EXPECT_EQ(read, contents);
+	}
+	std::filesystem::remove(path);
+}
+
+TEST(DropBehindTest, WritesAreUnchanged) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_drop_behind_write";
+	auto path = dir / "out.bin";
+	asio::io_context io;
+	cw::file::DiskWriter writer(1);
+	writer.setDropBehind(true);
+
+	std::vector<uint8_t> contents(19 * 1024 * 1024 + 5);
+	for (size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 29 + 1);
+
+	auto file = cw::file::WriteBehindFile::create(writer, io.get_executor());
+	file->open(path, contents.size(), [](std::error_code ec) { EXPECT_FALSE(ec); });
+	for (size_t offset = 0; offset < contents.size(); offset += 512 * 1024) {
+		size_t length = std::min<size_t>(512 * 1024, contents.size() - offset);
+		file->write(offset, cw::buffer::pooledCopy(std::span<const uint8_t>(contents).subspan(offset, length)));
+	}
+
+	auto work = asio::make_work_guard(io);
+	uint64_t written = 0;
+	file->finish([&](std::error_code ec, uint64_t bytes) { EXPECT_FALSE(ec); written = bytes; work.reset(); });
+	io.run();
+
+	EXPECT_EQ(written, contents.size());
+	std::ifstream in(path, std::ios::binary);
+	std::vector<uint8_t> back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(back, contents);
+	std::filesystem::remove_all(dir);
+}
+
+// ---------------------------------------------------------------------------
+// 63. INCOMING FILE BACKENDS (one sink interface, backend picked at run time)
+// ---------------------------------------------------------------------------
+TEST(IncomingFileTest, WritesThroughTheWritersBackend) {
+	EXPECT_EQ(cw::file::parseFileBackend("pool"), cw::file::FileBackend::ThreadPool);
+	EXPECT_EQ(cw::file::parseFileBackend("native"), cw::file::FileBackend::Native);
+	EXPECT_FALSE(cw::file::parseFileBackend("aio"));
+
+	cw::file::DiskWriter writer(1);
+	EXPECT_EQ(writer.setBackend(cw::file::FileBackend::Native), cw::file::hasNativeFileBackend());
+	ASSERT_TRUE(writer.setBackend(cw::file::FileBackend::ThreadPool));
+
+	auto dir = std::filesystem::temp_directory_path() / "cw_incoming_backend";
+	asio::io_context io;
+	auto file = cw::file::makeIncomingFile(writer, io.get_executor());
+	EXPECT_EQ(file->backend(), cw::file::FileBackend::ThreadPool);
+
+	uint64_t progress = 0;
+	file->onProgress([&](uint64_t written) { progress = written; });
+	file->open(dir / "out.bin", 12, [](std::error_code ec) { EXPECT_FALSE(ec); });
+	file->write(0, cw::buffer::SharedBuffer::fromVector({ 1, 2, 3, 4 }));
+	file->punchHole(4, 4);
+	file->write(8, cw::buffer::SharedBuffer::fromVector({ 9, 10, 11, 12 }));
+
+	auto work = asio::make_work_guard(io);
+	uint64_t written = 0;
+	file->finish([&](std::error_code ec, uint64_t bytes) { EXPECT_FALSE(ec); written = bytes; work.reset(); });
+	io.run();
+
+	EXPECT_EQ(written, 12u);
+	EXPECT_EQ(progress, 12u);
+	EXPECT_EQ(file->pendingBytes(), 0u);
+	std::ifstream in(dir / "out.bin", std::ios::binary);
+	std::vector<uint8_t> back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(back, (std::vector<uint8_t>{ 1, 2, 3, 4, 0, 0, 0, 0, 9, 10, 11, 12 }));
+	std::filesystem::remove_all(dir);
+}
+
+#if defined(CW_USE_IO_URING) && defined(ASIO_HAS_FILE)
+TEST(IncomingFileTest, AsyncWriteFileRoundTrips) {
+	cw::file::DiskWriter writer(1);
+	ASSERT_TRUE(cw::file::hasNativeFileBackend());
+
+	auto dir = std::filesystem::temp_directory_path() / "cw_async_write_file";
+	std::filesystem::remove_all(dir);
+	asio::io_context io;
+	auto file = cw::file::makeIncomingFile(writer, io.get_executor());
+	EXPECT_EQ(file->backend(), cw::file::FileBackend::Native);
+
+	// Many writes in flight at once, out of order, one of them gathered
+	std::vector<uint8_t> contents(256 * 1024 + 123);
+	for (size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 7 + (i >> 9));
+	const size_t piece = 16 * 1024;
+	auto slice = [&](size_t from, size_t to) { return cw::buffer::SharedBuffer::fromVector(std::vector<uint8_t>(contents.begin() + from, contents.begin() + to)); };
+
+	uint64_t progress = 0;
+	file->onProgress([&](uint64_t written) { progress = written; });
+	file->open(dir / "out.bin", contents.size(), [](std::error_code ec) { EXPECT_FALSE(ec); });
+	for (size_t offset = contents.size() / piece * piece; offset > piece; offset -= piece)
+		file->write(offset, slice(offset, std::min(offset + piece, contents.size())));
+	file->writeGathered(0, { slice(0, 100), slice(100, piece), slice(piece, 2 * piece) });
+	EXPECT_GT(file->pendingBytes(), 0u);
+
+	bool drained = false;
+	file->whenDrained(0, [&]() { drained = true; });
+	auto work = asio::make_work_guard(io);
+	uint64_t written = 0;
+	file->finish([&](std::error_code ec, uint64_t bytes) { EXPECT_FALSE(ec); written = bytes; work.reset(); });
+	io.run_for(std::chrono::seconds(10));
+
+	EXPECT_TRUE(drained);
+	EXPECT_EQ(written, contents.size());
+	EXPECT_EQ(progress, contents.size());
+	EXPECT_EQ(file->pendingBytes(), 0u);
+	// Written under the receiving name, published by the rename
+	EXPECT_FALSE(std::filesystem::exists(cw::file::receivingPathFor(dir / "out.bin")));
+	std::ifstream in(dir / "out.bin", std::ios::binary);
+	std::vector<uint8_t> back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(back, contents);
+	std::filesystem::remove_all(dir);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// 64. TRACEPOINTS (USDT/ETW probes, nothing at all when compiled out)
+// ---------------------------------------------------------------------------
+TEST(TracepointTest, CompiledOutProbesEvaluateNothing) {
+	int evaluated = 0;
+	CW_TRACE(test__probe, ++evaluated, 2u);
+#if !defined(CW_ENABLE_TRACEPOINTS)
+	EXPECT_EQ(evaluated, 0);
+#endif
+
+	// Congestion edges fire once per episode
+	cw::metrics::ConnectionMetrics metrics;
+	metrics.onCongested();
+	metrics.onCongested();
+	metrics.onDrained();
+	metrics.onDrained();
+	EXPECT_EQ(metrics.snapshot().congestionEvents, 1u);
+}
+
+// ---------------------------------------------------------------------------
+// 65. SESSION TIMELINE (per-thread spans, written as a Chrome trace)
+// ---------------------------------------------------------------------------
+TEST(TimelineTest, RecordsSpansPerThreadOnlyWhileStarted) {
+	auto& timeline = cw::metrics::Timeline::instance();
+	auto now = cw::metrics::Clock::now();
+	timeline.stop();
+	timeline.span("ignored", "test", now, now);
+
+	timeline.start(2);
+	EXPECT_EQ(timeline.eventCount(), 0u);
+	timeline.nameThisThread("test main");
+	timeline.span("read", "file", now, now + std::chrono::microseconds(5), 4096, 8192);
+	std::thread([&]() { cw::metrics::TimelineSpan span("disk write", "disk", 10); }).join();
+
+	// Past the per-thread bound events are counted, not kept
+	timeline.span("kept", "test", now, now);
+	timeline.span("dropped", "test", now, now);
+	timeline.stop();
+	timeline.span("ignored", "test", now, now);
+
+	EXPECT_EQ(timeline.eventCount(), 3u);
+	std::string json = timeline.toJson();
+	EXPECT_NE(json.find(R"("name":"read","cat":"file","ph":"X")"), std::string::npos);
+	EXPECT_NE(json.find(R"("dur":5.000)"), std::string::npos);
+	EXPECT_NE(json.find(R"("args":{"bytes":4096,"offset":8192})"), std::string::npos);
+	EXPECT_NE(json.find(R"("name":"disk write")"), std::string::npos);
+	EXPECT_NE(json.find(R"("args":{"name":"test main"})"), std::string::npos);
+	EXPECT_EQ(json.find("ignored"), std::string::npos);
+	EXPECT_EQ(json.find(R"("name":"dropped")"), std::string::npos);
+	EXPECT_NE(json.find(R"("otherData":{"dropped":1})"), std::string::npos);
+}
+
+TEST(TimelineTest, ChunkReadsLandOnTheTimeline) {
+	auto path = std::filesystem::temp_directory_path() / "cw_timeline_read.bin";
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << std::string(10000, 'x');
+	}
+
+	auto& timeline = cw::metrics::Timeline::instance();
+	timeline.start();
+	{
+		cw::file::ChunkSource source(path, cw::file::ReadMode::Stream);
+		while (!source.next(4096).empty()) {}
+	}
+	timeline.stop();
+
+	// Three chunks and the empty read at EOF
+	EXPECT_EQ(timeline.eventCount(), 4u);
+	std::string json = timeline.toJson();
+	EXPECT_NE(json.find(R"("args":{"bytes":1808,"offset":8192})"), std::string::npos);
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// 66. TRANSFER PROGRESS (counters at chunk granularity, sampled by a meter)
+// ---------------------------------------------------------------------------
+TEST(ProgressTest, StreamAcksCreditBytesAndTheFileOnce) {
+	auto progress = std::make_shared<cw::metrics::TransferProgress>();
+	progress->plan(2, 3000);
+	progress->planComplete();
+
+	// A resumed file: the first 500 bytes were there already
+	progress->onSkipped(500);
+	auto stream = std::make_shared<cw::metrics::StreamProgress>(progress, 1000, 1, 500);
+	EXPECT_FALSE(stream->onAck(800));
+	EXPECT_FALSE(stream->onAck(600)); // Stale acks credit nothing
+	EXPECT_TRUE(stream->onAck(1000));
+	EXPECT_TRUE(stream->onAck(1000)); // Another stripe of the same file
+
+	// A stream sized only at its end
+	auto unsized = std::make_shared<cw::metrics::StreamProgress>(progress, cw::packet::UNKNOWN_FILE_SIZE);
+	EXPECT_FALSE(unsized->onAck(1500));
+	unsized->setSize(2000);
+	EXPECT_TRUE(unsized->onAck(2000));
+
+	auto totals = progress->snapshot();
+	EXPECT_EQ(totals.bytesAcked, 3000u);
+	EXPECT_EQ(totals.filesAcked, 2u);
+	EXPECT_EQ(totals.bytesSent, 500u);
+}
+
+TEST(ProgressTest, MeterSmoothsTheRateAndGivesAnEta) {
+	auto progress = std::make_shared<cw::metrics::TransferProgress>();
+	cw::metrics::ProgressMeter meter(progress);
+
+	progress->plan(10, 100'000'000);
+	auto first = meter.sample();
+	EXPECT_EQ(first.bytesPerSecond, 0);
+	EXPECT_FALSE(first.eta); // Nothing moved yet, and more may be planned
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	progress->onAcked(1'000'000);
+	progress->onFilesAcked(1);
+	auto second = meter.sample();
+	EXPECT_GT(second.bytesPerSecond, 0);
+	EXPECT_FALSE(second.eta);
+
+	progress->planComplete();
+	auto third = meter.sample();
+	ASSERT_TRUE(third.eta);
+	EXPECT_GT(*third.eta, cw::metrics::Clock::duration::zero());
+
+	std::string line = cw::metrics::formatProgress(third);
+	EXPECT_NE(line.find("1.0 of 100.0 MB (1%), 1 of 10 files"), std::string::npos) << line;
+	EXPECT_NE(line.find("ETA"), std::string::npos) << line;
+}
+
+TEST(ProgressTest, RegistryListsOpenTransfersOnce) {
+	cw::file::TransferRegistry registry;
+	auto transfer = std::make_shared<cw::file::IncomingTransfer>();
+	transfer->path = "in/big.bin";
+	transfer->expectedSize = 4096;
+	transfer->stripeCount = 2;
+	transfer->receivedBytes = 1024;
+
+	// Both stripes open it
+	registry.track(transfer);
+	registry.track(transfer);
+	auto open = registry.status();
+	ASSERT_EQ(open.size(), 1u);
+	EXPECT_EQ(open[0].path, "in/big.bin");
+	EXPECT_EQ(open[0].receivedBytes, 1024u);
+	EXPECT_NE(cw::network::describeTransfer(open[0]).find("in/big.bin 0.0 of 0.0 MB (25%), 2 stripes"), std::string::npos);
+
+	transfer->markStripeDone();
+	transfer->markStripeDone();
+	EXPECT_TRUE(registry.status().empty());
+	transfer.reset();
+	EXPECT_TRUE(registry.status().empty());
+}
+
+// ---------------------------------------------------------------------------
+// 67. TRANSFER STATS (the receiver tells the sender where a file's time went)
+// ---------------------------------------------------------------------------
+TEST(TransferStatsTest, SenderHearsWhereTheTimeWent) {
+	cw::packet::TransferStats original;
+	original.streamId = 9;
+	original.fileSize = 1ull << 33;
+	original.receiveNanos = 123456789;
+	original.stallNanos = 4567;
+	original.diskWrites = 42;
+	original.diskMeanNanos = 1000;
+	original.diskP99Nanos = 99000;
+	auto frame = cw::packet::buildFrame(original);
+	auto view = cw::packet::parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::TransferStats);
+	auto decoded = cw::packet::TransferStats::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(decoded.fileSize, original.fileSize);
+	EXPECT_EQ(decoded.stallNanos, original.stallNanos);
+	EXPECT_EQ(decoded.diskP99Nanos, original.diskP99Nanos);
+
+	auto source = std::filesystem::temp_directory_path() / "cw_stats_src.bin";
+	std::vector<uint8_t> bytes(1024 * 1024 + 17);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 7);
+	writeBytes(source, bytes);
+
+	LoopbackServer loopback;
+	std::vector<cw::packet::TransferStats> stats;
+	loopback.upload(source, "cw_stats_dst.bin", {}, [&stats](cw::network::Connection& conn)
+		{
+			EXPECT_TRUE(conn.peerTakesTransferStats());
+			conn.onTransferStats([&stats](const cw::packet::TransferStats& pkt) { stats.push_back(pkt); });
+		});
+	loopback.runUntil([&] { return !stats.empty(); });
+
+	ASSERT_EQ(stats.size(), 1u);
+	EXPECT_EQ(stats[0].fileSize, bytes.size());
+	EXPECT_GT(stats[0].receiveNanos, 0u);
+	EXPECT_GT(stats[0].diskWrites, 0u);
+	EXPECT_GE(stats[0].diskP99Nanos, stats[0].diskMeanNanos / 2);
+
+	std::filesystem::remove("cw_stats_dst.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 68. AUTO-TUNING (hill climbing over streams, chunk size and compression)
+// ---------------------------------------------------------------------------
+TEST(AutoTunerTest, ClimbsToTheBestSettingAndSettles) {
+	using cw::compression::Codec;
+	cw::AutoTuner::Limits limits;
+	limits.maxStreams = 8;
+	limits.minChunkSize = 64 * 1024;
+	limits.maxChunkSize = 1024 * 1024;
+	limits.compressions = { { Codec::None, 0 }, { Codec::Zstd, 1 } };
+
+	// A link that peaks at 4 streams of 512 KB chunks, compressed
+	auto rateOf = [](const cw::TuningSetting& s)
+		{
+			double streams = 100.0 - 10.0 * std::abs(std::log2(static_cast<double>(s.streams)) - 2.0);
+			double chunk = 100.0 - 10.0 * std::abs(std::log2(static_cast<double>(s.chunkSize) / (512 * 1024)));
+			return streams * chunk * (s.compression == Codec::Zstd ? 1.5 : 1.0);
+		};
+
+	cw::AutoTuner tuner({ 1, 128 * 1024, Codec::None, 0 }, limits);
+	EXPECT_FALSE(tuner.onSample(1.0)); // Warm-up, discarded
+
+	for (int probe = 0; probe < 100 && !tuner.converged(); ++probe) {
+		// Settling after a change
+		if (tuner.onSample(rateOf(tuner.current()))) {
+			EXPECT_FALSE(tuner.onSample(0.0));
+		}
+	}
+	ASSERT_TRUE(tuner.converged());
+	cw::TuningSetting best = tuner.best();
+	EXPECT_EQ(best.streams, 4u);
+	EXPECT_EQ(best.chunkSize, 512u * 1024);
+	EXPECT_EQ(best.compression, Codec::Zstd);
+	EXPECT_EQ(tuner.current(), best);
+	EXPECT_DOUBLE_EQ(tuner.bestRate(), rateOf(best));
+
+	cw::TransferOptions options;
+	options.adaptiveChunkSize = true;
+	auto applied = best.applied(options);
+	EXPECT_EQ(applied.chunkSize, 512u * 1024);
+	EXPECT_FALSE(applied.adaptiveChunkSize);
+	EXPECT_EQ(applied.compression, Codec::Zstd);
+}
+
+TEST(AutoTunerTest, CacheKeepsTheBestSettingPerDestination) {
+	auto path = std::filesystem::temp_directory_path() / "cw_tuning_test" / "tuning";
+	std::filesystem::remove_all(path.parent_path());
+	{
+		cw::TuningCache cache(path);
+		EXPECT_FALSE(cache.find("server-a"));
+		cache.store("server-a", { 4, 512 * 1024, cw::compression::Codec::Lz4, 0 }, 1.25e9);
+		cache.store("server-b", { 1, 64 * 1024, cw::compression::Codec::None, 0 }, 3e6);
+		EXPECT_FALSE(cache.save());
+	}
+	std::ofstream(path, std::ios::app) << "garbage line\n";
+
+	cw::TuningCache cache(path);
+	auto a = cache.find("server-a");
+	ASSERT_TRUE(a);
+	EXPECT_EQ(a->setting.streams, 4u);
+	EXPECT_EQ(a->setting.chunkSize, 512u * 1024);
+	EXPECT_EQ(a->setting.compression, cw::compression::Codec::Lz4);
+	EXPECT_DOUBLE_EQ(a->bytesPerSecond, 1.25e9);
+	EXPECT_TRUE(cache.find("server-b"));
+	EXPECT_FALSE(cache.find("garbage"));
+	std::filesystem::remove_all(path.parent_path());
+}
+
+// ---------------------------------------------------------------------------
+// 69. MEMORY BUDGET (send queues, receive buffers and write-behind, capped)
+// ---------------------------------------------------------------------------
+TEST(MemoryBudgetTest, AccountsChargeTheBudgetAndGiveItBack) {
+	using cw::buffer::MemoryUse;
+	auto budget = std::make_shared<cw::buffer::MemoryBudget>(1000);
+	{
+		cw::buffer::MemoryAccount a(budget, 600);
+		cw::buffer::MemoryAccount b(budget);
+		a.add(MemoryUse::SendQueue, 300);
+		a.set(MemoryUse::ReceiveBuffer, 200);
+		b.add(MemoryUse::WriteBehind, 300);
+		EXPECT_EQ(budget->used(), 800u);
+		EXPECT_EQ(budget->used(MemoryUse::WriteBehind), 300u);
+		EXPECT_FALSE(a.constrained());
+
+		a.set(MemoryUse::ReceiveBuffer, 350); // Over its quota, the budget still under its limit
+		EXPECT_TRUE(a.overQuota());
+		EXPECT_TRUE(a.constrained());
+		EXPECT_FALSE(b.constrained());
+
+		b.add(MemoryUse::WriteBehind, 200); // Over the limit: everyone holds back
+		EXPECT_TRUE(budget->exceeded());
+		EXPECT_TRUE(b.constrained());
+
+		b.remove(MemoryUse::WriteBehind, 500);
+		a.remove(MemoryUse::SendQueue, 300);
+		EXPECT_EQ(a.used(), 350u);
+		EXPECT_FALSE(a.constrained());
+	}
+	EXPECT_EQ(budget->used(), 0u); // What a dropped connection still held
+}
+
+TEST(MemoryBudgetTest, ReceiverOverBudgetStillCompletes) {
+	auto source = std::filesystem::temp_directory_path() / "cw_budget_src.bin";
+	std::vector<uint8_t> bytes(4 * 1024 * 1024 + 5);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + 1);
+	writeBytes(source, bytes);
+
+	LoopbackServer loopback;
+	auto budget = std::make_shared<cw::buffer::MemoryBudget>(1); // Always exceeded: every chunk waits for the disk
+	loopback.server.setMemoryBudget(budget, 64 * 1024);
+
+	loopback.upload(source, "cw_budget_dst.bin");
+	loopback.runUntil([&] { return loopback.sent == 1 && loopback.filesReceived() == 1; }, std::chrono::seconds(20));
+
+	ASSERT_EQ(loopback.sent, 1u);
+	ASSERT_EQ(loopback.filesReceived(), 1u);
+	EXPECT_GT(loopback.metrics->snapshot().memoryPauses, 0u);
+	EXPECT_EQ(budget->used(cw::buffer::MemoryUse::WriteBehind), 0u);
+	EXPECT_EQ(readBytes("cw_budget_dst.bin"), bytes);
+	std::filesystem::remove("cw_budget_dst.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 70. GRACEFUL SHUTDOWN (half-close after the last frame, server drain)
+// ---------------------------------------------------------------------------
+TEST(GracefulShutdownTest, CloseAfterUploadAndDrain) {
+	auto source = std::filesystem::temp_directory_path() / "cw_drain_src.bin";
+	std::vector<uint8_t> bytes(2 * 1024 * 1024 + 3);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 5 + 2);
+	writeBytes(source, bytes);
+
+	LoopbackServer loopback;
+	uint16_t port = loopback.server.port();
+
+	// The client half-closes once its last frame is written; the server
+	// reads to the end, closes its side, and the close completes cleanly
+	std::shared_ptr<cw::network::Connection> conn;
+	std::error_code closed = asio::error::would_block;
+	loopback.spawn([&](cw::network::PooledConnection lease) -> asio::awaitable<void>
+		{
+			conn = lease.get();
+			co_await cw::asyncSendFile(lease.get(), source, "cw_drain_dst.bin");
+			co_await lease->asyncClose(asio::redirect_error(asio::use_awaitable, closed));
+		});
+	loopback.runUntil([&] { return closed != asio::error::would_block; });
+	ASSERT_FALSE(closed);
+	EXPECT_FALSE(conn->isOpen());
+	EXPECT_TRUE(loopback.runUntil([&] { return loopback.filesReceived() == 1; }));
+
+	// An idle connection is closed by a drain, which then reports done;
+	// nothing new is accepted
+	std::shared_ptr<cw::network::Connection> idle;
+	loopback.spawn([&](cw::network::PooledConnection lease) -> asio::awaitable<void>
+		{
+			co_await lease->asyncWaitCapabilities(asio::use_awaitable);
+			idle = lease.get();
+		});
+	ASSERT_TRUE(loopback.runUntil([&] { return idle != nullptr; }));
+
+	bool drained = false;
+	loopback.server.drain(std::chrono::seconds(5), [&drained]() { drained = true; });
+	EXPECT_TRUE(loopback.runUntil([&] { return drained; }));
+	EXPECT_TRUE(loopback.runUntil([&] { return !idle->isOpen(); }));
+
+	asio::ip::tcp::socket late(loopback.io);
+	std::error_code refused;
+	late.connect({ asio::ip::address_v4::loopback(), port }, refused);
+	EXPECT_TRUE(refused);
+	EXPECT_EQ(readBytes("cw_drain_dst.bin"), bytes);
+	std::filesystem::remove("cw_drain_dst.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 71. UPLOAD COMPLETION (woken by the last ack of the plan)
+// ---------------------------------------------------------------------------
+TEST(UploadCompletionTest, WaiterRunsOnceOnTheLastAck) {
+	cw::metrics::TransferProgress progress;
+	int runs = 0;
+	progress.plan(2, 100);
+	progress.onComplete([&runs]() { ++runs; });
+	progress.onFilesAcked(2); // Everything found so far, but the walk goes on
+	EXPECT_FALSE(progress.complete());
+	progress.plan(1, 10);
+	progress.planComplete();
+	EXPECT_EQ(runs, 0);
+	progress.onFilesAcked(1);
+	EXPECT_TRUE(progress.complete());
+	EXPECT_EQ(runs, 1);
+	progress.onFilesAcked(1);
+	EXPECT_EQ(runs, 1);
+
+	// Set once already complete: runs at once
+	progress.onComplete([&runs]() { ++runs; });
+	EXPECT_EQ(runs, 2);
+}
+
+TEST(UploadCompletionTest, LastAckMeansTheFileIsWritten) {
+	auto source = std::filesystem::temp_directory_path() / "cw_acked_src.bin";
+	std::vector<uint8_t> bytes(3 * 1024 * 1024 + 11);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 3 + 7);
+	writeBytes(source, bytes);
+
+	cw::TransferOptions options;
+	options.progress = std::make_shared<cw::metrics::TransferProgress>();
+	options.progress->plan(1, bytes.size());
+	options.progress->planComplete();
+	// Read back from the last ack's own handler: the file is already whole
+	bool acked = false;
+	std::vector<uint8_t> atAck;
+	options.progress->onComplete([&]()
+		{
+			acked = true;
+			atAck = readBytes("cw_acked_dst.bin");
+		});
+
+	LoopbackServer loopback;
+	loopback.upload(source, "cw_acked_dst.bin", options);
+	loopback.runUntil([&] { return acked; });
+
+	ASSERT_TRUE(acked);
+	EXPECT_EQ(options.progress->snapshot().bytesAcked, bytes.size());
+	EXPECT_EQ(atAck, bytes);
+	std::filesystem::remove("cw_acked_dst.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 72. TREE HASH (SHA-256 leaves hashed on arrival, pinpointing what to resend)
+// ---------------------------------------------------------------------------
+TEST(TreeHashTest, RootIgnoresArrivalOrderAndNamesWhatDiffers) {
+	std::vector<uint8_t> bytes(5 * 1000);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 31 + 1);
+	auto chunk = [&bytes](size_t index) { return std::span<const uint8_t>(bytes).subspan(index * 1000, 1000); };
+
+	cw::integrity::TreeHash inOrder, shuffled;
+	for (size_t i = 0; i < 5; ++i) inOrder.add(i * 1000, chunk(i));
+	for (size_t i : { 3, 0, 4, 1, 2 }) shuffled.add(i * 1000, chunk(i));
+	EXPECT_EQ(inOrder.root(), shuffled.root());
+	EXPECT_TRUE(shuffled.mismatches(inOrder.leaves()).empty());
+
+	// The same bytes elsewhere in the file are another leaf
+	EXPECT_NE(cw::integrity::TreeHash::hashLeaf(0, chunk(1)), cw::integrity::TreeHash::hashLeaf(1000, chunk(1)));
+
+	cw::integrity::TreeHash damaged;
+	for (size_t i = 0; i < 5; ++i) damaged.add(i * 1000, i == 3 ? chunk(0) : chunk(i));
+	EXPECT_NE(damaged.root(), inOrder.root());
+	auto resend = damaged.mismatches(inOrder.leaves());
+	ASSERT_EQ(resend.size(), 1u);
+	EXPECT_EQ(resend[0], std::make_pair(uint64_t(3000), uint32_t(1000)));
+
+	// A chunk sent again replaces its leaf
+	damaged.add(3000, chunk(3));
+	EXPECT_EQ(damaged.root(), inOrder.root());
+
+	cw::packet::TreeDigest original;
+	original.streamId = 4;
+	original.root = inOrder.root();
+	original.leaves = inOrder.leaves();
+	auto frame = cw::packet::buildFrame(original);
+	auto view = cw::packet::parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::TreeDigest);
+	auto decoded = cw::packet::TreeDigest::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(decoded.root, original.root);
+	EXPECT_EQ(decoded.leaves, original.leaves);
+}
+
+// Sends 'bytes' as two chunks; the second is damaged in a way its CRC32C
+// does not catch (the CRC is of the damaged bytes), the tree does
+static asio::awaitable<void> uploadDamaged(cw::network::PooledConnection lease, std::filesystem::path path, std::vector<uint8_t> bytes)
+{
+	auto conn = lease.get();
+	EXPECT_TRUE(conn->peerChecksTreeHash());
+
+	uint32_t streamId = conn->allocateStreamId();
+	conn->serveRetransmits(streamId, path, bytes.size());
+	conn->send(cw::packet::FileInfo{ .streamId = streamId, .fileSize = bytes.size(), .fileName = "cw_tree_dst.bin" });
+
+	size_t half = bytes.size() / 2;
+	cw::integrity::TreeHash tree;
+	for (uint64_t offset : { uint64_t(0), uint64_t(half) }) {
+		cw::packet::FileChunk chunk;
+		chunk.streamId = streamId;
+		chunk.offset = offset;
+		chunk.data.assign(bytes.begin() + offset, offset == 0 ? bytes.begin() + half : bytes.end());
+		tree.add(offset, chunk.data);
+		if (offset != 0) chunk.data[7] ^= 0xFF;
+		chunk.crc = cw::integrity::crc32c(chunk.data);
+		conn->send(chunk);
+	}
+
+	cw::packet::TreeDigest digest;
+	digest.streamId = streamId;
+	digest.root = tree.root();
+	digest.leaves = tree.leaves();
+	conn->send(digest);
+	cw::packet::FileDone done;
+	done.streamId = streamId;
+	done.fileSize = bytes.size();
+	conn->send(done);
+	co_return;
+}
+
+TEST(TreeHashTest, ChunkTheCrcMissedIsSentAgain) {
+	auto source = std::filesystem::temp_directory_path() / "cw_tree_src.bin";
+	std::vector<uint8_t> bytes(256 * 1024 + 3);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + 5);
+	writeBytes(source, bytes);
+
+	LoopbackServer loopback;
+	loopback.server.setTreeHash(true);
+	loopback.spawn([&](cw::network::PooledConnection lease) { return uploadDamaged(std::move(lease), source, bytes); });
+	loopback.runUntil([&] { return loopback.filesReceived() == 1; });
+
+	ASSERT_EQ(loopback.filesReceived(), 1u);
+	EXPECT_EQ(readBytes("cw_tree_dst.bin"), bytes);
+	std::filesystem::remove("cw_tree_dst.bin");
+	std::filesystem::remove(source);
+}
+
+TEST(TreeHashTest, StripedUploadIsChecked) {
+	auto source = std::filesystem::temp_directory_path() / "cw_tree_striped_src.bin";
+	std::vector<uint8_t> bytes(1024 * 1024 + 77);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 7 + i / 251);
+	writeBytes(source, bytes);
+
+	LoopbackServer loopback;
+	loopback.server.setTreeHash(true);
+	loopback.spawn([&](cw::network::PooledConnection first) -> asio::awaitable<void>
+		{
+			auto second = co_await loopback.pool->asyncAcquire("127.0.0.1", loopback.server.port(), asio::use_awaitable);
+			cw::TransferOptions options;
+			options.chunkSize = 64 * 1024;
+			options.treeHash = true;
+			std::vector<std::shared_ptr<cw::network::Connection>> conns{ first.get(), second.get() };
+			co_await cw::asyncSendFileStriped(conns, source, "cw_tree_striped.bin", options);
+		});
+	loopback.runUntil([&] { return loopback.filesReceived() == 1; });
+
+	ASSERT_EQ(loopback.filesReceived(), 1u);
+	EXPECT_EQ(readBytes("cw_tree_striped.bin"), bytes);
+	std::filesystem::remove("cw_tree_striped.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 73. CONTENT STORE (whole-file dedup of published files by hardlink)
+// ---------------------------------------------------------------------------
+TEST(ContentStoreTest, CopiesBecomeLinksToOneObject) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_cas_unit";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+
+	std::vector<uint8_t> shared(3 * 1024 * 1024 + 11);
+	for (size_t i = 0; i < shared.size(); ++i) shared[i] = static_cast<uint8_t>(i * 31 + i / 977);
+	std::vector<uint8_t> other = shared;
+	other.back() ^= 1;
+	writeBytes(dir / "a.so", shared);
+	writeBytes(dir / "b.so", shared);
+	writeBytes(dir / "c.so", other);
+	writeBytes(dir / "empty", {});
+
+	cw::file::ContentStore store(dir / "store");
+	using Adopted = cw::file::ContentStore::Adopted;
+	EXPECT_EQ(store.adopt(dir / "a.so"), Adopted::Stored);
+	EXPECT_EQ(store.adopt(dir / "b.so"), Adopted::Linked);
+	EXPECT_EQ(store.adopt(dir / "c.so"), Adopted::Stored);
+	EXPECT_EQ(store.adopt(dir / "empty"), Adopted::Skipped);
+	EXPECT_EQ(store.adopt(dir / "b.so"), Adopted::Linked); // Already one: nothing to do
+
+	EXPECT_TRUE(std::filesystem::equivalent(dir / "a.so", dir / "b.so"));
+	EXPECT_FALSE(std::filesystem::equivalent(dir / "a.so", dir / "c.so"));
+	EXPECT_EQ(std::filesystem::hard_link_count(dir / "a.so"), 3u); // a, b and the object
+	EXPECT_EQ(store.linkedFiles(), 1u);
+	EXPECT_EQ(store.savedBytes(), shared.size());
+
+	EXPECT_EQ(readBytes(dir / "b.so"), shared);
+	std::filesystem::remove_all(dir);
+}
+
+TEST(ContentStoreTest, ServerLinksTheSameUploadTwice) {
+	auto source = std::filesystem::temp_directory_path() / "cw_cas_src.bin";
+	std::vector<uint8_t> bytes(512 * 1024 + 5);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 11 + 3);
+	writeBytes(source, bytes);
+
+	LoopbackServer loopback;
+	auto store = std::make_shared<cw::file::ContentStore>("cw_cas_store");
+	loopback.server.setContentStore(store);
+	loopback.spawn([&](cw::network::PooledConnection lease) -> asio::awaitable<void>
+		{
+			co_await cw::asyncSendFile(lease.get(), source, "cw_cas_first.bin");
+			co_await cw::asyncSendFile(lease.get(), source, "cw_cas_second.bin");
+		});
+	loopback.runUntil([&] { return store->linkedFiles() > 0; });
+
+	EXPECT_EQ(loopback.filesReceived(), 2u);
+	ASSERT_EQ(store->linkedFiles(), 1u);
+	EXPECT_TRUE(std::filesystem::equivalent("cw_cas_first.bin", "cw_cas_second.bin"));
+	EXPECT_EQ(readBytes("cw_cas_second.bin"), bytes);
+	std::filesystem::remove("cw_cas_first.bin");
+	std::filesystem::remove("cw_cas_second.bin");
+	std::filesystem::remove_all("cw_cas_store");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 74. OBJECT STORE SINK (received files streamed into S3 multipart uploads)
+// ---------------------------------------------------------------------------
+TEST(ObjectStoreTest, SignsAsAwsDocuments) {
+	auto bytes = [](std::string_view text) { return std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(text.data()), text.size()); };
+	// RFC 4231, test case 2
+	EXPECT_EQ(cw::integrity::toHex(cw::integrity::hmacSha256(bytes("Jefe"), bytes("what do ya want for nothing?"))),
+		"5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+
+	// The worked example of the AWS Signature Version 4 documentation
+	cw::network::sigv4::Params query{ { "Version", "2010-05-08" }, { "Action", "ListUsers" } };
+	cw::network::sigv4::Params headers{ { "host", "iam.amazonaws.com" }, { "x-amz-date", "20150830T123600Z" },
+		{ "content-type", "application/x-www-form-urlencoded; charset=utf-8" } };
+	std::string auth = cw::network::sigv4::authorization("GET", "/", query, headers, cw::integrity::toHex(cw::integrity::sha256({})),
+		"20150830T123600Z", "us-east-1", "iam", "AKIDEXAMPLE", "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY");
+	EXPECT_EQ(auth, "AWS4-HMAC-SHA256 Credential=AKIDEXAMPLE/20150830/us-east-1/iam/aws4_request, "
+		"SignedHeaders=content-type;host;x-amz-date, Signature=5d672d79c15b13162d9279b0855cfba6789a8edb4c82c400e06b5924a6f2b5d7");
+
+	EXPECT_EQ(cw::network::sigv4::uriEncode("/builds/lib v2+.so", true), "/builds/lib%20v2%2B.so");
+}
+
+// Just enough of S3's multipart API, parts held a moment so they overlap
+struct FakeS3
+{
+	std::string path;
+	std::map<unsigned, std::string> parts;
+	std::string completion;
+	unsigned inFlight = 0;
+	unsigned maxInFlight = 0;
+	bool signedRequests = true;
+	bool aborted = false;
+};
+
+static asio::awaitable<void> fakeS3Exchange(asio::ip::tcp::socket socket, std::shared_ptr<FakeS3> s3)
+{
+	std::string data;
+	std::size_t headerEnd = co_await asio::async_read_until(socket, asio::dynamic_buffer(data), "\r\n\r\n", asio::use_awaitable);
+	std::string head = data.substr(0, headerEnd);
+	auto lengthAt = head.find("Content-Length: ");
+	std::size_t length = lengthAt == std::string::npos ? 0 : std::stoul(head.substr(lengthAt + 16));
+	if (data.size() - headerEnd < length)
+		co_await asio::async_read(socket, asio::dynamic_buffer(data), asio::transfer_exactly(length - (data.size() - headerEnd)), asio::use_awaitable);
+	std::string body = data.substr(headerEnd, length);
+
+	std::string line = head.substr(0, head.find("\r\n"));
+	if (head.find("Authorization: AWS4-HMAC-SHA256 Credential=AKID/") == std::string::npos) s3->signedRequests = false;
+	std::string target = line.substr(line.find(' ') + 1);
+	target.resize(target.find(' '));
+	s3->path = target.substr(0, target.find('?'));
+
+	std::string response;
+	if (line.starts_with("POST") && target.ends_with("?uploads=")) {
+		std::string xml = "<InitiateMultipartUploadResult><UploadId>upload-1</UploadId></InitiateMultipartUploadResult>";
+		response = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(xml.size()) + "\r\n\r\n" + xml;
+	}
+	else if (line.starts_with("PUT")) {
+		unsigned number = static_cast<unsigned>(std::stoul(target.substr(target.find("partNumber=") + 11)));
+		s3->maxInFlight = std::max(s3->maxInFlight, ++s3->inFlight);
+		asio::steady_timer hold(socket.get_executor(), std::chrono::milliseconds(400));
+		co_await hold.async_wait(asio::use_awaitable);
+		--s3->inFlight;
+		s3->parts[number] = body;
+		response = "HTTP/1.1 200 OK\r\nETag: \"etag-" + std::to_string(number) + "\"\r\nContent-Length: 0\r\n\r\n";
+	}
+	else if (line.starts_with("POST")) {
+		s3->completion = body;
+		response = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+	}
+	else {
+		s3->aborted = true;
+		response = "HTTP/1.1 204 No Content\r\n\r\n";
+	}
+	co_await asio::async_write(socket, asio::buffer(response), asio::use_awaitable);
+}
+
+static asio::awaitable<void> serveFakeS3(asio::ip::tcp::acceptor& acceptor, std::shared_ptr<FakeS3> s3)
+{
+	while (acceptor.is_open()) {
+		auto socket = co_await acceptor.async_accept(asio::use_awaitable);
+		asio::co_spawn(acceptor.get_executor(), fakeS3Exchange(std::move(socket), s3), asio::detached);
+	}
+}
+
+TEST(ObjectStoreTest, UploadBecomesMultipartObject) {
+	auto path = std::filesystem::temp_directory_path() / "cw_object_source.bin";
+	std::vector<uint8_t> bytes(12 * 1024 * 1024 + 7);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + (i >> 11));
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor s3Acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	auto s3 = std::make_shared<FakeS3>();
+	asio::co_spawn(io, serveFakeS3(s3Acceptor, s3), asio::detached);
+
+	cw::network::S3Config config;
+	config.host = "127.0.0.1";
+	config.port = s3Acceptor.local_endpoint().port();
+	config.bucket = "builds";
+	config.accessKey = "AKID";
+	config.secretKey = "secret";
+	auto store = std::make_shared<cw::network::S3Store>(io.get_executor(), config);
+
+	using Receiver = cw::network::ObjectStoreReceiver<cw::network::S3Store>;
+	Receiver::Options options;
+	options.prefix = "artifacts/";
+	options.partSize = Receiver::MIN_PART_SIZE;
+	options.maxParallelParts = 2;
+	std::optional<std::string> stored;
+	auto receiver = std::make_shared<Receiver>(store, options, [&](const std::string& key, uint64_t size)
+		{
+			EXPECT_EQ(size, bytes.size());
+			stored = key;
+		});
+
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(receiver);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	bool acked = false;
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, cw::asyncSendFile(client, path, "lib.so"), [&](std::exception_ptr error) { acked = !error; });
+		});
+
+	for (int i = 0; i < 200 && !(stored && acked); ++i) io.run_for(std::chrono::milliseconds(20));
+	s3Acceptor.close();
+
+	ASSERT_TRUE(stored);
+	EXPECT_EQ(*stored, "artifacts/lib.so");
+	EXPECT_TRUE(acked);
+	EXPECT_EQ(s3->path, "/builds/artifacts/lib.so");
+	EXPECT_TRUE(s3->signedRequests);
+	EXPECT_FALSE(s3->aborted);
+	EXPECT_EQ(s3->maxInFlight, 2u);
+	EXPECT_EQ(receiver->bufferedBytes(), 0u);
+
+	// Fixed-size parts, the last one short, listed in order
+	ASSERT_EQ(s3->parts.size(), 3u);
+	EXPECT_EQ(s3->parts[1].size(), Receiver::MIN_PART_SIZE);
+	EXPECT_EQ(s3->parts[3].size(), bytes.size() - 2 * Receiver::MIN_PART_SIZE);
+	std::string object = s3->parts[1] + s3->parts[2] + s3->parts[3];
+	EXPECT_TRUE(std::equal(object.begin(), object.end(), bytes.begin(), bytes.end(), [](char a, uint8_t b) { return static_cast<uint8_t>(a) == b; }));
+	EXPECT_NE(s3->completion.find("<Part><PartNumber>1</PartNumber><ETag>\"etag-1\"</ETag></Part><Part><PartNumber>2</PartNumber>"), std::string::npos);
+
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// 75. MULTIPATH (streams bound to source addresses, chunks by path throughput)
+// ---------------------------------------------------------------------------
+TEST(MultipathTest, StreamLeavesFromItsBoundAddress) {
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	std::vector<std::string> peers;
+	server.setConnectionSetup([&peers](cw::network::Connection& conn) { peers.push_back(conn.peerName()); });
+
+	// All of 127/8 is loopback on Linux: a second "NIC" to leave from
+	cw::network::SocketOptions options;
+	options.bindTo = "127.0.0.2";
+	cw::network::Client bound(io);
+	bound.SetSocketOptions(options);
+	bool connected = false;
+	bound.Connect("127.0.0.1", server.port(), [&connected]() { connected = true; });
+
+	// An address no interface has: no connection through some other path
+	options.bindTo = "192.0.2.1";
+	cw::network::Client stray(io);
+	stray.SetSocketOptions(options);
+	std::error_code strayError;
+	stray.Connect("127.0.0.1", server.port(), nullptr, [&strayError](std::error_code ec) { strayError = ec; });
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while ((peers.empty() || !strayError) && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+
+	EXPECT_TRUE(connected);
+	ASSERT_EQ(peers.size(), 1u);
+	EXPECT_TRUE(peers[0].starts_with("127.0.0.2:")) << peers[0];
+	EXPECT_TRUE(strayError);
+}
+
+TEST(MultipathTest, SlowPathCarriesItsShare) {
+	auto source = std::filesystem::temp_directory_path() / "cw_multipath_src.bin";
+	std::vector<uint8_t> bytes(16 * 1024 * 1024 + 5);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 31 + i / 4099);
+	writeBytes(source, bytes);
+
+	LoopbackServer loopback;
+	std::vector<std::shared_ptr<cw::network::Connection>> conns;
+	auto started = std::chrono::steady_clock::now();
+	loopback.spawn([&](cw::network::PooledConnection fast) -> asio::awaitable<void>
+		{
+			auto slow = co_await loopback.pool->asyncAcquire("127.0.0.1", loopback.server.port(), asio::use_awaitable);
+			slow.get()->addRateLimiter(std::make_shared<cw::network::RateLimiter>(2 * 1024 * 1024));
+
+			cw::TransferOptions options;
+			options.chunkSize = 64 * 1024;
+			conns = { slow.get(), fast.get() };
+			co_await cw::asyncSendFileStriped(conns, source, "cw_multipath.bin", options);
+		});
+	loopback.runUntil([&] { return loopback.filesReceived() == 1; }, std::chrono::seconds(15));
+
+	ASSERT_EQ(loopback.filesReceived(), 1u);
+	ASSERT_EQ(conns.size(), 2u);
+	// An equal split would hold the file for 4 s behind the 2 MB/s path
+	EXPECT_LT(conns[0]->metrics()->bytesSent(), conns[1]->metrics()->bytesSent() / 4);
+	EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(3));
+	EXPECT_EQ(readBytes("cw_multipath.bin"), bytes);
+	std::filesystem::remove("cw_multipath.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 76. FORWARD ERROR CORRECTION (Reed-Solomon parity over groups of UDP datagrams)
+// ---------------------------------------------------------------------------
+TEST(ReedSolomonTest, AnyKOfTheGroupRebuildTheRest) {
+	const size_t k = 10, m = 3;
+	std::vector<std::vector<uint8_t>> data(k);
+	for (size_t j = 0; j < k; ++j) {
+		data[j].resize(j == k - 1 ? 700 : 1200); // The last one short, as a read's tail
+		for (size_t i = 0; i < data[j].size(); ++i) data[j][i] = static_cast<uint8_t>(i * 31 + j * 7 + (i >> 8));
+	}
+
+	cw::integrity::ReedSolomon code(k, m);
+	std::vector<std::span<const uint8_t>> shards(data.begin(), data.end());
+	std::vector<std::vector<uint8_t>> parity(m, std::vector<uint8_t>(1200));
+	for (size_t i = 0; i < m; ++i) code.encode(i, shards, parity[i]);
+
+	// Lose three data shards and use the parity that is left after losing one more
+	std::vector<std::optional<std::vector<uint8_t>>> received(data.begin(), data.end());
+	received[0].reset();
+	received[4].reset();
+	received[9].reset();
+	std::vector<std::pair<size_t, std::span<const uint8_t>>> survivors{ { 0, parity[0] }, { 2, parity[2] } };
+	EXPECT_FALSE(code.reconstruct(received, survivors, 1200));
+
+	survivors.emplace_back(1, parity[1]);
+	ASSERT_TRUE(code.reconstruct(received, survivors, 1200));
+	for (size_t j = 0; j < k; ++j) {
+		ASSERT_TRUE(received[j]);
+		received[j]->resize(data[j].size());
+		EXPECT_EQ(*received[j], data[j]) << "shard " << j;
+	}
+}
+
+TEST(UdpTunnelTest, ParityRebuildsLostDatagrams) {
+	auto path = std::filesystem::temp_directory_path() / "cw_udp_fec.bin";
+	std::vector<uint8_t> bytes(2 * 1024 * 1024 + 41);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 17 + (i >> 11));
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	std::vector<cw::network::MemoryReceiver::File> received;
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(std::make_shared<cw::network::MemoryReceiver>([&](cw::network::MemoryReceiver::File file)
+		{
+			received.push_back(std::move(file));
+			io.stop();
+		}));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	// One in twenty datagrams is dropped; a quarter more in parity covers most
+	// of them. Paced, so that loopback's socket buffers drop nothing more.
+	cw::network::UdpTunnelOptions options;
+	options.simulatedLoss = 0.05;
+	options.fecOverhead = 0.25;
+	options.rateBytesPerSecond = 4 * 1024 * 1024;
+	auto listener = cw::network::UdpTunnel::listen(io, 0, acceptor.local_endpoint(), options);
+	auto dialer = cw::network::UdpTunnel::dial(io, { asio::ip::make_address("127.0.0.1"), listener->udpPort() }, 0, options);
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), dialer->localPort()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+
+			cw::TransferOptions transfer;
+			transfer.chunkSize = 64 * 1024;
+			transfer.ackWindowBytes = 1024 * 1024;
+			asio::co_spawn(io, cw::asyncSendFile(client, path, "over/fec.bin", transfer), asio::detached);
+		});
+
+	io.run_for(std::chrono::seconds(20));
+
+	ASSERT_EQ(received.size(), 1u);
+	EXPECT_EQ(received[0].data, bytes);
+	EXPECT_GT(listener->recovered(), 0u);
+
+	listener->close();
+	dialer->close();
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// 77. RECONNECT (session ids, transfers resumed on a new connection)
+// ---------------------------------------------------------------------------
+TEST(ReconnectTest, UploadSurvivesAResetConnection) {
+	auto source = std::filesystem::temp_directory_path() / "cw_reconnect_src.bin";
+	std::vector<uint8_t> bytes(24 * 1024 * 1024 + 13);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 29 + i / 8191);
+	std::ofstream(source, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	std::vector<std::weak_ptr<cw::network::Connection>> accepted;
+	server.setConnectionSetup([&accepted](cw::network::Connection& conn) { accepted.push_back(conn.shared_from_this()); });
+
+	// Paced, so that the reset lands mid-file
+	cw::network::Client client(io);
+	client.SetRateLimiter(std::make_shared<cw::network::RateLimiter>(16 * 1024 * 1024));
+	client.SetReconnect({});
+	EXPECT_NE(client.GetSessionId(), 0u);
+
+	cw::TransferOptions options;
+	options.chunkSize = 256 * 1024;
+	options.ackWindowBytes = 4 * 1024 * 1024;
+	options.progress = std::make_shared<cw::metrics::TransferProgress>();
+	options.progress->plan(1, bytes.size());
+	options.progress->planComplete();
+
+	std::shared_ptr<cw::network::Connection> first;
+	std::exception_ptr failure;
+	bool finished = false;
+	client.Connect("127.0.0.1", server.port(), [&]()
+		{
+			first = client.GetConnection();
+			asio::co_spawn(io, cw::asyncSendFile(first, source, "cw_reconnect.bin", options), [&](std::exception_ptr error)
+				{
+					failure = error;
+					finished = true;
+				});
+		});
+
+	// The server drops the connection a third of the way in
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (options.progress->snapshot().bytesAcked < 8 * 1024 * 1024 && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_EQ(accepted.size(), 1u);
+	accepted[0].lock()->shutdown();
+
+	while (!finished && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_TRUE(finished);
+	EXPECT_FALSE(failure);
+	EXPECT_TRUE(options.progress->complete());
+	EXPECT_EQ(options.progress->snapshot().bytesAcked, bytes.size());
+
+	// Continued where the server's disk got to, not from the start
+	auto second = client.GetConnection();
+	ASSERT_NE(second, first);
+	EXPECT_EQ(first->latest(), second);
+	EXPECT_EQ(accepted.size(), 2u);
+	EXPECT_LT(second->metrics()->bytesSent(), bytes.size() - 6 * 1024 * 1024);
+
+	std::ifstream in("cw_reconnect.bin", std::ios::binary);
+	std::vector<uint8_t> received((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(received, bytes);
+	in.close();
+	std::filesystem::remove("cw_reconnect.bin");
+	std::filesystem::remove(source);
+}
+
+TEST(ReconnectTest, ReturningSessionClosesTheConnectionLeftBehind) {
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	auto sessions = std::make_shared<cw::network::SessionTable>();
+	server.setConnectionSetup([sessions](cw::network::Connection& conn) { conn.setSessionTable(sessions); });
+
+	auto connect = [&io, &server]()
+		{
+			auto conn = cw::network::Connection::create(io);
+			conn->socket().connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()));
+			conn->start();
+			return conn;
+		};
+	auto run = [&io](auto done)
+		{
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+			while (!done() && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+		};
+
+	// The old connection is still up as far as the server knows (a NAT
+	// rebinding): the same session on a new one closes it
+	auto old = connect();
+	std::optional<std::error_code> oldJoined;
+	old->asyncOpenSession(42, [&oldJoined](std::error_code ec) { oldJoined = ec; });
+	run([&]() { return oldJoined.has_value(); });
+	ASSERT_EQ(oldJoined, std::error_code{});
+	EXPECT_TRUE(old->peerResumesSessions());
+	EXPECT_EQ(sessions->size(), 1u);
+
+	auto back = connect();
+	std::optional<std::error_code> backJoined;
+	back->asyncOpenSession(42, [&backJoined](std::error_code ec) { backJoined = ec; });
+	run([&]() { return backJoined.has_value() && !old->isOpen(); });
+	EXPECT_EQ(backJoined, std::error_code{});
+	EXPECT_FALSE(old->isOpen());
+	EXPECT_TRUE(back->isOpen());
+	EXPECT_EQ(sessions->size(), 1u);
+
+	// Closing forgets the session
+	back->shutdown();
+	run([&]() { return sessions->size() == 0; });
+	EXPECT_EQ(sessions->size(), 0u);
+}
+
+// ---------------------------------------------------------------------------
+// 78. SAFE NAMES (names a peer sends stay under the destination)
+// ---------------------------------------------------------------------------
+TEST(SafePathTest, RefusesNamesEscapingTheDestination) {
+	using cw::file::isSafeRelativePath;
+	static_assert(isSafeRelativePath("a/b.bin"));
+	EXPECT_TRUE(isSafeRelativePath("file.bin"));
+	EXPECT_TRUE(isSafeRelativePath("dir/sub/file.bin"));
+	EXPECT_TRUE(isSafeRelativePath("./dir/file.bin"));
+	EXPECT_TRUE(isSafeRelativePath("..file/x..y/..."));
+
+	EXPECT_FALSE(isSafeRelativePath(""));
+	EXPECT_FALSE(isSafeRelativePath("/etc/passwd"));
+	EXPECT_FALSE(isSafeRelativePath("\\\\server\\share\\x"));
+	EXPECT_FALSE(isSafeRelativePath("C:\\Windows\\x.dll"));
+	EXPECT_FALSE(isSafeRelativePath("c:x.dll"));
+	EXPECT_FALSE(isSafeRelativePath(".."));
+	EXPECT_FALSE(isSafeRelativePath("../x"));
+	EXPECT_FALSE(isSafeRelativePath("a/../../x"));
+	EXPECT_FALSE(isSafeRelativePath("a\\..\\..\\x"));
+	EXPECT_FALSE(isSafeRelativePath("a/.."));
+	EXPECT_FALSE(isSafeRelativePath(std::string_view("a\0/x", 4)));
+	EXPECT_FALSE(isSafeRelativePath(std::filesystem::path("/tmp/x")));
+	EXPECT_TRUE(isSafeRelativePath(std::filesystem::path("tmp/x")));
+}
+
+TEST(SafePathTest, ServerRefusesAnUploadOutsideItsDirectory) {
+	auto source = std::filesystem::temp_directory_path() / "cw_escape_src.bin";
+	std::ofstream(source, std::ios::binary) << "not for the parent directory";
+	auto escaped = std::filesystem::current_path().parent_path() / "cw_escaped.bin";
+	std::filesystem::remove(escaped);
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+
+	// The name is a protocol error: the server hangs up
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, cw::asyncSendFile(client, source, "sub/../../cw_escaped.bin"), asio::detached);
+		});
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	do io.run_for(std::chrono::milliseconds(5));
+	while (client->isOpen() && std::chrono::steady_clock::now() < deadline);
+
+	EXPECT_FALSE(client->isOpen());
+	EXPECT_FALSE(std::filesystem::exists(escaped));
+
+	// Archive members are held to the same rule
+	cw::file::ArchiveUnpacker unpacker;
+	auto header = cw::file::archiveHeader("../x.bin", 1);
+	EXPECT_THROW(unpacker.add(0, cw::buffer::SharedBuffer::fromVector(std::move(header))), std::runtime_error);
+
+	std::filesystem::remove(escaped);
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 79. AWAITABLE PACKETS (asyncSend, PacketChannel)
+// ---------------------------------------------------------------------------
+static asio::awaitable<void> sendNumbered(std::shared_ptr<cw::network::Connection> conn, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		cw::packet::TransferStats stats;
+		stats.streamId = static_cast<uint32_t>(i);
+		stats.fileSize = static_cast<uint64_t>(i) * 1000;
+		co_await conn->asyncSend(stats, asio::use_awaitable);
+	}
+	cw::packet::Error last;
+	last.message = "done";
+	co_await conn->asyncSend(last, cw::network::Priority::Normal, asio::use_awaitable);
+	co_await conn->asyncClose(asio::as_tuple(asio::use_awaitable));
+}
+
+using StatsChannel = cw::network::PacketChannel<cw::packet::TransferStats, cw::packet::Error>;
+
+static asio::awaitable<void> receiveNumbered(std::shared_ptr<StatsChannel> channel, std::vector<uint32_t>* seen, std::string* last, std::error_code* end)
+{
+	for (;;) {
+		auto [ec, packet] = co_await channel->asyncReceive(asio::as_tuple(asio::use_awaitable));
+		if (ec) {
+			*end = ec;
+			co_return;
+		}
+		if (auto* stats = std::get_if<cw::packet::TransferStats>(&packet)) {
+			EXPECT_EQ(stats->fileSize, uint64_t{ stats->streamId } * 1000);
+			seen->push_back(stats->streamId);
+		}
+		else {
+			*last = std::get<cw::packet::Error>(packet).message;
+		}
+
+		// A slow consumer: the channel fills and the socket waits
+		asio::steady_timer pause(co_await asio::this_coro::executor, std::chrono::microseconds(200));
+		co_await pause.async_wait(asio::use_awaitable);
+	}
+}
+
+TEST(AwaitablePacketTest, SendAndReceiveInACoroutine) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	constexpr int count = 500;
+	std::vector<uint32_t> seen;
+	std::string last;
+	std::error_code end;
+	bool received = false;
+
+	auto server = cw::network::Connection::create(io);
+	auto channel = std::make_shared<StatsChannel>(io.get_executor(), 4);
+	server->setHandler(channel);
+	acceptor.async_accept(server->socket(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			server->start();
+			asio::co_spawn(io, receiveNumbered(channel, &seen, &last, &end), [&](std::exception_ptr) { received = true; });
+		});
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, sendNumbered(client, count), asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (!received && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+
+	ASSERT_TRUE(received);
+	ASSERT_EQ(seen.size(), static_cast<size_t>(count));
+	for (int i = 0; i < count; ++i) EXPECT_EQ(seen[i], static_cast<uint32_t>(i));
+	EXPECT_EQ(last, "done");
+	EXPECT_EQ(end, asio::error::operation_aborted);
+
+	// Nothing is queued on a connection that is gone
+	std::error_code late;
+	asio::co_spawn(io, [&]() -> asio::awaitable<void>
+		{
+			auto [ec] = co_await client->asyncSend(cw::packet::TransferStats{}, asio::as_tuple(asio::use_awaitable));
+			late = ec;
+		}, asio::detached);
+	io.restart();
+	io.run_for(std::chrono::milliseconds(200));
+	EXPECT_EQ(late, asio::error::operation_aborted);
+}
+
+// ---------------------------------------------------------------------------
+// 80. HANDLER MEMORY (reads, writes and flushes reuse per-connection blocks)
+// ---------------------------------------------------------------------------
+TEST(HandlerMemoryTest, ReusesItsBlockAndCountsWhatDoesNotFit) {
+	cw::network::HandlerMemory<128> memory;
+	void* first = memory.allocate(100);
+	void* taken = memory.allocate(16); // Block in use
+	void* large = memory.allocate(256);
+	memory.deallocate(first);
+	EXPECT_EQ(memory.allocate(64), first);
+	EXPECT_NE(taken, first);
+	EXPECT_NE(large, first);
+	EXPECT_EQ(memory.misses(), 2u);
+	memory.deallocate(taken);
+	memory.deallocate(large);
+	memory.deallocate(first);
+}
+
+TEST(HandlerMemoryTest, SteadyUploadNeverAllocatesHandlers) {
+	auto path = std::filesystem::temp_directory_path() / "cw_handler_memory.bin";
+	std::vector<uint8_t> bytes(16 * 1024 * 1024 + 3);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 7 + (i >> 13));
+	writeBytes(path, bytes);
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	std::vector<cw::network::MemoryReceiver::File> received;
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(std::make_shared<cw::network::MemoryReceiver>([&](cw::network::MemoryReceiver::File file)
+		{
+			received.push_back(std::move(file));
+			io.stop();
+		}));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			cw::TransferOptions options;
+			options.chunkSize = 64 * 1024;
+			asio::co_spawn(io, cw::asyncSendFile(client, path, "handler_memory.bin", options), asio::detached);
+		});
+	io.run_for(std::chrono::seconds(20));
+
+	ASSERT_EQ(received.size(), 1u);
+	EXPECT_EQ(received[0].data, bytes);
+	EXPECT_EQ(server->handlerHeapAllocations(), 0u);
+	EXPECT_EQ(client->handlerHeapAllocations(), 0u);
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// 81. SPLICE RECEIVE (raw chunk data moved socket -> pipe -> file by the kernel)
+// ---------------------------------------------------------------------------
+#if defined(__linux__)
+TEST(SpliceReceiveTest, PipeMovesSocketBytesIntoAFileAtAnOffset) {
+	int sockets[2];
+	ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+	::fcntl(sockets[1], F_SETFL, O_NONBLOCK);
+	auto path = std::filesystem::temp_directory_path() / "cw_splice_pipe.bin";
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	ASSERT_GE(fd, 0);
+
+	auto pipe = cw::file::SplicePipe::acquire();
+	ASSERT_TRUE(pipe);
+	EXPECT_GT(pipe->capacity(), 0u);
+
+	std::size_t moved = 0;
+	EXPECT_EQ(pipe->fill(sockets[1], 100, moved), std::errc::resource_unavailable_try_again);
+
+	std::string text = "spliced at an offset";
+	ASSERT_EQ(::write(sockets[0], text.data(), text.size()), static_cast<ssize_t>(text.size()));
+	ASSERT_FALSE(pipe->fill(sockets[1], 100, moved));
+	EXPECT_EQ(moved, text.size());
+	std::size_t done = 0;
+	ASSERT_FALSE(pipe->drainTo(fd, 4096, moved, done));
+	EXPECT_EQ(done, text.size());
+
+	std::string back(text.size(), '\0');
+	EXPECT_EQ(::pread(fd, back.data(), back.size(), 4096), static_cast<ssize_t>(back.size()));
+	EXPECT_EQ(back, text);
+
+	// Drained, it goes back to the pool and is handed out again
+	auto* raw = pipe.get();
+	pipe.reset();
+	EXPECT_EQ(cw::file::SplicePipe::acquire().get(), raw);
+
+	::close(sockets[1]);
+	EXPECT_FALSE(cw::file::SplicePipe::acquire()->fill(sockets[0], 100, moved) == std::errc::resource_unavailable_try_again);
+	::close(sockets[0]);
+	::close(fd);
+	std::filesystem::remove(path);
+}
+
+TEST(SpliceReceiveTest, UploadWithoutChecksumsIsSplicedIntoTheFile) {
+	auto source = std::filesystem::temp_directory_path() / "cw_splice_source.bin";
+	std::vector<uint8_t> bytes(9 * 1024 * 1024 + 11);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + (i >> 12));
+	writeBytes(source, bytes);
+	std::filesystem::remove_all("cw_splice");
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	auto server = cw::network::Connection::create(io);
+	server->setSpliceReceive(true);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			cw::TransferOptions options;
+			options.chunkSize = 1024 * 1024;
+			options.checksums = false;
+			asio::co_spawn(io, cw::asyncSendFile(client, source, "cw_splice/copy.bin", options), asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (server->metrics()->snapshot().filesReceived == 0 && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+
+	std::ifstream in("cw_splice/copy.bin", std::ios::binary);
+	std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(contents, bytes);
+	EXPECT_GE(server->metrics()->snapshot().bytesReceived, bytes.size());
+	in.close();
+
+	std::filesystem::remove_all("cw_splice");
+	std::filesystem::remove(source);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// 82. ZERO-COPY SENDS (MSG_ZEROCOPY, frames held until the kernel is done)
+// ---------------------------------------------------------------------------
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+TEST(ZeroCopySendTest, LargeChunksGoOutIntactWithZeroCopySends) {
+	auto path = std::filesystem::temp_directory_path() / "cw_zero_copy.bin";
+	std::vector<uint8_t> bytes(8 * 1024 * 1024 + 5);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 11 + (i >> 10));
+	writeBytes(path, bytes);
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	std::vector<cw::network::MemoryReceiver::File> received;
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(std::make_shared<cw::network::MemoryReceiver>([&](cw::network::MemoryReceiver::File file)
+		{
+			received.push_back(std::move(file));
+			io.stop();
+		}));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			cw::network::SocketOptions options;
+			options.zeroCopy = true;
+			cw::network::applySocketOptions(client->socket(), options);
+			client->start();
+
+			cw::TransferOptions transfer;
+			transfer.chunkSize = 256 * 1024;
+			asio::co_spawn(io, cw::asyncSendFile(client, path, "zero_copy.bin", transfer), asio::detached);
+		});
+	io.run_for(std::chrono::seconds(20));
+
+	ASSERT_EQ(received.size(), 1u);
+	EXPECT_EQ(received[0].data, bytes);
+	// Over loopback the kernel reports it copied, and the sends after that copy
+	EXPECT_GT(client->zeroCopySends(), 0u);
+	EXPECT_EQ(server->zeroCopySends(), 0u);
+	std::filesystem::remove(path);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// 83. ZERO-COPY RECEIVE (TCP_ZEROCOPY_RECEIVE pages of large chunks)
+// ---------------------------------------------------------------------------
+#if defined(TCP_ZEROCOPY_RECEIVE)
+TEST(ZeroCopyReceiveTest, LargeChunksAreCheckedAndWrittenFromTheirPieces) {
+	auto source = std::filesystem::temp_directory_path() / "cw_mapped_source.bin";
+	std::vector<uint8_t> bytes(10 * 1024 * 1024 + 333);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 17 + (i >> 9));
+	writeBytes(source, bytes);
+	std::filesystem::remove_all("cw_mapped");
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	auto server = cw::network::Connection::create(io);
+	server->setZeroCopyReceive(true);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	// Loopback payload is not page-aligned: the pieces are mostly read, but
+	// go through the same path as mapped ones
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			EXPECT_TRUE(cw::network::MappedReceive::supportedOn(static_cast<int>(client->socket().native_handle())));
+			client->start();
+			cw::TransferOptions options;
+			options.chunkSize = 2 * 1024 * 1024;
+			asio::co_spawn(io, cw::asyncSendFile(client, source, "cw_mapped/copy.bin", options), asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (server->metrics()->snapshot().filesReceived == 0 && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+
+	std::ifstream in("cw_mapped/copy.bin", std::ios::binary);
+	std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(contents, bytes);
+	EXPECT_GE(server->metrics()->snapshot().bytesReceived, bytes.size());
+	in.close();
+
+	std::filesystem::remove_all("cw_mapped");
+	std::filesystem::remove(source);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// 84. GATHERED WRITES (chunks of one read that continue one another, one pwritev)
+// ---------------------------------------------------------------------------
+TEST(GatheredWriteTest, PiecesLandBackToBackPastTheIovecLimit) {
+	auto path = std::filesystem::temp_directory_path() / "cw_gathered_write.bin";
+	std::vector<std::vector<uint8_t>> pieces;
+	std::vector<uint8_t> expected;
+	for (size_t i = 0; i < 1500; ++i) {
+		pieces.emplace_back(i % 7 == 0 ? 0 : i % 13 + 1, static_cast<uint8_t>(i));
+		expected.insert(expected.end(), pieces.back().begin(), pieces.back().end());
+	}
+	std::vector<std::span<const uint8_t>> spans(pieces.begin(), pieces.end());
+	{
+		auto file = cw::file::FileHandle::openWrite(path);
+		EXPECT_FALSE(file.writeAt(100, spans));
+	}
+
+	std::ifstream in(path, std::ios::binary);
+	std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	ASSERT_EQ(contents.size(), 100 + expected.size());
+	EXPECT_TRUE(std::equal(expected.begin(), expected.end(), contents.begin() + 100));
+	std::filesystem::remove(path);
+}
+
+TEST(GatheredWriteTest, SmallChunksOfOneReadShareAWrite) {
+	auto source = std::filesystem::temp_directory_path() / "cw_gathered_source.bin";
+	std::vector<uint8_t> bytes(4 * 1024 * 1024 + 77);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 5 + (i >> 8));
+	writeBytes(source, bytes);
+	std::filesystem::remove_all("cw_gathered");
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	auto server = cw::network::Connection::create(io);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			cw::TransferOptions options;
+			options.chunkSize = 16 * 1024;
+			asio::co_spawn(io, cw::asyncSendFile(client, source, "cw_gathered/copy.bin", options), asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (server->metrics()->snapshot().filesReceived == 0 && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+
+	std::ifstream in("cw_gathered/copy.bin", std::ios::binary);
+	std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	EXPECT_EQ(contents, bytes);
+
+	// 257 chunks; reads of 64 KB and more bring several at a time
+	EXPECT_LT(server->metrics()->snapshot().diskLatency.count, bytes.size() / (16 * 1024));
+
+	std::filesystem::remove_all("cw_gathered");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 85. CORKING (a burst of packets held back and written together)
+// ---------------------------------------------------------------------------
+TEST(CorkTest, PacketsWaitForUncork) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	auto server = cw::network::Connection::create(io);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	bool connected = false;
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			connected = true;
+		});
+	while (!connected) io.run_one();
+	io.run_for(std::chrono::milliseconds(20));
+	uint64_t sent = client->metrics()->snapshot().framesSent;
+	uint64_t received = server->metrics()->snapshot().framesReceived;
+
+	std::optional<cw::network::Connection::Cork> cork(client);
+	for (uint32_t i = 0; i < 3; ++i) {
+		cw::packet::TransferStats stats;
+		stats.streamId = i;
+		client->send(stats);
+	}
+	io.run_for(std::chrono::milliseconds(50));
+	EXPECT_EQ(client->metrics()->snapshot().framesSent, sent);
+	EXPECT_EQ(server->metrics()->snapshot().framesReceived, received);
+
+	cork.reset();
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (server->metrics()->snapshot().framesReceived < received + 3 && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+	EXPECT_EQ(client->metrics()->snapshot().framesSent, sent + 3);
+	EXPECT_EQ(server->metrics()->snapshot().framesReceived, received + 3);
+}
+
+TEST(CorkTest, WritesPastTheHighWatermarkWhileCorked) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	auto server = cw::network::Connection::create(io);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->setWatermarks(64, 256);
+	bool connected = false;
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			connected = true;
+		});
+	while (!connected) io.run_one();
+	io.run_for(std::chrono::milliseconds(20));
+	uint64_t received = server->metrics()->snapshot().framesReceived;
+
+	// More than the high watermark queued: held back, the producer would wait forever
+	cw::network::Connection::Cork cork(client);
+	for (uint32_t i = 0; i < 32; ++i) {
+		cw::packet::TransferStats stats;
+		stats.streamId = i;
+		client->send(stats);
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (server->metrics()->snapshot().framesReceived == received && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+	EXPECT_GT(server->metrics()->snapshot().framesReceived, received);
+}
+
+// A started client connected to a started server over loopback, idle
+static std::pair<std::shared_ptr<cw::network::Connection>, std::shared_ptr<cw::network::Connection>> connectedPair(asio::io_context& io,
+	asio::ip::tcp::acceptor& acceptor)
+{
+	auto server = cw::network::Connection::create(io);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	bool connected = false;
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			connected = true;
+		});
+	while (!connected) io.run_one();
+	io.run_for(std::chrono::milliseconds(20));
+	return { client, server };
+}
+
+TEST(CorkTest, WaitWritableFiresOnceDrainedToTheLowWatermark) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	auto [client, server] = connectedPair(io, acceptor);
+
+	// Held by the cork, the queue cannot drain; small batches drain it in steps
+	std::optional<cw::network::Connection::Cork> cork(client);
+	client->setMaxWriteBatchBytes(256);
+	for (uint32_t i = 0; i < 200; ++i) {
+		cw::packet::TransferStats stats;
+		stats.streamId = i;
+		client->send(stats);
+	}
+	size_t queued = client->queuedBytes();
+	size_t low = queued / 2;
+	client->setWatermarks(low, queued * 2);
+
+	std::optional<size_t> wokenAt;
+	client->asyncWaitWritable([&](std::error_code ec)
+		{
+			EXPECT_FALSE(ec);
+			wokenAt = client->queuedBytes();
+		});
+	auto blocked = std::async(std::launch::async, [&]() { return client->waitWritable(); });
+	io.run_for(std::chrono::milliseconds(50));
+	EXPECT_FALSE(wokenAt);
+	EXPECT_EQ(blocked.wait_for(std::chrono::seconds(0)), std::future_status::timeout);
+	EXPECT_EQ(client->queuedBytes(), queued);
+
+	cork.reset();
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (blocked.wait_for(std::chrono::seconds(0)) != std::future_status::ready && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+	ASSERT_TRUE(wokenAt);
+	// Woken by the write that took it to the low watermark, not at the end
+	EXPECT_LE(*wokenAt, low);
+	EXPECT_GT(*wokenAt, low - 256);
+	ASSERT_EQ(blocked.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+	EXPECT_FALSE(blocked.get());
+}
+
+TEST(CorkTest, GatheredWritesStayWithinTheBatchCap) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	auto [client, server] = connectedPair(io, acceptor);
+	uint64_t sent = client->metrics()->snapshot().framesSent;
+
+	const size_t cap = 300;
+	client->setMaxWriteBatchBytes(cap);
+	std::optional<cw::network::Connection::Cork> cork(client);
+	for (uint32_t i = 0; i < 200; ++i) {
+		cw::packet::TransferStats stats;
+		stats.streamId = i;
+		client->send(stats);
+	}
+	size_t queued = client->queuedBytes();
+	cork.reset();
+
+	// One handler at a time: each completed write takes one batch off the queue
+	size_t writes = 0;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (client->queuedBytes() > 0 && std::chrono::steady_clock::now() < deadline) {
+		size_t before = client->queuedBytes();
+		io.run_one_for(std::chrono::milliseconds(10));
+		size_t after = client->queuedBytes();
+		ASSERT_LE(after, before);
+		EXPECT_LE(before - after, cap);
+		if (after < before) ++writes;
+	}
+	EXPECT_EQ(client->queuedBytes(), 0u);
+	EXPECT_GE(writes, queued / cap);
+	// Still gathered: several frames to a write
+	EXPECT_EQ(client->metrics()->snapshot().framesSent, sent + 200);
+	EXPECT_LT(writes, 100u);
+}
+
+// ---------------------------------------------------------------------------
+// 86. DELAYED ACKS (acks of several streams in one AckBatch, piggybacked)
+// ---------------------------------------------------------------------------
+TEST(DelayedAckTest, BatchRoundTrips) {
+	AckBatch original;
+	original.acks.resize(3);
+	for (uint32_t i = 0; i < 3; ++i) {
+		original.acks[i].streamId = i * 7;
+		original.acks[i].offset = 0x100000000ull + i;
+	}
+
+	std::vector<uint8_t> frame = buildFrame(original);
+	ParsedFrame view = parseFrame(frame);
+	EXPECT_EQ(view.type, PacketType::AckBatch);
+	AckBatch reconstructed = AckBatch::deserialize(view.payload_view, view.size);
+	ASSERT_EQ(reconstructed.acks.size(), 3u);
+	for (uint32_t i = 0; i < 3; ++i) {
+		EXPECT_EQ(reconstructed.acks[i].streamId, i * 7);
+		EXPECT_EQ(reconstructed.acks[i].offset, 0x100000000ull + i);
+	}
+
+	std::vector<uint8_t> lying = { 0, 0, 0, 2, 0, 0, 0, 1 };
+	EXPECT_THROW(AckBatch::deserialize(lying.data(), lying.size()), std::runtime_error);
+}
+
+// A connected pair whose server end delays its acks by 'delay'
+static void connectAckPair(asio::io_context& io, asio::ip::tcp::acceptor& acceptor, std::shared_ptr<cw::network::Connection>& server,
+	std::shared_ptr<cw::network::Connection>& client, std::chrono::microseconds delay)
+{
+	server = cw::network::Connection::create(io);
+	server->setAckDelay(delay);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [client](std::error_code ec) { if (!ec) client->start(); });
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!server->peerTakesAckBatches() && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	io.run_for(std::chrono::milliseconds(10));
+}
+
+TEST(DelayedAckTest, AcksRideAlongWithTheNextFrame) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	std::shared_ptr<cw::network::Connection> server, client;
+	connectAckPair(io, acceptor, server, client, std::chrono::seconds(10));
+	ASSERT_TRUE(server->peerTakesAckBatches());
+
+	uint32_t first = client->allocateStreamId();
+	uint32_t second = client->allocateStreamId();
+	std::optional<std::error_code> firstAcked, secondAcked;
+	client->asyncWaitAcked(first, 300, [&](std::error_code ec) { firstAcked = ec; });
+	client->asyncWaitAcked(second, 50, [&](std::error_code ec) { secondAcked = ec; });
+	uint64_t received = client->metrics()->snapshot().framesReceived;
+
+	server->sendAck(first, 100);
+	server->sendAck(first, 300);
+	server->sendAck(second, 50);
+	io.run_for(std::chrono::milliseconds(30));
+	EXPECT_EQ(client->metrics()->snapshot().framesReceived, received);
+	EXPECT_FALSE(firstAcked);
+
+	// Reverse traffic carries them: one AckBatch ahead of the packet
+	cw::packet::TransferStats stats;
+	server->send(stats);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!(firstAcked && secondAcked) && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	ASSERT_TRUE(firstAcked && secondAcked);
+	EXPECT_FALSE(*firstAcked);
+	EXPECT_FALSE(*secondAcked);
+	io.run_for(std::chrono::milliseconds(10));
+	EXPECT_EQ(client->metrics()->snapshot().framesReceived, received + 2);
+}
+
+TEST(DelayedAckTest, DelayRunsOutIntoOneFrame) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	std::shared_ptr<cw::network::Connection> server, client;
+	connectAckPair(io, acceptor, server, client, std::chrono::milliseconds(5));
+
+	std::vector<uint32_t> streams;
+	for (int i = 0; i < 20; ++i) streams.push_back(client->allocateStreamId());
+	size_t acked = 0;
+	for (uint32_t stream : streams) {
+		client->asyncWaitAcked(stream, 1000, [&acked](std::error_code ec) { if (!ec) ++acked; });
+	}
+	io.run_for(std::chrono::milliseconds(5));
+	uint64_t received = client->metrics()->snapshot().framesReceived;
+
+	for (uint32_t stream : streams) server->sendAck(stream, 1000);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (acked < streams.size() && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	EXPECT_EQ(acked, streams.size());
+	EXPECT_EQ(client->metrics()->snapshot().framesReceived, received + 1);
+}
+
+// ---------------------------------------------------------------------------
+// 87. STREAM ERRORS (the receiver fails one stream, the sender drops it)
+// ---------------------------------------------------------------------------
+TEST(StreamErrorTest, ErrorCarriesItsStream) {
+	Error original{ static_cast<uint16_t>(ErrorCode::DiskFull), "no space left", 42 };
+	std::vector<uint8_t> frame = buildFrame(original);
+	ParsedFrame view = parseFrame(frame);
+	Error reconstructed = Error::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(reconstructed.code, static_cast<uint16_t>(ErrorCode::DiskFull));
+	EXPECT_EQ(reconstructed.message, "no space left");
+	EXPECT_EQ(reconstructed.streamId, 42u);
+
+	// Older peers end the payload at the message: a connection-wide error
+	std::vector<uint8_t> old = { 0, 3, 0, 0, 0, 2, 'n', 'o' };
+	Error legacy = Error::deserialize(old.data(), old.size());
+	EXPECT_EQ(legacy.code, static_cast<uint16_t>(ErrorCode::Rejected));
+	EXPECT_EQ(legacy.message, "no");
+	EXPECT_EQ(legacy.streamId, 0u);
+}
+
+TEST(StreamErrorTest, FailedStreamDropsItsQueuedFrames) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	auto server = cw::network::Connection::create(io);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	bool connected = false;
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			connected = true;
+		});
+	while (!connected) io.run_one();
+	io.run_for(std::chrono::milliseconds(20));
+
+	uint32_t doomed = client->allocateStreamId();
+	uint32_t other = client->allocateStreamId();
+	std::optional<std::error_code> waited;
+	client->asyncWaitAcked(doomed, 4096, [&](std::error_code ec) { waited = ec; });
+
+	cw::network::Connection::Cork cork(client);
+	for (uint32_t i = 0; i < 4; ++i) {
+		FileChunk chunk;
+		chunk.streamId = doomed;
+		chunk.offset = i * 1024;
+		chunk.data.assign(1024, 0xAB);
+		client->send(chunk);
+	}
+	FileChunk kept;
+	kept.streamId = other;
+	kept.data.assign(1024, 0xCD);
+	client->send(kept);
+	io.run_for(std::chrono::milliseconds(10));
+	size_t queued = client->queuedBytes();
+	ASSERT_GT(queued, 4 * 1024u);
+
+	Error err{ static_cast<uint16_t>(ErrorCode::DiskFull), "disk full", doomed };
+	server->send(err);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!waited && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	ASSERT_TRUE(waited);
+	EXPECT_EQ(*waited, std::make_error_code(std::errc::no_space_on_device));
+	EXPECT_EQ(client->streamError(doomed), std::make_error_code(std::errc::no_space_on_device));
+	EXPECT_FALSE(client->streamError(other));
+
+	// Only the other stream's chunk is left to write
+	EXPECT_LT(client->queuedBytes(), queued - 4 * 1024);
+	EXPECT_GT(client->queuedBytes(), 1024u);
+
+	// Later waits fail at once; releasing the stream forgets the failure
+	std::optional<std::error_code> late;
+	client->asyncWaitAcked(doomed, 8192, [&](std::error_code ec) { late = ec; });
+	io.run_for(std::chrono::milliseconds(5));
+	ASSERT_TRUE(late);
+	EXPECT_EQ(*late, std::make_error_code(std::errc::no_space_on_device));
+	client->releaseStream(doomed);
+	io.run_for(std::chrono::milliseconds(5));
+	EXPECT_FALSE(client->streamError(doomed));
+}
+
+// ---------------------------------------------------------------------------
+// 88. TIMER WHEEL (deadlines of many connections and transfers on one timer)
+// ---------------------------------------------------------------------------
+TEST(TimerWheelTest, DeadlinesFireInOrderAcrossLevels) {
+	asio::io_context io;
+	auto& wheel = cw::network::TimerWheel::of(io);
+	wheel.setResolution(std::chrono::milliseconds(1));
+
+	// 1 ms ticks: 70 ms and 300 ms start on the second level
+	std::vector<std::chrono::milliseconds> delays = { std::chrono::milliseconds(300), std::chrono::milliseconds(3), std::chrono::milliseconds(70), std::chrono::milliseconds(20) };
+	std::vector<std::unique_ptr<cw::network::Timeout>> timeouts;
+	std::vector<std::pair<size_t, std::chrono::steady_clock::duration>> fired;
+	auto armed = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < delays.size(); ++i) {
+		timeouts.push_back(std::make_unique<cw::network::Timeout>(wheel, io.get_executor()));
+		timeouts.back()->expiresAfter(delays[i], [&, i]() { fired.emplace_back(i, std::chrono::steady_clock::now() - armed); });
+	}
+	EXPECT_EQ(wheel.size(), delays.size());
+
+	io.run();
+	ASSERT_EQ(fired.size(), delays.size());
+	std::vector<size_t> order;
+	for (auto& [index, after] : fired) {
+		order.push_back(index);
+		EXPECT_GE(after, delays[index]);
+	}
+	EXPECT_EQ(order, (std::vector<size_t>{ 1, 3, 2, 0 }));
+	EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST(TimerWheelTest, CancelledAndRearmedDeadlines) {
+	asio::io_context io;
+	auto& wheel = cw::network::TimerWheel::of(io);
+	wheel.setResolution(std::chrono::milliseconds(1));
+
+	int cancelled = 0, first = 0, second = 0;
+	cw::network::Timeout dropped(wheel, io.get_executor());
+	cw::network::Timeout rearmed(wheel, io.get_executor());
+	dropped.expiresAfter(std::chrono::milliseconds(5), [&]() { ++cancelled; });
+	rearmed.expiresAfter(std::chrono::milliseconds(5), [&]() { ++first; });
+	rearmed.expiresAfter(std::chrono::milliseconds(15), [&]() { ++second; });
+	EXPECT_EQ(wheel.size(), 2u);
+	dropped.cancel();
+	EXPECT_FALSE(dropped.armed());
+	EXPECT_TRUE(rearmed.armed());
+
+	{
+		// Destroyed armed: taken off the wheel
+		cw::network::Timeout gone(wheel, io.get_executor());
+		gone.expiresAfter(std::chrono::milliseconds(5), [&]() { ++cancelled; });
+	}
+	EXPECT_EQ(wheel.size(), 1u);
+
+	io.run();
+	EXPECT_EQ(cancelled, 0);
+	EXPECT_EQ(first, 0);
+	EXPECT_EQ(second, 1);
+	EXPECT_FALSE(rearmed.armed());
+}
+
+TEST(TimerWheelTest, ThousandsOfDeadlinesFireOnceNoneEarly) {
+	asio::io_context io;
+	auto& wheel = cw::network::TimerWheel::of(io);
+	wheel.setResolution(std::chrono::milliseconds(1));
+
+	constexpr size_t COUNT = 20000;
+	std::mt19937 random(7);
+	std::vector<std::unique_ptr<cw::network::Timeout>> timeouts;
+	std::vector<std::chrono::milliseconds> delays;
+	std::vector<int> fires(COUNT, 0);
+	size_t early = 0;
+	auto armed = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < COUNT; ++i) {
+		delays.emplace_back(random() % 200);
+		timeouts.push_back(std::make_unique<cw::network::Timeout>(wheel, io.get_executor()));
+		timeouts.back()->expiresAfter(delays[i], [&, i]()
+			{
+				++fires[i];
+				if (std::chrono::steady_clock::now() - armed < delays[i]) ++early;
+			});
+	}
+
+	io.run();
+	EXPECT_EQ(std::count(fires.begin(), fires.end(), 1), static_cast<std::ptrdiff_t>(COUNT));
+	EXPECT_EQ(early, 0u);
+}
+
+TEST(TimerWheelTest, StalledIncomingFileIsFailed) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+
+	auto server = cw::network::Connection::create(io);
+	server->setStallTimeout(std::chrono::milliseconds(50));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [client](std::error_code ec) { if (!ec) client->start(); });
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (client->peerVersion() == 0 && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+
+	// Half the file, then nothing
+	uint32_t streamId = client->allocateStreamId();
+	client->send(cw::packet::FileInfo{ .streamId = streamId, .fileSize = 2048, .fileName = "cw_stall_dst.bin" });
+	cw::packet::FileChunk chunk;
+	chunk.streamId = streamId;
+	chunk.data.assign(1024, 0x5A);
+	client->send(chunk);
+
+	std::optional<std::error_code> result;
+	auto sent = std::chrono::steady_clock::now();
+	client->asyncWaitAcked(streamId, 2048, [&](std::error_code ec) { result = ec; });
+	while (!result && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+
+	ASSERT_TRUE(result);
+	EXPECT_EQ(*result, std::make_error_code(std::errc::timed_out));
+	EXPECT_GE(std::chrono::steady_clock::now() - sent, std::chrono::milliseconds(50));
+	EXPECT_TRUE(server->socket().is_open());
+	std::filesystem::remove("cw_stall_dst.bin");
+}
+
+// ---------------------------------------------------------------------------
+// 89. HEARTBEAT (Ping/Pong finds peers gone without closing)
+// ---------------------------------------------------------------------------
+TEST(HeartbeatTest, QuietPeerIsPingedAndStaysOpen) {
+	Ping ping;
+	ping.nonce = 0x0102030405060708ull;
+	std::vector<uint8_t> frame = buildFrame(ping);
+	ParsedFrame view = parseFrame(frame);
+	EXPECT_EQ(view.type, PacketType::Ping);
+	EXPECT_EQ(Ping::deserialize(view.payload_view, view.size).nonce, ping.nonce);
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	auto server = cw::network::Connection::create(io);
+	server->setHeartbeat(std::chrono::milliseconds(20), 2);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [client](std::error_code ec) { if (!ec) client->start(); });
+
+	auto started = std::chrono::steady_clock::now();
+	while (!server->peerAnswersPings() && std::chrono::steady_clock::now() - started < std::chrono::seconds(5)) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	ASSERT_TRUE(server->peerAnswersPings());
+	uint64_t received = client->metrics()->snapshot().framesReceived;
+
+	// Nothing else to say: the Pongs alone keep it open
+	io.run_for(std::chrono::milliseconds(200));
+	EXPECT_TRUE(server->socket().is_open());
+	EXPECT_GE(client->metrics()->snapshot().framesReceived, received + 3);
+}
+
+TEST(HeartbeatTest, SilentPeerIsClosed) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	auto server = cw::network::Connection::create(io);
+	server->setHeartbeat(std::chrono::milliseconds(20), 3);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	// A peer that says it answers Pings, then never reads again
+	asio::ip::tcp::socket peer(io);
+	peer.connect(acceptor.local_endpoint());
+	Capabilities caps;
+	caps.features = cw::packet::CAP_HEARTBEAT;
+	asio::write(peer, asio::buffer(buildFrame(caps)));
+
+	auto started = std::chrono::steady_clock::now();
+	while (!server->peerAnswersPings() && std::chrono::steady_clock::now() - started < std::chrono::seconds(5)) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	ASSERT_TRUE(server->peerAnswersPings());
+	while (server->socket().is_open() && std::chrono::steady_clock::now() - started < std::chrono::seconds(5)) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	EXPECT_FALSE(server->socket().is_open());
+	EXPECT_GE(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(60));
+	EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(1));
+}
+
+TEST(HeartbeatTest, PingsDoNotKeepAnIdleConnectionOpen) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	auto server = cw::network::Connection::create(io);
+	server->setHeartbeat(std::chrono::milliseconds(20));
+	server->setIdleTimeout(std::chrono::milliseconds(150));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [client](std::error_code ec) { if (!ec) client->start(); });
+
+	auto started = std::chrono::steady_clock::now();
+	while (!server->peerAnswersPings() && std::chrono::steady_clock::now() - started < std::chrono::seconds(5)) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	ASSERT_TRUE(server->peerAnswersPings());
+	while (server->socket().is_open() && std::chrono::steady_clock::now() - started < std::chrono::seconds(5)) {
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	EXPECT_FALSE(server->socket().is_open());
+	EXPECT_GE(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(150));
+	EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(1));
+}
+
+// ---------------------------------------------------------------------------
+// 90. WATCH MODE (inotify changes, debounced into batches, sent as they come)
+// ---------------------------------------------------------------------------
+#if defined(__linux__)
+TEST(DirectoryWatcherTest, ChangesArriveInOneDebouncedBatch) {
+	auto root = std::filesystem::temp_directory_path() / "cw_watcher";
+	std::filesystem::remove_all(root);
+	std::filesystem::create_directories(root / "a");
+	std::ofstream(root / "old.txt") << "unchanged";
+
+	asio::io_context io;
+	auto watcher = cw::file::DirectoryWatcher::start(root, io.get_executor(), std::chrono::milliseconds(50), std::chrono::seconds(2));
+	EXPECT_EQ(watcher->watched(), 2u);
+
+	std::optional<cw::file::WatchBatch> batch;
+	asio::co_spawn(io, [&]() -> asio::awaitable<void> { batch = co_await watcher->next(); }, asio::detached);
+
+	// Written three times, a directory made with a file already in it
+	for (int i = 0; i < 3; ++i) {
+		std::ofstream(root / "a" / "x.txt") << "version " << i;
+		io.run_for(std::chrono::milliseconds(5));
+	}
+	std::filesystem::create_directories(root / "new" / "inner");
+	std::ofstream(root / "new" / "inner" / "f.txt") << "nested";
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!batch && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_TRUE(batch);
+	EXPECT_FALSE(batch->overflowed);
+
+	std::set<std::filesystem::path> changed;
+	for (const auto& file : batch->files) changed.insert(file.relativePath);
+	EXPECT_EQ(batch->files.size(), changed.size());
+	EXPECT_EQ(changed, (std::set<std::filesystem::path>{ std::filesystem::path("a") / "x.txt", std::filesystem::path("new") / "inner" / "f.txt" }));
+	EXPECT_EQ(watcher->watched(), 4u);
+
+	// Later writes go into the next batch
+	batch.reset();
+	asio::co_spawn(io, [&]() -> asio::awaitable<void> { batch = co_await watcher->next(); }, asio::detached);
+	std::ofstream(root / "new" / "inner" / "g.txt") << "later";
+	deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!batch && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_TRUE(batch);
+	ASSERT_EQ(batch->files.size(), 1u);
+	EXPECT_EQ(batch->files[0].relativePath, std::filesystem::path("new") / "inner" / "g.txt");
+	EXPECT_EQ(batch->files[0].size, 5u);
+
+	watcher->cancel();
+	std::filesystem::remove_all(root);
+}
+
+static asio::awaitable<void> watchTree(std::shared_ptr<cw::network::ClientPool> pool, uint16_t port, std::filesystem::path root)
+{
+	auto lease = co_await pool->asyncAcquire("127.0.0.1", port, asio::use_awaitable);
+	std::vector<std::shared_ptr<cw::network::Connection>> conns{ lease.get() };
+	cw::DirectoryUploadOptions uploadOptions;
+	uploadOptions.watchDebounce = std::chrono::milliseconds(20);
+	co_await cw::asyncWatchDirectory(conns, root, {}, uploadOptions);
+}
+
+TEST(WatchModeTest, ChangedFilesAreSentWhileWatching) {
+	// Names are relative to 'source', and the server writes to the working directory
+	auto source = std::filesystem::temp_directory_path() / "cw_watch_src";
+	std::filesystem::remove_all(source);
+	std::filesystem::remove_all("cw_watch");
+	std::filesystem::create_directories(source / "cw_watch");
+	std::ofstream(source / "cw_watch" / "first.txt") << "there from the start";
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	auto pool = cw::network::ClientPool::create(io);
+	asio::co_spawn(io, watchTree(pool, server.port(), source), asio::detached);
+
+	auto waitFor = [&](const std::filesystem::path& path, const std::string& contents)
+		{
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+			while (readText(path) != contents && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+			return readText(path) == contents;
+		};
+
+	EXPECT_TRUE(waitFor("cw_watch/first.txt", "there from the start"));
+
+	// Written after the first pass: sent without another scan
+	std::ofstream(source / "cw_watch" / "second.txt") << "written later";
+	EXPECT_TRUE(waitFor("cw_watch/second.txt", "written later"));
+	std::ofstream(source / "cw_watch" / "first.txt") << "changed";
+	EXPECT_TRUE(waitFor("cw_watch/first.txt", "changed"));
+
+	std::filesystem::remove_all("cw_watch");
+	std::filesystem::remove_all(source);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// 91. SCAN INDEX (the last completed sync, mapped; unchanged files not asked about)
+// ---------------------------------------------------------------------------
+TEST(ScanIndexTest, SavedRecordsAreFoundInTheMappedFile) {
+	auto path = std::filesystem::temp_directory_path() / "cw_scan_index" / "index";
+	std::filesystem::remove_all(path.parent_path());
+
+	cw::file::ScanIndex missing(path);
+	EXPECT_EQ(missing.size(), 0u);
+	EXPECT_FALSE(missing.find("a"));
+
+	// Out of order, one path twice: the last record wins
+	missing.record({ "dir/z.bin", 1, 10, 100, 0 });
+	missing.record({ "a.txt", 2, 20, 200, 0xabc });
+	missing.record({ "dir/m.bin", 3, 30, 300, 0 });
+	missing.record({ "a.txt", 4, 40, 400, 0xdef });
+	EXPECT_FALSE(missing.save());
+
+	cw::file::ScanIndex index(path);
+	EXPECT_EQ(index.size(), 3u);
+	auto a = index.find("a.txt");
+	ASSERT_TRUE(a);
+	EXPECT_EQ(a->size, 4u);
+	EXPECT_EQ(a->modifiedNs, 40);
+	EXPECT_EQ(a->inode, 400u);
+	EXPECT_EQ(a->hash, 0xdefu);
+	ASSERT_TRUE(index.find("dir/m.bin"));
+	EXPECT_EQ(index.find("dir/z.bin")->inode, 100u);
+	EXPECT_FALSE(index.find("dir"));
+	EXPECT_FALSE(index.find("zzz"));
+
+	// Cut short: opened as empty, not read past its end
+	auto size = std::filesystem::file_size(path);
+	std::filesystem::resize_file(path, size - 12);
+	cw::file::ScanIndex damaged(path);
+	EXPECT_FALSE(damaged.find("dir/z.bin"));
+	std::filesystem::resize_file(path, 10);
+	EXPECT_EQ(cw::file::ScanIndex(path).size(), 0u);
+
+	// One per tree and server
+	EXPECT_NE(cw::file::ScanIndex::defaultPath("a", "host"), cw::file::ScanIndex::defaultPath("b", "host"));
+	EXPECT_NE(cw::file::ScanIndex::defaultPath("a", "host"), cw::file::ScanIndex::defaultPath("a", "other"));
+	std::filesystem::remove_all(path.parent_path());
+}
+
+static asio::awaitable<void> findChanged(std::shared_ptr<cw::network::ClientPool> pool, uint16_t port, std::filesystem::path root,
+	std::shared_ptr<cw::file::ScanIndex> index, std::optional<std::set<std::string>>* changed)
+{
+	auto lease = co_await pool->asyncAcquire("127.0.0.1", port, asio::use_awaitable);
+	auto files = co_await cw::asyncFindChangedFiles(lease.get(), root, true, std::nullopt, index);
+	std::set<std::string> names;
+	for (const auto& file : files) names.insert(file.relativePath.generic_string());
+	*changed = names;
+}
+
+TEST(ScanIndexTest, SyncAsksOnlyAboutFilesChangedSinceTheIndex) {
+	auto source = std::filesystem::temp_directory_path() / "cw_scanidx_src";
+	auto path = std::filesystem::temp_directory_path() / "cw_scanidx_index";
+	std::filesystem::remove_all(source);
+	std::filesystem::remove(path);
+	std::filesystem::remove_all("cw_scanidx");
+	std::filesystem::create_directories(source / "cw_scanidx");
+	std::ofstream(source / "cw_scanidx" / "a.txt") << "alpha";
+	std::ofstream(source / "cw_scanidx" / "b.txt") << "beta";
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	auto pool = cw::network::ClientPool::create(io);
+	auto run = [&](std::shared_ptr<cw::file::ScanIndex> index)
+		{
+			std::optional<std::set<std::string>> changed;
+			asio::co_spawn(io, findChanged(pool, server.port(), source, index, &changed), asio::detached);
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+			while (!changed && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+			return changed.value_or(std::set<std::string>{ "timed out" });
+		};
+
+	// Nothing indexed: the server lacks both
+	auto first = std::make_shared<cw::file::ScanIndex>(path);
+	EXPECT_EQ(run(first), (std::set<std::string>{ "cw_scanidx/a.txt", "cw_scanidx/b.txt" }));
+	EXPECT_EQ(first->recorded(), 2u);
+	EXPECT_FALSE(first->save());
+
+	// The server still lacks both, but only the file changed since is asked about
+	std::ofstream(source / "cw_scanidx" / "b.txt") << "beta, longer";
+	auto second = std::make_shared<cw::file::ScanIndex>(path);
+	EXPECT_EQ(second->size(), 2u);
+	EXPECT_EQ(run(second), (std::set<std::string>{ "cw_scanidx/b.txt" }));
+	EXPECT_EQ(second->recorded(), 2u);
+
+	std::filesystem::remove_all(source);
+	std::filesystem::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// 92. SUBTREE DIGESTS (sync compares directories first, lists only those that differ)
+// ---------------------------------------------------------------------------
+TEST(SubtreeDigestTest, RoundTripAndTreeSums) {
+	SubtreeDigests original;
+	original.requestId = 9;
+	original.flags = SubtreeDigests::SUBTREE_WITH_HASH | SubtreeDigests::SUBTREE_FRESH;
+	original.subtrees.push_back({ ".", 0x1234, -5 });
+	original.subtrees.push_back({ "a/b", 0xffffffffffffffffull, 1'700'000'000'000'000'000 });
+
+	std::vector<uint8_t> frame = buildFrame(original);
+	ParsedFrame view = parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::SubtreeDigests);
+	auto decoded = SubtreeDigests::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(decoded.requestId, 9u);
+	EXPECT_EQ(decoded.flags, original.flags);
+	ASSERT_EQ(decoded.subtrees.size(), 2u);
+	EXPECT_EQ(decoded.subtrees[0].directory, ".");
+	EXPECT_EQ(decoded.subtrees[0].newestNs, -5);
+	EXPECT_EQ(decoded.subtrees[1].directory, "a/b");
+	EXPECT_EQ(decoded.subtrees[1].digest, 0xffffffffffffffffull);
+	EXPECT_THROW(SubtreeDigests::deserialize(view.payload_view, view.size - 1), std::runtime_error);
+
+	// A directory sums up its files and the directories below it
+	auto root = std::filesystem::temp_directory_path() / "cw_subtree_sum";
+	std::filesystem::remove_all(root);
+	std::filesystem::create_directories(root / "a" / "b");
+	std::ofstream(root / "top.txt") << "top";
+	std::ofstream(root / "a" / "one.txt") << "one";
+	std::ofstream(root / "a" / "b" / "two.txt") << "two!";
+
+	std::unordered_map<std::string, cw::file::SubtreeSummary> sums;
+	cw::file::summarizeTree(root, "a", false, sums);
+	EXPECT_EQ(sums.size(), 2u);
+	EXPECT_EQ(sums.at("a/b").digest, cw::file::subtreeTerm("a/b/two.txt", 4, 0));
+	EXPECT_EQ(sums.at("a").digest, cw::file::subtreeTerm("a/one.txt", 3, 0) + cw::file::subtreeTerm("a/b/two.txt", 4, 0));
+
+	// The root, from what was summed up already
+	cw::file::summarizeTree(root, {}, false, sums);
+	EXPECT_EQ(sums.at(".").digest, sums.at("a").digest + cw::file::subtreeTerm("top.txt", 3, 0));
+	EXPECT_TRUE(cw::file::subtreeMatches(sums.at("a"), sums.at("a").digest, sums.at("a").newestNs, false));
+	EXPECT_FALSE(cw::file::subtreeMatches(sums.at("a"), sums.at("a").digest, sums.at("a").oldestNs + 1, false));
+	EXPECT_TRUE(cw::file::subtreeMatches(sums.at("a"), sums.at("a").digest, sums.at("a").oldestNs + 1, true));
+
+	std::unordered_map<std::string, cw::file::SubtreeSummary> hashed;
+	cw::file::summarizeTree(root, "a/b", true, hashed);
+	EXPECT_EQ(hashed.at("a/b").digest, cw::file::subtreeTerm("a/b/two.txt", 4, *cw::file::contentHash(root / "a" / "b" / "two.txt")));
+	std::filesystem::remove_all(root);
+}
+
+static asio::awaitable<void> reconcile(std::shared_ptr<cw::network::ClientPool> pool, uint16_t port, std::filesystem::path root,
+	bool withHash, std::optional<std::set<std::string>>* changed)
+{
+	auto lease = co_await pool->asyncAcquire("127.0.0.1", port, asio::use_awaitable);
+	co_await lease->asyncWaitCapabilities(asio::use_awaitable);
+	EXPECT_TRUE(lease->peerComparesSubtrees());
+	auto files = co_await cw::asyncFindChangedFiles(lease.get(), root, withHash);
+	std::set<std::string> names;
+	for (const auto& file : files) names.insert(file.relativePath.generic_string());
+	*changed = names;
+}
+
+TEST(SubtreeDigestTest, SyncListsOnlyTheDirectoriesThatDiffer) {
+	// The server writes to and compares against the working directory
+	auto source = std::filesystem::temp_directory_path() / "cw_recon_src";
+	std::filesystem::remove_all(source);
+	std::filesystem::remove_all("cw_recon");
+	std::filesystem::create_directories(source / "cw_recon" / "a");
+	std::filesystem::create_directories(source / "cw_recon" / "b" / "c");
+	std::ofstream(source / "cw_recon" / "a" / "1.txt") << "one";
+	std::ofstream(source / "cw_recon" / "a" / "2.txt") << "two";
+	std::ofstream(source / "cw_recon" / "b" / "3.txt") << "three";
+	std::ofstream(source / "cw_recon" / "b" / "c" / "4.txt") << "four";
+
+	// The server's copy, written later: current by mtime
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	std::filesystem::copy(source / "cw_recon", "cw_recon", std::filesystem::copy_options::recursive);
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	auto pool = cw::network::ClientPool::create(io);
+	auto run = [&](bool withHash)
+		{
+			std::optional<std::set<std::string>> changed;
+			asio::co_spawn(io, reconcile(pool, server.port(), source, withHash, &changed), asio::detached);
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+			while (!changed && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+			return changed.value_or(std::set<std::string>{ "timed out" });
+		};
+
+	EXPECT_EQ(run(false), std::set<std::string>{});
+
+	// Changed on the client since: a longer file deep down, one of the same size
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	std::ofstream(source / "cw_recon" / "b" / "c" / "4.txt") << "four, longer";
+	std::ofstream(source / "cw_recon" / "a" / "1.txt") << "ONE";
+	EXPECT_EQ(run(false), (std::set<std::string>{ "cw_recon/a/1.txt", "cw_recon/b/c/4.txt" }));
+	EXPECT_EQ(run(true), (std::set<std::string>{ "cw_recon/a/1.txt", "cw_recon/b/c/4.txt" }));
+
+	// Only a different size: by contents, the other is current
+	std::filesystem::copy_file(source / "cw_recon" / "a" / "1.txt", "cw_recon/a/1.txt", std::filesystem::copy_options::overwrite_existing);
+	EXPECT_EQ(run(true), (std::set<std::string>{ "cw_recon/b/c/4.txt" }));
+
+	std::filesystem::remove_all("cw_recon");
+	std::filesystem::remove_all(source);
+}
+
+// ---------------------------------------------------------------------------
+// 93. SIGNATURE CACHE (delta signatures kept by size, mtime and inode)
+// ---------------------------------------------------------------------------
+static bool sameBlocks(const cw::packet::Signatures& a, const cw::packet::Signatures& b)
+{
+	if (a.blockSize != b.blockSize || a.fileSize != b.fileSize || a.blocks.size() != b.blocks.size()) return false;
+	for (size_t i = 0; i < a.blocks.size(); ++i) {
+		if (a.blocks[i].weak != b.blocks[i].weak || a.blocks[i].strong != b.blocks[i].strong) return false;
+	}
+	return true;
+}
+
+TEST(SignatureCacheTest, AnswersFromTheEntryUntilTheFileChanges) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_sigcache";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+
+	std::vector<uint8_t> bytes(2 * 1024 * 1024 + 777);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>((i * 2654435761u) >> 11);
+	writeBytes(dir / "big.bin", bytes);
+	writeBytes(dir / "small.bin", std::vector<uint8_t>(64 * 1024, 7));
+
+	cw::file::SignatureCache cache(dir / "cache");
+	auto expected = cw::file::computeSignatures(dir / "big.bin");
+	EXPECT_TRUE(sameBlocks(cache.signatures(dir / "big.bin"), expected));
+	EXPECT_EQ(cache.misses(), 1u);
+	EXPECT_TRUE(std::filesystem::is_regular_file(cache.entryFor(dir / "big.bin")));
+
+	EXPECT_TRUE(sameBlocks(cache.signatures(dir / "big.bin"), expected));
+	EXPECT_EQ(cache.hits(), 1u);
+
+	// Below MIN_SIZE: read each time, nothing stored
+	cache.signatures(dir / "small.bin");
+	EXPECT_FALSE(std::filesystem::exists(cache.entryFor(dir / "small.bin")));
+
+	// Rewritten: the entry no longer matches, and is replaced
+	bytes[100] ^= 0xFF;
+	writeBytes(dir / "big.bin", bytes);
+	std::filesystem::last_write_time(dir / "big.bin", std::filesystem::last_write_time(dir / "big.bin") + std::chrono::seconds(1));
+	expected = cw::file::computeSignatures(dir / "big.bin");
+	EXPECT_TRUE(sameBlocks(cache.signatures(dir / "big.bin"), expected));
+	EXPECT_EQ(cache.hits(), 1u);
+	EXPECT_TRUE(sameBlocks(cache.signatures(dir / "big.bin"), expected));
+	EXPECT_EQ(cache.hits(), 2u);
+
+	// A damaged entry is read past, not trusted
+	std::filesystem::resize_file(cache.entryFor(dir / "big.bin"), 40);
+	EXPECT_TRUE(sameBlocks(cache.signatures(dir / "big.bin"), expected));
+	EXPECT_EQ(cache.hits(), 2u);
+
+	std::filesystem::remove_all(dir);
+}
+
+static asio::awaitable<void> uploadThenAskSignatures(std::shared_ptr<cw::network::ClientPool> pool, uint16_t port,
+	std::filesystem::path path, std::shared_ptr<cw::file::SignatureCache> cache, std::optional<cw::packet::Signatures>* result)
+{
+	auto lease = co_await pool->asyncAcquire("127.0.0.1", port, asio::use_awaitable);
+	co_await cw::asyncSendFile(lease.get(), path, "cw_sigcache_received.bin");
+
+	// Refreshed on the disk pool once published
+	asio::steady_timer poll(co_await asio::this_coro::executor);
+	for (int i = 0; i < 2000 && !std::filesystem::exists(cache->entryFor("cw_sigcache_received.bin")); ++i) {
+		poll.expires_after(std::chrono::milliseconds(5));
+		co_await poll.async_wait(asio::use_awaitable);
+	}
+
+	cw::packet::SignatureRequest request;
+	request.fileName = "cw_sigcache_received.bin";
+	*result = co_await lease->asyncRequestSignatures(std::move(request), asio::use_awaitable);
+}
+
+TEST(SignatureCacheTest, ServerRefreshesPublishedFiles) {
+	auto source = std::filesystem::temp_directory_path() / "cw_sigcache_src.bin";
+	std::vector<uint8_t> bytes(3 * 1024 * 1024 + 9);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + i / 4099);
+	writeBytes(source, bytes);
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	auto cache = std::make_shared<cw::file::SignatureCache>("cw_sigcache_store");
+	server.setSignatureCache(cache);
+	auto pool = cw::network::ClientPool::create(io);
+
+	std::optional<cw::packet::Signatures> signatures;
+	asio::co_spawn(io, uploadThenAskSignatures(pool, server.port(), source, cache, &signatures), asio::detached);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (!signatures && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+
+	ASSERT_TRUE(signatures);
+	EXPECT_TRUE(sameBlocks(*signatures, cw::file::computeSignatures(source)));
+	EXPECT_EQ(cache->hits(), 1u);
+	EXPECT_EQ(cache->misses(), 0u);
+
+	std::filesystem::remove("cw_sigcache_received.bin");
+	std::filesystem::remove_all("cw_sigcache_store");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 94. BATCH COMPRESSION (small-file batches compressed as one, with a dictionary)
+// ---------------------------------------------------------------------------
+TEST(BatchCompressionTest, PacketsRoundTrip) {
+	CompressedBatch original;
+	original.codec = static_cast<uint8_t>(cw::compression::Codec::Zstd);
+	original.dictionaryId = 0xC0FFEE;
+	original.rawSize = 4096;
+	original.data = { 1, 2, 3, 4, 5 };
+
+	auto frame = buildFrame(original);
+	auto view = parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::CompressedBatch);
+	auto decoded = CompressedBatch::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(decoded.codec, original.codec);
+	EXPECT_EQ(decoded.dictionaryId, original.dictionaryId);
+	EXPECT_EQ(decoded.rawSize, original.rawSize);
+	EXPECT_EQ(decoded.data, original.data);
+	EXPECT_THROW(CompressedBatch::deserialize(view.payload_view, CompressedBatch::HEADER_SIZE - 1), std::runtime_error);
+
+	BatchDictionary dictionary;
+	dictionary.dictionaryId = 7;
+	dictionary.data = { 9, 8, 7 };
+	frame = buildFrame(dictionary);
+	view = parseFrame(frame);
+	ASSERT_EQ(view.type, PacketType::BatchDictionary);
+	auto shared = BatchDictionary::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(shared.dictionaryId, 7u);
+	EXPECT_EQ(shared.data, dictionary.data);
+	EXPECT_THROW(BatchDictionary::deserialize(view.payload_view, sizeof(uint32_t)), std::runtime_error);
+}
+
+// Small JSON documents alike in all but their values
+static std::string configFile(int i)
+{
+	return "{\n  \"service\": \"worker-" + std::to_string(i) + "\",\n  \"replicas\": " + std::to_string(i % 7 + 1) +
+		",\n  \"image\": \"registry.example.com/team/worker:" + std::to_string(i % 13) + ".0\",\n  \"resources\": { \"cpu\": \"" +
+		std::to_string(i % 4 + 1) + "\", \"memory\": \"" + std::to_string((i % 8 + 1) * 256) + "Mi\" },\n  \"env\": { \"LOG_LEVEL\": \"" +
+		(i % 2 ? "info" : "debug") + "\", \"REGION\": \"eu-west-" + std::to_string(i % 3 + 1) + "\" }\n}\n";
+}
+
+TEST(BatchCompressionTest, DictionaryLearnsWhatSmallFilesShare) {
+	if (!(cw::compression::supportedCodecs() & cw::compression::codecBit(cw::compression::Codec::Zstd))) GTEST_SKIP() << "No zstd in this build";
+
+	std::vector<std::vector<uint8_t>> samples;
+	for (int i = 0; i < 500; ++i) {
+		auto text = configFile(i);
+		samples.emplace_back(text.begin(), text.end());
+	}
+	auto dictionary = cw::compression::Dictionary::train(samples, 16 * 1024);
+	ASSERT_TRUE(dictionary);
+	EXPECT_NE(dictionary->id(), 0u);
+	EXPECT_EQ(cw::compression::Dictionary(std::vector<uint8_t>(dictionary->bytes().begin(), dictionary->bytes().end())).id(), dictionary->id());
+
+	// One file alone: the dictionary finds what plain zstd has no earlier bytes for
+	auto text = configFile(1234);
+	std::vector<uint8_t> one(text.begin(), text.end());
+	auto compressed = dictionary->compress(one);
+	ASSERT_TRUE(compressed);
+	auto plain = cw::compression::compress(cw::compression::Codec::Zstd, one);
+	EXPECT_LT(compressed->size(), plain ? plain->size() : one.size());
+
+	std::vector<uint8_t> restored(one.size());
+	EXPECT_FALSE(dictionary->decompress(*compressed, restored));
+	EXPECT_EQ(restored, one);
+}
+
+static asio::awaitable<void> uploadWithDictionary(std::shared_ptr<cw::network::Connection> conn, std::filesystem::path root, bool* done)
+{
+	co_await conn->asyncWaitCapabilities(asio::use_awaitable);
+	EXPECT_TRUE(conn->peerTakesCompressedBatches());
+
+	cw::TransferOptions options;
+	options.batchDictionary = cw::trainBatchDictionary(root, options.batchMaxFileSize);
+	EXPECT_TRUE(options.batchDictionary);
+	options.batchMaxBytes = 16 * 1024; // Several batches, one dictionary
+	cw::DirectoryUploadOptions uploadOptions;
+	uploadOptions.workers = 2;
+	std::vector<std::shared_ptr<cw::network::Connection>> conns{ conn };
+	co_await cw::asyncUploadDirectory(conns, root, options, uploadOptions);
+	*done = true;
+}
+
+TEST(BatchCompressionTest, SmallFilesArriveThroughCompressedBatches) {
+	if (!(cw::compression::supportedCodecs() & cw::compression::codecBit(cw::compression::Codec::Zstd))) GTEST_SKIP() << "No zstd in this build";
+
+	auto source = std::filesystem::temp_directory_path() / "cw_zdict_src";
+	std::filesystem::remove_all(source);
+	std::filesystem::remove_all("cw_zdict");
+	std::filesystem::create_directories(source / "cw_zdict");
+
+	std::vector<std::pair<std::string, std::string>> files;
+	size_t rawBytes = 0;
+	for (int i = 0; i < 1500; ++i) {
+		std::string name = "cw_zdict/service" + std::to_string(i) + ".json";
+		files.emplace_back(name, configFile(i));
+		std::ofstream(source / name, std::ios::binary) << files.back().second;
+		rawBytes += files.back().second.size();
+	}
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	auto client = cw::network::Connection::create(io);
+
+	bool done = false;
+	client->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, uploadWithDictionary(client, source, &done), asio::detached);
+		});
+
+	auto arrived = [&files]()
+		{
+			for (const auto& [name, contents] : files) {
+				std::error_code ec;
+				if (std::filesystem::file_size(name, ec) != contents.size() || ec) return false;
+			}
+			return true;
+		};
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!(done && arrived()) && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	EXPECT_TRUE(done);
+
+	for (const auto& [name, contents] : files) {
+		std::ifstream in(name, std::ios::binary);
+		EXPECT_EQ(std::string(std::istreambuf_iterator<char>(in), {}), contents) << name;
+	}
+	// Names, contents and the dictionary itself, in a fraction of the bytes
+	EXPECT_LT(client->metrics()->bytesSent(), rawBytes / 2);
+
+	std::filesystem::remove_all("cw_zdict");
+	std::filesystem::remove_all(source);
+}
+
+// ---------------------------------------------------------------------------
+// 95. WORK POOL (chunks compressed, checksummed and decompressed side by side)
+// ---------------------------------------------------------------------------
+static asio::awaitable<void> takeInOrder(cw::OrderedJobs<int>& jobs, std::vector<int>* taken, bool* threw)
+{
+	while (!jobs.empty()) {
+		try {
+			taken->push_back(co_await jobs.next());
+		}
+		catch (const std::runtime_error&) {
+			*threw = true;
+		}
+	}
+}
+
+TEST(WorkPoolTest, OrderedJobsAreTakenInSubmissionOrder) {
+	auto pool = std::make_shared<cw::WorkPool>(4);
+	asio::io_context io;
+	cw::OrderedJobs<int> jobs(pool, io.get_executor());
+
+	// Early jobs take longest: they finish last, and are still taken first
+	for (int i = 0; i < 12; ++i) {
+		jobs.submit([i]()
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(12 - i));
+				if (i == 5) throw std::runtime_error("job failed");
+				return i;
+			});
+	}
+	EXPECT_EQ(jobs.size(), 12u);
+
+	std::vector<int> taken;
+	bool threw = false;
+	asio::co_spawn(io, takeInOrder(jobs, &taken, &threw), asio::detached);
+	io.run_for(std::chrono::seconds(5));
+
+	EXPECT_TRUE(threw);
+	EXPECT_EQ(taken, (std::vector<int>{ 0, 1, 2, 3, 4, 6, 7, 8, 9, 10, 11 }));
+	EXPECT_TRUE(jobs.empty());
+}
+
+TEST(WorkPoolTest, ResequencerAppliesInSubmissionOrder) {
+	auto pool = std::make_shared<cw::WorkPool>(4);
+	asio::thread_pool target(2);
+	auto strand = asio::make_strand(target.get_executor());
+	std::vector<int> applied; // Only touched on the strand
+	std::atomic<int> count{ 0 };
+	{
+		cw::Resequencer resequencer(pool, strand);
+		for (int i = 0; i < 40; ++i) {
+			// Every fifth without work: posted, it still waits its turn
+			if (i % 5 == 4) {
+				resequencer.post([&, i]() { applied.push_back(i); ++count; });
+				continue;
+			}
+			resequencer.submit([i]() { std::this_thread::sleep_for(std::chrono::microseconds((40 - i) * 100)); },
+				[&, i]() { applied.push_back(i); ++count; });
+		}
+	}
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (count < 40 && std::chrono::steady_clock::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	target.join();
+
+	ASSERT_EQ(applied.size(), 40u);
+	for (int i = 0; i < 40; ++i) EXPECT_EQ(applied[i], i);
+}
+
+TEST(WorkPoolTest, FileSentThroughThePoolArrivesIntact) {
+	auto source = std::filesystem::temp_directory_path() / "cw_workpool_src.bin";
+	std::vector<uint8_t> bytes(6 * 1024 * 1024 + 333);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>((i / 64) % 7 == 0 ? i * 31 + (i >> 11) : i % 29);
+	std::fill(bytes.begin() + 2 * 1024 * 1024, bytes.begin() + 3 * 1024 * 1024, 0); // Zero chunks go as FileHole
+	writeBytes(source, bytes);
+
+	auto pool = std::make_shared<cw::WorkPool>(4);
+	auto diskWriter = std::make_shared<cw::file::DiskWriter>(2);
+	diskWriter->setWorkPool(pool);
+
+	asio::io_context io;
+	cw::network::Server server(io, 0, diskWriter);
+	server.setTreeHash(true);
+	auto client = cw::network::Connection::create(io);
+
+	bool done = false;
+	client->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+
+			cw::TransferOptions options;
+			options.workPool = pool;
+			options.treeHash = true;
+			options.ackWindowBytes = 2 * 1024 * 1024; // Waits on acks with chunks still on the pool
+			for (auto codec : { cw::compression::Codec::Zstd, cw::compression::Codec::Lz4 }) {
+				if (cw::compression::supportedCodecs() & cw::compression::codecBit(codec)) options.compression = codec;
+			}
+			asio::co_spawn(io, [&, options]() -> asio::awaitable<void>
+				{
+					co_await client->asyncWaitCapabilities(asio::use_awaitable);
+					co_await cw::asyncSendFile(client, source, "cw_workpool.bin", options);
+					done = true;
+				}, asio::detached);
+		});
+
+	auto arrived = []()
+		{
+			std::error_code ec;
+			return std::filesystem::exists("cw_workpool.bin", ec);
+		};
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (!(done && arrived()) && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	EXPECT_TRUE(done);
+
+	std::ifstream in("cw_workpool.bin", std::ios::binary);
+	std::vector<uint8_t> received((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_TRUE(received == bytes);
+
+	std::filesystem::remove("cw_workpool.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 96. WORK-STEALING SCHEDULER (per-thread deques, bounded injection queue)
+// ---------------------------------------------------------------------------
+static asio::awaitable<void> runOnPool(cw::WorkPool& pool, std::thread::id ioThread, int* result, bool* threw, bool* resumedHere)
+{
+	*result = co_await pool.asyncRun([]() { return 6 * 7; }, asio::use_awaitable);
+	*resumedHere = std::this_thread::get_id() == ioThread;
+	try {
+		co_await pool.asyncRun([]() { throw std::runtime_error("task failed"); }, asio::use_awaitable);
+	}
+	catch (const std::runtime_error&) {
+		*threw = true;
+	}
+}
+
+TEST(WorkSchedulerTest, AsyncRunCompletesOnTheCallersExecutor) {
+	cw::WorkPool pool(3);
+	asio::io_context io;
+	int result = 0;
+	bool threw = false;
+	bool resumedHere = false;
+	asio::co_spawn(io, runOnPool(pool, std::this_thread::get_id(), &result, &threw, &resumedHere), asio::detached);
+	io.run_for(std::chrono::seconds(5));
+
+	EXPECT_EQ(result, 42);
+	EXPECT_TRUE(threw);
+	EXPECT_TRUE(resumedHere);
+}
+
+TEST(WorkSchedulerTest, TasksSpawnedByATaskAreStolenByIdleThreads) {
+	cw::WorkPool pool(4);
+	std::atomic<int> done{ 0 };
+	std::mutex mutex;
+	std::set<std::thread::id> ran;
+
+	// One task queues all the others on its own deque: only stealing spreads them
+	asio::post(pool.executor(), [&]()
+		{
+			EXPECT_TRUE(pool.runningInThisThread());
+			for (int i = 0; i < 64; ++i) {
+				asio::post(pool.executor(), [&]()
+					{
+						std::this_thread::sleep_for(std::chrono::milliseconds(2));
+						{
+							std::lock_guard lock(mutex);
+							ran.insert(std::this_thread::get_id());
+						}
+						++done;
+					});
+			}
+		});
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (done < 64 && std::chrono::steady_clock::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	EXPECT_EQ(done, 64);
+	EXPECT_GT(pool.steals(), 0u);
+	EXPECT_GT(ran.size(), 1u);
+	EXPECT_FALSE(pool.runningInThisThread());
+}
+
+TEST(WorkSchedulerTest, FullInjectionQueueHoldsBackTheSubmitter) {
+	std::atomic<int> done{ 0 };
+	{
+		cw::WorkPool pool(2, 4);
+		for (int i = 0; i < 200; ++i) {
+			pool.schedule([&done]()
+				{
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+					++done;
+				});
+		}
+	}
+	// Nothing was dropped, and the pool ran what was queued before it stopped
+	EXPECT_EQ(done, 200);
+}
+
+static asio::awaitable<void> hashOnPool(std::shared_ptr<cw::WorkPool> pool, std::vector<std::filesystem::path> paths,
+	std::vector<std::optional<uint64_t>>* hashes)
+{
+	*hashes = co_await cw::detail::asyncHashFiles(std::move(paths), std::nullopt, pool);
+}
+
+TEST(WorkSchedulerTest, FilesAreHashedSideBySide) {
+	auto root = std::filesystem::temp_directory_path() / "cw_hash_pool";
+	std::filesystem::remove_all(root);
+	std::filesystem::create_directories(root);
+	std::vector<std::filesystem::path> paths;
+	for (int i = 0; i < 40; ++i) {
+		paths.push_back(root / ("f" + std::to_string(i)));
+		std::ofstream(paths.back(), std::ios::binary) << std::string(1000 + i * 37, static_cast<char>('a' + i % 26));
+	}
+	paths.push_back(root / "missing");
+	paths.push_back({}); // Skipped
+
+	asio::io_context io;
+	std::vector<std::optional<uint64_t>> hashes;
+	asio::co_spawn(io, hashOnPool(std::make_shared<cw::WorkPool>(4), paths, &hashes), asio::detached);
+	io.run_for(std::chrono::seconds(10));
+
+	ASSERT_EQ(hashes.size(), paths.size());
+	for (int i = 0; i < 40; ++i) EXPECT_EQ(hashes[i], cw::file::contentHash(paths[i])) << i;
+	EXPECT_FALSE(hashes[40]);
+	EXPECT_FALSE(hashes[41]);
+	std::filesystem::remove_all(root);
+}
+
+// ---------------------------------------------------------------------------
+// 97. CRC32C BACKENDS (interleaved lanes, ISA-L) AND THE DEFLATE CODEC
+// ---------------------------------------------------------------------------
+
+TEST(AcceleratedChecksumTest, MatchesSoftwareAroundTheLaneThreshold)
+{
+	std::vector<std::uint8_t> data(3 * 65536 + 97);
+	std::mt19937 rng(97);
+	for (auto& byte : data) byte = static_cast<std::uint8_t>(rng());
+
+	EXPECT_FALSE(cw::integrity::crc32cBackend().empty());
+	for (std::size_t length : { 0uz, 1uz, 7uz, 4095uz, 4096uz, 4097uz, 4096uz * 3 + 1, 4096uz * 3 + 23, 65536uz, data.size() }) {
+		std::uint32_t expected = ~cw::integrity::detail::crc32cSoftware(0xFFFFFFFFu, data.data(), length);
+		EXPECT_EQ(cw::integrity::crc32c(std::span(data.data(), length)), expected) << length;
+	}
+
+	// Continuing from an earlier CRC gives the CRC of the whole
+	std::uint32_t head = cw::integrity::crc32c(std::span(data.data(), 5000));
+	EXPECT_EQ(cw::integrity::crc32c(std::span(data.data() + 5000, data.size() - 5000), head), cw::integrity::crc32c(data));
+}
+
+TEST(AcceleratedChecksumTest, DeflateRoundTrip)
+{
+	using cw::compression::Codec;
+	if (!(cw::compression::supportedCodecs() & cw::compression::codecBit(Codec::Deflate))) GTEST_SKIP() << "built without ISA-L";
+
+	std::vector<std::uint8_t> data(256 * 1024);
+	for (std::size_t i = 0; i < data.size(); ++i) data[i] = static_cast<std::uint8_t>("deflate me "[i % 11]);
+	for (int level : { 1, 3 }) {
+		auto packed = cw::compression::compress(Codec::Deflate, data, level);
+		ASSERT_TRUE(packed) << level;
+		std::vector<std::uint8_t> out(data.size());
+		EXPECT_FALSE(cw::compression::decompress(Codec::Deflate, *packed, out));
+		EXPECT_EQ(out, data);
+	}
+	EXPECT_EQ(cw::compression::codecFromName("deflate"), Codec::Deflate);
+}
+
+// ---------------------------------------------------------------------------
+// 98. FRONT-CODED FILEINFO NAMES (shared prefix with the previous name per class)
+// ---------------------------------------------------------------------------
+
+TEST(FrontCodedPathTest, NamesRoundTripPerChain) {
+	std::vector<std::pair<std::uint8_t, std::string>> names = {
+		{ 1, "project/src/module/alpha.cpp" },
+		{ 1, "project/src/module/alpha.h" },
+		{ 2, "project/assets/big.bin" },
+		{ 1, "project/src/module/beta/gamma.cpp" },
+		{ 1, "project/README" },
+		{ 2, "project/assets/big2.bin" },
+		{ 1, "project/README" },
+	};
+
+	std::array<std::string, cw::packet::PRIORITY_CLASSES> sent, received;
+	std::size_t plainBytes = 0, codedBytes = 0;
+	for (auto& [chain, name] : names) {
+		auto coded = cw::packet::FrontCodedFileInfo::code(7, 100, chain, name, sent[chain]);
+		sent[chain] = name;
+		auto frame = buildFrame(coded);
+		plainBytes += buildFrame(FileInfo{ .streamId = 7, .fileSize = 100, .fileName = name }).size();
+		codedBytes += frame.size();
+
+		auto view = cw::packet::parseFrame(frame);
+		ASSERT_EQ(view.type, PacketType::FrontCodedFileInfo);
+		auto decoded = cw::packet::FrontCodedFileInfo::deserialize(view.payload_view, view.size);
+		EXPECT_EQ(decoded.chain, chain);
+		EXPECT_EQ(decoded.streamId, 7u);
+		EXPECT_EQ(decoded.fileSize, 100u);
+		decoded.decodeInto(received[decoded.chain]);
+		EXPECT_EQ(received[chain], name);
+	}
+	EXPECT_LT(codedBytes, plainBytes);
+	EXPECT_EQ(cw::packet::FrontCodedFileInfo::code(1, 1, 0, "a/b", "a/b").suffix, "");
+}
+
+TEST(FrontCodedPathTest, RejectsAPrefixItDoesNotHave) {
+	std::string previous = "short";
+	cw::packet::FrontCodedFileInfo coded{ .streamId = 1, .fileSize = 1, .chain = 0, .prefixLength = 6, .suffix = "x" };
+	EXPECT_THROW(coded.decodeInto(previous), std::runtime_error);
+
+	coded.prefixLength = 0;
+	coded.suffix = "";
+	EXPECT_THROW(coded.decodeInto(previous), std::runtime_error);
+
+	auto frame = buildFrame(cw::packet::FrontCodedFileInfo{ .streamId = 1, .fileSize = 1, .chain = 0, .prefixLength = 2, .suffix = "name" });
+	frame.pop_back();
+	EXPECT_THROW(cw::packet::FrontCodedFileInfo::deserialize(frame.data() + FRAME_HEADER_SIZE, frame.size() - FRAME_HEADER_SIZE), std::runtime_error);
+}
+
+// ---------------------------------------------------------------------------
+// 99. FILE ATTRIBUTES (mtime and mode set on the received file as it closes)
+// ---------------------------------------------------------------------------
+
+TEST(FileAttributesTest, UploadKeepsMtimeAndMode) {
+	namespace fs = std::filesystem;
+	auto source = fs::temp_directory_path() / "cw_attributes.bin";
+	std::vector<uint8_t> bytes(300 * 1024 + 5, 0x5A);
+	std::ofstream(source, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	auto modified = fs::file_time_type::clock::now() - std::chrono::hours(24 * 400) - std::chrono::nanoseconds(123456789);
+	fs::last_write_time(source, modified);
+	fs::permissions(source, fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read);
+	fs::remove_all("cw_attributes");
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(asio::ip::tcp::endpoint(acceptor.local_endpoint()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, [client, source]() -> asio::awaitable<void>
+				{
+					co_await client->asyncWaitCapabilities(asio::use_awaitable);
+					EXPECT_TRUE(client->peerSetsAttributes());
+					co_await cw::asyncSendFile(client, source, "cw_attributes/copy.bin", {});
+				}, asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (server->metrics()->snapshot().filesReceived == 0 && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+
+	fs::path copy = "cw_attributes/copy.bin";
+	ASSERT_TRUE(fs::exists(copy));
+	EXPECT_EQ(fs::file_size(copy), bytes.size());
+	EXPECT_EQ(cw::file::modifiedNs(fs::last_write_time(copy)), cw::file::modifiedNs(fs::last_write_time(source)));
+	EXPECT_EQ(fs::status(copy).permissions() & fs::perms::all, fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read);
+	fs::remove_all("cw_attributes");
+	fs::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 100. DISK FAIR SHARE (deficit round robin of disk time across tenants)
+// ---------------------------------------------------------------------------
+
+// Runs 'jobs' jobs of about 'each' for 'tenant' on 'scheduler', recording
+// into 'order' which tenant finished each
+static void queueDiskJobs(cw::file::DiskScheduler& scheduler, const std::shared_ptr<cw::file::DiskTenant>& tenant, int jobs,
+	std::chrono::microseconds each, std::mutex& mutex, std::vector<std::string>& order)
+{
+	auto executor = scheduler.executor(tenant);
+	for (int i = 0; i < jobs; ++i) {
+		asio::post(executor, [&, name = tenant->name(), each]()
+			{
+				auto until = std::chrono::steady_clock::now() + each;
+				while (std::chrono::steady_clock::now() < until) {}
+				std::lock_guard lock(mutex);
+				order.push_back(name);
+			});
+	}
+}
+
+TEST(DiskFairShareTest, SmallTenantDoesNotWaitBehindABigOne) {
+	asio::thread_pool pool(1);
+	cw::file::DiskScheduler scheduler(pool.get_executor(), 1);
+	auto big = scheduler.tenant("big");
+	auto small = scheduler.tenant("small");
+	EXPECT_EQ(scheduler.tenant("big"), big);
+
+	std::mutex mutex;
+	std::vector<std::string> order;
+	queueDiskJobs(scheduler, big, 60, std::chrono::microseconds(200), mutex, order);
+	queueDiskJobs(scheduler, small, 5, std::chrono::microseconds(200), mutex, order);
+	pool.join();
+
+	ASSERT_EQ(order.size(), 65u);
+	// First come, first served would finish the small tenant last
+	auto lastSmall = std::find(order.rbegin(), order.rend(), "small").base() - order.begin();
+	EXPECT_LT(lastSmall, 30);
+	EXPECT_GT(small->busyTime(), std::chrono::microseconds(5 * 200));
+}
+
+TEST(DiskFairShareTest, WeightsSplitDiskTime) {
+	asio::thread_pool pool(1);
+	cw::file::DiskScheduler scheduler(pool.get_executor(), 1);
+	scheduler.setWeight("heavy", 3);
+	auto heavy = scheduler.tenant("heavy");
+	auto light = scheduler.tenant("light");
+	EXPECT_EQ(heavy->weight(), 3.0);
+	EXPECT_EQ(light->weight(), 1.0);
+
+	// Every job takes exactly 200us on a clock the jobs advance, so the
+	// order depends on the charges alone, not on how fast the machine is
+	std::atomic<std::int64_t> nanos{ 0 };
+	scheduler.setClock([&] { return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(nanos.load())); });
+	// and the pool holds off until both tenants have queued everything
+	std::promise<void> queued;
+	asio::post(pool, [ready = queued.get_future()]() { ready.wait(); });
+
+	std::mutex mutex;
+	std::vector<std::string> order;
+	for (auto& tenant : { light, heavy }) {
+		auto executor = scheduler.executor(tenant);
+		for (int i = 0; i < 80; ++i) {
+			asio::post(executor, [&, name = tenant->name()]()
+				{
+					nanos += 200'000;
+					std::lock_guard lock(mutex);
+					order.push_back(name);
+				});
+		}
+	}
+	queued.set_value();
+	pool.join();
+
+	ASSERT_EQ(order.size(), 160u);
+	EXPECT_EQ(heavy->busyTime(), std::chrono::microseconds(80 * 200));
+	EXPECT_EQ(light->busyTime(), std::chrono::microseconds(80 * 200));
+	// While both have work, the heavy one gets three jobs to each of the light one's
+	auto heavyCount = std::count(order.begin() + 20, order.begin() + 100, "heavy");
+	EXPECT_EQ(heavyCount, 60);
+}
+
+TEST(DiskFairShareTest, ConnectionsWriteThroughTheirTenant) {
+	auto writer = std::make_shared<cw::file::DiskWriter>(2);
+	EXPECT_EQ(writer->tenant("10.0.0.1"), nullptr);
+	writer->enableFairShare().setWeight("127.0.0.1", 2);
+
+	auto source = std::filesystem::temp_directory_path() / "cw_fair_share.bin";
+	std::vector<uint8_t> bytes(700 * 1024 + 3);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 7);
+	std::ofstream(source, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	std::filesystem::remove_all("cw_fair_share");
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	server->setDiskWriter(writer);
+	std::shared_ptr<cw::file::DiskTenant> tenant;
+	acceptor.async_accept(server->socket(), [&](std::error_code ec)
+		{
+			if (ec) return;
+			tenant = writer->tenant(server->peerAddress());
+			server->setDiskTenant(tenant);
+			server->start();
+		});
+
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(asio::ip::tcp::endpoint(acceptor.local_endpoint()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, cw::asyncSendFile(client, source, "cw_fair_share/copy.bin", {}), asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (server->metrics()->snapshot().filesReceived == 0 && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+
+	ASSERT_TRUE(tenant);
+	EXPECT_EQ(tenant->name(), "127.0.0.1");
+	EXPECT_EQ(tenant->weight(), 2.0);
+	EXPECT_GT(tenant->busyTime().count(), 0);
+
+	std::ifstream in("cw_fair_share/copy.bin", std::ios::binary);
+	std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(contents, bytes);
+	in.close();
+	std::filesystem::remove_all("cw_fair_share");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 101. ADMISSION CONTROL (busy receivers refuse new files, senders retry)
+// ---------------------------------------------------------------------------
+
+TEST(AdmissionControlTest, DiskWriterRefusesWhileBehind) {
+	cw::file::DiskWriter writer(1);
+	EXPECT_FALSE(writer.admissionLimited());
+	writer.load()->add(64 * 1024 * 1024);
+	EXPECT_FALSE(writer.admissionDelay()); // No limits: everything is taken
+
+	writer.setAdmissionLimits(1024 * 1024, std::chrono::milliseconds(0));
+	EXPECT_TRUE(writer.admissionLimited());
+	auto delay = writer.admissionDelay();
+	ASSERT_TRUE(delay);
+	EXPECT_GE(*delay, std::chrono::milliseconds(100));
+	writer.load()->remove(64 * 1024 * 1024 - 1000);
+	EXPECT_FALSE(writer.admissionDelay());
+
+	// Slow writes, while something is queued; the delay follows their latency
+	writer.setAdmissionLimits(0, std::chrono::milliseconds(50));
+	for (int i = 0; i < 64; ++i) writer.load()->record(std::chrono::seconds(2));
+	delay = writer.admissionDelay();
+	ASSERT_TRUE(delay);
+	EXPECT_GT(*delay, std::chrono::milliseconds(1000));
+	writer.load()->remove(1000);
+	EXPECT_FALSE(writer.admissionDelay()); // An idle disk takes anything
+
+	cw::packet::Error busy;
+	busy.code = static_cast<uint16_t>(cw::packet::ErrorCode::Busy);
+	busy.streamId = 7;
+	busy.retryAfterMs = 1500;
+	busy.message = "busy";
+	std::vector<uint8_t> payload(busy.payloadSize());
+	cw::binary::ByteWriter out(payload.data());
+	busy.serialize(out);
+	auto decoded = cw::packet::Error::deserialize(payload.data(), payload.size());
+	EXPECT_EQ(decoded.streamId, 7u);
+	EXPECT_EQ(decoded.retryAfterMs, 1500u);
+	// An older peer's Error, without the field
+	auto older = cw::packet::Error::deserialize(payload.data(), payload.size() - sizeof(uint32_t));
+	EXPECT_EQ(older.streamId, 7u);
+	EXPECT_EQ(older.retryAfterMs, 0u);
+}
+
+// Sends 'source' to a server whose disk looks behind until 'clearAfter';
+// returns the upload's error, if any, and the wait the server asked for
+static std::error_code uploadToBusyServer(const std::filesystem::path& source, const std::string& name, unsigned busyRetries,
+	std::chrono::milliseconds clearAfter, std::chrono::milliseconds& retryAfter)
+{
+	constexpr std::size_t BACKLOG = 8 * 1024 * 1024;
+	auto writer = std::make_shared<cw::file::DiskWriter>(1);
+	writer->setAdmissionLimits(1024 * 1024, std::chrono::milliseconds(0));
+	writer->load()->add(BACKLOG);
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	server->setDiskWriter(writer);
+	acceptor.async_accept(server->socket(), [&](std::error_code ec)
+		{
+			if (!ec) server->start();
+		});
+
+	asio::steady_timer clear(io, clearAfter);
+	clear.async_wait([&](std::error_code) { writer->load()->remove(BACKLOG); });
+
+	auto client = cw::network::Connection::create(io);
+	std::optional<std::error_code> result;
+	client->socket().async_connect(asio::ip::tcp::endpoint(acceptor.local_endpoint()), [&](std::error_code ec)
+		{
+			if (ec) {
+				result = ec;
+				return;
+			}
+			client->start();
+			asio::co_spawn(io, [&]() -> asio::awaitable<void>
+				{
+					co_await client->asyncWaitCapabilities(asio::use_awaitable);
+					cw::TransferOptions options;
+					options.busyRetries = busyRetries;
+					options.busyBackoff = std::chrono::milliseconds(10);
+					co_await cw::asyncSendFile(client, source, name, options);
+				},
+				[&](std::exception_ptr e)
+				{
+					result = std::error_code{};
+					try {
+						if (e) std::rethrow_exception(e);
+					}
+					catch (const std::system_error& error) {
+						result = error.code();
+					}
+				});
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!result && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(10));
+	EXPECT_TRUE(client->peerRefusesWhenBusy());
+	retryAfter = client->busyRetryAfter();
+	return result.value_or(std::make_error_code(std::errc::timed_out));
+}
+
+TEST(AdmissionControlTest, BusyServerGetsTheFileLater) {
+	namespace fs = std::filesystem;
+	auto source = fs::temp_directory_path() / "cw_admission.bin";
+	std::vector<uint8_t> bytes(300 * 1024 + 11);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13);
+	std::ofstream(source, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	fs::remove_all("cw_admission");
+
+	std::chrono::milliseconds retryAfter{ 0 };
+	EXPECT_FALSE(uploadToBusyServer(source, "cw_admission/copy.bin", 8, std::chrono::milliseconds(150), retryAfter));
+	EXPECT_GE(retryAfter, std::chrono::milliseconds(100));
+
+	std::ifstream in("cw_admission/copy.bin", std::ios::binary);
+	std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(contents, bytes);
+	in.close();
+
+	// Without retries the file is not held for a second try: the refused one never lands
+	uploadToBusyServer(source, "cw_admission/refused.bin", 0, std::chrono::seconds(30), retryAfter);
+	EXPECT_FALSE(fs::exists("cw_admission/refused.bin"));
+
+	fs::remove_all("cw_admission");
+	fs::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 102. LIVE STATS (StatsRequest / StatsResponse over the data protocol)
+// ---------------------------------------------------------------------------
+
+TEST(LiveStatsTest, ServerAnswersStatsRequests) {
+	auto registry = std::make_shared<cw::metrics::MetricsRegistry>();
+	auto writer = std::make_shared<cw::file::DiskWriter>(1);
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	server->setDiskWriter(writer);
+	server->serveStats(registry);
+	acceptor.async_accept(server->socket(), [&](std::error_code ec)
+		{
+			if (ec) return;
+			registry->track(server->metrics());
+			server->start();
+		});
+
+	auto client = cw::network::Connection::create(io);
+	std::optional<std::error_code> result;
+	std::string text;
+	client->socket().async_connect(asio::ip::tcp::endpoint(acceptor.local_endpoint()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			client->asyncWaitCapabilities([&](std::error_code ec)
+				{
+					ASSERT_FALSE(ec);
+					EXPECT_TRUE(client->peerServesStats());
+					client->asyncQueryStats([&](std::error_code ec, std::string stats)
+						{
+							result = ec;
+							text = std::move(stats);
+						});
+				});
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!result && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(10));
+	ASSERT_TRUE(result);
+	EXPECT_FALSE(*result);
+	EXPECT_NE(text.find("cw_connections_open 1\n"), std::string::npos);
+	EXPECT_NE(text.find("cw_disk_latency_seconds_count"), std::string::npos);
+	EXPECT_NE(text.find("cw_disk_queued_bytes 0\n"), std::string::npos);
+	EXPECT_NE(text.find("# TYPE cw_transfer_received_bytes gauge\n"), std::string::npos);
+
+	// The server does not ask: the client serves none
+	EXPECT_FALSE(server->peerServesStats());
+	std::optional<std::error_code> refused;
+	server->asyncQueryStats([&](std::error_code ec, std::string) { refused = ec; });
+	deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!refused && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(10));
+	ASSERT_TRUE(refused);
+	EXPECT_EQ(*refused, std::errc::operation_not_supported);
+
+	EXPECT_EQ(cw::network::prometheusLabel("a\"b\\c\nd"), "a\\\"b\\\\c\\nd");
+}
+
+// ---------------------------------------------------------------------------
+// 103. AF_XDP FRAMING (Ethernet/IPv4/UDP headers written and read in UMEM)
+// ---------------------------------------------------------------------------
+
+TEST(XdpFramingTest, HeadersRoundTripAndRejectCorruption) {
+	namespace xdp = cw::network::xdp;
+	xdp::Address from{ { 0x02, 0, 0, 0, 0, 1 }, { asio::ip::make_address_v4("10.0.0.1"), 40000 } };
+	xdp::Address to{ { 0x02, 0, 0, 0, 0, 2 }, { asio::ip::make_address_v4("10.0.0.2"), 8080 } };
+
+	std::string payload = "stream bytes over a dedicated link";
+	std::vector<uint8_t> frame(xdp::HEADERS_SIZE + payload.size());
+	std::memcpy(frame.data() + xdp::HEADERS_SIZE, payload.data(), payload.size());
+	xdp::writeHeaders(frame.data(), from, to, payload.size(), 7);
+
+	// The IPv4 header sums to zero with its checksum in
+	EXPECT_EQ(xdp::checksumFold(xdp::checksumAdd(frame.data() + xdp::ETHERNET_HEADER_SIZE, 20)), 0);
+
+	xdp::Address parsedFrom, parsedTo;
+	auto parsed = xdp::parseFrame(frame, parsedFrom, parsedTo);
+	ASSERT_TRUE(parsed);
+	EXPECT_EQ(std::string(parsed->begin(), parsed->end()), payload);
+	EXPECT_EQ(parsedFrom.endpoint, from.endpoint);
+	EXPECT_EQ(parsedTo.endpoint, to.endpoint);
+	EXPECT_EQ(parsedFrom.mac, from.mac);
+	EXPECT_EQ(parsedTo.mac, to.mac);
+
+	// A flipped payload bit fails the UDP checksum
+	auto corrupt = frame;
+	corrupt.back() ^= 1;
+	EXPECT_FALSE(xdp::parseFrame(corrupt, parsedFrom, parsedTo));
+
+	// Fragments and other protocols are not ours
+	auto fragment = frame;
+	fragment[xdp::ETHERNET_HEADER_SIZE + 6] |= 0x20;
+	EXPECT_FALSE(xdp::parseFrame(fragment, parsedFrom, parsedTo));
+	auto arp = frame;
+	arp[12] = 0x08;
+	arp[13] = 0x06;
+	EXPECT_FALSE(xdp::parseFrame(arp, parsedFrom, parsedTo));
+	EXPECT_FALSE(xdp::parseFrame(std::span<const uint8_t>(frame).first(xdp::HEADERS_SIZE - 1), parsedFrom, parsedTo));
+}
+
+// ---------------------------------------------------------------------------
+// 104. SPINNING EVENT LOOP (io_context polled without sleeping)
+// ---------------------------------------------------------------------------
+
+TEST(SpinningLoopTest, RunsHandlersAndStopsLikeRun) {
+	asio::io_context io;
+
+	// Out of work: returns, as run() would
+	int ran = 0;
+	asio::steady_timer timer(io, std::chrono::milliseconds(5));
+	timer.async_wait([&](std::error_code ec)
+		{
+			EXPECT_FALSE(ec);
+			++ran;
+			asio::post(io, [&]() { ++ran; });
+		});
+	cw::network::runSpinning(io);
+	EXPECT_EQ(ran, 2);
+	EXPECT_TRUE(io.stopped());
+
+	// Stopped from another thread while it has work
+	io.restart();
+	auto guard = asio::make_work_guard(io);
+	std::thread stopper([&io]()
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			io.stop();
+		});
+	cw::network::runEventLoop(io, true);
+	stopper.join();
+	EXPECT_TRUE(io.stopped());
+}
+
+// ---------------------------------------------------------------------------
+// 105. INLINE SENDS (a shard's connections send without the posted flush)
+// ---------------------------------------------------------------------------
+
+TEST(InlineSendTest, SendsFromTheStrandAndFromOtherThreads) {
+	// Configured as ShardedServer configures its contexts
+	asio::io_context io(asio::config_from_string("scheduler.concurrency_hint=1\nreactor.io_locking=0"));
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	auto client = cw::network::Connection::create(io);
+	client->setInlineSends(true);
+	std::thread other;
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			// On the strand: each goes out inline, queued behind the write in flight
+			for (int i = 0; i < 10; ++i) {
+				cw::packet::Ack ack;
+				ack.streamId = 1000 + i;
+				client->send(ack);
+			}
+			// Off it, as the disk pool sends: through the posted flush
+			other = std::thread([&client]()
+				{
+					for (int i = 0; i < 10; ++i) {
+						cw::packet::Ack ack;
+						ack.streamId = 2000 + i;
+						client->send(ack);
+					}
+				});
+		});
+
+	io.run_for(std::chrono::milliseconds(300));
+	other.join();
+
+	// Capabilities on start, then the twenty acks
+	EXPECT_EQ(client->metrics()->snapshot().framesSent, 21u);
+	EXPECT_GE(server->metrics()->snapshot().framesReceived, 21u);
+}
+
+// ---------------------------------------------------------------------------
+// 106. PENDING REQUESTS (replies matched to pipelined requests by id)
+// ---------------------------------------------------------------------------
+
+TEST(PendingRequestsTest, CompletesByIdInAnyOrder) {
+	cw::network::PendingRequests requests;
+	std::vector<std::pair<std::uint32_t, std::string>> completed;
+	std::optional<std::error_code> failed;
+
+	std::uint32_t first = requests.nextId();
+	std::uint32_t second = requests.nextId();
+	std::uint32_t third = requests.nextId();
+	EXPECT_NE(first, 0u);
+	EXPECT_NE(first, second);
+	requests.add<std::string>(first, [&, first](std::error_code ec, std::string text) { EXPECT_FALSE(ec); completed.emplace_back(first, text); });
+	requests.add<std::string>(second, [&, second](std::error_code ec, std::string text) { EXPECT_FALSE(ec); completed.emplace_back(second, text); });
+	requests.add<std::vector<std::uint32_t>>(third, [&](std::error_code ec, std::vector<std::uint32_t> indices)
+		{
+			failed = ec;
+			EXPECT_TRUE(indices.empty());
+		});
+	EXPECT_EQ(requests.size(), 3u);
+
+	// Replies out of order; one of the wrong kind, and one nobody asked for, change nothing
+	EXPECT_TRUE(requests.complete(second, std::string("two")));
+	EXPECT_FALSE(requests.complete(third, std::string("wrong kind")));
+	EXPECT_FALSE(requests.complete(third + 100, std::string("unasked")));
+	EXPECT_TRUE(requests.complete(first, std::string("one")));
+	EXPECT_FALSE(requests.complete(first, std::string("again")));
+	ASSERT_EQ(completed.size(), 2u);
+	EXPECT_EQ(completed[0], std::make_pair(second, std::string("two")));
+	EXPECT_EQ(completed[1], std::make_pair(first, std::string("one")));
+
+	// Closing fails the rest
+	requests.failAll(asio::error::operation_aborted);
+	ASSERT_TRUE(failed);
+	EXPECT_EQ(*failed, asio::error::operation_aborted);
+	EXPECT_EQ(requests.size(), 0u);
+}
+
+TEST(PendingRequestsTest, PipelinesRequestsOverAConnection) {
+	auto registry = std::make_shared<cw::metrics::MetricsRegistry>();
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	server->setDiskWriter(std::make_shared<cw::file::DiskWriter>(1));
+	server->serveStats(registry);
+	acceptor.async_accept(server->socket(), [&](std::error_code ec) { if (!ec) server->start(); });
+
+	// Eight requests in flight at once, then one awaited from a coroutine
+	constexpr int REQUESTS = 8;
+	auto client = cw::network::Connection::create(io);
+	int answered = 0;
+	bool awaited = false;
+	client->socket().async_connect(asio::ip::tcp::endpoint(acceptor.local_endpoint()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			client->asyncWaitCapabilities([&](std::error_code ec)
+				{
+					ASSERT_FALSE(ec);
+					for (int i = 0; i < REQUESTS; ++i) {
+						client->asyncQueryStats([&](std::error_code ec, std::string text)
+							{
+								EXPECT_FALSE(ec);
+								EXPECT_NE(text.find("cw_disk_queued_bytes"), std::string::npos);
+								++answered;
+							});
+					}
+					asio::co_spawn(io, [&]() -> asio::awaitable<void>
+						{
+							std::string text = co_await client->asyncQueryStats(asio::use_awaitable);
+							awaited = !text.empty();
+						}, asio::detached);
+				});
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while ((answered < REQUESTS || !awaited) && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(10));
+	EXPECT_EQ(answered, REQUESTS);
+	EXPECT_TRUE(awaited);
+}
+
+// ---------------------------------------------------------------------------
+// 107. RECEIVED RANGES (out-of-order chunks: duplicates and gaps told apart)
+// ---------------------------------------------------------------------------
+
+TEST(RangeSetTest, MergesCountsAndFindsGaps) {
+	cw::file::RangeSet ranges;
+	EXPECT_EQ(ranges.insert(100, 200), 100u);
+	EXPECT_EQ(ranges.insert(300, 400), 100u);
+	EXPECT_EQ(ranges.insert(150, 250), 50u); // Overlaps the first
+	EXPECT_EQ(ranges.insert(100, 200), 0u);  // A duplicate
+	EXPECT_EQ(ranges.rangeCount(), 2u);
+	EXPECT_EQ(ranges.covered(), 250u);
+	EXPECT_TRUE(ranges.contains(120, 250));
+	EXPECT_FALSE(ranges.contains(240, 310));
+
+	using Ranges = std::vector<cw::file::RangeSet::Range>;
+	EXPECT_EQ(ranges.gaps(500), Ranges({ { 0, 100 }, { 250, 300 }, { 400, 500 } }));
+
+	// Filling a gap joins its neighbours
+	EXPECT_EQ(ranges.insert(250, 300), 50u);
+	EXPECT_EQ(ranges.rangeCount(), 1u);
+	EXPECT_TRUE(ranges.contains(100, 400));
+
+	// Taking a range out of the middle splits it
+	EXPECT_EQ(ranges.erase(150, 160), 10u);
+	EXPECT_EQ(ranges.rangeCount(), 2u);
+	EXPECT_EQ(ranges.covered(), 290u);
+	EXPECT_EQ(ranges.gaps(400), Ranges({ { 0, 100 }, { 150, 160 } }));
+	EXPECT_EQ(ranges.erase(0, 1000), 290u);
+	EXPECT_EQ(ranges.rangeCount(), 0u);
+}
+
+// Sends 'bytes' as four chunks out of order: the third twice, the last never
+static asio::awaitable<void> uploadWithGap(cw::network::PooledConnection lease, std::filesystem::path path, std::vector<uint8_t> bytes)
+{
+	auto conn = lease.get();
+
+	uint32_t streamId = conn->allocateStreamId();
+	conn->serveRetransmits(streamId, path, bytes.size());
+	conn->send(cw::packet::FileInfo{ .streamId = streamId, .fileSize = bytes.size(), .fileName = "cw_gap_dst.bin" });
+
+	size_t quarter = bytes.size() / 4;
+	for (size_t index : { 2, 0, 2, 1 }) {
+		cw::packet::FileChunk chunk;
+		chunk.streamId = streamId;
+		chunk.offset = index * quarter;
+		chunk.data.assign(bytes.begin() + index * quarter, bytes.begin() + (index + 1) * quarter);
+		chunk.crc = cw::integrity::crc32c(chunk.data);
+		conn->send(chunk);
+	}
+	cw::packet::FileDone done;
+	done.streamId = streamId;
+	done.fileSize = bytes.size();
+	done.crc = cw::integrity::crc32c(bytes);
+	conn->send(done);
+	co_return;
+}
+
+TEST(ReceivedRangesTest, DuplicateIsDroppedAndGapAskedFor) {
+	auto source = std::filesystem::temp_directory_path() / "cw_gap_src.bin";
+	std::vector<uint8_t> bytes(4 * 64 * 1024 + 5);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 7 + 3);
+	writeBytes(source, bytes);
+
+	LoopbackServer loopback;
+	loopback.spawn([&](cw::network::PooledConnection lease) { return uploadWithGap(std::move(lease), source, bytes); });
+	loopback.runUntil([&] { return loopback.filesReceived() == 1; });
+
+	// The duplicate did not spoil the digest; the missing quarter came on request
+	ASSERT_EQ(loopback.filesReceived(), 1u);
+	EXPECT_EQ(readBytes("cw_gap_dst.bin"), bytes);
+	std::filesystem::remove("cw_gap_dst.bin");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 108. WAN EMULATION (latency, bottleneck rate and loss on a loopback relay)
+// ---------------------------------------------------------------------------
+
+TEST(WanEmulatorTest, DelaysAndPacesWhatItRelays) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+	// 60 ms RTT, 4 Mbit/s: 64 KiB take 131 ms to serialize, then 30 ms to cross
+	cw::network::WanProfile profile;
+	EXPECT_TRUE(cw::network::parseWanOption("--wan-rtt-ms=60", profile));
+	EXPECT_TRUE(cw::network::parseWanOption("--wan-mbit=4", profile));
+	EXPECT_FALSE(cw::network::parseWanOption("--nodelay", profile));
+	EXPECT_TRUE(profile.shapes());
+	cw::network::WanEmulator emulator(io, acceptor.local_endpoint(), profile);
+
+	std::vector<uint8_t> sent(64 * 1024);
+	for (size_t i = 0; i < sent.size(); ++i) sent[i] = static_cast<uint8_t>(i * 31);
+	std::vector<uint8_t> received(sent.size());
+	std::vector<uint8_t> reply(1);
+	std::chrono::steady_clock::duration oneWay{}, roundTrip{};
+
+	asio::ip::tcp::socket server(io);
+	asio::ip::tcp::socket client(io);
+	auto started = std::chrono::steady_clock::now();
+	acceptor.async_accept(server, [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			asio::async_read(server, asio::buffer(received), [&](std::error_code ec, size_t)
+				{
+					ASSERT_FALSE(ec);
+					oneWay = std::chrono::steady_clock::now() - started;
+					asio::async_write(server, asio::buffer(reply), [](std::error_code, size_t) {});
+				});
+		});
+	client.async_connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), emulator.port()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			started = std::chrono::steady_clock::now();
+			asio::async_write(client, asio::buffer(sent), [&](std::error_code ec, size_t)
+				{
+					ASSERT_FALSE(ec);
+					asio::async_read(client, asio::buffer(reply), [&](std::error_code ec, size_t)
+						{
+							EXPECT_FALSE(ec);
+							roundTrip = std::chrono::steady_clock::now() - started;
+							io.stop();
+						});
+				});
+		});
+
+	io.run_for(std::chrono::seconds(3));
+	EXPECT_EQ(received, sent);
+	EXPECT_GE(oneWay, std::chrono::milliseconds(150));
+	EXPECT_GE(roundTrip, oneWay + std::chrono::milliseconds(30));
+}
+
+TEST(WanEmulatorTest, LostSegmentsArriveARoundTripLate) {
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+	cw::network::WanProfile profile;
+	profile.rtt = std::chrono::milliseconds(40);
+	profile.lossRate = 1;
+	cw::network::WanEmulator emulator(io, acceptor.local_endpoint(), profile);
+
+	asio::ip::tcp::socket server(io);
+	asio::ip::tcp::socket client(io);
+	std::array<uint8_t, 4> sent{ 1, 2, 3, 4 }, received{};
+	std::chrono::steady_clock::duration oneWay{};
+	auto started = std::chrono::steady_clock::now();
+	acceptor.async_accept(server, [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			asio::async_read(server, asio::buffer(received), [&](std::error_code ec, size_t)
+				{
+					EXPECT_FALSE(ec);
+					oneWay = std::chrono::steady_clock::now() - started;
+					io.stop();
+				});
+		});
+	client.async_connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), emulator.port()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			started = std::chrono::steady_clock::now();
+			asio::async_write(client, asio::buffer(sent), [](std::error_code, size_t) {});
+		});
+
+	io.run_for(std::chrono::seconds(1));
+	EXPECT_EQ(received, sent);
+	// Half the RTT to cross, and a whole one more for the resend
+	EXPECT_GE(oneWay, std::chrono::milliseconds(60));
+}
+
+// ---------------------------------------------------------------------------
+// 109. ALLOCATION-FREE STEADY STATE (heap allocations on the chunk path)
+// ---------------------------------------------------------------------------
+
+TEST(RingQueueTest, WrapsGrowsAndErasesInOrder) {
+	cw::network::RingQueue<int> queue;
+	for (int i = 0; i < 12; ++i) queue.push_back(i);
+	for (int i = 0; i < 10; ++i) queue.pop_front();
+	size_t capacity = queue.capacity();
+	for (int i = 12; i < 20; ++i) queue.push_back(i); // Wraps round the ring
+	queue.push_front(11);
+	EXPECT_EQ(queue.capacity(), capacity);
+	EXPECT_EQ(std::vector<int>(queue.begin(), queue.end()), (std::vector<int>{ 11, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19 }));
+
+	for (int i = 20; i < 40; ++i) queue.push_back(i); // Grows, in order
+	EXPECT_GT(queue.capacity(), capacity);
+	EXPECT_EQ(queue.front(), 11);
+	EXPECT_EQ(queue.back(), 39);
+
+	queue.erase(queue.begin(), queue.begin() + 3);
+	EXPECT_EQ(queue.front(), 12);
+	queue.erase(queue.begin() + 1, queue.begin() + 3); // 13 and 14
+	EXPECT_EQ(queue[1], 15);
+	EXPECT_EQ(erase_if(queue, [](int v) { return v % 2 == 0; }), 13u);
+	EXPECT_EQ(std::vector<int>(queue.begin(), queue.end()), (std::vector<int>{ 15, 17, 19, 21, 23, 25, 27, 29, 31, 33, 35, 37, 39 }));
+}
+
+// Every operator new of this binary, counted while 'counting' is on. The
+// other forms (array, nothrow) forward to this one.
+namespace heap_count {
+	std::atomic<bool> counting = false;
+	std::atomic<uint64_t> calls = 0;
+}
+
+void* operator new(std::size_t size)
+{
+	if (heap_count::counting.load(std::memory_order_relaxed)) {
+		heap_count::calls.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (size == 0) size = 1;
+	if (void* p = std::malloc(size)) return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+TEST(SteadyStateAllocationTest, ChunksFlowWithoutHeapAllocations) {
+	// Client and server on one io_context: the whole chunk path, from the
+	// frames built to the disk writes, runs while the counter is on
+	constexpr size_t CHUNK = 64 * 1024;
+	constexpr size_t BACKLOG = 64;   // Chunks kept queued ahead of the receiver
+	constexpr size_t WARMUP = 4096;  // Queues and buffers at their working size
+	constexpr size_t MEASURED = 512; // Per window
+	constexpr size_t WINDOWS = 4;
+	constexpr size_t TOTAL = WARMUP + WINDOWS * MEASURED + 2 * BACKLOG; // Still streaming when counting stops
+	constexpr uint64_t SIZE = TOTAL * CHUNK;
+
+	// Payload copies are taken on the io thread and dropped on the disk
+	// threads, whose caches hold on to some: stocked up front, the pool
+	// never runs short of them however deep the disk queue gets
+	cw::buffer::BufferPool::instance().prefill(CHUNK, 1024);
+
+	asio::io_context io;
+	auto writer = std::make_shared<cw::file::DiskWriter>(2);
+	cw::network::Server server(io, 0, writer);
+	auto metrics = std::make_shared<cw::metrics::MetricsRegistry>();
+	server.setMetrics(metrics);
+	auto pool = cw::network::ClientPool::create(io);
+
+	std::optional<cw::network::PooledConnection> lease;
+	pool->asyncAcquire("127.0.0.1", server.port(), [&](std::error_code, cw::network::PooledConnection c) { lease.emplace(std::move(c)); });
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!lease && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_TRUE(lease);
+	auto conn = lease->get();
+
+	std::vector<uint8_t> bytes(CHUNK);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + 1);
+	uint32_t crc = cw::integrity::crc32c(bytes);
+	auto payload = cw::buffer::SharedBuffer::fromVector(std::move(bytes));
+
+	uint32_t streamId = conn->allocateStreamId();
+	conn->send(cw::packet::FileInfo{ .streamId = streamId, .fileSize = SIZE, .fileName = "cw_steady_dst.bin" });
+
+	// Runs until 'chunks' have been received, topping the sender's queue up as they go
+	size_t sent = 0;
+	auto streamUntil = [&](size_t chunks) {
+		auto until = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+		for (;;) {
+			size_t received = metrics->snapshot().framesReceived - 1; // Less the FileInfo
+			if (received >= chunks || std::chrono::steady_clock::now() >= until) return received;
+			for (; sent < std::min(TOTAL, received + BACKLOG); ++sent) {
+				conn->send(cw::packet::SharedFileChunk{ .streamId = streamId, .offset = sent * CHUNK, .data = payload, .crc = crc });
+			}
+			io.run_for(std::chrono::milliseconds(1));
+		}
+	};
+
+	// A window may still see a pool or queue reach a new high-water mark,
+	// as the disk threads' timing varies; one that allocates per chunk (or
+	// per read) never has a window without
+	ASSERT_GE(streamUntil(WARMUP), WARMUP);
+	std::vector<uint64_t> allocations;
+	for (size_t window = 1; window <= WINDOWS; ++window) {
+		heap_count::calls = 0;
+		heap_count::counting = true;
+		size_t received = streamUntil(WARMUP + window * MEASURED);
+		heap_count::counting = false;
+		ASSERT_GE(received, WARMUP + window * MEASURED);
+		allocations.push_back(heap_count::calls.load());
+		if (allocations.back() == 0) break;
+	}
+	EXPECT_EQ(allocations.back(), 0u) << "Allocations per window of " << MEASURED << " chunks: " << ::testing::PrintToString(allocations);
+
+	ASSERT_GE(streamUntil(TOTAL), TOTAL);
+	cw::packet::FileDone done;
+	done.streamId = streamId;
+	done.fileSize = SIZE;
+	conn->send(done);
+	deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (metrics->snapshot().filesReceived == 0 && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	EXPECT_EQ(metrics->snapshot().filesReceived, 1u);
+	std::filesystem::remove("cw_steady_dst.bin");
+}
+
+// ---------------------------------------------------------------------------
+// 110. MAPPED WRITES (received chunks copied into a shared mapping of the file)
+// ---------------------------------------------------------------------------
+TEST(MappedWritesTest, MapsOnlyAFullyAllocatedFile) {
+	auto path = std::filesystem::temp_directory_path() / "cw_mapped_writable.bin";
+	{
+		auto file = cw::file::FileHandle::openWrite(path);
+		ASSERT_FALSE(file.preallocate(1024 * 1024));
+	}
+	cw::file::WritableMapping mapping;
+	if (mapping.map(path, 1024 * 1024)) {
+		std::filesystem::remove(path);
+		GTEST_SKIP() << "Preallocation or shared mappings unsupported here";
+	}
+	std::vector<uint8_t> bytes(5000, 0x5a);
+	EXPECT_TRUE(mapping.write(1024 * 1024 - 5000, bytes));
+	EXPECT_FALSE(mapping.write(1024 * 1024 - 4999, bytes));
+	EXPECT_FALSE(mapping.flush(1024 * 1024 - 5000, 5000, true));
+	mapping.unmap();
+	{
+		std::ifstream in(path, std::ios::binary);
+		in.seekg(1024 * 1024 - 5000);
+		std::vector<uint8_t> back(5000);
+		in.read(reinterpret_cast<char*>(back.data()), back.size());
+		EXPECT_EQ(back, bytes);
+	}
+
+	// Only as long as the mapping, with no blocks behind it: a store could SIGBUS
+	std::filesystem::resize_file(path, 0);
+	std::filesystem::resize_file(path, 1024 * 1024);
+	EXPECT_EQ(mapping.map(path, 1024 * 1024), std::errc::operation_not_supported);
+	EXPECT_FALSE(mapping.isMapped());
+	std::filesystem::remove(path);
+}
+
+TEST(MappedWritesTest, WritesAreUnchangedUnderEveryDurability) {
+	auto dir = std::filesystem::temp_directory_path() / "cw_mapped_write";
+	auto path = dir / "out.bin";
+
+	// Past a MAPPED_SYNC_STEP, with a hole in the middle after which writes
+	// go through the file
+	std::vector<uint8_t> contents(19 * 1024 * 1024 + 5);
+	for (size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 29 + 1);
+	const size_t HOLE = 9 * 1024 * 1024;
+	std::fill_n(contents.begin() + HOLE, 1024 * 1024, 0);
+	auto piece = [&](size_t from, size_t length)
+		{
+			return cw::buffer::pooledCopy(std::span<const uint8_t>(contents).subspan(from, length));
+		};
+
+	for (auto durability : { cw::file::Durability::None, cw::file::Durability::PerFile, cw::file::Durability::GroupCommit }) {
+		asio::io_context io;
+		cw::file::DiskWriter writer(1);
+		writer.setMappedWrites(true);
+		writer.setDurability(durability);
+
+		// Back to front, the last megabyte gathered
+		auto file = cw::file::WriteBehindFile::create(writer, io.get_executor());
+		file->open(path, contents.size(), [](std::error_code ec) { EXPECT_FALSE(ec); });
+		size_t tail = contents.size() - 1024 * 1024;
+		file->writeGathered(tail, { piece(tail, 300 * 1024), piece(tail + 300 * 1024, contents.size() - tail - 300 * 1024) });
+		for (size_t offset = tail; offset > HOLE + 1024 * 1024;) {
+			size_t length = std::min<size_t>(512 * 1024, offset - HOLE - 1024 * 1024);
+			offset -= length;
+			file->write(offset, piece(offset, length));
+		}
+		file->punchHole(HOLE, 1024 * 1024);
+		for (size_t offset = HOLE; offset > 0;) {
+			size_t length = std::min<size_t>(512 * 1024, offset);
+			offset -= length;
+			file->write(offset, piece(offset, length));
+		}
+
+		auto work = asio::make_work_guard(io);
+		uint64_t written = 0;
+		file->finish([&](std::error_code ec, uint64_t bytes) { EXPECT_FALSE(ec); written = bytes; work.reset(); });
+		io.run();
+
+		EXPECT_EQ(written, contents.size());
+		std::ifstream in(path, std::ios::binary);
+		std::vector<uint8_t> back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		EXPECT_EQ(back, contents);
+		in.close();
+		std::filesystem::remove_all(dir);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// 111. VOLUMES (received files spread over destination roots on their own drives)
+// ---------------------------------------------------------------------------
+TEST(VolumeSetTest, PlacesByNameOrByLoad) {
+	EXPECT_EQ(cw::file::parsePlacement("hash"), cw::file::Placement::Hash);
+	EXPECT_EQ(cw::file::parsePlacement("least-loaded"), cw::file::Placement::LeastLoaded);
+	EXPECT_FALSE(cw::file::parsePlacement("random"));
+
+	std::vector<cw::file::VolumeSet::Volume> list{ { {}, std::make_shared<cw::file::DiskWriter>(1) },
+		{ "/mnt/b", std::make_shared<cw::file::DiskWriter>(1) }, { "/mnt/c", std::make_shared<cw::file::DiskWriter>(1) } };
+	cw::file::VolumeSet byName(list);
+	std::array<int, 3> used{};
+	for (int i = 0; i < 300; ++i) {
+		std::string name = "dir/file" + std::to_string(i) + ".bin";
+		const auto& volume = byName.place(name);
+		EXPECT_EQ(&byName.place(name), &volume);
+		++used[&volume - &byName[0]];
+	}
+	for (int count : used) EXPECT_GT(count, 50);
+	EXPECT_EQ(cw::file::VolumeSet::pathOn(byName[0], "a/b"), std::filesystem::path("a/b"));
+	EXPECT_EQ(cw::file::VolumeSet::pathOn(byName[2], "a/b"), std::filesystem::path("/mnt/c/a/b"));
+
+	// Idle volumes in turn; then the one with the least queued
+	cw::file::VolumeSet byLoad(list, cw::file::Placement::LeastLoaded);
+	std::set<const cw::file::VolumeSet::Volume*> idle;
+	for (int i = 0; i < 3; ++i) idle.insert(&byLoad.place("x"));
+	EXPECT_EQ(idle.size(), 3u);
+	list[0].writer->load()->add(1 << 20);
+	list[2].writer->load()->add(2 << 20);
+	for (int i = 0; i < 3; ++i) EXPECT_EQ(&byLoad.place("x"), &byLoad[1]);
+	list[0].writer->load()->remove(1 << 20);
+	list[2].writer->load()->remove(2 << 20);
+}
+
+TEST(VolumeSetTest, ServerSpreadsReceivedFiles) {
+	auto source = std::filesystem::temp_directory_path() / "cw_volume_src.bin";
+	std::vector<uint8_t> bytes(256 * 1024 + 3);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 5 + 7);
+	writeBytes(source, bytes);
+
+	auto writer = std::make_shared<cw::file::DiskWriter>(1);
+	auto second = std::filesystem::temp_directory_path() / "cw_volume_b";
+	auto third = std::filesystem::temp_directory_path() / "cw_volume_c";
+	auto volumes = std::make_shared<const cw::file::VolumeSet>(std::vector<cw::file::VolumeSet::Volume>{
+		{ {}, writer }, { second, std::make_shared<cw::file::DiskWriter>(1) }, { third, std::make_shared<cw::file::DiskWriter>(1) } });
+	LoopbackServer loopback({}, writer);
+	loopback.server.setVolumes(volumes);
+
+	std::vector<std::string> names;
+	for (int i = 0; i < 12; ++i) names.push_back("cw_volume_dir/file" + std::to_string(i) + ".bin");
+	for (const auto& name : names) loopback.upload(source, name);
+	loopback.runUntil([&] { return loopback.filesReceived() == names.size(); });
+	EXPECT_EQ(loopback.filesReceived(), names.size());
+
+	std::set<const cw::file::VolumeSet::Volume*> used;
+	for (const auto& name : names) {
+		const auto& volume = volumes->place(name);
+		used.insert(&volume);
+		auto path = cw::file::VolumeSet::pathOn(volume, name);
+		EXPECT_EQ(readBytes(path), bytes) << path;
+	}
+	EXPECT_GT(used.size(), 1u);
+
+	std::filesystem::remove_all("cw_volume_dir");
+	std::filesystem::remove_all(second);
+	std::filesystem::remove_all(third);
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 112. WRITE LANES (one file's chunk writes spread over several disk threads)
+// ---------------------------------------------------------------------------
+TEST(WriteLanesTest, WritesAreUnchangedAcrossLanes) {
+	cw::file::DiskWriter clamped(2);
+	clamped.setWriteLanes(8);
+	EXPECT_EQ(clamped.writeLanes(), 2u);
+	clamped.setWriteLanes(0);
+	EXPECT_EQ(clamped.writeLanes(), 1u);
+
+	auto dir = std::filesystem::temp_directory_path() / "cw_write_lanes";
+	auto path = dir / "out.bin";
+	std::vector<uint8_t> contents(16 * 1024 * 1024 + 333);
+	for (size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 31 + (i >> 20));
+	auto piece = [&](size_t from, size_t length)
+		{
+			return cw::buffer::pooledCopy(std::span<const uint8_t>(contents).subspan(from, length));
+		};
+
+	// Through the page cache, unbuffered (a scratch buffer per lane) and mapped
+	for (int mode = 0; mode < 3; ++mode) {
+		asio::io_context io;
+		cw::file::DiskWriter writer(4);
+		writer.setWriteLanes(4, 1);
+		if (mode == 1) writer.setDirectIoMinSize(1);
+		if (mode == 2) writer.setMappedWrites(true);
+
+		// Stripes of a striped transfer, a gathered run each, then a chunk
+		// written again and a checkpoint between them
+		const size_t CHUNK = 256 * 1024 + 512;
+		auto file = cw::file::WriteBehindFile::create(writer, io.get_executor());
+		file->open(path, contents.size(), [](std::error_code ec) { EXPECT_FALSE(ec); });
+		std::vector<size_t> offsets;
+		for (size_t offset = 0; offset < contents.size(); offset += CHUNK) offsets.push_back(offset);
+		std::mt19937 random(7 + mode);
+		std::shuffle(offsets.begin(), offsets.end(), random);
+		for (size_t i = 0; i < offsets.size(); ++i) {
+			size_t offset = offsets[i];
+			size_t length = std::min(CHUNK, contents.size() - offset);
+			if (i % 3 == 0 && length > 1000) file->writeGathered(offset, { piece(offset, 1000), piece(offset + 1000, length - 1000) });
+			else file->write(offset, piece(offset, length));
+			if (i == offsets.size() / 2) file->checkpoint();
+		}
+		file->unwrite(CHUNK);
+		file->write(0, piece(0, CHUNK));
+
+		auto work = asio::make_work_guard(io);
+		uint64_t written = 0;
+		file->finish([&](std::error_code ec, uint64_t bytes) { EXPECT_FALSE(ec); written = bytes; work.reset(); });
+		io.run();
+
+		EXPECT_EQ(written, contents.size()) << mode;
+		EXPECT_EQ(file->pendingBytes(), 0u);
+		std::ifstream in(path, std::ios::binary);
+		std::vector<uint8_t> back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		EXPECT_TRUE(back == contents) << mode;
+		in.close();
+		std::filesystem::remove_all(dir);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// 113. CLUSTER (files sharded over several servers by consistent hash of path)
+// ---------------------------------------------------------------------------
+TEST(HashRingTest, SpreadsNamesAndMovesFewOnMembershipChange) {
+	cw::network::HashRing ring({ "a", "b", "c", "d" });
+	EXPECT_EQ(ring.size(), 4u);
+	EXPECT_FALSE(ring.add("b"));
+
+	std::vector<std::string> names;
+	for (int i = 0; i < 4000; ++i) names.push_back("dir" + std::to_string(i % 37) + "/file" + std::to_string(i) + ".bin");
+
+	std::map<std::string, size_t> counts;
+	std::vector<std::string> before;
+	for (const auto& name : names) {
+		before.push_back(ring.owner(name));
+		++counts[before.back()];
+	}
+	EXPECT_EQ(counts.size(), 4u);
+	for (const auto& [member, count] : counts) {
+		EXPECT_GT(count, names.size() / 8) << member;
+		EXPECT_LT(count, names.size() / 2) << member;
+	}
+
+	// Losing "c" moves only its names; every other name stays put
+	EXPECT_TRUE(ring.remove("c"));
+	EXPECT_FALSE(ring.remove("c"));
+	for (size_t i = 0; i < names.size(); ++i) {
+		if (before[i] != "c") EXPECT_EQ(ring.owner(names[i]), before[i]);
+		else EXPECT_NE(ring.owner(names[i]), "c");
+	}
+
+	// A new member takes names only for itself
+	ring.add("e");
+	size_t moved = 0;
+	for (size_t i = 0; i < names.size(); ++i) {
+		const auto& owner = ring.owner(names[i]);
+		if (before[i] != "c" && owner != before[i]) {
+			EXPECT_EQ(owner, "e");
+			++moved;
+		}
+	}
+	EXPECT_GT(moved, 0u);
+	EXPECT_LT(moved, names.size() / 2);
+
+	// The same members in another order place the same way
+	cw::network::HashRing other({ "d", "a", "b", "e" });
+	for (const auto& name : names) EXPECT_EQ(other.owner(name), ring.owner(name));
+}
+
+static asio::awaitable<void> uploadTreeToCluster(std::shared_ptr<cw::network::ClientPool> pool, std::vector<uint16_t> ports,
+	std::filesystem::path root, std::vector<std::string> members, bool* done)
+{
+	auto route = std::make_shared<cw::ClusterRoute>(cw::ClusterRoute{ cw::network::HashRing(members), {} });
+	std::vector<cw::network::PooledConnection> leases;
+	for (auto port : ports) {
+		route->servers.emplace_back();
+		for (int i = 0; i < 2; ++i) {
+			leases.push_back(co_await pool->asyncAcquire("127.0.0.1", port, asio::use_awaitable));
+			route->servers.back().push_back(leases.back().get());
+		}
+	}
+	cw::DirectoryUploadOptions uploadOptions;
+	uploadOptions.cluster = route;
+	co_await cw::asyncUploadDirectory(route->all(), root, {}, uploadOptions);
+	*done = true;
+}
+
+TEST(ClusterTest, UploadShardsFilesOverServersByPath) {
+	// Names are relative to 'source'; both servers write to the working directory
+	auto source = std::filesystem::temp_directory_path() / "cw_cluster_src";
+	std::filesystem::remove_all(source);
+	std::filesystem::remove_all("cw_cluster");
+	std::filesystem::create_directories(source / "cw_cluster" / "sub");
+	std::vector<std::string> names;
+	for (int i = 0; i < 24; ++i) {
+		names.push_back("cw_cluster/" + std::string(i % 2 ? "sub/" : "") + "f" + std::to_string(i) + ".txt");
+		std::ofstream(source / names.back()) << "contents of " << names.back();
+	}
+
+	// The second server shares the first's io_context and pool
+	LoopbackServer first;
+	cw::network::Server second(first.io, 0);
+	auto secondMetrics = std::make_shared<cw::metrics::MetricsRegistry>();
+	second.setMetrics(secondMetrics);
+
+	std::vector<std::string> members{ "first", "second" };
+	bool done = false;
+	asio::co_spawn(first.io, uploadTreeToCluster(first.pool, { first.server.port(), second.port() }, source, members, &done), asio::detached);
+	EXPECT_TRUE(first.runUntil([&] { return done && first.filesReceived() + secondMetrics->snapshot().filesReceived == names.size(); }));
+
+	// Each server received exactly the files the ring gives it
+	cw::network::HashRing ring(members);
+	size_t toFirst = 0;
+	for (const auto& name : names) toFirst += ring.owner(name) == "first";
+	EXPECT_GT(toFirst, 0u);
+	EXPECT_LT(toFirst, names.size());
+	EXPECT_EQ(first.filesReceived(), toFirst);
+	EXPECT_EQ(secondMetrics->snapshot().filesReceived, names.size() - toFirst);
+	for (const auto& name : names) EXPECT_EQ(readText(name), "contents of " + name);
+
+	std::filesystem::remove_all("cw_cluster");
+	std::filesystem::remove_all(source);
+}
+
+// ---------------------------------------------------------------------------
+// 114. LOAD GOSSIP (busy servers redirect new files to peers with room)
+// ---------------------------------------------------------------------------
+TEST(LoadGossipTest, PicksTheLeastLoadedPeerWithRoom) {
+	asio::io_context io;
+	auto writer = std::make_shared<cw::file::DiskWriter>(1);
+	auto gossip = cw::network::LoadGossip::start(io, 0, "self:8080", writer);
+	EXPECT_FALSE(gossip->redirectTarget());
+
+	auto now = std::chrono::steady_clock::now();
+	gossip->heard({ "self:8080", 0, false, now }); // Its own report, looped back
+	gossip->heard({ "a:8080", 5000, false, now });
+	gossip->heard({ "b:8080", 100, true, now });   // Busy itself
+	gossip->heard({ "c:8080", 10, false, now - cw::network::LoadGossip::DEFAULT_INTERVAL * 10 }); // Gone quiet
+	EXPECT_EQ(gossip->peers().size(), 3u);
+	EXPECT_EQ(gossip->redirectTarget(), "a:8080");
+	gossip->heard({ "d:8080", 1000, false, now });
+	EXPECT_EQ(gossip->redirectTarget(), "d:8080");
+
+	auto datagram = cw::network::LoadGossip::encode({ "[::1]:9000", 123456789, true, {} });
+	auto decoded = cw::network::LoadGossip::decode(datagram.data(), datagram.size());
+	ASSERT_TRUE(decoded);
+	EXPECT_EQ(decoded->address, "[::1]:9000");
+	EXPECT_EQ(decoded->queuedBytes, 123456789u);
+	EXPECT_TRUE(decoded->busy);
+	EXPECT_FALSE(cw::network::LoadGossip::decode(datagram.data(), datagram.size() - 1));
+	datagram[0] ^= 1;
+	EXPECT_FALSE(cw::network::LoadGossip::decode(datagram.data(), datagram.size()));
+
+	EXPECT_EQ(cw::network::splitHostPort("host:80"), std::make_pair(std::string("host"), uint16_t(80)));
+	EXPECT_EQ(cw::network::splitHostPort("[::1]:9000"), std::make_pair(std::string("::1"), uint16_t(9000)));
+	EXPECT_FALSE(cw::network::splitHostPort("host"));
+	EXPECT_FALSE(cw::network::splitHostPort("::1"));
+	EXPECT_FALSE(cw::network::splitHostPort("host:99999"));
+
+	// The redirect travels in the Busy Error; without one the Error is as before
+	cw::packet::Error busy;
+	busy.code = static_cast<uint16_t>(cw::packet::ErrorCode::Busy);
+	busy.streamId = 3;
+	busy.retryAfterMs = 200;
+	busy.message = "busy";
+	size_t plain = busy.payloadSize();
+	busy.redirect = "peer:8080";
+	std::vector<uint8_t> payload(busy.payloadSize());
+	EXPECT_EQ(payload.size(), plain + sizeof(uint16_t) + busy.redirect.size());
+	cw::binary::ByteWriter out(payload.data());
+	busy.serialize(out);
+	auto read = cw::packet::Error::deserialize(payload.data(), payload.size());
+	EXPECT_EQ(read.retryAfterMs, 200u);
+	EXPECT_EQ(read.redirect, "peer:8080");
+	EXPECT_EQ(cw::packet::Error::deserialize(payload.data(), plain).redirect, "");
+	gossip->stop();
+	io.run_for(std::chrono::milliseconds(10));
+}
+
+TEST(LoadGossipTest, BusyServerRedirectsTheFileToAPeer) {
+	auto source = std::filesystem::temp_directory_path() / "cw_gossip_src.bin";
+	std::vector<uint8_t> bytes(200 * 1024 + 9);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 11 + 1);
+	writeBytes(source, bytes);
+	std::filesystem::remove_all("cw_gossip");
+
+	// 'busy' refuses every new file; 'idle' takes them
+	constexpr std::size_t BACKLOG = 8 * 1024 * 1024;
+	asio::io_context io;
+	auto busyWriter = std::make_shared<cw::file::DiskWriter>(1);
+	busyWriter->setAdmissionLimits(1024 * 1024, std::chrono::milliseconds(0));
+	busyWriter->load()->add(BACKLOG);
+	auto idleWriter = std::make_shared<cw::file::DiskWriter>(1);
+	cw::network::Server busy(io, 0, busyWriter);
+	cw::network::Server idle(io, 0, idleWriter);
+	auto busyMetrics = std::make_shared<cw::metrics::MetricsRegistry>();
+	auto idleMetrics = std::make_shared<cw::metrics::MetricsRegistry>();
+	busy.setMetrics(busyMetrics);
+	idle.setMetrics(idleMetrics);
+
+	constexpr std::chrono::milliseconds INTERVAL{ 20 };
+	auto busyGossip = cw::network::LoadGossip::start(io, 0, "127.0.0.1:" + std::to_string(busy.port()), busyWriter, {}, INTERVAL);
+	auto idleGossip = cw::network::LoadGossip::start(io, 0, "127.0.0.1:" + std::to_string(idle.port()), idleWriter,
+		{ { asio::ip::address_v4::loopback(), busyGossip->port() } }, INTERVAL);
+	busy.setLoadGossip(busyGossip);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (!busyGossip->redirectTarget() && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	EXPECT_EQ(busyGossip->redirectTarget(), "127.0.0.1:" + std::to_string(idle.port()));
+
+	auto pool = cw::network::ClientPool::create(io);
+	std::optional<std::error_code> result;
+	asio::co_spawn(io, [&]() -> asio::awaitable<void>
+		{
+			auto lease = co_await pool->asyncAcquire("127.0.0.1", busy.port(), asio::use_awaitable);
+			cw::TransferOptions options;
+			options.busyBackoff = std::chrono::milliseconds(10);
+			options.redirectPool = pool;
+			co_await cw::asyncSendFile(lease.get(), source, "cw_gossip/copy.bin", options);
+		},
+		[&](std::exception_ptr e)
+		{
+			result = std::error_code{};
+			try {
+				if (e) std::rethrow_exception(e);
+			}
+			catch (const std::system_error& error) {
+				result = error.code();
+			}
+		});
+	deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!result && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_TRUE(result);
+	EXPECT_FALSE(*result) << result->message();
+	EXPECT_EQ(busyMetrics->snapshot().filesReceived, 0u);
+	EXPECT_EQ(idleMetrics->snapshot().filesReceived, 1u);
+
+	std::ifstream in("cw_gossip/copy.bin", std::ios::binary);
+	std::vector<uint8_t> received((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(received, bytes);
+
+	busyGossip->stop();
+	idleGossip->stop();
+	busyWriter->load()->remove(BACKLOG);
+	io.run_for(std::chrono::milliseconds(10));
+	std::filesystem::remove_all("cw_gossip");
+	std::filesystem::remove(source);
+}
+
+// ---------------------------------------------------------------------------
+// 115. CHUNK CACHE (recently sent chunks served again from memory)
+// ---------------------------------------------------------------------------
+TEST(ChunkCacheTest, EvictsLeastRecentlyUsedWithinItsBudget) {
+	cw::file::ChunkCache cache(3 * 1024, 1);
+	cw::file::FileIdentity file{ 1, 2, 10000, 3, 0 };
+	auto chunk = [](uint8_t fill)
+		{
+			cw::buffer::PooledBuffer data(1024);
+			std::fill(data.data(), data.data() + 1024, fill);
+			return std::move(data).share();
+		};
+	auto key = [&](uint64_t offset) { return cw::file::ChunkCache::Key{ file, offset, 1024 }; };
+
+	cache.insert(key(0), chunk(0));
+	cache.insert(key(1024), chunk(1));
+	cache.insert(key(2048), chunk(2));
+	ASSERT_TRUE(cache.find(key(0))); // Now the most recent
+	cache.insert(key(3072), chunk(3));
+
+	EXPECT_FALSE(cache.find(key(1024))); // The least recent went
+	auto hit = cache.find(key(0));
+	ASSERT_TRUE(hit);
+	EXPECT_EQ(hit->data()[0], 0);
+	EXPECT_TRUE(cache.find(key(2048)));
+	EXPECT_TRUE(cache.find(key(3072)));
+
+	// Another version of the file, or another chunk size, is another chunk
+	auto rewritten = key(0);
+	rewritten.file.modifiedNs = 4;
+	EXPECT_FALSE(cache.find(rewritten));
+	EXPECT_FALSE(cache.find({ file, 0, 512 }));
+
+	auto stats = cache.stats();
+	EXPECT_EQ(stats.entries, 3u);
+	EXPECT_EQ(stats.bytes, 3u * 1024);
+	EXPECT_EQ(stats.evictions, 1u);
+	EXPECT_EQ(stats.hits, 4u);
+	EXPECT_EQ(stats.misses, 3u);
+
+	cw::buffer::PooledBuffer big(4096);
+	cache.insert(key(4096), std::move(big).share()); // Larger than the budget: not kept
+	EXPECT_EQ(cache.stats().entries, 3u);
+}
+
+TEST(ChunkCacheTest, SourceServesRepeatReadsFromTheSameBuffers) {
+	auto path = std::filesystem::temp_directory_path() / "cw_chunk_cache.bin";
+	std::vector<uint8_t> bytes(300 * 1024 + 5);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 7 + (i >> 9));
+	writeBytes(path, bytes);
+
+	auto cache = std::make_shared<cw::file::ChunkCache>(4 * 1024 * 1024);
+	auto readAll = [&](std::vector<const uint8_t*>& addresses)
+		{
+			cw::file::ChunkSource source(path, cw::file::ReadMode::Stream);
+			source.setCache(cache);
+			std::vector<uint8_t> contents;
+			for (auto chunk = source.next(64 * 1024); !chunk.empty(); chunk = source.next(64 * 1024)) {
+				addresses.push_back(chunk.data());
+				contents.insert(contents.end(), chunk.data(), chunk.data() + chunk.size());
+			}
+			return contents;
+		};
+
+	std::vector<const uint8_t*> first, second;
+	EXPECT_EQ(readAll(first), bytes);
+	EXPECT_EQ(cache->stats().entries, 5u);
+	EXPECT_EQ(readAll(second), bytes);
+	EXPECT_EQ(second, first); // The very buffers read the first time: no copy
+	EXPECT_EQ(cache->stats().hits, 5u);
+
+	// Mapped reads are the page cache already: not cached
+	cw::file::ChunkSource mapped(path, cw::file::ReadMode::MemoryMap);
+	mapped.setCache(cache);
+	EXPECT_TRUE(mapped.isMapped());
+	mapped.next(64 * 1024);
+	EXPECT_EQ(cache->stats().hits, 5u);
+
+	// Rewritten: read again from the file, not served stale
+	bytes[0] ^= 0xff;
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	writeBytes(path, bytes);
+	std::vector<const uint8_t*> third;
+	EXPECT_EQ(readAll(third), bytes);
+	std::filesystem::remove(path);
+}
+
+TEST(ChunkCacheTest, RepeatDownloadsAreServedFromMemory) {
+	auto root = std::filesystem::temp_directory_path() / "cw_chunk_cache_root";
+	std::filesystem::create_directories(root);
+	std::vector<uint8_t> contents((2 << 20) + 3);
+	for (std::size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 29 + (i >> 8));
+	writeBytes(root / "artifact.bin", contents);
+	for (const char* name : { "cw_cc_first.bin", "cw_cc_second.bin" }) std::filesystem::remove(name);
+
+	asio::io_context io;
+	cw::network::Server server(io, 0);
+	cw::TransferOptions options;
+	options.memoryMap = true; // Overridden by the cache
+	options.chunkCache = std::make_shared<cw::file::ChunkCache>(16 * 1024 * 1024);
+	server.setDownloadRoots({ root }, options);
+
+	bool done = false;
+	auto conn = cw::network::Connection::create(io);
+	conn->socket().async_connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), server.port()),
+		[&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			conn->start();
+			asio::co_spawn(io, [&]() -> asio::awaitable<void>
+				{
+					co_await cw::asyncDownloadFile(conn, "artifact.bin", "cw_cc_first.bin");
+					co_await cw::asyncDownloadFile(conn, "artifact.bin", "cw_cc_second.bin");
+					done = true;
+				}, asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!done && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_TRUE(done);
+
+	auto stats = options.chunkCache->stats();
+	EXPECT_GT(stats.entries, 0u);
+	EXPECT_EQ(stats.hits, stats.entries); // The second download read nothing from the file
+	for (const char* name : { "cw_cc_first.bin", "cw_cc_second.bin" }) {
+		std::ifstream in(name, std::ios::binary);
+		EXPECT_TRUE(std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {}) == contents) << name;
+		in.close();
+		std::filesystem::remove(name);
+	}
+	conn->shutdown();
+	std::filesystem::remove_all(root);
+}
+
+// ---------------------------------------------------------------------------
+// 116. SWARM (receivers fetch pieces from each other, as the origin's tracker says)
+// ---------------------------------------------------------------------------
+TEST(SwarmTrackerTest, AssignsRarestPiecesFromTheLeastBusyHolder) {
+	using Status = cw::network::SwarmAssignment::Status;
+	asio::io_context io;
+	cw::network::SwarmTracker::Options options;
+	options.pieceSize = 100;
+	options.uploadSlots = 1;
+	options.originSlots = 1;
+	auto tracker = cw::network::SwarmTracker::start(io, 0, "origin:1",
+		[](const std::string& name) -> std::optional<uint64_t> { return name == "f" ? std::optional<uint64_t>(350) : std::nullopt; }, options);
+
+	auto ask = [&](const std::string& member, cw::network::PieceMap have, uint32_t failedPiece = cw::network::SwarmQuery::NO_PIECE, std::string failedSource = "")
+		{
+			cw::network::SwarmQuery query{ 7, "f", member, std::move(have), failedPiece, std::move(failedSource) };
+			// Through the wire format, as the members send it
+			auto datagram = cw::network::encode(query);
+			auto decoded = cw::network::decodeQuery(datagram.data(), datagram.size());
+			EXPECT_TRUE(decoded);
+			auto answer = tracker->answer(*decoded);
+			auto reply = cw::network::encode(answer);
+			auto back = cw::network::decodeAssignment(reply.data(), reply.size());
+			EXPECT_TRUE(back);
+			EXPECT_EQ(back->nonce, 7u);
+			return *back;
+		};
+
+	auto a = ask("a:1", {});
+	ASSERT_EQ(a.status, Status::Fetch); // From the origin, its one slot now taken
+	EXPECT_TRUE(a.fromOrigin);
+	EXPECT_EQ(a.source, "origin:1");
+	EXPECT_EQ(a.fileSize, 350u);
+	EXPECT_EQ(a.pieceSize, 100u);
+	EXPECT_EQ(tracker->stats().fromOrigin, 1u);
+	EXPECT_EQ(ask("b:1", {}).status, Status::Wait); // Nobody else holds anything
+
+	// 'a' got its piece and takes the origin's slot for the next; 'b'
+	// fetches the one 'a' has from 'a'
+	cw::network::PieceMap aHas(4);
+	aHas.set(a.piece);
+	auto again = ask("a:1", aHas);
+	ASSERT_EQ(again.status, Status::Fetch);
+	EXPECT_NE(again.piece, a.piece);
+	EXPECT_TRUE(again.fromOrigin);
+
+	auto b = ask("b:1", cw::network::PieceMap(4));
+	ASSERT_EQ(b.status, Status::Fetch);
+	EXPECT_FALSE(b.fromOrigin);
+	EXPECT_EQ(b.source, "a:1");
+	EXPECT_EQ(b.piece, a.piece);
+	EXPECT_EQ(tracker->stats().fromPeers, 1u);
+
+	// 'a' failed to send it: forgotten, with the origin's slot it held
+	auto c = ask("b:1", cw::network::PieceMap(4), b.piece, "a:1");
+	ASSERT_EQ(c.status, Status::Fetch);
+	EXPECT_TRUE(c.fromOrigin);
+	EXPECT_EQ(tracker->stats().members, 1u);
+
+	cw::network::PieceMap all(4);
+	for (uint32_t piece = 0; piece < 4; ++piece) all.set(piece);
+	EXPECT_TRUE(all.complete());
+	EXPECT_EQ(ask("c:1", all).status, Status::Done);
+
+	cw::network::SwarmQuery unknown{ 1, "g", "a:1", {}, cw::network::SwarmQuery::NO_PIECE, "" };
+	EXPECT_EQ(tracker->answer(unknown).status, Status::Unknown);
+
+	auto datagram = cw::network::encode(cw::network::SwarmQuery{ 1, "f", "a:1", all, cw::network::SwarmQuery::NO_PIECE, "" });
+	EXPECT_FALSE(cw::network::decodeQuery(datagram.data(), datagram.size() - 1));
+	datagram[0] ^= 1;
+	EXPECT_FALSE(cw::network::decodeQuery(datagram.data(), datagram.size()));
+	tracker->stop();
+	io.run_for(std::chrono::milliseconds(10));
+}
+
+TEST(SwarmTest, MembersFetchPiecesFromEachOther) {
+	auto root = std::filesystem::temp_directory_path() / "cw_swarm_origin";
+	std::filesystem::create_directories(root);
+	std::vector<uint8_t> contents(1024 * 1024 + 77);
+	for (std::size_t i = 0; i < contents.size(); ++i) contents[i] = static_cast<uint8_t>(i * 13 + (i >> 10));
+	writeBytes(root / "dataset.bin", contents);
+
+	asio::io_context io;
+	cw::network::Server origin(io, 0);
+	origin.setDownloadRoots({ root });
+	cw::network::SwarmTracker::Options trackerOptions;
+	trackerOptions.pieceSize = 64 * 1024;
+	trackerOptions.originSlots = 1; // Most pieces must come from the members
+	auto tracker = cw::network::SwarmTracker::start(io, 0, "127.0.0.1:" + std::to_string(origin.port()),
+		[&](const std::string& name) -> std::optional<uint64_t> { return std::filesystem::file_size(root / name); }, trackerOptions);
+
+	constexpr int MEMBERS = 3;
+	std::vector<std::unique_ptr<cw::network::Server>> servers;
+	std::vector<std::shared_ptr<cw::SwarmMember>> members;
+	auto pool = cw::network::ClientPool::create(io);
+	for (int i = 0; i < MEMBERS; ++i) {
+		std::string pieces = "cw_swarm_m" + std::to_string(i);
+		std::filesystem::remove_all(pieces);
+		std::filesystem::create_directories(pieces);
+		servers.push_back(std::make_unique<cw::network::Server>(io, 0));
+		servers.back()->setDownloadRoots({ std::filesystem::absolute(pieces) });
+
+		cw::SwarmMember::Options options;
+		options.tracker = "127.0.0.1:" + std::to_string(tracker->port());
+		options.address = "127.0.0.1:" + std::to_string(servers.back()->port());
+		options.pieceDirectory = pieces;
+		options.parallel = 2;
+		options.waitInterval = std::chrono::milliseconds(10);
+		members.push_back(cw::SwarmMember::create(io, pool, options));
+	}
+
+	int done = 0;
+	std::vector<std::string> failures;
+	for (int i = 0; i < MEMBERS; ++i) {
+		asio::co_spawn(io, members[i]->asyncFetch("dataset.bin", "cw_swarm_out" + std::to_string(i) + ".bin"),
+			[&](std::exception_ptr error, uint64_t size)
+			{
+				++done;
+				try {
+					if (error) std::rethrow_exception(error);
+					EXPECT_EQ(size, contents.size());
+				}
+				catch (const std::exception& e) {
+					failures.push_back(e.what());
+				}
+			});
+	}
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+	while (done < MEMBERS && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	ASSERT_EQ(done, MEMBERS);
+	EXPECT_TRUE(failures.empty()) << failures.front();
+
+	for (int i = 0; i < MEMBERS; ++i) {
+		std::string name = "cw_swarm_out" + std::to_string(i) + ".bin";
+		std::ifstream in(name, std::ios::binary);
+		EXPECT_TRUE(std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {}) == contents) << name;
+		in.close();
+		std::filesystem::remove(name);
+	}
+	auto stats = tracker->stats();
+	EXPECT_GT(stats.fromPeers, 0u);
+	EXPECT_EQ(stats.fromOrigin + stats.fromPeers, MEMBERS * 17u); // Every piece of every member assigned once
+
+	for (auto& member : members) member->stop();
+	tracker->stop();
+	io.run_for(std::chrono::milliseconds(20));
+	for (int i = 0; i < MEMBERS; ++i) std::filesystem::remove_all("cw_swarm_m" + std::to_string(i));
+	std::filesystem::remove_all(root);
+}
+
+// ---------------------------------------------------------------------------
+// 117. CREATE RING (small files opened, written, closed and renamed in io_uring batches)
+// ---------------------------------------------------------------------------
+#if defined(CW_HAS_CREATE_RING)
+TEST(CreateRingTest, ChainsCreateWholeFilesAndFailAlone) {
+	auto* ring = cw::file::CreateRing::forThisThread();
+	if (!ring) GTEST_SKIP() << "No io_uring with direct descriptors here";
+
+	auto dir = std::filesystem::temp_directory_path() / "cw_create_ring_direct";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	ASSERT_GE(fd, 0);
+
+	// More files than one submission takes, one of them in a missing directory
+	constexpr int FILES = cw::file::CreateRing::SLOTS * 2 + 5;
+	std::vector<std::string> receiving(FILES), names(FILES);
+	std::vector<std::vector<uint8_t>> data(FILES);
+	std::vector<cw::file::CreateRing::File> batch;
+	for (int i = 0; i < FILES; ++i) {
+		receiving[i] = (i == 7 ? "missing/" : "") + std::to_string(i) + ".cwrecv";
+		names[i] = std::to_string(i) + ".txt";
+		data[i].assign(static_cast<std::size_t>(i * 31), static_cast<uint8_t>(i));
+		batch.push_back({ fd, receiving[i].c_str(), names[i].c_str(), data[i], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC });
+	}
+	auto results = ring->write(batch);
+	::close(fd);
+
+	ASSERT_EQ(results.size(), static_cast<std::size_t>(FILES));
+	for (int i = 0; i < FILES; ++i) {
+		if (i == 7) {
+			EXPECT_EQ(results[i], -ENOENT);
+			EXPECT_FALSE(std::filesystem::exists(dir / names[i]));
+			continue;
+		}
+		EXPECT_EQ(results[i], 0) << i;
+		std::ifstream in(dir / names[i], std::ios::binary);
+		EXPECT_TRUE(std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {}) == data[i]) << i;
+		EXPECT_FALSE(std::filesystem::exists(dir / receiving[i]));
+	}
+	std::filesystem::remove_all(dir);
+}
+#endif
+
+TEST(CreateRingTest, SmallFileBatchesLandWholeWhicheverWayTheyAreWritten) {
+	std::filesystem::remove_all("cw_create_ring");
+	for (auto durability : { cw::file::Durability::None, cw::file::Durability::GroupCommit, cw::file::Durability::PerFile }) {
+		asio::io_context io;
+		cw::file::DiskWriter writer(2);
+		writer.setDurability(durability);
+		auto work = asio::make_work_guard(io);
+
+		constexpr int FILES = 300;
+		std::vector<cw::file::SmallFile> small;
+		for (int i = 0; i < FILES; ++i) {
+			std::vector<uint8_t> bytes(static_cast<std::size_t>(i % 17 * 100), static_cast<uint8_t>(i));
+			small.push_back({ std::filesystem::path("cw_create_ring") / ("d" + std::to_string(i % 7)) / ("f" + std::to_string(i)), cw::buffer::SharedBuffer::fromVector(std::move(bytes)) });
+		}
+		std::uint64_t expected = 0;
+		for (const auto& file : small) expected += file.data.size();
+
+		std::optional<std::error_code> result;
+		uint64_t written = 0;
+		cw::file::writeSmallFiles(writer, std::move(small), io.get_executor(), [&](std::error_code ec, uint64_t bytes)
+			{
+				result = ec;
+				written = bytes;
+				work.reset();
+			});
+		io.run();
+		ASSERT_TRUE(result);
+		EXPECT_FALSE(*result) << result->message();
+		EXPECT_EQ(written, expected);
+		for (int i = 0; i < FILES; ++i) {
+			auto path = std::filesystem::path("cw_create_ring") / ("d" + std::to_string(i % 7)) / ("f" + std::to_string(i));
+			ASSERT_EQ(std::filesystem::file_size(path), static_cast<std::uintmax_t>(i % 17 * 100)) << path;
+		}
+		EXPECT_FALSE(std::filesystem::exists("cw_create_ring/d0/f0.cwrecv"));
+	}
+
+	// A name under a regular file: fails, as it did file by file
+	{
+		asio::io_context io;
+		cw::file::DiskWriter writer(1);
+		std::ofstream("cw_create_ring/plain") << "x";
+		std::vector<cw::file::SmallFile> small;
+		small.push_back({ "cw_create_ring/ok.txt", cw::buffer::SharedBuffer::fromVector({ 'o', 'k' }) });
+		small.push_back({ "cw_create_ring/plain/bad.txt", cw::buffer::SharedBuffer::fromVector({ 'n', 'o' }) });
+		std::optional<std::error_code> result;
+		auto work = asio::make_work_guard(io);
+		cw::file::writeSmallFiles(writer, std::move(small), io.get_executor(), [&](std::error_code ec, uint64_t) { result = ec; work.reset(); });
+		io.run();
+		ASSERT_TRUE(result);
+		EXPECT_TRUE(*result);
+		EXPECT_EQ(std::filesystem::file_size("cw_create_ring/ok.txt"), 2u);
+	}
+	std::filesystem::remove_all("cw_create_ring");
+}
+
+// ---------------------------------------------------------------------------
+// 118. NATIVE FRAMES (little-endian chunk headers between little-endian peers)
+// ---------------------------------------------------------------------------
+TEST(NativeFrameTest, ChunkHeaderIsLittleEndianAndRoundTrips) {
+	FileChunk chunk;
+	chunk.streamId = 0x01020304;
+	chunk.offset = 0x1122334455667788ull;
+	chunk.data = { 9, 8, 7 };
+	chunk.crc = 0xA1B2C3D4;
+
+	auto frame = buildFrame(chunk, FrameFormat::Native);
+	EXPECT_EQ(frame.size(), buildFrame(chunk, FrameFormat::Compact).size());
+	EXPECT_EQ(frame[0], NATIVE_FRAME_VERSION);
+
+	ParseResult result = tryParseFrame(frame.data(), frame.size());
+	ASSERT_EQ(result.status, ParseStatus::Complete);
+	EXPECT_EQ(result.frame.type, PacketType::FileChunk);
+	EXPECT_EQ(result.frame.order, WireOrder::LittleEndian);
+
+	const uint8_t* payload = result.frame.payload_view;
+	EXPECT_EQ(payload[0], 0x04); // streamId, low byte first
+	EXPECT_EQ(payload[4], 0x88); // offset, low byte first
+
+	auto view = FileChunkView::deserialize(payload, result.frame.size, result.frame.order);
+	EXPECT_EQ(view.streamId, chunk.streamId);
+	EXPECT_EQ(view.offset, chunk.offset);
+	EXPECT_EQ(std::vector<uint8_t>(view.data.begin(), view.data.end()), chunk.data);
+	EXPECT_EQ(view.crc, chunk.crc);
+
+	// Every send-side chunk writes the same header
+	SharedFileChunk shared{ .streamId = chunk.streamId, .offset = chunk.offset, .data = cw::buffer::SharedBuffer::fromVector(std::vector<uint8_t>(chunk.data)), .crc = chunk.crc };
+	auto outgoing = buildOutgoingFrame(shared, FrameFormat::Native);
+	EXPECT_TRUE(std::equal(outgoing.header.begin(), outgoing.header.end(), frame.begin()));
+
+	// Without a CRC, and the registry hands the order to the decoder
+	chunk.crc.reset();
+	frame = buildFrame(chunk, FrameFormat::Native);
+	RecordingHandler handler;
+	PacketList::dispatch(parseFrame(frame), handler);
+	ASSERT_EQ(handler.calls.size(), 1u);
+	EXPECT_EQ(handler.calls[0], "chunk 3");
+	EXPECT_FALSE(FileChunkView::deserialize(parseFrame(frame).payload_view, parseFrame(frame).size, WireOrder::LittleEndian).crc.has_value());
+}
+
+TEST(NativeFrameTest, OtherPacketsStayCompactAndNativeIsOnlyForChunks) {
+	Ack ack;
+	ack.streamId = 3;
+	ack.offset = 99;
+	EXPECT_EQ(buildFrame(ack, FrameFormat::Native), buildFrame(ack, FrameFormat::Compact));
+
+	// A native header on anything but a FileChunk is a corrupt stream
+	auto frame = buildFrame(ack, FrameFormat::Compact);
+	frame[0] = NATIVE_FRAME_VERSION;
+	EXPECT_EQ(tryParseFrame(frame.data(), frame.size()).status, ParseStatus::ProtocolError);
+
+	// Classic and compact chunk frames still read big-endian
+	FileChunk chunk;
+	chunk.streamId = 5;
+	chunk.offset = 1;
+	chunk.data = { 1 };
+	auto compact = buildFrame(chunk, FrameFormat::Compact);
+	EXPECT_EQ(parseFrame(compact).order, WireOrder::BigEndian);
+	EXPECT_EQ(parseFrame(compact).payload_view[3], 5);
+}
+
+// ---------------------------------------------------------------------------
+// 119. EXTENSION FIELDS (optional TLV fields after a packet's layout)
+// ---------------------------------------------------------------------------
+TEST(ExtensionsTest, FieldsRoundTripInTypeOrderAndUnknownOnesPassThrough) {
+	FileInfo info{ .streamId = 4, .fileSize = 100, .fileName = "a.bin" };
+	auto plain = buildFrame(info);
+
+	info.extensions.setInteger<uint64_t>(7, 0x0102030405060708ull);
+	info.extensions.set(2, std::vector<uint8_t>{ 'x', 'y' });
+	info.extensions.setInteger<uint32_t>(30, 5);
+	info.extensions.setInteger<uint32_t>(30, 6); // Replaces
+	EXPECT_EQ(info.extensions.view().present(), (1u << 2) | (1u << 7) | (1u << 30));
+
+	auto frame = buildFrame(info);
+	EXPECT_EQ(frame.size(), plain.size() + EXTENSION_BLOCK_HEADER_SIZE + 3 * EXTENSION_ENTRY_HEADER_SIZE + 2 + 8 + 4);
+	EXPECT_TRUE(std::equal(plain.begin() + FRAME_HEADER_SIZE, plain.end(), frame.begin() + FRAME_HEADER_SIZE)); // Same bytes ahead of the block
+
+	ParsedFrame parsed = parseFrame(frame);
+	auto view = FileInfoView::deserialize(parsed.payload_view, parsed.size);
+	EXPECT_EQ(view.fileName, "a.bin");
+	EXPECT_TRUE(view.extensions.has(7));
+	EXPECT_FALSE(view.extensions.has(3));
+	EXPECT_EQ(view.extensions.integer<uint64_t>(7), 0x0102030405060708ull);
+	EXPECT_EQ(view.extensions.integer<uint32_t>(30), 6u);
+	EXPECT_FALSE(view.extensions.integer<uint32_t>(7).has_value()); // Another width
+	auto text = view.extensions.find(2);
+	ASSERT_TRUE(text.has_value());
+	EXPECT_EQ(std::string(text->begin(), text->end()), "xy");
+
+	// A relay re-sending the view passes every field on, read or not
+	EXPECT_EQ(buildFrame(view), frame);
+	EXPECT_EQ(buildFrame(FileInfo::deserialize(parsed.payload_view, parsed.size)), frame);
+
+	// An older decoder stops after the name; erasing every field gives the plain packet back
+	info.extensions.erase(2);
+	info.extensions.erase(7);
+	info.extensions.erase(30);
+	EXPECT_TRUE(info.extensions.empty());
+	EXPECT_EQ(buildFrame(info), plain);
+	EXPECT_TRUE(FileInfoView::deserialize(parseFrame(plain).payload_view, parseFrame(plain).size).extensions.empty());
+}
+
+TEST(ExtensionsTest, CorruptBlocksAreRejected) {
+	Extensions extensions;
+	extensions.setInteger<uint16_t>(1, 9);
+	extensions.setInteger<uint16_t>(3, 9);
+	std::vector<uint8_t> block(extensions.encodedSize());
+	cw::binary::ByteWriter out(block.data());
+	extensions.write(out);
+	EXPECT_EQ(ExtensionsView::parse(block.data(), block.size()).integer<uint16_t>(3), 9u);
+
+	auto rejects = [](std::vector<uint8_t> bytes) { EXPECT_THROW(ExtensionsView::parse(bytes.data(), bytes.size()), std::runtime_error); };
+	rejects(std::vector<uint8_t>(block.begin(), block.end() - 1)); // Truncated
+	auto wrongBitmap = block;
+	wrongBitmap[3] ^= 1u << 2;
+	rejects(wrongBitmap);
+	auto outOfOrder = block;
+	std::swap(outOfOrder[EXTENSION_BLOCK_HEADER_SIZE], outOfOrder[EXTENSION_BLOCK_HEADER_SIZE + EXTENSION_ENTRY_HEADER_SIZE + 2]);
+	rejects(outOfOrder);
+	rejects({ 0, 0, 0 });
+
+	EXPECT_THROW(extensions.set(EXTENSION_TYPES, {}), std::out_of_range);
+}
+
+// ---------------------------------------------------------------------------
+// 120. STAGE PROFILE (sampled CPU time per pipeline stage)
+// ---------------------------------------------------------------------------
+TEST(StageProfileTest, SamplesCallsAndKeepsNestedStagesApart) {
+	using cw::metrics::Stage;
+	using cw::metrics::StageTimer;
+	auto& profile = cw::metrics::StageProfile::instance();
+	auto spin = [](std::chrono::microseconds length)
+		{
+			auto until = std::chrono::steady_clock::now() + length;
+			while (std::chrono::steady_clock::now() < until) {}
+		};
+
+	// Off: nothing counted
+	profile.stop();
+	{ StageTimer stage(Stage::Compress); }
+	profile.start(4);
+	EXPECT_EQ(profile.breakdown()[Stage::Compress].calls, 0u);
+
+	// One call in four timed, the total scaled up by the calls
+	for (int i = 0; i < 8; ++i) {
+		StageTimer stage(Stage::Compress);
+		spin(std::chrono::microseconds(200));
+	}
+
+	// A read doing nothing but hashing: the hash is timed whenever the read
+	// is, and its time is the hash's alone
+	for (int i = 0; i < 4; ++i) {
+		StageTimer read(Stage::Read);
+		StageTimer hash(Stage::Hash);
+		spin(std::chrono::microseconds(900));
+	}
+	profile.stop();
+
+	auto breakdown = profile.breakdown();
+	EXPECT_EQ(breakdown[Stage::Compress].calls, 8u);
+	EXPECT_EQ(breakdown[Stage::Compress].sampled, 2u);
+	EXPECT_GE(breakdown[Stage::Compress].seconds, 0.0015); // 8 x 200 us, less the clocks' error
+	EXPECT_EQ(breakdown[Stage::Read].sampled, 1u);
+	EXPECT_EQ(breakdown[Stage::Hash].calls, 4u);
+	EXPECT_GE(breakdown[Stage::Hash].sampled, 1u);
+	EXPECT_GE(breakdown[Stage::Hash].seconds, 0.003);
+	EXPECT_LT(breakdown[Stage::Read].seconds, breakdown[Stage::Hash].seconds / 4);
+	EXPECT_EQ(breakdown[Stage::Fsync].calls, 0u);
+
+	double shares = 0;
+	for (const auto& stage : breakdown.stages) shares += stage.share;
+	EXPECT_NEAR(shares, 1.0, 1e-9);
+
+	std::string report = breakdown.format();
+	EXPECT_EQ(report.find("CPU by stage"), 0u);
+	EXPECT_LT(report.find("hash"), report.find("read")); // Busiest first
+	EXPECT_EQ(report.find("fsync"), std::string::npos);  // Never ran
+}
+
+// ---------------------------------------------------------------------------
+// 121. SEALED CHUNKS (per-chunk AEAD for transports without TLS)
+// ---------------------------------------------------------------------------
+TEST(ChunkCipherTest, KeysAreReadFromHex) {
+	auto key = cw::integrity::parseChunkKey(std::string(62, '0') + "fF\n");
+	ASSERT_TRUE(key.has_value());
+	EXPECT_EQ((*key)[0], 0);
+	EXPECT_EQ((*key)[31], 0xFF);
+	EXPECT_FALSE(cw::integrity::parseChunkKey(std::string(62, '0')).has_value());
+	EXPECT_FALSE(cw::integrity::parseChunkKey(std::string(63, '0') + "g").has_value());
+}
+
+TEST(ChunkCipherTest, SealedChunkRoundTrips) {
+	SealedChunk chunk;
+	chunk.streamId = 6;
+	chunk.offset = 1ull << 33;
+	chunk.suite = static_cast<uint8_t>(cw::integrity::ChunkCipherSuite::ChaCha20Poly1305);
+	chunk.codec = static_cast<uint8_t>(cw::compression::Codec::None);
+	chunk.rawSize = 4;
+	chunk.salt.fill(0x5A);
+	chunk.data = cw::buffer::SharedBuffer::fromVector(std::vector<uint8_t>(4 + cw::integrity::CHUNK_TAG_SIZE, 7));
+
+	auto frame = buildFrame(chunk);
+	auto view = parseFrame(frame);
+	EXPECT_EQ(view.type, PacketType::SealedChunk);
+	auto decoded = SealedChunkView::deserialize(view.payload_view, view.size);
+	EXPECT_EQ(decoded.streamId, 6u);
+	EXPECT_EQ(decoded.offset, chunk.offset);
+	EXPECT_EQ(decoded.suite, chunk.suite);
+	EXPECT_EQ(decoded.rawSize, 4u);
+	EXPECT_EQ(decoded.salt, chunk.salt);
+	EXPECT_EQ(decoded.data.size(), 4 + cw::integrity::CHUNK_TAG_SIZE);
+
+	// Shorter than a tag cannot be a sealed chunk
+	chunk.data = cw::buffer::SharedBuffer::fromVector(std::vector<uint8_t>(3));
+	frame = buildFrame(chunk);
+	view = parseFrame(frame);
+	EXPECT_THROW(SealedChunkView::deserialize(view.payload_view, view.size), std::runtime_error);
+}
+
+#if defined(CW_HAS_CHUNK_CIPHER)
+TEST(ChunkCipherTest, BothSuitesSealAndCatchTampering) {
+	cw::integrity::ChunkKey key;
+	for (size_t i = 0; i < key.size(); ++i) key[i] = static_cast<uint8_t>(i * 3 + 1);
+	std::vector<uint8_t> plain(5000);
+	for (size_t i = 0; i < plain.size(); ++i) plain[i] = static_cast<uint8_t>(i / 7);
+
+	for (auto suite : { cw::integrity::ChunkCipherSuite::Aes256Gcm, cw::integrity::ChunkCipherSuite::ChaCha20Poly1305 }) {
+		auto salt = cw::integrity::ChunkCipher::newSalt();
+		auto cipher = cw::integrity::ChunkCipher::derive(key, salt, suite);
+		auto aad = cipher->associatedData(4096, 0, static_cast<uint32_t>(plain.size()));
+
+		std::vector<uint8_t> sealed(cw::integrity::ChunkCipher::sealedSize(plain.size()));
+		ASSERT_TRUE(cipher->seal(4096, aad, plain, sealed));
+		EXPECT_FALSE(std::equal(plain.begin(), plain.end(), sealed.begin()));
+
+		// The same key and salt open it, as the receiver derives them
+		std::vector<uint8_t> opened(plain.size());
+		ASSERT_TRUE(cw::integrity::ChunkCipher::derive(key, salt, suite)->open(4096, aad, sealed, opened));
+		EXPECT_EQ(opened, plain);
+
+		// A flipped bit, another offset (the nonce) or another header fails
+		auto flipped = sealed;
+		flipped[100] ^= 1;
+		EXPECT_FALSE(cipher->open(4096, aad, flipped, opened));
+		EXPECT_FALSE(cipher->open(8192, cipher->associatedData(8192, 0, static_cast<uint32_t>(plain.size())), sealed, opened));
+		EXPECT_FALSE(cipher->open(4096, cipher->associatedData(4096, 1, static_cast<uint32_t>(plain.size())), sealed, opened));
+
+		// Same bytes at another offset or in another file: other ciphertext
+		std::vector<uint8_t> elsewhere(sealed.size());
+		ASSERT_TRUE(cipher->seal(8192, aad, plain, elsewhere));
+		EXPECT_NE(elsewhere, sealed);
+		ASSERT_TRUE(cw::integrity::ChunkCipher::derive(key, cw::integrity::ChunkCipher::newSalt(), suite)->seal(4096, aad, plain, elsewhere));
+		EXPECT_NE(elsewhere, sealed);
+
+		// Compressed before sealing, decompressed after opening
+		if (cw::compression::supportedCodecs() & cw::compression::codecBit(cw::compression::Codec::Lz4)) {
+			auto compressed = cw::compression::compress(cw::compression::Codec::Lz4, plain, 0);
+			ASSERT_TRUE(compressed.has_value());
+			auto lz4 = static_cast<uint8_t>(cw::compression::Codec::Lz4);
+			std::vector<uint8_t> packed(cw::integrity::ChunkCipher::sealedSize(compressed->size()));
+			ASSERT_TRUE(cipher->seal(0, cipher->associatedData(0, lz4, static_cast<uint32_t>(plain.size())), *compressed, packed));
+			std::fill(opened.begin(), opened.end(), 0);
+			EXPECT_FALSE(cw::file::openSealedChunk(*cipher, 0, cw::compression::Codec::Lz4, packed, opened));
+			EXPECT_EQ(opened, plain);
+			packed.back() ^= 1;
+			EXPECT_EQ(cw::file::openSealedChunk(*cipher, 0, cw::compression::Codec::Lz4, packed, opened), std::errc::illegal_byte_sequence);
+		}
+	}
+}
+
+static asio::awaitable<void> uploadSealed(cw::network::PooledConnection conn, std::filesystem::path path,
+	std::shared_ptr<const cw::integrity::ChunkKey> key, std::shared_ptr<std::string> failure)
+{
+	cw::TransferOptions options;
+	options.chunkSize = 64 * 1024;
+	options.chunkKey = key;
+	options.workPool = std::make_shared<cw::WorkPool>(2);
+	try {
+		co_await cw::asyncSendFile(conn.get(), path, "cw_sealed_dst.bin", options);
+	}
+	catch (const std::system_error& e) {
+		*failure = e.what();
+	}
+}
+
+TEST(ChunkCipherTest, UploadArrivesSealedAndIntact) {
+	auto source = std::filesystem::temp_directory_path() / "cw_sealed_src.bin";
+	std::vector<uint8_t> bytes(512 * 1024 + 11);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 31 + i / 509);
+	writeBytes(source, bytes);
+
+	auto key = std::make_shared<const cw::integrity::ChunkKey>(*cw::integrity::parseChunkKey(std::string(64, 'a')));
+	LoopbackServer loopback;
+	loopback.server.setChunkKey(key);
+
+	auto failure = std::make_shared<std::string>();
+	loopback.spawn([&](cw::network::PooledConnection conn) { return uploadSealed(std::move(conn), source, key, failure); });
+	loopback.runUntil([&] { return loopback.filesReceived() == 1; });
+
+	ASSERT_EQ(loopback.filesReceived(), 1u) << *failure;
+	EXPECT_EQ(readBytes("cw_sealed_dst.bin"), bytes);
+	std::filesystem::remove("cw_sealed_dst.bin");
+	std::filesystem::remove(source);
+}
+
+TEST(ChunkCipherTest, ServerWithoutTheKeyIsNotSentClearData) {
+	auto source = std::filesystem::temp_directory_path() / "cw_sealed_src2.bin";
+	writeBytes(source, std::vector<uint8_t>(1000, 3));
+
+	auto key = std::make_shared<const cw::integrity::ChunkKey>(*cw::integrity::parseChunkKey(std::string(64, 'b')));
+	LoopbackServer loopback;
+
+	auto failure = std::make_shared<std::string>();
+	loopback.spawn([&](cw::network::PooledConnection conn) { return uploadSealed(std::move(conn), source, key, failure); });
+	loopback.runUntil([&] { return !failure->empty(); });
+
+	EXPECT_NE(failure->find("sealed"), std::string::npos);
+	EXPECT_FALSE(std::filesystem::exists("cw_sealed_dst.bin"));
+	std::filesystem::remove(source);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// 122. STREAM TABLE (flat per-stream state, bounded by the streams open)
+// ---------------------------------------------------------------------------
+TEST(StreamTableTest, MatchesAMapThroughChurn) {
+	cw::network::StreamTable<std::unique_ptr<uint64_t>> table;
+	std::map<uint32_t, uint64_t> expected;
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	for (int i = 0; i < 200000; ++i) {
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		auto key = static_cast<uint32_t>(state % 3000);
+		if (state & (1ull << 40)) {
+			auto [it, inserted] = table.try_emplace(key, std::make_unique<uint64_t>(state));
+			if (inserted) expected[key] = state;
+			EXPECT_EQ(*it->second, expected[key]);
+		}
+		else {
+			EXPECT_EQ(table.erase(key), expected.erase(key));
+		}
+	}
+	ASSERT_EQ(table.size(), expected.size());
+	size_t seen = 0;
+	for (const auto& [key, value] : table) {
+		EXPECT_EQ(*value, expected.at(key));
+		++seen;
+	}
+	EXPECT_EQ(seen, expected.size());
+	EXPECT_FALSE(table.contains(3000));
+	EXPECT_EQ(table.find(3000), table.end());
+}
+
+TEST(StreamTableTest, EntriesStayPutAndTheIndexShrinksAsStreamsClose) {
+	cw::network::StreamTable<std::string> table;
+	std::string& first = table.emplace(1, "first").first->second;
+
+	// A burst of consecutive ids, as a connection allocates them
+	for (uint32_t id = 2; id <= 10000; ++id) table[id] = std::to_string(id);
+	EXPECT_EQ(&table.find(1)->second, &first); // Not moved by the growth
+	EXPECT_GE(table.capacity(), 10000u * 4 / 3);
+
+	for (uint32_t id = 2; id <= 10000; ++id) table.erase(table.find(id));
+	EXPECT_EQ(table.size(), 1u);
+	EXPECT_EQ(first, "first");
+	EXPECT_EQ(table.capacity(), cw::network::StreamTable<std::string>::MIN_CAPACITY);
+
+	// A million files one after another, a few open at a time: the index stays small
+	for (uint32_t id = 100; id < 1000100; ++id) {
+		table.emplace(id, "x");
+		if (id >= 104) table.erase(id - 4);
+	}
+	EXPECT_EQ(table.size(), 5u);
+	EXPECT_EQ(table.capacity(), cw::network::StreamTable<std::string>::MIN_CAPACITY);
+	table.clear();
+	EXPECT_TRUE(table.empty());
+}
+
+// ---------------------------------------------------------------------------
+// 123. FLAT HASH (SwissTable-style open addressing for server-side state)
+// ---------------------------------------------------------------------------
+TEST(FlatHashTest, MatchesAMapThroughChurn) {
+	cw::FlatHashMap<std::string, std::unique_ptr<uint64_t>> table;
+	std::map<std::string, uint64_t> expected;
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	for (int i = 0; i < 200000; ++i) {
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		std::string key = "dir/" + std::to_string(state % 5000);
+		if (state & (1ull << 40)) {
+			auto [it, inserted] = table.try_emplace(key, std::make_unique<uint64_t>(state));
+			if (inserted) expected[key] = state;
+			EXPECT_EQ(*it->second, expected[key]);
+		}
+		else {
+			EXPECT_EQ(table.erase(key), expected.erase(key));
+		}
+	}
+	ASSERT_EQ(table.size(), expected.size());
+	size_t seen = 0;
+	for (const auto& [key, value] : table) {
+		EXPECT_EQ(*value, expected.at(key));
+		++seen;
+	}
+	EXPECT_EQ(seen, expected.size());
+	EXPECT_FALSE(table.contains(std::string("dir/5000")));
+	EXPECT_EQ(table.find(std::string("dir/5000")), table.end());
+}
+
+TEST(FlatHashTest, FullGroupsAreProbedPastAndTombstonesReclaimed) {
+	// Every key hashes alike: each lookup walks the groups, and erased slots
+	// in full groups must stay tombstones for the keys beyond them
+	struct SameHash
+	{
+		size_t operator()(uint32_t) const { return 42; }
+	};
+	cw::FlatHashSet<uint32_t, SameHash> colliding;
+	for (uint32_t i = 0; i < 100; ++i) EXPECT_TRUE(colliding.insert(i).second);
+	for (uint32_t i = 0; i < 100; i += 2) EXPECT_EQ(colliding.erase(i), 1u);
+	for (uint32_t i = 0; i < 100; ++i) EXPECT_EQ(colliding.contains(i), i % 2 == 1) << i;
+	EXPECT_FALSE(colliding.insert(99u).second);
+
+	// Keys coming and going forever (files opening and closing) reuse the
+	// slots of the ones gone rather than grow the table
+	cw::FlatHashMap<uint64_t, uint64_t> table;
+	for (uint64_t i = 0; i < 100000; ++i) {
+		table[i] = i;
+		if (i >= 50) {
+			EXPECT_EQ(table.erase(i - 50), 1u);
+		}
+	}
+	EXPECT_EQ(table.size(), 50u);
+	EXPECT_LE(table.capacity(), 128u);
+	for (uint64_t i = 100000 - 50; i < 100000; ++i) EXPECT_EQ(table.find(i)->second, i);
+
+	// Erasing while iterating leaves the others in place
+	for (auto it = table.begin(); it != table.end(); ++it) {
+		if (it->first % 2 == 0) table.erase(it);
+	}
+	EXPECT_EQ(table.size(), 25u);
+	table.clear();
+	EXPECT_TRUE(table.empty());
+	EXPECT_EQ(table.capacity(), 0u);
+}
+
+// ---------------------------------------------------------------------------
+// 124. INLINE FILES (a small file whole in its FileInfo)
+// ---------------------------------------------------------------------------
+TEST(InlineFilesTest, SmallFileGoesInOneFrameWithItsAttributes) {
+	namespace fs = std::filesystem;
+	auto source = fs::temp_directory_path() / "cw_inline.bin";
+	std::vector<uint8_t> bytes(5000);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 7);
+	std::ofstream(source, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	fs::last_write_time(source, fs::file_time_type::clock::now() - std::chrono::hours(24 * 30));
+	fs::permissions(source, fs::perms::owner_read | fs::perms::owner_write | fs::perms::others_read);
+	fs::remove_all("cw_inline");
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	// The same file as FileInfo, FileChunk and FileDone, then inline
+	std::vector<uint64_t> frames;
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(asio::ip::tcp::endpoint(acceptor.local_endpoint()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, [&, client, source]() -> asio::awaitable<void>
+				{
+					co_await client->asyncWaitCapabilities(asio::use_awaitable);
+					EXPECT_TRUE(client->peerTakesInlineFiles());
+					for (size_t inlineMax : { size_t(0), size_t(16 * 1024) }) {
+						cw::TransferOptions options;
+						options.inlineMaxFileSize = inlineMax;
+						auto before = server->metrics()->snapshot();
+						co_await cw::asyncSendFile(client, source, "cw_inline/copy" + std::to_string(inlineMax) + ".bin", options);
+						asio::steady_timer timer(io);
+						while (server->metrics()->snapshot().filesReceived == before.filesReceived) {
+							timer.expires_after(std::chrono::milliseconds(5));
+							co_await timer.async_wait(asio::use_awaitable);
+						}
+						frames.push_back(server->metrics()->snapshot().framesReceived - before.framesReceived);
+					}
+				}, asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (frames.size() < 2 && std::chrono::steady_clock::now() < deadline) {
+		io.run_for(std::chrono::milliseconds(10));
+	}
+
+	ASSERT_EQ(frames.size(), 2u);
+	EXPECT_GE(frames[0], 3u);
+	EXPECT_EQ(frames[1], 1u);
+	for (const char* name : { "cw_inline/copy16384.bin", "cw_inline/copy0.bin" }) {
+		std::ifstream in(name, std::ios::binary);
+		std::vector<uint8_t> received((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		EXPECT_EQ(received, bytes) << name;
+		EXPECT_EQ(cw::file::modifiedNs(fs::last_write_time(name)), cw::file::modifiedNs(fs::last_write_time(source))) << name;
+		EXPECT_EQ(fs::status(name).permissions() & fs::perms::all, fs::perms::owner_read | fs::perms::owner_write | fs::perms::others_read) << name;
+	}
+	fs::remove_all("cw_inline");
+	fs::remove(source);
+}
+
+TEST(InlineFilesTest, ReceiverWithAChunkKeyDropsInlineContent) {
+	namespace fs = std::filesystem;
+	fs::remove("cw_inline_keyed.bin");
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	auto server = cw::network::Connection::create(io);
+	server->setChunkKey(std::make_shared<const cw::integrity::ChunkKey>(*cw::integrity::parseChunkKey(std::string(64, 'c'))));
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	// A sender without the key: the receiver does not offer inline files,
+	// and one sent anyway is file data in the clear
+	bool offered = true;
+	bool sent = false;
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(asio::ip::tcp::endpoint(acceptor.local_endpoint()), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+			asio::co_spawn(io, [&, client]() -> asio::awaitable<void>
+				{
+					co_await client->asyncWaitCapabilities(asio::use_awaitable);
+					offered = client->peerTakesInlineFiles();
+
+					std::vector<uint8_t> content(100, 0x42);
+					cw::packet::FileInfo info;
+					info.streamId = client->allocateStreamId();
+					info.fileSize = content.size();
+					info.fileName = "cw_inline_keyed.bin";
+					info.extensions.set(cw::packet::FILE_INFO_CONTENT, content);
+					client->send(info);
+					sent = true;
+				}, asio::detached);
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while ((!sent || client->isOpen()) && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+	io.run_for(std::chrono::milliseconds(50));
+
+	EXPECT_FALSE(offered);
+	EXPECT_TRUE(sent);
+	EXPECT_FALSE(client->isOpen());
+	EXPECT_EQ(server->metrics()->snapshot().filesReceived, 0u);
+	EXPECT_FALSE(fs::exists("cw_inline_keyed.bin"));
+	fs::remove("cw_inline_keyed.bin");
+}
+
+// ---------------------------------------------------------------------------
+// 125. SERVER THREADS (one io_context run by several threads, a strand per connection)
+// ---------------------------------------------------------------------------
+TEST(ServerThreadsTest, ConcurrentUploadsCompleteOnSeveralThreads) {
+	const size_t files = 8;
+	std::vector<std::filesystem::path> sources;
+	std::vector<std::vector<uint8_t>> contents(files);
+	for (size_t f = 0; f < files; ++f) {
+		contents[f].resize(1024 * 1024 + f * 4099);
+		for (size_t i = 0; i < contents[f].size(); ++i) contents[f][i] = static_cast<uint8_t>(i * (f + 3) + i / 251);
+		sources.push_back(std::filesystem::temp_directory_path() / ("cw_threads_src" + std::to_string(f) + ".bin"));
+		writeBytes(sources.back(), contents[f]);
+	}
+
+	asio::io_context serverIo;
+	cw::network::Server server(serverIo, 0);
+	auto metrics = std::make_shared<cw::metrics::MetricsRegistry>();
+	server.setMetrics(metrics);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 4; ++i) threads.emplace_back([&serverIo] { serverIo.run(); });
+
+	// Each upload on its own pooled connection, all under way at once
+	asio::io_context io;
+	auto pool = cw::network::ClientPool::create(io);
+	size_t sent = 0;
+	for (size_t f = 0; f < files; ++f) {
+		asio::co_spawn(io, uploadFile(pool, server.port(), sources[f], "cw_threads_dst" + std::to_string(f) + ".bin", &sent), asio::detached);
+	}
+	auto allDone = [&] { return sent == files && metrics->snapshot().filesReceived == files; };
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (!allDone() && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+
+	serverIo.stop();
+	for (auto& thread : threads) thread.join();
+
+	EXPECT_TRUE(allDone());
+	EXPECT_EQ(pool->stats().connects, files);
+	for (size_t f = 0; f < files; ++f) {
+		auto name = "cw_threads_dst" + std::to_string(f) + ".bin";
+		EXPECT_EQ(readBytes(name), contents[f]) << name;
+		std::filesystem::remove(name);
+		std::filesystem::remove(sources[f]);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// 126. SHARDED SERVER (connections spread over per-core io_contexts)
+// ---------------------------------------------------------------------------
+TEST(ShardedServerTest, ConnectionsSpreadAndTransfersCompleteOnEveryShard) {
+	const size_t shards = 4, files = 16;
+	std::vector<std::filesystem::path> sources;
+	std::vector<std::vector<uint8_t>> contents(files);
+	for (size_t f = 0; f < files; ++f) {
+		contents[f].resize(64 * 1024 + f * 17);
+		for (size_t i = 0; i < contents[f].size(); ++i) contents[f][i] = static_cast<uint8_t>(i * 7 + f);
+		sources.push_back(std::filesystem::temp_directory_path() / ("cw_shards_src" + std::to_string(f) + ".bin"));
+		writeBytes(sources.back(), contents[f]);
+	}
+
+	// The shard each connection landed on, told by the context its socket runs on
+	cw::network::ShardedServer server(0, shards);
+	ASSERT_NE(server.port(), 0);
+	std::mutex mutex;
+	std::vector<std::vector<std::shared_ptr<cw::metrics::ConnectionMetrics>>> byShard(shards);
+	server.setConnectionSetup([&](cw::network::Connection& conn)
+		{
+			auto& context = asio::query(conn.socket().get_executor(), asio::execution::context);
+			for (size_t i = 0; i < shards; ++i) {
+				if (&context != &static_cast<asio::execution_context&>(server.context(i))) continue;
+				std::lock_guard lock(mutex);
+				byShard[i].push_back(conn.metrics());
+			}
+		});
+	std::thread thread([&server] { server.run(); });
+
+	asio::io_context io;
+	cw::network::ClientPoolOptions options;
+	options.maxPerEndpoint = files;
+	auto pool = cw::network::ClientPool::create(io, options);
+	size_t sent = 0;
+	for (size_t f = 0; f < files; ++f) {
+		asio::co_spawn(io, uploadFile(pool, server.port(), sources[f], "cw_shards_dst" + std::to_string(f) + ".bin", &sent), asio::detached);
+	}
+	auto filesReceived = [&](size_t shard)
+		{
+			std::lock_guard lock(mutex);
+			uint64_t count = 0;
+			for (const auto& metrics : byShard[shard]) count += metrics->snapshot().filesReceived;
+			return count;
+		};
+	auto total = [&] { uint64_t count = 0; for (size_t i = 0; i < shards; ++i) count += filesReceived(i); return count; };
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (total() < files && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+
+	server.stop();
+	thread.join();
+
+	// Every connection was accounted to a shard, more than one shard took
+	// some, and files arrived through shards other than the accepting one
+	size_t connections = 0, shardsUsed = 0;
+	for (const auto& list : byShard) {
+		connections += list.size();
+		shardsUsed += !list.empty();
+	}
+	EXPECT_EQ(connections, files);
+	EXPECT_GT(shardsUsed, 1u);
+	EXPECT_EQ(total(), files);
+	EXPECT_GT(total() - filesReceived(0), 0u);
+
+	for (size_t f = 0; f < files; ++f) {
+		auto name = "cw_shards_dst" + std::to_string(f) + ".bin";
+		EXPECT_EQ(readBytes(name), contents[f]) << name;
+		std::filesystem::remove(name);
+		std::filesystem::remove(sources[f]);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// 127. DIRECTORY UPLOAD WORKERS (files in flight capped by DirectoryUploadOptions::workers)
+// ---------------------------------------------------------------------------
+
+// Keeps uploads in memory, counting the files open on the receiver: FileInfo
+// seen, FileDone not yet
+class CountingReceiver : public cw::network::MemoryReceiver
+{
+public:
+	using MemoryReceiver::MemoryReceiver;
+	using MemoryReceiver::onPacket;
+
+	void onPacket(cw::network::Connection& conn, cw::packet::FileInfoView pkt)
+	{
+		maxOpen = std::max(maxOpen, ++open);
+		MemoryReceiver::onPacket(conn, pkt);
+	}
+
+	void onPacket(cw::network::Connection& conn, cw::packet::FileDone pkt)
+	{
+		--open;
+		MemoryReceiver::onPacket(conn, pkt);
+	}
+
+	size_t open = 0;
+	size_t maxOpen = 0;
+};
+
+TEST(DirectoryUploadTest, WorkersCapTheFilesInFlight) {
+	auto root = std::filesystem::temp_directory_path() / "cw_workers_src";
+	std::filesystem::remove_all(root);
+	std::filesystem::create_directories(root);
+	const size_t files = 20;
+	std::map<std::string, std::vector<uint8_t>> contents;
+	for (size_t f = 0; f < files; ++f) {
+		auto name = "f" + std::to_string(f) + ".bin";
+		auto& bytes = contents[name];
+		bytes.resize(256 * 1024 + f * 101);
+		for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 13 + f);
+		writeBytes(root / name, bytes);
+	}
+
+	asio::io_context io;
+	asio::ip::tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), 0 });
+	std::map<std::string, std::vector<uint8_t>> received;
+	auto receiver = std::make_shared<CountingReceiver>([&](cw::network::MemoryReceiver::File file) { received[file.name] = std::move(file.data); });
+	auto server = cw::network::Connection::create(io);
+	server->setHandler(receiver);
+	acceptor.async_accept(server->socket(), [server](std::error_code ec) { if (!ec) server->start(); });
+
+	// One connection, so the receiver sees files open and close in the order the workers send them
+	bool done = false;
+	auto client = cw::network::Connection::create(io);
+	client->socket().async_connect(acceptor.local_endpoint(), [&](std::error_code ec)
+		{
+			ASSERT_FALSE(ec);
+			client->start();
+
+			cw::TransferOptions options;
+			options.chunkSize = 16 * 1024;
+			options.batchMaxFileSize = 0; // Every file on its own stream
+			options.ackWindowBytes = 2 * 1024 * 1024;
+			cw::DirectoryUploadOptions uploadOptions;
+			uploadOptions.workers = 3;
+			asio::co_spawn(io, cw::asyncUploadDirectory({ client }, root, options, uploadOptions), [&](std::exception_ptr e)
+				{
+					EXPECT_FALSE(e);
+					done = true;
+				});
+		});
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while ((!done || received.size() < files) && std::chrono::steady_clock::now() < deadline) io.run_for(std::chrono::milliseconds(5));
+
+	EXPECT_TRUE(done);
+	EXPECT_EQ(received, contents);
+	EXPECT_EQ(receiver->open, 0u);
+	EXPECT_LE(receiver->maxOpen, 3u);
+	EXPECT_GT(receiver->maxOpen, 1u);
+	std::filesystem::remove_all(root);
+}
+
+// ---------------------------------------------------------------------------
+// 128. COROUTINE UPLOADS (asyncSendFile's completion, and the files it cannot send)
+// ---------------------------------------------------------------------------
+TEST(AsyncSendFileTest, CompletesOnceSentAndReportsWhatItCannotRead) {
+	auto source = std::filesystem::temp_directory_path() / "cw_async_send_src.bin";
+	std::vector<uint8_t> bytes(300 * 1024 + 9);
+	for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<uint8_t>(i * 11 + i / 97);
+	writeBytes(source, bytes);
+	auto missing = std::filesystem::temp_directory_path() / "cw_async_send_missing.bin";
+	std::filesystem::remove(missing);
+	auto directory = std::filesystem::temp_directory_path() / "cw_async_send_dir";
+	std::filesystem::create_directories(directory);
+
+	LoopbackServer loopback;
+	cw::network::PooledConnection lease;
+	loopback.spawn([&](cw::network::PooledConnection conn) -> asio::awaitable<void>
+		{
+			lease = std::move(conn);
+			co_return;
+		});
+	ASSERT_TRUE(loopback.runUntil([&] { return bool(lease); }));
+
+	// Runs one asyncSendFile to its completion handler, and returns what it completed with
+	auto send = [&](const std::filesystem::path& path, const std::string& name)
+		{
+			std::optional<std::exception_ptr> result;
+			asio::co_spawn(loopback.io, cw::asyncSendFile(lease.get(), path, name), [&](std::exception_ptr e) { result = e; });
+			loopback.runUntil([&] { return result.has_value(); });
+			return result;
+		};
+
+	auto sent = send(source, "cw_async_send_dst.bin");
+	ASSERT_TRUE(sent);
+	EXPECT_FALSE(*sent);
+	ASSERT_TRUE(loopback.runUntil([&] { return loopback.filesReceived() == 1; }));
+	EXPECT_EQ(readBytes("cw_async_send_dst.bin"), bytes);
+
+	// A missing file is logged and skipped: the upload completes having sent nothing
+	auto skipped = send(missing, "cw_async_send_missing.bin");
+	ASSERT_TRUE(skipped);
+	EXPECT_FALSE(*skipped);
+
+	// One that cannot be read completes with the error, before any of it is sent
+	auto failed = send(directory, "cw_async_send_dir.bin");
+	ASSERT_TRUE(failed);
+	ASSERT_TRUE(*failed);
+	EXPECT_THROW(std::rethrow_exception(*failed), std::filesystem::filesystem_error);
+
+	// Neither opened a stream on the receiver, and the connection still takes files
+	auto again = send(source, "cw_async_send_again.bin");
+	ASSERT_TRUE(again);
+	EXPECT_FALSE(*again);
+	EXPECT_TRUE(loopback.runUntil([&] { return loopback.filesReceived() == 2; }));
+	EXPECT_TRUE(lease->isOpen());
+	EXPECT_FALSE(std::filesystem::exists("cw_async_send_missing.bin"));
+	EXPECT_FALSE(std::filesystem::exists("cw_async_send_dir.bin"));
+
+	std::filesystem::remove("cw_async_send_dst.bin");
+	std::filesystem::remove("cw_async_send_again.bin");
+	std::filesystem::remove(source);
+	std::filesystem::remove(directory);
+}